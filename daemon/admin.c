@@ -221,11 +221,11 @@ adminDispatchServerSetThreadpoolParameters(virNetServerPtr server ATTRIBUTE_UNUS
         goto cleanup;
     }
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  ADMIN_SERVER_THREADPOOL_PARAMETERS_MAX,
-                                  &params,
-                                  &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        ADMIN_SERVER_THREADPOOL_PARAMETERS_MAX,
+                                        &params,
+                                        &nparams) < 0)
         goto cleanup;
 
 
@@ -238,7 +238,7 @@ adminDispatchServerSetThreadpoolParameters(virNetServerPtr server ATTRIBUTE_UNUS
     if (rv < 0)
         virNetMessageSaveError(rerr);
 
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     virObjectUnref(srv);
     return rv;
 }
@@ -367,7 +367,7 @@ adminDispatchServerSetClientLimits(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
         args->params.params_len,
         ADMIN_SERVER_CLIENT_LIMITS_MAX, &params, &nparams) < 0)
         goto cleanup;
@@ -379,7 +379,7 @@ adminDispatchServerSetClientLimits(virNetServerPtr server ATTRIBUTE_UNUSED,
  cleanup:
     if (rv < 0)
         virNetMessageSaveError(rerr);
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     virObjectUnref(srv);
     return rv;
 }
@@ -415,6 +415,170 @@ adminConnectGetLoggingFilters(char **filters, unsigned int flags)
     return ret;
 }
 
+/* Leaves out the oldest messages if they don't fit in a reply */
+static int
+adminConnectGetLoggingRecorder(char **messages, unsigned int flags)
+{
+    char *tmp = NULL;
+    size_t len;
+
+    virCheckFlags(0, -1);
+
+    if (!(tmp = virLogRecorderDump()))
+        return -1;
+
+    if ((len = strlen(tmp)) >= ADMIN_STRING_MAX) {
+        char *start = strchr(tmp + len - ADMIN_STRING_MAX + 1, '\n');
+
+        start = start ? start + 1 : tmp + len;
+        memmove(tmp, start, tmp + len - start + 1);
+    }
+
+    *messages = tmp;
+    return 0;
+}
+
+#define ADD_PARAM(type, suffix, value) \
+    do { \
+        snprintf(field, sizeof(field), \
+                 VIR_CONNECT_ALLOC_STATS_PREFIX "%zu." suffix, count); \
+        if (virTypedParamsAdd ## type(&tmpparams, nparams, &maxparams, \
+                                      field, value) < 0) \
+            goto cleanup; \
+    } while (0)
+
+static int
+adminConnectGetAllocStats(virTypedParameterPtr *params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t count = 0;
+    int domcode;
+
+    virCheckFlags(0, -1);
+
+    *nparams = 0;
+
+    if (!virAllocStatsIsEnabled()) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("allocation statistics are not collected"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_CONNECT_ALLOC_STATS_COUNT, 0) < 0)
+        goto cleanup;
+
+    for (domcode = 0; domcode < VIR_ERR_DOMAIN_LAST; domcode++) {
+        unsigned long long allocs;
+        unsigned long long bytes;
+        const char *name = virErrorDomainName(domcode);
+
+        if (virAllocStatsGet(domcode, &allocs, &bytes) < 0 || !allocs)
+            continue;
+
+        if (!name || !*name)
+            name = "Other";
+
+        ADD_PARAM(UInt, "domain", domcode);
+        ADD_PARAM(String, "name", name);
+        ADD_PARAM(ULLong, "allocs", allocs);
+        ADD_PARAM(ULLong, "bytes", bytes);
+        count++;
+    }
+
+    tmpparams[0].value.ui = count;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+#undef ADD_PARAM
+
+#define ADD_PARAM(type, prefix, suffix, value) \
+    do { \
+        snprintf(field, sizeof(field), prefix "%zu." suffix, i); \
+        if (virTypedParamsAdd ## type(&tmpparams, nparams, &maxparams, \
+                                      field, value) < 0) \
+            goto cleanup; \
+    } while (0)
+
+static int
+adminConnectGetLockStats(virTypedParameterPtr *params,
+                         int *nparams,
+                         unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virClassLockStatsPtr stats = NULL;
+    size_t nstats = 0;
+    virThreadLockStatsPtr callsites = NULL;
+    size_t ncallsites = 0;
+    size_t i;
+
+    virCheckFlags(0, -1);
+
+    *nparams = 0;
+
+    if (virClassGetLockStats(&stats, &nstats) < 0 ||
+        virThreadLockStatsGet(&callsites, &ncallsites) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_CONNECT_LOCK_STATS_COUNT, nstats) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_CONNECT_LOCK_STATS_CALLSITE_COUNT,
+                              ncallsites) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        ADD_PARAM(String, VIR_CONNECT_LOCK_STATS_PREFIX,
+                  "class", stats[i].name);
+        ADD_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_PREFIX,
+                  "contended", stats[i].contended);
+        ADD_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_PREFIX,
+                  "wait", stats[i].waited);
+    }
+
+    for (i = 0; i < ncallsites; i++) {
+        virThreadLockStatsPtr cs = &callsites[i];
+
+        ADD_PARAM(String, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "file", cs->filename ? cs->filename : "");
+        ADD_PARAM(String, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "function", cs->funcname ? cs->funcname : "");
+        ADD_PARAM(UInt, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "line", cs->linenr);
+        ADD_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "contended", cs->contended);
+        ADD_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "wait", cs->waited);
+    }
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    VIR_FREE(stats);
+    VIR_FREE(callsites);
+    return ret;
+}
+
+#undef ADD_PARAM
+
 static int
 adminConnectSetLoggingOutputs(virNetDaemonPtr dmn ATTRIBUTE_UNUSED,
                               const char *outputs,
@@ -487,4 +651,142 @@ adminDispatchConnectGetLoggingFilters(virNetServerPtr server ATTRIBUTE_UNUSED,
 
     return 0;
 }
+
+static int
+adminDispatchConnectGetLoggingRecorder(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       admin_connect_get_logging_recorder_args *args,
+                                       admin_connect_get_logging_recorder_ret *ret)
+{
+    char *messages = NULL;
+
+    if (adminConnectGetLoggingRecorder(&messages, args->flags) < 0) {
+        virNetMessageSaveError(rerr);
+        return -1;
+    }
+
+    VIR_STEAL_PTR(ret->messages, messages);
+
+    return 0;
+}
+
+static int
+adminDispatchServerGetProcedureStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                     virNetServerClientPtr client,
+                                     virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                     virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+                                     admin_server_get_procedure_stats_args *args,
+                                     admin_server_get_procedure_stats_ret *ret)
+{
+    int rv = -1;
+    virNetServerPtr srv = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    struct daemonAdmClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!(srv = virNetDaemonGetServer(priv->dmn, args->srv.name)))
+        goto cleanup;
+
+    if (adminServerGetProcedureStats(srv, &params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_SERVER_PROCEDURE_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of procedure statistics parameters %d "
+                         "exceeds max allowed limit: %d"), nparams,
+                       ADMIN_SERVER_PROCEDURE_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virTypedParamsFree(params, nparams);
+    virObjectUnref(srv);
+    return rv;
+}
+
+static int
+adminDispatchConnectGetAllocStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                  virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                  virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                  virNetMessageErrorPtr rerr,
+                                  admin_connect_get_alloc_stats_args *args,
+                                  admin_connect_get_alloc_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetAllocStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_CONNECT_ALLOC_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of allocation statistics parameters %d "
+                         "exceeds max allowed limit: %d"), nparams,
+                       ADMIN_CONNECT_ALLOC_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
+static int
+adminDispatchConnectGetLockStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                 virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                 virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                 virNetMessageErrorPtr rerr,
+                                 admin_connect_get_lock_stats_args *args,
+                                 admin_connect_get_lock_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetLockStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_CONNECT_LOCK_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of lock statistics parameters %d "
+                         "exceeds max allowed limit: %d"), nparams,
+                       ADMIN_CONNECT_LOCK_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
 #include "admin_dispatch.h"
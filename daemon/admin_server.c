@@ -86,6 +86,12 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
     size_t freeWorkers;
     size_t nPrioWorkers;
     size_t jobQueueDepth;
+    unsigned long long msgPoolHits;
+    unsigned long long msgPoolMisses;
+    unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                              [VIR_THREAD_POOL_LATENCY_LAST];
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i, j;
     virTypedParameterPtr tmpparams = NULL;
 
     virCheckFlags(0, -1);
@@ -99,6 +105,9 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
         goto cleanup;
     }
 
+    virNetServerGetMessagePoolStats(srv, &msgPoolHits, &msgPoolMisses);
+    virNetServerGetJobLatency(srv, latency);
+
     if (virTypedParamsAddUInt(&tmpparams, nparams,
                               &maxparams, VIR_THREADPOOL_WORKERS_MIN,
                               minWorkers) < 0)
@@ -129,6 +138,29 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
                               jobQueueDepth) < 0)
         goto cleanup;
 
+    if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                &maxparams, VIR_THREADPOOL_MESSAGE_POOL_HITS,
+                                msgPoolHits) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams,
+                                &maxparams, VIR_THREADPOOL_MESSAGE_POOL_MISSES,
+                                msgPoolMisses) < 0)
+        goto cleanup;
+
+    for (i = 0; i < VIR_THREAD_POOL_PRIORITY_LAST; i++) {
+        for (j = 0; j < VIR_THREAD_POOL_LATENCY_LAST; j++) {
+            snprintf(field, sizeof(field), "%s%s.%s",
+                     VIR_THREADPOOL_JOB_LATENCY_PREFIX,
+                     virThreadPoolPriorityTypeToString(i),
+                     virThreadPoolLatencyBucketTypeToString(j));
+
+            if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                        field, latency[i][j]) < 0)
+                goto cleanup;
+        }
+    }
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -225,6 +257,8 @@ adminClientGetInfo(virNetServerClientPtr client,
     const char *attr = NULL;
     virTypedParameterPtr tmpparams = NULL;
     virIdentityPtr identity = NULL;
+    size_t nevents;
+    unsigned long long dropped;
 
     virCheckFlags(0, -1);
 
@@ -294,6 +328,13 @@ adminClientGetInfo(virNetServerClientPtr client,
                                 VIR_CLIENT_INFO_SELINUX_CONTEXT, attr) < 0))
         goto cleanup;
 
+    virNetServerClientGetEventStats(client, &nevents, &dropped);
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_EVENTS_QUEUED, nevents) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_EVENTS_DROPPED, dropped) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -388,3 +429,118 @@ adminServerSetClientLimits(virNetServerPtr srv,
 
     return 0;
 }
+
+#define ADD_PARAM(type, suffix, value) \
+    do { \
+        snprintf(field, sizeof(field), \
+                 VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu." suffix, *count); \
+        if (virTypedParamsAdd ## type(params, nparams, maxparams, \
+                                      field, value) < 0) \
+            goto cleanup; \
+    } while (0)
+
+static int
+adminServerAddProcedureStats(virNetServerProgramPtr prog,
+                             virTypedParameterPtr *params,
+                             int *nparams,
+                             int *maxparams,
+                             size_t *count)
+{
+    int ret = -1;
+    virNetServerProgramProcStatsPtr stats = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    int nstats;
+    size_t i, j;
+
+    if ((nstats = virNetServerProgramGetProcStats(prog, &stats)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        const char *name;
+
+        if (!stats[i].calls)
+            continue;
+
+        if (!(name = virNetServerProgramGetProcName(prog, i)))
+            continue;
+
+        ADD_PARAM(UInt, "program", virNetServerProgramGetID(prog));
+        ADD_PARAM(UInt, "procedure", i);
+        ADD_PARAM(String, "name", name);
+        ADD_PARAM(ULLong, "calls", stats[i].calls);
+        ADD_PARAM(ULLong, "errors", stats[i].errors);
+        ADD_PARAM(ULLong, "bytesIn", stats[i].bytesIn);
+        ADD_PARAM(ULLong, "bytesOut", stats[i].bytesOut);
+
+        for (j = 0; j < VIR_NET_SERVER_PROGRAM_TIME_LAST; j++) {
+            const char *bucket = virNetServerProgramTimeBucketTypeToString(j);
+
+            snprintf(field, sizeof(field),
+                     VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu.queueTime.%s",
+                     *count, bucket);
+            if (virTypedParamsAddULLong(params, nparams, maxparams,
+                                        field, stats[i].queueTime[j]) < 0)
+                goto cleanup;
+
+            snprintf(field, sizeof(field),
+                     VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu.execTime.%s",
+                     *count, bucket);
+            if (virTypedParamsAddULLong(params, nparams, maxparams,
+                                        field, stats[i].execTime[j]) < 0)
+                goto cleanup;
+        }
+
+        (*count)++;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(stats);
+    return ret;
+}
+
+#undef ADD_PARAM
+
+int
+adminServerGetProcedureStats(virNetServerPtr srv,
+                             virTypedParameterPtr *params,
+                             int *nparams,
+                             unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virNetServerProgramPtr *progs = NULL;
+    int nprogs = 0;
+    size_t count = 0;
+    size_t i;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(0, -1);
+
+    *nparams = 0;
+
+    if ((nprogs = virNetServerGetPrograms(srv, &progs)) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_PROCEDURE_STATS_COUNT, 0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nprogs; i++) {
+        if (adminServerAddProcedureStats(progs[i], &tmpparams, nparams,
+                                         &maxparams, &count) < 0)
+            goto cleanup;
+    }
+
+    tmpparams[0].value.ui = count;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    virObjectListFreeCount(progs, nprogs);
+    return ret;
+}
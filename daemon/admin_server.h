@@ -72,4 +72,9 @@ int adminServerSetClientLimits(virNetServerPtr srv,
                                int nparams,
                                unsigned int flags);
 
+int adminServerGetProcedureStats(virNetServerPtr srv,
+                                 virTypedParameterPtr *params,
+                                 int *nparams,
+                                 unsigned int flags);
+
 #endif /* __LIBVIRTD_ADMIN_SERVER_H__ */
@@ -153,10 +153,17 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->prio_workers = 5;
 
+    data->event_loop_threads = 0;
+
     data->max_client_requests = 5;
+    data->max_client_events = 10000;
+    data->client_events_policy = VIR_NET_SERVER_CLIENT_EVENTS_DROP_NEWEST;
+
+    data->log_recorder_size = 256;
 
     data->audit_level = 1;
     data->audit_logging = 0;
+    data->audit_queue_size = 1024;
 
     data->keepalive_interval = 5;
     data->keepalive_count = 5;
@@ -167,6 +174,9 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->admin_max_queued_clients = 20;
     data->admin_max_client_requests = 5;
 
+    data->alloc_stats = true;
+    data->lock_stats = false;
+
     data->admin_keepalive_interval = 5;
     data->admin_keepalive_count = 5;
 
@@ -215,6 +225,12 @@ daemonConfigFree(struct daemonConfig *data)
         tmp++;
     }
     VIR_FREE(data->access_drivers);
+    tmp = data->procedure_priorities;
+    while (tmp && *tmp) {
+        VIR_FREE(*tmp);
+        tmp++;
+    }
+    VIR_FREE(data->procedure_priorities);
 
     VIR_FREE(data->unix_sock_admin_perms);
     VIR_FREE(data->unix_sock_ro_perms);
@@ -256,6 +272,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
                         const char *filename,
                         virConfPtr conf)
 {
+    char *policy = NULL;
+
     if (virConfGetValueBool(conf, "listen_tcp", &data->listen_tcp) < 0)
         goto error;
     if (virConfGetValueBool(conf, "listen_tls", &data->listen_tls) < 0)
@@ -346,10 +364,29 @@ daemonConfigLoadOptions(struct daemonConfig *data,
 
     if (virConfGetValueUInt(conf, "prio_workers", &data->prio_workers) < 0)
         goto error;
+    if (virConfGetValueStringList(conf, "procedure_priorities", false,
+                                  &data->procedure_priorities) < 0)
+        goto error;
+
+    if (virConfGetValueUInt(conf, "event_loop_threads", &data->event_loop_threads) < 0)
+        goto error;
 
     if (virConfGetValueUInt(conf, "max_client_requests", &data->max_client_requests) < 0)
         goto error;
 
+    if (virConfGetValueUInt(conf, "max_client_events", &data->max_client_events) < 0)
+        goto error;
+    if (virConfGetValueString(conf, "client_events_policy", &policy) < 0)
+        goto error;
+    if (policy &&
+        (data->client_events_policy =
+         virNetServerClientEventsPolicyTypeFromString(policy)) < 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("%s: unknown client_events_policy '%s'"),
+                       filename, policy);
+        goto error;
+    }
+
     if (virConfGetValueUInt(conf, "admin_min_workers", &data->admin_min_workers) < 0)
         goto error;
     if (virConfGetValueUInt(conf, "admin_max_workers", &data->admin_max_workers) < 0)
@@ -365,6 +402,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueBool(conf, "audit_logging", &data->audit_logging) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "audit_queue_size", &data->audit_queue_size) < 0)
+        goto error;
 
     if (virConfGetValueString(conf, "host_uuid", &data->host_uuid) < 0)
         goto error;
@@ -377,6 +416,12 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueString(conf, "log_outputs", &data->log_outputs) < 0)
         goto error;
+    if (virConfGetValueBool(conf, "log_async", &data->log_async) < 0)
+        goto error;
+    if (virConfGetValueBool(conf, "log_flush_on_abort", &data->log_flush_on_abort) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "log_recorder_size", &data->log_recorder_size) < 0)
+        goto error;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &data->keepalive_interval) < 0)
         goto error;
@@ -391,9 +436,17 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     if (virConfGetValueUInt(conf, "ovs_timeout", &data->ovs_timeout) < 0)
         goto error;
 
+    if (virConfGetValueBool(conf, "alloc_stats", &data->alloc_stats) < 0)
+        goto error;
+
+    if (virConfGetValueBool(conf, "lock_stats", &data->lock_stats) < 0)
+        goto error;
+
+    VIR_FREE(policy);
     return 0;
 
  error:
+    VIR_FREE(policy);
     return -1;
 }
 
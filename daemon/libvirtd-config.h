@@ -70,15 +70,24 @@ struct daemonConfig {
     unsigned int max_anonymous_clients;
 
     unsigned int prio_workers;
+    char **procedure_priorities;
+
+    unsigned int event_loop_threads;
 
     unsigned int max_client_requests;
+    unsigned int max_client_events;
+    int client_events_policy; /* virNetServerClientEventsPolicy */
 
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
+    bool log_async;
+    bool log_flush_on_abort;
+    unsigned int log_recorder_size;
 
     unsigned int audit_level;
     bool audit_logging;
+    unsigned int audit_queue_size;
 
     int keepalive_interval;
     unsigned int keepalive_count;
@@ -93,6 +102,9 @@ struct daemonConfig {
     unsigned int admin_keepalive_count;
 
     unsigned int ovs_timeout;
+
+    bool alloc_stats;
+    bool lock_stats;
 };
 
 
@@ -31,6 +31,10 @@
 #include <stdlib.h>
 #include <grp.h>
 
+#ifdef __linux__
+# include <linux/rtnetlink.h>
+#endif
+
 #include "libvirt_internal.h"
 #include "virerror.h"
 #include "virfile.h"
@@ -50,6 +54,7 @@
 #include "virconf.h"
 #include "virnetlink.h"
 #include "virnetdaemon.h"
+#include "vireventpoll.h"
 #include "remote.h"
 #include "virhook.h"
 #include "viraudit.h"
@@ -646,6 +651,9 @@ daemonSetupLogging(struct daemonConfig *config,
     if (virLogGetNbOutputs() == 0)
         virLogSetOutputs(virLogGetDefaultOutput());
 
+    if (virLogSetRecorderSize(config->log_recorder_size) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -725,6 +733,14 @@ static void daemonReloadHandler(virNetDaemonPtr dmn ATTRIBUTE_UNUSED,
         VIR_WARN("Error while reloading drivers");
 }
 
+static void daemonLogDumpHandler(virNetDaemonPtr dmn ATTRIBUTE_UNUSED,
+                                 siginfo_t *sig ATTRIBUTE_UNUSED,
+                                 void *opaque ATTRIBUTE_UNUSED)
+{
+    VIR_INFO("Dumping the log recorder on SIGUSR2");
+    virLogRecorderDumpToOutputs();
+}
+
 static int daemonSetupSignals(virNetDaemonPtr dmn)
 {
     if (virNetDaemonAddSignalHandler(dmn, SIGINT, daemonShutdownHandler, NULL) < 0)
@@ -735,6 +751,8 @@ static int daemonSetupSignals(virNetDaemonPtr dmn)
         return -1;
     if (virNetDaemonAddSignalHandler(dmn, SIGHUP, daemonReloadHandler, NULL) < 0)
         return -1;
+    if (virNetDaemonAddSignalHandler(dmn, SIGUSR2, daemonLogDumpHandler, NULL) < 0)
+        return -1;
     return 0;
 }
 
@@ -881,6 +899,70 @@ static int daemonStateInit(virNetDaemonPtr dmn)
     return 0;
 }
 
+/*
+ * Override the scheduling priority the protocol files assign to
+ * procedures, using "Name:priority" entries from the config.
+ */
+static int
+daemonSetupProcedurePriorities(char **entries)
+{
+    struct {
+        virNetServerProgramProcPtr procs;
+        size_t nprocs;
+    } programs[] = {
+        { remoteProcs, remoteNProcs },
+        { lxcProcs, lxcNProcs },
+        { qemuProcs, qemuNProcs },
+    };
+    char **tmp;
+    char *name = NULL;
+    int ret = -1;
+
+    for (tmp = entries; tmp && *tmp; tmp++) {
+        const char *sep = strchr(*tmp, ':');
+        bool found = false;
+        int priority;
+        size_t i;
+        size_t j;
+
+        if (!sep ||
+            (priority = virThreadPoolPriorityTypeFromString(sep + 1)) < 0) {
+            virReportError(VIR_ERR_CONF_SYNTAX,
+                           _("invalid procedure priority '%s', expected "
+                             "'name:normal|high|urgent'"), *tmp);
+            goto cleanup;
+        }
+
+        VIR_FREE(name);
+        if (VIR_STRNDUP(name, *tmp, sep - *tmp) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ARRAY_CARDINALITY(programs); i++) {
+            for (j = 0; j < programs[i].nprocs; j++) {
+                if (STREQ_NULLABLE(programs[i].procs[j].name, name)) {
+                    programs[i].procs[j].priority = priority;
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) {
+            virReportError(VIR_ERR_CONF_SYNTAX,
+                           _("unknown procedure '%s' in procedure_priorities"),
+                           name);
+            goto cleanup;
+        }
+
+        VIR_DEBUG("Procedure %s now has priority %s", name, sep + 1);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(name);
+    return ret;
+}
+
 static int migrateProfile(void)
 {
     char *old_base = NULL;
@@ -1214,6 +1296,9 @@ int main(int argc, char **argv) {
 
     daemonSetupNetDevOpenvswitch(config);
 
+    virAllocStatsSetEnabled(config->alloc_stats);
+    virThreadLockStatsSetEnabled(config->lock_stats);
+
     if (daemonSetupAccessManager(config) < 0) {
         VIR_ERROR(_("Can't initialize access manager"));
         exit(EXIT_FAILURE);
@@ -1258,6 +1343,11 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The log writer thread must be started in the final process */
+    if (config->log_async &&
+        virLogSetAsync(true, config->log_flush_on_abort) < 0)
+        VIR_WARN("Unable to enable buffered logging");
+
     /* Try to claim the pidfile, exiting if we can't */
     if ((pid_file_fd = virPidFileAcquirePath(pid_file, false, getpid())) < 0) {
         ret = VIR_DAEMON_ERR_PIDFILE;
@@ -1302,6 +1392,11 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (virEventPollStartLoops(config->event_loop_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     if (!(srv = virNetServerNew("libvirtd", 1,
                                 config->min_workers,
                                 config->max_workers,
@@ -1314,7 +1409,7 @@ int main(int argc, char **argv) {
                                 remoteClientInitHook,
                                 NULL,
                                 remoteClientFreeFunc,
-                                NULL))) {
+                                config))) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
@@ -1340,6 +1435,10 @@ int main(int argc, char **argv) {
     remoteProcs[REMOTE_PROC_AUTH_SASL_STEP].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_SASL_START].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_POLKIT].needAuth = false;
+    if (daemonSetupProcedurePriorities(config->procedure_priorities) < 0) {
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
     if (!(remoteProgram = virNetServerProgramNew(REMOTE_PROGRAM,
                                                  REMOTE_PROTOCOL_VERSION,
                                                  remoteProcs,
@@ -1428,6 +1527,10 @@ int main(int argc, char **argv) {
                 goto cleanup;
             }
             VIR_DEBUG("Proceeding without auditing");
+        } else if (virAuditStartQueue(config->audit_queue_size,
+                                      config->audit_level > 1) < 0) {
+            ret = VIR_DAEMON_ERR_AUDIT;
+            goto cleanup;
         }
     }
     virAuditLog(config->audit_logging > 0);
@@ -1479,8 +1582,9 @@ int main(int argc, char **argv) {
     }
 
 #if defined(__linux__) && defined(NETLINK_ROUTE)
-    /* Register the netlink event service for NETLINK_ROUTE */
-    if (virNetlinkEventServiceStart(NETLINK_ROUTE, 0) < 0) {
+    /* Register the netlink event service for NETLINK_ROUTE, joining the
+     * link group so that drivers can follow changes of host interfaces */
+    if (virNetlinkEventServiceStart(NETLINK_ROUTE, RTNLGRP_LINK) < 0) {
         ret = VIR_DAEMON_ERR_NETWORK;
         goto cleanup;
     }
@@ -1525,6 +1629,16 @@ int main(int argc, char **argv) {
 
     virNetlinkShutdown();
 
+    if (config->audit_level) {
+        virAuditStats stats;
+
+        virAuditClose();
+        virAuditGetStats(&stats);
+        if (stats.dropped || stats.delayed)
+            VIR_WARN("Audit queue dropped %llu and delayed %llu of %llu records",
+                     stats.dropped, stats.delayed, stats.queued + stats.dropped);
+    }
+
     if (pid_file_fd != -1)
         virPidFileReleasePath(pid_file, pid_file_fd);
 
@@ -1550,5 +1664,7 @@ int main(int argc, char **argv) {
     VIR_FREE(remote_config_file);
     daemonConfigFree(config);
 
+    ignore_value(virLogSetAsync(false, false));
+
     return ret;
 }
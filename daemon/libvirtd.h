@@ -48,6 +48,10 @@ typedef struct daemonAdmClientPrivate daemonAdmClientPrivate;
 typedef daemonAdmClientPrivate *daemonAdmClientPrivatePtr;
 typedef struct daemonClientEventCallback daemonClientEventCallback;
 typedef daemonClientEventCallback *daemonClientEventCallbackPtr;
+typedef struct daemonClientStatsCallback daemonClientStatsCallback;
+typedef daemonClientStatsCallback *daemonClientStatsCallbackPtr;
+typedef struct daemonClientEventBatch daemonClientEventBatch;
+typedef daemonClientEventBatch *daemonClientEventBatchPtr;
 
 /* Stores the per-client connection state */
 struct daemonClientPrivate {
@@ -66,8 +70,13 @@ struct daemonClientPrivate {
     size_t nnodeDeviceEventCallbacks;
     daemonClientEventCallbackPtr *secretEventCallbacks;
     size_t nsecretEventCallbacks;
+    daemonClientStatsCallbackPtr *statsCallbacks;
+    size_t nstatsCallbacks;
     bool closeRegistered;
 
+    /* Events waiting to be sent together, has its own lock */
+    daemonClientEventBatchPtr eventBatch;
+
 # if WITH_SASL
     virNetSASLSessionPtr sasl;
 # endif
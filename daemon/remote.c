@@ -26,6 +26,7 @@
 
 #include "remote.h"
 #include "libvirtd.h"
+#include "libvirtd-config.h"
 #include "libvirt_internal.h"
 #include "datatypes.h"
 #include "viralloc.h"
@@ -83,6 +84,59 @@ struct daemonClientEventCallback {
     bool legacy;
 };
 
+/* State of a subscription to domain statistics. The values last sent for
+ * each domain are kept so that the updates carry only the changes. */
+struct daemonClientStatsCallback {
+    virNetServerClientPtr client;
+    int callbackID;
+
+    bool full; /* the client has no state yet */
+    virHashTablePtr fields; /* field name -> unsigned int id */
+    unsigned int nfields;
+
+    virHashTablePtr domains; /* UUID string -> daemonClientStatsDomain */
+    unsigned long long tick;
+};
+
+typedef struct daemonClientStatsDomain daemonClientStatsDomain;
+typedef daemonClientStatsDomain *daemonClientStatsDomainPtr;
+struct daemonClientStatsDomain {
+    unsigned long long tick; /* of the last update including the domain */
+
+    /* indexed by field id, type is 0 for fields the domain doesn't have */
+    virTypedParameterPtr values;
+    size_t nvalues;
+};
+
+/* How long an event may wait for others to share its message */
+#define REMOTE_EVENT_BATCH_DELAY 20 /* milliseconds */
+
+/* Send the batch right away once the events in it take this much */
+#define REMOTE_EVENT_BATCH_FLUSH_SIZE VIR_NET_MESSAGE_INITIAL
+
+typedef struct daemonClientEventBatchItem daemonClientEventBatchItem;
+typedef daemonClientEventBatchItem *daemonClientEventBatchItemPtr;
+struct daemonClientEventBatchItem {
+    remote_connect_event_batch_entry entry;
+
+    /* Set for domain lifecycle events, which a later one supersedes */
+    bool lifecycle;
+    int callbackID;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+};
+
+struct daemonClientEventBatch {
+    virMutex lock;
+
+    bool enabled;
+    unsigned int flags; /* REMOTE_CONNECT_EVENT_BATCH_* */
+    int timer;
+
+    daemonClientEventBatchItemPtr items;
+    size_t nitems;
+    size_t size; /* of all payloads in @items */
+};
+
 static virDomainPtr get_nonnull_domain(virConnectPtr conn, remote_nonnull_domain domain);
 static virNetworkPtr get_nonnull_network(virConnectPtr conn, remote_nonnull_network network);
 static virInterfacePtr get_nonnull_interface(virConnectPtr conn, remote_nonnull_interface iface);
@@ -121,6 +175,13 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
                               xdrproc_t proc,
                               void *data);
 
+static void
+remoteDispatchObjectEventSendNow(virNetServerClientPtr client,
+                                 virNetServerProgramPtr program,
+                                 int procnr,
+                                 xdrproc_t proc,
+                                 void *data);
+
 static void
 remoteEventCallbackFree(void *opaque)
 {
@@ -132,6 +193,317 @@ remoteEventCallbackFree(void *opaque)
 }
 
 
+static void
+remoteStatsDomainFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    daemonClientStatsDomainPtr dom = payload;
+
+    if (!dom)
+        return;
+
+    virTypedParamsFree(dom->values, dom->nvalues);
+    VIR_FREE(dom);
+}
+
+
+static daemonClientStatsCallbackPtr
+remoteStatsCallbackNew(virNetServerClientPtr client)
+{
+    daemonClientStatsCallbackPtr callback;
+
+    if (VIR_ALLOC(callback) < 0)
+        return NULL;
+
+    if (!(callback->fields = virHashCreate(32, virHashValueFree)) ||
+        !(callback->domains = virHashCreate(32, remoteStatsDomainFree))) {
+        virHashFree(callback->fields);
+        VIR_FREE(callback);
+        return NULL;
+    }
+
+    callback->client = virObjectRef(client);
+    callback->callbackID = -1;
+    callback->full = true;
+
+    return callback;
+}
+
+
+static void
+remoteStatsCallbackFree(void *opaque)
+{
+    daemonClientStatsCallbackPtr callback = opaque;
+
+    if (!callback)
+        return;
+
+    virHashFree(callback->domains);
+    virHashFree(callback->fields);
+    virObjectUnref(callback->client);
+    VIR_FREE(callback);
+}
+
+
+static bool
+remoteStatsValueEqual(virTypedParameterPtr a,
+                      virTypedParameterPtr b)
+{
+    if (a->type != b->type)
+        return false;
+
+    switch ((virTypedParameterType) a->type) {
+    case VIR_TYPED_PARAM_INT:
+        return a->value.i == b->value.i;
+    case VIR_TYPED_PARAM_UINT:
+        return a->value.ui == b->value.ui;
+    case VIR_TYPED_PARAM_LLONG:
+        return a->value.l == b->value.l;
+    case VIR_TYPED_PARAM_ULLONG:
+        return a->value.ul == b->value.ul;
+    case VIR_TYPED_PARAM_DOUBLE:
+        return a->value.d == b->value.d;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        return a->value.b == b->value.b;
+    case VIR_TYPED_PARAM_STRING:
+        return STREQ_NULLABLE(a->value.s, b->value.s);
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    return false;
+}
+
+
+static int
+remoteStatsValueSerialize(remote_typed_param_value *dst,
+                          virTypedParameterPtr src)
+{
+    dst->type = src->type;
+    switch ((virTypedParameterType) src->type) {
+    case VIR_TYPED_PARAM_INT:
+        dst->remote_typed_param_value_u.i = src->value.i;
+        return 0;
+    case VIR_TYPED_PARAM_UINT:
+        dst->remote_typed_param_value_u.ui = src->value.ui;
+        return 0;
+    case VIR_TYPED_PARAM_LLONG:
+        dst->remote_typed_param_value_u.l = src->value.l;
+        return 0;
+    case VIR_TYPED_PARAM_ULLONG:
+        dst->remote_typed_param_value_u.ul = src->value.ul;
+        return 0;
+    case VIR_TYPED_PARAM_DOUBLE:
+        dst->remote_typed_param_value_u.d = src->value.d;
+        return 0;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        dst->remote_typed_param_value_u.b = src->value.b;
+        return 0;
+    case VIR_TYPED_PARAM_STRING:
+        return VIR_STRDUP(dst->remote_typed_param_value_u.s, src->value.s);
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"), src->type);
+    return -1;
+}
+
+
+/*
+ * Fills @delta with the changes of @record since the previous update and
+ * remembers the new values. Fields seen for the first time are assigned
+ * an id and appended to @msg.
+ */
+static int
+remoteRelayDomainStatsRecord(daemonClientStatsCallbackPtr callback,
+                             virDomainStatsRecordPtr record,
+                             remote_domain_stats_delta *delta,
+                             remote_connect_domain_stats_event_msg *msg,
+                             size_t *nfieldsAlloc)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    daemonClientStatsDomainPtr dom;
+    bool *present = NULL;
+    size_t npresent = 0;
+    size_t nchangedAlloc = 0;
+    size_t nremovedAlloc = 0;
+    size_t i;
+    int ret = -1;
+
+    make_nonnull_domain(&delta->dom, record->dom);
+
+    virUUIDFormat(record->dom->uuid, uuidstr);
+    if (!(dom = virHashLookup(callback->domains, uuidstr))) {
+        if (VIR_ALLOC(dom) < 0)
+            goto cleanup;
+        if (virHashAddEntry(callback->domains, uuidstr, dom) < 0) {
+            VIR_FREE(dom);
+            goto cleanup;
+        }
+    }
+    dom->tick = callback->tick;
+
+    for (i = 0; i < record->nparams; i++) {
+        virTypedParameterPtr param = &record->params[i];
+        virTypedParameterPtr last;
+        remote_domain_stats_value *value;
+        unsigned int *id;
+
+        if (!(id = virHashLookup(callback->fields, param->field))) {
+            remote_domain_stats_field *field;
+
+            if (VIR_ALLOC(id) < 0)
+                goto cleanup;
+            *id = callback->nfields;
+            if (virHashAddEntry(callback->fields, param->field, id) < 0) {
+                VIR_FREE(id);
+                goto cleanup;
+            }
+            callback->nfields++;
+
+            if (VIR_RESIZE_N(msg->fields.fields_val, *nfieldsAlloc,
+                             msg->fields.fields_len, 1) < 0)
+                goto cleanup;
+            field = &msg->fields.fields_val[msg->fields.fields_len++];
+            field->id = *id;
+            if (VIR_STRDUP(field->name, param->field) < 0)
+                goto cleanup;
+        }
+
+        if (*id >= dom->nvalues &&
+            VIR_EXPAND_N(dom->values, dom->nvalues,
+                         callback->nfields - dom->nvalues) < 0)
+            goto cleanup;
+        if (*id >= npresent &&
+            VIR_EXPAND_N(present, npresent, callback->nfields - npresent) < 0)
+            goto cleanup;
+        present[*id] = true;
+
+        last = &dom->values[*id];
+        if (remoteStatsValueEqual(last, param))
+            continue;
+
+        if (VIR_RESIZE_N(delta->changed.changed_val, nchangedAlloc,
+                         delta->changed.changed_len, 1) < 0)
+            goto cleanup;
+        value = &delta->changed.changed_val[delta->changed.changed_len++];
+        value->id = *id;
+        if (remoteStatsValueSerialize(&value->value, param) < 0)
+            goto cleanup;
+
+        virTypedParamsClear(last, 1);
+        *last = *param;
+        if (param->type == VIR_TYPED_PARAM_STRING) {
+            last->value.s = NULL;
+            if (VIR_STRDUP(last->value.s, param->value.s) < 0) {
+                last->type = 0;
+                goto cleanup;
+            }
+        }
+    }
+
+    for (i = 0; i < dom->nvalues; i++) {
+        if (!dom->values[i].type || (i < npresent && present[i]))
+            continue;
+
+        if (VIR_RESIZE_N(delta->removed.removed_val, nremovedAlloc,
+                         delta->removed.removed_len, 1) < 0)
+            goto cleanup;
+        delta->removed.removed_val[delta->removed.removed_len++] = i;
+
+        virTypedParamsClear(&dom->values[i], 1);
+        dom->values[i].type = 0;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(present);
+    return ret;
+}
+
+
+static int
+remoteStatsDomainIsStale(const void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         const void *opaque)
+{
+    const daemonClientStatsDomain *dom = payload;
+    const unsigned long long *tick = opaque;
+
+    return dom->tick != *tick;
+}
+
+
+static void
+remoteRelayDomainStats(virConnectPtr conn ATTRIBUTE_UNUSED,
+                       virDomainStatsRecordPtr *stats,
+                       int nstats,
+                       void *opaque)
+{
+    daemonClientStatsCallbackPtr callback = opaque;
+    remote_connect_domain_stats_event_msg msg;
+    size_t nfieldsAlloc = 0;
+    size_t i;
+
+    if (callback->callbackID < 0)
+        return;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.callbackID = callback->callbackID;
+    msg.full = callback->full;
+    callback->tick++;
+
+    if (nstats > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("Too many records in stats update: %d > %d"),
+                       nstats, REMOTE_DOMAIN_LIST_MAX);
+        goto error;
+    }
+
+    if (nstats) {
+        if (VIR_ALLOC_N(msg.records.records_val, nstats) < 0)
+            goto error;
+        msg.records.records_len = nstats;
+    }
+
+    for (i = 0; i < nstats; i++) {
+        if (remoteRelayDomainStatsRecord(callback, stats[i],
+                                         &msg.records.records_val[i],
+                                         &msg, &nfieldsAlloc) < 0)
+            goto error;
+    }
+
+    /* Forget domains which are gone or don't match the filter anymore */
+    if (virHashRemoveSet(callback->domains, remoteStatsDomainIsStale,
+                         &callback->tick) < 0)
+        goto error;
+
+    callback->full = false;
+
+    VIR_DEBUG("Relaying stats of %d domains, callback %d, %u new fields",
+              nstats, callback->callbackID, msg.fields.fields_len);
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT,
+                                  (xdrproc_t)xdr_remote_connect_domain_stats_event_msg,
+                                  &msg);
+    return;
+
+ error:
+    /* The client would get out of sync; start from scratch next time */
+    VIR_WARN("unable to relay domain stats for callback %d: %s",
+             callback->callbackID, virGetLastErrorMessage());
+    virHashRemoveAll(callback->domains);
+    virHashRemoveAll(callback->fields);
+    callback->nfields = 0;
+    callback->full = true;
+    xdr_free((xdrproc_t)xdr_remote_connect_domain_stats_event_msg,
+             (char *) &msg);
+}
+
+
 static bool
 remoteRelayDomainEventCheckACL(virNetServerClientPtr client,
                                virConnectPtr conn, virDomainPtr dom)
@@ -1469,9 +1841,45 @@ remoteRelayStoragePoolEventRefresh(virConnectPtr conn,
     return 0;
 }
 
+static int
+remoteRelayStoragePoolEventVolumeJob(virConnectPtr conn,
+                                     virStoragePoolPtr pool,
+                                     const char *volume,
+                                     int type,
+                                     int status,
+                                     void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+    remote_storage_pool_event_volume_job_msg data;
+
+    if (callback->callbackID < 0 ||
+        !remoteRelayStoragePoolEventCheckACL(callback->client, conn, pool))
+        return -1;
+
+    VIR_DEBUG("Relaying storage pool volume job event %s %d %d, callback %d",
+              volume, type, status, callback->callbackID);
+
+    /* build return data */
+    memset(&data, 0, sizeof(data));
+    if (VIR_STRDUP(data.volume, volume) < 0)
+        return -1;
+    make_nonnull_storage_pool(&data.pool, pool);
+    data.callbackID = callback->callbackID;
+    data.type = type;
+    data.status = status;
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_STORAGE_POOL_EVENT_VOLUME_JOB,
+                                  (xdrproc_t)xdr_remote_storage_pool_event_volume_job_msg,
+                                  &data);
+
+    return 0;
+}
+
 static virConnectStoragePoolEventGenericCallback storageEventCallbacks[] = {
     VIR_STORAGE_POOL_EVENT_CALLBACK(remoteRelayStoragePoolEventLifecycle),
     VIR_STORAGE_POOL_EVENT_CALLBACK(remoteRelayStoragePoolEventRefresh),
+    VIR_STORAGE_POOL_EVENT_CALLBACK(remoteRelayStoragePoolEventVolumeJob),
 };
 
 verify(ARRAY_CARDINALITY(storageEventCallbacks) == VIR_STORAGE_POOL_EVENT_ID_LAST);
@@ -1670,100 +2078,371 @@ void remoteRelayConnectionClosedEvent(virConnectPtr conn ATTRIBUTE_UNUSED, int r
                                   &msg);
 }
 
-#define DEREG_CB(conn, eventCallbacks, neventCallbacks, deregFcn, name) \
-    do { \
-        size_t i; \
-        for (i = 0; i < neventCallbacks; i++) { \
-            int callbackID = eventCallbacks[i]->callbackID; \
-            if (callbackID < 0) { \
-                VIR_WARN("unexpected incomplete %s callback %zu", name, i); \
-                continue; \
-            } \
-            VIR_DEBUG("Deregistering remote %s event relay %d", \
-                      name, callbackID); \
-            eventCallbacks[i]->callbackID = -1; \
-            if (deregFcn(conn, callbackID) < 0) \
-                VIR_WARN("unexpected %s event deregister failure", name); \
-        } \
-        VIR_FREE(eventCallbacks); \
-        neventCallbacks = 0; \
-    } while (0);
-
-/*
- * You must hold lock for at least the client
- * We don't free stuff here, merely disconnect the client's
- * network socket & resources.
- * We keep the libvirt connection open until any async
- * jobs have finished, then clean it up elsewhere
- */
-void remoteClientFreeFunc(void *data)
+static void
+remoteEventBatchItemsFree(daemonClientEventBatchItemPtr items,
+                          size_t nitems)
 {
-    struct daemonClientPrivate *priv = data;
-
-    /* Deregister event delivery callback */
-    if (priv->conn) {
-        virIdentityPtr sysident = virIdentityGetSystem();
+    size_t i;
 
-        virIdentitySetCurrent(sysident);
+    for (i = 0; i < nitems; i++)
+        VIR_FREE(items[i].entry.payload.payload_val);
+    VIR_FREE(items);
+}
 
-        DEREG_CB(priv->conn, priv->domainEventCallbacks,
-                 priv->ndomainEventCallbacks,
-                 virConnectDomainEventDeregisterAny, "domain");
-        DEREG_CB(priv->conn, priv->networkEventCallbacks,
-                 priv->nnetworkEventCallbacks,
-                 virConnectNetworkEventDeregisterAny, "network");
-        DEREG_CB(priv->conn, priv->storageEventCallbacks,
-                 priv->nstorageEventCallbacks,
-                 virConnectStoragePoolEventDeregisterAny, "storage");
-        DEREG_CB(priv->conn, priv->nodeDeviceEventCallbacks,
-                 priv->nnodeDeviceEventCallbacks,
-                 virConnectNodeDeviceEventDeregisterAny, "node device");
-        DEREG_CB(priv->conn, priv->secretEventCallbacks,
-                 priv->nsecretEventCallbacks,
-                 virConnectSecretEventDeregisterAny, "secret");
-        DEREG_CB(priv->conn, priv->qemuEventCallbacks,
-                 priv->nqemuEventCallbacks,
-                 virConnectDomainQemuMonitorEventDeregister, "qemu monitor");
 
-        if (priv->closeRegistered) {
-            if (virConnectUnregisterCloseCallback(priv->conn,
-                                                  remoteRelayConnectionClosedEvent) < 0)
-                VIR_WARN("unexpected close callback event deregister failure");
-        }
+static daemonClientEventBatchPtr
+remoteEventBatchNew(void)
+{
+    daemonClientEventBatchPtr batch;
 
-        virConnectClose(priv->conn);
+    if (VIR_ALLOC(batch) < 0)
+        return NULL;
 
-        virIdentitySetCurrent(NULL);
-        virObjectUnref(sysident);
+    if (virMutexInit(&batch->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        VIR_FREE(batch);
+        return NULL;
     }
 
-    VIR_FREE(priv);
+    batch->timer = -1;
+    return batch;
 }
-#undef DEREG_CB
 
 
-static void remoteClientCloseFunc(virNetServerClientPtr client)
+static void
+remoteEventBatchFree(daemonClientEventBatchPtr batch)
 {
-    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    if (!batch)
+        return;
 
-    daemonRemoveAllClientStreams(priv->streams);
+    remoteEventBatchItemsFree(batch->items, batch->nitems);
+    virMutexDestroy(&batch->lock);
+    VIR_FREE(batch);
 }
 
 
-void *remoteClientInitHook(virNetServerClientPtr client,
-                           void *opaque ATTRIBUTE_UNUSED)
+/* Send all pending events in one message. Must be called with the
+ * batch lock held. */
+static void
+remoteEventBatchFlushLocked(virNetServerClientPtr client,
+                            daemonClientEventBatchPtr batch)
 {
-    struct daemonClientPrivate *priv;
+    remote_connect_event_batch_msg msg;
+    size_t i;
 
-    if (VIR_ALLOC(priv) < 0)
-        return NULL;
+    if (batch->nitems == 0)
+        return;
 
-    if (virMutexInit(&priv->lock) < 0) {
-        VIR_FREE(priv);
+    memset(&msg, 0, sizeof(msg));
+    if (VIR_ALLOC_N(msg.events.events_val, batch->nitems) < 0)
+        goto cleanup;
+
+    for (i = 0; i < batch->nitems; i++) {
+        msg.events.events_val[i] = batch->items[i].entry;
+        memset(&batch->items[i].entry, 0, sizeof(batch->items[i].entry));
+    }
+    msg.events.events_len = batch->nitems;
+
+    VIR_DEBUG("Flushing batch of %zu events, %zu bytes",
+              batch->nitems, batch->size);
+
+    /* Frees the payloads which @msg took over */
+    remoteDispatchObjectEventSendNow(client, remoteProgram,
+                                     REMOTE_PROC_CONNECT_EVENT_BATCH,
+                                     (xdrproc_t)xdr_remote_connect_event_batch_msg,
+                                     &msg);
+
+ cleanup:
+    remoteEventBatchItemsFree(batch->items, batch->nitems);
+    batch->items = NULL;
+    batch->nitems = 0;
+    batch->size = 0;
+    if (batch->timer != -1)
+        virEventUpdateTimeout(batch->timer, -1);
+}
+
+
+static void
+remoteEventBatchTimer(int timer ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virNetServerClientPtr client = opaque;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    daemonClientEventBatchPtr batch = priv->eventBatch;
+
+    virMutexLock(&batch->lock);
+    remoteEventBatchFlushLocked(client, batch);
+    virMutexUnlock(&batch->lock);
+}
+
+
+/* Stop batching when the client goes away. Whatever is still pending
+ * is discarded and the timer drops its reference on the client. */
+static void
+remoteEventBatchStop(daemonClientEventBatchPtr batch)
+{
+    if (!batch)
+        return;
+
+    virMutexLock(&batch->lock);
+    batch->enabled = false;
+    if (batch->timer != -1) {
+        virEventRemoveTimeout(batch->timer);
+        batch->timer = -1;
+    }
+    remoteEventBatchItemsFree(batch->items, batch->nitems);
+    batch->items = NULL;
+    batch->nitems = 0;
+    batch->size = 0;
+    virMutexUnlock(&batch->lock);
+}
+
+
+static int
+remoteEventBatchEncode(xdrproc_t proc,
+                       void *data,
+                       char **payload,
+                       unsigned int *len)
+{
+    size_t size = 1024;
+    char *buf;
+    XDR xdr;
+
+    for (;;) {
+        if (VIR_ALLOC_N(buf, size) < 0)
+            return -1;
+
+        xdrmem_create(&xdr, buf, size, XDR_ENCODE);
+        if ((*proc)(&xdr, data))
+            break;
+
+        xdr_destroy(&xdr);
+        VIR_FREE(buf);
+
+        size *= 4;
+        if (size > REMOTE_CONNECT_EVENT_BATCH_PAYLOAD_MAX)
+            return -1;
+    }
+
+    *len = xdr_getpos(&xdr);
+    xdr_destroy(&xdr);
+    *payload = buf;
+    return 0;
+}
+
+
+/**
+ * remoteEventBatchQueue:
+ * @client: the client to deliver the event to
+ * @procnr: the event procedure
+ * @proc: XDR filter for @data
+ * @data: the event
+ *
+ * Add the event to the client's pending batch if the client asked
+ * for batching. With REMOTE_CONNECT_EVENT_BATCH_COALESCE a domain
+ * lifecycle event replaces the one still pending for the same domain
+ * and callback.
+ *
+ * Returns 0 if queued, -1 if the event must be sent on its own, in
+ * which case the events queued before it have already been sent.
+ */
+static int
+remoteEventBatchQueue(virNetServerClientPtr client,
+                      int procnr,
+                      xdrproc_t proc,
+                      void *data)
+{
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    daemonClientEventBatchPtr batch = priv->eventBatch;
+    daemonClientEventBatchItem item;
+    remote_domain_event_lifecycle_msg *lifecycle = NULL;
+    int ret = -1;
+    size_t i;
+
+    memset(&item, 0, sizeof(item));
+
+    virMutexLock(&batch->lock);
+
+    if (!batch->enabled || batch->timer == -1)
+        goto cleanup;
+
+    /* The client is about to lose the connection, must not wait */
+    if (procnr == REMOTE_PROC_CONNECT_EVENT_CONNECTION_CLOSED)
+        goto flush;
+
+    if (remoteEventBatchEncode(proc, data, &item.entry.payload.payload_val,
+                               &item.entry.payload.payload_len) < 0)
+        goto flush;
+    item.entry.procedure = procnr;
+
+    if (procnr == REMOTE_PROC_DOMAIN_EVENT_LIFECYCLE) {
+        lifecycle = data;
+        item.callbackID = -1;
+    } else if (procnr == REMOTE_PROC_DOMAIN_EVENT_CALLBACK_LIFECYCLE) {
+        remote_domain_event_callback_lifecycle_msg *msg = data;
+        lifecycle = &msg->msg;
+        item.callbackID = msg->callbackID;
+    }
+
+    if (lifecycle) {
+        item.lifecycle = true;
+        memcpy(item.uuid, lifecycle->dom.uuid, VIR_UUID_BUFLEN);
+    }
+
+    if (item.lifecycle &&
+        (batch->flags & REMOTE_CONNECT_EVENT_BATCH_COALESCE)) {
+        for (i = 0; i < batch->nitems; i++) {
+            daemonClientEventBatchItemPtr old = batch->items + i;
+
+            if (old->lifecycle &&
+                old->entry.procedure == procnr &&
+                old->callbackID == item.callbackID &&
+                memcmp(old->uuid, item.uuid, VIR_UUID_BUFLEN) == 0) {
+                batch->size -= old->entry.payload.payload_len;
+                VIR_FREE(old->entry.payload.payload_val);
+                VIR_DELETE_ELEMENT(batch->items, i, batch->nitems);
+                break;
+            }
+        }
+    }
+
+    batch->size += item.entry.payload.payload_len;
+    if (VIR_APPEND_ELEMENT(batch->items, batch->nitems, item) < 0) {
+        batch->size -= item.entry.payload.payload_len;
+        VIR_FREE(item.entry.payload.payload_val);
+        goto flush;
+    }
+
+    if (batch->nitems >= REMOTE_CONNECT_EVENT_BATCH_MAX ||
+        batch->size >= REMOTE_EVENT_BATCH_FLUSH_SIZE)
+        remoteEventBatchFlushLocked(client, batch);
+    else if (batch->nitems == 1)
+        virEventUpdateTimeout(batch->timer, REMOTE_EVENT_BATCH_DELAY);
+
+    ret = 0;
+    goto cleanup;
+
+ flush:
+    remoteEventBatchFlushLocked(client, batch);
+
+ cleanup:
+    virMutexUnlock(&batch->lock);
+    return ret;
+}
+
+
+#define DEREG_CB(conn, eventCallbacks, neventCallbacks, deregFcn, name) \
+    do { \
+        size_t i; \
+        for (i = 0; i < neventCallbacks; i++) { \
+            int callbackID = eventCallbacks[i]->callbackID; \
+            if (callbackID < 0) { \
+                VIR_WARN("unexpected incomplete %s callback %zu", name, i); \
+                continue; \
+            } \
+            VIR_DEBUG("Deregistering remote %s event relay %d", \
+                      name, callbackID); \
+            eventCallbacks[i]->callbackID = -1; \
+            if (deregFcn(conn, callbackID) < 0) \
+                VIR_WARN("unexpected %s event deregister failure", name); \
+        } \
+        VIR_FREE(eventCallbacks); \
+        neventCallbacks = 0; \
+    } while (0);
+
+/*
+ * You must hold lock for at least the client
+ * We don't free stuff here, merely disconnect the client's
+ * network socket & resources.
+ * We keep the libvirt connection open until any async
+ * jobs have finished, then clean it up elsewhere
+ */
+void remoteClientFreeFunc(void *data)
+{
+    struct daemonClientPrivate *priv = data;
+
+    /* Deregister event delivery callback */
+    if (priv->conn) {
+        virIdentityPtr sysident = virIdentityGetSystem();
+
+        virIdentitySetCurrent(sysident);
+
+        DEREG_CB(priv->conn, priv->domainEventCallbacks,
+                 priv->ndomainEventCallbacks,
+                 virConnectDomainEventDeregisterAny, "domain");
+        DEREG_CB(priv->conn, priv->networkEventCallbacks,
+                 priv->nnetworkEventCallbacks,
+                 virConnectNetworkEventDeregisterAny, "network");
+        DEREG_CB(priv->conn, priv->storageEventCallbacks,
+                 priv->nstorageEventCallbacks,
+                 virConnectStoragePoolEventDeregisterAny, "storage");
+        DEREG_CB(priv->conn, priv->nodeDeviceEventCallbacks,
+                 priv->nnodeDeviceEventCallbacks,
+                 virConnectNodeDeviceEventDeregisterAny, "node device");
+        DEREG_CB(priv->conn, priv->secretEventCallbacks,
+                 priv->nsecretEventCallbacks,
+                 virConnectSecretEventDeregisterAny, "secret");
+        DEREG_CB(priv->conn, priv->qemuEventCallbacks,
+                 priv->nqemuEventCallbacks,
+                 virConnectDomainQemuMonitorEventDeregister, "qemu monitor");
+        DEREG_CB(priv->conn, priv->statsCallbacks,
+                 priv->nstatsCallbacks,
+                 virConnectDomainStatsDeregister, "domain stats");
+
+        if (priv->closeRegistered) {
+            if (virConnectUnregisterCloseCallback(priv->conn,
+                                                  remoteRelayConnectionClosedEvent) < 0)
+                VIR_WARN("unexpected close callback event deregister failure");
+        }
+
+        virConnectClose(priv->conn);
+
+        virIdentitySetCurrent(NULL);
+        virObjectUnref(sysident);
+    }
+
+    remoteEventBatchFree(priv->eventBatch);
+    VIR_FREE(priv);
+}
+#undef DEREG_CB
+
+
+static void remoteClientCloseFunc(virNetServerClientPtr client)
+{
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    daemonRemoveAllClientStreams(priv->streams);
+    remoteEventBatchStop(priv->eventBatch);
+}
+
+
+void *remoteClientInitHook(virNetServerClientPtr client,
+                           void *opaque)
+{
+    struct daemonConfig *config = opaque;
+    struct daemonClientPrivate *priv;
+
+    if (VIR_ALLOC(priv) < 0)
+        return NULL;
+
+    if (virMutexInit(&priv->lock) < 0) {
+        VIR_FREE(priv);
         virReportSystemError(errno, "%s", _("unable to init mutex"));
         return NULL;
     }
 
+    if (!(priv->eventBatch = remoteEventBatchNew())) {
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        return NULL;
+    }
+
+    if (config)
+        virNetServerClientSetEventQueueLimit(client, config->max_client_events,
+                                             config->client_events_policy);
+
     virNetServerClientSetCloseHook(client, remoteClientCloseFunc);
     return priv;
 }
@@ -3981,6 +4660,22 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
                               int procnr,
                               xdrproc_t proc,
                               void *data)
+{
+    if (program == remoteProgram &&
+        remoteEventBatchQueue(client, procnr, proc, data) == 0) {
+        xdr_free(proc, data);
+        return;
+    }
+
+    remoteDispatchObjectEventSendNow(client, program, procnr, proc, data);
+}
+
+static void
+remoteDispatchObjectEventSendNow(virNetServerClientPtr client,
+                                 virNetServerProgramPtr program,
+                                 int procnr,
+                                 xdrproc_t proc,
+                                 void *data)
 {
     virNetMessagePtr msg;
 
@@ -4001,7 +4696,8 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
         goto cleanup;
 
     VIR_DEBUG("Queue event %d %zu", procnr, msg->bufferLength);
-    virNetServerClientSendMessage(client, msg);
+    if (virNetServerClientSendEvent(client, msg) < 0)
+        goto cleanup;
 
     xdr_free(proc, data);
     return;
@@ -4660,9 +5356,15 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
     case VIR_DRV_FEATURE_FD_PASSING:
     case VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK:
     case VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK:
+    case VIR_DRV_FEATURE_REMOTE_COMPACT_STATS:
+    case VIR_DRV_FEATURE_REMOTE_EVENT_BATCH:
         supported = 1;
         break;
 
+    case VIR_DRV_FEATURE_REMOTE_SHARED_REPLIES:
+        supported = virNetServerClientCanShareReplies(client);
+        break;
+
     default:
         if ((supported = virConnectSupportsFeature(priv->conn, args->feature)) < 0)
             goto cleanup;
@@ -5196,9 +5898,9 @@ remoteDispatchDomainMigrateBegin3Params(virNetServerPtr server ATTRIBUTE_UNUSED,
     if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
         goto cleanup;
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     if (!(xml = virDomainMigrateBegin3Params(dom, params, nparams,
@@ -5213,7 +5915,7 @@ remoteDispatchDomainMigrateBegin3Params(virNetServerPtr server ATTRIBUTE_UNUSED,
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0)
         virNetMessageSaveError(rerr);
     virObjectUnref(dom);
@@ -5249,9 +5951,9 @@ remoteDispatchDomainMigratePrepare3Params(virNetServerPtr server ATTRIBUTE_UNUSE
         goto cleanup;
     }
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     /* Wacky world of XDR ... */
@@ -5272,7 +5974,7 @@ remoteDispatchDomainMigratePrepare3Params(virNetServerPtr server ATTRIBUTE_UNUSE
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0) {
         virNetMessageSaveError(rerr);
         VIR_FREE(uri_out);
@@ -5310,9 +6012,9 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
         goto cleanup;
     }
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
@@ -5335,7 +6037,7 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0) {
         virNetMessageSaveError(rerr);
         VIR_FREE(cookieout);
@@ -5383,9 +6085,9 @@ remoteDispatchDomainMigratePerform3Params(virNetServerPtr server ATTRIBUTE_UNUSE
     if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
         goto cleanup;
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     dconnuri = args->dconnuri == NULL ? NULL : *args->dconnuri;
@@ -5403,7 +6105,7 @@ remoteDispatchDomainMigratePerform3Params(virNetServerPtr server ATTRIBUTE_UNUSE
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0)
         virNetMessageSaveError(rerr);
     virObjectUnref(dom);
@@ -5440,9 +6142,9 @@ remoteDispatchDomainMigrateFinish3Params(virNetServerPtr server ATTRIBUTE_UNUSED
         goto cleanup;
     }
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     dom = virDomainMigrateFinish3Params(priv->conn, params, nparams,
@@ -5461,7 +6163,7 @@ remoteDispatchDomainMigrateFinish3Params(virNetServerPtr server ATTRIBUTE_UNUSED
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0) {
         virNetMessageSaveError(rerr);
         VIR_FREE(cookieout);
@@ -5500,9 +6202,9 @@ remoteDispatchDomainMigrateConfirm3Params(virNetServerPtr server ATTRIBUTE_UNUSE
     if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
         goto cleanup;
 
-    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->params.params_val,
-                                  args->params.params_len,
-                                  0, &params, &nparams) < 0)
+    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->params.params_val,
+                                        args->params.params_len,
+                                        0, &params, &nparams) < 0)
         goto cleanup;
 
     if (virDomainMigrateConfirm3Params(dom, params, nparams,
@@ -5514,7 +6216,7 @@ remoteDispatchDomainMigrateConfirm3Params(virNetServerPtr server ATTRIBUTE_UNUSE
     rv = 0;
 
  cleanup:
-    virTypedParamsFree(params, nparams);
+    VIR_FREE(params);
     if (rv < 0)
         virNetMessageSaveError(rerr);
     virObjectUnref(dom);
@@ -6494,46 +7196,37 @@ remoteDispatchNetworkGetDHCPLeases(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+/* Collects the stats for both variants of the bulk stats call */
 static int
-remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
-                                       virNetServerClientPtr client,
-                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
-                                       virNetMessageErrorPtr rerr,
-                                       remote_connect_get_all_domain_stats_args *args,
-                                       remote_connect_get_all_domain_stats_ret *ret)
+remoteGetAllDomainStats(struct daemonClientPrivate *priv,
+                        remote_nonnull_domain *doms_val,
+                        unsigned int doms_len,
+                        unsigned int stats,
+                        unsigned int flags,
+                        virDomainStatsRecordPtr **retStats)
 {
-    int rv = -1;
-    size_t i;
-    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
-    virDomainStatsRecordPtr *retStats = NULL;
-    int nrecords = 0;
     virDomainPtr *doms = NULL;
+    int nrecords = -1;
+    size_t i;
 
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
-        goto cleanup;
+        return -1;
     }
 
-    if (args->doms.doms_len) {
-        if (VIR_ALLOC_N(doms, args->doms.doms_len + 1) < 0)
+    if (doms_len) {
+        if (VIR_ALLOC_N(doms, doms_len + 1) < 0)
             goto cleanup;
 
-        for (i = 0; i < args->doms.doms_len; i++) {
-            if (!(doms[i] = get_nonnull_domain(priv->conn, args->doms.doms_val[i])))
+        for (i = 0; i < doms_len; i++) {
+            if (!(doms[i] = get_nonnull_domain(priv->conn, doms_val[i])))
                 goto cleanup;
         }
 
-        if ((nrecords = virDomainListGetStats(doms,
-                                              args->stats,
-                                              &retStats,
-                                              args->flags)) < 0)
-            goto cleanup;
+        nrecords = virDomainListGetStats(doms, stats, retStats, flags);
     } else {
-        if ((nrecords = virConnectGetAllDomainStats(priv->conn,
-                                                    args->stats,
-                                                    &retStats,
-                                                    args->flags)) < 0)
-            goto cleanup;
+        nrecords = virConnectGetAllDomainStats(priv->conn, stats,
+                                               retStats, flags);
     }
 
     if (nrecords > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
@@ -6541,9 +7234,36 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
                        _("Number of domain stats records is %d, "
                          "which exceeds max limit: %d"),
                        nrecords, REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
-        goto cleanup;
+        virDomainStatsRecordListFree(*retStats);
+        *retStats = NULL;
+        nrecords = -1;
     }
 
+ cleanup:
+    virObjectListFree(doms);
+    return nrecords;
+}
+
+
+static int
+remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_all_domain_stats_args *args,
+                                       remote_connect_get_all_domain_stats_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *retStats = NULL;
+    int nrecords = 0;
+
+    if ((nrecords = remoteGetAllDomainStats(priv, args->doms.doms_val,
+                                            args->doms.doms_len, args->stats,
+                                            args->flags, &retStats)) < 0)
+        goto cleanup;
+
     if (nrecords) {
         if (VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0)
             goto cleanup;
@@ -6574,36 +7294,477 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
         virNetMessageSaveError(rerr);
 
     virDomainStatsRecordListFree(retStats);
-    virObjectListFree(doms);
 
     return rv;
 }
 
 
+/* Same as remoteDispatchConnectGetAllDomainStats, except that each
+ * distinct field name is sent only once. Clients use it only after
+ * probing VIR_DRV_FEATURE_REMOTE_COMPACT_STATS. */
 static int
-remoteDispatchNodeAllocPages(virNetServerPtr server ATTRIBUTE_UNUSED,
-                             virNetServerClientPtr client,
-                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
-                             virNetMessageErrorPtr rerr,
-                             remote_node_alloc_pages_args *args,
-                             remote_node_alloc_pages_ret *ret)
+remoteDispatchConnectGetAllDomainStatsCompact(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                              virNetMessageErrorPtr rerr,
+                                              remote_connect_get_all_domain_stats_compact_args *args,
+                                              remote_connect_get_all_domain_stats_compact_ret *ret)
 {
     int rv = -1;
-    int len;
-    struct daemonClientPrivate *priv =
-        virNetServerClientGetPrivateData(client);
+    size_t i;
+    size_t j;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *retStats = NULL;
+    virHashTablePtr fields = NULL;
+    size_t nfieldsAlloc = 0;
+    int nrecords = 0;
 
-    if (!priv->conn) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+    if ((nrecords = remoteGetAllDomainStats(priv, args->doms.doms_val,
+                                            args->doms.doms_len, args->stats,
+                                            args->flags, &retStats)) < 0)
         goto cleanup;
-    }
 
-    if ((len = virNodeAllocPages(priv->conn,
-                                 args->pageSizes.pageSizes_len,
-                                 args->pageSizes.pageSizes_val,
-                                 (unsigned long long *) args->pageCounts.pageCounts_val,
-                                 args->startCell,
-                                 args->cellCount,
+    if (!(fields = virHashCreate(32, virHashValueFree)))
+        goto cleanup;
+
+    if (nrecords &&
+        VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0)
+        goto cleanup;
+    ret->retStats.retStats_len = nrecords;
+
+    for (i = 0; i < nrecords; i++) {
+        remote_domain_stats_compact_record *dst = ret->retStats.retStats_val + i;
+
+        make_nonnull_domain(&dst->dom, retStats[i]->dom);
+
+        if (retStats[i]->nparams &&
+            VIR_ALLOC_N(dst->params.params_val, retStats[i]->nparams) < 0)
+            goto cleanup;
+
+        for (j = 0; j < retStats[i]->nparams; j++) {
+            virTypedParameterPtr param = retStats[i]->params + j;
+            remote_domain_stats_value *value;
+            unsigned int *id;
+
+            /* Sparse arrays are skipped like virTypedParamsSerialize does */
+            if (!param->type)
+                continue;
+
+            if (!(id = virHashLookup(fields, param->field))) {
+                if (VIR_ALLOC(id) < 0)
+                    goto cleanup;
+                *id = ret->fields.fields_len;
+                if (virHashAddEntry(fields, param->field, id) < 0) {
+                    VIR_FREE(id);
+                    goto cleanup;
+                }
+
+                if (VIR_RESIZE_N(ret->fields.fields_val, nfieldsAlloc,
+                                 ret->fields.fields_len, 1) < 0 ||
+                    VIR_STRDUP(ret->fields.fields_val[ret->fields.fields_len],
+                               param->field) < 0)
+                    goto cleanup;
+                ret->fields.fields_len++;
+            }
+
+            value = dst->params.params_val + dst->params.params_len++;
+            value->id = *id;
+            if (remoteStatsValueSerialize(&value->value, param) < 0)
+                goto cleanup;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virHashFree(fields);
+    virDomainStatsRecordListFree(retStats);
+
+    return rv;
+}
+
+
+static int
+remoteDispatchDomainGetStatsHistory(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                    virNetServerClientPtr client,
+                                    virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                    virNetMessageErrorPtr rerr,
+                                    remote_domain_get_stats_history_args *args,
+                                    remote_domain_get_stats_history_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainPtr dom = NULL;
+    virDomainStatsRecordPtr *samples = NULL;
+    int nsamples = 0;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(dom = get_nonnull_domain(priv->conn, args->dom)))
+        goto cleanup;
+
+    if ((nsamples = virDomainGetStatsHistory(dom, args->start, args->end,
+                                             &samples, args->flags)) < 0)
+        goto cleanup;
+
+    if (nsamples > REMOTE_DOMAIN_STATS_HISTORY_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain stats samples is %d, "
+                         "which exceeds max limit: %d"),
+                       nsamples, REMOTE_DOMAIN_STATS_HISTORY_MAX);
+        goto cleanup;
+    }
+
+    if (nsamples) {
+        if (VIR_ALLOC_N(ret->samples.samples_val, nsamples) < 0)
+            goto cleanup;
+
+        ret->samples.samples_len = nsamples;
+
+        for (i = 0; i < nsamples; i++) {
+            remote_domain_stats_record *dst = ret->samples.samples_val + i;
+
+            make_nonnull_domain(&dst->dom, samples[i]->dom);
+
+            if (virTypedParamsSerialize(samples[i]->params,
+                                        samples[i]->nparams,
+                                        (virTypedParameterRemotePtr *) &dst->params.params_val,
+                                        &dst->params.params_len,
+                                        VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virDomainStatsRecordListFree(samples);
+    virObjectUnref(dom);
+
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectDomainStatsRegister(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                         virNetServerClientPtr client,
+                                         virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                         virNetMessageErrorPtr rerr,
+                                         remote_connect_domain_stats_register_args *args,
+                                         remote_connect_domain_stats_register_ret *ret)
+{
+    int callbackID;
+    int rv = -1;
+    daemonClientStatsCallbackPtr callback = NULL;
+    daemonClientStatsCallbackPtr ref;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    /* Append an incomplete callback first, see
+     * remoteDispatchConnectNetworkEventRegisterAny */
+    if (!(callback = remoteStatsCallbackNew(client)))
+        goto cleanup;
+    ref = callback;
+    if (VIR_APPEND_ELEMENT(priv->statsCallbacks,
+                           priv->nstatsCallbacks,
+                           callback) < 0)
+        goto cleanup;
+
+    if ((callbackID = virConnectDomainStatsRegister(priv->conn,
+                                                    args->stats,
+                                                    args->interval,
+                                                    remoteRelayDomainStats,
+                                                    ref,
+                                                    remoteStatsCallbackFree,
+                                                    args->flags)) < 0) {
+        VIR_SHRINK_N(priv->statsCallbacks, priv->nstatsCallbacks, 1);
+        callback = ref;
+        goto cleanup;
+    }
+
+    ref->callbackID = callbackID;
+    ret->callbackID = callbackID;
+
+    rv = 0;
+
+ cleanup:
+    remoteStatsCallbackFree(callback);
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectDomainStatsDeregister(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                           virNetServerClientPtr client,
+                                           virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                           virNetMessageErrorPtr rerr,
+                                           remote_connect_domain_stats_deregister_args *args)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    for (i = 0; i < priv->nstatsCallbacks; i++) {
+        if (priv->statsCallbacks[i]->callbackID == args->callbackID)
+            break;
+    }
+    if (i == priv->nstatsCallbacks) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("domain stats callback %d not registered"),
+                       args->callbackID);
+        goto cleanup;
+    }
+
+    if (virConnectDomainStatsDeregister(priv->conn, args->callbackID) < 0)
+        goto cleanup;
+
+    VIR_DELETE_ELEMENT(priv->statsCallbacks, i, priv->nstatsCallbacks);
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
+/* Called with the client locked, so must not queue the message itself */
+static virNetMessagePtr
+remoteClientEventsLost(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                       unsigned long long count)
+{
+    remote_connect_event_lost_msg data = { count };
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = virNetServerProgramGetID(remoteProgram);
+    msg->header.vers = virNetServerProgramGetVersion(remoteProgram);
+    msg->header.proc = REMOTE_PROC_CONNECT_EVENT_LOST;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 1;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_remote_connect_event_lost_msg,
+                                   &data) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
+static int
+remoteDispatchConnectEventBatchEnable(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                      virNetMessageErrorPtr rerr,
+                                      remote_connect_event_batch_enable_args *args)
+{
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    daemonClientEventBatchPtr batch = priv->eventBatch;
+
+    virMutexLock(&batch->lock);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (args->flags & ~REMOTE_CONNECT_EVENT_BATCH_COALESCE) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("unsupported event batch flags 0x%x"),
+                       args->flags & ~REMOTE_CONNECT_EVENT_BATCH_COALESCE);
+        goto cleanup;
+    }
+
+    /* The timer keeps the client alive until the close hook removes it */
+    if (batch->timer == -1) {
+        if ((batch->timer = virEventAddTimeout(-1, remoteEventBatchTimer,
+                                               client,
+                                               virObjectFreeCallback)) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("could not initialize event batch timer"));
+            goto cleanup;
+        }
+        virObjectRef(client);
+    }
+
+    batch->enabled = true;
+    batch->flags = args->flags;
+
+    /* Clients new enough to batch also know about lost events */
+    virNetServerClientSetEventsLostFunc(client, remoteClientEventsLost);
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&batch->lock);
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectSharedRepliesEnable(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                         virNetServerClientPtr client,
+                                         virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                         virNetMessageErrorPtr rerr,
+                                         remote_connect_shared_replies_enable_args *args)
+{
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (virNetServerClientSetSharedReplies(client, args->min_size) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectListDomainChanges(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_list_domain_changes_args *args,
+                                       remote_connect_list_domain_changes_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    unsigned long long cursor = args->cursor;
+    virDomainPtr *changed = NULL;
+    virDomainPtr *removed = NULL;
+    int nchanged = 0;
+    size_t nremoved = 0;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((nchanged = virConnectListDomainChanges(priv->conn, &cursor,
+                                                &changed, &removed,
+                                                args->flags)) < 0)
+        goto cleanup;
+
+    while (removed && removed[nremoved])
+        nremoved++;
+
+    if (nchanged > REMOTE_DOMAIN_LIST_MAX ||
+        nremoved > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Too many domains '%zu' for limit '%d'"),
+                       nchanged > nremoved ? (size_t) nchanged : nremoved,
+                       REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (nchanged) {
+        if (VIR_ALLOC_N(ret->changed.changed_val, nchanged) < 0)
+            goto cleanup;
+
+        ret->changed.changed_len = nchanged;
+        for (i = 0; i < nchanged; i++)
+            make_nonnull_domain(ret->changed.changed_val + i, changed[i]);
+    }
+
+    if (nremoved) {
+        if (VIR_ALLOC_N(ret->removed.removed_val, nremoved) < 0)
+            goto cleanup;
+
+        ret->removed.removed_len = nremoved;
+        for (i = 0; i < nremoved; i++)
+            make_nonnull_domain(ret->removed.removed_val + i, removed[i]);
+    }
+
+    ret->cursor = cursor;
+    ret->resync = !removed;
+    ret->ret = nchanged;
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virObjectListFreeCount(changed, nchanged);
+    virObjectListFreeCount(removed, nremoved);
+    return rv;
+}
+
+
+static int
+remoteDispatchNodeAllocPages(virNetServerPtr server ATTRIBUTE_UNUSED,
+                             virNetServerClientPtr client,
+                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                             virNetMessageErrorPtr rerr,
+                             remote_node_alloc_pages_args *args,
+                             remote_node_alloc_pages_ret *ret)
+{
+    int rv = -1;
+    int len;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((len = virNodeAllocPages(priv->conn,
+                                 args->pageSizes.pageSizes_len,
+                                 args->pageSizes.pageSizes_val,
+                                 (unsigned long long *) args->pageCounts.pageCounts_val,
+                                 args->startCell,
+                                 args->cellCount,
                                  args->flags)) < 0)
         goto cleanup;
 
@@ -6897,6 +8058,44 @@ remoteDispatchStorageVolGetInfoFlags(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+static int
+remoteDispatchStorageVolGetJobInfo(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   remote_storage_vol_get_job_info_args *args,
+                                   remote_storage_vol_get_job_info_ret *ret)
+{
+    int rv = -1;
+    virStorageVolPtr vol = NULL;
+    virStorageVolJobInfo tmp;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(vol = get_nonnull_storage_vol(priv->conn, args->vol)))
+        goto cleanup;
+
+    if (virStorageVolGetJobInfo(vol, &tmp, args->flags) < 0)
+        goto cleanup;
+
+    ret->type = tmp.type;
+    ret->processed = tmp.processed;
+    ret->total = tmp.total;
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virObjectUnref(vol);
+    return rv;
+}
+
+
 /*----- Helpers. -----*/
 
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
@@ -906,12 +906,12 @@ daemonStreamHandleRead(virNetServerClientPtr client,
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
         stream->refs++;
-        if (virNetServerProgramSendStreamData(remoteProgram,
-                                              client,
-                                              msg,
-                                              stream->procedure,
-                                              stream->serial,
-                                              buffer, rv) < 0)
+        if (virNetServerProgramSendStreamBuffer(remoteProgram,
+                                                client,
+                                                msg,
+                                                stream->procedure,
+                                                stream->serial,
+                                                &buffer, rv) < 0)
             goto cleanup;
         msg = NULL;
     }
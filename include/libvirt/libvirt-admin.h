@@ -189,6 +189,44 @@ virAdmServerPtr virAdmConnectLookupServer(virAdmConnectPtr conn,
 
 # define VIR_THREADPOOL_JOB_QUEUE_DEPTH "jobQueueDepth"
 
+/**
+ * VIR_THREADPOOL_MESSAGE_POOL_HITS:
+ * Macro for the msgPoolHits attribute: represents the number of RPC
+ * messages and message buffers which were handed out by the server from its
+ * pool of recycled ones, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_MESSAGE_POOL_HITS "msgPoolHits"
+
+/**
+ * VIR_THREADPOOL_MESSAGE_POOL_MISSES:
+ * Macro for the msgPoolMisses attribute: represents the number of RPC
+ * messages and message buffers which the server had to allocate because its
+ * pool of recycled ones was empty, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_THREADPOOL_MESSAGE_POOL_MISSES "msgPoolMisses"
+
+/**
+ * VIR_THREADPOOL_JOB_LATENCY_PREFIX:
+ * Prefix of the threadpool job latency histogram attributes. For each job
+ * priority level (normal, high, urgent) the daemon reports the number of
+ * jobs which waited in the queue for less than 1ms, 10ms, 100ms, 1s, 10s or
+ * longer ("inf") before a worker picked them up, as VIR_TYPED_PARAM_ULLONG
+ * named "jobLatency.<priority>.<bucket>", e.g. "jobLatency.high.10ms".
+ *
+ * NOTE: These attributes are read-only and any attempt to set them will be
+ * denied by daemon
+ */
+
+# define VIR_THREADPOOL_JOB_LATENCY_PREFIX "jobLatency."
+
 /* Tunables for a server workerpool */
 int virAdmServerGetThreadPoolParameters(virAdmServerPtr srv,
                                         virTypedParameterPtr *params,
@@ -345,6 +383,29 @@ virAdmServerLookupClient(virAdmServerPtr srv,
 
 # define VIR_CLIENT_INFO_SELINUX_CONTEXT "selinux_context"
 
+/**
+ * VIR_CLIENT_INFO_EVENTS_QUEUED:
+ * Macro represents the number of asynchronous event messages waiting to be
+ * sent to the client, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_EVENTS_QUEUED "events_queued"
+
+/**
+ * VIR_CLIENT_INFO_EVENTS_DROPPED:
+ * Macro represents the number of asynchronous event messages which were
+ * dropped because the client's event queue was full, as
+ * VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_EVENTS_DROPPED "events_dropped"
+
 int virAdmClientGetInfo(virAdmClientPtr client,
                         virTypedParameterPtr *params,
                         int *nparams,
@@ -420,6 +481,145 @@ int virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
                                    const char *filters,
                                    unsigned int flags);
 
+/**
+ * VIR_SERVER_PROCEDURE_STATS_COUNT:
+ * Macro for the number of procedures reported by
+ * virAdmServerGetProcedureStats, as VIR_TYPED_PARAM_UINT. Only procedures
+ * which were called at least once are reported.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_COUNT "proc.count"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_PREFIX:
+ * Prefix of the per procedure attributes reported by
+ * virAdmServerGetProcedureStats. For each procedure index <num> from 0 to
+ * VIR_SERVER_PROCEDURE_STATS_COUNT - 1 the following are reported:
+ *
+ *  "proc.<num>.program"   - RPC program number, as VIR_TYPED_PARAM_UINT
+ *  "proc.<num>.procedure" - procedure number within the program,
+ *                           as VIR_TYPED_PARAM_UINT
+ *  "proc.<num>.name"      - procedure name, as VIR_TYPED_PARAM_STRING
+ *  "proc.<num>.calls"     - number of calls, as VIR_TYPED_PARAM_ULLONG
+ *  "proc.<num>.errors"    - number of calls which failed,
+ *                           as VIR_TYPED_PARAM_ULLONG
+ *  "proc.<num>.bytesIn"   - bytes received in calls, as VIR_TYPED_PARAM_ULLONG
+ *  "proc.<num>.bytesOut"  - bytes sent in successful replies,
+ *                           as VIR_TYPED_PARAM_ULLONG
+ *  "proc.<num>.queueTime.<bucket>" - number of calls which waited for a
+ *                           worker for less than <bucket>,
+ *                           as VIR_TYPED_PARAM_ULLONG
+ *  "proc.<num>.execTime.<bucket>"  - number of calls which executed in less
+ *                           than <bucket>, as VIR_TYPED_PARAM_ULLONG
+ *
+ * where <bucket> is one of "10us", "100us", "1ms", "10ms", "100ms", "1s",
+ * "10s" and "inf", the last one counting all the slower calls.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_PREFIX "proc."
+
+int virAdmServerGetProcedureStats(virAdmServerPtr srv,
+                                  virTypedParameterPtr *params,
+                                  int *nparams,
+                                  unsigned int flags);
+
+int virAdmConnectGetLoggingRecorder(virAdmConnectPtr conn,
+                                    char **messages,
+                                    unsigned int flags);
+
+/**
+ * VIR_CONNECT_ALLOC_STATS_COUNT:
+ * Macro for the number of subsystems reported by
+ * virAdmConnectGetAllocStats, as VIR_TYPED_PARAM_UINT. Only subsystems
+ * which allocated memory at least once are reported.
+ */
+
+# define VIR_CONNECT_ALLOC_STATS_COUNT "alloc.count"
+
+/**
+ * VIR_CONNECT_ALLOC_STATS_PREFIX:
+ * Prefix of the per subsystem attributes reported by
+ * virAdmConnectGetAllocStats. For each subsystem index <num> from 0 to
+ * VIR_CONNECT_ALLOC_STATS_COUNT - 1 the following are reported:
+ *
+ *  "alloc.<num>.domain" - error domain of the subsystem (one of the
+ *                         virErrorDomain values), as VIR_TYPED_PARAM_UINT
+ *  "alloc.<num>.name"   - name of the subsystem, as VIR_TYPED_PARAM_STRING
+ *  "alloc.<num>.allocs" - number of allocations, as VIR_TYPED_PARAM_ULLONG
+ *  "alloc.<num>.bytes"  - number of bytes allocated,
+ *                         as VIR_TYPED_PARAM_ULLONG
+ */
+
+# define VIR_CONNECT_ALLOC_STATS_PREFIX "alloc."
+
+int virAdmConnectGetAllocStats(virAdmConnectPtr conn,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags);
+
+/**
+ * VIR_CONNECT_LOCK_STATS_COUNT:
+ * Macro for the number of object classes reported by
+ * virAdmConnectGetLockStats, as VIR_TYPED_PARAM_UINT. Only classes whose
+ * instances found their lock busy at least once are reported.
+ */
+
+# define VIR_CONNECT_LOCK_STATS_COUNT "lock.count"
+
+/**
+ * VIR_CONNECT_LOCK_STATS_PREFIX:
+ * Prefix of the per class attributes reported by
+ * virAdmConnectGetLockStats. For each class index <num> from 0 to
+ * VIR_CONNECT_LOCK_STATS_COUNT - 1 the following are reported:
+ *
+ *  "lock.<num>.class"     - name of the object class,
+ *                           as VIR_TYPED_PARAM_STRING
+ *  "lock.<num>.contended" - number of times the lock of an instance was
+ *                           held by another thread when acquiring it,
+ *                           as VIR_TYPED_PARAM_ULLONG
+ *  "lock.<num>.wait"      - total time spent waiting for those locks, in
+ *                           microseconds, as VIR_TYPED_PARAM_ULLONG
+ */
+
+# define VIR_CONNECT_LOCK_STATS_PREFIX "lock."
+
+/**
+ * VIR_CONNECT_LOCK_STATS_CALLSITE_COUNT:
+ * Macro for the number of source locations reported by
+ * virAdmConnectGetLockStats, as VIR_TYPED_PARAM_UINT. Locations are only
+ * collected when the daemon has lock_stats enabled, and only those which
+ * waited for a lock at least once are reported.
+ */
+
+# define VIR_CONNECT_LOCK_STATS_CALLSITE_COUNT "lock.callsite.count"
+
+/**
+ * VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX:
+ * Prefix of the per source location attributes reported by
+ * virAdmConnectGetLockStats. For each location index <num> from 0 to
+ * VIR_CONNECT_LOCK_STATS_CALLSITE_COUNT - 1 the following are reported:
+ *
+ *  "lock.callsite.<num>.file"      - source file of the code acquiring
+ *                                    the lock, as VIR_TYPED_PARAM_STRING
+ *  "lock.callsite.<num>.function"  - function acquiring the lock,
+ *                                    as VIR_TYPED_PARAM_STRING
+ *  "lock.callsite.<num>.line"      - line number, as VIR_TYPED_PARAM_UINT
+ *  "lock.callsite.<num>.contended" - number of times the lock was held by
+ *                                    another thread, as VIR_TYPED_PARAM_ULLONG
+ *  "lock.callsite.<num>.wait"      - total time spent waiting, in
+ *                                    microseconds, as VIR_TYPED_PARAM_ULLONG
+ *
+ * The daemon tracks a limited number of locations; an entry with an empty
+ * file name accounts for all the others.
+ */
+
+# define VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX "lock.callsite."
+
+int virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags);
+
 # ifdef __cplusplus
 }
 # endif
@@ -224,8 +224,10 @@ typedef enum {
 typedef struct _virDomainControlInfo virDomainControlInfo;
 struct _virDomainControlInfo {
     unsigned int state;     /* control state, one of virDomainControlState */
-    unsigned int details;   /* state details, currently 0 except for ERROR
-                               state (one of virDomainControlErrorReason) */
+    unsigned int details;   /* state details, one of virDomainControlErrorReason
+                               in ERROR state; in JOB and OCCUPIED states the
+                               number of jobs waiting to be started (if
+                               supported by the hypervisor); 0 otherwise */
     unsigned long long stateTime; /* for how long (in msec) control interface
                                      has been in current state (except for OK
                                      and ERROR states) */
@@ -823,6 +825,14 @@ typedef enum {
      */
     VIR_MIGRATE_TLS               = (1 << 16),
 
+    /* Send memory pages to the destination host through several connections.
+     * The number of connections may be set with the
+     * VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS parameter, otherwise the
+     * hypervisor default is used. This cannot be combined with
+     * VIR_MIGRATE_TUNNELLED.
+     */
+    VIR_MIGRATE_PARALLEL          = (1 << 17),
+
 } virDomainMigrateFlags;
 
 
@@ -1008,6 +1018,37 @@ typedef enum {
  */
 # define VIR_MIGRATE_PARAM_AUTO_CONVERGE_INCREMENT  "auto_converge.increment"
 
+/**
+ * VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS:
+ *
+ * virDomainMigrate* params field: number of connections used during parallel
+ * migration. As VIR_TYPED_PARAM_INT.
+ */
+# define VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS     "parallel.connections"
+
+/**
+ * VIR_MIGRATE_PARAM_CONVERGENCE_TIME:
+ *
+ * virDomainMigrate* params field: the total time (in milliseconds) a live
+ * migration should take. When set, the hypervisor driver watches every
+ * iteration of memory transfer and, if the migration is not going to finish
+ * in time, gradually raises the maximum downtime (up to
+ * VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME), throttles guest CPUs harder
+ * if VIR_MIGRATE_AUTO_CONVERGE was requested and finally switches to
+ * post-copy if VIR_MIGRATE_POSTCOPY was requested. As VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_MIGRATE_PARAM_CONVERGENCE_TIME         "convergence.time"
+
+/**
+ * VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME:
+ *
+ * virDomainMigrate* params field: the highest downtime (in milliseconds)
+ * the driver may allow while trying to finish the migration within
+ * VIR_MIGRATE_PARAM_CONVERGENCE_TIME. The default is 2000 ms. As
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME "convergence.max_downtime"
+
 /* Domain migration. */
 virDomainPtr virDomainMigrate (virDomainPtr domain, virConnectPtr dconn,
                                unsigned long flags, const char *dname,
@@ -1550,6 +1591,9 @@ typedef enum {
 
 char *                  virDomainGetXMLDesc     (virDomainPtr domain,
                                                  unsigned int flags);
+char *                  virDomainGetXMLDescSubtree(virDomainPtr domain,
+                                                   const char *subtree,
+                                                   unsigned int flags);
 
 
 char *                  virConnectDomainXMLFromNative(virConnectPtr conn,
@@ -1789,6 +1833,11 @@ typedef enum {
 int                     virConnectListAllDomains (virConnectPtr conn,
                                                   virDomainPtr **domains,
                                                   unsigned int flags);
+int                     virConnectListDomainChanges (virConnectPtr conn,
+                                                     unsigned long long *cursor,
+                                                     virDomainPtr **changed,
+                                                     virDomainPtr **removed,
+                                                     unsigned int flags);
 int                     virDomainCreate         (virDomainPtr domain);
 int                     virDomainCreateWithFlags (virDomainPtr domain,
                                                   unsigned int flags);
@@ -2021,6 +2070,10 @@ int virDomainDetachDeviceFlags(virDomainPtr domain,
                                const char *xml, unsigned int flags);
 int virDomainUpdateDeviceFlags(virDomainPtr domain,
                                const char *xml, unsigned int flags);
+int virDomainAttachDevices(virDomainPtr domain,
+                           const char **xmls,
+                           unsigned int nxmls,
+                           unsigned int flags);
 
 typedef struct _virDomainStatsRecord virDomainStatsRecord;
 typedef virDomainStatsRecord *virDomainStatsRecordPtr;
@@ -2038,6 +2091,9 @@ typedef enum {
     VIR_DOMAIN_STATS_INTERFACE = (1 << 4), /* return domain interfaces info */
     VIR_DOMAIN_STATS_BLOCK = (1 << 5), /* return domain block info */
     VIR_DOMAIN_STATS_PERF = (1 << 6), /* return domain perf event info */
+    VIR_DOMAIN_STATS_START = (1 << 7), /* return domain startup timing */
+    VIR_DOMAIN_STATS_GUEST = (1 << 8), /* return guest agent information */
+    VIR_DOMAIN_STATS_DIRTYRATE = (1 << 9), /* return domain dirty rate info */
 } virDomainStatsTypes;
 
 typedef enum {
@@ -2068,6 +2124,38 @@ int virDomainListGetStats(virDomainPtr *doms,
 
 void virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats);
 
+/**
+ * virConnectDomainStatsCallback:
+ * @conn: connection object
+ * @stats: array of stats records, one per domain
+ * @nstats: number of records in @stats
+ * @opaque: application specified data
+ *
+ * The callback signature to use when registering for periodic domain
+ * statistics with virConnectDomainStatsRegister(). @stats is owned by
+ * libvirt and only valid for the duration of the callback.
+ */
+typedef void (*virConnectDomainStatsCallback)(virConnectPtr conn,
+                                              virDomainStatsRecordPtr *stats,
+                                              int nstats,
+                                              void *opaque);
+
+int virConnectDomainStatsRegister(virConnectPtr conn,
+                                  unsigned int stats,
+                                  unsigned int interval,
+                                  virConnectDomainStatsCallback cb,
+                                  void *opaque,
+                                  virFreeCallback freecb,
+                                  unsigned int flags);
+int virConnectDomainStatsDeregister(virConnectPtr conn,
+                                    int callbackID);
+
+int virDomainGetStatsHistory(virDomainPtr dom,
+                             unsigned long long start,
+                             unsigned long long end,
+                             virDomainStatsRecordPtr **samples,
+                             unsigned int flags);
+
 /*
  * Perf Event API
  */
@@ -2335,6 +2423,9 @@ typedef enum {
      * exists as long as sync is active */
     VIR_DOMAIN_BLOCK_JOB_TYPE_ACTIVE_COMMIT = 4,
 
+    /* Block Backup (virDomainBlockBackup), job ends on completion */
+    VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP = 5,
+
 # ifdef VIR_ENUM_SENTINELS
     VIR_DOMAIN_BLOCK_JOB_TYPE_LAST
 # endif
@@ -2488,6 +2579,46 @@ int virDomainBlockCopy(virDomainPtr dom, const char *disk,
                        int nparams,
                        unsigned int flags);
 
+/**
+ * virDomainBlockBackupFlags:
+ *
+ * Flags available for virDomainBlockBackup().
+ */
+typedef enum {
+    VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT   = 1 << 0, /* Reuse existing external
+                                                     file for the backup */
+    VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL = 1 << 1, /* Copy only the clusters
+                                                     recorded in the dirty
+                                                     bitmap */
+} virDomainBlockBackupFlags;
+
+/**
+ * VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH:
+ * Macro for the virDomainBlockBackup bandwidth tunable: it represents
+ * the maximum bandwidth in bytes/s used while copying data to the
+ * backup target, with a type of ullong.  Specifying 0 is the same as
+ * omitting this parameter, to request no bandwidth limiting.  The
+ * bandwidth can later be changed via virDomainBlockJobSetSpeed().
+ */
+# define VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH "bandwidth"
+
+/**
+ * VIR_DOMAIN_BLOCK_BACKUP_BITMAP:
+ * Macro for the virDomainBlockBackup dirty bitmap name, as a string.
+ * With VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL, only clusters the named
+ * bitmap records as written are copied and the bitmap is cleared once
+ * the backup succeeds.  Without that flag a full backup is taken and a
+ * new bitmap with this name is created at the same point in time, so
+ * that the next incremental backup can build on top of it.
+ */
+# define VIR_DOMAIN_BLOCK_BACKUP_BITMAP "bitmap"
+
+int virDomainBlockBackup(virDomainPtr dom, const char *disk,
+                         const char *destxml,
+                         virTypedParameterPtr params,
+                         int nparams,
+                         unsigned int flags);
+
 /**
  * virDomainBlockCommitFlags:
  *
@@ -4756,4 +4887,26 @@ int virDomainSetLifecycleAction(virDomainPtr domain,
                                 unsigned int action,
                                 unsigned int flags);
 
+/**
+ * virDomainDirtyRateStatus:
+ *
+ * Status of the most recent dirty rate calculation of a domain.
+ */
+typedef enum {
+    VIR_DOMAIN_DIRTYRATE_UNSTARTED = 0, /* the dirty rate calculation has
+                                           not been started */
+    VIR_DOMAIN_DIRTYRATE_MEASURING = 1, /* the dirty rate calculation is
+                                           measuring */
+    VIR_DOMAIN_DIRTYRATE_MEASURED  = 2, /* the dirty rate calculation is
+                                           completed */
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_DOMAIN_DIRTYRATE_LAST
+# endif
+} virDomainDirtyRateStatus;
+
+int virDomainStartDirtyRateCalc(virDomainPtr domain,
+                                int seconds,
+                                unsigned int flags);
+
 #endif /* __VIR_LIBVIRT_DOMAIN_H__ */
@@ -167,6 +167,12 @@ typedef enum {
 # endif
 } virStorageVolWipeAlgorithm;
 
+typedef enum {
+    VIR_STORAGE_VOL_WIPE_ASYNC = 1 << 0, /* return once the wipe has been
+                                            started, finish it in the
+                                            background */
+} virStorageVolWipeFlags;
+
 typedef enum {
     VIR_STORAGE_VOL_USE_ALLOCATION = 0,
 
@@ -185,6 +191,31 @@ struct _virStorageVolInfo {
 
 typedef virStorageVolInfo *virStorageVolInfoPtr;
 
+/**
+ * virStorageVolJobType:
+ *
+ * Type of a background job running on a storage volume.
+ */
+typedef enum {
+    VIR_STORAGE_VOL_JOB_NONE = 0, /* no job is running */
+    VIR_STORAGE_VOL_JOB_BUILD = 1, /* volume is being created from another */
+    VIR_STORAGE_VOL_JOB_WIPE = 2, /* volume is being wiped */
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_STORAGE_VOL_JOB_LAST
+# endif
+} virStorageVolJobType;
+
+typedef struct _virStorageVolJobInfo virStorageVolJobInfo;
+
+struct _virStorageVolJobInfo {
+    int type;                      /* virStorageVolJobType */
+    unsigned long long processed;  /* Bytes processed so far */
+    unsigned long long total;      /* Bytes to process, 0 if unknown */
+};
+
+typedef virStorageVolJobInfo *virStorageVolJobInfoPtr;
+
 typedef enum {
     VIR_STORAGE_XML_INACTIVE    = (1 << 0), /* dump inactive pool/volume information */
 } virStorageXMLFlags;
@@ -284,6 +315,11 @@ int                     virStoragePoolDelete            (virStoragePoolPtr pool,
                                                          unsigned int flags);
 int                     virStoragePoolRef               (virStoragePoolPtr pool);
 int                     virStoragePoolFree              (virStoragePoolPtr pool);
+typedef enum {
+    VIR_STORAGE_POOL_REFRESH_INCREMENTAL = 1 << 0, /* only probe volumes whose
+                                                      files changed */
+} virStoragePoolRefreshFlags;
+
 int                     virStoragePoolRefresh           (virStoragePoolPtr pool,
                                                          unsigned int flags);
 
@@ -336,7 +372,11 @@ const char*             virStorageVolGetKey             (virStorageVolPtr vol);
 
 typedef enum {
     VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA = 1 << 0,
-    VIR_STORAGE_VOL_CREATE_REFLINK = 1 << 1, /* perform a btrfs lightweight copy */
+    VIR_STORAGE_VOL_CREATE_REFLINK = 1 << 1, /* perform a reflink (COW)
+                                                lightweight copy */
+    VIR_STORAGE_VOL_CREATE_ASYNC = 1 << 2, /* return once the volume has been
+                                              defined, copy the data in the
+                                              background */
 } virStorageVolCreateFlags;
 
 virStorageVolPtr        virStorageVolCreateXML          (virStoragePoolPtr pool,
@@ -349,6 +389,8 @@ virStorageVolPtr        virStorageVolCreateXMLFrom      (virStoragePoolPtr pool,
 
 typedef enum {
     VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM = 1 << 0, /* Use sparse stream */
+    VIR_STORAGE_VOL_DOWNLOAD_NOCACHE = 1 << 1, /* Don't keep the volume data
+                                                  in the host page cache */
 } virStorageVolDownloadFlags;
 
 int                     virStorageVolDownload           (virStorageVolPtr vol,
@@ -358,6 +400,8 @@ int                     virStorageVolDownload           (virStorageVolPtr vol,
                                                          unsigned int flags);
 typedef enum {
     VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM = 1 << 0,  /* Use sparse stream */
+    VIR_STORAGE_VOL_UPLOAD_NOCACHE = 1 << 1, /* Don't keep the volume data
+                                                in the host page cache */
 } virStorageVolUploadFlags;
 
 int                     virStorageVolUpload             (virStorageVolPtr vol,
@@ -380,6 +424,9 @@ int                     virStorageVolGetInfo            (virStorageVolPtr vol,
 int                     virStorageVolGetInfoFlags       (virStorageVolPtr vol,
                                                          virStorageVolInfoPtr info,
                                                          unsigned int flags);
+int                     virStorageVolGetJobInfo         (virStorageVolPtr vol,
+                                                         virStorageVolJobInfoPtr info,
+                                                         unsigned int flags);
 char *                  virStorageVolGetXMLDesc         (virStorageVolPtr pool,
                                                          unsigned int flags);
 
@@ -416,6 +463,7 @@ int virStoragePoolIsPersistent(virStoragePoolPtr pool);
 typedef enum {
     VIR_STORAGE_POOL_EVENT_ID_LIFECYCLE = 0, /* virConnectStoragePoolEventLifecycleCallback */
     VIR_STORAGE_POOL_EVENT_ID_REFRESH = 1, /* virConnectStoragePoolEventGenericCallback */
+    VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB = 2, /* virConnectStoragePoolEventVolumeJobCallback */
 
 # ifdef VIR_ENUM_SENTINELS
     VIR_STORAGE_POOL_EVENT_ID_LAST
@@ -494,4 +542,44 @@ typedef void (*virConnectStoragePoolEventLifecycleCallback)(virConnectPtr conn,
                                                             int detail,
                                                             void *opaque);
 
+/**
+ * virStoragePoolEventVolumeJobStatus:
+ *
+ * Outcome of a background volume job reported by
+ * VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB.
+ */
+typedef enum {
+    VIR_STORAGE_POOL_EVENT_VOLUME_JOB_COMPLETED = 0,
+    VIR_STORAGE_POOL_EVENT_VOLUME_JOB_FAILED = 1,
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_STORAGE_POOL_EVENT_VOLUME_JOB_LAST
+# endif
+} virStoragePoolEventVolumeJobStatus;
+
+/**
+ * virConnectStoragePoolEventVolumeJobCallback:
+ * @conn: connection object
+ * @pool: pool containing the volume
+ * @volume: name of the volume the job ran on
+ * @type: the virStorageVolJobType of the job
+ * @status: the virStoragePoolEventVolumeJobStatus of the job
+ * @opaque: application specified data
+ *
+ * This callback is called when a background volume job started with
+ * VIR_STORAGE_VOL_CREATE_ASYNC or VIR_STORAGE_VOL_WIPE_ASYNC finishes.
+ * If the job of type VIR_STORAGE_VOL_JOB_BUILD failed, the volume has
+ * already been deleted.
+ *
+ * The callback signature to use when registering for an event of type
+ * VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB with
+ * virConnectStoragePoolEventRegisterAny()
+ */
+typedef void (*virConnectStoragePoolEventVolumeJobCallback)(virConnectPtr conn,
+                                                            virStoragePoolPtr pool,
+                                                            const char *volume,
+                                                            int type,
+                                                            int status,
+                                                            void *opaque);
+
 #endif /* __VIR_LIBVIRT_STORAGE_H__ */
@@ -99,4 +99,39 @@ AC_DEFUN([LIBVIRT_CHECK_EXTERNAL_PROGRAMS], [
 
   AC_PATH_PROG([EBTABLES_PATH], [ebtables], [/sbin/ebtables], [$LIBVIRT_SBIN_PATH])
   AC_DEFINE_UNQUOTED([EBTABLES_PATH], ["$EBTABLES_PATH"], [path to ebtables binary])
+
+  AC_PATH_PROG([IPTABLES_NFT_PATH], [iptables-nft],
+               [/sbin/iptables-nft], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IPTABLES_NFT_PATH], ["$IPTABLES_NFT_PATH"],
+                     [path to iptables-nft binary])
+
+  AC_PATH_PROG([IP6TABLES_NFT_PATH], [ip6tables-nft],
+               [/sbin/ip6tables-nft], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IP6TABLES_NFT_PATH], ["$IP6TABLES_NFT_PATH"],
+                     [path to ip6tables-nft binary])
+
+  AC_PATH_PROG([EBTABLES_NFT_PATH], [ebtables-nft],
+               [/sbin/ebtables-nft], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([EBTABLES_NFT_PATH], ["$EBTABLES_NFT_PATH"],
+                     [path to ebtables-nft binary])
+
+  AC_PATH_PROG([IPTABLES_RESTORE_PATH], [iptables-restore],
+               [/sbin/iptables-restore], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IPTABLES_RESTORE_PATH], ["$IPTABLES_RESTORE_PATH"],
+                     [path to iptables-restore binary])
+
+  AC_PATH_PROG([IP6TABLES_RESTORE_PATH], [ip6tables-restore],
+               [/sbin/ip6tables-restore], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IP6TABLES_RESTORE_PATH], ["$IP6TABLES_RESTORE_PATH"],
+                     [path to ip6tables-restore binary])
+
+  AC_PATH_PROG([IPTABLES_NFT_RESTORE_PATH], [iptables-nft-restore],
+               [/sbin/iptables-nft-restore], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IPTABLES_NFT_RESTORE_PATH], ["$IPTABLES_NFT_RESTORE_PATH"],
+                     [path to iptables-nft-restore binary])
+
+  AC_PATH_PROG([IP6TABLES_NFT_RESTORE_PATH], [ip6tables-nft-restore],
+               [/sbin/ip6tables-nft-restore], [$LIBVIRT_SBIN_PATH])
+  AC_DEFINE_UNQUOTED([IP6TABLES_NFT_RESTORE_PATH], ["$IP6TABLES_NFT_RESTORE_PATH"],
+                     [path to ip6tables-nft-restore binary])
 ])
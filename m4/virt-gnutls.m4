@@ -64,6 +64,9 @@ AC_DEFUN([LIBVIRT_CHECK_GNUTLS],[
 
     AC_CHECK_FUNCS([gnutls_rnd])
     AC_CHECK_FUNCS([gnutls_cipher_encrypt])
+    AC_CHECK_FUNCS([gnutls_session_ticket_key_generate \
+                    gnutls_session_ticket_enable_server \
+                    gnutls_session_get_data2])
     CFLAGS="$OLD_CFLAGS"
     LIBS="$OLD_LIBS"
   fi
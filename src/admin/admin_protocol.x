@@ -48,6 +48,15 @@ const ADMIN_CLIENT_INFO_PARAMETERS_MAX = 64;
 /* Upper limit on number of client processing controls */
 const ADMIN_SERVER_CLIENT_LIMITS_MAX = 32;
 
+/* Upper limit on number of procedure statistics parameters */
+const ADMIN_SERVER_PROCEDURE_STATS_MAX = 65536;
+
+/* Upper limit on number of allocation statistics parameters */
+const ADMIN_CONNECT_ALLOC_STATS_MAX = 1024;
+
+/* Upper limit on number of lock statistics parameters */
+const ADMIN_CONNECT_LOCK_STATS_MAX = 4096;
+
 /* A long string, which may NOT be NULL. */
 typedef string admin_nonnull_string<ADMIN_STRING_MAX>;
 
@@ -211,6 +220,39 @@ struct admin_connect_set_logging_filters_args {
     unsigned int flags;
 };
 
+struct admin_server_get_procedure_stats_args {
+    admin_nonnull_server srv;
+    unsigned int flags;
+};
+
+struct admin_server_get_procedure_stats_ret {
+    admin_typed_param params<ADMIN_SERVER_PROCEDURE_STATS_MAX>;
+};
+
+struct admin_connect_get_logging_recorder_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_logging_recorder_ret {
+    admin_nonnull_string messages;
+};
+
+struct admin_connect_get_alloc_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_alloc_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_ALLOC_STATS_MAX>;
+};
+
+struct admin_connect_get_lock_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_lock_stats_ret {
+    admin_typed_param params<ADMIN_CONNECT_LOCK_STATS_MAX>;
+};
+
 /* Define the program number, protocol version and procedure numbers here. */
 const ADMIN_PROGRAM = 0x06900690;
 const ADMIN_PROTOCOL_VERSION = 1;
@@ -316,5 +358,25 @@ enum admin_procedure {
     /**
      * @generate: both
      */
-    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17
+    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_GET_PROCEDURE_STATS = 18,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_LOGGING_RECORDER = 19,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_ALLOC_STATS = 20,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_LOCK_STATS = 21
 };
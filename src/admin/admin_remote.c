@@ -495,3 +495,152 @@ remoteAdminConnectGetLoggingFilters(virAdmConnectPtr conn,
     virObjectUnlock(priv);
     return rv;
 }
+
+static int
+remoteAdminConnectGetLoggingRecorder(virAdmConnectPtr conn,
+                                     char **messages,
+                                     unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_get_logging_recorder_args args;
+    admin_connect_get_logging_recorder_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_GET_LOGGING_RECORDER,
+             (xdrproc_t) xdr_admin_connect_get_logging_recorder_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_logging_recorder_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    VIR_STEAL_PTR(*messages, ret.messages);
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_logging_recorder_ret, (char *) &ret);
+
+ done:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminServerGetProcedureStats(virAdmServerPtr srv,
+                                   virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags)
+{
+    int rv = -1;
+    admin_server_get_procedure_stats_args args;
+    admin_server_get_procedure_stats_ret ret;
+    remoteAdminPrivPtr priv = srv->conn->privateData;
+    args.flags = flags;
+    make_nonnull_server(&args.srv, srv);
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(srv->conn, 0, ADMIN_PROC_SERVER_GET_PROCEDURE_STATS,
+             (xdrproc_t) xdr_admin_server_get_procedure_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_server_get_procedure_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_SERVER_PROCEDURE_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_server_get_procedure_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminConnectGetAllocStats(virAdmConnectPtr conn,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    int rv = -1;
+    admin_connect_get_alloc_stats_args args;
+    admin_connect_get_alloc_stats_ret ret;
+    remoteAdminPrivPtr priv = conn->privateData;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn, 0, ADMIN_PROC_CONNECT_GET_ALLOC_STATS,
+             (xdrproc_t) xdr_admin_connect_get_alloc_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_alloc_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_CONNECT_ALLOC_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_alloc_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminConnectGetLockStats(virAdmConnectPtr conn,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int rv = -1;
+    admin_connect_get_lock_stats_args args;
+    admin_connect_get_lock_stats_ret ret;
+    remoteAdminPrivPtr priv = conn->privateData;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn, 0, ADMIN_PROC_CONNECT_GET_LOCK_STATS,
+             (xdrproc_t) xdr_admin_connect_get_lock_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_lock_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_CONNECT_LOCK_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_lock_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
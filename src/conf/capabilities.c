@@ -1461,6 +1461,8 @@ virCapabilitiesInitNUMA(virCapsPtr caps)
     if ((max_node = virNumaGetMaxNode()) < 0)
         goto cleanup;
 
+    virHostCPUTopologyRefresh();
+
     for (n = 0; n <= max_node; n++) {
         size_t i;
 
@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <strings.h>
+
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
@@ -355,31 +357,38 @@ virDomainPCIAddressBusSetModel(virDomainPCIAddressBusPtr bus,
 }
 
 
-bool
-virDomainPCIAddressBusIsFullyReserved(virDomainPCIAddressBusPtr bus)
+/* Returns the mask of slots on @bus from @minSlot up to the bus' maxSlot */
+static uint32_t
+virDomainPCIAddressBusSlotMask(virDomainPCIAddressBusPtr bus,
+                               size_t minSlot)
 {
-    size_t i;
+    uint32_t mask;
 
-    for (i = bus->minSlot; i <= bus->maxSlot; i++) {
-        if (!bus->slot[i].functions)
-            return false;
-    }
+    if (minSlot > bus->maxSlot)
+        return 0;
 
-    return true;
+    mask = UINT32_MAX << minSlot;
+    if (bus->maxSlot < VIR_PCI_ADDRESS_SLOT_LAST)
+        mask &= ~(UINT32_MAX << (bus->maxSlot + 1));
+
+    return mask;
 }
 
 
 bool
-virDomainPCIAddressBusIsEmpty(virDomainPCIAddressBusPtr bus)
+virDomainPCIAddressBusIsFullyReserved(virDomainPCIAddressBusPtr bus)
 {
-    size_t i;
+    uint32_t mask = virDomainPCIAddressBusSlotMask(bus, bus->minSlot);
 
-    for (i = bus->minSlot; i <= bus->maxSlot; i++) {
-        if (bus->slot[i].functions)
-            return false;
-    }
+    return (bus->usedSlots & mask) == mask;
+}
 
-    return true;
+
+bool
+virDomainPCIAddressBusIsEmpty(virDomainPCIAddressBusPtr bus)
+{
+    return !(bus->usedSlots &
+             virDomainPCIAddressBusSlotMask(bus, bus->minSlot));
 }
 
 
@@ -622,6 +631,7 @@ virDomainPCIAddressReserveAddrInternal(virDomainPCIAddressSetPtr addrs,
 
     /* mark the requested function as reserved */
     bus->slot[addr->slot].functions |= (1 << addr->function);
+    bus->usedSlots |= (1U << addr->slot);
     VIR_DEBUG("Reserving PCI address %s (aggregate='%s')", addrStr,
               bus->slot[addr->slot].aggregate ? "true" : "false");
 
@@ -691,7 +701,11 @@ void
 virDomainPCIAddressReleaseAddr(virDomainPCIAddressSetPtr addrs,
                                virPCIDeviceAddressPtr addr)
 {
-    addrs->buses[addr->bus].slot[addr->slot].functions &= ~(1 << addr->function);
+    virDomainPCIAddressBusPtr bus = &addrs->buses[addr->bus];
+
+    bus->slot[addr->slot].functions &= ~(1 << addr->function);
+    if (!bus->slot[addr->slot].functions)
+        bus->usedSlots &= ~(1U << addr->slot);
 }
 
 virDomainPCIAddressSetPtr
@@ -732,18 +746,27 @@ virDomainPCIAddressFindUnusedFunctionOnBus(virDomainPCIAddressBusPtr bus,
                                            virDomainPCIConnectFlags flags,
                                            bool *found)
 {
-    int ret = -1;
-    char *addrStr = NULL;
-
     *found = false;
 
-    if (!(addrStr = virDomainPCIAddressAsString(searchAddr)))
-        goto cleanup;
-
-    if (!virDomainPCIAddressFlagsCompatible(searchAddr, addrStr, bus->flags,
+    /* The address string is only needed for error reporting, which
+     * is disabled here */
+    if (!virDomainPCIAddressFlagsCompatible(searchAddr, NULL, bus->flags,
                                             flags, false, false)) {
         VIR_DEBUG("PCI bus %.4x:%.2x is not compatible with the device",
                   searchAddr->domain, searchAddr->bus);
+    } else if (!(flags & VIR_PCI_CONNECT_AGGREGATE_SLOT)) {
+        /* Only a completely unused slot will do, so there's no need to
+         * look at the individual slots */
+        uint32_t freeSlots = ~bus->usedSlots &
+            virDomainPCIAddressBusSlotMask(bus, searchAddr->slot);
+
+        if (freeSlots) {
+            searchAddr->slot = ffs(freeSlots) - 1;
+            *found = true;
+        } else {
+            VIR_DEBUG("PCI bus %.4x:%.2x has no unused slot",
+                      searchAddr->domain, searchAddr->bus);
+        }
     } else {
         while (searchAddr->slot <= bus->maxSlot) {
             if (bus->slot[searchAddr->slot].functions == 0) {
@@ -784,11 +807,7 @@ virDomainPCIAddressFindUnusedFunctionOnBus(virDomainPCIAddressBusPtr bus,
         }
     }
 
-    ret = 0;
-
- cleanup:
-    VIR_FREE(addrStr);
-    return ret;
+    return 0;
 }
 
 
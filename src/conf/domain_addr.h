@@ -101,6 +101,12 @@ typedef struct {
      */
     virDomainPCIAddressSlot slot[VIR_PCI_ADDRESS_SLOT_LAST + 1];
 
+    /* Each bit represents one slot; it is set if any function of
+     * that slot is in use. Kept in sync with slot[].functions so that
+     * free slots can be found without walking the whole bus.
+     */
+    uint32_t usedSlots;
+
     /* See virDomainDeviceInfo::isolationGroup */
     unsigned int isolationGroup;
 
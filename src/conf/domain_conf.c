@@ -59,6 +59,7 @@
 #include "virnetdevmacvlan.h"
 #include "virhostdev.h"
 #include "virmdev.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -83,6 +84,9 @@ struct _virDomainXMLOption {
 
     /* Private data for save image stored in snapshot XML */
     virSaveCookieCallbacks saveCookie;
+
+    /* Compiled XPath expressions shared by all parsers */
+    virXPathCachePtr xpathCache;
 };
 
 #define VIR_DOMAIN_DEF_FORMAT_COMMON_FLAGS \
@@ -103,6 +107,17 @@ VIR_ENUM_IMPL(virDomainTaint, VIR_DOMAIN_TAINT_LAST,
               "custom-dtb",
               "custom-ga-command");
 
+VIR_ENUM_IMPL(virDomainDefSubtree, VIR_DOMAIN_DEF_SUBTREE_LAST,
+              "metadata",
+              "devices/disk",
+              "devices/controller",
+              "devices/filesystem",
+              "devices/interface",
+              "devices/channel",
+              "devices/graphics",
+              "devices/video",
+              "devices/hostdev");
+
 VIR_ENUM_IMPL(virDomainVirt, VIR_DOMAIN_VIRT_LAST,
               "none",
               "qemu",
@@ -897,7 +912,7 @@ VIR_ENUM_IMPL(virDomainHPTResizing,
  * <mirror> XML (remaining types are not two-phase). */
 VIR_ENUM_DECL(virDomainBlockJob)
 VIR_ENUM_IMPL(virDomainBlockJob, VIR_DOMAIN_BLOCK_JOB_TYPE_LAST,
-              "", "", "copy", "", "active-commit")
+              "", "", "copy", "", "active-commit", "")
 
 VIR_ENUM_IMPL(virDomainMemoryModel,
               VIR_DOMAIN_MEMORY_MODEL_LAST,
@@ -915,8 +930,26 @@ static virClassPtr virDomainXMLOptionClass;
 static void virDomainObjDispose(void *obj);
 static void virDomainXMLOptionClassDispose(void *obj);
 
+/* Change counter shared by all domain objects. It is seeded from the
+ * wall clock so that generations handed out to clients before a daemon
+ * restart are never mistaken for current ones. */
+static virMutex virDomainObjGenerationLock = VIR_MUTEX_INITIALIZER;
+static unsigned long long virDomainObjGenerationCounter;
+
 static int virDomainObjOnceInit(void)
 {
+    unsigned long long now;
+
+    if (virTimeMicrosNowRaw(&now) < 0) {
+        virReportSystemError(errno, "%s", _("cannot get current time"));
+        return -1;
+    }
+
+    virMutexLock(&virDomainObjGenerationLock);
+    if (virDomainObjGenerationCounter < now)
+        virDomainObjGenerationCounter = now;
+    virMutexUnlock(&virDomainObjGenerationLock);
+
     if (!(virDomainObjClass = virClassNew(virClassForObjectLockable(),
                                           "virDomainObj",
                                           sizeof(virDomainObj),
@@ -935,6 +968,77 @@ static int virDomainObjOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(virDomainObj)
 
 
+/**
+ * virDomainObjGetGeneration:
+ *
+ * Returns the most recent generation assigned to any domain object by
+ * virDomainObjBumpGeneration(), or 0 on failure. The value only ever
+ * grows, so any object with a generation greater than a value obtained
+ * earlier has changed since.
+ */
+unsigned long long
+virDomainObjGetGeneration(void)
+{
+    unsigned long long ret;
+
+    if (virDomainObjInitialize() < 0)
+        return 0;
+
+    virMutexLock(&virDomainObjGenerationLock);
+    ret = virDomainObjGenerationCounter;
+    virMutexUnlock(&virDomainObjGenerationLock);
+
+    return ret;
+}
+
+
+/**
+ * virDomainObjNextGeneration:
+ *
+ * Allocates a new, unique generation. Returns 0 on failure.
+ */
+unsigned long long
+virDomainObjNextGeneration(void)
+{
+    unsigned long long ret;
+
+    if (virDomainObjInitialize() < 0)
+        return 0;
+
+    virMutexLock(&virDomainObjGenerationLock);
+    ret = ++virDomainObjGenerationCounter;
+    virMutexUnlock(&virDomainObjGenerationLock);
+
+    return ret;
+}
+
+
+/**
+ * virDomainObjBumpGeneration:
+ * @obj: locked domain object
+ *
+ * Mark @obj as changed, for the benefit of incremental listing of
+ * domains.
+ */
+void
+virDomainObjBumpGeneration(virDomainObjPtr obj)
+{
+    obj->generation = virDomainObjNextGeneration();
+}
+
+
+/*
+ * Note that the persistent definition of @obj may have changed. This
+ * errs on the safe side and is also done when a caller merely got hold
+ * of the definition it could modify.
+ */
+static void
+virDomainObjBumpDefGeneration(virDomainObjPtr obj)
+{
+    obj->defGeneration = virDomainObjNextGeneration();
+}
+
+
 static void
 virDomainXMLOptionClassDispose(void *obj)
 {
@@ -942,6 +1046,8 @@ virDomainXMLOptionClassDispose(void *obj)
 
     if (xmlopt->config.privFree)
         (xmlopt->config.privFree)(xmlopt->config.priv);
+
+    virObjectUnref(xmlopt->xpathCache);
 }
 
 /**
@@ -1085,6 +1191,11 @@ virDomainXMLOptionNew(virDomainDefParserConfigPtr config,
     if (!(xmlopt = virObjectNew(virDomainXMLOptionClass)))
         return NULL;
 
+    if (!(xmlopt->xpathCache = virXPathCacheNew())) {
+        virObjectUnref(xmlopt);
+        return NULL;
+    }
+
     if (priv)
         xmlopt->privateData = *priv;
 
@@ -1825,13 +1936,13 @@ int
 virDomainDiskSetDriver(virDomainDiskDefPtr def, const char *name)
 {
     int ret;
-    char *tmp = def->src->driverName;
+    const char *tmp = def->src->driverName;
 
-    ret = VIR_STRDUP(def->src->driverName, name);
+    ret = virStringIntern(&def->src->driverName, name);
     if (ret < 0)
         def->src->driverName = tmp;
     else
-        VIR_FREE(tmp);
+        virStringInternFree(tmp);
     return ret;
 }
 
@@ -2773,6 +2884,18 @@ virDomainIOThreadIDDefArrayFree(virDomainIOThreadIDDefPtr *def,
 }
 
 
+static void
+virDomainResctrlDefFree(virDomainResctrlDefPtr resctrl)
+{
+    if (!resctrl)
+        return;
+
+    virObjectUnref(resctrl->alloc);
+    virBitmapFree(resctrl->vcpus);
+    VIR_FREE(resctrl);
+}
+
+
 static int
 virDomainIOThreadIDDefArrayInit(virDomainDefPtr def,
                                 unsigned int iothreads)
@@ -2859,6 +2982,265 @@ virDomainLoaderDefFree(virDomainLoaderDefPtr loader)
     VIR_FREE(loader);
 }
 
+/* Below this many disks, interfaces and host devices altogether
+ * scanning the arrays is no slower than maintaining an index */
+#define VIR_DOMAIN_DEF_INDEX_MIN_DEVICES 32
+
+typedef enum {
+    VIR_DOMAIN_DEF_INDEX_DISK_TARGET,
+    VIR_DOMAIN_DEF_INDEX_NET_MAC,
+    VIR_DOMAIN_DEF_INDEX_ALIAS,
+} virDomainDefIndexTable;
+
+typedef struct _virDomainDefIndexEntry virDomainDefIndexEntry;
+typedef virDomainDefIndexEntry *virDomainDefIndexEntryPtr;
+struct _virDomainDefIndexEntry {
+    virDomainDeviceType type; /* DISK, NET or HOSTDEV */
+    size_t idx;
+};
+
+/*
+ * Hash indexes of the disks, interfaces and host devices of a domain
+ * definition by target, MAC address and alias.
+ *
+ * The device arrays are modified directly all over the tree, so the
+ * index is not updated along with them. Instead it is rebuilt on the
+ * next lookup after the arrays were reallocated or resized, every hit
+ * is checked against the device it points to, and a device missing
+ * from the index is looked up by scanning the arrays as before, which
+ * also marks the index for rebuilding. A stale index thus costs an
+ * extra scan and rebuild but never yields a device which doesn't match.
+ */
+struct _virDomainDefIndex {
+    virMutex lock;
+    bool valid;
+
+    /* the arrays the index was built from */
+    virDomainDiskDefPtr *disks;
+    size_t ndisks;
+    virDomainNetDefPtr *nets;
+    size_t nnets;
+    virDomainHostdevDefPtr *hostdevs;
+    size_t nhostdevs;
+
+    virDomainDefIndexEntryPtr entries;
+    virHashTablePtr disksByTarget;
+    virHashTablePtr netsByMAC;
+    virHashTablePtr byAlias;
+};
+
+/* stored for keys shared by more than one device */
+static virDomainDefIndexEntry virDomainDefIndexAmbiguous;
+
+
+static virDomainDefIndexPtr
+virDomainDefIndexNew(void)
+{
+    virDomainDefIndexPtr index;
+
+    if (VIR_ALLOC(index) < 0)
+        return NULL;
+
+    if (virMutexInit(&index->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+
+static void
+virDomainDefIndexClear(virDomainDefIndexPtr index)
+{
+    index->valid = false;
+    VIR_FREE(index->entries);
+    virHashFree(index->disksByTarget);
+    virHashFree(index->netsByMAC);
+    virHashFree(index->byAlias);
+    index->disksByTarget = NULL;
+    index->netsByMAC = NULL;
+    index->byAlias = NULL;
+}
+
+
+static void
+virDomainDefIndexFree(virDomainDefIndexPtr index)
+{
+    if (!index)
+        return;
+
+    virDomainDefIndexClear(index);
+    virMutexDestroy(&index->lock);
+    VIR_FREE(index);
+}
+
+
+/* Adds @entry under @key, the first device with the key wins unless
+ * @markAmbiguous is set */
+static int
+virDomainDefIndexAdd(virHashTablePtr table,
+                     const char *key,
+                     virDomainDefIndexEntryPtr entry,
+                     bool markAmbiguous)
+{
+    if (!key)
+        return 0;
+
+    if (virHashLookup(table, key)) {
+        if (markAmbiguous)
+            return virHashUpdateEntry(table, key, &virDomainDefIndexAmbiguous);
+        return 0;
+    }
+
+    return virHashAddEntry(table, key, entry);
+}
+
+
+/*
+ * Makes sure the index of @def matches its device arrays, with the
+ * index lock held. Returns false if the index should not be used.
+ */
+static bool
+virDomainDefIndexRefresh(virDomainDefPtr def)
+{
+    virDomainDefIndexPtr index = def->index;
+    virDomainDefIndexEntryPtr entry;
+    char mac[VIR_MAC_STRING_BUFLEN];
+    virErrorPtr orig_err = NULL;
+    size_t i;
+
+    if (def->ndisks + def->nnets + def->nhostdevs <
+        VIR_DOMAIN_DEF_INDEX_MIN_DEVICES)
+        return false;
+
+    if (index->valid &&
+        index->disks == def->disks && index->ndisks == def->ndisks &&
+        index->nets == def->nets && index->nnets == def->nnets &&
+        index->hostdevs == def->hostdevs &&
+        index->nhostdevs == def->nhostdevs)
+        return true;
+
+    virDomainDefIndexClear(index);
+    orig_err = virSaveLastError();
+
+    if (VIR_ALLOC_N(index->entries,
+                    def->ndisks + def->nnets + def->nhostdevs) < 0 ||
+        !(index->disksByTarget = virHashCreate(def->ndisks, NULL)) ||
+        !(index->netsByMAC = virHashCreate(def->nnets, NULL)) ||
+        !(index->byAlias = virHashCreate(def->ndisks + def->nnets +
+                                         def->nhostdevs, NULL)))
+        goto error;
+
+    /* in the order virDomainDefFindDevice looks at the devices */
+    entry = index->entries;
+    for (i = 0; i < def->ndisks; i++, entry++) {
+        entry->type = VIR_DOMAIN_DEVICE_DISK;
+        entry->idx = i;
+        if (virDomainDefIndexAdd(index->disksByTarget, def->disks[i]->dst,
+                                 entry, false) < 0 ||
+            virDomainDefIndexAdd(index->byAlias, def->disks[i]->info.alias,
+                                 entry, false) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < def->nnets; i++, entry++) {
+        entry->type = VIR_DOMAIN_DEVICE_NET;
+        entry->idx = i;
+        virMacAddrFormat(&def->nets[i]->mac, mac);
+        if (virDomainDefIndexAdd(index->netsByMAC, mac, entry, true) < 0 ||
+            virDomainDefIndexAdd(index->byAlias, def->nets[i]->info.alias,
+                                 entry, false) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < def->nhostdevs; i++, entry++) {
+        entry->type = VIR_DOMAIN_DEVICE_HOSTDEV;
+        entry->idx = i;
+        if (virDomainDefIndexAdd(index->byAlias, def->hostdevs[i]->info->alias,
+                                 entry, false) < 0)
+            goto error;
+    }
+
+    index->disks = def->disks;
+    index->ndisks = def->ndisks;
+    index->nets = def->nets;
+    index->nnets = def->nnets;
+    index->hostdevs = def->hostdevs;
+    index->nhostdevs = def->nhostdevs;
+    index->valid = true;
+    virFreeError(orig_err);
+    return true;
+
+ error:
+    /* lookups don't fail, they just won't use the index */
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    } else {
+        virResetLastError();
+    }
+    virDomainDefIndexClear(index);
+    return false;
+}
+
+
+/*
+ * Looks up @key in @table of the index of @def and copies the entry
+ * found to @entry. Returns false if the arrays need to be scanned.
+ */
+static bool
+virDomainDefIndexLookup(virDomainDefPtr def,
+                        virDomainDefIndexTable table,
+                        const char *key,
+                        virDomainDefIndexEntryPtr entry)
+{
+    virDomainDefIndexPtr index = def->index;
+    virDomainDefIndexEntryPtr found = NULL;
+
+    if (!index || !key)
+        return false;
+
+    virMutexLock(&index->lock);
+
+    if (virDomainDefIndexRefresh(def)) {
+        switch (table) {
+        case VIR_DOMAIN_DEF_INDEX_DISK_TARGET:
+            found = virHashLookup(index->disksByTarget, key);
+            break;
+        case VIR_DOMAIN_DEF_INDEX_NET_MAC:
+            found = virHashLookup(index->netsByMAC, key);
+            break;
+        case VIR_DOMAIN_DEF_INDEX_ALIAS:
+            found = virHashLookup(index->byAlias, key);
+            break;
+        }
+
+        if (found == &virDomainDefIndexAmbiguous)
+            found = NULL;
+        if (found)
+            *entry = *found;
+    }
+
+    virMutexUnlock(&index->lock);
+    return !!found;
+}
+
+
+/* Makes the next lookup rebuild the index of @def */
+static void
+virDomainDefIndexInvalidate(virDomainDefPtr def)
+{
+    if (!def->index)
+        return;
+
+    virMutexLock(&def->index->lock);
+    def->index->valid = false;
+    virMutexUnlock(&def->index->lock);
+}
+
 void virDomainDefFree(virDomainDefPtr def)
 {
     size_t i;
@@ -3021,6 +3403,10 @@ void virDomainDefFree(virDomainDefPtr def)
 
     virBitmapFree(def->cputune.emulatorpin);
 
+    for (i = 0; i < def->nresctrls; i++)
+        virDomainResctrlDefFree(def->resctrls[i]);
+    VIR_FREE(def->resctrls);
+
     virDomainNumaFree(def->numa);
 
     virSysinfoDefFree(def->sysinfo);
@@ -3038,6 +3424,8 @@ void virDomainDefFree(virDomainDefPtr def)
 
     xmlFreeNode(def->metadata);
 
+    virDomainDefIndexFree(def->index);
+
     VIR_FREE(def);
 }
 
@@ -3049,6 +3437,7 @@ static void virDomainObjDispose(void *obj)
     virCondDestroy(&dom->cond);
     virDomainDefFree(dom->def);
     virDomainDefFree(dom->newDef);
+    VIR_FREE(dom->compactConfig);
 
     if (dom->privateDataFreeFunc)
         (dom->privateDataFreeFunc)(dom->privateData);
@@ -3107,6 +3496,9 @@ virDomainDefNew(void)
     if (!(ret->numa = virDomainNumaNew()))
         goto error;
 
+    if (!(ret->index = virDomainDefIndexNew()))
+        goto error;
+
     ret->mem.hard_limit = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
     ret->mem.soft_limit = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
     ret->mem.swap_hard_limit = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
@@ -3168,8 +3560,12 @@ void virDomainObjAssignDef(virDomainObjPtr domain,
             else
                 virDomainDefFree(domain->def);
             domain->def = def;
+            VIR_FREE(domain->compactConfig);
         }
     }
+
+    virDomainObjBumpGeneration(domain);
+    virDomainObjBumpDefGeneration(domain);
 }
 
 
@@ -3313,6 +3709,8 @@ virDomainObjGetPersistentDef(virCapsPtr caps,
         virDomainObjSetDefTransient(caps, xmlopt, domain) < 0)
         return NULL;
 
+    virDomainObjBumpDefGeneration(domain);
+
     if (domain->newDef)
         return domain->newDef;
     else
@@ -3408,6 +3806,9 @@ virDomainObjGetDefs(virDomainObjPtr vm,
             *persDef = vm->def;
     }
 
+    if (persDef && *persDef)
+        virDomainObjBumpDefGeneration(vm);
+
     return 0;
 }
 
@@ -3452,6 +3853,9 @@ virDomainObjGetOneDefState(virDomainObjPtr vm,
             *live = false;
     }
 
+    if (!virDomainObjIsActive(vm) || flags & VIR_DOMAIN_AFFECT_CONFIG)
+        virDomainObjBumpDefGeneration(vm);
+
     if (virDomainObjIsActive(vm) && flags & VIR_DOMAIN_AFFECT_CONFIG)
         return vm->newDef;
     else
@@ -8988,7 +9392,10 @@ virDomainDiskDefDriverParseXML(virDomainDiskDefPtr def,
     char *tmp = NULL;
     int ret = -1;
 
-    def->src->driverName = virXMLPropString(cur, "name");
+    tmp = virXMLPropString(cur, "name");
+    if (virDomainDiskSetDriver(def, tmp) < 0)
+        goto cleanup;
+    VIR_FREE(tmp);
 
     if ((tmp = virXMLPropString(cur, "cache")) &&
         (def->cachemode = virDomainDiskCacheTypeFromString(tmp)) < 0) {
@@ -15393,6 +15800,7 @@ virDomainDeviceDefParse(const char *xmlStr,
     if (!(xml = virXMLParseStringCtxt(xmlStr, _("(device_definition)"), &ctxt)))
         goto error;
 
+    virXPathContextSetCache(ctxt, xmlopt->xpathCache);
     node = ctxt->node;
 
     if (VIR_ALLOC(dev) < 0)
@@ -15916,9 +16324,17 @@ virDomainDiskIndexByName(virDomainDefPtr def, const char *name,
                          bool allow_ambiguous)
 {
     virDomainDiskDefPtr vdisk;
+    virDomainDefIndexEntry entry;
     size_t i;
     int candidate = -1;
 
+    if (*name != '/' &&
+        virDomainDefIndexLookup(def, VIR_DOMAIN_DEF_INDEX_DISK_TARGET,
+                                name, &entry) &&
+        entry.idx < def->ndisks &&
+        STREQ(def->disks[entry.idx]->dst, name))
+        return entry.idx;
+
     /* We prefer the <target dev='name'/> name (it's shorter, required
      * for all disks, and should be unambiguous), but also support
      * <source file='name'/> (if unambiguous).  Assume dst if there is
@@ -15926,8 +16342,10 @@ virDomainDiskIndexByName(virDomainDefPtr def, const char *name,
     for (i = 0; i < def->ndisks; i++) {
         vdisk = def->disks[i];
         if (*name != '/') {
-            if (STREQ(vdisk->dst, name))
+            if (STREQ(vdisk->dst, name)) {
+                virDomainDefIndexInvalidate(def);
                 return i;
+            }
         } else if (STREQ_NULLABLE(virDomainDiskGetSource(vdisk), name)) {
             if (allow_ambiguous)
                 return i;
@@ -15959,6 +16377,38 @@ virDomainDiskByName(virDomainDefPtr def,
     return idx < 0 ? NULL : def->disks[idx];
 }
 
+
+/**
+ * virDomainDiskByAlias:
+ * @def: domain definition
+ * @alias: device alias
+ *
+ * Returns the first disk of @def with @alias, or NULL.
+ */
+virDomainDiskDefPtr
+virDomainDiskByAlias(virDomainDefPtr def,
+                     const char *alias)
+{
+    virDomainDefIndexEntry entry;
+    size_t i;
+
+    if (virDomainDefIndexLookup(def, VIR_DOMAIN_DEF_INDEX_ALIAS,
+                                alias, &entry) &&
+        entry.type == VIR_DOMAIN_DEVICE_DISK &&
+        entry.idx < def->ndisks &&
+        STREQ_NULLABLE(def->disks[entry.idx]->info.alias, alias))
+        return def->disks[entry.idx];
+
+    for (i = 0; i < def->ndisks; i++) {
+        if (STREQ_NULLABLE(def->disks[i]->info.alias, alias)) {
+            virDomainDefIndexInvalidate(def);
+            return def->disks[i];
+        }
+    }
+
+    return NULL;
+}
+
 int virDomainDiskInsert(virDomainDefPtr def,
                         virDomainDiskDefPtr disk)
 {
@@ -16058,10 +16508,25 @@ virDomainNetFindIdx(virDomainDefPtr def, virDomainNetDefPtr net)
     size_t i;
     int matchidx = -1;
     char mac[VIR_MAC_STRING_BUFLEN];
+    virDomainDefIndexEntry entry;
     bool MACAddrSpecified = !net->mac.generated;
     bool PCIAddrSpecified = virDomainDeviceAddressIsValid(&net->info,
                                                           VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI);
 
+    /* The index only knows MAC addresses used by a single interface,
+     * which spares the scan for duplicates */
+    if (MACAddrSpecified &&
+        virDomainDefIndexLookup(def, VIR_DOMAIN_DEF_INDEX_NET_MAC,
+                                virMacAddrFormat(&net->mac, mac), &entry) &&
+        entry.idx < def->nnets &&
+        virMacAddrCmp(&def->nets[entry.idx]->mac, &net->mac) == 0) {
+        if (!PCIAddrSpecified ||
+            virPCIDeviceAddressEqual(&def->nets[entry.idx]->info.addr.pci,
+                                     &net->info.addr.pci))
+            matchidx = entry.idx;
+        goto done;
+    }
+
     for (i = 0; i < def->nnets; i++) {
         if (MACAddrSpecified &&
             virMacAddrCmp(&def->nets[i]->mac, &net->mac) != 0)
@@ -16094,6 +16559,10 @@ virDomainNetFindIdx(virDomainDefPtr def, virDomainNetDefPtr net)
         matchidx = i;
     }
 
+    if (matchidx >= 0 && MACAddrSpecified)
+        virDomainDefIndexInvalidate(def);
+
+ done:
     if (matchidx < 0) {
         if (MACAddrSpecified && PCIAddrSpecified) {
             virReportError(VIR_ERR_OPERATION_FAILED,
@@ -17802,62 +18271,308 @@ virDomainIOThreadSchedParse(xmlNodePtr node,
 }
 
 
-static int
-virDomainVcpuParse(virDomainDefPtr def,
-                   xmlXPathContextPtr ctxt,
-                   virDomainXMLOptionPtr xmlopt)
+/*
+ * Find the resctrl group for the vcpus of @node, creating it when
+ * there's none yet.  Groups must not share any vcpu.
+ */
+static virDomainResctrlDefPtr
+virDomainResctrlGetOrNew(xmlNodePtr node,
+                         virDomainDefPtr def)
 {
-    int n;
-    xmlNodePtr *nodes = NULL;
-    xmlNodePtr vcpuNode;
+    virDomainResctrlDefPtr resctrl = NULL;
+    virBitmapPtr vcpus = NULL;
+    char *vcpus_str = NULL;
+    char *id = NULL;
     size_t i;
-    char *tmp = NULL;
-    unsigned int maxvcpus;
-    unsigned int vcpus;
-    int ret = -1;
 
-    vcpus = maxvcpus = 1;
+    if ((vcpus_str = virXMLPropString(node, "vcpus"))) {
+        if (virBitmapParse(vcpus_str, &vcpus, VIR_DOMAIN_CPUMASK_LEN) < 0)
+            goto cleanup;
 
-    if ((vcpuNode = virXPathNode("./vcpu[1]", ctxt))) {
-        if ((tmp = virXMLNodeContentString(vcpuNode))) {
-            if (virStrToLong_ui(tmp, NULL, 10, &maxvcpus) < 0) {
-                virReportError(VIR_ERR_XML_ERROR, "%s",
-                               _("maximum vcpus count must be an integer"));
-                goto cleanup;
-            }
-            VIR_FREE(tmp);
+        if (virBitmapIsAllClear(vcpus)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("'vcpus' bitmap '%s' of <%s> is empty"),
+                           vcpus_str, node->name);
+            goto cleanup;
         }
 
-        if ((tmp = virXMLPropString(vcpuNode, "current"))) {
-            if (virStrToLong_ui(tmp, NULL, 10, &vcpus) < 0) {
-                virReportError(VIR_ERR_XML_ERROR, "%s",
-                               _("current vcpus count must be an integer"));
-                goto cleanup;
-            }
-            VIR_FREE(tmp);
-        } else {
-            vcpus = maxvcpus;
+        if (virBitmapLastSetBit(vcpus) >= virDomainDefGetVcpusMax(def)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("'vcpus' bitmap '%s' of <%s> exceeds the "
+                             "<vcpu> count"),
+                           vcpus_str, node->name);
+            goto cleanup;
         }
+    }
 
-        tmp = virXMLPropString(vcpuNode, "placement");
-        if (tmp) {
-            if ((def->placement_mode =
-                 virDomainCpuPlacementModeTypeFromString(tmp)) < 0) {
-                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                               _("Unsupported CPU placement mode '%s'"),
-                               tmp);
-                goto cleanup;
-            }
-            VIR_FREE(tmp);
-        } else {
-            def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_STATIC;
-        }
+    for (i = 0; i < def->nresctrls; i++) {
+        virDomainResctrlDefPtr tmp = def->resctrls[i];
 
-        if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
-            tmp = virXMLPropString(vcpuNode, "cpuset");
-            if (tmp) {
-                if (virBitmapParse(tmp, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
-                    goto cleanup;
+        if (virBitmapEqual(tmp->vcpus, vcpus)) {
+            resctrl = tmp;
+            goto cleanup;
+        }
+
+        if (tmp->vcpus && vcpus && virBitmapOverlaps(tmp->vcpus, vcpus)) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("'vcpus' of <%s> must not overlap"),
+                           node->name);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC(resctrl) < 0 ||
+        !(resctrl->alloc = virResctrlAllocNew()))
+        goto error;
+
+    if (vcpus) {
+        char *fmt;
+
+        if (!(fmt = virBitmapFormat(vcpus)) ||
+            virAsprintf(&id, "vcpus_%s", fmt) < 0) {
+            VIR_FREE(fmt);
+            goto error;
+        }
+        VIR_FREE(fmt);
+    } else if (VIR_STRDUP(id, "domain") < 0) {
+        goto error;
+    }
+
+    if (virResctrlAllocSetID(resctrl->alloc, id) < 0)
+        goto error;
+
+    VIR_STEAL_PTR(resctrl->vcpus, vcpus);
+
+    if (VIR_APPEND_ELEMENT_COPY(def->resctrls, def->nresctrls, resctrl) < 0)
+        goto error;
+
+ cleanup:
+    virBitmapFree(vcpus);
+    VIR_FREE(vcpus_str);
+    VIR_FREE(id);
+    return resctrl;
+
+ error:
+    virDomainResctrlDefFree(resctrl);
+    resctrl = NULL;
+    goto cleanup;
+}
+
+
+static int
+virDomainCachetuneDefParseCache(xmlNodePtr node,
+                                virResctrlAllocPtr alloc)
+{
+    char *tmp = NULL;
+    char *unit = NULL;
+    unsigned int level;
+    unsigned int cache;
+    int type;
+    unsigned long long size;
+    int ret = -1;
+
+    if (!(tmp = virXMLPropString(node, "id")) ||
+        virStrToLong_uip(tmp, NULL, 10, &cache) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid or missing attribute 'id' of <cache>: '%s'"),
+                       NULLSTR(tmp));
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    if (!(tmp = virXMLPropString(node, "level")) ||
+        virStrToLong_uip(tmp, NULL, 10, &level) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid or missing attribute 'level' of <cache>: '%s'"),
+                       NULLSTR(tmp));
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    if (!(tmp = virXMLPropString(node, "type")) ||
+        (type = virCacheTypeFromString(tmp)) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid or missing attribute 'type' of <cache>: '%s'"),
+                       NULLSTR(tmp));
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    if (!(tmp = virXMLPropString(node, "size")) ||
+        virStrToLong_ullp(tmp, NULL, 10, &size) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid or missing attribute 'size' of <cache>: '%s'"),
+                       NULLSTR(tmp));
+        goto cleanup;
+    }
+
+    unit = virXMLPropString(node, "unit");
+    if (virScaleInteger(&size, unit, 1024, ULLONG_MAX) < 0)
+        goto cleanup;
+
+    if (virResctrlAllocSetCacheSize(alloc, level, type, cache, size) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(unit);
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
+static int
+virDomainCachetuneDefParse(virDomainDefPtr def,
+                           xmlXPathContextPtr ctxt,
+                           xmlNodePtr node)
+{
+    xmlNodePtr oldnode = ctxt->node;
+    xmlNodePtr *nodes = NULL;
+    virDomainResctrlDefPtr resctrl;
+    size_t i;
+    int n;
+    int ret = -1;
+
+    ctxt->node = node;
+
+    if (!(resctrl = virDomainResctrlGetOrNew(node, def)))
+        goto cleanup;
+
+    if ((n = virXPathNodeSet("./cache", ctxt, &nodes)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        if (virDomainCachetuneDefParseCache(nodes[i], resctrl->alloc) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    ctxt->node = oldnode;
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
+static int
+virDomainMemorytuneDefParse(virDomainDefPtr def,
+                            xmlXPathContextPtr ctxt,
+                            xmlNodePtr node)
+{
+    xmlNodePtr oldnode = ctxt->node;
+    xmlNodePtr *nodes = NULL;
+    virDomainResctrlDefPtr resctrl;
+    char *tmp = NULL;
+    size_t i;
+    int n;
+    int ret = -1;
+
+    ctxt->node = node;
+
+    if (!(resctrl = virDomainResctrlGetOrNew(node, def)))
+        goto cleanup;
+
+    if (virResctrlAllocHasMemoryBandwidth(resctrl->alloc)) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("only one <memorytune> per set of vcpus is supported"));
+        goto cleanup;
+    }
+
+    if ((n = virXPathNodeSet("./node", ctxt, &nodes)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        unsigned int id;
+        unsigned int bandwidth;
+
+        if (!(tmp = virXMLPropString(nodes[i], "id")) ||
+            virStrToLong_uip(tmp, NULL, 10, &id) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("Invalid or missing attribute 'id' of <node>: '%s'"),
+                           NULLSTR(tmp));
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+
+        if (!(tmp = virXMLPropString(nodes[i], "bandwidth")) ||
+            virStrToLong_uip(tmp, NULL, 10, &bandwidth) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("Invalid or missing attribute 'bandwidth' of <node>: '%s'"),
+                           NULLSTR(tmp));
+            goto cleanup;
+        }
+        VIR_FREE(tmp);
+
+        if (virResctrlAllocSetMemoryBandwidth(resctrl->alloc, id,
+                                              bandwidth) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    ctxt->node = oldnode;
+    VIR_FREE(tmp);
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
+static int
+virDomainVcpuParse(virDomainDefPtr def,
+                   xmlXPathContextPtr ctxt,
+                   virDomainXMLOptionPtr xmlopt)
+{
+    int n;
+    xmlNodePtr *nodes = NULL;
+    xmlNodePtr vcpuNode;
+    size_t i;
+    char *tmp = NULL;
+    unsigned int maxvcpus;
+    unsigned int vcpus;
+    int ret = -1;
+
+    vcpus = maxvcpus = 1;
+
+    if ((vcpuNode = virXPathNode("./vcpu[1]", ctxt))) {
+        if ((tmp = virXMLNodeContentString(vcpuNode))) {
+            if (virStrToLong_ui(tmp, NULL, 10, &maxvcpus) < 0) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("maximum vcpus count must be an integer"));
+                goto cleanup;
+            }
+            VIR_FREE(tmp);
+        }
+
+        if ((tmp = virXMLPropString(vcpuNode, "current"))) {
+            if (virStrToLong_ui(tmp, NULL, 10, &vcpus) < 0) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("current vcpus count must be an integer"));
+                goto cleanup;
+            }
+            VIR_FREE(tmp);
+        } else {
+            vcpus = maxvcpus;
+        }
+
+        tmp = virXMLPropString(vcpuNode, "placement");
+        if (tmp) {
+            if ((def->placement_mode =
+                 virDomainCpuPlacementModeTypeFromString(tmp)) < 0) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Unsupported CPU placement mode '%s'"),
+                               tmp);
+                goto cleanup;
+            }
+            VIR_FREE(tmp);
+        } else {
+            def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_STATIC;
+        }
+
+        if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
+            tmp = virXMLPropString(vcpuNode, "cpuset");
+            if (tmp) {
+                if (virBitmapParse(tmp, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+                    goto cleanup;
 
                 if (virBitmapIsAllClear(def->cpumask)) {
                     virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
@@ -18655,6 +19370,30 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./cputune/cachetune", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract cachetune nodes"));
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainCachetuneDefParse(def, ctxt, nodes[i]) < 0)
+            goto error;
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./cputune/memorytune", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract memorytune nodes"));
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainMemorytuneDefParse(def, ctxt, nodes[i]) < 0)
+            goto error;
+    }
+    VIR_FREE(nodes);
+
     if (virCPUDefParseXML(ctxt, "./cpu[1]", VIR_CPU_TYPE_GUEST, &def->cpu) < 0)
         goto error;
 
@@ -19983,6 +20722,7 @@ virDomainDefParseNode(xmlDocPtr xml,
         goto cleanup;
     }
 
+    virXPathContextSetCache(ctxt, xmlopt->xpathCache);
     ctxt->node = root;
     def = virDomainDefParseXML(xml, root, ctxt, caps, xmlopt, parseOpaque, flags);
 
@@ -20015,6 +20755,7 @@ virDomainObjParseNode(xmlDocPtr xml,
         goto cleanup;
     }
 
+    virXPathContextSetCache(ctxt, xmlopt->xpathCache);
     ctxt->node = root;
     obj = virDomainObjParseXML(xml, ctxt, caps, xmlopt, flags);
 
@@ -25497,45 +26238,136 @@ virDomainSchedulerFormat(virBufferPtr buf,
 
 
 static int
-virDomainCputuneDefFormat(virBufferPtr buf,
-                          virDomainDefPtr def)
+virDomainCachetuneDefFormatHelper(unsigned int level,
+                                  virCacheType type,
+                                  unsigned int cache,
+                                  unsigned long long size,
+                                  void *opaque)
 {
-    size_t i;
-    virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
-    int ret = -1;
+    virBufferPtr buf = opaque;
+    const char *units[] = { "B", "KiB", "MiB", "GiB" };
+    size_t unit = 0;
 
-    virBufferSetChildIndent(&childrenBuf, buf);
+    /* Use the largest unit the size is a whole multiple of */
+    while (unit + 1 < ARRAY_CARDINALITY(units) && size % 1024 == 0) {
+        size /= 1024;
+        unit++;
+    }
 
-    if (def->cputune.sharesSpecified)
-        virBufferAsprintf(&childrenBuf, "<shares>%llu</shares>\n",
-                          def->cputune.shares);
-    if (def->cputune.period)
-        virBufferAsprintf(&childrenBuf, "<period>%llu</period>\n",
-                          def->cputune.period);
-    if (def->cputune.quota)
-        virBufferAsprintf(&childrenBuf, "<quota>%lld</quota>\n",
-                          def->cputune.quota);
-    if (def->cputune.global_period)
-        virBufferAsprintf(&childrenBuf, "<global_period>%llu</global_period>\n",
-                          def->cputune.global_period);
-    if (def->cputune.global_quota)
-        virBufferAsprintf(&childrenBuf, "<global_quota>%lld</global_quota>\n",
-                          def->cputune.global_quota);
+    virBufferAsprintf(buf,
+                      "<cache id='%u' level='%u' type='%s' "
+                      "size='%llu' unit='%s'/>\n",
+                      cache, level, virCacheTypeToString(type),
+                      size, units[unit]);
 
-    if (def->cputune.emulator_period)
-        virBufferAsprintf(&childrenBuf, "<emulator_period>%llu"
-                          "</emulator_period>\n",
-                          def->cputune.emulator_period);
+    return 0;
+}
 
-    if (def->cputune.emulator_quota)
-        virBufferAsprintf(&childrenBuf, "<emulator_quota>%lld"
-                          "</emulator_quota>\n",
-                          def->cputune.emulator_quota);
 
-    if (def->cputune.iothread_period)
-        virBufferAsprintf(&childrenBuf, "<iothread_period>%llu"
-                          "</iothread_period>\n",
-                          def->cputune.iothread_period);
+static int
+virDomainMemorytuneDefFormatHelper(unsigned int node,
+                                   unsigned int bandwidth,
+                                   void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    virBufferAsprintf(buf, "<node id='%u' bandwidth='%u'/>\n",
+                      node, bandwidth);
+
+    return 0;
+}
+
+
+static int
+virDomainResctrlDefFormatOne(virBufferPtr buf,
+                             virDomainResctrlDefPtr resctrl,
+                             const char *name,
+                             bool memory)
+{
+    virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
+    char *vcpus = NULL;
+    int ret = -1;
+
+    virBufferSetChildIndent(&childrenBuf, buf);
+
+    if (memory) {
+        if (virResctrlAllocForeachMemory(resctrl->alloc,
+                                         virDomainMemorytuneDefFormatHelper,
+                                         &childrenBuf) < 0)
+            goto cleanup;
+    } else {
+        if (virResctrlAllocForeachCache(resctrl->alloc,
+                                        virDomainCachetuneDefFormatHelper,
+                                        &childrenBuf) < 0)
+            goto cleanup;
+    }
+
+    if (virBufferCheckError(&childrenBuf) < 0)
+        goto cleanup;
+
+    if (!virBufferUse(&childrenBuf)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virBufferAsprintf(buf, "<%s", name);
+    if (resctrl->vcpus) {
+        if (!(vcpus = virBitmapFormat(resctrl->vcpus)))
+            goto cleanup;
+        virBufferAsprintf(buf, " vcpus='%s'", vcpus);
+    }
+    virBufferAddLit(buf, ">\n");
+    virBufferAddBuffer(buf, &childrenBuf);
+    virBufferAsprintf(buf, "</%s>\n", name);
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&childrenBuf);
+    VIR_FREE(vcpus);
+    return ret;
+}
+
+
+static int
+virDomainCputuneDefFormat(virBufferPtr buf,
+                          virDomainDefPtr def)
+{
+    size_t i;
+    virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
+    int ret = -1;
+
+    virBufferSetChildIndent(&childrenBuf, buf);
+
+    if (def->cputune.sharesSpecified)
+        virBufferAsprintf(&childrenBuf, "<shares>%llu</shares>\n",
+                          def->cputune.shares);
+    if (def->cputune.period)
+        virBufferAsprintf(&childrenBuf, "<period>%llu</period>\n",
+                          def->cputune.period);
+    if (def->cputune.quota)
+        virBufferAsprintf(&childrenBuf, "<quota>%lld</quota>\n",
+                          def->cputune.quota);
+    if (def->cputune.global_period)
+        virBufferAsprintf(&childrenBuf, "<global_period>%llu</global_period>\n",
+                          def->cputune.global_period);
+    if (def->cputune.global_quota)
+        virBufferAsprintf(&childrenBuf, "<global_quota>%lld</global_quota>\n",
+                          def->cputune.global_quota);
+
+    if (def->cputune.emulator_period)
+        virBufferAsprintf(&childrenBuf, "<emulator_period>%llu"
+                          "</emulator_period>\n",
+                          def->cputune.emulator_period);
+
+    if (def->cputune.emulator_quota)
+        virBufferAsprintf(&childrenBuf, "<emulator_quota>%lld"
+                          "</emulator_quota>\n",
+                          def->cputune.emulator_quota);
+
+    if (def->cputune.iothread_period)
+        virBufferAsprintf(&childrenBuf, "<iothread_period>%llu"
+                          "</iothread_period>\n",
+                          def->cputune.iothread_period);
 
     if (def->cputune.iothread_quota)
         virBufferAsprintf(&childrenBuf, "<iothread_quota>%lld"
@@ -25597,6 +26429,18 @@ virDomainCputuneDefFormat(virBufferPtr buf,
                                  def->iothreadids[i]->iothread_id);
     }
 
+    for (i = 0; i < def->nresctrls; i++) {
+        if (virDomainResctrlDefFormatOne(&childrenBuf, def->resctrls[i],
+                                         "cachetune", false) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < def->nresctrls; i++) {
+        if (virDomainResctrlDefFormatOne(&childrenBuf, def->resctrls[i],
+                                         "memorytune", true) < 0)
+            goto cleanup;
+    }
+
     if (virBufferCheckError(&childrenBuf) < 0)
         return -1;
 
@@ -25726,6 +26570,34 @@ virDomainIOMMUDefFormat(virBufferPtr buf,
 }
 
 
+static int
+virDomainDefMetadataFormat(virBufferPtr buf,
+                           virDomainDefPtr def)
+{
+    xmlBufferPtr xmlbuf;
+    int oldIndentTreeOutput = xmlIndentTreeOutput;
+
+    /* Indentation on output requires that we previously set
+     * xmlKeepBlanksDefault to 0 when parsing; also, libxml does 2
+     * spaces per level of indentation of intermediate elements,
+     * but no leading indentation before the starting element.
+     * Thankfully, libxml maps what looks like globals into
+     * thread-local uses, so we are thread-safe.  */
+    xmlIndentTreeOutput = 1;
+    xmlbuf = xmlBufferCreate();
+    if (xmlNodeDump(xmlbuf, def->metadata->doc, def->metadata,
+                    virBufferGetIndent(buf, false) / 2, 1) < 0) {
+        xmlBufferFree(xmlbuf);
+        xmlIndentTreeOutput = oldIndentTreeOutput;
+        return -1;
+    }
+    virBufferAsprintf(buf, "%s\n", (char *) xmlBufferContent(xmlbuf));
+    xmlBufferFree(xmlbuf);
+    xmlIndentTreeOutput = oldIndentTreeOutput;
+    return 0;
+}
+
+
 /* This internal version appends to an existing buffer
  * (possibly with auto-indent), rather than flattening
  * to string.
@@ -25779,28 +26651,9 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     virBufferEscapeString(buf, "<description>%s</description>\n",
                           def->description);
 
-    if (def->metadata) {
-        xmlBufferPtr xmlbuf;
-        int oldIndentTreeOutput = xmlIndentTreeOutput;
-
-        /* Indentation on output requires that we previously set
-         * xmlKeepBlanksDefault to 0 when parsing; also, libxml does 2
-         * spaces per level of indentation of intermediate elements,
-         * but no leading indentation before the starting element.
-         * Thankfully, libxml maps what looks like globals into
-         * thread-local uses, so we are thread-safe.  */
-        xmlIndentTreeOutput = 1;
-        xmlbuf = xmlBufferCreate();
-        if (xmlNodeDump(xmlbuf, def->metadata->doc, def->metadata,
-                        virBufferGetIndent(buf, false) / 2, 1) < 0) {
-            xmlBufferFree(xmlbuf);
-            xmlIndentTreeOutput = oldIndentTreeOutput;
-            goto error;
-        }
-        virBufferAsprintf(buf, "%s\n", (char *) xmlBufferContent(xmlbuf));
-        xmlBufferFree(xmlbuf);
-        xmlIndentTreeOutput = oldIndentTreeOutput;
-    }
+    if (def->metadata &&
+        virDomainDefMetadataFormat(buf, def) < 0)
+        goto error;
 
     if (virDomainDefHasMemoryHotplug(def)) {
         virBufferAsprintf(buf,
@@ -26559,6 +27412,152 @@ virDomainDefFormat(virDomainDefPtr def, virCapsPtr caps, unsigned int flags)
 }
 
 
+/**
+ * virDomainDefFormatSubtree:
+ * @def: domain definition
+ * @caps: capabilities, may be NULL
+ * @path: subtree to format, see virDomainDefSubtree
+ * @flags: bitwise-OR of VIR_DOMAIN_DEF_FORMAT_SECURE and
+ *         VIR_DOMAIN_DEF_FORMAT_INACTIVE
+ *
+ * Formats only the part of the domain XML selected by @path, without
+ * the rest of the definition. Devices are wrapped in a <devices/>
+ * element, each formatted exactly as virDomainDefFormat would.
+ *
+ * Returns the XML string or NULL on error.
+ */
+char *
+virDomainDefFormatSubtree(virDomainDefPtr def,
+                          virCapsPtr caps,
+                          const char *path,
+                          unsigned int flags)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
+    char *netprefix = NULL;
+    int subtree;
+    size_t i;
+
+    virCheckFlags(VIR_DOMAIN_DEF_FORMAT_SECURE |
+                  VIR_DOMAIN_DEF_FORMAT_INACTIVE, NULL);
+
+    if ((subtree = virDomainDefSubtreeTypeFromString(path)) < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("unsupported domain XML subtree '%s'"), path);
+        return NULL;
+    }
+
+    if (def->id == -1)
+        flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE;
+
+    if (subtree == VIR_DOMAIN_DEF_SUBTREE_METADATA) {
+        if (!def->metadata)
+            virBufferAddLit(&buf, "<metadata/>\n");
+        else if (virDomainDefMetadataFormat(&buf, def) < 0)
+            goto error;
+
+        if (virBufferCheckError(&buf) < 0)
+            goto error;
+
+        return virBufferContentAndReset(&buf);
+    }
+
+    if (caps)
+        netprefix = caps->host.netprefix;
+
+    virBufferSetChildIndent(&childrenBuf, &buf);
+
+    switch ((virDomainDefSubtree) subtree) {
+    case VIR_DOMAIN_DEF_SUBTREE_DISK:
+        for (i = 0; i < def->ndisks; i++) {
+            if (virDomainDiskDefFormat(&childrenBuf, def->disks[i], flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_CONTROLLER:
+        for (i = 0; i < def->ncontrollers; i++) {
+            if (virDomainControllerDefFormat(&childrenBuf, def->controllers[i],
+                                             flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_FILESYSTEM:
+        for (i = 0; i < def->nfss; i++) {
+            if (virDomainFSDefFormat(&childrenBuf, def->fss[i], flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_INTERFACE:
+        for (i = 0; i < def->nnets; i++) {
+            if (virDomainNetDefFormat(&childrenBuf, def->nets[i],
+                                      netprefix, flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_CHANNEL:
+        for (i = 0; i < def->nchannels; i++) {
+            if (virDomainChrDefFormat(&childrenBuf, def->channels[i], flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_GRAPHICS:
+        for (i = 0; i < def->ngraphics; i++) {
+            if (virDomainGraphicsDefFormat(&childrenBuf, def->graphics[i],
+                                           flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_VIDEO:
+        for (i = 0; i < def->nvideos; i++) {
+            if (virDomainVideoDefFormat(&childrenBuf, def->videos[i], flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_HOSTDEV:
+        for (i = 0; i < def->nhostdevs; i++) {
+            /* hostdevs of other devices are formatted by their owner */
+            if (def->hostdevs[i]->parent.type == VIR_DOMAIN_DEVICE_NONE &&
+                virDomainHostdevDefFormat(&childrenBuf, def->hostdevs[i],
+                                          flags) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_DEF_SUBTREE_METADATA:
+    case VIR_DOMAIN_DEF_SUBTREE_LAST:
+        break;
+    }
+
+    if (virBufferCheckError(&childrenBuf) < 0)
+        goto error;
+
+    if (virBufferUse(&childrenBuf)) {
+        virBufferAddLit(&buf, "<devices>\n");
+        virBufferAddBuffer(&buf, &childrenBuf);
+        virBufferAddLit(&buf, "</devices>\n");
+    } else {
+        virBufferAddLit(&buf, "<devices/>\n");
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto error;
+
+    return virBufferContentAndReset(&buf);
+
+ error:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(&childrenBuf);
+    return NULL;
+}
+
+
 char *
 virDomainObjFormat(virDomainXMLOptionPtr xmlopt,
                    virDomainObjPtr obj,
@@ -26750,6 +27749,9 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     int ret = -1;
     char *xml;
 
+    /* The status is saved whenever the live definition changed */
+    virDomainObjBumpGeneration(obj);
+
     if (!(xml = virDomainObjFormat(xmlopt, obj, caps, flags)))
         goto cleanup;
 
@@ -27094,60 +28096,1527 @@ virDomainDiskDefForeachPath(virDomainDiskDefPtr disk,
 }
 
 
-/* Copy src into a new definition; with the quality of the copy
- * depending on the migratable flag (false for transitions between
- * persistent and active, true for transitions across save files or
- * snapshots).  */
-virDomainDefPtr
-virDomainDefCopy(virDomainDefPtr src,
-                 virCapsPtr caps,
-                 virDomainXMLOptionPtr xmlopt,
-                 void *parseOpaque,
-                 bool migratable)
+/*
+ * Native copy of domain definitions
+ *
+ * virDomainDefCopy used to format the definition into XML and parse it
+ * back.  The functions below produce the same definition by copying the
+ * structures directly, which is considerably cheaper for large guests.
+ * Since callers rely on the semantics of the round trip, the copy drops
+ * everything the XML round trip would drop: runtime only data such as
+ * aliases, PTY paths or generated ports does not survive, just as if
+ * the definition had been parsed as inactive XML.
+ *
+ * Definitions using features which are not (yet) handled here are
+ * copied through XML as before; see virDomainDefCopyNativeSupported.
+ * Any new member of virDomainDef has to be either copied or rejected
+ * there, domaindefcopytest checks all the XML files of the parser tests
+ * to catch the ones that are left out.
+ */
+
+static bool
+virDomainDefCopyNativeSupported(const virDomainDef *def,
+                                bool migratable)
 {
-    char *xml;
-    virDomainDefPtr ret;
-    unsigned int format_flags = VIR_DOMAIN_DEF_FORMAT_SECURE;
-    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+    bool live = def->id != -1;
+    size_t i;
 
-    if (migratable)
-        format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE | VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
+    if (migratable || def->namespaceData || def->postParseFailed)
+        return false;
 
-    /* Easiest to clone via a round-trip through XML.  */
-    if (!(xml = virDomainDefFormat(src, caps, format_flags)))
-        return NULL;
+    if (def->nfss || def->nhostdevs || def->nsmartcards || def->nleases ||
+        def->nshmems || def->nmems || def->tpm || def->nresctrls)
+        return false;
 
-    ret = virDomainDefParseString(xml, caps, xmlopt, parseOpaque, parse_flags);
+    for (i = 0; i < def->nseclabels; i++) {
+        virSecurityLabelDefPtr seclabel = def->seclabels[i];
 
-    VIR_FREE(xml);
-    return ret;
+        if (!seclabel->model ||
+            seclabel->type == VIR_DOMAIN_SECLABEL_DEFAULT ||
+            (seclabel->type == VIR_DOMAIN_SECLABEL_STATIC &&
+             !seclabel->label &&
+             STRNEQ(seclabel->model, "none")))
+            return false;
+    }
+
+    for (i = 0; i < def->ndisks; i++) {
+        virStorageSourcePtr backing = def->disks[i]->src->backingStore;
+
+        /* Only the backing chain terminator is copied for now */
+        if (live && backing && virStorageSourceIsBacking(backing))
+            return false;
+    }
+
+    for (i = 0; i < def->nnets; i++) {
+        virDomainNetDefPtr net = def->nets[i];
+
+        if (net->type == VIR_DOMAIN_NET_TYPE_HOSTDEV ||
+            (live && net->type == VIR_DOMAIN_NET_TYPE_NETWORK &&
+             net->data.network.actual) ||
+            (net->type == VIR_DOMAIN_NET_TYPE_VHOSTUSER &&
+             net->data.vhostuser->type != VIR_DOMAIN_CHR_TYPE_UNIX) ||
+            net->hostIP.nips || net->hostIP.nroutes ||
+            net->guestIP.nips || net->guestIP.nroutes)
+            return false;
+    }
+
+    return true;
 }
 
-virDomainDefPtr
-virDomainObjCopyPersistentDef(virDomainObjPtr dom,
-                              virCapsPtr caps,
-                              virDomainXMLOptionPtr xmlopt)
+
+static int
+virDomainDefCopyDeviceInfo(virDomainDeviceInfoPtr dst,
+                           virDomainDeviceInfoPtr src,
+                           virDomainXMLOptionPtr xmlopt)
 {
-    virDomainDefPtr cur;
+    if (virDomainDeviceInfoCopy(dst, src) < 0)
+        return -1;
 
-    cur = virDomainObjGetPersistentDef(caps, xmlopt, dom);
-    return virDomainDefCopy(cur, caps, xmlopt, NULL, false);
+    /* only user aliases are parsed from inactive XML */
+    if (dst->alias &&
+        !(xmlopt->config.features & VIR_DOMAIN_DEF_FEATURE_USER_ALIAS &&
+          STRPREFIX(dst->alias, USER_ALIAS_PREFIX) &&
+          strspn(dst->alias, USER_ALIAS_CHARS) == strlen(dst->alias)))
+        VIR_FREE(dst->alias);
+
+    return 0;
 }
 
 
-virDomainState
-virDomainObjGetState(virDomainObjPtr dom, int *reason)
+static virDomainVirtioOptionsPtr
+virDomainDefCopyVirtioOptions(virDomainVirtioOptionsPtr src)
 {
-    if (reason)
-        *reason = dom->state.reason;
+    virDomainVirtioOptionsPtr ret;
 
-    return dom->state.state;
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    *ret = *src;
+    return ret;
 }
 
 
-void
-virDomainObjSetState(virDomainObjPtr dom, virDomainState state, int reason)
+static int
+virDomainDefCopyDeviceSeclabels(virSecurityDeviceLabelDefPtr **dst,
+                                size_t *ndst,
+                                virSecurityDeviceLabelDefPtr *src,
+                                size_t nsrc,
+                                bool live)
+{
+    virSecurityDeviceLabelDefPtr seclabel = NULL;
+    size_t i;
+
+    for (i = 0; i < nsrc; i++) {
+        /* inactive XML skips labels that were only placeholders */
+        if (!live && !src[i]->label && src[i]->relabel)
+            continue;
+
+        if (!(seclabel = virSecurityDeviceLabelDefCopy(src[i])))
+            goto error;
+
+        seclabel->relabel = seclabel->labelskip || seclabel->relabel;
+        seclabel->labelskip = false;
+
+        if (VIR_APPEND_ELEMENT(*dst, *ndst, seclabel) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    virSecurityDeviceLabelDefFree(seclabel);
+    return -1;
+}
+
+
+static virSecurityLabelDefPtr
+virDomainDefCopySeclabel(virSecurityLabelDefPtr src)
+{
+    virSecurityLabelDefPtr ret;
+
+    if (!(ret = virSecurityLabelDefNew(src->model)))
+        return NULL;
+
+    ret->type = src->type;
+    ret->relabel = src->relabel;
+
+    if (STREQ(src->model, "none") ||
+        src->type == VIR_DOMAIN_SECLABEL_NONE) {
+        ret->type = VIR_DOMAIN_SECLABEL_NONE;
+        ret->relabel = false;
+        return ret;
+    }
+
+    /* the generated labels of a running domain are not kept */
+    if ((src->type == VIR_DOMAIN_SECLABEL_STATIC &&
+         VIR_STRDUP(ret->label, src->label) < 0) ||
+        (src->type == VIR_DOMAIN_SECLABEL_DYNAMIC &&
+         VIR_STRDUP(ret->baselabel, src->baselabel) < 0)) {
+        virSecurityLabelDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Copies the XML visible parts of a disk source. Backing chains are
+ * never part of inactive XML; the terminator of a live definition is
+ * the only chain element copied so far.
+ */
+static virStorageSourcePtr
+virDomainDefCopyDiskSource(virStorageSourcePtr src,
+                           bool live)
+{
+    virStorageSourcePtr ret;
+    size_t i;
+
+    if (!(ret = virStorageSourceCopy(src, false)))
+        return NULL;
+
+    ret->id = 0;
+    ret->capacity = 0;
+    ret->allocation = 0;
+    ret->has_allocation = false;
+    ret->physical = 0;
+    ret->tlsFromConfig = false;
+    ret->tlsVerify = false;
+    ret->detected = false;
+    ret->authInherited = src->authInherited;
+    ret->encryptionInherited = src->encryptionInherited;
+    VIR_FREE(ret->relPath);
+    VIR_FREE(ret->backingStoreRaw);
+    VIR_FREE(ret->nodeformat);
+    VIR_FREE(ret->nodestorage);
+    VIR_FREE(ret->compat);
+    VIR_FREE(ret->tlsAlias);
+    VIR_FREE(ret->tlsCertdir);
+    virBitmapFree(ret->features);
+    ret->features = NULL;
+    VIR_FREE(ret->perms);
+    VIR_FREE(ret->timestamps);
+
+    if (ret->srcpool) {
+        ret->srcpool->voltype = 0;
+        ret->srcpool->pooltype = 0;
+        ret->srcpool->actualtype = 0;
+    }
+
+    /* labels are formatted only for local sources */
+    for (i = 0; i < ret->nseclabels; i++)
+        virSecurityDeviceLabelDefFree(ret->seclabels[i]);
+    VIR_FREE(ret->seclabels);
+    ret->nseclabels = 0;
+
+    if ((src->type == VIR_STORAGE_TYPE_FILE ||
+         src->type == VIR_STORAGE_TYPE_BLOCK ||
+         src->type == VIR_STORAGE_TYPE_VOLUME) &&
+        virDomainDefCopyDeviceSeclabels(&ret->seclabels, &ret->nseclabels,
+                                        src->seclabels, src->nseclabels,
+                                        live) < 0)
+        goto error;
+
+    if (live && src->backingStore &&
+        VIR_ALLOC(ret->backingStore) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virStorageSourceFree(ret);
+    return NULL;
+}
+
+
+static virDomainDiskDefPtr
+virDomainDefCopyDisk(virDomainDiskDefPtr src,
+                     virDomainXMLOptionPtr xmlopt,
+                     bool live)
+{
+    virDomainDiskDefPtr ret;
+
+    if (!(ret = virDomainDiskDefNew(xmlopt)))
+        return NULL;
+
+    virStorageSourceFree(ret->src);
+    if (!(ret->src = virDomainDefCopyDiskSource(src->src, live)))
+        goto error;
+
+    ret->device = src->device;
+    ret->bus = src->bus;
+    ret->tray_status = src->tray_status;
+    ret->removable = src->removable;
+    ret->geometry = src->geometry;
+    ret->blockio = src->blockio;
+    ret->blkdeviotune = src->blkdeviotune;
+    ret->blkdeviotune.group_name = NULL;
+    ret->cachemode = src->cachemode;
+    ret->error_policy = src->error_policy;
+    ret->rerror_policy = src->rerror_policy;
+    ret->iomode = src->iomode;
+    ret->ioeventfd = src->ioeventfd;
+    ret->event_idx = src->event_idx;
+    ret->copy_on_read = src->copy_on_read;
+    ret->snapshot = src->snapshot;
+    ret->startupPolicy = src->startupPolicy;
+    ret->transient = src->transient;
+    ret->rawio = src->rawio;
+    ret->sgio = src->sgio;
+    ret->discard = src->discard;
+    ret->iothread = src->iothread;
+    ret->detect_zeroes = src->detect_zeroes;
+    ret->queues = src->queues;
+
+    if (VIR_STRDUP(ret->dst, src->dst) < 0 ||
+        VIR_STRDUP(ret->blkdeviotune.group_name,
+                   src->blkdeviotune.group_name) < 0 ||
+        VIR_STRDUP(ret->serial, src->serial) < 0 ||
+        VIR_STRDUP(ret->wwn, src->wwn) < 0 ||
+        VIR_STRDUP(ret->vendor, src->vendor) < 0 ||
+        VIR_STRDUP(ret->product, src->product) < 0 ||
+        VIR_STRDUP(ret->domain_name, src->domain_name) < 0)
+        goto error;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainDiskDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainControllerDefPtr
+virDomainDefCopyController(virDomainControllerDefPtr src,
+                           virDomainXMLOptionPtr xmlopt)
+{
+    virDomainControllerDefPtr ret;
+
+    if (!(ret = virDomainControllerDefNew(src->type)))
+        return NULL;
+
+    ret->idx = src->idx;
+    ret->model = src->model;
+    ret->queues = src->queues;
+    ret->cmd_per_lun = src->cmd_per_lun;
+    ret->max_sectors = src->max_sectors;
+    ret->ioeventfd = src->ioeventfd;
+    ret->iothread = src->iothread;
+    ret->opts = src->opts;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainControllerDefFree(ret);
+    return NULL;
+}
+
+
+/*
+ * Completes virDomainChrSourceDefCopy with the fields it leaves out.
+ * Security labels are only kept for character devices (@chrdev).
+ */
+static int
+virDomainDefCopyChrSource(virDomainChrSourceDefPtr dst,
+                          virDomainChrSourceDefPtr src,
+                          bool chrdev,
+                          bool live)
+{
+    bool seclabels = chrdev;
+
+    if (virDomainChrSourceDefCopy(dst, src) < 0)
+        return -1;
+
+    switch ((virDomainChrType) src->type) {
+    case VIR_DOMAIN_CHR_TYPE_PTY:
+        /* the path of a PTY is only parsed from live XML */
+        seclabels = chrdev && live && src->data.file.path;
+        VIR_FREE(dst->data.file.path);
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_TCP:
+        dst->data.tcp.listen = src->data.tcp.listen;
+        dst->data.tcp.protocol = src->data.tcp.protocol;
+        dst->data.tcp.tlsFromConfig = false;
+        seclabels = false;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_UNIX:
+        if (src->data.nix.path) {
+            dst->data.nix.listen = src->data.nix.listen;
+        } else {
+            memset(&dst->data.nix.reconnect, 0,
+                   sizeof(dst->data.nix.reconnect));
+            seclabels = false;
+        }
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_SPICEVMC:
+        dst->data.spicevmc = src->data.spicevmc;
+        seclabels = false;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_SPICEPORT:
+        if (VIR_STRDUP(dst->data.spiceport.channel,
+                       src->data.spiceport.channel) < 0)
+            return -1;
+        seclabels = false;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_FILE:
+    case VIR_DOMAIN_CHR_TYPE_DEV:
+    case VIR_DOMAIN_CHR_TYPE_PIPE:
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_NULL:
+    case VIR_DOMAIN_CHR_TYPE_VC:
+    case VIR_DOMAIN_CHR_TYPE_STDIO:
+    case VIR_DOMAIN_CHR_TYPE_UDP:
+    case VIR_DOMAIN_CHR_TYPE_NMDM:
+    case VIR_DOMAIN_CHR_TYPE_LAST:
+        seclabels = false;
+        break;
+    }
+
+    dst->logappend = src->logappend;
+    if (VIR_STRDUP(dst->logfile, src->logfile) < 0)
+        return -1;
+
+    if (seclabels &&
+        virDomainDefCopyDeviceSeclabels(&dst->seclabels, &dst->nseclabels,
+                                        src->seclabels, src->nseclabels,
+                                        live) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static virDomainChrDefPtr
+virDomainDefCopyChr(virDomainChrDefPtr src,
+                    virDomainXMLOptionPtr xmlopt,
+                    bool live)
+{
+    virDomainChrDefPtr ret;
+
+    if (!(ret = virDomainChrDefNew(xmlopt)))
+        return NULL;
+
+    ret->deviceType = src->deviceType;
+    ret->targetTypeAttr = src->targetTypeAttr;
+    ret->targetType = src->targetType;
+
+    if (ret->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL) {
+        switch ((virDomainChrChannelTargetType) ret->targetType) {
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_GUESTFWD:
+            if (src->target.addr) {
+                if (VIR_ALLOC(ret->target.addr) < 0)
+                    goto error;
+                *ret->target.addr = *src->target.addr;
+            }
+            break;
+
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_XEN:
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_VIRTIO:
+            ret->target.name = NULL;
+            if (VIR_STRDUP(ret->target.name, src->target.name) < 0)
+                goto error;
+            break;
+
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_NONE:
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_LAST:
+            break;
+        }
+    } else {
+        ret->target.port = src->target.port;
+    }
+
+    if (virDomainDefCopyChrSource(ret->source, src->source, true, live) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainChrDefFree(ret);
+    return NULL;
+}
+
+
+static int
+virDomainDefCopyIPInfo(virNetDevIPInfoPtr dst ATTRIBUTE_UNUSED,
+                       const virNetDevIPInfo *src)
+{
+    /* rejected by virDomainDefCopyNativeSupported */
+    if (src->nips || src->nroutes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("copying of interface IP configuration "
+                         "is not supported"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static virDomainNetDefPtr
+virDomainDefCopyNet(virDomainNetDefPtr src,
+                    virCapsPtr caps,
+                    virDomainXMLOptionPtr xmlopt,
+                    bool live)
+{
+    virDomainNetDefPtr ret;
+    const char *prefix = caps ? caps->host.netprefix : NULL;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+    ret->mac = src->mac;
+    ret->driver = src->driver;
+    ret->tune = src->tune;
+    ret->trustGuestRxFilters = src->trustGuestRxFilters;
+    ret->linkstate = src->linkstate;
+    ret->mtu = src->mtu;
+
+    if (VIR_STRDUP(ret->model, src->model) < 0 ||
+        VIR_STRDUP(ret->backend.tap, src->backend.tap) < 0 ||
+        VIR_STRDUP(ret->backend.vhost, src->backend.vhost) < 0 ||
+        VIR_STRDUP(ret->script, src->script) < 0 ||
+        VIR_STRDUP(ret->domain_name, src->domain_name) < 0 ||
+        VIR_STRDUP(ret->ifname_guest_actual, src->ifname_guest_actual) < 0 ||
+        VIR_STRDUP(ret->ifname_guest, src->ifname_guest) < 0 ||
+        VIR_STRDUP(ret->filter, src->filter) < 0)
+        goto error;
+
+    switch (src->type) {
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        if (VIR_ALLOC(ret->data.vhostuser) < 0 ||
+            VIR_STRDUP(ret->data.vhostuser->data.nix.path,
+                       src->data.vhostuser->data.nix.path) < 0)
+            goto error;
+        ret->data.vhostuser->type = VIR_DOMAIN_CHR_TYPE_UNIX;
+        ret->data.vhostuser->data.nix.listen = src->data.vhostuser->data.nix.listen;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+        ret->data.socket.port = src->data.socket.port;
+        ret->data.socket.localport = src->data.socket.localport;
+        if (VIR_STRDUP(ret->data.socket.address,
+                       src->data.socket.address) < 0 ||
+            VIR_STRDUP(ret->data.socket.localaddr,
+                       src->data.socket.localaddr) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+        /* the actual network connection is never part of inactive XML */
+        if (VIR_STRDUP(ret->data.network.name, src->data.network.name) < 0 ||
+            VIR_STRDUP(ret->data.network.portgroup,
+                       src->data.network.portgroup) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        if (VIR_STRDUP(ret->data.bridge.brname, src->data.bridge.brname) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+        if (VIR_STRDUP(ret->data.internal.name, src->data.internal.name) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+        ret->data.direct.mode = src->data.direct.mode;
+        if (VIR_STRDUP(ret->data.direct.linkdev, src->data.direct.linkdev) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+        /* rejected by virDomainDefCopyNativeSupported */
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("copying of hostdev interfaces is not supported"));
+        goto error;
+
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    /* generated target names are blanked out when parsing inactive XML */
+    if (src->ifname &&
+        !(STRPREFIX(src->ifname, VIR_NET_GENERATED_TAP_PREFIX) ||
+          (prefix && STRPREFIX(src->ifname, prefix))) &&
+        VIR_STRDUP(ret->ifname, src->ifname) < 0)
+        goto error;
+
+    if (virDomainDefCopyIPInfo(&ret->hostIP, &src->hostIP) < 0 ||
+        virDomainDefCopyIPInfo(&ret->guestIP, &src->guestIP) < 0)
+        goto error;
+
+    if (src->virtPortProfile) {
+        if (VIR_ALLOC(ret->virtPortProfile) < 0)
+            goto error;
+        *ret->virtPortProfile = *src->virtPortProfile;
+    }
+
+    if (src->filterparams) {
+        if (!(ret->filterparams = virNWFilterHashTableCreate(0)) ||
+            virNWFilterHashTablePutAll(src->filterparams,
+                                       ret->filterparams) < 0)
+            goto error;
+    }
+
+    if (virNetDevBandwidthCopy(&ret->bandwidth, src->bandwidth) < 0 ||
+        virNetDevVlanCopy(&ret->vlan, &src->vlan) < 0)
+        goto error;
+
+    if (src->coalesce) {
+        if (VIR_ALLOC(ret->coalesce) < 0)
+            goto error;
+        *ret->coalesce = *src->coalesce;
+    }
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainNetDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainInputDefPtr
+virDomainDefCopyInput(virDomainInputDefPtr src,
+                      virDomainXMLOptionPtr xmlopt)
+{
+    virDomainInputDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+    ret->bus = src->bus;
+
+    if (VIR_STRDUP(ret->source.evdev, src->source.evdev) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainInputDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainSoundDefPtr
+virDomainDefCopySound(virDomainSoundDefPtr src,
+                      virDomainXMLOptionPtr xmlopt)
+{
+    virDomainSoundDefPtr ret;
+    size_t i;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->ncodecs) {
+        if (VIR_ALLOC_N(ret->codecs, src->ncodecs) < 0)
+            goto error;
+        ret->ncodecs = src->ncodecs;
+    }
+
+    for (i = 0; i < src->ncodecs; i++) {
+        if (VIR_ALLOC(ret->codecs[i]) < 0)
+            goto error;
+        *ret->codecs[i] = *src->codecs[i];
+    }
+
+    return ret;
+
+ error:
+    virDomainSoundDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainVideoDefPtr
+virDomainDefCopyVideo(virDomainVideoDefPtr src,
+                      virDomainXMLOptionPtr xmlopt)
+{
+    virDomainVideoDefPtr ret;
+
+    if (!(ret = virDomainVideoDefNew()))
+        return NULL;
+
+    ret->type = src->type;
+    ret->ram = src->ram;
+    ret->vram = src->vram;
+    ret->vram64 = src->vram64;
+    ret->vgamem = src->vgamem;
+    ret->heads = src->heads;
+    ret->primary = src->primary;
+
+    if (src->accel) {
+        if (VIR_ALLOC(ret->accel) < 0)
+            goto error;
+        *ret->accel = *src->accel;
+    }
+
+    if (src->driver) {
+        if (VIR_ALLOC(ret->driver) < 0)
+            goto error;
+        *ret->driver = *src->driver;
+    }
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainVideoDefFree(ret);
+    return NULL;
+}
+
+
+static int
+virDomainDefCopyGraphicsAuth(virDomainGraphicsAuthDefPtr dst,
+                             virDomainGraphicsAuthDefPtr src)
+{
+    /* nothing but the password carries the other settings */
+    if (!src->passwd)
+        return 0;
+
+    dst->expires = src->expires;
+    dst->validTo = src->validTo;
+    dst->connected = src->connected;
+
+    return VIR_STRDUP(dst->passwd, src->passwd);
+}
+
+
+static virDomainGraphicsDefPtr
+virDomainDefCopyGraphics(virDomainGraphicsDefPtr src,
+                         bool live)
+{
+    virDomainGraphicsDefPtr ret;
+    virDomainGraphicsListenDefPtr glisten = virDomainGraphicsGetListen(src, 0);
+    bool portAttrs;
+    size_t i;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+
+    /* ports are formatted only for listen types with an address */
+    portAttrs = glisten &&
+                (glisten->type == VIR_DOMAIN_GRAPHICS_LISTEN_TYPE_ADDRESS ||
+                 glisten->type == VIR_DOMAIN_GRAPHICS_LISTEN_TYPE_NETWORK);
+
+    switch (src->type) {
+    case VIR_DOMAIN_GRAPHICS_TYPE_VNC:
+        ret->data.vnc.sharePolicy = src->data.vnc.sharePolicy;
+        if (portAttrs) {
+            ret->data.vnc.autoport = src->data.vnc.autoport;
+            if (!src->data.vnc.autoport)
+                ret->data.vnc.port = src->data.vnc.port;
+
+            if (src->data.vnc.websocketGenerated && !live)
+                ret->data.vnc.websocket = -1;
+            else
+                ret->data.vnc.websocket = src->data.vnc.websocket;
+        } else {
+            ret->data.vnc.autoport = true;
+        }
+
+        if (VIR_STRDUP(ret->data.vnc.keymap, src->data.vnc.keymap) < 0 ||
+            virDomainDefCopyGraphicsAuth(&ret->data.vnc.auth,
+                                         &src->data.vnc.auth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SDL:
+        ret->data.sdl.fullscreen = src->data.sdl.fullscreen;
+        if (VIR_STRDUP(ret->data.sdl.display, src->data.sdl.display) < 0 ||
+            VIR_STRDUP(ret->data.sdl.xauth, src->data.sdl.xauth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_RDP:
+        ret->data.rdp = src->data.rdp;
+        if (ret->data.rdp.autoport)
+            ret->data.rdp.port = 0;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_DESKTOP:
+        ret->data.desktop.fullscreen = src->data.desktop.fullscreen;
+        if (VIR_STRDUP(ret->data.desktop.display,
+                       src->data.desktop.display) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SPICE:
+        ret->data.spice = src->data.spice;
+        ret->data.spice.keymap = NULL;
+        ret->data.spice.rendernode = NULL;
+        memset(&ret->data.spice.auth, 0, sizeof(ret->data.spice.auth));
+        ret->data.spice.portReserved = false;
+        ret->data.spice.tlsPortReserved = false;
+        if (!portAttrs) {
+            ret->data.spice.port = 0;
+            ret->data.spice.tlsPort = 0;
+            ret->data.spice.autoport = false;
+        } else if (ret->data.spice.autoport) {
+            ret->data.spice.port = 0;
+            ret->data.spice.tlsPort = 0;
+        }
+
+        if (VIR_STRDUP(ret->data.spice.keymap, src->data.spice.keymap) < 0 ||
+            VIR_STRDUP(ret->data.spice.rendernode,
+                       src->data.spice.rendernode) < 0 ||
+            virDomainDefCopyGraphicsAuth(&ret->data.spice.auth,
+                                         &src->data.spice.auth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_LAST:
+        break;
+    }
+
+    if (src->nListens) {
+        if (VIR_ALLOC_N(ret->listens, src->nListens) < 0)
+            goto error;
+        ret->nListens = src->nListens;
+    }
+
+    for (i = 0; i < src->nListens; i++) {
+        virDomainGraphicsListenDefPtr dst = &ret->listens[i];
+
+        dst->type = src->listens[i].type;
+
+        /* the address of a network listen is runtime data */
+        if ((dst->type != VIR_DOMAIN_GRAPHICS_LISTEN_TYPE_NETWORK &&
+             VIR_STRDUP(dst->address, src->listens[i].address) < 0) ||
+            VIR_STRDUP(dst->network, src->listens[i].network) < 0 ||
+            VIR_STRDUP(dst->socket, src->listens[i].socket) < 0)
+            goto error;
+    }
+
+    return ret;
+
+ error:
+    virDomainGraphicsDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainHubDefPtr
+virDomainDefCopyHub(virDomainHubDefPtr src,
+                    virDomainXMLOptionPtr xmlopt)
+{
+    virDomainHubDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0) {
+        virDomainHubDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainRedirdevDefPtr
+virDomainDefCopyRedirdev(virDomainRedirdevDefPtr src,
+                         virDomainXMLOptionPtr xmlopt,
+                         bool live)
+{
+    virDomainRedirdevDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->bus = src->bus;
+
+    if (!(ret->source = virDomainChrSourceDefNew(xmlopt)) ||
+        virDomainDefCopyChrSource(ret->source, src->source, false, live) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0) {
+        virDomainRedirdevDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainRNGDefPtr
+virDomainDefCopyRNG(virDomainRNGDefPtr src,
+                    virDomainXMLOptionPtr xmlopt,
+                    bool live)
+{
+    virDomainRNGDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+    ret->backend = src->backend;
+    ret->rate = src->rate;
+    ret->period = src->period;
+
+    switch ((virDomainRNGBackend) src->backend) {
+    case VIR_DOMAIN_RNG_BACKEND_RANDOM:
+        if (VIR_STRDUP(ret->source.file, src->source.file) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_RNG_BACKEND_EGD:
+        if (!(ret->source.chardev = virDomainChrSourceDefNew(xmlopt)) ||
+            virDomainDefCopyChrSource(ret->source.chardev,
+                                      src->source.chardev, false, live) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_RNG_BACKEND_LAST:
+        break;
+    }
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainRNGDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainPanicDefPtr
+virDomainDefCopyPanic(virDomainPanicDefPtr src,
+                      virDomainXMLOptionPtr xmlopt)
+{
+    virDomainPanicDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0) {
+        virDomainPanicDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainWatchdogDefPtr
+virDomainDefCopyWatchdog(virDomainWatchdogDefPtr src,
+                         virDomainXMLOptionPtr xmlopt)
+{
+    virDomainWatchdogDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+    ret->action = src->action;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0) {
+        virDomainWatchdogDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainMemballoonDefPtr
+virDomainDefCopyMemballoon(virDomainMemballoonDefPtr src,
+                           virDomainXMLOptionPtr xmlopt)
+{
+    virDomainMemballoonDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+    ret->period = src->period;
+    ret->autodeflate = src->autodeflate;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0)
+        goto error;
+
+    if (src->virtio &&
+        !(ret->virtio = virDomainDefCopyVirtioOptions(src->virtio)))
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainMemballoonDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainNVRAMDefPtr
+virDomainDefCopyNVRAM(virDomainNVRAMDefPtr src,
+                      virDomainXMLOptionPtr xmlopt)
+{
+    virDomainNVRAMDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info, xmlopt) < 0) {
+        virDomainNVRAMDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainRedirFilterDefPtr
+virDomainDefCopyRedirFilter(virDomainRedirFilterDefPtr src)
+{
+    virDomainRedirFilterDefPtr ret;
+    size_t i;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    if (src->nusbdevs) {
+        if (VIR_ALLOC_N(ret->usbdevs, src->nusbdevs) < 0)
+            goto error;
+        ret->nusbdevs = src->nusbdevs;
+    }
+
+    for (i = 0; i < src->nusbdevs; i++) {
+        if (VIR_ALLOC(ret->usbdevs[i]) < 0)
+            goto error;
+        *ret->usbdevs[i] = *src->usbdevs[i];
+    }
+
+    return ret;
+
+ error:
+    virDomainRedirFilterDefFree(ret);
+    return NULL;
+}
+
+
+/* Copies an array of device definitions using @copyfunc */
+#define VIR_DOMAIN_DEF_COPY_DEVICES(dst, src, field, nfield, copyfunc) \
+    do { \
+        size_t _i; \
+        if ((src)->nfield && \
+            VIR_ALLOC_N((dst)->field, (src)->nfield) < 0) \
+            goto error; \
+        for (_i = 0; _i < (src)->nfield; _i++) { \
+            if (!((dst)->field[_i] = copyfunc)) \
+                goto error; \
+            (dst)->nfield++; \
+        } \
+    } while (0)
+
+
+static int
+virDomainDefCopyOS(virDomainOSDefPtr dst,
+                   virDomainOSDefPtr src)
+{
+    size_t i;
+
+    dst->type = src->type;
+    dst->arch = src->arch;
+    dst->nBootDevs = src->nBootDevs;
+    memcpy(dst->bootDevs, src->bootDevs, sizeof(src->bootDevs));
+    dst->bootmenu = src->bootmenu;
+    dst->bm_timeout = src->bm_timeout;
+    dst->bm_timeout_set = src->bm_timeout_set;
+    dst->smbios_mode = src->smbios_mode;
+    dst->bios = src->bios;
+
+    if (VIR_STRDUP(dst->machine, src->machine) < 0 ||
+        VIR_STRDUP(dst->init, src->init) < 0 ||
+        VIR_STRDUP(dst->initdir, src->initdir) < 0 ||
+        VIR_STRDUP(dst->inituser, src->inituser) < 0 ||
+        VIR_STRDUP(dst->initgroup, src->initgroup) < 0 ||
+        VIR_STRDUP(dst->kernel, src->kernel) < 0 ||
+        VIR_STRDUP(dst->initrd, src->initrd) < 0 ||
+        VIR_STRDUP(dst->cmdline, src->cmdline) < 0 ||
+        VIR_STRDUP(dst->dtb, src->dtb) < 0 ||
+        VIR_STRDUP(dst->root, src->root) < 0 ||
+        VIR_STRDUP(dst->slic_table, src->slic_table) < 0 ||
+        VIR_STRDUP(dst->bootloader, src->bootloader) < 0 ||
+        VIR_STRDUP(dst->bootloaderArgs, src->bootloaderArgs) < 0)
+        return -1;
+
+    if (src->initargv &&
+        virStringListCopy(&dst->initargv,
+                          (const char **) src->initargv) < 0)
+        return -1;
+
+    if (src->initenv) {
+        for (i = 0; src->initenv[i]; i++);
+
+        if (VIR_ALLOC_N(dst->initenv, i + 1) < 0)
+            return -1;
+
+        for (i = 0; src->initenv[i]; i++) {
+            if (VIR_ALLOC(dst->initenv[i]) < 0 ||
+                VIR_STRDUP(dst->initenv[i]->name, src->initenv[i]->name) < 0 ||
+                VIR_STRDUP(dst->initenv[i]->value, src->initenv[i]->value) < 0)
+                return -1;
+        }
+    }
+
+    if (src->loader) {
+        if (VIR_ALLOC(dst->loader) < 0)
+            return -1;
+
+        dst->loader->readonly = src->loader->readonly;
+        dst->loader->type = src->loader->type;
+        dst->loader->secure = src->loader->secure;
+
+        if (VIR_STRDUP(dst->loader->path, src->loader->path) < 0 ||
+            VIR_STRDUP(dst->loader->nvram, src->loader->nvram) < 0 ||
+            VIR_STRDUP(dst->loader->templt, src->loader->templt) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyClock(virDomainClockDefPtr dst,
+                      virDomainClockDefPtr src)
+{
+    size_t i;
+
+    dst->offset = src->offset;
+    dst->data = src->data;
+
+    if (src->offset == VIR_DOMAIN_CLOCK_OFFSET_TIMEZONE) {
+        dst->data.timezone = NULL;
+        if (VIR_STRDUP(dst->data.timezone, src->data.timezone) < 0)
+            return -1;
+    } else if (src->offset == VIR_DOMAIN_CLOCK_OFFSET_VARIABLE) {
+        /* the start time adjustment exists only while running */
+        dst->data.variable.adjustment0 = 0;
+    }
+
+    if (src->ntimers) {
+        if (VIR_ALLOC_N(dst->timers, src->ntimers) < 0)
+            return -1;
+        dst->ntimers = src->ntimers;
+    }
+
+    for (i = 0; i < src->ntimers; i++) {
+        if (VIR_ALLOC(dst->timers[i]) < 0)
+            return -1;
+        *dst->timers[i] = *src->timers[i];
+    }
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyTuning(virDomainDefPtr dst,
+                       virDomainDefPtr src,
+                       virDomainXMLOptionPtr xmlopt)
+{
+    size_t i;
+
+    dst->blkio.weight = src->blkio.weight;
+    if (src->blkio.ndevices) {
+        if (VIR_ALLOC_N(dst->blkio.devices, src->blkio.ndevices) < 0)
+            return -1;
+        dst->blkio.ndevices = src->blkio.ndevices;
+    }
+
+    for (i = 0; i < src->blkio.ndevices; i++) {
+        dst->blkio.devices[i] = src->blkio.devices[i];
+        dst->blkio.devices[i].path = NULL;
+        if (VIR_STRDUP(dst->blkio.devices[i].path,
+                       src->blkio.devices[i].path) < 0)
+            return -1;
+    }
+
+    dst->mem = src->mem;
+    dst->mem.hugepages = NULL;
+    dst->mem.nhugepages = 0;
+    if (src->mem.nhugepages) {
+        if (VIR_ALLOC_N(dst->mem.hugepages, src->mem.nhugepages) < 0)
+            return -1;
+        dst->mem.nhugepages = src->mem.nhugepages;
+    }
+
+    for (i = 0; i < src->mem.nhugepages; i++) {
+        dst->mem.hugepages[i].size = src->mem.hugepages[i].size;
+        if (src->mem.hugepages[i].nodemask &&
+            !(dst->mem.hugepages[i].nodemask =
+              virBitmapNewCopy(src->mem.hugepages[i].nodemask)))
+            return -1;
+    }
+
+    if (virDomainDefSetVcpusMax(dst, src->maxvcpus, xmlopt) < 0)
+        return -1;
+
+    for (i = 0; i < src->maxvcpus; i++) {
+        virDomainVcpuDefPtr vcpu = dst->vcpus[i];
+
+        vcpu->online = src->vcpus[i]->online;
+        vcpu->hotpluggable = src->vcpus[i]->hotpluggable;
+        vcpu->order = src->vcpus[i]->order;
+        vcpu->sched = src->vcpus[i]->sched;
+        if (src->vcpus[i]->cpumask &&
+            !(vcpu->cpumask = virBitmapNewCopy(src->vcpus[i]->cpumask)))
+            return -1;
+    }
+
+    dst->individualvcpus = src->individualvcpus;
+    dst->placement_mode = src->placement_mode;
+    if (src->cpumask &&
+        !(dst->cpumask = virBitmapNewCopy(src->cpumask)))
+        return -1;
+
+    if (src->niothreadids) {
+        if (VIR_ALLOC_N(dst->iothreadids, src->niothreadids) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < src->niothreadids; i++) {
+        virDomainIOThreadIDDefPtr iothread;
+
+        if (VIR_ALLOC(iothread) < 0)
+            return -1;
+        dst->iothreadids[dst->niothreadids++] = iothread;
+
+        /* the thread itself belongs to the running domain */
+        iothread->autofill = src->iothreadids[i]->autofill;
+        iothread->iothread_id = src->iothreadids[i]->iothread_id;
+        iothread->sched = src->iothreadids[i]->sched;
+        if (src->iothreadids[i]->cpumask &&
+            !(iothread->cpumask =
+              virBitmapNewCopy(src->iothreadids[i]->cpumask)))
+            return -1;
+    }
+
+    dst->cputune = src->cputune;
+    dst->cputune.emulatorpin = NULL;
+    if (src->cputune.emulatorpin &&
+        !(dst->cputune.emulatorpin =
+          virBitmapNewCopy(src->cputune.emulatorpin)))
+        return -1;
+
+    virDomainNumaFree(dst->numa);
+    if (!(dst->numa = virDomainNumaCopy(src->numa)))
+        return -1;
+
+    if (src->resource) {
+        if (VIR_ALLOC(dst->resource) < 0 ||
+            VIR_STRDUP(dst->resource->partition,
+                       src->resource->partition) < 0)
+            return -1;
+    }
+
+    if (src->idmap.nuidmap) {
+        if (VIR_ALLOC_N(dst->idmap.uidmap, src->idmap.nuidmap) < 0)
+            return -1;
+        memcpy(dst->idmap.uidmap, src->idmap.uidmap,
+               sizeof(*src->idmap.uidmap) * src->idmap.nuidmap);
+        dst->idmap.nuidmap = src->idmap.nuidmap;
+    }
+
+    if (src->idmap.ngidmap) {
+        if (VIR_ALLOC_N(dst->idmap.gidmap, src->idmap.ngidmap) < 0)
+            return -1;
+        memcpy(dst->idmap.gidmap, src->idmap.gidmap,
+               sizeof(*src->idmap.gidmap) * src->idmap.ngidmap);
+        dst->idmap.ngidmap = src->idmap.ngidmap;
+    }
+
+    return 0;
+}
+
+
+static virDomainDefPtr
+virDomainDefCopyNative(virDomainDefPtr src,
+                       virCapsPtr caps,
+                       virDomainXMLOptionPtr xmlopt)
+{
+    virDomainDefPtr ret;
+    bool live = src->id != -1;
+    size_t i;
+
+    if (!(ret = virDomainDefNew()))
+        return NULL;
+
+    ret->virtType = src->virtType;
+    ret->id = -1;
+    memcpy(ret->uuid, src->uuid, VIR_UUID_BUFLEN);
+
+    if (VIR_STRDUP(ret->name, src->name) < 0 ||
+        VIR_STRDUP(ret->title, src->title) < 0 ||
+        VIR_STRDUP(ret->description, src->description) < 0 ||
+        VIR_STRDUP(ret->emulator, src->emulator) < 0 ||
+        VIR_STRDUP(ret->hyperv_vendor_id, src->hyperv_vendor_id) < 0)
+        goto error;
+
+    if (virDomainDefCopyTuning(ret, src, xmlopt) < 0)
+        goto error;
+
+    ret->onReboot = src->onReboot;
+    ret->onPoweroff = src->onPoweroff;
+    ret->onCrash = src->onCrash;
+    ret->onLockFailure = src->onLockFailure;
+    ret->pm = src->pm;
+    ret->perf = src->perf;
+
+    if (virDomainDefCopyOS(&ret->os, &src->os) < 0)
+        goto error;
+
+    memcpy(ret->features, src->features, sizeof(src->features));
+    ret->apic_eoi = src->apic_eoi;
+    memcpy(ret->hyperv_features, src->hyperv_features,
+           sizeof(src->hyperv_features));
+    memcpy(ret->kvm_features, src->kvm_features, sizeof(src->kvm_features));
+    ret->hyperv_spinlocks = src->hyperv_spinlocks;
+    ret->gic_version = src->gic_version;
+    ret->ioapic = src->ioapic;
+    ret->hpt_resizing = src->hpt_resizing;
+    memcpy(ret->caps_features, src->caps_features,
+           sizeof(src->caps_features));
+
+    if (virDomainDefCopyClock(&ret->clock, &src->clock) < 0)
+        goto error;
+
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, graphics, ngraphics,
+                                virDomainDefCopyGraphics(src->graphics[_i],
+                                                         live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, disks, ndisks,
+                                virDomainDefCopyDisk(src->disks[_i],
+                                                     xmlopt, live));
+    /* the parser keeps controllers sorted */
+    if (src->ncontrollers &&
+        VIR_ALLOC_N(ret->controllers, src->ncontrollers) < 0)
+        goto error;
+
+    for (i = 0; i < src->ncontrollers; i++) {
+        virDomainControllerDefPtr cont;
+
+        if (!(cont = virDomainDefCopyController(src->controllers[i], xmlopt)))
+            goto error;
+        virDomainControllerInsertPreAlloced(ret, cont);
+    }
+
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, nets, nnets,
+                                virDomainDefCopyNet(src->nets[_i],
+                                                    caps, xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, inputs, ninputs,
+                                virDomainDefCopyInput(src->inputs[_i],
+                                                      xmlopt));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, sounds, nsounds,
+                                virDomainDefCopySound(src->sounds[_i],
+                                                      xmlopt));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, videos, nvideos,
+                                virDomainDefCopyVideo(src->videos[_i],
+                                                      xmlopt));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, redirdevs, nredirdevs,
+                                virDomainDefCopyRedirdev(src->redirdevs[_i],
+                                                         xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, serials, nserials,
+                                virDomainDefCopyChr(src->serials[_i],
+                                                    xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, parallels, nparallels,
+                                virDomainDefCopyChr(src->parallels[_i],
+                                                    xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, channels, nchannels,
+                                virDomainDefCopyChr(src->channels[_i],
+                                                    xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, consoles, nconsoles,
+                                virDomainDefCopyChr(src->consoles[_i],
+                                                    xmlopt, live));
+    /* console ports are implicit */
+    for (i = 0; i < ret->nconsoles; i++)
+        ret->consoles[i]->target.port = i;
+
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, hubs, nhubs,
+                                virDomainDefCopyHub(src->hubs[_i], xmlopt));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, seclabels, nseclabels,
+                                virDomainDefCopySeclabel(src->seclabels[_i]));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, rngs, nrngs,
+                                virDomainDefCopyRNG(src->rngs[_i],
+                                                    xmlopt, live));
+    VIR_DOMAIN_DEF_COPY_DEVICES(ret, src, panics, npanics,
+                                virDomainDefCopyPanic(src->panics[_i],
+                                                      xmlopt));
+
+    if (src->watchdog &&
+        !(ret->watchdog = virDomainDefCopyWatchdog(src->watchdog, xmlopt)))
+        goto error;
+
+    if (src->memballoon &&
+        !(ret->memballoon = virDomainDefCopyMemballoon(src->memballoon,
+                                                       xmlopt)))
+        goto error;
+
+    if (src->nvram &&
+        !(ret->nvram = virDomainDefCopyNVRAM(src->nvram, xmlopt)))
+        goto error;
+
+    if (src->cpu &&
+        !(ret->cpu = virCPUDefCopy(src->cpu)))
+        goto error;
+
+    if (src->sysinfo &&
+        !(ret->sysinfo = virSysinfoDefCopy(src->sysinfo)))
+        goto error;
+
+    if (src->redirfilter &&
+        !(ret->redirfilter = virDomainDefCopyRedirFilter(src->redirfilter)))
+        goto error;
+
+    if (src->iommu) {
+        if (VIR_ALLOC(ret->iommu) < 0)
+            goto error;
+        *ret->iommu = *src->iommu;
+    }
+
+    if (src->keywrap) {
+        if (VIR_ALLOC(ret->keywrap) < 0)
+            goto error;
+        *ret->keywrap = *src->keywrap;
+    }
+
+    if (src->metadata &&
+        !(ret->metadata = xmlCopyNode(src->metadata, 1))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    ret->ns = xmlopt->ns;
+
+    return ret;
+
+ error:
+    virDomainDefFree(ret);
+    return NULL;
+}
+
+#undef VIR_DOMAIN_DEF_COPY_DEVICES
+
+
+/* Copy src into a new definition; with the quality of the copy
+ * depending on the migratable flag (false for transitions between
+ * persistent and active, true for transitions across save files or
+ * snapshots).  */
+virDomainDefPtr
+virDomainDefCopy(virDomainDefPtr src,
+                 virCapsPtr caps,
+                 virDomainXMLOptionPtr xmlopt,
+                 void *parseOpaque,
+                 bool migratable)
+{
+    char *xml;
+    virDomainDefPtr ret;
+    unsigned int format_flags = VIR_DOMAIN_DEF_FORMAT_SECURE;
+    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+
+    if (virDomainDefCopyNativeSupported(src, migratable))
+        return virDomainDefCopyNative(src, caps, xmlopt);
+
+    if (migratable)
+        format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE | VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
+
+    /* Anything else is cloned via a round-trip through XML.  */
+    if (!(xml = virDomainDefFormat(src, caps, format_flags)))
+        return NULL;
+
+    ret = virDomainDefParseString(xml, caps, xmlopt, parseOpaque, parse_flags);
+
+    VIR_FREE(xml);
+    return ret;
+}
+
+virDomainDefPtr
+virDomainObjCopyPersistentDef(virDomainObjPtr dom,
+                              virCapsPtr caps,
+                              virDomainXMLOptionPtr xmlopt)
+{
+    virDomainDefPtr cur;
+
+    cur = virDomainObjGetPersistentDef(caps, xmlopt, dom);
+    return virDomainDefCopy(cur, caps, xmlopt, NULL, false);
+}
+
+
+virDomainState
+virDomainObjGetState(virDomainObjPtr dom, int *reason)
+{
+    if (reason)
+        *reason = dom->state.reason;
+
+    return dom->state.state;
+}
+
+
+void
+virDomainObjSetState(virDomainObjPtr dom, virDomainState state, int reason)
 {
     int last = -1;
 
@@ -27190,6 +29659,8 @@ virDomainObjSetState(virDomainObjPtr dom, virDomainState state, int reason)
         dom->state.reason = reason;
     else
         dom->state.reason = 0;
+
+    virDomainObjBumpGeneration(dom);
 }
 
 
@@ -27690,10 +30161,59 @@ virDomainDefFindDevice(virDomainDefPtr def,
                        bool reportError)
 {
     virDomainDefFindDeviceCallbackData data = { devAlias, dev };
+    virDomainDefIndexEntry entry;
+    size_t i;
 
     dev->type = VIR_DOMAIN_DEVICE_NONE;
-    virDomainDeviceInfoIterateInternal(def, virDomainDefFindDeviceCallback,
-                                       true, &data);
+
+    if (virDomainDefIndexLookup(def, VIR_DOMAIN_DEF_INDEX_ALIAS,
+                                devAlias, &entry)) {
+        switch (entry.type) {
+        case VIR_DOMAIN_DEVICE_DISK:
+            if (entry.idx < def->ndisks &&
+                STREQ_NULLABLE(def->disks[entry.idx]->info.alias, devAlias)) {
+                dev->type = VIR_DOMAIN_DEVICE_DISK;
+                dev->data.disk = def->disks[entry.idx];
+            }
+            break;
+
+        case VIR_DOMAIN_DEVICE_NET:
+            if (entry.idx < def->nnets &&
+                STREQ_NULLABLE(def->nets[entry.idx]->info.alias, devAlias)) {
+                dev->type = VIR_DOMAIN_DEVICE_NET;
+                dev->data.net = def->nets[entry.idx];
+            }
+            break;
+
+        case VIR_DOMAIN_DEVICE_HOSTDEV:
+            /* sound devices are looked at before host devices */
+            for (i = 0; i < def->nsounds; i++) {
+                if (STREQ_NULLABLE(def->sounds[i]->info.alias, devAlias))
+                    break;
+            }
+            if (i == def->nsounds &&
+                entry.idx < def->nhostdevs &&
+                STREQ_NULLABLE(def->hostdevs[entry.idx]->info->alias,
+                               devAlias)) {
+                dev->type = VIR_DOMAIN_DEVICE_HOSTDEV;
+                dev->data.hostdev = def->hostdevs[entry.idx];
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (dev->type == VIR_DOMAIN_DEVICE_NONE) {
+        virDomainDeviceInfoIterateInternal(def, virDomainDefFindDeviceCallback,
+                                           true, &data);
+
+        if (dev->type == VIR_DOMAIN_DEVICE_DISK ||
+            dev->type == VIR_DOMAIN_DEVICE_NET ||
+            dev->type == VIR_DOMAIN_DEVICE_HOSTDEV)
+            virDomainDefIndexInvalidate(def);
+    }
 
     if (dev->type == VIR_DOMAIN_DEVICE_NONE) {
         if (reportError) {
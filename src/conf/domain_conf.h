@@ -56,6 +56,7 @@
 # include "virperf.h"
 # include "virtypedparam.h"
 # include "virsavecookie.h"
+# include "virresctrl.h"
 
 /* forward declarations of all device types, required by
  * virDomainDeviceDef
@@ -2179,6 +2180,15 @@ struct _virDomainCputune {
 };
 
 
+typedef struct _virDomainResctrlDef virDomainResctrlDef;
+typedef virDomainResctrlDef *virDomainResctrlDefPtr;
+
+struct _virDomainResctrlDef {
+    virBitmapPtr vcpus; /* NULL for the whole domain */
+    virResctrlAllocPtr alloc;
+};
+
+
 typedef struct _virDomainVcpuDef virDomainVcpuDef;
 typedef virDomainVcpuDef *virDomainVcpuDefPtr;
 
@@ -2282,6 +2292,9 @@ struct _virDomainVirtioOptions {
  * NB: if adding to this struct, virDomainDefCheckABIStability
  * may well need an update
  */
+typedef struct _virDomainDefIndex virDomainDefIndex;
+typedef virDomainDefIndex *virDomainDefIndexPtr;
+
 typedef struct _virDomainDef virDomainDef;
 typedef virDomainDef *virDomainDefPtr;
 struct _virDomainDef {
@@ -2307,6 +2320,9 @@ struct _virDomainDef {
 
     virDomainCputune cputune;
 
+    size_t nresctrls;
+    virDomainResctrlDefPtr *resctrls;
+
     virDomainNumaPtr numa;
     virDomainResourceDefPtr resource;
     virDomainIdMapDef idmap;
@@ -2431,6 +2447,9 @@ struct _virDomainDef {
                              callbacks failed for a non-critical reason
                              (was not able to fill in some data) and thus
                              should be re-run before starting */
+
+    /* device lookup indexes, may be NULL */
+    virDomainDefIndexPtr index;
 };
 
 
@@ -2486,6 +2505,11 @@ struct _virDomainObj {
     virDomainDefPtr def; /* The current definition */
     virDomainDefPtr newDef; /* New definition to activate at shutdown */
 
+    /* Configuration file to parse @def from again, if @def only holds
+     * the name and UUID of an inactive domain to save memory. See
+     * virDomainObjListCompact. */
+    char *compactConfig;
+
     virDomainSnapshotObjListPtr snapshots;
     virDomainSnapshotObjPtr current_snapshot;
 
@@ -2498,6 +2522,12 @@ struct _virDomainObj {
 
     unsigned long long original_memlock; /* Original RLIMIT_MEMLOCK, zero if no
                                           * restore will be required later */
+
+    unsigned long long generation; /* Last change of definition or state,
+                                    * see virDomainObjBumpGeneration */
+    unsigned long long defGeneration; /* Last time the persistent definition
+                                       * was replaced or handed out for
+                                       * modification */
 };
 
 typedef bool (*virDomainObjListACLFilter)(virConnectPtr conn,
@@ -2792,6 +2822,10 @@ void virDomainObjAssignDef(virDomainObjPtr domain,
                            virDomainDefPtr def,
                            bool live,
                            virDomainDefPtr *oldDef);
+unsigned long long virDomainObjGetGeneration(void);
+unsigned long long virDomainObjNextGeneration(void);
+void virDomainObjBumpGeneration(virDomainObjPtr obj)
+    ATTRIBUTE_NONNULL(1);
 int virDomainObjSetDefTransient(virCapsPtr caps,
                                 virDomainXMLOptionPtr xmlopt,
                                 virDomainObjPtr domain);
@@ -2943,6 +2977,30 @@ unsigned int virDomainDefFormatConvertXMLFlags(unsigned int flags);
 char *virDomainDefFormat(virDomainDefPtr def,
                          virCapsPtr caps,
                          unsigned int flags);
+
+/* Subtrees virDomainDefFormatSubtree can format on their own,
+ * named by their path below the <domain/> element */
+typedef enum {
+    VIR_DOMAIN_DEF_SUBTREE_METADATA,
+    VIR_DOMAIN_DEF_SUBTREE_DISK,
+    VIR_DOMAIN_DEF_SUBTREE_CONTROLLER,
+    VIR_DOMAIN_DEF_SUBTREE_FILESYSTEM,
+    VIR_DOMAIN_DEF_SUBTREE_INTERFACE,
+    VIR_DOMAIN_DEF_SUBTREE_CHANNEL,
+    VIR_DOMAIN_DEF_SUBTREE_GRAPHICS,
+    VIR_DOMAIN_DEF_SUBTREE_VIDEO,
+    VIR_DOMAIN_DEF_SUBTREE_HOSTDEV,
+
+    VIR_DOMAIN_DEF_SUBTREE_LAST
+} virDomainDefSubtree;
+
+VIR_ENUM_DECL(virDomainDefSubtree)
+
+char *virDomainDefFormatSubtree(virDomainDefPtr def,
+                                virCapsPtr caps,
+                                const char *path,
+                                unsigned int flags)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
 char *virDomainObjFormat(virDomainXMLOptionPtr xmlopt,
                          virDomainObjPtr obj,
                          virCapsPtr caps,
@@ -2987,6 +3045,8 @@ int virDomainDiskIndexByName(virDomainDefPtr def, const char *name,
 virDomainDiskDefPtr virDomainDiskByName(virDomainDefPtr def,
                                         const char *name,
                                         bool allow_ambiguous);
+virDomainDiskDefPtr virDomainDiskByAlias(virDomainDefPtr def,
+                                         const char *alias);
 const char *virDomainDiskPathByName(virDomainDefPtr, const char *name);
 int virDomainDiskInsert(virDomainDefPtr def,
                         virDomainDiskDefPtr disk)
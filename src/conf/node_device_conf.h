@@ -178,6 +178,7 @@ struct _virNodeDevCapPCIDev {
     int numa_node;
     virPCIEDeviceInfoPtr pci_express;
     int hdrType; /* enum virPCIHeaderType or -1 */
+    bool configLoaded; /* hdrType and pci_express were read already */
     virNodeDevCapMdevTypePtr *mdev_types;
     size_t nmdev_types;
 };
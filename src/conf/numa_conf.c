@@ -1065,6 +1065,67 @@ virDomainNumaNew(void)
 }
 
 
+/**
+ * virDomainNumaCopy:
+ * @src: NUMA definition to copy
+ *
+ * Returns a deep copy of @src, or NULL on error.
+ */
+virDomainNumaPtr
+virDomainNumaCopy(virDomainNumaPtr src)
+{
+    virDomainNumaPtr ret = NULL;
+    size_t i;
+
+    if (!(ret = virDomainNumaNew()))
+        return NULL;
+
+    ret->memory.specified = src->memory.specified;
+    ret->memory.mode = src->memory.mode;
+    ret->memory.placement = src->memory.placement;
+    if (src->memory.nodeset &&
+        !(ret->memory.nodeset = virBitmapNewCopy(src->memory.nodeset)))
+        goto error;
+
+    if (src->nmem_nodes) {
+        if (VIR_ALLOC_N(ret->mem_nodes, src->nmem_nodes) < 0)
+            goto error;
+        ret->nmem_nodes = src->nmem_nodes;
+    }
+
+    for (i = 0; i < src->nmem_nodes; i++) {
+        virDomainNumaNodePtr srcnode = &src->mem_nodes[i];
+        virDomainNumaNodePtr dstnode = &ret->mem_nodes[i];
+
+        dstnode->mem = srcnode->mem;
+        dstnode->mode = srcnode->mode;
+        dstnode->memAccess = srcnode->memAccess;
+
+        if (srcnode->cpumask &&
+            !(dstnode->cpumask = virBitmapNewCopy(srcnode->cpumask)))
+            goto error;
+
+        if (srcnode->nodeset &&
+            !(dstnode->nodeset = virBitmapNewCopy(srcnode->nodeset)))
+            goto error;
+
+        if (srcnode->ndistances) {
+            if (VIR_ALLOC_N(dstnode->distances, srcnode->ndistances) < 0)
+                goto error;
+            memcpy(dstnode->distances, srcnode->distances,
+                   sizeof(*srcnode->distances) * srcnode->ndistances);
+            dstnode->ndistances = srcnode->ndistances;
+        }
+    }
+
+    return ret;
+
+ error:
+    virDomainNumaFree(ret);
+    return NULL;
+}
+
+
 bool
 virDomainNumaCheckABIStability(virDomainNumaPtr src,
                                virDomainNumaPtr tgt)
@@ -56,6 +56,7 @@ VIR_ENUM_DECL(virDomainMemoryAccess)
 
 
 virDomainNumaPtr virDomainNumaNew(void);
+virDomainNumaPtr virDomainNumaCopy(virDomainNumaPtr src);
 void virDomainNumaFree(virDomainNumaPtr numa);
 
 /*
@@ -3087,7 +3087,7 @@ virNWFilterRuleDefDetailsFormat(virBufferPtr buf,
 }
 
 
-static int
+int
 virNWFilterRuleDefFormat(virBufferPtr buf,
                          virNWFilterRuleDefPtr def)
 {
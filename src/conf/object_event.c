@@ -34,6 +34,7 @@
 #include "virerror.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virhash.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -58,10 +59,21 @@ struct _virObjectEventCallback {
 typedef struct _virObjectEventCallback virObjectEventCallback;
 typedef virObjectEventCallback *virObjectEventCallbackPtr;
 
+/* Callbacks sharing the same eventID and key filter (or lack of one),
+ * kept in registration order */
+struct _virObjectEventCallbackBucket {
+    size_t count;
+    virObjectEventCallbackPtr *callbacks;
+};
+typedef struct _virObjectEventCallbackBucket virObjectEventCallbackBucket;
+typedef virObjectEventCallbackBucket *virObjectEventCallbackBucketPtr;
+
 struct _virObjectEventCallbackList {
     unsigned int nextID;
     size_t count;
     virObjectEventCallbackPtr *callbacks;
+    /* virObjectEventCallbackBucketPtr indexed by eventID and key */
+    virHashTablePtr index;
 };
 
 struct _virObjectEventQueue {
@@ -154,6 +166,127 @@ virObjectEventCallbackFree(virObjectEventCallbackPtr cb)
     VIR_FREE(cb);
 }
 
+static void
+virObjectEventCallbackBucketFree(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED)
+{
+    virObjectEventCallbackBucketPtr bucket = payload;
+
+    if (!bucket)
+        return;
+
+    VIR_FREE(bucket->callbacks);
+    VIR_FREE(bucket);
+}
+
+
+/**
+ * virObjectEventCallbackIndexKey:
+ * @eventID: the event ID
+ * @key: optional key of per-object filtering
+ *
+ * Format the name of the index bucket holding callbacks registered
+ * for @eventID, either for the object identified by @key or for all
+ * objects when @key is NULL.
+ *
+ * Returns the allocated name, or NULL on OOM.
+ */
+static char *
+virObjectEventCallbackIndexKey(int eventID,
+                               const char *key)
+{
+    char *ret = NULL;
+
+    if (key)
+        ignore_value(virAsprintf(&ret, "%d:%s", eventID, key));
+    else
+        ignore_value(virAsprintf(&ret, "%d", eventID));
+    return ret;
+}
+
+
+static virObjectEventCallbackBucketPtr
+virObjectEventCallbackIndexLookup(virObjectEventCallbackListPtr cbList,
+                                  int eventID,
+                                  const char *key)
+{
+    virObjectEventCallbackBucketPtr ret;
+    char *name;
+
+    if (!(name = virObjectEventCallbackIndexKey(eventID, key)))
+        return NULL;
+
+    ret = virHashLookup(cbList->index, name);
+    VIR_FREE(name);
+    return ret;
+}
+
+
+static int
+virObjectEventCallbackIndexAdd(virObjectEventCallbackListPtr cbList,
+                               virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackBucketPtr bucket = NULL;
+    char *name;
+    int ret = -1;
+
+    if (!(name = virObjectEventCallbackIndexKey(cb->eventID,
+                                                cb->key_filter ? cb->key : NULL)))
+        return -1;
+
+    if (!(bucket = virHashLookup(cbList->index, name))) {
+        if (VIR_ALLOC(bucket) < 0)
+            goto cleanup;
+        if (virHashAddEntry(cbList->index, name, bucket) < 0) {
+            VIR_FREE(bucket);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT(bucket->callbacks, bucket->count, cb) < 0) {
+        if (bucket->count == 0)
+            virHashRemoveEntry(cbList->index, name);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(name);
+    return ret;
+}
+
+
+static void
+virObjectEventCallbackIndexRemove(virObjectEventCallbackListPtr cbList,
+                                  virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackBucketPtr bucket;
+    char *name;
+    size_t i;
+
+    if (!(name = virObjectEventCallbackIndexKey(cb->eventID,
+                                                cb->key_filter ? cb->key : NULL)))
+        return;
+
+    if (!(bucket = virHashLookup(cbList->index, name)))
+        goto cleanup;
+
+    for (i = 0; i < bucket->count; i++) {
+        if (bucket->callbacks[i] == cb) {
+            VIR_DELETE_ELEMENT(bucket->callbacks, i, bucket->count);
+            break;
+        }
+    }
+
+    if (bucket->count == 0)
+        virHashRemoveEntry(cbList->index, name);
+
+ cleanup:
+    VIR_FREE(name);
+}
+
+
 /**
  * virObjectEventCallbackListFree:
  * @list: event callback list head
@@ -174,6 +307,7 @@ virObjectEventCallbackListFree(virObjectEventCallbackListPtr list)
         VIR_FREE(list->callbacks[i]);
     }
     VIR_FREE(list->callbacks);
+    virHashFree(list->index);
     VIR_FREE(list);
 }
 
@@ -263,6 +397,7 @@ virObjectEventCallbackListRemoveID(virConnectPtr conn,
              * function won't end up with a double free error */
             if (doFreeCb && cb->freecb)
                 (*cb->freecb)(cb->opaque);
+            virObjectEventCallbackIndexRemove(cbList, cb);
             virObjectEventCallbackFree(cb);
             VIR_DELETE_ELEMENT(cbList->callbacks, i, cbList->count);
             return ret;
@@ -312,6 +447,7 @@ virObjectEventCallbackListPurgeMarked(virObjectEventCallbackListPtr cbList)
             virFreeCallback freecb = cbList->callbacks[n]->freecb;
             if (freecb)
                 (*freecb)(cbList->callbacks[n]->opaque);
+            virObjectEventCallbackIndexRemove(cbList, cbList->callbacks[n]);
             virObjectEventCallbackFree(cbList->callbacks[n]);
 
             VIR_DELETE_ELEMENT(cbList->callbacks, n, cbList->count);
@@ -454,8 +590,13 @@ virObjectEventCallbackListAddID(virConnectPtr conn,
     cb->filter_opaque = filter_opaque;
     cb->legacy = legacy;
 
-    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0)
+    if (virObjectEventCallbackIndexAdd(cbList, cb) < 0)
+        goto cleanup;
+
+    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0) {
+        virObjectEventCallbackIndexRemove(cbList, cb);
         goto cleanup;
+    }
 
     /* When additional filtering is being done, every client callback
      * is matched to exactly one server callback.  */
@@ -580,6 +721,10 @@ virObjectEventStateNew(void)
     if (VIR_ALLOC(state->callbacks) < 0)
         goto error;
 
+    if (!(state->callbacks->index = virHashCreate(10,
+                                                  virObjectEventCallbackBucketFree)))
+        goto error;
+
     if (!(state->queue = virObjectEventQueueNew()))
         goto error;
 
@@ -693,19 +838,50 @@ virObjectEventDispatchMatchCallback(virObjectEventPtr event,
 }
 
 
+/**
+ * virObjectEventStateDispatchCallbacks:
+ * @state: the event state object
+ * @event: the event to dispatch
+ * @callbacks: the list of registered callbacks
+ *
+ * Invoke every callback matching @event.  Only the index buckets for
+ * callbacks registered on all objects and on the object @event is
+ * about are visited; the two are walked in callbackID order so that
+ * callbacks still run in the order they were registered.
+ */
 static void
 virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
                                      virObjectEventPtr event,
                                      virObjectEventCallbackListPtr callbacks)
 {
-    size_t i;
-    /* Cache this now, since we may be dropping the lock,
-       and have more callbacks added. We're guaranteed not
-       to have any removed */
-    size_t cbCount = callbacks->count;
-
-    for (i = 0; i < cbCount; i++) {
-        virObjectEventCallbackPtr cb = callbacks->callbacks[i];
+    virObjectEventCallbackBucketPtr global;
+    virObjectEventCallbackBucketPtr keyed = NULL;
+    size_t i = 0;
+    size_t j = 0;
+    size_t globalCount = 0;
+    size_t keyedCount = 0;
+
+    /* Buckets are only freed once empty, and callbacks are only marked
+     * for deletion while dispatching, so the bucket pointers stay valid
+     * across dropping the lock. Cache the counts now, since we may have
+     * more callbacks added meanwhile. */
+    if ((global = virObjectEventCallbackIndexLookup(callbacks,
+                                                    event->eventID, NULL)))
+        globalCount = global->count;
+    if (event->meta.key &&
+        (keyed = virObjectEventCallbackIndexLookup(callbacks, event->eventID,
+                                                   event->meta.key)))
+        keyedCount = keyed->count;
+
+    while (i < globalCount || j < keyedCount) {
+        virObjectEventCallbackPtr cb;
+
+        if (j >= keyedCount ||
+            (i < globalCount &&
+             global->callbacks[i]->callbackID < keyed->callbacks[j]->callbackID))
+            cb = global->callbacks[i++];
+        else
+            cb = keyed->callbacks[j++];
 
         if (!virObjectEventDispatchMatchCallback(event, cb))
             continue;
@@ -102,6 +102,7 @@ void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def)
         virDomainSnapshotDiskDefClear(&def->disks[i]);
     VIR_FREE(def->disks);
     virDomainDefFree(def->dom);
+    VIR_FREE(def->domxml);
     virObjectUnref(def->cookie);
     VIR_FREE(def);
 }
@@ -194,9 +195,42 @@ virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
     return ret;
 }
 
+/* Format the <domain> element of a snapshot as it is going to be
+ * nested in <domainsnapshot> again by virDomainSnapshotDefFormat.  */
+static char *
+virDomainSnapshotDomainNodeFormat(xmlDocPtr doc,
+                                  xmlNodePtr node)
+{
+    xmlBufferPtr xmlbuf = NULL;
+    char *ret = NULL;
+
+    if (!(xmlbuf = xmlBufferCreate())) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (xmlNodeDump(xmlbuf, doc, node, 1, 1) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to convert the XML node tree"));
+        goto cleanup;
+    }
+
+    ignore_value(VIR_STRDUP(ret, (const char *)xmlBufferContent(xmlbuf)));
+
+ cleanup:
+    xmlBufferFree(xmlbuf);
+    return ret;
+}
+
 /* flags is bitwise-or of virDomainSnapshotParseFlags.
  * If flags does not include VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE, then
  * caps are ignored.
+ *
+ * VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN only takes effect together with
+ * VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE and leaves parsing the nested
+ * domain definition to virDomainSnapshotDefEnsureDom; parsing it is by
+ * far the most expensive part, and most snapshots loaded from disk are
+ * never reverted to.
  */
 static virDomainSnapshotDefPtr
 virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
@@ -282,10 +316,18 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
                                _("missing domain in snapshot"));
                 goto cleanup;
             }
-            def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
-                                             caps, xmlopt, NULL, domainflags);
-            if (!def->dom)
-                goto cleanup;
+            if (flags & VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN) {
+                if (!(def->domxml = virDomainSnapshotDomainNodeFormat(ctxt->node->doc,
+                                                                      domainNode)))
+                    goto cleanup;
+                def->domflags = domainflags;
+            } else {
+                def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
+                                                 caps, xmlopt, NULL,
+                                                 domainflags);
+                if (!def->dom)
+                    goto cleanup;
+            }
         } else {
             VIR_WARN("parsing older snapshot that lacks domain");
         }
@@ -435,6 +477,34 @@ virDomainSnapshotDefParseString(const char *xmlStr,
 }
 
 
+/**
+ * virDomainSnapshotDefEnsureDom:
+ * @def: snapshot def object
+ * @caps: driver capabilities
+ * @xmlopt: driver XML options
+ *
+ * Parse the domain definition of a snapshot that was loaded with
+ * VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN, so that def->dom can be used.
+ * Returns 0 on success, including when the snapshot has no domain
+ * definition at all, -1 on error.
+ */
+int
+virDomainSnapshotDefEnsureDom(virDomainSnapshotDefPtr def,
+                              virCapsPtr caps,
+                              virDomainXMLOptionPtr xmlopt)
+{
+    if (def->dom || !def->domxml)
+        return 0;
+
+    if (!(def->dom = virDomainDefParseString(def->domxml, caps, xmlopt, NULL,
+                                             def->domflags)))
+        return -1;
+
+    VIR_FREE(def->domxml);
+    return 0;
+}
+
+
 /**
  * virDomainSnapshotDefAssignExternalNames:
  * @def: snapshot def object
@@ -745,9 +815,18 @@ virDomainSnapshotDefFormat(const char *domain_uuid,
         virBufferAddLit(&buf, "</disks>\n");
     }
 
+    /* The unparsed domain definition was formatted with secure
+     * information in it, any other format has to parse it first.  */
+    if (!(flags & VIR_DOMAIN_DEF_FORMAT_SECURE) &&
+        virDomainSnapshotDefEnsureDom(def, caps, xmlopt) < 0)
+        goto error;
+
     if (def->dom) {
         if (virDomainDefFormatInternal(def->dom, caps, flags, &buf) < 0)
             goto error;
+    } else if (def->domxml) {
+        virBufferAdd(&buf, def->domxml, -1);
+        virBufferAddLit(&buf, "\n");
     } else if (domain_uuid) {
         virBufferAddLit(&buf, "<domain>\n");
         virBufferAdjustIndent(&buf, 2);
@@ -1028,44 +1107,43 @@ virDomainSnapshotForEachChild(virDomainSnapshotObjPtr snapshot,
     return snapshot->nchildren;
 }
 
-struct snapshot_act_on_descendant {
-    int number;
-    virHashIterator iter;
-    void *data;
-};
-
-static int
-virDomainSnapshotActOnDescendant(void *payload,
-                                 const void *name,
-                                 void *data)
-{
-    virDomainSnapshotObjPtr obj = payload;
-    struct snapshot_act_on_descendant *curr = data;
-
-    curr->number += 1 + virDomainSnapshotForEachDescendant(obj,
-                                                           curr->iter,
-                                                           curr->data);
-    (curr->iter)(payload, name, curr->data);
-    return 0;
-}
-
 /* Run iter(data) on all descendants of snapshot, while ignoring all
  * other entries in snapshots.  Return the number of descendants
- * visited.  No particular ordering is guaranteed.  */
+ * visited.  Descendants are visited children first, which allows iter
+ * to remove the snapshot it is called on; no other ordering is
+ * guaranteed.  The walk follows the child and parent links without
+ * recursing, so deep snapshot chains don't exhaust the stack.  */
 int
 virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                    virHashIterator iter,
                                    void *data)
 {
-    struct snapshot_act_on_descendant act;
+    virDomainSnapshotObjPtr curr = snapshot->first_child;
+    virDomainSnapshotObjPtr next;
+    int number = 0;
+
+    if (!curr)
+        return 0;
 
-    act.number = 0;
-    act.iter = iter;
-    act.data = data;
-    virDomainSnapshotForEachChild(snapshot,
-                                  virDomainSnapshotActOnDescendant, &act);
+    while (curr->first_child)
+        curr = curr->first_child;
 
-    return act.number;
+    while (curr != snapshot) {
+        /* Pick the next one before iter gets a chance to free curr */
+        if (curr->sibling) {
+            next = curr->sibling;
+            while (next->first_child)
+                next = next->first_child;
+        } else {
+            next = curr->parent;
+        }
+
+        (iter)(curr, curr->def->name, data);
+        number++;
+        curr = next;
+    }
+
+    return number;
 }
 
 /* Struct and callback function used as a hash table callback; each call
@@ -1123,6 +1201,28 @@ virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
     return act.err;
 }
 
+/* Link a newly defined snapshot to the parent named in its definition,
+ * or to the metaroot if it has no parent.  The parent has to be in
+ * the list already, which makes this O(1) unlike rebuilding all
+ * relations with virDomainSnapshotUpdateRelations.  */
+void
+virDomainSnapshotSetParent(virDomainSnapshotObjListPtr snapshots,
+                           virDomainSnapshotObjPtr snapshot)
+{
+    virDomainSnapshotObjPtr parent;
+
+    parent = virDomainSnapshotFindByName(snapshots, snapshot->def->parent);
+    if (!parent) {
+        VIR_WARN("snapshot %s lacks parent", snapshot->def->name);
+        parent = &snapshots->metaroot;
+    }
+
+    snapshot->parent = parent;
+    parent->nchildren++;
+    snapshot->sibling = parent->first_child;
+    parent->first_child = snapshot;
+}
+
 /* Prepare to reparent or delete snapshot, by removing it from its
  * current listed parent.  Note that when bulk removing all children
  * of a parent, it is faster to just 0 the count rather than calling
@@ -1220,6 +1320,7 @@ virDomainSnapshotRedefinePrep(virDomainPtr domain,
                               virDomainObjPtr vm,
                               virDomainSnapshotDefPtr *defptr,
                               virDomainSnapshotObjPtr *snap,
+                              virCapsPtr caps,
                               virDomainXMLOptionPtr xmlopt,
                               bool *update_current,
                               unsigned int flags)
@@ -1306,6 +1407,9 @@ virDomainSnapshotRedefinePrep(virDomainPtr domain,
             goto cleanup;
         }
 
+        if (virDomainSnapshotDefEnsureDom(other->def, caps, xmlopt) < 0)
+            goto cleanup;
+
         if (other->def->dom) {
             if (def->dom) {
                 if (!virDomainDefCheckABIStability(other->def->dom,
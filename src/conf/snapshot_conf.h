@@ -76,6 +76,12 @@ struct _virDomainSnapshotDef {
 
     virDomainDefPtr dom;
 
+    /* <domain> of a snapshot parsed with
+     * VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN, turned into dom by
+     * virDomainSnapshotDefEnsureDom on first use */
+    char *domxml;
+    unsigned int domflags;
+
     virObjectPtr cookie;
 
     /* Internal use.  */
@@ -101,6 +107,7 @@ typedef enum {
     VIR_DOMAIN_SNAPSHOT_PARSE_DISKS    = 1 << 1,
     VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL = 1 << 2,
     VIR_DOMAIN_SNAPSHOT_PARSE_OFFLINE  = 1 << 3,
+    VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN = 1 << 4,
 } virDomainSnapshotParseFlags;
 
 virDomainSnapshotDefPtr virDomainSnapshotDefParseString(const char *xmlStr,
@@ -113,6 +120,9 @@ virDomainSnapshotDefPtr virDomainSnapshotDefParseNode(xmlDocPtr xml,
                                                       virDomainXMLOptionPtr xmlopt,
                                                       unsigned int flags);
 void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def);
+int virDomainSnapshotDefEnsureDom(virDomainSnapshotDefPtr def,
+                                  virCapsPtr caps,
+                                  virDomainXMLOptionPtr xmlopt);
 char *virDomainSnapshotDefFormat(const char *domain_uuid,
                                  virDomainSnapshotDefPtr def,
                                  virCapsPtr caps,
@@ -146,6 +156,8 @@ int virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                        virHashIterator iter,
                                        void *data);
 int virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots);
+void virDomainSnapshotSetParent(virDomainSnapshotObjListPtr snapshots,
+                                virDomainSnapshotObjPtr snapshot);
 void virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot);
 
 # define VIR_DOMAIN_SNAPSHOT_FILTERS_METADATA \
@@ -184,6 +196,7 @@ int virDomainSnapshotRedefinePrep(virDomainPtr domain,
                                   virDomainObjPtr vm,
                                   virDomainSnapshotDefPtr *def,
                                   virDomainSnapshotObjPtr *snap,
+                                  virCapsPtr caps,
                                   virDomainXMLOptionPtr xmlopt,
                                   bool *update_current,
                                   unsigned int flags);
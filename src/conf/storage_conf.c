@@ -339,10 +339,77 @@ virStorageVolDefFree(virStorageVolDefPtr def)
     VIR_FREE(def->source.extents);
 
     virStorageSourceClear(&def->target);
+    VIR_FREE(def->indexKey);
+    VIR_FREE(def->indexPath);
     VIR_FREE(def);
 }
 
 
+virStorageVolJobPtr
+virStorageVolJobNew(int type,
+                    unsigned long long total)
+{
+    virStorageVolJobPtr job;
+
+    if (VIR_ALLOC(job) < 0)
+        return NULL;
+
+    if (virMutexInit(&job->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(job);
+        return NULL;
+    }
+
+    job->type = type;
+    job->total = total;
+
+    return job;
+}
+
+
+void
+virStorageVolJobFree(virStorageVolJobPtr job)
+{
+    if (!job)
+        return;
+
+    virMutexDestroy(&job->lock);
+    VIR_FREE(job);
+}
+
+
+/*
+ * Account @processed more bytes to @job, which may be NULL if the
+ * operation is not run as a job. Safe to call from several threads.
+ */
+void
+virStorageVolJobAddProgress(virStorageVolJobPtr job,
+                            unsigned long long processed)
+{
+    if (!job)
+        return;
+
+    virMutexLock(&job->lock);
+    job->processed += processed;
+    if (job->total && job->processed > job->total)
+        job->processed = job->total;
+    virMutexUnlock(&job->lock);
+}
+
+
+void
+virStorageVolJobGetProgress(virStorageVolJobPtr job,
+                            unsigned long long *processed,
+                            unsigned long long *total)
+{
+    virMutexLock(&job->lock);
+    *processed = job->processed;
+    *total = job->total;
+    virMutexUnlock(&job->lock);
+}
+
+
 void
 virStoragePoolSourceDeviceClear(virStoragePoolSourceDevicePtr dev)
 {
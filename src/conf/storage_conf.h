@@ -61,6 +61,29 @@ struct _virStorageVolSource {
 
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
+/* Identity of a file backed volume at the time it was probed */
+typedef struct _virStorageVolFingerprint virStorageVolFingerprint;
+typedef virStorageVolFingerprint *virStorageVolFingerprintPtr;
+struct _virStorageVolFingerprint {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+/* Progress of a background job running on a volume. The job is owned
+ * by the storage driver; backends only report progress through it. */
+typedef struct _virStorageVolJob virStorageVolJob;
+typedef virStorageVolJob *virStorageVolJobPtr;
+struct _virStorageVolJob {
+    virMutex lock;
+    int type; /* virStorageVolJobType */
+    unsigned long long processed;
+    unsigned long long total;
+};
+
 struct _virStorageVolDef {
     char *name;
     char *key;
@@ -68,9 +91,17 @@ struct _virStorageVolDef {
 
     bool building;
     unsigned int in_use;
+    virStorageVolJobPtr job; /* background job running on the volume */
 
     virStorageVolSource source;
     virStorageSource target;
+
+    virStorageVolFingerprint fingerprint;
+
+    /* Key and path the volume is indexed under by virstorageobj.c,
+     * which may differ from the current ones if those were changed */
+    char *indexKey;
+    char *indexPath;
 };
 
 typedef struct _virStorageVolDefList virStorageVolDefList;
@@ -289,6 +320,22 @@ virStoragePoolSaveConfig(const char *configFile,
 void
 virStorageVolDefFree(virStorageVolDefPtr def);
 
+virStorageVolJobPtr
+virStorageVolJobNew(int type,
+                    unsigned long long total);
+
+void
+virStorageVolJobFree(virStorageVolJobPtr job);
+
+void
+virStorageVolJobAddProgress(virStorageVolJobPtr job,
+                            unsigned long long processed);
+
+void
+virStorageVolJobGetProgress(virStorageVolJobPtr job,
+                            unsigned long long *processed,
+                            unsigned long long *total);
+
 void
 virStoragePoolSourceClear(virStoragePoolSourcePtr source);
 
@@ -27,6 +27,10 @@
 #include "object_event_private.h"
 #include "datatypes.h"
 #include "virlog.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("conf.storage_event");
 
@@ -56,12 +60,24 @@ struct _virStoragePoolEventRefresh {
 typedef struct _virStoragePoolEventRefresh virStoragePoolEventRefresh;
 typedef virStoragePoolEventRefresh *virStoragePoolEventRefreshPtr;
 
+struct _virStoragePoolEventVolumeJob {
+    virStoragePoolEvent parent;
+
+    char *volume;
+    int type;
+    int status;
+};
+typedef struct _virStoragePoolEventVolumeJob virStoragePoolEventVolumeJob;
+typedef virStoragePoolEventVolumeJob *virStoragePoolEventVolumeJobPtr;
+
 static virClassPtr virStoragePoolEventClass;
 static virClassPtr virStoragePoolEventLifecycleClass;
 static virClassPtr virStoragePoolEventRefreshClass;
+static virClassPtr virStoragePoolEventVolumeJobClass;
 static void virStoragePoolEventDispose(void *obj);
 static void virStoragePoolEventLifecycleDispose(void *obj);
 static void virStoragePoolEventRefreshDispose(void *obj);
+static void virStoragePoolEventVolumeJobDispose(void *obj);
 
 static int
 virStoragePoolEventsOnceInit(void)
@@ -84,6 +100,12 @@ virStoragePoolEventsOnceInit(void)
                       sizeof(virStoragePoolEventRefresh),
                       virStoragePoolEventRefreshDispose)))
         return -1;
+    if (!(virStoragePoolEventVolumeJobClass =
+          virClassNew(virStoragePoolEventClass,
+                      "virStoragePoolEventVolumeJob",
+                      sizeof(virStoragePoolEventVolumeJob),
+                      virStoragePoolEventVolumeJobDispose)))
+        return -1;
     return 0;
 }
 
@@ -113,6 +135,16 @@ virStoragePoolEventRefreshDispose(void *obj)
 }
 
 
+static void
+virStoragePoolEventVolumeJobDispose(void *obj)
+{
+    virStoragePoolEventVolumeJobPtr event = obj;
+    VIR_DEBUG("obj=%p", event);
+
+    VIR_FREE(event->volume);
+}
+
+
 static void
 virStoragePoolEventDispatchDefaultFunc(virConnectPtr conn,
                                        virObjectEventPtr event,
@@ -146,6 +178,19 @@ virStoragePoolEventDispatchDefaultFunc(virConnectPtr conn,
             goto cleanup;
         }
 
+    case VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB:
+        {
+            virStoragePoolEventVolumeJobPtr storagePoolVolumeJobEvent;
+
+            storagePoolVolumeJobEvent = (virStoragePoolEventVolumeJobPtr)event;
+            ((virConnectStoragePoolEventVolumeJobCallback)cb)(conn, pool,
+                                                              storagePoolVolumeJobEvent->volume,
+                                                              storagePoolVolumeJobEvent->type,
+                                                              storagePoolVolumeJobEvent->status,
+                                                              cbopaque);
+            goto cleanup;
+        }
+
     case VIR_STORAGE_POOL_EVENT_ID_LAST:
         break;
     }
@@ -304,3 +349,44 @@ virStoragePoolEventRefreshNew(const char *name,
 
     return (virObjectEventPtr)event;
 }
+
+
+/**
+ * virStoragePoolEventVolumeJobNew:
+ * @name: name of the storage pool object the event describes
+ * @uuid: uuid of the storage pool object the event describes
+ * @volume: name of the volume the job ran on
+ * @type: type of the job, one of virStorageVolJobType
+ * @status: outcome of the job, one of virStoragePoolEventVolumeJobStatus
+ *
+ * Create a new storage pool volume job event.
+ */
+virObjectEventPtr
+virStoragePoolEventVolumeJobNew(const char *name,
+                                const unsigned char *uuid,
+                                const char *volume,
+                                int type,
+                                int status)
+{
+    virStoragePoolEventVolumeJobPtr event;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (virStoragePoolEventsInitialize() < 0)
+        return NULL;
+
+    virUUIDFormat(uuid, uuidstr);
+    if (!(event = virObjectEventNew(virStoragePoolEventVolumeJobClass,
+                                    virStoragePoolEventDispatchDefaultFunc,
+                                    VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB,
+                                    0, name, uuid, uuidstr)))
+        return NULL;
+
+    if (VIR_STRDUP(event->volume, volume) < 0) {
+        virObjectUnref(event);
+        return NULL;
+    }
+    event->type = type;
+    event->status = status;
+
+    return (virObjectEventPtr)event;
+}
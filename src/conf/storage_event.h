@@ -61,4 +61,11 @@ virObjectEventPtr
 virStoragePoolEventRefreshNew(const char *name,
                               const unsigned char *uuid);
 
+virObjectEventPtr
+virStoragePoolEventVolumeJobNew(const char *name,
+                                const unsigned char *uuid,
+                                const char *volume,
+                                int type,
+                                int status);
+
 #endif
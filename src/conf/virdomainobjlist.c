@@ -30,6 +30,7 @@
 #include "snapshot_conf.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhostcpu.h"
 #include "virlog.h"
 #include "virstring.h"
 
@@ -38,7 +39,48 @@
 VIR_LOG_INIT("conf.virdomainobjlist");
 
 static virClassPtr virDomainObjListClass;
+static virClassPtr virDomainObjListSnapshotClass;
 static void virDomainObjListDispose(void *obj);
+static void virDomainObjListSnapshotDispose(void *obj);
+
+
+typedef struct _virDomainObjListSnapshotEntry virDomainObjListSnapshotEntry;
+typedef virDomainObjListSnapshotEntry *virDomainObjListSnapshotEntryPtr;
+struct _virDomainObjListSnapshotEntry {
+    char *key;
+    virDomainObjPtr vm;
+};
+
+/*
+ * An immutable copy of the list contents. Readers grab a reference
+ * to the currently published snapshot and then look up and iterate
+ * domains without holding the list lock, so that listing or looking
+ * up domains never waits for a define/undefine in progress (nor the
+ * other way round). Each entry holds a reference on its domain object,
+ * so objects stay valid for as long as any reader uses the snapshot.
+ */
+typedef struct _virDomainObjListSnapshot virDomainObjListSnapshot;
+typedef virDomainObjListSnapshot *virDomainObjListSnapshotPtr;
+struct _virDomainObjListSnapshot {
+    virObject parent;
+
+    size_t nentries;
+    /* both sorted by key, for lookup-by-uuid and lookup-by-name */
+    virDomainObjListSnapshotEntryPtr byUUID;
+    virDomainObjListSnapshotEntryPtr byName;
+};
+
+
+/* How many removed domains are remembered for incremental listing.
+ * Clients whose cursor predates the oldest one get a full listing. */
+#define VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX 1024
+
+typedef struct _virDomainObjListTombstone virDomainObjListTombstone;
+typedef virDomainObjListTombstone *virDomainObjListTombstonePtr;
+struct _virDomainObjListTombstone {
+    virDomainDefPtr def; /* only name, UUID and ID are filled in */
+    unsigned long long generation;
+};
 
 
 struct _virDomainObjList {
@@ -51,6 +93,26 @@ struct _virDomainObjList {
     /* name -> virDomainObj mapping for O(1),
      * lockless lookup-by-name */
     virHashTable *objsName;
+
+    /* Guards @snapshot and the tombstones and is never held for
+     * long. The snapshot is rebuilt from the hash tables whenever
+     * they change; NULL means it is stale and has to be rebuilt
+     * before use. */
+    virMutex snapshotLock;
+    virDomainObjListSnapshotPtr snapshot;
+
+    /* Ring of recently removed domains, oldest at @tombstonesStart */
+    virDomainObjListTombstonePtr tombstones;
+    size_t ntombstones;
+    size_t tombstonesStart;
+    /* Cursors older than this can't be served incrementally */
+    unsigned long long tombstonesExpired;
+
+    /* Used to parse the definitions of compacted domains again. Set by
+     * the first virDomainObjListCompact and never changed afterwards, so
+     * that they can be read without the list lock. */
+    virCapsPtr compactCaps;
+    virDomainXMLOptionPtr compactXMLOpt;
 };
 
 
@@ -62,6 +124,12 @@ static int virDomainObjListOnceInit(void)
                                               virDomainObjListDispose)))
         return -1;
 
+    if (!(virDomainObjListSnapshotClass = virClassNew(virClassForObject(),
+                                                      "virDomainObjListSnapshot",
+                                                      sizeof(virDomainObjListSnapshot),
+                                                      virDomainObjListSnapshotDispose)))
+        return -1;
+
     return 0;
 }
 
@@ -77,6 +145,15 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (!(doms = virObjectRWLockableNew(virDomainObjListClass)))
         return NULL;
 
+    if (virMutexInit(&doms->snapshotLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        virObjectUnref(doms);
+        return NULL;
+    }
+
+    doms->tombstonesExpired = virDomainObjGetGeneration();
+
     if (!(doms->objs = virHashCreate(50, virObjectFreeHashData)) ||
         !(doms->objsName = virHashCreate(50, virObjectFreeHashData))) {
         virObjectUnref(doms);
@@ -91,50 +168,384 @@ static void virDomainObjListDispose(void *obj)
 {
     virDomainObjListPtr doms = obj;
 
+    size_t i;
+
+    for (i = 0; i < doms->ntombstones; i++)
+        virDomainDefFree(doms->tombstones[i].def);
+    VIR_FREE(doms->tombstones);
+    virObjectUnref(doms->snapshot);
+    virMutexDestroy(&doms->snapshotLock);
     virHashFree(doms->objs);
     virHashFree(doms->objsName);
+    virObjectUnref(doms->compactCaps);
+    virObjectUnref(doms->compactXMLOpt);
+}
+
+
+/*
+ * Parses the full definition of @vm, which must be locked, again if it
+ * was compacted by virDomainObjListCompact.
+ */
+static int
+virDomainObjListInflate(virDomainObjListPtr doms,
+                        virDomainObjPtr vm)
+{
+    virDomainDefPtr def;
+
+    if (!vm->compactConfig)
+        return 0;
+
+    VIR_DEBUG("Parsing definition of domain '%s' from '%s' again",
+              vm->def->name, vm->compactConfig);
+
+    if (!(def = virDomainDefParseFile(vm->compactConfig, doms->compactCaps,
+                                      doms->compactXMLOpt, NULL,
+                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE |
+                                      VIR_DOMAIN_DEF_PARSE_ALLOW_POST_PARSE_FAIL)))
+        return -1;
+
+    if (STRNEQ(def->name, vm->def->name) ||
+        memcmp(def->uuid, vm->def->uuid, VIR_UUID_BUFLEN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("configuration file '%s' no longer describes "
+                         "domain '%s'"),
+                       vm->compactConfig, vm->def->name);
+        virDomainDefFree(def);
+        return -1;
+    }
+
+    virDomainDefFree(vm->def);
+    vm->def = def;
+    VIR_FREE(vm->compactConfig);
+    return 0;
+}
+
+
+static void
+virDomainObjListSnapshotEntriesFree(virDomainObjListSnapshotEntryPtr entries,
+                                    size_t nentries)
+{
+    size_t i;
+
+    if (!entries)
+        return;
+
+    for (i = 0; i < nentries; i++) {
+        VIR_FREE(entries[i].key);
+        virObjectUnref(entries[i].vm);
+    }
+    VIR_FREE(entries);
+}
+
+
+static void
+virDomainObjListSnapshotDispose(void *obj)
+{
+    virDomainObjListSnapshotPtr snap = obj;
+
+    virDomainObjListSnapshotEntriesFree(snap->byUUID, snap->nentries);
+    virDomainObjListSnapshotEntriesFree(snap->byName, snap->nentries);
+}
+
+
+static int
+virDomainObjListSnapshotEntryCompare(const void *a,
+                                     const void *b)
+{
+    const virDomainObjListSnapshotEntry *ea = a;
+    const virDomainObjListSnapshotEntry *eb = b;
+
+    return strcmp(ea->key, eb->key);
+}
+
+
+struct virDomainObjListSnapshotData {
+    virDomainObjListSnapshotEntryPtr entries;
+    size_t nentries;
+    size_t maxentries;
+    bool oom;
+};
+
+
+static int
+virDomainObjListSnapshotIterator(void *payload,
+                                 const void *name,
+                                 void *opaque)
+{
+    struct virDomainObjListSnapshotData *data = opaque;
+    virDomainObjListSnapshotEntryPtr entry;
+
+    if (data->oom || data->nentries == data->maxentries)
+        return 0;
+
+    entry = &data->entries[data->nentries];
+    if (VIR_STRDUP_QUIET(entry->key, name) < 0) {
+        data->oom = true;
+        return 0;
+    }
+    entry->vm = virObjectRef(payload);
+    data->nentries++;
+    return 0;
+}
+
+
+static virDomainObjListSnapshotEntryPtr
+virDomainObjListSnapshotCopyTable(virHashTablePtr table,
+                                  size_t nentries)
+{
+    struct virDomainObjListSnapshotData data = { NULL, 0, nentries, false };
+
+    /* Allocate at least one element so that an empty list
+     * is distinguishable from an allocation failure */
+    if (VIR_ALLOC_N_QUIET(data.entries, nentries + 1) < 0)
+        return NULL;
+
+    virHashForEach(table, virDomainObjListSnapshotIterator, &data);
+    if (data.oom || data.nentries != nentries) {
+        virDomainObjListSnapshotEntriesFree(data.entries, data.nentries);
+        return NULL;
+    }
+
+    qsort(data.entries, data.nentries, sizeof(*data.entries),
+          virDomainObjListSnapshotEntryCompare);
+
+    return data.entries;
+}
+
+
+/*
+ * The caller must hold lock on 'doms' (either read or write).
+ *
+ * Returns a new reference to the published snapshot, building
+ * and publishing one first if the current one is stale. Does not
+ * report errors, returns NULL on allocation failure.
+ */
+static virDomainObjListSnapshotPtr
+virDomainObjListSnapshotRefresh(virDomainObjListPtr doms)
+{
+    virDomainObjListSnapshotPtr snap = NULL;
+    size_t nentries;
+
+    virMutexLock(&doms->snapshotLock);
+    snap = virObjectRef(doms->snapshot);
+    virMutexUnlock(&doms->snapshotLock);
+
+    if (snap)
+        return snap;
+
+    if (virDomainObjListInitialize() < 0 ||
+        !(snap = virObjectNew(virDomainObjListSnapshotClass)))
+        return NULL;
+
+    /* Both tables are kept in sync, but be defensive about
+     * in-place removals done via virDomainObjListRemoveLocked */
+    nentries = virHashSize(doms->objs);
+    if (virHashSize(doms->objsName) != nentries ||
+        !(snap->byUUID = virDomainObjListSnapshotCopyTable(doms->objs,
+                                                           nentries)))
+        goto error;
+    snap->nentries = nentries;
+    if (!(snap->byName = virDomainObjListSnapshotCopyTable(doms->objsName,
+                                                           nentries)))
+        goto error;
+
+    /* Somebody holding the read lock might have published
+     * an identical snapshot in the meantime; prefer that one */
+    virMutexLock(&doms->snapshotLock);
+    if (doms->snapshot) {
+        virObjectUnref(snap);
+        snap = virObjectRef(doms->snapshot);
+    } else {
+        doms->snapshot = virObjectRef(snap);
+    }
+    virMutexUnlock(&doms->snapshotLock);
+
+    return snap;
+
+ error:
+    virObjectUnref(snap);
+    return NULL;
+}
+
+
+/*
+ * The caller must hold lock on 'doms'. To be called whenever
+ * the hash tables are modified.
+ */
+static void
+virDomainObjListSnapshotInvalidate(virDomainObjListPtr doms)
+{
+    virDomainObjListSnapshotPtr old;
+
+    virMutexLock(&doms->snapshotLock);
+    old = doms->snapshot;
+    doms->snapshot = NULL;
+    virMutexUnlock(&doms->snapshotLock);
+
+    virObjectUnref(old);
 }
 
 
-static int virDomainObjListSearchID(const void *payload,
-                                    const void *name ATTRIBUTE_UNUSED,
-                                    const void *data)
+/*
+ * The caller must hold write lock on 'doms' and call this right
+ * before releasing it, so that readers find a fresh snapshot and
+ * don't need to take the list lock themselves. If building one
+ * fails the snapshot stays stale and the next reader retries.
+ */
+static void
+virDomainObjListSnapshotPublish(virDomainObjListPtr doms)
 {
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    const int *id = data;
-    int want = 0;
+    virObjectUnref(virDomainObjListSnapshotRefresh(doms));
+}
 
+
+/*
+ * Returns a new reference to an up-to-date snapshot of @doms
+ * without locking @doms in the common case, or NULL with an
+ * error reported.
+ */
+static virDomainObjListSnapshotPtr
+virDomainObjListSnapshotGet(virDomainObjListPtr doms)
+{
+    virDomainObjListSnapshotPtr snap;
+
+    virMutexLock(&doms->snapshotLock);
+    snap = virObjectRef(doms->snapshot);
+    virMutexUnlock(&doms->snapshotLock);
+
+    if (snap)
+        return snap;
+
+    virObjectRWLockRead(doms);
+    snap = virDomainObjListSnapshotRefresh(doms);
+    virObjectRWUnlock(doms);
+
+    if (!snap)
+        virReportOOMError();
+
+    return snap;
+}
+
+
+/*
+ * Calls @iter for each domain in the list without holding the list
+ * lock. Returns 0 on success, -1 with an error reported if no
+ * snapshot could be obtained.
+ */
+static int
+virDomainObjListSnapshotForEach(virDomainObjListPtr doms,
+                                virHashIterator iter,
+                                void *opaque)
+{
+    virDomainObjListSnapshotPtr snap;
+    size_t i;
+
+    if (!(snap = virDomainObjListSnapshotGet(doms)))
+        return -1;
+
+    for (i = 0; i < snap->nentries; i++)
+        iter(snap->byUUID[i].vm, snap->byUUID[i].key, opaque);
+
+    virObjectUnref(snap);
+    return 0;
+}
+
+
+static virDomainObjPtr
+virDomainObjListSnapshotLookup(virDomainObjListSnapshotEntryPtr entries,
+                               size_t nentries,
+                               const char *key)
+{
+    virDomainObjListSnapshotEntry needle = { (char *) key, NULL };
+    virDomainObjListSnapshotEntryPtr entry;
+
+    entry = bsearch(&needle, entries, nentries, sizeof(*entries),
+                    virDomainObjListSnapshotEntryCompare);
+
+    return entry ? entry->vm : NULL;
+}
+
+
+/*
+ * Locks @obj found in the snapshot (which must still be referenced
+ * by the caller so that @obj is guaranteed to be alive) and checks
+ * it is not being removed. If @ref is true an extra reference is
+ * given to the caller.
+ */
+static virDomainObjPtr
+virDomainObjListSnapshotClaim(virDomainObjPtr obj,
+                              bool ref)
+{
+    if (!obj)
+        return NULL;
+
+    if (ref)
+        virObjectRef(obj);
     virObjectLock(obj);
-    if (virDomainObjIsActive(obj) &&
-        obj->def->id == *id)
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
+    if (obj->removing) {
+        virObjectUnlock(obj);
+        if (ref)
+            virObjectUnref(obj);
+        return NULL;
+    }
+
+    return obj;
+}
+
+
+/*
+ * Like virDomainObjListSnapshotClaim, but also makes sure the full
+ * definition of the claimed domain is in memory.
+ */
+static virDomainObjPtr
+virDomainObjListClaimInflated(virDomainObjListPtr doms,
+                              virDomainObjPtr obj,
+                              bool ref)
+{
+    if (!(obj = virDomainObjListSnapshotClaim(obj, ref)))
+        return NULL;
+
+    if (virDomainObjListInflate(doms, obj) < 0) {
+        virObjectUnlock(obj);
+        if (ref)
+            virObjectUnref(obj);
+        return NULL;
+    }
+
+    return obj;
 }
 
+
 static virDomainObjPtr
 virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
                                  int id,
                                  bool ref)
 {
-    virDomainObjPtr obj;
-    virObjectRWLockRead(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id, NULL);
-    if (ref) {
-        virObjectRef(obj);
-        virObjectRWUnlock(doms);
-    }
-    if (obj) {
-        virObjectLock(obj);
-        if (obj->removing) {
-            virObjectUnlock(obj);
-            if (ref)
-                virObjectUnref(obj);
-            obj = NULL;
+    virDomainObjListSnapshotPtr snap;
+    virDomainObjPtr obj = NULL;
+    size_t i;
+
+    if (!(snap = virDomainObjListSnapshotGet(doms)))
+        return NULL;
+
+    for (i = 0; i < snap->nentries; i++) {
+        virDomainObjPtr vm = snap->byUUID[i].vm;
+        bool want;
+
+        virObjectLock(vm);
+        want = virDomainObjIsActive(vm) && vm->def->id == id;
+        virObjectUnlock(vm);
+
+        if (want) {
+            obj = vm;
+            break;
         }
     }
-    if (!ref)
-        virObjectRWUnlock(doms);
+
+    obj = virDomainObjListSnapshotClaim(obj, ref);
+    virObjectUnref(snap);
     return obj;
 }
 
@@ -158,27 +569,17 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
                                    bool ref)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virDomainObjListSnapshotPtr snap;
     virDomainObjPtr obj;
 
-    virObjectRWLockRead(doms);
+    if (!(snap = virDomainObjListSnapshotGet(doms)))
+        return NULL;
+
     virUUIDFormat(uuid, uuidstr);
 
-    obj = virHashLookup(doms->objs, uuidstr);
-    if (ref) {
-        virObjectRef(obj);
-        virObjectRWUnlock(doms);
-    }
-    if (obj) {
-        virObjectLock(obj);
-        if (obj->removing) {
-            virObjectUnlock(obj);
-            if (ref)
-                virObjectUnref(obj);
-            obj = NULL;
-        }
-    }
-    if (!ref)
-        virObjectRWUnlock(doms);
+    obj = virDomainObjListSnapshotLookup(snap->byUUID, snap->nentries, uuidstr);
+    obj = virDomainObjListClaimInflated(doms, obj, ref);
+    virObjectUnref(snap);
     return obj;
 }
 
@@ -202,20 +603,15 @@ virDomainObjListFindByUUIDRef(virDomainObjListPtr doms,
 virDomainObjPtr virDomainObjListFindByName(virDomainObjListPtr doms,
                                            const char *name)
 {
+    virDomainObjListSnapshotPtr snap;
     virDomainObjPtr obj;
 
-    virObjectRWLockRead(doms);
-    obj = virHashLookup(doms->objsName, name);
-    virObjectRef(obj);
-    virObjectRWUnlock(doms);
-    if (obj) {
-        virObjectLock(obj);
-        if (obj->removing) {
-            virObjectUnlock(obj);
-            virObjectUnref(obj);
-            obj = NULL;
-        }
-    }
+    if (!(snap = virDomainObjListSnapshotGet(doms)))
+        return NULL;
+
+    obj = virDomainObjListSnapshotLookup(snap->byName, snap->nentries, name);
+    obj = virDomainObjListClaimInflated(doms, obj, true);
+    virObjectUnref(snap);
     return obj;
 }
 
@@ -250,6 +646,9 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
     /* See if a VM with matching UUID already exists */
     if ((vm = virHashLookup(doms->objs, uuidstr))) {
         virObjectLock(vm);
+        if (virDomainObjListInflate(doms, vm) < 0)
+            goto error;
+
         /* UUID matches, but if names don't match, refuse it */
         if (STRNEQ(vm->def->name, def->name)) {
             virUUIDFormat(vm->def->uuid, uuidstr);
@@ -308,6 +707,8 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
         /* Since domain is in two hash tables, increment the
          * reference counter */
         virObjectRef(vm);
+
+        virDomainObjListSnapshotInvalidate(doms);
     }
  cleanup:
     return vm;
@@ -329,11 +730,66 @@ virDomainObjPtr virDomainObjListAdd(virDomainObjListPtr doms,
 
     virObjectRWLockWrite(doms);
     ret = virDomainObjListAddLocked(doms, def, xmlopt, flags, oldDef);
+    virDomainObjListSnapshotPublish(doms);
     virObjectRWUnlock(doms);
     return ret;
 }
 
 
+/*
+ * Remember that @dom was removed so that incremental listing can
+ * report it. The caller must hold lock on 'doms' and 'dom'.
+ */
+static void
+virDomainObjListAddTombstone(virDomainObjListPtr doms,
+                             virDomainObjPtr dom)
+{
+    virDomainObjListTombstonePtr tomb;
+    virDomainDefPtr def;
+    virErrorPtr orig_err = virSaveLastError();
+    unsigned long long generation = virDomainObjNextGeneration();
+
+    /* Removal itself can't fail, don't let this clobber the error
+     * the caller might be about to report */
+    def = virDomainDefNewFull(dom->def->name, dom->def->uuid, -1);
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    } else {
+        virResetLastError();
+    }
+
+    virMutexLock(&doms->snapshotLock);
+
+    if (!def || (!doms->tombstones &&
+                 VIR_ALLOC_N_QUIET(doms->tombstones,
+                                   VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX) < 0)) {
+        /* Without the record clients relying on it must start over */
+        doms->tombstonesExpired = generation;
+        virMutexUnlock(&doms->snapshotLock);
+        virDomainDefFree(def);
+        return;
+    }
+
+    if (doms->ntombstones == VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX) {
+        tomb = &doms->tombstones[doms->tombstonesStart];
+        doms->tombstonesExpired = tomb->generation;
+        virDomainDefFree(tomb->def);
+        doms->tombstonesStart = (doms->tombstonesStart + 1) %
+                                VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX;
+        doms->ntombstones--;
+    }
+
+    tomb = &doms->tombstones[(doms->tombstonesStart + doms->ntombstones) %
+                             VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX];
+    tomb->def = def;
+    tomb->generation = generation;
+    doms->ntombstones++;
+
+    virMutexUnlock(&doms->snapshotLock);
+}
+
+
 /*
  * The caller must hold a lock on the driver owning 'doms',
  * and must also have locked 'dom', to ensure no one else
@@ -353,8 +809,11 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
     virObjectLock(dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
+    virDomainObjListSnapshotInvalidate(doms);
+    virDomainObjListAddTombstone(doms, dom);
     virObjectUnlock(dom);
     virObjectUnref(dom);
+    virDomainObjListSnapshotPublish(doms);
     virObjectRWUnlock(doms);
 }
 
@@ -418,6 +877,10 @@ virDomainObjListRename(virDomainObjListPtr doms,
     if (rc < 0)
         goto cleanup;
 
+    virDomainObjBumpGeneration(dom);
+    virDomainObjListSnapshotInvalidate(doms);
+    virDomainObjListSnapshotPublish(doms);
+
     ret = 0;
  cleanup:
     virObjectRWUnlock(doms);
@@ -436,90 +899,221 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
+    /* Readers still holding an older snapshot must not pick it up */
+    dom->removing = true;
     virUUIDFormat(dom->def->uuid, uuidstr);
 
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
+    virDomainObjListSnapshotInvalidate(doms);
+    virDomainObjListAddTombstone(doms, dom);
     virObjectUnlock(dom);
 }
 
 
+/* Upper bound of threads parsing domain configs at daemon startup */
+#define VIR_DOMAIN_OBJ_LIST_LOAD_THREADS 8
+
+typedef struct _virDomainObjListLoadEntry virDomainObjListLoadEntry;
+typedef virDomainObjListLoadEntry *virDomainObjListLoadEntryPtr;
+struct _virDomainObjListLoadEntry {
+    char *name;
+
+    /* filled in by the parse workers */
+    virDomainDefPtr def; /* inactive config */
+    int autostart;
+    virDomainObjPtr obj; /* live status, unlocked */
+};
+
+typedef struct _virDomainObjListLoadData virDomainObjListLoadData;
+typedef virDomainObjListLoadData *virDomainObjListLoadDataPtr;
+struct _virDomainObjListLoadData {
+    virMutex lock;
+    size_t next; /* first entry not picked up by a worker yet */
+
+    virDomainObjListLoadEntryPtr entries;
+    size_t nentries;
+
+    const char *configDir;
+    const char *autostartDir;
+    bool liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+};
+
+
+static int
+virDomainObjListParseConfig(virDomainObjListLoadDataPtr data,
+                            virDomainObjListLoadEntryPtr entry)
+{
+    char *configFile = NULL, *autostartLink = NULL;
+    int ret = -1;
+
+    if ((configFile = virDomainConfigFile(data->configDir, entry->name)) == NULL)
+        goto cleanup;
+    if (!(entry->def = virDomainDefParseFile(configFile, data->caps,
+                                             data->xmlopt, NULL,
+                                             VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                             VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                             VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE |
+                                             VIR_DOMAIN_DEF_PARSE_ALLOW_POST_PARSE_FAIL)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(data->autostartDir,
+                                             entry->name)) == NULL)
+        goto cleanup;
+
+    if ((entry->autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virDomainDefFree(entry->def);
+        entry->def = NULL;
+    }
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+    return ret;
+}
+
+
+static int
+virDomainObjListParseStatus(virDomainObjListLoadDataPtr data,
+                            virDomainObjListLoadEntryPtr entry)
+{
+    char *statusFile = NULL;
+
+    if ((statusFile = virDomainConfigFile(data->configDir, entry->name)) == NULL)
+        return -1;
+
+    entry->obj = virDomainObjParseFile(statusFile, data->caps, data->xmlopt,
+                                       VIR_DOMAIN_DEF_PARSE_STATUS |
+                                       VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                       VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                       VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                       VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE |
+                                       VIR_DOMAIN_DEF_PARSE_ALLOW_POST_PARSE_FAIL);
+    VIR_FREE(statusFile);
+
+    if (!entry->obj)
+        return -1;
+
+    /* The object is locked again by whichever thread adds it to the list */
+    virObjectUnlock(entry->obj);
+    return 0;
+}
+
+
+static void
+virDomainObjListLoadWorker(void *opaque)
+{
+    virDomainObjListLoadDataPtr data = opaque;
+    virDomainObjListLoadEntryPtr entry;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->next == data->nentries) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        entry = &data->entries[data->next++];
+        virMutexUnlock(&data->lock);
+
+        VIR_INFO("Loading config file '%s.xml'", entry->name);
+        /* NB: errors are reported once the entry is added to the list */
+        if (data->liveStatus)
+            ignore_value(virDomainObjListParseStatus(data, entry));
+        else
+            ignore_value(virDomainObjListParseConfig(data, entry));
+    }
+}
+
+
+/*
+ * Parses all entries of @data, using up to
+ * VIR_DOMAIN_OBJ_LIST_LOAD_THREADS threads. The calling thread
+ * takes part in parsing too, so this works even if no thread
+ * can be spawned.
+ */
+static void
+virDomainObjListLoadParseAll(virDomainObjListLoadDataPtr data)
+{
+    virThread threads[VIR_DOMAIN_OBJ_LIST_LOAD_THREADS - 1];
+    size_t nthreads = VIR_DOMAIN_OBJ_LIST_LOAD_THREADS;
+    int ncpus;
+    size_t i;
+
+    if ((ncpus = virHostCPUGetCount()) > 0 && (size_t) ncpus < nthreads)
+        nthreads = ncpus;
+    if (data->nentries < nthreads)
+        nthreads = data->nentries;
+
+    /* account for the calling thread */
+    if (nthreads > 0)
+        nthreads--;
+
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            virDomainObjListLoadWorker, data) < 0) {
+            VIR_WARN("Failed to create config loading thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
+        }
+    }
+    nthreads = i;
+
+    virDomainObjListLoadWorker(data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+}
+
+
 static virDomainObjPtr
 virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
                            virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
+                           virDomainObjListLoadEntryPtr entry,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
-    int autostart;
     virDomainDefPtr oldDef = NULL;
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
-                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE |
-                                      VIR_DOMAIN_DEF_PARSE_ALLOW_POST_PARSE_FAIL)))
-        goto error;
-
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
+    if (!entry->def)
+        return NULL;
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
+    if (!(dom = virDomainObjListAddLocked(doms, entry->def, xmlopt,
+                                          0, &oldDef)))
+        return NULL;
+    entry->def = NULL;
 
-    dom->autostart = autostart;
+    dom->autostart = entry->autostart;
 
     if (notify)
         (*notify)(dom, oldDef == NULL, opaque);
 
     virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
-
- error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    virDomainDefFree(def);
-    return NULL;
 }
 
 
 static virDomainObjPtr
 virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
+                           virDomainObjListLoadEntryPtr entry,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = entry->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
+    if (!obj)
+        return NULL;
 
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE |
-                                      VIR_DOMAIN_DEF_PARSE_ALLOW_POST_PARSE_FAIL)))
-        goto error;
+    entry->obj = NULL;
+    virObjectLock(obj);
 
     virUUIDFormat(obj->def->uuid, uuidstr);
 
@@ -542,19 +1136,26 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
      * reference counter */
     virObjectRef(obj);
 
+    virDomainObjListSnapshotInvalidate(doms);
+
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
  error:
+    virObjectUnlock(obj);
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
 
+/*
+ * The config files are parsed in parallel, which is where nearly all
+ * the time goes with many domains, and without holding the list lock.
+ * Domains are then added to the list in the directory order, same as
+ * if the files were loaded one by one.
+ */
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -565,8 +1166,17 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    virDomainObjListLoadData data = {
+        .configDir = configDir,
+        .autostartDir = autostartDir,
+        .liveStatus = liveStatus,
+        .caps = caps,
+        .xmlopt = xmlopt,
+    };
     DIR *dir;
     struct dirent *entry;
+    char *name = NULL;
+    size_t i;
     int ret = -1;
     int rc;
 
@@ -575,49 +1185,160 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectRWLockWrite(doms);
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_DIR_CLOSE(dir);
+        return -1;
+    }
 
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
-
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
+        if (VIR_STRDUP(name, entry->d_name) < 0 ||
+            VIR_EXPAND_N(data.entries, data.nentries, 1) < 0) {
+            VIR_FREE(name);
+            ret = -1;
+            break;
+        }
+        data.entries[data.nentries - 1].name = name;
+        name = NULL;
+    }
+
+    VIR_DIR_CLOSE(dir);
+
+    virDomainObjListLoadParseAll(&data);
+
+    virObjectRWLockWrite(doms);
+
+    for (i = 0; i < data.nentries; i++) {
+        virDomainObjPtr dom;
+
         /* NB: ignoring errors, so one malformed config doesn't
            kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
         if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
+            dom = virDomainObjListLoadStatus(doms, &data.entries[i],
+                                             notify, opaque);
         else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             notify,
-                                             opaque);
+            dom = virDomainObjListLoadConfig(doms, xmlopt, &data.entries[i],
+                                             notify, opaque);
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
         } else {
-            VIR_ERROR(_("Failed to load config for domain '%s'"), entry->d_name);
+            VIR_ERROR(_("Failed to load config for domain '%s'"),
+                      data.entries[i].name);
         }
     }
 
-    VIR_DIR_CLOSE(dir);
+    virDomainObjListSnapshotPublish(doms);
     virObjectRWUnlock(doms);
+
+    for (i = 0; i < data.nentries; i++) {
+        VIR_FREE(data.entries[i].name);
+        virDomainDefFree(data.entries[i].def);
+        virObjectUnref(data.entries[i].obj);
+    }
+    VIR_FREE(data.entries);
+    virMutexDestroy(&data.lock);
     return ret;
 }
 
 
+struct virDomainObjListCompactData {
+    const char *configDir;
+    size_t ncompacted;
+};
+
+
+static int
+virDomainObjListCompactOne(void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           void *opaque)
+{
+    virDomainObjPtr vm = payload;
+    struct virDomainObjListCompactData *data = opaque;
+    virDomainDefPtr def = NULL;
+    char *configFile = NULL;
+
+    virObjectLock(vm);
+
+    if (virDomainObjIsActive(vm) || !vm->persistent || vm->newDef ||
+        vm->compactConfig || vm->removing)
+        goto cleanup;
+
+    if (!(configFile = virDomainConfigFile(data->configDir, vm->def->name)) ||
+        !virFileExists(configFile))
+        goto cleanup;
+
+    if (!(def = virDomainDefNew()) ||
+        VIR_STRDUP(def->name, vm->def->name) < 0)
+        goto cleanup;
+
+    memcpy(def->uuid, vm->def->uuid, VIR_UUID_BUFLEN);
+    def->id = vm->def->id;
+    def->virtType = vm->def->virtType;
+    def->os.type = vm->def->os.type;
+
+    virDomainDefFree(vm->def);
+    vm->def = def;
+    def = NULL;
+    vm->compactConfig = configFile;
+    configFile = NULL;
+    data->ncompacted++;
+
+ cleanup:
+    virResetLastError();
+    virDomainDefFree(def);
+    VIR_FREE(configFile);
+    virObjectUnlock(vm);
+    return 0;
+}
+
+
+/**
+ * virDomainObjListCompact:
+ * @doms: domain list
+ * @configDir: directory holding the persistent configs
+ * @caps: capabilities used to parse the configs again
+ * @xmlopt: XML options used to parse the configs again
+ *
+ * Replaces the definition of every inactive persistent domain with a
+ * summary holding just its name and UUID. The full definition is parsed
+ * from @configDir again once the domain is looked up, collected or
+ * iterated over.
+ *
+ * This must only be called when nobody else can hold a pointer to the
+ * domain definitions, e.g. during driver startup.
+ *
+ * Returns the number of compacted domains.
+ */
+size_t
+virDomainObjListCompact(virDomainObjListPtr doms,
+                        const char *configDir,
+                        virCapsPtr caps,
+                        virDomainXMLOptionPtr xmlopt)
+{
+    struct virDomainObjListCompactData data = { configDir, 0 };
+
+    virObjectRWLockWrite(doms);
+
+    if (!doms->compactCaps)
+        doms->compactCaps = virObjectRef(caps);
+    if (!doms->compactXMLOpt)
+        doms->compactXMLOpt = virObjectRef(xmlopt);
+
+    virHashForEach(doms->objs, virDomainObjListCompactOne, &data);
+
+    virObjectRWUnlock(doms);
+
+    VIR_INFO("Compacted %zu inactive domains from %s",
+             data.ncompacted, configDir);
+    return data.ncompacted;
+}
+
 struct virDomainObjListData {
     virDomainObjListACLFilter filter;
     virConnectPtr conn;
@@ -657,9 +1378,8 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              virConnectPtr conn)
 {
     struct virDomainObjListData data = { filter, conn, active, 0 };
-    virObjectRWLockRead(doms);
-    virHashForEach(doms->objs, virDomainObjListCount, &data);
-    virObjectRWUnlock(doms);
+    if (virDomainObjListSnapshotForEach(doms, virDomainObjListCount, &data) < 0)
+        return -1;
     return data.count;
 }
 
@@ -701,9 +1421,9 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
 {
     struct virDomainIDData data = { filter, conn,
                                     0, maxids, ids };
-    virObjectRWLockRead(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
-    virObjectRWUnlock(doms);
+    if (virDomainObjListSnapshotForEach(doms, virDomainObjListCopyActiveIDs,
+                                        &data) < 0)
+        return -1;
     return data.numids;
 }
 
@@ -755,9 +1475,9 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
     struct virDomainNameData data = { filter, conn,
                                       0, 0, maxnames, names };
     size_t i;
-    virObjectRWLockRead(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectRWUnlock(doms);
+    if (virDomainObjListSnapshotForEach(doms, virDomainObjListCopyInactiveNames,
+                                        &data) < 0)
+        return -1;
     if (data.oom) {
         for (i = 0; i < data.numnames; i++)
             VIR_FREE(data.names[i]);
@@ -769,6 +1489,7 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
 
 
 struct virDomainListIterData {
+    virDomainObjListPtr doms;
     virDomainObjListIterator callback;
     void *opaque;
     int ret;
@@ -781,6 +1502,18 @@ virDomainObjListHelper(void *payload,
                        void *opaque)
 {
     struct virDomainListIterData *data = opaque;
+    virDomainObjPtr vm = payload;
+    int rc;
+
+    virObjectLock(vm);
+    rc = virDomainObjListInflate(data->doms, vm);
+    virObjectUnlock(vm);
+
+    if (rc < 0) {
+        VIR_WARN("%s", virGetLastErrorMessage());
+        data->ret = -1;
+        return 0;
+    }
 
     if (data->callback(payload, data->opaque) < 0)
         data->ret = -1;
@@ -794,7 +1527,7 @@ virDomainObjListForEach(virDomainObjListPtr doms,
                         void *opaque)
 {
     struct virDomainListIterData data = {
-        callback, opaque, 0,
+        doms, callback, opaque, 0,
     };
     virObjectRWLockRead(doms);
     virHashForEach(doms->objs, virDomainObjListHelper, &data);
@@ -867,30 +1600,14 @@ virDomainObjMatchFilter(virDomainObjPtr vm,
 #undef MATCH
 
 
-struct virDomainListData {
-    virDomainObjPtr *vms;
-    size_t nvms;
-};
-
-
-static int
-virDomainObjListCollectIterator(void *payload,
-                                const void *name ATTRIBUTE_UNUSED,
-                                void *opaque)
-{
-    struct virDomainListData *data = opaque;
-
-    data->vms[data->nvms++] = virObjectRef(payload);
-    return 0;
-}
-
-
 static void
-virDomainObjListFilter(virDomainObjPtr **list,
+virDomainObjListFilter(virDomainObjListPtr domlist,
+                       virDomainObjPtr **list,
                        size_t *nvms,
                        virConnectPtr conn,
                        virDomainObjListACLFilter filter,
-                       unsigned int flags)
+                       unsigned int flags,
+                       bool inflate)
 {
     size_t i = 0;
 
@@ -913,41 +1630,67 @@ virDomainObjListFilter(virDomainObjPtr **list,
             continue;
         }
 
+        /* the caller gets to look at the whole definition */
+        if (inflate && virDomainObjListInflate(domlist, vm) < 0) {
+            VIR_WARN("%s", virGetLastErrorMessage());
+            virResetLastError();
+        }
+
         virObjectUnlock(vm);
         i++;
     }
 }
 
 
-int
-virDomainObjListCollect(virDomainObjListPtr domlist,
-                        virConnectPtr conn,
-                        virDomainObjPtr **vms,
-                        size_t *nvms,
-                        virDomainObjListACLFilter filter,
-                        unsigned int flags)
+static int
+virDomainObjListCollectInternal(virDomainObjListPtr domlist,
+                                virConnectPtr conn,
+                                virDomainObjPtr **vms,
+                                size_t *nvms,
+                                virDomainObjListACLFilter filter,
+                                unsigned int flags,
+                                bool inflate)
 {
-    struct virDomainListData data = { NULL, 0 };
+    virDomainObjListSnapshotPtr snap;
+    virDomainObjPtr *list = NULL;
+    size_t nlist;
+    size_t i;
 
-    virObjectRWLockRead(domlist);
-    sa_assert(domlist->objs);
-    if (VIR_ALLOC_N(data.vms, virHashSize(domlist->objs)) < 0) {
-        virObjectRWUnlock(domlist);
+    if (!(snap = virDomainObjListSnapshotGet(domlist)))
+        return -1;
+
+    nlist = snap->nentries;
+    if (VIR_ALLOC_N(list, nlist) < 0) {
+        virObjectUnref(snap);
         return -1;
     }
 
-    virHashForEach(domlist->objs, virDomainObjListCollectIterator, &data);
-    virObjectRWUnlock(domlist);
+    for (i = 0; i < nlist; i++)
+        list[i] = virObjectRef(snap->byUUID[i].vm);
+    virObjectUnref(snap);
 
-    virDomainObjListFilter(&data.vms, &data.nvms, conn, filter, flags);
+    virDomainObjListFilter(domlist, &list, &nlist, conn, filter, flags, inflate);
 
-    *nvms = data.nvms;
-    *vms = data.vms;
+    *nvms = nlist;
+    *vms = list;
 
     return 0;
 }
 
 
+int
+virDomainObjListCollect(virDomainObjListPtr domlist,
+                        virConnectPtr conn,
+                        virDomainObjPtr **vms,
+                        size_t *nvms,
+                        virDomainObjListACLFilter filter,
+                        unsigned int flags)
+{
+    return virDomainObjListCollectInternal(domlist, conn, vms, nvms,
+                                           filter, flags, true);
+}
+
+
 int
 virDomainObjListConvert(virDomainObjListPtr domlist,
                         virConnectPtr conn,
@@ -960,23 +1703,27 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
                         bool skip_missing)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virDomainObjListSnapshotPtr snap;
     virDomainObjPtr vm;
     size_t i;
 
     *nvms = 0;
     *vms = NULL;
 
-    virObjectRWLockRead(domlist);
+    if (!(snap = virDomainObjListSnapshotGet(domlist)))
+        return -1;
+
     for (i = 0; i < ndoms; i++) {
         virDomainPtr dom = doms[i];
 
         virUUIDFormat(dom->uuid, uuidstr);
 
-        if (!(vm = virHashLookup(domlist->objs, uuidstr))) {
+        if (!(vm = virDomainObjListSnapshotLookup(snap->byUUID,
+                                                  snap->nentries,
+                                                  uuidstr))) {
             if (skip_missing)
                 continue;
 
-            virObjectRWUnlock(domlist);
             virReportError(VIR_ERR_NO_DOMAIN,
                            _("no domain with matching uuid '%s' (%s)"),
                            uuidstr, dom->name);
@@ -986,19 +1733,19 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
         virObjectRef(vm);
 
         if (VIR_APPEND_ELEMENT(*vms, *nvms, vm) < 0) {
-            virObjectRWUnlock(domlist);
             virObjectUnref(vm);
             goto error;
         }
     }
-    virObjectRWUnlock(domlist);
+    virObjectUnref(snap);
 
     sa_assert(*vms);
-    virDomainObjListFilter(vms, nvms, conn, filter, flags);
+    virDomainObjListFilter(domlist, vms, nvms, conn, filter, flags, true);
 
     return 0;
 
  error:
+    virObjectUnref(snap);
     virObjectListFreeCount(*vms, *nvms);
     *vms = NULL;
     *nvms = 0;
@@ -1020,7 +1767,9 @@ virDomainObjListExport(virDomainObjListPtr domlist,
     size_t i;
     int ret = -1;
 
-    if (virDomainObjListCollect(domlist, conn, &vms, &nvms, filter, flags) < 0)
+    /* only names and UUIDs are needed, keep compacted domains as they are */
+    if (virDomainObjListCollectInternal(domlist, conn, &vms, &nvms,
+                                        filter, flags, false) < 0)
         return -1;
 
     if (domains) {
@@ -1049,3 +1798,121 @@ virDomainObjListExport(virDomainObjListPtr domlist,
     virObjectListFreeCount(vms, nvms);
     return ret;
 }
+
+
+/**
+ * virDomainObjListExportChanges:
+ * @domlist: domain list
+ * @conn: connection the returned domains belong to
+ * @cursor: in: generation returned by the previous call, or 0;
+ *          out: generation to pass to the next call
+ * @changed: filled with the domains defined or changed since @cursor
+ * @removed: filled with the domains removed since @cursor, or NULL
+ * @filter: ACL filter
+ *
+ * If @cursor is 0 or too old for the removed domains to be known,
+ * @changed gets all domains and @removed is set to NULL to signal
+ * the caller has to forget any domain not listed.
+ *
+ * Returns the number of changed domains, or -1 on error.
+ */
+int
+virDomainObjListExportChanges(virDomainObjListPtr domlist,
+                              virConnectPtr conn,
+                              unsigned long long *cursor,
+                              virDomainPtr **changed,
+                              virDomainPtr **removed,
+                              virDomainObjListACLFilter filter)
+{
+    virDomainObjListSnapshotPtr snap = NULL;
+    virDomainPtr *chg = NULL;
+    virDomainPtr *rem = NULL;
+    size_t nchg = 0;
+    size_t nrem = 0;
+    unsigned long long since = *cursor;
+    unsigned long long current;
+    bool resync;
+    size_t i;
+    int ret = -1;
+
+    *changed = NULL;
+    *removed = NULL;
+
+    /* Read the generation first; anything changing while we look at
+     * the domains is reported again by the next call. */
+    if ((current = virDomainObjGetGeneration()) == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to get domain list generation"));
+        return -1;
+    }
+
+    virMutexLock(&domlist->snapshotLock);
+    resync = since == 0 || since < domlist->tombstonesExpired ||
+             since > current;
+
+    if (!resync) {
+        if (VIR_ALLOC_N(rem, domlist->ntombstones + 1) < 0) {
+            virMutexUnlock(&domlist->snapshotLock);
+            goto cleanup;
+        }
+
+        for (i = 0; i < domlist->ntombstones; i++) {
+            virDomainObjListTombstonePtr tomb;
+
+            tomb = &domlist->tombstones[(domlist->tombstonesStart + i) %
+                                        VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX];
+            if (tomb->generation <= since ||
+                (filter && !filter(conn, tomb->def)))
+                continue;
+
+            if (!(rem[nrem] = virGetDomain(conn, tomb->def->name,
+                                           tomb->def->uuid, -1))) {
+                virMutexUnlock(&domlist->snapshotLock);
+                goto cleanup;
+            }
+            nrem++;
+        }
+    }
+    virMutexUnlock(&domlist->snapshotLock);
+
+    if (!(snap = virDomainObjListSnapshotGet(domlist)))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(chg, snap->nentries + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < snap->nentries; i++) {
+        virDomainObjPtr vm = snap->byUUID[i].vm;
+
+        virObjectLock(vm);
+        if (vm->removing ||
+            (!resync && vm->generation <= since) ||
+            (filter && !filter(conn, vm->def))) {
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        chg[nchg] = virGetDomain(conn, vm->def->name,
+                                 vm->def->uuid, vm->def->id);
+        virObjectUnlock(vm);
+
+        if (!chg[nchg])
+            goto cleanup;
+        nchg++;
+    }
+
+    *cursor = current;
+    *changed = chg;
+    chg = NULL;
+    if (!resync) {
+        *removed = rem;
+        rem = NULL;
+    }
+    ret = nchg;
+
+ cleanup:
+    virObjectUnref(snap);
+    virObjectListFreeCount(chg, nchg);
+    virObjectListFreeCount(rem, nrem);
+    return ret;
+}
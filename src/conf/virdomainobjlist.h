@@ -78,6 +78,11 @@ int virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                    virDomainLoadConfigNotify notify,
                                    void *opaque);
 
+size_t virDomainObjListCompact(virDomainObjListPtr doms,
+                               const char *configDir,
+                               virCapsPtr caps,
+                               virDomainXMLOptionPtr xmlopt);
+
 int virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                                  bool active,
                                  virDomainObjListACLFilter filter,
@@ -146,6 +151,12 @@ int virDomainObjListExport(virDomainObjListPtr doms,
                            virDomainPtr **domains,
                            virDomainObjListACLFilter filter,
                            unsigned int flags);
+int virDomainObjListExportChanges(virDomainObjListPtr domlist,
+                                  virConnectPtr conn,
+                                  unsigned long long *cursor,
+                                  virDomainPtr **changed,
+                                  virDomainPtr **removed,
+                                  virDomainObjListACLFilter filter);
 int virDomainObjListConvert(virDomainObjListPtr domlist,
                             virConnectPtr conn,
                             virDomainPtr *doms,
@@ -269,61 +269,72 @@ virNetworkObjUnrefMacMap(virNetworkObjPtr obj)
 
 int
 virNetworkObjMacMgrAdd(virNetworkObjPtr obj,
-                       const char *dnsmasqStateDir,
                        const char *domain,
                        const virMacAddr *mac)
 {
     char macStr[VIR_MAC_STRING_BUFLEN];
-    char *file = NULL;
-    int ret = -1;
 
     if (!obj->macmap)
         return 0;
 
     virMacAddrFormat(mac, macStr);
 
-    if (!(file = virMacMapFileName(dnsmasqStateDir, obj->def->bridge)))
-        goto cleanup;
-
-    if (virMacMapAdd(obj->macmap, domain, macStr) < 0)
-        goto cleanup;
-
-    if (virMacMapWriteFile(obj->macmap, file) < 0)
-        goto cleanup;
-
-    ret = 0;
- cleanup:
-    VIR_FREE(file);
-    return ret;
+    return virMacMapAdd(obj->macmap, domain, macStr);
 }
 
 
 int
 virNetworkObjMacMgrDel(virNetworkObjPtr obj,
-                       const char *dnsmasqStateDir,
                        const char *domain,
                        const virMacAddr *mac)
 {
     char macStr[VIR_MAC_STRING_BUFLEN];
-    char *file = NULL;
-    int ret = -1;
 
     if (!obj->macmap)
         return 0;
 
     virMacAddrFormat(mac, macStr);
 
+    return virMacMapRemove(obj->macmap, domain, macStr);
+}
+
+
+/*
+ * virNetworkObjMacMgrSave:
+ * @obj: network object
+ * @dnsmasqStateDir: directory holding the MAC map file
+ *
+ * Queue a write of the MAC map of @obj. virNetworkObjMacMgrAdd and
+ * virNetworkObjMacMgrDel only update the map in memory so that
+ * the caller can batch several changes into a single write. The
+ * file itself is replaced by the virFileRewriteStrAsync writer, so
+ * @obj is not kept locked while the data is synced.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virNetworkObjMacMgrSave(virNetworkObjPtr obj,
+                        const char *dnsmasqStateDir)
+{
+    char *file = NULL;
+    char *str = NULL;
+    int ret = -1;
+
+    if (!obj->macmap)
+        return 0;
+
     if (!(file = virMacMapFileName(dnsmasqStateDir, obj->def->bridge)))
         goto cleanup;
 
-    if (virMacMapRemove(obj->macmap, domain, macStr) < 0)
+    if (virMacMapDumpStr(obj->macmap, &str) < 0)
         goto cleanup;
 
-    if (virMacMapWriteFile(obj->macmap, file) < 0)
+    if (virFileRewriteStrAsync(file, 0644, str, NULL, NULL) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
+    VIR_FREE(str);
     VIR_FREE(file);
     return ret;
 }
@@ -93,16 +93,18 @@ virNetworkObjUnrefMacMap(virNetworkObjPtr obj);
 
 int
 virNetworkObjMacMgrAdd(virNetworkObjPtr obj,
-                       const char *dnsmasqStateDir,
                        const char *domain,
                        const virMacAddr *mac);
 
 int
 virNetworkObjMacMgrDel(virNetworkObjPtr obj,
-                       const char *dnsmasqStateDir,
                        const char *domain,
                        const virMacAddr *mac);
 
+int
+virNetworkObjMacMgrSave(virNetworkObjPtr obj,
+                        const char *dnsmasqStateDir);
+
 void
 virNetworkObjEndAPI(virNetworkObjPtr *net);
 
@@ -22,6 +22,9 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "datatypes.h"
 #include "virsecretobj.h"
@@ -41,6 +44,7 @@ struct _virSecretObj {
     virObjectLockable parent;
     char *configFile;
     char *base64File;
+    char *usageKey;             /* May be NULL */
     virSecretDefPtr def;
     unsigned char *value;       /* May be NULL */
     size_t value_size;
@@ -57,11 +61,10 @@ struct _virSecretObjList {
     /* uuid string -> virSecretObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
-};
 
-struct virSecretSearchData {
-    int usageType;
-    const char *usageID;
+    /* "usagetype:usageid" string -> virSecretObj mapping
+     * for O(1), lockless lookup-by-usage */
+    virHashTable *objsUsage;
 };
 
 
@@ -126,7 +129,8 @@ virSecretObjListNew(void)
     if (!(secrets = virObjectRWLockableNew(virSecretObjListClass)))
         return NULL;
 
-    if (!(secrets->objs = virHashCreate(50, virObjectFreeHashData))) {
+    if (!(secrets->objs = virHashCreate(50, virObjectFreeHashData)) ||
+        !(secrets->objsUsage = virHashCreate(50, virObjectFreeHashData))) {
         virObjectUnref(secrets);
         return NULL;
     }
@@ -135,19 +139,71 @@ virSecretObjListNew(void)
 }
 
 
+/*
+ * virSecretObjValuePin:
+ * @value: secret value buffer
+ * @value_size: size of @value
+ *
+ * Try to keep @value out of swap. This is best effort only: the
+ * daemon may lack the privilege or the RLIMIT_MEMLOCK headroom, in
+ * which case the value is still usable, just not pinned. Heap pages
+ * may be shared with other values, so freeing one of them can unpin
+ * its neighbours too.
+ */
+#if HAVE_MMAP
+static void
+virSecretObjValuePin(unsigned char *value,
+                     size_t value_size)
+{
+    char ebuf[1024];
+
+    if (value_size && mlock(value, value_size) < 0)
+        VIR_DEBUG("Unable to lock secret value in memory: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+}
+#else /* !HAVE_MMAP */
+static void
+virSecretObjValuePin(unsigned char *value ATTRIBUTE_UNUSED,
+                     size_t value_size ATTRIBUTE_UNUSED)
+{
+}
+#endif /* !HAVE_MMAP */
+
+
+/*
+ * virSecretObjValueFree:
+ * @value: pointer to secret value buffer
+ * @value_size: size of @value
+ *
+ * Wipe, unpin and free @value. Wiping before free ensures we
+ * don't leave a secret on the heap.
+ */
+static void
+virSecretObjValueFree(unsigned char **value,
+                      size_t value_size)
+{
+    if (!*value)
+        return;
+
+    memset(*value, 0, value_size);
+#if HAVE_MMAP
+    if (value_size)
+        ignore_value(munlock(*value, value_size));
+#endif
+    VIR_FREE(*value);
+}
+
+
 static void
 virSecretObjDispose(void *opaque)
 {
     virSecretObjPtr obj = opaque;
 
     virSecretDefFree(obj->def);
-    if (obj->value) {
-        /* Wipe before free to ensure we don't leave a secret on the heap */
-        memset(obj->value, 0, obj->value_size);
-        VIR_FREE(obj->value);
-    }
+    virSecretObjValueFree(&obj->value, obj->value_size);
     VIR_FREE(obj->configFile);
     VIR_FREE(obj->base64File);
+    VIR_FREE(obj->usageKey);
 }
 
 
@@ -157,6 +213,31 @@ virSecretObjListDispose(void *obj)
     virSecretObjListPtr secrets = obj;
 
     virHashFree(secrets->objs);
+    virHashFree(secrets->objsUsage);
+}
+
+
+/*
+ * virSecretObjListUsageKey:
+ * @usageType: secret usageType
+ * @usageID: secret usage string
+ *
+ * Format the key used by the usage table. Secrets with no usage are
+ * not indexed, so for VIR_SECRET_USAGE_TYPE_NONE @key is set to NULL.
+ *
+ * Returns 0 on success, -1 on OOM.
+ */
+static int
+virSecretObjListUsageKey(int usageType,
+                         const char *usageID,
+                         char **key)
+{
+    *key = NULL;
+
+    if (usageType == VIR_SECRET_USAGE_TYPE_NONE || !usageID)
+        return 0;
+
+    return virAsprintf(key, "%d:%s", usageType, usageID);
 }
 
 
@@ -202,32 +283,6 @@ virSecretObjListFindByUUID(virSecretObjListPtr secrets,
 }
 
 
-static int
-virSecretObjSearchName(const void *payload,
-                       const void *name ATTRIBUTE_UNUSED,
-                       const void *opaque)
-{
-    virSecretObjPtr obj = (virSecretObjPtr) payload;
-    virSecretDefPtr def;
-    struct virSecretSearchData *data = (struct virSecretSearchData *) opaque;
-    int found = 0;
-
-    virObjectLock(obj);
-    def = obj->def;
-
-    if (def->usage_type != data->usageType)
-        goto cleanup;
-
-    if (data->usageType != VIR_SECRET_USAGE_TYPE_NONE &&
-        STREQ(def->usage_id, data->usageID))
-        found = 1;
-
- cleanup:
-    virObjectUnlock(obj);
-    return found;
-}
-
-
 /**
  * virSecretObjFindByUsageLocked:
  * @secrets: list of secret objects
@@ -244,12 +299,13 @@ virSecretObjListFindByUsageLocked(virSecretObjListPtr secrets,
                                   const char *usageID)
 {
     virSecretObjPtr obj = NULL;
-    struct virSecretSearchData data = { .usageType = usageType,
-                                        .usageID = usageID };
+    char *key = NULL;
 
-    obj = virHashSearch(secrets->objs, virSecretObjSearchName, &data, NULL);
-    if (obj)
-        virObjectRef(obj);
+    if (virSecretObjListUsageKey(usageType, usageID, &key) < 0 || !key)
+        return NULL;
+
+    obj = virObjectRef(virHashLookup(secrets->objsUsage, key));
+    VIR_FREE(key);
     return obj;
 }
 
@@ -307,6 +363,8 @@ virSecretObjListRemove(virSecretObjListPtr secrets,
 
     virObjectRWLockWrite(secrets);
     virObjectLock(obj);
+    if (obj->usageKey)
+        virHashRemoveEntry(secrets->objsUsage, obj->usageKey);
     virHashRemoveEntry(secrets->objs, uuidstr);
     virObjectUnlock(obj);
     virObjectUnref(obj);
@@ -348,7 +406,8 @@ virSecretObjListAdd(virSecretObjListPtr secrets,
         virObjectLock(obj);
         objdef = obj->def;
 
-        if (STRNEQ_NULLABLE(objdef->usage_id, newdef->usage_id)) {
+        if (objdef->usage_type != newdef->usage_type ||
+            STRNEQ_NULLABLE(objdef->usage_id, newdef->usage_id)) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("a secret with UUID %s is already defined for "
                              "use with %s"),
@@ -393,9 +452,21 @@ virSecretObjListAdd(virSecretObjListPtr secrets,
             !(obj->base64File = virFileBuildPath(configDir, uuidstr, ".base64")))
             goto cleanup;
 
+        if (virSecretObjListUsageKey(newdef->usage_type, newdef->usage_id,
+                                     &obj->usageKey) < 0)
+            goto cleanup;
+
         if (virHashAddEntry(secrets->objs, uuidstr, obj) < 0)
             goto cleanup;
 
+        if (obj->usageKey) {
+            if (virHashAddEntry(secrets->objsUsage, obj->usageKey, obj) < 0) {
+                virHashSteal(secrets->objs, uuidstr);
+                goto cleanup;
+            }
+            virObjectRef(obj);
+        }
+
         obj->def = newdef;
         virObjectRef(obj);
     }
@@ -777,6 +848,7 @@ virSecretObjSetValue(virSecretObjPtr obj,
     old_value_size = obj->value_size;
 
     memcpy(new_value, value, value_size);
+    virSecretObjValuePin(new_value, value_size);
     obj->value = new_value;
     obj->value_size = value_size;
 
@@ -784,10 +856,7 @@ virSecretObjSetValue(virSecretObjPtr obj,
         goto error;
 
     /* Saved successfully - drop old value */
-    if (old_value) {
-        memset(old_value, 0, old_value_size);
-        VIR_FREE(old_value);
-    }
+    virSecretObjValueFree(&old_value, old_value_size);
 
     return 0;
 
@@ -795,8 +864,7 @@ virSecretObjSetValue(virSecretObjPtr obj,
     /* Error - restore previous state and free new value */
     obj->value = old_value;
     obj->value_size = old_value_size;
-    memset(new_value, 0, value_size);
-    VIR_FREE(new_value);
+    virSecretObjValueFree(&new_value, value_size);
     return -1;
 }
 
@@ -889,6 +957,7 @@ virSecretLoadValue(virSecretObjPtr obj)
     obj->value = (unsigned char *)value;
     value = NULL;
     obj->value_size = value_size;
+    virSecretObjValuePin(obj->value, obj->value_size);
 
     ret = 0;
 
@@ -27,6 +27,7 @@
 #include "viralloc.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virscsihost.h"
 #include "virstring.h"
@@ -55,8 +56,218 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    /* Volumes remembered across an incremental refresh, keyed by name */
+    virHashTablePtr stashedVolumes;
 };
 
+/* Index of the volumes of every storage pool by key and by target path,
+ * so that looking a volume up does not have to lock and walk each pool.
+ * An entry always refers to a volume currently in the volume list of
+ * its pool; entries are added and removed with the pool locked. Keys or
+ * paths shared by volumes of several pools are indexed for the last one
+ * added only, so a miss does not prove the volume does not exist. */
+typedef struct _virStorageVolIndexEntry virStorageVolIndexEntry;
+typedef virStorageVolIndexEntry *virStorageVolIndexEntryPtr;
+struct _virStorageVolIndexEntry {
+    virStoragePoolObjPtr obj;
+    virStorageVolDefPtr voldef;
+};
+
+static virMutex virStorageVolIndexLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageVolIndexByKey;
+static virHashTablePtr virStorageVolIndexByPath;
+
+
+static void
+virStorageVolIndexInsert(virHashTablePtr *table,
+                         char **indexed,
+                         const char *name,
+                         virStoragePoolObjPtr obj,
+                         virStorageVolDefPtr voldef)
+{
+    virStorageVolIndexEntryPtr entry = NULL;
+
+    if (!name)
+        return;
+
+    if (!*table && !(*table = virHashCreate(64, virHashValueFree)))
+        goto error;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(*indexed, name) < 0)
+        goto error;
+
+    entry->obj = obj;
+    entry->voldef = voldef;
+
+    if (virHashUpdateEntry(*table, name, entry) < 0)
+        goto error;
+
+    return;
+
+ error:
+    /* The index is only an accelerator, lookups fall back to a scan */
+    VIR_FREE(*indexed);
+    VIR_FREE(entry);
+    virResetLastError();
+}
+
+
+static void
+virStorageVolIndexDelete(virHashTablePtr table,
+                         char **indexed,
+                         virStorageVolDefPtr voldef)
+{
+    virStorageVolIndexEntryPtr entry;
+
+    if (!*indexed)
+        return;
+
+    if ((entry = virHashLookup(table, *indexed)) && entry->voldef == voldef)
+        virHashRemoveEntry(table, *indexed);
+
+    VIR_FREE(*indexed);
+}
+
+
+static void
+virStorageVolIndexAdd(virStoragePoolObjPtr obj,
+                      virStorageVolDefPtr voldef)
+{
+    virMutexLock(&virStorageVolIndexLock);
+    virStorageVolIndexDelete(virStorageVolIndexByKey, &voldef->indexKey,
+                             voldef);
+    virStorageVolIndexDelete(virStorageVolIndexByPath, &voldef->indexPath,
+                             voldef);
+    virStorageVolIndexInsert(&virStorageVolIndexByKey, &voldef->indexKey,
+                             voldef->key, obj, voldef);
+    virStorageVolIndexInsert(&virStorageVolIndexByPath, &voldef->indexPath,
+                             voldef->target.path, obj, voldef);
+    virMutexUnlock(&virStorageVolIndexLock);
+}
+
+
+static void
+virStorageVolIndexRemove(virStorageVolDefPtr voldef)
+{
+    virMutexLock(&virStorageVolIndexLock);
+    virStorageVolIndexDelete(virStorageVolIndexByKey, &voldef->indexKey,
+                             voldef);
+    virStorageVolIndexDelete(virStorageVolIndexByPath, &voldef->indexPath,
+                             voldef);
+    virMutexUnlock(&virStorageVolIndexLock);
+}
+
+
+static bool
+virStorageVolIndexGet(virHashTablePtr *table,
+                      const char *name,
+                      virStoragePoolObjPtr *obj,
+                      virStorageVolDefPtr *voldef)
+{
+    virStorageVolIndexEntryPtr entry;
+    bool found = false;
+
+    virMutexLock(&virStorageVolIndexLock);
+    if (*table && (entry = virHashLookup(*table, name))) {
+        *obj = entry->obj;
+        *voldef = entry->voldef;
+        found = true;
+    }
+    virMutexUnlock(&virStorageVolIndexLock);
+
+    return found;
+}
+
+
+static virStoragePoolObjPtr
+virStoragePoolObjFindByVolIndex(virHashTablePtr *table,
+                                const char *name,
+                                virStorageVolDefPtr *voldef)
+{
+    virStoragePoolObjPtr obj;
+    virStoragePoolObjPtr checkobj;
+    virStorageVolDefPtr checkvol;
+
+    if (!virStorageVolIndexGet(table, name, &obj, voldef))
+        return NULL;
+
+    /* The volume may have been removed before we got the pool lock,
+     * once it is held the entry can not change anymore */
+    virStoragePoolObjLock(obj);
+    if (!virStorageVolIndexGet(table, name, &checkobj, &checkvol) ||
+        checkobj != obj || checkvol != *voldef) {
+        virStoragePoolObjUnlock(obj);
+        *voldef = NULL;
+        return NULL;
+    }
+
+    return obj;
+}
+
+
+/**
+ * virStoragePoolObjFindByVolKey:
+ * @key: volume key
+ * @voldef: filled with the volume found
+ *
+ * Looks up the volume identified by @key in the index of all volumes.
+ * The caller must hold whatever protects storage pool objects from
+ * being freed, as for virStoragePoolObjFindByName().
+ *
+ * Returns the locked pool object containing the volume, or NULL if the
+ * index has no such volume. Since the index is not authoritative the
+ * caller should then search the pools the slow way.
+ */
+virStoragePoolObjPtr
+virStoragePoolObjFindByVolKey(const char *key,
+                              virStorageVolDefPtr *voldef)
+{
+    virStoragePoolObjPtr obj;
+
+    if (!(obj = virStoragePoolObjFindByVolIndex(&virStorageVolIndexByKey,
+                                                key, voldef)))
+        return NULL;
+
+    if (STRNEQ_NULLABLE((*voldef)->key, key)) {
+        virStoragePoolObjUnlock(obj);
+        *voldef = NULL;
+        return NULL;
+    }
+
+    return obj;
+}
+
+
+/**
+ * virStoragePoolObjFindByVolPath:
+ * @path: volume target path
+ * @voldef: filled with the volume found
+ *
+ * Same as virStoragePoolObjFindByVolKey() for the volume whose target
+ * path is @path.
+ */
+virStoragePoolObjPtr
+virStoragePoolObjFindByVolPath(const char *path,
+                               virStorageVolDefPtr *voldef)
+{
+    virStoragePoolObjPtr obj;
+
+    if (!(obj = virStoragePoolObjFindByVolIndex(&virStorageVolIndexByPath,
+                                                path, voldef)))
+        return NULL;
+
+    if (STRNEQ_NULLABLE((*voldef)->target.path, path)) {
+        virStoragePoolObjUnlock(obj);
+        *voldef = NULL;
+        return NULL;
+    }
+
+    return obj;
+}
+
+
 virStoragePoolObjPtr
 virStoragePoolObjNew(void)
 {
@@ -193,6 +404,7 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj)
         return;
 
     virStoragePoolObjClearVols(obj);
+    virStoragePoolObjClearStashedVols(obj);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -294,20 +506,102 @@ void
 virStoragePoolObjClearVols(virStoragePoolObjPtr obj)
 {
     size_t i;
-    for (i = 0; i < obj->volumes.count; i++)
+    for (i = 0; i < obj->volumes.count; i++) {
+        virStorageVolIndexRemove(obj->volumes.objs[i]);
         virStorageVolDefFree(obj->volumes.objs[i]);
+    }
 
     VIR_FREE(obj->volumes.objs);
     obj->volumes.count = 0;
 }
 
 
+static void
+virStoragePoolObjStashedVolFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageVolDefFree(payload);
+}
+
+
+/**
+ * virStoragePoolObjStashVols:
+ * @obj: storage pool object
+ *
+ * Move every volume of @obj aside so that a following refresh can take
+ * back the definitions of volumes that did not change instead of
+ * probing them again. Whatever is left unclaimed after the refresh is
+ * released by virStoragePoolObjClearStashedVols().
+ *
+ * Returns 0 on success, -1 on error in which case the volume list is
+ * cleared as virStoragePoolObjClearVols() would.
+ */
+int
+virStoragePoolObjStashVols(virStoragePoolObjPtr obj)
+{
+    size_t i;
+
+    virStoragePoolObjClearStashedVols(obj);
+
+    if (!(obj->stashedVolumes =
+          virHashCreate(obj->volumes.count + 1,
+                        virStoragePoolObjStashedVolFree))) {
+        virStoragePoolObjClearVols(obj);
+        return -1;
+    }
+
+    for (i = 0; i < obj->volumes.count; i++) {
+        virStorageVolDefPtr voldef = obj->volumes.objs[i];
+
+        virStorageVolIndexRemove(voldef);
+
+        /* A duplicate name just loses its cached probe results */
+        if (virHashAddEntry(obj->stashedVolumes, voldef->name, voldef) < 0) {
+            virStorageVolDefFree(voldef);
+            virResetLastError();
+        }
+    }
+
+    VIR_FREE(obj->volumes.objs);
+    obj->volumes.count = 0;
+    return 0;
+}
+
+
+/**
+ * virStoragePoolObjTakeStashedVol:
+ * @obj: storage pool object
+ * @name: volume name
+ *
+ * Returns the stashed definition of volume @name, removing it from the
+ * stash, or NULL if there is none. The caller owns the result.
+ */
+virStorageVolDefPtr
+virStoragePoolObjTakeStashedVol(virStoragePoolObjPtr obj,
+                                const char *name)
+{
+    if (!obj->stashedVolumes)
+        return NULL;
+
+    return virHashSteal(obj->stashedVolumes, name);
+}
+
+
+void
+virStoragePoolObjClearStashedVols(virStoragePoolObjPtr obj)
+{
+    virHashFree(obj->stashedVolumes);
+    obj->stashedVolumes = NULL;
+}
+
+
 int
 virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
                         virStorageVolDefPtr voldef)
 {
     if (VIR_APPEND_ELEMENT(obj->volumes.objs, obj->volumes.count, voldef) < 0)
         return -1;
+    virStorageVolIndexAdd(obj, obj->volumes.objs[obj->volumes.count - 1]);
     return 0;
 }
 
@@ -323,6 +617,7 @@ virStoragePoolObjRemoveVol(virStoragePoolObjPtr obj,
         if (obj->volumes.objs[i] == voldef) {
             VIR_INFO("Deleting volume '%s' from storage pool '%s'",
                      voldef->name, def->name);
+            virStorageVolIndexRemove(voldef);
             virStorageVolDefFree(voldef);
 
             VIR_DELETE_ELEMENT(obj->volumes.objs, i, obj->volumes.count);
@@ -49,6 +49,11 @@ struct _virStorageDriverState {
 
     /* Immutable pointer, self-locking APIs */
     virObjectEventStatePtr storageEventState;
+
+    /* Number of running background volume jobs, signalled on jobsCond
+     * whenever one finishes */
+    size_t njobs;
+    virCond jobsCond;
 };
 
 typedef bool
@@ -121,6 +126,14 @@ virStoragePoolObjPtr
 virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
                             const char *name);
 
+virStoragePoolObjPtr
+virStoragePoolObjFindByVolKey(const char *key,
+                              virStorageVolDefPtr *voldef);
+
+virStoragePoolObjPtr
+virStoragePoolObjFindByVolPath(const char *path,
+                               virStorageVolDefPtr *voldef);
+
 int
 virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
                         virStorageVolDefPtr voldef);
@@ -165,6 +178,16 @@ virStorageVolDefFindByName(virStoragePoolObjPtr obj,
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr obj);
 
+int
+virStoragePoolObjStashVols(virStoragePoolObjPtr obj);
+
+virStorageVolDefPtr
+virStoragePoolObjTakeStashedVol(virStoragePoolObjPtr obj,
+                                const char *name);
+
+void
+virStoragePoolObjClearStashedVols(virStoragePoolObjPtr obj);
+
 typedef bool
 (*virStoragePoolVolumeACLFilter)(virConnectPtr conn,
                                  virStoragePoolDefPtr pool,
@@ -32,6 +32,7 @@
 #include "cpu_x86.h"
 #include "virbuffer.h"
 #include "virendian.h"
+#include "virhash.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_CPU
@@ -51,12 +52,24 @@ struct _virCPUx86Vendor {
     virCPUx86CPUID cpuid;
 };
 
+/* A single word of a dense feature bitset (see virCPUx86Map) and the bits
+ * a feature occupies in it.
+ */
+typedef struct _virCPUx86FeatureWord virCPUx86FeatureWord;
+struct _virCPUx86FeatureWord {
+    size_t word;
+    uint32_t mask;
+};
+
 typedef struct _virCPUx86Feature virCPUx86Feature;
 typedef virCPUx86Feature *virCPUx86FeaturePtr;
 struct _virCPUx86Feature {
     char *name;
     virCPUx86Data data;
     bool migratable;
+    /* non-zero words of the feature in a dense bitset */
+    size_t nwords;
+    virCPUx86FeatureWord *words;
 };
 
 
@@ -137,8 +150,20 @@ struct _virCPUx86Model {
     virCPUx86VendorPtr vendor;
     uint32_t signature;
     virCPUx86Data data;
+    /* dense bitset of model's features, only set for models from the map */
+    uint32_t *bits;
+    /* name and data point to a model from the map (see x86ModelShare) */
+    bool shared;
 };
 
+/*
+ * Decoding CPU data needs to check every feature against every CPU model,
+ * which is too slow with the sparse virCPUx86Data representation. Thus once
+ * the map is loaded, all CPUID leaves used by any feature are collected in
+ * @leaves and CPU data can be converted into a dense bitset of @nwords
+ * 32-bit words: eax, ebx, ecx, and edx of each leaf in @leaves, in this
+ * order. Each feature and model from the map is stored in this form too.
+ */
 typedef struct _virCPUx86Map virCPUx86Map;
 typedef virCPUx86Map *virCPUx86MapPtr;
 struct _virCPUx86Map {
@@ -146,10 +171,13 @@ struct _virCPUx86Map {
     virCPUx86VendorPtr *vendors;
     size_t nfeatures;
     virCPUx86FeaturePtr *features;
+    virHashTablePtr featureNames;
     size_t nmodels;
     virCPUx86ModelPtr *models;
     size_t nblockers;
     virCPUx86FeaturePtr *migrate_blockers;
+    virCPUx86Data leaves;
+    size_t nwords;
 };
 
 static virCPUx86MapPtr cpuMap;
@@ -245,14 +273,7 @@ static virCPUx86FeaturePtr
 x86FeatureFind(virCPUx86MapPtr map,
                const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < map->nfeatures; i++) {
-        if (STREQ(map->features[i]->name, name))
-            return map->features[i];
-    }
-
-    return NULL;
+    return virHashLookup(map->featureNames, name);
 }
 
 
@@ -466,6 +487,109 @@ x86DataIsSubset(const virCPUx86Data *data,
 }
 
 
+/* Returns the index of the first word of @cpuid's leaf in a dense bitset
+ * or -1 if no feature uses the leaf.
+ */
+static ssize_t
+x86BitsLeafIndex(virCPUx86MapPtr map,
+                 const virCPUx86CPUID *cpuid)
+{
+    virCPUx86CPUID *leaf;
+
+    if (!(leaf = bsearch(cpuid, map->leaves.data, map->leaves.len,
+                         sizeof(virCPUx86CPUID), virCPUx86CPUIDSorter)))
+        return -1;
+
+    return (leaf - map->leaves.data) * 4;
+}
+
+
+static void
+x86DataToBits(virCPUx86MapPtr map,
+              const virCPUx86Data *data,
+              uint32_t *bits)
+{
+    size_t i;
+    ssize_t word;
+
+    memset(bits, 0, map->nwords * sizeof(*bits));
+
+    for (i = 0; i < data->len; i++) {
+        const virCPUx86CPUID *cpuid = data->data + i;
+
+        if ((word = x86BitsLeafIndex(map, cpuid)) < 0)
+            continue;
+
+        bits[word] = cpuid->eax;
+        bits[word + 1] = cpuid->ebx;
+        bits[word + 2] = cpuid->ecx;
+        bits[word + 3] = cpuid->edx;
+    }
+}
+
+
+static bool
+x86BitsHasFeature(const uint32_t *bits,
+                  const virCPUx86Feature *feature)
+{
+    size_t i;
+
+    for (i = 0; i < feature->nwords; i++) {
+        const virCPUx86FeatureWord *w = feature->words + i;
+
+        if ((bits[w->word] & w->mask) != w->mask)
+            return false;
+    }
+
+    return true;
+}
+
+
+static void
+x86BitsAddFeature(uint32_t *bits,
+                  const virCPUx86Feature *feature)
+{
+    size_t i;
+
+    for (i = 0; i < feature->nwords; i++)
+        bits[feature->words[i].word] |= feature->words[i].mask;
+}
+
+
+static void
+x86BitsRemoveFeature(uint32_t *bits,
+                     const virCPUx86Feature *feature)
+{
+    size_t i;
+
+    for (i = 0; i < feature->nwords; i++)
+        bits[feature->words[i].word] &= ~feature->words[i].mask;
+}
+
+
+/* Counts features x86DataToCPUFeatures would find in @bits and removes
+ * them from @bits in the same way.
+ */
+static size_t
+x86BitsCountFeatures(virCPUx86MapPtr map,
+                     uint32_t *bits)
+{
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < map->nfeatures; i++) {
+        virCPUx86FeaturePtr feature = map->features[i];
+
+        if (x86BitsHasFeature(bits, feature)) {
+            x86BitsRemoveFeature(bits, feature);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
 /* also removes all detected features from data */
 static int
 x86DataToCPUFeatures(virCPUDefPtr cpu,
@@ -797,6 +921,7 @@ x86FeatureFree(virCPUx86FeaturePtr feature)
 
     VIR_FREE(feature->name);
     virCPUx86DataClear(&feature->data);
+    VIR_FREE(feature->words);
     VIR_FREE(feature);
 }
 
@@ -975,6 +1100,8 @@ x86FeaturesLoad(virCPUx86MapPtr map,
         if (!(feature = x86FeatureParse(ctxt, map)))
             return -1;
         map->features[map->nfeatures++] = feature;
+        if (virHashAddEntry(map->featureNames, feature->name, feature) < 0)
+            return -1;
         if (!feature->migratable &&
             VIR_APPEND_ELEMENT(map->migrate_blockers,
                                map->nblockers,
@@ -1004,8 +1131,11 @@ x86ModelFree(virCPUx86ModelPtr model)
     if (!model)
         return;
 
-    VIR_FREE(model->name);
-    virCPUx86DataClear(&model->data);
+    if (!model->shared) {
+        VIR_FREE(model->name);
+        virCPUx86DataClear(&model->data);
+    }
+    VIR_FREE(model->bits);
     VIR_FREE(model);
 }
 
@@ -1029,6 +1159,54 @@ x86ModelCopy(virCPUx86ModelPtr model)
 }
 
 
+/*
+ * Returns a model which refers to the name and data of @model without
+ * copying them. This is only allowed for models from the CPU map, which
+ * is never modified or freed once loaded. The returned model has to be
+ * turned into a private copy by x86ModelUnshare before its data can be
+ * changed.
+ */
+static virCPUx86ModelPtr
+x86ModelShare(virCPUx86ModelPtr model)
+{
+    virCPUx86ModelPtr shared;
+
+    if (VIR_ALLOC(shared) < 0)
+        return NULL;
+
+    shared->name = model->name;
+    shared->vendor = model->vendor;
+    shared->signature = model->signature;
+    shared->data = model->data;
+    shared->shared = true;
+
+    return shared;
+}
+
+
+static int
+x86ModelUnshare(virCPUx86ModelPtr model)
+{
+    virCPUx86Data data = VIR_CPU_X86_DATA_INIT;
+    char *name = NULL;
+
+    if (!model->shared)
+        return 0;
+
+    if (VIR_STRDUP(name, model->name) < 0 ||
+        x86DataCopy(&data, &model->data) < 0) {
+        VIR_FREE(name);
+        return -1;
+    }
+
+    model->name = name;
+    model->data = data;
+    model->shared = false;
+
+    return 0;
+}
+
+
 static virCPUx86ModelPtr
 x86ModelFind(virCPUx86MapPtr map,
              const char *name)
@@ -1077,7 +1255,7 @@ x86ModelFromCPU(const virCPUDef *cpu,
             return NULL;
         }
 
-        model = x86ModelCopy(model);
+        model = x86ModelShare(model);
     } else {
         model = x86ModelNew();
     }
@@ -1104,6 +1282,9 @@ x86ModelFromCPU(const virCPUDef *cpu,
             goto error;
         }
 
+        if (x86ModelUnshare(model) < 0)
+            goto error;
+
         if (policy == -1) {
             switch (fpol) {
             case VIR_CPU_FEATURE_FORCE:
@@ -1342,6 +1523,7 @@ x86MapFree(virCPUx86MapPtr map)
     for (i = 0; i < map->nfeatures; i++)
         x86FeatureFree(map->features[i]);
     VIR_FREE(map->features);
+    virHashFree(map->featureNames);
 
     for (i = 0; i < map->nmodels; i++)
         x86ModelFree(map->models[i]);
@@ -1356,6 +1538,8 @@ x86MapFree(virCPUx86MapPtr map)
      */
     VIR_FREE(map->migrate_blockers);
 
+    virCPUx86DataClear(&map->leaves);
+
     VIR_FREE(map);
 }
 
@@ -1384,6 +1568,69 @@ x86MapLoadCallback(cpuMapElement element,
 }
 
 
+/*
+ * Computes the dense bitset representation of all features and models
+ * once the whole map is loaded.
+ */
+static int
+x86MapInitBits(virCPUx86MapPtr map)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < map->nfeatures; i++) {
+        virCPUx86FeaturePtr feature = map->features[i];
+        virCPUx86DataIterator iter = virCPUx86DataIteratorInit(&feature->data);
+        virCPUx86CPUID *cpuid;
+
+        while ((cpuid = x86DataCpuidNext(&iter))) {
+            virCPUx86CPUID leaf = {
+                .eax_in = cpuid->eax_in,
+                .ecx_in = cpuid->ecx_in
+            };
+
+            if (!x86DataCpuid(&map->leaves, &leaf) &&
+                virCPUx86DataAddCPUIDInt(&map->leaves, &leaf) < 0)
+                return -1;
+        }
+    }
+
+    map->nwords = map->leaves.len * 4;
+
+    for (i = 0; i < map->nfeatures; i++) {
+        virCPUx86FeaturePtr feature = map->features[i];
+        virCPUx86DataIterator iter = virCPUx86DataIteratorInit(&feature->data);
+        virCPUx86CPUID *cpuid;
+
+        while ((cpuid = x86DataCpuidNext(&iter))) {
+            uint32_t regs[] = {
+                cpuid->eax, cpuid->ebx, cpuid->ecx, cpuid->edx
+            };
+            ssize_t word = x86BitsLeafIndex(map, cpuid);
+
+            for (j = 0; j < ARRAY_CARDINALITY(regs); j++) {
+                virCPUx86FeatureWord w = { word + j, regs[j] };
+
+                if (w.mask &&
+                    VIR_APPEND_ELEMENT(feature->words, feature->nwords, w) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    for (i = 0; i < map->nmodels; i++) {
+        virCPUx86ModelPtr model = map->models[i];
+
+        if (VIR_ALLOC_N(model->bits, map->nwords) < 0)
+            return -1;
+
+        x86DataToBits(map, &model->data, model->bits);
+    }
+
+    return 0;
+}
+
+
 static virCPUx86MapPtr
 virCPUx86LoadMap(void)
 {
@@ -1392,7 +1639,11 @@ virCPUx86LoadMap(void)
     if (VIR_ALLOC(map) < 0)
         return NULL;
 
-    if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0)
+    if (!(map->featureNames = virHashCreate(256, NULL)))
+        goto error;
+
+    if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0 ||
+        x86MapInitBits(map) < 0)
         goto error;
 
     return map;
@@ -1581,7 +1832,8 @@ x86Compute(virCPUDefPtr host,
         !(cpu_require = x86ModelFromCPU(cpu, map, VIR_CPU_FEATURE_REQUIRE)) ||
         !(cpu_optional = x86ModelFromCPU(cpu, map, VIR_CPU_FEATURE_OPTIONAL)) ||
         !(cpu_disable = x86ModelFromCPU(cpu, map, VIR_CPU_FEATURE_DISABLE)) ||
-        !(cpu_forbid = x86ModelFromCPU(cpu, map, VIR_CPU_FEATURE_FORBID)))
+        !(cpu_forbid = x86ModelFromCPU(cpu, map, VIR_CPU_FEATURE_FORBID)) ||
+        x86ModelUnshare(cpu_require) < 0)
         goto error;
 
     x86DataIntersect(&cpu_forbid->data, &host_model->data);
@@ -1753,27 +2005,22 @@ virCPUx86Compare(virCPUDefPtr host,
  */
 static int
 x86DecodeUseCandidate(virCPUx86ModelPtr current,
-                      virCPUDefPtr cpuCurrent,
+                      size_t nfeaturesCurrent,
                       virCPUx86ModelPtr candidate,
-                      virCPUDefPtr cpuCandidate,
+                      size_t nrequired,
+                      size_t ndisabled,
                       uint32_t signature,
                       const char *preferred,
                       bool checkPolicy)
 {
-    if (checkPolicy) {
-        size_t i;
-        for (i = 0; i < cpuCandidate->nfeatures; i++) {
-            if (cpuCandidate->features[i].policy == VIR_CPU_FEATURE_DISABLE)
-                return 0;
-            cpuCandidate->features[i].policy = -1;
-        }
-    }
+    if (checkPolicy && ndisabled > 0)
+        return 0;
 
     if (preferred &&
-        STREQ(cpuCandidate->model, preferred))
+        STREQ(candidate->name, preferred))
         return 2;
 
-    if (!cpuCurrent)
+    if (!current)
         return 1;
 
     /* Ideally we want to select a model with family/model equal to
@@ -1785,7 +2032,7 @@ x86DecodeUseCandidate(virCPUx86ModelPtr current,
         candidate->signature != signature)
         return 0;
 
-    if (cpuCurrent->nfeatures > cpuCandidate->nfeatures)
+    if (nfeaturesCurrent > nrequired + ndisabled)
         return 1;
 
     /* Prefer a candidate with matching signature even though it would
@@ -1800,6 +2047,44 @@ x86DecodeUseCandidate(virCPUx86ModelPtr current,
 }
 
 
+/*
+ * Computes the number of required and disabled features x86DataToCPU would
+ * produce for @candidate without building the CPU definition. @copy and
+ * @modelData are used as a scratch space.
+ */
+static void
+x86DecodeCandidate(virCPUx86MapPtr map,
+                   const uint32_t *data,
+                   virCPUx86ModelPtr candidate,
+                   virDomainCapsCPUModelPtr hvModel,
+                   uint32_t *copy,
+                   uint32_t *modelData,
+                   size_t *nrequired,
+                   size_t *ndisabled)
+{
+    size_t i;
+
+    for (i = 0; i < map->nwords; i++) {
+        copy[i] = data[i] & ~candidate->bits[i];
+        modelData[i] = candidate->bits[i] & ~data[i];
+    }
+
+    if (hvModel && hvModel->blockers) {
+        char **blocker;
+        virCPUx86FeaturePtr feature;
+
+        for (blocker = hvModel->blockers; *blocker; blocker++) {
+            if ((feature = x86FeatureFind(map, *blocker)) &&
+                !x86BitsHasFeature(copy, feature))
+                x86BitsAddFeature(modelData, feature);
+        }
+    }
+
+    *nrequired = x86BitsCountFeatures(map, copy);
+    *ndisabled = x86BitsCountFeatures(map, modelData);
+}
+
+
 /**
  * Drop broken TSX features.
  */
@@ -1845,14 +2130,17 @@ x86Decode(virCPUDefPtr cpu,
     int ret = -1;
     virCPUx86MapPtr map;
     virCPUx86ModelPtr candidate;
-    virCPUDefPtr cpuCandidate;
     virCPUx86ModelPtr model = NULL;
+    size_t nfeatures = 0;
     virCPUDefPtr cpuModel = NULL;
     virCPUx86Data data = VIR_CPU_X86_DATA_INIT;
-    virCPUx86Data copy = VIR_CPU_X86_DATA_INIT;
-    virCPUx86Data features = VIR_CPU_X86_DATA_INIT;
     virCPUx86VendorPtr vendor;
     virDomainCapsCPUModelPtr hvModel = NULL;
+    virDomainCapsCPUModelPtr hvCandidate = NULL;
+    uint32_t *bits = NULL;
+    uint32_t *dataBits;
+    uint32_t *copyBits;
+    uint32_t *modelBits;
     uint32_t signature;
     ssize_t i;
     int rc;
@@ -1868,13 +2156,25 @@ x86Decode(virCPUDefPtr cpu,
 
     x86DataFilterTSX(&data, vendor, map);
 
+    if (VIR_ALLOC_N(bits, map->nwords * 3) < 0)
+        goto cleanup;
+
+    dataBits = bits;
+    copyBits = bits + map->nwords;
+    modelBits = bits + map->nwords * 2;
+    x86DataToBits(map, &data, dataBits);
+
     /* Walk through the CPU models in reverse order to check newest
      * models first.
      */
     for (i = map->nmodels - 1; i >= 0; i--) {
+        size_t nrequired;
+        size_t ndisabled;
+
         candidate = map->models[i];
         if (models &&
-            !(hvModel = virDomainCapsCPUModelsGet(models, candidate->name))) {
+            !(hvCandidate = virDomainCapsCPUModelsGet(models,
+                                                      candidate->name))) {
             if (preferred && STREQ(candidate->name, preferred)) {
                 if (cpu->fallback != VIR_CPU_FALLBACK_ALLOW) {
                     virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
@@ -1902,30 +2202,36 @@ x86Decode(virCPUDefPtr cpu,
             continue;
         }
 
-        if (!(cpuCandidate = x86DataToCPU(&data, candidate, map, hvModel)))
-            goto cleanup;
-        cpuCandidate->type = cpu->type;
+        x86DecodeCandidate(map, dataBits, candidate, hvCandidate,
+                           copyBits, modelBits, &nrequired, &ndisabled);
 
-        if ((rc = x86DecodeUseCandidate(model, cpuModel,
-                                        candidate, cpuCandidate,
+        if ((rc = x86DecodeUseCandidate(model, nfeatures,
+                                        candidate, nrequired, ndisabled,
                                         signature, preferred,
                                         cpu->type == VIR_CPU_TYPE_HOST))) {
-            virCPUDefFree(cpuModel);
-            cpuModel = cpuCandidate;
             model = candidate;
+            hvModel = hvCandidate;
+            nfeatures = nrequired + ndisabled;
             if (rc == 2)
                 break;
-        } else {
-            virCPUDefFree(cpuCandidate);
         }
     }
 
-    if (!cpuModel) {
+    if (!model) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("Cannot find suitable CPU model for given data"));
         goto cleanup;
     }
 
+    if (!(cpuModel = x86DataToCPU(&data, model, map, hvModel)))
+        goto cleanup;
+
+    /* feature policy is ignored for host CPU */
+    if (cpu->type == VIR_CPU_TYPE_HOST) {
+        for (i = 0; i < cpuModel->nfeatures; i++)
+            cpuModel->features[i].policy = -1;
+    }
+
     /* Remove non-migratable features if requested
      * Note: this only works as long as no CPU model contains non-migratable
      * features directly */
@@ -1957,8 +2263,7 @@ x86Decode(virCPUDefPtr cpu,
  cleanup:
     virCPUDefFree(cpuModel);
     virCPUx86DataClear(&data);
-    virCPUx86DataClear(&copy);
-    virCPUx86DataClear(&features);
+    VIR_FREE(bits);
     return ret;
 }
 
@@ -1979,8 +2284,11 @@ x86EncodePolicy(virCPUx86Data *data,
 {
     virCPUx86ModelPtr model;
 
-    if (!(model = x86ModelFromCPU(cpu, map, policy)))
+    if (!(model = x86ModelFromCPU(cpu, map, policy)) ||
+        x86ModelUnshare(model) < 0) {
+        x86ModelFree(model);
         return -1;
+    }
 
     *data = model->data;
     model->data.len = 0;
@@ -2459,7 +2767,9 @@ x86Baseline(virCPUDefPtr *cpus,
     if (!(map = virCPUx86GetMap()))
         goto error;
 
-    if (!(base_model = x86ModelFromCPU(cpus[0], map, VIR_CPU_FEATURE_REQUIRE)))
+    if (!(base_model = x86ModelFromCPU(cpus[0], map,
+                                       VIR_CPU_FEATURE_REQUIRE)) ||
+        x86ModelUnshare(base_model) < 0)
         goto error;
 
     if (VIR_ALLOC(cpu) < 0)
@@ -2621,13 +2931,16 @@ virCPUx86Update(virCPUDefPtr guest,
     if (!(map = virCPUx86GetMap()))
         return -1;
 
-    if (!(model = x86ModelFromCPU(host, map, -1)))
-        goto cleanup;
-
     for (i = 0; i < guest->nfeatures; i++) {
         if (guest->features[i].policy == VIR_CPU_FEATURE_OPTIONAL) {
-            int supported = x86FeatureInData(guest->features[i].name,
-                                             &model->data, map);
+            int supported;
+
+            /* host CPU data are only needed to resolve optional features */
+            if (!model && !(model = x86ModelFromCPU(host, map, -1)))
+                goto cleanup;
+
+            supported = x86FeatureInData(guest->features[i].name,
+                                         &model->data, map);
             if (supported < 0)
                 goto cleanup;
             else if (supported)
@@ -2831,7 +3144,8 @@ virCPUx86Translate(virCPUDefPtr cpu,
     if (!(map = virCPUx86GetMap()))
         goto cleanup;
 
-    if (!(model = x86ModelFromCPU(cpu, map, -1)))
+    if (!(model = x86ModelFromCPU(cpu, map, -1)) ||
+        x86ModelUnshare(model) < 0)
         goto cleanup;
 
     if (model->vendor &&
@@ -1026,6 +1026,19 @@ typedef int
                          int nparams,
                          unsigned int flags);
 
+typedef int
+(*virDrvDomainBlockBackup)(virDomainPtr dom,
+                           const char *path,
+                           const char *destxml,
+                           virTypedParameterPtr params,
+                           int nparams,
+                           unsigned int flags);
+
+typedef int
+(*virDrvDomainStartDirtyRateCalc)(virDomainPtr domain,
+                                  int seconds,
+                                  unsigned int flags);
+
 typedef int
 (*virDrvDomainBlockCommit)(virDomainPtr dom,
                            const char *disk,
@@ -1283,6 +1296,44 @@ typedef int
                                   unsigned int action,
                                   unsigned int flags);
 
+typedef int
+(*virDrvConnectListDomainChanges)(virConnectPtr conn,
+                                  unsigned long long *cursor,
+                                  virDomainPtr **changed,
+                                  virDomainPtr **removed,
+                                  unsigned int flags);
+
+typedef int
+(*virDrvConnectDomainStatsRegister)(virConnectPtr conn,
+                                    unsigned int stats,
+                                    unsigned int interval,
+                                    virConnectDomainStatsCallback cb,
+                                    void *opaque,
+                                    virFreeCallback freecb,
+                                    unsigned int flags);
+
+typedef int
+(*virDrvConnectDomainStatsDeregister)(virConnectPtr conn,
+                                      int callbackID);
+
+typedef int
+(*virDrvDomainGetStatsHistory)(virDomainPtr dom,
+                               unsigned long long start,
+                               unsigned long long end,
+                               virDomainStatsRecordPtr **samples,
+                               unsigned int flags);
+
+typedef char *
+(*virDrvDomainGetXMLDescSubtree)(virDomainPtr dom,
+                                 const char *subtree,
+                                 unsigned int flags);
+
+typedef int
+(*virDrvDomainAttachDevices)(virDomainPtr dom,
+                             const char **xmls,
+                             unsigned int nxmls,
+                             unsigned int flags);
+
 
 typedef struct _virHypervisorDriver virHypervisorDriver;
 typedef virHypervisorDriver *virHypervisorDriverPtr;
@@ -1528,6 +1579,14 @@ struct _virHypervisorDriver {
     virDrvDomainSetVcpu domainSetVcpu;
     virDrvDomainSetBlockThreshold domainSetBlockThreshold;
     virDrvDomainSetLifecycleAction domainSetLifecycleAction;
+    virDrvConnectListDomainChanges connectListDomainChanges;
+    virDrvConnectDomainStatsRegister connectDomainStatsRegister;
+    virDrvConnectDomainStatsDeregister connectDomainStatsDeregister;
+    virDrvDomainGetStatsHistory domainGetStatsHistory;
+    virDrvDomainGetXMLDescSubtree domainGetXMLDescSubtree;
+    virDrvDomainAttachDevices domainAttachDevices;
+    virDrvDomainBlockBackup domainBlockBackup;
+    virDrvDomainStartDirtyRateCalc domainStartDirtyRateCalc;
 };
 
 
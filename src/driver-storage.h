@@ -213,6 +213,11 @@ typedef int
 (*virDrvConnectStoragePoolEventDeregisterAny)(virConnectPtr conn,
                                               int callbackID);
 
+typedef int
+(*virDrvStorageVolGetJobInfo)(virStorageVolPtr vol,
+                              virStorageVolJobInfoPtr info,
+                              unsigned int flags);
+
 
 typedef struct _virStorageDriver virStorageDriver;
 typedef virStorageDriver *virStorageDriverPtr;
@@ -268,6 +273,7 @@ struct _virStorageDriver {
     virDrvStorageVolResize storageVolResize;
     virDrvStoragePoolIsActive storagePoolIsActive;
     virDrvStoragePoolIsPersistent storagePoolIsPersistent;
+    virDrvStorageVolGetJobInfo storageVolGetJobInfo;
 };
 
 
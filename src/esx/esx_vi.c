@@ -36,6 +36,8 @@
 #include "esx_vi_methods.h"
 #include "esx_util.h"
 #include "virstring.h"
+#include "viratomic.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_ESX
 
@@ -965,10 +967,15 @@ ESX_VI__TEMPLATE__ALLOC(Context)
 /* esxVI_Context_Free */
 ESX_VI__TEMPLATE__FREE(Context,
 {
+    size_t i;
+
     if (item->sessionLock)
         virMutexDestroy(item->sessionLock);
 
+    /* The shared object is freed along with the last handle using it */
     esxVI_CURL_Free(&item->curl);
+    for (i = 0; i < ARRAY_CARDINALITY(item->curlPool); i++)
+        esxVI_CURL_Free(&item->curlPool[i]);
     VIR_FREE(item->url);
     VIR_FREE(item->ipAddress);
     VIR_FREE(item->username);
@@ -991,6 +998,47 @@ ESX_VI__TEMPLATE__FREE(Context,
     esxVI_SelectionSpec_Free(&item->selectSet_datacenterToNetwork);
 })
 
+/*
+ * Concurrent API calls would serialize on a single CURL handle. Create a
+ * few more handles, each with its own persistent connection, sharing the
+ * cookies and thereby the session of the main one.
+ */
+static int
+esxVI_Context_ConnectPool(esxVI_Context *ctx, esxUtil_ParsedUri *parsedUri)
+{
+    size_t i;
+
+    if (esxVI_SharedCURL_Alloc(&ctx->curlShared) < 0 ||
+        esxVI_SharedCURL_Add(ctx->curlShared, ctx->curl) < 0) {
+        esxVI_SharedCURL_Free(&ctx->curlShared);
+        return -1;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(ctx->curlPool); i++) {
+        if (esxVI_CURL_Alloc(&ctx->curlPool[i]) < 0 ||
+            esxVI_CURL_Connect(ctx->curlPool[i], parsedUri) < 0 ||
+            esxVI_SharedCURL_Add(ctx->curlShared, ctx->curlPool[i]) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Picks the CURL handle for the next request in a round-robin fashion */
+static esxVI_CURL *
+esxVI_Context_GetCURL(esxVI_Context *ctx)
+{
+    unsigned int next = virAtomicIntInc(&ctx->curlNext);
+
+    next %= ESX_VI__CONTEXT__CURL_POOL_SIZE;
+
+    if (next == 0 || !ctx->curlPool[next - 1])
+        return ctx->curl;
+
+    return ctx->curlPool[next - 1];
+}
+
 int
 esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
                       const char *ipAddress, const char *username,
@@ -1015,6 +1063,7 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
 
     if (esxVI_CURL_Alloc(&ctx->curl) < 0 ||
         esxVI_CURL_Connect(ctx->curl, parsedUri) < 0 ||
+        esxVI_Context_ConnectPool(ctx, parsedUri) < 0 ||
         VIR_STRDUP(ctx->url, url) < 0 ||
         VIR_STRDUP(ctx->ipAddress, ipAddress) < 0 ||
         VIR_STRDUP(ctx->username, username) < 0 ||
@@ -1420,6 +1469,7 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
     char *xpathExpression = NULL;
     xmlXPathContextPtr xpathContext = NULL;
     xmlNodePtr responseNode = NULL;
+    esxVI_CURL *curl;
 
     if (!request || !response || *response) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
@@ -1429,18 +1479,20 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
     if (esxVI_Response_Alloc(response) < 0)
         return -1;
 
-    virMutexLock(&ctx->curl->lock);
+    curl = esxVI_Context_GetCURL(ctx);
 
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_URL, ctx->url);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_RANGE, NULL);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_WRITEDATA, &buffer);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_UPLOAD, 0);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_POSTFIELDS, request);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_POSTFIELDSIZE, strlen(request));
+    virMutexLock(&curl->lock);
 
-    (*response)->responseCode = esxVI_CURL_Perform(ctx->curl, ctx->url);
+    curl_easy_setopt(curl->handle, CURLOPT_URL, ctx->url);
+    curl_easy_setopt(curl->handle, CURLOPT_RANGE, NULL);
+    curl_easy_setopt(curl->handle, CURLOPT_WRITEDATA, &buffer);
+    curl_easy_setopt(curl->handle, CURLOPT_UPLOAD, 0);
+    curl_easy_setopt(curl->handle, CURLOPT_POSTFIELDS, request);
+    curl_easy_setopt(curl->handle, CURLOPT_POSTFIELDSIZE, strlen(request));
+
+    (*response)->responseCode = esxVI_CURL_Perform(curl, ctx->url);
 
-    virMutexUnlock(&ctx->curl->lock);
+    virMutexUnlock(&curl->lock);
 
     if ((*response)->responseCode < 0)
         goto cleanup;
@@ -2072,6 +2124,10 @@ esxVI_BuildSelectSetCollection(esxVI_Context *ctx)
  *
  * Instead query the session manager for the current session of this
  * connection and re-login if there is no current session.
+ *
+ * Every API call starts with this check, so skip it if the session was
+ * found to be alive just recently. The server's idle timeout is in the
+ * range of minutes, so it cannot have expired in the meantime.
  */
 int
 esxVI_EnsureSession(esxVI_Context *ctx)
@@ -2082,6 +2138,7 @@ esxVI_EnsureSession(esxVI_Context *ctx)
     esxVI_DynamicProperty *dynamicProperty = NULL;
     esxVI_UserSession *currentSession = NULL;
     char *escapedPassword = NULL;
+    unsigned long long now = 0;
 
     if (!ctx->sessionLock) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid call, no mutex"));
@@ -2095,6 +2152,12 @@ esxVI_EnsureSession(esxVI_Context *ctx)
         goto cleanup;
     }
 
+    if (virTimeMillisNow(&now) == 0 && ctx->sessionChecked &&
+        now < ctx->sessionChecked + ESX_VI__SESSION__CHECK_INTERVAL * 1000) {
+        result = 0;
+        goto cleanup;
+    }
+
     escapedPassword = esxUtil_EscapeForXml(ctx->password);
 
     if (!escapedPassword) {
@@ -2140,6 +2203,7 @@ esxVI_EnsureSession(esxVI_Context *ctx)
         goto cleanup;
     }
 
+    ctx->sessionChecked = now;
     result = 0;
 
  cleanup:
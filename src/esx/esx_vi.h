@@ -182,9 +182,18 @@ int esxVI_MultiCURL_CheckFirstMessage(esxVI_MultiCURL *multi, long *responseCode
  * Context
  */
 
+/* Number of CURL handles SOAP requests are spread over */
+# define ESX_VI__CONTEXT__CURL_POOL_SIZE 4
+
+/* Seconds after a successful session check to skip the next one */
+# define ESX_VI__SESSION__CHECK_INTERVAL 10
+
 struct _esxVI_Context {
     /* All members are used read-only after esxVI_Context_Connect ... */
     esxVI_CURL *curl;
+    esxVI_CURL *curlPool[ESX_VI__CONTEXT__CURL_POOL_SIZE - 1]; /* besides curl */
+    esxVI_SharedCURL *curlShared; /* session cookie shared by all handles */
+    int curlNext; /* ... except the handle to use next, changed atomically */
     char *url;
     char *ipAddress;
     char *username;
@@ -193,8 +202,9 @@ struct _esxVI_Context {
     unsigned long apiVersion; /* = 1000000 * major + 1000 * minor + micro */
     esxVI_ProductLine productLine;
     unsigned long productVersion; /* = 1000000 * major + 1000 * minor + micro */
-    esxVI_UserSession *session; /* ... except the session ... */
-    virMutexPtr sessionLock; /* ... that is protected by this mutex */
+    esxVI_UserSession *session; /* ... and the session ... */
+    unsigned long long sessionChecked; /* ... with its last check time ... */
+    virMutexPtr sessionLock; /* ... that are protected by this mutex */
     esxVI_Datacenter *datacenter;
     char *datacenterPath; /* including folders */
     esxVI_ComputeResource *computeResource;
@@ -34,6 +34,13 @@
 #include "virstring.h"
 #include "viraccessapicheck.h"
 #include "virinterfaceobj.h"
+#include "virnetlink.h"
+#include "virtime.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+# define NETCF_WITH_LINK_EVENTS 1
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_INTERFACE
 
@@ -41,11 +48,40 @@ VIR_LOG_INIT("interface.interface_backend_netcf");
 
 #define INTERFACE_DRIVER_NAME "netcf"
 
+/* How long the cached interface list is trusted at most, as changes to
+ * interface configuration made outside of libvirt don't show up as link
+ * events */
+#define NETCF_IFACE_CACHE_MAX_AGE (60 * 1000)
+
+typedef struct _netcfInterfaceCacheEntry netcfInterfaceCacheEntry;
+typedef netcfInterfaceCacheEntry *netcfInterfaceCacheEntryPtr;
+struct _netcfInterfaceCacheEntry {
+    char *name;
+    char *mac;
+    bool active;
+};
+
 /* Main driver state */
 typedef struct
 {
     virObjectLockable parent;
     struct netcf *netcf;
+
+    /* Name, MAC address and state of every interface known to netcf, as
+     * needed for listing them, protected by the driver lock. */
+    bool cacheValid;
+    unsigned long long cacheTime;
+    netcfInterfaceCacheEntryPtr cache;
+    size_t ncache;
+
+    /* Names of links that changed since the cache was last updated, as
+     * reported by netlink. Protected by @linksLock rather than the driver
+     * lock, which is held across slow calls into netcf, so that the
+     * netlink event handler never waits for those. */
+    virMutex linksLock;
+    virHashTablePtr changedLinks;
+    bool changedAll;
+    int linkWatch;
 } virNetcfDriverState, *virNetcfDriverStatePtr;
 
 static virClassPtr virNetcfDriverStateClass;
@@ -67,6 +103,21 @@ VIR_ONCE_GLOBAL_INIT(virNetcfDriverState)
 static virNetcfDriverStatePtr driver;
 
 
+static void
+netcfInterfaceCacheClear(virNetcfDriverStatePtr _driver)
+{
+    size_t i;
+
+    for (i = 0; i < _driver->ncache; i++) {
+        VIR_FREE(_driver->cache[i].name);
+        VIR_FREE(_driver->cache[i].mac);
+    }
+    VIR_FREE(_driver->cache);
+    _driver->ncache = 0;
+    _driver->cacheValid = false;
+}
+
+
 static void
 virNetcfDriverStateDispose(void *obj)
 {
@@ -74,6 +125,22 @@ virNetcfDriverStateDispose(void *obj)
 
     if (_driver->netcf)
         ncf_close(_driver->netcf);
+
+    netcfInterfaceCacheClear(_driver);
+    virHashFree(_driver->changedLinks);
+    virMutexDestroy(&_driver->linksLock);
+}
+
+
+/*
+ * Makes the next listing rebuild the interface cache from scratch. Must
+ * be called with the driver locked by anything that may change the
+ * interfaces known to netcf.
+ */
+static void
+netcfInterfaceCacheInvalidate(void)
+{
+    driver->cacheValid = false;
 }
 
 
@@ -88,6 +155,21 @@ netcfStateInitialize(bool privileged ATTRIBUTE_UNUSED,
     if (!(driver = virObjectLockableNew(virNetcfDriverStateClass)))
         return -1;
 
+    driver->linkWatch = -1;
+    if (virMutexInit(&driver->linksLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        virObjectUnref(driver);
+        driver = NULL;
+        return -1;
+    }
+
+    if (!(driver->changedLinks = virHashCreate(16, NULL))) {
+        virObjectUnref(driver);
+        driver = NULL;
+        return -1;
+    }
+
     /* open netcf */
     if (ncf_init(&driver->netcf, NULL) != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -106,6 +188,14 @@ netcfStateCleanup(void)
     if (!driver)
         return -1;
 
+#ifdef NETCF_WITH_LINK_EVENTS
+    /* The netlink client holds a reference to the driver */
+    if (driver->linkWatch >= 0) {
+        virNetlinkEventRemoveClient(driver->linkWatch, NULL, NETLINK_ROUTE);
+        driver->linkWatch = -1;
+    }
+#endif
+
     if (virObjectUnref(driver)) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Attempt to close netcf state driver "
@@ -126,6 +216,7 @@ netcfStateReload(void)
         return 0;
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
     ncf_close(driver->netcf);
     if (ncf_init(&driver->netcf, NULL) != 0) {
         /* this isn't a good situation, because we can't shut down the
@@ -265,6 +356,331 @@ netcfInterfaceObjIsActive(struct netcf_if *iface,
     return ret;
 }
 
+#ifdef NETCF_WITH_LINK_EVENTS
+static void
+netcfInterfaceLinkEvent(struct nlmsghdr *hdr,
+                        unsigned int length ATTRIBUTE_UNUSED,
+                        struct sockaddr_nl *peer ATTRIBUTE_UNUSED,
+                        bool *handled ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    virNetcfDriverStatePtr _driver = opaque;
+    struct nlattr *tb[IFLA_MAX + 1];
+    const char *ifname = NULL;
+
+    if (hdr->nlmsg_type != RTM_NEWLINK &&
+        hdr->nlmsg_type != RTM_DELLINK)
+        return;
+
+    if (nlmsg_parse(hdr, sizeof(struct ifinfomsg), tb, IFLA_MAX, NULL) == 0 &&
+        tb[IFLA_IFNAME])
+        ifname = nla_get_string(tb[IFLA_IFNAME]);
+
+    virMutexLock(&_driver->linksLock);
+    if (!ifname ||
+        virHashUpdateEntry(_driver->changedLinks, ifname, (void *) 1) < 0) {
+        /* Don't know what changed, so refetch everything */
+        virResetLastError();
+        _driver->changedAll = true;
+    }
+    virMutexUnlock(&_driver->linksLock);
+}
+
+
+static void
+netcfInterfaceLinkEventRemove(int watch ATTRIBUTE_UNUSED,
+                              const virMacAddr *macaddr ATTRIBUTE_UNUSED,
+                              void *opaque)
+{
+    virObjectUnref(opaque);
+}
+
+
+/*
+ * Makes sure link changes are tracked, which the cache relies on.
+ * Returns false if they can't be, in which case interfaces have to be
+ * listed without the cache.
+ */
+static bool
+netcfInterfaceCacheWatch(void)
+{
+    int watch;
+
+    if (driver->linkWatch >= 0)
+        return true;
+
+    /* libvirtd starts the netlink event service only after drivers */
+    if (!virNetlinkEventServiceIsRunning(NETLINK_ROUTE))
+        return false;
+
+    virObjectRef(driver);
+    if ((watch = virNetlinkEventAddClient(netcfInterfaceLinkEvent,
+                                          netcfInterfaceLinkEventRemove,
+                                          driver, NULL, NETLINK_ROUTE)) < 0) {
+        VIR_WARN("Failed to watch link changes: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        virObjectUnref(driver);
+        return false;
+    }
+
+    driver->linkWatch = watch;
+    netcfInterfaceCacheInvalidate();
+    return true;
+}
+#else /* !NETCF_WITH_LINK_EVENTS */
+static bool
+netcfInterfaceCacheWatch(void)
+{
+    return false;
+}
+#endif /* !NETCF_WITH_LINK_EVENTS */
+
+
+static netcfInterfaceCacheEntryPtr
+netcfInterfaceCacheFind(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < driver->ncache; i++) {
+        if (STREQ(driver->cache[i].name, name))
+            return &driver->cache[i];
+    }
+
+    return NULL;
+}
+
+
+static int
+netcfInterfaceCacheAppend(netcfInterfaceCacheEntryPtr *cache,
+                          size_t *ncache,
+                          struct netcf_if *iface,
+                          bool active)
+{
+    netcfInterfaceCacheEntry entry = { .active = active };
+
+    if (VIR_STRDUP(entry.name, ncf_if_name(iface)) < 0 ||
+        VIR_STRDUP(entry.mac, ncf_if_mac_string(iface)) < 0)
+        goto error;
+
+    if (VIR_APPEND_ELEMENT(*cache, *ncache, entry) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    VIR_FREE(entry.name);
+    VIR_FREE(entry.mac);
+    return -1;
+}
+
+
+static int
+netcfInterfaceCacheListState(netcfInterfaceCacheEntryPtr *cache,
+                             size_t *ncache,
+                             unsigned int ncf_flags)
+{
+    int count;
+    size_t i;
+    char **names = NULL;
+    struct netcf_if *iface = NULL;
+    int ret = -1;
+
+    if ((count = ncf_num_of_interfaces(driver->netcf, ncf_flags)) < 0) {
+        const char *errmsg, *details;
+        int errcode = ncf_error(driver->netcf, &errmsg, &details);
+
+        virReportError(netcf_to_vir_err(errcode),
+                       _("failed to get number of host interfaces: %s%s%s"),
+                       errmsg, details ? " - " : "",
+                       details ? details : "");
+        return -1;
+    }
+
+    if (count == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(names, count) < 0)
+        return -1;
+
+    if ((count = ncf_list_interfaces(driver->netcf, count,
+                                     names, ncf_flags)) < 0) {
+        const char *errmsg, *details;
+        int errcode = ncf_error(driver->netcf, &errmsg, &details);
+
+        virReportError(netcf_to_vir_err(errcode),
+                       _("failed to list host interfaces: %s%s%s"),
+                       errmsg, details ? " - " : "",
+                       details ? details : "");
+        goto cleanup;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!(iface = ncf_lookup_by_name(driver->netcf, names[i]))) {
+            const char *errmsg, *details;
+            int errcode = ncf_error(driver->netcf, &errmsg, &details);
+            if (errcode != NETCF_NOERROR) {
+                virReportError(netcf_to_vir_err(errcode),
+                               _("couldn't find interface named '%s': %s%s%s"),
+                               names[i], errmsg,
+                               details ? " - " : "", details ? details : "");
+                goto cleanup;
+            }
+            /* deleted by another process meanwhile */
+            continue;
+        }
+
+        if (netcfInterfaceCacheAppend(cache, ncache, iface,
+                                      ncf_flags == NETCF_IFACE_ACTIVE) < 0)
+            goto cleanup;
+
+        ncf_if_free(iface);
+        iface = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    ncf_if_free(iface);
+    if (count > 0)
+        for (i = 0; i < count; i++)
+            VIR_FREE(names[i]);
+    VIR_FREE(names);
+    return ret;
+}
+
+
+static int
+netcfInterfaceCacheFill(void)
+{
+    netcfInterfaceCacheEntryPtr cache = NULL;
+    size_t ncache = 0;
+    size_t i;
+
+    if (netcfInterfaceCacheListState(&cache, &ncache,
+                                     NETCF_IFACE_ACTIVE) < 0 ||
+        netcfInterfaceCacheListState(&cache, &ncache,
+                                     NETCF_IFACE_INACTIVE) < 0) {
+        for (i = 0; i < ncache; i++) {
+            VIR_FREE(cache[i].name);
+            VIR_FREE(cache[i].mac);
+        }
+        VIR_FREE(cache);
+        return -1;
+    }
+
+    netcfInterfaceCacheClear(driver);
+    driver->cache = cache;
+    driver->ncache = ncache;
+    return 0;
+}
+
+
+/* Asks netcf again about the single interface @name */
+static int
+netcfInterfaceCacheRefreshLink(void *payload ATTRIBUTE_UNUSED,
+                               const void *name,
+                               void *opaque)
+{
+    int *ret = opaque;
+    netcfInterfaceCacheEntryPtr entry = netcfInterfaceCacheFind(name);
+    struct netcf_if *iface;
+    bool active;
+
+    if (*ret < 0)
+        return 0;
+
+    if (!(iface = ncf_lookup_by_name(driver->netcf, name))) {
+        const char *errmsg, *details;
+        int errcode = ncf_error(driver->netcf, &errmsg, &details);
+        if (errcode != NETCF_NOERROR) {
+            virReportError(netcf_to_vir_err(errcode),
+                           _("couldn't find interface named '%s': %s%s%s"),
+                           (const char *) name, errmsg,
+                           details ? " - " : "", details ? details : "");
+            *ret = -1;
+            return 0;
+        }
+
+        /* Either gone, or a link netcf doesn't know about */
+        if (entry) {
+            size_t i = entry - driver->cache;
+
+            VIR_FREE(entry->name);
+            VIR_FREE(entry->mac);
+            VIR_DELETE_ELEMENT(driver->cache, i, driver->ncache);
+        }
+        return 0;
+    }
+
+    if (netcfInterfaceObjIsActive(iface, &active) < 0) {
+        *ret = -1;
+    } else if (entry) {
+        entry->active = active;
+        VIR_FREE(entry->mac);
+        if (VIR_STRDUP(entry->mac, ncf_if_mac_string(iface)) < 0)
+            *ret = -1;
+    } else if (netcfInterfaceCacheAppend(&driver->cache, &driver->ncache,
+                                         iface, active) < 0) {
+        *ret = -1;
+    }
+
+    ncf_if_free(iface);
+    return 0;
+}
+
+
+/*
+ * Brings the interface cache up to date, asking netcf only about links
+ * that changed since the last update, unless the cache has to be built
+ * from scratch. Must be called with the driver locked.
+ *
+ * Returns 0 if the cache can be used, 1 if it can't because link changes
+ * are not tracked, -1 on error.
+ */
+static int
+netcfInterfaceCacheUpdate(void)
+{
+    virHashTablePtr changed;
+    virHashTablePtr fresh;
+    bool changedAll;
+    unsigned long long now;
+    int ret = 0;
+
+    if (!netcfInterfaceCacheWatch())
+        return 1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (!(fresh = virHashCreate(16, NULL)))
+        return -1;
+
+    virMutexLock(&driver->linksLock);
+    changed = driver->changedLinks;
+    driver->changedLinks = fresh;
+    changedAll = driver->changedAll;
+    driver->changedAll = false;
+    virMutexUnlock(&driver->linksLock);
+
+    if (!driver->cacheValid || changedAll ||
+        now - driver->cacheTime >= NETCF_IFACE_CACHE_MAX_AGE) {
+        if ((ret = netcfInterfaceCacheFill()) == 0) {
+            driver->cacheValid = true;
+            driver->cacheTime = now;
+        }
+    } else {
+        virHashForEach(changed, netcfInterfaceCacheRefreshLink, &ret);
+    }
+
+    if (ret < 0)
+        netcfInterfaceCacheInvalidate();
+
+    virHashFree(changed);
+    return ret;
+}
+
+
 static int netcfConnectNumOfInterfacesImpl(virConnectPtr conn,
                                            int status,
                                            virInterfaceObjListFilter filter)
@@ -521,13 +937,67 @@ static int netcfConnectListDefinedInterfaces(virConnectPtr conn, char **const na
 
 }
 
+/* Same as netcfConnectListAllInterfaces, but served from the interface
+ * cache. Must be called with the driver locked. */
+static int
+netcfConnectListAllInterfacesCached(virConnectPtr conn,
+                                    virInterfacePtr **ifaces,
+                                    unsigned int ncf_flags)
+{
+    virInterfacePtr *tmp_iface_objs = NULL;
+    int niface_objs = 0;
+    size_t i;
+
+    if (ifaces && VIR_ALLOC_N(tmp_iface_objs, driver->ncache + 1) < 0)
+        return -1;
+
+    for (i = 0; i < driver->ncache; i++) {
+        netcfInterfaceCacheEntryPtr entry = &driver->cache[i];
+        virInterfaceDef def;
+
+        if (!(ncf_flags & (entry->active ? NETCF_IFACE_ACTIVE :
+                                           NETCF_IFACE_INACTIVE)))
+            continue;
+
+        /* Minimal definition for access control checks, see
+         * netcfGetMinimalDefForDevice */
+        memset(&def, 0, sizeof(def));
+        def.name = entry->name;
+        def.mac = entry->mac;
+
+        if (!virConnectListAllInterfacesCheckACL(conn, &def))
+            continue;
+
+        if (ifaces &&
+            !(tmp_iface_objs[niface_objs] = virGetInterface(conn, entry->name,
+                                                            entry->mac)))
+            goto error;
+        niface_objs++;
+    }
+
+    if (tmp_iface_objs) {
+        /* trim the array to the final size */
+        ignore_value(VIR_REALLOC_N(tmp_iface_objs, niface_objs + 1));
+        *ifaces = tmp_iface_objs;
+    }
+
+    return niface_objs;
+
+ error:
+    for (i = 0; i < niface_objs; i++)
+        virObjectUnref(tmp_iface_objs[i]);
+    VIR_FREE(tmp_iface_objs);
+    return -1;
+}
+
+
 #define MATCH(FLAG) (flags & (FLAG))
 static int
 netcfConnectListAllInterfaces(virConnectPtr conn,
                               virInterfacePtr **ifaces,
                               unsigned int flags)
 {
-    int count;
+    int count = 0;
     size_t i;
     unsigned int ncf_flags = 0;
     struct netcf_if *iface = NULL;
@@ -535,6 +1005,7 @@ netcfConnectListAllInterfaces(virConnectPtr conn,
     virInterfacePtr iface_obj = NULL;
     int niface_objs = 0;
     int ret = -1;
+    int rc;
     char **names = NULL;
 
     virCheckFlags(VIR_CONNECT_LIST_INTERFACES_FILTERS_ACTIVE, -1);
@@ -554,6 +1025,14 @@ netcfConnectListAllInterfaces(virConnectPtr conn,
         ncf_flags = NETCF_IFACE_ACTIVE | NETCF_IFACE_INACTIVE;
     }
 
+    if ((rc = netcfInterfaceCacheUpdate()) < 0)
+        goto cleanup;
+
+    if (rc == 0) {
+        ret = netcfConnectListAllInterfacesCached(conn, ifaces, ncf_flags);
+        goto cleanup;
+    }
+
     if ((count = ncf_num_of_interfaces(driver->netcf, ncf_flags)) < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -822,6 +1301,7 @@ static virInterfacePtr netcfInterfaceDefineXML(virConnectPtr conn,
     virCheckFlags(0, NULL);
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     ifacedef = virInterfaceDefParseString(xml);
     if (!ifacedef) {
@@ -866,6 +1346,7 @@ static int netcfInterfaceUndefine(virInterfacePtr ifinfo)
     int ret = -1;
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     iface = interfaceDriverGetNetcfIF(driver->netcf, ifinfo);
     if (!iface) {
@@ -909,6 +1390,7 @@ static int netcfInterfaceCreate(virInterfacePtr ifinfo,
     virCheckFlags(0, -1);
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     iface = interfaceDriverGetNetcfIF(driver->netcf, ifinfo);
     if (!iface) {
@@ -961,6 +1443,7 @@ static int netcfInterfaceDestroy(virInterfacePtr ifinfo,
     virCheckFlags(0, -1);
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     iface = interfaceDriverGetNetcfIF(driver->netcf, ifinfo);
     if (!iface) {
@@ -1046,6 +1529,7 @@ static int netcfInterfaceChangeBegin(virConnectPtr conn, unsigned int flags)
         return -1;
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     ret = ncf_change_begin(driver->netcf, 0);
     if (ret < 0) {
@@ -1071,6 +1555,7 @@ static int netcfInterfaceChangeCommit(virConnectPtr conn, unsigned int flags)
         return -1;
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     ret = ncf_change_commit(driver->netcf, 0);
     if (ret < 0) {
@@ -1096,6 +1581,7 @@ static int netcfInterfaceChangeRollback(virConnectPtr conn, unsigned int flags)
         return -1;
 
     virObjectLock(driver);
+    netcfInterfaceCacheInvalidate();
 
     ret = ncf_change_rollback(driver->netcf, 0);
     if (ret < 0) {
@@ -1241,3 +1241,186 @@ virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
     virDispatchError(NULL);
     return -1;
 }
+
+/**
+ * virAdmServerGetProcedureStats:
+ * @srv: a valid server object reference
+ * @params: pointer to procedure statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve per procedure RPC call statistics from server @srv. For every
+ * procedure of every program served by @srv which was called at least once,
+ * these include:
+ *  - number of calls and of failed calls,
+ *  - number of bytes received in calls and sent in replies,
+ *  - histograms of the time calls waited for a worker and of the time they
+ *  took to execute.
+ * See VIR_SERVER_PROCEDURE_STATS_PREFIX for how these are named.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmServerGetProcedureStats(virAdmServerPtr srv,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, params=%p, nparams=%p, flags=0x%x",
+              srv, params, nparams, flags);
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminServerGetProcedureStats(srv, params,
+                                                  nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetLoggingRecorder:
+ * @conn: pointer to an active admin connection
+ * @messages: pointer to a variable to store the recorded messages
+ *            (allocated automatically)
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves the messages kept by the log flight recorder of the daemon,
+ * which holds the last messages emitted by each of its threads regardless
+ * of the logging filters (see log_recorder_size in libvirtd.conf). The
+ * messages are sorted from the oldest to the newest, one per line, in the
+ * format used by the file logging outputs. If they don't fit in a single
+ * RPC message, the oldest ones are left out.
+ *
+ * Caller is responsible for freeing @messages.
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectGetLoggingRecorder(virAdmConnectPtr conn,
+                                char **messages,
+                                unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, messages=%p, flags=0x%x", conn, messages, flags);
+
+    virResetLastError();
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(messages, error);
+
+    if ((ret = remoteAdminConnectGetLoggingRecorder(conn, messages,
+                                                    flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetAllocStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to allocation statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve the memory allocation statistics of the daemon, broken down by
+ * the subsystem which made the allocations. Subsystems are identified by
+ * their error domain, e.g. VIR_FROM_QEMU or VIR_FROM_RPC. For each of them
+ * the number of allocations and of bytes allocated since the daemon started
+ * are reported; memory being freed is not taken into account. See
+ * VIR_CONNECT_ALLOC_STATS_PREFIX for how these are named.
+ *
+ * The statistics are only available if the daemon collects them, see
+ * alloc_stats in libvirtd.conf.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmConnectGetAllocStats(virAdmConnectPtr conn,
+                           virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=0x%x",
+              conn, params, nparams, flags);
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetAllocStats(conn, params,
+                                               nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetLockStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to lock statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve the lock contention statistics of the daemon, broken down by
+ * the class of the objects being locked, e.g. "virDomainObj". For each
+ * class the number of times a thread found the lock of one of its
+ * instances held by another thread, and the total time spent waiting for
+ * it, are reported since the daemon started. Uncontended acquisitions are
+ * not counted. See VIR_CONNECT_LOCK_STATS_PREFIX for how these are named.
+ *
+ * If the daemon has lock_stats enabled in libvirtd.conf, the same numbers
+ * are also reported for every source location which had to wait for a
+ * lock, including locks which are not part of an object, see
+ * VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                          virTypedParameterPtr *params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=0x%x",
+              conn, params, nparams, flags);
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminConnectGetLockStats(conn, params,
+                                              nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
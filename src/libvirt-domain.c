@@ -2599,6 +2599,69 @@ virDomainGetXMLDesc(virDomainPtr domain, unsigned int flags)
 }
 
 
+/**
+ * virDomainGetXMLDescSubtree:
+ * @domain: a domain object
+ * @subtree: path of the subtree below the <domain/> element
+ * @flags: bitwise-OR of VIR_DOMAIN_XML_SECURE and VIR_DOMAIN_XML_INACTIVE
+ *
+ * Provide the XML description of a part of the domain only, which is
+ * cheaper than virDomainGetXMLDesc() if the caller is not interested
+ * in the rest of the definition. The supported values of @subtree are
+ * "metadata" for the <metadata/> element and "devices/disk",
+ * "devices/controller", "devices/filesystem", "devices/interface",
+ * "devices/channel", "devices/graphics", "devices/video" and
+ * "devices/hostdev" for all devices of that kind, wrapped in a
+ * <devices/> element. Each element is formatted exactly as in the
+ * output of virDomainGetXMLDesc() with the same @flags. Use
+ * virDomainGetMetadata() to get a single metadata namespace.
+ *
+ * @flags have the same meaning as for virDomainGetXMLDesc(); in
+ * particular VIR_DOMAIN_XML_SECURE is rejected on read-only
+ * connections.
+ *
+ * Returns a 0 terminated UTF-8 encoded XML instance, or NULL in case of error.
+ *         the caller must free() the returned value.
+ */
+char *
+virDomainGetXMLDescSubtree(virDomainPtr domain,
+                           const char *subtree,
+                           unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "subtree=%s, flags=0x%x", NULLSTR(subtree), flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, NULL);
+    conn = domain->conn;
+
+    virCheckNonNullArgGoto(subtree, error);
+
+    if ((conn->flags & VIR_CONNECT_RO) &&
+        (flags & VIR_DOMAIN_XML_SECURE)) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("virDomainGetXMLDescSubtree with secure flag"));
+        goto error;
+    }
+
+    if (conn->driver->domainGetXMLDescSubtree) {
+        char *ret;
+        ret = conn->driver->domainGetXMLDescSubtree(domain, subtree, flags);
+        if (!ret)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(domain->conn);
+    return NULL;
+}
+
+
 /**
  * virConnectDomainXMLFromNative:
  * @conn: a connection object
@@ -6501,6 +6564,81 @@ virConnectListAllDomains(virConnectPtr conn,
 }
 
 
+/**
+ * virConnectListDomainChanges:
+ * @conn: Pointer to the hypervisor connection.
+ * @cursor: in: value returned by the previous call, or 0 for the first call;
+ *          out: value to pass to the next call
+ * @changed: Pointer to a variable to store the array of domains that were
+ *           defined, started, stopped or otherwise changed since @cursor
+ * @removed: Pointer to a variable to store the array of domains that were
+ *           undefined since @cursor
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Incremental variant of virConnectListAllDomains(), meant for clients
+ * that keep polling the full list of domains. Instead of returning all
+ * domains every time, only domains which changed since the previous call
+ * are returned, identified by the opaque @cursor value.
+ *
+ * If @cursor is 0, or if the hypervisor no longer remembers enough
+ * history to know what changed since @cursor (for example because the
+ * daemon was restarted), all domains are returned in @changed and
+ * @removed is set to NULL. Otherwise @removed is set to a (possibly
+ * empty) array. Callers should drop every domain listed in @removed
+ * from their inventory and then add or refresh every domain listed in
+ * @changed; a domain undefined and defined again in between may show
+ * up in both arrays. When @removed is NULL, every domain not listed in
+ * @changed has to be dropped.
+ *
+ * Domains changing while the call is in progress may be reported again
+ * by the next call.
+ *
+ * Returns the number of domains in @changed or -1 and sets both
+ * @changed and @removed to NULL in case of error. On success the
+ * arrays are guaranteed to have an extra allocated element set to
+ * NULL, to make iteration easier. The caller is responsible for
+ * calling virDomainFree() on each array element, then calling free()
+ * on both @changed and @removed.
+ */
+int
+virConnectListDomainChanges(virConnectPtr conn,
+                            unsigned long long *cursor,
+                            virDomainPtr **changed,
+                            virDomainPtr **removed,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, cursor=%p, changed=%p, removed=%p, flags=0x%x",
+              conn, cursor, changed, removed, flags);
+
+    virResetLastError();
+
+    if (changed)
+        *changed = NULL;
+    if (removed)
+        *removed = NULL;
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(cursor, error);
+    virCheckNonNullArgGoto(changed, error);
+    virCheckNonNullArgGoto(removed, error);
+
+    if (conn->driver->connectListDomainChanges) {
+        int ret;
+        ret = conn->driver->connectListDomainChanges(conn, cursor, changed,
+                                                     removed, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virDomainCreate:
  * @domain: pointer to a defined domain
@@ -8167,6 +8305,64 @@ virDomainAttachDeviceFlags(virDomainPtr domain,
 }
 
 
+/**
+ * virDomainAttachDevices:
+ * @domain: pointer to domain object
+ * @xmls: array of XML descriptions, one device each
+ * @nxmls: number of entries in @xmls
+ * @flags: bitwise-OR of virDomainDeviceModifyFlags
+ *
+ * Attach several virtual devices to a domain in a single call. The
+ * @flags parameter has the same meaning as for
+ * virDomainAttachDeviceFlags() and applies to every device in @xmls.
+ *
+ * All device descriptions are parsed and checked against the domain
+ * definition before any of them is attached. The devices are then
+ * attached in array order and the domain state and persistent
+ * configuration are saved once, after the last device.
+ *
+ * If attaching a device to the running domain fails, the devices that
+ * precede it in @xmls remain attached to the running domain, but the
+ * persistent configuration is left untouched.
+ *
+ * Returns 0 in case of success, -1 in case of failure.
+ */
+int
+virDomainAttachDevices(virDomainPtr domain,
+                       const char **xmls,
+                       unsigned int nxmls,
+                       unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "xmls=%p, nxmls=%u, flags=0x%x",
+                     xmls, nxmls, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckNonNullArgGoto(xmls, error);
+    virCheckPositiveArgGoto(nxmls, error);
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->driver->domainAttachDevices) {
+        int ret;
+        ret = conn->driver->domainAttachDevices(domain, xmls, nxmls, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
+
 /**
  * virDomainDetachDevice:
  * @domain: pointer to domain object
@@ -10240,6 +10436,94 @@ virDomainBlockCopy(virDomainPtr dom, const char *disk,
 }
 
 
+/**
+ * virDomainBlockBackup:
+ * @dom: pointer to domain object
+ * @disk: path to the block device, or device shorthand
+ * @destxml: XML description of the backup destination
+ * @params: Pointer to block backup parameter objects, or NULL
+ * @nparams: Number of block backup parameters (this value can be the same or
+ *           less than the number of parameters supported)
+ * @flags: bitwise-OR of virDomainBlockBackupFlags
+ *
+ * Copy a point-in-time view of the guest-visible contents of a disk to
+ * a new file described by @destxml, while the guest keeps running and
+ * writing to its original disk.  The destination XML has a top-level
+ * element of <disk> as described for virDomainBlockCopy(); only the
+ * sub-elements describing the new host resource are used.
+ *
+ * This command starts a long-running job of type
+ * VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP whose progress can be tracked via
+ * virDomainGetBlockJobInfo().  Unlike a copy job, a backup job ends on
+ * its own once all data has been written, and the guest keeps using its
+ * original disk throughout.  An event is issued when the job ends; the
+ * job can be canceled early with virDomainBlockJobAbort().
+ *
+ * By default the whole disk is copied.  If the
+ * VIR_DOMAIN_BLOCK_BACKUP_BITMAP parameter names a dirty bitmap, that
+ * bitmap is created together with the full backup and records from then
+ * on which parts of the disk the guest writes to.  A later call with the
+ * same bitmap name and the VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL flag then
+ * copies only those parts, and resets the bitmap once the backup
+ * succeeds, so that a chain of incremental backups can be built without
+ * rereading the unchanged parts of the disk.
+ *
+ * The destination will be created unless the
+ * VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT flag is present stating that the
+ * file was pre-created with the correct format and sufficient size.  For
+ * an incremental backup, a pre-created destination typically is a qcow2
+ * file whose backing file is the previous backup in the chain.
+ *
+ * The @disk parameter is either an unambiguous source name of the
+ * block device (the <source file='...'/> sub-element, such as
+ * "/path/to/image"), or the device target shorthand (the
+ * <target dev='...'/> sub-element, such as "vda").
+ *
+ * Returns 0 if the operation has started, -1 on failure.
+ */
+int
+virDomainBlockBackup(virDomainPtr dom, const char *disk,
+                     const char *destxml,
+                     virTypedParameterPtr params,
+                     int nparams,
+                     unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom,
+                     "disk=%s, destxml=%s, params=%p, nparams=%d, flags=0x%x",
+                     disk, destxml, params, nparams, flags);
+    VIR_TYPED_PARAMS_DEBUG(params, nparams);
+
+    virResetLastError();
+
+    virCheckDomainReturn(dom, -1);
+    conn = dom->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+    virCheckNonNullArgGoto(disk, error);
+    virCheckNonNullArgGoto(destxml, error);
+    virCheckNonNegativeArgGoto(nparams, error);
+    if (nparams)
+        virCheckNonNullArgGoto(params, error);
+
+    if (conn->driver->domainBlockBackup) {
+        int ret;
+        ret = conn->driver->domainBlockBackup(dom, disk, destxml,
+                                              params, nparams, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(dom->conn);
+    return -1;
+}
+
+
 /**
  * virDomainBlockCommit:
  * @dom: pointer to domain object
@@ -11269,6 +11553,12 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "state.state" - state of the VM, returned as int from virDomainState enum
  *     "state.reason" - reason for entering given state, returned as int from
  *                      virDomain*Reason enum corresponding to given state.
+ *     "state.job.queued" - number of jobs waiting to be started on the domain
+ *                          as unsigned int.
+ *     "state.job.wait.count" - number of jobs which had to wait before they
+ *                              could start as unsigned long long.
+ *     "state.job.wait.time" - total time those jobs spent waiting in
+ *                             milliseconds as unsigned long long.
  *
  * VIR_DOMAIN_STATS_CPU_TOTAL:
  *     Return CPU statistics and usage information. The typed parameter keys
@@ -11377,6 +11667,11 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "perf.mbml" - the amount of data (bytes/s) sent through the memory
  *                   controller on the socket as unsigned long long. It is
  *                   produced by mbml perf event.
+ *     "perf.vcpu.<num>.cmt", "perf.vcpu.<num>.mbmt",
+ *     "perf.vcpu.<num>.mbml" - the same values accounted to vCPU <num> only.
+ *                              Only reported when the host monitors the cmt,
+ *                              mbmt and mbml events through resctrl rather
+ *                              than perf.
  *     "perf.cache_misses" - the count of cache misses as unsigned long long.
  *                           It is produced by cache_misses perf event.
  *     "perf.cache_references" - the count of cache hits as unsigned long long.
@@ -11432,6 +11727,81 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "perf.emulation_faults" - The count of emulation faults as unsigned
  *                               long long. It is produced by the
  *                               emulation_faults perf event
+ *     "perf.vcpu.<num>.<event>" - the count of any of the events above other
+ *                                 than cmt, mbmt and mbml, accounted to the
+ *                                 thread of vCPU <num> only, as unsigned
+ *                                 long long.
+ *
+ * VIR_DOMAIN_STATS_START:
+ *     Return how long the last startup of a running domain took, broken
+ *     down into its phases. All values are in microseconds as unsigned
+ *     long long. The typed parameter keys are in this format:
+ *
+ *     "start.init" - initial checks and capabilities lookup.
+ *     "start.prepare" - preparing the domain definition and the host.
+ *     "start.command" - building the command line and setting up
+ *                       everything needed to spawn the process.
+ *     "start.exec" - spawning the process until it is ready to exec.
+ *     "start.cgroup" - cgroup placement and emulator tuning.
+ *     "start.label" - security labelling of the domain's resources.
+ *     "start.monitor" - waiting for and connecting to the monitor.
+ *     "start.qmp" - querying and configuring the hypervisor through the
+ *                   monitor before the guest runs.
+ *     "start.resume" - the final state refresh and starting the vCPUs.
+ *     "start.total" - sum of all the phases above.
+ *
+ * VIR_DOMAIN_STATS_GUEST:
+ *     Return information the guest agent reports about the running guest.
+ *     The agents of all requested domains are queried concurrently and an
+ *     agent that is missing or does not answer within a few seconds just
+ *     leaves this group out for its domain. Groups the agent does not
+ *     support are left out as well. The typed parameter keys are in this
+ *     format:
+ *
+ *     "guest.if.count" - number of network interfaces as unsigned int.
+ *     "guest.if.<num>.name" - name of the interface as string.
+ *     "guest.if.<num>.hwaddr" - hardware address of the interface as string.
+ *     "guest.if.<num>.addr.count" - number of addresses of the interface as
+ *                                   unsigned int.
+ *     "guest.if.<num>.addr.<num>.type" - "ipv4" or "ipv6" as string.
+ *     "guest.if.<num>.addr.<num>.addr" - the address as string.
+ *     "guest.if.<num>.addr.<num>.prefix" - prefix length as unsigned int.
+ *     "guest.fs.count" - number of mounted filesystems as unsigned int.
+ *     "guest.fs.<num>.mountpoint" - path of the mount point as string.
+ *     "guest.fs.<num>.name" - device name in the guest as string.
+ *     "guest.fs.<num>.fstype" - filesystem type as string.
+ *     "guest.fs.<num>.disk.count" - number of disks backing the filesystem
+ *                                   as unsigned int.
+ *     "guest.fs.<num>.disk.<num>.alias" - target of the disk in the domain
+ *                                         definition as string.
+ *     "guest.user.count" - number of logged in users as unsigned int.
+ *     "guest.user.<num>.name" - name of the user as string.
+ *     "guest.user.<num>.domain" - domain of the user as string.
+ *     "guest.user.<num>.login-time" - login time in milliseconds since the
+ *                                     epoch as unsigned long long.
+ *
+ *     Since querying every guest is costly, this group is not part of the
+ *     groups returned when @stats is 0 and has to be asked for explicitly.
+ *
+ * VIR_DOMAIN_STATS_DIRTYRATE:
+ *     Return the result of the most recent memory dirty rate calculation
+ *     started by virDomainStartDirtyRateCalc(). Reading it does not start
+ *     a new calculation. The typed parameter keys are in this format:
+ *
+ *     "dirtyrate.calc_status" - the status of the calculation, returned as
+ *                               int from virDomainDirtyRateStatus enum.
+ *     "dirtyrate.calc_start_time" - the start time of the calculation in
+ *                                   seconds since the epoch as long long.
+ *     "dirtyrate.calc_period" - the period of the calculation in seconds
+ *                               as int.
+ *     "dirtyrate.megabytes_per_second" - the rate at which the guest
+ *                                        dirtied its memory, in MiB/s, as
+ *                                        long long. Only present once the
+ *                                        calculation is measured.
+ *     "dirtyrate.working_set" - estimated amount of distinct guest memory
+ *                               written during the calculation period, in
+ *                               KiB, as unsigned long long. Only present
+ *                               once the calculation is measured.
  *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
@@ -11439,7 +11809,7 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * was not successful.
  *
  * Using 0 for @stats returns all stats groups supported by the given
- * hypervisor.
+ * hypervisor, except those documented as having to be asked for explicitly.
  *
  * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
  * the function return error in case some of the stat types in @stats were
@@ -11501,6 +11871,183 @@ virConnectGetAllDomainStats(virConnectPtr conn,
 }
 
 
+/**
+ * virConnectDomainStatsRegister:
+ * @conn: pointer to the hypervisor connection
+ * @stats: stats to return, binary-OR of virDomainStatsTypes
+ * @interval: period of the updates in seconds
+ * @cb: callback to the function handling the statistics
+ * @opaque: opaque data to pass on to the callback
+ * @freecb: optional function to deallocate opaque when not used anymore
+ * @flags: extra flags; binary-OR of virConnectGetAllDomainStatsFlags
+ *
+ * Subscribes to statistics of all domains on the connection. Every
+ * @interval seconds @cb is invoked with the same records
+ * virConnectGetAllDomainStats() would return for @stats and @flags.
+ * This saves clients which keep polling the statistics from issuing the
+ * call over and over; in addition, remote connections only transfer the
+ * values which changed since the previous update, which greatly reduces
+ * the amount of data sent for large numbers of domains.
+ *
+ * The records passed to @cb always contain the full set of statistics,
+ * i.e. applications don't have to track the changes themselves.
+ *
+ * Domains are filtered according to @flags on each update, so domains
+ * which start matching the filter later are reported as well.
+ *
+ * For remote connections the callback is invoked from the event loop,
+ * which must be running, see virEventRegisterDefaultImpl(). Local drivers
+ * invoke it from a worker thread, in which case the callback must not
+ * deregister itself.
+ *
+ * The reference can be released once the object is no longer required
+ * by calling virConnectDomainStatsDeregister() with the returned ID.
+ *
+ * Returns a callback identifier on success, -1 on failure.
+ */
+int
+virConnectDomainStatsRegister(virConnectPtr conn,
+                              unsigned int stats,
+                              unsigned int interval,
+                              virConnectDomainStatsCallback cb,
+                              void *opaque,
+                              virFreeCallback freecb,
+                              unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, stats=0x%x, interval=%u, cb=%p, opaque=%p, "
+              "freecb=%p, flags=0x%x",
+              conn, stats, interval, cb, opaque, freecb, flags);
+
+    virResetLastError();
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(cb, error);
+    virCheckPositiveArgGoto(interval, error);
+
+    if (conn->driver && conn->driver->connectDomainStatsRegister) {
+        int ret;
+        ret = conn->driver->connectDomainStatsRegister(conn, stats, interval,
+                                                       cb, opaque, freecb,
+                                                       flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virConnectDomainStatsDeregister:
+ * @conn: pointer to the hypervisor connection
+ * @callbackID: the callback identifier
+ *
+ * Removes a subscription for domain statistics. The @callbackID must be
+ * the identifier that was returned by virConnectDomainStatsRegister().
+ * No new invocation of the callback is started once this call returns.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virConnectDomainStatsDeregister(virConnectPtr conn,
+                                int callbackID)
+{
+    VIR_DEBUG("conn=%p, callbackID=%d", conn, callbackID);
+
+    virResetLastError();
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNegativeArgGoto(callbackID, error);
+
+    if (conn->driver && conn->driver->connectDomainStatsDeregister) {
+        int ret;
+        ret = conn->driver->connectDomainStatsDeregister(conn, callbackID);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virDomainGetStatsHistory:
+ * @dom: pointer to the domain object
+ * @start: oldest time of the samples to return
+ * @end: newest time of the samples to return, or 0 for the latest sample
+ * @samples: Pointer that will be filled with the array of samples
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Query the statistics the hypervisor sampled periodically for the
+ * running domain @dom. Times are in milliseconds since the epoch.
+ * Sampling must be enabled in the driver's configuration (see
+ * stats_history_interval in qemu.conf) and only a limited number of the
+ * most recent samples is kept. The history starts anew each time the
+ * domain is started.
+ *
+ * Each returned record is one sample, oldest first. The first typed
+ * parameter of each record is "timestamp" as VIR_TYPED_PARAM_ULLONG,
+ * the rest are the statistics sampled at that time named as described
+ * by virConnectGetAllDomainStats(). At the moment the
+ * VIR_DOMAIN_STATS_CPU_TOTAL, VIR_DOMAIN_STATS_INTERFACE and
+ * VIR_DOMAIN_STATS_BLOCK groups are sampled.
+ *
+ * Note that the returned array should be freed by the caller with
+ * virDomainStatsRecordListFree.
+ *
+ * Returns the count of returned samples, or -1 on error.
+ */
+int
+virDomainGetStatsHistory(virDomainPtr dom,
+                         unsigned long long start,
+                         unsigned long long end,
+                         virDomainStatsRecordPtr **samples,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom, "start=%llu, end=%llu, samples=%p, flags=%x",
+                     start, end, samples, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(dom, -1);
+    conn = dom->conn;
+
+    virCheckNonNullArgGoto(samples, error);
+    *samples = NULL;
+
+    if (end && end < start) {
+        virReportInvalidArg(end,
+                            _("end time must not be before start time "
+                              "in %s"), __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->driver->domainGetStatsHistory) {
+        int ret;
+        ret = conn->driver->domainGetStatsHistory(dom, start, end,
+                                                  samples, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virDomainListGetStats:
  * @doms: NULL terminated array of domains
@@ -11523,7 +12070,7 @@ virConnectGetAllDomainStats(virConnectPtr conn,
  * in virConnectGetAllDomainStats.
  *
  * Using 0 for @stats returns all stats groups supported by the given
- * hypervisor.
+ * hypervisor, except those documented as having to be asked for explicitly.
  *
  * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
  * the function return error in case some of the stat types in @stats were
@@ -12095,3 +12642,53 @@ int virDomainSetLifecycleAction(virDomainPtr domain,
     virDispatchError(domain->conn);
     return -1;
 }
+
+
+/**
+ * virDomainStartDirtyRateCalc:
+ * @domain: a domain object
+ * @seconds: specified calculating time in seconds
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Calculate the current domain's memory dirty rate in next @seconds.
+ * The calculation result can be obtained by calling
+ * virConnectGetAllDomainStats() or virDomainListGetStats() with the
+ * VIR_DOMAIN_STATS_DIRTYRATE group.
+ *
+ * The rate is estimated by sampling guest pages at the start and the end
+ * of the period, so the guest keeps running at full speed. Together with
+ * the working set reported alongside it, it tells how fast a live
+ * migration of @domain would have to copy memory to converge.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virDomainStartDirtyRateCalc(virDomainPtr domain,
+                            int seconds,
+                            unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "seconds=%d, flags=0x%x", seconds, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->driver->domainStartDirtyRateCalc) {
+        int ret;
+        ret = conn->driver->domainStartDirtyRateCalc(domain, seconds, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
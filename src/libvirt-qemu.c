@@ -182,6 +182,12 @@ virDomainQemuAttach(virConnectPtr conn,
  * VIR_DOMAIN_QEMU_AGENT_COMMAND_NOWAIT(0): does not wait.
  * positive value: wait for @timeout seconds
  *
+ * If @cmd is a JSON array of commands, they are all sent to the agent
+ * at once and the result is the array of their replies, in the same
+ * order. A command failing in the guest then only shows up as an
+ * error object in its reply. None of the commands may be one the
+ * agent doesn't reply to, such as guest-shutdown.
+ *
  * Returns strings if success, NULL in failure.
  */
 char *
@@ -842,12 +842,20 @@ virStoragePoolRef(virStoragePoolPtr pool)
 /**
  * virStoragePoolRefresh:
  * @pool: pointer to storage pool
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStoragePoolRefreshFlags
  *
  * Request that the pool refresh its list of volumes. This may
  * involve communicating with a remote server, and/or initializing
  * new devices at the OS layer
  *
+ * If @flags contains VIR_STORAGE_POOL_REFRESH_INCREMENTAL, pools
+ * backed by a local directory (dir, fs, netfs and vstorage) keep the
+ * details of every volume whose file has the same inode, size and
+ * modification and change times as at the previous refresh instead of
+ * opening and probing it again. Information derived from other files,
+ * such as the details of a backing image, may then be stale. Other pool
+ * types treat the flag as a full refresh.
+ *
  * Returns 0 if the volume list was refreshed, -1 on failure
  */
 int
@@ -1496,6 +1504,13 @@ virStorageVolCreateXML(virStoragePoolPtr pool,
  * qcow2 image files which don't support full preallocation,
  * by creating a sparse image file with metadata.
  *
+ * If VIR_STORAGE_VOL_CREATE_ASYNC is included in @flags, the call
+ * returns as soon as the new volume is defined and the data is copied
+ * by a background job.  The progress can be queried with
+ * virStorageVolGetJobInfo() and completion is signalled by a
+ * VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB event.  If the copy fails, the
+ * volume is deleted again.
+ *
  * virStorageVolFree should be used to free the resources after the
  * storage volume object is no longer needed.
  *
@@ -1554,6 +1569,11 @@ virStorageVolCreateXMLFrom(virStoragePoolPtr pool,
  * VIR_STREAM_RECV_STOP_AT_HOLE) for honouring holes sent by
  * server.
  *
+ * If VIR_STORAGE_VOL_DOWNLOAD_NOCACHE is set in @flags the server
+ * asks the kernel to drop the volume data it read from the host page
+ * cache, so that downloading a large volume does not evict data used
+ * by other guests.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -1625,6 +1645,11 @@ virStorageVolDownload(virStorageVolPtr vol,
  * the @stream with combination of virStreamSparseSendAll() or
  * virStreamSendHole() to preserve source file sparseness.
  *
+ * If VIR_STORAGE_VOL_UPLOAD_NOCACHE is set in @flags the server
+ * periodically syncs the uploaded data to disk and drops it from the
+ * host page cache, so that uploading a large volume does not evict
+ * data used by other guests.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -1728,7 +1753,7 @@ virStorageVolDelete(virStorageVolPtr vol,
 /**
  * virStorageVolWipe:
  * @vol: pointer to storage volume
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Ensure data previously on a volume is not accessible to future reads.
  *
@@ -1742,6 +1767,8 @@ virStorageVolDelete(virStorageVolPtr vol,
  * stored journaled, log structured, copy-on-write, versioned, and
  * network file systems are known to be problematic.
  *
+ * See virStorageVolWipePattern() for VIR_STORAGE_VOL_WIPE_ASYNC.
+ *
  * Returns 0 on success, or -1 on error
  */
 int
@@ -1778,7 +1805,7 @@ virStorageVolWipe(virStorageVolPtr vol,
  * virStorageVolWipePattern:
  * @vol: pointer to storage volume
  * @algorithm: one of virStorageVolWipeAlgorithm
- * @flags: future flags, use 0 for now
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Similar to virStorageVolWipe, but one can choose between
  * different wiping algorithms. Also note, that depending on the
@@ -1788,6 +1815,12 @@ virStorageVolWipe(virStorageVolPtr vol,
  * versioned, and network file systems are known to be
  * problematic.
  *
+ * If VIR_STORAGE_VOL_WIPE_ASYNC is included in @flags, the call
+ * returns once the wipe has been started by a background job. The
+ * progress can be queried with virStorageVolGetJobInfo() and
+ * completion is signalled by a VIR_STORAGE_POOL_EVENT_ID_VOLUME_JOB
+ * event.
+ *
  * Returns 0 on success, or -1 on error.
  */
 int
@@ -1969,6 +2002,54 @@ virStorageVolGetInfoFlags(virStorageVolPtr vol,
 }
 
 
+/**
+ * virStorageVolGetJobInfo:
+ * @vol: pointer to storage volume
+ * @info: pointer at which to store the job information
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Fetches the progress of the background job currently running on
+ * the volume, as started by virStorageVolCreateXMLFrom() with
+ * VIR_STORAGE_VOL_CREATE_ASYNC or virStorageVolWipePattern() with
+ * VIR_STORAGE_VOL_WIPE_ASYNC.  If no job is running, the type in
+ * @info is VIR_STORAGE_VOL_JOB_NONE.
+ *
+ * Returns 0 on success, or -1 on failure.
+ */
+int
+virStorageVolGetJobInfo(virStorageVolPtr vol,
+                        virStorageVolJobInfoPtr info,
+                        unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, info=%p, flags=0x%x", vol, info, flags);
+
+    virResetLastError();
+
+    if (info)
+        memset(info, 0, sizeof(*info));
+
+    virCheckStorageVolReturn(vol, -1);
+    virCheckNonNullArgGoto(info, error);
+
+    conn = vol->conn;
+
+    if (conn->storageDriver->storageVolGetJobInfo) {
+        int ret;
+        ret = conn->storageDriver->storageVolGetJobInfo(vol, info, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
 /**
  * virStorageVolGetXMLDesc:
  * @vol: pointer to storage volume
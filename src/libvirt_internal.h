@@ -123,6 +123,21 @@ enum {
      * Support for driver close callback rpc
      */
     VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK = 15,
+
+    /*
+     * Support for bulk stats with interned field names on the wire
+     */
+    VIR_DRV_FEATURE_REMOTE_COMPACT_STATS = 16,
+
+    /*
+     * Support for delivering several events in one message
+     */
+    VIR_DRV_FEATURE_REMOTE_EVENT_BATCH = 17,
+
+    /*
+     * Support for passing large replies in shared memory on local sockets
+     */
+    VIR_DRV_FEATURE_REMOTE_SHARED_REPLIES = 18,
 };
 
 
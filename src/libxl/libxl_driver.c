@@ -2893,6 +2893,7 @@ libxlDomainUndefineFlags(virDomainPtr dom,
 
     if (virDomainObjIsActive(vm)) {
         vm->persistent = 0;
+        virDomainObjBumpGeneration(vm);
     } else {
         virDomainObjListRemove(driver->domains, vm);
         vm = NULL;
@@ -4458,6 +4459,7 @@ libxlDomainSetAutostart(virDomainPtr dom, int autostart)
         }
 
         vm->autostart = autostart;
+        virDomainObjBumpGeneration(vm);
     }
     ret = 0;
 
@@ -5678,6 +5680,25 @@ libxlConnectListAllDomains(virConnectPtr conn,
     return ret;
 }
 
+static int
+libxlConnectListDomainChanges(virConnectPtr conn,
+                              unsigned long long *cursor,
+                              virDomainPtr **changed,
+                              virDomainPtr **removed,
+                              unsigned int flags)
+{
+    libxlDriverPrivatePtr driver = conn->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virConnectListDomainChangesEnsureACL(conn) < 0)
+        return -1;
+
+    return virDomainObjListExportChanges(driver->domains, conn, cursor,
+                                         changed, removed,
+                                         virConnectListDomainChangesCheckACL);
+}
+
 /* Which features are supported by this driver? */
 static int
 libxlConnectSupportsFeature(virConnectPtr conn, int feature)
@@ -5877,6 +5898,7 @@ libxlDomainMigrateBegin3Params(virDomainPtr domain,
 {
     const char *xmlin = NULL;
     virDomainObjPtr vm = NULL;
+    unsigned int nconnections;
 
 #ifdef LIBXL_HAVE_NO_SUSPEND_RESUME
     virReportUnsupportedError();
@@ -5887,6 +5909,9 @@ libxlDomainMigrateBegin3Params(virDomainPtr domain,
     if (virTypedParamsValidate(params, nparams, LIBXL_MIGRATION_PARAMETERS) < 0)
         return NULL;
 
+    if (libxlMigrationGetConnections(params, nparams, flags, &nconnections) < 0)
+        return NULL;
+
     if (virTypedParamsGetString(params, nparams,
                                 VIR_MIGRATE_PARAM_DEST_XML,
                                 &xmlin) < 0)
@@ -5913,7 +5938,7 @@ libxlDomainMigrateBegin3Params(virDomainPtr domain,
         return NULL;
     }
 
-    return libxlDomainMigrationBegin(domain->conn, vm, xmlin,
+    return libxlDomainMigrationBegin(domain->conn, vm, xmlin, nconnections,
                                      cookieout, cookieoutlen);
 }
 
@@ -6043,6 +6068,7 @@ libxlDomainMigratePerform3Params(virDomainPtr dom,
     const char *dom_xml = NULL;
     const char *dname = NULL;
     const char *uri = NULL;
+    unsigned int nconnections;
     int ret = -1;
 
 #ifdef LIBXL_HAVE_NO_SUSPEND_RESUME
@@ -6054,6 +6080,9 @@ libxlDomainMigratePerform3Params(virDomainPtr dom,
     if (virTypedParamsValidate(params, nparams, LIBXL_MIGRATION_PARAMETERS) < 0)
         goto cleanup;
 
+    if (libxlMigrationGetConnections(params, nparams, flags, &nconnections) < 0)
+        goto cleanup;
+
     if (virTypedParamsGetString(params, nparams,
                                 VIR_MIGRATE_PARAM_DEST_XML,
                                 &dom_xml) < 0 ||
@@ -6074,11 +6103,12 @@ libxlDomainMigratePerform3Params(virDomainPtr dom,
 
     if ((flags & (VIR_MIGRATE_TUNNELLED | VIR_MIGRATE_PEER2PEER))) {
         if (libxlDomainMigrationPerformP2P(driver, vm, dom->conn, dom_xml,
-                                           dconnuri, uri, dname, flags) < 0)
+                                           dconnuri, uri, dname,
+                                           nconnections, flags) < 0)
             goto cleanup;
     } else {
         if (libxlDomainMigrationPerform(driver, vm, dom_xml, dconnuri,
-                                        uri, dname, flags) < 0)
+                                        uri, dname, nconnections, flags) < 0)
             goto cleanup;
     }
 
@@ -6582,6 +6612,7 @@ static virHypervisorDriver libxlHypervisorDriver = {
     .connectGetDomainCapabilities = libxlConnectGetDomainCapabilities, /* 2.0.0 */
     .connectCompareCPU = libxlConnectCompareCPU, /* 2.3.0 */
     .connectBaselineCPU = libxlConnectBaselineCPU, /* 2.3.0 */
+    .connectListDomainChanges = libxlConnectListDomainChanges, /* 4.0.0 */
 };
 
 static virConnectDriver libxlConnectDriver = {
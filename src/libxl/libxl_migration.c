@@ -24,6 +24,8 @@
 
 #include <config.h>
 
+#include <arpa/inet.h>
+
 #include "internal.h"
 #include "virlog.h"
 #include "virerror.h"
@@ -60,6 +62,10 @@ struct _libxlMigrationCookie {
     /* Guest properties */
     unsigned char uuid[VIR_UUID_BUFLEN];
     char *name;
+
+    /* Number of connections the migration data is spread over,
+     * 0 if it is sent as plain stream on a single connection */
+    unsigned int nconnections;
 };
 
 typedef struct _libxlMigrationDstArgs {
@@ -74,6 +80,10 @@ typedef struct _libxlMigrationDstArgs {
     /* for freeing listen sockets */
     virNetSocketPtr *socks;
     size_t nsocks;
+
+    /* connections accepted so far for parallel migration */
+    int *recvfds;
+    size_t nrecvfds;
 } libxlMigrationDstArgs;
 
 static virClassPtr libxlMigrationDstArgsClass;
@@ -91,7 +101,8 @@ libxlMigrationCookieFree(libxlMigrationCookiePtr mig)
 }
 
 static libxlMigrationCookiePtr
-libxlMigrationCookieNew(virDomainObjPtr dom)
+libxlMigrationCookieNew(virDomainObjPtr dom,
+                        unsigned int nconnections)
 {
     libxlMigrationCookiePtr mig = NULL;
 
@@ -107,6 +118,7 @@ libxlMigrationCookieNew(virDomainObjPtr dom)
         goto error;
 
     mig->xenMigStreamVer = LIBXL_SAVE_VERSION;
+    mig->nconnections = nconnections;
 
     return mig;
 
@@ -136,6 +148,9 @@ libxlMigrationBakeCookie(libxlMigrationCookiePtr mig,
     virBufferAsprintf(&buf, "<uuid>%s</uuid>\n", uuidstr);
     virBufferEscapeString(&buf, "<hostname>%s</hostname>\n", mig->srcHostname);
     virBufferAsprintf(&buf, "<migration-stream-version>%u</migration-stream-version>\n", mig->xenMigStreamVer);
+    if (mig->nconnections)
+        virBufferAsprintf(&buf, "<parallel connections='%u'/>\n",
+                          mig->nconnections);
     virBufferAdjustIndent(&buf, -2);
     virBufferAddLit(&buf, "</libxl-migration>\n");
 
@@ -218,6 +233,16 @@ libxlMigrationEatCookie(const char *cookiein,
         goto error;
     }
 
+    if (virXPathBoolean("boolean(./parallel)", ctxt) &&
+        (virXPathUInt("string(./parallel/@connections)",
+                      ctxt, &mig->nconnections) < 0 ||
+         mig->nconnections == 0 ||
+         mig->nconnections > LIBXL_MIGRATION_MAX_CONNECTIONS)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("invalid number of parallel migration connections"));
+        goto error;
+    }
+
     *migout = mig;
     ret = 0;
     goto cleanup;
@@ -236,9 +261,13 @@ static void
 libxlMigrationDstArgsDispose(void *obj)
 {
     libxlMigrationDstArgs *args = obj;
+    size_t i;
 
     libxlMigrationCookieFree(args->migcookie);
     VIR_FREE(args->socks);
+    for (i = 0; i < args->nrecvfds; i++)
+        VIR_FORCE_CLOSE(args->recvfds[i]);
+    VIR_FREE(args->recvfds);
 }
 
 static int
@@ -255,6 +284,218 @@ libxlMigrationDstArgsOnceInit(void)
 
 VIR_ONCE_GLOBAL_INIT(libxlMigrationDstArgs)
 
+
+/*
+ * Parallel migration spreads the stream written by libxl over several
+ * TCP connections, so that a single connection's window and the CPU
+ * handling it do not limit the transfer.  Each connection starts with
+ * its index as a 32-bit big-endian number.  The stream is then cut
+ * into chunks which are sent round-robin over the connections, each
+ * preceded by its length as a 32-bit big-endian number.  A chunk of
+ * zero length marks the end of the stream.
+ */
+#define LIBXL_MIGRATION_CHUNK_SIZE (1024 * 1024)
+
+typedef struct _libxlMigrationParallelData libxlMigrationParallelData;
+struct _libxlMigrationParallelData {
+    int pipefd; /* libxl side of the stream */
+    int *fds;   /* connections, in the order of their index */
+    size_t nfds;
+    int err;    /* errno of the first failure */
+};
+
+
+static int
+libxlMigrationParallelWriteHeader(int fd,
+                                  uint32_t val)
+{
+    uint32_t header = htonl(val);
+
+    if (safewrite(fd, &header, sizeof(header)) != sizeof(header))
+        return -1;
+    return 0;
+}
+
+
+static int
+libxlMigrationParallelReadHeader(int fd,
+                                 uint32_t *val)
+{
+    uint32_t header;
+    ssize_t got;
+
+    if ((got = saferead(fd, &header, sizeof(header))) != sizeof(header)) {
+        if (got >= 0)
+            errno = EIO;
+        return -1;
+    }
+    *val = ntohl(header);
+    return 0;
+}
+
+
+/* Source side: cuts the data libxl writes to the pipe into chunks */
+static void
+libxlMigrationParallelSendFunc(void *opaque)
+{
+    libxlMigrationParallelData *data = opaque;
+    char *buf = NULL;
+    size_t i;
+
+    if (VIR_ALLOC_N_QUIET(buf, LIBXL_MIGRATION_CHUNK_SIZE) < 0) {
+        data->err = ENOMEM;
+        goto cleanup;
+    }
+
+    for (i = 0; ; i++) {
+        int fd = data->fds[i % data->nfds];
+        ssize_t got;
+
+        if ((got = saferead(data->pipefd, buf, LIBXL_MIGRATION_CHUNK_SIZE)) < 0 ||
+            libxlMigrationParallelWriteHeader(fd, got) < 0 ||
+            (got > 0 && safewrite(fd, buf, got) != got)) {
+            data->err = errno;
+            goto cleanup;
+        }
+
+        if (got == 0)
+            break;
+    }
+
+ cleanup:
+    /* Make libxl fail rather than block if we gave up early */
+    VIR_FORCE_CLOSE(data->pipefd);
+    VIR_FREE(buf);
+}
+
+
+/* Destination side: reassembles the chunks into the pipe libxl reads */
+static void
+libxlMigrationParallelRecvFunc(void *opaque)
+{
+    libxlMigrationParallelData *data = opaque;
+    char *buf = NULL;
+    size_t i;
+
+    if (VIR_ALLOC_N_QUIET(buf, LIBXL_MIGRATION_CHUNK_SIZE) < 0) {
+        data->err = ENOMEM;
+        goto cleanup;
+    }
+
+    for (i = 0; ; i++) {
+        int fd = data->fds[i % data->nfds];
+        uint32_t len;
+
+        if (libxlMigrationParallelReadHeader(fd, &len) < 0) {
+            data->err = errno;
+            goto cleanup;
+        }
+
+        if (len == 0)
+            break;
+
+        if (len > LIBXL_MIGRATION_CHUNK_SIZE) {
+            data->err = EINVAL;
+            goto cleanup;
+        }
+
+        if (saferead(fd, buf, len) != (ssize_t) len) {
+            data->err = errno ? errno : EIO;
+            goto cleanup;
+        }
+
+        if (safewrite(data->pipefd, buf, len) != (ssize_t) len) {
+            data->err = errno;
+            goto cleanup;
+        }
+    }
+
+ cleanup:
+    /* libxl sees the end of the stream, or a truncated one on error */
+    VIR_FORCE_CLOSE(data->pipefd);
+    VIR_FREE(buf);
+}
+
+
+/**
+ * libxlMigrationParallelStart:
+ * @data: connections to use
+ * @send: whether this is the source side
+ * @thread: thread to initialize
+ * @fd: filled with the descriptor to hand to libxl
+ *
+ * Creates a pipe for libxl and starts a thread relaying the data
+ * between the pipe and the connections in @data.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+libxlMigrationParallelStart(libxlMigrationParallelData *data,
+                            bool send,
+                            virThreadPtr thread,
+                            int *fd)
+{
+    int pipefd[2] = { -1, -1 };
+
+    if (pipe(pipefd) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to make pipes"));
+        return -1;
+    }
+
+    data->pipefd = send ? pipefd[0] : pipefd[1];
+    data->err = 0;
+
+    if (virThreadCreate(thread, true,
+                        send ? libxlMigrationParallelSendFunc :
+                               libxlMigrationParallelRecvFunc,
+                        data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create parallel migration thread"));
+        VIR_FORCE_CLOSE(pipefd[0]);
+        VIR_FORCE_CLOSE(pipefd[1]);
+        return -1;
+    }
+
+    *fd = send ? pipefd[1] : pipefd[0];
+    return 0;
+}
+
+
+/*
+ * Puts the connections accepted by the destination in the order of
+ * the indexes the source sent on them.
+ */
+static int
+libxlMigrationParallelSortConnections(int *recvfds,
+                                      size_t nrecvfds,
+                                      int *fds)
+{
+    size_t i;
+
+    for (i = 0; i < nrecvfds; i++)
+        fds[i] = -1;
+
+    for (i = 0; i < nrecvfds; i++) {
+        uint32_t idx;
+
+        if (libxlMigrationParallelReadHeader(recvfds[i], &idx) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Failed to read migration connection index"));
+            return -1;
+        }
+
+        if (idx >= nrecvfds || fds[idx] != -1) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("Unexpected migration connection index %u"), idx);
+            return -1;
+        }
+
+        fds[idx] = recvfds[i];
+    }
+
+    return 0;
+}
+
 static void
 libxlDoMigrateReceive(void *opaque)
 {
@@ -264,8 +505,11 @@ libxlDoMigrateReceive(void *opaque)
     size_t nsocks = args->nsocks;
     libxlDriverPrivatePtr driver = args->conn->privateData;
     int recvfd = args->recvfd;
+    libxlMigrationParallelData parallel = { .pipefd = -1 };
+    virThread parallelThread;
+    bool parallelRunning = false;
     size_t i;
-    int ret;
+    int ret = -1;
     bool remove_dom = 0;
 
     virObjectRef(vm);
@@ -273,6 +517,20 @@ libxlDoMigrateReceive(void *opaque)
     if (libxlDomainObjBeginJob(driver, vm, LIBXL_JOB_MODIFY) < 0)
         goto cleanup;
 
+    if (args->nrecvfds) {
+        if (VIR_ALLOC_N(parallel.fds, args->nrecvfds) < 0)
+            goto restored;
+        parallel.nfds = args->nrecvfds;
+
+        if (libxlMigrationParallelSortConnections(args->recvfds,
+                                                  args->nrecvfds,
+                                                  parallel.fds) < 0 ||
+            libxlMigrationParallelStart(&parallel, false,
+                                        &parallelThread, &recvfd) < 0)
+            goto restored;
+        parallelRunning = true;
+    }
+
     /*
      * Always start the domain paused.  If needed, unpause in the
      * finish phase, after transfer of the domain is complete.
@@ -280,6 +538,19 @@ libxlDoMigrateReceive(void *opaque)
     ret = libxlDomainStartRestore(driver, vm, true, recvfd,
                                   args->migcookie->xenMigStreamVer);
 
+ restored:
+    if (parallelRunning) {
+        /* Unblock the relay thread in case libxl gave up early */
+        VIR_FORCE_CLOSE(recvfd);
+        virThreadJoin(&parallelThread);
+        if (parallel.err && ret == 0) {
+            virReportSystemError(parallel.err, "%s",
+                                 _("Failed to receive migration data"));
+            ret = -1;
+        }
+    }
+    VIR_FREE(parallel.fds);
+
     if (ret < 0 && !vm->persistent)
         remove_dom = true;
 
@@ -324,11 +595,27 @@ libxlMigrateReceive(virNetSocketPtr sock,
                        _("Failed to accept migration connection"));
         goto fail;
     }
-    VIR_DEBUG("Accepted migration connection."
-              "  Spawning thread to process migration data");
     recvfd = virNetSocketDupFD(client_sock, true);
     virObjectUnref(client_sock);
 
+    if (args->migcookie->nconnections) {
+        if (VIR_APPEND_ELEMENT_COPY(args->recvfds, args->nrecvfds, recvfd) < 0)
+            goto fail;
+        recvfd = -1;
+
+        VIR_DEBUG("Accepted migration connection %zu of %u",
+                  args->nrecvfds, args->migcookie->nconnections);
+        if (args->nrecvfds < args->migcookie->nconnections)
+            return;
+
+        /* Don't accept any more connections */
+        for (i = 0; i < nsocks; i++)
+            virNetSocketUpdateIOCallback(socks[i], 0);
+    }
+
+    VIR_DEBUG("Accepted migration connection."
+              "  Spawning thread to process migration data");
+
     /*
      * Avoid blocking the event loop.  Start a thread to receive
      * the migration data
@@ -398,6 +685,7 @@ char *
 libxlDomainMigrationBegin(virConnectPtr conn,
                           virDomainObjPtr vm,
                           const char *xmlin,
+                          unsigned int nconnections,
                           char **cookieout,
                           int *cookieoutlen)
 {
@@ -411,7 +699,7 @@ libxlDomainMigrationBegin(virConnectPtr conn,
     if (libxlDomainObjBeginJob(driver, vm, LIBXL_JOB_MODIFY) < 0)
         goto cleanup;
 
-    if (!(mig = libxlMigrationCookieNew(vm)))
+    if (!(mig = libxlMigrationCookieNew(vm, nconnections)))
         goto endjob;
 
     if (libxlMigrationBakeCookie(mig, cookieout, cookieoutlen) < 0)
@@ -779,7 +1067,8 @@ libxlDomainMigrationPrepare(virConnectPtr dconn,
         if (virNetSocketSetBlocking(socks[i], true) < 0)
              continue;
 
-        if (virNetSocketListen(socks[i], 1) < 0)
+        if (virNetSocketListen(socks[i],
+                               MAX(1, args->migcookie->nconnections)) < 0)
             continue;
 
         if (virNetSocketAddIOCallback(socks[i],
@@ -976,6 +1265,7 @@ libxlDoMigrateP2P(libxlDriverPrivatePtr driver,
                   const char *dconnuri ATTRIBUTE_UNUSED,
                   const char *dname,
                   const char *uri,
+                  unsigned int nconnections,
                   unsigned int flags)
 {
     virDomainPtr ddomain = NULL;
@@ -994,7 +1284,7 @@ libxlDoMigrateP2P(libxlDriverPrivatePtr driver,
     virStreamPtr st = NULL;
     struct libxlTunnelControl *tc = NULL;
 
-    dom_xml = libxlDomainMigrationBegin(sconn, vm, xmlin,
+    dom_xml = libxlDomainMigrationBegin(sconn, vm, xmlin, nconnections,
                                         &cookieout, &cookieoutlen);
     if (!dom_xml)
         goto cleanup;
@@ -1053,7 +1343,7 @@ libxlDoMigrateP2P(libxlDriverPrivatePtr driver,
         ret = libxlMigrationStartTunnel(driver, vm, flags, st, &tc);
     else
         ret = libxlDomainMigrationPerform(driver, vm, NULL, NULL,
-                                          uri_out, NULL, flags);
+                                          uri_out, NULL, nconnections, flags);
     if (ret < 0)
         orig_err = virSaveLastError();
 
@@ -1138,6 +1428,7 @@ libxlDomainMigrationPerformP2P(libxlDriverPrivatePtr driver,
                                const char *dconnuri,
                                const char *uri_str ATTRIBUTE_UNUSED,
                                const char *dname,
+                               unsigned int nconnections,
                                unsigned int flags)
 {
     int ret = -1;
@@ -1173,7 +1464,7 @@ libxlDomainMigrationPerformP2P(libxlDriverPrivatePtr driver,
     }
 
     ret = libxlDoMigrateP2P(driver, vm, sconn, xmlin, dconn, dconnuri,
-                            dname, uri_str, flags);
+                            dname, uri_str, nconnections, flags);
 
  cleanup:
     orig_err = virSaveLastError();
@@ -1188,6 +1479,29 @@ libxlDomainMigrationPerformP2P(libxlDriverPrivatePtr driver,
     return ret;
 }
 
+/* Opens a connection to the migration destination */
+static int
+libxlMigrationConnect(const char *hostname,
+                      const char *portstr)
+{
+    virNetSocketPtr sock;
+    int sockfd;
+
+    if (virNetSocketNewConnectTCP(hostname, portstr,
+                                  AF_UNSPEC,
+                                  &sock) < 0)
+        return -1;
+
+    if (virNetSocketSetBlocking(sock, true) < 0) {
+        virObjectUnref(sock);
+        return -1;
+    }
+
+    sockfd = virNetSocketDupFD(sock, true);
+    virObjectUnref(sock);
+    return sockfd;
+}
+
 int
 libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
                             virDomainObjPtr vm,
@@ -1195,6 +1509,7 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
                             const char *dconnuri ATTRIBUTE_UNUSED,
                             const char *uri_str,
                             const char *dname ATTRIBUTE_UNUSED,
+                            unsigned int nconnections,
                             unsigned int flags)
 {
     libxlDomainObjPrivatePtr priv = vm->privateData;
@@ -1202,8 +1517,10 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
     unsigned short port = 0;
     char portstr[100];
     virURIPtr uri = NULL;
-    virNetSocketPtr sock;
     int sockfd = -1;
+    libxlMigrationParallelData parallel = { .pipefd = -1 };
+    virThread parallelThread;
+    size_t i;
     int ret = -1;
 
     /* parse dst host:port from uri */
@@ -1216,18 +1533,31 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
     snprintf(portstr, sizeof(portstr), "%d", port);
 
     /* socket connect to dst host:port */
-    if (virNetSocketNewConnectTCP(hostname, portstr,
-                                  AF_UNSPEC,
-                                  &sock) < 0)
-        goto cleanup;
+    if (nconnections) {
+        if (VIR_ALLOC_N(parallel.fds, nconnections) < 0)
+            goto cleanup;
 
-    if (virNetSocketSetBlocking(sock, true) < 0) {
-        virObjectUnref(sock);
+        /* Connect one after another so that none of the connections
+         * overflows the listen queue of the destination */
+        for (i = 0; i < nconnections; i++) {
+            if ((parallel.fds[i] = libxlMigrationConnect(hostname, portstr)) < 0)
+                goto cleanup;
+            parallel.nfds++;
+
+            if (libxlMigrationParallelWriteHeader(parallel.fds[i], i) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Failed to send migration connection index"));
+                goto cleanup;
+            }
+        }
+    } else if ((sockfd = libxlMigrationConnect(hostname, portstr)) < 0) {
         goto cleanup;
     }
 
-    sockfd = virNetSocketDupFD(sock, true);
-    virObjectUnref(sock);
+    if (nconnections &&
+        libxlMigrationParallelStart(&parallel, true,
+                                    &parallelThread, &sockfd) < 0)
+        goto cleanup;
 
     if (virDomainLockProcessPause(driver->lockManager, vm, &priv->lockState) < 0)
         VIR_WARN("Unable to release lease on %s", vm->def->name);
@@ -1236,14 +1566,79 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
     /* suspend vm and send saved data to dst through socket fd */
     virObjectUnlock(vm);
     ret = libxlDoMigrateSend(driver, vm, flags, sockfd);
+
+    if (nconnections) {
+        /* Let the relay thread see the end of the stream */
+        VIR_FORCE_CLOSE(sockfd);
+        virThreadJoin(&parallelThread);
+        if (parallel.err && ret == 0) {
+            virReportSystemError(parallel.err, "%s",
+                                 _("Failed to send migration data to destination host"));
+            ret = -1;
+        }
+    }
     virObjectLock(vm);
 
  cleanup:
     VIR_FORCE_CLOSE(sockfd);
+    for (i = 0; i < parallel.nfds; i++)
+        VIR_FORCE_CLOSE(parallel.fds[i]);
+    VIR_FREE(parallel.fds);
     virURIFree(uri);
     return ret;
 }
 
+
+/**
+ * libxlMigrationGetConnections:
+ * @params: migration parameters
+ * @nparams: number of @params
+ * @flags: migration flags
+ * @nconnections: filled with the number of connections to use
+ *
+ * Works out how many connections a migration with @flags and @params
+ * is to use. 0 means the data is sent over one connection as they
+ * come from libxl.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+libxlMigrationGetConnections(virTypedParameterPtr params,
+                             int nparams,
+                             unsigned int flags,
+                             unsigned int *nconnections)
+{
+    int nconn = LIBXL_MIGRATION_DEFAULT_CONNECTIONS;
+    int rc;
+
+    *nconnections = 0;
+
+    if (!(flags & VIR_MIGRATE_PARALLEL))
+        return 0;
+
+    if (flags & VIR_MIGRATE_TUNNELLED) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration cannot be tunnelled"));
+        return -1;
+    }
+
+    if ((rc = virTypedParamsGetInt(params, nparams,
+                                   VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                   &nconn)) < 0)
+        return -1;
+
+    if (nconn < 1 || nconn > LIBXL_MIGRATION_MAX_CONNECTIONS) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("number of parallel migration connections must be "
+                         "between 1 and %d"),
+                       LIBXL_MIGRATION_MAX_CONNECTIONS);
+        return -1;
+    }
+
+    *nconnections = nconn;
+    return 0;
+}
+
 virDomainPtr
 libxlDomainMigrationFinish(virConnectPtr dconn,
                            virDomainObjPtr vm,
@@ -32,19 +32,32 @@
      VIR_MIGRATE_TUNNELLED | \
      VIR_MIGRATE_PERSIST_DEST | \
      VIR_MIGRATE_UNDEFINE_SOURCE | \
-     VIR_MIGRATE_PAUSED)
+     VIR_MIGRATE_PAUSED | \
+     VIR_MIGRATE_PARALLEL)
 
 /* All supported migration parameters and their types. */
 # define LIBXL_MIGRATION_PARAMETERS \
     VIR_MIGRATE_PARAM_URI,              VIR_TYPED_PARAM_STRING, \
     VIR_MIGRATE_PARAM_DEST_NAME,        VIR_TYPED_PARAM_STRING, \
     VIR_MIGRATE_PARAM_DEST_XML,         VIR_TYPED_PARAM_STRING, \
+    VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS, VIR_TYPED_PARAM_INT, \
     NULL
 
+/* Connections used by parallel migration */
+# define LIBXL_MIGRATION_DEFAULT_CONNECTIONS 2
+# define LIBXL_MIGRATION_MAX_CONNECTIONS 16
+
+int
+libxlMigrationGetConnections(virTypedParameterPtr params,
+                             int nparams,
+                             unsigned int flags,
+                             unsigned int *nconnections);
+
 char *
 libxlDomainMigrationBegin(virConnectPtr conn,
                           virDomainObjPtr vm,
                           const char *xmlin,
+                          unsigned int nconnections,
                           char **cookieout,
                           int *cookieoutlen);
 
@@ -78,6 +91,7 @@ libxlDomainMigrationPerformP2P(libxlDriverPrivatePtr driver,
                                const char *dconnuri,
                                const char *uri_str,
                                const char *dname,
+                               unsigned int nconnections,
                                unsigned int flags);
 
 int
@@ -87,6 +101,7 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
                             const char *dconnuri,
                             const char *uri_str,
                             const char *dname,
+                            unsigned int nconnections,
                             unsigned int flags);
 
 virDomainPtr
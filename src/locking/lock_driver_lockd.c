@@ -612,6 +612,95 @@ static int virLockManagerLockDaemonAddResource(virLockManagerPtr lock,
 }
 
 
+/*
+ * Acquire or release all the resources of @priv in a single call.
+ *
+ * Returns 0 on success, 1 if the daemon predates the batched
+ * procedures and the caller should fall back to one call per
+ * resource, -1 on error
+ */
+static int
+virLockManagerLockDaemonBatchCall(virLockManagerLockDaemonPrivatePtr priv,
+                                  virNetClientPtr client,
+                                  virNetClientProgramPtr program,
+                                  int *counter,
+                                  bool acquire)
+{
+    virLockSpaceProtocolResource *resources = NULL;
+    virErrorPtr err;
+    size_t i;
+    int rv = -1;
+    int rc;
+
+    if (priv->nresources > VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX)
+        return 1;
+
+    if (VIR_ALLOC_N(resources, priv->nresources) < 0)
+        return -1;
+
+    for (i = 0; i < priv->nresources; i++) {
+        resources[i].path = priv->resources[i].lockspace;
+        resources[i].name = priv->resources[i].name;
+        resources[i].flags = priv->resources[i].flags;
+
+        if (!acquire)
+            resources[i].flags &=
+                ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+                  VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
+    }
+
+    if (acquire) {
+        virLockSpaceProtocolAcquireResourcesArgs args;
+
+        memset(&args, 0, sizeof(args));
+        args.resources.resources_len = priv->nresources;
+        args.resources.resources_val = resources;
+
+        rc = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, &args,
+                                     (xdrproc_t)xdr_void, NULL);
+    } else {
+        virLockSpaceProtocolReleaseResourcesArgs args;
+
+        memset(&args, 0, sizeof(args));
+        args.resources.resources_len = priv->nresources;
+        args.resources.resources_val = resources;
+
+        rc = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourcesArgs, &args,
+                                     (xdrproc_t)xdr_void, NULL);
+    }
+
+    if (rc < 0) {
+        /* An older virtlockd rejects the procedure number without
+         * touching any lock, so it is safe to retry one by one */
+        if ((err = virGetLastError()) &&
+            err->domain == VIR_FROM_RPC &&
+            err->code == VIR_ERR_RPC &&
+            virNetClientIsOpen(client)) {
+            VIR_DEBUG("Lock daemon lacks batched resource calls, falling back");
+            virResetLastError();
+            rv = 1;
+        }
+        goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(resources);
+    return rv;
+}
+
+
 static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
                                            const char *state ATTRIBUTE_UNUSED,
                                            unsigned int flags,
@@ -622,6 +711,7 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
     virNetClientProgramPtr program = NULL;
     int counter = 0;
     int rv = -1;
+    int rc;
     virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
 
     virCheckFlags(VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY |
@@ -642,8 +732,15 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources > 0 &&
+        (rc = virLockManagerLockDaemonBatchCall(priv, client, program,
+                                                &counter, true)) != 0) {
         size_t i;
+
+        if (rc < 0)
+            goto cleanup;
+
         for (i = 0; i < priv->nresources; i++) {
             virLockSpaceProtocolAcquireResourceArgs args;
 
@@ -689,6 +786,7 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     virNetClientProgramPtr program = NULL;
     int counter = 0;
     int rv = -1;
+    int rc;
     size_t i;
     virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
 
@@ -700,6 +798,13 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     if (!(client = virLockManagerLockDaemonConnect(lock, &program, &counter)))
         goto cleanup;
 
+    if (priv->nresources > 0 &&
+        (rc = virLockManagerLockDaemonBatchCall(priv, client, program,
+                                                &counter, false)) <= 0) {
+        rv = rc;
+        goto cleanup;
+    }
+
     for (i = 0; i < priv->nresources; i++) {
         virLockSpaceProtocolReleaseResourceArgs args;
 
@@ -44,6 +44,7 @@
 #include "virfile.h"
 #include "virconf.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #include "configmake.h"
 
@@ -54,6 +55,10 @@ VIR_LOG_INIT("locking.lock_driver_sanlock");
 #define VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE "__LIBVIRT__DISKS__"
 #define VIR_LOCK_MANAGER_SANLOCK_KILLPATH LIBEXECDIR "/libvirt_sanlock_helper"
 
+/* Upper bound on the number of threads initializing the automatic
+ * disk leases of a single domain concurrently */
+#define VIR_LOCK_MANAGER_SANLOCK_CREATE_THREADS 8
+
 /*
  * temporary fix for the case where the sanlock devel package is
  * too old to provide that define, and probably the functionality too
@@ -92,6 +97,8 @@ struct _virLockManagerSanlockPrivate {
     bool hasRWDisks;
     int res_count;
     struct sanlk_resource *res_args[SANLK_MAX_RESOURCES];
+    /* automatic disk leases whose lease file may still need creating */
+    bool res_create[SANLK_MAX_RESOURCES];
 
     /* whether the VM was registered or not */
     bool registered;
@@ -780,6 +787,112 @@ virLockManagerSanlockCreateLease(virLockManagerSanlockDriverPtr driver,
 }
 
 
+typedef struct _virLockManagerSanlockCreateData virLockManagerSanlockCreateData;
+typedef virLockManagerSanlockCreateData *virLockManagerSanlockCreateDataPtr;
+
+struct _virLockManagerSanlockCreateData {
+    virMutex lock;
+    virLockManagerSanlockDriverPtr driver;
+    struct sanlk_resource **res;
+    size_t nres;
+    size_t next;
+    virErrorPtr err;
+};
+
+
+static void
+virLockManagerSanlockCreateLeasesWorker(void *opaque)
+{
+    virLockManagerSanlockCreateDataPtr data = opaque;
+
+    virMutexLock(&data->lock);
+    while (data->next < data->nres && !data->err) {
+        struct sanlk_resource *res = data->res[data->next++];
+        int rc;
+
+        virMutexUnlock(&data->lock);
+        rc = virLockManagerSanlockCreateLease(data->driver, res);
+        virMutexLock(&data->lock);
+
+        if (rc < 0 && !data->err)
+            data->err = virSaveLastError();
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Initializing a lease is a synchronous write to the lease volume,
+ * which on shared storage can take a while. Rather than paying
+ * that round trip once per disk, create all the pending leases of
+ * the domain from a small pool of threads.
+ */
+static int
+virLockManagerSanlockCreateLeases(virLockManagerSanlockDriverPtr driver,
+                                  virLockManagerSanlockPrivatePtr priv)
+{
+    virLockManagerSanlockCreateData data;
+    struct sanlk_resource *res[SANLK_MAX_RESOURCES];
+    virThread threads[VIR_LOCK_MANAGER_SANLOCK_CREATE_THREADS];
+    size_t nthreads = 0;
+    size_t i;
+
+    memset(&data, 0, sizeof(data));
+    data.driver = driver;
+    data.res = res;
+
+    for (i = 0; i < priv->res_count; i++) {
+        if (priv->res_create[i])
+            res[data.nres++] = priv->res_args[i];
+    }
+
+    if (data.nres == 0)
+        return 0;
+
+    VIR_DEBUG("Creating %zu leases", data.nres);
+
+    if (data.nres == 1) {
+        if (virLockManagerSanlockCreateLease(driver, res[0]) < 0)
+            return -1;
+        goto done;
+    }
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    for (i = 0; i < MIN(data.nres, VIR_LOCK_MANAGER_SANLOCK_CREATE_THREADS); i++) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            virLockManagerSanlockCreateLeasesWorker,
+                            &data) < 0)
+            break;
+        nthreads++;
+    }
+
+    /* Whatever the threads did not get to is done here */
+    virLockManagerSanlockCreateLeasesWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virMutexDestroy(&data.lock);
+
+    if (data.err) {
+        virSetError(data.err);
+        virFreeError(data.err);
+        return -1;
+    }
+
+ done:
+    for (i = 0; i < priv->res_count; i++)
+        priv->res_create[i] = false;
+
+    return 0;
+}
+
+
 static int virLockManagerSanlockAddResource(virLockManagerPtr lock,
                                             unsigned int type,
                                             const char *name,
@@ -811,9 +924,9 @@ static int virLockManagerSanlockAddResource(virLockManagerPtr lock,
                                              !!(flags & VIR_LOCK_MANAGER_RESOURCE_SHARED)) < 0)
                 return -1;
 
-            if (virLockManagerSanlockCreateLease(driver,
-                                                 priv->res_args[priv->res_count-1]) < 0)
-                return -1;
+            /* The lease is created together with all the other
+             * ones of this domain right before acquiring them */
+            priv->res_create[priv->res_count-1] = true;
         } else {
             if (!(flags & (VIR_LOCK_MANAGER_RESOURCE_SHARED |
                            VIR_LOCK_MANAGER_RESOURCE_READONLY)))
@@ -1030,6 +1143,9 @@ static int virLockManagerSanlockAcquire(virLockManagerPtr lock,
     }
 
     if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
+        if (virLockManagerSanlockCreateLeases(driver, priv) < 0)
+            goto error;
+
         VIR_DEBUG("Acquiring object %u", priv->res_count);
         if ((rv = sanlock_acquire(sock, priv->vm_pid, 0,
                                   priv->res_count, priv->res_args,
@@ -42,6 +42,7 @@
 #include "virconf.h"
 #include "rpc/virnetdaemon.h"
 #include "virrandom.h"
+#include "vireventpoll.h"
 #include "virhash.h"
 #include "viruuid.h"
 #include "virstring.h"
@@ -165,6 +166,9 @@ virLogDaemonNew(virLogDaemonConfigPtr config, bool privileged)
     virObjectUnref(srv);
     srv = NULL;
 
+    if (virEventPollStartLoops(config->event_loop_threads) < 0)
+        goto error;
+
     if (!(logd->handler = virLogHandlerNew(privileged,
                                            config->max_size,
                                            config->max_backups,
@@ -231,6 +235,9 @@ virLogDaemonNewPostExecRestart(virJSONValuePtr object, bool privileged,
         goto error;
     }
 
+    if (virEventPollStartLoops(config->event_loop_threads) < 0)
+        goto error;
+
     if (!(logd->handler = virLogHandlerNewPostExecRestart(child,
                                                           privileged,
                                                           config->max_size,
@@ -34,6 +34,7 @@ struct _virLogDaemonConfig {
     char *log_filters;
     char *log_outputs;
     unsigned int max_clients;
+    unsigned int event_loop_threads;
 
     size_t max_backups;
     size_t max_size;
@@ -31,6 +31,8 @@
 #include "virlog.h"
 #include "virrotatingfile.h"
 #include "viruuid.h"
+#include "virthread.h"
+#include "virevent.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -43,10 +45,16 @@ VIR_LOG_INIT("logging.log_handler");
 
 #define DEFAULT_MODE 0600
 
+/* Maximum amount of data moved from a pipe to its file per event */
+#define VIR_LOG_HANDLER_BATCH (64 * 1024)
+
 typedef struct _virLogHandlerLogFile virLogHandlerLogFile;
 typedef virLogHandlerLogFile *virLogHandlerLogFilePtr;
 
 struct _virLogHandlerLogFile {
+    /* Serializes the use of @file, since the pipe events can be
+     * dispatched from several event loop threads */
+    virMutex lock;
     virRotatingFileWriterPtr file;
     int watch;
     int pipefd; /* Read from QEMU via this */
@@ -100,12 +108,35 @@ virLogHandlerLogFileFree(virLogHandlerLogFilePtr file)
     if (file->watch != -1)
         virEventRemoveHandle(file->watch);
 
+    virMutexDestroy(&file->lock);
     VIR_FREE(file->driver);
     VIR_FREE(file->domname);
     VIR_FREE(file);
 }
 
 
+static virLogHandlerLogFilePtr
+virLogHandlerLogFileNew(void)
+{
+    virLogHandlerLogFilePtr file;
+
+    if (VIR_ALLOC(file) < 0)
+        return NULL;
+
+    if (virMutexInit(&file->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        VIR_FREE(file);
+        return NULL;
+    }
+
+    file->watch = -1;
+    file->pipefd = -1;
+
+    return file;
+}
+
+
 static void
 virLogHandlerLogFileClose(virLogHandlerPtr handler,
                           virLogHandlerLogFilePtr file)
@@ -145,7 +176,6 @@ virLogHandlerDomainLogFileEvent(int watch,
 {
     virLogHandlerPtr handler = opaque;
     virLogHandlerLogFilePtr logfile;
-    char buf[1024];
     ssize_t len;
 
     virObjectLock(handler);
@@ -156,30 +186,45 @@ virLogHandlerDomainLogFileEvent(int watch,
         return;
     }
 
- reread:
-    len = read(fd, buf, sizeof(buf));
-    if (len < 0) {
-        if (errno == EINTR)
-            goto reread;
+    /* The file can only be closed from this callback, which is never run
+     * concurrently for the same watch, so it's safe to let go of the
+     * handler while writing */
+    virMutexLock(&logfile->lock);
+    virObjectUnlock(handler);
 
-        virReportSystemError(errno, "%s",
-                             _("Unable to read from log pipe"));
-        goto error;
+    /* Once QEMU is gone, save whatever is left in the pipe */
+    do {
+        len = virRotatingFileWriterAppendFD(logfile->file, fd,
+                                            VIR_LOG_HANDLER_BATCH);
+    } while (len > 0 && (events & VIR_EVENT_HANDLE_HANGUP));
+
+    virMutexUnlock(&logfile->lock);
+
+    if (len < 0 || (events & VIR_EVENT_HANDLE_HANGUP)) {
+        virObjectLock(handler);
+        handler->inhibitor(false, handler->opaque);
+        virLogHandlerLogFileClose(handler, logfile);
+        virObjectUnlock(handler);
     }
+}
 
-    if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
-        goto error;
 
-    if (events & VIR_EVENT_HANDLE_HANGUP)
-        goto error;
+/* Spreads the files over the event loop threads */
+static int
+virLogHandlerLogFileAddWatch(virLogHandlerPtr handler,
+                             virLogHandlerLogFilePtr file)
+{
+    unsigned int key;
 
-    virObjectUnlock(handler);
-    return;
+    memcpy(&key, file->domuuid, sizeof(key));
 
- error:
-    handler->inhibitor(false, handler->opaque);
-    virLogHandlerLogFileClose(handler, logfile);
-    virObjectUnlock(handler);
+    file->watch = virEventAddHandleAffinity(file->pipefd,
+                                            VIR_EVENT_HANDLE_READABLE,
+                                            virLogHandlerDomainLogFileEvent,
+                                            handler,
+                                            NULL,
+                                            key);
+    return file->watch;
 }
 
 
@@ -220,7 +265,7 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
     const char *domuuid;
     const char *tmp;
 
-    if (VIR_ALLOC(file) < 0)
+    if (!(file = virLogHandlerLogFileNew()))
         return NULL;
 
     handler->inhibitor(true, handler->opaque);
@@ -327,11 +372,7 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
         if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
             goto error;
 
-        if ((file->watch = virEventAddHandle(file->pipefd,
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             virLogHandlerDomainLogFileEvent,
-                                             handler,
-                                             NULL)) < 0) {
+        if (virLogHandlerLogFileAddWatch(handler, file) < 0) {
             VIR_DELETE_ELEMENT(handler->files, handler->nfiles - 1, handler->nfiles);
             goto error;
         }
@@ -393,10 +434,9 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
                              _("Cannot open fifo pipe"));
         goto error;
     }
-    if (VIR_ALLOC(file) < 0)
+    if (!(file = virLogHandlerLogFileNew()))
         goto error;
 
-    file->watch = -1;
     file->pipefd = pipefd[0];
     pipefd[0] = -1;
     memcpy(file->domuuid, domuuid, VIR_UUID_BUFLEN);
@@ -414,17 +454,15 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
     if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
         goto error;
 
-    if ((file->watch = virEventAddHandle(file->pipefd,
-                                         VIR_EVENT_HANDLE_READABLE,
-                                         virLogHandlerDomainLogFileEvent,
-                                         handler,
-                                         NULL)) < 0) {
+    if (virLogHandlerLogFileAddWatch(handler, file) < 0) {
         VIR_DELETE_ELEMENT(handler->files, handler->nfiles - 1, handler->nfiles);
         goto error;
     }
 
+    virMutexLock(&file->lock);
     *inode = virRotatingFileWriterGetINode(file->file);
     *offset = virRotatingFileWriterGetOffset(file->file);
+    virMutexUnlock(&file->lock);
 
     virObjectUnlock(handler);
     return pipefd[1];
@@ -469,8 +507,10 @@ virLogHandlerDomainGetLogFilePosition(virLogHandlerPtr handler,
         goto cleanup;
     }
 
+    virMutexLock(&file->lock);
     *inode = virRotatingFileWriterGetINode(file->file);
     *offset = virRotatingFileWriterGetOffset(file->file);
+    virMutexUnlock(&file->lock);
 
     ret = 0;
 
@@ -489,18 +529,37 @@ virLogHandlerDomainReadLogFile(virLogHandlerPtr handler,
                                unsigned int flags)
 {
     virRotatingFileReaderPtr file = NULL;
+    virLogHandlerLogFilePtr logfile = NULL;
     char *data = NULL;
     ssize_t got;
+    size_t i;
 
     virCheckFlags(0, NULL);
 
     virObjectLock(handler);
 
-    if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
-        goto error;
+    for (i = 0; i < handler->nfiles; i++) {
+        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
+                  path)) {
+            logfile = handler->files[i];
+            break;
+        }
+    }
 
-    if (virRotatingFileReaderSeek(file, inode, offset) < 0)
-        goto error;
+    if (logfile) {
+        /* The writer knows where to find @inode */
+        virMutexLock(&logfile->lock);
+        file = virRotatingFileWriterNewReader(logfile->file, inode, offset);
+        virMutexUnlock(&logfile->lock);
+        if (!file)
+            goto error;
+    } else {
+        if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
+            goto error;
+
+        if (virRotatingFileReaderSeek(file, inode, offset) < 0)
+            goto error;
+    }
 
     if (VIR_ALLOC_N(data, maxlen + 1) < 0)
         goto error;
@@ -532,6 +591,7 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
                                  unsigned int flags)
 {
     size_t i;
+    virLogHandlerLogFilePtr file = NULL;
     virRotatingFileWriterPtr writer = NULL;
     virRotatingFileWriterPtr newwriter = NULL;
     int ret = -1;
@@ -544,7 +604,8 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
 
     for (i = 0; i < handler->nfiles; i++) {
         if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file), path)) {
-            writer = handler->files[i]->file;
+            file = handler->files[i];
+            writer = file->file;
             break;
         }
     }
@@ -560,10 +621,12 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
         writer = newwriter;
     }
 
-    if (virRotatingFileWriterAppend(writer, message, strlen(message)) < 0)
-        goto cleanup;
-
-    ret = 0;
+    if (file)
+        virMutexLock(&file->lock);
+    if (virRotatingFileWriterAppend(writer, message, strlen(message)) >= 0)
+        ret = 0;
+    if (file)
+        virMutexUnlock(&file->lock);
 
  cleanup:
     virRotatingFileWriterFree(newwriter);
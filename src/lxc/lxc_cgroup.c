@@ -311,6 +311,41 @@ int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo)
 }
 
 
+/*
+ * Get the host CPUs the container is allowed to run on. @cpus is set
+ * to NULL if the cpuset controller isn't available, in which case the
+ * container can use all host CPUs.
+ */
+int virLXCCgroupGetCpuset(virBitmapPtr *cpus)
+{
+    int ret = -1;
+    virCgroupPtr cgroup;
+    char *str = NULL;
+
+    *cpus = NULL;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        return -1;
+
+    if (!virCgroupHasController(cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpusetCpus(cgroup, &str) < 0)
+        goto cleanup;
+
+    if (virBitmapParse(str, cpus, VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
 
 typedef struct _virLXCCgroupDevicePolicy virLXCCgroupDevicePolicy;
 typedef virLXCCgroupDevicePolicy *virLXCCgroupDevicePolicyPtr;
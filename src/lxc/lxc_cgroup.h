@@ -38,6 +38,8 @@ int virLXCCgroupSetup(virDomainDefPtr def,
 
 int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo);
 
+int virLXCCgroupGetCpuset(virBitmapPtr *cpus);
+
 int
 virLXCSetupHostUSBDeviceCgroup(virUSBDevicePtr dev,
                                const char *path,
@@ -59,6 +59,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "lxc_container.h"
+#include "lxc_fuse.h"
 #include "viralloc.h"
 #include "virnetdevveth.h"
 #include "viruuid.h"
@@ -1018,25 +1019,37 @@ static int lxcContainerMountBasicFS(bool userns_enabled,
 static int lxcContainerMountProcFuse(virDomainDefPtr def,
                                      const char *stateDir)
 {
-    int ret;
-    char *meminfo_path = NULL;
+    int ret = -1;
+    size_t i;
+    char *src_path = NULL;
+    char *dst_path = NULL;
 
-    VIR_DEBUG("Mount /proc/meminfo stateDir=%s", stateDir);
+    VIR_DEBUG("Mount virtualized /proc files stateDir=%s", stateDir);
 
-    if ((ret = virAsprintf(&meminfo_path,
-                           "/.oldroot/%s/%s.fuse/meminfo",
-                           stateDir,
-                           def->name)) < 0)
-        return ret;
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++) {
+        const char *file = virLXCFuseFileTypeToString(i);
 
-    if ((ret = mount(meminfo_path, "/proc/meminfo",
-                     NULL, MS_BIND, NULL)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to mount %s on /proc/meminfo"),
-                             meminfo_path);
+        if (virAsprintf(&src_path, "/.oldroot/%s/%s.fuse/%s",
+                        stateDir, def->name, file) < 0 ||
+            virAsprintf(&dst_path, "/proc/%s", file) < 0)
+            goto cleanup;
+
+        if (mount(src_path, dst_path, NULL, MS_BIND, NULL) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to mount %s on %s"),
+                                 src_path, dst_path);
+            goto cleanup;
+        }
+
+        VIR_FREE(src_path);
+        VIR_FREE(dst_path);
     }
 
-    VIR_FREE(meminfo_path);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(src_path);
+    VIR_FREE(dst_path);
     return ret;
 }
 #else
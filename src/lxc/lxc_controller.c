@@ -78,6 +78,9 @@
 
 VIR_LOG_INIT("lxc.lxc_controller");
 
+/* Large enough to soak up a burst of console output in a single read */
+#define VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE (64 * 1024)
+
 typedef struct _virLXCControllerConsole virLXCControllerConsole;
 typedef virLXCControllerConsole *virLXCControllerConsolePtr;
 struct _virLXCControllerConsole {
@@ -85,19 +88,24 @@ struct _virLXCControllerConsole {
     int hostFd;  /* PTY FD in the host OS */
     bool hostClosed;
     int hostEpoll;
+    int hostEvents; /* events currently requested on hostWatch */
 
     int contWatch;
     int contFd;  /* PTY FD in the container */
     bool contClosed;
     int contEpoll;
+    int contEvents; /* events currently requested on contWatch */
 
     int epollWatch;
     int epollFd; /* epoll FD for dealing with EOF */
 
+    /* Pending data starts at *Off and is *Len bytes long */
+    size_t fromHostOff;
     size_t fromHostLen;
-    char fromHostBuf[1024];
+    char fromHostBuf[VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE];
+    size_t fromContOff;
     size_t fromContLen;
-    char fromContBuf[1024];
+    char fromContBuf[VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE];
 
     virNetDaemonPtr daemon;
 };
@@ -778,11 +786,12 @@ static int virLXCControllerGetNumadAdvice(virLXCControllerPtr ctrl,
      */
     if (virDomainDefNeedsPlacementAdvice(ctrl->def)) {
         nodeset = virNumaGetAutoPlacementAdvice(virDomainDefGetVcpus(ctrl->def),
-                                                ctrl->def->mem.cur_balloon);
+                                                ctrl->def->mem.cur_balloon,
+                                                0);
         if (!nodeset)
             goto cleanup;
 
-        VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
+        VIR_DEBUG("Advisory nodeset: %s", nodeset);
 
         if (virBitmapParse(nodeset, &nodemask, VIR_DOMAIN_CPUMASK_LEN) < 0)
             goto cleanup;
@@ -1060,8 +1069,15 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     VIR_DEBUG("Container watch=%d, events=%d closed=%d; host watch=%d events=%d closed=%d",
               console->contWatch, contEvents, console->contClosed,
               console->hostWatch, hostEvents, console->hostClosed);
-    virEventUpdateHandle(console->contWatch, contEvents);
-    virEventUpdateHandle(console->hostWatch, hostEvents);
+    /* Most of the time nothing changes, don't bother the event loop then */
+    if (contEvents != console->contEvents) {
+        virEventUpdateHandle(console->contWatch, contEvents);
+        console->contEvents = contEvents;
+    }
+    if (hostEvents != console->hostEvents) {
+        virEventUpdateHandle(console->hostWatch, hostEvents);
+        console->hostEvents = hostEvents;
+    }
 
     if (console->hostClosed) {
         /* Must setup an epoll to detect when host becomes accessible again */
@@ -1190,6 +1206,39 @@ static void virLXCControllerConsoleEPoll(int watch, int fd, int events, void *op
     virMutexUnlock(&lock);
 }
 
+/*
+ * Write as much of the pending data in @buf to @fd as it will take
+ * without blocking
+ */
+static int virLXCControllerConsoleFlush(int fd,
+                                        char *buf,
+                                        size_t *off,
+                                        size_t *len)
+{
+    while (*len) {
+        ssize_t done = write(fd, buf + *off, *len);
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to write to container pty"));
+            return -1;
+        }
+
+        *off += done;
+        *len -= done;
+    }
+
+    if (*len == 0)
+        *off = 0;
+
+    return 0;
+}
+
+
 static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaque)
 {
     virLXCControllerConsolePtr console = opaque;
@@ -1201,60 +1250,74 @@ static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaqu
               console->fromContLen);
     if (events & VIR_EVENT_HANDLE_READABLE) {
         char *buf;
+        size_t *off;
         size_t *len;
         size_t avail;
         ssize_t done;
+        int peerFd;
+        bool peerClosed;
         if (watch == console->hostWatch) {
             buf = console->fromHostBuf;
+            off = &console->fromHostOff;
             len = &console->fromHostLen;
-            avail = sizeof(console->fromHostBuf) - *len;
+            peerFd = console->contFd;
+            peerClosed = console->contClosed;
         } else {
             buf = console->fromContBuf;
+            off = &console->fromContOff;
             len = &console->fromContLen;
-            avail = sizeof(console->fromContBuf) - *len;
+            peerFd = console->hostFd;
+            peerClosed = console->hostClosed;
         }
-     reread:
-        done = read(fd, buf + *len, avail);
-        if (done == -1 && errno == EINTR)
-            goto reread;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to read container pty"));
-            goto error;
-        }
-        if (done > 0) {
+
+        /* Keep reading until the fd is drained or the buffer is full,
+         * handing the data on to the other side straight away rather
+         * than waiting for another trip through the event loop */
+        while (1) {
+            if (*off + *len == VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE && *off) {
+                memmove(buf, buf + *off, *len);
+                *off = 0;
+            }
+
+            avail = VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE - *off - *len;
+            if (avail == 0)
+                break;
+
+            done = read(fd, buf + *off + *len, avail);
+            if (done == -1 && errno == EINTR)
+                continue;
+            if (done == -1 && errno != EAGAIN) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to read container pty"));
+                goto error;
+            }
+            if (done <= 0) {
+                VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+                break;
+            }
+
             *len += done;
-        } else {
-            VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+
+            if (!peerClosed &&
+                virLXCControllerConsoleFlush(peerFd, buf, off, len) < 0)
+                goto error;
+
+            if (done < avail)
+                break;
         }
     }
 
     if (events & VIR_EVENT_HANDLE_WRITABLE) {
-        char *buf;
-        size_t *len;
-        ssize_t done;
         if (watch == console->hostWatch) {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-        } else {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-        }
-
-     rewrite:
-        done = write(fd, buf, *len);
-        if (done == -1 && errno == EINTR)
-            goto rewrite;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to write to container pty"));
-            goto error;
-        }
-        if (done > 0) {
-            memmove(buf, buf + done, (*len - done));
-            *len -= done;
+            if (virLXCControllerConsoleFlush(fd, console->fromContBuf,
+                                             &console->fromContOff,
+                                             &console->fromContLen) < 0)
+                goto error;
         } else {
-            VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
+            if (virLXCControllerConsoleFlush(fd, console->fromHostBuf,
+                                             &console->fromHostOff,
+                                             &console->fromHostLen) < 0)
+                goto error;
         }
     }
 
@@ -1329,6 +1392,7 @@ static int virLXCControllerMain(virLXCControllerPtr ctrl)
                            _("Unable to watch host console PTY"));
             goto cleanup;
         }
+        ctrl->consoles[i].hostEvents = VIR_EVENT_HANDLE_READABLE;
 
         if ((ctrl->consoles[i].contWatch = virEventAddHandle(ctrl->consoles[i].contFd,
                                                              VIR_EVENT_HANDLE_READABLE,
@@ -1339,6 +1403,7 @@ static int virLXCControllerMain(virLXCControllerPtr ctrl)
                            _("Unable to watch host console PTY"));
             goto cleanup;
         }
+        ctrl->consoles[i].contEvents = VIR_EVENT_HANDLE_READABLE;
     }
 
     virNetDaemonRun(ctrl->daemon);
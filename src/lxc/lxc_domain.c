@@ -43,6 +43,16 @@ VIR_ENUM_IMPL(virLXCDomainJob, LXC_JOB_LAST,
               "modify",
 );
 
+VIR_ENUM_IMPL(virLXCDomainStartPhase, VIR_LXC_DOMAIN_START_PHASE_LAST,
+              "prepare",
+              "label",
+              "network",
+              "launch",
+              "setup",
+              "monitor",
+              "finish",
+);
+
 VIR_LOG_INIT("lxc.lxc_domain");
 
 static int
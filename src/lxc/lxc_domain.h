@@ -76,6 +76,21 @@ struct virLXCDomainJobObj {
 };
 
 
+/* Phases of container startup which are timed separately */
+typedef enum {
+    VIR_LXC_DOMAIN_START_PHASE_PREPARE = 0, /* checks, hooks, host devices */
+    VIR_LXC_DOMAIN_START_PHASE_LABEL,       /* security labelling */
+    VIR_LXC_DOMAIN_START_PHASE_NETWORK,     /* consoles, interfaces, namespaces */
+    VIR_LXC_DOMAIN_START_PHASE_LAUNCH,      /* spawning the controller */
+    VIR_LXC_DOMAIN_START_PHASE_SETUP,       /* container setup by the controller */
+    VIR_LXC_DOMAIN_START_PHASE_MONITOR,     /* cgroup lookup, monitor connection */
+    VIR_LXC_DOMAIN_START_PHASE_FINISH,      /* 'started' hook */
+
+    VIR_LXC_DOMAIN_START_PHASE_LAST
+} virLXCDomainStartPhase;
+VIR_ENUM_DECL(virLXCDomainStartPhase)
+
+
 typedef struct _virLXCDomainObjPrivate virLXCDomainObjPrivate;
 typedef virLXCDomainObjPrivate *virLXCDomainObjPrivatePtr;
 struct _virLXCDomainObjPrivate {
@@ -89,6 +104,9 @@ struct _virLXCDomainObjPrivate {
     virCgroupPtr cgroup;
     char *machineName;
 
+    /* Microseconds spent in each phase of the last startup */
+    unsigned long long startPhases[VIR_LXC_DOMAIN_START_PHASE_LAST];
+
     struct virLXCDomainJobObj job;
 };
 
@@ -556,6 +556,7 @@ static int lxcDomainUndefineFlags(virDomainPtr dom,
 
     if (virDomainObjIsActive(vm)) {
         vm->persistent = 0;
+        virDomainObjBumpGeneration(vm);
     } else {
         virDomainObjListRemove(driver->domains, vm);
     }
@@ -2974,6 +2975,7 @@ static int lxcDomainSetAutostart(virDomainPtr dom,
     }
 
     vm->autostart = autostart;
+    virDomainObjBumpGeneration(vm);
     ret = 0;
 
  endjob:
@@ -3347,6 +3349,25 @@ lxcConnectListAllDomains(virConnectPtr conn,
     return ret;
 }
 
+static int
+lxcConnectListDomainChanges(virConnectPtr conn,
+                            unsigned long long *cursor,
+                            virDomainPtr **changed,
+                            virDomainPtr **removed,
+                            unsigned int flags)
+{
+    virLXCDriverPtr driver = conn->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virConnectListDomainChangesEnsureACL(conn) < 0)
+        return -1;
+
+    return virDomainObjListExportChanges(driver->domains, conn, cursor,
+                                         changed, removed,
+                                         virConnectListDomainChangesCheckACL);
+}
+
 
 static int
 lxcDomainInitctlCallback(pid_t pid ATTRIBUTE_UNUSED,
@@ -5486,6 +5507,461 @@ lxcDomainHasManagedSaveImage(virDomainPtr dom, unsigned int flags)
 }
 
 
+#define LXC_ADD_COUNT_PARAM(record, maxparams, type, count) \
+do { \
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "%s.count", type); \
+    if (virTypedParamsAddUInt(&(record)->params, \
+                              &(record)->nparams, \
+                              maxparams, \
+                              param_name, \
+                              count) < 0) \
+        return -1; \
+} while (0)
+
+#define LXC_ADD_NAME_PARAM(record, maxparams, type, subtype, num, name) \
+do { \
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
+             "%s.%zu.%s", type, num, subtype); \
+    if (virTypedParamsAddString(&(record)->params, \
+                                &(record)->nparams, \
+                                maxparams, \
+                                param_name, \
+                                name) < 0) \
+        return -1; \
+} while (0)
+
+#define LXC_ADD_ULL_PARAM(record, maxparams, type, num, name, value) \
+do { \
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
+    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
+             "%s.%zu.%s", type, num, name); \
+    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
+                                              &(record)->nparams, \
+                                              maxparams, \
+                                              param_name, \
+                                              value) < 0) \
+        return -1; \
+} while (0)
+
+
+static int
+lxcDomainGetStatsState(virDomainObjPtr dom,
+                       virDomainStatsRecordPtr record,
+                       int *maxparams,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    if (virTypedParamsAddInt(&record->params,
+                             &record->nparams,
+                             maxparams,
+                             "state.state",
+                             dom->state.state) < 0)
+        return -1;
+
+    if (virTypedParamsAddInt(&record->params,
+                             &record->nparams,
+                             maxparams,
+                             "state.reason",
+                             dom->state.reason) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+lxcDomainGetStatsCpu(virDomainObjPtr dom,
+                     virDomainStatsRecordPtr record,
+                     int *maxparams,
+                     virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    virLXCDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cpu_time = 0;
+    unsigned long long user_time = 0;
+    unsigned long long sys_time = 0;
+
+    if (!virDomainObjIsActive(dom) || !priv->cgroup)
+        return 0;
+
+    if (virCgroupGetCpuacctTimes(priv->cgroup,
+                                 &cpu_time, &user_time, &sys_time) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "cpu.time",
+                                cpu_time) < 0 ||
+        virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "cpu.user",
+                                user_time) < 0 ||
+        virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "cpu.system",
+                                sys_time) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+lxcDomainGetStatsBalloon(virDomainObjPtr dom,
+                         virDomainStatsRecordPtr record,
+                         int *maxparams,
+                         virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    virLXCDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long mem_usage;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "balloon.current",
+                                dom->def->mem.cur_balloon) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "balloon.maximum",
+                                virDomainDefGetMemoryTotal(dom->def)) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(dom) || !priv->cgroup)
+        return 0;
+
+    if (virCgroupGetMemoryUsage(priv->cgroup, &mem_usage) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "balloon.rss",
+                                mem_usage) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+lxcDomainGetStatsInterface(virDomainObjPtr dom,
+                           virDomainStatsRecordPtr record,
+                           int *maxparams,
+                           virHashTablePtr netstats)
+{
+    struct _virDomainInterfaceStats tmp;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    LXC_ADD_COUNT_PARAM(record, maxparams, "net", dom->def->nnets);
+
+    for (i = 0; i < dom->def->nnets; i++) {
+        virDomainNetDefPtr net = dom->def->nets[i];
+
+        if (!net->ifname)
+            continue;
+
+        memset(&tmp, 0, sizeof(tmp));
+
+        LXC_ADD_NAME_PARAM(record, maxparams, "net", "name", i, net->ifname);
+
+        if (virNetDevTapInterfaceStatsLookup(netstats, net->ifname, &tmp,
+                                             !virDomainNetTypeSharesHostView(net)) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "rx.bytes", tmp.rx_bytes);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "rx.pkts", tmp.rx_packets);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "rx.errs", tmp.rx_errs);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "rx.drop", tmp.rx_drop);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "tx.bytes", tmp.tx_bytes);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "tx.pkts", tmp.tx_packets);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "tx.errs", tmp.tx_errs);
+        LXC_ADD_ULL_PARAM(record, maxparams, "net", i, "tx.drop", tmp.tx_drop);
+    }
+
+    return 0;
+}
+
+
+static int
+lxcDomainGetStatsBlock(virDomainObjPtr dom,
+                       virDomainStatsRecordPtr record,
+                       int *maxparams,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    virLXCDomainObjPrivatePtr priv = dom->privateData;
+    long long rd_req, rd_bytes, wr_req, wr_bytes;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom) || !priv->cgroup ||
+        !virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_BLKIO))
+        return 0;
+
+    LXC_ADD_COUNT_PARAM(record, maxparams, "block", dom->def->ndisks);
+
+    for (i = 0; i < dom->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = dom->def->disks[i];
+        const char *path = virDomainDiskGetSource(disk);
+
+        LXC_ADD_NAME_PARAM(record, maxparams, "block", "name", i, disk->dst);
+        if (path)
+            LXC_ADD_NAME_PARAM(record, maxparams, "block", "path", i, path);
+
+        if (!disk->info.alias ||
+            virCgroupGetBlkioIoDeviceServiced(priv->cgroup,
+                                              disk->info.alias,
+                                              &rd_bytes,
+                                              &wr_bytes,
+                                              &rd_req,
+                                              &wr_req) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        LXC_ADD_ULL_PARAM(record, maxparams, "block", i, "rd.reqs", rd_req);
+        LXC_ADD_ULL_PARAM(record, maxparams, "block", i, "rd.bytes", rd_bytes);
+        LXC_ADD_ULL_PARAM(record, maxparams, "block", i, "wr.reqs", wr_req);
+        LXC_ADD_ULL_PARAM(record, maxparams, "block", i, "wr.bytes", wr_bytes);
+    }
+
+    return 0;
+}
+
+
+static int
+lxcDomainGetStatsStart(virDomainObjPtr dom,
+                       virDomainStatsRecordPtr record,
+                       int *maxparams,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    virLXCDomainObjPrivatePtr priv = dom->privateData;
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long total = 0;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    for (i = 0; i < VIR_LXC_DOMAIN_START_PHASE_LAST; i++) {
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "start.%s",
+                 virLXCDomainStartPhaseTypeToString(i));
+
+        if (virTypedParamsAddULLong(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    priv->startPhases[i]) < 0)
+            return -1;
+
+        total += priv->startPhases[i];
+    }
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "start.total",
+                                total) < 0)
+        return -1;
+
+    return 0;
+}
+
+#undef LXC_ADD_ULL_PARAM
+#undef LXC_ADD_NAME_PARAM
+#undef LXC_ADD_COUNT_PARAM
+
+
+typedef int
+(*lxcDomainGetStatsFunc)(virDomainObjPtr dom,
+                         virDomainStatsRecordPtr record,
+                         int *maxparams,
+                         virHashTablePtr netstats);
+
+struct lxcDomainGetStatsWorker {
+    lxcDomainGetStatsFunc func;
+    unsigned int stats;
+};
+
+static struct lxcDomainGetStatsWorker lxcDomainGetStatsWorkers[] = {
+    { lxcDomainGetStatsState, VIR_DOMAIN_STATS_STATE },
+    { lxcDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL },
+    { lxcDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON },
+    { lxcDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE },
+    { lxcDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK },
+    { lxcDomainGetStatsStart, VIR_DOMAIN_STATS_START },
+    { NULL, 0 }
+};
+
+
+static int
+lxcDomainGetStatsCheckSupport(unsigned int *stats,
+                              bool enforce)
+{
+    unsigned int supportedstats = 0;
+    size_t i;
+
+    for (i = 0; lxcDomainGetStatsWorkers[i].func; i++)
+        supportedstats |= lxcDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        *stats = supportedstats;
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supportedstats);
+        return -1;
+    }
+
+    *stats &= supportedstats;
+    return 0;
+}
+
+
+static int
+lxcDomainGetStats(virConnectPtr conn,
+                  virDomainObjPtr dom,
+                  unsigned int stats,
+                  virDomainStatsRecordPtr *record,
+                  virHashTablePtr netstats)
+{
+    virDomainStatsRecordPtr tmp;
+    int maxparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    for (i = 0; lxcDomainGetStatsWorkers[i].func; i++) {
+        if (stats & lxcDomainGetStatsWorkers[i].stats &&
+            lxcDomainGetStatsWorkers[i].func(dom, tmp, &maxparams,
+                                             netstats) < 0)
+            goto cleanup;
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+                                  dom->def->uuid, dom->def->id)))
+        goto cleanup;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+
+    return ret;
+}
+
+
+/*
+ * Everything is read straight from the cgroups and the host interfaces,
+ * so no job is needed and each container is locked only while its own
+ * record is filled in. The statistics of all host interfaces are fetched
+ * with a single netlink dump up front and shared by all the containers.
+ */
+static int
+lxcConnectGetAllDomainStats(virConnectPtr conn,
+                            virDomainPtr *doms,
+                            unsigned int ndoms,
+                            unsigned int stats,
+                            virDomainStatsRecordPtr **retStats,
+                            unsigned int flags)
+{
+    virLXCDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    virHashTablePtr netstats = NULL;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    size_t nvms = 0;
+    int nstats = 0;
+    size_t i;
+    int ret = -1;
+    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+        return -1;
+
+    if (lxcDomainGetStatsCheckSupport(&stats, enforce) < 0)
+        return -1;
+
+    if (ndoms) {
+        if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
+                                    &nvms, virConnectGetAllDomainStatsCheckACL,
+                                    lflags, true) < 0)
+            return -1;
+    } else {
+        if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
+                                    virConnectGetAllDomainStatsCheckACL,
+                                    lflags) < 0)
+            return -1;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+        goto cleanup;
+
+    /* Interfaces missing from the snapshot are queried one by one */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(netstats = virNetDevTapInterfaceStatsAll()))
+        virResetLastError();
+
+    for (i = 0; i < nvms; i++) {
+        virDomainStatsRecordPtr tmp = NULL;
+        virDomainObjPtr vm = vms[i];
+
+        virObjectLock(vm);
+        if (lxcDomainGetStats(conn, vm, stats, &tmp, netstats) < 0) {
+            virObjectUnlock(vm);
+            goto cleanup;
+        }
+        virObjectUnlock(vm);
+
+        if (tmp)
+            tmpstats[nstats++] = tmp;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+ cleanup:
+    virHashFree(netstats);
+    virDomainStatsRecordListFree(tmpstats);
+    virObjectListFreeCount(vms, nvms);
+
+    return ret;
+}
+
+
 /* Function Tables */
 static virHypervisorDriver lxcHypervisorDriver = {
     .name = LXC_DRIVER_NAME,
@@ -5579,6 +6055,8 @@ static virHypervisorDriver lxcHypervisorDriver = {
     .nodeGetFreePages = lxcNodeGetFreePages, /* 1.2.6 */
     .nodeAllocPages = lxcNodeAllocPages, /* 1.2.9 */
     .domainHasManagedSaveImage = lxcDomainHasManagedSaveImage, /* 1.2.13 */
+    .connectListDomainChanges = lxcConnectListDomainChanges, /* 4.0.0 */
+    .connectGetAllDomainStats = lxcConnectGetAllDomainStats, /* 4.0.0 */
 };
 
 static virConnectDriver lxcConnectDriver = {
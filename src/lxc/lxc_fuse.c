@@ -36,12 +36,31 @@
 #include "virfile.h"
 #include "virbuffer.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
+VIR_ENUM_IMPL(virLXCFuseFile, VIR_LXC_FUSE_FILE_LAST,
+              "meminfo",
+              "cpuinfo",
+              "stat");
+
 #if WITH_FUSE
 
-static const char *fuse_meminfo_path = "/meminfo";
+/* How long rendered content is served from the cache. Monitoring
+ * agents in the container tend to read these files many times per
+ * second, and rendering them involves reading several host and cgroup
+ * files each time. */
+#define LXC_FUSE_CACHE_TTL_MS 1000
+
+/* Returns the virtualized file for @path, or -1 if there's none */
+static int lxcProcFileFromPath(const char *path)
+{
+    if (path[0] != '/')
+        return -1;
+
+    return virLXCFuseFileTypeFromString(path + 1);
+}
 
 static int lxcProcGetattr(const char *path, struct stat *stbuf)
 {
@@ -49,7 +68,8 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     char *mempath = NULL;
     struct stat sb;
     struct fuse_context *context = fuse_get_context();
-    virDomainDefPtr def = (virDomainDefPtr)context->private_data;
+    virLXCFusePtr fuse = context->private_data;
+    virDomainDefPtr def = fuse->def;
 
     memset(stbuf, 0, sizeof(struct stat));
     if (virAsprintf(&mempath, "/proc/%s", path) < 0)
@@ -60,7 +80,7 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     if (STREQ(path, "/")) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (STREQ(path, fuse_meminfo_path)) {
+    } else if (lxcProcFileFromPath(path) >= 0) {
         if (stat(mempath, &sb) < 0) {
             res = -errno;
             goto cleanup;
@@ -90,12 +110,15 @@ static int lxcProcReaddir(const char *path, void *buf,
                           off_t offset ATTRIBUTE_UNUSED,
                           struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
+    size_t i;
+
     if (STRNEQ(path, "/"))
         return -ENOENT;
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, fuse_meminfo_path + 1, NULL, 0);
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+        filler(buf, virLXCFuseFileTypeToString(i), NULL, 0);
 
     return 0;
 }
@@ -103,7 +126,7 @@ static int lxcProcReaddir(const char *path, void *buf,
 static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
-    if (STRNEQ(path, fuse_meminfo_path))
+    if (lxcProcFileFromPath(path) < 0)
         return -ENOENT;
 
     if ((fi->flags & 3) != O_RDONLY)
@@ -128,36 +151,24 @@ static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
     return res;
 }
 
-static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
-                              char *buf, size_t size, off_t offset)
+static int lxcProcRenderMeminfo(const char *hostpath, virDomainDefPtr def,
+                                virBufferPtr new_meminfo)
 {
-    int res;
+    int res = -1;
     FILE *fd = NULL;
     char *line = NULL;
     size_t n;
     struct virLXCMeminfo meminfo;
-    virBuffer buffer = VIR_BUFFER_INITIALIZER;
-    virBufferPtr new_meminfo = &buffer;
 
-    if (virLXCCgroupGetMeminfo(&meminfo) < 0) {
-        virErrorSetErrnoFromLastError();
-        return -errno;
-    }
+    if (virLXCCgroupGetMeminfo(&meminfo) < 0)
+        return -1;
 
     fd = fopen(hostpath, "r");
     if (fd == NULL) {
         virReportSystemError(errno, _("Cannot open %s"), hostpath);
-        res = -errno;
         goto cleanup;
     }
 
-    if (fseek(fd, offset, SEEK_SET) < 0) {
-        virReportSystemError(errno, "%s", _("fseek failed"));
-        res = -errno;
-        goto cleanup;
-    }
-
-    res = -1;
     while (getline(&line, &n, fd) > 0) {
         char *ptr = strchr(line, ':');
         if (!ptr)
@@ -227,24 +238,218 @@ static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
             *ptr = ':';
             virBufferAdd(new_meminfo, line, -1);
         }
+    }
 
-        if (virBufferCheckError(new_meminfo) < 0) {
-            res = -errno;
-            goto cleanup;
+    res = 0;
+
+ cleanup:
+    VIR_FREE(line);
+    VIR_FORCE_FCLOSE(fd);
+    return res;
+}
+
+/*
+ * Only show the CPUs the container is allowed to run on, renumbered
+ * from 0, so that tools sizing their thread pools by the number of
+ * processors get it right. Lines that are not part of a processor
+ * block (some architectures list global information there) are kept.
+ */
+static int lxcProcRenderCpuinfo(const char *hostpath,
+                                virDomainDefPtr def ATTRIBUTE_UNUSED,
+                                virBufferPtr new_cpuinfo)
+{
+    int res = -1;
+    FILE *fd = NULL;
+    char *line = NULL;
+    size_t n;
+    virBitmapPtr cpus = NULL;
+    bool skip = false;
+    unsigned int nextcpu = 0;
+
+    if (virLXCCgroupGetCpuset(&cpus) < 0)
+        return -1;
+
+    fd = fopen(hostpath, "r");
+    if (fd == NULL) {
+        virReportSystemError(errno, _("Cannot open %s"), hostpath);
+        goto cleanup;
+    }
+
+    while (getline(&line, &n, fd) > 0) {
+        char *ptr;
+        char *end;
+        unsigned int cpu;
+
+        if (STRPREFIX(line, "processor") &&
+            (ptr = strchr(line, ':')) &&
+            virStrToLong_ui(ptr + 1, &end, 10, &cpu) == 0) {
+            skip = cpus && !virBitmapIsBitSet(cpus, cpu);
+
+            if (!skip) {
+                *ptr = '\0';
+                virBufferAsprintf(new_cpuinfo, "%s: %u\n", line, nextcpu++);
+            }
+            continue;
         }
+
+        if (!skip)
+            virBufferAdd(new_cpuinfo, line, -1);
+
+        /* An empty line terminates the processor block */
+        if (line[0] == '\n')
+            skip = false;
     }
-    res = strlen(virBufferCurrentContent(new_meminfo));
-    if (res > size)
-        res = size;
-    memcpy(buf, virBufferCurrentContent(new_meminfo), res);
+
+    res = 0;
 
  cleanup:
+    virBitmapFree(cpus);
     VIR_FREE(line);
-    virBufferFreeAndReset(new_meminfo);
     VIR_FORCE_FCLOSE(fd);
     return res;
 }
 
+# define LXC_PROC_STAT_CPU_FIELDS 10
+
+/*
+ * Only show the per-CPU lines of the CPUs the container is allowed to
+ * run on, renumbered from 0, and make the aggregate "cpu" line the sum
+ * of those.
+ */
+static int lxcProcRenderStat(const char *hostpath,
+                             virDomainDefPtr def ATTRIBUTE_UNUSED,
+                             virBufferPtr new_stat)
+{
+    int res = -1;
+    char *content = NULL;
+    char **lines = NULL;
+    virBitmapPtr cpus = NULL;
+    unsigned long long sum[LXC_PROC_STAT_CPU_FIELDS] = { 0 };
+    size_t nfields = 0;
+    unsigned int nextcpu = 0;
+    size_t i;
+    size_t j;
+
+    if (virLXCCgroupGetCpuset(&cpus) < 0)
+        return -1;
+
+    if (virFileReadAll(hostpath, 1024 * 1024, &content) < 0)
+        goto cleanup;
+
+    if (!(lines = virStringSplit(content, "\n", 0)))
+        goto cleanup;
+
+    /* The aggregate line comes first, so sum up the per-CPU lines
+     * of the allowed CPUs beforehand */
+    for (i = 0; lines[i]; i++) {
+        unsigned long long val;
+        unsigned int cpu;
+        char *ptr;
+
+        if (STRPREFIX(lines[i], "cpu ")) {
+            /* Keep the number of fields the host reports */
+            ptr = lines[i] + 3;
+            while (nfields < LXC_PROC_STAT_CPU_FIELDS &&
+                   virStrToLong_ull(ptr, &ptr, 10, &val) == 0)
+                nfields++;
+            continue;
+        }
+
+        if (!STRPREFIX(lines[i], "cpu") ||
+            virStrToLong_ui(lines[i] + 3, &ptr, 10, &cpu) < 0 ||
+            (cpus && !virBitmapIsBitSet(cpus, cpu)))
+            continue;
+
+        for (j = 0; j < LXC_PROC_STAT_CPU_FIELDS; j++) {
+            if (virStrToLong_ull(ptr, &ptr, 10, &val) < 0)
+                break;
+            sum[j] += val;
+        }
+    }
+
+    for (i = 0; lines[i]; i++) {
+        unsigned int cpu;
+        char *ptr;
+
+        if (!*lines[i])
+            continue;
+
+        if (STRPREFIX(lines[i], "cpu ")) {
+            virBufferAddLit(new_stat, "cpu ");
+            for (j = 0; j < nfields; j++)
+                virBufferAsprintf(new_stat, " %llu", sum[j]);
+            virBufferAddLit(new_stat, "\n");
+        } else if (STRPREFIX(lines[i], "cpu") &&
+                   virStrToLong_ui(lines[i] + 3, &ptr, 10, &cpu) == 0) {
+            if (cpus && !virBitmapIsBitSet(cpus, cpu))
+                continue;
+            virBufferAsprintf(new_stat, "cpu%u%s\n", nextcpu++, ptr);
+        } else {
+            virBufferAsprintf(new_stat, "%s\n", lines[i]);
+        }
+    }
+
+    res = 0;
+
+ cleanup:
+    virStringListFree(lines);
+    VIR_FREE(content);
+    virBitmapFree(cpus);
+    return res;
+}
+
+typedef int (*lxcProcRenderFunc)(const char *hostpath,
+                                 virDomainDefPtr def,
+                                 virBufferPtr buf);
+
+static lxcProcRenderFunc lxcProcRenderers[VIR_LXC_FUSE_FILE_LAST] = {
+    [VIR_LXC_FUSE_FILE_MEMINFO] = lxcProcRenderMeminfo,
+    [VIR_LXC_FUSE_FILE_CPUINFO] = lxcProcRenderCpuinfo,
+    [VIR_LXC_FUSE_FILE_STAT] = lxcProcRenderStat,
+};
+
+/*
+ * Serve @file from the cache, rendering it again if the cached copy
+ * has expired. Rendering the whole file rather than just the part
+ * being read also means reads at an offset get consistent content.
+ * fuse_loop() handles one request at a time, so there's no need to
+ * lock the cache.
+ */
+static int lxcProcReadCached(virLXCFusePtr fuse, int file,
+                             const char *hostpath,
+                             char *buf, size_t size, off_t offset)
+{
+    struct virLXCFuseCache *cache = &fuse->cache[file];
+    unsigned long long now;
+    int res;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (!cache->content || now >= cache->expires) {
+        virBuffer buffer = VIR_BUFFER_INITIALIZER;
+
+        if (lxcProcRenderers[file](hostpath, fuse->def, &buffer) < 0 ||
+            virBufferCheckError(&buffer) < 0) {
+            virBufferFreeAndReset(&buffer);
+            return -1;
+        }
+
+        VIR_FREE(cache->content);
+        cache->len = virBufferUse(&buffer);
+        cache->content = virBufferContentAndReset(&buffer);
+        cache->expires = now + LXC_FUSE_CACHE_TTL_MS;
+    }
+
+    if (offset >= cache->len)
+        return 0;
+
+    res = MIN(size, cache->len - offset);
+    memcpy(buf, cache->content + offset, res);
+
+    return res;
+}
+
 static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
                        char *buf ATTRIBUTE_UNUSED,
                        size_t size ATTRIBUTE_UNUSED,
@@ -254,16 +459,18 @@ static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
     int res = -ENOENT;
     char *hostpath = NULL;
     struct fuse_context *context = NULL;
-    virDomainDefPtr def = NULL;
+    virLXCFusePtr fuse = NULL;
+    int file;
 
     if (virAsprintf(&hostpath, "/proc/%s", path) < 0)
         return -errno;
 
     context = fuse_get_context();
-    def = (virDomainDefPtr)context->private_data;
+    fuse = context->private_data;
 
-    if (STREQ(path, fuse_meminfo_path)) {
-        if ((res = lxcProcReadMeminfo(hostpath, def, buf, size, offset)) < 0)
+    if ((file = lxcProcFileFromPath(path)) >= 0) {
+        if ((res = lxcProcReadCached(fuse, file, hostpath,
+                                     buf, size, offset)) < 0)
             res = lxcProcHostRead(hostpath, buf, size, offset);
     }
 
@@ -334,7 +541,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
         goto cleanup1;
 
     fuse->fuse = fuse_new(fuse->ch, &args, &lxcProcOper,
-                          sizeof(lxcProcOper), fuse->def);
+                          sizeof(lxcProcOper), fuse);
     if (fuse->fuse == NULL) {
         fuse_unmount(fuse->mountpoint, fuse->ch);
         goto cleanup1;
@@ -367,6 +574,7 @@ int lxcStartFuse(virLXCFusePtr fuse)
 void lxcFreeFuse(virLXCFusePtr *f)
 {
     virLXCFusePtr fuse = *f;
+    size_t i;
     /* lxcFuseRun thread create success */
     if (fuse) {
         /* exit fuse_loop, lxcFuseRun thread may try to destroy
@@ -376,6 +584,8 @@ void lxcFreeFuse(virLXCFusePtr *f)
             fuse_exit(fuse->fuse);
         virMutexUnlock(&fuse->lock);
 
+        for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+            VIR_FREE(fuse->cache[i].content);
         VIR_FREE(fuse->mountpoint);
         VIR_FREE(*f);
     }
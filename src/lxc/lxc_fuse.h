@@ -32,6 +32,7 @@
 
 # include "lxc_conf.h"
 # include "viralloc.h"
+# include "virutil.h"
 
 struct virLXCMeminfo {
     unsigned long long memtotal;
@@ -47,6 +48,24 @@ struct virLXCMeminfo {
 };
 typedef struct virLXCMeminfo *virLXCMeminfoPtr;
 
+/* Files of the host's /proc that are virtualized for the container */
+typedef enum {
+    VIR_LXC_FUSE_FILE_MEMINFO,
+    VIR_LXC_FUSE_FILE_CPUINFO,
+    VIR_LXC_FUSE_FILE_STAT,
+
+    VIR_LXC_FUSE_FILE_LAST
+} virLXCFuseFile;
+
+VIR_ENUM_DECL(virLXCFuseFile)
+
+/* Rendered content of a virtualized file, reused until @expires */
+struct virLXCFuseCache {
+    char *content;
+    size_t len;
+    unsigned long long expires; /* milliseconds since epoch */
+};
+
 struct virLXCFuse {
     virDomainDefPtr def;
     virThread thread;
@@ -54,6 +73,8 @@ struct virLXCFuse {
     struct fuse *fuse;
     struct fuse_chan *ch;
     virMutex lock;
+
+    struct virLXCFuseCache cache[VIR_LXC_FUSE_FILE_LAST];
 };
 typedef struct virLXCFuse *virLXCFusePtr;
 
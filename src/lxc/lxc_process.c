@@ -1166,6 +1166,82 @@ virLXCProcessEnsureRootFS(virDomainObjPtr vm)
     return -1;
 }
 
+static unsigned long long
+virLXCProcessStartPhaseBegin(void)
+{
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMicrosNowRaw(&now));
+    return now;
+}
+
+
+/**
+ * virLXCProcessStartPhaseEnd:
+ * @vm: domain being started
+ * @phase: phase of startup which just finished
+ * @begin: value returned by virLXCProcessStartPhaseBegin()
+ *
+ * Accounts the time since @begin to @phase of the startup of @vm.
+ * Returns the current time so that it can be used as the beginning
+ * of the following phase.
+ */
+static unsigned long long
+virLXCProcessStartPhaseEnd(virDomainObjPtr vm,
+                           virLXCDomainStartPhase phase,
+                           unsigned long long begin)
+{
+    virLXCDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now = 0;
+    unsigned long long usecs = 0;
+
+    if (begin &&
+        virTimeMicrosNowRaw(&now) == 0 &&
+        now > begin)
+        usecs = now - begin;
+
+    priv->startPhases[phase] += usecs;
+
+    VIR_DEBUG("vm=%p name=%s phase=%s usecs=%llu",
+              vm, vm->def->name,
+              virLXCDomainStartPhaseTypeToString(phase), usecs);
+
+    return now;
+}
+
+
+/* Appends the startup timing of @vm to its log file */
+static void
+virLXCProcessStartPhaseLog(virDomainObjPtr vm,
+                           int logfd)
+{
+    virLXCDomainObjPrivatePtr priv = vm->privateData;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned long long total = 0;
+    char ebuf[1024];
+    char *msg;
+    size_t i;
+
+    virBufferAddLit(&buf, "startup timing (usecs):");
+    for (i = 0; i < VIR_LXC_DOMAIN_START_PHASE_LAST; i++) {
+        virBufferAsprintf(&buf, " %s=%llu",
+                          virLXCDomainStartPhaseTypeToString(i),
+                          priv->startPhases[i]);
+        total += priv->startPhases[i];
+    }
+    virBufferAsprintf(&buf, " total=%llu\n", total);
+
+    if (!(msg = virBufferContentAndReset(&buf)))
+        return;
+
+    VIR_INFO("Container %s %s", vm->def->name, msg);
+    if (safewrite(logfd, msg, strlen(msg)) < 0)
+        VIR_WARN("Unable to write startup timing to logfile: %s",
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+    VIR_FREE(msg);
+}
+
+
 /**
  * virLXCProcessStart:
  * @conn: pointer to connection
@@ -1206,6 +1282,10 @@ int virLXCProcessStart(virConnectPtr conn,
     virCgroupPtr selfcgroup;
     int status;
     char *pidfile = NULL;
+    unsigned long long then;
+
+    memset(priv->startPhases, 0, sizeof(priv->startPhases));
+    then = virLXCProcessStartPhaseBegin();
 
     if (virCgroupNewSelf(&selfcgroup) < 0)
         return -1;
@@ -1321,6 +1401,9 @@ int virLXCProcessStart(virConnectPtr conn,
     for (i = 0; i < vm->def->nconsoles; i++)
         ttyFDs[i] = -1;
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_PREPARE,
+                                      then);
+
     /* If you are using a SecurityDriver with dynamic labelling,
        then generate a security label for isolation */
     VIR_DEBUG("Generating domain security label (if required)");
@@ -1343,6 +1426,9 @@ int virLXCProcessStart(virConnectPtr conn,
                                       vm->def, NULL, false) < 0)
         goto cleanup;
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_LABEL,
+                                      then);
+
     VIR_DEBUG("Setting up consoles");
     for (i = 0; i < vm->def->nconsoles; i++) {
         char *ttyPath;
@@ -1369,6 +1455,9 @@ int virLXCProcessStart(virConnectPtr conn,
     if (virLXCProcessSetupNamespaces(conn, vm->def->namespaceData, nsInheritFDs) < 0)
         goto cleanup;
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_NETWORK,
+                                      then);
+
     VIR_DEBUG("Preparing to launch");
     if ((logfd = open(logfile, O_WRONLY | O_APPEND | O_CREAT,
              S_IRUSR|S_IWUSR)) < 0) {
@@ -1485,6 +1574,11 @@ int virLXCProcessStart(virConnectPtr conn,
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
         driver->inhibitCallback(true, driver->inhibitOpaque);
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_LAUNCH,
+                                      then);
+
+    /* The controller sets up namespaces, mounts, devices and
+     * cgroups of the container before it lets us continue */
     if (lxcContainerWaitForContinue(handshakefds[0]) < 0) {
         char out[1024];
 
@@ -1496,6 +1590,9 @@ int virLXCProcessStart(virConnectPtr conn,
         goto cleanup;
     }
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_SETUP,
+                                      then);
+
     priv->machineName = virLXCDomainGetMachineName(vm->def, vm->pid);
     if (!priv->machineName)
         goto cleanup;
@@ -1534,6 +1631,9 @@ int virLXCProcessStart(virConnectPtr conn,
                              conn, lxcProcessAutoDestroy) < 0)
         goto cleanup;
 
+    then = virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_MONITOR,
+                                      then);
+
     /* We don't need the temporary NIC names anymore, clear them */
     virLXCProcessCleanInterfaces(vm->def);
 
@@ -1554,6 +1654,9 @@ int virLXCProcessStart(virConnectPtr conn,
             goto cleanup;
     }
 
+    virLXCProcessStartPhaseEnd(vm, VIR_LXC_DOMAIN_START_PHASE_FINISH, then);
+    virLXCProcessStartPhaseLog(vm, logfd);
+
     rc = 0;
 
  cleanup:
@@ -1586,19 +1689,32 @@ int virLXCProcessStart(virConnectPtr conn,
     return rc;
 }
 
-struct virLXCProcessAutostartData {
+/* Upper limit of containers started at the same time on autostart */
+#define VIR_LXC_PROCESS_AUTOSTART_WORKERS 8
+
+typedef struct _virLXCProcessAutostartData virLXCProcessAutostartData;
+struct _virLXCProcessAutostartData {
     virLXCDriverPtr driver;
     virConnectPtr conn;
+    virMutex lock;
+    virDomainObjPtr *vms;
+    size_t nvms;
+    size_t next; /* protected by lock */
 };
 
-static int
-virLXCProcessAutostartDomain(virDomainObjPtr vm,
-                             void *opaque)
+static void
+virLXCProcessAutostartDomain(virLXCProcessAutostartData *data,
+                             virDomainObjPtr vm)
 {
-    const struct virLXCProcessAutostartData *data = opaque;
-    int ret = 0;
+    int ret;
 
     virObjectLock(vm);
+    if (virLXCDomainObjBeginJob(data->driver, vm, LXC_JOB_MODIFY) < 0) {
+        VIR_ERROR(_("Failed to start job on VM '%s': %s"),
+                  vm->def->name, virGetLastErrorMessage());
+        goto cleanup;
+    }
+
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
         ret = virLXCProcessStart(data->conn, data->driver, vm,
@@ -1618,8 +1734,32 @@ virLXCProcessAutostartDomain(virDomainObjPtr vm,
                 virObjectEventStateQueue(data->driver->domainEventState, event);
         }
     }
+
+    virLXCDomainObjEndJob(data->driver, vm);
+
+ cleanup:
     virObjectUnlock(vm);
-    return ret;
+}
+
+
+static void
+virLXCProcessAutostartWorker(void *opaque)
+{
+    virLXCProcessAutostartData *data = opaque;
+
+    for (;;) {
+        virDomainObjPtr vm;
+
+        virMutexLock(&data->lock);
+        if (data->next >= data->nvms) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        vm = data->vms[data->next++];
+        virMutexUnlock(&data->lock);
+
+        virLXCProcessAutostartDomain(data, vm);
+    }
 }
 
 
@@ -1634,12 +1774,53 @@ virLXCProcessAutostartAll(virLXCDriverPtr driver)
     virConnectPtr conn = virConnectOpen("lxc:///");
     /* Ignoring NULL conn which is mostly harmless here */
 
-    struct virLXCProcessAutostartData data = { driver, conn };
+    virLXCProcessAutostartData data = { .driver = driver, .conn = conn };
+    virThreadPtr threads = NULL;
+    size_t nworkers;
+    size_t nthreads = 0;
+    size_t i;
+
+    /* Each start mostly waits for its controller to set up the
+     * container, so start a bunch of them at the same time */
+    if (virDomainObjListCollect(driver->domains, conn, &data.vms, &data.nvms,
+                                NULL,
+                                VIR_CONNECT_LIST_DOMAINS_AUTOSTART |
+                                VIR_CONNECT_LIST_DOMAINS_INACTIVE) < 0)
+        goto cleanup;
 
-    virDomainObjListForEach(driver->domains,
-                            virLXCProcessAutostartDomain,
-                            &data);
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        goto cleanup;
+    }
 
+    nworkers = MIN(data.nvms, VIR_LXC_PROCESS_AUTOSTART_WORKERS);
+
+    if (nworkers > 1 && VIR_ALLOC_N(threads, nworkers) == 0) {
+        for (i = 0; i < nworkers; i++) {
+            if (virThreadCreate(&threads[nthreads], true,
+                                virLXCProcessAutostartWorker, &data) < 0) {
+                VIR_WARN("Failed to start autostart worker: %s",
+                         virGetLastErrorMessage());
+                virResetLastError();
+                continue;
+            }
+            nthreads++;
+        }
+    }
+
+    /* Work on whatever is left if no thread could be started */
+    if (nthreads == 0)
+        virLXCProcessAutostartWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virMutexDestroy(&data.lock);
+
+ cleanup:
+    virObjectListFreeCount(data.vms, data.nvms);
+    VIR_FREE(threads);
     virObjectUnref(conn);
 }
 
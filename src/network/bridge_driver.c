@@ -74,6 +74,8 @@
 #include "network_event.h"
 #include "virhook.h"
 #include "virjson.h"
+#include "virtime.h"
+#include "virevent.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 #define MAX_BRIDGE_ID 256
@@ -85,6 +87,11 @@
  */
 #define VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX (32 * 1024 * 1024)
 
+/* dnsmasq refreshes closer to each other than this are coalesced */
+#define NETWORK_DHCP_REFRESH_INTERVAL 500 /* milliseconds */
+
+#define NETWORK_PORT_SYNC_INTERVAL 500 /* milliseconds */
+
 #define SYSCTL_PATH "/proc/sys"
 
 VIR_LOG_INIT("network.bridge_driver");
@@ -143,6 +150,31 @@ networkDnsmasqCapsRefresh(virNetworkDriverStatePtr driver)
 }
 
 
+typedef struct _networkLeaseCache networkLeaseCache;
+typedef networkLeaseCache *networkLeaseCachePtr;
+struct _networkLeaseCache {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    virJSONValuePtr leases;
+};
+
+
+static void
+networkLeaseCacheFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    networkLeaseCachePtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virJSONValueFree(entry->leases);
+    VIR_FREE(entry);
+}
+
+
 static int
 networkStateCleanup(void);
 
@@ -265,6 +297,164 @@ networkRunHook(virNetworkObjPtr obj,
 }
 
 
+typedef enum {
+    NETWORK_PORT_SYNC_STATUS = 1 << 0, /* network status XML */
+    NETWORK_PORT_SYNC_MACMAP = 1 << 1, /* MAC map of the bridge */
+} networkPortSyncFlags;
+
+
+static int
+networkPortSyncWrite(virNetworkDriverStatePtr driver,
+                     virNetworkObjPtr obj,
+                     unsigned int flags)
+{
+    int ret = 0;
+
+    if ((flags & NETWORK_PORT_SYNC_MACMAP) &&
+        virNetworkObjMacMgrSave(obj, driver->dnsmasqStateDir) < 0)
+        ret = -1;
+
+    if ((flags & NETWORK_PORT_SYNC_STATUS) &&
+        virNetworkObjSaveStatus(driver->stateDir, obj) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+typedef struct _networkPortSyncEntry networkPortSyncEntry;
+struct _networkPortSyncEntry {
+    char *name;
+    unsigned int flags;
+};
+
+struct networkPortSyncData {
+    networkPortSyncEntry *entries;
+    size_t nentries;
+};
+
+
+static int
+networkPortSyncCollect(void *payload,
+                       const void *name,
+                       void *opaque)
+{
+    struct networkPortSyncData *data = opaque;
+    networkPortSyncEntry entry = { NULL, *(unsigned int *)payload };
+
+    if (VIR_STRDUP(entry.name, name) < 0 ||
+        VIR_APPEND_ELEMENT(data->entries, data->nentries, entry) < 0) {
+        VIR_FREE(entry.name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* networkPortSyncFlush:
+ *  Write out all the changes queued by networkPortSync.
+ */
+static void
+networkPortSyncFlush(virNetworkDriverStatePtr driver)
+{
+    struct networkPortSyncData data = { NULL, 0 };
+    virNetworkObjPtr obj;
+    size_t i;
+
+    networkDriverLock(driver);
+    if (virHashForEach(driver->portSync, networkPortSyncCollect, &data) < 0)
+        VIR_WARN("unable to collect the pending network state updates");
+    virHashRemoveAll(driver->portSync);
+    if (driver->portSyncTimer >= 0)
+        virEventUpdateTimeout(driver->portSyncTimer, -1);
+    networkDriverUnlock(driver);
+
+    for (i = 0; i < data.nentries; i++) {
+        const char *name = data.entries[i].name;
+
+        if ((obj = virNetworkObjFindByName(driver->networks, name))) {
+            if (virNetworkObjIsActive(obj) &&
+                networkPortSyncWrite(driver, obj, data.entries[i].flags) < 0)
+                VIR_WARN("unable to save state of network '%s'", name);
+
+            virNetworkObjEndAPI(&obj);
+        }
+
+        VIR_FREE(data.entries[i].name);
+    }
+
+    VIR_FREE(data.entries);
+}
+
+
+static void
+networkPortSyncTimer(int timer ATTRIBUTE_UNUSED,
+                     void *opaque)
+{
+    networkPortSyncFlush(opaque);
+}
+
+
+/* networkPortSync:
+ *  Record that the files selected by @flags (networkPortSyncFlags)
+ *  no longer match the in-memory state of @obj, which must be locked.
+ *  Plugging or unplugging a port only changes a few counters, so
+ *  rather than rewriting the files for each port, the writes of a
+ *  burst of plugs (e.g. a mass start of domains) are coalesced and
+ *  done at most once per NETWORK_PORT_SYNC_INTERVAL. Without an
+ *  event loop the files are written right away.
+ *
+ *  Only use this for informational state nothing is rolled back for,
+ *  like the MAC map read by the NSS module. The status XML records
+ *  the QoS accounting and is written synchronously, so that it is not
+ *  lost in a crash and failures can be rolled back.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+static int
+networkPortSync(virNetworkDriverStatePtr driver,
+                virNetworkObjPtr obj,
+                unsigned int flags)
+{
+    virNetworkDefPtr def = virNetworkObjGetDef(obj);
+    unsigned int *pending;
+    bool deferred = false;
+
+    networkDriverLock(driver);
+
+    if (driver->portSyncTimer < 0)
+        driver->portSyncTimer = virEventAddTimeout(-1, networkPortSyncTimer,
+                                                   driver, NULL);
+
+    if (driver->portSyncTimer >= 0) {
+        if ((pending = virHashLookup(driver->portSync, def->name))) {
+            *pending |= flags;
+            deferred = true;
+        } else if (VIR_ALLOC(pending) == 0) {
+            *pending = flags;
+            if (virHashAddEntry(driver->portSync, def->name, pending) < 0) {
+                VIR_FREE(pending);
+            } else {
+                if (virHashSize(driver->portSync) == 1)
+                    virEventUpdateTimeout(driver->portSyncTimer,
+                                          NETWORK_PORT_SYNC_INTERVAL);
+                deferred = true;
+            }
+        }
+    }
+
+    networkDriverUnlock(driver);
+
+    if (deferred) {
+        VIR_DEBUG("Deferring state update of network %s", def->name);
+        return 0;
+    }
+
+    return networkPortSyncWrite(driver, obj, flags);
+}
+
+
 static char *
 networkDnsmasqLeaseFileNameDefault(virNetworkDriverStatePtr driver,
                                    const char *netname)
@@ -374,7 +564,8 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     unlink(customleasefile);
     unlink(configfile);
 
-    /* MAC map manager */
+    /* MAC map manager; a queued write must not recreate the file */
+    virFileRewriteAsyncFlush();
     unlink(macMapFile);
 
     /* radvd */
@@ -671,6 +862,13 @@ networkStateInitialize(bool privileged,
         goto error;
     }
 
+    network_driver->dhcpRefreshTimer = -1;
+    network_driver->portSyncTimer = -1;
+    if (!(network_driver->dhcpRefresh = virHashCreate(0, virHashValueFree)) ||
+        !(network_driver->portSync = virHashCreate(0, virHashValueFree)) ||
+        !(network_driver->leaseCache = virHashCreate(0, networkLeaseCacheFree)))
+        goto error;
+
     /* configuration/state paths are one of
      * ~/.config/libvirt/... (session/unprivileged)
      * /etc/libvirt/... && /var/(run|lib)/libvirt/... (system/privileged).
@@ -848,6 +1046,14 @@ networkStateCleanup(void)
 
     virObjectUnref(network_driver->networkEventState);
 
+    /* the networks keep running, so their files must be up to date */
+    if (network_driver->portSync)
+        networkPortSyncFlush(network_driver);
+    virFileRewriteAsyncFlush();
+    if (network_driver->portSyncTimer >= 0)
+        virEventRemoveTimeout(network_driver->portSyncTimer);
+    virHashFree(network_driver->portSync);
+
     /* free inactive networks */
     virObjectUnref(network_driver->networks);
 
@@ -860,6 +1066,11 @@ networkStateCleanup(void)
 
     virObjectUnref(network_driver->dnsmasqCaps);
 
+    if (network_driver->dhcpRefreshTimer >= 0)
+        virEventRemoveTimeout(network_driver->dhcpRefreshTimer);
+    virHashFree(network_driver->dhcpRefresh);
+    virHashFree(network_driver->leaseCache);
+
     virMutexDestroy(&network_driver->lock);
 
     VIR_FREE(network_driver);
@@ -1699,6 +1910,136 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
 }
 
 
+typedef struct _networkDhcpRefresh networkDhcpRefresh;
+typedef networkDhcpRefresh *networkDhcpRefreshPtr;
+struct _networkDhcpRefresh {
+    unsigned long long last; /* time of the last refresh */
+    bool pending;
+};
+
+
+static int
+networkDhcpRefreshCollect(void *payload,
+                          const void *name,
+                          void *opaque)
+{
+    networkDhcpRefreshPtr refresh = payload;
+    char ***names = opaque;
+    char **tmp;
+
+    if (!refresh->pending)
+        return 0;
+
+    if (!(tmp = virStringListAdd((const char **)*names, name)))
+        return -1;
+
+    virStringListFree(*names);
+    *names = tmp;
+    refresh->pending = false;
+    ignore_value(virTimeMillisNow(&refresh->last));
+    return 0;
+}
+
+
+static void
+networkDhcpRefreshTimer(int timer,
+                        void *opaque)
+{
+    virNetworkDriverStatePtr driver = opaque;
+    virNetworkObjPtr obj;
+    char **names = NULL;
+    size_t i;
+
+    networkDriverLock(driver);
+    if (virHashForEach(driver->dhcpRefresh,
+                       networkDhcpRefreshCollect, &names) < 0)
+        VIR_WARN("unable to collect the pending dnsmasq refreshes");
+    virEventUpdateTimeout(timer, -1);
+    networkDriverUnlock(driver);
+
+    for (i = 0; names && names[i]; i++) {
+        if (!(obj = virNetworkObjFindByName(driver->networks, names[i])))
+            continue;
+
+        if (virNetworkObjIsActive(obj) &&
+            networkRefreshDhcpDaemon(driver, obj) < 0)
+            VIR_WARN("unable to refresh dnsmasq for network '%s'", names[i]);
+
+        virNetworkObjEndAPI(&obj);
+    }
+
+    virStringListFree(names);
+}
+
+
+/* networkScheduleRefreshDhcpDaemon:
+ *  Like networkRefreshDhcpDaemon, but if dnsmasq was refreshed less
+ *  than NETWORK_DHCP_REFRESH_INTERVAL ago, only schedule another
+ *  refresh for when the interval is over. A burst of updates of the
+ *  host entries thus rewrites the hosts files and signals dnsmasq a
+ *  couple of times rather than once per update.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+static int
+networkScheduleRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
+                                 virNetworkObjPtr obj)
+{
+    virNetworkDefPtr def = virNetworkObjGetDef(obj);
+    networkDhcpRefreshPtr refresh;
+    unsigned long long now;
+    bool immediate = true;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    networkDriverLock(driver);
+
+    if (!(refresh = virHashLookup(driver->dhcpRefresh, def->name))) {
+        if (VIR_ALLOC(refresh) < 0)
+            goto cleanup;
+
+        if (virHashAddEntry(driver->dhcpRefresh, def->name, refresh) < 0) {
+            VIR_FREE(refresh);
+            goto cleanup;
+        }
+    }
+
+    if (refresh->pending) {
+        immediate = false;
+    } else if (now < refresh->last + NETWORK_DHCP_REFRESH_INTERVAL) {
+        /* without an event loop there's nothing to defer to */
+        if (driver->dhcpRefreshTimer < 0)
+            driver->dhcpRefreshTimer = virEventAddTimeout(-1,
+                                                          networkDhcpRefreshTimer,
+                                                          driver, NULL);
+
+        if (driver->dhcpRefreshTimer >= 0) {
+            VIR_DEBUG("Deferring refresh of dnsmasq for network %s",
+                      def->name);
+            refresh->pending = true;
+            virEventUpdateTimeout(driver->dhcpRefreshTimer,
+                                  NETWORK_DHCP_REFRESH_INTERVAL);
+            immediate = false;
+        }
+    }
+
+    if (immediate)
+        refresh->last = now;
+
+    ret = 0;
+
+ cleanup:
+    networkDriverUnlock(driver);
+
+    if (ret == 0 && immediate)
+        ret = networkRefreshDhcpDaemon(driver, obj);
+
+    return ret;
+}
+
+
 /* networkRestartDhcpDaemon:
  *
  * kill and restart dnsmasq, in order to update any config that is on
@@ -2057,8 +2398,9 @@ networkRefreshDaemons(virNetworkDriverStatePtr driver)
 
 static int
 networkReloadFirewallRulesHelper(virNetworkObjPtr obj,
-                                 void *opaque ATTRIBUTE_UNUSED)
+                                 void *opaque)
 {
+    virFirewallSnapshotPtr snapshot = opaque;
     virNetworkDefPtr def;
 
     virObjectLock(obj);
@@ -2071,10 +2413,19 @@ networkReloadFirewallRulesHelper(virNetworkObjPtr obj,
          * libvirt need to have iptables rules reloaded. The 4th L3
          * network type, forward='open', doesn't need this because it
          * has no iptables rules.
+         *
+         * Rules which are all still in place, e.g. after a plain
+         * libvirtd restart, are left alone rather than being removed
+         * and added again.
          */
-        networkRemoveFirewallRules(def);
-        if (networkAddFirewallRules(def) < 0) {
-            /* failed to add but already logged */
+        if (snapshot && networkFirewallRulesPresent(def, snapshot)) {
+            VIR_DEBUG("Firewall rules for network '%s' are in place",
+                      def->name);
+        } else {
+            networkRemoveFirewallRules(def);
+            if (networkAddFirewallRules(def) < 0) {
+                /* failed to add but already logged */
+            }
         }
     }
     virObjectUnlock(obj);
@@ -2085,10 +2436,20 @@ networkReloadFirewallRulesHelper(virNetworkObjPtr obj,
 static void
 networkReloadFirewallRules(virNetworkDriverStatePtr driver)
 {
+    virFirewallSnapshotPtr snapshot;
+
     VIR_INFO("Reloading iptables rules");
+
+    if (!(snapshot = virFirewallSnapshotNew())) {
+        VIR_WARN("Unable to read existing firewall rules, "
+                 "reapplying all of them: %s", virGetLastErrorMessage());
+        virResetLastError();
+    }
+
     virNetworkObjListForEach(driver->networks,
                              networkReloadFirewallRulesHelper,
-                             NULL);
+                             snapshot);
+    virFirewallSnapshotFree(snapshot);
 }
 
 
@@ -3777,7 +4138,7 @@ networkUpdate(virNetworkPtr net,
 
             if ((newDhcpActive != oldDhcpActive &&
                  networkRestartDhcpDaemon(driver, obj) < 0) ||
-                networkRefreshDhcpDaemon(driver, obj) < 0) {
+                networkScheduleRefreshDhcpDaemon(driver, obj) < 0) {
                 goto cleanup;
             }
 
@@ -3786,7 +4147,7 @@ networkUpdate(virNetworkPtr net,
              * (not the .conf file) so we can just update the config
              * files and send SIGHUP to dnsmasq.
              */
-            if (networkRefreshDhcpDaemon(driver, obj) < 0)
+            if (networkScheduleRefreshDhcpDaemon(driver, obj) < 0)
                 goto cleanup;
 
         }
@@ -4050,6 +4411,85 @@ networkSetAutostart(virNetworkPtr net,
 }
 
 
+/* networkDnsmasqLeasesGet:
+ *  Parse the custom lease file @path, reusing the result of a previous
+ *  call as long as the file was not rewritten in the meantime. The
+ *  array stored in @leases, which is NULL for a missing or empty file,
+ *  is owned by the cache and may only be used with the driver locked.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+static int
+networkDnsmasqLeasesGet(virNetworkDriverStatePtr driver,
+                        const char *path,
+                        virJSONValuePtr *leases)
+{
+    networkLeaseCachePtr entry = NULL;
+    struct stat sb;
+    char *contents = NULL;
+    int fd = -1;
+    int len;
+    int ret = -1;
+
+    *leases = NULL;
+
+    /* Even though src/network/leaseshelper.c guarantees the existence of
+     * leases file (even if no leases are present), and the control reaches
+     * here, instead of reporting error, return 0 leases */
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        fstat(fd, &sb) < 0) {
+        ignore_value(virHashRemoveEntry(driver->leaseCache, path));
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* leaseshelper replaces the file on every change */
+    if ((entry = virHashLookup(driver->leaseCache, path)) &&
+        entry->dev == sb.st_dev && entry->ino == sb.st_ino &&
+        entry->size == sb.st_size && entry->mtime == sb.st_mtime) {
+        *leases = entry->leases;
+        entry = NULL;
+        ret = 0;
+        goto cleanup;
+    }
+    entry = NULL;
+    ignore_value(virHashRemoveEntry(driver->leaseCache, path));
+
+    if ((len = virFileReadLimFD(fd, VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
+                                &contents)) <= 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(entry) < 0)
+        goto cleanup;
+
+    if (!(entry->leases = virJSONValueFromString(contents))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid json in file: %s"), path);
+        goto cleanup;
+    }
+
+    entry->dev = sb.st_dev;
+    entry->ino = sb.st_ino;
+    entry->size = sb.st_size;
+    entry->mtime = sb.st_mtime;
+
+    if (virHashAddEntry(driver->leaseCache, path, entry) < 0)
+        goto cleanup;
+
+    *leases = entry->leases;
+    entry = NULL;
+    ret = 0;
+
+ cleanup:
+    networkLeaseCacheFree(entry, NULL);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(contents);
+    return ret;
+}
+
+
 static int
 networkGetDHCPLeases(virNetworkPtr net,
                      const char *mac,
@@ -4061,12 +4501,11 @@ networkGetDHCPLeases(virNetworkPtr net,
     size_t nleases = 0;
     int rv = -1;
     ssize_t size = 0;
-    int custom_lease_file_len = 0;
     bool need_results = !!leases;
     long long currtime = 0;
     long long expirytime_tmp = -1;
     bool ipv6 = false;
-    char *lease_entries = NULL;
+    bool locked = false;
     char *custom_lease_file = NULL;
     const char *ip_tmp = NULL;
     const char *mac_tmp = NULL;
@@ -4097,24 +4536,13 @@ networkGetDHCPLeases(virNetworkPtr net,
     /* Retrieve custom leases file location */
     custom_lease_file = networkDnsmasqLeaseFileNameCustom(driver, def->bridge);
 
-    /* Read entire contents */
-    if ((custom_lease_file_len = virFileReadAll(custom_lease_file,
-                                                VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
-                                                &lease_entries)) < 0) {
-        /* Even though src/network/leaseshelper.c guarantees the existence of
-         * leases file (even if no leases are present), and the control reaches
-         * here, instead of reporting error, return 0 leases */
-        rv = 0;
-        goto error;
-    }
+    networkDriverLock(driver);
+    locked = true;
 
-    if (custom_lease_file_len) {
-        if (!(leases_array = virJSONValueFromString(lease_entries))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("invalid json in file: %s"), custom_lease_file);
-            goto error;
-        }
+    if (networkDnsmasqLeasesGet(driver, custom_lease_file, &leases_array) < 0)
+        goto error;
 
+    if (leases_array) {
         if ((size = virJSONValueArraySize(leases_array)) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("couldn't fetch array of leases"));
@@ -4222,10 +4650,10 @@ networkGetDHCPLeases(virNetworkPtr net,
     rv = nleases;
 
  cleanup:
+    if (locked)
+        networkDriverUnlock(driver);
     VIR_FREE(lease);
-    VIR_FREE(lease_entries);
     VIR_FREE(custom_lease_file);
-    virJSONValueFree(leases_array);
 
     virNetworkObjEndAPI(&obj);
 
@@ -4666,8 +5094,8 @@ networkAllocateActualDevice(virDomainDefPtr dom,
         }
     }
 
-    if (virNetworkObjMacMgrAdd(obj, driver->dnsmasqStateDir,
-                               dom->name, &iface->mac) < 0)
+    if (virNetworkObjMacMgrAdd(obj, dom->name, &iface->mac) < 0 ||
+        networkPortSync(driver, obj, NETWORK_PORT_SYNC_MACMAP) < 0)
         goto error;
 
     if (virNetDevVPortProfileCheckComplete(virtport, true) < 0)
@@ -5089,7 +5517,8 @@ networkReleaseActualDevice(virDomainDefPtr dom,
     }
 
  success:
-    virNetworkObjMacMgrDel(obj, driver->dnsmasqStateDir, dom->name, &iface->mac);
+    if (virNetworkObjMacMgrDel(obj, dom->name, &iface->mac) == 0)
+        ignore_value(networkPortSync(driver, obj, NETWORK_PORT_SYNC_MACMAP));
 
     if (iface->data.network.actual) {
         netdef->connections--;
@@ -5436,7 +5865,8 @@ networkPlugBandwidthImpl(virNetworkObjPtr obj,
     /* update sum of 'floor'-s of attached NICs */
     tmp_floor_sum += ifaceBand->in->floor;
     virNetworkObjSetFloorSum(obj, tmp_floor_sum);
-    /* update status file */
+    /* update status file right away, the floor sum and class IDs
+     * could not be recovered after a crash otherwise */
     if (virNetworkObjSaveStatus(driver->stateDir, obj) < 0) {
         ignore_value(virBitmapClearBit(classIdMap, class_id));
         tmp_floor_sum -= ifaceBand->in->floor;
@@ -5535,7 +5965,7 @@ networkUnplugBandwidth(virNetworkObjPtr obj,
         /* return class ID */
         ignore_value(virBitmapClearBit(classIdMap,
                                        iface->data.network.actual->class_id));
-        /* update status file */
+        /* update status file right away, see networkPlugBandwidthImpl */
         if (virNetworkObjSaveStatus(driver->stateDir, obj) < 0) {
             tmp_floor_sum += ifaceBand->in->floor;
             virNetworkObjSetFloorSum(obj, tmp_floor_sum);
@@ -633,13 +633,13 @@ networkRemoveIPSpecificFirewallRules(virFirewallPtr fw,
 }
 
 
-/* Add all rules for all ip addresses (and general rules) on a network */
-int networkAddFirewallRules(virNetworkDefPtr def)
+/* Build the rules for all ip addresses (and general rules) on a network */
+static virFirewallPtr
+networkBuildFirewallRules(virNetworkDefPtr def)
 {
     size_t i;
     virNetworkIPDefPtr ipdef;
     virFirewallPtr fw = NULL;
-    int ret = -1;
 
     fw = virFirewallNew();
 
@@ -651,7 +651,7 @@ int networkAddFirewallRules(virNetworkDefPtr def)
          (ipdef = virNetworkDefGetIPByIndex(def, AF_UNSPEC, i));
          i++) {
         if (networkAddIPSpecificFirewallRules(fw, def, ipdef) < 0)
-            goto cleanup;
+            goto error;
     }
 
     virFirewallStartRollback(fw, 0);
@@ -660,13 +660,29 @@ int networkAddFirewallRules(virNetworkDefPtr def)
          (ipdef = virNetworkDefGetIPByIndex(def, AF_UNSPEC, i));
          i++) {
         if (networkRemoveIPSpecificFirewallRules(fw, def, ipdef) < 0)
-            goto cleanup;
+            goto error;
     }
     networkRemoveGeneralFirewallRules(fw, def);
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
     networkAddChecksumFirewallRules(fw, def);
 
+    return fw;
+
+ error:
+    virFirewallFree(fw);
+    return NULL;
+}
+
+/* Add all rules for all ip addresses (and general rules) on a network */
+int networkAddFirewallRules(virNetworkDefPtr def)
+{
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+
+    if (!(fw = networkBuildFirewallRules(def)))
+        goto cleanup;
+
     if (virFirewallApply(fw) < 0)
         goto cleanup;
 
@@ -676,6 +692,24 @@ int networkAddFirewallRules(virNetworkDefPtr def)
     return ret;
 }
 
+/* Check if all rules a network needs are already in @snapshot */
+bool networkFirewallRulesPresent(virNetworkDefPtr def,
+                                 virFirewallSnapshotPtr snapshot)
+{
+    virFirewallPtr fw = NULL;
+    bool ret = false;
+
+    if (!(fw = networkBuildFirewallRules(def))) {
+        virResetLastError();
+        return false;
+    }
+
+    ret = virFirewallIsApplied(fw, snapshot);
+
+    virFirewallFree(fw);
+    return ret;
+}
+
 /* Remove all rules for all ip addresses (and general rules) on a network */
 void networkRemoveFirewallRules(virNetworkDefPtr def)
 {
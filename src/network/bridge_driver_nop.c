@@ -34,3 +34,9 @@ int networkAddFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 void networkRemoveFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 {
 }
+
+bool networkFirewallRulesPresent(virNetworkDefPtr def ATTRIBUTE_UNUSED,
+                                 virFirewallSnapshotPtr snapshot ATTRIBUTE_UNUSED)
+{
+    return true;
+}
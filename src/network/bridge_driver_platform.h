@@ -29,6 +29,8 @@
 # include "virdnsmasq.h"
 # include "virnetworkobj.h"
 # include "object_event.h"
+# include "virhash.h"
+# include "virfirewall.h"
 
 /* Main driver state */
 struct _virNetworkDriverState {
@@ -52,6 +54,19 @@ struct _virNetworkDriverState {
 
     /* Immutable pointer, self-locking APIs */
     virObjectEventStatePtr networkEventState;
+
+    /* Require lock: coalescing of dnsmasq refreshes, keyed by
+     * network name */
+    virHashTablePtr dhcpRefresh;
+    int dhcpRefreshTimer;
+
+    /* Require lock: status and MAC map files with changes still to
+     * be written out, keyed by network name */
+    virHashTablePtr portSync;
+    int portSyncTimer;
+
+    /* Require lock: parsed lease files, keyed by path */
+    virHashTablePtr leaseCache;
 };
 
 typedef struct _virNetworkDriverState virNetworkDriverState;
@@ -63,4 +78,7 @@ int networkAddFirewallRules(virNetworkDefPtr def);
 
 void networkRemoveFirewallRules(virNetworkDefPtr def);
 
+bool networkFirewallRulesPresent(virNetworkDefPtr def,
+                                 virFirewallSnapshotPtr snapshot);
+
 #endif /* __VIR_BRIDGE_DRIVER_PLATFORM_H__ */
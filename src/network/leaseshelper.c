@@ -243,6 +243,15 @@ main(int argc, char **argv)
         /* Write to file */
         if (virFileRewriteStr(custom_lease_file, 0644, leases_str) < 0)
             goto cleanup;
+
+        /* Republish the index used by the NSS modules. We hold the
+         * pidfile, so no other helper can be rebuilding it. Failing
+         * to do so is not fatal, the NSS modules notice that the index
+         * is out of date and read the lease files instead. */
+        if (virLeaseIndexRebuild(LOCALSTATEDIR "/lib/libvirt/dnsmasq",
+                                 LOCALSTATEDIR "/lib/libvirt/dnsmasq/"
+                                 VIR_LEASE_INDEX_FILE) < 0)
+            virResetLastError();
         break;
 
     case VIR_LEASE_ACTION_LAST:
@@ -73,6 +73,13 @@ nodeDeviceUpdateCaps(virNodeDeviceDefPtr def)
            if (nodeDeviceSysfsGetPCIRelatedDevCaps(def->sysfs_path,
                                                    &cap->data.pci_dev) < 0)
               return -1;
+           /* We need to be root to read PCI device configs */
+           if (driver->privileged && !cap->data.pci_dev.configLoaded &&
+               nodeDeviceSysfsGetPCIConfigCaps(&cap->data.pci_dev) < 0)
+              return -1;
+           if (nodeDeviceSysfsGetPCIMdevTypesCaps(def->sysfs_path,
+                                                  &cap->data.pci_dev) < 0)
+              return -1;
            break;
 
         /* all types that (supposedly) don't require any updates
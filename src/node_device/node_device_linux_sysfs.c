@@ -35,6 +35,7 @@
 #include "virfcp.h"
 #include "virlog.h"
 #include "virfile.h"
+#include "virpci.h"
 #include "virscsihost.h"
 #include "virstring.h"
 #include "virvhba.h"
@@ -194,6 +195,142 @@ nodeDeviceSysfsGetPCIRelatedDevCaps(const char *sysfsPath,
 }
 
 
+/* nodeDeviceSysfsGetPCIConfigCaps() reads the data stored in the PCI
+ * config space of the device, i.e. the header type and the PCI Express
+ * link capabilities and status. Accessing the config space requires root
+ * privileges and is slow enough for it to be postponed until the full
+ * XML of the device is requested for the first time.
+ */
+int
+nodeDeviceSysfsGetPCIConfigCaps(virNodeDevCapPCIDevPtr pci_dev)
+{
+    virPCIDevicePtr pciDev = NULL;
+    virPCIEDeviceInfoPtr pci_express = NULL;
+    int ret = -1;
+
+    if (!(pciDev = virPCIDeviceNew(pci_dev->domain,
+                                   pci_dev->bus,
+                                   pci_dev->slot,
+                                   pci_dev->function)))
+        goto cleanup;
+
+    if (virPCIGetHeaderType(pciDev, &pci_dev->hdrType) < 0)
+        goto cleanup;
+
+    if (virPCIDeviceIsPCIExpress(pciDev) > 0) {
+        if (VIR_ALLOC(pci_express) < 0)
+            goto cleanup;
+
+        if (virPCIDeviceHasPCIExpressLink(pciDev) > 0) {
+            if (VIR_ALLOC(pci_express->link_cap) < 0 ||
+                VIR_ALLOC(pci_express->link_sta) < 0)
+                goto cleanup;
+
+            if (virPCIDeviceGetLinkCapSta(pciDev,
+                                          &pci_express->link_cap->port,
+                                          &pci_express->link_cap->speed,
+                                          &pci_express->link_cap->width,
+                                          &pci_express->link_sta->speed,
+                                          &pci_express->link_sta->width) < 0)
+                goto cleanup;
+
+            pci_express->link_sta->port = -1; /* PCIe can't negotiate port. Yet :) */
+        }
+        virPCIEDeviceInfoFree(pci_dev->pci_express);
+        VIR_STEAL_PTR(pci_dev->pci_express, pci_express);
+        pci_dev->flags |= VIR_NODE_DEV_CAP_FLAG_PCIE;
+    }
+
+    pci_dev->configLoaded = true;
+    ret = 0;
+
+ cleanup:
+    virPCIDeviceFree(pciDev);
+    virPCIEDeviceInfoFree(pci_express);
+    return ret;
+}
+
+
+static int
+nodeDeviceSysfsGetPCIMdevType(const char *dir,
+                              const char *id,
+                              virNodeDevCapMdevTypePtr type)
+{
+    if (VIR_STRDUP(type->id, id) < 0)
+        return -1;
+
+    if (virFileReadValueString(&type->name, "%s/%s/name", dir, id) == -1)
+        return -1;
+
+    if (virFileReadValueString(&type->device_api, "%s/%s/device_api",
+                               dir, id) < 0)
+        return -1;
+
+    if (virFileReadValueUint(&type->available_instances,
+                             "%s/%s/available_instances", dir, id) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* nodeDeviceSysfsGetPCIMdevTypesCaps() gets the mediated device types
+ * supported by the device. The number of available instances changes
+ * whenever a mediated device is created or removed, so this must be
+ * refreshed anytime full XML of the device is requested.
+ */
+int
+nodeDeviceSysfsGetPCIMdevTypesCaps(const char *sysfsPath,
+                                   virNodeDevCapPCIDevPtr pci_dev)
+{
+    int ret = -1;
+    int dirret = -1;
+    DIR *dir = NULL;
+    struct dirent *entry;
+    char *path = NULL;
+    virNodeDevCapMdevTypePtr type = NULL;
+    size_t i;
+
+    /* this could be a refresh, so clear out the old data */
+    for (i = 0; i < pci_dev->nmdev_types; i++)
+        virNodeDevCapMdevTypeFree(pci_dev->mdev_types[i]);
+    VIR_FREE(pci_dev->mdev_types);
+    pci_dev->nmdev_types = 0;
+    pci_dev->flags &= ~VIR_NODE_DEV_CAP_FLAG_PCI_MDEV;
+
+    if (virAsprintf(&path, "%s/mdev_supported_types", sysfsPath) < 0)
+        return -1;
+
+    if ((dirret = virDirOpenIfExists(&dir, path)) <= 0) {
+        ret = dirret;
+        goto cleanup;
+    }
+
+    while ((dirret = virDirRead(dir, &entry, path)) > 0) {
+        if (VIR_ALLOC(type) < 0)
+            goto cleanup;
+
+        if (nodeDeviceSysfsGetPCIMdevType(path, entry->d_name, type) < 0)
+            goto cleanup;
+
+        if (VIR_APPEND_ELEMENT(pci_dev->mdev_types,
+                               pci_dev->nmdev_types, type) < 0)
+            goto cleanup;
+    }
+
+    if (dirret < 0)
+        goto cleanup;
+
+    pci_dev->flags |= VIR_NODE_DEV_CAP_FLAG_PCI_MDEV;
+    ret = 0;
+ cleanup:
+    virNodeDevCapMdevTypeFree(type);
+    VIR_FREE(path);
+    VIR_DIR_CLOSE(dir);
+    return ret;
+}
+
+
 #else
 
 int
@@ -215,4 +352,17 @@ nodeDeviceSysfsGetPCIRelatedDevCaps(const char *sysfsPath ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+nodeDeviceSysfsGetPCIConfigCaps(virNodeDevCapPCIDevPtr pci_dev ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int
+nodeDeviceSysfsGetPCIMdevTypesCaps(const char *sysfsPath ATTRIBUTE_UNUSED,
+                                   virNodeDevCapPCIDevPtr pci_dev ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
 #endif /* __linux__ */
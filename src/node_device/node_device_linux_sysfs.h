@@ -30,5 +30,8 @@ int nodeDeviceSysfsGetSCSITargetCaps(const char *sysfsPath,
                                      virNodeDevCapSCSITargetPtr scsi_target);
 int nodeDeviceSysfsGetPCIRelatedDevCaps(const char *sysfsPath,
                                         virNodeDevCapPCIDevPtr pci_dev);
+int nodeDeviceSysfsGetPCIConfigCaps(virNodeDevCapPCIDevPtr pci_dev);
+int nodeDeviceSysfsGetPCIMdevTypesCaps(const char *sysfsPath,
+                                       virNodeDevCapPCIDevPtr pci_dev);
 
 #endif /* __VIR_NODE_DEVICE_LINUX_SYSFS_H__ */
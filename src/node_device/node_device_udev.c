@@ -44,6 +44,7 @@
 #include "virstring.h"
 #include "virnetdev.h"
 #include "virmdev.h"
+#include "virhostcpu.h"
 
 #define VIR_FROM_THIS VIR_FROM_NODEDEV
 
@@ -67,6 +68,10 @@ struct _udevEventData {
     virCond threadCond;
     bool threadQuit;
     bool dataReady;
+
+    /* Initial enumeration of existing devices */
+    virThread enumThread;
+    bool enumThreadRunning;
 };
 
 static virClassPtr udevEventDataClass;
@@ -361,6 +366,10 @@ udevLogFunction(struct udev *udev ATTRIBUTE_UNUSED,
 #endif
 
 
+/* libpciaccess' ID database lookup isn't thread safe and both the initial
+ * enumeration and the udev event handler thread may call it */
+static virMutex udevPCITranslateLock = VIR_MUTEX_INITIALIZER;
+
 static int
 udevTranslatePCIIds(unsigned int vendor,
                     unsigned int product,
@@ -369,6 +378,7 @@ udevTranslatePCIIds(unsigned int vendor,
 {
     struct pci_id_match m;
     const char *vendor_name = NULL, *device_name = NULL;
+    int ret = 0;
 
     m.vendor_id = vendor;
     m.device_id = product;
@@ -378,6 +388,8 @@ udevTranslatePCIIds(unsigned int vendor,
     m.device_class_mask = 0;
     m.match_data = 0;
 
+    virMutexLock(&udevPCITranslateLock);
+
     /* pci_get_strings returns void */
     pci_get_strings(&m,
                     &device_name,
@@ -387,121 +399,10 @@ udevTranslatePCIIds(unsigned int vendor,
 
     if (VIR_STRDUP(*vendor_string, vendor_name) < 0 ||
         VIR_STRDUP(*product_string, device_name) < 0)
-        return -1;
+        ret = -1;
 
-    return 0;
-}
-
-
-static int
-udevFillMdevType(struct udev_device *device,
-                 const char *dir,
-                 virNodeDevCapMdevTypePtr type)
-{
-    int ret = -1;
-    char *attrpath = NULL;
-
-#define MDEV_GET_SYSFS_ATTR(attr_name, cb, ...) \
-    do { \
-        if (virAsprintf(&attrpath, "%s/%s", dir, #attr_name) < 0) \
-            goto cleanup; \
- \
-        if (cb(device, attrpath, __VA_ARGS__) < 0) \
-            goto cleanup; \
- \
-        VIR_FREE(attrpath); \
-    } while (0) \
-
-    if (VIR_STRDUP(type->id, last_component(dir)) < 0)
-        goto cleanup;
+    virMutexUnlock(&udevPCITranslateLock);
 
-    /* query udev for the attributes under subdirectories using the relative
-     * path stored in @dir, i.e. 'mdev_supported_types/<type_id>'
-     */
-    MDEV_GET_SYSFS_ATTR(name, udevGetStringSysfsAttr, &type->name);
-    MDEV_GET_SYSFS_ATTR(device_api, udevGetStringSysfsAttr, &type->device_api);
-    MDEV_GET_SYSFS_ATTR(available_instances, udevGetUintSysfsAttr,
-                        &type->available_instances, 10);
-
-#undef MDEV_GET_SYSFS_ATTR
-
-    ret = 0;
- cleanup:
-    VIR_FREE(attrpath);
-    return ret;
-}
-
-
-static int
-udevPCIGetMdevTypesCap(struct udev_device *device,
-                       virNodeDevCapPCIDevPtr pcidata)
-{
-    int ret = -1;
-    int dirret = -1;
-    DIR *dir = NULL;
-    struct dirent *entry;
-    char *path = NULL;
-    char *tmppath = NULL;
-    virNodeDevCapMdevTypePtr type = NULL;
-    virNodeDevCapMdevTypePtr *types = NULL;
-    size_t ntypes = 0;
-    size_t i;
-
-    if (virAsprintf(&path, "%s/mdev_supported_types",
-                    udev_device_get_syspath(device)) < 0)
-        return -1;
-
-    if ((dirret = virDirOpenIfExists(&dir, path)) < 0)
-        goto cleanup;
-
-    if (dirret == 0) {
-        ret = 0;
-        goto cleanup;
-    }
-
-    if (VIR_ALLOC(types) < 0)
-        goto cleanup;
-
-    /* UDEV doesn't report attributes under subdirectories by default but is
-     * able to query them if the path to the attribute is relative to the
-     * device's base path, e.g. /sys/devices/../0000:00:01.0/ is the device's
-     * base path as udev reports it, but we're interested in attributes under
-     * /sys/devices/../0000:00:01.0/mdev_supported_types/<type>/. So, we need to
-     * scan the subdirectories ourselves.
-     */
-    while ((dirret = virDirRead(dir, &entry, path)) > 0) {
-        if (VIR_ALLOC(type) < 0)
-            goto cleanup;
-
-        /* construct the relative mdev type path bit for udev */
-        if (virAsprintf(&tmppath, "mdev_supported_types/%s", entry->d_name) < 0)
-            goto cleanup;
-
-        if (udevFillMdevType(device, tmppath, type) < 0)
-            goto cleanup;
-
-        if (VIR_APPEND_ELEMENT(types, ntypes, type) < 0)
-            goto cleanup;
-
-        VIR_FREE(tmppath);
-    }
-
-    if (dirret < 0)
-        goto cleanup;
-
-    VIR_STEAL_PTR(pcidata->mdev_types, types);
-    pcidata->nmdev_types = ntypes;
-    pcidata->flags |= VIR_NODE_DEV_CAP_FLAG_PCI_MDEV;
-    ntypes = 0;
-    ret = 0;
- cleanup:
-    virNodeDevCapMdevTypeFree(type);
-    for (i = 0; i < ntypes; i++)
-        virNodeDevCapMdevTypeFree(types[i]);
-    VIR_FREE(types);
-    VIR_FREE(path);
-    VIR_FREE(tmppath);
-    VIR_DIR_CLOSE(dir);
     return ret;
 }
 
@@ -511,15 +412,9 @@ udevProcessPCI(struct udev_device *device,
                virNodeDeviceDefPtr def)
 {
     virNodeDevCapPCIDevPtr pci_dev = &def->caps->data.pci_dev;
-    virPCIEDeviceInfoPtr pci_express = NULL;
-    virPCIDevicePtr pciDev = NULL;
+    char *mdevTypesPath = NULL;
     int ret = -1;
     char *p;
-    bool privileged;
-
-    nodeDeviceLock();
-    privileged = driver->privileged;
-    nodeDeviceUnlock();
 
     if (udevGetUintProperty(device, "PCI_CLASS", &pci_dev->class, 16) < 0)
         goto cleanup;
@@ -561,53 +456,22 @@ udevProcessPCI(struct udev_device *device,
     if (nodeDeviceSysfsGetPCIRelatedDevCaps(def->sysfs_path, pci_dev) < 0)
         goto cleanup;
 
-    if (!(pciDev = virPCIDeviceNew(pci_dev->domain,
-                                   pci_dev->bus,
-                                   pci_dev->slot,
-                                   pci_dev->function)))
+    /* Reading the PCI config space (header type, PCIe link) and the
+     * mdev types is comparatively expensive and only needed once the full
+     * XML of the device is requested, see nodeDeviceUpdateCaps(). Just
+     * note whether the device is mediated devices framework capable so
+     * that listing devices by capability works. */
+    if (virAsprintf(&mdevTypesPath, "%s/mdev_supported_types",
+                    def->sysfs_path) < 0)
         goto cleanup;
 
-    /* We need to be root to read PCI device configs */
-    if (privileged) {
-        if (virPCIGetHeaderType(pciDev, &pci_dev->hdrType) < 0)
-            goto cleanup;
-
-        if (virPCIDeviceIsPCIExpress(pciDev) > 0) {
-            if (VIR_ALLOC(pci_express) < 0)
-                goto cleanup;
-
-            if (virPCIDeviceHasPCIExpressLink(pciDev) > 0) {
-                if (VIR_ALLOC(pci_express->link_cap) < 0 ||
-                    VIR_ALLOC(pci_express->link_sta) < 0)
-                    goto cleanup;
-
-                if (virPCIDeviceGetLinkCapSta(pciDev,
-                                              &pci_express->link_cap->port,
-                                              &pci_express->link_cap->speed,
-                                              &pci_express->link_cap->width,
-                                              &pci_express->link_sta->speed,
-                                              &pci_express->link_sta->width) < 0)
-                    goto cleanup;
-
-                pci_express->link_sta->port = -1; /* PCIe can't negotiate port. Yet :) */
-            }
-            pci_dev->flags |= VIR_NODE_DEV_CAP_FLAG_PCIE;
-            pci_dev->pci_express = pci_express;
-            pci_express = NULL;
-        }
-    }
-
-    /* check whether the device is mediated devices framework capable, if so,
-     * process it
-     */
-    if (udevPCIGetMdevTypesCap(device, pci_dev) < 0)
-        goto cleanup;
+    if (virFileExists(mdevTypesPath))
+        pci_dev->flags |= VIR_NODE_DEV_CAP_FLAG_PCI_MDEV;
 
     ret = 0;
 
  cleanup:
-    virPCIDeviceFree(pciDev);
-    virPCIEDeviceInfoFree(pci_express);
+    VIR_FREE(mdevTypesPath);
     return ret;
 }
 
@@ -1596,6 +1460,22 @@ udevEnumerateAddMatches(struct udev_enumerate *udev_enumerate)
 }
 
 
+/* Returns true if the driver is being shut down, in which case the
+ * initial enumeration should be abandoned. */
+static bool
+udevEnumerateShouldQuit(void)
+{
+    udevEventDataPtr priv = driver->privateData;
+    bool ret;
+
+    virObjectLock(priv);
+    ret = priv->threadQuit;
+    virObjectUnlock(priv);
+
+    return ret;
+}
+
+
 static int
 udevEnumerateDevices(struct udev *udev)
 {
@@ -1617,6 +1497,8 @@ udevEnumerateDevices(struct udev *udev)
 
     udev_list_entry_foreach(list_entry,
                             udev_enumerate_get_list_entry(udev_enumerate)) {
+        if (udevEnumerateShouldQuit())
+            break;
 
         udevProcessDeviceListEntry(udev, list_entry);
     }
@@ -1655,6 +1537,9 @@ nodeStateCleanup(void)
         virCondSignal(&priv->threadCond);
         virObjectUnlock(priv);
         virThreadJoin(&priv->th);
+
+        if (priv->enumThreadRunning)
+            virThreadJoin(&priv->enumThread);
     }
 
     virObjectUnref(priv);
@@ -1676,6 +1561,11 @@ udevHandleOneDevice(struct udev_device *device)
 
     VIR_DEBUG("udev action: '%s'", action);
 
+    /* Host CPU topology is cached, make sure hotplugged or onlined
+     * CPUs get noticed */
+    if (STREQ_NULLABLE(udev_device_get_subsystem(device), "cpu"))
+        virHostCPUTopologyInvalidate();
+
     if (STREQ(action, "add") || STREQ(action, "change"))
         return udevAddOneDevice(device);
 
@@ -1915,6 +1805,33 @@ udevPCITranslateInit(bool privileged ATTRIBUTE_UNUSED)
 }
 
 
+/* Enumerating all the devices on a large host can take a considerable
+ * amount of time, do it in a separate thread so that the daemon startup
+ * isn't blocked by it. Devices appearing in the meantime are picked up
+ * by the udev monitor. libudev is not thread safe, so the thread uses its
+ * own udev context rather than sharing the monitor's one. */
+static void
+udevEnumerateDevicesThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    struct udev *udev = NULL;
+
+    if (!(udev = udev_new())) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to create udev context"));
+        return;
+    }
+#if HAVE_UDEV_LOGGING
+    /* cast to get rid of missing-format-attribute warning */
+    udev_set_log_fn(udev, (udevLogFunctionPtr) udevLogFunction);
+#endif
+
+    if (udevEnumerateDevices(udev) < 0)
+        VIR_WARN("Failed to enumerate host node devices");
+
+    udev_unref(udev);
+}
+
+
 static int
 nodeStateInitialize(bool privileged,
                     virStateInhibitCallback callback ATTRIBUTE_UNUSED,
@@ -2001,8 +1918,13 @@ nodeStateInitialize(bool privileged,
         goto cleanup;
 
     /* Populate with known devices */
-    if (udevEnumerateDevices(udev) != 0)
+    if (virThreadCreate(&priv->enumThread, true,
+                        udevEnumerateDevicesThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create udev enumerate thread"));
         goto cleanup;
+    }
+    priv->enumThreadRunning = true;
 
     return 0;
 
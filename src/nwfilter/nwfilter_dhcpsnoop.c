@@ -93,6 +93,8 @@ struct virNWFilterSnoopState {
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     virHashTablePtr      active;
     virMutex             activeLock; /* protects Active */
+    /* decodes packets for all snoop threads */
+    virThreadPoolPtr     decodePool;
 };
 
 # define virNWFilterSnoopLock() \
@@ -246,6 +248,7 @@ struct _virNWFilterDHCPDecodeJob {
     int caplen;
     bool fromVM;
     int *qCtr;
+    virNWFilterSnoopReqPtr req;
 };
 
 # define DHCP_PKT_RATE          10 /* pkts/sec */
@@ -1157,10 +1160,11 @@ virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
  * Worker function to decode the DHCP message and with that
  * also do the time-consuming work of instantiating the filters
  */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = opaque;
     virNWFilterDHCPDecodeJobPtr job = jobdata;
+    virNWFilterSnoopReqPtr req = job->req;
     virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
 
     if (virNWFilterSnoopDHCPDecode(req, packet,
@@ -1180,6 +1184,7 @@ static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
  */
 static int
 virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
+                                    virNWFilterSnoopReqPtr req,
                                     virNWFilterSnoopEthHdrPtr pep,
                                     int len, pcap_direction_t dir,
                                     int *qCtr)
@@ -1197,6 +1202,7 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
     job->caplen = len;
     job->fromVM = (dir == PCAP_D_IN);
     job->qCtr = qCtr;
+    job->req = req;
 
     ret = virThreadPoolSendJob(pool, 0, job);
 
@@ -1341,7 +1347,7 @@ virNWFilterDHCPSnoopThread(void *req0)
     int tmp = -1, rv, n, pollTo;
     size_t i;
     char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
+    virThreadPoolPtr worker = virNWFilterSnoopState.decodePool;
     time_t last_displayed = 0, last_displayed_queue = 0;
     virNWFilterSnoopPcapConf pcapConf[] = {
         {
@@ -1395,13 +1401,10 @@ virNWFilterDHCPSnoopThread(void *req0)
         }
         tmp = virNetDevGetIndex(req->ifname, &ifindex);
         ignore_value(VIR_STRDUP(threadkey, req->threadkey));
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
     }
 
     /* let creator know how well we initialized */
-    if (error || !threadkey || tmp < 0 || !worker ||
+    if (error || !threadkey || tmp < 0 ||
         ifindex != req->ifindex)
         req->threadStatus = THREAD_STATUS_FAIL;
     else
@@ -1526,10 +1529,10 @@ virNWFilterDHCPSnoopThread(void *req0)
                     continue;
                 }
 
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
+                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, req, packet,
+                                                        hdr->caplen,
+                                                        pcapConf[i].dir,
+                                                        &pcapConf[i].qCtr) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("Job submission failed on "
                                      "interface '%s'"), req->ifname);
@@ -1557,7 +1560,11 @@ virNWFilterDHCPSnoopThread(void *req0)
     virNWFilterSnoopUnlock();
 
  exit:
-    virThreadPoolFree(worker);
+    /* the shared worker may still be decoding packets we queued */
+    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
+        while (virAtomicIntGet(&pcapConf[i].qCtr) > 0)
+            usleep(10 * 1000);
+    }
 
     virNWFilterSnoopReqPut(req);
 
@@ -2095,6 +2102,16 @@ virNWFilterDHCPSnoopInit(void)
         !virNWFilterSnoopState.active)
         goto err_exit;
 
+    /*
+     * A single worker serves all interfaces: applying the rules for a
+     * lease is serialized by the filter update lock anyway, and this
+     * keeps the per-request ordering of DHCP messages.
+     */
+    virNWFilterSnoopState.decodePool =
+        virThreadPoolNew(1, 1, 0, virNWFilterDHCPDecodeWorker, NULL);
+    if (!virNWFilterSnoopState.decodePool)
+        goto err_exit;
+
     virNWFilterSnoopLeaseFileLoad();
     virNWFilterSnoopLeaseFileOpen();
 
@@ -2110,6 +2127,9 @@ virNWFilterDHCPSnoopInit(void)
     virHashFree(virNWFilterSnoopState.active);
     virNWFilterSnoopState.active = NULL;
 
+    virThreadPoolFree(virNWFilterSnoopState.decodePool);
+    virNWFilterSnoopState.decodePool = NULL;
+
     return -1;
 }
 
@@ -2185,6 +2205,9 @@ virNWFilterDHCPSnoopShutdown(void)
     virNWFilterSnoopEndThreads();
     virNWFilterSnoopJoinThreads();
 
+    virThreadPoolFree(virNWFilterSnoopState.decodePool);
+    virNWFilterSnoopState.decodePool = NULL;
+
     virNWFilterSnoopLock();
 
     virNWFilterSnoopLeaseFileClose();
@@ -39,6 +39,8 @@
 #include "datatypes.h"
 #include "virsocketaddr.h"
 #include "virstring.h"
+#include "vircrypto.h"
+#include "virbuffer.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -73,6 +75,12 @@ static virNWFilterTechDriverPtr filter_tech_drivers[] = {
  */
 static virMutex updateMutex;
 
+/* Maps an interface name to a digest of the rules currently active on
+ * it, so that a filter rebuild can leave alone the interfaces for which
+ * the redefined filter expands to exactly the same rules.
+ * Protected by updateMutex. */
+static virHashTablePtr appliedRules;
+
 int virNWFilterTechDriversInit(bool privileged)
 {
     size_t i = 0;
@@ -80,6 +88,11 @@ int virNWFilterTechDriversInit(bool privileged)
     if (virMutexInitRecursive(&updateMutex) < 0)
         return -1;
 
+    if (!(appliedRules = virHashCreate(0, virHashValueFree))) {
+        virMutexDestroy(&updateMutex);
+        return -1;
+    }
+
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
@@ -97,6 +110,8 @@ void virNWFilterTechDriversShutdown(void)
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+    virHashFree(appliedRules);
+    appliedRules = NULL;
     virMutexDestroy(&updateMutex);
 }
 
@@ -574,6 +589,47 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
 }
 
 
+/**
+ * virNWFilterInstDigest:
+ * @inst: the instantiated rules of an interface
+ *
+ * Compute a digest over everything the tech driver uses to build the
+ * firewall rules of an interface, so that two instantiations can be
+ * compared without generating and diffing the actual rules.
+ *
+ * Returns the digest string or NULL on error.
+ */
+static char *
+virNWFilterInstDigest(virNWFilterInstPtr inst)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *digest = NULL;
+    size_t i;
+
+    for (i = 0; i < inst->nrules; i++) {
+        virNWFilterRuleInstPtr rule = inst->rules[i];
+
+        virBufferAsprintf(&buf, "%s %d %d\n",
+                          rule->chainSuffix, rule->chainPriority,
+                          rule->priority);
+        if (virNWFilterRuleDefFormat(&buf, rule->def) < 0 ||
+            virNWFilterFormatParamAttributes(&buf, rule->vars, "") < 0)
+            goto cleanup;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    ignore_value(virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                                     virBufferCurrentContent(&buf),
+                                     &digest));
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    return digest;
+}
+
+
 /**
  * virNWFilterDoInstantiate:
  * @vmuuid: The UUID of the VM
@@ -616,6 +672,7 @@ virNWFilterDoInstantiate(const unsigned char *vmuuid,
     virNWFilterVarValuePtr lv;
     const char *learning;
     bool reportIP = false;
+    char *digest = NULL;
 
     virNWFilterHashTablePtr missing_vars = virNWFilterHashTableCreate(0);
 
@@ -646,6 +703,8 @@ virNWFilterDoInstantiate(const unsigned char *vmuuid,
     if (virHashSize(missing_vars->hashTable) == 1) {
         if (virHashLookup(missing_vars->hashTable,
                           NWFILTER_STD_VAR_IP) != NULL) {
+            /* the learning code installs its own rules */
+            virHashRemoveEntry(appliedRules, ifname);
             if (STRCASEEQ(learning, "none")) {        /* no learning */
                 reportIP = true;
                 goto err_unresolvable_vars;
@@ -704,6 +763,19 @@ virNWFilterDoInstantiate(const unsigned char *vmuuid,
     }
 
     if (instantiate) {
+        /* A digest failure only costs us the shortcut */
+        if (!(digest = virNWFilterInstDigest(&inst)))
+            virResetLastError();
+
+        if (useNewFilter == INSTANTIATE_FOLLOW_NEWFILTER && digest &&
+            STREQ_NULLABLE(virHashLookup(appliedRules, ifname), digest)) {
+            VIR_DEBUG("rules of interface %s unchanged, skipping", ifname);
+            *foundNewFilter = false;
+            goto err_exit;
+        }
+
+        virHashRemoveEntry(appliedRules, ifname);
+
         if (virNWFilterLockIface(ifname) < 0)
             goto err_exit;
 
@@ -719,10 +791,15 @@ virNWFilterDoInstantiate(const unsigned char *vmuuid,
             rc = -1;
         }
 
+        if (rc == 0 && digest &&
+            virHashAddEntry(appliedRules, ifname, digest) == 0)
+            digest = NULL;
+
         virNWFilterUnlockIface(ifname);
     }
 
  err_exit:
+    VIR_FREE(digest);
     virNWFilterInstReset(&inst);
     virNWFilterHashTableFree(missing_vars);
 
@@ -980,6 +1057,11 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
     else if (virNWFilterLookupLearnReq(ifindex) != NULL)
         return 0;
 
+    /* the recorded digest describes the rules being rolled back */
+    virMutexLock(&updateMutex);
+    virHashRemoveEntry(appliedRules, net->ifname);
+    virMutexUnlock(&updateMutex);
+
     return techdriver->tearNewRules(net->ifname);
 }
 
@@ -1034,6 +1116,8 @@ _virNWFilterTeardownFilter(const char *ifname)
 
     techdriver->allTeardown(ifname);
 
+    virHashRemoveEntry(appliedRules, ifname);
+
     virNWFilterIPAddrMapDelIPAddr(ifname, NULL);
 
     virNWFilterUnlockIface(ifname);
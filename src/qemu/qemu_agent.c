@@ -33,15 +33,18 @@
 #include <sys/time.h>
 
 #include "qemu_agent.h"
+#include "qemu_domain.h"
 #include "viralloc.h"
 #include "virlog.h"
 #include "virerror.h"
 #include "virjson.h"
+#include "virbuffer.h"
 #include "virfile.h"
 #include "virprocess.h"
 #include "virtime.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virevent.h"
 #include "base64.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -86,6 +89,12 @@ struct _qemuAgentMessage {
     /* id of the issued sync comand */
     unsigned long long id;
     bool first;
+
+    /* For a batch, the number of commands in txBuffer and where their
+     * replies are stored in order, rxObject being unused */
+    size_t nreplies;
+    size_t nreceived;
+    virJSONValuePtr *replies;
 };
 
 
@@ -122,6 +131,10 @@ struct _qemuAgent {
      * but fire up an event on qemu monitor instead.
      * Take that as indication of successful completion */
     qemuAgentEvent await_event;
+
+    /* Whether every reply the agent sent so far was matched to its
+     * command, so the next one needs no guest-sync first */
+    bool inSync;
 };
 
 static virClassPtr qemuAgentClass;
@@ -358,12 +371,19 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
                     goto cleanup;
                 }
             }
-            msg->rxObject = obj;
-            msg->finished = 1;
+            if (msg->nreplies) {
+                msg->replies[msg->nreceived++] = obj;
+                if (msg->nreceived == msg->nreplies)
+                    msg->finished = 1;
+            } else {
+                msg->rxObject = obj;
+                msg->finished = 1;
+            }
             obj = NULL;
         } else {
             /* we are out of sync */
             VIR_DEBUG("Ignoring delayed reply");
+            mon->inSync = false;
         }
         ret = 0;
     } else {
@@ -731,6 +751,7 @@ qemuAgentOpen(virDomainObjPtr vm,
               qemuAgentCallbacksPtr cb)
 {
     qemuAgentPtr mon;
+    int node = qemuDomainGetHomeNode(vm);
 
     if (!cb || !cb->eofNotify) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -775,16 +796,18 @@ qemuAgentOpen(virDomainObjPtr vm,
         goto cleanup;
 
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE |
-                                        (mon->connectPending ?
-                                         VIR_EVENT_HANDLE_WRITABLE :
-                                         0),
-                                        qemuAgentIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    if ((mon->watch = virEventAddHandleAffinity(mon->fd,
+                                                VIR_EVENT_HANDLE_HANGUP |
+                                                VIR_EVENT_HANDLE_ERROR |
+                                                VIR_EVENT_HANDLE_READABLE |
+                                                (mon->connectPending ?
+                                                 VIR_EVENT_HANDLE_WRITABLE :
+                                                 0),
+                                                qemuAgentIO,
+                                                mon,
+                                                virObjectFreeCallback,
+                                                vm->def->id,
+                                                node)) < 0) {
         virObjectUnref(mon);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("unable to register monitor events"));
@@ -813,6 +836,8 @@ qemuAgentNotifyCloseLocked(qemuAgentPtr mon)
 {
     if (mon) {
         mon->running = false;
+        /* Nothing is known about the agent a reopened channel talks to */
+        mon->inSync = false;
 
         /* If there is somebody waiting for a message
          * wake him up. No message will arrive anyway. */
@@ -933,6 +958,10 @@ static int qemuAgentSend(qemuAgentPtr mon,
     ret = 0;
 
  cleanup:
+    /* Whatever the agent still answers would be taken for the
+     * reply to the next command */
+    if (ret < 0)
+        mon->inSync = false;
     mon->msg = NULL;
     qemuAgentUpdateWatch(mon);
 
@@ -1002,6 +1031,7 @@ qemuAgentGuestSync(qemuAgentPtr mon)
         }
     }
 
+    mon->inSync = true;
     ret = 0;
 
  cleanup:
@@ -1139,9 +1169,14 @@ qemuAgentCommand(qemuAgentPtr mon,
         return -1;
     }
 
-    if (qemuAgentGuestSync(mon) < 0)
+    if (!mon->inSync &&
+        qemuAgentGuestSync(mon) < 0)
         return -1;
 
+    /* The guest may go away or restart its agent in response */
+    if (await_event)
+        mon->inSync = false;
+
     memset(&msg, 0, sizeof(msg));
 
     if (!(cmdstr = virJSONValueToString(cmd, false)))
@@ -1185,6 +1220,99 @@ qemuAgentCommand(qemuAgentPtr mon,
     return ret;
 }
 
+/**
+ * qemuAgentCommandBatch:
+ * @mon: Monitor
+ * @cmds: commands to run
+ * @ncmds: number of @cmds
+ * @replies: array of @ncmds filled with the reply to each command
+ * @seconds: how long to wait for all the replies, as for qemuAgentSend
+ *
+ * Send all @cmds at once and wait for their replies, which the agent
+ * sends back in order. None of @cmds may be one to which the agent
+ * doesn't reply. Replies carrying an error are stored like any other,
+ * so one failed command doesn't hide the result of the others.
+ *
+ * Returns: 0 if all the replies arrived, which the caller must free,
+ *          -2 on timeout,
+ *          -1 otherwise
+ */
+int
+qemuAgentCommandBatch(qemuAgentPtr mon,
+                      virJSONValuePtr *cmds,
+                      size_t ncmds,
+                      virJSONValuePtr *replies,
+                      int seconds)
+{
+    int ret = -1;
+    qemuAgentMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    memset(&msg, 0, sizeof(msg));
+    for (i = 0; i < ncmds; i++)
+        replies[i] = NULL;
+
+    if (!mon->running) {
+        virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                       _("Guest agent disappeared while executing command"));
+        return -1;
+    }
+
+    if (ncmds == 0)
+        return 0;
+
+    if (!mon->inSync &&
+        qemuAgentGuestSync(mon) < 0)
+        return -1;
+
+    for (i = 0; i < ncmds; i++) {
+        char *cmdstr;
+
+        if (!(cmdstr = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+        virBufferAsprintf(&buf, "%s" LINE_ENDING, cmdstr);
+        VIR_FREE(cmdstr);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    msg.txBuffer = virBufferContentAndReset(&buf);
+    msg.txLength = strlen(msg.txBuffer);
+    msg.nreplies = ncmds;
+    msg.replies = replies;
+
+    VIR_DEBUG("Send %zu commands for write, seconds = %d", ncmds, seconds);
+
+    ret = qemuAgentSend(mon, &msg, seconds);
+
+    VIR_DEBUG("Receive %zu of %zu command replies ret=%d",
+              msg.nreceived, ncmds, ret);
+
+    if (ret == 0 && msg.nreceived < ncmds) {
+        if (mon->running)
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+        else
+            virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                           _("Guest agent disappeared while executing command"));
+        mon->inSync = false;
+        ret = -1;
+    }
+
+ cleanup:
+    if (ret < 0) {
+        for (i = 0; i < msg.nreceived; i++)
+            virJSONValueFree(replies[i]);
+        for (i = 0; i < ncmds; i++)
+            replies[i] = NULL;
+    }
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(msg.txBuffer);
+    return ret;
+}
+
 static virJSONValuePtr ATTRIBUTE_SENTINEL
 qemuAgentMakeCommand(const char *cmdname,
                      ...)
@@ -1251,6 +1379,13 @@ void qemuAgentNotifyEvent(qemuAgentPtr mon,
     virObjectLock(mon);
 
     VIR_DEBUG("mon=%p event=%d await_event=%d", mon, event, mon->await_event);
+
+    /* The agent restarts with the guest, and the replies it didn't
+     * get to send before are lost or still sitting in the channel */
+    if (event == QEMU_AGENT_EVENT_RESET ||
+        event == QEMU_AGENT_EVENT_SHUTDOWN)
+        mon->inSync = false;
+
     if (mon->await_event == event) {
         mon->await_event = QEMU_AGENT_EVENT_NONE;
         /* somebody waiting for this event, wake him up. */
@@ -1413,6 +1548,74 @@ qemuAgentSuspend(qemuAgentPtr mon,
     return ret;
 }
 
+/*
+ * Run each command of the @array as a batch, storing the array of
+ * their replies in @result.
+ */
+static int
+qemuAgentArbitraryCommandBatch(qemuAgentPtr mon,
+                               virJSONValuePtr array,
+                               virJSONValuePtr *result,
+                               int timeout)
+{
+    int ret = -1;
+    size_t ncmds = virJSONValueArraySize(array);
+    virJSONValuePtr *cmds = NULL;
+    virJSONValuePtr *replies = NULL;
+    size_t i;
+
+    *result = NULL;
+
+    if (ncmds == 0) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("guest agent command batch is empty"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(cmds, ncmds) < 0 ||
+        VIR_ALLOC_N(replies, ncmds) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        cmds[i] = virJSONValueArrayGet(array, i);
+        if (!virJSONValueIsObject(cmds[i])) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("guest agent command %zu in batch "
+                             "is not an object"), i);
+            goto cleanup;
+        }
+    }
+
+    if ((ret = qemuAgentCommandBatch(mon, cmds, ncmds, replies, timeout)) < 0)
+        goto cleanup;
+
+    ret = -1;
+    if (!(*result = virJSONValueNewArray()))
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (virJSONValueArrayAppend(*result, replies[i]) < 0)
+            goto cleanup;
+        replies[i] = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (replies) {
+        for (i = 0; i < ncmds; i++)
+            virJSONValueFree(replies[i]);
+    }
+    if (ret < 0) {
+        virJSONValueFree(*result);
+        *result = NULL;
+    }
+    VIR_FREE(replies);
+    VIR_FREE(cmds);
+    return ret;
+}
+
+
 int
 qemuAgentArbitraryCommand(qemuAgentPtr mon,
                           const char *cmd_str,
@@ -1435,8 +1638,13 @@ qemuAgentArbitraryCommand(qemuAgentPtr mon,
     if (!(cmd = virJSONValueFromString(cmd_str)))
         goto cleanup;
 
-    if ((ret = qemuAgentCommand(mon, cmd, &reply, true, timeout)) < 0)
+    if (virJSONValueIsArray(cmd)) {
+        ret = qemuAgentArbitraryCommandBatch(mon, cmd, &reply, timeout);
+        if (ret < 0)
+            goto cleanup;
+    } else if ((ret = qemuAgentCommand(mon, cmd, &reply, true, timeout)) < 0) {
         goto cleanup;
+    }
 
     if (!(*result = virJSONValueToString(reply, false)))
         ret = -1;
@@ -1838,28 +2046,19 @@ qemuAgentSetTime(qemuAgentPtr mon,
 }
 
 
-int
-qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
-                   virDomainDefPtr vmdef)
+static int
+qemuAgentParseFSInfo(virJSONValuePtr reply,
+                     virDomainFSInfoPtr **info,
+                     virDomainDefPtr vmdef)
 {
     size_t i, j, k;
     int ret = -1;
     ssize_t ndata = 0, ndisk;
     char **alias;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
     virDomainFSInfoPtr *info_ret = NULL;
     virPCIDeviceAddress pci_address;
 
-    cmd = qemuAgentMakeCommand("guest-get-fsinfo", NULL);
-    if (!cmd)
-        return ret;
-
-    if (qemuAgentCommand(mon, cmd, &reply, true,
-                         VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
-        goto cleanup;
-
     if (!(data = virJSONValueObjectGet(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("guest-get-fsinfo reply was missing return data"));
@@ -2010,6 +2209,29 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
             virDomainFSInfoFree(info_ret[i]);
         VIR_FREE(info_ret);
     }
+    return ret;
+}
+
+
+int
+qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
+                   virDomainDefPtr vmdef)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuAgentMakeCommand("guest-get-fsinfo", NULL);
+    if (!cmd)
+        return ret;
+
+    if (qemuAgentCommand(mon, cmd, &reply, true,
+                         VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+
+    ret = qemuAgentParseFSInfo(reply, info, vmdef);
+
+ cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -2026,15 +2248,13 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
  *
  * Returns: number of interfaces on success, -1 on error.
  */
-int
-qemuAgentGetInterfaces(qemuAgentPtr mon,
-                       virDomainInterfacePtr **ifaces)
+static int
+qemuAgentParseInterfaces(virJSONValuePtr reply,
+                         virDomainInterfacePtr **ifaces)
 {
     int ret = -1;
     size_t i, j;
     ssize_t size = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr ret_array = NULL;
     size_t ifaces_count = 0;
     size_t addrs_count = 0;
@@ -2048,14 +2268,6 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
         return -1;
     }
 
-    if (!(cmd = qemuAgentMakeCommand("guest-network-get-interfaces", NULL)))
-        goto cleanup;
-
-    if (qemuAgentCommand(mon, cmd, &reply, false, VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0 ||
-        qemuAgentCheckError(cmd, reply) < 0) {
-        goto cleanup;
-    }
-
     if (!(ret_array = virJSONValueObjectGet(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("qemu agent didn't provide 'return' field"));
@@ -2195,8 +2407,6 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
     ret = ifaces_count;
 
  cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
     virHashFree(ifaces_store);
     return ret;
 
@@ -2212,6 +2422,31 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
 }
 
 
+int
+qemuAgentGetInterfaces(qemuAgentPtr mon,
+                       virDomainInterfacePtr **ifaces)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuAgentMakeCommand("guest-network-get-interfaces", NULL)))
+        goto cleanup;
+
+    if (qemuAgentCommand(mon, cmd, &reply, false, VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0 ||
+        qemuAgentCheckError(cmd, reply) < 0) {
+        goto cleanup;
+    }
+
+    ret = qemuAgentParseInterfaces(reply, ifaces);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 int
 qemuAgentSetUserPassword(qemuAgentPtr mon,
                          const char *user,
@@ -2246,3 +2481,166 @@ qemuAgentSetUserPassword(qemuAgentPtr mon,
     VIR_FREE(password64);
     return ret;
 }
+
+
+static int
+qemuAgentParseUsers(virJSONValuePtr reply,
+                    qemuAgentUserInfoPtr *users)
+{
+    virJSONValuePtr data;
+    qemuAgentUserInfoPtr users_ret = NULL;
+    ssize_t ndata;
+    size_t i;
+    int ret = -1;
+
+    if (!(data = virJSONValueObjectGetArray(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("guest-get-users reply was missing return data"));
+        return -1;
+    }
+
+    ndata = virJSONValueArraySize(data);
+    if (ndata && VIR_ALLOC_N(users_ret, ndata) < 0)
+        return -1;
+
+    for (i = 0; i < ndata; i++) {
+        virJSONValuePtr entry = virJSONValueArrayGet(data, i);
+        double loginTime;
+
+        if (!entry ||
+            VIR_STRDUP(users_ret[i].user,
+                       virJSONValueObjectGetString(entry, "user")) <= 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("'user' missing in reply of guest-get-users"));
+            goto cleanup;
+        }
+
+        if (VIR_STRDUP(users_ret[i].domain,
+                       virJSONValueObjectGetString(entry, "domain")) < 0)
+            goto cleanup;
+
+        if (virJSONValueObjectGetNumberDouble(entry, "login-time",
+                                              &loginTime) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("'login-time' missing in reply of guest-get-users"));
+            goto cleanup;
+        }
+        users_ret[i].loginTime = loginTime * 1000;
+    }
+
+    *users = users_ret;
+    users_ret = NULL;
+    ret = ndata;
+
+ cleanup:
+    if (users_ret) {
+        for (i = 0; i < ndata; i++) {
+            VIR_FREE(users_ret[i].user);
+            VIR_FREE(users_ret[i].domain);
+        }
+        VIR_FREE(users_ret);
+    }
+    return ret;
+}
+
+
+void
+qemuAgentGuestInfoClear(qemuAgentGuestInfoPtr info)
+{
+    int i;
+
+    for (i = 0; i < info->nifaces; i++)
+        virDomainInterfaceFree(info->ifaces[i]);
+    VIR_FREE(info->ifaces);
+    for (i = 0; i < info->nfs; i++)
+        virDomainFSInfoFree(info->fs[i]);
+    VIR_FREE(info->fs);
+    for (i = 0; i < info->nusers; i++) {
+        VIR_FREE(info->users[i].user);
+        VIR_FREE(info->users[i].domain);
+    }
+    VIR_FREE(info->users);
+    info->nifaces = info->nfs = info->nusers = -1;
+}
+
+
+/**
+ * qemuAgentGetGuestInfo:
+ * @mon: Monitor
+ * @vmdef: domain definition to map guest disks to
+ * @seconds: how long to wait for the agent, as for qemuAgentSend
+ * @info: filled with what the guest reported
+ *
+ * Query interfaces, filesystems and logged in users of the guest in a
+ * single round trip. A query the agent fails, for instance because
+ * it's too old to know about it, is only left out of @info.
+ *
+ * Returns 0 on success, -2 on timeout and -1 on other errors
+ */
+int
+qemuAgentGetGuestInfo(qemuAgentPtr mon,
+                      virDomainDefPtr vmdef,
+                      int seconds,
+                      qemuAgentGuestInfoPtr info)
+{
+    const char *cmdnames[] = { "guest-network-get-interfaces",
+                               "guest-get-fsinfo",
+                               "guest-get-users" };
+    virJSONValuePtr cmds[ARRAY_CARDINALITY(cmdnames)] = { NULL };
+    virJSONValuePtr replies[ARRAY_CARDINALITY(cmdnames)] = { NULL };
+    size_t i;
+    int ret = -1;
+
+    memset(info, 0, sizeof(*info));
+    info->nifaces = info->nfs = info->nusers = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(cmdnames); i++) {
+        if (!(cmds[i] = qemuAgentMakeCommand(cmdnames[i], NULL)))
+            goto cleanup;
+    }
+
+    if ((ret = qemuAgentCommandBatch(mon, cmds, ARRAY_CARDINALITY(cmds),
+                                     replies, seconds)) < 0)
+        goto cleanup;
+
+    ret = -1;
+    for (i = 0; i < ARRAY_CARDINALITY(cmdnames); i++) {
+        int rc = -1;
+
+        if (qemuAgentCheckError(cmds[i], replies[i]) < 0) {
+            VIR_DEBUG("Leaving out %s: %s",
+                      cmdnames[i], virGetLastErrorMessage());
+            virResetLastError();
+            continue;
+        }
+
+        switch (i) {
+        case 0:
+            rc = info->nifaces = qemuAgentParseInterfaces(replies[i],
+                                                          &info->ifaces);
+            break;
+        case 1:
+            rc = info->nfs = qemuAgentParseFSInfo(replies[i], &info->fs,
+                                                  vmdef);
+            break;
+        case 2:
+            rc = info->nusers = qemuAgentParseUsers(replies[i],
+                                                    &info->users);
+            break;
+        }
+
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        qemuAgentGuestInfoClear(info);
+    for (i = 0; i < ARRAY_CARDINALITY(cmdnames); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    return ret;
+}
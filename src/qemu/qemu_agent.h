@@ -27,6 +27,7 @@
 
 # include "internal.h"
 # include "domain_conf.h"
+# include "virjson.h"
 
 typedef struct _qemuAgent qemuAgent;
 typedef qemuAgent *qemuAgentPtr;
@@ -81,6 +82,12 @@ int qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
 int qemuAgentSuspend(qemuAgentPtr mon,
                      unsigned int target);
 
+int qemuAgentCommandBatch(qemuAgentPtr mon,
+                          virJSONValuePtr *cmds,
+                          size_t ncmds,
+                          virJSONValuePtr *replies,
+                          int seconds);
+
 int qemuAgentArbitraryCommand(qemuAgentPtr mon,
                               const char *cmd,
                               char **result,
@@ -120,4 +127,30 @@ int qemuAgentSetUserPassword(qemuAgentPtr mon,
                              const char *user,
                              const char *password,
                              bool crypted);
+
+typedef struct _qemuAgentUserInfo qemuAgentUserInfo;
+typedef qemuAgentUserInfo *qemuAgentUserInfoPtr;
+struct _qemuAgentUserInfo {
+    char *user;
+    char *domain; /* only reported by Windows guests */
+    unsigned long long loginTime; /* in milliseconds since the epoch */
+};
+
+typedef struct _qemuAgentGuestInfo qemuAgentGuestInfo;
+typedef qemuAgentGuestInfo *qemuAgentGuestInfoPtr;
+struct _qemuAgentGuestInfo {
+    /* Each count is -1 if the agent refused to tell */
+    virDomainInterfacePtr *ifaces;
+    int nifaces;
+    virDomainFSInfoPtr *fs;
+    int nfs;
+    qemuAgentUserInfoPtr users;
+    int nusers;
+};
+
+int qemuAgentGetGuestInfo(qemuAgentPtr mon,
+                          virDomainDefPtr vmdef,
+                          int seconds,
+                          qemuAgentGuestInfoPtr info);
+void qemuAgentGuestInfoClear(qemuAgentGuestInfoPtr info);
 #endif /* __QEMU_AGENT_H__ */
@@ -191,7 +191,15 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
         break;
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    /* A finished backup leaves the guest disk untouched; just drop
+     * qemu's access to the target.  */
+    if (diskPriv->backupTarget && !diskPriv->blockjob) {
+        qemuDomainDiskChainElementRevoke(driver, vm, diskPriv->backupTarget);
+        virStorageSourceFree(diskPriv->backupTarget);
+        diskPriv->backupTarget = NULL;
+    }
+
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after block job", vm->def->name);
 
     if (status == VIR_DOMAIN_BLOCK_JOB_COMPLETED && vm->newDef) {
@@ -250,3 +258,93 @@ qemuBlockJobSyncEnd(virQEMUDriverPtr driver,
     qemuBlockJobUpdate(driver, vm, asyncJob, disk);
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockJobSync = false;
 }
+
+
+/**
+ * qemuBlockJobInfoInvalidate:
+ * @vm: domain
+ *
+ * Drop the block job progress cached for the disks of @vm, so that the
+ * next query asks QEMU again. Has to be called whenever a block job is
+ * started or changed and when QEMU reports an event for one.
+ */
+void
+qemuBlockJobInfoInvalidate(virDomainObjPtr vm)
+{
+    QEMU_DOMAIN_PRIVATE(vm)->blockJobInfoTime = 0;
+}
+
+
+/**
+ * qemuBlockJobInfoIsFresh:
+ * @vm: domain
+ *
+ * Returns true if the block job progress cached for the disks of @vm
+ * can be used to answer a query without asking QEMU.
+ */
+bool
+qemuBlockJobInfoIsFresh(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+
+    if (!priv->blockJobInfoTime || virTimeMillisNow(&now) < 0)
+        return false;
+
+    return now - priv->blockJobInfoTime < QEMU_BLOCKJOB_INFO_MAX_AGE;
+}
+
+
+/**
+ * qemuBlockJobInfoRefresh:
+ * @driver: qemu driver
+ * @vm: domain
+ * @asyncJob: current async job
+ *
+ * Fetch the progress of the block jobs of all disks of @vm with a single
+ * monitor command and cache it in the private data of each disk. The
+ * caller has to own a job.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuBlockJobInfoRefresh(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm,
+                        qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr all = NULL;
+    qemuMonitorBlockJobInfoPtr data;
+    unsigned long long now;
+    size_t i;
+    int ret = -1;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return -1;
+    all = qemuMonitorGetAllBlockJobInfo(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !all)
+        goto cleanup;
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+
+        if (disk->info.alias &&
+            (data = virHashLookup(all, disk->info.alias))) {
+            diskPriv->blockJobInfo = *data;
+            diskPriv->hasBlockJobInfo = true;
+        } else {
+            diskPriv->hasBlockJobInfo = false;
+        }
+    }
+
+    priv->blockJobInfoTime = now;
+    ret = 0;
+
+ cleanup:
+    virHashFree(all);
+    return ret;
+}
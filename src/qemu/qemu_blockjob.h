@@ -43,4 +43,14 @@ void qemuBlockJobSyncEnd(virQEMUDriverPtr driver,
                          qemuDomainAsyncJob asyncJob,
                          virDomainDiskDefPtr disk);
 
+/* How long the block job progress fetched for all disks of a domain at
+ * once is used to answer queries, in milliseconds */
+# define QEMU_BLOCKJOB_INFO_MAX_AGE 1000
+
+void qemuBlockJobInfoInvalidate(virDomainObjPtr vm);
+bool qemuBlockJobInfoIsFresh(virDomainObjPtr vm);
+int qemuBlockJobInfoRefresh(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            qemuDomainAsyncJob asyncJob);
+
 #endif /* __QEMU_BLOCKJOB_H__ */
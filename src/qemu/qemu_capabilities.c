@@ -42,6 +42,9 @@
 #include "virhostcpu.h"
 #include "qemu_monitor.h"
 #include "virstring.h"
+#include "viratomic.h"
+#include "virtime.h"
+#include "dirname.h"
 #include "qemu_hostdev.h"
 #include "qemu_domain.h"
 #define __QEMU_CAPSPRIV_H_ALLOW__
@@ -52,9 +55,19 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdarg.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
+/* Maximum number of binaries probed in parallel */
+#define VIR_QEMU_CAPS_PROBE_WORKERS 4
+
+/* How long (in ms) a successful validation of cached capabilities is
+ * trusted as long as no watched file changed */
+#define VIR_QEMU_CAPS_VALIDATE_INTERVAL 5000
+
 VIR_LOG_INIT("qemu.qemu_capabilities");
 
 /* While not public, these strings must not change. They
@@ -449,6 +462,9 @@ VIR_ENUM_IMPL(virQEMUCaps, QEMU_CAPS_LAST,
 
               /* 275 */
               "sclplmconsole",
+              "query-cpus-fast",
+              "memory-backend.prealloc-threads",
+              "calc-dirty-rate",
     );
 
 
@@ -495,6 +511,14 @@ struct _virQEMUCaps {
     time_t ctime;
     time_t libvirtCtime;
 
+    /* Unique among the objects created by this process */
+    unsigned int serial;
+
+    /* Only needed while the object is cached, protected by cache lock */
+    unsigned long long validatedTime;
+    unsigned int validatedGeneration;
+    bool watched;
+
     virBitmapPtr flags;
 
     unsigned int version;
@@ -515,6 +539,12 @@ struct _virQEMUCaps {
 
     virQEMUCapsHostCPUData kvmCPU;
     virQEMUCapsHostCPUData tcgCPU;
+
+    /* Domain capabilities filled in so far, keyed by machine type,
+     * architecture and virt type. They go away with the object when the
+     * capabilities cache replaces it. Not copied. */
+    virMutex domCapsLock;
+    virHashTablePtr domCaps;
 };
 
 struct virQEMUCapsSearchData {
@@ -523,6 +553,7 @@ struct virQEMUCapsSearchData {
 
 
 static virClassPtr virQEMUCapsClass;
+static int virQEMUCapsSerial;
 static void virQEMUCapsDispose(void *obj);
 
 static int virQEMUCapsOnceInit(void)
@@ -970,6 +1001,12 @@ virQEMUCapsFindBinaryForArch(virArch hostarch,
     return ret;
 }
 
+static const char *virQEMUCapsKVMBinaries[] = {
+    "/usr/libexec/qemu-kvm", /* RHEL */
+    "qemu-kvm", /* Fedora */
+    "kvm", /* Debian/Ubuntu */
+};
+
 static int
 virQEMUCapsInitGuest(virCapsPtr caps,
                      virFileCachePtr cache,
@@ -1004,9 +1041,9 @@ virQEMUCapsInitGuest(virCapsPtr caps,
      */
     if (virQEMUCapsGuestIsNative(hostarch, guestarch)) {
         const char *kvmbins[] = {
-            "/usr/libexec/qemu-kvm", /* RHEL */
-            "qemu-kvm", /* Fedora */
-            "kvm", /* Debian/Ubuntu */
+            virQEMUCapsKVMBinaries[0],
+            virQEMUCapsKVMBinaries[1],
+            virQEMUCapsKVMBinaries[2],
             NULL,
         };
 
@@ -1179,6 +1216,68 @@ virQEMUCapsProbeHostCPUForEmulator(virArch hostArch,
 }
 
 
+static int
+virQEMUCapsPrefetchAdd(char ***binaries,
+                       size_t *nbinaries,
+                       char *binary)
+{
+    if (!binary)
+        return 0;
+
+    if (virStringListHasString((const char **) *binaries, binary)) {
+        VIR_FREE(binary);
+        return 0;
+    }
+
+    /* @nbinaries counts the NULL terminator too */
+    if (VIR_EXPAND_N(*binaries, *nbinaries, 1) < 0) {
+        VIR_FREE(binary);
+        return -1;
+    }
+    (*binaries)[*nbinaries - 2] = binary;
+
+    return 0;
+}
+
+
+/* Probing a binary means starting it and talking to it over QMP, which
+ * takes a while. Look up every binary virQEMUCapsInitGuest() is going
+ * to ask for and probe the ones not cached yet in parallel, so that a
+ * QEMU upgrade doesn't cost the sum of all the probes on startup. */
+static void
+virQEMUCapsPrefetch(virFileCachePtr cache,
+                    virArch hostarch)
+{
+    char **binaries = NULL;
+    size_t nbinaries = 1;
+    size_t i;
+
+    if (VIR_ALLOC_N(binaries, nbinaries) < 0)
+        goto cleanup;
+
+    for (i = 0; i < VIR_ARCH_LAST; i++) {
+        if (virQEMUCapsPrefetchAdd(&binaries, &nbinaries,
+                                   virQEMUCapsFindBinaryForArch(hostarch, i)) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsKVMBinaries); i++) {
+        if (virQEMUCapsPrefetchAdd(&binaries, &nbinaries,
+                                   virFindFileInPath(virQEMUCapsKVMBinaries[i])) < 0)
+            goto cleanup;
+    }
+
+    VIR_DEBUG("Prefetching capabilities of %zu binaries", nbinaries - 1);
+    ignore_value(virFileCachePrefetch(cache, (const char *const *) binaries,
+                                      VIR_QEMU_CAPS_PROBE_WORKERS));
+
+ cleanup:
+    /* The lookups done later will probe anything that's missing */
+    virResetLastError();
+    virStringListFree(binaries);
+}
+
+
 virCapsPtr
 virQEMUCapsInit(virFileCachePtr cache)
 {
@@ -1217,6 +1316,8 @@ virQEMUCapsInit(virFileCachePtr cache)
     virCapabilitiesAddHostMigrateTransport(caps, "tcp");
     virCapabilitiesAddHostMigrateTransport(caps, "rdma");
 
+    virQEMUCapsPrefetch(cache, hostarch);
+
     /* QEMU can support pretty much every arch that exists,
      * so just probe for them all - we gracefully fail
      * if a qemu-system-$ARCH binary can't be found
@@ -1567,7 +1668,9 @@ struct virQEMUCapsStringFlags virQEMUCapsCommands[] = {
     { "query-qmp-schema", QEMU_CAPS_QUERY_QMP_SCHEMA },
     { "query-cpu-model-expansion", QEMU_CAPS_QUERY_CPU_MODEL_EXPANSION},
     { "query-cpu-definitions", QEMU_CAPS_QUERY_CPU_DEFINITIONS},
-    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES}
+    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES},
+    { "query-cpus-fast", QEMU_CAPS_QUERY_CPUS_FAST},
+    { "calc-dirty-rate", QEMU_CAPS_CALC_DIRTY_RATE },
 };
 
 struct virQEMUCapsStringFlags virQEMUCapsMigration[] = {
@@ -1803,6 +1906,7 @@ static struct virQEMUCapsStringFlags virQEMUCapsQMPSchemaQueries[] = {
     { "blockdev-add/arg-type/options/+gluster/debug-level", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
     { "blockdev-add/arg-type/+gluster/debug", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
     { "blockdev-add/arg-type/+vxhs", QEMU_CAPS_VXHS},
+    { "object-add/arg-type/+memory-backend-file/prealloc-threads", QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS},
 };
 
 struct virQEMUCapsObjectTypeProps {
@@ -2216,9 +2320,21 @@ virQEMUCapsNew(void)
     if (!(qemuCaps = virObjectNew(virQEMUCapsClass)))
         return NULL;
 
+    qemuCaps->serial = virAtomicIntInc(&virQEMUCapsSerial);
+
+    if (virMutexInit(&qemuCaps->domCapsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        VIR_FREE(qemuCaps);
+        return NULL;
+    }
+
     if (!(qemuCaps->flags = virBitmapNew(QEMU_CAPS_LAST)))
         goto error;
 
+    if (!(qemuCaps->domCaps = virHashCreate(5, virObjectFreeHashData)))
+        goto error;
+
     return qemuCaps;
 
  error:
@@ -2352,6 +2468,9 @@ void virQEMUCapsDispose(void *obj)
 
     virQEMUCapsHostCPUDataClear(&qemuCaps->kvmCPU);
     virQEMUCapsHostCPUDataClear(&qemuCaps->tcgCPU);
+
+    virHashFree(qemuCaps->domCaps);
+    virMutexDestroy(&qemuCaps->domCapsLock);
 }
 
 void
@@ -2459,6 +2578,13 @@ const char *virQEMUCapsGetBinary(virQEMUCapsPtr qemuCaps)
 }
 
 
+/* Lets callers tell capabilities apart without holding a reference */
+unsigned int virQEMUCapsGetSerial(virQEMUCapsPtr qemuCaps)
+{
+    return qemuCaps->serial;
+}
+
+
 void
 virQEMUCapsSetArch(virQEMUCapsPtr qemuCaps,
                    virArch arch)
@@ -3785,21 +3911,145 @@ virQEMUCapsLoadCPUModels(virQEMUCapsPtr qemuCaps,
 }
 
 
+/* Changes to the emulator binaries or /dev/kvm are noticed through
+ * inotify, any event bumps @generation and makes cached capabilities
+ * go through full validation on the next lookup. */
+typedef struct _virQEMUCapsWatch virQEMUCapsWatch;
+typedef virQEMUCapsWatch *virQEMUCapsWatchPtr;
+struct _virQEMUCapsWatch {
+    int fd;
+    int watch;
+    int generation; /* atomic */
+};
+
 struct _virQEMUCapsCachePriv {
     char *libDir;
     uid_t runUid;
     gid_t runGid;
     virArch hostArch;
+    virQEMUCapsWatchPtr watch; /* NULL without inotify or event loop */
 };
 typedef struct _virQEMUCapsCachePriv virQEMUCapsCachePriv;
 typedef virQEMUCapsCachePriv *virQEMUCapsCachePrivPtr;
 
 
+#ifdef HAVE_SYS_INOTIFY_H
+# define VIR_QEMU_CAPS_WATCH_MASK \
+    (IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static void
+virQEMUCapsWatchFree(void *opaque)
+{
+    virQEMUCapsWatchPtr watch = opaque;
+
+    VIR_FORCE_CLOSE(watch->fd);
+    VIR_FREE(watch);
+}
+
+
+static void
+virQEMUCapsWatchEvent(int handle ATTRIBUTE_UNUSED,
+                      int fd,
+                      int events ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virQEMUCapsWatchPtr watch = opaque;
+    char buf[4096];
+
+    /* The details don't matter, anything changing is a reason to
+     * validate all the cached capabilities again. */
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    virAtomicIntInc(&watch->generation);
+}
+
+
+static virQEMUCapsWatchPtr
+virQEMUCapsWatchNew(void)
+{
+    virQEMUCapsWatchPtr watch;
+    char ebuf[1024];
+
+    if (VIR_ALLOC(watch) < 0)
+        return NULL;
+    watch->watch = -1;
+
+    if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        VIR_DEBUG("Unable to initialize inotify: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+
+    if (inotify_add_watch(watch->fd, "/dev", VIR_QEMU_CAPS_WATCH_MASK) < 0) {
+        VIR_DEBUG("Unable to watch /dev: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+
+    if ((watch->watch = virEventAddHandle(watch->fd,
+                                          VIR_EVENT_HANDLE_READABLE,
+                                          virQEMUCapsWatchEvent,
+                                          watch,
+                                          virQEMUCapsWatchFree)) < 0) {
+        VIR_DEBUG("No event loop to watch QEMU binaries from");
+        virResetLastError();
+        goto error;
+    }
+
+    return watch;
+
+ error:
+    virQEMUCapsWatchFree(watch);
+    return NULL;
+}
+
+
+static void
+virQEMUCapsWatchBinary(virQEMUCapsWatchPtr watch,
+                       const char *binary)
+{
+    char *dir = NULL;
+    char ebuf[1024];
+
+    /* Packages are usually upgraded by renaming a new file over the old
+     * one, so watch the directory rather than just the binary. */
+    if (!(dir = mdir_name(binary)))
+        return;
+
+    if (inotify_add_watch(watch->fd, dir, VIR_QEMU_CAPS_WATCH_MASK) < 0)
+        VIR_DEBUG("Unable to watch %s: %s",
+                  dir, virStrerror(errno, ebuf, sizeof(ebuf)));
+
+    VIR_FREE(dir);
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+static virQEMUCapsWatchPtr
+virQEMUCapsWatchNew(void)
+{
+    return NULL;
+}
+
+
+static void
+virQEMUCapsWatchBinary(virQEMUCapsWatchPtr watch ATTRIBUTE_UNUSED,
+                       const char *binary ATTRIBUTE_UNUSED)
+{
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
 static void
 virQEMUCapsCachePrivFree(void *privData)
 {
     virQEMUCapsCachePrivPtr priv = privData;
 
+    /* The event loop frees @watch once it's done with it */
+    if (priv->watch)
+        virEventRemoveHandle(priv->watch->watch);
     VIR_FREE(priv->libDir);
     VIR_FREE(priv);
 }
@@ -4279,10 +4529,29 @@ virQEMUCapsIsValid(void *data,
     virQEMUCapsCachePrivPtr priv = privData;
     bool kvmUsable;
     struct stat sb;
+    unsigned long long now = 0;
+    int generation = 0;
 
     if (!qemuCaps->binary)
         return true;
 
+    /* Without a way to notice changes, validate on every lookup */
+    if (priv->watch) {
+        generation = virAtomicIntGet(&priv->watch->generation);
+
+        if (virTimeMillisNow(&now) < 0) {
+            virResetLastError();
+            now = 0;
+        }
+
+        if (now &&
+            qemuCaps->validatedTime &&
+            qemuCaps->validatedGeneration == generation &&
+            now >= qemuCaps->validatedTime &&
+            now - qemuCaps->validatedTime < VIR_QEMU_CAPS_VALIDATE_INTERVAL)
+            return true;
+    }
+
     if (qemuCaps->libvirtCtime != virGetSelfLastChanged() ||
         qemuCaps->libvirtVersion != LIBVIR_VERSION_NUMBER) {
         VIR_DEBUG("Outdated capabilities for '%s': libvirt changed "
@@ -4331,6 +4600,15 @@ virQEMUCapsIsValid(void *data,
         return false;
     }
 
+    if (priv->watch) {
+        if (!qemuCaps->watched) {
+            virQEMUCapsWatchBinary(priv->watch, qemuCaps->binary);
+            qemuCaps->watched = true;
+        }
+        qemuCaps->validatedTime = now;
+        qemuCaps->validatedGeneration = generation;
+    }
+
     return true;
 }
 
@@ -4945,6 +5223,8 @@ virQEMUCapsInitQMPCommandFree(virQEMUCapsInitQMPCommandPtr cmd)
 }
 
 
+static int virQEMUCapsQMPCommandID;
+
 static virQEMUCapsInitQMPCommandPtr
 virQEMUCapsInitQMPCommandNew(char *binary,
                              const char *libDir,
@@ -4953,6 +5233,7 @@ virQEMUCapsInitQMPCommandNew(char *binary,
                              char **qmperr)
 {
     virQEMUCapsInitQMPCommandPtr cmd = NULL;
+    int id = virAtomicIntInc(&virQEMUCapsQMPCommandID);
 
     if (VIR_ALLOC(cmd) < 0)
         goto error;
@@ -4965,10 +5246,11 @@ virQEMUCapsInitQMPCommandNew(char *binary,
     cmd->qmperr = qmperr;
 
     /* the ".sock" sufix is important to avoid a possible clash with a qemu
-     * domain called "capabilities"
+     * domain called "capabilities", the @id keeps binaries probed in
+     * parallel apart
      */
-    if (virAsprintf(&cmd->monpath, "%s/%s", libDir,
-                    "capabilities.monitor.sock") < 0)
+    if (virAsprintf(&cmd->monpath, "%s/capabilities.%d.monitor.sock",
+                    libDir, id) < 0)
         goto error;
     if (virAsprintf(&cmd->monarg, "unix:%s,server,nowait", cmd->monpath) < 0)
         goto error;
@@ -4979,7 +5261,8 @@ virQEMUCapsInitQMPCommandNew(char *binary,
      * -daemonize we need QEMU to be allowed to create them, rather
      * than libvirtd. So we're using libDir which QEMU can write to
      */
-    if (virAsprintf(&cmd->pidfile, "%s/%s", libDir, "capabilities.pidfile") < 0)
+    if (virAsprintf(&cmd->pidfile, "%s/capabilities.%d.pidfile",
+                    libDir, id) < 0)
         goto error;
 
     virPidFileForceCleanupPath(cmd->pidfile);
@@ -5336,6 +5619,8 @@ virQEMUCapsCacheNew(const char *libDir,
     priv->runUid = runUid;
     priv->runGid = runGid;
 
+    priv->watch = virQEMUCapsWatchNew();
+
  cleanup:
     VIR_FREE(capsCacheDir);
     return cache;
@@ -5812,3 +6097,70 @@ virQEMUCapsFillDomainCaps(virCapsPtr caps,
         return -1;
     return 0;
 }
+
+
+/**
+ * virQEMUCapsGetDomainCaps:
+ * @qemuCaps: capabilities of the emulator binary
+ * @caps: host capabilities
+ * @machine: canonical machine type
+ * @arch: guest architecture
+ * @virttype: virtualization type
+ * @firmwares: firmwares to use
+ * @nfirmwares: number of items in @firmwares
+ *
+ * Get the domain capabilities of @machine, @arch and @virttype for the
+ * emulator described by @qemuCaps. They are filled in by the first call
+ * and kept within @qemuCaps, so that later calls only cost a lookup
+ * until the capabilities cache refreshes @qemuCaps.
+ *
+ * The returned object is shared and must not be modified. The caller has
+ * to unref it.
+ *
+ * Returns the domain capabilities or NULL on error.
+ */
+virDomainCapsPtr
+virQEMUCapsGetDomainCaps(virQEMUCapsPtr qemuCaps,
+                         virCapsPtr caps,
+                         const char *machine,
+                         virArch arch,
+                         virDomainVirtType virttype,
+                         virFirmwarePtr *firmwares,
+                         size_t nfirmwares)
+{
+    virDomainCapsPtr domCaps = NULL;
+    char *key = NULL;
+
+    if (virAsprintf(&key, "%s:%s:%s", machine, virArchToString(arch),
+                    virDomainVirtTypeToString(virttype)) < 0)
+        return NULL;
+
+    /* Filling in is done under the lock so that concurrent callers asking
+     * for the same capabilities wait for a single result */
+    virMutexLock(&qemuCaps->domCapsLock);
+
+    if ((domCaps = virHashLookup(qemuCaps->domCaps, key))) {
+        virObjectRef(domCaps);
+        goto cleanup;
+    }
+
+    if (!(domCaps = virDomainCapsNew(qemuCaps->binary, machine,
+                                     arch, virttype)))
+        goto cleanup;
+
+    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
+                                  firmwares, nfirmwares) < 0 ||
+        virHashAddEntry(qemuCaps->domCaps, key, domCaps) < 0) {
+        virObjectUnref(domCaps);
+        domCaps = NULL;
+        goto cleanup;
+    }
+
+    /* one reference is owned by the hash table */
+    virObjectRef(domCaps);
+
+ cleanup:
+    virMutexUnlock(&qemuCaps->domCapsLock);
+    VIR_FREE(key);
+    return domCaps;
+}
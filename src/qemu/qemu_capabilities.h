@@ -435,6 +435,9 @@ typedef enum {
 
     /* 275 */
     QEMU_CAPS_DEVICE_SCLPLMCONSOLE, /* -device sclplmconsole */
+    QEMU_CAPS_QUERY_CPUS_FAST, /* query-cpus-fast command */
+    QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS, /* -object memory-backend-*,prealloc-threads */
+    QEMU_CAPS_CALC_DIRTY_RATE, /* calc-dirty-rate command */
 
     QEMU_CAPS_LAST /* this must always be the last item */
 } virQEMUCapsFlags;
@@ -467,6 +470,7 @@ bool virQEMUCapsSupportsSMM(virQEMUCapsPtr qemuCaps,
 char *virQEMUCapsFlagsString(virQEMUCapsPtr qemuCaps);
 
 const char *virQEMUCapsGetBinary(virQEMUCapsPtr qemuCaps);
+unsigned int virQEMUCapsGetSerial(virQEMUCapsPtr qemuCaps);
 virArch virQEMUCapsGetArch(virQEMUCapsPtr qemuCaps);
 unsigned int virQEMUCapsGetVersion(virQEMUCapsPtr qemuCaps);
 const char *virQEMUCapsGetPackage(virQEMUCapsPtr qemuCaps);
@@ -552,6 +556,14 @@ int virQEMUCapsFillDomainCaps(virCapsPtr caps,
                               virFirmwarePtr *firmwares,
                               size_t nfirmwares);
 
+virDomainCapsPtr virQEMUCapsGetDomainCaps(virQEMUCapsPtr qemuCaps,
+                                          virCapsPtr caps,
+                                          const char *machine,
+                                          virArch arch,
+                                          virDomainVirtType virttype,
+                                          virFirmwarePtr *firmwares,
+                                          size_t nfirmwares);
+
 bool virQEMUCapsGuestIsNative(virArch host,
                               virArch guest);
 
@@ -3297,6 +3297,34 @@ qemuBuildControllerDevCommandLine(virCommandPtr cmd,
  *          1 on success and if there's no need to use memory-backend-*
  *         -1 on error.
  */
+/*
+ * Preallocation is spread over as many threads as there are vCPUs using
+ * the memory, but no more than the host CPUs the emulator is pinned to,
+ * which the preallocating threads inherit.
+ */
+static unsigned int
+qemuBuildMemoryBackendPreallocThreads(virDomainDefPtr def,
+                                      int targetNode)
+{
+    virBitmapPtr cpumask = NULL;
+    virBitmapPtr emulatorpin = def->cputune.emulatorpin;
+    unsigned int threads = virDomainDefGetVcpus(def);
+
+    if (targetNode >= 0 &&
+        targetNode < virDomainNumaGetNodeCount(def->numa) &&
+        (cpumask = virDomainNumaGetNodeCpumask(def->numa, targetNode)))
+        threads = virBitmapCountBits(cpumask);
+
+    if (!emulatorpin)
+        emulatorpin = def->cpumask;
+
+    if (emulatorpin)
+        threads = MIN(threads, virBitmapCountBits(emulatorpin));
+
+    return MAX(threads, 1);
+}
+
+
 int
 qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
                           const char **backendType,
@@ -3434,6 +3462,15 @@ qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
                                   NULL) < 0)
             goto cleanup;
 
+        if (prealloc &&
+            virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS) &&
+            virJSONValueObjectAdd(props,
+                                  "u:prealloc-threads",
+                                  qemuBuildMemoryBackendPreallocThreads(def,
+                                                                        mem->targetNode),
+                                  NULL) < 0)
+            goto cleanup;
+
         switch (memAccess) {
         case VIR_DOMAIN_MEMORY_ACCESS_SHARED:
             if (virJSONValueObjectAdd(props, "b:share", true, NULL) < 0)
@@ -8407,36 +8444,74 @@ qemuBuildVhostuserCommandLine(virQEMUDriverPtr driver,
     return -1;
 }
 
-static int
-qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
-                              virLogManagerPtr logManager,
-                              virCommandPtr cmd,
-                              virDomainDefPtr def,
-                              virDomainNetDefPtr net,
-                              virQEMUCapsPtr qemuCaps,
-                              int vlan,
-                              unsigned int bootindex,
-                              virNetDevVPortProfileOp vmop,
-                              bool standalone,
-                              size_t *nnicindexes,
-                              int **nicindexes,
-                              bool chardevStdioLogd)
+/* Upper bound on the number of threads used to set up the host side
+ * of the domain's network interfaces in parallel */
+#define QEMU_BUILD_NET_PREPARE_WORKERS 4
+
+typedef struct _qemuBuildNetPrepare qemuBuildNetPrepare;
+typedef qemuBuildNetPrepare *qemuBuildNetPreparePtr;
+struct _qemuBuildNetPrepare {
+    virQEMUDriverPtr driver;
+    virDomainDefPtr def;
+    virDomainNetDefPtr net;
+    virQEMUCapsPtr qemuCaps;
+    virNetDevVPortProfileOp vmop;
+    bool standalone;
+
+    int *tapfd;
+    size_t tapfdSize;
+    int *vhostfd;
+    size_t vhostfdSize;
+
+    unsigned long long tapTime;     /* ms spent in creating tap devices */
+    unsigned long long vhostTime;   /* ms spent in opening vhost-net */
+
+    bool prepared;
+    virErrorPtr err;
+};
+
+
+static void
+qemuBuildNetPrepareClear(qemuBuildNetPreparePtr data)
 {
-    int ret = -1;
-    char *nic = NULL, *host = NULL;
-    int *tapfd = NULL;
-    size_t tapfdSize = 0;
-    int *vhostfd = NULL;
-    size_t vhostfdSize = 0;
-    char **tapfdName = NULL;
-    char **vhostfdName = NULL;
-    virDomainNetType actualType = virDomainNetGetActualType(net);
-    virNetDevBandwidthPtr actualBandwidth;
     size_t i;
 
+    for (i = 0; data->tapfd && i < data->tapfdSize; i++)
+        VIR_FORCE_CLOSE(data->tapfd[i]);
+    for (i = 0; data->vhostfd && i < data->vhostfdSize; i++)
+        VIR_FORCE_CLOSE(data->vhostfd[i]);
+    VIR_FREE(data->tapfd);
+    VIR_FREE(data->vhostfd);
+    data->tapfdSize = 0;
+    data->vhostfdSize = 0;
+    virFreeError(data->err);
+    data->err = NULL;
+}
 
-    if (!bootindex)
-        bootindex = net->info.bootIndex;
+
+/**
+ * qemuBuildInterfacePrepare:
+ * @data: interface to prepare
+ *
+ * Create the host side of the interface (tap or macvtap device,
+ * bandwidth, MTU) and open its vhost-net file descriptors. This does
+ * not touch the command line and may therefore run in a helper thread
+ * while other interfaces are being prepared.
+ *
+ * On success @data->prepared is set. On failure, the error is stored
+ * in @data->err.
+ */
+static void
+qemuBuildInterfacePrepare(qemuBuildNetPreparePtr data)
+{
+    virQEMUDriverPtr driver = data->driver;
+    virDomainDefPtr def = data->def;
+    virDomainNetDefPtr net = data->net;
+    virDomainNetType actualType = virDomainNetGetActualType(net);
+    virNetDevBandwidthPtr actualBandwidth;
+    unsigned long long then = 0;
+    unsigned long long now = 0;
+    virErrorPtr err;
 
     /* Currently nothing besides TAP devices supports multiqueue. */
     if (net->driver.virtio.queues > 0 &&
@@ -8448,7 +8523,7 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                        _("Multiqueue network is not supported for: %s"),
                        virDomainNetTypeToString(actualType));
-        return -1;
+        goto error;
     }
 
     /* and only TAP devices support nwfilter rules */
@@ -8460,7 +8535,7 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
                        _("filterref is not supported for "
                          "network interfaces of type %s"),
                        virDomainNetTypeToString(actualType));
-        return -1;
+        goto error;
     }
 
     if (net->backend.tap &&
@@ -8470,59 +8545,246 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                        _("Custom tap device path is not supported for: %s"),
                        virDomainNetTypeToString(actualType));
-        return -1;
+        goto error;
     }
 
+    ignore_value(virTimeMillisNow(&then));
+
     switch (actualType) {
     case VIR_DOMAIN_NET_TYPE_NETWORK:
     case VIR_DOMAIN_NET_TYPE_BRIDGE:
-        tapfdSize = net->driver.virtio.queues;
-        if (!tapfdSize)
-            tapfdSize = 1;
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+        data->tapfdSize = net->driver.virtio.queues;
+        if (!data->tapfdSize)
+            data->tapfdSize = 1;
 
-        if (VIR_ALLOC_N(tapfd, tapfdSize) < 0 ||
-            VIR_ALLOC_N(tapfdName, tapfdSize) < 0)
-            goto cleanup;
+        if (VIR_ALLOC_N(data->tapfd, data->tapfdSize) < 0)
+            goto error;
 
-        memset(tapfd, -1, tapfdSize * sizeof(tapfd[0]));
+        memset(data->tapfd, -1, data->tapfdSize * sizeof(data->tapfd[0]));
 
-        if (qemuInterfaceBridgeConnect(def, driver, net,
-                                       tapfd, &tapfdSize) < 0)
-            goto cleanup;
+        if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+            if (qemuInterfaceDirectConnect(def, driver, net, data->tapfd,
+                                           data->tapfdSize, data->vmop) < 0)
+                goto error;
+        } else if (actualType == VIR_DOMAIN_NET_TYPE_ETHERNET) {
+            if (qemuInterfaceEthernetConnect(def, driver, net, data->tapfd,
+                                             data->tapfdSize) < 0)
+                goto error;
+        } else {
+            if (qemuInterfaceBridgeConnect(def, driver, net, data->tapfd,
+                                           &data->tapfdSize) < 0)
+                goto error;
+        }
         break;
 
-    case VIR_DOMAIN_NET_TYPE_DIRECT:
-        tapfdSize = net->driver.virtio.queues;
-        if (!tapfdSize)
-            tapfdSize = 1;
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        /* Neither of these has anything to set up on the host here;
+         * see qemuBuildInterfaceCommandLine */
+        data->prepared = true;
+        return;
 
-        if (VIR_ALLOC_N(tapfd, tapfdSize) < 0 ||
-            VIR_ALLOC_N(tapfdName, tapfdSize) < 0)
-            goto cleanup;
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        /* nada */
+        break;
+    }
 
-        memset(tapfd, -1, tapfdSize * sizeof(tapfd[0]));
+    /* Set bandwidth or warn if requested and not supported. */
+    actualBandwidth = virDomainNetGetActualBandwidth(net);
+    if (actualBandwidth) {
+        if (virNetDevSupportBandwidth(actualType)) {
+            if (virNetDevBandwidthSet(net->ifname, actualBandwidth, false,
+                                      !virDomainNetTypeSharesHostView(net)) < 0)
+                goto error;
+        } else {
+            VIR_WARN("setting bandwidth on interfaces of "
+                     "type '%s' is not implemented yet",
+                     virDomainNetTypeToString(actualType));
+        }
+    }
 
-        if (qemuInterfaceDirectConnect(def, driver, net,
-                                       tapfd, tapfdSize, vmop) < 0)
-            goto cleanup;
-        break;
+    if (net->mtu &&
+        virNetDevSetMTU(net->ifname, net->mtu) < 0)
+        goto error;
 
-    case VIR_DOMAIN_NET_TYPE_ETHERNET:
-        tapfdSize = net->driver.virtio.queues;
-        if (!tapfdSize)
-            tapfdSize = 1;
+    ignore_value(virTimeMillisNow(&now));
+    data->tapTime = now - then;
+    then = now;
 
-        if (VIR_ALLOC_N(tapfd, tapfdSize) < 0 ||
-            VIR_ALLOC_N(tapfdName, tapfdSize) < 0)
-            goto cleanup;
+    if ((actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+         actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
+         actualType == VIR_DOMAIN_NET_TYPE_ETHERNET ||
+         actualType == VIR_DOMAIN_NET_TYPE_DIRECT) &&
+        !data->standalone) {
+        /* Attempt to use vhost-net mode for these types of
+           network device */
+        data->vhostfdSize = net->driver.virtio.queues;
+        if (!data->vhostfdSize)
+            data->vhostfdSize = 1;
 
-        memset(tapfd, -1, tapfdSize * sizeof(tapfd[0]));
+        if (VIR_ALLOC_N(data->vhostfd, data->vhostfdSize) < 0)
+            goto error;
 
-        if (qemuInterfaceEthernetConnect(def, driver, net,
-                                         tapfd, tapfdSize) < 0)
-            goto cleanup;
-        break;
+        memset(data->vhostfd, -1,
+               data->vhostfdSize * sizeof(data->vhostfd[0]));
+
+        if (qemuInterfaceOpenVhostNet(def, net, data->qemuCaps,
+                                      data->vhostfd, &data->vhostfdSize) < 0)
+            goto error;
+    }
+
+    ignore_value(virTimeMillisNow(&now));
+    data->vhostTime = now - then;
+
+    VIR_DEBUG("Prepared interface %s: tap setup %llu ms, vhost setup %llu ms",
+              NULLSTR(net->ifname), data->tapTime, data->vhostTime);
+
+    data->prepared = true;
+    return;
+
+ error:
+    err = virSaveLastError();
+    virDomainConfNWFilterTeardown(net);
+    qemuBuildNetPrepareClear(data);
+    data->err = err;
+}
+
+
+typedef struct _qemuBuildNetPreparePool qemuBuildNetPreparePool;
+typedef qemuBuildNetPreparePool *qemuBuildNetPreparePoolPtr;
+struct _qemuBuildNetPreparePool {
+    virMutex lock;
+    size_t next;
+
+    qemuBuildNetPreparePtr data;
+    size_t ndata;
+};
+
+
+static void
+qemuBuildNetPrepareWorker(void *opaque)
+{
+    qemuBuildNetPreparePoolPtr pool = opaque;
+
+    while (true) {
+        size_t i;
+
+        virMutexLock(&pool->lock);
+        i = pool->next++;
+        virMutexUnlock(&pool->lock);
+
+        if (i >= pool->ndata)
+            break;
+
+        qemuBuildInterfacePrepare(&pool->data[i]);
+    }
+}
+
+
+/**
+ * qemuBuildNetPrepareAll:
+ * @data: interfaces to prepare
+ * @ndata: number of items in @data
+ *
+ * Prepare the host side of all interfaces in @data. Every interface's
+ * tap devices and vhost-net file descriptors are set up independently
+ * of all the others, so with more than one interface the work is spread
+ * over up to QEMU_BUILD_NET_PREPARE_WORKERS threads, one of which is the
+ * calling thread. The outcome of each interface is recorded in its own
+ * @data item.
+ *
+ * Returns 0 on success, -1 if the work could not be started at all.
+ */
+static int
+qemuBuildNetPrepareAll(qemuBuildNetPreparePtr data,
+                       size_t ndata)
+{
+    qemuBuildNetPreparePool pool = { .next = 0, .data = data, .ndata = ndata };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t nworkers = MIN(ndata, QEMU_BUILD_NET_PREPARE_WORKERS);
+    char ebuf[1024];
+    unsigned long long then = 0;
+    unsigned long long now = 0;
+    size_t i;
+
+    if (virMutexInit(&pool.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    ignore_value(virTimeMillisNow(&then));
+
+    if (nworkers > 1 &&
+        VIR_ALLOC_N_QUIET(threads, nworkers - 1) == 0) {
+        for (nthreads = 0; nthreads < nworkers - 1; nthreads++) {
+            if (virThreadCreate(&threads[nthreads], true,
+                                qemuBuildNetPrepareWorker, &pool) < 0) {
+                VIR_WARN("Unable to create interface setup thread: %s",
+                         virStrerror(errno, ebuf, sizeof(ebuf)));
+                break;
+            }
+        }
+    }
+
+    qemuBuildNetPrepareWorker(&pool);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_DEBUG("Prepared %zu network interfaces using %zu threads in %llu ms",
+              ndata, nthreads + 1, now - then);
+
+    VIR_FREE(threads);
+    virMutexDestroy(&pool.lock);
+    return 0;
+}
+
+
+static int
+qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
+                              virLogManagerPtr logManager,
+                              virCommandPtr cmd,
+                              virDomainDefPtr def,
+                              virDomainNetDefPtr net,
+                              virQEMUCapsPtr qemuCaps,
+                              qemuBuildNetPreparePtr prep,
+                              int vlan,
+                              unsigned int bootindex,
+                              size_t *nnicindexes,
+                              int **nicindexes,
+                              bool chardevStdioLogd)
+{
+    int ret = -1;
+    char *nic = NULL, *host = NULL;
+    int *tapfd = prep->tapfd;
+    size_t tapfdSize = prep->tapfdSize;
+    int *vhostfd = prep->vhostfd;
+    size_t vhostfdSize = prep->vhostfdSize;
+    char **tapfdName = NULL;
+    char **vhostfdName = NULL;
+    virDomainNetType actualType = virDomainNetGetActualType(net);
+    size_t i;
+
+    /* The fds are ours from now on */
+    prep->tapfd = NULL;
+    prep->tapfdSize = 0;
+    prep->vhostfd = NULL;
+    prep->vhostfdSize = 0;
+
+    if (!bootindex)
+        bootindex = net->info.bootIndex;
 
+    switch (actualType) {
     case VIR_DOMAIN_NET_TYPE_HOSTDEV:
         /* NET_TYPE_HOSTDEV devices are really hostdev devices, so
          * their commandlines are constructed with other hostdevs.
@@ -8538,6 +8800,10 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
         goto cleanup;
         break;
 
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
     case VIR_DOMAIN_NET_TYPE_USER:
     case VIR_DOMAIN_NET_TYPE_SERVER:
     case VIR_DOMAIN_NET_TYPE_CLIENT:
@@ -8545,10 +8811,13 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
     case VIR_DOMAIN_NET_TYPE_INTERNAL:
     case VIR_DOMAIN_NET_TYPE_UDP:
     case VIR_DOMAIN_NET_TYPE_LAST:
-        /* nada */
         break;
     }
 
+    if ((tapfdSize && VIR_ALLOC_N(tapfdName, tapfdSize) < 0) ||
+        (vhostfdSize && VIR_ALLOC_N(vhostfdName, vhostfdSize) < 0))
+        goto cleanup;
+
     /* For types whose implementations use a netdev on the host, add
      * an entry to nicindexes for passing on to systemd.
     */
@@ -8594,46 +8863,6 @@ qemuBuildInterfaceCommandLine(virQEMUDriverPtr driver,
        break;
     }
 
-    /* Set bandwidth or warn if requested and not supported. */
-    actualBandwidth = virDomainNetGetActualBandwidth(net);
-    if (actualBandwidth) {
-        if (virNetDevSupportBandwidth(actualType)) {
-            if (virNetDevBandwidthSet(net->ifname, actualBandwidth, false,
-                                      !virDomainNetTypeSharesHostView(net)) < 0)
-                goto cleanup;
-        } else {
-            VIR_WARN("setting bandwidth on interfaces of "
-                     "type '%s' is not implemented yet",
-                     virDomainNetTypeToString(actualType));
-        }
-    }
-
-    if (net->mtu &&
-        virNetDevSetMTU(net->ifname, net->mtu) < 0)
-        goto cleanup;
-
-    if ((actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-         actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
-         actualType == VIR_DOMAIN_NET_TYPE_ETHERNET ||
-         actualType == VIR_DOMAIN_NET_TYPE_DIRECT) &&
-        !standalone) {
-        /* Attempt to use vhost-net mode for these types of
-           network device */
-        vhostfdSize = net->driver.virtio.queues;
-        if (!vhostfdSize)
-            vhostfdSize = 1;
-
-        if (VIR_ALLOC_N(vhostfd, vhostfdSize) < 0 ||
-            VIR_ALLOC_N(vhostfdName, vhostfdSize))
-            goto cleanup;
-
-        memset(vhostfd, -1, vhostfdSize * sizeof(vhostfd[0]));
-
-        if (qemuInterfaceOpenVhostNet(def, net, qemuCaps,
-                                      vhostfd, &vhostfdSize) < 0)
-            goto cleanup;
-    }
-
     for (i = 0; i < tapfdSize; i++) {
         if (qemuSecuritySetTapFDLabel(driver->securityManager,
                                       def, tapfd[i]) < 0)
@@ -8734,12 +8963,27 @@ qemuBuildNetCommandLine(virQEMUDriverPtr driver,
                         bool chardevStdioLogd)
 {
     size_t i;
-    int last_good_net = -1;
+    qemuBuildNetPreparePtr prep = NULL;
     virErrorPtr originalError = NULL;
 
     if (def->nnets) {
         unsigned int bootNet = 0;
 
+        if (VIR_ALLOC_N(prep, def->nnets) < 0)
+            return -1;
+
+        for (i = 0; i < def->nnets; i++) {
+            prep[i].driver = driver;
+            prep[i].def = def;
+            prep[i].net = def->nets[i];
+            prep[i].qemuCaps = qemuCaps;
+            prep[i].vmop = vmop;
+            prep[i].standalone = standalone;
+        }
+
+        if (qemuBuildNetPrepareAll(prep, def->nnets) < 0)
+            goto error;
+
         if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_BOOTINDEX)) {
             /* convert <boot dev='network'/> to bootindex since we didn't emit
              * -boot n
@@ -8762,14 +9006,20 @@ qemuBuildNetCommandLine(virQEMUDriverPtr driver,
             else
                 vlan = i;
 
+            if (!prep[i].prepared) {
+                virSetError(prep[i].err);
+                goto error;
+            }
+
             if (qemuBuildInterfaceCommandLine(driver, logManager, cmd, def, net,
-                                              qemuCaps, vlan, bootNet, vmop,
-                                              standalone, nnicindexes,
-                                              nicindexes,
-                                              chardevStdioLogd) < 0)
+                                              qemuCaps, &prep[i], vlan, bootNet,
+                                              nnicindexes, nicindexes,
+                                              chardevStdioLogd) < 0) {
+                /* the interface has cleaned up after itself */
+                prep[i].prepared = false;
                 goto error;
+            }
 
-            last_good_net = i;
             /* if this interface is a type='hostdev' interface and we
              * haven't yet added a "bootindex" parameter to an
              * emulated network device, save the bootindex - hostdev
@@ -8783,14 +9033,22 @@ qemuBuildNetCommandLine(virQEMUDriverPtr driver,
             bootNet = 0;
         }
     }
+
+    for (i = 0; prep && i < def->nnets; i++)
+        qemuBuildNetPrepareClear(&prep[i]);
+    VIR_FREE(prep);
     return 0;
 
  error:
     /* free up any resources in the network driver
      * but don't overwrite the original error */
     originalError = virSaveLastError();
-    for (i = 0; last_good_net != -1 && i <= last_good_net; i++)
-        virDomainConfNWFilterTeardown(def->nets[i]);
+    for (i = 0; i < def->nnets; i++) {
+        if (prep[i].prepared)
+            virDomainConfNWFilterTeardown(def->nets[i]);
+        qemuBuildNetPrepareClear(&prep[i]);
+    }
+    VIR_FREE(prep);
     virSetError(originalError);
     virFreeError(originalError);
     return -1;
@@ -156,6 +156,7 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
         cfg->group = (gid_t)-1;
     }
     cfg->dynamicOwnership = privileged;
+    cfg->rememberOwner = privileged;
 
     cfg->cgroupControllers = -1; /* -1 == auto-detect */
 
@@ -315,6 +316,8 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->autoStartParallel = 1;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
@@ -323,6 +326,9 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->glusterDebugLevel = 4;
     cfg->stdioLogD = true;
 
+    cfg->statsHistoryLength = 60;
+    cfg->statusSaveDelay = 100;
+
     if (!(cfg->namespaces = virBitmapNew(QEMU_DOMAIN_NS_LAST)))
         goto error;
 
@@ -349,6 +355,7 @@ static void virQEMUDriverConfigDispose(void *obj)
     virQEMUDriverConfigPtr cfg = obj;
 
     virBitmapFree(cfg->namespaces);
+    virBitmapFree(cfg->housekeepingCpus);
 
     virStringListFree(cfg->cgroupDeviceACL);
 
@@ -481,6 +488,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     char **nvram = NULL;
     char *corestr = NULL;
     char **namespaces = NULL;
+    char *housekeeping = NULL;
+    unsigned int thinExtendSize = 0;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -697,6 +706,9 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueBool(conf, "dynamic_ownership", &cfg->dynamicOwnership) < 0)
         goto cleanup;
 
+    if (virConfGetValueBool(conf, "remember_owner", &cfg->rememberOwner) < 0)
+        goto cleanup;
+
     if (virConfGetValueStringList(conf,  "cgroup_controllers", false,
                                   &controllers) < 0)
         goto cleanup;
@@ -732,6 +744,13 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueBool(conf, "auto_start_bypass_cache", &cfg->autoStartBypassCache) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "auto_start_parallel", &cfg->autoStartParallel) < 0)
+        goto cleanup;
+    if (cfg->autoStartParallel == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("auto_start_parallel must be greater than 0"));
+        goto cleanup;
+    }
 
     if (virConfGetValueStringList(conf, "hugetlbfs_mount", true,
                                   &hugetlbfs) < 0)
@@ -756,6 +775,34 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         }
     }
 
+    if (virConfGetValueBool(conf, "hugepages_auto_grow", &cfg->hugepagesAutoGrow) < 0)
+        goto cleanup;
+
+    if (virConfGetValueString(conf, "housekeeping_cpus", &housekeeping) < 0)
+        goto cleanup;
+    if (housekeeping) {
+        virBitmapFree(cfg->housekeepingCpus);
+        cfg->housekeepingCpus = NULL;
+
+        if (virBitmapParse(housekeeping, &cfg->housekeepingCpus,
+                           VIR_DOMAIN_CPUMASK_LEN) < 0)
+            goto cleanup;
+
+        if (virBitmapIsAllClear(cfg->housekeepingCpus)) {
+            virReportError(VIR_ERR_CONF_SYNTAX,
+                           _("Invalid value '%s' for housekeeping_cpus"),
+                           housekeeping);
+            goto cleanup;
+        }
+    }
+
+    if (virConfGetValueBool(conf, "auto_iothreads", &cfg->autoIOThreads) < 0)
+        goto cleanup;
+
+    if (virConfGetValueUInt(conf, "thin_extend_size", &thinExtendSize) < 0)
+        goto cleanup;
+    cfg->thinExtendSize = (unsigned long long) thinExtendSize << 20;
+
     if (virConfGetValueString(conf, "bridge_helper", &cfg->bridgeHelperName) < 0)
         goto cleanup;
 
@@ -912,6 +959,41 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueString(conf, "memory_backing_dir", &cfg->memoryBackingDir) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "stats_history_interval",
+                            &cfg->statsHistoryInterval) < 0 ||
+        virConfGetValueUInt(conf, "stats_history_length",
+                            &cfg->statsHistoryLength) < 0)
+        goto cleanup;
+
+    if (cfg->statsHistoryInterval > INT_MAX / 1000) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("stats_history_interval is too long"));
+        goto cleanup;
+    }
+
+    if (cfg->statsHistoryLength == 0 ||
+        cfg->statsHistoryLength > QEMU_STATS_HISTORY_LENGTH_MAX) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("stats_history_length must be between 1 and %d"),
+                       QEMU_STATS_HISTORY_LENGTH_MAX);
+        goto cleanup;
+    }
+
+    if (virConfGetValueUInt(conf, "status_save_delay",
+                            &cfg->statusSaveDelay) < 0)
+        goto cleanup;
+
+    if (cfg->statusSaveDelay > QEMU_STATUS_SAVE_DELAY_MAX) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("status_save_delay must not exceed %d"),
+                       QEMU_STATUS_SAVE_DELAY_MAX);
+        goto cleanup;
+    }
+
+    if (virConfGetValueBool(conf, "compact_inactive_domains",
+                            &cfg->compactInactiveDomains) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
@@ -920,6 +1002,7 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     virStringListFree(hugetlbfs);
     virStringListFree(nvram);
     VIR_FREE(corestr);
+    VIR_FREE(housekeeping);
     VIR_FREE(user);
     VIR_FREE(group);
     virConfFree(conf);
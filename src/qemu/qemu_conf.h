@@ -61,12 +61,39 @@
 
 # define QEMU_DRIVER_NAME "QEMU"
 
+/* Upper limit of the stats_history_length setting */
+# define QEMU_STATS_HISTORY_LENGTH_MAX 4096
+
+/* Upper limit of the status_save_delay setting, in milliseconds */
+# define QEMU_STATUS_SAVE_DELAY_MAX 10000
+
 typedef struct _virQEMUDriver virQEMUDriver;
 typedef virQEMUDriver *virQEMUDriverPtr;
 
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+/* Defined and used by qemu_driver.c only */
+typedef struct _qemuDomainStatsSubscription qemuDomainStatsSubscription;
+typedef qemuDomainStatsSubscription *qemuDomainStatsSubscriptionPtr;
+
+/* Defined and used by qemu_domain.c only */
+typedef struct _qemuDomainStatusWriter qemuDomainStatusWriter;
+typedef qemuDomainStatusWriter *qemuDomainStatusWriterPtr;
+
+/* Defined and used by qemu_domain.c only */
+typedef struct _qemuDomainDevTemplate qemuDomainDevTemplate;
+typedef qemuDomainDevTemplate *qemuDomainDevTemplatePtr;
+
+/* Huge pages set aside for a domain until its memory is allocated */
+typedef struct _qemuHugepageReservation qemuHugepageReservation;
+typedef qemuHugepageReservation *qemuHugepageReservationPtr;
+struct _qemuHugepageReservation {
+    int node;                   /* host NUMA node, -1 for the whole host */
+    unsigned int size;          /* huge page size in KiB */
+    unsigned long long count;   /* number of pages */
+};
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -90,6 +117,7 @@ struct _virQEMUDriverConfig {
     uid_t user;
     gid_t group;
     bool dynamicOwnership;
+    bool rememberOwner;
 
     virBitmapPtr namespaces;
 
@@ -162,6 +190,10 @@ struct _virQEMUDriverConfig {
     bool clearEmulatorCapabilities;
     bool allowDiskFormatProbing;
     bool setProcessName;
+    bool hugepagesAutoGrow;
+    virBitmapPtr housekeepingCpus;
+    bool autoIOThreads;
+    unsigned long long thinExtendSize; /* in bytes, 0 disables */
 
     unsigned int maxProcesses;
     unsigned int maxFiles;
@@ -181,6 +213,7 @@ struct _virQEMUDriverConfig {
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    unsigned int autoStartParallel;
 
     char *lockManagerName;
 
@@ -206,6 +239,13 @@ struct _virQEMUDriverConfig {
 
     bool vxhsTLS;
     char *vxhsTLSx509certdir;
+
+    unsigned int statsHistoryInterval;
+    unsigned int statsHistoryLength;
+
+    unsigned int statusSaveDelay;
+
+    bool compactInactiveDomains;
 };
 
 /* Main driver state */
@@ -219,6 +259,39 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr statsPool;
+
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr reconnectPool;
+
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr statsStreamPool;
+
+    /* Immutable pointer, self-locking APIs. NULL if
+     * stats_history_interval is 0 */
+    virThreadPoolPtr statsHistoryPool;
+
+    /* Immutable value. -1 if stats_history_interval is 0 */
+    int statsHistoryTimer;
+
+    /* Immutable pointer, self-locking APIs. NULL if
+     * status_save_delay is 0 */
+    qemuDomainStatusWriterPtr statusWriter;
+
+    /* Require lock while using. Subscriptions are self-locking */
+    qemuDomainStatsSubscriptionPtr *statsSubscriptions;
+    size_t nstatsSubscriptions;
+    int nextStatsSubscriptionID;
+
+    /* Require lock while using */
+    qemuHugepageReservationPtr hugepageReservations;
+    size_t nhugepageReservations;
+
+    /* Require lock to get a reference on the object,
+     * lockless access thereafter */
+    qemuDomainDevTemplatePtr devTemplate;
+
     /* Atomic increment only */
     int lastvmid;
 
@@ -50,6 +50,7 @@
 #include "virprocess.h"
 #include "vircrypto.h"
 #include "virsystemd.h"
+#include "virprobe.h"
 #include "secret_util.h"
 #include "logging/log_manager.h"
 #include "locking/domain_lock.h"
@@ -73,6 +74,7 @@
 
 #include <libxml/xpathInternals.h>
 #include "dosname.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -106,6 +108,18 @@ VIR_ENUM_IMPL(qemuDomainNamespace, QEMU_DOMAIN_NS_LAST,
               "mount",
 );
 
+VIR_ENUM_IMPL(qemuDomainStartPhase, QEMU_DOMAIN_START_PHASE_LAST,
+              "init",
+              "prepare",
+              "command",
+              "exec",
+              "cgroup",
+              "label",
+              "monitor",
+              "qmp",
+              "resume",
+);
+
 
 #define PROC_MOUNTS "/proc/mounts"
 #define DEVPREFIX "/dev/"
@@ -295,14 +309,6 @@ qemuDomainObjInitJob(qemuDomainObjPrivatePtr priv)
 {
     memset(&priv->job, 0, sizeof(priv->job));
 
-    if (virCondInit(&priv->job.cond) < 0)
-        return -1;
-
-    if (virCondInit(&priv->job.asyncCond) < 0) {
-        virCondDestroy(&priv->job.cond);
-        return -1;
-    }
-
     return 0;
 }
 
@@ -358,8 +364,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     VIR_FREE(priv->job.current);
     VIR_FREE(priv->job.completed);
-    virCondDestroy(&priv->job.cond);
-    virCondDestroy(&priv->job.asyncCond);
+    VIR_FREE(priv->job.waiters);
 }
 
 static bool
@@ -891,6 +896,7 @@ qemuDomainSecretInfoFree(qemuDomainSecretInfoPtr *secinfo)
 
 
 static virClassPtr qemuDomainDiskPrivateClass;
+static void qemuDomainDiskPrivateDispose(void *obj);
 
 static int
 qemuDomainDiskPrivateOnceInit(void)
@@ -898,7 +904,7 @@ qemuDomainDiskPrivateOnceInit(void)
     qemuDomainDiskPrivateClass = virClassNew(virClassForObject(),
                                              "qemuDomainDiskPrivate",
                                              sizeof(qemuDomainDiskPrivate),
-                                             NULL);
+                                             qemuDomainDiskPrivateDispose);
     if (!qemuDomainDiskPrivateClass)
         return -1;
     else
@@ -922,6 +928,15 @@ qemuDomainDiskPrivateNew(void)
 }
 
 
+static void
+qemuDomainDiskPrivateDispose(void *obj)
+{
+    qemuDomainDiskPrivatePtr priv = obj;
+
+    virStorageSourceFree(priv->backupTarget);
+}
+
+
 static virClassPtr qemuDomainStorageSourcePrivateClass;
 static void qemuDomainStorageSourcePrivateDispose(void *obj);
 
@@ -1048,6 +1063,7 @@ qemuDomainVcpuPrivateDispose(void *obj)
 
     VIR_FREE(priv->type);
     VIR_FREE(priv->alias);
+    virObjectUnref(priv->monitor);
     return;
 }
 
@@ -1814,6 +1830,9 @@ qemuDomainObjPrivateDataClear(qemuDomainObjPrivatePtr priv)
     virPerfFree(priv->perf);
     priv->perf = NULL;
 
+    virObjectUnref(priv->monitor);
+    priv->monitor = NULL;
+
     VIR_FREE(priv->machineName);
 
     virObjectUnref(priv->qemuCaps);
@@ -1850,6 +1869,98 @@ qemuDomainObjPrivateDataClear(qemuDomainObjPrivatePtr priv)
 
     virBitmapFree(priv->migrationCaps);
     priv->migrationCaps = NULL;
+
+    qemuDomainStatsHistoryFree(priv->statsHistory);
+    priv->statsHistory = NULL;
+
+    priv->memStatsExpiry = 0;
+    priv->nmemStats = 0;
+
+    if (priv->memPeekFifo)
+        unlink(priv->memPeekFifo);
+    VIR_FREE(priv->memPeekFifo);
+}
+
+
+/**
+ * qemuDomainObjClearValidated:
+ * @priv: domain private data
+ *
+ * Forgets which definition was validated last, so that the next start
+ * validates the definition again.
+ */
+void
+qemuDomainObjClearValidated(qemuDomainObjPrivatePtr priv)
+{
+    priv->validatedDefGeneration = 0;
+    priv->validatedQEMUCapsSerial = 0;
+}
+
+
+/**
+ * qemuDomainProcessEventSubmit:
+ * @driver: qemu driver data
+ * @event: the event, holding a reference on its domain
+ *
+ * Queue @event for processing in the driver's worker pool. Events of
+ * one domain are handled by one worker at a time in the order they
+ * were submitted, while events of different domains are handled in
+ * parallel. The domain object must be locked.
+ *
+ * Returns 0 on success, -1 on error in which case @event still
+ * belongs to the caller.
+ */
+int
+qemuDomainProcessEventSubmit(virQEMUDriverPtr driver,
+                             struct qemuProcessEvent *event)
+{
+    virDomainObjPtr vm = event->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (VIR_APPEND_ELEMENT_COPY(priv->events, priv->nevents, event) < 0)
+        return -1;
+
+    if (priv->eventsScheduled)
+        return 0;
+
+    /* The worker holds its own reference for as long as it drains
+     * the queue */
+    virObjectRef(vm);
+    if (virThreadPoolSendJob(driver->workerPool, 0, vm) < 0) {
+        virObjectUnref(vm);
+        VIR_DELETE_ELEMENT(priv->events, priv->nevents - 1, priv->nevents);
+        return -1;
+    }
+
+    priv->eventsScheduled = true;
+    return 0;
+}
+
+
+/**
+ * qemuDomainProcessEventNext:
+ * @vm: locked domain object
+ *
+ * Take the oldest event queued by qemuDomainProcessEventSubmit(). Once
+ * the queue is empty the calling worker no longer owns it, and the next
+ * event submitted schedules a new job.
+ *
+ * Returns the event or NULL if there are no more.
+ */
+struct qemuProcessEvent *
+qemuDomainProcessEventNext(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuProcessEvent *event;
+
+    if (priv->nevents == 0) {
+        priv->eventsScheduled = false;
+        return NULL;
+    }
+
+    event = priv->events[0];
+    VIR_DELETE_ELEMENT(priv->events, 0, priv->nevents);
+    return event;
 }
 
 
@@ -1880,6 +1991,10 @@ qemuDomainObjPrivateFree(void *data)
 
     qemuDomainSecretInfoFree(&priv->migSecinfo);
     qemuDomainMasterKeyFree(priv);
+    qemuDomainObjClearValidated(priv);
+
+    /* Every queued event holds a reference, so this is always empty */
+    VIR_FREE(priv->events);
 
     VIR_FREE(priv);
 }
@@ -4233,14 +4348,10 @@ virDomainDefParserConfig virQEMUDriverDomainDefParserConfig = {
 static void
 qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-
     if (virDomainObjIsActive(obj)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, obj) < 0)
             VIR_WARN("Failed to save status on vm %s", obj->def->name);
     }
-
-    virObjectUnref(cfg);
 }
 
 void
@@ -4266,7 +4377,11 @@ qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
 
     priv->job.phase = phase;
     priv->job.asyncOwner = me;
-    qemuDomainObjSaveJob(driver, obj);
+
+    /* recovering async jobs after a restart relies on the phase */
+    if (virDomainObjIsActive(obj) &&
+        qemuDomainObjFlushStatus(driver, obj) < 0)
+        VIR_WARN("Failed to save status on vm %s", obj->def->name);
 }
 
 void
@@ -4281,6 +4396,20 @@ qemuDomainObjSetAsyncJobMask(virDomainObjPtr obj,
     priv->job.mask = allowedJobs | JOB_MASK(QEMU_JOB_DESTROY);
 }
 
+static void qemuDomainObjWakeJobWaiter(qemuDomainObjPrivatePtr priv);
+
+/* Milliseconds since @since, or 0 if @since is not set */
+static unsigned long long
+qemuDomainJobElapsed(unsigned long long since)
+{
+    unsigned long long now;
+
+    if (!since || virTimeMillisNow(&now) < 0 || now < since)
+        return 0;
+
+    return now - since;
+}
+
 void
 qemuDomainObjDiscardAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 {
@@ -4290,6 +4419,7 @@ qemuDomainObjDiscardAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
         qemuDomainObjResetJob(priv);
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
+    qemuDomainObjWakeJobWaiter(priv);
 }
 
 void
@@ -4320,6 +4450,162 @@ qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
     return !priv->job.active && qemuDomainNestedJobAllowed(priv, job);
 }
 
+static bool
+qemuDomainObjCanStartJob(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
+{
+    if (job == QEMU_JOB_ASYNC_NESTED)
+        return !priv->job.active;
+
+    return qemuDomainJobAllowed(priv, job);
+}
+
+/* Jobs which the rest have to wait for are served first, the others in
+ * the order they arrived in */
+static unsigned int
+qemuDomainJobPriority(qemuDomainJob job)
+{
+    switch (job) {
+    case QEMU_JOB_DESTROY:
+    case QEMU_JOB_ABORT:
+    case QEMU_JOB_ASYNC_NESTED:
+        return 0;
+
+    case QEMU_JOB_NONE:
+    case QEMU_JOB_QUERY:
+    case QEMU_JOB_SUSPEND:
+    case QEMU_JOB_MODIFY:
+    case QEMU_JOB_MIGRATION_OP:
+    case QEMU_JOB_ASYNC:
+    case QEMU_JOB_LAST:
+        break;
+    }
+
+    return 1;
+}
+
+/*
+ * Lets the first waiter whose job can start now go. Only one waiter is
+ * let go at a time; once it starts its job, the next one is considered
+ * when that job ends or, for async jobs, as soon as it has started.
+ */
+static void
+qemuDomainObjWakeJobWaiter(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    if (priv->job.ngranted)
+        return;
+
+    for (i = 0; i < priv->job.nwaiters; i++) {
+        qemuDomainJobWaiterPtr waiter = priv->job.waiters[i];
+
+        if (!qemuDomainObjCanStartJob(priv, waiter->job))
+            continue;
+
+        VIR_DELETE_ELEMENT_INPLACE(priv->job.waiters, i, priv->job.nwaiters);
+        waiter->granted = true;
+        priv->job.ngranted++;
+        virCondSignal(&waiter->cond);
+        return;
+    }
+}
+
+static int
+qemuDomainObjEnqueueJobWaiter(qemuDomainObjPrivatePtr priv,
+                              qemuDomainJobWaiterPtr waiter)
+{
+    size_t i;
+
+    for (i = 0; i < priv->job.nwaiters; i++) {
+        if (priv->job.waiters[i]->priority > waiter->priority)
+            break;
+    }
+
+    return VIR_INSERT_ELEMENT(priv->job.waiters, i, priv->job.nwaiters, waiter);
+}
+
+static void
+qemuDomainObjDequeueJobWaiter(qemuDomainObjPrivatePtr priv,
+                              qemuDomainJobWaiterPtr waiter)
+{
+    size_t i;
+
+    for (i = 0; i < priv->job.nwaiters; i++) {
+        if (priv->job.waiters[i] == waiter) {
+            VIR_DELETE_ELEMENT_INPLACE(priv->job.waiters, i,
+                                       priv->job.nwaiters);
+            return;
+        }
+    }
+}
+
+/*
+ * Waits for its turn to start @job. Jobs are served by priority and in
+ * the order they arrived in, skipping those which cannot run while the
+ * current async job is active.
+ *
+ * Returns 0 once the job may start, -1 with errno set otherwise.
+ */
+static int
+qemuDomainObjWaitForJob(virDomainObjPtr obj,
+                        qemuDomainJob job,
+                        unsigned long long then)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainJobWaiter waiter = {
+        .job = job,
+        .priority = qemuDomainJobPriority(job),
+    };
+    unsigned long long queued = 0;
+    unsigned long long now = 0;
+    int ret = -1;
+    int saved_errno;
+
+    if (!priv->job.nwaiters && !priv->job.ngranted &&
+        qemuDomainObjCanStartJob(priv, job))
+        return 0;
+
+    if (virCondInit(&waiter.cond) < 0)
+        return -1;
+
+    if (qemuDomainObjEnqueueJobWaiter(priv, &waiter) < 0) {
+        errno = ENOMEM;
+        goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&queued));
+    qemuDomainObjWakeJobWaiter(priv);
+
+    while (!waiter.granted) {
+        VIR_DEBUG("Waiting for job (vm=%p name=%s, %zu waiting)",
+                  obj, obj->def->name, priv->job.nwaiters);
+        if (virCondWaitUntil(&waiter.cond, &obj->parent.lock, then) < 0 &&
+            !waiter.granted) {
+            saved_errno = errno;
+            qemuDomainObjDequeueJobWaiter(priv, &waiter);
+            errno = saved_errno;
+            goto cleanup;
+        }
+    }
+
+    priv->job.ngranted--;
+
+    ignore_value(virTimeMillisNow(&now));
+    if (now > queued) {
+        VIR_DEBUG("Job waited %llums in queue (vm=%p name=%s)",
+                  now - queued, obj, obj->def->name);
+        priv->job.waitTime += now - queued;
+    }
+    priv->job.waitCount++;
+    ret = 0;
+
+ cleanup:
+    saved_errno = errno;
+    virCondDestroy(&waiter.cond);
+    errno = saved_errno;
+    return ret;
+}
+
 /* Give up waiting for mutex after 30 seconds */
 #define QEMU_JOB_WAIT_TIME (1000ull * 30)
 
@@ -4335,6 +4621,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long queued;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     bool async = job == QEMU_JOB_ASYNC;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
@@ -4359,36 +4646,33 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         return -1;
     }
 
+    PROBE(QEMU_JOB_BEGIN,
+          "vm=%p name=%s job=%s asyncJob=%s",
+          obj, obj->def->name, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob));
+
     priv->jobs_queued++;
+    queued = now;
     then = now + QEMU_JOB_WAIT_TIME;
 
- retry:
     if (cfg->maxQueuedJobs &&
         priv->jobs_queued > cfg->maxQueuedJobs) {
         goto error;
     }
 
-    while (!nested && !qemuDomainNestedJobAllowed(priv, job)) {
-        VIR_DEBUG("Waiting for async job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.asyncCond, &obj->parent.lock, then) < 0)
-            goto error;
-    }
-
-    while (priv->job.active) {
-        VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
-            goto error;
-    }
-
-    /* No job is active but a new async job could have been started while obj
-     * was unlocked, so we need to recheck it. */
-    if (!nested && !qemuDomainNestedJobAllowed(priv, job))
-        goto retry;
+    if (qemuDomainObjWaitForJob(obj, job, then) < 0)
+        goto error;
 
     qemuDomainObjResetJob(priv);
 
     ignore_value(virTimeMillisNow(&now));
 
+    PROBE(QEMU_JOB_ACQUIRE,
+          "vm=%p name=%s job=%s asyncJob=%s waited=%llu",
+          obj, obj->def->name, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob),
+          now > queued ? now - queued : 0);
+
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
                    qemuDomainJobTypeToString(job),
@@ -4411,6 +4695,9 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         priv->job.asyncOwnerAPI = virThreadJobGet();
         priv->job.asyncStarted = now;
         priv->job.current->started = now;
+
+        /* Jobs allowed during this async job may run now */
+        qemuDomainObjWakeJobWaiter(priv);
     }
 
     if (qemuDomainTrackJob(job))
@@ -4426,6 +4713,12 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     if (priv->job.asyncJob && priv->job.asyncStarted)
         asyncDuration = now - priv->job.asyncStarted;
 
+    PROBE(QEMU_JOB_FAIL,
+          "vm=%p name=%s job=%s asyncJob=%s waited=%llu",
+          obj, obj->def->name, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob),
+          now > queued ? now - queued : 0);
+
     VIR_WARN("Cannot start job (%s, %s) for domain %s; "
              "current job is (%s, %s) owned by (%llu %s, %llu %s) "
              "for (%llus, %llus)",
@@ -4473,6 +4766,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
 
  cleanup:
     priv->jobs_queued--;
+    qemuDomainObjWakeJobWaiter(priv);
     virObjectUnref(cfg);
     return ret;
 }
@@ -4555,10 +4849,16 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    PROBE(QEMU_JOB_END,
+          "vm=%p name=%s job=%s asyncJob=%s held=%llu",
+          obj, obj->def->name, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+          qemuDomainJobElapsed(priv->job.started));
+
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    qemuDomainObjWakeJobWaiter(priv);
 }
 
 void
@@ -4572,9 +4872,15 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    PROBE(QEMU_JOB_END,
+          "vm=%p name=%s job=%s asyncJob=%s held=%llu",
+          obj, obj->def->name, qemuDomainJobTypeToString(QEMU_JOB_ASYNC),
+          qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+          qemuDomainJobElapsed(priv->job.asyncStarted));
+
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
-    virCondBroadcast(&priv->job.asyncCond);
+    qemuDomainObjWakeJobWaiter(priv);
 }
 
 void
@@ -4708,6 +5014,30 @@ qemuDomainObjEnterMonitorAsync(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * obj must be locked before calling
+ *
+ * Waits for the replies to commands queued by qemuMonitorCompletionSubmit
+ * with @obj unlocked. The caller should not hold a job so that a QEMU
+ * which isn't responding doesn't block other jobs, the wait is given up
+ * after the same time as waiting for a job.
+ *
+ * Returns 0 when all replies arrived, -1 on error or timeout.
+ */
+int
+qemuDomainObjWaitMonitorCompletion(virDomainObjPtr obj,
+                                   qemuMonitorCompletionPtr completion)
+{
+    int ret;
+
+    virObjectUnlock(obj);
+    ret = qemuMonitorCompletionWait(completion, QEMU_JOB_WAIT_TIME);
+    virObjectLock(obj);
+
+    return ret;
+}
+
+
 /*
  * obj must be locked before calling
  *
@@ -5607,9 +5937,13 @@ qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
     /* Prefer action on the disks in use at the time the snapshot was
      * created; but fall back to current definition if dealing with a
      * snapshot created prior to libvirt 0.9.5.  */
-    virDomainDefPtr def = snap->def->dom;
+    virDomainDefPtr def;
+
+    if (virDomainSnapshotDefEnsureDom(snap->def, driver->caps,
+                                      driver->xmlopt) < 0)
+        return -1;
 
-    if (!def)
+    if (!(def = snap->def->dom))
         def = vm->def;
     return qemuDomainSnapshotForEachQcow2Raw(driver, def, snap->def->name,
                                              op, try_all, def->ndisks);
@@ -5801,18 +6135,14 @@ qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                         bool value)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if (priv->fakeReboot == value)
-        goto cleanup;
+        return;
 
     priv->fakeReboot = value;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
-
- cleanup:
-    virObjectUnref(cfg);
 }
 
 static void
@@ -6571,26 +6901,64 @@ qemuDomainMigratableDefCheckABIStability(virQEMUDriverPtr driver,
 #define COPY_FLAGS (VIR_DOMAIN_XML_SECURE | \
                     VIR_DOMAIN_XML_MIGRATABLE)
 
+/*
+ * Most of the cost of an ABI check is in turning both definitions into
+ * their migratable form. The formatted XML is a canonical fingerprint of
+ * that form: if it is identical on both sides, parsing it would produce
+ * identical definitions which always pass the detailed comparison, so it
+ * is only parsed and compared device by device on a mismatch, which is
+ * also when a meaningful error needs to be reported.
+ */
+static bool
+qemuDomainMigratableXMLCheckABIStability(virQEMUDriverPtr driver,
+                                         virDomainDefPtr src,
+                                         const char *xmlSrc,
+                                         virDomainDefPtr dst,
+                                         const char *xmlDst)
+{
+    virDomainDefPtr migratableSrc = NULL;
+    virDomainDefPtr migratableDst = NULL;
+    bool ret = false;
+
+    if (STREQ(xmlSrc, xmlDst)) {
+        dst->mem.cur_balloon = src->mem.cur_balloon;
+        return true;
+    }
+
+    if (!(migratableSrc = qemuDomainDefFromXML(driver, xmlSrc)) ||
+        !(migratableDst = qemuDomainDefFromXML(driver, xmlDst)))
+        goto cleanup;
+
+    ret = qemuDomainMigratableDefCheckABIStability(driver,
+                                                   src, migratableSrc,
+                                                   dst, migratableDst);
+
+ cleanup:
+    virDomainDefFree(migratableSrc);
+    virDomainDefFree(migratableDst);
+    return ret;
+}
+
+
 bool
 qemuDomainDefCheckABIStability(virQEMUDriverPtr driver,
                                virDomainDefPtr src,
                                virDomainDefPtr dst)
 {
-    virDomainDefPtr migratableDefSrc = NULL;
-    virDomainDefPtr migratableDefDst = NULL;
+    char *xmlSrc = NULL;
+    char *xmlDst = NULL;
     bool ret = false;
 
-    if (!(migratableDefSrc = qemuDomainDefCopy(driver, src, COPY_FLAGS)) ||
-        !(migratableDefDst = qemuDomainDefCopy(driver, dst, COPY_FLAGS)))
+    if (!(xmlSrc = qemuDomainDefFormatXML(driver, src, COPY_FLAGS)) ||
+        !(xmlDst = qemuDomainDefFormatXML(driver, dst, COPY_FLAGS)))
         goto cleanup;
 
-    ret = qemuDomainMigratableDefCheckABIStability(driver,
-                                                   src, migratableDefSrc,
-                                                   dst, migratableDefDst);
+    ret = qemuDomainMigratableXMLCheckABIStability(driver, src, xmlSrc,
+                                                   dst, xmlDst);
 
  cleanup:
-    virDomainDefFree(migratableDefSrc);
-    virDomainDefFree(migratableDefDst);
+    VIR_FREE(xmlSrc);
+    VIR_FREE(xmlDst);
     return ret;
 }
 
@@ -6600,24 +6968,20 @@ qemuDomainCheckABIStability(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             virDomainDefPtr dst)
 {
-    virDomainDefPtr migratableSrc = NULL;
-    virDomainDefPtr migratableDst = NULL;
-    char *xml = NULL;
+    char *xmlSrc = NULL;
+    char *xmlDst = NULL;
     bool ret = false;
 
-    if (!(xml = qemuDomainFormatXML(driver, vm, COPY_FLAGS)) ||
-        !(migratableSrc = qemuDomainDefFromXML(driver, xml)) ||
-        !(migratableDst = qemuDomainDefCopy(driver, dst, COPY_FLAGS)))
+    if (!(xmlSrc = qemuDomainFormatXML(driver, vm, COPY_FLAGS)) ||
+        !(xmlDst = qemuDomainDefFormatXML(driver, dst, COPY_FLAGS)))
         goto cleanup;
 
-    ret = qemuDomainMigratableDefCheckABIStability(driver,
-                                                   vm->def, migratableSrc,
-                                                   dst, migratableDst);
+    ret = qemuDomainMigratableXMLCheckABIStability(driver, vm->def, xmlSrc,
+                                                   dst, xmlDst);
 
  cleanup:
-    VIR_FREE(xml);
-    virDomainDefFree(migratableSrc);
-    virDomainDefFree(migratableDst);
+    VIR_FREE(xmlSrc);
+    VIR_FREE(xmlDst);
     return ret;
 }
 
@@ -7495,6 +7859,38 @@ qemuDomainGetVcpuPid(virDomainObjPtr vm,
 }
 
 
+/**
+ * qemuDomainPerfEventResctrlType:
+ * @type: perf event
+ *
+ * The Intel RDT perf events are deprecated in favour of the monitoring
+ * groups of resctrl, which also allow per-vCPU accounting.  When the host
+ * supports it those events are gathered from resctrl instead of perf.
+ *
+ * Returns the resctrl monitoring feature (virResctrlMonitorType) used for
+ * @type or -1 if @type should be handled by perf.
+ */
+int
+qemuDomainPerfEventResctrlType(virPerfEventType type)
+{
+    virResctrlMonitorType montype;
+
+    if (type == VIR_PERF_EVENT_CMT)
+        montype = VIR_RESCTRL_MONITOR_LLC_OCCUPANCY;
+    else if (type == VIR_PERF_EVENT_MBMT)
+        montype = VIR_RESCTRL_MONITOR_MBM_TOTAL_BYTES;
+    else if (type == VIR_PERF_EVENT_MBML)
+        montype = VIR_RESCTRL_MONITOR_MBM_LOCAL_BYTES;
+    else
+        return -1;
+
+    if (!virResctrlMonitorIsSupported(montype))
+        return -1;
+
+    return montype;
+}
+
+
 /**
  * qemuDomainValidateVcpuInfo:
  *
@@ -7566,21 +7962,25 @@ qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
                           int asyncJob,
                           bool state)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainVcpuDefPtr vcpu;
     qemuDomainVcpuPrivatePtr vcpupriv;
     qemuMonitorCPUInfoPtr info = NULL;
     size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
     size_t i;
     bool hotplug;
+    bool fast;
     int rc;
     int ret = -1;
 
     hotplug = qemuDomainSupportsNewVcpuHotplug(vm);
+    fast = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_CPUS_FAST);
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
 
-    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus, hotplug);
+    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus,
+                               hotplug, fast);
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         goto cleanup;
@@ -7674,17 +8074,20 @@ qemuDomainGetVcpuHalted(virDomainObjPtr vm,
  *
  * Updates vCPU halted state in the private data of @vm.
  *
- * Returns 0 on success and -1 on error
+ * Returns 0 on success, 1 if the halted state can't be obtained without
+ * interrupting the vCPUs and -1 on error
  */
 int
 qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             int asyncJob)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainVcpuDefPtr vcpu;
     qemuDomainVcpuPrivatePtr vcpupriv;
     size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
     virBitmapPtr haltedmap = NULL;
+    bool fast;
     size_t i;
     int ret = -1;
 
@@ -7692,10 +8095,17 @@ qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
     if (vm->def->virtType == VIR_DOMAIN_VIRT_QEMU)
         return 0;
 
+    /* query-cpus-fast reports the halted state on s390 only, whereas
+     * query-cpus would kick every vCPU out of the guest to collect it */
+    fast = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_CPUS_FAST);
+    if (fast && !ARCH_IS_S390(vm->def->os.arch))
+        return 1;
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
 
-    haltedmap = qemuMonitorGetCpuHalted(qemuDomainGetMonitor(vm), maxvcpus);
+    haltedmap = qemuMonitorGetCpuHalted(qemuDomainGetMonitor(vm), maxvcpus,
+                                        fast);
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0 || !haltedmap)
         goto cleanup;
@@ -8405,23 +8815,46 @@ struct qemuDomainCreateDeviceData {
     const char *path;     /* Path to temp new /dev location */
     char * const *devMountsPath;
     size_t ndevMountsPath;
+    qemuDomainDevTemplatePtr tmpl; /* Prebuilt default devices, or NULL */
 };
 
 
-static int
-qemuDomainCreateDeviceRecursive(const char *device,
-                                const struct qemuDomainCreateDeviceData *data,
-                                bool allow_noent,
-                                unsigned int ttl)
+/* Returns true if @device lives under a mount point preserved from
+ * the host /dev and thus must not be created. */
+static bool
+qemuDomainCreateDeviceSkip(const char *device,
+                           const struct qemuDomainCreateDeviceData *data)
 {
-    char *devicePath = NULL;
-    char *target = NULL;
-    struct stat sb;
-    int ret = -1;
-    bool isLink = false;
-    bool isDev = false;
-    bool isReg = false;
-    bool isDir = false;
+    size_t i;
+
+    for (i = 0; i < data->ndevMountsPath; i++) {
+        if (STREQ(data->devMountsPath[i], "/dev"))
+            continue;
+        if (STRPREFIX(device, data->devMountsPath[i])) {
+            VIR_DEBUG("Skipping dev %s because of %s mount point",
+                      device, data->devMountsPath[i]);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static int
+qemuDomainCreateDeviceRecursive(const char *device,
+                                const struct qemuDomainCreateDeviceData *data,
+                                bool allow_noent,
+                                unsigned int ttl)
+{
+    char *devicePath = NULL;
+    char *target = NULL;
+    struct stat sb;
+    int ret = -1;
+    bool isLink = false;
+    bool isDev = false;
+    bool isReg = false;
+    bool isDir = false;
     bool create = false;
 #ifdef WITH_SELINUX
     char *tcon = NULL;
@@ -8463,35 +8896,22 @@ qemuDomainCreateDeviceRecursive(const char *device,
      * Otherwise we might get fooled with `/dev/../var/my_image'.
      * For now, lets hope callers play nice.
      */
-    if (STRPREFIX(device, DEVPREFIX)) {
-        size_t i;
-
-        for (i = 0; i < data->ndevMountsPath; i++) {
-            if (STREQ(data->devMountsPath[i], "/dev"))
-                continue;
-            if (STRPREFIX(device, data->devMountsPath[i]))
-                break;
-        }
-
-        if (i == data->ndevMountsPath) {
-            /* Okay, @device is in /dev but not in any mount point under /dev.
-             * Create it. */
-            if (virAsprintf(&devicePath, "%s/%s",
-                            data->path, device + strlen(DEVPREFIX)) < 0)
-                goto cleanup;
+    if (STRPREFIX(device, DEVPREFIX) &&
+        !qemuDomainCreateDeviceSkip(device, data)) {
+        /* Okay, @device is in /dev but not in any mount point under /dev.
+         * Create it. */
+        if (virAsprintf(&devicePath, "%s/%s",
+                        data->path, device + strlen(DEVPREFIX)) < 0)
+            goto cleanup;
 
-            if (virFileMakeParentPath(devicePath) < 0) {
-                virReportSystemError(errno,
-                                     _("Unable to create %s"),
-                                     devicePath);
-                goto cleanup;
-            }
-            VIR_DEBUG("Creating dev %s", device);
-            create = true;
-        } else {
-            VIR_DEBUG("Skipping dev %s because of %s mount point",
-                      device, data->devMountsPath[i]);
+        if (virFileMakeParentPath(devicePath) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to create %s"),
+                                 devicePath);
+            goto cleanup;
         }
+        VIR_DEBUG("Creating dev %s", device);
+        create = true;
     }
 
     if (isLink) {
@@ -8656,153 +9076,592 @@ qemuDomainCreateDevice(const char *device,
 }
 
 
-static int
-qemuDomainPopulateDevices(virQEMUDriverConfigPtr cfg,
-                          virDomainObjPtr vm ATTRIBUTE_UNUSED,
-                          const struct qemuDomainCreateDeviceData *data)
+/* A snapshot of the device nodes every domain gets in its private /dev.
+ * Building it means walking the device ACL list and resolving symlink
+ * chains, fetching ACLs and SELinux labels on the way. That is done
+ * once in the daemon and then replayed in each new namespace, instead
+ * of repeating all the lookups for every domain startup. */
+typedef struct _qemuDomainDevTemplateNode qemuDomainDevTemplateNode;
+typedef qemuDomainDevTemplateNode *qemuDomainDevTemplateNodePtr;
+struct _qemuDomainDevTemplateNode {
+    char *path;     /* path in the host namespace */
+    char *target;   /* symlink target as stored in the link */
+    bool missing;   /* @path did not exist when the template was built */
+    struct stat sb;
+    void *acl;      /* access ACL, only for nodes under /dev */
+#ifdef WITH_SELINUX
+    char *tcon;     /* SELinux label, only for nodes under /dev */
+#endif
+};
+
+struct _qemuDomainDevTemplate {
+    virObject parent;
+
+    char **devices; /* the device list the template was built from */
+
+    qemuDomainDevTemplateNodePtr nodes;
+    size_t nnodes;
+};
+
+static virClassPtr qemuDomainDevTemplateClass;
+
+static void
+qemuDomainDevTemplateDispose(void *obj)
 {
-    const char *const *devices = (const char *const *) cfg->cgroupDeviceACL;
+    qemuDomainDevTemplatePtr tmpl = obj;
     size_t i;
-    int ret = -1;
 
-    if (!devices)
-        devices = defaultDeviceACL;
+    for (i = 0; i < tmpl->nnodes; i++) {
+        qemuDomainDevTemplateNodePtr node = &tmpl->nodes[i];
 
-    for (i = 0; devices[i]; i++) {
-        if (qemuDomainCreateDevice(devices[i], data, true) < 0)
-            goto cleanup;
+        VIR_FREE(node->path);
+        VIR_FREE(node->target);
+        if (node->acl)
+            virFileFreeACLs(&node->acl);
+#ifdef WITH_SELINUX
+        freecon(node->tcon);
+#endif
     }
+    VIR_FREE(tmpl->nodes);
+    virStringListFree(tmpl->devices);
+}
 
-    ret = 0;
- cleanup:
-    return ret;
+static int
+qemuDomainDevTemplateOnceInit(void)
+{
+    if (!(qemuDomainDevTemplateClass = virClassNew(virClassForObject(),
+                                                   "qemuDomainDevTemplate",
+                                                   sizeof(qemuDomainDevTemplate),
+                                                   qemuDomainDevTemplateDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuDomainDevTemplate)
+
+
+static bool
+qemuDomainDevTemplateHasNode(qemuDomainDevTemplatePtr tmpl,
+                             const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < tmpl->nnodes; i++) {
+        if (STREQ(tmpl->nodes[i].path, path))
+            return true;
+    }
+
+    return false;
 }
 
 
+/* Mirrors qemuDomainCreateDeviceRecursive, except nothing is
+ * created. Every path visited is recorded so that the template can
+ * be revalidated later, but only nodes under /dev carry the ACL and
+ * SELinux label needed to replay them. */
 static int
-qemuDomainSetupDev(virQEMUDriverConfigPtr cfg,
-                   virSecurityManagerPtr mgr,
-                   virDomainObjPtr vm,
-                   const struct qemuDomainCreateDeviceData *data)
+qemuDomainDevTemplateAddRecursive(qemuDomainDevTemplatePtr tmpl,
+                                  const char *device,
+                                  unsigned int ttl)
 {
-    char *mount_options = NULL;
-    char *opts = NULL;
+    qemuDomainDevTemplateNode node;
+    char *target = NULL;
     int ret = -1;
 
-    VIR_DEBUG("Setting up /dev/ for domain %s", vm->def->name);
+    memset(&node, 0, sizeof(node));
 
-    mount_options = qemuSecurityGetMountOptions(mgr, vm->def);
+    if (!ttl) {
+        virReportSystemError(ELOOP,
+                             _("Too many levels of symbolic links: %s"),
+                             device);
+        return ret;
+    }
 
-    if (!mount_options &&
-        VIR_STRDUP(mount_options, "") < 0)
-        goto cleanup;
+    if (qemuDomainDevTemplateHasNode(tmpl, device))
+        return 0;
 
-    /*
-     * tmpfs is limited to 64kb, since we only have device nodes in there
-     * and don't want to DOS the entire OS RAM usage
-     */
-    if (virAsprintf(&opts,
-                    "mode=755,size=65536%s", mount_options) < 0)
+    if (VIR_STRDUP(node.path, device) < 0)
+        return ret;
+
+    if (lstat(device, &node.sb) < 0) {
+        if (errno != ENOENT) {
+            virReportSystemError(errno, _("Unable to stat %s"), device);
+            goto cleanup;
+        }
+        /* Ignore non-existent device, but notice if it shows up. */
+        node.missing = true;
+    } else if (S_ISLNK(node.sb.st_mode)) {
+        if (virFileReadLink(device, &node.target) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to resolve symlink %s"),
+                                 device);
+            goto cleanup;
+        }
+
+        if (IS_RELATIVE_FILE_NAME(node.target)) {
+            char *c = NULL, *devTmp = NULL;
+
+            if (VIR_STRDUP(devTmp, device) < 0)
+                goto cleanup;
+
+            if ((c = strrchr(devTmp, '/')))
+                *(c + 1) = '\0';
+
+            if (virAsprintf(&target, "%s%s", devTmp, node.target) < 0) {
+                VIR_FREE(devTmp);
+                goto cleanup;
+            }
+            VIR_FREE(devTmp);
+        } else if (VIR_STRDUP(target, node.target) < 0) {
+            goto cleanup;
+        }
+    } else if (!S_ISCHR(node.sb.st_mode) && !S_ISBLK(node.sb.st_mode) &&
+               !S_ISREG(node.sb.st_mode) && !S_ISFIFO(node.sb.st_mode) &&
+               !S_ISSOCK(node.sb.st_mode) && !S_ISDIR(node.sb.st_mode)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("unsupported device type %s 0%o"),
+                       device, node.sb.st_mode);
         goto cleanup;
+    }
 
-    if (virFileSetupDev(data->path, opts) < 0)
+    if (!node.missing && STRPREFIX(device, DEVPREFIX)) {
+        /* Symlinks don't have ACLs. */
+        if (!S_ISLNK(node.sb.st_mode) &&
+            virFileGetACLs(device, &node.acl) < 0 &&
+            errno != ENOTSUP) {
+            virReportSystemError(errno,
+                                 _("Failed to get ACLs on device %s"),
+                                 device);
+            goto cleanup;
+        }
+
+#ifdef WITH_SELINUX
+        if (lgetfilecon_raw(device, &node.tcon) < 0 &&
+            (errno != ENOTSUP && errno != ENODATA)) {
+            virReportSystemError(errno,
+                                 _("Unable to get SELinux label from %s"),
+                                 device);
+            goto cleanup;
+        }
+#endif
+    }
+
+    if (VIR_APPEND_ELEMENT(tmpl->nodes, tmpl->nnodes, node) < 0)
         goto cleanup;
 
-    if (qemuDomainPopulateDevices(cfg, vm, data) < 0)
+    if (target &&
+        qemuDomainDevTemplateAddRecursive(tmpl, target, ttl - 1) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
-    VIR_FREE(opts);
-    VIR_FREE(mount_options);
+    VIR_FREE(target);
+    VIR_FREE(node.path);
+    VIR_FREE(node.target);
+    if (node.acl)
+        virFileFreeACLs(&node.acl);
+#ifdef WITH_SELINUX
+    freecon(node.tcon);
+#endif
     return ret;
 }
 
 
-static int
-qemuDomainSetupDisk(virQEMUDriverConfigPtr cfg ATTRIBUTE_UNUSED,
-                    virDomainDiskDefPtr disk,
-                    const struct qemuDomainCreateDeviceData *data)
+static qemuDomainDevTemplatePtr
+qemuDomainDevTemplateNew(const char *const *devices)
 {
-    virStorageSourcePtr next;
-    char *dst = NULL;
-    int ret = -1;
+    qemuDomainDevTemplatePtr tmpl;
+    long symloop_max = sysconf(_SC_SYMLOOP_MAX);
+    size_t i;
 
-    for (next = disk->src; virStorageSourceIsBacking(next); next = next->backingStore) {
-        if (!next->path || !virStorageSourceIsLocalStorage(next)) {
-            /* Not creating device. Just continue. */
-            continue;
-        }
+    if (qemuDomainDevTemplateInitialize() < 0)
+        return NULL;
 
-        if (qemuDomainCreateDevice(next->path, data, false) < 0)
-            goto cleanup;
+    if (!(tmpl = virObjectNew(qemuDomainDevTemplateClass)))
+        return NULL;
+
+    if (virStringListCopy(&tmpl->devices, (const char **) devices) < 0)
+        goto error;
+
+    for (i = 0; devices[i]; i++) {
+        if (qemuDomainDevTemplateAddRecursive(tmpl, devices[i],
+                                              symloop_max) < 0)
+            goto error;
     }
 
-    ret = 0;
- cleanup:
-    VIR_FREE(dst);
-    return ret;
+    VIR_DEBUG("Built /dev template with %zu nodes", tmpl->nnodes);
+    return tmpl;
+
+ error:
+    virObjectUnref(tmpl);
+    return NULL;
 }
 
 
-static int
-qemuDomainSetupAllDisks(virQEMUDriverConfigPtr cfg,
-                        virDomainObjPtr vm,
-                        const struct qemuDomainCreateDeviceData *data)
+/* Returns true if none of the recorded nodes changed since the
+ * template was built. Any change to the owner, mode, ACL or label of
+ * a node bumps its ctime, and a replaced node gets a new inode. */
+static bool
+qemuDomainDevTemplateIsValid(qemuDomainDevTemplatePtr tmpl,
+                             const char *const *devices)
 {
     size_t i;
-    VIR_DEBUG("Setting up disks");
 
-    for (i = 0; i < vm->def->ndisks; i++) {
-        if (qemuDomainSetupDisk(cfg,
-                                vm->def->disks[i],
-                                data) < 0)
-            return -1;
+    for (i = 0; devices[i] || tmpl->devices[i]; i++) {
+        if (STRNEQ_NULLABLE(devices[i], tmpl->devices[i]))
+            return false;
     }
 
-    VIR_DEBUG("Setup all disks");
-    return 0;
+    for (i = 0; i < tmpl->nnodes; i++) {
+        qemuDomainDevTemplateNodePtr node = &tmpl->nodes[i];
+        struct stat sb;
+
+        if (lstat(node->path, &sb) < 0) {
+            if (errno == ENOENT && node->missing)
+                continue;
+            return false;
+        }
+
+        if (node->missing ||
+            sb.st_dev != node->sb.st_dev ||
+            sb.st_ino != node->sb.st_ino ||
+            sb.st_mode != node->sb.st_mode ||
+            sb.st_rdev != node->sb.st_rdev ||
+            get_stat_ctime(&sb).tv_sec != get_stat_ctime(&node->sb).tv_sec ||
+            get_stat_ctime_ns(&sb) != get_stat_ctime_ns(&node->sb))
+            return false;
+    }
+
+    return true;
 }
 
 
-static int
-qemuDomainSetupHostdev(virQEMUDriverConfigPtr cfg ATTRIBUTE_UNUSED,
-                       virDomainHostdevDefPtr dev,
-                       const struct qemuDomainCreateDeviceData *data)
+/**
+ * qemuDomainGetDevTemplate:
+ * @driver: qemu driver
+ * @cfg: driver config
+ *
+ * Returns a reference to the cached template of the devices every
+ * domain's private /dev is populated with, rebuilding it first if
+ * the device list or any of the host nodes changed. Must be called
+ * before forking the domain process, the result is meant to be handed
+ * to qemuDomainBuildNamespace().
+ *
+ * Returns the template on success, NULL on error.
+ */
+qemuDomainDevTemplatePtr
+qemuDomainGetDevTemplate(virQEMUDriverPtr driver,
+                         virQEMUDriverConfigPtr cfg)
 {
-    int ret = -1;
-    char **path = NULL;
-    size_t i, npaths = 0;
+    const char *const *devices = (const char *const *) cfg->cgroupDeviceACL;
+    qemuDomainDevTemplatePtr tmpl = NULL;
 
-    if (qemuDomainGetHostdevPath(NULL, dev, false, &npaths, &path, NULL) < 0)
-        goto cleanup;
+    if (!devices)
+        devices = defaultDeviceACL;
 
-    for (i = 0; i < npaths; i++) {
-        if (qemuDomainCreateDevice(path[i], data, false) < 0)
-            goto cleanup;
+    virMutexLock(&driver->lock);
+
+    if (driver->devTemplate &&
+        !qemuDomainDevTemplateIsValid(driver->devTemplate, devices)) {
+        VIR_DEBUG("Dropping stale /dev template");
+        virObjectUnref(driver->devTemplate);
+        driver->devTemplate = NULL;
     }
 
-    ret = 0;
+    if (!driver->devTemplate &&
+        !(driver->devTemplate = qemuDomainDevTemplateNew(devices)))
+        goto cleanup;
+
+    tmpl = virObjectRef(driver->devTemplate);
+
  cleanup:
-    for (i = 0; i < npaths; i++)
-        VIR_FREE(path[i]);
-    VIR_FREE(path);
-    return ret;
+    virMutexUnlock(&driver->lock);
+    return tmpl;
 }
 
 
 static int
-qemuDomainSetupAllHostdevs(virQEMUDriverConfigPtr cfg,
-                           virDomainObjPtr vm,
-                           const struct qemuDomainCreateDeviceData *data)
+qemuDomainDevTemplateReplay(qemuDomainDevTemplatePtr tmpl,
+                            const struct qemuDomainCreateDeviceData *data)
 {
+    char *devicePath = NULL;
+    char *parent = NULL;
+    char *lastParent = NULL;
+    char *c;
     size_t i;
+    int ret = -1;
 
-    VIR_DEBUG("Setting up hostdevs");
-    for (i = 0; i < vm->def->nhostdevs; i++) {
-        if (qemuDomainSetupHostdev(cfg,
-                                   vm->def->hostdevs[i],
-                                   data) < 0)
+    for (i = 0; i < tmpl->nnodes; i++) {
+        qemuDomainDevTemplateNodePtr node = &tmpl->nodes[i];
+        mode_t mode = node->sb.st_mode;
+        bool isLink = S_ISLNK(mode);
+        bool isReg = S_ISREG(mode) || S_ISFIFO(mode) || S_ISSOCK(mode);
+        bool isDir = S_ISDIR(mode);
+
+        if (node->missing ||
+            !STRPREFIX(node->path, DEVPREFIX) ||
+            qemuDomainCreateDeviceSkip(node->path, data))
+            continue;
+
+        VIR_FREE(devicePath);
+        if (virAsprintf(&devicePath, "%s/%s",
+                        data->path, node->path + strlen(DEVPREFIX)) < 0)
+            goto cleanup;
+
+        /* Most nodes live right in /dev, avoid walking the same parent
+         * directory over and over again. */
+        if (VIR_STRDUP(parent, devicePath) < 0)
+            goto cleanup;
+        if ((c = strrchr(parent, '/')))
+            *c = '\0';
+
+        if (STRNEQ_NULLABLE(parent, lastParent)) {
+            if (virFileMakeParentPath(devicePath) < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to create %s"),
+                                     devicePath);
+                goto cleanup;
+            }
+            VIR_FREE(lastParent);
+            lastParent = parent;
+        } else {
+            VIR_FREE(parent);
+        }
+        parent = NULL;
+
+        VIR_DEBUG("Creating dev %s", node->path);
+
+        if (isLink) {
+            if (symlink(node->target, devicePath) < 0) {
+                if (errno == EEXIST)
+                    continue;
+                virReportSystemError(errno,
+                                     _("unable to create symlink %s"),
+                                     devicePath);
+                goto cleanup;
+            }
+        } else if (isReg) {
+            if (virFileTouch(devicePath, mode) < 0)
+                goto cleanup;
+        } else if (isDir) {
+            if (virFileMakePathWithMode(devicePath, mode) < 0)
+                goto cleanup;
+        } else {
+            if (mknod(devicePath, mode, node->sb.st_rdev) < 0) {
+                if (errno == EEXIST)
+                    continue;
+                virReportSystemError(errno,
+                                     _("Failed to make device %s"),
+                                     devicePath);
+                goto cleanup;
+            }
+        }
+
+        if (lchown(devicePath, node->sb.st_uid, node->sb.st_gid) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to chown device %s"),
+                                 devicePath);
+            goto cleanup;
+        }
+
+        /* Symlinks don't have mode */
+        if (!isLink &&
+            chmod(devicePath, mode) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to set permissions for device %s"),
+                                 devicePath);
+            goto cleanup;
+        }
+
+        if (node->acl &&
+            virFileSetACLs(devicePath, node->acl) < 0 &&
+            errno != ENOTSUP) {
+            virReportSystemError(errno,
+                                 _("Failed to copy ACLs on device %s"),
+                                 devicePath);
+            goto cleanup;
+        }
+
+#ifdef WITH_SELINUX
+        if (node->tcon &&
+            lsetfilecon_raw(devicePath,
+                            (VIR_SELINUX_CTX_CONST char *) node->tcon) < 0) {
+            VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+            if (errno != EOPNOTSUPP && errno != ENOTSUP) {
+            VIR_WARNINGS_RESET
+                virReportSystemError(errno,
+                                     _("Unable to set SELinux label on %s"),
+                                     devicePath);
+                goto cleanup;
+            }
+        }
+#endif
+
+        if ((isReg || isDir) &&
+            virFileBindMountDevice(node->path, devicePath) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(devicePath);
+    VIR_FREE(parent);
+    VIR_FREE(lastParent);
+    return ret;
+}
+
+
+static int
+qemuDomainPopulateDevices(virQEMUDriverConfigPtr cfg,
+                          virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                          const struct qemuDomainCreateDeviceData *data)
+{
+    const char *const *devices = (const char *const *) cfg->cgroupDeviceACL;
+    size_t i;
+    int ret = -1;
+
+    if (data->tmpl)
+        return qemuDomainDevTemplateReplay(data->tmpl, data);
+
+    if (!devices)
+        devices = defaultDeviceACL;
+
+    for (i = 0; devices[i]; i++) {
+        if (qemuDomainCreateDevice(devices[i], data, true) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    return ret;
+}
+
+
+static int
+qemuDomainSetupDev(virQEMUDriverConfigPtr cfg,
+                   virSecurityManagerPtr mgr,
+                   virDomainObjPtr vm,
+                   const struct qemuDomainCreateDeviceData *data)
+{
+    char *mount_options = NULL;
+    char *opts = NULL;
+    int ret = -1;
+
+    VIR_DEBUG("Setting up /dev/ for domain %s", vm->def->name);
+
+    mount_options = qemuSecurityGetMountOptions(mgr, vm->def);
+
+    if (!mount_options &&
+        VIR_STRDUP(mount_options, "") < 0)
+        goto cleanup;
+
+    /*
+     * tmpfs is limited to 64kb, since we only have device nodes in there
+     * and don't want to DOS the entire OS RAM usage
+     */
+    if (virAsprintf(&opts,
+                    "mode=755,size=65536%s", mount_options) < 0)
+        goto cleanup;
+
+    if (virFileSetupDev(data->path, opts) < 0)
+        goto cleanup;
+
+    if (qemuDomainPopulateDevices(cfg, vm, data) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(opts);
+    VIR_FREE(mount_options);
+    return ret;
+}
+
+
+static int
+qemuDomainSetupDisk(virQEMUDriverConfigPtr cfg ATTRIBUTE_UNUSED,
+                    virDomainDiskDefPtr disk,
+                    const struct qemuDomainCreateDeviceData *data)
+{
+    virStorageSourcePtr next;
+    char *dst = NULL;
+    int ret = -1;
+
+    for (next = disk->src; virStorageSourceIsBacking(next); next = next->backingStore) {
+        if (!next->path || !virStorageSourceIsLocalStorage(next)) {
+            /* Not creating device. Just continue. */
+            continue;
+        }
+
+        if (qemuDomainCreateDevice(next->path, data, false) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(dst);
+    return ret;
+}
+
+
+static int
+qemuDomainSetupAllDisks(virQEMUDriverConfigPtr cfg,
+                        virDomainObjPtr vm,
+                        const struct qemuDomainCreateDeviceData *data)
+{
+    size_t i;
+    VIR_DEBUG("Setting up disks");
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        if (qemuDomainSetupDisk(cfg,
+                                vm->def->disks[i],
+                                data) < 0)
+            return -1;
+    }
+
+    VIR_DEBUG("Setup all disks");
+    return 0;
+}
+
+
+static int
+qemuDomainSetupHostdev(virQEMUDriverConfigPtr cfg ATTRIBUTE_UNUSED,
+                       virDomainHostdevDefPtr dev,
+                       const struct qemuDomainCreateDeviceData *data)
+{
+    int ret = -1;
+    char **path = NULL;
+    size_t i, npaths = 0;
+
+    if (qemuDomainGetHostdevPath(NULL, dev, false, &npaths, &path, NULL) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npaths; i++) {
+        if (qemuDomainCreateDevice(path[i], data, false) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < npaths; i++)
+        VIR_FREE(path[i]);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+qemuDomainSetupAllHostdevs(virQEMUDriverConfigPtr cfg,
+                           virDomainObjPtr vm,
+                           const struct qemuDomainCreateDeviceData *data)
+{
+    size_t i;
+
+    VIR_DEBUG("Setting up hostdevs");
+    for (i = 0; i < vm->def->nhostdevs; i++) {
+        if (qemuDomainSetupHostdev(cfg,
+                                   vm->def->hostdevs[i],
+                                   data) < 0)
             return -1;
     }
     VIR_DEBUG("Setup all hostdevs");
@@ -9033,6 +9892,7 @@ qemuDomainSetupAllRNGs(virQEMUDriverConfigPtr cfg,
 int
 qemuDomainBuildNamespace(virQEMUDriverConfigPtr cfg,
                          virSecurityManagerPtr mgr,
+                         qemuDomainDevTemplatePtr tmpl,
                          virDomainObjPtr vm)
 {
     struct qemuDomainCreateDeviceData data;
@@ -9067,6 +9927,7 @@ qemuDomainBuildNamespace(virQEMUDriverConfigPtr cfg,
     data.path = devPath;
     data.devMountsPath = devMountsPath;
     data.ndevMountsPath = ndevMountsPath;
+    data.tmpl = tmpl;
 
     if (virProcessSetupPrivateMountNS() < 0)
         goto cleanup;
@@ -10414,3 +11275,564 @@ qemuDomainCheckMigrationCapabilities(virQEMUDriverPtr driver,
     virStringListFree(caps);
     return ret;
 }
+
+
+qemuDomainStatsHistoryPtr
+qemuDomainStatsHistoryNew(size_t length)
+{
+    qemuDomainStatsHistoryPtr history;
+
+    if (VIR_ALLOC(history) < 0)
+        return NULL;
+
+    if (VIR_ALLOC_N(history->samples, length) < 0) {
+        VIR_FREE(history);
+        return NULL;
+    }
+    history->length = length;
+
+    return history;
+}
+
+
+void
+qemuDomainStatsHistoryFree(qemuDomainStatsHistoryPtr history)
+{
+    size_t i;
+
+    if (!history)
+        return;
+
+    for (i = 0; i < history->length; i++)
+        virTypedParamsFree(history->samples[i].params,
+                           history->samples[i].nparams);
+    VIR_FREE(history->samples);
+    VIR_FREE(history);
+}
+
+
+/**
+ * qemuDomainStatsHistoryAdd:
+ * @history: history of the domain
+ * @timestamp: time the sample was taken at
+ * @params: the sampled statistics
+ * @nparams: number of items in @params
+ *
+ * Appends a sample to @history, dropping the oldest one if @history is
+ * full. @params is owned by @history afterwards.
+ */
+void
+qemuDomainStatsHistoryAdd(qemuDomainStatsHistoryPtr history,
+                          unsigned long long timestamp,
+                          virTypedParameterPtr params,
+                          int nparams)
+{
+    qemuDomainStatsSamplePtr sample;
+
+    if (history->count == history->length) {
+        sample = &history->samples[history->first];
+        virTypedParamsFree(sample->params, sample->nparams);
+        history->first = (history->first + 1) % history->length;
+        history->count--;
+    }
+
+    sample = &history->samples[(history->first + history->count) %
+                               history->length];
+    sample->timestamp = timestamp;
+    sample->params = params;
+    sample->nparams = nparams;
+    history->count++;
+}
+
+
+/**
+ * qemuDomainStatsHistoryGet:
+ * @history: history of the domain, may be NULL
+ * @dom: domain the records are filled in for
+ * @start: oldest time of the samples to return
+ * @end: newest time of the samples to return, 0 for no limit
+ *
+ * Copies the samples in @history taken between @start and @end into
+ * @records, oldest first. The first item of each record is the
+ * "timestamp" of the sample.
+ *
+ * Returns the number of records or -1 on error.
+ */
+int
+qemuDomainStatsHistoryGet(qemuDomainStatsHistoryPtr history,
+                          virDomainPtr dom,
+                          unsigned long long start,
+                          unsigned long long end,
+                          virDomainStatsRecordPtr **records)
+{
+    virDomainStatsRecordPtr *tmp = NULL;
+    virDomainStatsRecordPtr elem = NULL;
+    size_t count = history ? history->count : 0;
+    int nrecords = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(tmp, count + 1) < 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        qemuDomainStatsSamplePtr sample;
+        virTypedParameterPtr params = NULL;
+
+        sample = &history->samples[(history->first + i) % history->length];
+        if (sample->timestamp < start ||
+            (end && sample->timestamp > end))
+            continue;
+
+        if (VIR_ALLOC(elem) < 0 ||
+            VIR_ALLOC_N(elem->params, sample->nparams + 1) < 0 ||
+            virTypedParamsCopy(&params, sample->params, sample->nparams) < 0)
+            goto cleanup;
+
+        if (virTypedParameterAssign(&elem->params[0], "timestamp",
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    sample->timestamp) < 0) {
+            virTypedParamsFree(params, sample->nparams);
+            goto cleanup;
+        }
+
+        /* strings in @params are owned by @elem from now on */
+        if (sample->nparams > 0)
+            memcpy(elem->params + 1, params, sizeof(*params) * sample->nparams);
+        elem->nparams = sample->nparams + 1;
+        VIR_FREE(params);
+
+        elem->dom = virObjectRef(dom);
+        tmp[nrecords++] = elem;
+        elem = NULL;
+    }
+
+    *records = tmp;
+    tmp = NULL;
+    ret = nrecords;
+
+ cleanup:
+    if (elem) {
+        virTypedParamsFree(elem->params, elem->nparams);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmp);
+    return ret;
+}
+
+
+/*
+ * With status_save_delay set, the status XML of running domains is
+ * written by a dedicated thread. A domain asking for its status to be
+ * saved is queued and written once the delay expires; any further
+ * requests made in the meantime are covered by that single write, which
+ * formats the state current at the time it is done.
+ */
+typedef struct _qemuDomainStatusWriterEntry qemuDomainStatusWriterEntry;
+typedef qemuDomainStatusWriterEntry *qemuDomainStatusWriterEntryPtr;
+struct _qemuDomainStatusWriterEntry {
+    virDomainObjPtr vm;
+    unsigned long long deadline;
+};
+
+struct _qemuDomainStatusWriter {
+    virMutex lock;
+    virCond cond;
+    virThread thread;
+    bool quit;
+
+    virQEMUDriverPtr driver;
+    unsigned int delay; /* in milliseconds */
+
+    /* Domains waiting for their status to be written, each holding a
+     * reference. The delay is the same for all of them, so the queue
+     * is sorted by deadline. */
+    qemuDomainStatusWriterEntryPtr queue;
+    size_t nqueue;
+};
+
+
+static void
+qemuDomainStatusWriterSave(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+
+    if (virDomainObjIsActive(vm) &&
+        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        VIR_WARN("Failed to save status on vm %s", vm->def->name);
+
+    virObjectUnref(cfg);
+}
+
+
+static void
+qemuDomainStatusWriterThread(void *opaque)
+{
+    qemuDomainStatusWriterPtr writer = opaque;
+    qemuDomainStatusWriterEntry entry;
+    qemuDomainObjPrivatePtr priv;
+    unsigned long long now;
+
+    virMutexLock(&writer->lock);
+
+    while (true) {
+        if (writer->nqueue == 0) {
+            if (writer->quit)
+                break;
+
+            if (virCondWait(&writer->cond, &writer->lock) < 0)
+                VIR_WARN("Unable to wait on status writer condition");
+            continue;
+        }
+
+        /* pending writes are done right away when shutting down */
+        if (!writer->quit &&
+            virTimeMillisNow(&now) == 0 &&
+            writer->queue[0].deadline > now) {
+            ignore_value(virCondWaitUntil(&writer->cond, &writer->lock,
+                                          writer->queue[0].deadline));
+            continue;
+        }
+
+        entry = writer->queue[0];
+        VIR_DELETE_ELEMENT(writer->queue, 0, writer->nqueue);
+
+        /* changes made from now on need another write */
+        priv = entry.vm->privateData;
+        priv->statusPending = false;
+
+        virMutexUnlock(&writer->lock);
+
+        virObjectLock(entry.vm);
+        qemuDomainStatusWriterSave(writer->driver, entry.vm);
+        virObjectUnlock(entry.vm);
+        virObjectUnref(entry.vm);
+
+        virMutexLock(&writer->lock);
+    }
+
+    virMutexUnlock(&writer->lock);
+}
+
+
+/**
+ * qemuDomainStatusWriterNew:
+ * @driver: qemu driver
+ * @delay: time in milliseconds a status write may be held back
+ *
+ * Starts the thread writing the status XML of domains on behalf of
+ * qemuDomainObjSaveStatus.
+ *
+ * Returns the writer or NULL on error.
+ */
+qemuDomainStatusWriterPtr
+qemuDomainStatusWriterNew(virQEMUDriverPtr driver,
+                          unsigned int delay)
+{
+    qemuDomainStatusWriterPtr writer;
+
+    if (VIR_ALLOC(writer) < 0)
+        return NULL;
+
+    if (virMutexInit(&writer->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        VIR_FREE(writer);
+        return NULL;
+    }
+
+    if (virCondInit(&writer->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize condition"));
+        virMutexDestroy(&writer->lock);
+        VIR_FREE(writer);
+        return NULL;
+    }
+
+    writer->driver = driver;
+    writer->delay = delay;
+
+    if (virThreadCreate(&writer->thread, true,
+                        qemuDomainStatusWriterThread, writer) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create status writer thread"));
+        virCondDestroy(&writer->cond);
+        virMutexDestroy(&writer->lock);
+        VIR_FREE(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+/**
+ * qemuDomainStatusWriterFree:
+ * @writer: the status writer
+ *
+ * Writes the status of all queued domains and stops the writer thread.
+ */
+void
+qemuDomainStatusWriterFree(qemuDomainStatusWriterPtr writer)
+{
+    if (!writer)
+        return;
+
+    virMutexLock(&writer->lock);
+    writer->quit = true;
+    virCondSignal(&writer->cond);
+    virMutexUnlock(&writer->lock);
+
+    virThreadJoin(&writer->thread);
+
+    VIR_FREE(writer->queue);
+    virCondDestroy(&writer->cond);
+    virMutexDestroy(&writer->lock);
+    VIR_FREE(writer);
+}
+
+
+/**
+ * qemuDomainObjSaveStatus:
+ * @driver: qemu driver
+ * @vm: domain object, locked
+ *
+ * Saves the status XML of @vm. With status_save_delay set, the write is
+ * left to the status writer thread and repeated calls within the delay
+ * result in a single write; use qemuDomainObjFlushStatus where the
+ * status has to be on disk before proceeding.
+ *
+ * Returns 0 on success, -1 if a synchronous write failed.
+ */
+int
+qemuDomainObjSaveStatus(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm)
+{
+    qemuDomainStatusWriterPtr writer = driver->statusWriter;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatusWriterEntry entry;
+
+    if (!writer)
+        return qemuDomainObjFlushStatus(driver, vm);
+
+    /* The write may be deferred, but the change is not */
+    virDomainObjBumpGeneration(vm);
+
+    virMutexLock(&writer->lock);
+
+    if (priv->statusPending)
+        goto cleanup;
+
+    if (virTimeMillisNow(&entry.deadline) < 0)
+        goto error;
+    entry.deadline += writer->delay;
+    entry.vm = virObjectRef(vm);
+
+    if (VIR_APPEND_ELEMENT(writer->queue, writer->nqueue, entry) < 0) {
+        virObjectUnref(vm);
+        goto error;
+    }
+
+    priv->statusPending = true;
+    if (writer->nqueue == 1)
+        virCondSignal(&writer->cond);
+
+ cleanup:
+    virMutexUnlock(&writer->lock);
+    return 0;
+
+ error:
+    /* fall back to doing it now */
+    virMutexUnlock(&writer->lock);
+    return qemuDomainObjFlushStatus(driver, vm);
+}
+
+
+/**
+ * qemuDomainObjFlushStatus:
+ * @driver: qemu driver
+ * @vm: domain object, locked
+ *
+ * Writes the status XML of @vm synchronously, superseding a write
+ * queued by qemuDomainObjSaveStatus. On success the current status of
+ * @vm is on disk when this returns.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainObjFlushStatus(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    qemuDomainStatusWriterPtr writer = driver->statusWriter;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    size_t i;
+    int ret;
+
+    if (writer) {
+        virMutexLock(&writer->lock);
+        if (priv->statusPending) {
+            for (i = 0; i < writer->nqueue; i++) {
+                if (writer->queue[i].vm == vm)
+                    break;
+            }
+
+            /* the caller still holds a reference on @vm */
+            if (i < writer->nqueue) {
+                VIR_DELETE_ELEMENT(writer->queue, i, writer->nqueue);
+                virObjectUnref(vm);
+            }
+            priv->statusPending = false;
+        }
+        virMutexUnlock(&writer->lock);
+    }
+
+    cfg = virQEMUDriverGetConfig(driver);
+    ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuDomainMemoryStatsInvalidate:
+ * @vm: domain
+ *
+ * Drop the guest memory stats cached for @vm, so that the next query asks
+ * QEMU again. Has to be called whenever the stats period is changed.
+ */
+void
+qemuDomainMemoryStatsInvalidate(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->memStatsExpiry = 0;
+    priv->nmemStats = 0;
+}
+
+
+/**
+ * qemuDomainMemoryStatsCacheGet:
+ * @vm: domain
+ * @stats: array to fill
+ * @nr_stats: number of items @stats can hold
+ *
+ * Fill @stats with the guest memory stats cached for @vm if the balloon
+ * driver cannot have refreshed them since they were fetched. The current
+ * balloon size is taken from the definition, which is kept up to date by
+ * the BALLOON_CHANGE event. The caller has to hold the lock of @vm, but
+ * does not need a job.
+ *
+ * Returns the number of items filled in, or -1 if the stats have to be
+ * fetched from QEMU.
+ */
+int
+qemuDomainMemoryStatsCacheGet(virDomainObjPtr vm,
+                              virDomainMemoryStatPtr stats,
+                              unsigned int nr_stats)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    int nstats;
+    size_t i;
+
+    if (!priv->memStatsExpiry ||
+        virTimeMillisNow(&now) < 0 ||
+        now >= priv->memStatsExpiry)
+        return -1;
+
+    nstats = MIN(priv->nmemStats, nr_stats);
+    memcpy(stats, priv->memStats, nstats * sizeof(*stats));
+
+    for (i = 0; i < nstats; i++) {
+        if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON)
+            stats[i].val = vm->def->mem.cur_balloon;
+    }
+
+    return nstats;
+}
+
+
+/**
+ * qemuDomainMemoryStatsCacheStore:
+ * @vm: domain
+ * @stats: stats just fetched from QEMU
+ * @nstats: number of items in @stats
+ *
+ * Remember @stats until the balloon driver of @vm polls the guest again,
+ * which is the time the guest last reported them plus the stats period.
+ * Nothing is cached unless the guest is polled periodically and QEMU
+ * reports balloon size changes as events, or if @stats may be truncated.
+ */
+void
+qemuDomainMemoryStatsCacheStore(virDomainObjPtr vm,
+                                virDomainMemoryStatPtr stats,
+                                int nstats)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    unsigned long long period;
+    unsigned long long expiry;
+    size_t i;
+
+    qemuDomainMemoryStatsInvalidate(vm);
+
+    if (nstats <= 0 || nstats > VIR_DOMAIN_MEMORY_STAT_NR ||
+        !vm->def->memballoon || vm->def->memballoon->period <= 0 ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BALLOON_EVENT) ||
+        virTimeMillisNow(&now) < 0)
+        return;
+
+    period = vm->def->memballoon->period * 1000ull;
+    expiry = now + period;
+
+    for (i = 0; i < nstats; i++) {
+        if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE) {
+            unsigned long long next = (stats[i].val * 1000ull) + period;
+
+            if (next > now && next < expiry)
+                expiry = next;
+            break;
+        }
+    }
+
+    memcpy(priv->memStats, stats, nstats * sizeof(*stats));
+    priv->nmemStats = nstats;
+    priv->memStatsExpiry = expiry;
+}
+
+
+/**
+ * qemuDomainGetHomeNode:
+ * @vm: domain object
+ *
+ * Get the host NUMA node the memory of @vm is bound to, which is where
+ * the daemon should keep the structures it uses for @vm's I/O. If the
+ * memory is bound to several nodes, the first one is used.
+ *
+ * Returns the node or -1 if @vm's memory is not bound or interleaved.
+ */
+int
+qemuDomainGetHomeNode(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainNumatuneMemMode mode;
+    virBitmapPtr nodeset;
+
+    if (virDomainNumatuneGetMode(vm->def->numa, -1, &mode) < 0) {
+        /* vCPU placement decided by numad or the built-in placement */
+        nodeset = priv ? priv->autoNodeset : NULL;
+    } else if (mode == VIR_DOMAIN_NUMATUNE_MEM_INTERLEAVE) {
+        return -1;
+    } else {
+        nodeset = virDomainNumatuneGetNodeset(vm->def->numa,
+                                              priv ? priv->autoNodeset : NULL,
+                                              -1);
+    }
+
+    if (!nodeset)
+        return -1;
+
+    return virBitmapNextSetBit(nodeset, -1);
+}
@@ -27,6 +27,7 @@
 # include "virthread.h"
 # include "vircgroup.h"
 # include "virperf.h"
+# include "virresctrl.h"
 # include "domain_addr.h"
 # include "domain_conf.h"
 # include "snapshot_conf.h"
@@ -142,14 +143,30 @@ struct _qemuDomainJobInfo {
     qemuDomainMirrorStats mirrorStats;
 };
 
+/* A thread waiting in qemuDomainObjBeginJobInternal */
+typedef struct _qemuDomainJobWaiter qemuDomainJobWaiter;
+typedef qemuDomainJobWaiter *qemuDomainJobWaiterPtr;
+struct _qemuDomainJobWaiter {
+    virCond cond;                       /* Signalled when the job may start */
+    qemuDomainJob job;
+    unsigned int priority;              /* Lower value is served first */
+    bool granted;
+};
+
 struct qemuDomainJobObj {
-    virCond cond;                       /* Use to coordinate jobs */
     qemuDomainJob active;               /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
     const char *ownerAPI;               /* The API which owns the job */
     unsigned long long started;         /* When the current job started */
 
-    virCond asyncCond;                  /* Use to coordinate with async jobs */
+    qemuDomainJobWaiterPtr *waiters;    /* Jobs waiting to start, in the order
+                                         * they are going to be served */
+    size_t nwaiters;
+    size_t ngranted;                    /* Waiters allowed to start which did
+                                         * not wake up yet */
+    unsigned long long waitCount;       /* Number of jobs which had to wait */
+    unsigned long long waitTime;        /* Total time they waited (ms) */
+
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
     unsigned long long asyncOwner;      /* Thread which set current async job */
     const char *asyncOwnerAPI;          /* The API which owns the async job */
@@ -196,6 +213,22 @@ VIR_ENUM_DECL(qemuDomainNamespace)
 bool qemuDomainNamespaceEnabled(virDomainObjPtr vm,
                                 qemuDomainNamespace ns);
 
+/* Phases of domain startup which are timed separately */
+typedef enum {
+    QEMU_DOMAIN_START_PHASE_INIT = 0,  /* checks, capabilities lookup */
+    QEMU_DOMAIN_START_PHASE_PREPARE,   /* domain and host preparation */
+    QEMU_DOMAIN_START_PHASE_COMMAND,   /* building the command line */
+    QEMU_DOMAIN_START_PHASE_EXEC,      /* fork, namespace setup, exec */
+    QEMU_DOMAIN_START_PHASE_CGROUP,    /* cgroup and emulator tuning */
+    QEMU_DOMAIN_START_PHASE_LABEL,     /* security labelling */
+    QEMU_DOMAIN_START_PHASE_MONITOR,   /* connecting to the monitor */
+    QEMU_DOMAIN_START_PHASE_QMP,       /* post-launch monitor queries */
+    QEMU_DOMAIN_START_PHASE_RESUME,    /* final refresh and resuming CPUs */
+
+    QEMU_DOMAIN_START_PHASE_LAST
+} qemuDomainStartPhase;
+VIR_ENUM_DECL(qemuDomainStartPhase)
+
 /* Type of domain secret */
 typedef enum {
     VIR_DOMAIN_SECRET_INFO_TYPE_PLAIN = 0,
@@ -233,6 +266,26 @@ struct _qemuDomainSecretInfo {
     } s;
 };
 
+/* Bounded history of statistics samples of a domain, see
+ * stats_history_interval in qemu.conf. Once full, the oldest sample is
+ * dropped for each new one. */
+typedef struct _qemuDomainStatsSample qemuDomainStatsSample;
+typedef qemuDomainStatsSample *qemuDomainStatsSamplePtr;
+struct _qemuDomainStatsSample {
+    unsigned long long timestamp; /* milliseconds since the epoch */
+    virTypedParameterPtr params;
+    int nparams;
+};
+
+typedef struct _qemuDomainStatsHistory qemuDomainStatsHistory;
+typedef qemuDomainStatsHistory *qemuDomainStatsHistoryPtr;
+struct _qemuDomainStatsHistory {
+    qemuDomainStatsSamplePtr samples;
+    size_t length;
+    size_t first; /* index of the oldest sample */
+    size_t count;
+};
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -248,6 +301,20 @@ struct _qemuDomainObjPrivate {
     bool monError;
     unsigned long long monStart;
 
+    /* Microseconds spent in each phase of the last startup */
+    unsigned long long startPhases[QEMU_DOMAIN_START_PHASE_LAST];
+
+    /* Definition generation last validated on startup and the serial
+     * of the QEMU capabilities it was validated against */
+    unsigned long long validatedDefGeneration;
+    unsigned int validatedQEMUCapsSerial;
+
+    /* Monitor events waiting to be processed, in the order they came.
+     * @eventsScheduled is set while a worker owns the queue. */
+    struct qemuProcessEvent **events;
+    size_t nevents;
+    bool eventsScheduled;
+
     qemuAgentPtr agent;
     bool agentError;
 
@@ -281,6 +348,11 @@ struct _qemuDomainObjPrivate {
     virCgroupPtr cgroup;
 
     virPerfPtr perf;
+    virResctrlMonitorPtr monitor; /* resctrl monitoring of non-vCPU threads */
+
+    /* huge pages reserved in the driver while the domain is starting */
+    qemuHugepageReservationPtr hugepageReservations;
+    size_t nhugepageReservations;
 
     qemuDomainUnpluggingDevice unplug;
 
@@ -329,6 +401,32 @@ struct _qemuDomainObjPrivate {
     /* Migration capabilities. Rechecked on reconnect, not to be saved in
      * private XML. */
     virBitmapPtr migrationCaps;
+
+    /* Samples taken since the domain was started, not to be saved in
+     * private XML. NULL until the first sample was taken. */
+    qemuDomainStatsHistoryPtr statsHistory;
+    bool statsHistoryPending; /* a sample is being taken */
+
+    /* The status writer has this domain queued. Protected by the lock of
+     * the status writer. */
+    bool statusPending;
+
+    /* When the block job progress cached for every disk was fetched, in
+     * milliseconds since the epoch, or 0 if it has to be fetched again.
+     * Not to be saved in private XML. */
+    unsigned long long blockJobInfoTime;
+
+    /* Guest memory stats last fetched from the balloon driver and until
+     * when, in milliseconds since the epoch, they can be served without
+     * asking QEMU again; 0 if they have to be fetched. Not to be saved in
+     * private XML. */
+    virDomainMemoryStatStruct memStats[VIR_DOMAIN_MEMORY_STAT_NR];
+    int nmemStats;
+    unsigned long long memStatsExpiry;
+
+    /* FIFO in the cache directory QEMU saves peeked memory into, created
+     * on the first peek and removed when the domain stops. */
+    char *memPeekFifo;
 };
 
 # define QEMU_DOMAIN_PRIVATE(vm) \
@@ -352,6 +450,13 @@ struct _qemuDomainDiskPrivate {
     int blockJobStatus; /* status of the finished block job */
     bool blockJobSync; /* the block job needs synchronized termination */
 
+    /* block job progress as of the domain's blockJobInfoTime */
+    qemuMonitorBlockJobInfo blockJobInfo;
+    bool hasBlockJobInfo; /* false if the disk had no block job then */
+
+    /* target of a running backup job, labelled for qemu's access */
+    virStorageSourcePtr backupTarget;
+
     bool migrating; /* the disk is being migrated */
 
     /* information about the device */
@@ -386,6 +491,7 @@ struct _qemuDomainVcpuPrivate {
     virObject parent;
 
     pid_t tid; /* vcpu thread id */
+    virResctrlMonitorPtr monitor; /* resctrl monitoring of the vcpu thread */
     int enable_id; /* order in which the vcpus were enabled in qemu */
     int qemu_id; /* ID reported by qemu as 'CPU' in query-cpus */
     char *alias;
@@ -446,6 +552,7 @@ typedef enum {
     QEMU_PROCESS_EVENT_SERIAL_CHANGED,
     QEMU_PROCESS_EVENT_BLOCK_JOB,
     QEMU_PROCESS_EVENT_MONITOR_EOF,
+    QEMU_PROCESS_EVENT_BLOCK_THRESHOLD,
 
     QEMU_PROCESS_EVENT_LAST
 } qemuProcessEventType;
@@ -526,6 +633,9 @@ int qemuDomainObjEnterMonitorAsync(virQEMUDriverPtr driver,
                                    virDomainObjPtr obj,
                                    qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjWaitMonitorCompletion(virDomainObjPtr obj,
+                                       qemuMonitorCompletionPtr completion)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
 
 qemuAgentPtr qemuDomainObjEnterAgent(virDomainObjPtr obj)
@@ -700,6 +810,14 @@ void qemuDomainCleanupRun(virQEMUDriverPtr driver,
 
 void qemuDomainObjPrivateDataClear(qemuDomainObjPrivatePtr priv);
 
+void qemuDomainObjClearValidated(qemuDomainObjPrivatePtr priv);
+
+int qemuDomainProcessEventSubmit(virQEMUDriverPtr driver,
+                                 struct qemuProcessEvent *event)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+struct qemuProcessEvent *qemuDomainProcessEventNext(virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1);
+
 extern virDomainXMLPrivateDataCallbacks virQEMUDriverPrivateDataCallbacks;
 extern virDomainXMLNamespace virQEMUDriverDomainXMLNamespace;
 extern virDomainDefParserConfig virQEMUDriverDomainDefParserConfig;
@@ -783,6 +901,7 @@ int qemuDomainDefValidateMemoryHotplug(const virDomainDef *def,
 bool qemuDomainSupportsNewVcpuHotplug(virDomainObjPtr vm);
 bool qemuDomainHasVcpuPids(virDomainObjPtr vm);
 pid_t qemuDomainGetVcpuPid(virDomainObjPtr vm, unsigned int vcpuid);
+int qemuDomainPerfEventResctrlType(virPerfEventType type);
 int qemuDomainValidateVcpuInfo(virDomainObjPtr vm);
 int qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
@@ -916,8 +1035,12 @@ int qemuDomainGetHostdevPath(virDomainDefPtr def,
                              char ***path,
                              int **perms);
 
+qemuDomainDevTemplatePtr qemuDomainGetDevTemplate(virQEMUDriverPtr driver,
+                                                  virQEMUDriverConfigPtr cfg);
+
 int qemuDomainBuildNamespace(virQEMUDriverConfigPtr cfg,
                              virSecurityManagerPtr mgr,
+                             qemuDomainDevTemplatePtr tmpl,
                              virDomainObjPtr vm);
 
 int qemuDomainCreateNamespace(virQEMUDriverPtr driver,
@@ -1010,4 +1133,39 @@ qemuDomainCheckMigrationCapabilities(virQEMUDriverPtr driver,
                                      virDomainObjPtr vm,
                                      qemuDomainAsyncJob asyncJob);
 
+qemuDomainStatsHistoryPtr qemuDomainStatsHistoryNew(size_t length);
+
+void qemuDomainStatsHistoryFree(qemuDomainStatsHistoryPtr history);
+
+void qemuDomainMemoryStatsInvalidate(virDomainObjPtr vm);
+int qemuDomainGetHomeNode(virDomainObjPtr vm);
+int qemuDomainMemoryStatsCacheGet(virDomainObjPtr vm,
+                                  virDomainMemoryStatPtr stats,
+                                  unsigned int nr_stats);
+void qemuDomainMemoryStatsCacheStore(virDomainObjPtr vm,
+                                     virDomainMemoryStatPtr stats,
+                                     int nstats);
+
+void qemuDomainStatsHistoryAdd(qemuDomainStatsHistoryPtr history,
+                               unsigned long long timestamp,
+                               virTypedParameterPtr params,
+                               int nparams);
+
+int qemuDomainStatsHistoryGet(qemuDomainStatsHistoryPtr history,
+                              virDomainPtr dom,
+                              unsigned long long start,
+                              unsigned long long end,
+                              virDomainStatsRecordPtr **records);
+
+qemuDomainStatusWriterPtr qemuDomainStatusWriterNew(virQEMUDriverPtr driver,
+                                                    unsigned int delay);
+
+void qemuDomainStatusWriterFree(qemuDomainStatusWriterPtr writer);
+
+int qemuDomainObjSaveStatus(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm);
+
+int qemuDomainObjFlushStatus(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm);
+
 #endif /* __QEMU_DOMAIN_H__ */
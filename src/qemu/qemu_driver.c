@@ -89,6 +89,8 @@
 #include "virfdstream.h"
 #include "configmake.h"
 #include "virthreadpool.h"
+#include "viratomic.h"
+#include "viridentity.h"
 #include "locking/lock_manager.h"
 #include "locking/domain_lock.h"
 #include "virkeycode.h"
@@ -138,8 +140,42 @@ VIR_LOG_INIT("qemu.qemu_driver");
 
 #define QEMU_NB_BANDWIDTH_PARAM 7
 
+/* Number of threads collecting domain statistics in parallel */
+#define QEMU_DOMAIN_STATS_WORKERS 8
+
+/* Workers handling monitor events, each serving one domain at a time */
+#define QEMU_PROCESS_EVENT_WORKERS 8
+
+/* Time in milliseconds collecting statistics of a single domain may take
+ * before the domain's record is filled with the data which doesn't need
+ * the monitor only. This matches the time a caller used to wait for the
+ * domain's job (QEMU_JOB_WAIT_TIME). */
+#define QEMU_DOMAIN_STATS_TIMEOUT (30 * 1000ull)
+
+/* Seconds the guest agent of a single domain may take to answer, short
+ * enough for the answer to make it within QEMU_DOMAIN_STATS_TIMEOUT */
+#define QEMU_DOMAIN_STATS_AGENT_TIMEOUT 3
+
+/* Statistics groups only returned when explicitly asked for, as each
+ * of them costs a round trip into every guest */
+#define QEMU_DOMAIN_STATS_EXPLICIT VIR_DOMAIN_STATS_GUEST
+
+/* Longest dirty rate calculation QEMU accepts, in seconds */
+#define QEMU_DOMAIN_DIRTYRATE_CALC_MAX 60
+
+/* Statistics groups sampled into the history of each domain */
+#define QEMU_DOMAIN_STATS_HISTORY (VIR_DOMAIN_STATS_CPU_TOTAL | \
+                                   VIR_DOMAIN_STATS_INTERFACE | \
+                                   VIR_DOMAIN_STATS_BLOCK)
+
 static void qemuProcessEventHandler(void *data, void *opaque);
 
+static void qemuDomainGetStatsWorkerFunc(void *data, void *opaque);
+static void qemuDomainStatsStreamWorkerFunc(void *data, void *opaque);
+static void qemuDomainStatsHistoryWorkerFunc(void *data, void *opaque);
+static void qemuDomainStatsHistoryTimer(int timer, void *opaque);
+static void qemuDomainStatsSubscriptionRemove(qemuDomainStatsSubscriptionPtr sub);
+
 static int qemuStateCleanup(void);
 
 static int qemuDomainObjStart(virConnectPtr conn,
@@ -187,6 +223,10 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    virDomainObjPtr *vms;       /* Domains to start, ref'd */
+    size_t nvms;
+    volatile int next;          /* Index of the next domain to start */
 };
 
 
@@ -254,19 +294,39 @@ qemuSnapObjFromSnapshot(virDomainObjPtr vm,
 }
 
 static int
-qemuAutostartDomain(virDomainObjPtr vm,
-                    void *opaque)
+qemuAutostartCollect(virDomainObjPtr vm,
+                     void *opaque)
 {
     struct qemuAutostartData *data = opaque;
+    int ret = 0;
+
+    virObjectLock(vm);
+    if (vm->autostart &&
+        !virDomainObjIsActive(vm)) {
+        virObjectRef(vm);
+        if (VIR_APPEND_ELEMENT_COPY(data->vms, data->nvms, vm) < 0) {
+            virObjectUnref(vm);
+            ret = -1;
+        }
+    }
+    virObjectUnlock(vm);
+
+    return ret;
+}
+
+
+/* Consumes the reference on @vm taken by qemuAutostartCollect */
+static void
+qemuAutostartDomain(virDomainObjPtr vm,
+                    struct qemuAutostartData *data)
+{
     int flags = 0;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(data->driver);
-    int ret = -1;
 
     if (cfg->autoStartBypassCache)
         flags |= VIR_DOMAIN_START_BYPASS_CACHE;
 
     virObjectLock(vm);
-    virObjectRef(vm);
     virResetLastError();
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
@@ -288,11 +348,20 @@ qemuAutostartDomain(virDomainObjPtr vm,
         qemuProcessEndJob(data->driver, vm);
     }
 
-    ret = 0;
  cleanup:
     virDomainObjEndAPI(&vm);
     virObjectUnref(cfg);
-    return ret;
+}
+
+
+static void
+qemuAutostartWorker(void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+    size_t i;
+
+    while ((i = virAtomicIntInc(&data->next) - 1) < data->nvms)
+        qemuAutostartDomain(data->vms[i], data);
 }
 
 
@@ -307,10 +376,40 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
      */
     virConnectPtr conn = virConnectOpen(cfg->uri);
     /* Ignoring NULL conn which is mostly harmless here */
-    struct qemuAutostartData data = { driver, conn };
+    struct qemuAutostartData data = { driver, conn, NULL, 0, 0 };
+    virThreadPtr workers = NULL;
+    size_t nworkers = 0;
+    size_t i;
+
+    if (virDomainObjListForEach(driver->domains, qemuAutostartCollect,
+                                &data) < 0)
+        VIR_WARN("Not all autostart domains could be collected: %s",
+                 virGetLastErrorMessage());
+
+    nworkers = MIN(cfg->autoStartParallel, data.nvms);
+    VIR_DEBUG("Starting %zu domains using %zu threads", data.nvms, nworkers);
+
+    /* The calling thread is always one of the workers */
+    if (nworkers > 1 && VIR_ALLOC_N(workers, nworkers - 1) < 0)
+        nworkers = 1;
+
+    for (i = 0; i + 1 < nworkers; i++) {
+        if (virThreadCreate(&workers[i], true,
+                            qemuAutostartWorker, &data) < 0) {
+            VIR_WARN("Failed to create autostart thread: %s",
+                     virGetLastErrorMessage());
+            break;
+        }
+    }
+    nworkers = i;
+
+    qemuAutostartWorker(&data);
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
 
+    VIR_FREE(workers);
+    VIR_FREE(data.vms);
     virObjectUnref(conn);
     virObjectUnref(cfg);
 }
@@ -420,6 +519,8 @@ qemuSecurityInit(virQEMUDriverPtr driver)
     if (virQEMUDriverIsPrivileged(driver)) {
         if (cfg->dynamicOwnership)
             flags |= VIR_SECURITY_MANAGER_DYNAMIC_OWNERSHIP;
+        if (cfg->rememberOwner)
+            flags |= VIR_SECURITY_MANAGER_REMEMBER_OWNER;
         if (virBitmapIsBitSet(cfg->namespaces, QEMU_DOMAIN_NS_MOUNT))
             flags |= VIR_SECURITY_MANAGER_MOUNT_NAMESPACE;
         if (!(mgr = qemuSecurityNewDAC(QEMU_DRIVER_NAME,
@@ -467,7 +568,8 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     virDomainSnapshotObjPtr current = NULL;
     unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
                           VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_LAZY_DOMAIN);
     int ret = -1;
     virCapsPtr caps = NULL;
     int direrr;
@@ -637,6 +739,8 @@ qemuStateInitialize(bool privileged,
     if (VIR_ALLOC(qemu_driver) < 0)
         return -1;
 
+    qemu_driver->statsHistoryTimer = -1;
+
     if (virMutexInit(&qemu_driver->lock) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot initialize mutex"));
@@ -947,12 +1051,46 @@ qemuStateInitialize(bool privileged,
                             qemuDomainManagedSaveLoad,
                             qemu_driver);
 
-    qemuProcessReconnectAll(conn, qemu_driver);
+    if (cfg->statusSaveDelay > 0 &&
+        !(qemu_driver->statusWriter =
+          qemuDomainStatusWriterNew(qemu_driver, cfg->statusSaveDelay)))
+        goto error;
+
+    if (qemuProcessReconnectAll(conn, qemu_driver) < 0)
+        goto error;
 
-    qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, qemuProcessEventHandler, qemu_driver);
+    qemu_driver->workerPool = virThreadPoolNew(0, QEMU_PROCESS_EVENT_WORKERS, 0,
+                                               qemuProcessEventHandler,
+                                               qemu_driver);
     if (!qemu_driver->workerPool)
         goto error;
 
+    qemu_driver->statsPool = virThreadPoolNew(0, QEMU_DOMAIN_STATS_WORKERS, 0,
+                                              qemuDomainGetStatsWorkerFunc,
+                                              qemu_driver);
+    if (!qemu_driver->statsPool)
+        goto error;
+
+    qemu_driver->statsStreamPool = virThreadPoolNew(0, 1, 0,
+                                                    qemuDomainStatsStreamWorkerFunc,
+                                                    qemu_driver);
+    if (!qemu_driver->statsStreamPool)
+        goto error;
+
+    if (cfg->statsHistoryInterval > 0) {
+        qemu_driver->statsHistoryPool = virThreadPoolNew(0, QEMU_DOMAIN_STATS_WORKERS, 0,
+                                                         qemuDomainStatsHistoryWorkerFunc,
+                                                         qemu_driver);
+        if (!qemu_driver->statsHistoryPool)
+            goto error;
+
+        if ((qemu_driver->statsHistoryTimer =
+             virEventAddTimeout(cfg->statsHistoryInterval * 1000,
+                                qemuDomainStatsHistoryTimer,
+                                qemu_driver, NULL)) < 0)
+            goto error;
+    }
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -975,10 +1113,27 @@ qemuStateInitialize(bool privileged,
 static void
 qemuStateAutoStart(void)
 {
+    virQEMUDriverConfigPtr cfg;
+    virCapsPtr caps = NULL;
+
     if (!qemu_driver)
         return;
 
     qemuAutostartDomains(qemu_driver);
+
+    /* Nothing else touches the domains before clients are accepted */
+    cfg = virQEMUDriverGetConfig(qemu_driver);
+    if (cfg->compactInactiveDomains) {
+        if ((caps = virQEMUDriverGetCapabilities(qemu_driver, false)))
+            virDomainObjListCompact(qemu_driver->domains, cfg->configDir,
+                                    caps, qemu_driver->xmlopt);
+        else
+            VIR_WARN("Not compacting inactive domains: %s",
+                     virGetLastErrorMessage());
+    }
+
+    virObjectUnref(caps);
+    virObjectUnref(cfg);
 }
 
 static void qemuNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
@@ -1093,11 +1248,26 @@ qemuStateStop(void)
 static int
 qemuStateCleanup(void)
 {
+    size_t i;
+
     if (!qemu_driver)
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+    virThreadPoolFree(qemu_driver->reconnectPool);
     virThreadPoolFree(qemu_driver->workerPool);
+    if (qemu_driver->statsHistoryTimer >= 0)
+        virEventRemoveTimeout(qemu_driver->statsHistoryTimer);
+    virThreadPoolFree(qemu_driver->statsHistoryPool);
+    for (i = 0; i < qemu_driver->nstatsSubscriptions; i++)
+        qemuDomainStatsSubscriptionRemove(qemu_driver->statsSubscriptions[i]);
+    virThreadPoolFree(qemu_driver->statsStreamPool);
+    virObjectListFreeCount(qemu_driver->statsSubscriptions,
+                           qemu_driver->nstatsSubscriptions);
+    VIR_FREE(qemu_driver->hugepageReservations);
+    virObjectUnref(qemu_driver->devTemplate);
+    virThreadPoolFree(qemu_driver->statsPool);
+    qemuDomainStatusWriterFree(qemu_driver->statusWriter);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
@@ -1476,6 +1646,33 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
 }
 
 
+/*
+ * Gets the CPU time consumed by all threads of a running domain. The
+ * cpuacct controller accounts for all of them in a single file, which is
+ * kept open by the cgroup code and does not need to be parsed, and the
+ * value is in nanoseconds rather than in clock ticks. The process' stat
+ * file in /proc is only used when the controller is not available.
+ */
+static int
+qemuDomainGetCpuTime(virDomainObjPtr vm,
+                     unsigned long long *cpuTime)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (priv->cgroup &&
+        virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUACCT)) {
+        if (virCgroupGetCpuacctUsage(priv->cgroup, cpuTime) == 0)
+            return 0;
+
+        VIR_DEBUG("Falling back to /proc for CPU time of domain %s",
+                  vm->def->name);
+        virResetLastError();
+    }
+
+    return qemuGetProcessInfo(cpuTime, NULL, NULL, vm->pid, 0);
+}
+
+
 static int
 qemuDomainHelperGetVcpus(virDomainObjPtr vm,
                          virVcpuInfoPtr info,
@@ -1855,7 +2052,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     virDomainPausedReason reason;
     int eventDetail;
     int state;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
@@ -1863,7 +2059,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     if (virDomainSuspendEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    cfg = virQEMUDriverGetConfig(driver);
     priv = vm->privateData;
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_SUSPEND) < 0)
@@ -1901,7 +2096,7 @@ static int qemuDomainSuspend(virDomainPtr dom)
                                              eventDetail);
         }
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -1912,7 +2107,6 @@ static int qemuDomainSuspend(virDomainPtr dom)
     virDomainObjEndAPI(&vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -1925,12 +2119,10 @@ static int qemuDomainResume(virDomainPtr dom)
     virObjectEventPtr event = NULL;
     int state;
     int reason;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
 
-    cfg = virQEMUDriverGetConfig(driver);
 
     if (virDomainResumeEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
@@ -1968,7 +2160,7 @@ static int qemuDomainResume(virDomainPtr dom)
                                          VIR_DOMAIN_EVENT_RESUMED,
                                          VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -1978,7 +2170,6 @@ static int qemuDomainResume(virDomainPtr dom)
  cleanup:
     virDomainObjEndAPI(&vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -2461,6 +2652,8 @@ static int qemuDomainSetMemoryFlags(virDomainPtr dom, unsigned long newmem,
 
     ret = 0;
  endjob:
+    if (ret == 0)
+        virDomainObjBumpGeneration(vm);
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
@@ -2530,7 +2723,8 @@ static int qemuDomainSetMemoryStatsPeriod(virDomainPtr dom, int period,
         }
 
         def->memballoon->period = period;
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainMemoryStatsInvalidate(vm);
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -2696,7 +2890,7 @@ qemuDomainGetInfo(virDomainPtr dom,
     }
 
     if (virDomainObjIsActive(vm)) {
-        if (qemuGetProcessInfo(&(info->cpuTime), NULL, NULL, vm->pid, 0) < 0) {
+        if (qemuDomainGetCpuTime(vm, &info->cpuTime) < 0) {
             virReportError(VIR_ERR_OPERATION_FAILED, "%s",
                            _("cannot read cputime for domain"));
             goto cleanup;
@@ -2775,10 +2969,12 @@ qemuDomainGetControlInfo(virDomainPtr dom,
             goto cleanup;
         if (priv->job.current) {
             info->state = VIR_DOMAIN_CONTROL_JOB;
+            info->details = priv->job.nwaiters;
             info->stateTime -= priv->job.current->started;
         } else {
             if (priv->monStart > 0) {
                 info->state = VIR_DOMAIN_CONTROL_OCCUPIED;
+                info->details = priv->job.nwaiters;
                 info->stateTime -= priv->monStart;
             } else {
                 /* At this point the domain has an active job, but monitor was
@@ -2821,6 +3017,8 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    QEMU_SAVE_FORMAT_ZSTD = 5,
+    QEMU_SAVE_FORMAT_LZ4 = 6,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2834,7 +3032,9 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "zstd",
+              "lz4")
 
 VIR_ENUM_DECL(qemuDumpFormat)
 VIR_ENUM_IMPL(qemuDumpFormat, VIR_DOMAIN_CORE_DUMP_FORMAT_LAST,
@@ -3241,8 +3441,8 @@ qemuFileWrapperFDClose(virDomainObjPtr vm,
 {
     int ret;
 
-    /* virFileWrapperFd uses iohelper to write data onto disk.
-     * However, iohelper calls fdatasync() which may take ages to
+    /* virFileWrapperFd uses a thread to write data onto disk.
+     * However, that thread calls fdatasync() which may take ages to
      * finish. Therefore, we shouldn't be waiting with the domain
      * object locked. */
 
@@ -3834,6 +4034,11 @@ doCoreDump(virQEMUDriverPtr driver,
                            NULL, NULL)) < 0)
         goto cleanup;
 
+    /* Guest memory tends to be mostly zeroes, don't waste time and space
+     * writing them out in ELF dumps */
+    if (dump_flags & VIR_DUMP_MEMORY_ONLY)
+        flags |= VIR_FILE_WRAPPER_SPARSE;
+
     if (!(wrapperFd = virFileWrapperFdNew(&fd, path, flags)))
         goto cleanup;
 
@@ -4222,7 +4427,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool removeInactive = false;
 
     if (qemuDomainObjBeginAsyncJob(driver, vm, QEMU_ASYNC_JOB_DUMP,
@@ -4246,7 +4450,7 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 
     qemuDomainEventQueue(driver, event);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainObjSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -4296,7 +4500,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
         qemuDomainRemoveInactiveJob(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
 }
 
 
@@ -4305,7 +4508,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
                           char *devAlias)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainDeviceDef dev;
 
     VIR_DEBUG("Removing device %s from domain %p %s",
@@ -4329,7 +4531,7 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
             goto endjob;
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("unable to save domain status after removing device %s",
                  devAlias);
 
@@ -4338,7 +4540,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 }
 
 
@@ -4645,7 +4846,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
                           char *devAlias,
                           bool connected)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainChrDeviceState newstate;
     virObjectEventPtr event = NULL;
     virDomainDeviceDef dev;
@@ -4696,7 +4896,7 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
     dev.data.chr->state = newstate;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save status of domain %s after updating state of "
                  "channel %s", vm->def->name, devAlias);
 
@@ -4722,7 +4922,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 
 }
 
@@ -4754,6 +4953,91 @@ processBlockJobEvent(virQEMUDriverPtr driver,
 }
 
 
+/* Grow the logical volume under a qcow2 disk after its write threshold
+ * was crossed, then arm the threshold for the new end of the volume.  */
+static void
+processBlockThresholdEvent(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           char *diskdst)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virConnectPtr conn = NULL;
+    virStoragePoolPtr pool = NULL;
+    virStorageVolPtr vol = NULL;
+    virStorageVolInfo info;
+    virDomainDiskDefPtr disk;
+    unsigned long long max;
+    unsigned long long delta = cfg->thinExtendSize;
+    int rc;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        VIR_DEBUG("Domain is not running");
+        goto endjob;
+    }
+
+    if (!(disk = virDomainDiskByName(vm->def, diskdst, false)) ||
+        !qemuProcessDiskThinExtendWanted(cfg, disk)) {
+        VIR_DEBUG("disk '%s' is gone or no longer extended", diskdst);
+        goto endjob;
+    }
+
+    max = qemuProcessDiskThinExtendMax(disk);
+
+    /* The volume isn't ours, so don't keep the domain locked while the
+     * storage driver grows it.  The job keeps the disk in place.  */
+    qemuDomainObjEnterRemote(vm);
+    if (!(conn = virConnectOpen(cfg->uri)) ||
+        !(pool = virStoragePoolLookupByName(conn, disk->src->srcpool->pool)) ||
+        !(vol = virStorageVolLookupByName(pool, disk->src->srcpool->volume)) ||
+        virStorageVolGetInfo(vol, &info) < 0) {
+        rc = -1;
+    } else {
+        if (max)
+            delta = MIN(delta, max > info.capacity ? max - info.capacity : 0);
+
+        if (delta == 0) {
+            VIR_DEBUG("volume of disk '%s' is fully extended", diskdst);
+            rc = 0;
+        } else {
+            VIR_DEBUG("extending volume of disk '%s' by %llu bytes",
+                      diskdst, delta);
+            rc = virStorageVolResize(vol, delta,
+                                     VIR_STORAGE_VOL_RESIZE_ALLOCATE |
+                                     VIR_STORAGE_VOL_RESIZE_DELTA);
+        }
+    }
+    qemuDomainObjExitRemote(vm);
+
+    if (rc < 0) {
+        VIR_WARN("Unable to extend volume of disk '%s' of domain %s: %s",
+                 diskdst, vm->def->name, virGetLastErrorMessage());
+        goto endjob;
+    }
+
+    if (!virDomainObjIsActive(vm))
+        goto endjob;
+
+    if (qemuProcessDiskThinExtendArm(driver, vm, disk,
+                                     QEMU_ASYNC_JOB_NONE) < 0)
+        VIR_WARN("Unable to arm volume extension for disk '%s' of "
+                 "domain %s: %s", diskdst, vm->def->name,
+                 virGetLastErrorMessage());
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    VIR_FREE(diskdst);
+    virObjectUnref(vol);
+    virObjectUnref(pool);
+    virObjectUnref(conn);
+    virObjectUnref(cfg);
+}
+
+
 static void
 processMonitorEOFEvent(virQEMUDriverPtr driver,
                        virDomainObjPtr vm)
@@ -4800,16 +5084,13 @@ processMonitorEOFEvent(virQEMUDriverPtr driver,
 }
 
 
-static void qemuProcessEventHandler(void *data, void *opaque)
+static void
+qemuProcessEventHandle(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       struct qemuProcessEvent *processEvent)
 {
-    struct qemuProcessEvent *processEvent = data;
-    virDomainObjPtr vm = processEvent->vm;
-    virQEMUDriverPtr driver = opaque;
-
     VIR_DEBUG("vm=%p, event=%d", vm, processEvent->eventType);
 
-    virObjectLock(vm);
-
     switch (processEvent->eventType) {
     case QEMU_PROCESS_EVENT_WATCHDOG:
         processWatchdogEvent(driver, vm, processEvent->action);
@@ -4837,12 +5118,33 @@ static void qemuProcessEventHandler(void *data, void *opaque)
     case QEMU_PROCESS_EVENT_MONITOR_EOF:
         processMonitorEOFEvent(driver, vm);
         break;
+    case QEMU_PROCESS_EVENT_BLOCK_THRESHOLD:
+        processBlockThresholdEvent(driver, vm, processEvent->data);
+        break;
     case QEMU_PROCESS_EVENT_LAST:
         break;
     }
+}
+
+
+/* Drains the event queue of one domain, see qemuDomainProcessEventSubmit */
+static void qemuProcessEventHandler(void *data, void *opaque)
+{
+    virDomainObjPtr vm = data;
+    virQEMUDriverPtr driver = opaque;
+    struct qemuProcessEvent *processEvent;
+
+    virObjectLock(vm);
+
+    while ((processEvent = qemuDomainProcessEventNext(vm))) {
+        qemuProcessEventHandle(driver, vm, processEvent);
+
+        /* The worker's own reference keeps @vm alive */
+        virObjectUnref(processEvent->vm);
+        VIR_FREE(processEvent);
+    }
 
     virDomainObjEndAPI(&vm);
-    VIR_FREE(processEvent);
 }
 
 
@@ -5051,7 +5353,7 @@ qemuDomainPinVcpuLive(virDomainObjPtr vm,
     vcpuinfo->cpumask = tmpmap;
     tmpmap = NULL;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -5276,7 +5578,7 @@ qemuDomainPinEmulator(virDomainPtr dom,
         if (!(def->cputune.emulatorpin = virBitmapNewCopy(pcpumap)))
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
 
         str = virBitmapFormat(pcpumap);
@@ -5746,7 +6048,7 @@ qemuDomainPinIOThread(virDomainPtr dom,
         if (virProcessSetAffinity(iothrid->thread_id, pcpumap) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
 
         if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -6046,7 +6348,7 @@ qemuDomainChgIOThread(virQEMUDriverPtr driver,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -6415,6 +6717,16 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
 
     if ((fd = qemuOpenFile(driver, NULL, path, oflags, NULL, NULL)) < 0)
         goto error;
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* QEMU reads the image from start to end; let the kernel read ahead
+     * more aggressively so that loading memory is not bound by latency */
+    if (!bypass_cache) {
+        int rc;
+
+        if ((rc = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL)) != 0)
+            VIR_DEBUG("Unable to set read ahead for %s: %d", path, rc);
+    }
+#endif
     if (bypass_cache &&
         !(*wrapperFd = virFileWrapperFdNew(&fd, path,
                                            VIR_FILE_WRAPPER_BYPASS_CACHE)))
@@ -6542,7 +6854,6 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     int intermediatefd = -1;
     virCommandPtr cmd = NULL;
     char *errbuf = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virQEMUSaveHeaderPtr header = &data->header;
     qemuDomainSaveCookiePtr cookie = NULL;
 
@@ -6630,7 +6941,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
                                "%s", _("failed to resume domain"));
             goto cleanup;
         }
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
             goto cleanup;
         }
@@ -6652,7 +6963,6 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     if (qemuSecurityRestoreSavedStateLabel(driver->securityManager,
                                            vm->def, path) < 0)
         VIR_WARN("failed to restore save state label on %s", path);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -7066,6 +7376,44 @@ static char
 }
 
 
+static char *
+qemuDomainGetXMLDescSubtree(virDomainPtr dom,
+                            const char *subtree,
+                            unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    virDomainDefPtr def;
+    virCapsPtr caps = NULL;
+    char *ret = NULL;
+
+    virCheckFlags(VIR_DOMAIN_XML_SECURE |
+                  VIR_DOMAIN_XML_INACTIVE, NULL);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainGetXMLDescSubtreeEnsureACL(dom->conn, vm->def, flags) < 0)
+        goto cleanup;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto cleanup;
+
+    if ((flags & VIR_DOMAIN_XML_INACTIVE) && vm->newDef)
+        def = vm->newDef;
+    else
+        def = vm->def;
+
+    ret = virDomainDefFormatSubtree(def, caps, subtree,
+                                    virDomainDefFormatConvertXMLFlags(flags));
+
+ cleanup:
+    virObjectUnref(caps);
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
 static char *qemuConnectDomainXMLFromNative(virConnectPtr conn,
                                             const char *format,
                                             const char *config,
@@ -7556,6 +7904,7 @@ qemuDomainUndefineFlags(virDomainPtr dom,
      * domain obj from the hash table.
      */
     vm->persistent = 0;
+    virDomainObjBumpGeneration(vm);
     if (!virDomainObjIsActive(vm))
         qemuDomainRemoveInactive(driver, vm);
 
@@ -8454,7 +8803,7 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjFlushStatus(driver, vm) < 0) {
             ret = -1;
             goto cleanup;
         }
@@ -8517,65 +8866,234 @@ qemuDomainAttachDeviceFlags(virDomainPtr dom,
     return ret;
 }
 
-static int qemuDomainAttachDevice(virDomainPtr dom, const char *xml)
-{
-    return qemuDomainAttachDeviceFlags(dom, xml,
-                                       VIR_DOMAIN_AFFECT_LIVE);
-}
-
-
-static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
-                                       const char *xml,
-                                       unsigned int flags)
+/* Attach @ndevs devices described by @xmls under a single modify job.
+ * Every device is parsed and checked before the first one is attached,
+ * the persistent definition is copied and saved once and the status XML
+ * is written once after the last live attach. */
+static int
+qemuDomainAttachDevicesLiveAndConfig(virConnectPtr conn,
+                                     virDomainObjPtr vm,
+                                     virQEMUDriverPtr driver,
+                                     const char **xmls,
+                                     size_t nxmls,
+                                     unsigned int flags)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm = NULL;
     virDomainDefPtr vmdef = NULL;
-    virDomainDeviceDefPtr dev = NULL, dev_copy = NULL;
-    bool force = (flags & VIR_DOMAIN_DEVICE_MODIFY_FORCE) != 0;
-    int ret = -1;
     virQEMUDriverConfigPtr cfg = NULL;
+    virDomainDeviceDefPtr *devs = NULL;
+    virDomainDeviceDefPtr *devs_live = NULL;
+    size_t ndevs = 0;
+    size_t ndevs_live = 0;
+    size_t i;
+    int ret = -1;
     virCapsPtr caps = NULL;
-    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE;
+    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                               VIR_DOMAIN_DEF_PARSE_ABI_UPDATE;
 
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
-                  VIR_DOMAIN_AFFECT_CONFIG |
-                  VIR_DOMAIN_DEVICE_MODIFY_FORCE, -1);
-
-    virNWFilterReadLockFilterUpdates();
+                  VIR_DOMAIN_AFFECT_CONFIG, -1);
 
     cfg = virQEMUDriverGetConfig(driver);
 
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
-    if (!(vm = qemuDomObjFromDomain(dom)))
+    if (VIR_ALLOC_N(devs, nxmls) < 0)
         goto cleanup;
 
-    if (virDomainUpdateDeviceFlagsEnsureACL(dom->conn, vm->def, flags) < 0)
-        goto cleanup;
+    for (ndevs = 0; ndevs < nxmls; ndevs++) {
+        if (!(devs[ndevs] = virDomainDeviceDefParse(xmls[ndevs], vm->def,
+                                                    caps, driver->xmlopt,
+                                                    parse_flags)))
+            goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
-        goto cleanup;
+        if (virDomainDeviceValidateAliasForHotplug(vm, devs[ndevs], flags) < 0) {
+            ndevs++;
+            goto cleanup;
+        }
+    }
 
-    dev = dev_copy = virDomainDeviceDefParse(xml, vm->def,
-                                             caps, driver->xmlopt,
-                                             parse_flags);
-    if (dev == NULL)
-        goto endjob;
+    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+        if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+            /* Adding to CONFIG takes one instance, so the live
+             * attach needs its own deep copy of every device. */
+            if (VIR_ALLOC_N(devs_live, ndevs) < 0)
+                goto cleanup;
 
-    if (virDomainObjUpdateModificationImpact(vm, &flags) < 0)
-        goto endjob;
+            for (ndevs_live = 0; ndevs_live < ndevs; ndevs_live++) {
+                if (!(devs_live[ndevs_live] =
+                      virDomainDeviceDefCopy(devs[ndevs_live], vm->def,
+                                             caps, driver->xmlopt)))
+                    goto cleanup;
+            }
+        }
 
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
-        flags & VIR_DOMAIN_AFFECT_LIVE) {
-        /* If we are affecting both CONFIG and LIVE
-         * create a deep copy of device as adding
-         * to CONFIG takes one instance.
-         */
-        dev_copy = virDomainDeviceDefCopy(dev, vm->def, caps, driver->xmlopt);
-        if (!dev_copy)
-            goto endjob;
+        for (i = 0; i < ndevs; i++) {
+            if (virDomainDefCompatibleDevice(vm->def,
+                                             devs_live ? devs_live[i] : devs[i]) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        if (!(vmdef = virDomainObjCopyPersistentDef(vm, caps, driver->xmlopt)))
+            goto cleanup;
+
+        for (i = 0; i < ndevs; i++) {
+            if (virDomainDefCompatibleDevice(vmdef, devs[i]) < 0)
+                goto cleanup;
+            if (qemuDomainAttachDeviceConfig(vmdef, devs[i], conn, caps,
+                                             parse_flags,
+                                             driver->xmlopt) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+        for (i = 0; i < ndevs; i++) {
+            virDomainDeviceDefPtr dev = devs_live ? devs_live[i] : devs[i];
+
+            /* Devices earlier in the batch are part of vm->def by now,
+             * so re-check to catch duplicates within the batch itself. */
+            if (i > 0 && virDomainDefCompatibleDevice(vm->def, dev) < 0)
+                break;
+
+            if (qemuDomainAttachDeviceLive(vm, dev, conn, driver) < 0)
+                break;
+        }
+
+        /*
+         * update domain status forcibly because the domain status may be
+         * changed even if we failed to attach a device. For example,
+         * a new controller may be created.
+         */
+        if (qemuDomainObjFlushStatus(driver, vm) < 0 || i < ndevs)
+            goto cleanup;
+    }
+
+    /* Finally, if no error until here, we can save config. */
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        if (virDomainSaveConfig(cfg->configDir, driver->caps, vmdef) < 0)
+            goto cleanup;
+
+        virDomainObjAssignDef(vm, vmdef, false, NULL);
+        vmdef = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(vmdef);
+    for (i = 0; i < ndevs_live; i++)
+        virDomainDeviceDefFree(devs_live[i]);
+    VIR_FREE(devs_live);
+    for (i = 0; i < ndevs; i++)
+        virDomainDeviceDefFree(devs[i]);
+    VIR_FREE(devs);
+    virObjectUnref(cfg);
+    virObjectUnref(caps);
+
+    return ret;
+}
+
+static int
+qemuDomainAttachDevices(virDomainPtr dom,
+                        const char **xmls,
+                        unsigned int nxmls,
+                        unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+
+    virNWFilterReadLockFilterUpdates();
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainAttachDevicesEnsureACL(dom->conn, vm->def, flags) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (virDomainObjUpdateModificationImpact(vm, &flags) < 0)
+        goto endjob;
+
+    if (qemuDomainAttachDevicesLiveAndConfig(dom->conn, vm, driver,
+                                             xmls, nxmls, flags) < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    virNWFilterUnlockFilterUpdates();
+    return ret;
+}
+
+static int qemuDomainAttachDevice(virDomainPtr dom, const char *xml)
+{
+    return qemuDomainAttachDeviceFlags(dom, xml,
+                                       VIR_DOMAIN_AFFECT_LIVE);
+}
+
+
+static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
+                                       const char *xml,
+                                       unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    virDomainDefPtr vmdef = NULL;
+    virDomainDeviceDefPtr dev = NULL, dev_copy = NULL;
+    bool force = (flags & VIR_DOMAIN_DEVICE_MODIFY_FORCE) != 0;
+    int ret = -1;
+    virQEMUDriverConfigPtr cfg = NULL;
+    virCapsPtr caps = NULL;
+    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE;
+
+    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
+                  VIR_DOMAIN_AFFECT_CONFIG |
+                  VIR_DOMAIN_DEVICE_MODIFY_FORCE, -1);
+
+    virNWFilterReadLockFilterUpdates();
+
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto cleanup;
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainUpdateDeviceFlagsEnsureACL(dom->conn, vm->def, flags) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    dev = dev_copy = virDomainDeviceDefParse(xml, vm->def,
+                                             caps, driver->xmlopt,
+                                             parse_flags);
+    if (dev == NULL)
+        goto endjob;
+
+    if (virDomainObjUpdateModificationImpact(vm, &flags) < 0)
+        goto endjob;
+
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
+        flags & VIR_DOMAIN_AFFECT_LIVE) {
+        /* If we are affecting both CONFIG and LIVE
+         * create a deep copy of device as adding
+         * to CONFIG takes one instance.
+         */
+        dev_copy = virDomainDeviceDefCopy(dev, vm->def, caps, driver->xmlopt);
+        if (!dev_copy)
+            goto endjob;
     }
 
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
@@ -8604,7 +9122,7 @@ static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjFlushStatus(driver, vm) < 0) {
             ret = -1;
             goto endjob;
         }
@@ -8696,7 +9214,7 @@ qemuDomainDetachDeviceLiveAndConfig(virQEMUDriverPtr driver,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjFlushStatus(driver, vm) < 0) {
             ret = -1;
             goto cleanup;
         }
@@ -8843,6 +9361,7 @@ static int qemuDomainSetAutostart(virDomainPtr dom,
         }
 
         vm->autostart = autostart;
+        virDomainObjBumpGeneration(vm);
 
  endjob:
         qemuDomainObjEndJob(driver, vm);
@@ -9256,7 +9775,7 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
             }
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
     if (ret < 0)
@@ -9522,7 +10041,7 @@ qemuDomainSetMemoryParameters(virDomainPtr dom,
 #undef VIR_SET_MEM_PARAMETER
 
     if (def &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainObjSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (persistentDef &&
@@ -9791,7 +10310,7 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
                                  -1, mode, nodeset) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -9977,16 +10496,26 @@ qemuDomainSetPerfEvents(virDomainPtr dom,
             enabled = param->value.b;
             type = virPerfEventTypeFromString(param->field);
 
-            if (!enabled && virPerfEventDisable(priv->perf, type) < 0)
-                goto endjob;
-            if (enabled && virPerfEventEnable(priv->perf, type, vm->pid) < 0)
-                goto endjob;
+            /* resctrl monitoring groups are set up below */
+            if (qemuDomainPerfEventResctrlType(type) < 0) {
+                if (!enabled && virPerfEventDisable(priv->perf, type) < 0)
+                    goto endjob;
+                if (enabled && virPerfEventEnable(priv->perf, type, vm->pid) < 0)
+                    goto endjob;
+            }
 
             def->perf.events[type] = enabled ?
                 VIR_TRISTATE_BOOL_YES : VIR_TRISTATE_BOOL_NO;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuProcessResctrlMonitorWanted(def)) {
+            if (qemuProcessResctrlMonitorStart(vm) < 0)
+                goto endjob;
+        } else {
+            qemuProcessResctrlMonitorStop(vm);
+        }
+
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -10057,6 +10586,9 @@ qemuDomainGetPerfEvents(virDomainPtr dom,
 
         if (flags & VIR_DOMAIN_AFFECT_CONFIG)
             perf_enabled = def->perf.events[i] == VIR_TRISTATE_BOOL_YES;
+        else if (qemuDomainPerfEventResctrlType(i) >= 0)
+            perf_enabled = priv->monitor &&
+                           def->perf.events[i] == VIR_TRISTATE_BOOL_YES;
         else
             perf_enabled = virPerfEventIsEnabled(priv->perf, i);
 
@@ -10465,7 +10997,7 @@ qemuDomainSetSchedulerParametersFlags(virDomainPtr dom,
         }
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (eventNparams) {
@@ -11278,7 +11810,7 @@ qemuDomainSetInterfaceParameters(virDomainPtr dom,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -11429,6 +11961,27 @@ qemuDomainGetInterfaceParameters(virDomainPtr dom,
     return ret;
 }
 
+/* Appends the RSS of the domain process to the @nstats entries in @stats */
+static int
+qemuDomainMemoryStatsAddRSS(virDomainObjPtr vm,
+                            virDomainMemoryStatPtr stats,
+                            int nstats)
+{
+    long rss;
+
+    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("cannot get RSS for domain"));
+    } else {
+        stats[nstats].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
+        stats[nstats].val = rss;
+        nstats++;
+    }
+
+    return nstats;
+}
+
+
 /* This functions assumes that job QEMU_JOB_QUERY is started by a caller */
 static int
 qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
@@ -11438,7 +11991,6 @@ qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
 
 {
     int ret = -1;
-    long rss;
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
@@ -11448,28 +12000,31 @@ qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
 
     if (vm->def->memballoon &&
         vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO) {
-        qemuDomainObjEnterMonitor(driver, vm);
-        ret = qemuMonitorGetMemoryStats(qemuDomainGetMonitor(vm),
-                                        vm->def->memballoon, stats, nr_stats);
-        if (qemuDomainObjExitMonitor(driver, vm) < 0)
-            ret = -1;
+        if ((ret = qemuDomainMemoryStatsCacheGet(vm, stats, nr_stats)) < 0) {
+            virDomainMemoryStatStruct all[VIR_DOMAIN_MEMORY_STAT_NR];
 
-        if (ret < 0 || ret >= nr_stats)
+            qemuDomainObjEnterMonitor(driver, vm);
+            ret = qemuMonitorGetMemoryStats(qemuDomainGetMonitor(vm),
+                                            vm->def->memballoon, all,
+                                            VIR_DOMAIN_MEMORY_STAT_NR);
+            if (qemuDomainObjExitMonitor(driver, vm) < 0)
+                ret = -1;
+
+            if (ret < 0)
+                return ret;
+
+            qemuDomainMemoryStatsCacheStore(vm, all, ret);
+            ret = MIN(ret, nr_stats);
+            memcpy(stats, all, ret * sizeof(*stats));
+        }
+
+        if (ret >= nr_stats)
             return ret;
     } else {
         ret = 0;
     }
 
-    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
-        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
-                       _("cannot get RSS for domain"));
-    } else {
-        stats[ret].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
-        stats[ret].val = rss;
-        ret++;
-    }
-
-    return ret;
+    return qemuDomainMemoryStatsAddRSS(vm, stats, ret);
 }
 
 static int
@@ -11480,6 +12035,9 @@ qemuDomainMemoryStats(virDomainPtr dom,
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    qemuMonitorCompletionPtr completion = NULL;
+    virDomainMemoryStatStruct all[VIR_DOMAIN_MEMORY_STAT_NR];
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -11490,14 +12048,59 @@ qemuDomainMemoryStats(virDomainPtr dom,
     if (virDomainMemoryStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
+    /* Stats cached since the guest last reported them need neither a job
+     * nor a round trip to QEMU */
+    if (virDomainObjIsActive(vm) &&
+        vm->def->memballoon &&
+        vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO &&
+        (ret = qemuDomainMemoryStatsCacheGet(vm, stats, nr_stats)) >= 0) {
+        if (ret < nr_stats)
+            ret = qemuDomainMemoryStatsAddRSS(vm, stats, ret);
+        goto cleanup;
+    }
+
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
         goto cleanup;
 
-    ret = qemuDomainMemoryStatsInternal(driver, vm, stats, nr_stats);
+    priv = vm->privateData;
+
+    if (!priv->monJSON ||
+        !virDomainObjIsActive(vm) ||
+        !vm->def->memballoon ||
+        vm->def->memballoon->model != VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO) {
+        ret = qemuDomainMemoryStatsInternal(driver, vm, stats, nr_stats);
+        qemuDomainObjEndJob(driver, vm);
+        goto cleanup;
+    }
 
+    /* The job is not held while waiting for the guest stats, which need
+     * QEMU's main loop and may take a while on a busy host */
+    qemuDomainObjEnterMonitor(driver, vm);
+    completion = qemuMonitorGetMemoryStatsStart(priv->mon,
+                                                vm->def->memballoon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !completion) {
+        qemuDomainObjEndJob(driver, vm);
+        goto cleanup;
+    }
     qemuDomainObjEndJob(driver, vm);
 
+    if (qemuDomainObjWaitMonitorCompletion(vm, completion) < 0 ||
+        (ret = qemuMonitorGetMemoryStatsFinish(completion, all,
+                                               ARRAY_CARDINALITY(all))) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virDomainObjIsActive(vm))
+        qemuDomainMemoryStatsCacheStore(vm, all, ret);
+    ret = MIN(ret, nr_stats);
+    memcpy(stats, all, ret * sizeof(*stats));
+
+    if (ret < nr_stats && virDomainObjIsActive(vm))
+        ret = qemuDomainMemoryStatsAddRSS(vm, stats, ret);
+
  cleanup:
+    virObjectUnref(completion);
     virDomainObjEndAPI(&vm);
     return ret;
 }
@@ -11562,6 +12165,94 @@ qemuDomainBlockPeek(virDomainPtr dom,
     return ret;
 }
 
+/**
+ * qemuDomainMemoryPeekOpenFifo:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @cfg: driver configuration data
+ * @size: number of bytes to be peeked
+ * @fd: filled with the read end of the FIFO
+ *
+ * QEMU only saves memory into a named file, so rather than a temporary
+ * file for every peek, a FIFO is created for the domain once and opened
+ * for reading before QEMU is asked to save into it. QEMU writes the whole
+ * range before replying, so this only works if the pipe buffer can hold
+ * @size bytes; otherwise @fd is left at -1 and the caller has to fall
+ * back to a temporary file.
+ *
+ * Returns 0 on success (even if the FIFO can't be used), -1 on error.
+ */
+#ifdef F_SETPIPE_SZ
+static int
+qemuDomainMemoryPeekOpenFifo(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             virQEMUDriverConfigPtr cfg,
+                             size_t size,
+                             int *fd)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *path = NULL;
+    struct stat sb;
+    int ret = -1;
+
+    *fd = -1;
+
+    if (!priv->memPeekFifo) {
+        if (virAsprintf(&path, "%s/qemu.mem.%s.fifo",
+                        cfg->cacheDir, vm->def->name) < 0)
+            goto cleanup;
+
+        /* A FIFO left behind by a previous daemon can be reused */
+        if (mkfifo(path, S_IRUSR | S_IWUSR) < 0 &&
+            (errno != EEXIST ||
+             lstat(path, &sb) < 0 || !S_ISFIFO(sb.st_mode))) {
+            virReportSystemError(errno,
+                                 _("failed to create FIFO '%s'"), path);
+            goto cleanup;
+        }
+
+        if (qemuSecuritySetSavedStateLabel(driver->securityManager,
+                                           vm->def, path) < 0) {
+            unlink(path);
+            goto cleanup;
+        }
+
+        VIR_STEAL_PTR(priv->memPeekFifo, path);
+    }
+
+    /* Opening the read end without blocking makes QEMU's open of the
+     * write end succeed right away */
+    if ((*fd = open(priv->memPeekFifo,
+                    O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        virReportSystemError(errno, _("failed to open FIFO '%s'"),
+                             priv->memPeekFifo);
+        goto cleanup;
+    }
+
+    if (fcntl(*fd, F_GETPIPE_SZ) < size &&
+        (size > INT_MAX || fcntl(*fd, F_SETPIPE_SZ, (int) size) < 0))
+        VIR_FORCE_CLOSE(*fd);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+#else /* !F_SETPIPE_SZ */
+static int
+qemuDomainMemoryPeekOpenFifo(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                             virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                             virQEMUDriverConfigPtr cfg ATTRIBUTE_UNUSED,
+                             size_t size ATTRIBUTE_UNUSED,
+                             int *fd)
+{
+    *fd = -1;
+    return 0;
+}
+#endif /* !F_SETPIPE_SZ */
+
+
 static int
 qemuDomainMemoryPeek(virDomainPtr dom,
                      unsigned long long offset, size_t size,
@@ -11571,7 +12262,9 @@ qemuDomainMemoryPeek(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     char *tmp = NULL;
+    const char *path;
     int fd = -1, ret = -1;
+    ssize_t got;
     qemuDomainObjPrivatePtr priv;
     virQEMUDriverConfigPtr cfg = NULL;
 
@@ -11600,27 +12293,36 @@ qemuDomainMemoryPeek(virDomainPtr dom,
         goto endjob;
     }
 
-    if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", cfg->cacheDir) < 0)
-        goto endjob;
+    priv = vm->privateData;
 
-    /* Create a temporary filename. */
-    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
-        virReportSystemError(errno,
-                             _("mkostemp(\"%s\") failed"), tmp);
+    if (qemuDomainMemoryPeekOpenFifo(driver, vm, cfg, size, &fd) < 0)
         goto endjob;
-    }
 
-    qemuSecuritySetSavedStateLabel(driver->securityManager, vm->def, tmp);
+    if (fd >= 0) {
+        path = priv->memPeekFifo;
+    } else {
+        if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", cfg->cacheDir) < 0)
+            goto endjob;
+
+        /* Create a temporary filename. */
+        if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+            virReportSystemError(errno,
+                                 _("mkostemp(\"%s\") failed"), tmp);
+            goto endjob;
+        }
+
+        qemuSecuritySetSavedStateLabel(driver->securityManager, vm->def, tmp);
+        path = tmp;
+    }
 
-    priv = vm->privateData;
     qemuDomainObjEnterMonitor(driver, vm);
     if (flags == VIR_MEMORY_VIRTUAL) {
-        if (qemuMonitorSaveVirtualMemory(priv->mon, offset, size, tmp) < 0) {
+        if (qemuMonitorSaveVirtualMemory(priv->mon, offset, size, path) < 0) {
             ignore_value(qemuDomainObjExitMonitor(driver, vm));
             goto endjob;
         }
     } else {
-        if (qemuMonitorSavePhysicalMemory(priv->mon, offset, size, tmp) < 0) {
+        if (qemuMonitorSavePhysicalMemory(priv->mon, offset, size, path) < 0) {
             ignore_value(qemuDomainObjExitMonitor(driver, vm));
             goto endjob;
         }
@@ -11629,10 +12331,16 @@ qemuDomainMemoryPeek(virDomainPtr dom,
         goto endjob;
 
     /* Read the memory file into buffer. */
-    if (saferead(fd, buffer, size) == (ssize_t) -1) {
+    if ((got = saferead(fd, buffer, size)) == (ssize_t) -1) {
         virReportSystemError(errno,
-                             _("failed to read temporary file "
-                               "created with template %s"), tmp);
+                             _("failed to read memory saved into %s"), path);
+        goto endjob;
+    }
+
+    if (!tmp && got != size) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("expected %zu bytes of memory, got %zd"),
+                       size, got);
         goto endjob;
     }
 
@@ -11834,7 +12542,10 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     int ret = -1;
     virDomainDiskDefPtr disk;
     virQEMUDriverConfigPtr cfg = NULL;
-    int rc;
+    qemuDomainObjPrivatePtr priv;
+    qemuMonitorCompletionPtr completion = NULL;
+    bool hasJob = true;
+    int rc = 0;
     virHashTablePtr stats = NULL;
     qemuBlockStats *entry;
     char *alias = NULL;
@@ -11845,6 +12556,7 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
         return -1;
 
     cfg = virQEMUDriverGetConfig(driver);
+    priv = vm->privateData;
 
     if (virDomainGetBlockInfoEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
@@ -11886,15 +12598,54 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     }
 
     qemuDomainObjEnterMonitor(driver, vm);
-    rc = qemuMonitorGetAllBlockStatsInfo(qemuDomainGetMonitor(vm),
-                                         &stats, false);
-    if (rc >= 0)
-        rc = qemuMonitorBlockStatsUpdateCapacity(qemuDomainGetMonitor(vm),
-                                                 stats, false);
+    if (priv->monJSON)
+        completion = qemuMonitorGetAllBlockStatsCapacityStart(priv->mon);
+    else
+        rc = qemuMonitorGetAllBlockStatsCapacity(priv->mon, &stats,
+                                                 false, false);
 
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0 ||
+        (priv->monJSON && !completion))
         goto endjob;
 
+    if (completion) {
+        /* Don't block other jobs while QEMU replies. The job is acquired
+         * again before the disk is touched, since it might have been
+         * unplugged or changed in the meantime. */
+        qemuDomainObjEndJob(driver, vm);
+        hasJob = false;
+
+        if (qemuDomainObjWaitMonitorCompletion(vm, completion) < 0 ||
+            qemuMonitorGetAllBlockStatsCapacityFinish(completion, &stats,
+                                                      false, false) < 0)
+            goto cleanup;
+
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+            goto cleanup;
+        hasJob = true;
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                           _("domain is not running"));
+            goto endjob;
+        }
+
+        if (!(disk = virDomainDiskByName(vm->def, path, false))) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid path %s not assigned to domain"), path);
+            goto endjob;
+        }
+
+        VIR_FREE(alias);
+        if (!disk->info.alias ||
+            !(alias = qemuDomainStorageAlias(disk->info.alias, 0))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("missing disk device alias name for %s"),
+                           disk->dst);
+            goto endjob;
+        }
+    }
+
     if (!(entry = virHashLookup(stats, alias))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("failed to gather stats for disk '%s'"), disk->dst);
@@ -11942,10 +12693,12 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     ret = 0;
 
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    if (hasJob)
+        qemuDomainObjEndJob(driver, vm);
  cleanup:
     VIR_FREE(alias);
     virHashFree(stats);
+    virObjectUnref(completion);
     virDomainObjEndAPI(&vm);
     virObjectUnref(cfg);
     return ret;
@@ -12117,6 +12870,7 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
     virDomainDefPtr def = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    qemuMonitorMigrationParamsPtr migParams = NULL;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -12134,6 +12888,9 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
     if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         goto cleanup;
 
+    if (!(migParams = qemuMigrationParams(NULL, 0, flags, true)))
+        goto cleanup;
+
     if (virLockManagerPluginUsesState(driver->lockManager)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Cannot use migrate v2 protocol with lock manager %s"),
@@ -12155,9 +12912,10 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
                                      NULL, 0, NULL, NULL, /* No cookies */
                                      uri_in, uri_out,
                                      &def, origname, NULL, 0, NULL, 0,
-                                     compression, flags);
+                                     compression, migParams, flags);
 
  cleanup:
+    qemuMigrationParamsFree(&migParams);
     VIR_FREE(compression);
     VIR_FREE(origname);
     virDomainDefFree(def);
@@ -12366,6 +13124,7 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
     virDomainDefPtr def = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    qemuMonitorMigrationParamsPtr migParams = NULL;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -12383,6 +13142,9 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
     if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         goto cleanup;
 
+    if (!(migParams = qemuMigrationParams(NULL, 0, flags, true)))
+        goto cleanup;
+
     if (!(def = qemuMigrationPrepareDef(driver, dom_xml, dname, &origname)))
         goto cleanup;
 
@@ -12394,9 +13156,10 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
                                      cookieout, cookieoutlen,
                                      uri_in, uri_out,
                                      &def, origname, NULL, 0, NULL, 0,
-                                     compression, flags);
+                                     compression, migParams, flags);
 
  cleanup:
+    qemuMigrationParamsFree(&migParams);
     VIR_FREE(compression);
     VIR_FREE(origname);
     virDomainDefFree(def);
@@ -12426,6 +13189,7 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
     const char **migrate_disks = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    qemuMonitorMigrationParamsPtr migParams = NULL;
     int ret = -1;
 
     virCheckFlagsGoto(QEMU_MIGRATION_FLAGS, cleanup);
@@ -12459,6 +13223,9 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
     if (!(compression = qemuMigrationCompressionParse(params, nparams, flags)))
         goto cleanup;
 
+    if (!(migParams = qemuMigrationParams(params, nparams, flags, true)))
+        goto cleanup;
+
     if (flags & VIR_MIGRATE_TUNNELLED) {
         /* this is a logical error; we never should have gotten here with
          * VIR_MIGRATE_TUNNELLED set
@@ -12481,9 +13248,10 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
                                      uri_in, uri_out,
                                      &def, origname, listenAddress,
                                      nmigrate_disks, migrate_disks, nbdPort,
-                                     compression, flags);
+                                     compression, migParams, flags);
 
  cleanup:
+    qemuMigrationParamsFree(&migParams);
     VIR_FREE(compression);
     VIR_FREE(migrate_disks);
     VIR_FREE(origname);
@@ -12698,7 +13466,7 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     if (nmigrate_disks < 0)
         goto cleanup;
 
-    if (!(migParams = qemuMigrationParams(params, nparams, flags)))
+    if (!(migParams = qemuMigrationParams(params, nparams, flags, false)))
         goto cleanup;
 
     if (!(compression = qemuMigrationCompressionParse(params, nparams, flags)))
@@ -13147,6 +13915,7 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     bool events = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+    qemuMonitorCompletionPtr completion = NULL;
     int ret = -1;
 
     if (completed) {
@@ -13185,11 +13954,15 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
         jobInfo->status == QEMU_DOMAIN_JOB_STATUS_MIGRATING ||
         jobInfo->status == QEMU_DOMAIN_JOB_STATUS_QEMU_COMPLETED ||
         jobInfo->status == QEMU_DOMAIN_JOB_STATUS_POSTCOPY) {
+        /* Migration events imply JSON monitor, the reply is waited for
+         * after the job is ended */
         if (events &&
-            jobInfo->status != QEMU_DOMAIN_JOB_STATUS_ACTIVE &&
-            qemuMigrationFetchStats(driver, vm, QEMU_ASYNC_JOB_NONE,
-                                    jobInfo, NULL) < 0)
-            goto cleanup;
+            jobInfo->status != QEMU_DOMAIN_JOB_STATUS_ACTIVE) {
+            qemuDomainObjEnterMonitor(driver, vm);
+            completion = qemuMonitorGetMigrationStatsStart(priv->mon);
+            if (qemuDomainObjExitMonitor(driver, vm) < 0 || !completion)
+                goto cleanup;
+        }
 
         if (jobInfo->status == QEMU_DOMAIN_JOB_STATUS_ACTIVE &&
             qemuMigrationFetchMirrorStats(driver, vm, QEMU_ASYNC_JOB_NONE,
@@ -13204,6 +13977,16 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
 
  cleanup:
     qemuDomainObjEndJob(driver, vm);
+
+    if (completion) {
+        if (ret == 0 &&
+            (qemuDomainObjWaitMonitorCompletion(vm, completion) < 0 ||
+             qemuMonitorGetMigrationStatsFinish(completion, &jobInfo->stats,
+                                                NULL) < 0))
+            ret = -1;
+        virObjectUnref(completion);
+    }
+
     return ret;
 }
 
@@ -14716,7 +15499,7 @@ qemuDomainSnapshotCreateDiskActive(virQEMUDriverPtr driver,
     }
 
     if (ret == 0 || !actions) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0 ||
+        if (qemuDomainObjFlushStatus(driver, vm) < 0 ||
             (persist && virDomainSaveConfig(cfg->configDir, driver->caps,
                                             vm->newDef) < 0))
             ret = -1;
@@ -14933,7 +15716,6 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
     bool update_current = true;
     bool redefine = flags & VIR_DOMAIN_SNAPSHOT_CREATE_REDEFINE;
     unsigned int parse_flags = VIR_DOMAIN_SNAPSHOT_PARSE_DISKS;
-    virDomainSnapshotObjPtr other = NULL;
     int align_location = VIR_DOMAIN_SNAPSHOT_LOCATION_INTERNAL;
     bool align_match = true;
     virQEMUDriverConfigPtr cfg = NULL;
@@ -15060,7 +15842,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
 
     if (redefine) {
         if (virDomainSnapshotRedefinePrep(domain, vm, &def, &snap,
-                                          driver->xmlopt,
+                                          caps, driver->xmlopt,
                                           &update_current, flags) < 0)
             goto endjob;
     } else {
@@ -15185,12 +15967,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
         } else {
             if (update_current)
                 vm->current_snapshot = snap;
-            other = virDomainSnapshotFindByName(vm->snapshots,
-                                                snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            virDomainSnapshotSetParent(vm->snapshots, snap);
         }
     } else if (snap) {
         virDomainSnapshotObjListRemove(vm->snapshots, snap);
@@ -15656,6 +16433,9 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
     if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)))
         goto endjob;
 
+    if (virDomainSnapshotDefEnsureDom(snap->def, caps, driver->xmlopt) < 0)
+        goto endjob;
+
     if (!vm->persistent &&
         snap->def->state != VIR_DOMAIN_RUNNING &&
         snap->def->state != VIR_DOMAIN_PAUSED &&
@@ -16566,7 +17346,6 @@ qemuDomainBlockPullCommon(virQEMUDriverPtr driver,
                           unsigned int flags)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     char *device = NULL;
     virDomainDiskDefPtr disk;
     virStorageSourcePtr baseSource = NULL;
@@ -16657,8 +17436,9 @@ qemuDomainBlockPullCommon(virQEMUDriverPtr driver,
         goto endjob;
 
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+    qemuBlockJobInfoInvalidate(vm);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
 
@@ -16666,7 +17446,6 @@ qemuDomainBlockPullCommon(virQEMUDriverPtr driver,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(basePath);
     VIR_FREE(backingPath);
     VIR_FREE(device);
@@ -16683,7 +17462,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     char *device = NULL;
     virDomainDiskDefPtr disk = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool save = false;
     bool pivot = !!(flags & VIR_DOMAIN_BLOCK_JOB_ABORT_PIVOT);
     bool async = !!(flags & VIR_DOMAIN_BLOCK_JOB_ABORT_ASYNC);
@@ -16755,7 +17533,7 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
      * effort to save it now.  But we can ignore failure, since there
      * will be further changes when the event marks completion.  */
     if (save)
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
+        ignore_value(qemuDomainObjSaveStatus(driver, vm));
 
     /* With synchronous block cancel, we must synthesize an event, and
      * we silently ignore the ABORT_ASYNC flag.  With asynchronous
@@ -16782,7 +17560,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(device);
     virDomainObjEndAPI(&vm);
     return ret;
@@ -16838,7 +17615,9 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     virDomainDiskDefPtr disk;
+    qemuDomainDiskPrivatePtr diskPriv;
     int ret = -1;
+    bool job = false;
     qemuMonitorBlockJobInfo rawInfo;
 
     virCheckFlags(VIR_DOMAIN_BLOCK_JOB_INFO_BANDWIDTH_BYTES, -1);
@@ -16849,9 +17628,14 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
     if (virDomainGetBlockJobInfoEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
-        goto cleanup;
+    /* Progress of all block jobs of the domain is fetched at once and
+     * reused for a while, so that tools polling many jobs neither talk
+     * to the monitor on each call nor have to wait for a job.  */
+    if (!qemuBlockJobInfoIsFresh(vm)) {
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+            goto cleanup;
+        job = true;
+    }
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -16867,37 +17651,38 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
                        _("disk %s not found in the domain"), path);
         goto endjob;
     }
+    diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    ret = qemuMonitorGetBlockJobInfo(qemuDomainGetMonitor(vm),
-                                     disk->info.alias, &rawInfo);
-    if (qemuDomainObjExitMonitor(driver, vm) < 0)
-        ret = -1;
-    if (ret <= 0)
+    if (job && qemuBlockJobInfoRefresh(driver, vm, QEMU_ASYNC_JOB_NONE) < 0)
         goto endjob;
 
-    if (qemuBlockJobInfoTranslate(&rawInfo, info, disk,
-                                  flags & VIR_DOMAIN_BLOCK_JOB_INFO_BANDWIDTH_BYTES) < 0) {
-        ret = -1;
+    if (!diskPriv->hasBlockJobInfo) {
+        ret = 0;
         goto endjob;
     }
+    rawInfo = diskPriv->blockJobInfo;
+
+    if (qemuBlockJobInfoTranslate(&rawInfo, info, disk,
+                                  flags & VIR_DOMAIN_BLOCK_JOB_INFO_BANDWIDTH_BYTES) < 0)
+        goto endjob;
+    ret = 1;
 
     /* Snoop block copy operations, so future cancel operations can
      * avoid checking if pivot is safe.  Save the change to XML, but
      * we can ignore failure because it is only an optimization.  We
      * hold the vm lock, so modifying the in-memory representation is
-     * safe, even if we are a query rather than a modify job. */
+     * safe, even if we are a query rather than a modify job or hold
+     * no job at all. */
     if (disk->mirror &&
         rawInfo.ready != 0 &&
         info->cur == info->end && !disk->mirrorState) {
-        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
         disk->mirrorState = VIR_DOMAIN_DISK_MIRROR_STATE_READY;
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
-        virObjectUnref(cfg);
+        ignore_value(qemuDomainObjSaveStatus(driver, vm));
     }
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    if (job)
+        qemuDomainObjEndJob(driver, vm);
 
  cleanup:
     virDomainObjEndAPI(&vm);
@@ -16961,6 +17746,7 @@ qemuDomainBlockJobSetSpeed(virDomainPtr dom,
                                       speed);
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
+    qemuBlockJobInfoInvalidate(vm);
 
  endjob:
     qemuDomainObjEndJob(driver, vm);
@@ -17192,8 +17978,9 @@ qemuDomainBlockCopyCommon(virDomainObjPtr vm,
     mirror = NULL;
     disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+    qemuBlockJobInfoInvalidate(vm);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
 
@@ -17365,6 +18152,229 @@ qemuDomainBlockCopy(virDomainPtr dom, const char *disk, const char *destxml,
 }
 
 
+/* bandwidth in bytes/s.  Caller must lock vm beforehand, and not
+ * access target afterwards.  */
+static int
+qemuDomainBlockBackupCommon(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            const char *path,
+                            virStorageSourcePtr target,
+                            const char *bitmap,
+                            unsigned long long bandwidth,
+                            unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    char *device = NULL;
+    virDomainDiskDefPtr disk = NULL;
+    qemuDomainDiskPrivatePtr diskPriv;
+    virJSONValuePtr actions = NULL;
+    const char *format = NULL;
+    virErrorPtr monitor_error = NULL;
+    bool reuse = !!(flags & VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT);
+    bool incremental = !!(flags & VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL);
+    bool need_unlink = false;
+    int ret = -1;
+
+    if (incremental && !bitmap) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("incremental backup requires a dirty bitmap name"));
+        goto cleanup;
+    }
+
+    if (virStorageSourceIsRelative(target)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("absolute path must be used as block backup target"));
+        goto cleanup;
+    }
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto endjob;
+    }
+
+    if (!(disk = qemuDomainDiskByName(vm->def, path)))
+        goto endjob;
+    diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+
+    if (!(device = qemuAliasFromDisk(disk)))
+        goto endjob;
+
+    if (qemuDomainDiskBlockJobIsActive(disk))
+        goto endjob;
+
+    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCKJOB_ASYNC)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("block backup is not supported with this QEMU binary"));
+        goto endjob;
+    }
+
+    if (bitmap && !incremental &&
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_TRANSACTION)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("creating a dirty bitmap together with a backup "
+                         "is not supported with this QEMU binary"));
+        goto endjob;
+    }
+
+    /* XXX Allow non-file backup destinations */
+    if (!virStorageSourceIsLocalStorage(target)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("non-file destination not supported yet"));
+        goto endjob;
+    }
+
+    if (qemuDomainStorageFileInit(driver, vm, target, NULL) < 0)
+        goto endjob;
+
+    if (qemuDomainBlockCopyValidateMirror(target, disk->dst, &reuse) < 0)
+        goto endjob;
+
+    if (!target->format) {
+        if (!(flags & VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT))
+            target->format = disk->src->format;
+        else
+            target->format = virStorageFileProbeFormat(target->path, cfg->user,
+                                                       cfg->group);
+    }
+
+    if (!reuse) {
+        if (virStorageFileCreate(target) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to create backup target"));
+            goto endjob;
+        }
+
+        need_unlink = true;
+    }
+
+    if (target->format > 0)
+        format = virStorageFileFormatTypeToString(target->format);
+
+    if (virStorageSourceInitChainElement(target, disk->src, false) < 0)
+        goto endjob;
+
+    if (qemuDomainDiskChainElementPrepare(driver, vm, target, false) < 0) {
+        qemuDomainDiskChainElementRevoke(driver, vm, target);
+        goto endjob;
+    }
+
+    /* A new bitmap has to start tracking writes at exactly the point in
+     * time the full backup is taken, so both go in one transaction.  */
+    if (bitmap && !incremental && !(actions = virJSONValueNewArray())) {
+        qemuDomainDiskChainElementRevoke(driver, vm, target);
+        goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    if (actions) {
+        bool persistent = disk->src->format == VIR_STORAGE_FILE_QCOW2;
+
+        if ((ret = qemuMonitorAddBitmap(priv->mon, actions, device,
+                                        bitmap, persistent)) == 0 &&
+            (ret = qemuMonitorDriveBackup(priv->mon, actions, device,
+                                          target->path, format, NULL,
+                                          bandwidth, reuse)) == 0)
+            ret = qemuMonitorTransaction(priv->mon, actions);
+    } else {
+        ret = qemuMonitorDriveBackup(priv->mon, NULL, device, target->path,
+                                     format, incremental ? bitmap : NULL,
+                                     bandwidth, reuse);
+    }
+    virDomainAuditDisk(vm, NULL, target, "backup", ret >= 0);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+    if (ret < 0) {
+        monitor_error = virSaveLastError();
+        qemuDomainDiskChainElementRevoke(driver, vm, target);
+        goto endjob;
+    }
+
+    /* The guest keeps using its own disk; only remember the target so
+     * that its labels can be dropped once the job ends.  */
+    need_unlink = false;
+    virStorageFileDeinit(target);
+    diskPriv->backupTarget = target;
+    target = NULL;
+    diskPriv->blockjob = true;
+    qemuBlockJobInfoInvalidate(vm);
+
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
+        VIR_WARN("Unable to save status on vm %s after state change",
+                 vm->def->name);
+
+ endjob:
+    if (need_unlink && virStorageFileUnlink(target) < 0)
+        VIR_WARN("%s", _("unable to remove just-created backup target"));
+    virStorageFileDeinit(target);
+    qemuDomainObjEndJob(driver, vm);
+    if (monitor_error) {
+        virSetError(monitor_error);
+        virFreeError(monitor_error);
+    }
+
+ cleanup:
+    virJSONValueFree(actions);
+    VIR_FREE(device);
+    virObjectUnref(cfg);
+    virStorageSourceFree(target);
+    return ret;
+}
+
+
+static int
+qemuDomainBlockBackup(virDomainPtr dom, const char *disk, const char *destxml,
+                      virTypedParameterPtr params, int nparams,
+                      unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    int ret = -1;
+    unsigned long long bandwidth = 0;
+    const char *bitmap = NULL;
+    virStorageSourcePtr dest = NULL;
+
+    virCheckFlags(VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT |
+                  VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL, -1);
+    if (virTypedParamsValidate(params, nparams,
+                               VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                               VIR_TYPED_PARAM_ULLONG,
+                               VIR_DOMAIN_BLOCK_BACKUP_BITMAP,
+                               VIR_TYPED_PARAM_STRING,
+                               NULL) < 0)
+        return -1;
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return -1;
+
+    if (virDomainBlockBackupEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (virTypedParamsGetULLong(params, nparams,
+                                VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                                &bandwidth) < 0 ||
+        virTypedParamsGetString(params, nparams,
+                                VIR_DOMAIN_BLOCK_BACKUP_BITMAP,
+                                &bitmap) < 0)
+        goto cleanup;
+
+    if (!(dest = virDomainDiskDefSourceParse(destxml, vm->def, driver->xmlopt,
+                                             VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+        goto cleanup;
+
+    ret = qemuDomainBlockBackupCommon(driver, vm, disk, dest, bitmap,
+                                      bandwidth, flags);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
 static int
 qemuDomainBlockPull(virDomainPtr dom, const char *path, unsigned long bandwidth,
                     unsigned int flags)
@@ -17394,7 +18404,6 @@ qemuDomainBlockCommit(virDomainPtr dom,
                       unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    virQEMUDriverConfigPtr cfg = NULL;
     qemuDomainObjPrivatePtr priv;
     virDomainObjPtr vm = NULL;
     char *device = NULL;
@@ -17421,7 +18430,6 @@ qemuDomainBlockCommit(virDomainPtr dom,
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
     priv = vm->privateData;
-    cfg = virQEMUDriverGetConfig(driver);
 
     if (virDomainBlockCommitEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
@@ -17590,13 +18598,14 @@ qemuDomainBlockCommit(virDomainPtr dom,
 
     if (ret == 0) {
         QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+        qemuBlockJobInfoInvalidate(vm);
         mirror = NULL;
     } else {
         disk->mirror = NULL;
         disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after block job",
                  vm->def->name);
 
@@ -17621,7 +18630,6 @@ qemuDomainBlockCommit(virDomainPtr dom,
     VIR_FREE(basePath);
     VIR_FREE(backingPath);
     VIR_FREE(device);
-    virObjectUnref(cfg);
     virDomainObjEndAPI(&vm);
     return ret;
 }
@@ -18147,8 +19155,7 @@ qemuDomainSetBlockIoTune(virDomainPtr dom,
         if (virDomainDiskSetBlockIOTune(disk, &info) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir,
-                                vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
 
         if (eventNparams) {
@@ -18705,6 +19712,25 @@ qemuConnectListAllDomains(virConnectPtr conn,
     return ret;
 }
 
+static int
+qemuConnectListDomainChanges(virConnectPtr conn,
+                             unsigned long long *cursor,
+                             virDomainPtr **changed,
+                             virDomainPtr **removed,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virConnectListDomainChangesEnsureACL(conn) < 0)
+        return -1;
+
+    return virDomainObjListExportChanges(driver->domains, conn, cursor,
+                                         changed, removed,
+                                         virConnectListDomainChangesCheckACL);
+}
+
 static char *
 qemuDomainQemuAgentCommand(virDomainPtr domain,
                            const char *cmd,
@@ -19326,11 +20352,10 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
-        goto cleanup;
-
-    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
-                                  cfg->firmwares, cfg->nfirmwares) < 0)
+    if (!(domCaps = virQEMUCapsGetDomainCaps(qemuCaps, caps, machine,
+                                             arch, virttype,
+                                             cfg->firmwares,
+                                             cfg->nfirmwares)))
         goto cleanup;
 
     ret = virDomainCapsFormat(domCaps);
@@ -19348,8 +20373,11 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags ATTRIBUTE_UNUSED)
+                        unsigned int privflags ATTRIBUTE_UNUSED,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+
     if (virTypedParamsAddInt(&record->params,
                              &record->nparams,
                              maxparams,
@@ -19364,6 +20392,27 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              dom->state.reason) < 0)
         return -1;
 
+    if (virTypedParamsAddUInt(&record->params,
+                              &record->nparams,
+                              maxparams,
+                              "state.job.queued",
+                              priv->job.nwaiters) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.job.wait.count",
+                                priv->job.waitCount) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.job.wait.time",
+                                priv->job.waitTime) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -19384,7 +20433,8 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
                       virDomainStatsRecordPtr record,
                       int *maxparams,
-                      unsigned int privflags ATTRIBUTE_UNUSED)
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     unsigned long long cpu_time = 0;
@@ -19395,15 +20445,27 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     if (!priv->cgroup)
         return 0;
 
-    err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.time",
-                                        cpu_time) < 0)
+    if (virCgroupGetCpuacctTimes(priv->cgroup,
+                                 &cpu_time, &user_time, &sys_time) < 0) {
+        /* Fall back to what can be read separately */
+        virResetLastError();
+        err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
+        if (!err && virTypedParamsAddULLong(&record->params,
+                                            &record->nparams,
+                                            maxparams,
+                                            "cpu.time",
+                                            cpu_time) < 0)
+            return -1;
+
+        err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
+    } else if (virTypedParamsAddULLong(&record->params,
+                                       &record->nparams,
+                                       maxparams,
+                                       "cpu.time",
+                                       cpu_time) < 0) {
         return -1;
+    }
 
-    err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
     if (!err && virTypedParamsAddULLong(&record->params,
                                         &record->nparams,
                                         maxparams,
@@ -19425,7 +20487,8 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
-                          unsigned int privflags)
+                          unsigned int privflags,
+                          virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
@@ -19496,7 +20559,8 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags)
+                       unsigned int privflags,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -19524,12 +20588,14 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
         goto cleanup;
 
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
-        if (qemuDomainRefreshVcpuHalted(driver, dom,
-                                        QEMU_ASYNC_JOB_NONE) < 0) {
+        int rc = qemuDomainRefreshVcpuHalted(driver, dom, QEMU_ASYNC_JOB_NONE);
+
+        if (rc < 0) {
             /* it's ok to be silent and go ahead, because halted vcpu info
              * wasn't here from the beginning */
             virResetLastError();
-        } else if (VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0) {
+        } else if (rc == 0 &&
+                   VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0) {
             goto cleanup;
         }
     }
@@ -19637,7 +20703,8 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
                             virDomainStatsRecordPtr record,
                             int *maxparams,
-                            unsigned int privflags ATTRIBUTE_UNUSED)
+                            unsigned int privflags ATTRIBUTE_UNUSED,
+                            virHashTablePtr netstats)
 {
     size_t i;
     struct _virDomainInterfaceStats tmp;
@@ -19669,8 +20736,8 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                 continue;
             }
         } else {
-            if (virNetDevTapInterfaceStats(net->ifname, &tmp,
-                                           !virDomainNetTypeSharesHostView(net)) < 0) {
+            if (virNetDevTapInterfaceStatsLookup(netstats, net->ifname, &tmp,
+                                                 !virDomainNetTypeSharesHostView(net)) < 0) {
                 virResetLastError();
                 continue;
             }
@@ -19898,7 +20965,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags)
+                        unsigned int privflags,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -19916,11 +20984,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
         qemuDomainObjEnterMonitor(driver, dom);
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats,
-                                             visitBacking);
-        if (rc >= 0)
-            ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
-                                                             visitBacking));
+        rc = qemuMonitorGetAllBlockStatsCapacity(priv->mon, &stats,
+                                                 visitBacking, true);
 
         if (fetchnodedata)
             nodedata = qemuMonitorQueryNamedBlockNodes(priv->mon);
@@ -19979,18 +21044,117 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
 #undef QEMU_ADD_COUNT_PARAM
 
+/*
+ * Reports the hardware and software perf events of @dom, both as a total
+ * for the whole process and for each vCPU thread.  All events of a task
+ * are read at once, so the values are consistent with each other.
+ */
 static int
-qemuDomainGetStatsPerfOneEvent(virPerfPtr perf,
-                               virPerfEventType type,
+qemuDomainGetStatsPerfCounters(virDomainObjPtr dom,
                                virDomainStatsRecordPtr record,
                                int *maxparams)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    size_t maxvcpus = virDomainDefGetVcpusMax(dom->def);
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    virPerfCounters counters;
+    size_t i;
+    size_t j;
+    int rc;
+
+    if (virPerfReadEvents(priv->perf, &counters) < 0)
+        return -1;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (!virPerfEventIsEnabled(priv->perf, i) || !counters.valid[i])
+            continue;
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.%s",
+                 virPerfEventTypeToString(i));
+
+        if (virTypedParamsAddULLong(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    counters.values[i]) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < maxvcpus; i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(dom->def, i);
+
+        if (!vcpu->online)
+            continue;
+
+        if ((rc = virPerfReadThreadEvents(priv->perf, i, &counters)) < 0)
+            return -1;
+
+        if (rc == 0)
+            continue;
+
+        for (j = 0; j < VIR_PERF_EVENT_LAST; j++) {
+            if (!counters.valid[j])
+                continue;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "perf.vcpu.%zu.%s", i, virPerfEventTypeToString(j));
+
+            if (virTypedParamsAddULLong(&record->params,
+                                        &record->nparams,
+                                        maxparams,
+                                        param_name,
+                                        counters.values[j]) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reports the counter @montype of the resctrl monitoring groups of @dom as
+ * perf event @type, both as a total and for each vCPU.
+ */
+static int
+qemuDomainGetStatsPerfResctrl(virDomainObjPtr dom,
+                              virPerfEventType type,
+                              virResctrlMonitorType montype,
+                              virDomainStatsRecordPtr record,
+                              int *maxparams)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    size_t maxvcpus = virDomainDefGetVcpusMax(dom->def);
     char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
-    uint64_t value = 0;
+    unsigned long long total = 0;
+    unsigned long long value;
+    size_t i;
 
-    if (virPerfReadEvent(perf, type, &value) < 0)
+    if (virResctrlMonitorGetStats(priv->monitor, montype, &total) < 0)
         return -1;
 
+    for (i = 0; i < maxvcpus; i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(dom->def, i);
+        qemuDomainVcpuPrivatePtr vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
+
+        if (!vcpu->online || !vcpupriv->monitor)
+            continue;
+
+        if (virResctrlMonitorGetStats(vcpupriv->monitor, montype, &value) < 0)
+            return -1;
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.vcpu.%zu.%s",
+                 i, virPerfEventTypeToString(type));
+
+        if (virTypedParamsAddULLong(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    value) < 0)
+            return -1;
+
+        total += value;
+    }
+
     snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.%s",
              virPerfEventTypeToString(type));
 
@@ -19998,7 +21162,7 @@ qemuDomainGetStatsPerfOneEvent(virPerfPtr perf,
                                 &record->nparams,
                                 maxparams,
                                 param_name,
-                                value) < 0)
+                                total) < 0)
         return -1;
 
     return 0;
@@ -20009,18 +21173,26 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags ATTRIBUTE_UNUSED)
+                       unsigned int privflags ATTRIBUTE_UNUSED,
+                       virHashTablePtr netstats ATTRIBUTE_UNUSED)
 {
     size_t i;
     qemuDomainObjPrivatePtr priv = dom->privateData;
     int ret = -1;
 
+    if (priv->perf &&
+        qemuDomainGetStatsPerfCounters(dom, record, maxparams) < 0)
+        goto cleanup;
+
     for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
-        if (!virPerfEventIsEnabled(priv->perf, i))
-             continue;
+        int montype = qemuDomainPerfEventResctrlType(i);
 
-        if (qemuDomainGetStatsPerfOneEvent(priv->perf, i,
-                                           record, maxparams) < 0)
+        if (montype < 0 || !priv->monitor ||
+            dom->def->perf.events[i] != VIR_TRISTATE_BOOL_YES)
+            continue;
+
+        if (qemuDomainGetStatsPerfResctrl(dom, i, montype,
+                                          record, maxparams) < 0)
             goto cleanup;
     }
 
@@ -20030,12 +21202,317 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     return ret;
 }
 
+static int
+qemuDomainGetStatsStart(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags ATTRIBUTE_UNUSED,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long total = 0;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    for (i = 0; i < QEMU_DOMAIN_START_PHASE_LAST; i++) {
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "start.%s",
+                 qemuDomainStartPhaseTypeToString(i));
+
+        if (virTypedParamsAddULLong(&record->params,
+                                    &record->nparams,
+                                    maxparams,
+                                    param_name,
+                                    priv->startPhases[i]) < 0)
+            return -1;
+
+        total += priv->startPhases[i];
+    }
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "start.total",
+                                total) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+qemuDomainGetStatsGuestInterfaces(virDomainStatsRecordPtr record,
+                                  int *maxparams,
+                                  qemuAgentGuestInfoPtr info)
+{
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i, j;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "guest.if.count", info->nifaces) < 0)
+        return -1;
+
+    for (i = 0; i < info->nifaces; i++) {
+        virDomainInterfacePtr iface = info->ifaces[i];
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.if.%zu.name", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name, iface->name) < 0)
+            return -1;
+
+        if (iface->hwaddr) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.if.%zu.hwaddr", i);
+            if (virTypedParamsAddString(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        iface->hwaddr) < 0)
+                return -1;
+        }
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.if.%zu.addr.count", i);
+        if (virTypedParamsAddUInt(&record->params, &record->nparams,
+                                  maxparams, param_name, iface->naddrs) < 0)
+            return -1;
+
+        for (j = 0; j < iface->naddrs; j++) {
+            virDomainIPAddressPtr addr = &iface->addrs[j];
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.if.%zu.addr.%zu.type", i, j);
+            if (virTypedParamsAddString(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        addr->type == VIR_IP_ADDR_TYPE_IPV6 ?
+                                        "ipv6" : "ipv4") < 0)
+                return -1;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.if.%zu.addr.%zu.addr", i, j);
+            if (virTypedParamsAddString(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        addr->addr) < 0)
+                return -1;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.if.%zu.addr.%zu.prefix", i, j);
+            if (virTypedParamsAddUInt(&record->params, &record->nparams,
+                                      maxparams, param_name,
+                                      addr->prefix) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsGuestFS(virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          qemuAgentGuestInfoPtr info)
+{
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i, j;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "guest.fs.count", info->nfs) < 0)
+        return -1;
+
+    for (i = 0; i < info->nfs; i++) {
+        virDomainFSInfoPtr fs = info->fs[i];
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.fs.%zu.mountpoint", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name,
+                                    fs->mountpoint) < 0)
+            return -1;
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.fs.%zu.name", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name, fs->name) < 0)
+            return -1;
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.fs.%zu.fstype", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name, fs->fstype) < 0)
+            return -1;
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.fs.%zu.disk.count", i);
+        if (virTypedParamsAddUInt(&record->params, &record->nparams,
+                                  maxparams, param_name, fs->ndevAlias) < 0)
+            return -1;
+
+        for (j = 0; j < fs->ndevAlias; j++) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.fs.%zu.disk.%zu.alias", i, j);
+            if (virTypedParamsAddString(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        fs->devAlias[j]) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsGuestUsers(virDomainStatsRecordPtr record,
+                             int *maxparams,
+                             qemuAgentGuestInfoPtr info)
+{
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "guest.user.count", info->nusers) < 0)
+        return -1;
+
+    for (i = 0; i < info->nusers; i++) {
+        qemuAgentUserInfoPtr user = &info->users[i];
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.user.%zu.name", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name, user->user) < 0)
+            return -1;
+
+        if (user->domain) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "guest.user.%zu.domain", i);
+            if (virTypedParamsAddString(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        user->domain) < 0)
+                return -1;
+        }
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "guest.user.%zu.login-time", i);
+        if (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                    maxparams, param_name,
+                                    user->loginTime) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsGuest(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags,
+                        virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    qemuAgentPtr agent;
+    qemuAgentGuestInfo info;
+    int rc;
+    int ret = -1;
+
+    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom) ||
+        !qemuDomainAgentAvailable(dom, false))
+        return 0;
+
+    agent = qemuDomainObjEnterAgent(dom);
+    rc = qemuAgentGetGuestInfo(agent, dom->def,
+                               QEMU_DOMAIN_STATS_AGENT_TIMEOUT, &info);
+    qemuDomainObjExitAgent(dom, agent);
+
+    /* An unresponsive agent is no reason to fail the other stats */
+    if (rc < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (info.nifaces >= 0 &&
+        qemuDomainGetStatsGuestInterfaces(record, maxparams, &info) < 0)
+        goto cleanup;
+
+    if (info.nfs >= 0 &&
+        qemuDomainGetStatsGuestFS(record, maxparams, &info) < 0)
+        goto cleanup;
+
+    if (info.nusers >= 0 &&
+        qemuDomainGetStatsGuestUsers(record, maxparams, &info) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuAgentGuestInfoClear(&info);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsDirtyRate(virQEMUDriverPtr driver,
+                            virDomainObjPtr dom,
+                            virDomainStatsRecordPtr record,
+                            int *maxparams,
+                            unsigned int privflags,
+                            virHashTablePtr netstats ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorDirtyRateInfo info;
+    unsigned long long written;
+    int rc;
+
+    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom) ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE))
+        return 0;
+
+    qemuDomainObjEnterMonitor(driver, dom);
+    rc = qemuMonitorQueryDirtyRate(priv->mon, &info);
+    if (qemuDomainObjExitMonitor(driver, dom) < 0 || rc < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "dirtyrate.calc_status", info.status) < 0 ||
+        virTypedParamsAddLLong(&record->params, &record->nparams, maxparams,
+                               "dirtyrate.calc_start_time",
+                               info.startTime) < 0 ||
+        virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "dirtyrate.calc_period", info.calcTime) < 0)
+        return -1;
+
+    if (info.status != VIR_DOMAIN_DIRTYRATE_MEASURED)
+        return 0;
+
+    /* QEMU compares sampled pages at the start and the end of the period,
+     * so the rate times the period is the memory written at least once
+     * during it, which cannot exceed what the guest has */
+    written = info.dirtyRate > 0 && info.calcTime > 0 ?
+        info.dirtyRate * info.calcTime * 1024ull : 0;
+    if (written > virDomainDefGetMemoryTotal(dom->def))
+        written = virDomainDefGetMemoryTotal(dom->def);
+
+    if (virTypedParamsAddLLong(&record->params, &record->nparams, maxparams,
+                               "dirtyrate.megabytes_per_second",
+                               info.dirtyRate) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "dirtyrate.working_set", written) < 0)
+        return -1;
+
+    return 0;
+}
+
 typedef int
 (*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
-                          unsigned int flags);
+                          unsigned int flags,
+                          virHashTablePtr netstats);
 
 struct qemuDomainGetStatsWorker {
     qemuDomainGetStatsFunc func;
@@ -20051,6 +21528,9 @@ static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
     { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
     { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
     { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
+    { qemuDomainGetStatsStart, VIR_DOMAIN_STATS_START, false },
+    { qemuDomainGetStatsGuest, VIR_DOMAIN_STATS_GUEST, true },
+    { qemuDomainGetStatsDirtyRate, VIR_DOMAIN_STATS_DIRTYRATE, true },
     { NULL, 0, false }
 };
 
@@ -20066,7 +21546,7 @@ qemuDomainGetStatsCheckSupport(unsigned int *stats,
         supportedstats |= qemuDomainGetStatsWorkers[i].stats;
 
     if (*stats == 0) {
-        *stats = supportedstats;
+        *stats = supportedstats & ~QEMU_DOMAIN_STATS_EXPLICIT;
         return 0;
     }
 
@@ -20083,83 +21563,702 @@ qemuDomainGetStatsCheckSupport(unsigned int *stats,
 }
 
 
-static bool
-qemuDomainGetStatsNeedMonitor(unsigned int stats)
+static bool
+qemuDomainGetStatsNeedMonitor(unsigned int stats)
+{
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].monitor)
+            return true;
+
+    return false;
+}
+
+
+static int
+qemuDomainGetStatsFill(virQEMUDriverPtr driver,
+                       virDomainObjPtr dom,
+                       unsigned int stats,
+                       virDomainStatsRecordPtr record,
+                       unsigned int flags,
+                       virHashTablePtr netstats)
+{
+    int maxparams = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, record,
+                                                  &maxparams, flags,
+                                                  netstats) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record,
+                   unsigned int flags,
+                   virHashTablePtr netstats)
+{
+    virDomainStatsRecordPtr tmp;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    if (qemuDomainGetStatsFill(conn->privateData, dom, stats, tmp, flags,
+                               netstats) < 0)
+        goto cleanup;
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+                                  dom->def->uuid, dom->def->id)))
+        goto cleanup;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+
+    return ret;
+}
+
+
+/*
+ * Collecting statistics of many domains is split across the threads of
+ * the driver's statsPool. Each domain gets a slot which is filled by
+ * whoever gets to it first: a pool thread, or the thread calling
+ * qemuConnectGetAllDomainStats once it finds a slot no pool thread has
+ * started yet. Slots of domains which take too long are abandoned; their
+ * pool thread drops the result once it's done.
+ */
+typedef struct _qemuDomainStatsCollection qemuDomainStatsCollection;
+typedef qemuDomainStatsCollection *qemuDomainStatsCollectionPtr;
+
+typedef struct _qemuDomainStatsSlot qemuDomainStatsSlot;
+typedef qemuDomainStatsSlot *qemuDomainStatsSlotPtr;
+struct _qemuDomainStatsSlot {
+    qemuDomainStatsCollectionPtr collection;
+    virDomainObjPtr vm;
+
+    unsigned long long started; /* 0 until somebody collects the stats */
+    bool done;
+    int ret;
+    virDomainStatsRecordPtr record;
+    virErrorPtr error;
+};
+
+struct _qemuDomainStatsCollection {
+    virObjectLockable parent;
+
+    virCond cond;
+
+    virConnectPtr conn;
+    unsigned int stats;
+    unsigned int privflags;
+    bool backing;
+    virHashTablePtr netstats; /* host interface stats, read-only */
+
+    qemuDomainStatsSlotPtr slots;
+    size_t nslots;
+};
+
+static virClassPtr qemuDomainStatsCollectionClass;
+
+static void qemuDomainStatsCollectionDispose(void *obj);
+
+static int
+qemuDomainStatsCollectionOnceInit(void)
+{
+    if (!(qemuDomainStatsCollectionClass =
+          virClassNew(virClassForObjectLockable(),
+                      "qemuDomainStatsCollection",
+                      sizeof(qemuDomainStatsCollection),
+                      qemuDomainStatsCollectionDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuDomainStatsCollection)
+
+
+static void
+qemuDomainStatsRecordFree(virDomainStatsRecordPtr record)
+{
+    if (!record)
+        return;
+
+    virObjectUnref(record->dom);
+    virTypedParamsFree(record->params, record->nparams);
+    VIR_FREE(record);
+}
+
+
+static void
+qemuDomainStatsCollectionDispose(void *obj)
+{
+    qemuDomainStatsCollectionPtr collection = obj;
+    size_t i;
+
+    for (i = 0; i < collection->nslots; i++) {
+        virObjectUnref(collection->slots[i].vm);
+        qemuDomainStatsRecordFree(collection->slots[i].record);
+        virFreeError(collection->slots[i].error);
+    }
+    VIR_FREE(collection->slots);
+
+    virHashFree(collection->netstats);
+    virObjectUnref(collection->conn);
+    virCondDestroy(&collection->cond);
+}
+
+
+static qemuDomainStatsCollectionPtr
+qemuDomainStatsCollectionNew(virConnectPtr conn,
+                             virDomainObjPtr *vms,
+                             size_t nvms,
+                             unsigned int stats,
+                             unsigned int privflags,
+                             bool backing)
+{
+    qemuDomainStatsCollectionPtr collection;
+    size_t i;
+
+    if (qemuDomainStatsCollectionInitialize() < 0)
+        return NULL;
+
+    if (!(collection = virObjectLockableNew(qemuDomainStatsCollectionClass)))
+        return NULL;
+
+    if (virCondInit(&collection->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virObjectUnref(collection);
+        return NULL;
+    }
+
+    if (nvms && VIR_ALLOC_N(collection->slots, nvms) < 0) {
+        virObjectUnref(collection);
+        return NULL;
+    }
+    collection->nslots = nvms;
+
+    for (i = 0; i < nvms; i++) {
+        collection->slots[i].collection = collection;
+        collection->slots[i].vm = virObjectRef(vms[i]);
+    }
+
+    collection->conn = virObjectRef(conn);
+    collection->stats = stats;
+    collection->privflags = privflags;
+    collection->backing = backing;
+
+    /* One snapshot of the host interfaces serves all the domains; it's
+     * only an optimization so failing to get it is not fatal */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(collection->netstats = virNetDevTapInterfaceStatsAll()))
+        virResetLastError();
+
+    return collection;
+}
+
+
+static int
+qemuDomainGetStatsOne(virQEMUDriverPtr driver,
+                      virConnectPtr conn,
+                      virDomainObjPtr vm,
+                      unsigned int stats,
+                      unsigned int privflags,
+                      bool backing,
+                      virHashTablePtr netstats,
+                      virDomainStatsRecordPtr *record)
+{
+    unsigned int domflags = 0;
+    int ret;
+
+    virObjectLock(vm);
+
+    if (HAVE_JOB(privflags) &&
+        qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
+        domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    /* else: without a job it's still possible to gather some data */
+
+    if (backing)
+        domflags |= QEMU_DOMAIN_STATS_BACKING;
+
+    ret = qemuDomainGetStats(conn, vm, stats, record, domflags, netstats);
+
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+/*
+ * Fills @slot of @collection, which must have been claimed by setting
+ * its start time. Called with @collection unlocked.
+ */
+static void
+qemuDomainStatsSlotCollect(virQEMUDriverPtr driver,
+                           qemuDomainStatsCollectionPtr collection,
+                           qemuDomainStatsSlotPtr slot,
+                           unsigned int privflags)
+{
+    virDomainStatsRecordPtr record = NULL;
+    virErrorPtr error = NULL;
+    int rc;
+
+    rc = qemuDomainGetStatsOne(driver, collection->conn, slot->vm,
+                               collection->stats, privflags,
+                               collection->backing, collection->netstats,
+                               &record);
+    if (rc < 0)
+        error = virSaveLastError();
+
+    virObjectLock(collection);
+    qemuDomainStatsRecordFree(slot->record);
+    virFreeError(slot->error);
+    slot->record = record;
+    slot->error = error;
+    slot->ret = rc;
+    slot->done = true;
+    virCondBroadcast(&collection->cond);
+    virObjectUnlock(collection);
+}
+
+
+static void
+qemuDomainGetStatsWorkerFunc(void *data,
+                             void *opaque)
+{
+    qemuDomainStatsSlotPtr slot = data;
+    qemuDomainStatsCollectionPtr collection = slot->collection;
+    virQEMUDriverPtr driver = opaque;
+    bool claimed = false;
+
+    virObjectLock(collection);
+    if (!slot->started) {
+        /* the start time is used for the timeout only */
+        if (virTimeMillisNow(&slot->started) < 0)
+            slot->started = 1;
+        claimed = true;
+    }
+    virObjectUnlock(collection);
+
+    if (claimed)
+        qemuDomainStatsSlotCollect(driver, collection, slot,
+                                   collection->privflags);
+
+    virResetLastError();
+    virObjectUnref(collection);
+}
+
+
+/*
+ * Waits for @slot of @collection to be filled, collecting it in this
+ * thread if no pool thread started it yet. Returns 0 once the slot is
+ * done, 1 if it timed out and -1 on error. Called with @collection
+ * locked.
+ */
+static int
+qemuDomainStatsSlotWait(virQEMUDriverPtr driver,
+                        qemuDomainStatsCollectionPtr collection,
+                        qemuDomainStatsSlotPtr slot)
+{
+    unsigned long long now;
+
+    while (!slot->done) {
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+
+        if (!slot->started) {
+            slot->started = now;
+            virObjectUnlock(collection);
+            qemuDomainStatsSlotCollect(driver, collection, slot,
+                                       collection->privflags);
+            virObjectLock(collection);
+            continue;
+        }
+
+        if (now >= slot->started + QEMU_DOMAIN_STATS_TIMEOUT)
+            return 1;
+
+        if (virCondWaitUntil(&collection->cond, &collection->parent.lock,
+                             slot->started + QEMU_DOMAIN_STATS_TIMEOUT) < 0 &&
+            errno != ETIMEDOUT) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for domain statistics"));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Collects statistics of @vms in parallel. On success the records are
+ * stored into @retStats and their count is returned, -1 is returned on
+ * error.
+ */
+static int
+qemuDomainStatsCollect(virQEMUDriverPtr driver,
+                       virConnectPtr conn,
+                       virDomainObjPtr *vms,
+                       size_t nvms,
+                       unsigned int stats,
+                       bool backing,
+                       virDomainStatsRecordPtr **retStats)
+{
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainStatsCollectionPtr collection = NULL;
+    int nstats = 0;
+    size_t i;
+    int rc;
+    int ret = -1;
+    unsigned int privflags = 0;
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+        goto cleanup;
+
+    if (qemuDomainGetStatsNeedMonitor(stats))
+        privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+
+    if (!(collection = qemuDomainStatsCollectionNew(conn, vms, nvms, stats,
+                                                    privflags, backing)))
+        goto cleanup;
+
+    /* Domains the pool can't take are collected by this thread below */
+    for (i = 0; nvms > 1 && i < nvms; i++) {
+        virObjectRef(collection);
+        if (virThreadPoolSendJob(driver->statsPool, 0,
+                                 &collection->slots[i]) < 0) {
+            virObjectUnref(collection);
+            virResetLastError();
+            break;
+        }
+    }
+
+    virObjectLock(collection);
+    for (i = 0; i < nvms; i++) {
+        qemuDomainStatsSlotPtr slot = &collection->slots[i];
+
+        if ((rc = qemuDomainStatsSlotWait(driver, collection, slot)) < 0) {
+            virObjectUnlock(collection);
+            goto cleanup;
+        }
+
+        if (rc > 0) {
+            /* Leave the slot to the pool thread and fill in whatever
+             * can be gathered without entering a job */
+            VIR_WARN("collecting statistics of domain '%s' timed out",
+                     slot->vm->def->name);
+            virObjectUnlock(collection);
+            rc = qemuDomainGetStatsOne(driver, conn, slot->vm, stats,
+                                       privflags & ~QEMU_DOMAIN_STATS_HAVE_JOB,
+                                       backing, collection->netstats,
+                                       &tmpstats[nstats]);
+            virObjectLock(collection);
+
+            if (rc < 0) {
+                virObjectUnlock(collection);
+                goto cleanup;
+            }
+        } else {
+            if (slot->ret < 0) {
+                if (slot->error)
+                    virSetError(slot->error);
+                virObjectUnlock(collection);
+                goto cleanup;
+            }
+
+            tmpstats[nstats] = slot->record;
+            slot->record = NULL;
+        }
+
+        if (tmpstats[nstats])
+            nstats++;
+    }
+    virObjectUnlock(collection);
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+ cleanup:
+    virObjectUnref(collection);
+    virDomainStatsRecordListFree(tmpstats);
+
+    return ret;
+}
+
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    bool backing = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING);
+    int ret = -1;
+    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+        return -1;
+
+    if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
+        return -1;
+
+    if (ndoms) {
+        if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
+                                    &nvms, virConnectGetAllDomainStatsCheckACL,
+                                    lflags, true) < 0)
+            return -1;
+    } else {
+        if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
+                                    virConnectGetAllDomainStatsCheckACL,
+                                    lflags) < 0)
+            return -1;
+    }
+
+    ret = qemuDomainStatsCollect(driver, conn, vms, nvms, stats, backing,
+                                 retStats);
+
+    virObjectListFreeCount(vms, nvms);
+
+    return ret;
+}
+
+
+/*
+ * Subscriptions to periodic statistics. The timer of each subscription
+ * fires in the event loop which must not talk to the monitor, so it
+ * merely hands the subscription over to the statsStreamPool where the
+ * statistics are collected and passed to the callback. A tick is skipped
+ * if the previous one is still being processed.
+ */
+struct _qemuDomainStatsSubscription {
+    virObjectLockable parent;
+
+    int id;
+    virQEMUDriverPtr driver;
+    virConnectPtr conn;
+    virIdentityPtr identity; /* of the subscriber, for the ACL checks */
+    virDomainObjListACLFilter filter;
+    unsigned int stats;
+    unsigned int flags;
+
+    virConnectDomainStatsCallback cb;
+    void *opaque;
+    virFreeCallback freecb;
+
+    int timer;
+    bool pending; /* a collection is queued or running */
+    bool removed;
+};
+
+static virClassPtr qemuDomainStatsSubscriptionClass;
+
+static void qemuDomainStatsSubscriptionDispose(void *obj);
+
+static int
+qemuDomainStatsSubscriptionOnceInit(void)
+{
+    if (!(qemuDomainStatsSubscriptionClass =
+          virClassNew(virClassForObjectLockable(),
+                      "qemuDomainStatsSubscription",
+                      sizeof(qemuDomainStatsSubscription),
+                      qemuDomainStatsSubscriptionDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuDomainStatsSubscription)
+
+
+static void
+qemuDomainStatsSubscriptionDispose(void *obj)
+{
+    qemuDomainStatsSubscriptionPtr sub = obj;
+
+    if (sub->freecb)
+        (sub->freecb)(sub->opaque);
+
+    virObjectUnref(sub->identity);
+    virObjectUnref(sub->conn);
+}
+
+
+static qemuDomainStatsSubscriptionPtr
+qemuDomainStatsSubscriptionNew(virQEMUDriverPtr driver,
+                               virConnectPtr conn,
+                               virDomainObjListACLFilter filter,
+                               unsigned int stats,
+                               unsigned int flags,
+                               virConnectDomainStatsCallback cb,
+                               void *opaque)
+{
+    qemuDomainStatsSubscriptionPtr sub;
+
+    if (qemuDomainStatsSubscriptionInitialize() < 0)
+        return NULL;
+
+    if (!(sub = virObjectLockableNew(qemuDomainStatsSubscriptionClass)))
+        return NULL;
+
+    if (!(sub->identity = virIdentityGetCurrent())) {
+        virObjectUnref(sub);
+        return NULL;
+    }
+
+    sub->driver = driver;
+    sub->conn = virObjectRef(conn);
+    sub->filter = filter;
+    sub->stats = stats;
+    sub->flags = flags;
+    sub->cb = cb;
+    sub->opaque = opaque;
+    sub->timer = -1;
+
+    return sub;
+}
+
+
+/* Stops @sub from firing again. As the callback runs with @sub locked,
+ * it's guaranteed not to be running anymore once this returns. */
+static void
+qemuDomainStatsSubscriptionRemove(qemuDomainStatsSubscriptionPtr sub)
 {
-    size_t i;
+    int timer;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
-        if (stats & qemuDomainGetStatsWorkers[i].stats &&
-            qemuDomainGetStatsWorkers[i].monitor)
-            return true;
+    virObjectLock(sub);
+    sub->removed = true;
+    timer = sub->timer;
+    sub->timer = -1;
+    virObjectUnlock(sub);
 
-    return false;
+    if (timer >= 0)
+        virEventRemoveTimeout(timer);
 }
 
 
-static int
-qemuDomainGetStats(virConnectPtr conn,
-                   virDomainObjPtr dom,
-                   unsigned int stats,
-                   virDomainStatsRecordPtr *record,
-                   unsigned int flags)
+static void
+qemuDomainStatsStreamWorkerFunc(void *data,
+                                void *opaque)
 {
-    int maxparams = 0;
-    virDomainStatsRecordPtr tmp;
-    size_t i;
-    int ret = -1;
+    qemuDomainStatsSubscriptionPtr sub = data;
+    virQEMUDriverPtr driver = opaque;
+    virIdentityPtr saved = virIdentityGetCurrent();
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    virDomainStatsRecordPtr *records = NULL;
+    int nrecords = -1;
+    unsigned int lflags = sub->flags &
+                          (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                           VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                           VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+    bool backing = !!(sub->flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING);
 
-    if (VIR_ALLOC(tmp) < 0)
+    if (virIdentitySetCurrent(sub->identity) < 0)
         goto cleanup;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
-        if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
-                goto cleanup;
-        }
-    }
-
-    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
-                                  dom->def->uuid, dom->def->id)))
+    if (virDomainObjListCollect(driver->domains, sub->conn, &vms, &nvms,
+                                sub->filter, lflags) < 0)
         goto cleanup;
 
-    *record = tmp;
-    tmp = NULL;
-    ret = 0;
+    nrecords = qemuDomainStatsCollect(driver, sub->conn, vms, nvms,
+                                      sub->stats, backing, &records);
 
  cleanup:
-    if (tmp) {
-        virTypedParamsFree(tmp->params, tmp->nparams);
-        VIR_FREE(tmp);
+    if (nrecords < 0)
+        VIR_WARN("unable to collect statistics for subscription %d: %s",
+                 sub->id, virGetLastErrorMessage());
+
+    virObjectLock(sub);
+    if (nrecords >= 0 && !sub->removed)
+        (sub->cb)(sub->conn, records, nrecords, sub->opaque);
+    sub->pending = false;
+    virObjectUnlock(sub);
+
+    virIdentitySetCurrent(saved);
+    virObjectUnref(saved);
+    virDomainStatsRecordListFree(records);
+    virObjectListFreeCount(vms, nvms);
+    virResetLastError();
+    virObjectUnref(sub);
+}
+
+
+static void
+qemuDomainStatsStreamTimer(int timer ATTRIBUTE_UNUSED,
+                           void *opaque)
+{
+    qemuDomainStatsSubscriptionPtr sub = opaque;
+
+    virObjectLock(sub);
+    if (sub->removed || sub->pending)
+        goto cleanup;
+
+    sub->pending = true;
+    virObjectRef(sub);
+    if (virThreadPoolSendJob(sub->driver->statsStreamPool, 0, sub) < 0) {
+        VIR_WARN("unable to queue statistics of subscription %d: %s",
+                 sub->id, virGetLastErrorMessage());
+        virResetLastError();
+        sub->pending = false;
+        virObjectUnref(sub);
     }
 
-    return ret;
+ cleanup:
+    virObjectUnlock(sub);
 }
 
 
 static int
-qemuConnectGetAllDomainStats(virConnectPtr conn,
-                             virDomainPtr *doms,
-                             unsigned int ndoms,
-                             unsigned int stats,
-                             virDomainStatsRecordPtr **retStats,
-                             unsigned int flags)
+qemuConnectDomainStatsRegister(virConnectPtr conn,
+                               unsigned int stats,
+                               unsigned int interval,
+                               virConnectDomainStatsCallback cb,
+                               void *opaque,
+                               virFreeCallback freecb,
+                               unsigned int flags)
 {
     virQEMUDriverPtr driver = conn->privateData;
-    virDomainObjPtr *vms = NULL;
-    virDomainObjPtr vm;
-    size_t nvms;
-    virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainStatsSubscriptionPtr sub = NULL;
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
-    int nstats = 0;
-    size_t i;
     int ret = -1;
-    unsigned int privflags = 0;
-    unsigned int domflags = 0;
-    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
-                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
-                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
 
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
@@ -20167,70 +22266,232 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
 
-    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+    if (virConnectDomainStatsRegisterEnsureACL(conn) < 0)
         return -1;
 
     if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
         return -1;
 
-    if (ndoms) {
-        if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
-                                    &nvms, virConnectGetAllDomainStatsCheckACL,
-                                    lflags, true) < 0)
-            return -1;
-    } else {
-        if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
-                                    virConnectGetAllDomainStatsCheckACL,
-                                    lflags) < 0)
-            return -1;
+    if (interval > INT_MAX / 1000) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("statistics interval %u is too long"), interval);
+        return -1;
     }
 
-    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+    if (!(sub = qemuDomainStatsSubscriptionNew(driver, conn,
+                                               virConnectDomainStatsRegisterCheckACL,
+                                               stats, flags, cb, opaque)))
         return -1;
 
-    if (qemuDomainGetStatsNeedMonitor(stats))
-        privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    virMutexLock(&driver->lock);
+    sub->id = driver->nextStatsSubscriptionID++;
 
-    for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
+    virObjectRef(sub);
+    if ((sub->timer = virEventAddTimeout(interval * 1000,
+                                         qemuDomainStatsStreamTimer, sub,
+                                         virObjectFreeCallback)) < 0) {
+        virObjectUnref(sub);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to add statistics timer"));
+        goto cleanup;
+    }
 
-        virObjectLock(vm);
+    if (VIR_APPEND_ELEMENT_COPY(driver->statsSubscriptions,
+                                driver->nstatsSubscriptions, sub) < 0) {
+        qemuDomainStatsSubscriptionRemove(sub);
+        goto cleanup;
+    }
+
+    /* Only now the subscription owns @opaque */
+    sub->freecb = freecb;
+    ret = sub->id;
+    sub = NULL;
+
+ cleanup:
+    virMutexUnlock(&driver->lock);
+    virObjectUnref(sub);
+    return ret;
+}
 
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
-                qemuDomainObjEndJob(driver, vm);
+static int
+qemuConnectDomainStatsDeregister(virConnectPtr conn,
+                                 int callbackID)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    qemuDomainStatsSubscriptionPtr sub = NULL;
+    size_t i;
 
-            virObjectUnlock(vm);
-            goto cleanup;
+    if (virConnectDomainStatsDeregisterEnsureACL(conn) < 0)
+        return -1;
+
+    virMutexLock(&driver->lock);
+    for (i = 0; i < driver->nstatsSubscriptions; i++) {
+        if (driver->statsSubscriptions[i]->id == callbackID &&
+            driver->statsSubscriptions[i]->conn == conn) {
+            sub = driver->statsSubscriptions[i];
+            VIR_DELETE_ELEMENT(driver->statsSubscriptions, i,
+                               driver->nstatsSubscriptions);
+            break;
         }
+    }
+    virMutexUnlock(&driver->lock);
+
+    if (!sub) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("could not find statistics subscription %d"),
+                       callbackID);
+        return -1;
+    }
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
+    qemuDomainStatsSubscriptionRemove(sub);
+    virObjectUnref(sub);
+    return 0;
+}
 
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
 
-        virObjectUnlock(vm);
+/*
+ * With stats_history_interval set in qemu.conf, the statistics of each
+ * running domain are sampled periodically into a ring buffer kept in the
+ * domain's private data which virDomainGetStatsHistory reads from. The
+ * timer merely hands the domains over to the statsHistoryPool so that a
+ * stuck monitor delays the samples of its own domain only.
+ */
+static void
+qemuDomainStatsHistoryWorkerFunc(void *data,
+                                 void *opaque)
+{
+    virDomainObjPtr vm = data;
+    virQEMUDriverPtr driver = opaque;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainStatsRecord record = { 0 };
+    unsigned long long now;
+
+    virObjectLock(vm);
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm))
+        goto endjob;
+
+    if (virTimeMillisNow(&now) < 0 ||
+        qemuDomainGetStatsFill(driver, vm, QEMU_DOMAIN_STATS_HISTORY, &record,
+                               QEMU_DOMAIN_STATS_HAVE_JOB, NULL) < 0)
+        goto endjob;
+
+    if (!priv->statsHistory &&
+        !(priv->statsHistory =
+          qemuDomainStatsHistoryNew(cfg->statsHistoryLength)))
+        goto endjob;
+
+    qemuDomainStatsHistoryAdd(priv->statsHistory, now,
+                              record.params, record.nparams);
+    record.params = NULL;
+    record.nparams = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    if (virGetLastError()) {
+        VIR_WARN("unable to sample statistics of domain '%s': %s",
+                 vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
     }
+    virTypedParamsFree(record.params, record.nparams);
+    priv->statsHistoryPending = false;
+    virDomainObjEndAPI(&vm);
+    virObjectUnref(cfg);
+}
 
-    *retStats = tmpstats;
-    tmpstats = NULL;
 
-    ret = nstats;
+static void
+qemuDomainStatsHistoryTimer(int timer ATTRIBUTE_UNUSED,
+                            void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t i;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms, NULL,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+
+        virObjectLock(vm);
+        if (priv->statsHistoryPending) {
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        priv->statsHistoryPending = true;
+        virObjectRef(vm);
+        if (virThreadPoolSendJob(driver->statsHistoryPool, 0, vm) < 0) {
+            priv->statsHistoryPending = false;
+            virObjectUnref(vm);
+            virObjectUnlock(vm);
+            goto cleanup;
+        }
+        virObjectUnlock(vm);
+    }
 
  cleanup:
-    virDomainStatsRecordListFree(tmpstats);
+    if (virGetLastError()) {
+        VIR_WARN("unable to sample domain statistics: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
     virObjectListFreeCount(vms, nvms);
+}
+
+
+static int
+qemuDomainGetStatsHistory(virDomainPtr dom,
+                          unsigned long long start,
+                          unsigned long long end,
+                          virDomainStatsRecordPtr **samples,
+                          unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return -1;
+
+    if (virDomainGetStatsHistoryEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    cfg = virQEMUDriverGetConfig(driver);
+    if (cfg->statsHistoryInterval == 0) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("statistics history is disabled in qemu.conf"));
+        goto cleanup;
+    }
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto cleanup;
+    }
 
+    priv = vm->privateData;
+    ret = qemuDomainStatsHistoryGet(priv->statsHistory, dom,
+                                    start, end, samples);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    virObjectUnref(cfg);
     return ret;
 }
 
@@ -21069,8 +23330,7 @@ qemuDomainSetLifecycleAction(virDomainPtr dom,
 
         qemuDomainModifyLifecycleAction(def, type, action);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir,
-                                vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -21094,6 +23354,67 @@ qemuDomainSetLifecycleAction(virDomainPtr dom,
 }
 
 
+static int
+qemuDomainStartDirtyRateCalc(virDomainPtr dom,
+                             int seconds,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+    int rc;
+
+    virCheckFlags(0, -1);
+
+    if (seconds < 1 || seconds > QEMU_DOMAIN_DIRTYRATE_CALC_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("seconds must be between 1 and %d"),
+                       QEMU_DOMAIN_DIRTYRATE_CALC_MAX);
+        return -1;
+    }
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return -1;
+
+    if (virDomainStartDirtyRateCalcEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    priv = vm->privateData;
+
+    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("QEMU does not support calculating dirty page rate"));
+        goto cleanup;
+    }
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto endjob;
+    }
+
+    VIR_DEBUG("Calculating dirty rate in next %d seconds", seconds);
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    rc = qemuMonitorStartDirtyRateCalc(priv->mon, seconds);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
 static virHypervisorDriver qemuHypervisorDriver = {
     .name = QEMU_DRIVER_NAME,
     .connectOpen = qemuConnectOpen, /* 0.2.0 */
@@ -21313,6 +23634,14 @@ static virHypervisorDriver qemuHypervisorDriver = {
     .domainSetVcpu = qemuDomainSetVcpu, /* 3.1.0 */
     .domainSetBlockThreshold = qemuDomainSetBlockThreshold, /* 3.2.0 */
     .domainSetLifecycleAction = qemuDomainSetLifecycleAction, /* 3.9.0 */
+    .connectListDomainChanges = qemuConnectListDomainChanges, /* 4.0.0 */
+    .connectDomainStatsRegister = qemuConnectDomainStatsRegister, /* 4.0.0 */
+    .connectDomainStatsDeregister = qemuConnectDomainStatsDeregister, /* 4.0.0 */
+    .domainGetStatsHistory = qemuDomainGetStatsHistory, /* 4.0.0 */
+    .domainGetXMLDescSubtree = qemuDomainGetXMLDescSubtree, /* 4.0.0 */
+    .domainAttachDevices = qemuDomainAttachDevices, /* 4.0.0 */
+    .domainBlockBackup = qemuDomainBlockBackup, /* 4.0.0 */
+    .domainStartDirtyRateCalc = qemuDomainStartDirtyRateCalc, /* 4.0.0 */
 };
 
 
@@ -5378,8 +5378,11 @@ qemuDomainRemoveVcpu(virQEMUDriverPtr driver,
 
     virErrorPreserveLast(&save_error);
 
-    for (i = vcpu; i < vcpu + nvcpus; i++)
+    for (i = vcpu; i < vcpu + nvcpus; i++) {
         ignore_value(virCgroupDelThread(priv->cgroup, VIR_CGROUP_THREAD_VCPU, i));
+        if (priv->perf)
+            virPerfRemoveThread(priv->perf, i);
+    }
 
     virErrorRestore(&save_error);
 
@@ -5454,7 +5457,7 @@ qemuDomainHotplugDelVcpu(virQEMUDriverPtr driver,
 
     qemuDomainVcpuPersistOrder(vm->def);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     ret = 0;
@@ -5530,7 +5533,7 @@ qemuDomainHotplugAddVcpu(virQEMUDriverPtr driver,
 
     qemuDomainVcpuPersistOrder(vm->def);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     ret = 0;
@@ -40,6 +40,7 @@
 #include "qemu_security.h"
 
 #include "domain_audit.h"
+#include "dirname.h"
 #include "virlog.h"
 #include "virerror.h"
 #include "viralloc.h"
@@ -51,6 +52,7 @@
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "virstoragefile.h"
 #include "viruri.h"
 #include "virhook.h"
@@ -723,22 +725,18 @@ qemuMigrationDriveMirrorCancelled(virQEMUDriverPtr driver,
 
 
 /*
- * Returns 0 on success,
+ * Returns 0 when the job is still running and needs to be cancelled,
  *         1 when job is already completed or it failed and failNoJob is false,
- *         -1 on error or when job failed and failNoJob is true.
+ *         -1 when job failed and failNoJob is true.
  */
 static int
-qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
-                                  virDomainObjPtr vm,
-                                  virDomainDiskDefPtr disk,
-                                  bool failNoJob,
-                                  qemuDomainAsyncJob asyncJob)
+qemuMigrationCheckOneDriveMirror(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 virDomainDiskDefPtr disk,
+                                 bool failNoJob,
+                                 qemuDomainAsyncJob asyncJob)
 {
-    qemuDomainObjPrivatePtr priv = vm->privateData;
-    char *diskAlias = NULL;
-    int ret = -1;
     int status;
-    int rv;
 
     status = qemuBlockJobUpdate(driver, vm, asyncJob, disk);
     switch (status) {
@@ -756,22 +754,7 @@ qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
         return 1;
     }
 
-    if (!(diskAlias = qemuAliasFromDisk(disk)))
-        return -1;
-
-    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
-        goto cleanup;
-
-    rv = qemuMonitorBlockJobCancel(priv->mon, diskAlias);
-
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rv < 0)
-        goto cleanup;
-
-    ret = 0;
-
- cleanup:
-    VIR_FREE(diskAlias);
-    return ret;
+    return 0;
 }
 
 
@@ -782,8 +765,9 @@ qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
  * @check: if true report an error when some of the mirrors fails
  *
  * Cancel all drive-mirrors started by qemuMigrationDriveMirror.
- * Any pending block job events for the affected disks will be
- * processed.
+ * All still running jobs are cancelled at once from a single monitor
+ * session and then we wait for all of them to go away. Any pending
+ * block job events for the affected disks will be processed.
  *
  * Returns 0 on success, -1 otherwise.
  */
@@ -794,7 +778,11 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
                                qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virErrorPtr err = NULL;
+    virDomainDiskDefPtr *disks = NULL;
+    size_t ndisks = 0;
+    char *diskAlias = NULL;
     int ret = -1;
     size_t i;
     int rv;
@@ -809,16 +797,49 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
         if (!diskPriv->migrating)
             continue;
 
-        rv = qemuMigrationCancelOneDriveMirror(driver, vm, disk,
-                                               check, asyncJob);
-        if (rv != 0) {
-            if (rv < 0) {
+        rv = qemuMigrationCheckOneDriveMirror(driver, vm, disk,
+                                              check, asyncJob);
+        if (rv == 0) {
+            if (VIR_APPEND_ELEMENT_COPY(disks, ndisks, disk) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        if (rv < 0) {
+            if (!err)
+                err = virSaveLastError();
+            failed = true;
+        }
+        qemuBlockJobSyncEnd(driver, vm, asyncJob, disk);
+        diskPriv->migrating = false;
+    }
+
+    if (ndisks > 0) {
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ndisks; i++) {
+            if (!(diskAlias = qemuAliasFromDisk(disks[i])) ||
+                qemuMonitorBlockJobCancel(priv->mon, diskAlias) < 0) {
                 if (!err)
                     err = virSaveLastError();
                 failed = true;
+            } else {
+                /* cancelled, we will wait for it below */
+                disks[i] = NULL;
             }
-            qemuBlockJobSyncEnd(driver, vm, asyncJob, disk);
-            diskPriv->migrating = false;
+            VIR_FREE(diskAlias);
+        }
+
+        if (qemuDomainObjExitMonitor(driver, vm) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ndisks; i++) {
+            if (!disks[i])
+                continue;
+
+            qemuBlockJobSyncEnd(driver, vm, asyncJob, disks[i]);
+            QEMU_DOMAIN_DISK_PRIVATE(disks[i])->migrating = false;
         }
     }
 
@@ -847,6 +868,7 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
     ret = failed ? -1 : 0;
 
  cleanup:
+    VIR_FREE(disks);
     if (err) {
         virSetError(err);
         virFreeError(err);
@@ -895,8 +917,9 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     char *hoststr = NULL;
     unsigned long long mirror_speed = speed;
     unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
+    virDomainDiskDefPtr failedDisk = NULL;
+    int mon_ret;
     int rv;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Starting drive mirrors for domain %s", vm->def->name);
 
@@ -923,10 +946,16 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     if (*migrate_flags & QEMU_MONITOR_MIGRATE_NON_SHARED_INC)
         mirror_flags |= VIR_DOMAIN_BLOCK_REBASE_SHALLOW;
 
+    /* QEMU doesn't accept drive-mirror within a transaction so we start all
+     * mirrors from a single monitor session instead of entering the monitor
+     * and saving status XML once per disk. */
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto cleanup;
+
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDefPtr disk = vm->def->disks[i];
         qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
-        int mon_ret;
 
         /* check whether disk should be migrated */
         if (!qemuMigrateDisk(disk, nmigrate_disks, migrate_disks))
@@ -935,11 +964,7 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
         if (!(diskAlias = qemuAliasFromDisk(disk)) ||
             (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
                          hoststr, port, diskAlias) < 0))
-            goto cleanup;
-
-        if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
-            goto cleanup;
+            break;
 
         qemuBlockJobSyncBegin(disk);
         /* Force "raw" format for NBD export */
@@ -948,16 +973,24 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
         VIR_FREE(diskAlias);
         VIR_FREE(nbd_dest);
 
-        if (qemuDomainObjExitMonitor(driver, vm) < 0 || mon_ret < 0) {
-            qemuBlockJobSyncEnd(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT, disk);
-            goto cleanup;
+        if (mon_ret < 0) {
+            failedDisk = disk;
+            break;
         }
         diskPriv->migrating = true;
+        qemuBlockJobInfoInvalidate(vm);
+    }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
-            VIR_WARN("Failed to save status on vm %s", vm->def->name);
-            goto cleanup;
-        }
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || i < vm->def->ndisks) {
+        if (failedDisk)
+            qemuBlockJobSyncEnd(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT,
+                                failedDisk);
+        goto cleanup;
+    }
+
+    if (qemuDomainObjFlushStatus(driver, vm) < 0) {
+        VIR_WARN("Failed to save status on vm %s", vm->def->name);
+        goto cleanup;
     }
 
     while ((rv = qemuMigrationDriveMirrorReady(driver, vm,
@@ -992,7 +1025,6 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     ret = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(diskAlias);
     VIR_FREE(nbd_dest);
     VIR_FREE(hoststr);
@@ -1580,6 +1612,167 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
 }
 
 
+#define QEMU_MIGRATION_CONVERGENCE_MAX_DOWNTIME 2000  /* ms */
+#define QEMU_MIGRATION_CONVERGENCE_DOWNTIME 300       /* QEMU's default, ms */
+#define QEMU_MIGRATION_CONVERGENCE_THROTTLE_MAX 50
+
+typedef struct _qemuMigrationConvergence qemuMigrationConvergence;
+typedef qemuMigrationConvergence *qemuMigrationConvergencePtr;
+struct _qemuMigrationConvergence {
+    unsigned long long target;      /* total migration time to aim for, ms */
+    unsigned long long maxDowntime; /* the highest downtime we may set, ms */
+    unsigned long long downtime;    /* downtime currently allowed, ms */
+    int throttleIncrement;          /* current cpu-throttle-increment or 0 */
+    unsigned long long iteration;   /* the last RAM pass we looked at */
+    bool autoConverge;
+    bool postcopy;
+};
+
+
+static void
+qemuMigrationConvergenceInit(qemuMigrationConvergencePtr conv,
+                             qemuMonitorMigrationParamsPtr migParams,
+                             unsigned long flags)
+{
+    memset(conv, 0, sizeof(*conv));
+
+    if (!migParams || !migParams->convergenceTime)
+        return;
+
+    conv->target = migParams->convergenceTime;
+    conv->maxDowntime = migParams->convergenceMaxDowntime;
+    if (!conv->maxDowntime)
+        conv->maxDowntime = QEMU_MIGRATION_CONVERGENCE_MAX_DOWNTIME;
+    conv->downtime = QEMU_MIGRATION_CONVERGENCE_DOWNTIME;
+    if (migParams->downtimeLimit_set)
+        conv->downtime = migParams->downtimeLimit;
+    if (migParams->cpuThrottleIncrement_set)
+        conv->throttleIncrement = migParams->cpuThrottleIncrement;
+    conv->autoConverge = !!(flags & VIR_MIGRATE_AUTO_CONVERGE);
+    conv->postcopy = !!(flags & VIR_MIGRATE_POSTCOPY);
+}
+
+
+/* qemuMigrationConverge:
+ *
+ * Called for every new iteration of RAM transfer reported by QEMU. Using the
+ * current transfer and dirty rates it projects when the migration would
+ * finish and, if it's not going to make it within the requested time, it
+ * takes the next step: raising the allowed downtime, throttling guest CPUs
+ * harder and, as the last resort, switching to post-copy.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuMigrationConverge(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      qemuDomainAsyncJob asyncJob,
+                      qemuMigrationConvergencePtr conv)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJobInfoPtr jobInfo = priv->job.current;
+    qemuMonitorMigrationStatsPtr stats = &jobInfo->stats;
+    qemuMonitorMigrationParams migParams = { 0 };
+    unsigned long long now;
+    unsigned long long elapsed;
+    unsigned long long dirty;
+    unsigned long long needed;
+    unsigned long long downtime;
+    int rc;
+
+    if (stats->ram_iteration == conv->iteration ||
+        jobInfo->status != QEMU_DOMAIN_JOB_STATUS_MIGRATING)
+        return 0;
+    conv->iteration = stats->ram_iteration;
+
+    /* The first pass copies all memory, it says nothing about convergence */
+    if (conv->iteration < 2)
+        return 0;
+
+    /* Without events the stats were just refreshed by
+     * qemuMigrationCheckJobStatus, otherwise we need to ask for them. */
+    if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT) &&
+        qemuMigrationFetchStats(driver, vm, asyncJob, jobInfo, NULL) < 0)
+        return -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (stats->ram_bps == 0)
+        return 0;
+
+    elapsed = now - jobInfo->started;
+    dirty = stats->ram_dirty_rate * stats->ram_page_size;
+
+    /* Downtime needed to send the remaining memory in one go */
+    needed = stats->ram_remaining * 1000 / stats->ram_bps;
+    if (needed <= conv->downtime)
+        return 0;
+
+    /* Still on schedule if we are going to get there in time */
+    if (dirty < stats->ram_bps &&
+        elapsed + stats->ram_remaining * 1000 / (stats->ram_bps - dirty) <=
+        conv->target)
+        return 0;
+
+    VIR_DEBUG("Migration of domain %s is not converging: iteration=%llu "
+              "elapsed=%llu remaining=%llu bps=%llu dirty=%llu downtime=%llu",
+              vm->def->name, conv->iteration, elapsed, stats->ram_remaining,
+              stats->ram_bps, dirty, conv->downtime);
+
+    if (conv->downtime < conv->maxDowntime) {
+        downtime = MIN(needed, conv->maxDowntime);
+        VIR_DEBUG("Raising migration downtime to %llu ms", downtime);
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            return -1;
+        rc = qemuMonitorSetMigrationDowntime(priv->mon, downtime);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+            return -1;
+
+        conv->downtime = downtime;
+        return 0;
+    }
+
+    if (conv->autoConverge &&
+        conv->throttleIncrement < QEMU_MIGRATION_CONVERGENCE_THROTTLE_MAX) {
+        if (conv->throttleIncrement == 0)
+            migParams.cpuThrottleIncrement = 10;
+        else
+            migParams.cpuThrottleIncrement = conv->throttleIncrement * 2;
+        migParams.cpuThrottleIncrement = MIN(migParams.cpuThrottleIncrement,
+                                             QEMU_MIGRATION_CONVERGENCE_THROTTLE_MAX);
+        migParams.cpuThrottleIncrement_set = true;
+        VIR_DEBUG("Raising CPU throttle increment to %d",
+                  migParams.cpuThrottleIncrement);
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            return -1;
+        rc = qemuMonitorSetMigrationParams(priv->mon, &migParams);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+            return -1;
+
+        conv->throttleIncrement = migParams.cpuThrottleIncrement;
+        return 0;
+    }
+
+    /* Only give up on pre-copy once we're out of time */
+    if (conv->postcopy && elapsed >= conv->target) {
+        VIR_DEBUG("Migration did not converge in time, starting post-copy");
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            return -1;
+        rc = qemuMonitorMigrateStartPostCopy(priv->mon);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+            return -1;
+
+        conv->postcopy = false;
+    }
+
+    return 0;
+}
+
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
  * QEMU reports failed migration.
  */
@@ -1588,7 +1781,8 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
                                qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn,
-                               unsigned int flags)
+                               unsigned int flags,
+                               qemuMigrationConvergencePtr conv)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = priv->job.current;
@@ -1602,18 +1796,28 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
         if (rv < 0)
             return rv;
 
+        if (conv && conv->target &&
+            qemuMigrationConverge(driver, vm, asyncJob, conv) < 0) {
+            jobInfo->status = QEMU_DOMAIN_JOB_STATUS_FAILED;
+            return -2;
+        }
+
         if (events) {
             if (virDomainObjWait(vm) < 0) {
                 jobInfo->status = QEMU_DOMAIN_JOB_STATUS_FAILED;
                 return -2;
             }
         } else {
-            /* Poll every 50ms for progress & to allow cancellation */
-            struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
+            /* QEMU won't tell us when migration finishes, poll it every 50ms.
+             * Anything else signalling the domain condition (a cancelled
+             * job, an I/O error, a block job event) ends the wait early. */
+            unsigned long long now;
 
-            virObjectUnlock(vm);
-            nanosleep(&ts, NULL);
-            virObjectLock(vm);
+            if (virTimeMillisNow(&now) < 0 ||
+                virDomainObjWaitUntil(vm, now + 50) < 0) {
+                jobInfo->status = QEMU_DOMAIN_JOB_STATUS_FAILED;
+                return -2;
+            }
         }
     }
 
@@ -1995,6 +2199,13 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (flags & VIR_MIGRATE_PARALLEL && flags & VIR_MIGRATE_TUNNELLED) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration is not supported with tunnelled "
+                         "migration"));
+        goto cleanup;
+    }
+
     if (flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC)) {
         bool has_drive_mirror =  virQEMUCapsGet(priv->qemuCaps,
                                                 QEMU_CAPS_DRIVE_MIRROR);
@@ -2402,7 +2613,8 @@ qemuMigrationSetEmptyTLSParams(virQEMUDriverPtr driver,
 qemuMonitorMigrationParamsPtr
 qemuMigrationParams(virTypedParameterPtr params,
                     int nparams,
-                    unsigned long flags)
+                    unsigned long flags,
+                    bool incoming)
 {
     qemuMonitorMigrationParamsPtr migParams;
 
@@ -2424,11 +2636,41 @@ qemuMigrationParams(virTypedParameterPtr params,
             migParams->VAR ## _set = true; \
     } while (0)
 
-    GET(AUTO_CONVERGE_INITIAL, cpuThrottleInitial);
-    GET(AUTO_CONVERGE_INCREMENT, cpuThrottleIncrement);
+    /* Auto-convergence only throttles the source, the destination doesn't
+     * even get the VIR_MIGRATE_AUTO_CONVERGE flag */
+    if (!incoming) {
+        GET(AUTO_CONVERGE_INITIAL, cpuThrottleInitial);
+        GET(AUTO_CONVERGE_INCREMENT, cpuThrottleIncrement);
+    }
+    GET(PARALLEL_CONNECTIONS, multifdChannels);
 
 #undef GET
 
+    /* The convergence controller only runs on the source as well */
+    if (!incoming) {
+        if (virTypedParamsGetULLong(params, nparams,
+                                    VIR_MIGRATE_PARAM_CONVERGENCE_TIME,
+                                    &migParams->convergenceTime) < 0 ||
+            virTypedParamsGetULLong(params, nparams,
+                                    VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME,
+                                    &migParams->convergenceMaxDowntime) < 0)
+            goto error;
+    }
+
+    if (migParams->convergenceMaxDowntime && !migParams->convergenceTime) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("maximum convergence downtime requires "
+                         "convergence time to be set"));
+        goto error;
+    }
+
+    if (migParams->convergenceTime && !(flags & VIR_MIGRATE_LIVE)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("convergence time can only be set for "
+                         "live migration"));
+        goto error;
+    }
+
     if ((migParams->cpuThrottleInitial_set ||
          migParams->cpuThrottleIncrement_set) &&
         !(flags & VIR_MIGRATE_AUTO_CONVERGE)) {
@@ -2437,6 +2679,20 @@ qemuMigrationParams(virTypedParameterPtr params,
         goto error;
     }
 
+    if (migParams->multifdChannels_set &&
+        !(flags & VIR_MIGRATE_PARALLEL)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("Turn parallel migration on to tune it"));
+        goto error;
+    }
+
+    if (migParams->multifdChannels_set &&
+        migParams->multifdChannels < 1) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("number of parallel connections must be positive"));
+        goto error;
+    }
+
     return migParams;
 
  error:
@@ -2542,6 +2798,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         const char **migrate_disks,
                         int nbdPort,
                         qemuMigrationCompressionPtr compression,
+                        qemuMonitorMigrationParamsPtr migParams,
                         unsigned long flags)
 {
     virDomainObjPtr vm = NULL;
@@ -2563,7 +2820,6 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     int rv;
     char *tlsAlias = NULL;
     char *secAlias = NULL;
-    qemuMonitorMigrationParams migParams = { 0 };
 
     virNWFilterReadLockFilterUpdates();
 
@@ -2607,6 +2863,13 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (flags & VIR_MIGRATE_PARALLEL && flags & VIR_MIGRATE_TUNNELLED) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration is not supported with tunnelled "
+                         "migration"));
+        goto cleanup;
+    }
+
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
@@ -2757,7 +3020,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     }
 
     if (qemuMigrationSetCompression(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN,
-                                    compression, &migParams) < 0)
+                                    compression, migParams) < 0)
         goto stopjob;
 
     /* Migrations using TLS need to add the "tls-creds-x509" object and
@@ -2770,17 +3033,17 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
 
         if (qemuMigrationAddTLSObjects(driver, vm, cfg, true,
                                        QEMU_ASYNC_JOB_MIGRATION_IN,
-                                       &tlsAlias, &secAlias, &migParams) < 0)
+                                       &tlsAlias, &secAlias, migParams) < 0)
             goto stopjob;
 
         /* Force reset of 'tls-hostname', it's a source only parameter */
-        if (VIR_STRDUP(migParams.tlsHostname, "") < 0)
+        if (VIR_STRDUP(migParams->tlsHostname, "") < 0)
             goto stopjob;
 
     } else {
         if (qemuMigrationSetEmptyTLSParams(driver, vm,
                                            QEMU_ASYNC_JOB_MIGRATION_IN,
-                                           &migParams) < 0)
+                                           migParams) < 0)
             goto stopjob;
     }
 
@@ -2800,8 +3063,14 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                                  QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
         goto stopjob;
 
+    if (qemuMigrationSetOption(driver, vm,
+                               QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
+                               flags & VIR_MIGRATE_PARALLEL,
+                               QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
+        goto stopjob;
+
     if (qemuMigrationSetParams(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN,
-                               &migParams) < 0)
+                               migParams) < 0)
         goto stopjob;
 
     if (mig->nbd &&
@@ -2889,7 +3158,6 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         virDomainObjRemoveTransientDef(vm);
         qemuDomainRemoveInactiveJob(driver, vm);
     }
-    qemuMigrationParamsClear(&migParams);
     virDomainObjEndAPI(&vm);
     qemuDomainEventQueue(driver, event);
     qemuMigrationCookieFree(mig);
@@ -2931,7 +3199,8 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
                            unsigned long flags)
 {
     qemuMigrationCompressionPtr compression = NULL;
-    int ret;
+    qemuMonitorMigrationParamsPtr migParams = NULL;
+    int ret = -1;
 
     VIR_DEBUG("driver=%p, dconn=%p, cookiein=%s, cookieinlen=%d, "
               "cookieout=%p, cookieoutlen=%p, st=%p, def=%p, "
@@ -2945,13 +3214,16 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
         return -1;
     }
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
-        return -1;
+    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)) ||
+        !(migParams = qemuMigrationParams(NULL, 0, flags, true)))
+        goto cleanup;
 
     ret = qemuMigrationPrepareAny(driver, dconn, cookiein, cookieinlen,
                                   cookieout, cookieoutlen, def, origname,
                                   st, NULL, 0, false, NULL, 0, NULL, 0,
-                                  compression, flags);
+                                  compression, migParams, flags);
+ cleanup:
+    qemuMigrationParamsFree(&migParams);
     VIR_FREE(compression);
     return ret;
 }
@@ -2996,6 +3268,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                            const char **migrate_disks,
                            int nbdPort,
                            qemuMigrationCompressionPtr compression,
+                           qemuMonitorMigrationParamsPtr migParams,
                            unsigned long flags)
 {
     unsigned short port = 0;
@@ -3119,7 +3392,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                                   NULL, uri ? uri->scheme : "tcp",
                                   port, autoPort, listenAddress,
                                   nmigrate_disks, migrate_disks, nbdPort,
-                                  compression, flags);
+                                  compression, migParams, flags);
  cleanup:
     virURIFree(uri);
     VIR_FREE(hostname);
@@ -3187,7 +3460,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     qemuMigrationCookiePtr mig;
     virObjectEventPtr event;
     int rv = -1;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = NULL;
 
@@ -3277,7 +3549,7 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
 
         qemuMigrationReset(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjFlushStatus(driver, vm) < 0)
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
     }
 
@@ -3286,7 +3558,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     rv = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     return rv;
 }
 
@@ -3371,7 +3642,11 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
+/* Data read from QEMU is sent in packets of the largest stream payload
+ * any peer accepts. A few of them are queued, so that reading from QEMU
+ * overlaps with encoding, encrypting and writing out the previous ones. */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+#define TUNNEL_SEND_BUF_COUNT 4
 
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
@@ -3382,12 +3657,91 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* Queue of buffers filled by the tunnel thread for the send thread */
+    virThread sendThread;
+    bool sending;                  /* send thread is running */
+    virMutex lock;                 /* protects the fields below */
+    virCond cond;
+    char *bufs[TUNNEL_SEND_BUF_COUNT];
+    size_t lens[TUNNEL_SEND_BUF_COUNT];
+    size_t head;                   /* first filled buffer */
+    size_t count;                  /* number of filled buffers */
+    bool done;                     /* no more buffers will be queued */
+    bool aborted;                  /* drop queued buffers */
+    bool sendFailed;
+    virErrorPtr sendErr;
 };
 
+static void qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        char *buf;
+        size_t len;
+        int rc;
+
+        while (data->count == 0 && !data->done && !data->aborted)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+
+        if (data->aborted || data->count == 0)
+            break;
+
+        buf = data->bufs[data->head];
+        len = data->lens[data->head];
+        virMutexUnlock(&data->lock);
+
+        rc = virStreamSend(data->st, buf, len);
+
+        virMutexLock(&data->lock);
+        if (rc < 0) {
+            /* Errors are thread local, hand it over to the tunnel thread */
+            data->sendFailed = true;
+            data->sendErr = virSaveLastError();
+            virResetLastError();
+            virCondBroadcast(&data->cond);
+            break;
+        }
+
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+/* Waits for the send thread to send everything queued (or just to stop
+ * if @drop is true). Returns -1 with the error set if sending failed. */
+static int qemuMigrationIOStopSend(qemuMigrationIOThreadPtr data,
+                                   bool drop)
+{
+    if (!data->sending)
+        return 0;
+
+    virMutexLock(&data->lock);
+    data->done = true;
+    if (drop)
+        data->aborted = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+    data->sending = false;
+
+    if (data->sendFailed) {
+        if (!drop && data->sendErr)
+            virSetError(data->sendErr);
+        return -1;
+    }
+
+    return 0;
+}
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
@@ -3395,8 +3749,13 @@ static void qemuMigrationIOFunc(void *arg)
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
         goto abrt;
+    }
+    data->sending = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -3445,12 +3804,31 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            size_t idx;
+            bool failed;
             int nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            /* Wait for a free buffer. Only this thread queues buffers,
+             * so the slot stays free until we queue it below. */
+            virMutexLock(&data->lock);
+            while (data->count == TUNNEL_SEND_BUF_COUNT && !data->sendFailed)
+                ignore_value(virCondWait(&data->cond, &data->lock));
+            idx = (data->head + data->count) % TUNNEL_SEND_BUF_COUNT;
+            failed = data->sendFailed;
+            virMutexUnlock(&data->lock);
+
+            if (failed) {
+                ignore_value(qemuMigrationIOStopSend(data, false));
+                goto error;
+            }
+
+            nbytes = saferead(data->sock, data->bufs[idx], TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                virMutexLock(&data->lock);
+                data->lens[idx] = nbytes;
+                data->count++;
+                virCondBroadcast(&data->cond);
+                virMutexUnlock(&data->lock);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -3462,11 +3840,13 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    if (qemuMigrationIOStopSend(data, false) < 0)
+        goto error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
     VIR_FORCE_CLOSE(data->sock);
-    VIR_FREE(buffer);
 
     return;
 
@@ -3476,6 +3856,7 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
+    ignore_value(qemuMigrationIOStopSend(data, true));
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -3489,7 +3870,23 @@ static void qemuMigrationIOFunc(void *arg)
     if (!virLastErrorIsSystemErrno(EPIPE))
         virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+}
+
+
+static void
+qemuMigrationIOThreadFree(qemuMigrationIOThreadPtr io)
+{
+    size_t i;
+
+    if (!io)
+        return;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(io->bufs[i]);
+    virFreeError(io->sendErr);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
+    VIR_FREE(io);
 }
 
 
@@ -3499,6 +3896,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
+    size_t i;
 
     if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
         virReportSystemError(errno, "%s",
@@ -3509,6 +3907,25 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        VIR_FREE(io);
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
+        goto error;
+    }
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(io->bufs[i], TUNNEL_SEND_BUF_SIZE) < 0)
+            goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
@@ -3527,7 +3944,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
  error:
     VIR_FORCE_CLOSE(wakeupFD[0]);
     VIR_FORCE_CLOSE(wakeupFD[1]);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return NULL;
 }
 
@@ -3561,7 +3978,7 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
  cleanup:
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return rv;
 }
 
@@ -3658,6 +4075,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     char *tlsAlias = NULL;
     char *secAlias = NULL;
     qemuMigrationIOThreadPtr iothread = NULL;
+    qemuMigrationConvergence conv;
     int fd = -1;
     unsigned long migrate_speed = resource ? resource : priv->migMaxBandwidth;
     virErrorPtr orig_err = NULL;
@@ -3667,6 +4085,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     bool cancel = false;
     unsigned int waitFlags;
     virDomainDefPtr persistDef = NULL;
+    char *persistXML = NULL;
     char *timestamp;
     int rc;
 
@@ -3707,10 +4126,11 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                                                        NULL, NULL)))
                 goto error;
         } else {
+            /* Format the definition right away rather than making a copy
+             * which would only be formatted again into the cookie */
             virDomainDefPtr def = vm->newDef ? vm->newDef : vm->def;
-            if (!(persistDef = qemuDomainDefCopy(driver, def,
-                                                 VIR_DOMAIN_XML_SECURE |
-                                                 VIR_DOMAIN_XML_MIGRATABLE)))
+            if (!(persistXML = qemuMigrationCookieFormatPersistent(driver,
+                                                                   def)))
                 goto error;
         }
     }
@@ -3789,6 +4209,12 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                                QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
         goto error;
 
+    if (qemuMigrationSetOption(driver, vm,
+                               QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
+                               flags & VIR_MIGRATE_PARALLEL,
+                               QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto error;
+
     if (qemuMigrationSetOption(driver, vm,
                                QEMU_MONITOR_MIGRATION_CAPS_RDMA_PIN_ALL,
                                flags & VIR_MIGRATE_RDMA_PIN_ALL,
@@ -3892,9 +4318,11 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     if (flags & VIR_MIGRATE_POSTCOPY)
         waitFlags |= QEMU_MIGRATION_COMPLETED_POSTCOPY;
 
+    qemuMigrationConvergenceInit(&conv, migParams, flags);
+
     rc = qemuMigrationWaitForCompletion(driver, vm,
                                         QEMU_ASYNC_JOB_MIGRATION_OUT,
-                                        dconn, waitFlags);
+                                        dconn, waitFlags, &conv);
     if (rc == -2) {
         goto error;
     } else if (rc == -1) {
@@ -3940,7 +4368,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
 
         rc = qemuMigrationWaitForCompletion(driver, vm,
                                             QEMU_ASYNC_JOB_MIGRATION_OUT,
-                                            dconn, waitFlags);
+                                            dconn, waitFlags, NULL);
         if (rc == -2) {
             goto error;
         } else if (rc == -1) {
@@ -3969,6 +4397,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                    QEMU_MIGRATION_COOKIE_STATS;
 
     if (qemuMigrationCookieAddPersistent(mig, &persistDef) < 0 ||
+        qemuMigrationCookieAddPersistentXML(mig, &persistXML) < 0 ||
         qemuMigrationBakeCookie(mig, driver, vm, cookieout,
                                 cookieoutlen, cookieFlags) < 0) {
         VIR_WARN("Unable to encode migration cookie");
@@ -3982,6 +4411,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     virObjectUnref(cfg);
     VIR_FORCE_CLOSE(fd);
     virDomainDefFree(persistDef);
+    VIR_FREE(persistXML);
     qemuMigrationCookieFree(mig);
 
     if (events)
@@ -4431,6 +4861,12 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
         if (qemuMigrationCompressionDump(compression, &params, &nparams,
                                          &maxparams, &flags) < 0)
             goto cleanup;
+
+        if (migParams->multifdChannels_set &&
+            virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                 migParams->multifdChannels) < 0)
+            goto cleanup;
     }
 
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED)
@@ -5186,6 +5622,7 @@ qemuMigrationPersist(virQEMUDriverPtr driver,
         goto cleanup;
 
     vm->persistent = 1;
+    virDomainObjBumpGeneration(vm);
     oldDef = vm->newDef;
     vm->newDef = qemuMigrationCookieGetPersistent(mig);
 
@@ -5237,7 +5674,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     virErrorPtr orig_err = NULL;
     int cookie_flags = 0;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     unsigned short port;
     unsigned long long timeReceived = 0;
     virObjectEventPtr event;
@@ -5431,7 +5867,7 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     }
 
     if (virDomainObjIsActive(vm) &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainObjFlushStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     /* Guest is successfully running, so cancel previous auto destroy */
@@ -5487,7 +5923,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
         virSetError(orig_err);
         virFreeError(orig_err);
     }
-    virObjectUnref(cfg);
 
     /* Set a special error if Finish is expected to return NULL as a result of
      * successful call with retcode != 0
@@ -5561,6 +5996,10 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         };
 
         cmd = virCommandNewArgs(args);
+        /* zstd can compress on all host CPUs at once which is what makes
+         * compressed save images of large domains bearable */
+        if (STREQ(last_component(prog), "zstd"))
+            virCommandAddArg(cmd, "-T0");
         virCommandSetInputFD(cmd, pipeFD[0]);
         virCommandSetOutputFD(cmd, &fd);
         virCommandSetErrorBuffer(cmd, &errbuf);
@@ -5587,7 +6026,7 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (rc < 0)
         goto cleanup;
 
-    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, 0);
+    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, 0, NULL);
 
     if (rc < 0) {
         if (rc == -2) {
@@ -46,7 +46,8 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
      VIR_MIGRATE_AUTO_CONVERGE | \
      VIR_MIGRATE_RDMA_PIN_ALL | \
      VIR_MIGRATE_POSTCOPY | \
-     VIR_MIGRATE_TLS)
+     VIR_MIGRATE_TLS | \
+     VIR_MIGRATE_PARALLEL)
 
 /* All supported migration parameters and their types. */
 # define QEMU_MIGRATION_PARAMETERS \
@@ -68,6 +69,9 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
     VIR_MIGRATE_PARAM_PERSIST_XML,      VIR_TYPED_PARAM_STRING, \
     VIR_MIGRATE_PARAM_AUTO_CONVERGE_INITIAL,        VIR_TYPED_PARAM_INT, \
     VIR_MIGRATE_PARAM_AUTO_CONVERGE_INCREMENT,      VIR_TYPED_PARAM_INT, \
+    VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,         VIR_TYPED_PARAM_INT, \
+    VIR_MIGRATE_PARAM_CONVERGENCE_TIME,             VIR_TYPED_PARAM_ULLONG, \
+    VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME,     VIR_TYPED_PARAM_ULLONG, \
     NULL
 
 
@@ -131,7 +135,8 @@ qemuMigrationParamsFree(qemuMonitorMigrationParamsPtr *migParams);
 qemuMonitorMigrationParamsPtr
 qemuMigrationParams(virTypedParameterPtr params,
                     int nparams,
-                    unsigned long flags);
+                    unsigned long flags,
+                    bool incoming);
 
 int
 qemuMigrationJobStart(virQEMUDriverPtr driver,
@@ -214,6 +219,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                            const char **migrate_disks,
                            int nbdPort,
                            qemuMigrationCompressionPtr compression,
+                           qemuMonitorMigrationParamsPtr migParams,
                            unsigned long flags);
 
 int
@@ -102,6 +102,7 @@ qemuMigrationCookieFree(qemuMigrationCookiePtr mig)
 
     qemuMigrationCookieGraphicsFree(mig->graphics);
     virDomainDefFree(mig->persistent);
+    VIR_FREE(mig->persistentXML);
     qemuMigrationCookieNetworkFree(mig->network);
     qemuMigrationCookieNBDFree(mig->nbd);
 
@@ -408,6 +409,52 @@ qemuMigrationCookieAddPersistent(qemuMigrationCookiePtr mig,
 }
 
 
+/* Formats @def the way it is stored in a migration cookie. */
+char *
+qemuMigrationCookieFormatPersistent(virQEMUDriverPtr driver,
+                                    virDomainDefPtr def)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAdjustIndent(&buf, 2);
+    if (qemuDomainDefFormatBuf(driver, def,
+                               VIR_DOMAIN_XML_INACTIVE |
+                               VIR_DOMAIN_XML_SECURE |
+                               VIR_DOMAIN_XML_MIGRATABLE,
+                               &buf) < 0 ||
+        virBufferCheckError(&buf) < 0) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Same as qemuMigrationCookieAddPersistent but takes a domain definition
+ * already formatted by qemuMigrationCookieFormatPersistent, which saves us
+ * from copying the definition only to format it again. */
+int
+qemuMigrationCookieAddPersistentXML(qemuMigrationCookiePtr mig,
+                                    char **xml)
+{
+    if (!xml || !*xml)
+        return 0;
+
+    if (mig->flags & QEMU_MIGRATION_COOKIE_PERSISTENT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Migration persistent data already present"));
+        return -1;
+    }
+
+    mig->persistentXML = *xml;
+    *xml = NULL;
+    mig->flags |= QEMU_MIGRATION_COOKIE_PERSISTENT;
+    mig->flagsMandatory |= QEMU_MIGRATION_COOKIE_PERSISTENT;
+    return 0;
+}
+
+
 virDomainDefPtr
 qemuMigrationCookieGetPersistent(qemuMigrationCookiePtr mig)
 {
@@ -751,7 +798,14 @@ qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
     }
 
     if ((mig->flags & QEMU_MIGRATION_COOKIE_PERSISTENT) &&
-        mig->persistent) {
+        mig->persistentXML) {
+        virBuffer xml = VIR_BUFFER_INITIALIZER;
+
+        /* already indented, keep it as is */
+        virBufferAdd(&xml, mig->persistentXML, -1);
+        virBufferAddBuffer(buf, &xml);
+    } else if ((mig->flags & QEMU_MIGRATION_COOKIE_PERSISTENT) &&
+               mig->persistent) {
         if (qemuDomainDefFormatBuf(driver,
                                    mig->persistent,
                                    VIR_DOMAIN_XML_INACTIVE |
@@ -117,6 +117,7 @@ struct _qemuMigrationCookie {
 
     /* If (flags & QEMU_MIGRATION_COOKIE_PERSISTENT) */
     virDomainDefPtr persistent;
+    char *persistentXML; /* already formatted @persistent, source only */
 
     /* If (flags & QEMU_MIGRATION_COOKIE_NETWORK) */
     qemuMigrationCookieNetworkPtr network;
@@ -157,6 +158,14 @@ int
 qemuMigrationCookieAddPersistent(qemuMigrationCookiePtr mig,
                                  virDomainDefPtr *def);
 
+char *
+qemuMigrationCookieFormatPersistent(virQEMUDriverPtr driver,
+                                    virDomainDefPtr def);
+
+int
+qemuMigrationCookieAddPersistentXML(qemuMigrationCookiePtr mig,
+                                    char **xml);
+
 virDomainDefPtr
 qemuMigrationCookieGetPersistent(qemuMigrationCookiePtr mig);
 
@@ -28,6 +28,9 @@
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "qemu_monitor.h"
 #include "qemu_monitor_text.h"
@@ -43,6 +46,8 @@
 #include "virprobe.h"
 #include "virstring.h"
 #include "virtime.h"
+#include "virevent.h"
+#include "dirname.h"
 
 #ifdef WITH_DTRACE_PROBES
 # include "libvirt_qemu_probes.h"
@@ -76,9 +81,11 @@ struct _qemuMonitor {
     qemuMonitorCallbacksPtr cb;
     void *callbackOpaque;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
-    qemuMonitorMessagePtr msg;
+    /* Commands being processed. They are written to the monitor
+     * back-to-back and their replies come back in the same order, so
+     * the first one is waiting for the next reply. */
+    qemuMonitorMessagePtr *msgs;
+    size_t nmsgs;
 
     /* Buffer incoming data ready for Text/QMP monitor
      * code to process & find message boundaries */
@@ -98,6 +105,13 @@ struct _qemuMonitor {
     /* cache of query-command-line-options results */
     virJSONValuePtr options;
 
+    /* Replies to query commands whose results change only on QMP events
+     * or commands sent by us, indexed by command name. The generation is
+     * bumped on every invalidation so that a reply which was in flight
+     * meanwhile is not cached. */
+    virHashTablePtr replyCache;
+    unsigned long long replyCacheGeneration;
+
     /* If found, path to the virtio memballoon driver */
     char *balloonpath;
     bool ballooninit;
@@ -180,7 +194,8 @@ VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
 VIR_ENUM_IMPL(qemuMonitorMigrationCaps,
               QEMU_MONITOR_MIGRATION_CAPS_LAST,
               "xbzrle", "auto-converge", "rdma-pin-all", "events",
-              "postcopy-ram", "compress", "pause-before-switchover")
+              "postcopy-ram", "compress", "pause-before-switchover",
+              "x-multifd")
 
 VIR_ENUM_IMPL(qemuMonitorVMStatus,
               QEMU_MONITOR_VM_STATUS_LAST,
@@ -329,11 +344,89 @@ qemuMonitorDispose(void *obj)
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
     VIR_FREE(mon->buffer);
+    VIR_FREE(mon->msgs);
     virJSONValueFree(mon->options);
+    virHashFree(mon->replyCache);
     VIR_FREE(mon->balloonpath);
 }
 
 
+#ifdef HAVE_SYS_INOTIFY_H
+/* How long to wait for a notification before checking the process
+ * and retrying anyway, in milliseconds */
+# define QEMU_MONITOR_SOCKET_POLL 100
+
+/* Returns an inotify descriptor watching the directory @monitor
+ * is going to be created in, or -1 if that's not possible. */
+static int
+qemuMonitorWatchSocket(const char *monitor)
+{
+    char *dir = NULL;
+    int fd = -1;
+
+    if (!(dir = mdir_name(monitor)))
+        return -1;
+
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+        inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0)
+        VIR_FORCE_CLOSE(fd);
+
+    VIR_FREE(dir);
+    return fd;
+}
+
+
+/* Like virTimeBackOffWait(), but instead of sleeping for increasingly
+ * long periods wake up as soon as something shows up in the socket
+ * directory. The first call never waits so that an already existing
+ * socket is connected to right away. */
+static bool
+qemuMonitorWaitSocket(int watchfd,
+                      virTimeBackOffVar *var,
+                      bool *first)
+{
+    struct pollfd pfd = { .fd = watchfd, .events = POLLIN };
+    unsigned long long now;
+    char buf[1024];
+
+    if (watchfd < 0)
+        return virTimeBackOffWait(var);
+
+    if (*first) {
+        *first = false;
+        return true;
+    }
+
+    if (virTimeMillisNowRaw(&now) < 0 || now > var->limit_t)
+        return false;
+
+    if (poll(&pfd, 1, MIN(var->limit_t - now, QEMU_MONITOR_SOCKET_POLL)) > 0) {
+        while (read(watchfd, buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    return true;
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+static int
+qemuMonitorWatchSocket(const char *monitor ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+
+static bool
+qemuMonitorWaitSocket(int watchfd ATTRIBUTE_UNUSED,
+                      virTimeBackOffVar *var,
+                      bool *first ATTRIBUTE_UNUSED)
+{
+    return virTimeBackOffWait(var);
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
 static int
 qemuMonitorOpenUnix(const char *monitor,
                     pid_t cpid,
@@ -343,6 +436,8 @@ qemuMonitorOpenUnix(const char *monitor,
     int monfd;
     virTimeBackOffVar timebackoff;
     int ret = -1;
+    int watchfd = -1;
+    bool first = true;
 
     if ((monfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
         virReportSystemError(errno,
@@ -360,7 +455,13 @@ qemuMonitorOpenUnix(const char *monitor,
 
     if (virTimeBackOffStart(&timebackoff, 1, timeout * 1000) < 0)
         goto error;
-    while (virTimeBackOffWait(&timebackoff)) {
+
+    /* Rather than polling for the socket with exponential back off,
+     * which sleeps for longer than it takes QEMU to create it, wait
+     * for it to show up whenever possible. */
+    watchfd = qemuMonitorWatchSocket(monitor);
+
+    while (qemuMonitorWaitSocket(watchfd, &timebackoff, &first)) {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
@@ -385,9 +486,11 @@ qemuMonitorOpenUnix(const char *monitor,
         goto error;
     }
 
+    VIR_FORCE_CLOSE(watchfd);
     return monfd;
 
  error:
+    VIR_FORCE_CLOSE(watchfd);
     VIR_FORCE_CLOSE(monfd);
     return -1;
 }
@@ -408,6 +511,58 @@ qemuMonitorOpenPty(const char *monitor)
 }
 
 
+/* Returns the first message which wasn't fully written yet */
+static qemuMonitorMessagePtr
+qemuMonitorTxMessage(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (mon->msgs[i]->txOffset < mon->msgs[i]->txLength)
+            return mon->msgs[i];
+    }
+
+    return NULL;
+}
+
+
+/* Takes the first message off the queue once it's finished, calling
+ * its completion callback if it was submitted by qemuMonitorSubmit.
+ * Returns true if it's a message somebody waits for in qemuMonitorSend. */
+static bool
+qemuMonitorPopMessage(qemuMonitorPtr mon,
+                      virErrorPtr error)
+{
+    qemuMonitorMessagePtr msg = mon->msgs[0];
+
+    ignore_value(VIR_DELETE_ELEMENT(mon->msgs, 0, mon->nmsgs));
+
+    if (msg->txID) {
+        PROBE(QEMU_MONITOR_COMMAND_REPLY,
+              "mon=%p vm=%p id=%s", mon, mon->vm, msg->txID);
+    }
+
+    if (!msg->completion)
+        return true;
+
+    /* @msg may be freed by the callback */
+    msg->completion(mon, msg, error, msg->completionOpaque);
+    return false;
+}
+
+
+/* Marks all messages still waiting for their reply as finished, to be
+ * used when an error occurred on the monitor channel */
+static void
+qemuMonitorFinishMessages(qemuMonitorPtr mon)
+{
+    while (mon->nmsgs) {
+        mon->msgs[0]->finished = true;
+        ignore_value(qemuMonitorPopMessage(mon, &mon->lastError));
+    }
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -416,56 +571,75 @@ static int
 qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
-    qemuMonitorMessagePtr msg = NULL;
+    int used = 0;
+    qemuMonitorMessagePtr msg;
+    bool finished;
+    bool wakeup = false;
 
-    /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    do {
+        msg = NULL;
+        finished = false;
+
+        /* See if there's a message & whether its ready for its reply
+         * ie whether its completed writing all its data */
+        if (mon->nmsgs &&
+            mon->msgs[0]->txOffset == mon->msgs[0]->txLength)
+            msg = mon->msgs[0];
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
-    char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
-    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
-    VIR_FREE(str1);
-    VIR_FREE(str2);
+        char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
+        char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
+        VIR_ERROR(_("Process %d %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, msg, str1, str2);
+        VIR_FREE(str1);
+        VIR_FREE(str2);
 # else
-    VIR_DEBUG("Process %d", (int)mon->bufferOffset);
+        VIR_DEBUG("Process %d", (int)mon->bufferOffset);
 # endif
 #endif
 
-    PROBE(QEMU_MONITOR_IO_PROCESS,
-          "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
+        PROBE(QEMU_MONITOR_IO_PROCESS,
+              "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
 
-    if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
-    else
-        len = qemuMonitorTextIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
+        if (mon->json)
+            len = qemuMonitorJSONIOProcess(mon,
+                                           mon->buffer, mon->bufferOffset,
+                                           msg);
+        else
+            len = qemuMonitorTextIOProcess(mon,
+                                           mon->buffer, mon->bufferOffset,
+                                           msg);
 
-    if (len < 0)
-        return -1;
+        if (len < 0)
+            return -1;
 
-    if (len && mon->waitGreeting)
-        mon->waitGreeting = false;
+        if (len && mon->waitGreeting)
+            mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
-    } else {
-        VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
-    }
+        if (len < mon->bufferOffset) {
+            memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
+            mon->bufferOffset -= len;
+        } else {
+            VIR_FREE(mon->buffer);
+            mon->bufferOffset = mon->bufferLength = 0;
+        }
 #if DEBUG_IO
-    VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
+        VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
 #endif
-    if (msg && msg->finished)
+        used += len;
+
+        /* The rest of the buffer may already hold the reply to the next
+         * command in the queue */
+        if (msg && msg->finished) {
+            finished = true;
+            if (qemuMonitorPopMessage(mon, NULL))
+                wakeup = true;
+        }
+    } while (finished && mon->bufferOffset);
+
+    if (wakeup)
         virCondBroadcast(&mon->notify);
-    return len;
+    return used;
 }
 
 
@@ -518,47 +692,54 @@ qemuMonitorIOWriteWithFD(qemuMonitorPtr mon,
 static int
 qemuMonitorIOWrite(qemuMonitorPtr mon)
 {
+    qemuMonitorMessagePtr msg;
     int done;
+    int total = 0;
     char *buf;
     size_t len;
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
-        return 0;
+    /* Write out as much of the pending messages as the socket takes,
+     * the replies are matched to them in order as they come back */
+    while ((msg = qemuMonitorTxMessage(mon))) {
+        if (msg->txFD != -1 && !mon->hasSendFD) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Monitor does not support sending of file descriptors"));
+            return -1;
+        }
 
-    if (mon->msg->txFD != -1 && !mon->hasSendFD) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Monitor does not support sending of file descriptors"));
-        return -1;
-    }
+        buf = msg->txBuffer + msg->txOffset;
+        len = msg->txLength - msg->txOffset;
+        if (msg->txFD == -1)
+            done = write(mon->fd, buf, len);
+        else
+            done = qemuMonitorIOWriteWithFD(mon, buf, len, msg->txFD);
 
-    buf = mon->msg->txBuffer + mon->msg->txOffset;
-    len = mon->msg->txLength - mon->msg->txOffset;
-    if (mon->msg->txFD == -1)
-        done = write(mon->fd, buf, len);
-    else
-        done = qemuMonitorIOWriteWithFD(mon, buf, len, mon->msg->txFD);
+        PROBE(QEMU_MONITOR_IO_WRITE,
+              "mon=%p buf=%s len=%zu ret=%d errno=%d",
+              mon, buf, len, done, done < 0 ? errno : 0);
 
-    PROBE(QEMU_MONITOR_IO_WRITE,
-          "mon=%p buf=%s len=%zu ret=%d errno=%d",
-          mon, buf, len, done, done < 0 ? errno : 0);
+        if (msg->txFD != -1) {
+            PROBE(QEMU_MONITOR_IO_SEND_FD,
+                  "mon=%p fd=%d ret=%d errno=%d",
+                  mon, msg->txFD, done, done < 0 ? errno : 0);
+        }
 
-    if (mon->msg->txFD != -1) {
-        PROBE(QEMU_MONITOR_IO_SEND_FD,
-              "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, done < 0 ? errno : 0);
-    }
+        if (done < 0) {
+            if (errno == EAGAIN)
+                break;
 
-    if (done < 0) {
-        if (errno == EAGAIN)
-            return 0;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to write to monitor"));
+            return -1;
+        }
+        msg->txOffset += done;
+        total += done;
 
-        virReportSystemError(errno, "%s",
-                             _("Unable to write to monitor"));
-        return -1;
+        if (msg->txOffset < msg->txLength)
+            break;
     }
-    mon->msg->txOffset += done;
-    return done;
+
+    return total;
 }
 
 
@@ -627,8 +808,7 @@ qemuMonitorUpdateWatch(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if ((mon->msg && mon->msg->txOffset < mon->msg->txLength) &&
-            !mon->waitGreeting)
+        if (qemuMonitorTxMessage(mon) && !mon->waitGreeting)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -753,11 +933,11 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
+        /* If IO process resulted in an error & we have messages,
          * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+        if (mon->nmsgs) {
+            qemuMonitorFinishMessages(mon);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -958,14 +1138,22 @@ qemuMonitorOpenFD(virDomainObjPtr vm,
 bool
 qemuMonitorRegister(qemuMonitorPtr mon)
 {
+    int node = qemuDomainGetHomeNode(mon->vm);
+
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE,
-                                        qemuMonitorIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    /* Keyed by domain ID so that monitor and agent I/O of a
+     * domain is dispatched from the same event loop thread, which
+     * runs on the domain's NUMA node if possible so that the buffers
+     * it fills are local to it */
+    if ((mon->watch = virEventAddHandleAffinity(mon->fd,
+                                                VIR_EVENT_HANDLE_HANGUP |
+                                                VIR_EVENT_HANDLE_ERROR |
+                                                VIR_EVENT_HANDLE_READABLE,
+                                                qemuMonitorIO,
+                                                mon,
+                                                virObjectFreeCallback,
+                                                mon->vm->def->id,
+                                                node)) < 0) {
         virObjectUnref(mon);
         return false;
     }
@@ -1003,7 +1191,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
     /* In case another thread is waiting for its monitor command to be
      * processed, we need to wake it up with appropriate error set.
      */
-    if (mon->msg) {
+    if (mon->nmsgs) {
         if (mon->lastError.code == VIR_ERR_OK) {
             virErrorPtr err = virSaveLastError();
 
@@ -1017,8 +1205,8 @@ qemuMonitorClose(qemuMonitorPtr mon)
                 virResetLastError();
             }
         }
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        qemuMonitorFinishMessages(mon);
+        virCondBroadcast(&mon->notify);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -1042,11 +1230,27 @@ qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+/**
+ * qemuMonitorSendBatch:
+ * @mon: monitor object
+ * @msgs: messages to send
+ * @nmsgs: number of messages in @msgs
+ *
+ * Writes all @msgs to the monitor without waiting for the replies in
+ * between and waits until all of them are finished. The replies are
+ * matched to the messages in the order they were sent, which is only
+ * reliable with the JSON monitor.
+ *
+ * Returns 0 on success, -1 on error (including an error detected on the
+ * monitor while the messages were in flight).
+ */
 int
-qemuMonitorSend(qemuMonitorPtr mon,
-                qemuMonitorMessagePtr msg)
+qemuMonitorSendBatch(qemuMonitorPtr mon,
+                     qemuMonitorMessagePtr *msgs,
+                     size_t nmsgs)
 {
     int ret = -1;
+    size_t i;
 
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
@@ -1056,14 +1260,26 @@ qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
-    mon->msg = msg;
-    qemuMonitorUpdateWatch(mon);
+    if (nmsgs > 1 && !mon->json) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("text monitor doesn't support sending "
+                         "multiple commands at once"));
+        return -1;
+    }
 
-    PROBE(QEMU_MONITOR_SEND_MSG,
-          "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+    /* Messages submitted by qemuMonitorSubmit may be queued already */
+    for (i = 0; i < nmsgs; i++) {
+        if (VIR_APPEND_ELEMENT_COPY(mon->msgs, mon->nmsgs, msgs[i]) < 0)
+            goto cleanup;
+
+        PROBE(QEMU_MONITOR_SEND_MSG,
+              "mon=%p msg=%s fd=%d",
+              mon, msgs[i]->txBuffer, msgs[i]->txFD);
+    }
 
-    while (!mon->msg->finished) {
+    qemuMonitorUpdateWatch(mon);
+
+    while (!msgs[nmsgs - 1]->finished) {
         if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to wait on monitor condition"));
@@ -1081,9 +1297,312 @@ qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
  cleanup:
-    mon->msg = NULL;
+    /* Finished messages are taken off the queue already, the rest must
+     * not be left behind */
+    for (i = 0; i < mon->nmsgs; i++) {
+        size_t j;
+
+        for (j = 0; j < nmsgs; j++) {
+            if (mon->msgs[i] == msgs[j])
+                break;
+        }
+
+        if (j < nmsgs)
+            ignore_value(VIR_DELETE_ELEMENT(mon->msgs, i--, mon->nmsgs));
+    }
+    qemuMonitorUpdateWatch(mon);
+
+    return ret;
+}
+
+
+int
+qemuMonitorSend(qemuMonitorPtr mon,
+                qemuMonitorMessagePtr msg)
+{
+    return qemuMonitorSendBatch(mon, &msg, 1);
+}
+
+
+/**
+ * qemuMonitorSubmit:
+ * @mon: monitor object
+ * @msg: message to send
+ *
+ * Queues @msg to be sent to the monitor without waiting for the reply.
+ * Once the reply arrived, or the monitor failed, the completion callback
+ * of @msg is called from the event loop with the monitor locked. @msg
+ * must stay valid until then. The callback is not called if this
+ * function fails.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorSubmit(qemuMonitorPtr mon,
+                  qemuMonitorMessagePtr msg)
+{
+    if (mon->lastError.code != VIR_ERR_OK) {
+        VIR_DEBUG("Attempt to submit command while error is set %s",
+                  NULLSTR(mon->lastError.message));
+        virSetError(&mon->lastError);
+        return -1;
+    }
+
+    if (!mon->json || !msg->completion) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("asynchronous commands are supported only by "
+                         "JSON monitor"));
+        return -1;
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(mon->msgs, mon->nmsgs, msg) < 0)
+        return -1;
+
+    PROBE(QEMU_MONITOR_SEND_MSG,
+          "mon=%p msg=%s fd=%d",
+          mon, msg->txBuffer, msg->txFD);
+
     qemuMonitorUpdateWatch(mon);
+    return 0;
+}
+
+
+struct _qemuMonitorCompletion {
+    virObjectLockable parent;
+
+    virCond cond;
+
+    qemuMonitorMessagePtr msgs;
+    size_t nmsgs;
+    size_t nfinished;
+
+    /* The first error reported for any of @msgs */
+    virError error;
+};
+
+static virClassPtr qemuMonitorCompletionClass;
+static void qemuMonitorCompletionDispose(void *obj);
+
+static int
+qemuMonitorCompletionOnceInit(void)
+{
+    if (!(qemuMonitorCompletionClass = virClassNew(virClassForObjectLockable(),
+                                                   "qemuMonitorCompletion",
+                                                   sizeof(qemuMonitorCompletion),
+                                                   qemuMonitorCompletionDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuMonitorCompletion)
+
+
+static void
+qemuMonitorCompletionDispose(void *obj)
+{
+    qemuMonitorCompletionPtr completion = obj;
+    size_t i;
+
+    for (i = 0; i < completion->nmsgs; i++) {
+        VIR_FREE(completion->msgs[i].txBuffer);
+        VIR_FREE(completion->msgs[i].txID);
+        VIR_FREE(completion->msgs[i].rxBuffer);
+        virJSONValueFree(completion->msgs[i].rxObject);
+    }
+    VIR_FREE(completion->msgs);
+
+    virResetError(&completion->error);
+    virCondDestroy(&completion->cond);
+}
+
+
+/**
+ * qemuMonitorCompletionNew:
+ * @nmsgs: number of messages
+ *
+ * Creates an object tracking @nmsgs messages which are sent to the
+ * monitor asynchronously. The caller formats the messages obtained by
+ * qemuMonitorCompletionGetMessage, queues them by
+ * qemuMonitorCompletionSubmit and collects the replies once
+ * qemuMonitorCompletionWait succeeded. The object may be released at any
+ * time, even while the messages are in flight.
+ */
+qemuMonitorCompletionPtr
+qemuMonitorCompletionNew(size_t nmsgs)
+{
+    qemuMonitorCompletionPtr completion;
+
+    if (qemuMonitorCompletionInitialize() < 0)
+        return NULL;
+
+    if (!(completion = virObjectLockableNew(qemuMonitorCompletionClass)))
+        return NULL;
+
+    if (virCondInit(&completion->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize monitor completion condition"));
+        goto error;
+    }
+
+    if (VIR_ALLOC_N(completion->msgs, nmsgs) < 0)
+        goto error;
+    completion->nmsgs = nmsgs;
+
+    return completion;
+
+ error:
+    virObjectUnref(completion);
+    return NULL;
+}
+
+
+qemuMonitorMessagePtr
+qemuMonitorCompletionGetMessage(qemuMonitorCompletionPtr completion,
+                                size_t idx)
+{
+    if (idx >= completion->nmsgs)
+        return NULL;
+
+    return &completion->msgs[idx];
+}
+
+
+/* Records @error (if any) as the error of @completion */
+static void
+qemuMonitorCompletionSetError(qemuMonitorCompletionPtr completion,
+                              virErrorPtr error)
+{
+    virErrorPtr orig;
+
+    if (!error || completion->error.code != VIR_ERR_OK)
+        return;
+
+    orig = virSaveLastError();
+    virSetError(error);
+    virCopyLastError(&completion->error);
+    if (orig) {
+        virSetError(orig);
+        virFreeError(orig);
+    } else {
+        virResetLastError();
+    }
+}
+
+
+static void
+qemuMonitorCompletionFinished(size_t count,
+                              virErrorPtr error,
+                              void *opaque)
+{
+    qemuMonitorCompletionPtr completion = opaque;
+
+    virObjectLock(completion);
+
+    qemuMonitorCompletionSetError(completion, error);
+
+    completion->nfinished += count;
+    if (completion->nfinished == completion->nmsgs)
+        virCondBroadcast(&completion->cond);
+
+    virObjectUnlock(completion);
+}
+
 
+static void
+qemuMonitorCompletionMessageDone(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                                 qemuMonitorMessagePtr msg ATTRIBUTE_UNUSED,
+                                 virErrorPtr error,
+                                 void *opaque)
+{
+    qemuMonitorCompletionFinished(1, error, opaque);
+    virObjectUnref(opaque);
+}
+
+
+/**
+ * qemuMonitorCompletionSubmit:
+ * @mon: monitor object
+ * @completion: completion object
+ *
+ * Queues all messages of @completion to be sent to @mon. Call this
+ * function while holding the monitor lock.
+ *
+ * Returns 0 on success, -1 on error in which case the messages which
+ * couldn't be queued are considered finished with the error.
+ */
+int
+qemuMonitorCompletionSubmit(qemuMonitorPtr mon,
+                            qemuMonitorCompletionPtr completion)
+{
+    size_t i;
+
+    QEMU_CHECK_MONITOR(mon);
+
+    for (i = 0; i < completion->nmsgs; i++) {
+        qemuMonitorMessagePtr msg = &completion->msgs[i];
+
+        msg->completion = qemuMonitorCompletionMessageDone;
+        msg->completionOpaque = virObjectRef(completion);
+
+        if (qemuMonitorSubmit(mon, msg) < 0) {
+            qemuMonitorCompletionFinished(completion->nmsgs - i,
+                                          virGetLastError(), completion);
+            virObjectUnref(completion);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * qemuMonitorCompletionWait:
+ * @completion: completion object
+ * @timeout: how long to wait in milliseconds
+ *
+ * Waits until all messages of @completion are finished. This must not be
+ * called while holding the monitor lock.
+ *
+ * Returns 0 when all replies arrived, -1 on error or timeout.
+ */
+int
+qemuMonitorCompletionWait(qemuMonitorCompletionPtr completion,
+                          unsigned long long timeout)
+{
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virObjectLock(completion);
+
+    while (completion->nfinished < completion->nmsgs) {
+        if (virCondWaitUntil(&completion->cond, &completion->parent.lock,
+                             now + timeout) < 0) {
+            if (errno == ETIMEDOUT)
+                virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                               _("timed out waiting for reply from "
+                                 "QEMU monitor"));
+            else
+                virReportSystemError(errno, "%s",
+                                     _("Unable to wait on monitor "
+                                       "completion condition"));
+            goto cleanup;
+        }
+    }
+
+    if (completion->error.code != VIR_ERR_OK) {
+        virSetError(&completion->error);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(completion);
     return ret;
 }
 
@@ -1116,6 +1635,84 @@ qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
 }
 
 
+/**
+ * qemuMonitorGetCachedReply:
+ * @mon: monitor object
+ * @cmdname: name of the query command
+ * @generation: filled with the current cache generation
+ *
+ * Returns a copy of the cached reply to @cmdname, or NULL if there is
+ * none. In that case the caller is expected to pass @generation to
+ * qemuMonitorCacheReply along with the reply it got from QEMU.
+ */
+virJSONValuePtr
+qemuMonitorGetCachedReply(qemuMonitorPtr mon,
+                          const char *cmdname,
+                          unsigned long long *generation)
+{
+    virJSONValuePtr reply;
+
+    *generation = mon->replyCacheGeneration;
+
+    if (!mon->replyCache ||
+        !(reply = virHashLookup(mon->replyCache, cmdname)))
+        return NULL;
+
+    VIR_DEBUG("using cached reply to '%s'", cmdname);
+    return virJSONValueCopy(reply);
+}
+
+
+/**
+ * qemuMonitorCacheReply:
+ * @mon: monitor object
+ * @cmdname: name of the query command
+ * @reply: successful reply to @cmdname
+ * @generation: cache generation from before the command was sent
+ *
+ * Stores a copy of @reply unless the cache was invalidated since
+ * @generation was obtained. Failing to cache the reply is not an error.
+ */
+void
+qemuMonitorCacheReply(qemuMonitorPtr mon,
+                      const char *cmdname,
+                      virJSONValuePtr reply,
+                      unsigned long long generation)
+{
+    virJSONValuePtr copy = NULL;
+
+    if (generation != mon->replyCacheGeneration)
+        return;
+
+    if ((!mon->replyCache &&
+         !(mon->replyCache = virHashCreate(5, virJSONValueHashFree))) ||
+        !(copy = virJSONValueCopy(reply)) ||
+        virHashUpdateEntry(mon->replyCache, cmdname, copy) < 0) {
+        virJSONValueFree(copy);
+        virResetLastError();
+    }
+}
+
+
+/**
+ * qemuMonitorInvalidateReplyCache:
+ * @mon: monitor object
+ *
+ * Drops all cached query replies. Called whenever a command or event
+ * might have changed the state they describe.
+ */
+void
+qemuMonitorInvalidateReplyCache(qemuMonitorPtr mon)
+{
+    mon->replyCacheGeneration++;
+
+    if (mon->replyCache && virHashSize(mon->replyCache) > 0) {
+        VIR_DEBUG("mon=%p invalidating cached replies", mon);
+        virHashRemoveAll(mon->replyCache);
+    }
+}
+
+
 /**
  * Search the qom objects for the balloon driver object by its known names
  * of "virtio-balloon-pci" or "virtio-balloon-ccw". The entry for the driver
@@ -1960,6 +2557,7 @@ qemuMonitorGetCPUInfoHotplug(struct qemuMonitorQueryHotpluggableCpusEntry *hotpl
  * @vcpus: pointer filled by array of qemuMonitorCPUInfo structures
  * @maxvcpus: total possible number of vcpus
  * @hotplug: query data relevant for hotplug support
+ * @fast: use QMP query-cpus-fast if supported
  *
  * Detects VCPU information. If qemu doesn't support or fails reporting
  * information this function will return success as other parts of libvirt
@@ -1972,7 +2570,8 @@ int
 qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                       qemuMonitorCPUInfoPtr *vcpus,
                       size_t maxvcpus,
-                      bool hotplug)
+                      bool hotplug,
+                      bool fast)
 {
     struct qemuMonitorQueryHotpluggableCpusEntry *hotplugcpus = NULL;
     size_t nhotplugcpus = 0;
@@ -1998,7 +2597,8 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
         goto cleanup;
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug,
+                                      fast);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
@@ -2034,13 +2634,19 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
 
 /**
  * qemuMonitorGetCpuHalted:
+ * @mon: monitor
+ * @maxvcpus: total possible number of vcpus
+ * @fast: use QMP query-cpus-fast if supported
  *
  * Returns a bitmap of vcpu id's that are halted. The id's correspond to the
- * 'CPU' field as reported by query-cpus'.
+ * 'CPU' field as reported by query-cpus', or 'cpu-index' as reported by
+ * query-cpus-fast. Note that the latter reports the halted state only on
+ * s390.
  */
 virBitmapPtr
 qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
-                        size_t maxvcpus)
+                        size_t maxvcpus,
+                        bool fast)
 {
     struct qemuMonitorQueryCpusEntry *cpuentries = NULL;
     size_t ncpuentries = 0;
@@ -2051,7 +2657,8 @@ qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
     QEMU_CHECK_MONITOR_NULL(mon);
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false,
+                                      fast);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
@@ -2138,6 +2745,40 @@ qemuMonitorGetMemoryStats(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetMemoryStatsStart:
+ * @mon: monitor object
+ * @balloon: balloon device definition
+ *
+ * Asynchronous variant of qemuMonitorGetMemoryStats. Queues the queries
+ * and returns an object to wait for the replies by
+ * qemuMonitorCompletionWait, which are then interpreted by
+ * qemuMonitorGetMemoryStatsFinish. Requires the JSON monitor.
+ *
+ * Returns the completion object or NULL on error.
+ */
+qemuMonitorCompletionPtr
+qemuMonitorGetMemoryStatsStart(qemuMonitorPtr mon,
+                               virDomainMemballoonDefPtr balloon)
+{
+    QEMU_CHECK_MONITOR_JSON_NULL(mon);
+
+    qemuMonitorInitBalloonObjectPath(mon, balloon);
+    return qemuMonitorJSONGetMemoryStatsStart(mon, mon->balloonpath);
+}
+
+
+int
+qemuMonitorGetMemoryStatsFinish(qemuMonitorCompletionPtr completion,
+                                virDomainMemoryStatPtr stats,
+                                unsigned int nr_stats)
+{
+    VIR_DEBUG("completion=%p stats=%p nstats=%u", completion, stats, nr_stats);
+
+    return qemuMonitorJSONGetMemoryStatsFinish(completion, stats, nr_stats);
+}
+
+
 /**
  * qemuMonitorSetMemoryStatsPeriod:
  *
@@ -2322,6 +2963,108 @@ qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetAllBlockStatsCapacity:
+ * @mon: monitor object
+ * @ret_stats: pointer that is filled with a hash table containing the stats
+ * @backingChain: recurse into the backing chain of devices
+ * @capacityOptional: don't fail if the capacity can't be filled in
+ *
+ * Combines qemuMonitorGetAllBlockStatsInfo and
+ * qemuMonitorBlockStatsUpdateCapacity. With the JSON monitor both queries
+ * are sent to QEMU back-to-back rather than waiting for the first reply.
+ *
+ * Returns < 0 on error, count of supported block stats fields on success.
+ */
+int
+qemuMonitorGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                    virHashTablePtr *ret_stats,
+                                    bool backingChain,
+                                    bool capacityOptional)
+{
+    int ret;
+
+    VIR_DEBUG("ret_stats=%p, backing=%d, capacityOptional=%d",
+              ret_stats, backingChain, capacityOptional);
+
+    QEMU_CHECK_MONITOR(mon);
+
+    if (!mon->json) {
+        if ((ret = qemuMonitorGetAllBlockStatsInfo(mon, ret_stats,
+                                                   backingChain)) < 0)
+            return -1;
+
+        if (qemuMonitorBlockStatsUpdateCapacity(mon, *ret_stats,
+                                                backingChain) < 0 &&
+            !capacityOptional)
+            goto error;
+
+        return ret;
+    }
+
+    if (!(*ret_stats = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    if ((ret = qemuMonitorJSONGetAllBlockStatsCapacity(mon, *ret_stats,
+                                                       backingChain,
+                                                       capacityOptional)) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virHashFree(*ret_stats);
+    *ret_stats = NULL;
+    return -1;
+}
+
+
+/**
+ * qemuMonitorGetAllBlockStatsCapacityStart:
+ * @mon: monitor object
+ *
+ * Asynchronous variant of qemuMonitorGetAllBlockStatsCapacity, the
+ * replies are to be interpreted by
+ * qemuMonitorGetAllBlockStatsCapacityFinish once
+ * qemuMonitorCompletionWait succeeded. Requires the JSON monitor.
+ *
+ * Returns the completion object or NULL on error.
+ */
+qemuMonitorCompletionPtr
+qemuMonitorGetAllBlockStatsCapacityStart(qemuMonitorPtr mon)
+{
+    QEMU_CHECK_MONITOR_JSON_NULL(mon);
+
+    return qemuMonitorJSONGetAllBlockStatsCapacityStart(mon);
+}
+
+
+int
+qemuMonitorGetAllBlockStatsCapacityFinish(qemuMonitorCompletionPtr completion,
+                                          virHashTablePtr *ret_stats,
+                                          bool backingChain,
+                                          bool capacityOptional)
+{
+    int ret;
+
+    VIR_DEBUG("ret_stats=%p, backing=%d, capacityOptional=%d",
+              ret_stats, backingChain, capacityOptional);
+
+    if (!(*ret_stats = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    if ((ret = qemuMonitorJSONGetAllBlockStatsCapacityFinish(completion,
+                                                             *ret_stats,
+                                                             backingChain,
+                                                             capacityOptional)) < 0) {
+        virHashFree(*ret_stats);
+        *ret_stats = NULL;
+    }
+
+    return ret;
+}
+
+
 int
 qemuMonitorBlockResize(qemuMonitorPtr mon,
                        const char *device,
@@ -2608,7 +3351,7 @@ qemuMonitorSetMigrationParams(qemuMonitorPtr mon,
               "decompressThreads=%d:%d cpuThrottleInitial=%d:%d "
               "cpuThrottleIncrement=%d:%d tlsCreds=%s tlsHostname=%s "
               "maxBandwidth=%d:%llu downtimeLimit=%d:%llu "
-              "blockIncremental=%d:%d",
+              "blockIncremental=%d:%d multifdChannels=%d:%d",
               params->compressLevel_set, params->compressLevel,
               params->compressThreads_set, params->compressThreads,
               params->decompressThreads_set, params->decompressThreads,
@@ -2617,7 +3360,8 @@ qemuMonitorSetMigrationParams(qemuMonitorPtr mon,
               NULLSTR(params->tlsCreds), NULLSTR(params->tlsHostname),
               params->maxBandwidth_set, params->maxBandwidth,
               params->downtimeLimit_set, params->downtimeLimit,
-              params->blockIncremental_set, params->blockIncremental);
+              params->blockIncremental_set, params->blockIncremental,
+              params->multifdChannels_set, params->multifdChannels);
 
     QEMU_CHECK_MONITOR_JSON(mon);
 
@@ -2642,6 +3386,37 @@ qemuMonitorGetMigrationStats(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetMigrationStatsStart:
+ * @mon: monitor object
+ *
+ * Asynchronous variant of qemuMonitorGetMigrationStats, the reply is to
+ * be interpreted by qemuMonitorGetMigrationStatsFinish once
+ * qemuMonitorCompletionWait succeeded. Requires the JSON monitor.
+ *
+ * Returns the completion object or NULL on error.
+ */
+qemuMonitorCompletionPtr
+qemuMonitorGetMigrationStatsStart(qemuMonitorPtr mon)
+{
+    QEMU_CHECK_MONITOR_JSON_NULL(mon);
+
+    return qemuMonitorJSONGetMigrationStatsStart(mon);
+}
+
+
+int
+qemuMonitorGetMigrationStatsFinish(qemuMonitorCompletionPtr completion,
+                                   qemuMonitorMigrationStatsPtr stats,
+                                   char **error)
+{
+    if (error)
+        *error = NULL;
+
+    return qemuMonitorJSONGetMigrationStatsFinish(completion, stats, error);
+}
+
+
 int
 qemuMonitorMigrateToFd(qemuMonitorPtr mon,
                        unsigned int flags,
@@ -3340,6 +4115,42 @@ qemuMonitorDriveMirror(qemuMonitorPtr mon,
 }
 
 
+/* Start a drive-backup block job copying device to target.  If bitmap
+ * is given only the clusters it marks as dirty are copied; otherwise the
+ * whole disk is.  bandwidth is in bytes/sec.  */
+int
+qemuMonitorDriveBackup(qemuMonitorPtr mon, virJSONValuePtr actions,
+                       const char *device, const char *target,
+                       const char *format, const char *bitmap,
+                       unsigned long long bandwidth, bool reuse)
+{
+    VIR_DEBUG("actions=%p, device=%s, target=%s, format=%s, bitmap=%s, "
+              "bandwidth=%llu, reuse=%d",
+              actions, device, target, NULLSTR(format), NULLSTR(bitmap),
+              bandwidth, reuse);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONDriveBackup(mon, actions, device, target, format,
+                                      bitmap, bandwidth, reuse);
+}
+
+
+/* Create a dirty bitmap named bitmap tracking writes to node.  */
+int
+qemuMonitorAddBitmap(qemuMonitorPtr mon, virJSONValuePtr actions,
+                     const char *node, const char *bitmap,
+                     bool persistent)
+{
+    VIR_DEBUG("actions=%p, node=%s, bitmap=%s, persistent=%d",
+              actions, node, bitmap, persistent);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONAddBitmap(mon, actions, node, bitmap, persistent);
+}
+
+
 /* Use the transaction QMP command to run atomic snapshot commands.  */
 int
 qemuMonitorTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
@@ -4347,3 +5158,27 @@ qemuMonitorSetWatchdogAction(qemuMonitorPtr mon,
 
     return qemuMonitorJSONSetWatchdogAction(mon, action);
 }
+
+
+int
+qemuMonitorStartDirtyRateCalc(qemuMonitorPtr mon,
+                              int seconds)
+{
+    VIR_DEBUG("seconds=%d", seconds);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONStartDirtyRateCalc(mon, seconds);
+}
+
+
+int
+qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                          qemuMonitorDirtyRateInfoPtr info)
+{
+    VIR_DEBUG("info=%p", info);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONQueryDirtyRate(mon, info);
+}
@@ -48,9 +48,22 @@ typedef int (*qemuMonitorPasswordHandler)(qemuMonitorPtr mon,
                                           size_t len,
                                           void *opaque);
 
+/* @error is set if the monitor failed before the reply arrived */
+typedef void (*qemuMonitorCompletionCallback)(qemuMonitorPtr mon,
+                                              qemuMonitorMessagePtr msg,
+                                              virErrorPtr error,
+                                              void *opaque);
+
+typedef struct _qemuMonitorCompletion qemuMonitorCompletion;
+typedef qemuMonitorCompletion *qemuMonitorCompletionPtr;
+
 struct _qemuMonitorMessage {
     int txFD;
 
+    /* Used by the JSON monitor to check that the reply belongs to the
+     * command, as several of them may be in flight */
+    char *txID;
+
     char *txBuffer;
     int txOffset;
     int txLength;
@@ -60,6 +73,9 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* Set by the JSON monitor to get the reply as text in rxBuffer
+     * instead of a parsed rxObject */
+    bool rxRaw;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -68,6 +84,10 @@ struct _qemuMonitorMessage {
 
     qemuMonitorPasswordHandler passwordHandler;
     void *passwordOpaque;
+
+    /* Set for messages queued by qemuMonitorSubmit */
+    qemuMonitorCompletionCallback completion;
+    void *completionOpaque;
 };
 
 typedef enum {
@@ -312,14 +332,41 @@ int qemuMonitorSetLink(qemuMonitorPtr mon,
                        virDomainNetInterfaceLinkState state)
     ATTRIBUTE_NONNULL(2);
 
+qemuMonitorCompletionPtr qemuMonitorCompletionNew(size_t nmsgs);
+int qemuMonitorCompletionSubmit(qemuMonitorPtr mon,
+                                qemuMonitorCompletionPtr completion)
+    ATTRIBUTE_NONNULL(2);
+int qemuMonitorCompletionWait(qemuMonitorCompletionPtr completion,
+                              unsigned long long timeout)
+    ATTRIBUTE_NONNULL(1);
+
 /* These APIs are for use by the internal Text/JSON monitor impl code only */
 char *qemuMonitorNextCommandID(qemuMonitorPtr mon);
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg);
+int qemuMonitorSendBatch(qemuMonitorPtr mon,
+                         qemuMonitorMessagePtr *msgs,
+                         size_t nmsgs);
+int qemuMonitorSubmit(qemuMonitorPtr mon,
+                      qemuMonitorMessagePtr msg);
+qemuMonitorMessagePtr
+qemuMonitorCompletionGetMessage(qemuMonitorCompletionPtr completion,
+                                size_t idx);
 virJSONValuePtr qemuMonitorGetOptions(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 void qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
     ATTRIBUTE_NONNULL(1);
+virJSONValuePtr qemuMonitorGetCachedReply(qemuMonitorPtr mon,
+                                          const char *cmdname,
+                                          unsigned long long *generation)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+void qemuMonitorCacheReply(qemuMonitorPtr mon,
+                           const char *cmdname,
+                           virJSONValuePtr reply,
+                           unsigned long long generation)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+void qemuMonitorInvalidateReplyCache(qemuMonitorPtr mon)
+    ATTRIBUTE_NONNULL(1);
 int qemuMonitorUpdateVideoMemorySize(qemuMonitorPtr mon,
                                      virDomainVideoDefPtr video,
                                      const char *videoName)
@@ -505,8 +552,11 @@ void qemuMonitorCPUInfoFree(qemuMonitorCPUInfoPtr list,
 int qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                           qemuMonitorCPUInfoPtr *vcpus,
                           size_t maxvcpus,
-                          bool hotplug);
-virBitmapPtr qemuMonitorGetCpuHalted(qemuMonitorPtr mon, size_t maxvcpus);
+                          bool hotplug,
+                          bool fast);
+virBitmapPtr qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
+                                     size_t maxvcpus,
+                                     bool fast);
 
 int qemuMonitorGetVirtType(qemuMonitorPtr mon,
                            virDomainVirtType *virtType);
@@ -516,6 +566,13 @@ int qemuMonitorGetMemoryStats(qemuMonitorPtr mon,
                               virDomainMemballoonDefPtr balloon,
                               virDomainMemoryStatPtr stats,
                               unsigned int nr_stats);
+qemuMonitorCompletionPtr
+qemuMonitorGetMemoryStatsStart(qemuMonitorPtr mon,
+                               virDomainMemballoonDefPtr balloon);
+int qemuMonitorGetMemoryStatsFinish(qemuMonitorCompletionPtr completion,
+                                    virDomainMemoryStatPtr stats,
+                                    unsigned int nr_stats)
+    ATTRIBUTE_NONNULL(1);
 int qemuMonitorSetMemoryStatsPeriod(qemuMonitorPtr mon,
                                     virDomainMemballoonDefPtr balloon,
                                     int period);
@@ -555,6 +612,20 @@ int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         bool backingChain)
     ATTRIBUTE_NONNULL(2);
 
+int qemuMonitorGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr *ret_stats,
+                                        bool backingChain,
+                                        bool capacityOptional)
+    ATTRIBUTE_NONNULL(2);
+qemuMonitorCompletionPtr
+qemuMonitorGetAllBlockStatsCapacityStart(qemuMonitorPtr mon);
+int
+qemuMonitorGetAllBlockStatsCapacityFinish(qemuMonitorCompletionPtr completion,
+                                          virHashTablePtr *ret_stats,
+                                          bool backingChain,
+                                          bool capacityOptional)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 int qemuMonitorBlockResize(qemuMonitorPtr mon,
                            const char *dev_name,
                            unsigned long long size);
@@ -636,6 +707,14 @@ struct _qemuMonitorMigrationParams {
 
     bool blockIncremental_set;
     bool blockIncremental;
+
+    bool multifdChannels_set;
+    int multifdChannels;
+
+    /* Not QEMU parameters: these drive libvirt's own convergence
+     * controller and are never sent to the monitor */
+    unsigned long long convergenceTime;
+    unsigned long long convergenceMaxDowntime;
 };
 
 int qemuMonitorGetMigrationParams(qemuMonitorPtr mon,
@@ -706,6 +785,13 @@ struct _qemuMonitorMigrationStats {
 int qemuMonitorGetMigrationStats(qemuMonitorPtr mon,
                                  qemuMonitorMigrationStatsPtr stats,
                                  char **error);
+qemuMonitorCompletionPtr
+qemuMonitorGetMigrationStatsStart(qemuMonitorPtr mon);
+int
+qemuMonitorGetMigrationStatsFinish(qemuMonitorCompletionPtr completion,
+                                   qemuMonitorMigrationStatsPtr stats,
+                                   char **error)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 typedef enum {
     QEMU_MONITOR_MIGRATION_CAPS_XBZRLE,
@@ -715,6 +801,7 @@ typedef enum {
     QEMU_MONITOR_MIGRATION_CAPS_POSTCOPY,
     QEMU_MONITOR_MIGRATION_CAPS_COMPRESS,
     QEMU_MONITOR_MIGRATION_CAPS_PAUSE_BEFORE_SWITCHOVER,
+    QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
 
     QEMU_MONITOR_MIGRATION_CAPS_LAST
 } qemuMonitorMigrationCaps;
@@ -859,6 +946,21 @@ int qemuMonitorDiskSnapshot(qemuMonitorPtr mon,
                             bool reuse);
 int qemuMonitorTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(2);
+int qemuMonitorDriveBackup(qemuMonitorPtr mon,
+                           virJSONValuePtr actions,
+                           const char *device,
+                           const char *target,
+                           const char *format,
+                           const char *bitmap,
+                           unsigned long long bandwidth,
+                           bool reuse)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorAddBitmap(qemuMonitorPtr mon,
+                         virJSONValuePtr actions,
+                         const char *node,
+                         const char *bitmap,
+                         bool persistent)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
 int qemuMonitorDriveMirror(qemuMonitorPtr mon,
                            const char *device,
                            const char *file,
@@ -1144,4 +1246,20 @@ virJSONValuePtr qemuMonitorQueryNamedBlockNodes(qemuMonitorPtr mon);
 
 int qemuMonitorSetWatchdogAction(qemuMonitorPtr mon,
                                  const char *action);
+
+int qemuMonitorStartDirtyRateCalc(qemuMonitorPtr mon,
+                                  int seconds);
+
+typedef struct _qemuMonitorDirtyRateInfo qemuMonitorDirtyRateInfo;
+typedef qemuMonitorDirtyRateInfo *qemuMonitorDirtyRateInfoPtr;
+
+struct _qemuMonitorDirtyRateInfo {
+    int status;             /* virDomainDirtyRateStatus */
+    long long startTime;    /* seconds since the epoch */
+    int calcTime;           /* seconds */
+    long long dirtyRate;    /* MiB/s, valid once measured */
+};
+
+int qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info);
 #endif /* QEMU_MONITOR_H */
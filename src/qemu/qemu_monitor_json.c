@@ -131,6 +131,15 @@ static qemuEventHandler eventHandlers[] = {
     /* We use bsearch, so keep this list sorted.  */
 };
 
+/* Frequent events which don't affect any of the cached query replies */
+static const char *qemuMonitorJSONCacheSafeEvents[] = {
+    "BALLOON_CHANGE",
+    "MIGRATION",
+    "MIGRATION_PASS",
+    "RTC_CHANGE",
+    NULL
+};
+
 static int
 qemuMonitorEventCompare(const void *key, const void *elt)
 {
@@ -172,6 +181,9 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     qemuMonitorEmitEvent(mon, type, seconds, micros, details);
     VIR_FREE(details);
 
+    if (!virStringListHasString(qemuMonitorJSONCacheSafeEvents, type))
+        qemuMonitorInvalidateReplyCache(mon);
+
     handler = bsearch(type, eventHandlers, ARRAY_CARDINALITY(eventHandlers),
                       sizeof(eventHandlers[0]), qemuMonitorEventCompare);
     if (handler) {
@@ -182,16 +194,126 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+/*
+ * Scans the top level keys of @line without building the object.
+ *
+ * Returns 1 if @line is a command reply, 0 if it is something else (an
+ * event or the greeting) and -1 on error.
+ */
+static int
+qemuMonitorJSONIOLineIsReply(const char *line,
+                             char **id)
+{
+    virJSONReaderPtr reader = NULL;
+    virJSONToken token;
+    const char *key;
+    bool reply = false;
+    int rc;
+    int ret = -1;
+
+    if (!(reader = virJSONReaderNew(line)))
+        return -1;
+
+    if (virJSONReaderNext(reader, &token) < 0)
+        goto cleanup;
+
+    if (token != VIR_JSON_TOKEN_OBJECT_START) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Parsed JSON reply '%s' isn't an object"), line);
+        goto cleanup;
+    }
+
+    while ((rc = virJSONReaderNextKey(reader, &key)) > 0) {
+        if (STREQ(key, "QMP") || STREQ(key, "event")) {
+            ret = 0;
+            goto cleanup;
+        }
+
+        if (STREQ(key, "return") || STREQ(key, "error"))
+            reply = true;
+
+        if (STREQ(key, "id")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                goto cleanup;
+            if (token == VIR_JSON_TOKEN_STRING) {
+                VIR_FREE(*id);
+                if (VIR_STRDUP(*id, virJSONReaderGetText(reader)) < 0)
+                    goto cleanup;
+            } else if (virJSONReaderSkip(reader) < 0) {
+                goto cleanup;
+            }
+            continue;
+        }
+
+        if (virJSONReaderSkip(reader) < 0)
+            goto cleanup;
+    }
+
+    if (rc < 0 || virJSONReaderNext(reader, &token) < 0)
+        goto cleanup;
+
+    ret = reply ? 1 : 0;
+
+ cleanup:
+    virJSONReaderFree(reader);
+    return ret;
+}
+
+
+/*
+ * Several commands may be in flight, so make sure the reply is for the one
+ * that is first in line. QEMU doesn't include the id in errors about
+ * commands it failed to parse, which is fine as they are still in order.
+ */
+static int
+qemuMonitorJSONIOCheckReplyID(qemuMonitorMessagePtr msg,
+                              const char *id)
+{
+    if (!msg->txID || !id)
+        return 0;
+
+    if (STRNEQ(id, msg->txID)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("reply id '%s' doesn't match command id '%s'"),
+                       id, msg->txID);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
                              qemuMonitorMessagePtr msg)
 {
     virJSONValuePtr obj = NULL;
+    char *id = NULL;
     int ret = -1;
+    int rc;
 
     VIR_DEBUG("Line [%s]", line);
 
+    /* Callers asking for the raw reply extract the data they need
+     * themselves, so don't bother building the whole object */
+    if (msg && msg->rxRaw) {
+        if ((rc = qemuMonitorJSONIOLineIsReply(line, &id)) < 0)
+            goto cleanup;
+
+        if (rc == 1) {
+            PROBE(QEMU_MONITOR_RECV_REPLY,
+                  "mon=%p reply=%s", mon, line);
+            if (qemuMonitorJSONIOCheckReplyID(msg, id) < 0 ||
+                VIR_STRDUP(msg->rxBuffer, line) < 0)
+                goto cleanup;
+            msg->rxLength = strlen(line);
+            msg->finished = 1;
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
     if (!(obj = virJSONValueFromString(line)))
         goto cleanup;
 
@@ -212,6 +334,9 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
         if (msg) {
+            if (qemuMonitorJSONIOCheckReplyID(msg,
+                                              virJSONValueObjectGetString(obj, "id")) < 0)
+                goto cleanup;
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
@@ -227,6 +352,7 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
  cleanup:
     virJSONValueFree(obj);
+    VIR_FREE(id);
     return ret;
 }
 
@@ -254,6 +380,10 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
             }
 
             VIR_FREE(line);
+
+            /* anything following the reply belongs to the next command */
+            if (msg && msg->finished)
+                break;
         } else {
             break;
         }
@@ -263,45 +393,277 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
     return used;
 }
 
+/*
+ * Finishes the command object left open in @writer by adding the command
+ * id (if @addID is true), and stores it in @msg to be sent to QEMU.
+ * @cmdname is only used for tracing.
+ */
+static int
+qemuMonitorJSONMessageFormatWriter(qemuMonitorPtr mon,
+                                   virBufferPtr buf,
+                                   virJSONWriterPtr writer,
+                                   const char *cmdname,
+                                   bool addID,
+                                   int scm_fd,
+                                   qemuMonitorMessagePtr msg)
+{
+    int ret = -1;
+    char *id = NULL;
+
+    if (addID) {
+        if (!(id = qemuMonitorNextCommandID(mon)))
+            goto cleanup;
+
+        if (virJSONWriterKey(writer, "id") < 0 ||
+            virJSONWriterString(writer, id) < 0)
+            goto cleanup;
+    }
+
+    if (virJSONWriterEndObject(writer) < 0 ||
+        virJSONWriterFinish(writer) < 0)
+        goto cleanup;
+
+    virBufferAddLit(buf, "\r\n");
+    if (virBufferCheckError(buf) < 0)
+        goto cleanup;
+
+    msg->txLength = virBufferUse(buf);
+    msg->txBuffer = virBufferContentAndReset(buf);
+    msg->txFD = scm_fd;
+    msg->txID = id;
+    id = NULL;
+
+    if (msg->txID) {
+        PROBE(QEMU_MONITOR_COMMAND_SEND,
+              "mon=%p id=%s cmd=%s", mon, msg->txID, NULLSTR(cmdname));
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(buf);
+    VIR_FREE(id);
+
+    return ret;
+}
+
+
+/*
+ * Drops the cached query replies unless @cmdname is known not to change
+ * any state. This is deliberately conservative, e.g. human monitor
+ * commands always invalidate the cache.
+ */
+static void
+qemuMonitorJSONInvalidateReplyCacheFor(qemuMonitorPtr mon,
+                                       const char *cmdname)
+{
+    if (cmdname &&
+        (STRPREFIX(cmdname, "query-") ||
+         STREQ(cmdname, "qom-get") ||
+         STREQ(cmdname, "qom-list")))
+        return;
+
+    qemuMonitorInvalidateReplyCache(mon);
+}
+
+
+/*
+ * Formats @cmd into @msg, adding the command id if it's a QEMU command
+ * and not the capabilities negotiation.
+ */
+static int
+qemuMonitorJSONMessageFormat(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             qemuMonitorMessagePtr msg)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    int npairs = virJSONValueObjectKeysNumber(cmd);
+    const char *cmdname = virJSONValueObjectGetString(cmd, "execute");
+    int i;
+
+    qemuMonitorJSONInvalidateReplyCacheFor(mon, cmdname);
+
+    virJSONWriterInit(&writer, &buf);
+    ignore_value(virJSONWriterStartObject(&writer));
+
+    for (i = 0; i < npairs; i++) {
+        if (virJSONWriterKey(&writer, virJSONValueObjectGetKey(cmd, i)) < 0 ||
+            virJSONWriterValue(&writer, virJSONValueObjectGetValue(cmd, i)) < 0)
+            break;
+    }
+
+    return qemuMonitorJSONMessageFormatWriter(mon, &buf, &writer, cmdname,
+                                              virJSONValueObjectHasKey(cmd, "execute") == 1,
+                                              scm_fd, msg);
+}
+
+
+/*
+ * Formats command @cmdname with arguments given in the same format as
+ * to qemuMonitorJSONMakeCommand straight into the message, which saves
+ * building and freeing a command object for simple commands.
+ */
+static int
+qemuMonitorJSONMessageFormatDirect(qemuMonitorPtr mon,
+                                   const char *cmdname,
+                                   va_list args,
+                                   qemuMonitorMessagePtr msg)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    va_list peek;
+    bool hasArgs;
+
+    va_copy(peek, args);
+    hasArgs = !!va_arg(peek, char *);
+    va_end(peek);
+
+    qemuMonitorJSONInvalidateReplyCacheFor(mon, cmdname);
+
+    virJSONWriterInit(&writer, &buf);
+
+    if (virJSONWriterStartObject(&writer) == 0 &&
+        virJSONWriterKey(&writer, "execute") == 0 &&
+        virJSONWriterString(&writer, cmdname) == 0 &&
+        hasArgs &&
+        virJSONWriterKey(&writer, "arguments") == 0 &&
+        virJSONWriterStartObject(&writer) == 0 &&
+        virJSONWriterObjectAddVArgs(&writer, args) >= 0)
+        ignore_value(virJSONWriterEndObject(&writer));
+
+    return qemuMonitorJSONMessageFormatWriter(mon, &buf, &writer, cmdname,
+                                              true, -1, msg);
+}
+
+
+static int ATTRIBUTE_SENTINEL
+qemuMonitorJSONMessageFormatCommand(qemuMonitorPtr mon,
+                                    qemuMonitorMessagePtr msg,
+                                    const char *cmdname,
+                                    ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, cmdname);
+    ret = qemuMonitorJSONMessageFormatDirect(mon, cmdname, args, msg);
+    va_end(args);
+
+    return ret;
+}
+
+
+/*
+ * Sends the formatted @msgs to QEMU in one go and waits for all replies.
+ * The transmit buffers are released afterwards while the replies are left
+ * in the messages for the caller.
+ */
+static int
+qemuMonitorJSONMessageSend(qemuMonitorPtr mon,
+                           qemuMonitorMessagePtr *msgs,
+                           size_t nmsgs)
+{
+    int ret;
+    size_t i;
+
+    for (i = 0; i < nmsgs; i++) {
+        VIR_DEBUG("Send command '%.*s' for write with FD %d",
+                  msgs[i]->txLength - 2, msgs[i]->txBuffer, msgs[i]->txFD);
+    }
+
+    ret = qemuMonitorSendBatch(mon, msgs, nmsgs);
+
+    for (i = 0; i < nmsgs; i++) {
+        VIR_DEBUG("Receive command reply ret=%d rxObject=%p rxBuffer=%p",
+                  ret, msgs[i]->rxObject, msgs[i]->rxBuffer);
+
+        VIR_FREE(msgs[i]->txBuffer);
+        VIR_FREE(msgs[i]->txID);
+    }
+
+    return ret;
+}
+
+
+static int
+qemuMonitorJSONCommandSend(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           qemuMonitorMessagePtr msg)
+{
+    if (qemuMonitorJSONMessageFormat(mon, cmd, scm_fd, msg) < 0)
+        return -1;
+
+    return qemuMonitorJSONMessageSend(mon, &msg, 1);
+}
+
+
+static int
+qemuMonitorJSONCommandDirectSend(qemuMonitorPtr mon,
+                                 const char *cmdname,
+                                 va_list args,
+                                 qemuMonitorMessagePtr msg)
+{
+    if (qemuMonitorJSONMessageFormatDirect(mon, cmdname, args, msg) < 0)
+        return -1;
+
+    return qemuMonitorJSONMessageSend(mon, &msg, 1);
+}
+
+
 static int
 qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
                              virJSONValuePtr cmd,
                              int scm_fd,
                              virJSONValuePtr *reply)
 {
-    int ret = -1;
     qemuMonitorMessage msg;
-    char *cmdstr = NULL;
-    char *id = NULL;
+    int ret;
 
     *reply = NULL;
 
     memset(&msg, 0, sizeof(msg));
 
-    if (virJSONValueObjectHasKey(cmd, "execute") == 1) {
-        if (!(id = qemuMonitorNextCommandID(mon)))
-            goto cleanup;
-        if (virJSONValueObjectAppendString(cmd, "id", id) < 0) {
+    ret = qemuMonitorJSONCommandSend(mon, cmd, scm_fd, &msg);
+
+    if (ret == 0) {
+        if (!msg.rxObject) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Unable to append command 'id' string"));
-            goto cleanup;
+                           _("Missing monitor reply object"));
+            ret = -1;
+        } else {
+            *reply = msg.rxObject;
         }
     }
 
-    if (!(cmdstr = virJSONValueToString(cmd, false)))
-        goto cleanup;
-    if (virAsprintf(&msg.txBuffer, "%s\r\n", cmdstr) < 0)
-        goto cleanup;
-    msg.txLength = strlen(msg.txBuffer);
-    msg.txFD = scm_fd;
+    return ret;
+}
 
-    VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
-    ret = qemuMonitorSend(mon, &msg);
+/*
+ * Sends @cmdname with the arguments given in qemuMonitorJSONMakeCommand
+ * format without building a command object. Errors in the reply are to
+ * be checked by qemuMonitorJSONCheckReplyError.
+ */
+static int ATTRIBUTE_SENTINEL
+qemuMonitorJSONCommandDirect(qemuMonitorPtr mon,
+                             virJSONValuePtr *reply,
+                             const char *cmdname,
+                             ...)
+{
+    qemuMonitorMessage msg;
+    va_list args;
+    int ret;
+
+    *reply = NULL;
 
-    VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
-              ret, msg.rxObject);
+    memset(&msg, 0, sizeof(msg));
 
+    va_start(args, cmdname);
+    ret = qemuMonitorJSONCommandDirectSend(mon, cmdname, args, &msg);
+    va_end(args);
 
     if (ret == 0) {
         if (!msg.rxObject) {
@@ -313,15 +675,89 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
         }
     }
 
- cleanup:
-    VIR_FREE(id);
-    VIR_FREE(cmdstr);
-    VIR_FREE(msg.txBuffer);
+    return ret;
+}
+
+
+/*
+ * Like qemuMonitorJSONCommandDirect, but the reply is handed back as the
+ * unparsed string so that callers interested in a small part of a large
+ * reply can pick it out with virJSONReader.
+ */
+static int ATTRIBUTE_SENTINEL
+qemuMonitorJSONCommandRawReply(qemuMonitorPtr mon,
+                               char **reply,
+                               const char *cmdname,
+                               ...)
+{
+    qemuMonitorMessage msg;
+    va_list args;
+    int ret;
+
+    *reply = NULL;
 
+    memset(&msg, 0, sizeof(msg));
+    msg.rxRaw = true;
+
+    va_start(args, cmdname);
+    ret = qemuMonitorJSONCommandDirectSend(mon, cmdname, args, &msg);
+    va_end(args);
+
+    if (ret == 0) {
+        if (!msg.rxBuffer) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+            ret = -1;
+        } else {
+            *reply = msg.rxBuffer;
+            msg.rxBuffer = NULL;
+        }
+    }
+
+    VIR_FREE(msg.rxBuffer);
     return ret;
 }
 
 
+/*
+ * Returns the reply object of message @idx of @completion which was
+ * waited for by qemuMonitorCompletionWait.
+ */
+static virJSONValuePtr
+qemuMonitorJSONCompletionReply(qemuMonitorCompletionPtr completion,
+                               size_t idx)
+{
+    qemuMonitorMessagePtr msg = qemuMonitorCompletionGetMessage(completion,
+                                                                idx);
+
+    if (!msg || !msg->rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        return NULL;
+    }
+
+    return msg->rxObject;
+}
+
+
+/* Like qemuMonitorJSONCompletionReply for messages sent with rxRaw */
+static const char *
+qemuMonitorJSONCompletionRawReply(qemuMonitorCompletionPtr completion,
+                                  size_t idx)
+{
+    qemuMonitorMessagePtr msg = qemuMonitorCompletionGetMessage(completion,
+                                                                idx);
+
+    if (!msg || !msg->rxBuffer) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        return NULL;
+    }
+
+    return msg->rxBuffer;
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -330,6 +766,32 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/*
+ * Sends the argument-less query command @cmdname unless a reply to it
+ * is cached already. Use this only for queries whose results don't
+ * change without QEMU emitting an event or us sending a command, as
+ * both invalidate the cache. Only successful replies are cached.
+ */
+static int
+qemuMonitorJSONCommandCached(qemuMonitorPtr mon,
+                             const char *cmdname,
+                             virJSONValuePtr *reply)
+{
+    unsigned long long generation;
+
+    if ((*reply = qemuMonitorGetCachedReply(mon, cmdname, &generation)))
+        return 0;
+
+    if (qemuMonitorJSONCommandDirect(mon, reply, cmdname, NULL) < 0)
+        return -1;
+
+    if (virJSONValueObjectHasKey(*reply, "return"))
+        qemuMonitorCacheReply(mon, cmdname, *reply, generation);
+
+    return 0;
+}
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -364,42 +826,47 @@ qemuMonitorJSONCommandName(virJSONValuePtr cmd)
         return "<unknown>";
 }
 
+/*
+ * Checks @reply of command @cmdname for errors. @cmd is the command
+ * object if there is one and is used for debug logging only.
+ */
 static int
-qemuMonitorJSONCheckError(virJSONValuePtr cmd,
-                          virJSONValuePtr reply)
+qemuMonitorJSONCheckReplyError(const char *cmdname,
+                               virJSONValuePtr cmd,
+                               virJSONValuePtr reply)
 {
     if (virJSONValueObjectHasKey(reply, "error")) {
         virJSONValuePtr error = virJSONValueObjectGet(reply, "error");
-        char *cmdstr = virJSONValueToString(cmd, false);
+        char *cmdstr = cmd ? virJSONValueToString(cmd, false) : NULL;
         char *replystr = virJSONValueToString(reply, false);
 
         /* Log the full JSON formatted command & error */
         VIR_DEBUG("unable to execute QEMU command %s: %s",
-                  NULLSTR(cmdstr), NULLSTR(replystr));
+                  cmd ? NULLSTR(cmdstr) : cmdname, NULLSTR(replystr));
 
         /* Only send the user the command name + friendly error */
         if (!error)
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("unable to execute QEMU command '%s'"),
-                           qemuMonitorJSONCommandName(cmd));
+                           cmdname);
         else
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("unable to execute QEMU command '%s': %s"),
-                           qemuMonitorJSONCommandName(cmd),
+                           cmdname,
                            qemuMonitorJSONStringifyError(error));
 
         VIR_FREE(cmdstr);
         VIR_FREE(replystr);
         return -1;
     } else if (!virJSONValueObjectHasKey(reply, "return")) {
-        char *cmdstr = virJSONValueToString(cmd, false);
+        char *cmdstr = cmd ? virJSONValueToString(cmd, false) : NULL;
         char *replystr = virJSONValueToString(reply, false);
 
         VIR_DEBUG("Neither 'return' nor 'error' is set in the JSON reply %s: %s",
-                  NULLSTR(cmdstr), NULLSTR(replystr));
+                  cmd ? NULLSTR(cmdstr) : cmdname, NULLSTR(replystr));
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unable to execute QEMU command '%s'"),
-                       qemuMonitorJSONCommandName(cmd));
+                       cmdname);
         VIR_FREE(cmdstr);
         VIR_FREE(replystr);
         return -1;
@@ -408,6 +875,35 @@ qemuMonitorJSONCheckError(virJSONValuePtr cmd,
 }
 
 
+static int
+qemuMonitorJSONCheckError(virJSONValuePtr cmd,
+                          virJSONValuePtr reply)
+{
+    return qemuMonitorJSONCheckReplyError(qemuMonitorJSONCommandName(cmd),
+                                          cmd, reply);
+}
+
+
+/*
+ * Same as qemuMonitorJSONCheckReplyError, for replies obtained by
+ * qemuMonitorJSONCommandRawReply.
+ */
+static int
+qemuMonitorJSONCheckRawError(const char *cmdname,
+                             const char *reply)
+{
+    virJSONValuePtr obj;
+    int ret;
+
+    if (!(obj = virJSONValueFromString(reply)))
+        return -1;
+
+    ret = qemuMonitorJSONCheckReplyError(cmdname, NULL, obj);
+    virJSONValueFree(obj);
+    return ret;
+}
+
+
 static bool
 qemuMonitorJSONErrorIsClass(virJSONValuePtr error,
                             const char *klass)
@@ -880,6 +1376,8 @@ qemuMonitorJSONHandleBlockJobImpl(qemuMonitorPtr mon,
         type = VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT;
     else if (STREQ(type_str, "mirror"))
         type = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
+    else if (STREQ(type_str, "backup"))
+        type = VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP;
 
     switch ((virConnectDomainEventBlockJobStatus) event) {
     case VIR_DOMAIN_BLOCK_JOB_COMPLETED:
@@ -1276,20 +1774,16 @@ qemuMonitorJSONGetStatus(qemuMonitorPtr mon,
 {
     int ret = -1;
     const char *status;
-    virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
 
     if (reason)
         *reason = VIR_DOMAIN_PAUSED_UNKNOWN;
 
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-status", NULL)))
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandDirect(mon, &reply, "query-status", NULL) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+    if (qemuMonitorJSONCheckReplyError("query-status", NULL, reply) < 0)
         goto cleanup;
 
     data = virJSONValueObjectGetObject(reply, "return");
@@ -1310,7 +1804,6 @@ qemuMonitorJSONGetStatus(qemuMonitorPtr mon,
     ret = 0;
 
  cleanup:
-    virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
@@ -1344,23 +1837,18 @@ int qemuMonitorJSONSetLink(qemuMonitorPtr mon,
 
     int ret = -1;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("set_link",
-                                                     "s:name", name,
-                                                     "b:up", state != VIR_DOMAIN_NET_INTERFACE_LINK_STATE_DOWN,
-                                                     NULL);
 
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandDirect(mon, &reply, "set_link",
+                                     "s:name", name,
+                                     "b:up", state != VIR_DOMAIN_NET_INTERFACE_LINK_STATE_DOWN,
+                                     NULL) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+    if (qemuMonitorJSONCheckReplyError("set_link", NULL, reply) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
-    virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
@@ -1388,6 +1876,7 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
 
 
 /*
+ * query-cpus:
  *
  * [{ "arch": "x86",
  *    "current": true,
@@ -1398,11 +1887,29 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
  *    "thread_id": 2631237},
  *    {...}
  *  ]
+ *
+ * query-cpus-fast, which doesn't interrupt the vCPUs and thus reports the
+ * halted state only where it is architecturally visible, i.e. on s390:
+ *
+ * [{ "arch": "x86",
+ *    "cpu-index": 0,
+ *    "qom-path": "/machine/unattached/device[0]",
+ *    "thread-id": 2631237,
+ *    "props": {...}},
+ *  { "arch": "s390",
+ *    "cpu-index": 1,
+ *    "qom-path": "/machine/unattached/device[1]",
+ *    "thread-id": 2631238,
+ *    "cpu-state": "operating",
+ *    "props": {...}},
+ *    {...}
+ *  ]
  */
 static int
 qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
                               struct qemuMonitorQueryCpusEntry **entries,
-                              size_t *nentries)
+                              size_t *nentries,
+                              bool fast)
 {
     struct qemuMonitorQueryCpusEntry *cpus = NULL;
     int ret = -1;
@@ -1421,6 +1928,7 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
         int thread = 0;
         bool halted = false;
         const char *qom_path;
+        const char *state;
         if (!entry) {
             ret = -2;
             goto cleanup;
@@ -1428,10 +1936,19 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
 
         /* Some older qemu versions don't report the thread_id so treat this as
          * non-fatal, simply returning no data */
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
-        ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
-        qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        if (fast) {
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "cpu-index", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread-id", &thread));
+            state = virJSONValueObjectGetString(entry, "cpu-state");
+            halted = STREQ_NULLABLE(state, "stopped") ||
+                     STREQ_NULLABLE(state, "check-stop");
+            qom_path = virJSONValueObjectGetString(entry, "qom-path");
+        } else {
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
+            ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
+            qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        }
 
         cpus[i].qemu_id = cpuid;
         cpus[i].tid = thread;
@@ -1456,6 +1973,8 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
  * @mon: monitor object
  * @entries: filled with detected entries on success
  * @nentries: number of entries returned
+ * @force: report an error if the command fails
+ * @fast: use query-cpus-fast instead of query-cpus
  *
  * Queries qemu for cpu-related information. Failure to execute the command or
  * extract results does not produce an error as libvirt can continue without
@@ -1468,13 +1987,19 @@ int
 qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                          struct qemuMonitorQueryCpusEntry **entries,
                          size_t *nentries,
-                         bool force)
+                         bool force,
+                         bool fast)
 {
     int ret = -1;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+    virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
 
+    if (fast)
+        cmd = qemuMonitorJSONMakeCommand("query-cpus-fast", NULL);
+    else
+        cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+
     if (!cmd)
         return -1;
 
@@ -1489,7 +2014,7 @@ qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
         goto cleanup;
     }
 
-    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries);
+    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries, fast);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -1650,48 +2175,50 @@ qemuMonitorJSONUpdateVideoVram64Size(qemuMonitorPtr mon,
 }
 
 
-int
-qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
-                              unsigned long long *currmem)
+static int
+qemuMonitorJSONBalloonInfoReply(virJSONValuePtr reply,
+                                unsigned long long *currmem)
 {
-    int ret = -1;
     virJSONValuePtr data;
     unsigned long long mem;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
-                                                     NULL);
-    virJSONValuePtr reply = NULL;
-
-    *currmem = 0;
-
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
 
     /* See if balloon soft-failed */
     if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-        qemuMonitorJSONHasError(reply, "KVMMissingCap")) {
-        ret = 0;
-        goto cleanup;
-    }
+        qemuMonitorJSONHasError(reply, "KVMMissingCap"))
+        return 0;
 
     /* See if any other fatal error occurred */
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+    if (qemuMonitorJSONCheckReplyError("query-balloon", NULL, reply) < 0)
+        return -1;
 
     data = virJSONValueObjectGetObject(reply, "return");
 
     if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("info balloon reply was missing balloon data"));
-        goto cleanup;
+        return -1;
     }
 
     *currmem = (mem/1024);
-    ret = 1;
+    return 1;
+}
+
+
+int
+qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
+                              unsigned long long *currmem)
+{
+    int ret = -1;
+    virJSONValuePtr reply = NULL;
+
+    *currmem = 0;
+
+    if (qemuMonitorJSONCommandDirect(mon, &reply, "query-balloon", NULL) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONBalloonInfoReply(reply, currmem);
+
  cleanup:
-    virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
@@ -1734,6 +2261,65 @@ qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
     }
 
 
+/*
+ * Parses the reply to the 'guest-stats' qom-get into @stats after the
+ * @got entries filled in already. Returns the new count of entries or -1
+ * if the stats were not available.
+ */
+static int
+qemuMonitorJSONGuestStatsReply(virJSONValuePtr reply,
+                               virDomainMemoryStatPtr stats,
+                               unsigned int nr_stats,
+                               int got)
+{
+    virJSONValuePtr data;
+    virJSONValuePtr statsdata;
+    unsigned long long mem;
+
+    if ((data = virJSONValueObjectGetObject(reply, "error"))) {
+        const char *klass = virJSONValueObjectGetString(data, "class");
+        const char *desc = virJSONValueObjectGetString(data, "desc");
+
+        if (STREQ_NULLABLE(klass, "GenericError") &&
+            STREQ_NULLABLE(desc, "guest hasn't updated any stats yet")) {
+            virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                           _("the guest hasn't updated any stats yet"));
+            return -1;
+        }
+    }
+
+    if (qemuMonitorJSONCheckReplyError("qom-get", NULL, reply) < 0)
+        return -1;
+
+    data = virJSONValueObjectGetObject(reply, "return");
+
+    if (!(statsdata = virJSONValueObjectGet(data, "stats"))) {
+        VIR_DEBUG("data does not include 'stats'");
+        return -1;
+    }
+
+    GET_BALLOON_STATS(statsdata, "stat-swap-in",
+                      VIR_DOMAIN_MEMORY_STAT_SWAP_IN, 1024);
+    GET_BALLOON_STATS(statsdata, "stat-swap-out",
+                      VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, 1024);
+    GET_BALLOON_STATS(statsdata, "stat-major-faults",
+                      VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, 1);
+    GET_BALLOON_STATS(statsdata, "stat-minor-faults",
+                      VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, 1);
+    GET_BALLOON_STATS(statsdata, "stat-free-memory",
+                      VIR_DOMAIN_MEMORY_STAT_UNUSED, 1024);
+    GET_BALLOON_STATS(statsdata, "stat-total-memory",
+                      VIR_DOMAIN_MEMORY_STAT_AVAILABLE, 1024);
+    GET_BALLOON_STATS(statsdata, "stat-available-memory",
+                      VIR_DOMAIN_MEMORY_STAT_USABLE, 1024);
+    GET_BALLOON_STATS(data, "last-update",
+                      VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1);
+
+    return got;
+}
+#undef GET_BALLOON_STATS
+
+
 int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                                   char *balloonpath,
                                   virDomainMemoryStatPtr stats,
@@ -1742,8 +2328,6 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
     int ret = -1;
     virJSONValuePtr cmd = NULL;
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
-    virJSONValuePtr statsdata;
     unsigned long long mem;
     int got = 0;
 
@@ -1766,51 +2350,87 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
 
-    if ((data = virJSONValueObjectGetObject(reply, "error"))) {
-        const char *klass = virJSONValueObjectGetString(data, "class");
-        const char *desc = virJSONValueObjectGetString(data, "desc");
+    if ((got = qemuMonitorJSONGuestStatsReply(reply, stats, nr_stats,
+                                              got)) < 0)
+        goto cleanup;
+
+    ret = got;
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/*
+ * Queues the same queries as qemuMonitorJSONGetMemoryStats without
+ * waiting for the replies, which are to be collected by
+ * qemuMonitorJSONGetMemoryStatsFinish.
+ */
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetMemoryStatsStart(qemuMonitorPtr mon,
+                                   char *balloonpath)
+{
+    qemuMonitorCompletionPtr completion;
+
+    if (!(completion = qemuMonitorCompletionNew(balloonpath ? 2 : 1)))
+        return NULL;
+
+    if (qemuMonitorJSONMessageFormatCommand(mon,
+                                            qemuMonitorCompletionGetMessage(completion, 0),
+                                            "query-balloon", NULL) < 0)
+        goto error;
+
+    if (balloonpath &&
+        qemuMonitorJSONMessageFormatCommand(mon,
+                                            qemuMonitorCompletionGetMessage(completion, 1),
+                                            "qom-get",
+                                            "s:path", balloonpath,
+                                            "s:property", "guest-stats",
+                                            NULL) < 0)
+        goto error;
+
+    if (qemuMonitorCompletionSubmit(mon, completion) < 0)
+        goto error;
+
+    return completion;
+
+ error:
+    virObjectUnref(completion);
+    return NULL;
+}
 
-        if (STREQ_NULLABLE(klass, "GenericError") &&
-            STREQ_NULLABLE(desc, "guest hasn't updated any stats yet")) {
-            virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                           _("the guest hasn't updated any stats yet"));
-            goto cleanup;
-        }
-    }
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+int
+qemuMonitorJSONGetMemoryStatsFinish(qemuMonitorCompletionPtr completion,
+                                    virDomainMemoryStatPtr stats,
+                                    unsigned int nr_stats)
+{
+    virJSONValuePtr reply;
+    unsigned long long mem = 0;
+    int got = 0;
+    int ret;
 
-    data = virJSONValueObjectGetObject(reply, "return");
+    if (!(reply = qemuMonitorJSONCompletionReply(completion, 0)))
+        return -1;
 
-    if (!(statsdata = virJSONValueObjectGet(data, "stats"))) {
-        VIR_DEBUG("data does not include 'stats'");
-        goto cleanup;
+    ret = qemuMonitorJSONBalloonInfoReply(reply, &mem);
+    if (ret == 1 && (got < nr_stats)) {
+        stats[got].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
+        stats[got].val = mem;
+        got++;
     }
 
-    GET_BALLOON_STATS(statsdata, "stat-swap-in",
-                      VIR_DOMAIN_MEMORY_STAT_SWAP_IN, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-swap-out",
-                      VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-major-faults",
-                      VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, 1);
-    GET_BALLOON_STATS(statsdata, "stat-minor-faults",
-                      VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, 1);
-    GET_BALLOON_STATS(statsdata, "stat-free-memory",
-                      VIR_DOMAIN_MEMORY_STAT_UNUSED, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-total-memory",
-                      VIR_DOMAIN_MEMORY_STAT_AVAILABLE, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-available-memory",
-                      VIR_DOMAIN_MEMORY_STAT_USABLE, 1024);
-    GET_BALLOON_STATS(data, "last-update",
-                      VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1);
-    ret = got;
- cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
-    return ret;
+    if (!qemuMonitorCompletionGetMessage(completion, 1))
+        return ret;
+
+    if (!(reply = qemuMonitorJSONCompletionReply(completion, 1)) ||
+        (got = qemuMonitorJSONGuestStatsReply(reply, stats, nr_stats,
+                                              got)) < 0)
+        return ret;
+
+    return got;
 }
-#undef GET_BALLOON_STATS
 
 
 /*
@@ -1837,34 +2457,58 @@ qemuMonitorJSONSetMemoryStatsPeriod(qemuMonitorPtr mon,
 }
 
 
+/* Checks @reply to the "query-block" command for errors and returns
+ * the list of devices stolen from it, or NULL on error */
+static virJSONValuePtr
+qemuMonitorJSONQueryBlockReply(virJSONValuePtr reply)
+{
+    virJSONValuePtr devices;
+
+    if (qemuMonitorJSONCheckReplyError("query-block", NULL, reply) < 0)
+        return NULL;
+
+    if (!(devices = virJSONValueObjectStealArray(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-block reply was missing device list"));
+        return NULL;
+    }
+
+    return devices;
+}
+
+
 /* qemuMonitorJSONQueryBlock:
  * @mon: Monitor pointer
+ * @cached: allow using a cached reply
  *
  * This helper will attempt to make a "query-block" call and check for
- * errors before returning with the reply.
+ * errors before returning with the reply. Callers interested in image
+ * sizes must not use a cached reply as those change without QEMU
+ * emitting any event.
  *
  * Returns: NULL on error, reply on success
  */
 static virJSONValuePtr
-qemuMonitorJSONQueryBlock(qemuMonitorPtr mon)
+qemuMonitorJSONQueryBlock(qemuMonitorPtr mon,
+                          bool cached)
 {
-    virJSONValuePtr cmd;
+    virJSONValuePtr cmd = NULL;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr devices = NULL;
 
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-block", NULL)))
-        return NULL;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0 ||
-        qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+    if (cached) {
+        if (qemuMonitorJSONCommandCached(mon, "query-block", &reply) < 0)
+            goto cleanup;
+    } else {
+        if (!(cmd = qemuMonitorJSONMakeCommand("query-block", NULL)))
+            return NULL;
 
-    if (!(devices = virJSONValueObjectStealArray(reply, "return"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("query-block reply was missing device list"));
-        goto cleanup;
+        if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+            goto cleanup;
     }
 
+    devices = qemuMonitorJSONQueryBlockReply(reply);
+
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
@@ -1910,7 +2554,7 @@ int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
 
     virJSONValuePtr devices;
 
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, true)))
         return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -1978,75 +2622,262 @@ int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
 }
 
 
+/*
+ * The query-blockstats reply is streamed with virJSONReader rather than
+ * parsed into an object as it can get rather big with many disks and
+ * long backing chains, while only a handful of counters are used.
+ */
+typedef struct _qemuMonitorJSONBlockStatsEntry qemuMonitorJSONBlockStatsEntry;
+typedef qemuMonitorJSONBlockStatsEntry *qemuMonitorJSONBlockStatsEntryPtr;
+struct _qemuMonitorJSONBlockStatsEntry {
+    char *device;
+
+    /* indexed by the depth in the backing chain */
+    qemuBlockStatsPtr *stats;
+    size_t nstats;
+};
+
+
+static void
+qemuMonitorJSONBlockStatsEntryClear(qemuMonitorJSONBlockStatsEntryPtr entry)
+{
+    size_t i;
+
+    for (i = 0; i < entry->nstats; i++)
+        VIR_FREE(entry->stats[i]);
+    VIR_FREE(entry->stats);
+    VIR_FREE(entry->device);
+    entry->nstats = 0;
+}
+
+
 static int
-qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
-                                    const char *dev_name,
-                                    int depth,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
+qemuMonitorJSONReadBlockStatsCounters(virJSONReaderPtr reader,
+                                      qemuBlockStatsPtr bstats)
 {
-    qemuBlockStatsPtr bstats = NULL;
-    virJSONValuePtr stats;
-    virJSONValuePtr parent;
-    virJSONValuePtr parentstats;
-    int ret = -1;
+    virJSONToken token;
+    const char *key;
+    unsigned int found = 0;
     int nstats = 0;
-    char *entry_name = qemuDomainStorageAlias(dev_name, depth);
-    virJSONValuePtr backing;
+    size_t i;
+    int rc;
+    struct {
+        const char *name;
+        long long *var;
+        bool mandatory;
+    } counters[] = {
+        { "rd_bytes", &bstats->rd_bytes, true },
+        { "wr_bytes", &bstats->wr_bytes, true },
+        { "rd_operations", &bstats->rd_req, true },
+        { "wr_operations", &bstats->wr_req, true },
+        { "rd_total_time_ns", &bstats->rd_total_times, false },
+        { "wr_total_time_ns", &bstats->wr_total_times, false },
+        { "flush_operations", &bstats->flush_req, false },
+        { "flush_total_time_ns", &bstats->flush_total_times, false },
+    };
 
-    if (!entry_name)
-        goto cleanup;
-    if (VIR_ALLOC(bstats) < 0)
-        goto cleanup;
+    while ((rc = virJSONReaderNextKey(reader, &key)) > 0) {
+        for (i = 0; i < ARRAY_CARDINALITY(counters); i++) {
+            if (STREQ(key, counters[i].name))
+                break;
+        }
+
+        if (i == ARRAY_CARDINALITY(counters)) {
+            if (virJSONReaderSkip(reader) < 0)
+                return -1;
+            continue;
+        }
+
+        if (virJSONReaderNext(reader, &token) < 0)
+            return -1;
+
+        if (virJSONReaderGetNumberLong(reader, counters[i].var) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot read %s statistic"), counters[i].name);
+            return -1;
+        }
+
+        if (!(found & (1U << i)))
+            nstats++;
+        found |= 1U << i;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(counters); i++) {
+        if (counters[i].mandatory && !(found & (1U << i))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot read %s statistic"), counters[i].name);
+            return -1;
+        }
+    }
+
+    return nstats;
+}
+
+
+/* Picks 'wr_highest_offset' out of the 'parent' member */
+static int
+qemuMonitorJSONReadBlockStatsParent(virJSONReaderPtr reader,
+                                    qemuBlockStatsPtr bstats)
+{
+    virJSONToken token;
+    const char *key;
+    bool inStats = false;
+    int rc;
+
+    if (virJSONReaderNext(reader, &token) < 0)
+        return -1;
+
+    if (token != VIR_JSON_TOKEN_OBJECT_START)
+        return virJSONReaderSkip(reader);
+
+    while (true) {
+        if ((rc = virJSONReaderNextKey(reader, &key)) < 0)
+            return -1;
+
+        if (rc == 0) {
+            /* leaving 'stats' continues with the rest of 'parent' */
+            if (!inStats)
+                return 0;
+            inStats = false;
+            continue;
+        }
+
+        if (!inStats && STREQ(key, "stats")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                return -1;
+            if (token == VIR_JSON_TOKEN_OBJECT_START)
+                inStats = true;
+            else if (virJSONReaderSkip(reader) < 0)
+                return -1;
+        } else if (inStats && STREQ(key, "wr_highest_offset")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                return -1;
+            if (virJSONReaderGetNumberUlong(reader,
+                                            &bstats->wr_highest_offset) == 0)
+                bstats->wr_highest_offset_valid = true;
+            else if (virJSONReaderSkip(reader) < 0)
+                return -1;
+        } else if (virJSONReaderSkip(reader) < 0) {
+            return -1;
+        }
+    }
+}
+
+
+/*
+ * Reads one block device object from the reply into @entry. The
+ * VIR_JSON_TOKEN_OBJECT_START token of the object was already consumed.
+ * Returns the number of statistics read for the top level image or -1
+ * on error.
+ */
+static int
+qemuMonitorJSONReadOneBlockStats(virJSONReaderPtr reader,
+                                 qemuMonitorJSONBlockStatsEntryPtr entry,
+                                 size_t depth,
+                                 bool backingChain)
+{
+    qemuBlockStatsPtr bstats = NULL;
+    virJSONToken token;
+    const char *key;
+    int nstats = -1;
+    int rc;
+
+    if (VIR_ALLOC(bstats) < 0 ||
+        VIR_APPEND_ELEMENT(entry->stats, entry->nstats, bstats) < 0) {
+        VIR_FREE(bstats);
+        return -1;
+    }
+
+    /* @bstats is owned by @entry from now on */
+    bstats = entry->stats[depth];
 
-    if ((stats = virJSONValueObjectGetObject(dev, "stats")) == NULL) {
+    while ((rc = virJSONReaderNextKey(reader, &key)) > 0) {
+        if (depth == 0 && STREQ(key, "device")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                return -1;
+            if (token != VIR_JSON_TOKEN_STRING) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("blockstats device entry was not "
+                                 "in expected format"));
+                return -1;
+            }
+            VIR_FREE(entry->device);
+            if (VIR_STRDUP(entry->device, virJSONReaderGetText(reader)) < 0)
+                return -1;
+        } else if (STREQ(key, "stats")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                return -1;
+            if (token != VIR_JSON_TOKEN_OBJECT_START) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("blockstats stats entry was not "
+                                 "in expected format"));
+                return -1;
+            }
+            if ((nstats = qemuMonitorJSONReadBlockStatsCounters(reader,
+                                                                bstats)) < 0)
+                return -1;
+        } else if (STREQ(key, "parent")) {
+            if (qemuMonitorJSONReadBlockStatsParent(reader, bstats) < 0)
+                return -1;
+        } else if (backingChain && STREQ(key, "backing")) {
+            if (virJSONReaderNext(reader, &token) < 0)
+                return -1;
+            if (token == VIR_JSON_TOKEN_OBJECT_START) {
+                if (qemuMonitorJSONReadOneBlockStats(reader, entry, depth + 1,
+                                                     true) < 0)
+                    return -1;
+            } else if (virJSONReaderSkip(reader) < 0) {
+                return -1;
+            }
+        } else if (virJSONReaderSkip(reader) < 0) {
+            return -1;
+        }
+    }
+
+    if (rc < 0)
+        return -1;
+
+    if (nstats < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("blockstats stats entry was not "
                          "in expected format"));
-        goto cleanup;
+        return -1;
     }
 
-#define QEMU_MONITOR_BLOCK_STAT_GET(NAME, VAR, MANDATORY) \
-    if (MANDATORY || virJSONValueObjectHasKey(stats, NAME)) { \
-        nstats++; \
-        if (virJSONValueObjectGetNumberLong(stats, NAME, &VAR) < 0) { \
-            virReportError(VIR_ERR_INTERNAL_ERROR, \
-                           _("cannot read %s statistic"), NAME); \
-            goto cleanup; \
-        } \
-    }
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_bytes", bstats->rd_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_bytes", bstats->wr_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_operations", bstats->rd_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_operations", bstats->wr_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_total_time_ns", bstats->rd_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_total_time_ns", bstats->wr_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_operations", bstats->flush_req, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_total_time_ns", bstats->flush_total_times, false);
-#undef QEMU_MONITOR_BLOCK_STAT_GET
+    return nstats;
+}
+
+
+static int
+qemuMonitorJSONAddBlockStatsEntry(qemuMonitorJSONBlockStatsEntryPtr entry,
+                                  virHashTablePtr hash)
+{
+    char *entry_name = NULL;
+    size_t i;
 
-    if ((parent = virJSONValueObjectGetObject(dev, "parent")) &&
-        (parentstats = virJSONValueObjectGetObject(parent, "stats"))) {
-        if (virJSONValueObjectGetNumberUlong(parentstats, "wr_highest_offset",
-                                             &bstats->wr_highest_offset) == 0)
-            bstats->wr_highest_offset_valid = true;
+    if (!entry->device) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats device entry was not "
+                         "in expected format"));
+        return -1;
     }
 
-    if (virHashAddEntry(hash, entry_name, bstats) < 0)
-        goto cleanup;
-    bstats = NULL;
+    for (i = 0; i < entry->nstats; i++) {
+        if (!(entry_name = qemuDomainStorageAlias(entry->device, i)))
+            return -1;
 
-    if (backingChain &&
-        (backing = virJSONValueObjectGetObject(dev, "backing")) &&
-        qemuMonitorJSONGetOneBlockStatsInfo(backing, dev_name, depth + 1,
-                                            hash, true) < 0)
-        goto cleanup;
+        if (virHashAddEntry(hash, entry_name, entry->stats[i]) < 0) {
+            VIR_FREE(entry_name);
+            return -1;
+        }
+        entry->stats[i] = NULL;
+        VIR_FREE(entry_name);
+    }
 
-    ret = nstats;
- cleanup:
-    VIR_FREE(bstats);
-    VIR_FREE(entry_name);
-    return ret;
+    return 0;
 }
 
 
@@ -2079,52 +2910,98 @@ qemuMonitorJSONQueryBlockstats(qemuMonitorPtr mon)
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
-{
-    int ret = -1;
+static int
+qemuMonitorJSONBlockStatsReply(const char *reply,
+                               virHashTablePtr hash,
+                               bool backingChain)
+{
+    virJSONReaderPtr reader = NULL;
+    qemuMonitorJSONBlockStatsEntry entry = { 0 };
+    virJSONToken token;
+    const char *key;
+    bool found = false;
     int nstats = 0;
-    int rc;
-    size_t i;
-    virJSONValuePtr devices;
-
-    if (!(devices = qemuMonitorJSONQueryBlockstats(mon)))
-        return -1;
+    int ret = -1;
+    int rc = 0;
 
-    for (i = 0; i < virJSONValueArraySize(devices); i++) {
-        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
-        const char *dev_name;
+    if (!(reader = virJSONReaderNew(reply)) ||
+        virJSONReaderNext(reader, &token) < 0)
+        goto cleanup;
 
-        if (!dev || dev->type != VIR_JSON_TYPE_OBJECT) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats device entry was not "
-                             "in expected format"));
-            goto cleanup;
+    while (!found && (rc = virJSONReaderNextKey(reader, &key)) > 0) {
+        if (STRNEQ(key, "return")) {
+            if (virJSONReaderSkip(reader) < 0)
+                goto cleanup;
+            continue;
         }
 
-        if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats device entry was not "
-                             "in expected format"));
+        if (virJSONReaderNext(reader, &token) < 0)
             goto cleanup;
-        }
 
-        rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
-                                                 backingChain);
+        if (token != VIR_JSON_TOKEN_ARRAY_START)
+            break;
+
+        found = true;
+        while ((rc = virJSONReaderNext(reader, &token)) > 0 &&
+               token != VIR_JSON_TOKEN_ARRAY_END) {
+            if (token != VIR_JSON_TOKEN_OBJECT_START) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("blockstats device entry was not "
+                                 "in expected format"));
+                goto cleanup;
+            }
+
+            if ((rc = qemuMonitorJSONReadOneBlockStats(reader, &entry, 0,
+                                                       backingChain)) < 0 ||
+                qemuMonitorJSONAddBlockStatsEntry(&entry, hash) < 0)
+                goto cleanup;
+
+            qemuMonitorJSONBlockStatsEntryClear(&entry);
+
+            if (rc > nstats)
+                nstats = rc;
+        }
 
         if (rc < 0)
             goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    if (!found) {
+        /* reports the error from QEMU if there was any */
+        if (qemuMonitorJSONCheckRawError("query-blockstats", reply) == 0)
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("query-blockstats reply was missing device list"));
+        goto cleanup;
+    }
+
+    ret = nstats;
+
+ cleanup:
+    qemuMonitorJSONBlockStatsEntryClear(&entry);
+    virJSONReaderFree(reader);
+    return ret;
+}
+
+
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    virHashTablePtr hash,
+                                    bool backingChain)
+{
+    char *reply = NULL;
+    int ret = -1;
 
-        if (rc > nstats)
-            nstats = rc;
-    }
+    if (qemuMonitorJSONCommandRawReply(mon, &reply, "query-blockstats",
+                                       NULL) < 0)
+        goto cleanup;
 
-    ret = nstats;
+    ret = qemuMonitorJSONBlockStatsReply(reply, hash, backingChain);
 
  cleanup:
-    virJSONValueFree(devices);
+    VIR_FREE(reply);
     return ret;
 }
 
@@ -2178,17 +3055,12 @@ qemuMonitorJSONBlockStatsUpdateCapacityOne(virJSONValuePtr image,
 }
 
 
-int
-qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
-                                        virHashTablePtr stats,
-                                        bool backingChain)
+static int
+qemuMonitorJSONBlockStatsUpdateCapacityDevices(virJSONValuePtr devices,
+                                               virHashTablePtr stats,
+                                               bool backingChain)
 {
-    int ret = -1;
     size_t i;
-    virJSONValuePtr devices;
-
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
-        return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev;
@@ -2197,10 +3069,10 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         const char *dev_name;
 
         if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)))
-            goto cleanup;
+            return -1;
 
         if (!(dev_name = qemuMonitorJSONGetBlockDevDevice(dev)))
-            goto cleanup;
+            return -1;
 
         /* drive may be empty */
         if (!(inserted = virJSONValueObjectGetObject(dev, "inserted")) ||
@@ -2210,10 +3082,60 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
                                                        stats,
                                                        backingChain) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr stats,
+                                        bool backingChain)
+{
+    int ret;
+    virJSONValuePtr devices;
+
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, false)))
+        return -1;
+
+    ret = qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, stats,
+                                                         backingChain);
+
+    virJSONValueFree(devices);
+    return ret;
+}
+
+
+/*
+ * Processes the replies to query-blockstats in raw form and query-block
+ * for qemuMonitorJSONGetAllBlockStatsCapacity. Unless @capacityOptional
+ * is true, failure to update the capacity is fatal.
+ */
+static int
+qemuMonitorJSONBlockStatsCapacityReply(const char *statsReply,
+                                       virJSONValuePtr blockReply,
+                                       virHashTablePtr hash,
+                                       bool backingChain,
+                                       bool capacityOptional)
+{
+    virJSONValuePtr devices = NULL;
+    int nstats;
+    int ret = -1;
+
+    if ((nstats = qemuMonitorJSONBlockStatsReply(statsReply, hash,
+                                                 backingChain)) < 0)
+        goto cleanup;
+
+    if (!(devices = qemuMonitorJSONQueryBlockReply(blockReply)) ||
+        qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, hash,
+                                                       backingChain) < 0) {
+        if (!capacityOptional)
             goto cleanup;
     }
 
-    ret = 0;
+    ret = nstats;
 
  cleanup:
     virJSONValueFree(devices);
@@ -2221,6 +3143,99 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
 }
 
 
+/*
+ * Does the job of qemuMonitorJSONGetAllBlockStatsInfo followed by
+ * qemuMonitorJSONBlockStatsUpdateCapacity, but sends both queries to
+ * QEMU at once which saves a round trip.
+ */
+int
+qemuMonitorJSONGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr hash,
+                                        bool backingChain,
+                                        bool capacityOptional)
+{
+    qemuMonitorMessage statsMsg;
+    qemuMonitorMessage blockMsg;
+    qemuMonitorMessagePtr msgs[] = { &statsMsg, &blockMsg };
+    int ret = -1;
+
+    memset(&statsMsg, 0, sizeof(statsMsg));
+    memset(&blockMsg, 0, sizeof(blockMsg));
+    statsMsg.rxRaw = true;
+
+    if (qemuMonitorJSONMessageFormatCommand(mon, &statsMsg,
+                                            "query-blockstats", NULL) < 0 ||
+        qemuMonitorJSONMessageFormatCommand(mon, &blockMsg,
+                                            "query-block", NULL) < 0 ||
+        qemuMonitorJSONMessageSend(mon, msgs, ARRAY_CARDINALITY(msgs)) < 0)
+        goto cleanup;
+
+    if (!statsMsg.rxBuffer || !blockMsg.rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        goto cleanup;
+    }
+
+    ret = qemuMonitorJSONBlockStatsCapacityReply(statsMsg.rxBuffer,
+                                                 blockMsg.rxObject,
+                                                 hash, backingChain,
+                                                 capacityOptional);
+
+ cleanup:
+    /* the first message may have been formatted alone */
+    VIR_FREE(statsMsg.txBuffer);
+    VIR_FREE(statsMsg.txID);
+    VIR_FREE(statsMsg.rxBuffer);
+    virJSONValueFree(blockMsg.rxObject);
+    return ret;
+}
+
+
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetAllBlockStatsCapacityStart(qemuMonitorPtr mon)
+{
+    qemuMonitorCompletionPtr completion;
+    qemuMonitorMessagePtr statsMsg;
+
+    if (!(completion = qemuMonitorCompletionNew(2)))
+        return NULL;
+
+    statsMsg = qemuMonitorCompletionGetMessage(completion, 0);
+    statsMsg->rxRaw = true;
+
+    if (qemuMonitorJSONMessageFormatCommand(mon, statsMsg,
+                                            "query-blockstats", NULL) < 0 ||
+        qemuMonitorJSONMessageFormatCommand(mon,
+                                            qemuMonitorCompletionGetMessage(completion, 1),
+                                            "query-block", NULL) < 0 ||
+        qemuMonitorCompletionSubmit(mon, completion) < 0) {
+        virObjectUnref(completion);
+        return NULL;
+    }
+
+    return completion;
+}
+
+
+int
+qemuMonitorJSONGetAllBlockStatsCapacityFinish(qemuMonitorCompletionPtr completion,
+                                              virHashTablePtr hash,
+                                              bool backingChain,
+                                              bool capacityOptional)
+{
+    const char *statsReply;
+    virJSONValuePtr blockReply;
+
+    if (!(statsReply = qemuMonitorJSONCompletionRawReply(completion, 0)) ||
+        !(blockReply = qemuMonitorJSONCompletionReply(completion, 1)))
+        return -1;
+
+    return qemuMonitorJSONBlockStatsCapacityReply(statsReply, blockReply,
+                                                  hash, backingChain,
+                                                  capacityOptional);
+}
+
+
 /* Return 0 on success, -1 on failure, or -2 if not supported.  Size
  * is in bytes.  */
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
@@ -2712,6 +3727,7 @@ qemuMonitorJSONGetMigrationParams(qemuMonitorPtr mon,
     PARSE_ULONG(maxBandwidth, "max-bandwidth");
     PARSE_ULONG(downtimeLimit, "downtime-limit");
     PARSE_BOOL(blockIncremental, "block-incremental");
+    PARSE_INT(multifdChannels, "x-multifd-channels");
 
 #undef PARSE_SET
 #undef PARSE_INT
@@ -2777,6 +3793,7 @@ qemuMonitorJSONSetMigrationParams(qemuMonitorPtr mon,
     APPEND_ULONG(maxBandwidth, "max-bandwidth");
     APPEND_ULONG(downtimeLimit, "downtime-limit");
     APPEND_BOOL(blockIncremental, "block-incremental");
+    APPEND_INT(multifdChannels, "x-multifd-channels");
 
 #undef APPEND
 #undef APPEND_INT
@@ -3049,6 +4066,46 @@ int qemuMonitorJSONGetMigrationStats(qemuMonitorPtr mon,
 }
 
 
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetMigrationStatsStart(qemuMonitorPtr mon)
+{
+    qemuMonitorCompletionPtr completion;
+
+    if (!(completion = qemuMonitorCompletionNew(1)))
+        return NULL;
+
+    if (qemuMonitorJSONMessageFormatCommand(mon,
+                                            qemuMonitorCompletionGetMessage(completion, 0),
+                                            "query-migrate", NULL) < 0 ||
+        qemuMonitorCompletionSubmit(mon, completion) < 0) {
+        virObjectUnref(completion);
+        return NULL;
+    }
+
+    return completion;
+}
+
+
+int
+qemuMonitorJSONGetMigrationStatsFinish(qemuMonitorCompletionPtr completion,
+                                       qemuMonitorMigrationStatsPtr stats,
+                                       char **error)
+{
+    virJSONValuePtr reply;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (!(reply = qemuMonitorJSONCompletionReply(completion, 0)) ||
+        qemuMonitorJSONCheckReplyError("query-migrate", NULL, reply) < 0 ||
+        qemuMonitorJSONGetMigrationStatsReply(reply, stats, error) < 0) {
+        memset(stats, 0, sizeof(*stats));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int qemuMonitorJSONMigrate(qemuMonitorPtr mon,
                            unsigned int flags,
                            const char *uri)
@@ -3714,22 +4771,16 @@ qemuMonitorJSONGetChardevInfo(qemuMonitorPtr mon,
 
 {
     int ret = -1;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-chardev",
-                                                     NULL);
     virJSONValuePtr reply = NULL;
 
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandCached(mon, "query-chardev", &reply) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+    if (qemuMonitorJSONCheckReplyError("query-chardev", NULL, reply) < 0)
         goto cleanup;
 
     ret = qemuMonitorJSONExtractChardevInfo(reply, info);
  cleanup:
-    virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
@@ -3994,6 +5045,85 @@ qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
     return ret;
 }
 
+/* speed is in bytes/sec.  A non-NULL bitmap requests an incremental
+ * backup of the clusters recorded in that dirty bitmap.  */
+int
+qemuMonitorJSONDriveBackup(qemuMonitorPtr mon, virJSONValuePtr actions,
+                           const char *device, const char *target,
+                           const char *format, const char *bitmap,
+                           unsigned long long speed, bool reuse)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "drive-backup",
+                                        "s:device", device,
+                                        "s:target", target,
+                                        "s:sync", bitmap ? "incremental" : "full",
+                                        "S:bitmap", bitmap,
+                                        "s:mode", reuse ? "existing" : "absolute-paths",
+                                        "S:format", format,
+                                        "Y:speed", speed,
+                                        NULL);
+    if (!cmd)
+        return -1;
+
+    if (actions) {
+        if (virJSONValueArrayAppend(actions, cmd) == 0) {
+            ret = 0;
+            cmd = NULL;
+        }
+    } else {
+        if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+            goto cleanup;
+
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+    }
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+int
+qemuMonitorJSONAddBitmap(qemuMonitorPtr mon, virJSONValuePtr actions,
+                         const char *node, const char *bitmap,
+                         bool persistent)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "block-dirty-bitmap-add",
+                                        "s:node", node,
+                                        "s:name", bitmap,
+                                        "B:persistent", persistent,
+                                        NULL);
+    if (!cmd)
+        return -1;
+
+    if (actions) {
+        if (virJSONValueArrayAppend(actions, cmd) == 0) {
+            ret = 0;
+            cmd = NULL;
+        }
+    } else {
+        if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+            goto cleanup;
+
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+    }
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
 int
 qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
 {
@@ -4153,7 +5283,7 @@ qemuMonitorJSONDiskNameLookup(qemuMonitorPtr mon,
     virJSONValuePtr devices;
     size_t i;
 
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, true)))
         return NULL;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -4385,6 +5515,8 @@ qemuMonitorJSONParseBlockJobInfo(virHashTablePtr blockJobs,
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT;
     else if (STREQ(type, "mirror"))
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
+    else if (STREQ(type, "backup"))
+        info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP;
     else
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
 
@@ -4827,14 +5959,9 @@ int qemuMonitorJSONGetBlockIoThrottle(qemuMonitorPtr mon,
                                       virDomainBlockIoTuneInfoPtr reply)
 {
     int ret = -1;
-    virJSONValuePtr cmd = NULL;
     virJSONValuePtr result = NULL;
 
-    cmd = qemuMonitorJSONMakeCommand("query-block", NULL);
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &result) < 0)
+    if (qemuMonitorJSONCommandCached(mon, "query-block", &result) < 0)
         goto cleanup;
 
     if (virJSONValueObjectHasKey(result, "error")) {
@@ -4852,7 +5979,6 @@ int qemuMonitorJSONGetBlockIoThrottle(qemuMonitorPtr mon,
 
     ret = qemuMonitorJSONBlockIoThrottleInfo(result, device, reply);
  cleanup:
-    virJSONValueFree(cmd);
     virJSONValueFree(result);
     return ret;
 }
@@ -7785,3 +8911,100 @@ qemuMonitorJSONSetWatchdogAction(qemuMonitorPtr mon,
     virJSONValueFree(reply);
     return ret;
 }
+
+
+int
+qemuMonitorJSONStartDirtyRateCalc(qemuMonitorPtr mon,
+                                  int seconds)
+{
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    int ret = -1;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("calc-dirty-rate",
+                                           "i:calc-time", seconds,
+                                           NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+VIR_ENUM_DECL(qemuMonitorDirtyRateStatus)
+VIR_ENUM_IMPL(qemuMonitorDirtyRateStatus,
+              VIR_DOMAIN_DIRTYRATE_LAST,
+              "unstarted",
+              "measuring",
+              "measured")
+
+int
+qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info)
+{
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr data;
+    const char *status;
+    int ret = -1;
+
+    memset(info, 0, sizeof(*info));
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-dirty-rate", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    if (!(data = virJSONValueObjectGetObject(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'return' data"));
+        goto cleanup;
+    }
+
+    if (!(status = virJSONValueObjectGetString(data, "status")) ||
+        (info->status = qemuMonitorDirtyRateStatusTypeFromString(status)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected dirty rate status '%s'"),
+                       NULLSTR(status));
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectGetNumberLong(data, "start-time",
+                                        &info->startTime) < 0 ||
+        virJSONValueObjectGetNumberInt(data, "calc-time",
+                                       &info->calcTime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing timing data"));
+        goto cleanup;
+    }
+
+    /* 'dirty-rate' is only reported once a measurement is complete */
+    if (info->status == VIR_DOMAIN_DIRTYRATE_MEASURED &&
+        virJSONValueObjectGetNumberLong(data, "dirty-rate",
+                                        &info->dirtyRate) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'dirty-rate'"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
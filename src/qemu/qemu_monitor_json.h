@@ -61,7 +61,8 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon);
 int qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                              struct qemuMonitorQueryCpusEntry **entries,
                              size_t *nentries,
-                             bool force);
+                             bool force,
+                             bool fast);
 int qemuMonitorJSONGetVirtType(qemuMonitorPtr mon,
                                virDomainVirtType *virtType);
 int qemuMonitorJSONUpdateVideoMemorySize(qemuMonitorPtr mon,
@@ -76,6 +77,12 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                                   char *balloonpath,
                                   virDomainMemoryStatPtr stats,
                                   unsigned int nr_stats);
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetMemoryStatsStart(qemuMonitorPtr mon,
+                                   char *balloonpath);
+int qemuMonitorJSONGetMemoryStatsFinish(qemuMonitorCompletionPtr completion,
+                                        virDomainMemoryStatPtr stats,
+                                        unsigned int nr_stats);
 int qemuMonitorJSONSetMemoryStatsPeriod(qemuMonitorPtr mon,
                                         char *balloonpath,
                                         int period);
@@ -89,6 +96,17 @@ int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                             virHashTablePtr stats,
                                             bool backingChain);
+int qemuMonitorJSONGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                            virHashTablePtr hash,
+                                            bool backingChain,
+                                            bool capacityOptional);
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetAllBlockStatsCapacityStart(qemuMonitorPtr mon);
+int
+qemuMonitorJSONGetAllBlockStatsCapacityFinish(qemuMonitorCompletionPtr completion,
+                                              virHashTablePtr hash,
+                                              bool backingChain,
+                                              bool capacityOptional);
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
                                const char *devce,
                                unsigned long long size);
@@ -143,6 +161,12 @@ int qemuMonitorJSONSetMigrationParams(qemuMonitorPtr mon,
 int qemuMonitorJSONGetMigrationStats(qemuMonitorPtr mon,
                                      qemuMonitorMigrationStatsPtr stats,
                                      char **error);
+qemuMonitorCompletionPtr
+qemuMonitorJSONGetMigrationStatsStart(qemuMonitorPtr mon);
+int
+qemuMonitorJSONGetMigrationStatsFinish(qemuMonitorCompletionPtr completion,
+                                       qemuMonitorMigrationStatsPtr stats,
+                                       char **error);
 
 int qemuMonitorJSONGetMigrationCapabilities(qemuMonitorPtr mon,
                                             char ***capabilities);
@@ -252,6 +276,21 @@ int qemuMonitorJSONDiskSnapshot(qemuMonitorPtr mon,
     ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5);
 int qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int qemuMonitorJSONDriveBackup(qemuMonitorPtr mon,
+                               virJSONValuePtr actions,
+                               const char *device,
+                               const char *target,
+                               const char *format,
+                               const char *bitmap,
+                               unsigned long long speed,
+                               bool reuse)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorJSONAddBitmap(qemuMonitorPtr mon,
+                             virJSONValuePtr actions,
+                             const char *node,
+                             const char *bitmap,
+                             bool persistent)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
 int qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
                                const char *device,
                                const char *file,
@@ -527,4 +566,12 @@ virJSONValuePtr qemuMonitorJSONQueryNamedBlockNodes(qemuMonitorPtr mon)
 int qemuMonitorJSONSetWatchdogAction(qemuMonitorPtr mon,
                                      const char *action)
     ATTRIBUTE_NONNULL(1);
+
+int qemuMonitorJSONStartDirtyRateCalc(qemuMonitorPtr mon,
+                                      int seconds)
+    ATTRIBUTE_NONNULL(1);
+
+int qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                                  qemuMonitorDirtyRateInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 #endif /* QEMU_MONITOR_JSON_H */
@@ -36,6 +36,7 @@
 #include "qemu_processpriv.h"
 #include "qemu_alias.h"
 #include "qemu_block.h"
+#include "qemu_blockjob.h"
 #include "qemu_domain.h"
 #include "qemu_domain_address.h"
 #include "qemu_cgroup.h"
@@ -64,6 +65,7 @@
 #include "viruuid.h"
 #include "virprocess.h"
 #include "virtime.h"
+#include "virprobe.h"
 #include "virnetdevtap.h"
 #include "virnetdevopenvswitch.h"
 #include "virnetdevmidonet.h"
@@ -78,6 +80,10 @@
 #include "nwfilter_conf.h"
 #include "netdev_bandwidth_conf.h"
 
+#ifdef WITH_DTRACE_PROBES
+# include "libvirt_qemu_probes.h"
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
 VIR_LOG_INIT("qemu.qemu_process");
@@ -301,7 +307,7 @@ qemuProcessHandleMonitorEOF(qemuMonitorPtr mon,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         VIR_FREE(processEvent);
         goto cleanup;
@@ -351,17 +357,12 @@ virDomainDiskDefPtr
 qemuProcessFindDomainDiskByAlias(virDomainObjPtr vm,
                                  const char *alias)
 {
-    size_t i;
+    virDomainDiskDefPtr disk;
 
     alias = qemuAliasDiskDriveSkipPrefix(alias);
 
-    for (i = 0; i < vm->def->ndisks; i++) {
-        virDomainDiskDefPtr disk;
-
-        disk = vm->def->disks[i];
-        if (disk->info.alias != NULL && STREQ(disk->info.alias, alias))
-            return disk;
-    }
+    if ((disk = virDomainDiskByAlias(vm->def, alias)))
+        return disk;
 
     virReportError(VIR_ERR_INTERNAL_ERROR,
                    _("no disk found with alias %s"),
@@ -483,7 +484,6 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event;
     qemuDomainObjPrivatePtr priv;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
 
     virObjectLock(vm);
@@ -493,7 +493,7 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (priv->agent)
         qemuAgentNotifyEvent(priv->agent, QEMU_AGENT_EVENT_RESET);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     if (vm->def->onReboot == VIR_DOMAIN_LIFECYCLE_ACTION_DESTROY ||
@@ -520,7 +520,6 @@ qemuProcessHandleReset(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  cleanup:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -540,7 +539,6 @@ qemuProcessFakeReboot(void *opaque)
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virQEMUDriverPtr driver = priv->driver;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainRunningReason reason = VIR_DOMAIN_RUNNING_BOOTED;
     int ret = -1, rc;
 
@@ -580,7 +578,7 @@ qemuProcessFakeReboot(void *opaque)
                                      VIR_DOMAIN_EVENT_RESUMED,
                                      VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainObjSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -595,7 +593,6 @@ qemuProcessFakeReboot(void *opaque)
         ignore_value(qemuProcessKill(vm, VIR_QEMU_PROCESS_KILL_FORCE));
     virDomainObjEndAPI(&vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 }
 
 
@@ -658,7 +655,6 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     qemuDomainObjPrivatePtr priv;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int detail = 0;
 
     VIR_DEBUG("vm=%p", vm);
@@ -701,7 +697,7 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                               VIR_DOMAIN_EVENT_SHUTDOWN,
                                               detail);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainObjSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -714,7 +710,6 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -729,7 +724,6 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectEventPtr event = NULL;
     virDomainPausedReason reason = VIR_DOMAIN_PAUSED_UNKNOWN;
     virDomainEventSuspendedDetailType detail = VIR_DOMAIN_EVENT_SUSPENDED_PAUSED;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING) {
@@ -770,7 +764,7 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjFlushStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -779,7 +773,6 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -792,7 +785,6 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED) {
@@ -812,7 +804,7 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                          VIR_DOMAIN_EVENT_RESUMED,
                                          VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -821,7 +813,6 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
  unlock:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -833,7 +824,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
 
@@ -856,7 +846,7 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         offset += vm->def->clock.data.variable.adjustment0;
         vm->def->clock.data.variable.adjustment = offset;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjSaveStatus(driver, vm) < 0)
            VIR_WARN("unable to save domain status with RTC change");
     }
 
@@ -865,7 +855,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -879,7 +868,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr watchdogEvent = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     watchdogEvent = virDomainEventWatchdogNewFromObj(vm, action);
@@ -899,7 +887,7 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjFlushStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after watchdog event",
                      vm->def->name);
         }
@@ -915,7 +903,7 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
              * deleted before handling watchdog event is finished.
              */
             virObjectRef(vm);
-            if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+            if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
                 if (!virObjectUnref(vm))
                     vm = NULL;
                 VIR_FREE(processEvent);
@@ -928,7 +916,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     qemuDomainEventQueue(driver, watchdogEvent);
     qemuDomainEventQueue(driver, lifecycleEvent);
 
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -948,7 +935,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     const char *srcPath;
     const char *devAlias;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias);
@@ -982,7 +968,7 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainObjFlushStatus(driver, vm) < 0)
             VIR_WARN("Unable to save status on vm %s after IO error", vm->def->name);
     }
     virObjectUnlock(vm);
@@ -990,7 +976,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     qemuDomainEventQueue(driver, ioErrorEvent);
     qemuDomainEventQueue(driver, ioErrorEvent2);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1017,6 +1002,8 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         goto error;
     diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
 
+    qemuBlockJobInfoInvalidate(vm);
+
     if (diskPriv->blockJobSync) {
         /* We have a SYNC API waiting for this event, dispatch it back */
         diskPriv->blockJobType = type;
@@ -1036,7 +1023,7 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         processEvent->status = status;
 
         virObjectRef(vm);
-        if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+        if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
             ignore_value(virObjectUnref(vm));
             goto error;
         }
@@ -1149,7 +1136,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, devAlias);
@@ -1164,7 +1150,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after tray moved event",
                      vm->def->name);
         }
@@ -1174,7 +1160,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1186,7 +1171,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMWakeupNewFromObj(vm);
@@ -1204,7 +1188,7 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                   VIR_DOMAIN_EVENT_STARTED,
                                                   VIR_DOMAIN_EVENT_STARTED_WAKEUP);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after wakeup event",
                      vm->def->name);
         }
@@ -1213,7 +1197,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1225,7 +1208,6 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendNewFromObj(vm);
@@ -1242,7 +1224,7 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_MEMORY);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1255,7 +1237,6 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1267,7 +1248,6 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventBalloonChangeNewFromObj(vm, actual);
@@ -1276,13 +1256,12 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save domain status with balloon change");
 
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1294,7 +1273,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virObjectEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendDiskNewFromObj(vm);
@@ -1311,7 +1289,7 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_DISK);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainObjSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1324,7 +1302,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     qemuDomainEventQueue(driver, event);
     qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -1351,7 +1328,7 @@ qemuProcessHandleGuestPanic(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
      * deleted before handling guest panic event is finished.
      */
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
         if (!virObjectUnref(vm))
             vm = NULL;
         VIR_FREE(processEvent);
@@ -1394,7 +1371,7 @@ qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -1487,10 +1464,13 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                 void *opaque)
 {
     virQEMUDriverPtr driver = opaque;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    struct qemuProcessEvent *processEvent = NULL;
     virObjectEventPtr event = NULL;
     virDomainDiskDefPtr disk;
     virStorageSourcePtr src;
     unsigned int idx;
+    char *data = NULL;
     char *dev = NULL;
     const char *path = NULL;
 
@@ -1509,10 +1489,30 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                            threshold, excess);
             VIR_FREE(dev);
         }
+
+        /* let the worker grow the volume and arm the next threshold */
+        if (src == disk->src && qemuProcessDiskThinExtendWanted(cfg, disk) &&
+            VIR_ALLOC(processEvent) == 0) {
+            if (VIR_STRDUP(data, disk->dst) < 0) {
+                VIR_FREE(processEvent);
+            } else {
+                processEvent->eventType = QEMU_PROCESS_EVENT_BLOCK_THRESHOLD;
+                processEvent->data = data;
+                processEvent->vm = vm;
+
+                virObjectRef(vm);
+                if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
+                    ignore_value(virObjectUnref(vm));
+                    VIR_FREE(data);
+                    VIR_FREE(processEvent);
+                }
+            }
+        }
     }
 
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
+    virObjectUnref(cfg);
 
     return 0;
 }
@@ -1543,7 +1543,7 @@ qemuProcessHandleNicRxFilterChanged(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -1586,7 +1586,7 @@ qemuProcessHandleSerialChanged(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuDomainProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -1678,6 +1678,12 @@ qemuProcessHandleMigrationPass(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    /* Keeps the iteration count reported for the job current without
+     * asking QEMU for complete statistics */
+    priv->job.current->stats.ram_iteration = pass;
+    /* Wake up the migration thread so that it can check convergence */
+    virDomainObjBroadcast(vm);
+
     qemuDomainEventQueue(driver,
                          virDomainEventMigrationIterationNewFromObj(vm, pass));
 
@@ -2467,14 +2473,84 @@ qemuProcessSetupPid(virDomainObjPtr vm,
 }
 
 
+/**
+ * qemuProcessGetHousekeepingCpus:
+ * @vm: domain object
+ * @cpumask: filled with the CPUs for the housekeeping threads of @vm
+ *
+ * Computes where the emulator and I/O threads of @vm are placed when they
+ * are not pinned explicitly: the housekeeping CPUs set in qemu.conf except
+ * for those any vCPU of @vm is pinned to.  If that leaves nothing, all the
+ * housekeeping CPUs are used.  @cpumask is set to NULL if no housekeeping
+ * CPUs are configured.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuProcessGetHousekeepingCpus(virDomainObjPtr vm,
+                               virBitmapPtr *cpumask)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(priv->driver);
+    virBitmapPtr ret = NULL;
+    size_t i;
+
+    *cpumask = NULL;
+
+    if (!cfg->housekeepingCpus) {
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    if (!(ret = virBitmapNewCopy(cfg->housekeepingCpus)))
+        goto error;
+
+    for (i = 0; i < virDomainDefGetVcpusMax(vm->def); i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        if (vcpu->online && vcpu->cpumask)
+            virBitmapSubtract(ret, vcpu->cpumask);
+    }
+
+    if (virBitmapIsAllClear(ret)) {
+        VIR_WARN("All housekeeping CPUs are used by vCPUs of domain %s",
+                 vm->def->name);
+        virBitmapFree(ret);
+        if (!(ret = virBitmapNewCopy(cfg->housekeepingCpus)))
+            goto error;
+    }
+
+    virObjectUnref(cfg);
+    *cpumask = ret;
+    return 0;
+
+ error:
+    virObjectUnref(cfg);
+    return -1;
+}
+
+
 static int
 qemuProcessSetupEmulator(virDomainObjPtr vm)
 {
-    return qemuProcessSetupPid(vm, vm->pid, VIR_CGROUP_THREAD_EMULATOR,
-                               0, vm->def->cputune.emulatorpin,
-                               vm->def->cputune.emulator_period,
-                               vm->def->cputune.emulator_quota,
-                               NULL);
+    virBitmapPtr housekeeping = NULL;
+    virBitmapPtr cpumask = vm->def->cputune.emulatorpin;
+    int ret;
+
+    if (!cpumask) {
+        if (qemuProcessGetHousekeepingCpus(vm, &housekeeping) < 0)
+            return -1;
+        cpumask = housekeeping;
+    }
+
+    ret = qemuProcessSetupPid(vm, vm->pid, VIR_CGROUP_THREAD_EMULATOR,
+                              0, cpumask,
+                              vm->def->cputune.emulator_period,
+                              vm->def->cputune.emulator_quota,
+                              NULL);
+
+    virBitmapFree(housekeeping);
+    return ret;
 }
 
 
@@ -2602,11 +2678,9 @@ qemuProcessUpdateVideoRamSize(virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
                               int asyncJob)
 {
-    int ret = -1;
     ssize_t i;
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainVideoDefPtr video = NULL;
-    virQEMUDriverConfigPtr cfg = NULL;
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
@@ -2663,11 +2737,7 @@ qemuProcessUpdateVideoRamSize(virQEMUDriverPtr driver,
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         return -1;
 
-    cfg = virQEMUDriverGetConfig(driver);
-    ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps);
-    virObjectUnref(cfg);
-
-    return ret;
+    return qemuDomainObjSaveStatus(driver, vm);
 
  error:
     ignore_value(qemuDomainObjExitMonitor(driver, vm));
@@ -2680,6 +2750,7 @@ struct qemuProcessHookData {
     virDomainObjPtr vm;
     virQEMUDriverPtr driver;
     virQEMUDriverConfigPtr cfg;
+    qemuDomainDevTemplatePtr devTemplate;
 };
 
 static int qemuProcessHook(void *data)
@@ -2720,7 +2791,8 @@ static int qemuProcessHook(void *data)
     if (qemuSecurityClearSocketLabel(h->driver->securityManager, h->vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainBuildNamespace(h->cfg, h->driver->securityManager, h->vm) < 0)
+    if (qemuDomainBuildNamespace(h->cfg, h->driver->securityManager,
+                                 h->devTemplate, h->vm) < 0)
         goto cleanup;
 
     if (virDomainNumatuneGetMode(h->vm->def->numa, -1, &mode) == 0) {
@@ -3246,6 +3318,162 @@ qemuProcessUpdateDevices(virQEMUDriverPtr driver,
     return ret;
 }
 
+/*
+ * Find the resctrl allocation the threads of vCPU @vcpuid belong to, or
+ * the domain-wide allocation if @vcpuid is -1.
+ */
+static virResctrlAllocPtr
+qemuProcessResctrlGetAlloc(virDomainDefPtr def,
+                           ssize_t vcpuid)
+{
+    virResctrlAllocPtr alloc = NULL;
+    size_t i;
+
+    for (i = 0; i < def->nresctrls; i++) {
+        virDomainResctrlDefPtr ct = def->resctrls[i];
+
+        if (virResctrlAllocIsEmpty(ct->alloc))
+            continue;
+
+        if (!ct->vcpus)
+            alloc = ct->alloc;
+        else if (vcpuid >= 0 && virBitmapIsBitSet(ct->vcpus, vcpuid))
+            return ct->alloc;
+    }
+
+    return alloc;
+}
+
+
+bool
+qemuProcessResctrlMonitorWanted(virDomainDefPtr def)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (def->perf.events[i] == VIR_TRISTATE_BOOL_YES &&
+            qemuDomainPerfEventResctrlType(i) >= 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+qemuProcessResctrlMonitorSetupVcpu(virDomainObjPtr vm,
+                                   unsigned int vcpuid)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, vcpuid);
+    qemuDomainVcpuPrivatePtr vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
+    pid_t vcpupid = qemuDomainGetVcpuPid(vm, vcpuid);
+    char *id = NULL;
+    int ret = -1;
+
+    if (!priv->monitor || vcpupid <= 0)
+        return 0;
+
+    if (!vcpupriv->monitor) {
+        if (!(vcpupriv->monitor = virResctrlMonitorNew()) ||
+            virAsprintf(&id, "vcpu%u", vcpuid) < 0 ||
+            virResctrlMonitorSetID(vcpupriv->monitor, id) < 0)
+            goto cleanup;
+    }
+
+    if (virResctrlMonitorCreate(vcpupriv->monitor,
+                                qemuProcessResctrlGetAlloc(vm->def, vcpuid),
+                                priv->machineName) < 0 ||
+        virResctrlMonitorAddPID(vcpupriv->monitor, vcpupid) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(id);
+    return ret;
+}
+
+
+/**
+ * qemuProcessResctrlMonitorStart:
+ * @vm: domain object
+ *
+ * Put each vCPU thread of @vm into its own resctrl monitoring group and
+ * all the other threads into a common one.  Already existing groups are
+ * reused.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuProcessResctrlMonitorStart(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
+    pid_t *pids = NULL;
+    size_t npids = 0;
+    size_t i;
+    int ret = -1;
+
+    if (priv->monitor)
+        return 0;
+
+    if (!(priv->monitor = virResctrlMonitorNew()) ||
+        virResctrlMonitorSetID(priv->monitor, "emulator") < 0 ||
+        virResctrlMonitorCreate(priv->monitor,
+                                qemuProcessResctrlGetAlloc(vm->def, -1),
+                                priv->machineName) < 0)
+        goto cleanup;
+
+    /* Unlike cgroups, resctrl groups work on threads rather than processes */
+    if (virProcessGetPids(vm->pid, &npids, &pids) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npids; i++) {
+        if (virResctrlMonitorAddPID(priv->monitor, pids[i]) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < maxvcpus; i++) {
+        if (qemuProcessResctrlMonitorSetupVcpu(vm, i) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (ret < 0)
+        qemuProcessResctrlMonitorStop(vm);
+    VIR_FREE(pids);
+    return ret;
+}
+
+
+void
+qemuProcessResctrlMonitorStop(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
+    size_t i;
+
+    for (i = 0; i < maxvcpus; i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+        qemuDomainVcpuPrivatePtr vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
+
+        if (!vcpupriv->monitor)
+            continue;
+
+        ignore_value(virResctrlMonitorRemove(vcpupriv->monitor));
+        virObjectUnref(vcpupriv->monitor);
+        vcpupriv->monitor = NULL;
+    }
+
+    if (priv->monitor) {
+        ignore_value(virResctrlMonitorRemove(priv->monitor));
+        virObjectUnref(priv->monitor);
+        priv->monitor = NULL;
+    }
+}
+
+
 static int
 qemuDomainPerfRestart(virDomainObjPtr vm)
 {
@@ -3258,7 +3486,8 @@ qemuDomainPerfRestart(virDomainObjPtr vm)
 
     for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
         if (def->perf.events[i] &&
-            def->perf.events[i] == VIR_TRISTATE_BOOL_YES) {
+            def->perf.events[i] == VIR_TRISTATE_BOOL_YES &&
+            qemuDomainPerfEventResctrlType(i) < 0) {
 
             /* Failure to re-enable the perf event should not be fatal */
             if (virPerfEventEnable(priv->perf, i, vm->pid) < 0)
@@ -3266,6 +3495,27 @@ qemuDomainPerfRestart(virDomainObjPtr vm)
         }
     }
 
+    for (i = 0; i < virDomainDefGetVcpusMax(def); i++) {
+        pid_t vcpupid = qemuDomainGetVcpuPid(vm, i);
+
+        if (!virDomainDefGetVcpu(def, i)->online || vcpupid <= 0)
+            continue;
+
+        if (virPerfAddThread(priv->perf, i, vcpupid) < 0)
+            VIR_WARN("Unable to count perf events of vCPU %zu of domain %s",
+                     i, def->name);
+    }
+
+    if (qemuProcessResctrlMonitorWanted(def) &&
+        qemuProcessResctrlMonitorStart(vm) < 0) {
+        VIR_WARN("Unable to restart resctrl monitoring of domain %s",
+                 def->name);
+        for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+            if (qemuDomainPerfEventResctrlType(i) >= 0)
+                def->perf.events[i] = VIR_TRISTATE_BOOL_NO;
+        }
+    }
+
     return 0;
 }
 
@@ -4674,6 +4924,38 @@ qemuProcessStartValidateDisks(virDomainObjPtr vm,
 }
 
 
+/* Validating the whole definition gets expensive with many devices and
+ * is pointless when the very same definition is started again with the
+ * same capabilities, e.g. when a crashed domain is restarted. The
+ * validation only depends on the definition and the QEMU capabilities. */
+static int
+qemuProcessStartValidateDef(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            virQEMUCapsPtr qemuCaps,
+                            virCapsPtr caps)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned int capsSerial = virQEMUCapsGetSerial(qemuCaps);
+
+    if (vm->defGeneration &&
+        priv->validatedDefGeneration == vm->defGeneration &&
+        priv->validatedQEMUCapsSerial == capsSerial) {
+        VIR_DEBUG("Definition of %s was validated already", vm->def->name);
+        return 0;
+    }
+
+    qemuDomainObjClearValidated(priv);
+
+    if (virDomainDefValidate(vm->def, caps, 0, driver->xmlopt) < 0)
+        return -1;
+
+    priv->validatedDefGeneration = vm->defGeneration;
+    priv->validatedQEMUCapsSerial = capsSerial;
+
+    return 0;
+}
+
+
 static int
 qemuProcessStartValidateXML(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
@@ -4696,7 +4978,7 @@ qemuProcessStartValidateXML(virQEMUDriverPtr driver,
      * VM that was running before (migration, snapshots, save). It's more
      * important to start such VM than keep the configuration clean */
     if ((flags & VIR_QEMU_PROCESS_START_NEW) &&
-        virDomainDefValidate(vm->def, caps, 0, driver->xmlopt) < 0)
+        qemuProcessStartValidateDef(driver, vm, qemuCaps, caps) < 0)
         return -1;
 
     return 0;
@@ -4771,6 +5053,46 @@ qemuProcessStartValidate(virQEMUDriverPtr driver,
 }
 
 
+static unsigned long long
+qemuProcessStartPhaseBegin(void)
+{
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMicrosNowRaw(&now));
+    return now;
+}
+
+
+/**
+ * qemuProcessStartPhaseEnd:
+ * @vm: domain being started
+ * @phase: phase of startup which just finished
+ * @begin: value returned by qemuProcessStartPhaseBegin()
+ *
+ * Accounts the time since @begin to @phase of the startup of @vm.
+ */
+static void
+qemuProcessStartPhaseEnd(virDomainObjPtr vm,
+                         qemuDomainStartPhase phase,
+                         unsigned long long begin)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now = 0;
+    unsigned long long usecs = 0;
+
+    if (begin &&
+        virTimeMicrosNowRaw(&now) == 0 &&
+        now > begin)
+        usecs = now - begin;
+
+    priv->startPhases[phase] += usecs;
+
+    PROBE(QEMU_PROCESS_START_PHASE,
+          "vm=%p name=%s phase=%s usecs=%llu",
+          vm, vm->def->name, qemuDomainStartPhaseTypeToString(phase), usecs);
+}
+
+
 /**
  * qemuProcessInit:
  *
@@ -4803,6 +5125,8 @@ qemuProcessInit(virQEMUDriverPtr driver,
 
     VIR_DEBUG("Beginning VM startup process");
 
+    memset(priv->startPhases, 0, sizeof(priv->startPhases));
+
     if (virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                        _("VM is already active"));
@@ -4952,14 +5276,52 @@ int
 qemuProcessSetupVcpu(virDomainObjPtr vm,
                      unsigned int vcpuid)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(priv->driver);
     pid_t vcpupid = qemuDomainGetVcpuPid(vm, vcpuid);
     virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, vcpuid);
+    virBitmapPtr hostcpus = NULL;
+    virBitmapPtr cpumask = vcpu->cpumask;
+    size_t i;
+    int rc;
+
+    /* The vCPU threads would otherwise inherit the placement of the
+     * emulator thread, which is confined to the housekeeping CPUs. */
+    if (!cpumask && cfg->housekeepingCpus && !vm->def->cpumask &&
+        vm->def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO &&
+        virHostCPUHasBitmap()) {
+        if (!(hostcpus = virHostCPUGetOnlineBitmap())) {
+            virObjectUnref(cfg);
+            return -1;
+        }
+        cpumask = hostcpus;
+    }
+    virObjectUnref(cfg);
+
+    rc = qemuProcessSetupPid(vm, vcpupid, VIR_CGROUP_THREAD_VCPU,
+                             vcpuid, cpumask,
+                             vm->def->cputune.period,
+                             vm->def->cputune.quota,
+                             &vcpu->sched);
+    virBitmapFree(hostcpus);
+    if (rc < 0)
+        return -1;
 
-    return qemuProcessSetupPid(vm, vcpupid, VIR_CGROUP_THREAD_VCPU,
-                               vcpuid, vcpu->cpumask,
-                               vm->def->cputune.period,
-                               vm->def->cputune.quota,
-                               &vcpu->sched);
+    for (i = 0; i < vm->def->nresctrls; i++) {
+        virDomainResctrlDefPtr ct = vm->def->resctrls[i];
+
+        if (ct->vcpus && virBitmapIsBitSet(ct->vcpus, vcpuid)) {
+            if (!virResctrlAllocIsEmpty(ct->alloc) &&
+                virResctrlAllocAddPID(ct->alloc, vcpupid) < 0)
+                return -1;
+            break;
+        }
+    }
+
+    if (priv->perf && virPerfAddThread(priv->perf, vcpuid, vcpupid) < 0)
+        return -1;
+
+    return qemuProcessResctrlMonitorSetupVcpu(vm, vcpuid);
 }
 
 
@@ -5016,14 +5378,26 @@ int
 qemuProcessSetupIOThread(virDomainObjPtr vm,
                          virDomainIOThreadIDDefPtr iothread)
 {
+    virBitmapPtr housekeeping = NULL;
+    virBitmapPtr cpumask = iothread->cpumask;
+    int ret;
+
+    if (!cpumask) {
+        if (qemuProcessGetHousekeepingCpus(vm, &housekeeping) < 0)
+            return -1;
+        cpumask = housekeeping;
+    }
 
-    return qemuProcessSetupPid(vm, iothread->thread_id,
-                               VIR_CGROUP_THREAD_IOTHREAD,
-                               iothread->iothread_id,
-                               iothread->cpumask,
-                               vm->def->cputune.iothread_period,
-                               vm->def->cputune.iothread_quota,
-                               &iothread->sched);
+    ret = qemuProcessSetupPid(vm, iothread->thread_id,
+                              VIR_CGROUP_THREAD_IOTHREAD,
+                              iothread->iothread_id,
+                              cpumask,
+                              vm->def->cputune.iothread_period,
+                              vm->def->cputune.iothread_quota,
+                              &iothread->sched);
+
+    virBitmapFree(housekeeping);
+    return ret;
 }
 
 
@@ -5294,9 +5668,12 @@ qemuProcessPrepareDomainNUMAPlacement(virDomainObjPtr vm,
                                       virCapsPtr caps)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
     char *nodeset = NULL;
     virBitmapPtr numadNodeset = NULL;
     virBitmapPtr hostMemoryNodeset = NULL;
+    unsigned long long hugepage_size = 0;
+    size_t i;
     int ret = -1;
 
     /* Get the advisory nodeset from numad if 'placement' of
@@ -5305,8 +5682,21 @@ qemuProcessPrepareDomainNUMAPlacement(virDomainObjPtr vm,
     if (!virDomainDefNeedsPlacementAdvice(vm->def))
         return 0;
 
+    /* Let the placement account for free huge pages of the size backing
+     * the domain memory rather than for free memory */
+    if (vm->def->mem.nhugepages) {
+        hugepage_size = vm->def->mem.hugepages[0].size;
+
+        cfg = virQEMUDriverGetConfig(priv->driver);
+        for (i = 0; !hugepage_size && i < cfg->nhugetlbfs; i++) {
+            if (cfg->hugetlbfs[i].deflt)
+                hugepage_size = cfg->hugetlbfs[i].size;
+        }
+    }
+
     nodeset = virNumaGetAutoPlacementAdvice(virDomainDefGetVcpus(vm->def),
-                                            virDomainDefGetMemoryTotal(vm->def));
+                                            virDomainDefGetMemoryTotal(vm->def),
+                                            hugepage_size);
 
     if (!nodeset)
         goto cleanup;
@@ -5314,7 +5704,7 @@ qemuProcessPrepareDomainNUMAPlacement(virDomainObjPtr vm,
     if (!(hostMemoryNodeset = virNumaGetHostMemoryNodeset()))
         goto cleanup;
 
-    VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
+    VIR_DEBUG("Advisory nodeset: %s", nodeset);
 
     if (virBitmapParse(nodeset, &numadNodeset, VIR_DOMAIN_CPUMASK_LEN) < 0)
         goto cleanup;
@@ -5335,6 +5725,7 @@ qemuProcessPrepareDomainNUMAPlacement(virDomainObjPtr vm,
     VIR_FREE(nodeset);
     virBitmapFree(numadNodeset);
     virBitmapFree(hostMemoryNodeset);
+    virObjectUnref(cfg);
     return ret;
 }
 
@@ -5373,6 +5764,197 @@ qemuProcessPrepareDomainStorage(virConnectPtr conn,
 }
 
 
+typedef struct _qemuProcessIOThreadDev qemuProcessIOThreadDev;
+struct _qemuProcessIOThreadDev {
+    unsigned int *iothread;
+    int node;
+};
+
+
+static int
+qemuProcessIOThreadDevCompare(const void *a,
+                              const void *b)
+{
+    const qemuProcessIOThreadDev *deva = a;
+    const qemuProcessIOThreadDev *devb = b;
+
+    return deva->node - devb->node;
+}
+
+
+static int
+qemuProcessGetDiskNUMANode(virDomainDiskDefPtr disk)
+{
+    if (!virStorageSourceIsLocalStorage(disk->src) || !disk->src->path)
+        return -1;
+
+    return virFileGetNUMANode(disk->src->path);
+}
+
+
+/**
+ * qemuProcessPrepareDomainIOThreads:
+ * @vm: domain object
+ * @caps: host capabilities
+ * @cfg: driver configuration
+ *
+ * With auto_iothreads enabled in qemu.conf, size the queues of virtio-blk
+ * disks and virtio-scsi controllers that don't set them to the number of
+ * vCPUs.  If the domain has no IOThreads at all, also create up to one
+ * IOThread per vCPU and spread the virtio-blk disks and virtio-scsi
+ * controllers across them, keeping devices on the same host NUMA node
+ * together.  An IOThread whose devices all sit on one node is pinned to
+ * that node's CPUs, unless housekeeping_cpus takes care of its placement.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuProcessPrepareDomainIOThreads(virDomainObjPtr vm,
+                                  virCapsPtr caps,
+                                  virQEMUDriverConfigPtr cfg)
+{
+    virDomainDefPtr def = vm->def;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned int nvcpus = virDomainDefGetVcpus(def);
+    qemuProcessIOThreadDev *devs = NULL;
+    size_t ndevs = 0;
+    size_t niothreads;
+    virBitmapPtr nodemask = NULL;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (!cfg->autoIOThreads)
+        return 0;
+
+    for (i = 0; nvcpus > 1 && i < def->ndisks; i++) {
+        virDomainDiskDefPtr disk = def->disks[i];
+
+        if (disk->bus == VIR_DOMAIN_DISK_BUS_VIRTIO && !disk->queues &&
+            virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_VIRTIO_BLK_NUM_QUEUES))
+            disk->queues = nvcpus;
+    }
+
+    for (i = 0; nvcpus > 1 && i < def->ncontrollers; i++) {
+        virDomainControllerDefPtr cont = def->controllers[i];
+
+        if (cont->type == VIR_DOMAIN_CONTROLLER_TYPE_SCSI &&
+            cont->model == VIR_DOMAIN_CONTROLLER_MODEL_SCSI_VIRTIO_SCSI &&
+            !cont->queues)
+            cont->queues = nvcpus;
+    }
+
+    if (def->niothreadids > 0 ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_OBJECT_IOTHREAD))
+        return 0;
+
+    if (VIR_ALLOC_N(devs, def->ndisks + def->ncontrollers) < 0)
+        goto cleanup;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainDiskDefPtr disk = def->disks[i];
+
+        if (disk->bus != VIR_DOMAIN_DISK_BUS_VIRTIO || disk->iothread ||
+            (disk->info.type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI &&
+             disk->info.type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_CCW))
+            continue;
+
+        devs[ndevs].iothread = &disk->iothread;
+        devs[ndevs++].node = qemuProcessGetDiskNUMANode(disk);
+    }
+
+    for (i = 0; i < def->ncontrollers; i++) {
+        virDomainControllerDefPtr cont = def->controllers[i];
+        int node = -1;
+
+        if (cont->type != VIR_DOMAIN_CONTROLLER_TYPE_SCSI ||
+            cont->model != VIR_DOMAIN_CONTROLLER_MODEL_SCSI_VIRTIO_SCSI ||
+            cont->iothread ||
+            (cont->info.type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI &&
+             cont->info.type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_CCW) ||
+            !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_VIRTIO_SCSI_IOTHREAD))
+            continue;
+
+        /* a controller goes with the first of its disks we can place */
+        for (j = 0; node < 0 && j < def->ndisks; j++) {
+            virDomainDiskDefPtr disk = def->disks[j];
+
+            if (disk->bus == VIR_DOMAIN_DISK_BUS_SCSI &&
+                disk->info.type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_DRIVE &&
+                disk->info.addr.drive.controller == cont->idx)
+                node = qemuProcessGetDiskNUMANode(disk);
+        }
+
+        devs[ndevs].iothread = &cont->iothread;
+        devs[ndevs++].node = node;
+    }
+
+    if (ndevs == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    niothreads = MIN(ndevs, nvcpus);
+    VIR_DEBUG("Spreading %zu devices across %zu IOThreads", ndevs, niothreads);
+
+    for (i = 0; i < niothreads; i++) {
+        if (!virDomainIOThreadIDAdd(def, i + 1))
+            goto cleanup;
+    }
+
+    /* Hand out consecutive runs of the devices sorted by node, so that
+     * an IOThread serves devices of as few nodes as possible.  */
+    qsort(devs, ndevs, sizeof(*devs), qemuProcessIOThreadDevCompare);
+
+    for (i = 0; i < ndevs; i++)
+        *devs[i].iothread = i * niothreads / ndevs + 1;
+
+    if (cfg->housekeepingCpus) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    for (i = 0; i < niothreads; i++) {
+        virDomainIOThreadIDDefPtr iothrid = def->iothreadids[i];
+        int node = -2;
+
+        for (j = 0; j < ndevs; j++) {
+            if (*devs[j].iothread != iothrid->iothread_id)
+                continue;
+
+            if (node == -2)
+                node = devs[j].node;
+            else if (node != devs[j].node)
+                node = -1;
+        }
+
+        if (node < 0)
+            continue;
+
+        if (!(nodemask = virBitmapNew(node + 1)) ||
+            virBitmapSetBit(nodemask, node) < 0 ||
+            !(iothrid->cpumask = virCapabilitiesGetCpusForNodemask(caps,
+                                                                   nodemask)))
+            goto cleanup;
+
+        if (virBitmapIsAllClear(iothrid->cpumask)) {
+            virBitmapFree(iothrid->cpumask);
+            iothrid->cpumask = NULL;
+        }
+
+        virBitmapFree(nodemask);
+        nodemask = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(nodemask);
+    VIR_FREE(devs);
+    return ret;
+}
+
+
 static void
 qemuProcessPrepareAllowReboot(virDomainObjPtr vm)
 {
@@ -5479,6 +6061,10 @@ qemuProcessPrepareDomain(virConnectPtr conn,
     if (qemuProcessPrepareDomainStorage(conn, driver, vm, priv, cfg, flags) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Assigning IOThreads and queues");
+    if (qemuProcessPrepareDomainIOThreads(vm, caps, cfg) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Prepare chardev source backends for TLS");
     qemuDomainPrepareChardevSource(vm->def, cfg);
 
@@ -5662,6 +6248,290 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Add @count pages of @size KiB on host node @node to @list, merging
+ * entries for the same pool.
+ */
+static int
+qemuProcessHugepageReservationAdd(qemuHugepageReservationPtr *list,
+                                  size_t *nlist,
+                                  int node,
+                                  unsigned int size,
+                                  unsigned long long count)
+{
+    qemuHugepageReservation res = { .node = node, .size = size, .count = count };
+    size_t i;
+
+    for (i = 0; i < *nlist; i++) {
+        if ((*list)[i].node == node && (*list)[i].size == size) {
+            (*list)[i].count += count;
+            return 0;
+        }
+    }
+
+    return VIR_APPEND_ELEMENT(*list, *nlist, res);
+}
+
+
+/*
+ * Only memory strictly bound to a single host node is accounted to that
+ * node, anything else may be allocated from the whole host.
+ */
+static int
+qemuProcessHugepageHostNode(virDomainObjPtr vm,
+                            int cellid)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainNumatuneMemMode mode;
+    virBitmapPtr nodeset;
+
+    if (virDomainNumatuneGetMode(vm->def->numa, cellid, &mode) < 0 ||
+        mode != VIR_DOMAIN_NUMATUNE_MEM_STRICT)
+        return -1;
+
+    nodeset = virDomainNumatuneGetNodeset(vm->def->numa, priv->autoNodeset,
+                                          cellid);
+    if (!nodeset || virBitmapCountBits(nodeset) != 1)
+        return -1;
+
+    return virBitmapNextSetBit(nodeset, -1);
+}
+
+
+/*
+ * Returns the huge page size in KiB backing guest NUMA node @cellid (or
+ * the whole guest if -1), or 0 if it's not backed by huge pages.
+ */
+static unsigned int
+qemuProcessHugepageSize(virQEMUDriverConfigPtr cfg,
+                        virDomainDefPtr def,
+                        int cellid)
+{
+    virDomainHugePagePtr hugepage = NULL;
+    size_t i;
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        if (!def->mem.hugepages[i].nodemask) {
+            if (!hugepage)
+                hugepage = &def->mem.hugepages[i];
+        } else if (cellid >= 0 &&
+                   virBitmapIsBitSet(def->mem.hugepages[i].nodemask, cellid)) {
+            hugepage = &def->mem.hugepages[i];
+            break;
+        }
+    }
+
+    if (!hugepage && cellid < 0 && def->mem.nhugepages)
+        hugepage = &def->mem.hugepages[0];
+
+    if (!hugepage)
+        return 0;
+
+    if (hugepage->size)
+        return hugepage->size;
+
+    for (i = 0; i < cfg->nhugetlbfs; i++) {
+        if (cfg->hugetlbfs[i].deflt)
+            return cfg->hugetlbfs[i].size;
+    }
+
+    return cfg->nhugetlbfs ? cfg->hugetlbfs[0].size : 0;
+}
+
+
+static int
+qemuProcessGetHugepageDemand(virQEMUDriverConfigPtr cfg,
+                             virDomainObjPtr vm,
+                             qemuHugepageReservationPtr *demand,
+                             size_t *ndemand)
+{
+    size_t ncells = virDomainNumaGetNodeCount(vm->def->numa);
+    unsigned int size;
+    size_t i;
+
+    if (ncells == 0) {
+        if (!(size = qemuProcessHugepageSize(cfg, vm->def, -1)))
+            return 0;
+
+        return qemuProcessHugepageReservationAdd(demand, ndemand,
+                                                 qemuProcessHugepageHostNode(vm, -1),
+                                                 size,
+                                                 VIR_DIV_UP(virDomainDefGetMemoryInitial(vm->def),
+                                                            size));
+    }
+
+    for (i = 0; i < ncells; i++) {
+        unsigned long long mem = virDomainNumaGetNodeMemorySize(vm->def->numa, i);
+
+        if (!(size = qemuProcessHugepageSize(cfg, vm->def, i)))
+            continue;
+
+        if (qemuProcessHugepageReservationAdd(demand, ndemand,
+                                              qemuProcessHugepageHostNode(vm, i),
+                                              size,
+                                              VIR_DIV_UP(mem, size)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * qemuProcessReserveHugepages:
+ * @driver: qemu driver
+ * @vm: domain object
+ *
+ * Check that the host has enough free huge pages for the memory of @vm,
+ * not counting pages already reserved for other domains which are still
+ * starting, and reserve them in the driver.  Optionally the pool is grown
+ * by the missing pages.  The reservation is released by
+ * qemuProcessReleaseHugepages once QEMU has allocated the memory.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuProcessReserveHugepages(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuHugepageReservationPtr demand = NULL;
+    size_t ndemand = 0;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (qemuProcessGetHugepageDemand(cfg, vm, &demand, &ndemand) < 0)
+        goto cleanup;
+
+    if (ndemand == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virMutexLock(&driver->lock);
+
+    for (i = 0; i < ndemand; i++) {
+        qemuHugepageReservationPtr d = &demand[i];
+        unsigned long long reserved = 0;
+        unsigned int page_avail;
+        unsigned int page_free;
+
+        for (j = 0; j < driver->nhugepageReservations; j++) {
+            qemuHugepageReservationPtr r = &driver->hugepageReservations[j];
+
+            if (r->size == d->size &&
+                (r->node == d->node || r->node < 0 || d->node < 0))
+                reserved += r->count;
+        }
+
+        if (virNumaGetPageInfo(d->node, d->size, 0,
+                               &page_avail, &page_free) < 0)
+            goto unlock;
+
+        VIR_DEBUG("Huge pages of %u KiB on node %d: free %u, reserved %llu, "
+                  "needed %llu", d->size, d->node, page_free, reserved,
+                  d->count);
+
+        if (page_free >= reserved + d->count)
+            continue;
+
+        if (!cfg->hugepagesAutoGrow) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("not enough free huge pages of size %u KiB on "
+                             "host node %d: needed %llu, free %llu"),
+                           d->size, d->node, d->count,
+                           page_free > reserved ? page_free - reserved : 0);
+            goto unlock;
+        }
+
+        if (virNumaSetPagePoolSize(d->node, d->size,
+                                   reserved + d->count - page_free, true) < 0)
+            goto unlock;
+    }
+
+    for (i = 0; i < ndemand; i++) {
+        if (qemuProcessHugepageReservationAdd(&driver->hugepageReservations,
+                                              &driver->nhugepageReservations,
+                                              demand[i].node, demand[i].size,
+                                              demand[i].count) < 0)
+            goto unlock;
+    }
+
+    VIR_STEAL_PTR(priv->hugepageReservations, demand);
+    priv->nhugepageReservations = ndemand;
+    ndemand = 0;
+    ret = 0;
+
+ unlock:
+    virMutexUnlock(&driver->lock);
+ cleanup:
+    VIR_FREE(demand);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static void
+qemuProcessReleaseHugepages(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
+    size_t j;
+
+    if (!priv->nhugepageReservations)
+        return;
+
+    virMutexLock(&driver->lock);
+
+    for (i = 0; i < priv->nhugepageReservations; i++) {
+        qemuHugepageReservationPtr d = &priv->hugepageReservations[i];
+
+        for (j = 0; j < driver->nhugepageReservations; j++) {
+            qemuHugepageReservationPtr r = &driver->hugepageReservations[j];
+
+            if (r->node != d->node || r->size != d->size)
+                continue;
+
+            r->count -= MIN(r->count, d->count);
+            if (r->count == 0)
+                VIR_DELETE_ELEMENT(driver->hugepageReservations, j,
+                                   driver->nhugepageReservations);
+            break;
+        }
+    }
+
+    virMutexUnlock(&driver->lock);
+
+    VIR_FREE(priv->hugepageReservations);
+    priv->nhugepageReservations = 0;
+}
+
+
+static int
+qemuProcessResctrlCreate(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
+
+    for (i = 0; i < vm->def->nresctrls; i++) {
+        virDomainResctrlDefPtr ct = vm->def->resctrls[i];
+
+        if (virResctrlAllocCreate(ct->alloc, priv->machineName) < 0)
+            return -1;
+
+        /* Threads spawned later inherit the group of the main process */
+        if (!ct->vcpus && !virResctrlAllocIsEmpty(ct->alloc) &&
+            virResctrlAllocAddPID(ct->alloc, vm->pid) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * qemuProcessLaunch:
  *
@@ -5696,6 +6566,7 @@ qemuProcessLaunch(virConnectPtr conn,
     virCapsPtr caps = NULL;
     size_t nnicindexes = 0;
     int *nicindexes = NULL;
+    unsigned long long then;
     size_t i;
 
     VIR_DEBUG("vm=%p name=%s id=%d asyncJob=%d "
@@ -5723,6 +6594,7 @@ qemuProcessLaunch(virConnectPtr conn,
     hookData.driver = driver;
     /* We don't increase cfg's reference counter here. */
     hookData.cfg = cfg;
+    hookData.devTemplate = NULL;
 
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
@@ -5734,6 +6606,7 @@ qemuProcessLaunch(virConnectPtr conn,
     logfile = qemuDomainLogContextGetWriteFD(logCtxt);
 
     VIR_DEBUG("Building emulator command line");
+    then = qemuProcessStartPhaseBegin();
     if (!(cmd = qemuBuildCommandLine(driver,
                                      qemuDomainLogContextGetManager(logCtxt),
                                      vm,
@@ -5747,6 +6620,10 @@ qemuProcessLaunch(virConnectPtr conn,
     if (incoming && incoming->fd != -1)
         virCommandPassFD(cmd, incoming->fd, 0);
 
+    VIR_DEBUG("Reserving huge pages (if required)");
+    if (qemuProcessReserveHugepages(driver, vm) < 0)
+        goto cleanup;
+
     /* now that we know it is about to start call the hook if present */
     if (qemuProcessStartHook(driver, vm,
                              VIR_HOOK_QEMU_OP_START,
@@ -5764,6 +6641,10 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuDomainCreateNamespace(driver, vm) < 0)
         goto cleanup;
 
+    if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
+        !(hookData.devTemplate = qemuDomainGetDevTemplate(driver, cfg)))
+        goto cleanup;
+
     VIR_DEBUG("Clear emulator capabilities: %d",
               cfg->clearEmulatorCapabilities);
     if (cfg->clearEmulatorCapabilities)
@@ -5791,6 +6672,9 @@ qemuProcessLaunch(virConnectPtr conn,
     virCommandDaemonize(cmd);
     virCommandRequireHandshake(cmd);
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_COMMAND, then);
+    then = qemuProcessStartPhaseBegin();
+
     if (qemuSecurityPreFork(driver->securityManager) < 0)
         goto cleanup;
     rv = virCommandRun(cmd, NULL);
@@ -5811,7 +6695,7 @@ qemuProcessLaunch(virConnectPtr conn,
     }
 
     VIR_DEBUG("Writing early domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         goto cleanup;
 
     VIR_DEBUG("Waiting for handshake from child");
@@ -5822,15 +6706,27 @@ qemuProcessLaunch(virConnectPtr conn,
         goto cleanup;
     }
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_EXEC, then);
+    then = qemuProcessStartPhaseBegin();
+
     VIR_DEBUG("Setting up domain cgroup (if required)");
     if (qemuSetupCgroup(vm, nnicindexes, nicindexes) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Setting up resctrl allocations (if required)");
+    if (qemuProcessResctrlCreate(vm) < 0)
+        goto cleanup;
+
+    if (qemuProcessResctrlMonitorWanted(vm->def) &&
+        qemuProcessResctrlMonitorStart(vm) < 0)
+        goto cleanup;
+
     if (!(priv->perf = virPerfNew()))
         goto cleanup;
 
     for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
         if (vm->def->perf.events[i] == VIR_TRISTATE_BOOL_YES &&
+            qemuDomainPerfEventResctrlType(i) < 0 &&
             virPerfEventEnable(priv->perf, i, vm->pid) < 0)
             goto cleanup;
     }
@@ -5845,6 +6741,9 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessSetupEmulator(vm) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_CGROUP, then);
+    then = qemuProcessStartPhaseBegin();
+
     VIR_DEBUG("Setting domain security labels");
     if (qemuSecuritySetAllLabel(driver,
                                 vm,
@@ -5881,6 +6780,9 @@ qemuProcessLaunch(virConnectPtr conn,
         goto cleanup;
     VIR_DEBUG("Handshake complete, child running");
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_LABEL, then);
+    then = qemuProcessStartPhaseBegin();
+
     if (rv == -1) /* The VM failed to start; tear filters before taps */
         virDomainConfVMNWFilterTeardown(vm);
 
@@ -5894,6 +6796,9 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuConnectAgent(driver, vm) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_MONITOR, then);
+    then = qemuProcessStartPhaseBegin();
+
     VIR_DEBUG("Verifying and updating provided guest CPU");
     if (qemuProcessUpdateAndVerifyCPU(driver, vm, asyncJob) < 0)
         goto cleanup;
@@ -5961,6 +6866,8 @@ qemuProcessLaunch(virConnectPtr conn,
         qemuProcessRefreshBalloonState(driver, vm, asyncJob) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_QMP, then);
+
     if (flags & VIR_QEMU_PROCESS_START_AUTODESTROY &&
         qemuProcessAutoDestroyAdd(driver, vm, conn) < 0)
         goto cleanup;
@@ -5968,8 +6875,12 @@ qemuProcessLaunch(virConnectPtr conn,
     ret = 0;
 
  cleanup:
+    /* QEMU preallocates huge page backed memory before the monitor becomes
+     * available, from now on the kernel's accounting covers it */
+    qemuProcessReleaseHugepages(driver, vm);
     qemuDomainSecretDestroy(vm);
     virCommandFree(cmd);
+    virObjectUnref(hookData.devTemplate);
     virObjectUnref(logCtxt);
     virObjectUnref(cfg);
     virObjectUnref(caps);
@@ -5988,6 +6899,156 @@ qemuProcessLaunch(virConnectPtr conn,
  * function is called after a deferred migration finishes so that we can update
  * state influenced by the migration stream.
  */
+/**
+ * qemuProcessDiskThinExtendWanted:
+ * @cfg: driver configuration
+ * @disk: disk definition
+ *
+ * Returns true if libvirt grows the logical volume backing @disk on its
+ * own as the guest fills it, which is the case for writable qcow2 images
+ * on volumes of a logical pool once thin_extend_size is set.
+ */
+bool
+qemuProcessDiskThinExtendWanted(virQEMUDriverConfigPtr cfg,
+                                virDomainDiskDefPtr disk)
+{
+    virStorageSourcePtr src = disk->src;
+
+    return cfg->thinExtendSize > 0 &&
+           !src->readonly &&
+           src->format == VIR_STORAGE_FILE_QCOW2 &&
+           src->srcpool &&
+           src->srcpool->pooltype == VIR_STORAGE_POOL_LOGICAL &&
+           src->path;
+}
+
+
+/**
+ * qemuProcessDiskThinExtendMax:
+ * @disk: disk definition
+ *
+ * Returns the size the volume of @disk is never grown beyond: the
+ * virtual size of the image plus room for qcow2 metadata, or 0 if the
+ * virtual size is unknown.
+ */
+unsigned long long
+qemuProcessDiskThinExtendMax(virDomainDiskDefPtr disk)
+{
+    return disk->src->capacity + disk->src->capacity / 10;
+}
+
+
+/**
+ * qemuProcessDiskThinExtendArm:
+ * @driver: qemu driver
+ * @vm: domain object
+ * @disk: disk whose volume libvirt extends
+ * @asyncJob: the job the caller holds
+ *
+ * Refresh the physical size of the volume backing @disk and set a write
+ * threshold half an extension step below its end, so that a
+ * BLOCK_WRITE_THRESHOLD event arrives while the guest still has room to
+ * write.  Nothing is armed once the volume reached its maximum size.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuProcessDiskThinExtendArm(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             virDomainDiskDefPtr disk,
+                             qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virStorageSourcePtr src = disk->src;
+    unsigned long long max = qemuProcessDiskThinExtendMax(disk);
+    unsigned long long margin;
+    struct stat sb;
+    int fd = -1;
+    int rc;
+    int ret = -1;
+
+    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_WRITE_THRESHOLD)) {
+        VIR_DEBUG("write thresholds not supported, not arming disk '%s'",
+                  disk->dst);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if ((fd = open(src->path, O_RDONLY)) < 0) {
+        virReportSystemError(errno, _("cannot open '%s'"), src->path);
+        goto cleanup;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("cannot stat '%s'"), src->path);
+        goto cleanup;
+    }
+
+    if (virStorageSourceUpdatePhysicalSize(src, fd, &sb) < 0)
+        goto cleanup;
+
+    if (max && src->physical >= max) {
+        VIR_DEBUG("volume of disk '%s' is fully extended", disk->dst);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!src->nodestorage &&
+        qemuBlockNodeNamesDetect(driver, vm, asyncJob) < 0)
+        goto cleanup;
+
+    if (!src->nodestorage) {
+        VIR_DEBUG("no node name for disk '%s', not arming", disk->dst);
+        ret = 0;
+        goto cleanup;
+    }
+
+    margin = MIN(cfg->thinExtendSize / 2, src->physical / 2);
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        goto cleanup;
+    rc = qemuMonitorSetBlockThreshold(priv->mon, src->nodestorage,
+                                      src->physical - margin);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static void
+qemuProcessSetupThinExtend(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuDomainAsyncJob asyncJob)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    size_t i;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (!qemuProcessDiskThinExtendWanted(cfg, disk))
+            continue;
+
+        /* the guest can run without it, it just may fill the volume */
+        if (qemuProcessDiskThinExtendArm(driver, vm, disk, asyncJob) < 0) {
+            VIR_WARN("Unable to arm volume extension for disk '%s' of "
+                     "domain %s: %s", disk->dst, vm->def->name,
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+
+    virObjectUnref(cfg);
+}
+
+
 static int
 qemuProcessRefreshState(virQEMUDriverPtr driver,
                         virDomainObjPtr vm,
@@ -6009,6 +7070,9 @@ qemuProcessRefreshState(virQEMUDriverPtr driver,
     if (qemuProcessRefreshDisks(driver, vm, asyncJob) < 0)
         return -1;
 
+    VIR_DEBUG("Arming thin volume extension");
+    qemuProcessSetupThinExtend(driver, vm, asyncJob);
+
     return 0;
 }
 
@@ -6026,7 +7090,6 @@ qemuProcessFinishStartup(virConnectPtr conn,
                          bool startCPUs,
                          virDomainPausedReason pausedReason)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
 
     if (qemuProcessRefreshState(driver, vm, asyncJob) < 0)
@@ -6047,7 +7110,7 @@ qemuProcessFinishStartup(virConnectPtr conn,
     }
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         goto cleanup;
 
     if (qemuProcessStartHook(driver, vm,
@@ -6058,7 +7121,6 @@ qemuProcessFinishStartup(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -6080,6 +7142,7 @@ qemuProcessStart(virConnectPtr conn,
     qemuProcessIncomingDefPtr incoming = NULL;
     unsigned int stopFlags;
     bool relabel = false;
+    unsigned long long then = qemuProcessStartPhaseBegin();
     int ret = -1;
     int rv;
 
@@ -6102,6 +7165,9 @@ qemuProcessStart(virConnectPtr conn,
                         asyncJob, !!migrateFrom, flags) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_INIT, then);
+    then = qemuProcessStartPhaseBegin();
+
     if (migrateFrom) {
         incoming = qemuProcessIncomingDefNew(priv->qemuCaps, NULL, migrateFrom,
                                              migrateFd, migratePath);
@@ -6115,6 +7181,8 @@ qemuProcessStart(virConnectPtr conn,
     if (qemuProcessPrepareHost(driver, vm, flags) < 0)
         goto stop;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_PREPARE, then);
+
     if ((rv = qemuProcessLaunch(conn, driver, vm, asyncJob, incoming,
                                 snapshot, vmop, flags)) < 0) {
         if (rv == -2)
@@ -6123,6 +7191,8 @@ qemuProcessStart(virConnectPtr conn,
     }
     relabel = true;
 
+    then = qemuProcessStartPhaseBegin();
+
     if (incoming &&
         incoming->deferredURI &&
         qemuMigrationRunIncoming(driver, vm, incoming->deferredURI, asyncJob) < 0)
@@ -6135,6 +7205,8 @@ qemuProcessStart(virConnectPtr conn,
                                  VIR_DOMAIN_PAUSED_USER) < 0)
         goto stop;
 
+    qemuProcessStartPhaseEnd(vm, QEMU_DOMAIN_START_PHASE_RESUME, then);
+
     /* Keep watching qemu log for errors during incoming migration, otherwise
      * unset reporting errors from qemu log. */
     if (!incoming)
@@ -6483,6 +7555,11 @@ void qemuProcessStop(virQEMUDriverPtr driver,
         networkReleaseActualDevice(vm->def, net);
     }
 
+    qemuProcessResctrlMonitorStop(vm);
+
+    for (i = 0; i < vm->def->nresctrls; i++)
+        virResctrlAllocRemove(vm->def->resctrls[i]->alloc);
+
  retry:
     if ((ret = qemuRemoveCgroup(vm)) < 0) {
         if (ret == -EBUSY && (retries++ < 5)) {
@@ -6775,7 +7852,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainObjFlushStatus(driver, vm) < 0)
         goto error;
 
     /* Run an hook to allow admins to do some magic */
@@ -7015,11 +8092,97 @@ qemuProcessRefreshCPU(virQEMUDriverPtr driver,
 }
 
 
+/* Number of domains being reconnected at the same time */
+#define QEMU_PROCESS_RECONNECT_WORKERS 16
+
 struct qemuProcessReconnectData {
     virConnectPtr conn;
     virQEMUDriverPtr driver;
     virDomainObjPtr obj;
+    bool refresh;       /* Only refresh state deferred from reconnect */
 };
+
+
+/*
+ * Refreshes the parts of the domain state which are not needed for the
+ * domain to be usable again after reconnect. Failures are not fatal.
+ *
+ * Must be called with a job on the locked domain object.
+ */
+static void
+qemuProcessReconnectRefresh(virQEMUDriverPtr driver,
+                            virDomainObjPtr obj)
+{
+    if (qemuProcessRefreshDisks(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
+        VIR_WARN("Failed to refresh disks of domain %s: %s",
+                 obj->def->name, virGetLastErrorMessage());
+
+    /* If querying of guest's RTC failed, report error, but do not kill the domain. */
+    qemuRefreshRTC(driver, obj);
+
+    if (qemuProcessRefreshBalloonState(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
+        VIR_WARN("Failed to refresh balloon of domain %s: %s",
+                 obj->def->name, virGetLastErrorMessage());
+}
+
+
+static void
+qemuProcessReconnectRefreshJob(virQEMUDriverPtr driver,
+                               virDomainObjPtr obj)
+{
+    virObjectLock(obj);
+
+    if (qemuDomainObjBeginJob(driver, obj, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(obj))
+        goto endjob;
+
+    VIR_DEBUG("Refreshing state of %p '%s'", obj, obj->def->name);
+
+    qemuProcessReconnectRefresh(driver, obj);
+
+    if (virDomainObjIsActive(obj))
+        ignore_value(qemuDomainObjSaveStatus(driver, obj));
+
+ endjob:
+    qemuDomainObjEndJob(driver, obj);
+
+ cleanup:
+    virDomainObjEndAPI(&obj);
+}
+
+
+/*
+ * Schedules qemuProcessReconnectRefresh to be run once no reconnect is
+ * waiting for a worker, or runs it right away if that is not possible.
+ */
+static void
+qemuProcessReconnectDeferRefresh(virQEMUDriverPtr driver,
+                                 virDomainObjPtr obj)
+{
+    struct qemuProcessReconnectData *data;
+
+    if (VIR_ALLOC(data) < 0)
+        goto error;
+
+    data->driver = driver;
+    data->obj = virObjectRef(obj);
+    data->refresh = true;
+
+    if (virThreadPoolSendJob(driver->reconnectPool,
+                             VIR_THREAD_POOL_PRIORITY_NORMAL, data) < 0) {
+        virObjectUnref(obj);
+        VIR_FREE(data);
+        goto error;
+    }
+
+    return;
+
+ error:
+    qemuProcessReconnectRefresh(driver, obj);
+}
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
@@ -7100,6 +8263,14 @@ qemuProcessReconnect(void *opaque)
     if (qemuConnectCgroup(obj) < 0)
         goto error;
 
+    for (i = 0; i < obj->def->nresctrls; i++) {
+        virResctrlAllocPtr alloc = obj->def->resctrls[i]->alloc;
+
+        if (!virResctrlAllocIsEmpty(alloc) &&
+            virResctrlAllocDeterminePath(alloc, priv->machineName) < 0)
+            goto error;
+    }
+
     if (qemuDomainPerfRestart(obj) < 0)
         goto error;
 
@@ -7201,21 +8372,12 @@ qemuProcessReconnect(void *opaque)
     if (qemuProcessFiltersInstantiate(obj->def))
         goto error;
 
-    if (qemuProcessRefreshDisks(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
-        goto error;
-
     if (qemuBlockNodeNamesDetect(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
         goto error;
 
     if (qemuRefreshVirtioChannelState(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
         goto error;
 
-    /* If querying of guest's RTC failed, report error, but do not kill the domain. */
-    qemuRefreshRTC(driver, obj);
-
-    if (qemuProcessRefreshBalloonState(driver, obj, QEMU_ASYNC_JOB_NONE) < 0)
-        goto error;
-
     if (qemuProcessRecoverJob(driver, obj, conn, &oldjob, &stopFlags) < 0)
         goto error;
 
@@ -7228,7 +8390,7 @@ qemuProcessReconnect(void *opaque)
         goto error;
 
     /* update domain state XML with possibly updated state in virDomainObj */
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
+    if (qemuDomainObjSaveStatus(driver, obj) < 0)
         goto error;
 
     /* Run an hook to allow admins to do some magic */
@@ -7251,6 +8413,10 @@ qemuProcessReconnect(void *opaque)
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
         driver->inhibitCallback(true, driver->inhibitOpaque);
 
+    /* Disk tray, RTC and balloon state can wait until the other domains
+     * are reconnected */
+    qemuProcessReconnectDeferRefresh(driver, obj);
+
  cleanup:
     if (jobStarted) {
         if (!virDomainObjIsActive(obj))
@@ -7292,11 +8458,24 @@ qemuProcessReconnect(void *opaque)
     goto cleanup;
 }
 
+static void
+qemuProcessReconnectWorker(void *jobdata,
+                           void *opaque ATTRIBUTE_UNUSED)
+{
+    struct qemuProcessReconnectData *data = jobdata;
+
+    if (data->refresh) {
+        qemuProcessReconnectRefreshJob(data->driver, data->obj);
+        VIR_FREE(data);
+    } else {
+        qemuProcessReconnect(data);
+    }
+}
+
 static int
 qemuProcessReconnectHelper(virDomainObjPtr obj,
                            void *opaque)
 {
-    virThread thread;
     struct qemuProcessReconnectData *src = opaque;
     struct qemuProcessReconnectData *data;
 
@@ -7312,7 +8491,7 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
 
     virNWFilterReadLockFilterUpdates();
 
-    /* this lock and reference will be eventually transferred to the thread
+    /* this lock and reference will be eventually transferred to the worker
      * that handles the reconnect */
     virObjectLock(obj);
     virObjectRef(obj);
@@ -7323,11 +8502,12 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
      */
     virObjectRef(data->conn);
 
-    if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
+    if (virThreadPoolSendJob(src->driver->reconnectPool,
+                             VIR_THREAD_POOL_PRIORITY_HIGH, data) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Could not create thread. QEMU initialization "
+                       _("Could not schedule reconnect. QEMU initialization "
                          "might be incomplete"));
-        /* We can't spawn a thread and thus connect to monitor. Kill qemu.
+        /* We can't run the reconnect and thus connect to monitor. Kill qemu.
          * It's safe to call qemuProcessStop without a job here since there
          * is no thread that could be doing anything else with the same domain
          * object.
@@ -7350,11 +8530,25 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
  * qemuProcessReconnectAll
  *
  * Try to re-open the resources for live VMs that we care
- * about.
+ * about. At most QEMU_PROCESS_RECONNECT_WORKERS domains are reconnected
+ * at the same time by the driver's reconnectPool, the rest is locked
+ * until a worker gets to them. Once no reconnect is waiting, the pool
+ * refreshes the state which is not needed right away.
+ *
+ * Returns 0 on success, -1 if the pool could not be created.
  */
-void
+int
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+
+    if (!(driver->reconnectPool = virThreadPoolNew(0,
+                                                   QEMU_PROCESS_RECONNECT_WORKERS,
+                                                   0,
+                                                   qemuProcessReconnectWorker,
+                                                   driver)))
+        return -1;
+
     virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+    return 0;
 }
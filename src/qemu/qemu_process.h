@@ -44,7 +44,7 @@ int qemuProcessBuildDestroyMemoryPaths(virQEMUDriverPtr driver,
                                        bool build);
 
 void qemuProcessAutostartAll(virQEMUDriverPtr driver);
-void qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver);
+int qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver);
 
 typedef struct _qemuProcessIncomingDef qemuProcessIncomingDef;
 typedef qemuProcessIncomingDef *qemuProcessIncomingDefPtr;
@@ -182,6 +182,10 @@ virDomainDiskDefPtr qemuProcessFindDomainDiskByAlias(virDomainObjPtr vm,
 int qemuConnectAgent(virQEMUDriverPtr driver, virDomainObjPtr vm);
 
 
+bool qemuProcessResctrlMonitorWanted(virDomainDefPtr def);
+int qemuProcessResctrlMonitorStart(virDomainObjPtr vm);
+void qemuProcessResctrlMonitorStop(virDomainObjPtr vm);
+
 int qemuProcessSetupVcpu(virDomainObjPtr vm,
                          unsigned int vcpuid);
 int qemuProcessSetupIOThread(virDomainObjPtr vm,
@@ -199,4 +203,12 @@ int qemuProcessRefreshDisks(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             qemuDomainAsyncJob asyncJob);
 
+bool qemuProcessDiskThinExtendWanted(virQEMUDriverConfigPtr cfg,
+                                     virDomainDiskDefPtr disk);
+unsigned long long qemuProcessDiskThinExtendMax(virDomainDiskDefPtr disk);
+int qemuProcessDiskThinExtendArm(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 virDomainDiskDefPtr disk,
+                                 qemuDomainAsyncJob asyncJob);
+
 #endif /* __QEMU_PROCESS_H__ */
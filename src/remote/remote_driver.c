@@ -75,8 +75,15 @@ VIR_LOG_INIT("remote.remote_driver");
 # define HYPER_TO_ULONG(_to, _from) (_to) = (_from)
 #endif
 
+/* Replies smaller than this are cheaper to copy through the socket
+ * than to set up a memfd for */
+#define REMOTE_SHARED_REPLY_MIN (256 * 1024)
+
 static bool inside_daemon;
 
+typedef struct _remoteStatsSubscription remoteStatsSubscription;
+typedef remoteStatsSubscription *remoteStatsSubscriptionPtr;
+
 struct private_data {
     virMutex lock;
 
@@ -98,9 +105,18 @@ struct private_data {
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
     bool serverCloseCallback;   /* Does server support driver close callback */
+    bool serverCompactStats;    /* Does server support compact bulk stats */
+    bool serverEventBatch;      /* Does server support batched events */
+    bool serverSharedReplies;   /* Can server pass replies in shared memory */
 
     virObjectEventStatePtr eventState;
     virConnectCloseCallbackDataPtr closeCallback;
+
+    /* Protects the subscriptions only, as they are looked up by the
+     * event handler which may run while @lock is held */
+    virMutex statsLock;
+    remoteStatsSubscriptionPtr *statsSubscriptions;
+    size_t nstatsSubscriptions;
 };
 
 enum {
@@ -130,6 +146,9 @@ static int callFull(virConnectPtr conn, struct private_data *priv,
                     int proc_nr,
                     xdrproc_t args_filter, char *args,
                     xdrproc_t ret_filter, char *ret);
+static int callBatch(virConnectPtr conn, struct private_data *priv,
+                     unsigned int flags,
+                     virNetClientProgramBatchCallPtr calls, size_t ncalls);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
 #if WITH_SASL
@@ -375,6 +394,11 @@ remoteStoragePoolBuildEventRefresh(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                    virNetClientPtr client ATTRIBUTE_UNUSED,
                                    void *evdata, void *opaque);
 
+static void
+remoteStoragePoolBuildEventVolumeJob(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                     virNetClientPtr client ATTRIBUTE_UNUSED,
+                                     void *evdata, void *opaque);
+
 static void
 remoteNodeDeviceBuildEventLifecycle(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                     virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -405,6 +429,21 @@ remoteConnectNotifyEventConnectionClosed(virNetClientProgramPtr prog ATTRIBUTE_U
                                          virNetClientPtr client ATTRIBUTE_UNUSED,
                                          void *evdata, void *opaque);
 
+static void
+remoteConnectNotifyDomainStats(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                               virNetClientPtr client ATTRIBUTE_UNUSED,
+                               void *evdata, void *opaque);
+
+static void
+remoteConnectDispatchEventBatch(virNetClientProgramPtr prog,
+                                virNetClientPtr client,
+                                void *evdata, void *opaque);
+
+static void
+remoteConnectNotifyEventLost(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                             virNetClientPtr client ATTRIBUTE_UNUSED,
+                             void *evdata, void *opaque);
+
 static virNetClientProgramEvent remoteEvents[] = {
     { REMOTE_PROC_DOMAIN_EVENT_LIFECYCLE,
       remoteDomainBuildEventLifecycle,
@@ -591,6 +630,10 @@ static virNetClientProgramEvent remoteEvents[] = {
       remoteStoragePoolBuildEventRefresh,
       sizeof(remote_storage_pool_event_refresh_msg),
       (xdrproc_t)xdr_remote_storage_pool_event_refresh_msg },
+    { REMOTE_PROC_STORAGE_POOL_EVENT_VOLUME_JOB,
+      remoteStoragePoolBuildEventVolumeJob,
+      sizeof(remote_storage_pool_event_volume_job_msg),
+      (xdrproc_t)xdr_remote_storage_pool_event_volume_job_msg },
     { REMOTE_PROC_NODE_DEVICE_EVENT_LIFECYCLE,
       remoteNodeDeviceBuildEventLifecycle,
       sizeof(remote_node_device_event_lifecycle_msg),
@@ -611,6 +654,18 @@ static virNetClientProgramEvent remoteEvents[] = {
       remoteDomainBuildEventBlockThreshold,
       sizeof(remote_domain_event_block_threshold_msg),
       (xdrproc_t)xdr_remote_domain_event_block_threshold_msg },
+    { REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT,
+      remoteConnectNotifyDomainStats,
+      sizeof(remote_connect_domain_stats_event_msg),
+      (xdrproc_t)xdr_remote_connect_domain_stats_event_msg },
+    { REMOTE_PROC_CONNECT_EVENT_BATCH,
+      remoteConnectDispatchEventBatch,
+      sizeof(remote_connect_event_batch_msg),
+      (xdrproc_t)xdr_remote_connect_event_batch_msg },
+    { REMOTE_PROC_CONNECT_EVENT_LOST,
+      remoteConnectNotifyEventLost,
+      sizeof(remote_connect_event_lost_msg),
+      (xdrproc_t)xdr_remote_connect_event_lost_msg },
 };
 
 static void
@@ -669,6 +724,52 @@ remoteConnectSupportsFeatureUnlocked(virConnectPtr conn,
     return rc != -1 && ret.supported;
 }
 
+/* Same as remoteConnectSupportsFeatureUnlocked, but asks about all
+ * @features within a single round trip */
+static int
+remoteConnectSupportsFeaturesUnlocked(virConnectPtr conn,
+                                      struct private_data *priv,
+                                      const int *features,
+                                      bool *supported,
+                                      size_t nfeatures)
+{
+    remote_connect_supports_feature_args *args = NULL;
+    remote_connect_supports_feature_ret *ret = NULL;
+    virNetClientProgramBatchCallPtr calls = NULL;
+    size_t i;
+    int rv = -1;
+
+    if (VIR_ALLOC_N(args, nfeatures) < 0 ||
+        VIR_ALLOC_N(ret, nfeatures) < 0 ||
+        VIR_ALLOC_N(calls, nfeatures) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nfeatures; i++) {
+        args[i].feature = features[i];
+        calls[i].proc = REMOTE_PROC_CONNECT_SUPPORTS_FEATURE;
+        calls[i].args_filter = (xdrproc_t)xdr_remote_connect_supports_feature_args;
+        calls[i].args = &args[i];
+        calls[i].ret_filter = (xdrproc_t)xdr_remote_connect_supports_feature_ret;
+        calls[i].ret = &ret[i];
+    }
+
+    if (callBatch(conn, priv, 0, calls, nfeatures) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nfeatures; i++) {
+        supported[i] = calls[i].rv != -1 && ret[i].supported;
+        virFreeError(calls[i].error);
+    }
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(args);
+    VIR_FREE(ret);
+    VIR_FREE(calls);
+    return rv;
+}
+
 /* helper macro to ease extraction of arguments from the URI */
 #define EXTRACT_URI_ARG_STR(ARG_NAME, ARG_VAR) \
     if (STRCASEEQ(var->name, ARG_NAME)) { \
@@ -810,6 +911,8 @@ doRemoteOpen(virConnectPtr conn,
     char *name = NULL, *command = NULL, *sockname = NULL, *netcat = NULL;
     char *port = NULL, *authtype = NULL, *username = NULL;
     bool sanity = true, verify = true, tty ATTRIBUTE_UNUSED = true;
+    bool eventBatch = true, noEventCoalesce = true;
+    bool noSharedReplies = true;
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
@@ -862,6 +965,9 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_sanity", sanity);
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
+            EXTRACT_URI_ARG_BOOL("no_event_batch", eventBatch);
+            EXTRACT_URI_ARG_BOOL("event_coalesce", noEventCoalesce);
+            EXTRACT_URI_ARG_BOOL("shared_replies", noSharedReplies);
 
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
@@ -1223,15 +1329,68 @@ doRemoteOpen(virConnectPtr conn,
     if (!(priv->eventState = virObjectEventStateNew()))
         goto failed;
 
-    priv->serverEventFilter = remoteConnectSupportsFeatureUnlocked(conn,
-                                priv, VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK);
+    {
+        const int features[] = { VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK,
+                                 VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK,
+                                 VIR_DRV_FEATURE_REMOTE_COMPACT_STATS,
+                                 VIR_DRV_FEATURE_REMOTE_EVENT_BATCH,
+                                 VIR_DRV_FEATURE_REMOTE_SHARED_REPLIES };
+        bool supported[ARRAY_CARDINALITY(features)] = { false };
+
+        /* Not knowing about a feature must not fail the open, so fall
+         * back to asking the server one feature at a time */
+        if (remoteConnectSupportsFeaturesUnlocked(conn, priv, features,
+                                                  supported,
+                                                  ARRAY_CARDINALITY(features)) < 0) {
+            size_t i;
+
+            VIR_DEBUG("Batched feature probe failed, probing one by one");
+            virResetLastError();
+            for (i = 0; i < ARRAY_CARDINALITY(features); i++)
+                supported[i] = remoteConnectSupportsFeatureUnlocked(conn,
+                                                                    priv,
+                                                                    features[i]);
+        }
+
+        priv->serverEventFilter = supported[0];
+        priv->serverCloseCallback = supported[1];
+        priv->serverCompactStats = supported[2];
+        priv->serverEventBatch = supported[3];
+        priv->serverSharedReplies = supported[4];
+    }
+
+    /* Let the server deliver events in batches; the events they carry
+     * are dispatched exactly as if they had arrived on their own. */
+    if (priv->serverEventBatch && eventBatch) {
+        remote_connect_event_batch_enable_args args;
+
+        args.flags = noEventCoalesce ? 0 : REMOTE_CONNECT_EVENT_BATCH_COALESCE;
+
+        if (call(conn, priv, 0, REMOTE_PROC_CONNECT_EVENT_BATCH_ENABLE,
+                 (xdrproc_t) xdr_remote_connect_event_batch_enable_args, (char *) &args,
+                 (xdrproc_t) xdr_void, (char *) NULL) < 0)
+            goto failed;
+    }
+
+    /* Only a direct UNIX socket gets the FD holding the reply, any
+     * tunnel in between would drop it */
+    if (!noSharedReplies && transport == trans_unix &&
+        priv->serverSharedReplies && virNetMessageCanSharePayload()) {
+        remote_connect_shared_replies_enable_args args;
+
+        args.min_size = REMOTE_SHARED_REPLY_MIN;
+
+        if (call(conn, priv, 0, REMOTE_PROC_CONNECT_SHARED_REPLIES_ENABLE,
+                 (xdrproc_t) xdr_remote_connect_shared_replies_enable_args, (char *) &args,
+                 (xdrproc_t) xdr_void, (char *) NULL) < 0)
+            goto failed;
+    }
+
     if (!priv->serverEventFilter) {
         VIR_INFO("Avoiding server event filtering since it is not "
                  "supported by the server");
     }
 
-    priv->serverCloseCallback = remoteConnectSupportsFeatureUnlocked(conn,
-                                    priv, VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK);
     if (!priv->serverCloseCallback) {
         VIR_INFO("Close callback registering isn't supported "
                  "by the remote side.");
@@ -1294,6 +1453,13 @@ remoteAllocPrivateData(void)
         VIR_FREE(priv);
         return NULL;
     }
+    if (virMutexInit(&priv->statsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        return NULL;
+    }
     remoteDriverLock(priv);
     priv->localUses = 1;
 
@@ -1440,6 +1606,8 @@ remoteConnectClose(virConnectPtr conn)
         conn->privateData = NULL;
         remoteDriverUnlock(priv);
         virMutexDestroy(&priv->lock);
+        virMutexDestroy(&priv->statsLock);
+        VIR_FREE(priv->statsSubscriptions);
         VIR_FREE(priv);
     }
     if (priv)
@@ -5440,6 +5608,29 @@ remoteStoragePoolBuildEventRefresh(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
     remoteEventQueue(priv, event, msg->callbackID);
 }
 
+static void
+remoteStoragePoolBuildEventVolumeJob(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                     virNetClientPtr client ATTRIBUTE_UNUSED,
+                                     void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    struct private_data *priv = conn->privateData;
+    remote_storage_pool_event_volume_job_msg *msg = evdata;
+    virStoragePoolPtr pool;
+    virObjectEventPtr event = NULL;
+
+    pool = get_nonnull_storage_pool(conn, msg->pool);
+    if (!pool)
+        return;
+
+    event = virStoragePoolEventVolumeJobNew(pool->name, pool->uuid,
+                                            msg->volume, msg->type,
+                                            msg->status);
+    virObjectUnref(pool);
+
+    remoteEventQueue(priv, event, msg->callbackID);
+}
+
 static void
 remoteNodeDeviceBuildEventLifecycle(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                     virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -6709,6 +6900,42 @@ callFull(virConnectPtr conn ATTRIBUTE_UNUSED,
     return rv;
 }
 
+/*
+ * Make all the @calls within a single round trip, filling in their
+ * serial numbers. See virNetClientProgramCallBatch.
+ */
+static int
+callBatch(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          unsigned int flags,
+          virNetClientProgramBatchCallPtr calls,
+          size_t ncalls)
+{
+    int rv;
+    size_t i;
+    virNetClientProgramPtr prog;
+    virNetClientPtr client = priv->client;
+
+    if (flags & REMOTE_CALL_QEMU)
+        prog = priv->qemuProgram;
+    else if (flags & REMOTE_CALL_LXC)
+        prog = priv->lxcProgram;
+    else
+        prog = priv->remoteProgram;
+
+    for (i = 0; i < ncalls; i++)
+        calls[i].serial = priv->counter++;
+    priv->localUses++;
+
+    /* Unlock for the same reasons as callFull */
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramCallBatch(prog, client, calls, ncalls);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    return rv;
+}
+
 static int
 call(virConnectPtr conn,
      struct private_data *priv,
@@ -7662,6 +7889,147 @@ remoteNetworkGetDHCPLeases(virNetworkPtr net,
 }
 
 
+static int
+remoteStatsValueDeserialize(virTypedParameterPtr dst,
+                            const char *field,
+                            remote_typed_param_value *src)
+{
+    virTypedParamsClear(dst, 1);
+    memset(dst, 0, sizeof(*dst));
+
+    if (virStrcpyStatic(dst->field, field) == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("parameter %s too big for destination"), field);
+        return -1;
+    }
+
+    switch ((virTypedParameterType) src->type) {
+    case VIR_TYPED_PARAM_INT:
+        dst->value.i = src->remote_typed_param_value_u.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        dst->value.ui = src->remote_typed_param_value_u.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        dst->value.l = src->remote_typed_param_value_u.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        dst->value.ul = src->remote_typed_param_value_u.ul;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        dst->value.d = src->remote_typed_param_value_u.d;
+        break;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        dst->value.b = src->remote_typed_param_value_u.b;
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        if (VIR_STRDUP(dst->value.s, src->remote_typed_param_value_u.s) < 0)
+            return -1;
+        break;
+    case VIR_TYPED_PARAM_LAST:
+    default:
+        virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
+                       src->type);
+        return -1;
+    }
+
+    dst->type = src->type;
+    return 0;
+}
+
+
+/* Variant of remoteConnectGetAllDomainStats for servers which send each
+ * distinct field name only once */
+static int
+remoteConnectGetAllDomainStatsCompact(virConnectPtr conn,
+                                      struct private_data *priv,
+                                      remote_connect_get_all_domain_stats_compact_args *args,
+                                      virDomainStatsRecordPtr **retStats)
+{
+    int rv = -1;
+    size_t i;
+    size_t j;
+    remote_connect_get_all_domain_stats_compact_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COMPACT,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_args, (char *)args,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    remoteDriverUnlock(priv);
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of stats entries is %d, which exceeds max limit: %d"),
+                       ret.retStats.retStats_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.retStats.retStats_len; i++) {
+        remote_domain_stats_compact_record *rec = ret.retStats.retStats_val + i;
+
+        if (rec->params.params_len > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("too many parameters '%u' for limit '%d'"),
+                           rec->params.params_len,
+                           REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+            goto cleanup;
+        }
+
+        if (VIR_ALLOC(elem) < 0 ||
+            VIR_ALLOC_N(elem->params, rec->params.params_len) < 0)
+            goto cleanup;
+
+        for (j = 0; j < rec->params.params_len; j++) {
+            remote_domain_stats_value *value = rec->params.params_val + j;
+
+            if (value->id >= ret.fields.fields_len) {
+                virReportError(VIR_ERR_RPC,
+                               _("unknown domain stats field id %u"),
+                               value->id);
+                goto cleanup;
+            }
+
+            if (remoteStatsValueDeserialize(elem->params + j,
+                                            ret.fields.fields_val[value->id],
+                                            &value->value) < 0)
+                goto cleanup;
+            elem->nparams++;
+        }
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        tmpret[i] = elem;
+        elem = NULL;
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = ret.retStats.retStats_len;
+
+ cleanup:
+    if (elem) {
+        virTypedParamsFree(elem->params, elem->nparams);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
+
 static int
 remoteConnectGetAllDomainStats(virConnectPtr conn,
                                virDomainPtr *doms,
@@ -7679,6 +8047,7 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
     virDomainStatsRecordPtr *tmpret = NULL;
 
     memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
 
     if (ndoms) {
         if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0)
@@ -7692,7 +8061,20 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
     args.stats = stats;
     args.flags = flags;
 
-    memset(&ret, 0, sizeof(ret));
+    *retStats = NULL;
+
+    if (priv->serverCompactStats) {
+        remote_connect_get_all_domain_stats_compact_args cargs;
+
+        cargs.doms.doms_val = args.doms.doms_val;
+        cargs.doms.doms_len = args.doms.doms_len;
+        cargs.stats = stats;
+        cargs.flags = flags;
+
+        rv = remoteConnectGetAllDomainStatsCompact(conn, priv, &cargs,
+                                                   retStats);
+        goto cleanup;
+    }
 
     remoteDriverLock(priv);
     if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
@@ -7710,8 +8092,6 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
         goto cleanup;
     }
 
-    *retStats = NULL;
-
     if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0)
         goto cleanup;
 
@@ -7754,66 +8134,751 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
 
 
 static int
-remoteNodeAllocPages(virConnectPtr conn,
-                     unsigned int npages,
-                     unsigned int *pageSizes,
-                     unsigned long long *pageCounts,
-                     int startCell,
-                     unsigned int cellCount,
-                     unsigned int flags)
+remoteDomainGetStatsHistory(virDomainPtr dom,
+                            unsigned long long start,
+                            unsigned long long end,
+                            virDomainStatsRecordPtr **samples,
+                            unsigned int flags)
 {
+    struct private_data *priv = dom->conn->privateData;
     int rv = -1;
-    remote_node_alloc_pages_args args;
-    remote_node_alloc_pages_ret ret;
-    struct private_data *priv = conn->privateData;
+    size_t i;
+    remote_domain_get_stats_history_args args;
+    remote_domain_get_stats_history_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
 
     remoteDriverLock(priv);
 
-    if (npages > REMOTE_NODE_MAX_CELLS) {
-        virReportError(VIR_ERR_RPC,
-                       _("too many NUMA cells: %d > %d"),
-                       npages, REMOTE_NODE_MAX_CELLS);
-        goto done;
-    }
-
-    args.pageSizes.pageSizes_val = (u_int *) pageSizes;
-    args.pageSizes.pageSizes_len = npages;
-    args.pageCounts.pageCounts_val = (uint64_t *) pageCounts;
-    args.pageCounts.pageCounts_len = npages;
-    args.startCell = startCell;
-    args.cellCount = cellCount;
+    make_nonnull_domain(&args.dom, dom);
+    args.start = start;
+    args.end = end;
     args.flags = flags;
 
     memset(&ret, 0, sizeof(ret));
-    if (call(conn, priv, 0, REMOTE_PROC_NODE_ALLOC_PAGES,
-             (xdrproc_t) xdr_remote_node_alloc_pages_args, (char *) &args,
-             (xdrproc_t) xdr_remote_node_alloc_pages_ret, (char *) &ret) == -1)
+    if (call(dom->conn, priv, 0, REMOTE_PROC_DOMAIN_GET_STATS_HISTORY,
+             (xdrproc_t)xdr_remote_domain_get_stats_history_args, (char *)&args,
+             (xdrproc_t)xdr_remote_domain_get_stats_history_ret, (char *)&ret) == -1)
         goto done;
 
-    rv = ret.ret;
-
- done:
-    remoteDriverUnlock(priv);
-    return rv;
-}
+    if (ret.samples.samples_len > REMOTE_DOMAIN_STATS_HISTORY_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of stats samples is %d, which exceeds max limit: %d"),
+                       ret.samples.samples_len, REMOTE_DOMAIN_STATS_HISTORY_MAX);
+        goto cleanup;
+    }
 
+    if (VIR_ALLOC_N(tmpret, ret.samples.samples_len + 1) < 0)
+        goto cleanup;
 
-static int
-remoteDomainGetFSInfo(virDomainPtr dom,
-                      virDomainFSInfoPtr **info,
-                      unsigned int flags)
-{
-    int rv = -1;
-    size_t i, j, len;
-    struct private_data *priv = dom->conn->privateData;
-    remote_domain_get_fsinfo_args args;
-    remote_domain_get_fsinfo_ret ret;
-    remote_domain_fsinfo *src;
-    virDomainFSInfoPtr *info_ret = NULL;
+    for (i = 0; i < ret.samples.samples_len; i++) {
+        remote_domain_stats_record *rec = ret.samples.samples_val + i;
 
-    remoteDriverLock(priv);
+        if (VIR_ALLOC(elem) < 0)
+            goto cleanup;
 
-    make_nonnull_domain(&args.dom, dom);
+        if (!(elem->dom = get_nonnull_domain(dom->conn, rec->dom)))
+            goto cleanup;
+
+        if (virTypedParamsDeserialize((virTypedParameterRemotePtr) rec->params.params_val,
+                                      rec->params.params_len,
+                                      REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                      &elem->params,
+                                      &elem->nparams))
+            goto cleanup;
+
+        tmpret[i] = elem;
+        elem = NULL;
+    }
+
+    *samples = tmpret;
+    tmpret = NULL;
+    rv = ret.samples.samples_len;
+
+ cleanup:
+    if (elem) {
+        virObjectUnref(elem->dom);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    xdr_free((xdrproc_t)xdr_remote_domain_get_stats_history_ret,
+             (char *) &ret);
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteConnectListDomainChanges(virConnectPtr conn,
+                               unsigned long long *cursor,
+                               virDomainPtr **changed,
+                               virDomainPtr **removed,
+                               unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i;
+    remote_connect_list_domain_changes_args args;
+    remote_connect_list_domain_changes_ret ret;
+    virDomainPtr *tmpchanged = NULL;
+    virDomainPtr *tmpremoved = NULL;
+
+    args.cursor = *cursor;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_LIST_DOMAIN_CHANGES,
+             (xdrproc_t)xdr_remote_connect_list_domain_changes_args, (char *)&args,
+             (xdrproc_t)xdr_remote_connect_list_domain_changes_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        return -1;
+    }
+    remoteDriverUnlock(priv);
+
+    if (ret.changed.changed_len > REMOTE_DOMAIN_LIST_MAX ||
+        ret.removed.removed_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Too many domains in the list of changes"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpchanged, ret.changed.changed_len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.changed.changed_len; i++) {
+        if (!(tmpchanged[i] = get_nonnull_domain(conn, ret.changed.changed_val[i])))
+            goto cleanup;
+    }
+
+    if (!ret.resync) {
+        if (VIR_ALLOC_N(tmpremoved, ret.removed.removed_len + 1) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ret.removed.removed_len; i++) {
+            if (!(tmpremoved[i] = get_nonnull_domain(conn, ret.removed.removed_val[i])))
+                goto cleanup;
+        }
+    }
+
+    *cursor = ret.cursor;
+    *changed = tmpchanged;
+    tmpchanged = NULL;
+    *removed = tmpremoved;
+    tmpremoved = NULL;
+    rv = ret.ret;
+
+ cleanup:
+    virObjectListFree(tmpchanged);
+    virObjectListFree(tmpremoved);
+    xdr_free((xdrproc_t)xdr_remote_connect_list_domain_changes_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
+
+/*
+ * Subscriptions to domain statistics. The server sends only the values
+ * which changed since the previous update; the full records are rebuilt
+ * here and handed over to the callback from the event loop.
+ */
+typedef struct _remoteStatsDomain remoteStatsDomain;
+typedef remoteStatsDomain *remoteStatsDomainPtr;
+struct _remoteStatsDomain {
+    unsigned long long tick; /* of the last update including the domain */
+
+    /* indexed by field id, type is 0 for fields the domain doesn't have */
+    virTypedParameterPtr values;
+    size_t nvalues;
+};
+
+struct _remoteStatsSubscription {
+    virObjectLockable parent;
+
+    virConnectPtr conn;
+    int callbackID;
+    virConnectDomainStatsCallback cb;
+    void *opaque;
+    virFreeCallback freecb;
+    bool removed;
+
+    char **fields; /* names indexed by field id */
+    size_t nfields;
+    virHashTablePtr domains; /* UUID string -> remoteStatsDomain */
+    unsigned long long tick;
+
+    /* the latest records not passed to the callback yet */
+    virDomainStatsRecordPtr *records;
+    int nrecords;
+    int timer;
+};
+
+static virClassPtr remoteStatsSubscriptionClass;
+
+static void remoteStatsSubscriptionDispose(void *obj);
+
+static int
+remoteStatsSubscriptionOnceInit(void)
+{
+    if (!(remoteStatsSubscriptionClass =
+          virClassNew(virClassForObjectLockable(),
+                      "remoteStatsSubscription",
+                      sizeof(remoteStatsSubscription),
+                      remoteStatsSubscriptionDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(remoteStatsSubscription)
+
+
+static void
+remoteStatsDomainFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    remoteStatsDomainPtr dom = payload;
+
+    if (!dom)
+        return;
+
+    virTypedParamsFree(dom->values, dom->nvalues);
+    VIR_FREE(dom);
+}
+
+
+static void
+remoteStatsSubscriptionClearFields(remoteStatsSubscriptionPtr sub)
+{
+    size_t i;
+
+    for (i = 0; i < sub->nfields; i++)
+        VIR_FREE(sub->fields[i]);
+    VIR_FREE(sub->fields);
+    sub->nfields = 0;
+}
+
+
+static void
+remoteStatsSubscriptionDispose(void *obj)
+{
+    remoteStatsSubscriptionPtr sub = obj;
+
+    if (sub->freecb)
+        (sub->freecb)(sub->opaque);
+
+    virDomainStatsRecordListFree(sub->records);
+    virHashFree(sub->domains);
+    remoteStatsSubscriptionClearFields(sub);
+    virObjectUnref(sub->conn);
+}
+
+
+static remoteStatsSubscriptionPtr
+remoteStatsSubscriptionNew(virConnectPtr conn,
+                           virConnectDomainStatsCallback cb,
+                           void *opaque)
+{
+    remoteStatsSubscriptionPtr sub;
+
+    if (remoteStatsSubscriptionInitialize() < 0)
+        return NULL;
+
+    if (!(sub = virObjectLockableNew(remoteStatsSubscriptionClass)))
+        return NULL;
+
+    if (!(sub->domains = virHashCreate(32, remoteStatsDomainFree))) {
+        virObjectUnref(sub);
+        return NULL;
+    }
+
+    sub->conn = virObjectRef(conn);
+    sub->cb = cb;
+    sub->opaque = opaque;
+    sub->callbackID = -1;
+    sub->timer = -1;
+
+    return sub;
+}
+
+
+static int
+remoteStatsDomainIsStale(const void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         const void *opaque)
+{
+    const remoteStatsDomain *dom = payload;
+    const unsigned long long *tick = opaque;
+
+    return dom->tick != *tick;
+}
+
+
+/* Applies the changes in @msg to the state kept in @sub */
+static int
+remoteStatsSubscriptionUpdate(remoteStatsSubscriptionPtr sub,
+                              remote_connect_domain_stats_event_msg *msg)
+{
+    size_t i;
+    size_t j;
+
+    if (msg->full) {
+        remoteStatsSubscriptionClearFields(sub);
+        virHashRemoveAll(sub->domains);
+    }
+
+    if (msg->fields.fields_len > REMOTE_DOMAIN_STATS_DELTA_MAX ||
+        msg->records.records_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Too many entries in domain stats update"));
+        return -1;
+    }
+
+    for (i = 0; i < msg->fields.fields_len; i++) {
+        remote_domain_stats_field *field = &msg->fields.fields_val[i];
+
+        if (field->id >= REMOTE_DOMAIN_STATS_DELTA_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("invalid domain stats field id %u"), field->id);
+            return -1;
+        }
+
+        if (field->id >= sub->nfields &&
+            VIR_EXPAND_N(sub->fields, sub->nfields,
+                         field->id + 1 - sub->nfields) < 0)
+            return -1;
+
+        VIR_FREE(sub->fields[field->id]);
+        if (VIR_STRDUP(sub->fields[field->id], field->name) < 0)
+            return -1;
+    }
+
+    sub->tick++;
+
+    for (i = 0; i < msg->records.records_len; i++) {
+        remote_domain_stats_delta *delta = &msg->records.records_val[i];
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+        remoteStatsDomainPtr dom;
+
+        virUUIDFormat((unsigned char *) delta->dom.uuid, uuidstr);
+        if (!(dom = virHashLookup(sub->domains, uuidstr))) {
+            if (VIR_ALLOC(dom) < 0)
+                return -1;
+            if (virHashAddEntry(sub->domains, uuidstr, dom) < 0) {
+                VIR_FREE(dom);
+                return -1;
+            }
+        }
+        dom->tick = sub->tick;
+
+        if (dom->nvalues < sub->nfields &&
+            VIR_EXPAND_N(dom->values, dom->nvalues,
+                         sub->nfields - dom->nvalues) < 0)
+            return -1;
+
+        for (j = 0; j < delta->changed.changed_len; j++) {
+            remote_domain_stats_value *value = &delta->changed.changed_val[j];
+
+            if (value->id >= sub->nfields || !sub->fields[value->id]) {
+                virReportError(VIR_ERR_RPC,
+                               _("unknown domain stats field id %u"),
+                               value->id);
+                return -1;
+            }
+
+            if (remoteStatsValueDeserialize(&dom->values[value->id],
+                                            sub->fields[value->id],
+                                            &value->value) < 0)
+                return -1;
+        }
+
+        for (j = 0; j < delta->removed.removed_len; j++) {
+            unsigned int id = delta->removed.removed_val[j];
+
+            if (id < dom->nvalues) {
+                virTypedParamsClear(&dom->values[id], 1);
+                dom->values[id].type = 0;
+            }
+        }
+    }
+
+    if (virHashRemoveSet(sub->domains, remoteStatsDomainIsStale,
+                         &sub->tick) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* Builds the full records of the domains in @msg, in the same order */
+static int
+remoteStatsSubscriptionBuild(remoteStatsSubscriptionPtr sub,
+                             remote_connect_domain_stats_event_msg *msg,
+                             virDomainStatsRecordPtr **records)
+{
+    virDomainStatsRecordPtr *tmp = NULL;
+    virDomainStatsRecordPtr elem = NULL;
+    int nrecords = 0;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(tmp, msg->records.records_len + 1) < 0)
+        return -1;
+
+    for (i = 0; i < msg->records.records_len; i++) {
+        remote_domain_stats_delta *delta = &msg->records.records_val[i];
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+        remoteStatsDomainPtr dom;
+
+        virUUIDFormat((unsigned char *) delta->dom.uuid, uuidstr);
+        if (!(dom = virHashLookup(sub->domains, uuidstr)))
+            continue;
+
+        if (VIR_ALLOC(elem) < 0 ||
+            VIR_ALLOC_N(elem->params, dom->nvalues) < 0)
+            goto cleanup;
+
+        for (j = 0; j < dom->nvalues; j++) {
+            virTypedParameterPtr param = &elem->params[elem->nparams];
+
+            if (!dom->values[j].type)
+                continue;
+
+            *param = dom->values[j];
+            if (param->type == VIR_TYPED_PARAM_STRING) {
+                param->value.s = NULL;
+                if (VIR_STRDUP(param->value.s, dom->values[j].value.s) < 0) {
+                    param->type = 0;
+                    goto cleanup;
+                }
+            }
+            elem->nparams++;
+        }
+
+        if (!(elem->dom = get_nonnull_domain(sub->conn, delta->dom)))
+            goto cleanup;
+
+        tmp[nrecords++] = elem;
+        elem = NULL;
+    }
+
+    *records = tmp;
+    tmp = NULL;
+    ret = nrecords;
+
+ cleanup:
+    if (elem) {
+        virTypedParamsFree(elem->params, elem->nparams);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmp);
+    return ret;
+}
+
+
+static void
+remoteStatsSubscriptionDispatch(int timer,
+                                void *opaque)
+{
+    remoteStatsSubscriptionPtr sub = opaque;
+    virDomainStatsRecordPtr *records;
+    int nrecords;
+    bool removed;
+
+    virObjectLock(sub);
+    virEventRemoveTimeout(timer);
+    sub->timer = -1;
+    records = sub->records;
+    nrecords = sub->nrecords;
+    sub->records = NULL;
+    sub->nrecords = 0;
+    removed = sub->removed;
+    virObjectUnlock(sub);
+
+    if (records && !removed)
+        (sub->cb)(sub->conn, records, nrecords, sub->opaque);
+
+    virDomainStatsRecordListFree(records);
+}
+
+
+static void
+remoteConnectDispatchEventBatch(virNetClientProgramPtr prog,
+                                virNetClientPtr client,
+                                void *evdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    remote_connect_event_batch_msg *msg = evdata;
+    size_t i;
+
+    VIR_DEBUG("Dispatching batch of %u events", msg->events.events_len);
+
+    for (i = 0; i < msg->events.events_len; i++) {
+        remote_connect_event_batch_entry *entry = msg->events.events_val + i;
+
+        if (entry->procedure == REMOTE_PROC_CONNECT_EVENT_BATCH) {
+            VIR_WARN("Ignoring nested event batch");
+            continue;
+        }
+
+        if (virNetClientProgramDispatchPayload(prog, client, entry->procedure,
+                                               entry->payload.payload_val,
+                                               entry->payload.payload_len) < 0)
+            VIR_WARN("Failed to dispatch batched event %d", entry->procedure);
+    }
+}
+
+
+static void
+remoteConnectNotifyEventLost(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                             virNetClientPtr client ATTRIBUTE_UNUSED,
+                             void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    remote_connect_event_lost_msg *msg = evdata;
+
+    VIR_WARN("Server dropped %llu events for connection %p as they were "
+             "not read fast enough", (unsigned long long)msg->count, conn);
+}
+
+
+static void
+remoteConnectNotifyDomainStats(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                               virNetClientPtr client ATTRIBUTE_UNUSED,
+                               void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    struct private_data *priv = conn->privateData;
+    remote_connect_domain_stats_event_msg *msg = evdata;
+    remoteStatsSubscriptionPtr sub = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+    int nrecords;
+    size_t i;
+
+    virMutexLock(&priv->statsLock);
+    for (i = 0; i < priv->nstatsSubscriptions; i++) {
+        if (priv->statsSubscriptions[i]->callbackID == msg->callbackID) {
+            sub = virObjectRef(priv->statsSubscriptions[i]);
+            break;
+        }
+    }
+    virMutexUnlock(&priv->statsLock);
+
+    if (!sub) {
+        VIR_DEBUG("No subscription for domain stats callback %d",
+                  msg->callbackID);
+        return;
+    }
+
+    virObjectLock(sub);
+    if (sub->removed)
+        goto cleanup;
+
+    if (remoteStatsSubscriptionUpdate(sub, msg) < 0 ||
+        (nrecords = remoteStatsSubscriptionBuild(sub, msg, &records)) < 0) {
+        VIR_WARN("unable to process domain stats update for callback %d: %s",
+                 msg->callbackID, virGetLastErrorMessage());
+        virResetLastError();
+        goto cleanup;
+    }
+
+    /* If the callback didn't get to the previous records yet, they are
+     * outdated now anyway */
+    virDomainStatsRecordListFree(sub->records);
+    sub->records = records;
+    sub->nrecords = nrecords;
+
+    if (sub->timer < 0) {
+        virObjectRef(sub);
+        if ((sub->timer = virEventAddTimeout(0, remoteStatsSubscriptionDispatch,
+                                             sub, virObjectFreeCallback)) < 0) {
+            VIR_WARN("unable to dispatch domain stats for callback %d",
+                     msg->callbackID);
+            virObjectUnref(sub);
+        }
+    }
+
+ cleanup:
+    virObjectUnlock(sub);
+    virObjectUnref(sub);
+}
+
+
+static int
+remoteConnectDomainStatsRegister(virConnectPtr conn,
+                                 unsigned int stats,
+                                 unsigned int interval,
+                                 virConnectDomainStatsCallback cb,
+                                 void *opaque,
+                                 virFreeCallback freecb,
+                                 unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    remote_connect_domain_stats_register_args args;
+    remote_connect_domain_stats_register_ret ret;
+    remote_connect_domain_stats_deregister_args dargs;
+    remoteStatsSubscriptionPtr sub = NULL;
+    int rv = -1;
+
+    if (!(sub = remoteStatsSubscriptionNew(conn, cb, opaque)))
+        return -1;
+
+    args.stats = stats;
+    args.interval = interval;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_DOMAIN_STATS_REGISTER,
+             (xdrproc_t) xdr_remote_connect_domain_stats_register_args, (char *) &args,
+             (xdrproc_t) xdr_remote_connect_domain_stats_register_ret, (char *) &ret) == -1)
+        goto done;
+
+    /* The first update is sent only after @interval, the subscription is
+     * in place by then */
+    sub->callbackID = ret.callbackID;
+
+    virMutexLock(&priv->statsLock);
+    if (VIR_APPEND_ELEMENT_COPY(priv->statsSubscriptions,
+                                priv->nstatsSubscriptions, sub) < 0) {
+        virMutexUnlock(&priv->statsLock);
+        dargs.callbackID = ret.callbackID;
+        ignore_value(call(conn, priv, 0,
+                          REMOTE_PROC_CONNECT_DOMAIN_STATS_DEREGISTER,
+                          (xdrproc_t) xdr_remote_connect_domain_stats_deregister_args,
+                          (char *) &dargs,
+                          (xdrproc_t) xdr_void, (char *) NULL));
+        goto done;
+    }
+    virMutexUnlock(&priv->statsLock);
+
+    /* Only now the subscription owns @opaque */
+    sub->freecb = freecb;
+    rv = ret.callbackID;
+    sub = NULL;
+
+ done:
+    remoteDriverUnlock(priv);
+    virObjectUnref(sub);
+    return rv;
+}
+
+
+static int
+remoteConnectDomainStatsDeregister(virConnectPtr conn,
+                                   int callbackID)
+{
+    struct private_data *priv = conn->privateData;
+    remote_connect_domain_stats_deregister_args args;
+    remoteStatsSubscriptionPtr sub = NULL;
+    size_t i;
+    int rv = -1;
+
+    virMutexLock(&priv->statsLock);
+    for (i = 0; i < priv->nstatsSubscriptions; i++) {
+        if (priv->statsSubscriptions[i]->callbackID == callbackID) {
+            sub = priv->statsSubscriptions[i];
+            VIR_DELETE_ELEMENT(priv->statsSubscriptions, i,
+                               priv->nstatsSubscriptions);
+            break;
+        }
+    }
+    virMutexUnlock(&priv->statsLock);
+
+    if (!sub) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("could not find statistics subscription %d"),
+                       callbackID);
+        return -1;
+    }
+
+    virObjectLock(sub);
+    sub->removed = true;
+    virObjectUnlock(sub);
+
+    args.callbackID = callbackID;
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_DOMAIN_STATS_DEREGISTER,
+             (xdrproc_t) xdr_remote_connect_domain_stats_deregister_args, (char *) &args,
+             (xdrproc_t) xdr_void, (char *) NULL) == -1)
+        goto done;
+
+    rv = 0;
+
+ done:
+    remoteDriverUnlock(priv);
+    virObjectUnref(sub);
+    return rv;
+}
+
+
+static int
+remoteNodeAllocPages(virConnectPtr conn,
+                     unsigned int npages,
+                     unsigned int *pageSizes,
+                     unsigned long long *pageCounts,
+                     int startCell,
+                     unsigned int cellCount,
+                     unsigned int flags)
+{
+    int rv = -1;
+    remote_node_alloc_pages_args args;
+    remote_node_alloc_pages_ret ret;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (npages > REMOTE_NODE_MAX_CELLS) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many NUMA cells: %d > %d"),
+                       npages, REMOTE_NODE_MAX_CELLS);
+        goto done;
+    }
+
+    args.pageSizes.pageSizes_val = (u_int *) pageSizes;
+    args.pageSizes.pageSizes_len = npages;
+    args.pageCounts.pageCounts_val = (uint64_t *) pageCounts;
+    args.pageCounts.pageCounts_len = npages;
+    args.startCell = startCell;
+    args.cellCount = cellCount;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_NODE_ALLOC_PAGES,
+             (xdrproc_t) xdr_remote_node_alloc_pages_args, (char *) &args,
+             (xdrproc_t) xdr_remote_node_alloc_pages_ret, (char *) &ret) == -1)
+        goto done;
+
+    rv = ret.ret;
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteDomainGetFSInfo(virDomainPtr dom,
+                      virDomainFSInfoPtr **info,
+                      unsigned int flags)
+{
+    int rv = -1;
+    size_t i, j, len;
+    struct private_data *priv = dom->conn->privateData;
+    remote_domain_get_fsinfo_args args;
+    remote_domain_get_fsinfo_ret ret;
+    remote_domain_fsinfo *src;
+    virDomainFSInfoPtr *info_ret = NULL;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_domain(&args.dom, dom);
 
     args.flags = flags;
 
@@ -8132,6 +9197,42 @@ remoteStorageVolGetInfoFlags(virStorageVolPtr vol,
 }
 
 
+static int
+remoteStorageVolGetJobInfo(virStorageVolPtr vol,
+                           virStorageVolJobInfoPtr result,
+                           unsigned int flags)
+{
+    int rv = -1;
+    struct private_data *priv = vol->conn->privateData;
+    remote_storage_vol_get_job_info_args args;
+    remote_storage_vol_get_job_info_ret ret;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_storage_vol(&args.vol, vol);
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(vol->conn, priv, 0, REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_args,
+             (char *)&args,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_ret,
+             (char *)&ret) == -1) {
+        goto done;
+    }
+
+    result->type = ret.type;
+    result->processed = ret.processed;
+    result->total = ret.total;
+    rv = 0;
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
  * (name, uuid) pair into virDomainPtr or virNetworkPtr object.
  * These can return NULL if underlying memory allocations fail,
@@ -8497,7 +9598,15 @@ static virHypervisorDriver hypervisor_driver = {
     .domainSetGuestVcpus = remoteDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = remoteDomainSetVcpu, /* 3.1.0 */
     .domainSetBlockThreshold = remoteDomainSetBlockThreshold, /* 3.2.0 */
-    .domainSetLifecycleAction = remoteDomainSetLifecycleAction /* 3.9.0 */
+    .domainSetLifecycleAction = remoteDomainSetLifecycleAction, /* 3.9.0 */
+    .connectListDomainChanges = remoteConnectListDomainChanges, /* 4.0.0 */
+    .connectDomainStatsRegister = remoteConnectDomainStatsRegister, /* 4.0.0 */
+    .connectDomainStatsDeregister = remoteConnectDomainStatsDeregister, /* 4.0.0 */
+    .domainGetStatsHistory = remoteDomainGetStatsHistory, /* 4.0.0 */
+    .domainGetXMLDescSubtree = remoteDomainGetXMLDescSubtree, /* 4.0.0 */
+    .domainAttachDevices = remoteDomainAttachDevices, /* 4.0.0 */
+    .domainBlockBackup = remoteDomainBlockBackup, /* 4.0.0 */
+    .domainStartDirtyRateCalc = remoteDomainStartDirtyRateCalc, /* 4.0.0 */
 };
 
 static virNetworkDriver network_driver = {
@@ -8589,6 +9698,7 @@ static virStorageDriver storage_driver = {
     .storageVolResize = remoteStorageVolResize, /* 0.9.10 */
     .storagePoolIsActive = remoteStoragePoolIsActive, /* 0.7.3 */
     .storagePoolIsPersistent = remoteStoragePoolIsPersistent, /* 0.7.3 */
+    .storageVolGetJobInfo = remoteStorageVolGetJobInfo, /* 4.0.0 */
 };
 
 static virSecretDriver secret_driver = {
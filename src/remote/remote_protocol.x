@@ -115,6 +115,9 @@ const REMOTE_DOMAIN_PERF_EVENTS_MAX = 64;
 /* Upper limit on block copy tunable parameters. */
 const REMOTE_DOMAIN_BLOCK_COPY_PARAMETERS_MAX = 16;
 
+/* Upper limit on number of block backup tunables. */
+const REMOTE_DOMAIN_BLOCK_BACKUP_PARAMETERS_MAX = 16;
+
 /* Upper limit on list of node cpu stats. */
 const REMOTE_NODE_CPU_STATS_MAX = 16;
 
@@ -235,6 +238,13 @@ const REMOTE_NETWORK_DHCP_LEASES_MAX = 65536;
 /* Upper limit on count of parameters returned via bulk stats API */
 const REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX = 262144;
 
+/* Upper limit on count of values in one domain stats update */
+const REMOTE_DOMAIN_STATS_DELTA_MAX = 262144;
+
+/* Upper limit on count of samples returned for one domain; the same as
+ * QEMU_STATS_HISTORY_LENGTH_MAX */
+const REMOTE_DOMAIN_STATS_HISTORY_MAX = 4096;
+
 /* Upper limit of message size for tunable event. */
 const REMOTE_DOMAIN_EVENT_TUNABLE_MAX = 2048;
 
@@ -253,6 +263,18 @@ const REMOTE_DOMAIN_IP_ADDR_MAX = 2048;
 /* Upper limit on number of guest vcpu information entries */
 const REMOTE_DOMAIN_GUEST_VCPU_PARAMS_MAX = 64;
 
+/* Upper limit on number of devices attached in one virDomainAttachDevices call */
+const REMOTE_DOMAIN_ATTACH_DEVICES_MAX = 256;
+
+/* Upper limit on number of events delivered in one batch message */
+const REMOTE_CONNECT_EVENT_BATCH_MAX = 1024;
+
+/* Upper limit of the encoded size of a single event in a batch */
+const REMOTE_CONNECT_EVENT_BATCH_PAYLOAD_MAX = 262144;
+
+/* Flags for REMOTE_PROC_CONNECT_EVENT_BATCH_ENABLE */
+const REMOTE_CONNECT_EVENT_BATCH_COALESCE = 1; /* drop superseded lifecycle events */
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -1953,6 +1975,17 @@ struct remote_storage_vol_get_info_flags_ret { /* insert@1 */
     unsigned hyper allocation;
 };
 
+struct remote_storage_vol_get_job_info_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_get_job_info_ret {
+    int type;
+    unsigned hyper processed;
+    unsigned hyper total;
+};
+
 struct remote_storage_vol_get_path_args {
     remote_nonnull_storage_vol vol;
 };
@@ -3176,6 +3209,14 @@ struct remote_storage_pool_event_refresh_msg {
     remote_nonnull_storage_pool pool;
 };
 
+struct remote_storage_pool_event_volume_job_msg {
+    int callbackID;
+    remote_nonnull_storage_pool pool;
+    remote_nonnull_string volume;
+    int type;
+    int status;
+};
+
 struct remote_connect_node_device_event_register_any_args {
     int eventID;
     remote_node_device dev;
@@ -3440,6 +3481,140 @@ struct remote_domain_set_lifecycle_action_args {
     unsigned int flags;
 };
 
+struct remote_connect_list_domain_changes_args {
+    unsigned hyper cursor;
+    unsigned int flags;
+};
+
+struct remote_connect_list_domain_changes_ret {
+    unsigned hyper cursor;
+    remote_nonnull_domain changed<REMOTE_DOMAIN_LIST_MAX>;
+    remote_nonnull_domain removed<REMOTE_DOMAIN_LIST_MAX>;
+    int resync; /* boolean; if set, @removed is meaningless */
+    unsigned int ret;
+};
+
+struct remote_connect_domain_stats_register_args {
+    unsigned int stats;
+    unsigned int interval;
+    unsigned int flags;
+};
+
+struct remote_connect_domain_stats_register_ret {
+    int callbackID;
+};
+
+struct remote_connect_domain_stats_deregister_args {
+    int callbackID;
+};
+
+/* Binds a stats field name to the id used for it in later updates */
+struct remote_domain_stats_field {
+    unsigned int id;
+    remote_nonnull_string name;
+};
+
+struct remote_domain_stats_value {
+    unsigned int id;
+    remote_typed_param_value value;
+};
+
+/* Changes of one domain's stats since the previous update */
+struct remote_domain_stats_delta {
+    remote_nonnull_domain dom;
+    remote_domain_stats_value changed<REMOTE_DOMAIN_STATS_DELTA_MAX>;
+    unsigned int removed<REMOTE_DOMAIN_STATS_DELTA_MAX>;
+};
+
+struct remote_connect_domain_stats_event_msg {
+    int callbackID;
+    int full; /* boolean; drop all state, @fields starts from scratch */
+    remote_domain_stats_field fields<REMOTE_DOMAIN_STATS_DELTA_MAX>;
+    remote_domain_stats_delta records<REMOTE_DOMAIN_LIST_MAX>;
+};
+
+/* Like remote_domain_stats_record, but refers to the field names by
+ * their index into remote_connect_get_all_domain_stats_compact_ret.fields */
+struct remote_domain_stats_compact_record {
+    remote_nonnull_domain dom;
+    remote_domain_stats_value params<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+};
+
+struct remote_connect_get_all_domain_stats_compact_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_get_all_domain_stats_compact_ret {
+    remote_nonnull_string fields<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+    remote_domain_stats_compact_record retStats<REMOTE_DOMAIN_LIST_MAX>;
+};
+
+struct remote_domain_get_stats_history_args {
+    remote_nonnull_domain dom;
+    unsigned hyper start;
+    unsigned hyper end;
+    unsigned int flags;
+};
+
+struct remote_domain_get_stats_history_ret {
+    remote_domain_stats_record samples<REMOTE_DOMAIN_STATS_HISTORY_MAX>;
+};
+
+struct remote_domain_get_xml_desc_subtree_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string subtree;
+    unsigned int flags;
+};
+
+struct remote_domain_get_xml_desc_subtree_ret {
+    remote_nonnull_string xml;
+};
+
+struct remote_domain_attach_devices_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string xmls<REMOTE_DOMAIN_ATTACH_DEVICES_MAX>; /* (const char **) */
+    unsigned int flags;
+};
+
+struct remote_connect_event_batch_enable_args {
+    unsigned int flags;
+};
+
+/* An event exactly as it would have been encoded in a message of
+ * its own, @procedure being the REMOTE_PROC_* the message would carry */
+struct remote_connect_event_batch_entry {
+    int procedure;
+    opaque payload<REMOTE_CONNECT_EVENT_BATCH_PAYLOAD_MAX>;
+};
+
+struct remote_connect_event_batch_msg {
+    remote_connect_event_batch_entry events<REMOTE_CONNECT_EVENT_BATCH_MAX>;
+};
+
+struct remote_connect_event_lost_msg {
+    unsigned hyper count;
+};
+
+struct remote_connect_shared_replies_enable_args {
+    unsigned int min_size;
+};
+
+struct remote_domain_block_backup_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string path;
+    remote_nonnull_string destxml;
+    remote_typed_param params<REMOTE_DOMAIN_BLOCK_BACKUP_PARAMETERS_MAX>;
+    unsigned int flags;
+};
+
+struct remote_domain_start_dirty_rate_calc_args {
+    remote_nonnull_domain dom;
+    int seconds;
+    unsigned int flags;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -3464,13 +3639,15 @@ enum remote_procedure {
      *   <paramnumber> specifies at which offset the stream parameter is inserted
      *   in the function parameter list.
      *
-     * - @priority: low|high
+     * - @priority: low|high|urgent
      *
      *   Each API that might eventually access hypervisor's monitor (and thus
      *   block) MUST fall into low priority. However, there are some exceptions
      *   to this rule, e.g. domainDestroy. Other APIs MAY be marked as high
      *   priority. If in doubt, it's safe to choose low. Low is taken as default,
-     *   and thus can be left out.
+     *   and thus can be left out. Cheap status queries which only look at
+     *   cached state and never wait for a domain job MAY be marked as urgent,
+     *   so that they are served ahead of any other queued call.
      *
      * - @acl: <object>:<permission>
      * - @acl: <object>:<permission>:<flagname>
@@ -4954,7 +5131,7 @@ enum remote_procedure {
 
     /**
      * @generate: none
-     * @priority: high
+     * @priority: urgent
      * @acl: domain:read
      */
     REMOTE_PROC_DOMAIN_GET_STATE = 212,
@@ -5068,7 +5245,7 @@ enum remote_procedure {
 
     /**
      * @generate: both
-     * @priority: high
+     * @priority: urgent
      * @acl: domain:read
      */
     REMOTE_PROC_DOMAIN_GET_CONTROL_INFO = 229,
@@ -6120,5 +6297,111 @@ enum remote_procedure {
      * @generate: both
      * @acl: domain:write
      */
-    REMOTE_PROC_DOMAIN_SET_LIFECYCLE_ACTION = 390
+    REMOTE_PROC_DOMAIN_SET_LIFECYCLE_ACTION = 390,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:search_domains
+     * @aclfilter: domain:getattr
+     */
+    REMOTE_PROC_CONNECT_LIST_DOMAIN_CHANGES = 391,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:search_domains
+     * @aclfilter: domain:read
+     */
+    REMOTE_PROC_CONNECT_DOMAIN_STATS_REGISTER = 392,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:read
+     */
+    REMOTE_PROC_CONNECT_DOMAIN_STATS_DEREGISTER = 393,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT = 394,
+
+    /**
+     * @generate: none
+     * @acl: connect:search_domains
+     * @aclfilter: domain:read
+     */
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COMPACT = 395,
+
+    /**
+     * @generate: none
+     * @acl: domain:read
+     */
+    REMOTE_PROC_DOMAIN_GET_STATS_HISTORY = 396,
+
+    /**
+     * @generate: both
+     * @acl: domain:read
+     * @acl: domain:read_secure:VIR_DOMAIN_XML_SECURE
+     */
+    REMOTE_PROC_DOMAIN_GET_XML_DESC_SUBTREE = 397,
+
+    /**
+     * @generate: both
+     * @acl: domain:write
+     * @acl: domain:save:!VIR_DOMAIN_AFFECT_CONFIG|VIR_DOMAIN_AFFECT_LIVE
+     * @acl: domain:save:VIR_DOMAIN_AFFECT_CONFIG
+     */
+    REMOTE_PROC_DOMAIN_ATTACH_DEVICES = 398,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: storage_vol:read
+     */
+    REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO = 399,
+
+    /**
+     * @generate: both
+     * @acl: none
+     */
+    REMOTE_PROC_STORAGE_POOL_EVENT_VOLUME_JOB = 400,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    REMOTE_PROC_CONNECT_EVENT_BATCH_ENABLE = 401,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    REMOTE_PROC_CONNECT_EVENT_BATCH = 402,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    REMOTE_PROC_CONNECT_EVENT_LOST = 403,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    REMOTE_PROC_CONNECT_SHARED_REPLIES_ENABLE = 404,
+
+    /**
+     * @generate: both
+     * @acl: domain:block_write
+     */
+    REMOTE_PROC_DOMAIN_BLOCK_BACKUP = 405,
+
+    /**
+     * @generate: both
+     * @acl: domain:read
+     */
+    REMOTE_PROC_DOMAIN_START_DIRTY_RATE_CALC = 406
 };
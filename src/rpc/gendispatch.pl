@@ -292,10 +292,12 @@ while (<PROTOCOL>) {
         $calls{$name}->{acl} = $opts{acl};
         $calls{$name}->{aclfilter} = $opts{aclfilter};
 
-        # for now, we distinguish only two levels of priority:
-        # low (0) and high (1)
+        # we distinguish three levels of priority:
+        # low (0), high (1) and urgent (2)
         if (exists $opts{priority}) {
-            if ($opts{priority} eq "high") {
+            if ($opts{priority} eq "urgent") {
+                $calls{$name}->{priority} = 2;
+            } elsif ($opts{priority} eq "high") {
                 $calls{$name}->{priority} = 1;
             } elsif ($opts{priority} eq "low") {
                 $calls{$name}->{priority} = 0;
@@ -565,13 +567,14 @@ elsif ($mode eq "server") {
                     }
                     push(@args_list, "$1");
                     push(@args_list, "n$1");
-                    push(@getters_list, "    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->$1.$1_val,\n" .
-                                        "                                  args->$1.$1_len,\n" .
-                                        "                                  $2,\n" .
-                                        "                                  &$1,\n" .
-                                        "                                  &n$1) < 0)\n" .
+                    # strings are borrowed from args which outlive the call
+                    push(@getters_list, "    if (virTypedParamsDeserializeBorrow((virTypedParameterRemotePtr) args->$1.$1_val,\n" .
+                                        "                                        args->$1.$1_len,\n" .
+                                        "                                        $2,\n" .
+                                        "                                        &$1,\n" .
+                                        "                                        &n$1) < 0)\n" .
                                         "        goto cleanup;\n");
-                    push(@free_list, "    virTypedParamsFree($1, n$1);");
+                    push(@free_list, "    VIR_FREE($1);");
                 } elsif ($args_member =~ m/<\S+>;/ or $args_member =~ m/\[\S+\];/) {
                     # just make all other array types fail
                     die "unhandled type for argument value: $args_member";
@@ -1203,7 +1206,7 @@ elsif ($mode eq "server") {
 
     print "virNetServerProgramProc ${structprefix}Procs[] = {\n";
     for ($id = 0 ; $id <= $#calls ; $id++) {
-        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority);
+        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority, $procname);
 
         if (defined $calls[$id] && !$calls[$id]->{msg}) {
             $comment = "/* Method $calls[$id]->{ProcName} => $id */";
@@ -1214,6 +1217,7 @@ elsif ($mode eq "server") {
             $retlen = $rettype ne "void" ? "sizeof($rettype)" : "0";
             $argfilter = $argtype ne "void" ? "xdr_$argtype" : "xdr_void";
             $retfilter = $rettype ne "void" ? "xdr_$rettype" : "xdr_void";
+            $procname = "\"$calls[$id]->{ProcName}\"";
         } else {
             if ($calls[$id]->{msg}) {
                 $comment = "/* Async event $calls[$id]->{ProcName} => $id */";
@@ -1224,11 +1228,12 @@ elsif ($mode eq "server") {
             $arglen = $retlen = 0;
             $argfilter = "xdr_void";
             $retfilter = "xdr_void";
+            $procname = "NULL";
         }
 
     $priority = defined $calls[$id]->{priority} ? $calls[$id]->{priority} : 0;
 
-        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority\n},\n";
+        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority,\n   $procname\n},\n";
     }
     print "};\n";
     print "size_t ${structprefix}NProcs = ARRAY_CARDINALITY(${structprefix}Procs);\n";
@@ -36,6 +36,10 @@
 
 VIR_LOG_INIT("rpc.keepalive");
 
+/* Number of one second slots in the timing wheel; deadlines further in
+ * the future simply stay in their slot for more than one revolution */
+#define VIR_KEEPALIVE_WHEEL_SIZE 64
+
 struct _virKeepAlive {
     virObjectLockable parent;
 
@@ -44,7 +48,13 @@ struct _virKeepAlive {
     unsigned int countToDeath;
     time_t lastPacketReceived;
     time_t intervalStart;
-    int timer;
+    bool active;
+
+    /* Protected by the wheel lock */
+    time_t deadline;
+    int slot;
+    virKeepAlivePtr wheelPrev;
+    virKeepAlivePtr wheelNext;
 
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
@@ -53,8 +63,31 @@ struct _virKeepAlive {
 };
 
 
+/*
+ * Rather than each keepalive object having its own timer, which makes
+ * the event loop scan thousands of them whenever it computes its poll
+ * timeout, all of them share a single timer ticking every second which
+ * drives a timing wheel. Received traffic merely moves intervalStart
+ * forward; an object whose deadline passed is only rescheduled when
+ * the wheel reaches it.
+ */
+typedef struct _virKeepAliveWheel virKeepAliveWheel;
+struct _virKeepAliveWheel {
+    virMutex lock;
+    int timer;
+    time_t lastTick;
+    size_t nscheduled;
+    virKeepAlivePtr slots[VIR_KEEPALIVE_WHEEL_SIZE];
+};
+
+static virKeepAliveWheel virKeepAliveWheelData = {
+    .lock = VIR_MUTEX_INITIALIZER,
+    .timer = -1,
+};
+
 static virClassPtr virKeepAliveClass;
 static void virKeepAliveDispose(void *obj);
+static void virKeepAliveWheelTick(int timer, void *opaque);
 
 static int virKeepAliveOnceInit(void)
 {
@@ -114,6 +147,81 @@ virKeepAliveMessage(virKeepAlivePtr ka, int proc)
 }
 
 
+/* Must be called with the wheel locked */
+static void
+virKeepAliveWheelUnlink(virKeepAlivePtr ka)
+{
+    virKeepAliveWheel *wheel = &virKeepAliveWheelData;
+
+    if (ka->slot < 0)
+        return;
+
+    if (ka->wheelPrev)
+        ka->wheelPrev->wheelNext = ka->wheelNext;
+    else
+        wheel->slots[ka->slot] = ka->wheelNext;
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka->wheelPrev;
+
+    ka->wheelPrev = ka->wheelNext = NULL;
+    ka->slot = -1;
+    wheel->nscheduled--;
+}
+
+
+/*
+ * Make the wheel check @ka again once @deadline passed. Must be called
+ * with @ka locked.
+ */
+static int
+virKeepAliveSchedule(virKeepAlivePtr ka,
+                     time_t deadline)
+{
+    virKeepAliveWheel *wheel = &virKeepAliveWheelData;
+    int ret = -1;
+
+    virMutexLock(&wheel->lock);
+
+    if (wheel->timer < 0) {
+        wheel->timer = virEventAddTimeout(1000, virKeepAliveWheelTick,
+                                          NULL, NULL);
+        if (wheel->timer < 0)
+            goto cleanup;
+    } else if (wheel->nscheduled == 0) {
+        virEventUpdateTimeout(wheel->timer, 1000);
+    }
+
+    virKeepAliveWheelUnlink(ka);
+
+    /* The slot for the last tick was already processed */
+    if (deadline <= wheel->lastTick)
+        deadline = wheel->lastTick + 1;
+
+    ka->deadline = deadline;
+    ka->slot = deadline % VIR_KEEPALIVE_WHEEL_SIZE;
+    ka->wheelNext = wheel->slots[ka->slot];
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka;
+    wheel->slots[ka->slot] = ka;
+    wheel->nscheduled++;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&wheel->lock);
+    return ret;
+}
+
+
+static void
+virKeepAliveUnschedule(virKeepAlivePtr ka)
+{
+    virMutexLock(&virKeepAliveWheelData.lock);
+    virKeepAliveWheelUnlink(ka);
+    virMutexUnlock(&virKeepAliveWheelData.lock);
+}
+
+
 static bool
 virKeepAliveTimerInternal(virKeepAlivePtr ka,
                           virNetMessagePtr *msg)
@@ -125,8 +233,8 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         return false;
 
     if (now - ka->intervalStart < ka->interval) {
-        timeval = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeval * 1000);
+        if (ka->active)
+            ignore_value(virKeepAliveSchedule(ka, ka->intervalStart + ka->interval));
         return false;
     }
 
@@ -141,35 +249,41 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
                   ka->client, ka->count, timeval);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("connection closed due to keepalive timeout"));
+        if (ka->active)
+            ignore_value(virKeepAliveSchedule(ka, now + ka->interval));
         return true;
     } else {
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
+        if (ka->active)
+            ignore_value(virKeepAliveSchedule(ka, now + ka->interval));
         return false;
     }
 }
 
 
 static void
-virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+virKeepAliveTimer(virKeepAlivePtr ka)
 {
-    virKeepAlivePtr ka = opaque;
     virNetMessagePtr msg = NULL;
     bool dead;
     void *client;
 
-    virObjectRef(ka);
     virObjectLock(ka);
 
+    if (!ka->active) {
+        virObjectUnlock(ka);
+        return;
+    }
+
     client = ka->client;
     dead = virKeepAliveTimerInternal(ka, &msg);
 
     virObjectUnlock(ka);
 
     if (!dead && !msg)
-        goto cleanup;
+        return;
 
     if (dead) {
         ka->deadCB(client);
@@ -177,9 +291,61 @@ virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
         VIR_WARN("Failed to send keepalive request to client %p", client);
         virNetMessageFree(msg);
     }
+}
+
+
+static void
+virKeepAliveWheelTick(int timer ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED)
+{
+    virKeepAliveWheel *wheel = &virKeepAliveWheelData;
+    virKeepAlivePtr *due = NULL;
+    size_t ndue = 0;
+    time_t now = time(NULL);
+    time_t start;
+    time_t t;
+    size_t i;
+
+    virMutexLock(&wheel->lock);
+
+    /* Catch up with any ticks we missed, or look at the whole wheel if
+     * the clock jumped */
+    if (wheel->lastTick == 0 || now < wheel->lastTick ||
+        now - wheel->lastTick >= VIR_KEEPALIVE_WHEEL_SIZE)
+        start = now - VIR_KEEPALIVE_WHEEL_SIZE + 1;
+    else
+        start = wheel->lastTick + 1;
+
+    for (t = start; t <= now; t++) {
+        virKeepAlivePtr ka = wheel->slots[t % VIR_KEEPALIVE_WHEEL_SIZE];
+
+        while (ka) {
+            virKeepAlivePtr next = ka->wheelNext;
+
+            if (ka->deadline <= now) {
+                if (VIR_APPEND_ELEMENT(due, ndue, ka) < 0) {
+                    /* Leave it for the next tick */
+                    virResetLastError();
+                    break;
+                }
+                virObjectRef(due[ndue - 1]);
+                virKeepAliveWheelUnlink(due[ndue - 1]);
+            }
+            ka = next;
+        }
+    }
+    wheel->lastTick = now;
 
- cleanup:
-    virObjectUnref(ka);
+    if (wheel->nscheduled == 0 && ndue == 0)
+        virEventUpdateTimeout(wheel->timer, -1);
+
+    virMutexUnlock(&wheel->lock);
+
+    for (i = 0; i < ndue; i++) {
+        virKeepAliveTimer(due[i]);
+        virObjectUnref(due[i]);
+    }
+    VIR_FREE(due);
 }
 
 
@@ -204,7 +370,7 @@ virKeepAliveNew(int interval,
     ka->interval = interval;
     ka->count = count;
     ka->countToDeath = count;
-    ka->timer = -1;
+    ka->slot = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
@@ -242,7 +408,7 @@ virKeepAliveStart(virKeepAlivePtr ka,
 
     virObjectLock(ka);
 
-    if (ka->timer >= 0) {
+    if (ka->active) {
         VIR_DEBUG("Keepalive messages already enabled");
         ret = 0;
         goto cleanup;
@@ -282,13 +448,12 @@ virKeepAliveStart(virKeepAlivePtr ka,
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
-    ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
-                                   ka, virObjectFreeCallback);
-    if (ka->timer < 0)
+    if (virKeepAliveSchedule(ka, now + timeout) < 0)
         goto cleanup;
 
-    /* the timer now has another reference to this object */
+    /* the wheel now has another reference to this object */
     virObjectRef(ka);
+    ka->active = true;
     ret = 0;
 
  cleanup:
@@ -300,18 +465,24 @@ virKeepAliveStart(virKeepAlivePtr ka,
 void
 virKeepAliveStop(virKeepAlivePtr ka)
 {
+    bool wasActive;
+
     virObjectLock(ka);
 
     PROBE(RPC_KEEPALIVE_STOP,
           "ka=%p client=%p",
           ka, ka->client);
 
-    if (ka->timer > 0) {
-        virEventRemoveTimeout(ka->timer);
-        ka->timer = -1;
+    wasActive = ka->active;
+    if (ka->active) {
+        virKeepAliveUnschedule(ka);
+        ka->active = false;
     }
 
     virObjectUnlock(ka);
+
+    if (wasActive)
+        virObjectUnref(ka);
 }
 
 
@@ -406,8 +577,8 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
         }
     }
 
-    if (ka->timer >= 0)
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
+    /* No need to touch the wheel, it will notice intervalStart moved
+     * when it gets to us */
 
     virObjectUnlock(ka);
 
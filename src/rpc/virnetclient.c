@@ -43,6 +43,10 @@
 
 VIR_LOG_INIT("rpc.netclient");
 
+/* Maximum number of idle messages and buffers (per size class) kept in
+ * the message pool of a client */
+#define VIR_NET_CLIENT_MESSAGE_POOL_MAX 16
+
 typedef struct _virNetClientCall virNetClientCall;
 typedef virNetClientCall *virNetClientCallPtr;
 
@@ -59,6 +63,13 @@ struct _virNetClientCall {
     bool expectReply;
     bool nonBlock;
     bool haveThread;
+    bool batched; /* Owned by virNetClientSendWithReplyBatch */
+
+    /* Set for calls made by virNetClientSendWithReplyAsync, which
+     * have no thread waiting for them */
+    virNetClientReplyFunc replyFunc;
+    void *replyOpaque;
+    virNetClientPtr client;
 
     virCond cond;
 
@@ -83,6 +94,9 @@ struct _virNetClient {
     /* For incoming message packets */
     virNetMessage msg;
 
+    /* Recycles messages and buffers of calls and streams */
+    virNetMessagePoolPtr msgpool;
+
 #if WITH_SASL
     virNetSASLSessionPtr sasl;
 #endif
@@ -323,6 +337,10 @@ static virNetClientPtr virNetClientNew(virNetSocketPtr sock,
     if (VIR_STRDUP(client->hostname, hostname) < 0)
         goto error;
 
+    if (!(client->msgpool = virNetMessagePoolNew(VIR_NET_CLIENT_MESSAGE_POOL_MAX)))
+        goto error;
+    client->msg.pool = virObjectRef(client->msgpool);
+
     PROBE(RPC_CLIENT_NEW,
           "client=%p sock=%p",
           client, client->sock);
@@ -725,6 +743,16 @@ int virNetClientDupFD(virNetClientPtr client, bool cloexec)
 }
 
 
+/*
+ * The pool is set up once when the client is created and never
+ * changes afterwards, so no locking is needed to get it.
+ */
+virNetMessagePoolPtr virNetClientGetMessagePool(virNetClientPtr client)
+{
+    return client->msgpool;
+}
+
+
 bool virNetClientHasPassFD(virNetClientPtr client)
 {
     bool hasPassFD;
@@ -765,7 +793,9 @@ void virNetClientDispose(void *obj)
     virObjectUnref(client->sasl);
 #endif
 
-    virNetMessageClear(&client->msg);
+    virNetMessageClearPayload(&client->msg);
+    virObjectUnref(client->msg.pool);
+    virObjectUnref(client->msgpool);
 }
 
 
@@ -909,7 +939,8 @@ int virNetClientSetTLSSession(virNetClientPtr client,
     virObjectLock(client);
 
     if (!(client->tls = virNetTLSSessionNew(tls,
-                                            client->hostname)))
+                                            client->hostname,
+                                            virNetSocketRemoteAddrStringURI(client->sock))))
         goto error;
 
     virNetSocketSetTLSSession(client->sock, client->tls);
@@ -1107,6 +1138,8 @@ static int
 virNetClientCallDispatchReply(virNetClientPtr client)
 {
     virNetClientCallPtr thecall;
+    char *buffer;
+    size_t bufferAlloc;
 
     /* Ok, definitely got an RPC reply now find
        out which waiting call is associated with it */
@@ -1124,10 +1157,16 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0)
-        return -1;
+    /* The request has already been sent, so rather than copying the
+     * reply we can just swap buffers and let the old one be recycled
+     * when client->msg is cleared */
+    buffer = thecall->msg->buffer;
+    bufferAlloc = thecall->msg->bufferAlloc;
+    thecall->msg->buffer = client->msg.buffer;
+    thecall->msg->bufferAlloc = client->msg.bufferAlloc;
+    client->msg.buffer = buffer;
+    client->msg.bufferAlloc = bufferAlloc;
 
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
@@ -1278,6 +1317,7 @@ virNetClientCallDispatch(virNetClientPtr client)
     switch (client->msg.header.type) {
     case VIR_NET_REPLY: /* Normal RPC replies */
     case VIR_NET_REPLY_WITH_FDS: /* Normal RPC replies with FDs */
+    case VIR_NET_REPLY_SHM: /* RPC replies with payload in shared memory */
         return virNetClientCallDispatchReply(client);
 
     case VIR_NET_MESSAGE: /* Async notifications */
@@ -1301,19 +1341,20 @@ static ssize_t
 virNetClientIOWriteMessage(virNetClientPtr client,
                            virNetClientCallPtr thecall)
 {
+    struct iovec iov[VIR_NET_MESSAGE_IOV_MAX];
+    int niov;
     ssize_t ret = 0;
 
-    if (thecall->msg->bufferOffset < thecall->msg->bufferLength) {
-        ret = virNetSocketWrite(client->sock,
-                                thecall->msg->buffer + thecall->msg->bufferOffset,
-                                thecall->msg->bufferLength - thecall->msg->bufferOffset);
+    if (virNetMessageHasPendingData(thecall->msg)) {
+        niov = virNetMessageGetIOV(thecall->msg, iov);
+        ret = virNetSocketWriteV(client->sock, iov, niov);
         if (ret <= 0)
             return ret;
 
-        thecall->msg->bufferOffset += ret;
+        virNetMessageConsumeIOV(thecall->msg, ret);
     }
 
-    if (thecall->msg->bufferOffset == thecall->msg->bufferLength) {
+    if (!virNetMessageHasPendingData(thecall->msg)) {
         size_t i;
         for (i = thecall->msg->donefds; i < thecall->msg->nfds; i++) {
             int rv;
@@ -1372,7 +1413,7 @@ virNetClientIOReadMessage(virNetClientPtr client)
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0)
+        if (virNetMessageAllocBuffer(&client->msg, client->msg.bufferLength) < 0)
             return -ENOMEM;
     }
 
@@ -1425,7 +1466,8 @@ virNetClientIOHandleInput(virNetClientPtr client)
                 if (virNetMessageDecodeHeader(&client->msg) < 0)
                     return -1;
 
-                if (client->msg.header.type == VIR_NET_REPLY_WITH_FDS) {
+                if (client->msg.header.type == VIR_NET_REPLY_WITH_FDS ||
+                    client->msg.header.type == VIR_NET_REPLY_SHM) {
                     size_t i;
 
                     if (virNetMessageDecodeNumFDs(&client->msg) < 0)
@@ -1492,6 +1534,34 @@ static bool virNetClientIOEventLoopPollEvents(virNetClientCallPtr call,
 }
 
 
+/*
+ * Hand the reply of an asynchronous call over to its callback, or NULL
+ * if the call could not be completed, and free the call.
+ */
+static void
+virNetClientCallFinishAsync(virNetClientCallPtr call,
+                            bool complete)
+{
+    virNetClientPtr client = call->client;
+
+    VIR_DEBUG("Finishing async call %p complete=%d", call, complete);
+
+    if (!complete) {
+        if (client->error)
+            virSetError(client->error);
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+    }
+
+    call->replyFunc(client, complete ? call->msg : NULL, call->replyOpaque);
+
+    virNetMessageFree(call->msg);
+    virCondDestroy(&call->cond);
+    VIR_FREE(call);
+}
+
+
 static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
                                               void *opaque)
 {
@@ -1516,6 +1586,10 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->batched) {
+        VIR_DEBUG("Completed batched call %p", call);
+    } else if (call->replyFunc) {
+        virNetClientCallFinishAsync(call, true);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1547,6 +1621,15 @@ virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
         return false;
 
     VIR_DEBUG("Removing call %p", call);
+    /* The batch owner notices the call is gone and frees it */
+    if (call->batched)
+        return true;
+
+    if (call->replyFunc) {
+        virNetClientCallFinishAsync(call, false);
+        return true;
+    }
+
     virCondDestroy(&call->cond);
     VIR_FREE(call->msg);
     VIR_FREE(call);
@@ -1863,11 +1946,12 @@ static void virNetClientIOUpdateCallback(virNetClientPtr client,
  * Returns 1 if the call was queued and will be completed later (only
  * for nonBlock == true), 0 if the call was completed and -1 on error.
  */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall);
+
 static int virNetClientIO(virNetClientPtr client,
                           virNetClientCallPtr thiscall)
 {
-    int rv = -1;
-
     VIR_DEBUG("Outgoing message prog=%u version=%u serial=%u proc=%d type=%d length=%zu dispatch=%p",
               thiscall->msg->header.prog,
               thiscall->msg->header.vers,
@@ -1880,6 +1964,20 @@ static int virNetClientIO(virNetClientPtr client,
     /* Stick ourselves on the end of the wait queue */
     virNetClientCallQueue(&client->waitDispatch, thiscall);
 
+    return virNetClientIOWait(client, thiscall);
+}
+
+
+/*
+ * Wait for @thiscall, which must already be in the wait queue, to
+ * complete, dispatching I/O for all queued calls if no other thread
+ * is doing so. Returns the same values as virNetClientIO.
+ */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall)
+{
+    int rv = -1;
+
     /* Check to see if another thread is dispatching */
     if (client->haveTheBuck) {
         char ignore = 1;
@@ -2164,6 +2262,193 @@ int virNetClientSendWithReply(virNetClientPtr client,
 }
 
 
+static bool
+virNetClientCallIsQueued(virNetClientCallPtr call,
+                         void *opaque)
+{
+    return call == opaque;
+}
+
+
+/*
+ * @msgs: messages allocated on heap or stack
+ * @nmsgs: number of messages in @msgs
+ *
+ * Send all the messages back to back, and then wait for all their
+ * replies synchronously, so that the whole batch costs a single round
+ * trip rather than @nmsgs of them. Each message is filled with its own
+ * reply, which may as well be an error reply.
+ *
+ * The caller is responsible for free'ing @msgs if they were allocated
+ * on the heap
+ *
+ * Returns 0 on success, -1 if any of the replies could not be received
+ */
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs)
+{
+    virNetClientCallPtr *calls = NULL;
+    size_t ncalls = 0;
+    size_t i;
+    int ret = -1;
+
+    if (nmsgs == 0)
+        return 0;
+
+    virObjectLock(client);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(calls, nmsgs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nmsgs; i++) {
+        PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+              "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+              client, msgs[i]->bufferLength,
+              msgs[i]->header.prog, msgs[i]->header.vers, msgs[i]->header.proc,
+              msgs[i]->header.type, msgs[i]->header.status, msgs[i]->header.serial);
+
+        if (!(calls[i] = virNetClientCallNew(msgs[i], true, false)))
+            goto cleanup;
+        calls[i]->batched = true;
+        ncalls++;
+    }
+
+    /* Queue all but the last call straight away, the last one then
+     * goes through the usual path which makes sure someone transmits
+     * the whole queue and waits for its reply */
+    for (i = 0; i < ncalls - 1; i++)
+        virNetClientCallQueue(&client->waitDispatch, calls[i]);
+
+    calls[ncalls - 1]->haveThread = true;
+    if (virNetClientIO(client, calls[ncalls - 1]) < 0)
+        goto cleanup;
+
+    /* Replies may arrive in any order, wait for the rest of them */
+    for (i = 0; i < ncalls - 1; i++) {
+        if (calls[i]->mode == VIR_NET_CLIENT_MODE_COMPLETE)
+            continue;
+
+        if (!virNetClientCallMatchPredicate(client->waitDispatch,
+                                            virNetClientCallIsQueued,
+                                            calls[i])) {
+            if (client->error)
+                virSetError(client->error);
+            else
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("client socket is closed"));
+            goto cleanup;
+        }
+
+        calls[i]->haveThread = true;
+        if (virNetClientIOWait(client, calls[i]) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncalls; i++) {
+        if (calls[i]->mode != VIR_NET_CLIENT_MODE_COMPLETE)
+            virNetClientCallRemove(&client->waitDispatch, calls[i]);
+        virCondDestroy(&calls[i]->cond);
+        VIR_FREE(calls[i]);
+    }
+    VIR_FREE(calls);
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+/*
+ * @msg: a message allocated on the heap
+ * @func: callback to invoke with the reply
+ * @opaque: data for @func
+ *
+ * Queue a message and return straight away, without waiting for the
+ * reply. Any number of such calls may be in flight at once. Once the
+ * reply arrives @func is invoked with it, from whichever thread is
+ * dispatching incoming data at the time, which is usually the event
+ * loop thread. If the connection is closed before the reply arrives,
+ * @func is invoked with a NULL message and an error reported instead.
+ *
+ * @func is invoked with the client locked, so it must not make any
+ * further calls on @client; it must not free the message either.
+ *
+ * Ownership of @msg is passed to the client on success, the caller
+ * is responsible for free'ing it on failure.
+ *
+ * Returns 0 if the message was queued, -1 on failure
+ */
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc func,
+                                   void *opaque)
+{
+    virNetClientCallPtr call;
+    int ret = -1;
+
+    virObjectLock(client);
+
+    PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+          "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc,
+          msg->header.type, msg->header.status, msg->header.serial);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    /* Without a thread waiting for the reply it is up to the event
+     * loop to transmit the call and read its reply */
+    if (!client->asyncIO) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to make asynchronous calls without async IO support"));
+        goto cleanup;
+    }
+
+    if (!(call = virNetClientCallNew(msg, true, false)))
+        goto cleanup;
+
+    call->replyFunc = func;
+    call->replyOpaque = opaque;
+    call->client = client;
+
+    virNetClientCallQueue(&client->waitDispatch, call);
+
+    if (client->haveTheBuck) {
+        char ignore = 1;
+
+        /* Make the dispatching thread poll for our call too */
+        if (safewrite(client->wakeupSendFD, &ignore, sizeof(ignore)) != sizeof(ignore)) {
+            virNetClientCallRemove(&client->waitDispatch, call);
+            virCondDestroy(&call->cond);
+            VIR_FREE(call);
+            virReportSystemError(errno, "%s",
+                                 _("failed to wake up polling thread"));
+            goto cleanup;
+        }
+    } else {
+        virNetClientIOUpdateCallback(client, true);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 /*
  * @msg: a message allocated on heap or stack
  *
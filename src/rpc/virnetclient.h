@@ -97,6 +97,8 @@ void virNetClientSetCloseCallback(virNetClientPtr client,
 int virNetClientGetFD(virNetClientPtr client);
 int virNetClientDupFD(virNetClientPtr client, bool cloexec);
 
+virNetMessagePoolPtr virNetClientGetMessagePool(virNetClientPtr client);
+
 bool virNetClientHasPassFD(virNetClientPtr client);
 
 int virNetClientAddProgram(virNetClientPtr client,
@@ -111,6 +113,19 @@ void virNetClientRemoveStream(virNetClientPtr client,
 int virNetClientSendWithReply(virNetClientPtr client,
                               virNetMessagePtr msg);
 
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs);
+
+typedef void (*virNetClientReplyFunc)(virNetClientPtr client,
+                                      virNetMessagePtr msg,
+                                      void *opaque);
+
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc func,
+                                   void *opaque);
+
 int virNetClientSendNoReply(virNetClientPtr client,
                             virNetMessagePtr msg);
 
@@ -268,28 +268,77 @@ int virNetClientProgramDispatch(virNetClientProgramPtr prog,
 }
 
 
-int virNetClientProgramCall(virNetClientProgramPtr prog,
-                            virNetClientPtr client,
-                            unsigned serial,
-                            int proc,
-                            size_t noutfds,
-                            int *outfds,
-                            size_t *ninfds,
-                            int **infds,
-                            xdrproc_t args_filter, void *args,
-                            xdrproc_t ret_filter, void *ret)
+/**
+ * virNetClientProgramDispatchPayload:
+ * @prog: the program the event belongs to
+ * @client: the client the event was received on
+ * @procedure: the event procedure
+ * @payload: the encoded event body
+ * @len: length of @payload
+ *
+ * Decode and dispatch a single event whose body was delivered
+ * separately from a message header, as is the case for events
+ * carried inside a batch message.
+ *
+ * Returns 0 on success, -1 if the event could not be decoded
+ */
+int virNetClientProgramDispatchPayload(virNetClientProgramPtr prog,
+                                       virNetClientPtr client,
+                                       int procedure,
+                                       const char *payload,
+                                       size_t len)
 {
-    virNetMessagePtr msg;
-    size_t i;
+    virNetClientProgramEventPtr event;
+    char *evdata;
+    XDR xdr;
+    int ret = -1;
 
-    if (infds)
-        *infds = NULL;
-    if (ninfds)
-        *ninfds = 0;
+    VIR_DEBUG("prog=%d proc=%d len=%zu", prog->program, procedure, len);
+
+    if (!(event = virNetClientProgramGetEvent(prog, procedure))) {
+        VIR_ERROR(_("No event expected with procedure 0x%x"), procedure);
+        return -1;
+    }
 
-    if (!(msg = virNetMessageNew(false)))
+    if (VIR_ALLOC_N(evdata, event->msg_len) < 0)
         return -1;
 
+    xdrmem_create(&xdr, (char *)payload, len, XDR_DECODE);
+    if (!(*event->msg_filter)(&xdr, evdata)) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unable to decode event with procedure 0x%x"),
+                       procedure);
+        goto cleanup;
+    }
+
+    event->func(prog, client, evdata, prog->eventOpaque);
+
+    xdr_free(event->msg_filter, evdata);
+    ret = 0;
+
+ cleanup:
+    xdr_destroy(&xdr);
+    VIR_FREE(evdata);
+    return ret;
+}
+
+
+static virNetMessagePtr
+virNetClientProgramCallPrepare(virNetClientProgramPtr prog,
+                               virNetClientPtr client,
+                               unsigned serial,
+                               int proc,
+                               size_t noutfds,
+                               int *outfds,
+                               xdrproc_t args_filter, void *args)
+{
+    virNetMessagePtr msg;
+    size_t i;
+
+    if (!(msg = virNetMessageNewFromPool(virNetClientGetMessagePool(client),
+                                         false)))
+        return NULL;
+
     msg->header.prog = prog->program;
     msg->header.vers = prog->version;
     msg->header.status = VIR_NET_OK;
@@ -326,15 +375,32 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetMessageEncodePayload(msg, args_filter, args) < 0)
         goto error;
 
-    if (virNetClientSendWithReply(client, msg) < 0)
-        goto error;
+    return msg;
+
+ error:
+    virNetMessageFree(msg);
+    return NULL;
+}
+
+
+static int
+virNetClientProgramCallFinish(virNetClientProgramPtr prog,
+                              virNetMessagePtr msg,
+                              unsigned serial,
+                              int proc,
+                              size_t *ninfds,
+                              int **infds,
+                              xdrproc_t ret_filter, void *ret)
+{
+    size_t i;
 
     /* None of these 3 should ever happen here, because
      * virNetClientSend should have validated the reply,
      * but it doesn't hurt to check again.
      */
     if (msg->header.type != VIR_NET_REPLY &&
-        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
+        msg->header.type != VIR_NET_REPLY_WITH_FDS &&
+        msg->header.type != VIR_NET_REPLY_SHM) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unexpected message type %d"), msg->header.type);
         goto error;
@@ -354,6 +420,13 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
 
     switch (msg->header.status) {
     case VIR_NET_OK:
+        /* The only FD is the one holding the payload */
+        if (msg->header.type == VIR_NET_REPLY_SHM) {
+            if (virNetMessageDecodeSharedPayload(msg, ret_filter, ret) < 0)
+                goto error;
+            break;
+        }
+
         if (infds && ninfds) {
             *ninfds = msg->nfds;
             if (VIR_ALLOC_N(*infds, *ninfds) < 0)
@@ -390,15 +463,214 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
         goto error;
     }
 
-    virNetMessageFree(msg);
-
     return 0;
 
  error:
-    virNetMessageFree(msg);
     if (infds && ninfds) {
         for (i = 0; i < *ninfds; i++)
             VIR_FORCE_CLOSE((*infds)[i]);
     }
     return -1;
 }
+
+
+int virNetClientProgramCall(virNetClientProgramPtr prog,
+                            virNetClientPtr client,
+                            unsigned serial,
+                            int proc,
+                            size_t noutfds,
+                            int *outfds,
+                            size_t *ninfds,
+                            int **infds,
+                            xdrproc_t args_filter, void *args,
+                            xdrproc_t ret_filter, void *ret)
+{
+    virNetMessagePtr msg;
+    int rv = -1;
+
+    if (infds)
+        *infds = NULL;
+    if (ninfds)
+        *ninfds = 0;
+
+    if (!(msg = virNetClientProgramCallPrepare(prog, client, serial, proc,
+                                               noutfds, outfds,
+                                               args_filter, args)))
+        return -1;
+
+    if (virNetClientSendWithReply(client, msg) < 0)
+        goto cleanup;
+
+    rv = virNetClientProgramCallFinish(prog, msg, serial, proc,
+                                       ninfds, infds, ret_filter, ret);
+
+ cleanup:
+    virNetMessageFree(msg);
+    return rv;
+}
+
+
+/*
+ * @calls: the calls to make
+ * @ncalls: number of entries in @calls
+ *
+ * Make all the @calls within a single round trip to the server, see
+ * virNetClientSendWithReplyBatch. The calls are independent of each
+ * other: the result of each is stored in its @rv field and, if it
+ * failed, its error in the @error field, which the caller must free.
+ *
+ * Returns 0 if all the calls were made, or -1 with an error reported
+ * if the batch could not be sent or its replies received, in which
+ * case none of the results are valid
+ */
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls)
+{
+    virNetMessagePtr *msgs = NULL;
+    size_t nmsgs = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(msgs, ncalls) < 0)
+        return -1;
+
+    for (i = 0; i < ncalls; i++) {
+        calls[i].rv = -1;
+        calls[i].error = NULL;
+
+        if (!(msgs[i] = virNetClientProgramCallPrepare(prog, client,
+                                                       calls[i].serial,
+                                                       calls[i].proc,
+                                                       0, NULL,
+                                                       calls[i].args_filter,
+                                                       calls[i].args)))
+            goto cleanup;
+        nmsgs++;
+    }
+
+    if (virNetClientSendWithReplyBatch(client, msgs, nmsgs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncalls; i++) {
+        calls[i].rv = virNetClientProgramCallFinish(prog, msgs[i],
+                                                    calls[i].serial,
+                                                    calls[i].proc,
+                                                    NULL, NULL,
+                                                    calls[i].ret_filter,
+                                                    calls[i].ret);
+        if (calls[i].rv < 0) {
+            calls[i].error = virSaveLastError();
+            virResetLastError();
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nmsgs; i++)
+        virNetMessageFree(msgs[i]);
+    VIR_FREE(msgs);
+    return ret;
+}
+
+
+typedef struct _virNetClientProgramAsyncCall virNetClientProgramAsyncCall;
+typedef virNetClientProgramAsyncCall *virNetClientProgramAsyncCallPtr;
+
+struct _virNetClientProgramAsyncCall {
+    virNetClientProgramPtr prog;
+    unsigned serial;
+    int proc;
+    xdrproc_t ret_filter;
+    void *ret;
+
+    virNetClientProgramReplyFunc func;
+    void *opaque;
+    virFreeCallback ff;
+};
+
+
+static void
+virNetClientProgramCallAsyncReply(virNetClientPtr client,
+                                  virNetMessagePtr msg,
+                                  void *opaque)
+{
+    virNetClientProgramAsyncCallPtr call = opaque;
+    int rv = -1;
+
+    if (msg)
+        rv = virNetClientProgramCallFinish(call->prog, msg,
+                                           call->serial, call->proc,
+                                           NULL, NULL,
+                                           call->ret_filter, call->ret);
+
+    call->func(call->prog, client, rv, call->ret, call->opaque);
+
+    if (call->ff)
+        call->ff(call->opaque);
+    virObjectUnref(call->prog);
+    VIR_FREE(call);
+}
+
+
+/*
+ * @ret: storage for the reply, which must stay valid until @func is invoked
+ * @func: callback to invoke once the call completed
+ * @opaque: data for @func
+ * @ff: optional callback to free @opaque once @func returned
+ *
+ * Make a call without waiting for its reply, see
+ * virNetClientSendWithReplyAsync. Once the reply arrives it is decoded
+ * into @ret and @func is invoked with @rv set to 0, or to -1 with an
+ * error reported if the call failed. The same restrictions as for
+ * virNetClientSendWithReplyAsync apply to @func.
+ *
+ * Returns 0 if the call was queued, -1 on failure in which case @func
+ * will never be invoked
+ */
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, void *ret,
+                                 virNetClientProgramReplyFunc func,
+                                 void *opaque,
+                                 virFreeCallback ff)
+{
+    virNetClientProgramAsyncCallPtr call = NULL;
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetClientProgramCallPrepare(prog, client, serial, proc,
+                                               0, NULL,
+                                               args_filter, args)))
+        return -1;
+
+    if (VIR_ALLOC(call) < 0)
+        goto error;
+
+    call->prog = virObjectRef(prog);
+    call->serial = serial;
+    call->proc = proc;
+    call->ret_filter = ret_filter;
+    call->ret = ret;
+    call->func = func;
+    call->opaque = opaque;
+    call->ff = ff;
+
+    if (virNetClientSendWithReplyAsync(client, msg,
+                                       virNetClientProgramCallAsyncReply,
+                                       call) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    if (call)
+        virObjectUnref(call->prog);
+    VIR_FREE(call);
+    virNetMessageFree(msg);
+    return -1;
+}
@@ -70,6 +70,12 @@ int virNetClientProgramDispatch(virNetClientProgramPtr prog,
                                 virNetClientPtr client,
                                 virNetMessagePtr msg);
 
+int virNetClientProgramDispatchPayload(virNetClientProgramPtr prog,
+                                       virNetClientPtr client,
+                                       int procedure,
+                                       const char *payload,
+                                       size_t len);
+
 int virNetClientProgramCall(virNetClientProgramPtr prog,
                             virNetClientPtr client,
                             unsigned serial,
@@ -81,6 +87,43 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
                             xdrproc_t args_filter, void *args,
                             xdrproc_t ret_filter, void *ret);
 
+typedef struct _virNetClientProgramBatchCall virNetClientProgramBatchCall;
+typedef virNetClientProgramBatchCall *virNetClientProgramBatchCallPtr;
+
+struct _virNetClientProgramBatchCall {
+    unsigned serial;
+    int proc;
+    xdrproc_t args_filter;
+    void *args;
+    xdrproc_t ret_filter;
+    void *ret;
+
+    /* Filled in by virNetClientProgramCallBatch */
+    int rv;
+    virErrorPtr error;
+};
+
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls);
+
+typedef void (*virNetClientProgramReplyFunc)(virNetClientProgramPtr prog,
+                                             virNetClientPtr client,
+                                             int rv,
+                                             void *ret,
+                                             void *opaque);
+
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, void *ret,
+                                 virNetClientProgramReplyFunc func,
+                                 void *opaque,
+                                 virFreeCallback ff);
+
 
 
 #endif /* __VIR_NET_CLIENT_PROGRAM_H__ */
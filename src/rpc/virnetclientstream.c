@@ -28,6 +28,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "virthread.h"
+#include "virprobe.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -290,7 +291,7 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     /* Unfortunately, we must allocate new message as the one we
      * get in @msg is going to be cleared later in the process. */
 
-    if (!(tmp_msg = virNetMessageNew(false)))
+    if (!(tmp_msg = virNetMessageNewFromPool(msg->pool, false)))
         return -1;
 
     /* Copy header */
@@ -298,10 +299,11 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
 
     /* Steal message buffer */
     tmp_msg->buffer = msg->buffer;
+    tmp_msg->bufferAlloc = msg->bufferAlloc;
     tmp_msg->bufferLength = msg->bufferLength;
     tmp_msg->bufferOffset = msg->bufferOffset;
     msg->buffer = NULL;
-    msg->bufferLength = msg->bufferOffset = 0;
+    msg->bufferAlloc = msg->bufferLength = msg->bufferOffset = 0;
 
     virObjectLock(st);
 
@@ -309,6 +311,10 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
      * here just yet. We want in order processing! */
     virNetMessageQueuePush(&st->rx, tmp_msg);
 
+    PROBE(RPC_CLIENT_STREAM_PACKET_QUEUE,
+          "st=%p len=%zu",
+          st, tmp_msg->bufferLength - tmp_msg->bufferOffset);
+
     virNetClientStreamEventTimerUpdate(st);
 
     virObjectUnlock(st);
@@ -325,7 +331,8 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
     virNetMessagePtr msg;
     VIR_DEBUG("st=%p status=%d data=%p nbytes=%zu", st, status, data, nbytes);
 
-    if (!(msg = virNetMessageNew(false)))
+    if (!(msg = virNetMessageNewFromPool(virNetClientGetMessagePool(client),
+                                         false)))
         return -1;
 
     virObjectLock(st);
@@ -346,7 +353,9 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
      * need a synchronous confirmation
      */
     if (status == VIR_NET_CONTINUE) {
-        if (virNetMessageEncodePayloadRaw(msg, data, nbytes) < 0)
+        /* SendNoReply does not return until the message has been
+         * written out, so @data can be sent without copying it */
+        if (virNetMessageEncodePayloadRef(msg, (char *)data, nbytes, false) < 0)
             goto error;
 
         if (virNetClientSendNoReply(client, msg) < 0)
@@ -453,6 +462,8 @@ virNetClientStreamHandleHole(virNetClientPtr client,
     virNetMessageQueueServe(&st->rx);
     virNetMessageFree(msg);
 
+    PROBE(RPC_CLIENT_STREAM_PACKET_SERVE, "st=%p", st);
+
     if (virNetClientStreamSetHole(st, data.length, data.flags) < 0)
         goto cleanup;
 
@@ -493,7 +504,8 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
         }
 
-        if (!(msg = virNetMessageNew(false)))
+        if (!(msg = virNetMessageNewFromPool(virNetClientGetMessagePool(client),
+                                             false)))
             goto cleanup;
 
         msg->header.prog = virNetClientProgramGetProgram(st->prog);
@@ -576,6 +588,8 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
         if (msg->bufferOffset == msg->bufferLength) {
             virNetMessageQueueServe(&st->rx);
             virNetMessageFree(msg);
+
+            PROBE(RPC_CLIENT_STREAM_PACKET_SERVE, "st=%p", st);
         }
     }
     rv = nbytes - want;
@@ -610,7 +624,8 @@ virNetClientStreamSendHole(virNetClientStreamPtr st,
     data.length = length;
     data.flags = flags;
 
-    if (!(msg = virNetMessageNew(false)))
+    if (!(msg = virNetMessageNewFromPool(virNetClientGetMessagePool(client),
+                                         false)))
         return -1;
 
     virObjectLock(st);
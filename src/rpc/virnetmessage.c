@@ -22,6 +22,11 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "virnetmessage.h"
 #include "viralloc.h"
@@ -30,25 +35,265 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virobject.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netmessage");
 
-virNetMessagePtr virNetMessageNew(bool tracked)
+/*
+ * Buffers are recycled in a handful of size classes, the smallest
+ * being enough for any short RPC call and the largest matching the
+ * initial size of an encoded reply. Anything bigger than that goes
+ * straight back to malloc/free.
+ */
+#define VIR_NET_MESSAGE_POOL_CLASSES 5
+#define VIR_NET_MESSAGE_POOL_CLASS_SIZE(cls) \
+    ((VIR_NET_MESSAGE_INITIAL >> (VIR_NET_MESSAGE_POOL_CLASSES - 1 - (cls))) + \
+     VIR_NET_MESSAGE_LEN_MAX)
+
+struct _virNetMessagePool {
+    virObjectLockable parent;
+
+    size_t maxFree;
+
+    /* Free buffers are chained through their first bytes */
+    char *buffers[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t nbuffers[VIR_NET_MESSAGE_POOL_CLASSES];
+
+    /* Free messages are chained through msg->next */
+    virNetMessagePtr msgs;
+    size_t nmsgs;
+
+    unsigned long long hits;
+    unsigned long long misses;
+};
+
+static virClassPtr virNetMessagePoolClass;
+static void virNetMessagePoolDispose(void *obj);
+
+static int virNetMessagePoolOnceInit(void)
 {
+    if (!(virNetMessagePoolClass = virClassNew(virClassForObjectLockable(),
+                                               "virNetMessagePool",
+                                               sizeof(virNetMessagePool),
+                                               virNetMessagePoolDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
+
+/**
+ * virNetMessagePoolNew:
+ * @maxFree: maximum number of idle messages and buffers per size class
+ *
+ * Creates a pool recycling message structs and their buffers, so that
+ * steady state RPC traffic does not need to hit the allocator.
+ *
+ * Returns the new pool or NULL on error
+ */
+virNetMessagePoolPtr
+virNetMessagePoolNew(size_t maxFree)
+{
+    virNetMessagePoolPtr pool;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return NULL;
+
+    if (!(pool = virObjectLockableNew(virNetMessagePoolClass)))
+        return NULL;
+
+    pool->maxFree = maxFree;
+
+    return pool;
+}
+
+
+static void
+virNetMessagePoolDispose(void *obj)
+{
+    virNetMessagePoolPtr pool = obj;
     virNetMessagePtr msg;
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        while (pool->buffers[i]) {
+            char *buf = pool->buffers[i];
+            memcpy(&pool->buffers[i], buf, sizeof(char *));
+            VIR_FREE(buf);
+        }
+    }
+
+    while ((msg = virNetMessageQueueServe(&pool->msgs)))
+        VIR_FREE(msg);
+}
+
+
+void
+virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                          unsigned long long *hits,
+                          unsigned long long *misses)
+{
+    virObjectLock(pool);
+    *hits = pool->hits;
+    *misses = pool->misses;
+    virObjectUnlock(pool);
+}
+
+
+static int
+virNetMessagePoolClassForSize(size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        if (len <= VIR_NET_MESSAGE_POOL_CLASS_SIZE(i))
+            return i;
+    }
+
+    return -1;
+}
+
+
+static char *
+virNetMessagePoolGetBuffer(virNetMessagePoolPtr pool,
+                           int cls)
+{
+    char *buf = NULL;
+
+    virObjectLock(pool);
+    if ((buf = pool->buffers[cls])) {
+        memcpy(&pool->buffers[cls], buf, sizeof(char *));
+        pool->nbuffers[cls]--;
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    virObjectUnlock(pool);
+
+    if (!buf)
+        ignore_value(VIR_ALLOC_N(buf, VIR_NET_MESSAGE_POOL_CLASS_SIZE(cls)));
+
+    return buf;
+}
+
+
+static void
+virNetMessagePoolPutBuffer(virNetMessagePoolPtr pool,
+                           char *buf,
+                           size_t len)
+{
+    int cls;
+
+    if (!buf)
+        return;
 
-    if (VIR_ALLOC(msg) < 0)
+    /* Only buffers which exactly match a size class can be recycled */
+    if ((cls = virNetMessagePoolClassForSize(len)) >= 0 &&
+        len == VIR_NET_MESSAGE_POOL_CLASS_SIZE(cls)) {
+        virObjectLock(pool);
+        if (pool->nbuffers[cls] < pool->maxFree) {
+            memcpy(buf, &pool->buffers[cls], sizeof(char *));
+            pool->buffers[cls] = buf;
+            pool->nbuffers[cls]++;
+            buf = NULL;
+        }
+        virObjectUnlock(pool);
+    }
+
+    VIR_FREE(buf);
+}
+
+
+virNetMessagePtr virNetMessageNew(bool tracked)
+{
+    return virNetMessageNewFromPool(NULL, tracked);
+}
+
+
+/**
+ * virNetMessageNewFromPool:
+ * @pool: pool to recycle the message from, or NULL
+ * @tracked: whether the message counts towards client request limits
+ *
+ * Allocates a new empty message, reusing an idle one from @pool if
+ * possible. The message, and any buffer allocated for it later on via
+ * virNetMessageAllocBuffer, are returned to @pool once freed.
+ *
+ * Returns the new message or NULL on error
+ */
+virNetMessagePtr virNetMessageNewFromPool(virNetMessagePoolPtr pool,
+                                          bool tracked)
+{
+    virNetMessagePtr msg = NULL;
+
+    if (pool) {
+        virObjectLock(pool);
+        if ((msg = virNetMessageQueueServe(&pool->msgs))) {
+            pool->nmsgs--;
+            pool->hits++;
+        } else {
+            pool->misses++;
+        }
+        virObjectUnlock(pool);
+    }
+
+    if (!msg && VIR_ALLOC(msg) < 0)
         return NULL;
 
     msg->tracked = tracked;
-    VIR_DEBUG("msg=%p tracked=%d", msg, tracked);
+    msg->pool = virObjectRef(pool);
+    VIR_DEBUG("msg=%p tracked=%d pool=%p", msg, tracked, pool);
 
     return msg;
 }
 
 
+/**
+ * virNetMessageAllocBuffer:
+ * @msg: the message
+ * @len: number of bytes the buffer must be able to hold
+ *
+ * Makes sure the message buffer can hold at least @len bytes,
+ * preserving its current contents. Neither bufferLength nor
+ * bufferOffset are changed. Newly allocated space is not
+ * guaranteed to be zeroed when the message comes from a pool.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageAllocBuffer(virNetMessagePtr msg,
+                             size_t len)
+{
+    char *buf;
+    int cls;
+
+    if (msg->buffer && len <= msg->bufferAlloc)
+        return 0;
+
+    if (!msg->pool || (cls = virNetMessagePoolClassForSize(len)) < 0) {
+        if (VIR_REALLOC_N(msg->buffer, len) < 0)
+            return -1;
+        msg->bufferAlloc = len;
+        return 0;
+    }
+
+    if (!(buf = virNetMessagePoolGetBuffer(msg->pool, cls)))
+        return -1;
+
+    if (msg->buffer)
+        memcpy(buf, msg->buffer, MIN(msg->bufferAlloc, len));
+    virNetMessagePoolPutBuffer(msg->pool, msg->buffer, msg->bufferAlloc);
+
+    msg->buffer = buf;
+    msg->bufferAlloc = VIR_NET_MESSAGE_POOL_CLASS_SIZE(cls);
+    return 0;
+}
+
+
 void
 virNetMessageClearPayload(virNetMessagePtr msg)
 {
@@ -61,26 +306,43 @@ virNetMessageClearPayload(virNetMessagePtr msg)
     msg->nfds = 0;
     VIR_FREE(msg->fds);
 
+    if (msg->bodyOwned)
+        VIR_FREE(msg->body);
+    msg->body = NULL;
+    msg->bodyOwned = false;
+    msg->bodyOffset = 0;
+    msg->bodyLength = 0;
+
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
-    VIR_FREE(msg->buffer);
+    if (msg->pool) {
+        virNetMessagePoolPutBuffer(msg->pool, msg->buffer, msg->bufferAlloc);
+        msg->buffer = NULL;
+    } else {
+        VIR_FREE(msg->buffer);
+    }
+    msg->bufferAlloc = 0;
 }
 
 
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
+    virNetMessagePoolPtr pool = msg->pool;
 
     VIR_DEBUG("msg=%p nfds=%zu", msg, msg->nfds);
 
     virNetMessageClearPayload(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
+    msg->pool = pool;
 }
 
 
 void virNetMessageFree(virNetMessagePtr msg)
 {
+    virNetMessagePoolPtr pool;
+
     if (!msg)
         return;
 
@@ -90,7 +352,24 @@ void virNetMessageFree(virNetMessagePtr msg)
         msg->cb(msg, msg->opaque);
 
     virNetMessageClearPayload(msg);
+
+    if (!(pool = msg->pool)) {
+        VIR_FREE(msg);
+        return;
+    }
+
+    memset(msg, 0, sizeof(*msg));
+    virObjectLock(pool);
+    if (pool->nmsgs < pool->maxFree) {
+        msg->next = pool->msgs;
+        pool->msgs = msg;
+        pool->nmsgs++;
+        msg = NULL;
+    }
+    virObjectUnlock(pool);
+
     VIR_FREE(msg);
+    virObjectUnref(pool);
 }
 
 void virNetMessageQueuePush(virNetMessagePtr *queue, virNetMessagePtr msg)
@@ -154,7 +433,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -231,7 +510,7 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     unsigned int len = 0;
 
     msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0)
         return ret;
     msg->bufferOffset = 0;
 
@@ -372,7 +651,7 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -433,6 +712,195 @@ int virNetMessageDecodePayload(virNetMessagePtr msg,
 }
 
 
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP) && defined(F_ADD_SEALS)
+# define VIR_NET_MESSAGE_SHM_SEALS \
+    (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+bool virNetMessageCanSharePayload(void)
+{
+    return true;
+}
+
+
+/**
+ * virNetMessageEncodeSharedPayload:
+ * @msg: a fully encoded VIR_NET_REPLY message
+ *
+ * Move the payload of @msg out into a sealed memfd which is passed
+ * alongside the message, leaving only its length in the message
+ * itself. The peer maps the memfd rather than reading the payload
+ * through the socket.
+ *
+ * Returns 0 on success, -1 on error after which @msg can only be
+ * reused to send an error
+ */
+int virNetMessageEncodeSharedPayload(virNetMessagePtr msg)
+{
+    size_t start = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+    unsigned int len;
+    int fd = -1;
+    int ret = -1;
+
+    if (msg->header.type != VIR_NET_REPLY ||
+        msg->header.status != VIR_NET_OK ||
+        msg->nfds || msg->bodyLength ||
+        msg->bufferLength < start) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("only plain successful replies can be shared"));
+        return -1;
+    }
+    if (!(len = msg->bufferLength - start)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("empty replies cannot be shared"));
+        return -1;
+    }
+
+    if ((fd = memfd_create("libvirt-rpc", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create shared payload"));
+        goto cleanup;
+    }
+
+    if (safewrite(fd, msg->buffer + start, len) != len) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to write shared payload"));
+        goto cleanup;
+    }
+
+    /* The peer must be able to trust the content won't change under it */
+    if (fcntl(fd, F_ADD_SEALS, VIR_NET_MESSAGE_SHM_SEALS) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seal shared payload"));
+        goto cleanup;
+    }
+
+    msg->header.type = VIR_NET_REPLY_SHM;
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageAddFD(msg, fd) < 0 ||
+        virNetMessageEncodeNumFDs(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t) xdr_u_int, &len) < 0) {
+        size_t i;
+
+        for (i = 0; i < msg->nfds; i++)
+            VIR_FORCE_CLOSE(msg->fds[i]);
+        VIR_FREE(msg->fds);
+        msg->nfds = 0;
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Moved %u bytes of payload to shared FD %d", len, msg->fds[0]);
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+/**
+ * virNetMessageDecodeSharedPayload:
+ * @msg: a VIR_NET_REPLY_SHM message with its FDs decoded
+ * @filter: XDR filter for the payload
+ * @data: where to decode the payload to
+ *
+ * Counterpart of virNetMessageEncodeSharedPayload, decoding the
+ * payload straight out of the mapped memfd.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageDecodeSharedPayload(virNetMessagePtr msg,
+                                     xdrproc_t filter,
+                                     void *data)
+{
+    XDR xdr;
+    unsigned int len;
+    struct stat sb;
+    int seals;
+    void *addr = MAP_FAILED;
+    int ret = -1;
+
+    xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                  msg->bufferLength - msg->bufferOffset, XDR_DECODE);
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to decode shared payload length"));
+        xdr_destroy(&xdr);
+        return -1;
+    }
+    xdr_destroy(&xdr);
+
+    if (msg->nfds != 1 || msg->fds[0] < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("Expected one FD with shared payload, got %zu"),
+                       msg->nfds);
+        return -1;
+    }
+
+    if (len == 0) {
+        virReportError(VIR_ERR_RPC, "%s", _("Shared payload is empty"));
+        return -1;
+    }
+
+    if (fstat(msg->fds[0], &sb) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to stat shared payload"));
+        return -1;
+    }
+
+    if ((seals = fcntl(msg->fds[0], F_GET_SEALS)) < 0 ||
+        (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) !=
+        (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+        sb.st_size < len) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared payload is not sealed or too short"));
+        return -1;
+    }
+
+    if ((addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE,
+                     msg->fds[0], 0)) == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to map shared payload"));
+        return -1;
+    }
+
+    xdrmem_create(&xdr, addr, len, XDR_DECODE);
+    if (!(*filter)(&xdr, data, 0)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to decode message payload"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    xdr_destroy(&xdr);
+    munmap(addr, len);
+    return ret;
+}
+#else /* !(HAVE_MEMFD_CREATE && HAVE_MMAP && F_ADD_SEALS) */
+bool virNetMessageCanSharePayload(void)
+{
+    return false;
+}
+
+
+int virNetMessageEncodeSharedPayload(virNetMessagePtr msg ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("Shared payloads are not supported on this platform"));
+    return -1;
+}
+
+
+int virNetMessageDecodeSharedPayload(virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                     xdrproc_t filter ATTRIBUTE_UNUSED,
+                                     void *data ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("Shared payloads are not supported on this platform"));
+    return -1;
+}
+#endif /* !(HAVE_MEMFD_CREATE && HAVE_MMAP && F_ADD_SEALS) */
+
+
 int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *data,
                                   size_t len)
@@ -456,7 +924,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 
         msg->bufferLength = msg->bufferOffset + len;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
@@ -485,6 +953,66 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 }
 
 
+/**
+ * virNetMessageEncodePayloadRef:
+ * @msg: the outgoing message with its header encoded
+ * @data: raw payload
+ * @len: length of @data
+ * @steal: whether the message takes ownership of @data
+ *
+ * Like virNetMessageEncodePayloadRaw, but instead of copying @data
+ * into the message buffer it is kept as a separate body which is
+ * written out straight after the buffer. If @steal is false the caller
+ * must keep @data around until the message has been fully sent. If
+ * @steal is true @data is freed along with the message, even on error.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  char *data,
+                                  size_t len,
+                                  bool steal)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    msg->body = data;
+    msg->bodyLength = len;
+    msg->bodyOffset = 0;
+    msg->bodyOwned = steal;
+
+    if ((msg->bufferOffset + len) >
+        (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send "
+                         "(%zu bytes needed, %zu bytes available)"),
+                       len,
+                       VIR_NET_MESSAGE_MAX +
+                       VIR_NET_MESSAGE_LEN_MAX -
+                       msg->bufferOffset);
+        return -1;
+    }
+
+    /* Encode the length word covering both buffer and body. */
+    VIR_DEBUG("Encode length as %zu", msg->bufferOffset + len);
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    return 0;
+
+ error:
+    xdr_destroy(&xdr);
+    return -1;
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
@@ -510,6 +1038,64 @@ int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 }
 
 
+/**
+ * virNetMessageGetIOV:
+ * @msg: the outgoing message
+ * @iov: array of at least VIR_NET_MESSAGE_IOV_MAX elements
+ *
+ * Fills @iov with the parts of the message which are yet to be sent.
+ *
+ * Returns the number of elements filled in
+ */
+int virNetMessageGetIOV(virNetMessagePtr msg,
+                        struct iovec *iov)
+{
+    int niov = 0;
+
+    if (msg->bufferOffset < msg->bufferLength) {
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+    }
+
+    if (msg->bodyOffset < msg->bodyLength) {
+        iov[niov].iov_base = msg->body + msg->bodyOffset;
+        iov[niov].iov_len = msg->bodyLength - msg->bodyOffset;
+        niov++;
+    }
+
+    return niov;
+}
+
+
+/**
+ * virNetMessageConsumeIOV:
+ * @msg: the outgoing message
+ * @len: number of bytes which were sent
+ *
+ * Advances the message past @len bytes which were written out
+ * from the vector returned by virNetMessageGetIOV.
+ */
+void virNetMessageConsumeIOV(virNetMessagePtr msg,
+                             size_t len)
+{
+    size_t n = MIN(len, msg->bufferLength - msg->bufferOffset);
+
+    msg->bufferOffset += n;
+    len -= n;
+
+    n = MIN(len, msg->bodyLength - msg->bodyOffset);
+    msg->bodyOffset += n;
+}
+
+
+bool virNetMessageHasPendingData(virNetMessagePtr msg)
+{
+    return msg->bufferOffset < msg->bufferLength ||
+        msg->bodyOffset < msg->bodyLength;
+}
+
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
 {
     /* This func may be called several times & the first
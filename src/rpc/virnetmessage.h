@@ -21,6 +21,8 @@
 #ifndef __VIR_NET_MESSAGE_H__
 # define __VIR_NET_MESSAGE_H__
 
+# include <sys/uio.h>
+
 # include "virnetprotocol.h"
 
 typedef struct virNetMessageHeader *virNetMessageHeaderPtr;
@@ -29,18 +31,34 @@ typedef struct virNetMessageError *virNetMessageErrorPtr;
 typedef struct _virNetMessage virNetMessage;
 typedef virNetMessage *virNetMessagePtr;
 
+typedef struct _virNetMessagePool virNetMessagePool;
+typedef virNetMessagePool *virNetMessagePoolPtr;
+
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
 struct _virNetMessage {
     bool tracked;
+    bool event; /* Counted against the client's event queue limit */
+    virNetMessagePoolPtr pool; /* Where to recycle buffer and message, or NULL */
 
     char *buffer; /* Initially VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX */
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
+    size_t bufferAlloc; /* Allocated size of @buffer, >= bufferLength */
     size_t bufferLength;
     size_t bufferOffset;
 
+    /* Optional raw payload which is sent straight after @buffer
+     * rather than being copied into it */
+    char *body;
+    size_t bodyLength;
+    size_t bodyOffset;
+    bool bodyOwned; /* Whether @body is freed along with the message */
+
     virNetMessageHeader header;
 
+    /* When an incoming call was queued for dispatch, in microseconds */
+    unsigned long long queued;
+
     virNetMessageFreeCallback cb;
     void *opaque;
 
@@ -52,7 +70,19 @@ struct _virNetMessage {
 };
 
 
+virNetMessagePoolPtr virNetMessagePoolNew(size_t maxFree);
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               unsigned long long *hits,
+                               unsigned long long *misses)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 virNetMessagePtr virNetMessageNew(bool tracked);
+virNetMessagePtr virNetMessageNewFromPool(virNetMessagePoolPtr pool,
+                                          bool tracked);
+
+int virNetMessageAllocBuffer(virNetMessagePtr msg,
+                             size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
 void virNetMessageClearPayload(virNetMessagePtr msg);
 
@@ -85,13 +115,37 @@ int virNetMessageDecodePayload(virNetMessagePtr msg,
 int virNetMessageEncodeNumFDs(virNetMessagePtr msg);
 int virNetMessageDecodeNumFDs(virNetMessagePtr msg);
 
+bool virNetMessageCanSharePayload(void);
+int virNetMessageEncodeSharedPayload(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageDecodeSharedPayload(virNetMessagePtr msg,
+                                     xdrproc_t filter,
+                                     void *data)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadRef(virNetMessagePtr msg,
+                                  char *buf,
+                                  size_t len,
+                                  bool steal)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+# define VIR_NET_MESSAGE_IOV_MAX 2
+
+int virNetMessageGetIOV(virNetMessagePtr msg,
+                        struct iovec *iov)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virNetMessageConsumeIOV(virNetMessagePtr msg,
+                             size_t len)
+    ATTRIBUTE_NONNULL(1);
+bool virNetMessageHasPendingData(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
 
@@ -151,6 +151,11 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_OK
  *          <empty>
  *
+ *  - type == VIR_NET_REPLY_SHM
+ *          int8 - number of FDs, always 1
+ *     * status == VIR_NET_OK
+ *          u_int - length of XXX_ret held in the passed memfd
+ *
  */
 enum virNetMessageType {
     /* client -> server. args from a method call */
@@ -166,7 +171,9 @@ enum virNetMessageType {
     /* server -> client. reply/error from a method call, with passed FDs */
     VIR_NET_REPLY_WITH_FDS = 5,
     /* either direction, stream hole data packet */
-    VIR_NET_STREAM_HOLE = 6
+    VIR_NET_STREAM_HOLE = 6,
+    /* server -> client. reply from a method call, payload in a passed memfd */
+    VIR_NET_REPLY_SHM = 7
 };
 
 enum virNetMessageStatus {
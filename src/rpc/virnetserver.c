@@ -31,11 +31,16 @@
 #include "virthreadpool.h"
 #include "virnetservermdns.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netserver");
 
+/* Maximum number of idle messages and buffers (per size class) kept in
+ * the message pool of a server */
+#define VIR_NET_SERVER_MESSAGE_POOL_MAX 64
+
 
 typedef struct _virNetServerJob virNetServerJob;
 typedef virNetServerJob *virNetServerJobPtr;
@@ -53,6 +58,9 @@ struct _virNetServer {
 
     virThreadPoolPtr workers;
 
+    /* Recycles messages and buffers of all clients */
+    virNetMessagePoolPtr msgpool;
+
     char *mdnsGroupName;
     virNetServerMDNSPtr mdns;
     virNetServerMDNSGroupPtr mdnsGroup;
@@ -195,6 +203,9 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
     VIR_DEBUG("server=%p client=%p message=%p",
               srv, client, msg);
 
+    if (virTimeMicrosNowRaw(&msg->queued) < 0)
+        msg->queued = 0;
+
     virObjectLock(srv);
     for (i = 0; i < srv->nprograms; i++) {
         if (virNetServerProgramMatches(srv->programs[i], msg)) {
@@ -217,7 +228,9 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        /* Let clients take turns so that one queueing lots of calls
+         * cannot delay everybody else's */
+        ret = virThreadPoolSendJobFull(srv->workers, priority, client, job);
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -278,6 +291,8 @@ int virNetServerAddClient(virNetServerPtr srv,
 {
     virObjectLock(srv);
 
+    virNetServerClientSetMessagePool(client, srv->msgpool);
+
     if (virNetServerClientInit(client) < 0)
         goto error;
 
@@ -369,6 +384,9 @@ virNetServerPtr virNetServerNew(const char *name,
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
+    if (!(srv->msgpool = virNetMessagePoolNew(VIR_NET_SERVER_MESSAGE_POOL_MAX)))
+        goto error;
+
     srv->next_client_id = next_client_id;
     srv->nclients_max = max_clients;
     srv->nclients_unauth_max = max_anonymous_clients;
@@ -780,6 +798,8 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    virObjectUnref(srv->msgpool);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
@@ -917,6 +937,24 @@ virNetServerGetThreadPoolParameters(virNetServerPtr srv,
     return 0;
 }
 
+void
+virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                unsigned long long *hits,
+                                unsigned long long *misses)
+{
+    virNetMessagePoolGetStats(srv->msgpool, hits, misses);
+}
+
+void
+virNetServerGetJobLatency(virNetServerPtr srv,
+                          unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                                                    [VIR_THREAD_POOL_LATENCY_LAST])
+{
+    virObjectLock(srv);
+    virThreadPoolGetJobLatency(srv->workers, latency);
+    virObjectUnlock(srv);
+}
+
 int
 virNetServerSetThreadPoolParameters(virNetServerPtr srv,
                                     long long int minWorkers,
@@ -1010,6 +1048,35 @@ virNetServerGetClients(virNetServerPtr srv,
     return ret;
 }
 
+int
+virNetServerGetPrograms(virNetServerPtr srv,
+                        virNetServerProgramPtr **progs)
+{
+    int ret = -1;
+    size_t i;
+    size_t nprogs = 0;
+    virNetServerProgramPtr *list = NULL;
+
+    virObjectLock(srv);
+
+    for (i = 0; i < srv->nprograms; i++) {
+        virNetServerProgramPtr prog = virObjectRef(srv->programs[i]);
+        if (VIR_APPEND_ELEMENT(list, nprogs, prog) < 0) {
+            virObjectUnref(prog);
+            goto cleanup;
+        }
+    }
+
+    *progs = list;
+    list = NULL;
+    ret = nprogs;
+
+ cleanup:
+    virObjectListFreeCount(list, nprogs);
+    virObjectUnlock(srv);
+    return ret;
+}
+
 virNetServerClientPtr
 virNetServerGetClient(virNetServerPtr srv,
                       unsigned long long id)
@@ -32,6 +32,7 @@
 # include "virnetserverservice.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virthreadpool.h"
 
 
 virNetServerPtr virNetServerNew(const char *name,
@@ -98,6 +99,14 @@ int virNetServerGetThreadPoolParameters(virNetServerPtr srv,
                                         size_t *nPrioWorkers,
                                         size_t *jobQueueDepth);
 
+void virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                     unsigned long long *hits,
+                                     unsigned long long *misses);
+
+void virNetServerGetJobLatency(virNetServerPtr srv,
+                               unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                                                         [VIR_THREAD_POOL_LATENCY_LAST]);
+
 int virNetServerSetThreadPoolParameters(virNetServerPtr srv,
                                         long long int minWorkers,
                                         long long int maxWorkers,
@@ -111,6 +120,9 @@ virNetServerClientPtr virNetServerGetClient(virNetServerPtr srv,
 int virNetServerGetClients(virNetServerPtr srv,
                            virNetServerClientPtr **clients);
 
+int virNetServerGetPrograms(virNetServerPtr srv,
+                            virNetServerProgramPtr **progs);
+
 size_t virNetServerGetMaxClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentClients(virNetServerPtr srv);
 size_t virNetServerGetMaxUnauthClients(virNetServerPtr srv);
@@ -44,6 +44,9 @@
 
 VIR_LOG_INIT("rpc.netserverclient");
 
+/* Size of the buffer small reads from the socket are made into */
+#define VIR_NET_SERVER_CLIENT_READ_AHEAD 16384
+
 /* Allow for filtering of incoming messages to a custom
  * dispatch processing queue, instead of the workers.
  * This allows for certain types of messages to be handled
@@ -82,6 +85,18 @@ struct _virNetServerClient
     int sockTimer; /* Timer to be fired upon cached data,
                     * so we jump out from poll() immediately */
 
+    /* Pool shared with the server for recycling rx messages */
+    virNetMessagePoolPtr msgpool;
+
+    /* Data read from the socket ahead of the message being received,
+     * allocated only while there is some */
+    char *readAhead;
+    size_t readAheadLength;
+    size_t readAheadOffset;
+
+    /* Successful replies at least this large are passed in a memfd
+     * rather than through the socket, 0 if never */
+    size_t sharedReplyMin;
 
     virIdentityPtr identity;
 
@@ -106,6 +121,19 @@ struct _virNetServerClient
      * back to client, including async events */
     virNetMessagePtr tx;
 
+    /* Count of async events in the 'tx' queue. Once
+     * it reaches nevents_max, further events are
+     * dropped according to eventsPolicy */
+    size_t nevents;
+    size_t nevents_max;
+    virNetServerClientEventsPolicy eventsPolicy;
+    unsigned long long eventsDropped;
+    /* Dropped since the client was last told about it */
+    unsigned long long eventsLost;
+    virNetServerClientEventsLostFunc eventsLostFunc;
+    /* The notification about lost events in 'tx', if any */
+    virNetMessagePtr eventsLostMsg;
+
     /* Filters to capture messages that would otherwise
      * end up on the 'dx' queue */
     virNetServerClientFilterPtr filters;
@@ -123,6 +151,11 @@ struct _virNetServerClient
 };
 
 
+VIR_ENUM_IMPL(virNetServerClientEventsPolicy,
+              VIR_NET_SERVER_CLIENT_EVENTS_LAST,
+              "drop-newest",
+              "drop-oldest")
+
 static virClassPtr virNetServerClientClass;
 static void virNetServerClientDispose(void *obj);
 
@@ -145,6 +178,7 @@ static void virNetServerClientUpdateEvent(virNetServerClientPtr client);
 static void virNetServerClientDispatchRead(virNetServerClientPtr client);
 static int virNetServerClientSendMessageLocked(virNetServerClientPtr client,
                                                virNetMessagePtr msg);
+static void virNetServerClientQueueEventsLost(virNetServerClientPtr client);
 
 /*
  * @client: a locked client object
@@ -241,7 +275,9 @@ static void virNetServerClientUpdateEvent(virNetServerClientPtr client)
 
     virNetSocketUpdateIOCallback(client->sock, mode);
 
-    if (client->rx && virNetSocketHasCachedData(client->sock))
+    if (client->rx &&
+        (virNetSocketHasCachedData(client->sock) ||
+         client->readAheadOffset < client->readAheadLength))
         virEventUpdateTimeout(client->sockTimer, 0);
 }
 
@@ -318,7 +354,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
         return -1;
     }
 
-    if (!(confirm = virNetMessageNew(false)))
+    if (!(confirm = virNetMessageNewFromPool(client->msgpool, false)))
         return -1;
 
     /* Checks have succeeded.  Write a '\1' byte back to the client to
@@ -326,7 +362,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
      * (NB. The '\1' byte is sent in an encrypted record).
      */
     confirm->bufferLength = 1;
-    if (VIR_ALLOC_N(confirm->buffer, confirm->bufferLength) < 0) {
+    if (virNetMessageAllocBuffer(confirm, confirm->bufferLength) < 0) {
         virNetMessageFree(confirm);
         return -1;
     }
@@ -392,7 +428,7 @@ virNetServerClientNewInternal(unsigned long long id,
     if (!(client->rx = virNetMessageNew(true)))
         goto error;
     client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (virNetMessageAllocBuffer(client->rx, client->rx->bufferLength) < 0)
         goto error;
     client->nrequests = 1;
 
@@ -903,6 +939,20 @@ void virNetServerClientSetDispatcher(virNetServerClientPtr client,
 }
 
 
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool)
+{
+    virObjectLock(client);
+    virObjectUnref(client->msgpool);
+    client->msgpool = virObjectRef(pool);
+
+    /* The initial rx message was allocated before we knew the pool */
+    if (client->rx && !client->rx->pool)
+        client->rx->pool = virObjectRef(pool);
+    virObjectUnlock(client);
+}
+
+
 const char *virNetServerClientLocalAddrStringSASL(virNetServerClientPtr client)
 {
     if (!client->sock)
@@ -948,6 +998,8 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tlsCtxt);
 #endif
     virObjectUnref(client->sock);
+    virObjectUnref(client->msgpool);
+    VIR_FREE(client->readAhead);
 }
 
 
@@ -1015,6 +1067,8 @@ void virNetServerClientClose(virNetServerClientPtr client)
             = virNetMessageQueueServe(&client->tx);
         virNetMessageFree(msg);
     }
+    client->nevents = 0;
+    client->eventsLostMsg = NULL;
 
     if (client->sock) {
         virObjectUnref(client->sock);
@@ -1073,7 +1127,7 @@ int virNetServerClientInit(virNetServerClientPtr client)
         int ret;
 
         if (!(client->tls = virNetTLSSessionNew(client->tlsCtxt,
-                                                NULL)))
+                                                NULL, NULL)))
             goto error;
 
         virNetSocketSetTLSSession(client->sock,
@@ -1120,6 +1174,7 @@ int virNetServerClientInit(virNetServerClientPtr client)
  */
 static ssize_t virNetServerClientRead(virNetServerClientPtr client)
 {
+    size_t want;
     ssize_t ret;
 
     if (client->rx->bufferLength <= client->rx->bufferOffset) {
@@ -1130,12 +1185,49 @@ static ssize_t virNetServerClientRead(virNetServerClientPtr client)
         return -1;
     }
 
-    ret = virNetSocketRead(client->sock,
-                           client->rx->buffer + client->rx->bufferOffset,
-                           client->rx->bufferLength - client->rx->bufferOffset);
+    want = client->rx->bufferLength - client->rx->bufferOffset;
+
+    /* Small reads, which is what most length words and calls are, go
+     * through the read-ahead buffer so that a pipelining client gets
+     * several messages received with a single syscall. File descriptors
+     * are passed along with the data and get lost if read past, so
+     * sockets supporting that always read exactly what is needed. */
+    if (client->readAheadOffset == client->readAheadLength &&
+        want < VIR_NET_SERVER_CLIENT_READ_AHEAD &&
+        !virNetSocketHasPassFD(client->sock)) {
+        if (!client->readAhead &&
+            VIR_ALLOC_N(client->readAhead, VIR_NET_SERVER_CLIENT_READ_AHEAD) < 0)
+            return -1;
+
+        ret = virNetSocketRead(client->sock, client->readAhead,
+                               VIR_NET_SERVER_CLIENT_READ_AHEAD);
+        if (ret <= 0) {
+            VIR_FREE(client->readAhead);
+            return ret;
+        }
 
-    if (ret <= 0)
-        return ret;
+        client->readAheadOffset = 0;
+        client->readAheadLength = ret;
+    }
+
+    if (client->readAheadOffset < client->readAheadLength) {
+        ret = MIN(want, client->readAheadLength - client->readAheadOffset);
+        memcpy(client->rx->buffer + client->rx->bufferOffset,
+               client->readAhead + client->readAheadOffset, ret);
+        client->readAheadOffset += ret;
+
+        /* Idle clients should not hold on to the buffer */
+        if (client->readAheadOffset == client->readAheadLength) {
+            VIR_FREE(client->readAhead);
+            client->readAheadOffset = client->readAheadLength = 0;
+        }
+    } else {
+        ret = virNetSocketRead(client->sock,
+                               client->rx->buffer + client->rx->bufferOffset,
+                               want);
+        if (ret <= 0)
+            return ret;
+    }
 
     client->rx->bufferOffset += ret;
     return ret;
@@ -1274,12 +1366,13 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetMessageNewFromPool(client->msgpool,
+                                                        true))) {
                 client->wantClose = true;
             } else {
                 client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
+                if (virNetMessageAllocBuffer(client->rx,
+                                             client->rx->bufferLength) < 0) {
                     client->wantClose = true;
                 } else {
                     client->nrequests++;
@@ -1287,6 +1380,12 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
             }
         }
         virNetServerClientUpdateEvent(client);
+
+        /* Queue any further complete messages we already have rather
+         * than waiting for the event loop to come back to us */
+        if (client->rx && !client->wantClose &&
+            client->readAheadOffset < client->readAheadLength)
+            goto readmore;
     }
 }
 
@@ -1301,6 +1400,8 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
  */
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_MESSAGE_IOV_MAX];
+    int niov;
     ssize_t ret;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
@@ -1311,16 +1412,15 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
         return -1;
     }
 
-    if (client->tx->bufferLength == client->tx->bufferOffset)
+    if (!virNetMessageHasPendingData(client->tx))
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    niov = virNetMessageGetIOV(client->tx, iov);
+    ret = virNetSocketWriteV(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    virNetMessageConsumeIOV(client->tx, ret);
     return ret;
 }
 
@@ -1333,7 +1433,7 @@ static void
 virNetServerClientDispatchWrite(virNetServerClientPtr client)
 {
     while (client->tx) {
-        if (client->tx->bufferOffset < client->tx->bufferLength) {
+        if (virNetMessageHasPendingData(client->tx)) {
             ssize_t ret;
             ret = virNetServerClientWrite(client);
             if (ret < 0) {
@@ -1344,7 +1444,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                 return; /* Would block on write EAGAIN */
         }
 
-        if (client->tx->bufferOffset == client->tx->bufferLength) {
+        if (!virNetMessageHasPendingData(client->tx)) {
             virNetMessagePtr msg;
             size_t i;
 
@@ -1373,6 +1473,11 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             /* Get finished msg from head of tx queue */
             msg = virNetMessageQueueServe(&client->tx);
 
+            if (msg == client->eventsLostMsg)
+                client->eventsLostMsg = NULL;
+            if (msg->event)
+                client->nevents--;
+
             if (msg->tracked) {
                 client->nrequests--;
                 /* See if the recv queue is currently throttled */
@@ -1381,7 +1486,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
                     msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    if (virNetMessageAllocBuffer(msg, msg->bufferLength) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -1393,6 +1498,8 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
 
             virNetMessageFree(msg);
 
+            virNetServerClientQueueEventsLost(client);
+
             virNetServerClientUpdateEvent(client);
 
             if (client->delayedClose)
@@ -1507,6 +1614,233 @@ int virNetServerClientSendMessage(virNetServerClientPtr client,
 }
 
 
+/**
+ * virNetServerClientSetEventQueueLimit:
+ * @client: the client
+ * @nevents_max: how many events may wait for transmission, 0 for no limit
+ * @policy: which event to drop once the limit is reached
+ *
+ * Bound the memory a client which doesn't keep up with its events
+ * can make the server hold on to.
+ */
+void virNetServerClientSetEventQueueLimit(virNetServerClientPtr client,
+                                          size_t nevents_max,
+                                          virNetServerClientEventsPolicy policy)
+{
+    virObjectLock(client);
+    client->nevents_max = nevents_max;
+    client->eventsPolicy = policy;
+    virObjectUnlock(client);
+}
+
+
+/**
+ * virNetServerClientCanShareReplies:
+ * @client: the client
+ *
+ * Only clients on a local socket able to pass FDs can map replies
+ * handed over in shared memory.
+ */
+bool virNetServerClientCanShareReplies(virNetServerClientPtr client)
+{
+    return virNetMessageCanSharePayload() &&
+        virNetSocketHasPassFD(client->sock);
+}
+
+
+/**
+ * virNetServerClientSetSharedReplies:
+ * @client: the client
+ * @minSize: smallest encoded reply to pass in shared memory, 0 to disable
+ *
+ * Returns 0 on success, -1 if the client can't map shared replies
+ */
+int virNetServerClientSetSharedReplies(virNetServerClientPtr client,
+                                       size_t minSize)
+{
+    int ret = -1;
+
+    virObjectLock(client);
+    if (minSize && !virNetServerClientCanShareReplies(client)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("shared replies are not supported on this connection"));
+        goto cleanup;
+    }
+    client->sharedReplyMin = minSize;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+size_t virNetServerClientGetSharedReplyMin(virNetServerClientPtr client)
+{
+    size_t ret;
+
+    virObjectLock(client);
+    ret = client->sharedReplyMin;
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+/**
+ * virNetServerClientSetEventsLostFunc:
+ * @client: the client
+ * @func: builds the notification about dropped events
+ *
+ * Set once the client is known to understand the notification. It is
+ * queued as soon as there is room for it after events were dropped,
+ * and is called with the client locked.
+ */
+void virNetServerClientSetEventsLostFunc(virNetServerClientPtr client,
+                                         virNetServerClientEventsLostFunc func)
+{
+    virObjectLock(client);
+    client->eventsLostFunc = func;
+    virNetServerClientQueueEventsLost(client);
+    virObjectUnlock(client);
+}
+
+
+/*
+ * @client: a locked client object
+ *
+ * Tell the client how many events it missed, if there are any and
+ * the queue has room for the notification.
+ */
+static void
+virNetServerClientQueueEventsLost(virNetServerClientPtr client)
+{
+    virNetMessagePtr msg;
+
+    if (!client->eventsLost ||
+        !client->eventsLostFunc ||
+        client->eventsLostMsg)
+        return;
+
+    if (client->nevents_max &&
+        client->nevents >= client->nevents_max)
+        return;
+
+    if (!(msg = client->eventsLostFunc(client, client->eventsLost)))
+        return;
+
+    msg->event = true;
+    if (virNetServerClientSendMessageLocked(client, msg) < 0) {
+        virNetMessageFree(msg);
+        return;
+    }
+
+    VIR_DEBUG("client=%p told about %llu lost events",
+              client, client->eventsLost);
+    client->nevents++;
+    client->eventsLost = 0;
+    client->eventsLostMsg = msg;
+}
+
+
+/*
+ * @client: a locked client object
+ *
+ * Unlink the oldest event which hasn't started being transmitted yet,
+ * leaving alone the notification about lost events.
+ */
+static virNetMessagePtr
+virNetServerClientTakeOldestEvent(virNetServerClientPtr client)
+{
+    virNetMessagePtr *prev = &client->tx;
+    virNetMessagePtr msg;
+
+    /* The head may be partially written already */
+    if (client->tx && client->tx->bufferOffset != 0)
+        prev = &client->tx->next;
+
+    for (msg = *prev; msg; prev = &msg->next, msg = msg->next) {
+        if (!msg->event || msg == client->eventsLostMsg)
+            continue;
+
+        *prev = msg->next;
+        msg->next = NULL;
+        client->nevents--;
+        return msg;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virNetServerClientSendEvent:
+ * @client: the client
+ * @msg: the encoded event
+ *
+ * Queue an asynchronous event for transmission, subject to the limit
+ * set by virNetServerClientSetEventQueueLimit().  An event which has
+ * to be dropped is accounted for and freed.
+ *
+ * Returns 0 if @msg was consumed, -1 if the client is closed and the
+ * caller still owns @msg.
+ */
+int virNetServerClientSendEvent(virNetServerClientPtr client,
+                                virNetMessagePtr msg)
+{
+    virNetMessagePtr old = NULL;
+    int ret = -1;
+
+    virObjectLock(client);
+
+    if (!client->sock || client->wantClose)
+        goto cleanup;
+
+    if (client->nevents_max &&
+        client->nevents >= client->nevents_max) {
+        if (client->eventsPolicy == VIR_NET_SERVER_CLIENT_EVENTS_DROP_OLDEST)
+            old = virNetServerClientTakeOldestEvent(client);
+
+        client->eventsDropped++;
+        client->eventsLost++;
+
+        if (!old) {
+            VIR_DEBUG("client=%p event queue full, dropping proc=%d",
+                      client, msg->header.proc);
+            virNetMessageFree(msg);
+            ret = 0;
+            goto cleanup;
+        }
+
+        VIR_DEBUG("client=%p event queue full, dropping proc=%d",
+                  client, old->header.proc);
+        virNetMessageFree(old);
+    }
+
+    virNetServerClientQueueEventsLost(client);
+
+    msg->event = true;
+    if (virNetServerClientSendMessageLocked(client, msg) < 0)
+        goto cleanup;
+    client->nevents++;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+void virNetServerClientGetEventStats(virNetServerClientPtr client,
+                                     size_t *nevents,
+                                     unsigned long long *dropped)
+{
+    virObjectLock(client);
+    *nevents = client->nevents;
+    *dropped = client->eventsDropped;
+    virObjectUnlock(client);
+}
+
+
 bool virNetServerClientNeedAuth(virNetServerClientPtr client)
 {
     bool need = false;
@@ -29,6 +29,7 @@
 # include "virnetmessage.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virutil.h"
 
 typedef struct _virNetServerClient virNetServerClient;
 typedef virNetServerClient *virNetServerClientPtr;
@@ -49,6 +50,20 @@ typedef void *(*virNetServerClientPrivNewPostExecRestart)(virNetServerClientPtr
 typedef void *(*virNetServerClientPrivNew)(virNetServerClientPtr client,
                                            void *opaque);
 
+/* What to do with an event once the client's event queue is full */
+typedef enum {
+    VIR_NET_SERVER_CLIENT_EVENTS_DROP_NEWEST = 0, /* discard the new event */
+    VIR_NET_SERVER_CLIENT_EVENTS_DROP_OLDEST, /* discard the oldest queued one */
+
+    VIR_NET_SERVER_CLIENT_EVENTS_LAST
+} virNetServerClientEventsPolicy;
+
+VIR_ENUM_DECL(virNetServerClientEventsPolicy)
+
+/* Build the message telling the client that @count events were dropped */
+typedef virNetMessagePtr (*virNetServerClientEventsLostFunc)(virNetServerClientPtr client,
+                                                             unsigned long long count);
+
 virNetServerClientPtr virNetServerClientNew(unsigned long long id,
                                             virNetSocketPtr sock,
                                             int auth,
@@ -122,6 +137,8 @@ void virNetServerClientSetCloseHook(virNetServerClientPtr client,
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool);
 void virNetServerClientClose(virNetServerClientPtr client);
 bool virNetServerClientIsClosed(virNetServerClientPtr client);
 
@@ -145,6 +162,21 @@ const char *virNetServerClientRemoteAddrStringURI(virNetServerClientPtr client);
 int virNetServerClientSendMessage(virNetServerClientPtr client,
                                   virNetMessagePtr msg);
 
+void virNetServerClientSetEventQueueLimit(virNetServerClientPtr client,
+                                          size_t nevents_max,
+                                          virNetServerClientEventsPolicy policy);
+bool virNetServerClientCanShareReplies(virNetServerClientPtr client);
+int virNetServerClientSetSharedReplies(virNetServerClientPtr client,
+                                       size_t minSize);
+size_t virNetServerClientGetSharedReplyMin(virNetServerClientPtr client);
+void virNetServerClientSetEventsLostFunc(virNetServerClientPtr client,
+                                         virNetServerClientEventsLostFunc func);
+int virNetServerClientSendEvent(virNetServerClientPtr client,
+                                virNetMessagePtr msg);
+void virNetServerClientGetEventStats(virNetServerClientPtr client,
+                                     size_t *nevents,
+                                     unsigned long long *dropped);
+
 bool virNetServerClientNeedAuth(virNetServerClientPtr client);
 
 int virNetServerClientGetTransport(virNetServerClientPtr client);
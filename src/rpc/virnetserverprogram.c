@@ -31,18 +31,25 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netserverprogram");
 
+VIR_ENUM_IMPL(virNetServerProgramTimeBucket, VIR_NET_SERVER_PROGRAM_TIME_LAST,
+              "10us", "100us", "1ms", "10ms", "100ms", "1s", "10s", "inf")
+
 struct _virNetServerProgram {
-    virObject object;
+    virObjectLockable parent;
 
     unsigned program;
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* Per procedure call statistics, indexed like @procs */
+    virNetServerProgramProcStatsPtr stats;
 };
 
 
@@ -51,7 +58,7 @@ static void virNetServerProgramDispose(void *obj);
 
 static int virNetServerProgramOnceInit(void)
 {
-    if (!(virNetServerProgramClass = virClassNew(virClassForObject(),
+    if (!(virNetServerProgramClass = virClassNew(virClassForObjectLockable(),
                                                  "virNetServerProgram",
                                                  sizeof(virNetServerProgram),
                                                  virNetServerProgramDispose)))
@@ -73,9 +80,14 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (virNetServerProgramInitialize() < 0)
         return NULL;
 
-    if (!(prog = virObjectNew(virNetServerProgramClass)))
+    if (!(prog = virObjectLockableNew(virNetServerProgramClass)))
         return NULL;
 
+    if (nprocs && VIR_ALLOC_N(prog->stats, nprocs) < 0) {
+        virObjectUnref(prog);
+        return NULL;
+    }
+
     prog->program = program;
     prog->version = version;
     prog->procs = procs;
@@ -139,6 +151,105 @@ virNetServerProgramGetPriority(virNetServerProgramPtr prog,
     return proc->priority;
 }
 
+const char *
+virNetServerProgramGetProcName(virNetServerProgramPtr prog,
+                               int procedure)
+{
+    virNetServerProgramProcPtr proc = virNetServerProgramGetProc(prog, procedure);
+
+    if (!proc)
+        return NULL;
+
+    return proc->name;
+}
+
+
+/*
+ * @stats: filled with a copy of the per procedure call statistics
+ *
+ * Returns the number of entries in @stats, which is indexed by
+ * procedure number, or -1 on error
+ */
+int
+virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                virNetServerProgramProcStatsPtr *stats)
+{
+    int ret = -1;
+
+    *stats = NULL;
+
+    virObjectLock(prog);
+
+    if (prog->nprocs &&
+        VIR_ALLOC_N(*stats, prog->nprocs) < 0)
+        goto cleanup;
+
+    if (prog->nprocs)
+        memcpy(*stats, prog->stats, sizeof(*prog->stats) * prog->nprocs);
+
+    ret = prog->nprocs;
+
+ cleanup:
+    virObjectUnlock(prog);
+    return ret;
+}
+
+
+static size_t
+virNetServerProgramTimeBucketFor(unsigned long long from,
+                                 unsigned long long to)
+{
+    unsigned long long elapsed = to > from ? to - from : 0;
+    unsigned long long limit = 10;
+    size_t bucket;
+
+    for (bucket = 0; bucket < VIR_NET_SERVER_PROGRAM_TIME_INF; bucket++) {
+        if (elapsed < limit)
+            break;
+        limit *= 10;
+    }
+
+    return bucket;
+}
+
+
+/*
+ * Account a single call of @procedure. Any of the @queued, @started
+ * and @finished timestamps may be 0 if unknown, in which case the
+ * corresponding histogram is left alone.
+ */
+static void
+virNetServerProgramUpdateStats(virNetServerProgramPtr prog,
+                               int procedure,
+                               unsigned long long queued,
+                               unsigned long long started,
+                               unsigned long long finished,
+                               size_t bytesIn,
+                               size_t bytesOut,
+                               bool error)
+{
+    virNetServerProgramProcStatsPtr stats;
+
+    if (!virNetServerProgramGetProc(prog, procedure))
+        return;
+
+    virObjectLock(prog);
+    stats = &prog->stats[procedure];
+
+    stats->calls++;
+    if (error)
+        stats->errors++;
+    stats->bytesIn += bytesIn;
+    stats->bytesOut += bytesOut;
+
+    if (queued && started)
+        stats->queueTime[virNetServerProgramTimeBucketFor(queued, started)]++;
+    if (started && finished)
+        stats->execTime[virNetServerProgramTimeBucketFor(started, finished)]++;
+
+    virObjectUnlock(prog);
+}
+
 static int
 virNetServerProgramSendError(unsigned program,
                              unsigned version,
@@ -377,10 +488,18 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     virNetServerProgramProcPtr dispatcher;
     virNetMessageError rerr;
     size_t i;
+    size_t sharedMin;
     virIdentityPtr identity = NULL;
+    unsigned long long queued = msg->queued;
+    unsigned long long started = 0;
+    unsigned long long finished = 0;
+    size_t bytesIn = msg->bufferLength;
 
     memset(&rerr, 0, sizeof(rerr));
 
+    if (virTimeMicrosNowRaw(&started) < 0)
+        started = 0;
+
     if (msg->header.status != VIR_NET_OK) {
         virReportError(VIR_ERR_RPC,
                        _("Unexpected message status %u"),
@@ -436,6 +555,9 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
      */
     rv = (dispatcher->func)(server, client, msg, &rerr, arg, ret);
 
+    if (virTimeMicrosNowRaw(&finished) < 0)
+        finished = 0;
+
     if (virIdentitySetCurrent(NULL) < 0)
         goto error;
 
@@ -486,14 +608,33 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     }
 
     xdr_free(dispatcher->ret_filter, ret);
+
+    /* Large replies to local clients which asked for it are handed
+     * over in a memfd instead of being copied through the socket */
+    if (!msg->nfds &&
+        (sharedMin = virNetServerClientGetSharedReplyMin(client)) &&
+        msg->bufferLength >= sharedMin &&
+        virNetMessageEncodeSharedPayload(msg) < 0)
+        goto error;
+
     VIR_FREE(arg);
     VIR_FREE(ret);
 
     virObjectUnref(identity);
+
+    virNetServerProgramUpdateStats(prog, msg->header.proc,
+                                   queued, started, finished, bytesIn,
+                                   msg->bufferLength + msg->bodyLength,
+                                   false);
+
     /* Put reply on end of tx queue to send out  */
     return virNetServerClientSendMessage(client, msg);
 
  error:
+    virNetServerProgramUpdateStats(prog, msg->header.proc,
+                                   queued, started, finished, bytesIn,
+                                   0, true);
+
     /* Bad stuff (de-)serializing message, but we have an
      * RPC error message we can send back to the client */
     rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
@@ -548,6 +689,50 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
+/*
+ * Like virNetServerProgramSendStreamData, but rather than copying
+ * @data into the message, ownership of the buffer is passed on to
+ * @msg and *@data is set to NULL. The buffer is only kept by the
+ * caller if the header could not be encoded, or there is no payload.
+ */
+int virNetServerProgramSendStreamBuffer(virNetServerProgramPtr prog,
+                                        virNetServerClientPtr client,
+                                        virNetMessagePtr msg,
+                                        int procedure,
+                                        unsigned int serial,
+                                        char **data,
+                                        size_t len)
+{
+    char *body;
+
+    VIR_DEBUG("client=%p msg=%p data=%p len=%zu", client, msg, *data, len);
+
+    if (len == 0)
+        return virNetServerProgramSendStreamData(prog, client, msg,
+                                                 procedure, serial,
+                                                 *data, len);
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    body = *data;
+    *data = NULL;
+    if (virNetMessageEncodePayloadRef(msg, body, len, true) < 0)
+        return -1;
+
+    VIR_DEBUG("Total %zu", msg->bufferLength + msg->bodyLength);
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
 int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
                                       virNetMessagePtr msg,
@@ -583,6 +768,9 @@ int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+void virNetServerProgramDispose(void *obj)
 {
+    virNetServerProgramPtr prog = obj;
+
+    VIR_FREE(prog->stats);
 }
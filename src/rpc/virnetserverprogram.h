@@ -27,6 +27,7 @@
 # include "virnetmessage.h"
 # include "virnetserverclient.h"
 # include "virobject.h"
+# include "virutil.h"
 
 typedef struct _virNetDaemon virNetDaemon;
 typedef virNetDaemon *virNetDaemonPtr;
@@ -58,6 +59,36 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    const char *name;
+};
+
+/* Call time histogram buckets, each one covering times below
+ * 10^n microseconds, with the last one catching everything else. */
+typedef enum {
+    VIR_NET_SERVER_PROGRAM_TIME_10US = 0,
+    VIR_NET_SERVER_PROGRAM_TIME_100US,
+    VIR_NET_SERVER_PROGRAM_TIME_1MS,
+    VIR_NET_SERVER_PROGRAM_TIME_10MS,
+    VIR_NET_SERVER_PROGRAM_TIME_100MS,
+    VIR_NET_SERVER_PROGRAM_TIME_1S,
+    VIR_NET_SERVER_PROGRAM_TIME_10S,
+    VIR_NET_SERVER_PROGRAM_TIME_INF,
+
+    VIR_NET_SERVER_PROGRAM_TIME_LAST
+} virNetServerProgramTimeBucket;
+
+VIR_ENUM_DECL(virNetServerProgramTimeBucket)
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long bytesIn;
+    unsigned long long bytesOut; /* Successful replies only */
+    unsigned long long queueTime[VIR_NET_SERVER_PROGRAM_TIME_LAST];
+    unsigned long long execTime[VIR_NET_SERVER_PROGRAM_TIME_LAST];
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -71,6 +102,12 @@ int virNetServerProgramGetVersion(virNetServerProgramPtr prog);
 unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
                                             int procedure);
 
+const char *virNetServerProgramGetProcName(virNetServerProgramPtr prog,
+                                           int procedure);
+
+int virNetServerProgramGetProcStats(virNetServerProgramPtr prog,
+                                    virNetServerProgramProcStatsPtr *stats);
+
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg);
 
@@ -104,6 +141,14 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+int virNetServerProgramSendStreamBuffer(virNetServerProgramPtr prog,
+                                        virNetServerClientPtr client,
+                                        virNetMessagePtr msg,
+                                        int procedure,
+                                        unsigned int serial,
+                                        char **data,
+                                        size_t len);
+
 int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
                                       virNetMessagePtr msg,
@@ -71,6 +71,9 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Largest amount of plaintext gnutls puts into a single record */
+#define VIR_NET_SOCKET_TLS_RECORD_MAX (16 * 1024)
+
 VIR_LOG_INIT("rpc.netsocket");
 
 struct _virNetSocket {
@@ -97,6 +100,7 @@ struct _virNetSocket {
 
 #if WITH_GNUTLS
     virNetTLSSessionPtr tlsSession;
+    char *tlsRecord; /* Scratch space for coalescing vectored writes */
 #endif
 #if WITH_SASL
     virNetSASLSessionPtr saslSession;
@@ -1340,6 +1344,7 @@ void virNetSocketDispose(void *obj)
     if (sock->tlsSession)
         virNetTLSSessionSetIOCallbacks(sock->tlsSession, NULL, NULL, NULL);
     virObjectUnref(sock->tlsSession);
+    VIR_FREE(sock->tlsRecord);
 #endif
 #if WITH_SASL
     virObjectUnref(sock->saslSession);
@@ -1989,6 +1994,111 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+#if WITH_GNUTLS
+/*
+ * Each gnutls_record_send call produces at least one record, so rather
+ * than sending a short header (and any other small leading parts) in a
+ * record of its own, pack as much as fits into a single one.
+ */
+static ssize_t virNetSocketWriteVTLS(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     int iovcnt)
+{
+    size_t len = 0;
+    size_t i;
+
+    if (iov[0].iov_len >= VIR_NET_SOCKET_TLS_RECORD_MAX)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+    if (!sock->tlsRecord &&
+        VIR_ALLOC_N(sock->tlsRecord, VIR_NET_SOCKET_TLS_RECORD_MAX) < 0)
+        return -1;
+
+    for (i = 0; i < iovcnt && len < VIR_NET_SOCKET_TLS_RECORD_MAX; i++) {
+        size_t n = MIN(iov[i].iov_len, VIR_NET_SOCKET_TLS_RECORD_MAX - len);
+
+        memcpy(sock->tlsRecord + len, iov[i].iov_base, n);
+        len += n;
+    }
+
+    return virNetSocketWriteWire(sock, sock->tlsRecord, len);
+}
+#endif
+
+
+/*
+ * Writes as much of the vector @iov as the socket accepts without
+ * blocking. Plain sockets use writev() directly, while for encrypted
+ * or tunnelled transports only the leading part is written and the
+ * caller is expected to call again for the rest, as with a short write.
+ *
+ * Returns the number of bytes written, 0 on EAGAIN, -1 on error
+ */
+ssize_t virNetSocketWriteV(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt)
+{
+    ssize_t ret;
+
+    if (iovcnt == 0)
+        return 0;
+
+    virObjectLock(sock);
+#if WITH_SASL
+    if (sock->saslSession) {
+        ret = virNetSocketWriteSASL(sock, iov[0].iov_base, iov[0].iov_len);
+        goto cleanup;
+    }
+#endif
+#if WITH_SSH2
+    if (sock->sshSession) {
+        ret = virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+        goto cleanup;
+    }
+#endif
+#if WITH_LIBSSH
+    if (sock->libsshSession) {
+        ret = virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+        goto cleanup;
+    }
+#endif
+#if WITH_GNUTLS
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE) {
+        ret = virNetSocketWriteVTLS(sock, iov, iovcnt);
+        goto cleanup;
+    }
+#endif
+
+ rewrite:
+    ret = writev(sock->fd, iov, iovcnt);
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN) {
+            ret = 0;
+            goto cleanup;
+        }
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        ret = -1;
+        goto cleanup;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        ret = -1;
+    }
+
+ cleanup:
+    virObjectUnlock(sock);
+    return ret;
+}
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
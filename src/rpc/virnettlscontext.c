@@ -40,10 +40,26 @@
 #include "virlog.h"
 #include "virprobe.h"
 #include "virthread.h"
+#include "virhash.h"
+#include "virtime.h"
 #include "configmake.h"
 
 #define DH_BITS 2048
 
+/* Maximum number of client sessions remembered for resumption */
+#define VIR_NET_TLS_SESSION_CACHE_MAX 64
+
+/* How long a server ticket key is used before a new one is generated,
+ * in milliseconds. Tickets encrypted with the previous key are then
+ * refused and the client falls back to a full handshake, so this also
+ * bounds how long a stolen ticket key remains useful. */
+#define VIR_NET_TLS_TICKET_KEY_LIFETIME (60 * 60 * 1000ull)
+
+#if defined(HAVE_GNUTLS_SESSION_TICKET_KEY_GENERATE) && \
+    defined(HAVE_GNUTLS_SESSION_TICKET_ENABLE_SERVER)
+# define VIR_NET_TLS_SESSION_TICKETS 1
+#endif
+
 #define LIBVIRT_PKI_DIR SYSCONFDIR "/pki"
 #define LIBVIRT_CACERT LIBVIRT_PKI_DIR "/CA/cacert.pem"
 #define LIBVIRT_CACRL LIBVIRT_PKI_DIR "/CA/cacrl.pem"
@@ -66,6 +82,12 @@ struct _virNetTLSContext {
     bool requireValidCert;
     const char *const*x509dnWhitelist;
     char *priority;
+
+    /* Server side key for encrypting session tickets */
+    gnutls_datum_t ticketKey;
+    unsigned long long ticketKeyTime;
+    /* Client side credentials the resumable sessions are bound to */
+    char *cacheKey;
 };
 
 struct _virNetTLSSession {
@@ -75,6 +97,8 @@ struct _virNetTLSSession {
 
     bool isServer;
     char *hostname;
+    char *cacheKey;
+    bool cacheSaved;
     gnutls_session_t session;
     virNetTLSSessionWriteFunc writeFunc;
     virNetTLSSessionReadFunc readFunc;
@@ -87,6 +111,25 @@ static virClassPtr virNetTLSSessionClass;
 static void virNetTLSContextDispose(void *obj);
 static void virNetTLSSessionDispose(void *obj);
 
+/*
+ * Client sessions which can be resumed by later connections to the
+ * same host with the same credentials, saving the server most of the
+ * cost of a full handshake
+ */
+static virHashTablePtr virNetTLSSessionCache;
+static virMutex virNetTLSSessionCacheLock = VIR_MUTEX_INITIALIZER;
+
+
+static void
+virNetTLSSessionCacheDataFree(void *payload,
+                              const void *name ATTRIBUTE_UNUSED)
+{
+    gnutls_datum_t *data = payload;
+
+    gnutls_free(data->data);
+    VIR_FREE(data);
+}
+
 
 static int virNetTLSContextOnceInit(void)
 {
@@ -102,6 +145,10 @@ static int virNetTLSContextOnceInit(void)
                                               virNetTLSSessionDispose)))
         return -1;
 
+    if (!(virNetTLSSessionCache = virHashCreate(VIR_NET_TLS_SESSION_CACHE_MAX,
+                                                virNetTLSSessionCacheDataFree)))
+        return -1;
+
     return 0;
 }
 
@@ -692,6 +739,59 @@ static int virNetTLSContextLoadCredentials(virNetTLSContextPtr ctxt,
 }
 
 
+static void
+virNetTLSContextFreeTicketKey(virNetTLSContextPtr ctxt)
+{
+    if (ctxt->ticketKey.data) {
+        memset(ctxt->ticketKey.data, 0, ctxt->ticketKey.size);
+        gnutls_free(ctxt->ticketKey.data);
+    }
+    ctxt->ticketKey.data = NULL;
+    ctxt->ticketKey.size = 0;
+}
+
+
+/*
+ * Generate the server key for encrypting session tickets, replacing the
+ * current one once it is older than VIR_NET_TLS_TICKET_KEY_LIFETIME.
+ * Sessions get their own copy of the key, so those already set up are
+ * not affected.
+ */
+static int
+virNetTLSContextRotateTicketKey(virNetTLSContextPtr ctxt)
+{
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+    gnutls_datum_t key = { NULL, 0 };
+    unsigned long long now;
+    int err;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (ctxt->ticketKey.data &&
+        now - ctxt->ticketKeyTime < VIR_NET_TLS_TICKET_KEY_LIFETIME)
+        return 0;
+
+    if ((err = gnutls_session_ticket_key_generate(&key)) < 0) {
+        virReportError(VIR_ERR_SYSTEM_ERROR,
+                       _("Unable to generate TLS session ticket key: %s"),
+                       gnutls_strerror(err));
+        return -1;
+    }
+
+    VIR_DEBUG("ctxt=%p %s TLS session ticket key", ctxt,
+              ctxt->ticketKey.data ? "rotating" : "generated");
+
+    virNetTLSContextFreeTicketKey(ctxt);
+    ctxt->ticketKey = key;
+    ctxt->ticketKeyTime = now;
+#else
+    VIR_DEBUG("ctxt=%p TLS session tickets not supported by gnutls", ctxt);
+#endif
+    return 0;
+}
+
+
 static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
                                                const char *cacrl,
                                                const char *cert,
@@ -752,6 +852,12 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
 
         gnutls_certificate_set_dh_params(ctxt->x509cred,
                                          ctxt->dhParams);
+
+        if (virNetTLSContextRotateTicketKey(ctxt) < 0)
+            goto error;
+    } else {
+        if (virAsprintf(&ctxt->cacheKey, "%s|%s", cacert, NULLSTR(cert)) < 0)
+            goto error;
     }
 
     ctxt->requireValidCert = requireValidCert;
@@ -767,6 +873,8 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
  error:
     if (isServer)
         gnutls_dh_params_deinit(ctxt->dhParams);
+    virNetTLSContextFreeTicketKey(ctxt);
+    VIR_FREE(ctxt->cacheKey);
     gnutls_certificate_free_credentials(ctxt->x509cred);
     VIR_FREE(ctxt);
     return NULL;
@@ -1149,6 +1257,8 @@ void virNetTLSContextDispose(void *obj)
           "ctxt=%p", ctxt);
 
     VIR_FREE(ctxt->priority);
+    VIR_FREE(ctxt->cacheKey);
+    virNetTLSContextFreeTicketKey(ctxt);
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
 }
@@ -1182,8 +1292,120 @@ virNetTLSSessionPull(void *opaque, void *buf, size_t len)
 }
 
 
+/*
+ * Offer the server to resume a session we previously had with it. If
+ * the server declines, the handshake silently falls back to a full one.
+ */
+static void
+virNetTLSSessionCacheRestore(virNetTLSSessionPtr sess)
+{
+    gnutls_datum_t *data;
+    int err;
+
+    virMutexLock(&virNetTLSSessionCacheLock);
+    if ((data = virHashLookup(virNetTLSSessionCache, sess->cacheKey))) {
+        VIR_DEBUG("Trying to resume TLS session for %s", sess->cacheKey);
+        if ((err = gnutls_session_set_data(sess->session,
+                                           data->data, data->size)) != 0) {
+            VIR_DEBUG("Cannot resume TLS session: %s", gnutls_strerror(err));
+            virHashRemoveEntry(virNetTLSSessionCache, sess->cacheKey);
+        }
+    }
+    virMutexUnlock(&virNetTLSSessionCacheLock);
+}
+
+
+static int
+virNetTLSSessionGetData(gnutls_session_t session,
+                        gnutls_datum_t *data)
+{
+#ifdef HAVE_GNUTLS_SESSION_GET_DATA2
+    return gnutls_session_get_data2(session, data);
+#else
+    size_t size = 0;
+    int err;
+
+    if ((err = gnutls_session_get_data(session, NULL, &size)) != 0)
+        return err;
+
+    if (!(data->data = gnutls_malloc(size)))
+        return GNUTLS_E_MEMORY_ERROR;
+
+    if ((err = gnutls_session_get_data(session, data->data, &size)) != 0) {
+        gnutls_free(data->data);
+        data->data = NULL;
+        return err;
+    }
+
+    data->size = size;
+    return 0;
+#endif
+}
+
+
+/*
+ * Remember the session so that later connections can resume it. With
+ * TLS 1.3 the ticket is only sent once the handshake completed, so
+ * this is retried as data is read until it has arrived.
+ */
+static void
+virNetTLSSessionCacheSave(virNetTLSSessionPtr sess)
+{
+    gnutls_datum_t *data = NULL;
+    int err;
+
+    if (!sess->cacheKey || sess->cacheSaved)
+        return;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+    if (gnutls_protocol_get_version(sess->session) == GNUTLS_TLS1_3 &&
+        !(gnutls_session_get_flags(sess->session) & GNUTLS_SFLAGS_SESSION_TICKET))
+        return;
+#endif
+
+    sess->cacheSaved = true;
+
+    if (VIR_ALLOC(data) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    if ((err = virNetTLSSessionGetData(sess->session, data)) != 0) {
+        VIR_DEBUG("Cannot save TLS session: %s", gnutls_strerror(err));
+        VIR_FREE(data);
+        return;
+    }
+
+    virMutexLock(&virNetTLSSessionCacheLock);
+    if (virHashSize(virNetTLSSessionCache) >= VIR_NET_TLS_SESSION_CACHE_MAX &&
+        !virHashLookup(virNetTLSSessionCache, sess->cacheKey))
+        virHashRemoveAll(virNetTLSSessionCache);
+    if (virHashUpdateEntry(virNetTLSSessionCache, sess->cacheKey, data) < 0) {
+        virResetLastError();
+        virNetTLSSessionCacheDataFree(data, NULL);
+    }
+    virMutexUnlock(&virNetTLSSessionCacheLock);
+}
+
+
+/*
+ * Forget a session which the server no longer accepts.
+ */
+static void
+virNetTLSSessionCacheForget(virNetTLSSessionPtr sess)
+{
+    if (!sess->cacheKey)
+        return;
+
+    virMutexLock(&virNetTLSSessionCacheLock);
+    virHashRemoveEntry(virNetTLSSessionCache, sess->cacheKey);
+    virMutexUnlock(&virNetTLSSessionCacheLock);
+}
+
+
 virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
-                                        const char *hostname)
+                                        const char *hostname,
+                                        const char *peer)
 {
     virNetTLSSessionPtr sess;
     int err;
@@ -1235,6 +1457,32 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_certificate_server_set_request(sess->session, GNUTLS_CERT_REQUEST);
 
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
+
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+        virObjectLock(ctxt);
+        if (virNetTLSContextRotateTicketKey(ctxt) < 0) {
+            virObjectUnlock(ctxt);
+            goto error;
+        }
+        err = gnutls_session_ticket_enable_server(sess->session,
+                                                  &ctxt->ticketKey);
+        virObjectUnlock(ctxt);
+
+        if (err != 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Failed to enable TLS session tickets: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+    } else if (hostname) {
+        /* Servers on different ports of one host are different servers
+         * which must not be offered each other's tickets */
+        if (virAsprintf(&sess->cacheKey, "%s|%s|%s",
+                        ctxt->cacheKey, hostname, NULLSTR(peer)) < 0)
+            goto error;
+
+        virNetTLSSessionCacheRestore(sess);
     }
 
     gnutls_transport_set_ptr(sess->session, sess);
@@ -1311,8 +1559,10 @@ ssize_t virNetTLSSessionRead(virNetTLSSessionPtr sess,
     virObjectLock(sess);
     ret = gnutls_record_recv(sess->session, buf, len);
 
-    if (ret >= 0)
+    if (ret >= 0) {
+        virNetTLSSessionCacheSave(sess);
         goto cleanup;
+    }
 
     switch (ret) {
     case GNUTLS_E_AGAIN:
@@ -1342,7 +1592,9 @@ int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
     VIR_DEBUG("Ret=%d", ret);
     if (ret == 0) {
         sess->handshakeComplete = true;
-        VIR_DEBUG("Handshake is complete");
+        VIR_DEBUG("Handshake is complete resumed=%d",
+                  gnutls_session_is_resumed(sess->session));
+        virNetTLSSessionCacheSave(sess);
         goto cleanup;
     }
     if (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN) {
@@ -1355,6 +1607,8 @@ int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
           virNetServerClientGetFD(client));
 #endif
 
+    virNetTLSSessionCacheForget(sess);
+
     virReportError(VIR_ERR_AUTH_FAILED,
                    _("TLS handshake failed %s"),
                    gnutls_strerror(ret));
@@ -1420,6 +1674,7 @@ void virNetTLSSessionDispose(void *obj)
 
     VIR_FREE(sess->x509dname);
     VIR_FREE(sess->hostname);
+    VIR_FREE(sess->cacheKey);
     gnutls_deinit(sess->session);
 }
 
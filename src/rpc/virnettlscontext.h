@@ -72,8 +72,13 @@ typedef ssize_t (*virNetTLSSessionWriteFunc)(const char *buf, size_t len,
 typedef ssize_t (*virNetTLSSessionReadFunc)(char *buf, size_t len,
                                             void *opaque);
 
+/*
+ * @peer identifies the server endpoint of a client session, e.g. its
+ * address and port, and may be NULL
+ */
 virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
-                                        const char *hostname);
+                                        const char *hostname,
+                                        const char *peer);
 
 void virNetTLSSessionSetIOCallbacks(virNetTLSSessionPtr sess,
                                     virNetTLSSessionWriteFunc writeFunc,
@@ -29,6 +29,7 @@
 #endif
 
 #include "security_dac.h"
+#include "security_util.h"
 #include "virerror.h"
 #include "virfile.h"
 #include "viralloc.h"
@@ -58,6 +59,7 @@ struct _virSecurityDACData {
     int ngroups;
     bool dynamicOwnership;
     bool mountNamespace;
+    bool rememberOwner;
     char *baselabel;
     virSecurityManagerDACChownCallback chownCallback;
 };
@@ -100,6 +102,17 @@ virSecurityDACChownListAppend(virSecurityDACChownListPtr list,
     int ret = -1;
     char *tmp = NULL;
     virSecurityDACChownItemPtr item = NULL;
+    size_t i;
+
+    /* Disks sharing a backing image would chown it once for each of
+     * them otherwise. */
+    for (i = 0; path && i < list->nItems; i++) {
+        if (STREQ_NULLABLE(list->items[i]->path, path) &&
+            list->items[i]->src == src &&
+            list->items[i]->uid == uid &&
+            list->items[i]->gid == gid)
+            return 0;
+    }
 
     if (VIR_ALLOC(item) < 0)
         return -1;
@@ -238,6 +251,14 @@ virSecurityDACSetDynamicOwnership(virSecurityManagerPtr mgr,
     priv->dynamicOwnership = dynamicOwnership;
 }
 
+void
+virSecurityDACSetRememberOwner(virSecurityManagerPtr mgr,
+                               bool rememberOwner)
+{
+    virSecurityDACDataPtr priv = virSecurityManagerGetPrivateData(mgr);
+    priv->rememberOwner = rememberOwner;
+}
+
 void
 virSecurityDACSetMountNamespace(virSecurityManagerPtr mgr,
                                 bool mountNamespace)
@@ -345,17 +366,37 @@ virSecurityDACGetImageIds(virSecurityLabelDefPtr seclabel,
  * @uid: user owning the @path
  * @gid: group owning the @path
  *
- * Remember the owner of @path (represented by @uid:@gid).
+ * Remember the owner of @path (represented by @uid:@gid). If
+ * @path is already in use by another domain, only the number of
+ * its users is increased and the originally recorded owner is
+ * kept.
  *
  * Returns: 0 on success, -1 on failure
  */
 static int
-virSecurityDACRememberLabel(virSecurityDACDataPtr priv ATTRIBUTE_UNUSED,
-                            const char *path ATTRIBUTE_UNUSED,
-                            uid_t uid ATTRIBUTE_UNUSED,
-                            gid_t gid ATTRIBUTE_UNUSED)
+virSecurityDACRememberLabel(virSecurityDACDataPtr priv,
+                            const char *path,
+                            uid_t uid,
+                            gid_t gid)
 {
-    return 0;
+    char *label = NULL;
+    int ret = -1;
+
+    if (!priv->rememberOwner)
+        return 0;
+
+    if (virAsprintf(&label, "+%u:+%u",
+                    (unsigned int) uid,
+                    (unsigned int) gid) < 0)
+        goto cleanup;
+
+    if (virSecuritySetRememberedLabel(SECURITY_DAC_NAME, path, label) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(label);
+    return ret;
 }
 
 /**
@@ -374,12 +415,41 @@ virSecurityDACRememberLabel(virSecurityDACDataPtr priv ATTRIBUTE_UNUSED,
  *         -1 on failure (@uid and @gid not touched)
  */
 static int
-virSecurityDACRecallLabel(virSecurityDACDataPtr priv ATTRIBUTE_UNUSED,
-                          const char *path ATTRIBUTE_UNUSED,
-                          uid_t *uid ATTRIBUTE_UNUSED,
-                          gid_t *gid ATTRIBUTE_UNUSED)
+virSecurityDACRecallLabel(virSecurityDACDataPtr priv,
+                          const char *path,
+                          uid_t *uid,
+                          gid_t *gid)
 {
-    return 0;
+    char *label = NULL;
+    uid_t tmpuid;
+    gid_t tmpgid;
+    int rv;
+    int ret = -1;
+
+    if (!priv->rememberOwner)
+        return 0;
+
+    if ((rv = virSecurityGetRememberedLabel(SECURITY_DAC_NAME,
+                                            path, &label)) != 0) {
+        ret = rv;
+        goto cleanup;
+    }
+
+    /* Nothing remembered, restore the default owner */
+    if (!label) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virParseOwnershipIds(label, &tmpuid, &tmpgid) < 0)
+        goto cleanup;
+
+    *uid = tmpuid;
+    *gid = tmpgid;
+    ret = 0;
+ cleanup:
+    VIR_FREE(label);
+    return ret;
 }
 
 static virSecurityDriverStatus
@@ -480,48 +550,77 @@ virSecurityDACTransactionStart(virSecurityManagerPtr mgr)
 }
 
 /**
- * virSecurityDACTransactionCommit:
+ * virSecurityDACTransactionDetach:
  * @mgr: security manager
- * @pid: domain's PID
+ * @cb: filled with the callback performing the chown()-s
+ * @opaque: filled with the transaction list
+ * @freecb: filled with the function freeing the list
  *
- * Enters the @pid namespace (usually @pid refers to a domain) and
- * performs all the chown()-s on the list. Note that the transaction is
- * also freed, therefore new one has to be started after successful
- * return from this function. Also it is considered as error if there's
- * no transaction set and this function is called.
+ * Takes the transaction away from the calling thread so that the
+ * caller can perform all the chown()-s on the list in a namespace it
+ * has entered for other transactions too. It is considered as error
+ * if there's no transaction set and this function is called.
  *
  * Returns: 0 on success,
  *         -1 otherwise.
  */
 static int
-virSecurityDACTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
-                                pid_t pid)
+virSecurityDACTransactionDetach(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
+                                virProcessNamespaceCallback *cb,
+                                void **opaque,
+                                virFreeCallback *freecb)
 {
     virSecurityDACChownListPtr list;
-    int ret = -1;
 
     list = virThreadLocalGet(&chownList);
     if (!list) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("No transaction is set"));
-        goto cleanup;
+        return -1;
     }
 
     if (virThreadLocalSet(&chownList, NULL) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to clear thread local variable"));
-        goto cleanup;
+        virSecurityDACChownListFree(list);
+        return -1;
     }
 
-    if (virProcessRunInMountNamespace(pid,
-                                      virSecurityDACTransactionRun,
-                                      list) < 0)
-        goto cleanup;
+    *cb = virSecurityDACTransactionRun;
+    *opaque = list;
+    *freecb = virSecurityDACChownListFree;
+    return 0;
+}
 
-    ret = 0;
- cleanup:
-    virSecurityDACChownListFree(list);
-    return ret;
+/**
+ * virSecurityDACTransactionCommit:
+ * @mgr: security manager
+ * @pid: domain's PID
+ *
+ * Enters the @pid namespace (usually @pid refers to a domain) and
+ * performs all the chown()-s on the list. Note that the transaction is
+ * also freed, therefore new one has to be started after successful
+ * return from this function. Also it is considered as error if there's
+ * no transaction set and this function is called.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise.
+ */
+static int
+virSecurityDACTransactionCommit(virSecurityManagerPtr mgr,
+                                pid_t pid)
+{
+    virProcessNamespaceCallback cb;
+    virFreeCallback freecb;
+    void *list;
+    int ret;
+
+    if (virSecurityDACTransactionDetach(mgr, &cb, &list, &freecb) < 0)
+        return -1;
+
+    ret = virProcessRunInMountNamespace(pid, cb, list);
+    freecb(list);
+    return ret < 0 ? -1 : 0;
 }
 
 /**
@@ -2111,6 +2210,7 @@ virSecurityDriver virSecurityDriverDAC = {
     .transactionStart                   = virSecurityDACTransactionStart,
     .transactionCommit                  = virSecurityDACTransactionCommit,
     .transactionAbort                   = virSecurityDACTransactionAbort,
+    .transactionDetach                  = virSecurityDACTransactionDetach,
 
     .domainSecurityVerify               = virSecurityDACVerify,
 
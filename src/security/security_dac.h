@@ -32,6 +32,9 @@ int virSecurityDACSetUserAndGroup(virSecurityManagerPtr mgr,
 void virSecurityDACSetDynamicOwnership(virSecurityManagerPtr mgr,
                                        bool dynamic);
 
+void virSecurityDACSetRememberOwner(virSecurityManagerPtr mgr,
+                                    bool rememberOwner);
+
 void virSecurityDACSetMountNamespace(virSecurityManagerPtr mgr,
                                      bool mountNamespace);
 
@@ -55,6 +55,10 @@ typedef int (*virSecurityDriverTransactionStart) (virSecurityManagerPtr mgr);
 typedef int (*virSecurityDriverTransactionCommit) (virSecurityManagerPtr mgr,
                                                    pid_t pid);
 typedef void (*virSecurityDriverTransactionAbort) (virSecurityManagerPtr mgr);
+typedef int (*virSecurityDriverTransactionDetach) (virSecurityManagerPtr mgr,
+                                                   virProcessNamespaceCallback *cb,
+                                                   void **opaque,
+                                                   virFreeCallback *freecb);
 
 typedef int (*virSecurityDomainRestoreDiskLabel) (virSecurityManagerPtr mgr,
                                                   virDomainDefPtr def,
@@ -151,6 +155,7 @@ struct _virSecurityDriver {
     virSecurityDriverTransactionStart transactionStart;
     virSecurityDriverTransactionCommit transactionCommit;
     virSecurityDriverTransactionAbort transactionAbort;
+    virSecurityDriverTransactionDetach transactionDetach;
 
     virSecurityDomainSecurityVerify domainSecurityVerify;
 
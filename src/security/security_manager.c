@@ -147,7 +147,8 @@ virSecurityManagerNewDAC(const char *virtDriver,
 
     virCheckFlags(VIR_SECURITY_MANAGER_NEW_MASK |
                   VIR_SECURITY_MANAGER_DYNAMIC_OWNERSHIP |
-                  VIR_SECURITY_MANAGER_MOUNT_NAMESPACE, NULL);
+                  VIR_SECURITY_MANAGER_MOUNT_NAMESPACE |
+                  VIR_SECURITY_MANAGER_REMEMBER_OWNER, NULL);
 
     mgr = virSecurityManagerNewDriver(&virSecurityDriverDAC,
                                       virtDriver,
@@ -163,6 +164,7 @@ virSecurityManagerNewDAC(const char *virtDriver,
 
     virSecurityDACSetDynamicOwnership(mgr, flags & VIR_SECURITY_MANAGER_DYNAMIC_OWNERSHIP);
     virSecurityDACSetMountNamespace(mgr, flags & VIR_SECURITY_MANAGER_MOUNT_NAMESPACE);
+    virSecurityDACSetRememberOwner(mgr, flags & VIR_SECURITY_MANAGER_REMEMBER_OWNER);
     virSecurityDACSetChownCallback(mgr, chownCallback);
 
     return mgr;
@@ -289,6 +291,43 @@ virSecurityManagerTransactionCommit(virSecurityManagerPtr mgr,
 }
 
 
+/**
+ * virSecurityManagerTransactionDetach:
+ * @mgr: security manager
+ * @cb: filled with the callback applying the transaction
+ * @opaque: filled with the transaction data for @cb
+ * @freecb: filled with the function freeing @opaque
+ *
+ * Takes the outstanding transaction away from the calling thread
+ * without applying it. The caller then runs @cb in the domain's mount
+ * namespace itself, so that several transactions can share a single
+ * namespace entry, and frees @opaque with @freecb afterwards. This is
+ * optional for drivers; if the driver does not support it, the caller
+ * has to use virSecurityManagerTransactionCommit() instead.
+ *
+ * Returns: 1 if the transaction was detached,
+ *          0 if the driver does not support detaching,
+ *         -1 otherwise.
+ */
+int
+virSecurityManagerTransactionDetach(virSecurityManagerPtr mgr,
+                                    virProcessNamespaceCallback *cb,
+                                    void **opaque,
+                                    virFreeCallback *freecb)
+{
+    int ret = 0;
+
+    virObjectLock(mgr);
+    if (mgr->drv->transactionDetach) {
+        ret = mgr->drv->transactionDetach(mgr, cb, opaque, freecb);
+        if (ret == 0)
+            ret = 1;
+    }
+    virObjectUnlock(mgr);
+    return ret;
+}
+
+
 /**
  * virSecurityManagerTransactionAbort:
  * @mgr: security manager
@@ -26,6 +26,7 @@
 # include "domain_conf.h"
 # include "vircommand.h"
 # include "virstoragefile.h"
+# include "virprocess.h"
 
 typedef struct _virSecurityManager virSecurityManager;
 typedef virSecurityManager *virSecurityManagerPtr;
@@ -37,6 +38,7 @@ typedef enum {
     VIR_SECURITY_MANAGER_PRIVILEGED         = 1 << 3,
     VIR_SECURITY_MANAGER_DYNAMIC_OWNERSHIP  = 1 << 4,
     VIR_SECURITY_MANAGER_MOUNT_NAMESPACE    = 1 << 5,
+    VIR_SECURITY_MANAGER_REMEMBER_OWNER     = 1 << 6,
 } virSecurityManagerNewFlags;
 
 # define VIR_SECURITY_MANAGER_NEW_MASK \
@@ -80,6 +82,10 @@ void virSecurityManagerPostFork(virSecurityManagerPtr mgr);
 int virSecurityManagerTransactionStart(virSecurityManagerPtr mgr);
 int virSecurityManagerTransactionCommit(virSecurityManagerPtr mgr,
                                         pid_t pid);
+int virSecurityManagerTransactionDetach(virSecurityManagerPtr mgr,
+                                        virProcessNamespaceCallback *cb,
+                                        void **opaque,
+                                        virFreeCallback *freecb);
 void virSecurityManagerTransactionAbort(virSecurityManagerPtr mgr);
 
 void *virSecurityManagerGetPrivateData(virSecurityManagerPtr mgr);
@@ -126,6 +126,14 @@ virSecuritySELinuxContextListAppend(virSecuritySELinuxContextListPtr list,
 {
     int ret = -1;
     virSecuritySELinuxContextItemPtr item = NULL;
+    size_t i;
+
+    for (i = 0; i < list->nItems; i++) {
+        if (STREQ(list->items[i]->path, path) &&
+            STREQ(list->items[i]->tcon, tcon) &&
+            list->items[i]->optional == optional)
+            return 0;
+    }
 
     if (VIR_ALLOC(item) < 0)
         return -1;
@@ -1036,25 +1044,31 @@ virSecuritySELinuxTransactionStart(virSecurityManagerPtr mgr)
 }
 
 /**
- * virSecuritySELinuxTransactionCommit:
+ * virSecuritySELinuxTransactionDetach:
  * @mgr: security manager
- * @pid: domain's PID
+ * @cb: filled with the callback performing the setfilecon()-s
+ * @opaque: filled with the transaction list
+ * @freecb: filled with the function freeing the list
  *
- * Enters the @pid namespace (usually @pid refers to a domain) and
- * performs all the sefilecon()-s on the list. Note that the
- * transaction is also freed, therefore new one has to be started after
- * successful return from this function. Also it is considered as error
- * if there's no transaction set and this function is called.
+ * Takes the transaction away from the calling thread so that the
+ * caller can perform all the setfilecon()-s on the list in a namespace
+ * it has entered for other transactions too. If there's no transaction
+ * set, @cb is set to NULL and there is nothing to run.
  *
  * Returns: 0 on success,
  *         -1 otherwise.
  */
 static int
-virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
-                                    pid_t pid)
+virSecuritySELinuxTransactionDetach(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
+                                    virProcessNamespaceCallback *cb,
+                                    void **opaque,
+                                    virFreeCallback *freecb)
 {
     virSecuritySELinuxContextListPtr list;
-    int ret = 0;
+
+    *cb = NULL;
+    *opaque = NULL;
+    *freecb = NULL;
 
     list = virThreadLocalGet(&contextList);
     if (!list)
@@ -1063,18 +1077,47 @@ virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
     if (virThreadLocalSet(&contextList, NULL) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to clear thread local variable"));
-        goto cleanup;
+        virSecuritySELinuxContextListFree(list);
+        return -1;
     }
 
-    if (virProcessRunInMountNamespace(pid,
-                                      virSecuritySELinuxTransactionRun,
-                                      list) < 0)
-        goto cleanup;
+    *cb = virSecuritySELinuxTransactionRun;
+    *opaque = list;
+    *freecb = virSecuritySELinuxContextListFree;
+    return 0;
+}
 
-    ret = 0;
- cleanup:
-    virSecuritySELinuxContextListFree(list);
-    return ret;
+/**
+ * virSecuritySELinuxTransactionCommit:
+ * @mgr: security manager
+ * @pid: domain's PID
+ *
+ * Enters the @pid namespace (usually @pid refers to a domain) and
+ * performs all the sefilecon()-s on the list. Note that the
+ * transaction is also freed, therefore new one has to be started after
+ * successful return from this function.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise.
+ */
+static int
+virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr,
+                                    pid_t pid)
+{
+    virProcessNamespaceCallback cb;
+    virFreeCallback freecb;
+    void *list;
+    int ret;
+
+    if (virSecuritySELinuxTransactionDetach(mgr, &cb, &list, &freecb) < 0)
+        return -1;
+
+    if (!cb)
+        return 0;
+
+    ret = virProcessRunInMountNamespace(pid, cb, list);
+    freecb(list);
+    return ret < 0 ? -1 : 0;
 }
 
 /**
@@ -1153,6 +1196,15 @@ virSecuritySELinuxSetFileconHelper(const char *path, const char *tcon,
     else if (rc > 0)
         return 0;
 
+    /* Skip paths which already carry the label, e.g. images shared
+     * by several disks or left over from a previous start. */
+    if (getfilecon_raw(path, &econ) >= 0) {
+        rc = STREQ(tcon, econ);
+        freecon(econ);
+        if (rc)
+            return 0;
+    }
+
     VIR_INFO("Setting SELinux context on '%s' to '%s'", path, tcon);
 
     if (setfilecon_raw(path, (VIR_SELINUX_CTX_CONST char *) tcon) < 0) {
@@ -3052,6 +3104,7 @@ virSecurityDriver virSecurityDriverSELinux = {
     .transactionStart                   = virSecuritySELinuxTransactionStart,
     .transactionCommit                  = virSecuritySELinuxTransactionCommit,
     .transactionAbort                   = virSecuritySELinuxTransactionAbort,
+    .transactionDetach                  = virSecuritySELinuxTransactionDetach,
 
     .domainSecurityVerify               = virSecuritySELinuxVerify,
 
@@ -41,6 +41,23 @@ struct _virSecurityStackData {
     virSecurityStackItemPtr itemsHead;
 };
 
+typedef struct _virSecurityStackTransaction virSecurityStackTransaction;
+typedef virSecurityStackTransaction *virSecurityStackTransactionPtr;
+
+struct _virSecurityStackTransaction {
+    virProcessNamespaceCallback cb;
+    void *opaque;
+    virFreeCallback freecb;
+};
+
+typedef struct _virSecurityStackTransactionList virSecurityStackTransactionList;
+typedef virSecurityStackTransactionList *virSecurityStackTransactionListPtr;
+
+struct _virSecurityStackTransactionList {
+    virSecurityStackTransactionPtr items;
+    size_t nitems;
+};
+
 int
 virSecurityStackAddNested(virSecurityManagerPtr mgr,
                           virSecurityManagerPtr nested)
@@ -154,19 +171,68 @@ virSecurityStackTransactionStart(virSecurityManagerPtr mgr)
 }
 
 
+/* Runs in the domain's mount namespace and applies the transactions
+ * of all nested drivers. Like with separate commits, a failing driver
+ * does not stop the others. */
+static int
+virSecurityStackTransactionRun(pid_t pid,
+                               void *opaque)
+{
+    virSecurityStackTransactionListPtr list = opaque;
+    size_t i;
+    int rc = 0;
+
+    for (i = 0; i < list->nitems; i++) {
+        if (list->items[i].cb(pid, list->items[i].opaque) < 0)
+            rc = -1;
+    }
+
+    return rc;
+}
+
+
+/* Nested drivers which can hand over their transaction get it applied
+ * from a single child process, so that the domain's mount namespace is
+ * entered once per commit rather than once per driver. */
 static int
 virSecurityStackTransactionCommit(virSecurityManagerPtr mgr,
                                   pid_t pid)
 {
     virSecurityStackDataPtr priv = virSecurityManagerGetPrivateData(mgr);
     virSecurityStackItemPtr item = priv->itemsHead;
+    virSecurityStackTransactionList list = { NULL, 0 };
+    size_t i;
     int rc = 0;
 
     for (; item; item = item->next) {
-        if (virSecurityManagerTransactionCommit(item->securityManager, pid) < 0)
+        virSecurityStackTransaction txn = { NULL, NULL, NULL };
+        int rv;
+
+        rv = virSecurityManagerTransactionDetach(item->securityManager,
+                                                 &txn.cb, &txn.opaque,
+                                                 &txn.freecb);
+        if (rv < 0) {
+            rc = -1;
+        } else if (rv == 0) {
+            if (virSecurityManagerTransactionCommit(item->securityManager,
+                                                    pid) < 0)
+                rc = -1;
+        } else if (txn.cb &&
+                   VIR_APPEND_ELEMENT(list.items, list.nitems, txn) < 0) {
+            txn.freecb(txn.opaque);
             rc = -1;
+        }
     }
 
+    if (list.nitems &&
+        virProcessRunInMountNamespace(pid, virSecurityStackTransactionRun,
+                                      &list) < 0)
+        rc = -1;
+
+    for (i = 0; i < list.nitems; i++)
+        list.items[i].freecb(list.items[i].opaque);
+    VIR_FREE(list.items);
+
     return rc;
 }
 
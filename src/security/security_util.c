@@ -0,0 +1,374 @@
+/*
+ * security_util.c: Helper functions for the security drivers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+
+#include "security_util.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_SECURITY
+
+VIR_LOG_INIT("security.security_util");
+
+/* The original label of a file is stored in an XATTR together with
+ * the number of domains using the file, so that it survives daemon
+ * restarts. Since reading XATTRs back for every disk of every domain
+ * is costly, the daemon also keeps them in a hash table keyed by the
+ * inode of the file. All changes to the XATTRs go through this table
+ * while holding the lock, so concurrent domains sharing an image
+ * (e.g. a read-only base image) agree on who is the first and the
+ * last user. */
+#ifdef __linux__
+# define XATTR_NAMESPACE "trusted"
+#else
+# define XATTR_NAMESPACE "system"
+#endif
+
+typedef struct _virSecurityRememberedLabel virSecurityRememberedLabel;
+typedef virSecurityRememberedLabel *virSecurityRememberedLabelPtr;
+struct _virSecurityRememberedLabel {
+    unsigned int refcount;
+    char *label;
+};
+
+static virMutex rememberedLock;
+static virHashTablePtr remembered;
+
+
+static void
+virSecurityRememberedLabelFree(void *payload,
+                               const void *name ATTRIBUTE_UNUSED)
+{
+    virSecurityRememberedLabelPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->label);
+    VIR_FREE(entry);
+}
+
+
+static int
+virSecurityUtilOnceInit(void)
+{
+    if (virMutexInit(&rememberedLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(remembered = virHashCreate(32, virSecurityRememberedLabelFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virSecurityUtil)
+
+
+static char *
+virSecurityGetAttrName(const char *name)
+{
+    char *ret;
+    ignore_value(virAsprintf(&ret, XATTR_NAMESPACE".libvirt.security.%s", name));
+    return ret;
+}
+
+
+static char *
+virSecurityGetRefCountAttrName(const char *name)
+{
+    char *ret;
+    ignore_value(virAsprintf(&ret, XATTR_NAMESPACE".libvirt.security.ref_%s", name));
+    return ret;
+}
+
+
+/* Whether @err means that @path can't carry our XATTRs at all, e.g.
+ * because of the filesystem or an unprivileged daemon, in which case
+ * labels are simply not remembered. */
+static bool
+virSecurityXAttrUnsupported(int err)
+{
+    return err == ENOSYS || err == ENOTSUP || err == EOPNOTSUPP ||
+        err == EPERM || err == EACCES || err == EROFS;
+}
+
+
+static char *
+virSecurityRememberedLabelKey(const char *name,
+                              const char *path)
+{
+    struct stat sb;
+    char *ret;
+
+    if (stat(path, &sb) < 0) {
+        virReportSystemError(errno, _("unable to stat: %s"), path);
+        return NULL;
+    }
+
+    ignore_value(virAsprintf(&ret, "%s:%llu:%llu", name,
+                             (unsigned long long) sb.st_dev,
+                             (unsigned long long) sb.st_ino));
+    return ret;
+}
+
+
+/*
+ * virSecurityRememberedLabelGet:
+ *
+ * Look up @path in the table, reading its XATTRs on a miss. Must be
+ * called with rememberedLock held.
+ *
+ * Returns: 1 with @entry set,
+ *          0 if XATTRs are not supported on @path,
+ *         -1 on error.
+ */
+static int
+virSecurityRememberedLabelGet(const char *key,
+                              const char *path,
+                              const char *attr_name,
+                              const char *ref_name,
+                              virSecurityRememberedLabelPtr *entry)
+{
+    char *value = NULL;
+    virSecurityRememberedLabelPtr tmp = NULL;
+    int ret = -1;
+
+    if ((*entry = virHashLookup(remembered, key)))
+        return 1;
+
+    if (VIR_ALLOC(tmp) < 0)
+        return -1;
+
+    if (virFileGetXAttr(path, ref_name, &value) < 0) {
+        if (virSecurityXAttrUnsupported(errno)) {
+            ret = 0;
+            goto cleanup;
+        }
+        if (errno != ENODATA) {
+            virReportSystemError(errno,
+                                 _("Unable to get XATTR %s on %s"),
+                                 ref_name, path);
+            goto cleanup;
+        }
+    } else if (virStrToLong_ui(value, NULL, 10, &tmp->refcount) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("malformed refcount %s on %s"),
+                       value, path);
+        goto cleanup;
+    }
+
+    if (tmp->refcount &&
+        virFileGetXAttr(path, attr_name, &tmp->label) < 0 &&
+        errno != ENODATA) {
+        virReportSystemError(errno,
+                             _("Unable to get XATTR %s on %s"),
+                             attr_name, path);
+        goto cleanup;
+    }
+
+    if (virHashAddEntry(remembered, key, tmp) < 0)
+        goto cleanup;
+
+    *entry = tmp;
+    tmp = NULL;
+    ret = 1;
+ cleanup:
+    virSecurityRememberedLabelFree(tmp, NULL);
+    VIR_FREE(value);
+    return ret;
+}
+
+
+/**
+ * virSecurityGetRememberedLabel:
+ * @name: security driver name
+ * @path: file name
+ * @label: label
+ *
+ * For given @path and security driver (@name) fetch remembered
+ * @label. The caller must not restore label if an error is
+ * indicated or if @label is NULL upon return.
+ *
+ * The idea is that the first time
+ * virSecuritySetRememberedLabel() is called over @path the
+ * @label is recorded and refcounter is set to 1. Each subsequent
+ * call to virSecuritySetRememberedLabel() increases the counter.
+ * Counterpart to this API is virSecurityGetRememberedLabel()
+ * which decreases the counter and reads the @label only if the
+ * counter reached value of zero.
+ *
+ * Returns: 1 if @path is still in use by another domain,
+ *          0 on success (@label might be NULL if nothing was remembered),
+ *         -1 otherwise (with error reported).
+ */
+int
+virSecurityGetRememberedLabel(const char *name,
+                              const char *path,
+                              char **label)
+{
+    char *key = NULL;
+    char *attr_name = NULL;
+    char *ref_name = NULL;
+    char *value = NULL;
+    virSecurityRememberedLabelPtr entry = NULL;
+    int rv;
+    int ret = -1;
+
+    *label = NULL;
+
+    if (virSecurityUtilInitialize() < 0)
+        return -1;
+
+    if (!(key = virSecurityRememberedLabelKey(name, path)) ||
+        !(attr_name = virSecurityGetAttrName(name)) ||
+        !(ref_name = virSecurityGetRefCountAttrName(name)))
+        goto cleanup;
+
+    virMutexLock(&rememberedLock);
+
+    if ((rv = virSecurityRememberedLabelGet(key, path, attr_name,
+                                            ref_name, &entry)) <= 0) {
+        ret = rv;
+        goto unlock;
+    }
+
+    if (entry->refcount == 0) {
+        ret = 0;
+        goto drop;
+    }
+
+    if (--entry->refcount > 0) {
+        if (virAsprintf(&value, "%u", entry->refcount) < 0 ||
+            virFileSetXAttr(path, ref_name, value) < 0)
+            goto drop;
+
+        VIR_DEBUG("Path %s still used %u times", path, entry->refcount);
+        ret = 1;
+        goto unlock;
+    }
+
+    if (virFileRemoveXAttr(path, ref_name) < 0 ||
+        virFileRemoveXAttr(path, attr_name) < 0)
+        goto drop;
+
+    *label = entry->label;
+    entry->label = NULL;
+    ret = 0;
+
+ drop:
+    /* On error the table may no longer match the XATTRs, so let
+     * the next caller read them again. */
+    ignore_value(virHashRemoveEntry(remembered, key));
+ unlock:
+    virMutexUnlock(&rememberedLock);
+ cleanup:
+    VIR_FREE(value);
+    VIR_FREE(ref_name);
+    VIR_FREE(attr_name);
+    VIR_FREE(key);
+    return ret;
+}
+
+
+/**
+ * virSecuritySetRememberedLabel:
+ * @name: security driver name
+ * @path: file name
+ * @label: label
+ *
+ * For given @path and security driver (@name), remember its
+ * @label. See virSecurityGetRememberedLabel() for more details.
+ * Only the first caller records @label, subsequent ones just
+ * increase the counter.
+ *
+ * Returns: the number of users of @path on success,
+ *          0 if labels can't be remembered on @path,
+ *         -1 otherwise (with error reported).
+ */
+int
+virSecuritySetRememberedLabel(const char *name,
+                              const char *path,
+                              const char *label)
+{
+    char *key = NULL;
+    char *attr_name = NULL;
+    char *ref_name = NULL;
+    char *value = NULL;
+    virSecurityRememberedLabelPtr entry = NULL;
+    int rv;
+    int ret = -1;
+
+    if (virSecurityUtilInitialize() < 0)
+        return -1;
+
+    if (!(key = virSecurityRememberedLabelKey(name, path)) ||
+        !(attr_name = virSecurityGetAttrName(name)) ||
+        !(ref_name = virSecurityGetRefCountAttrName(name)))
+        goto cleanup;
+
+    virMutexLock(&rememberedLock);
+
+    if ((rv = virSecurityRememberedLabelGet(key, path, attr_name,
+                                            ref_name, &entry)) <= 0) {
+        ret = rv;
+        goto unlock;
+    }
+
+    if (entry->refcount == 0) {
+        if (virFileSetXAttr(path, attr_name, label) < 0) {
+            if (virSecurityXAttrUnsupported(errno)) {
+                virResetLastError();
+                ret = 0;
+            }
+            goto drop;
+        }
+
+        VIR_FREE(entry->label);
+        if (VIR_STRDUP(entry->label, label) < 0)
+            goto drop;
+    }
+
+    if (virAsprintf(&value, "%u", entry->refcount + 1) < 0 ||
+        virFileSetXAttr(path, ref_name, value) < 0)
+        goto drop;
+
+    ret = ++entry->refcount;
+    goto unlock;
+
+ drop:
+    ignore_value(virHashRemoveEntry(remembered, key));
+ unlock:
+    virMutexUnlock(&rememberedLock);
+ cleanup:
+    VIR_FREE(value);
+    VIR_FREE(ref_name);
+    VIR_FREE(attr_name);
+    VIR_FREE(key);
+    return ret;
+}
@@ -129,6 +129,11 @@ virStorageBackendISCSIGetHostNumber(const char *sysfs_path,
     return ret;
 }
 
+/*
+ * Rescans the SCSI host of @session for new LUNs and fills in the
+ * volumes of @pool. The rescan is triggered through sysfs, which is what
+ * iscsiadm --rescan does too, without running it for every refresh.
+ */
 static int
 virStorageBackendISCSIFindLUs(virStoragePoolObjPtr pool,
                               const char *session)
@@ -144,6 +149,9 @@ virStorageBackendISCSIFindLUs(virStoragePoolObjPtr pool,
     if (virStorageBackendISCSIGetHostNumber(sysfs_path, &host) < 0)
         goto cleanup;
 
+    if (virStorageBackendSCSITriggerRescan(host) < 0)
+        goto cleanup;
+
     if (virStorageBackendSCSIFindLUs(pool, host) < 0)
         goto cleanup;
 
@@ -389,8 +397,6 @@ virStorageBackendISCSIRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     if ((session = virStorageBackendISCSISession(pool, false)) == NULL)
         goto cleanup;
-    if (virISCSIRescanLUNs(session) < 0)
-        goto cleanup;
     if (virStorageBackendISCSIFindLUs(pool, session) < 0)
         goto cleanup;
     VIR_FREE(session);
@@ -39,6 +39,7 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
 #include "storage_util.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
@@ -128,6 +129,13 @@ virStorageBackendLogicalInitializeDevice(const char *path)
 struct virStorageBackendLogicalPoolVolData {
     virStoragePoolObjPtr pool;
     virStorageVolDefPtr vol;
+
+    /* Volumes found so far by name, as a volume with several segments
+     * shows up on several rows. Only used when refreshing all volumes. */
+    virHashTablePtr vols;
+
+    /* Whether the volume group size was taken from a row already */
+    bool gotVG;
 };
 
 static int
@@ -273,6 +281,19 @@ virStorageBackendLogicalMakeVol(char **const groups,
     int ret = -1;
     const char *attrs = groups[9];
 
+    /* Every row carries the size of the volume group too, which saves
+     * running vgs separately when refreshing the pool */
+    if (!data->vol && !data->gotVG) {
+        if (virStrToLong_ull(groups[10], NULL, 10, &def->capacity) < 0 ||
+            virStrToLong_ull(groups[11], NULL, 10, &def->available) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed volume group size value"));
+            return -1;
+        }
+        def->allocation = def->capacity - def->available;
+        data->gotVG = true;
+    }
+
     /* Skip inactive volume */
     if (attrs[4] != 'a')
         return 0;
@@ -294,7 +315,7 @@ virStorageBackendLogicalMakeVol(char **const groups,
 
     /* Or filling in more data on an existing volume */
     if (vol == NULL)
-        vol = virStorageVolDefFindByName(pool, groups[0]);
+        vol = virHashLookup(data->vols, groups[0]);
 
     /* Or a completely new volume */
     if (vol == NULL) {
@@ -359,8 +380,15 @@ virStorageBackendLogicalMakeVol(char **const groups,
     if (virStorageBackendLogicalParseVolExtents(vol, groups) < 0)
         goto cleanup;
 
-    if (is_new_vol && virStoragePoolObjAddVol(pool, vol) < 0)
-        goto cleanup;
+    if (is_new_vol) {
+        if (virHashAddEntry(data->vols, vol->name, vol) < 0)
+            goto cleanup;
+
+        if (virStoragePoolObjAddVol(pool, vol) < 0) {
+            virHashRemoveEntry(data->vols, vol->name);
+            goto cleanup;
+        }
+    }
     vol = NULL;
 
     ret = 0;
@@ -382,9 +410,11 @@ virStorageBackendLogicalMakeVol(char **const groups,
 #define VIR_STORAGE_VOL_LOGICAL_VG_EXTENT_SIZE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_SIZE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_LV_ATTR_REGEX "(\\S+)#"
+#define VIR_STORAGE_VOL_LOGICAL_VG_SIZE_REGEX "([0-9]+)#"
+#define VIR_STORAGE_VOL_LOGICAL_VG_FREE_REGEX "([0-9]+)#"
 #define VIR_STORAGE_VOL_LOGICAL_SUFFIX_REGEX "?\\s*$"
 
-#define VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT 10
+#define VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT 12
 #define VIR_STORAGE_VOL_LOGICAL_REGEX \
            VIR_STORAGE_VOL_LOGICAL_PREFIX_REGEX \
            VIR_STORAGE_VOL_LOGICAL_LV_NAME_REGEX \
@@ -397,25 +427,34 @@ virStorageBackendLogicalMakeVol(char **const groups,
            VIR_STORAGE_VOL_LOGICAL_VG_EXTENT_SIZE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_SIZE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_LV_ATTR_REGEX \
+           VIR_STORAGE_VOL_LOGICAL_VG_SIZE_REGEX \
+           VIR_STORAGE_VOL_LOGICAL_VG_FREE_REGEX \
            VIR_STORAGE_VOL_LOGICAL_SUFFIX_REGEX
 
+/*
+ * Fills in the volumes of @pool, or only @vol if not NULL, from a single
+ * lvs run. When all volumes are looked for, the size of the volume group
+ * is filled in as well and @gotVG tells whether lvs printed any row to
+ * take it from.
+ */
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
-                                virStorageVolDefPtr vol)
+                                virStorageVolDefPtr vol,
+                                bool *gotVG)
 {
     /*
      * # lvs --separator # --noheadings --units b --unbuffered --nosuffix --options \
-     * "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr" VGNAME
+     * "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr,vg_size,vg_free" VGNAME
      *
-     * RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392#-wi-ao
-     * SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392#-wi-ao
-     * Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824#owi-a-
-     * Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#2181038080#-wi-a-
-     * Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#1040187392#swi-a-
-     * test_stripes##fSLSZH-zAS2-yAIb-n4mV-Al9u-HA3V-oo9K1B#/dev/sdc1(10240),/dev/sdd1(0)#striped#2#42949672960#4194304#-wi-a-
+     * RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392#-wi-ao#10603200512#4328521728
+     * SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392#-wi-ao#10603200512#4328521728
+     * Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824#owi-a-#10603200512#4328521728
+     * Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#2181038080#-wi-a-#10603200512#4328521728
+     * Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#1040187392#swi-a-#10603200512#4328521728
+     * test_stripes##fSLSZH-zAS2-yAIb-n4mV-Al9u-HA3V-oo9K1B#/dev/sdc1(10240),/dev/sdd1(0)#striped#2#42949672960#4194304#-wi-a-#10603200512#4328521728
      *
      * Pull out name, origin, & uuid, device, device extent start #,
-     * segment size, extent size, size, attrs
+     * segment size, extent size, size, attrs, volume group size & free
      *
      * NB can be multiple rows per volume if they have many extents
      *
@@ -442,6 +481,9 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
         .vol = vol,
     };
 
+    if (!vol && !(cbdata.vols = virHashCreate(64, NULL)))
+        return -1;
+
     cmd = virCommandNewArgList(LVS,
                                "--separator", "#",
                                "--noheadings",
@@ -449,9 +491,16 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                "--unbuffered",
                                "--nosuffix",
                                "--options",
-                               "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr",
-                               def->source.name,
+                               "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr,vg_size,vg_free",
                                NULL);
+
+    /* A new volume is looked up alone rather than by listing the whole
+     * volume group again */
+    if (vol)
+        virCommandAddArgFormat(cmd, "%s/%s", def->source.name, vol->name);
+    else
+        virCommandAddArg(cmd, def->source.name);
+
     if (virCommandRunRegex(cmd,
                            1,
                            regexes,
@@ -462,8 +511,12 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                            NULL) < 0)
         goto cleanup;
 
+    if (gotVG)
+        *gotVG = cbdata.gotVG;
+
     ret = 0;
  cleanup:
+    virHashFree(cbdata.vols);
     virCommandFree(cmd);
     return ret;
 }
@@ -818,14 +871,22 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
     };
     virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
     virCommandPtr cmd = NULL;
+    bool gotVG = false;
     int ret = -1;
 
     virWaitForDevices();
 
     /* Get list of all logical volumes */
-    if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
+    if (virStorageBackendLogicalFindLVs(pool, NULL, &gotVG) < 0)
         goto cleanup;
 
+    /* lvs prints no rows to take the volume group size from if there
+     * is no volume in it */
+    if (gotVG) {
+        ret = 0;
+        goto cleanup;
+    }
+
     cmd = virCommandNewArgList(VGS,
                                "--separator", ":",
                                "--noheadings",
@@ -1030,7 +1091,7 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
     }
 
     /* Fill in data about this new vol */
-    if (virStorageBackendLogicalFindLVs(pool, vol) < 0) {
+    if (virStorageBackendLogicalFindLVs(pool, vol, NULL) < 0) {
         virReportSystemError(errno,
                              _("cannot find newly created volume '%s'"),
                              vol->target.path);
@@ -1093,6 +1154,49 @@ virStorageBackendLogicalVolWipe(virConnectPtr conn,
     return -1;
 }
 
+static int
+virStorageBackendLogicalResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                  virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                  virStorageVolDefPtr vol,
+                                  unsigned long long capacity,
+                                  unsigned int flags)
+{
+    virCommandPtr cmd = NULL;
+    int ret = -1;
+
+    virCheckFlags(VIR_STORAGE_VOL_RESIZE_ALLOCATE |
+                  VIR_STORAGE_VOL_RESIZE_SHRINK, -1);
+
+    if (flags & VIR_STORAGE_VOL_RESIZE_SHRINK) {
+        virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                       _("shrinking logical volumes is not supported"));
+        return -1;
+    }
+
+    /* The virtual size of a sparse lv is only the size of its origin,
+     * growing the snapshot store would need a separate size.  */
+    if (vol->target.sparse) {
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       _("logical volume '%s' is sparse, volume resize "
+                         "not supported"),
+                       vol->target.path);
+        return -1;
+    }
+
+    cmd = virCommandNewArgList(LVEXTEND, "-L", NULL);
+    virCommandAddArgFormat(cmd, "%lluK", VIR_DIV_UP(capacity, 1024));
+    virCommandAddArg(cmd, vol->target.path);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCommandFree(cmd);
+    return ret;
+}
+
 virStorageBackend virStorageBackendLogical = {
     .type = VIR_STORAGE_POOL_LOGICAL,
 
@@ -1110,6 +1214,7 @@ virStorageBackend virStorageBackendLogical = {
     .uploadVol = virStorageBackendVolUploadLocal,
     .downloadVol = virStorageBackendVolDownloadLocal,
     .wipeVol = virStorageBackendLogicalVolWipe,
+    .resizeVol = virStorageBackendLogicalResizeVol,
 };
 
 
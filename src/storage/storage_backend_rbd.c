@@ -34,6 +34,9 @@
 #include "viruuid.h"
 #include "virstring.h"
 #include "virrandom.h"
+#include "virthread.h"
+#include "virhash.h"
+#include "virobject.h"
 #include "rados/librados.h"
 #include "rbd/librbd.h"
 #include "secret_util.h"
@@ -44,14 +47,48 @@
 VIR_LOG_INIT("storage.storage_backend_rbd");
 
 struct _virStorageBackendRBDState {
+    virObject parent;
+
     rados_t cluster;
     rados_ioctx_t ioctx;
     time_t starttime;
+    time_t lastused; /* protected by virStorageBackendRBDStatesLock */
 };
 
 typedef struct _virStorageBackendRBDState virStorageBackendRBDState;
 typedef virStorageBackendRBDState *virStorageBackendRBDStatePtr;
 
+/* Connecting to the cluster costs a round trip to the monitors, so the
+ * connection of an active pool is kept open until the pool is stopped.
+ * The table maps pool UUIDs to their connections and holds a reference
+ * to each of them, users of a connection hold one more. */
+static virClassPtr virStorageBackendRBDStateClass;
+static virMutex virStorageBackendRBDStatesLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageBackendRBDStates;
+
+/* A connection idle for this many seconds is checked before being reused */
+#define VIR_STORAGE_BACKEND_RBD_IDLE_CHECK 60
+
+/* Upper bound on threads querying images during pool refresh */
+#define VIR_STORAGE_BACKEND_RBD_REFRESH_THREADS 8
+
+static void virStorageBackendRBDStateDispose(void *obj);
+
+static int
+virStorageBackendRBDStateOnceInit(void)
+{
+    if (!(virStorageBackendRBDStateClass =
+          virClassNew(virClassForObject(),
+                      "virStorageBackendRBDState",
+                      sizeof(virStorageBackendRBDState),
+                      virStorageBackendRBDStateDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageBackendRBDState)
+
 static int
 virStorageBackendRBDRADOSConfSet(rados_t cluster,
                                  const char *option,
@@ -240,25 +277,81 @@ virStorageBackendRBDCloseRADOSConn(virStorageBackendRBDStatePtr ptr)
 
 
 static void
-virStorageBackendRBDFreeState(virStorageBackendRBDStatePtr *ptr)
+virStorageBackendRBDStateDispose(void *obj)
+{
+    virStorageBackendRBDCloseRADOSConn(obj);
+}
+
+
+/* Forget the cached connection of @pool, if it is still @ptr (or any
+ * connection if @ptr is NULL). Users still holding the connection keep
+ * it open until they are done with it. */
+static void
+virStorageBackendRBDDropState(virStoragePoolObjPtr pool,
+                              virStorageBackendRBDStatePtr ptr)
 {
-    if (!*ptr)
-        return;
+    virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(def->uuid, uuidstr);
+
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    if (virStorageBackendRBDStates &&
+        (!ptr || virHashLookup(virStorageBackendRBDStates, uuidstr) == ptr))
+        virHashRemoveEntry(virStorageBackendRBDStates, uuidstr);
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+}
 
-    virStorageBackendRBDCloseRADOSConn(*ptr);
 
-    VIR_FREE(*ptr);
+static void
+virStorageBackendRBDPutState(virStorageBackendRBDStatePtr *ptr)
+{
+    virObjectUnref(*ptr);
+    *ptr = NULL;
 }
 
 
 static virStorageBackendRBDStatePtr
-virStorageBackendRBDNewState(virConnectPtr conn,
+virStorageBackendRBDGetState(virConnectPtr conn,
                              virStoragePoolObjPtr pool)
 {
-    virStorageBackendRBDStatePtr ptr;
+    virStorageBackendRBDStatePtr ptr = NULL;
     virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    time_t now = time(0);
+    bool check = false;
+
+    if (virStorageBackendRBDStateInitialize() < 0)
+        return NULL;
+
+    virUUIDFormat(def->uuid, uuidstr);
+
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    if (virStorageBackendRBDStates &&
+        (ptr = virHashLookup(virStorageBackendRBDStates, uuidstr))) {
+        virObjectRef(ptr);
+        check = now - ptr->lastused >= VIR_STORAGE_BACKEND_RBD_IDLE_CHECK;
+        ptr->lastused = now;
+    }
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
+    if (ptr) {
+        struct rados_cluster_stat_t clusterstat;
+        char ebuf[1024];
+        int r;
+
+        /* The monitors may have gone away while the connection sat idle,
+         * a cheap query tells whether it is still usable */
+        if (!check || (r = rados_cluster_stat(ptr->cluster, &clusterstat)) >= 0)
+            return ptr;
+
+        VIR_WARN("Reconnecting stale RADOS connection of pool '%s': %s",
+                 def->name, virStrerror(-r, ebuf, sizeof(ebuf)));
+        virStorageBackendRBDDropState(pool, ptr);
+        virStorageBackendRBDPutState(&ptr);
+    }
 
-    if (VIR_ALLOC(ptr) < 0)
+    if (!(ptr = virObjectNew(virStorageBackendRBDStateClass)))
         return NULL;
 
     if (virStorageBackendRBDOpenRADOSConn(ptr, conn, &def->source) < 0)
@@ -267,10 +360,27 @@ virStorageBackendRBDNewState(virConnectPtr conn,
     if (virStorageBackendRBDOpenIoCTX(ptr, pool) < 0)
         goto error;
 
+    ptr->lastused = time(0);
+
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    if (!virStorageBackendRBDStates &&
+        !(virStorageBackendRBDStates = virHashCreate(10, virObjectFreeHashData))) {
+        virMutexUnlock(&virStorageBackendRBDStatesLock);
+        goto error;
+    }
+
+    /* Replaces the connection another thread may have raced us to */
+    if (virHashUpdateEntry(virStorageBackendRBDStates, uuidstr, ptr) < 0) {
+        virMutexUnlock(&virStorageBackendRBDStatesLock);
+        goto error;
+    }
+    virObjectRef(ptr);
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
     return ptr;
 
  error:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return NULL;
 }
 
@@ -368,14 +478,14 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     uint64_t features;
 
     if ((r = rbd_open_read_only(ptr->ioctx, vol->name, &image, NULL)) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to open the RBD image '%s'"),
                              vol->name);
         goto cleanup;
     }
 
     if ((r = rbd_stat(image, &info, sizeof(info))) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to stat the RBD image '%s'"),
                              vol->name);
         goto cleanup;
@@ -422,21 +532,184 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     return ret;
 }
 
+/* Returns a NULL terminated list of the names of all images in the pool */
+static char **
+virStorageBackendRBDListImages(virStorageBackendRBDStatePtr ptr,
+                               const char *poolname)
+{
+    char **ret = NULL;
+    char **names = NULL;
+    size_t max_size = 1024;
+    size_t i;
+#ifdef HAVE_RBD_LIST2
+    rbd_image_spec_t *images = NULL;
+    int r;
+
+    while (true) {
+        if (VIR_ALLOC_N(images, max_size) < 0)
+            goto cleanup;
+
+        if ((r = rbd_list2(ptr->ioctx, images, &max_size)) >= 0)
+            break;
+        VIR_FREE(images);
+        if (r != -ERANGE) {
+            virReportSystemError(-r, _("failed to list images of RBD pool %s"),
+                                 poolname);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC_N(names, max_size + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < max_size; i++) {
+        if (VIR_STRDUP(names[i], images[i].name) < 0)
+            goto cleanup;
+    }
+#else /* !HAVE_RBD_LIST2 */
+    char *name, *buf = NULL;
+    size_t nnames = 0;
+    int len = -1;
+
+    while (true) {
+        if (VIR_ALLOC_N(buf, max_size) < 0)
+            goto cleanup;
+
+        len = rbd_list(ptr->ioctx, buf, &max_size);
+        if (len >= 0)
+            break;
+        VIR_FREE(buf);
+        if (len != -ERANGE) {
+            virReportSystemError(-len, _("failed to list images of RBD pool %s"),
+                                 poolname);
+            goto cleanup;
+        }
+    }
+
+    /* The buffer holds the names one after another, each NUL terminated */
+    for (name = buf; name < buf + max_size && *name; name += strlen(name) + 1)
+        nnames++;
+
+    if (VIR_ALLOC_N(names, nnames + 1) < 0)
+        goto cleanup;
+
+    for (i = 0, name = buf; i < nnames; i++, name += strlen(name) + 1) {
+        if (VIR_STRDUP(names[i], name) < 0)
+            goto cleanup;
+    }
+#endif /* !HAVE_RBD_LIST2 */
+
+    ret = names;
+    names = NULL;
+
+ cleanup:
+#ifdef HAVE_RBD_LIST2
+    if (images)
+        rbd_image_spec_list_cleanup(images, max_size);
+    VIR_FREE(images);
+#else
+    VIR_FREE(buf);
+#endif
+    virStringListFree(names);
+    return ret;
+}
+
+
+typedef struct _virStorageBackendRBDRefreshData virStorageBackendRBDRefreshData;
+typedef virStorageBackendRBDRefreshData *virStorageBackendRBDRefreshDataPtr;
+struct _virStorageBackendRBDRefreshData {
+    virStoragePoolObjPtr pool;
+    virStorageBackendRBDStatePtr ptr;
+    char **names;
+    virStorageVolDefPtr *vols;   /* indexed like @names, NULL if skipped */
+    size_t nnames;
+
+    virMutex lock;               /* protects the fields below */
+    size_t next;                 /* next image to query */
+    bool failed;
+    virErrorPtr error;           /* first error raised by a worker */
+};
+
+
+static void
+virStorageBackendRBDRefreshWorker(void *opaque)
+{
+    virStorageBackendRBDRefreshDataPtr data = opaque;
+
+    while (true) {
+        virStorageVolDefPtr vol = NULL;
+        size_t idx;
+        int r;
+
+        virMutexLock(&data->lock);
+        if (data->failed || data->next >= data->nnames) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+        idx = data->next++;
+        virMutexUnlock(&data->lock);
+
+        if (VIR_ALLOC(vol) < 0 ||
+            VIR_STRDUP(vol->name, data->names[idx]) < 0) {
+            r = -ENOMEM;
+        } else {
+            r = volStorageBackendRBDRefreshVolInfo(vol, data->pool, data->ptr);
+        }
+
+        /* It could be that a volume has been deleted through a different route
+         * then libvirt and that will cause a -ENOENT to be returned.
+         *
+         * Another possibility is that there is something wrong with the placement
+         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
+         * to be returned.
+         *
+         * Do not error out and simply ignore the volume
+         */
+        if (r < 0) {
+            virStorageVolDefFree(vol);
+            if (r == -ENOENT || r == -ETIMEDOUT) {
+                virResetLastError();
+                continue;
+            }
+
+            /* Errors are thread local, keep them for the refreshing thread */
+            virMutexLock(&data->lock);
+            if (!data->failed) {
+                data->failed = true;
+                data->error = virSaveLastError();
+            }
+            virMutexUnlock(&data->lock);
+            virResetLastError();
+            return;
+        }
+
+        data->vols[idx] = vol;
+    }
+}
+
+
 static int
 virStorageBackendRBDRefreshPool(virConnectPtr conn,
                                 virStoragePoolObjPtr pool)
 {
-    size_t max_size = 1024;
     int ret = -1;
-    int len = -1;
     int r = 0;
-    char *name, *names = NULL;
     virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
     virStorageBackendRBDStatePtr ptr = NULL;
     struct rados_cluster_stat_t clusterstat;
     struct rados_pool_stat_t poolstat;
+    virStorageBackendRBDRefreshData data;
+    virThread threads[VIR_STORAGE_BACKEND_RBD_REFRESH_THREADS - 1];
+    size_t nthreads;
+    size_t i;
+
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if ((r = rados_cluster_stat(ptr->cluster, &clusterstat)) < 0) {
@@ -459,60 +732,51 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
               def->source.name, clusterstat.kb, clusterstat.kb_avail,
               poolstat.num_bytes);
 
-    while (true) {
-        if (VIR_ALLOC_N(names, max_size) < 0)
-            goto cleanup;
+    if (!(data.names = virStorageBackendRBDListImages(ptr, def->source.name)))
+        goto cleanup;
 
-        len = rbd_list(ptr->ioctx, names, &max_size);
-        if (len >= 0)
-            break;
-        if (len != -ERANGE) {
-            VIR_WARN("%s", "A problem occurred while listing RBD images");
-            goto cleanup;
-        }
-        VIR_FREE(names);
-    }
+    data.pool = pool;
+    data.ptr = ptr;
+    data.nnames = virStringListLength((const char * const *) data.names);
 
-    for (name = names; name < names + max_size;) {
-        virStorageVolDefPtr vol;
+    if (VIR_ALLOC_N(data.vols, data.nnames) < 0)
+        goto cleanup;
 
-        if (STREQ(name, ""))
+    /* Each image costs a few round trips to its OSDs, so query several
+     * of them at once. The calling thread is one of the workers. */
+    for (nthreads = 0;
+         nthreads < MIN(VIR_STORAGE_BACKEND_RBD_REFRESH_THREADS,
+                        data.nnames) - 1;
+         nthreads++) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            virStorageBackendRBDRefreshWorker, &data) < 0) {
+            VIR_WARN("Failed to create RBD refresh thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
             break;
-
-        if (VIR_ALLOC(vol) < 0)
-            goto cleanup;
-
-        if (VIR_STRDUP(vol->name, name) < 0) {
-            VIR_FREE(vol);
-            goto cleanup;
         }
+    }
 
-        name += strlen(name) + 1;
+    virStorageBackendRBDRefreshWorker(&data);
 
-        r = volStorageBackendRBDRefreshVolInfo(vol, pool, ptr);
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
 
-        /* It could be that a volume has been deleted through a different route
-         * then libvirt and that will cause a -ENOENT to be returned.
-         *
-         * Another possibility is that there is something wrong with the placement
-         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
-         * to be returned.
-         *
-         * Do not error out and simply ignore the volume
-         */
-        if (r < 0) {
-            if (r == -ENOENT || r == -ETIMEDOUT)
-                continue;
+    if (data.failed) {
+        if (data.error)
+            virSetError(data.error);
+        goto cleanup;
+    }
 
-            virStorageVolDefFree(vol);
-            goto cleanup;
-        }
+    for (i = 0; i < data.nnames; i++) {
+        if (!data.vols[i])
+            continue;
 
-        if (virStoragePoolObjAddVol(pool, vol) < 0) {
-            virStorageVolDefFree(vol);
+        if (virStoragePoolObjAddVol(pool, data.vols[i]) < 0) {
             virStoragePoolObjClearVols(pool);
             goto cleanup;
         }
+        data.vols[i] = NULL;
     }
 
     VIR_DEBUG("Found %zu images in RBD pool %s",
@@ -521,11 +785,25 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    VIR_FREE(names);
-    virStorageBackendRBDFreeState(&ptr);
+    for (i = 0; i < data.nnames; i++)
+        virStorageVolDefFree(data.vols[i]);
+    VIR_FREE(data.vols);
+    virStringListFree(data.names);
+    virFreeError(data.error);
+    virMutexDestroy(&data.lock);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
+
+static int
+virStorageBackendRBDStopPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+                             virStoragePoolObjPtr pool)
+{
+    virStorageBackendRBDDropState(pool, NULL);
+    return 0;
+}
+
 static int
 virStorageBackendRBDCleanupSnapshots(rados_ioctx_t ioctx,
                                      virStoragePoolSourcePtr source,
@@ -623,7 +901,7 @@ virStorageBackendRBDDeleteVol(virConnectPtr conn,
     if (flags & VIR_STORAGE_VOL_DELETE_ZEROED)
         VIR_WARN("%s", "This storage backend does not support zeroed removal of volumes");
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if (flags & VIR_STORAGE_VOL_DELETE_WITH_SNAPSHOTS) {
@@ -644,7 +922,7 @@ virStorageBackendRBDDeleteVol(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
@@ -718,7 +996,7 @@ virStorageBackendRBDBuildVol(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if ((r = virStorageBackendRBDCreateImage(ptr->ioctx, vol->name,
@@ -731,7 +1009,7 @@ virStorageBackendRBDBuildVol(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
@@ -1056,7 +1334,7 @@ virStorageBackendRBDBuildVolFrom(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if ((virStorageBackendRBDCloneImage(ptr->ioctx, origvol->name,
@@ -1066,7 +1344,7 @@ virStorageBackendRBDBuildVolFrom(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
@@ -1078,7 +1356,7 @@ virStorageBackendRBDRefreshVol(virConnectPtr conn,
     virStorageBackendRBDStatePtr ptr = NULL;
     int ret = -1;
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0)
@@ -1087,7 +1365,7 @@ virStorageBackendRBDRefreshVol(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
@@ -1105,7 +1383,7 @@ virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     virCheckFlags(0, -1);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if ((r = rbd_open(ptr->ioctx, vol->name, &image, NULL)) < 0) {
@@ -1125,7 +1403,7 @@ virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
  cleanup:
     if (image != NULL)
        rbd_close(image);
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
     return ret;
 }
 
@@ -1222,7 +1500,7 @@ virStorageBackendRBDVolWipe(virConnectPtr conn,
 
     VIR_DEBUG("Wiping RBD image %s/%s", def->source.name, vol->name);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
 
     if ((r = rbd_open(ptr->ioctx, vol->name, &image, NULL)) < 0) {
@@ -1281,7 +1559,7 @@ virStorageBackendRBDVolWipe(virConnectPtr conn,
     if (image)
         rbd_close(image);
 
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDPutState(&ptr);
 
     return ret;
 }
@@ -1290,6 +1568,7 @@ virStorageBackend virStorageBackendRBD = {
     .type = VIR_STORAGE_POOL_RBD,
 
     .refreshPool = virStorageBackendRBDRefreshPool,
+    .stopPool = virStorageBackendRBDStopPool,
     .createVol = virStorageBackendRBDCreateVol,
     .buildVol = virStorageBackendRBDBuildVol,
     .buildVolFrom = virStorageBackendRBDBuildVolFrom,
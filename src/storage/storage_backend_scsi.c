@@ -41,9 +41,7 @@
 
 VIR_LOG_INIT("storage.storage_backend_scsi");
 
-#define LINUX_SYSFS_SCSI_HOST_PREFIX "/sys/class/scsi_host"
 #define LINUX_SYSFS_SCSI_HOST_POSTFIX "device"
-#define LINUX_SYSFS_SCSI_HOST_SCAN_STRING "- - -"
 
 typedef struct _virStoragePoolFCRefreshInfo virStoragePoolFCRefreshInfo;
 typedef virStoragePoolFCRefreshInfo *virStoragePoolFCRefreshInfoPtr;
@@ -53,51 +51,6 @@ struct _virStoragePoolFCRefreshInfo {
 };
 
 
-static int
-virStorageBackendSCSITriggerRescan(uint32_t host)
-{
-    int fd = -1;
-    int retval = 0;
-    char *path;
-
-    VIR_DEBUG("Triggering rescan of host %d", host);
-
-    if (virAsprintf(&path, "%s/host%u/scan",
-                    LINUX_SYSFS_SCSI_HOST_PREFIX, host) < 0) {
-        retval = -1;
-        goto out;
-    }
-
-    VIR_DEBUG("Scan trigger path is '%s'", path);
-
-    fd = open(path, O_WRONLY);
-
-    if (fd < 0) {
-        virReportSystemError(errno,
-                             _("Could not open '%s' to trigger host scan"),
-                             path);
-        retval = -1;
-        goto free_path;
-    }
-
-    if (safewrite(fd,
-                  LINUX_SYSFS_SCSI_HOST_SCAN_STRING,
-                  sizeof(LINUX_SYSFS_SCSI_HOST_SCAN_STRING)) < 0) {
-        VIR_FORCE_CLOSE(fd);
-        virReportSystemError(errno,
-                             _("Write to '%s' to trigger host scan failed"),
-                             path);
-        retval = -1;
-    }
-
-    VIR_FORCE_CLOSE(fd);
- free_path:
-    VIR_FREE(path);
- out:
-    VIR_DEBUG("Rescan of host %d complete", host);
-    return retval;
-}
-
 /**
  * Frees opaque data
  *
@@ -50,6 +50,7 @@
 #include "configmake.h"
 #include "virsecret.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "viraccessapicheck.h"
 //#include "dirname.h"
 #include "storage_util.h"
@@ -171,68 +172,141 @@ storagePoolUpdateAllState(void)
     }
 }
 
+static void
+storageDriverAutostartPool(virStoragePoolObjPtr obj,
+                           virConnectPtr conn)
+{
+    virStoragePoolDefPtr def = virStoragePoolObjGetDef(obj);
+    virStorageBackendPtr backend;
+    bool started = false;
+
+    virStoragePoolObjLock(obj);
+    if ((backend = virStorageBackendForType(def->type)) == NULL) {
+        virStoragePoolObjUnlock(obj);
+        return;
+    }
+
+    if (virStoragePoolObjIsAutostart(obj) &&
+        !virStoragePoolObjIsActive(obj)) {
+        if (backend->startPool &&
+            backend->startPool(conn, obj) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to autostart storage pool '%s': %s"),
+                           def->name, virGetLastErrorMessage());
+            virStoragePoolObjUnlock(obj);
+            return;
+        }
+        started = true;
+    }
+
+    if (started) {
+        char *stateFile;
+
+        virStoragePoolObjClearVols(obj);
+        stateFile = virFileBuildPath(driver->stateDir, def->name, ".xml");
+        if (!stateFile ||
+            virStoragePoolSaveState(stateFile, def) < 0 ||
+            backend->refreshPool(conn, obj) < 0) {
+            if (stateFile)
+                unlink(stateFile);
+            if (backend->stopPool)
+                backend->stopPool(conn, obj);
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to autostart storage pool '%s': %s"),
+                           def->name, virGetLastErrorMessage());
+        } else {
+            virStoragePoolObjSetActive(obj, true);
+        }
+        VIR_FREE(stateFile);
+    }
+    virStoragePoolObjUnlock(obj);
+}
+
+
+/* Upper bound on threads starting pools at once. Starting a pool mostly
+ * waits for remote targets or helper programs, so this does not depend
+ * on the number of host CPUs. */
+#define STORAGE_DRIVER_AUTOSTART_THREADS 8
+
+struct storageDriverAutostartData {
+    virMutex lock;
+    size_t next;
+    virConnectPtr conn;
+};
+
+
+static void
+storageDriverAutostartWorker(void *opaque)
+{
+    struct storageDriverAutostartData *data = opaque;
+    virStoragePoolObjPtr obj;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->next == driver->pools.count) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        obj = driver->pools.objs[data->next++];
+        virMutexUnlock(&data->lock);
+
+        storageDriverAutostartPool(obj, data->conn);
+    }
+}
+
+
+/*
+ * Pools are started by up to STORAGE_DRIVER_AUTOSTART_THREADS threads,
+ * so that a pool whose start is slow, e.g. one logging in to an iSCSI
+ * target, does not hold back all the others. Each pool is only ever
+ * handled by a single thread, under its own lock.
+ */
 static void
 storageDriverAutostart(void)
 {
+    virThread threads[STORAGE_DRIVER_AUTOSTART_THREADS - 1];
+    size_t nthreads = STORAGE_DRIVER_AUTOSTART_THREADS;
+    struct storageDriverAutostartData data = { .next = 0 };
     size_t i;
-    virConnectPtr conn = NULL;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return;
+    }
 
     /* XXX Remove hardcoding of QEMU URI */
     if (driver->privileged)
-        conn = virConnectOpen("qemu:///system");
+        data.conn = virConnectOpen("qemu:///system");
     else
-        conn = virConnectOpen("qemu:///session");
+        data.conn = virConnectOpen("qemu:///session");
     /* Ignoring NULL conn - let backends decide */
 
-    for (i = 0; i < driver->pools.count; i++) {
-        virStoragePoolObjPtr obj = driver->pools.objs[i];
-        virStoragePoolDefPtr def = virStoragePoolObjGetDef(obj);
-        virStorageBackendPtr backend;
-        bool started = false;
-
-        virStoragePoolObjLock(obj);
-        if ((backend = virStorageBackendForType(def->type)) == NULL) {
-            virStoragePoolObjUnlock(obj);
-            continue;
-        }
+    if (driver->pools.count < nthreads)
+        nthreads = driver->pools.count;
 
-        if (virStoragePoolObjIsAutostart(obj) &&
-            !virStoragePoolObjIsActive(obj)) {
-            if (backend->startPool &&
-                backend->startPool(conn, obj) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               def->name, virGetLastErrorMessage());
-                virStoragePoolObjUnlock(obj);
-                continue;
-            }
-            started = true;
-        }
+    /* account for the calling thread */
+    if (nthreads > 0)
+        nthreads--;
 
-        if (started) {
-            char *stateFile;
-
-            virStoragePoolObjClearVols(obj);
-            stateFile = virFileBuildPath(driver->stateDir, def->name, ".xml");
-            if (!stateFile ||
-                virStoragePoolSaveState(stateFile, def) < 0 ||
-                backend->refreshPool(conn, obj) < 0) {
-                if (stateFile)
-                    unlink(stateFile);
-                if (backend->stopPool)
-                    backend->stopPool(conn, obj);
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               def->name, virGetLastErrorMessage());
-            } else {
-                virStoragePoolObjSetActive(obj, true);
-            }
-            VIR_FREE(stateFile);
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            storageDriverAutostartWorker, &data) < 0) {
+            VIR_WARN("Failed to create pool autostart thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
         }
-        virStoragePoolObjUnlock(obj);
     }
+    nthreads = i;
 
-    virObjectUnref(conn);
+    storageDriverAutostartWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virMutexDestroy(&data.lock);
+    virObjectUnref(data.conn);
 }
 
 /**
@@ -256,6 +330,11 @@ storageStateInitialize(bool privileged,
         VIR_FREE(driver);
         return ret;
     }
+    if (virCondInit(&driver->jobsCond) < 0) {
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(driver);
+        return ret;
+    }
     storageDriverLock();
 
     if (privileged) {
@@ -370,6 +449,14 @@ storageStateCleanup(void)
 
     storageDriverLock();
 
+    /* Background volume jobs use the pools and the event state */
+    while (driver->njobs > 0) {
+        if (virCondWait(&driver->jobsCond, &driver->lock) < 0) {
+            VIR_WARN("Failed to wait for volume jobs");
+            break;
+        }
+    }
+
     virObjectUnref(driver->storageEventState);
 
     /* free inactive pools */
@@ -379,6 +466,7 @@ storageStateCleanup(void)
     VIR_FREE(driver->autostartDir);
     VIR_FREE(driver->stateDir);
     storageDriverUnlock();
+    virCondDestroy(&driver->jobsCond);
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
 
@@ -1151,9 +1239,10 @@ storagePoolRefresh(virStoragePoolPtr pool,
     virStoragePoolDefPtr def;
     virStorageBackendPtr backend;
     int ret = -1;
+    int refreshed;
     virObjectEventPtr event = NULL;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_POOL_REFRESH_INCREMENTAL, -1);
 
     storageDriverLock();
     if (!(obj = storagePoolObjFindByUUID(pool->uuid, pool->name)))
@@ -1179,8 +1268,17 @@ storagePoolRefresh(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(obj);
-    if (backend->refreshPool(pool->conn, obj) < 0) {
+    if (flags & VIR_STORAGE_POOL_REFRESH_INCREMENTAL) {
+        if (virStoragePoolObjStashVols(obj) < 0)
+            goto cleanup;
+    } else {
+        virStoragePoolObjClearVols(obj);
+    }
+
+    refreshed = backend->refreshPool(pool->conn, obj);
+    virStoragePoolObjClearStashedVols(obj);
+
+    if (refreshed < 0) {
         if (backend->stopPool)
             backend->stopPool(pool->conn, obj);
 
@@ -1503,16 +1601,35 @@ storageVolLookupByKey(virConnectPtr conn,
 {
     size_t i;
     virStorageVolPtr vol = NULL;
+    virStoragePoolObjPtr obj;
+    virStorageVolDefPtr voldef;
 
     storageDriverLock();
+
+    if ((obj = virStoragePoolObjFindByVolKey(key, &voldef))) {
+        virStoragePoolDefPtr def = virStoragePoolObjGetDef(obj);
+
+        if (virStoragePoolObjIsActive(obj)) {
+            if (virStorageVolLookupByKeyEnsureACL(conn, def, voldef) < 0) {
+                virStoragePoolObjUnlock(obj);
+                goto cleanup;
+            }
+
+            vol = virGetStorageVol(conn, def->name,
+                                   voldef->name, voldef->key,
+                                   NULL, NULL);
+        }
+        virStoragePoolObjUnlock(obj);
+    }
+
     for (i = 0; i < driver->pools.count && !vol; i++) {
-        virStoragePoolObjPtr obj = driver->pools.objs[i];
         virStoragePoolDefPtr def;
 
+        obj = driver->pools.objs[i];
         virStoragePoolObjLock(obj);
         def = virStoragePoolObjGetDef(obj);
         if (virStoragePoolObjIsActive(obj)) {
-            virStorageVolDefPtr voldef = virStorageVolDefFindByKey(obj, key);
+            voldef = virStorageVolDefFindByKey(obj, key);
 
             if (voldef) {
                 if (virStorageVolLookupByKeyEnsureACL(conn, def, voldef) < 0) {
@@ -1543,6 +1660,8 @@ storageVolLookupByPath(virConnectPtr conn,
 {
     size_t i;
     virStorageVolPtr vol = NULL;
+    virStoragePoolObjPtr indexobj;
+    virStorageVolDefPtr indexvol;
     char *cleanpath;
 
     cleanpath = virFileSanitizePath(path);
@@ -1550,6 +1669,25 @@ storageVolLookupByPath(virConnectPtr conn,
         return NULL;
 
     storageDriverLock();
+
+    /* A volume whose target path is exactly @path needs no per pool
+     * translation to a stable path */
+    if ((indexobj = virStoragePoolObjFindByVolPath(cleanpath, &indexvol))) {
+        virStoragePoolDefPtr def = virStoragePoolObjGetDef(indexobj);
+
+        if (virStoragePoolObjIsActive(indexobj)) {
+            if (virStorageVolLookupByPathEnsureACL(conn, def, indexvol) < 0) {
+                virStoragePoolObjUnlock(indexobj);
+                goto cleanup;
+            }
+
+            vol = virGetStorageVol(conn, def->name,
+                                   indexvol->name, indexvol->key,
+                                   NULL, NULL);
+        }
+        virStoragePoolObjUnlock(indexobj);
+    }
+
     for (i = 0; i < driver->pools.count && !vol; i++) {
         virStoragePoolObjPtr obj = driver->pools.objs[i];
         virStoragePoolDefPtr def;
@@ -1937,6 +2075,194 @@ storageVolCreateXML(virStoragePoolPtr pool,
     return vol;
 }
 
+/* State of a volume operation which runs without the pool lock held,
+ * either in the calling thread or in a background job thread. */
+typedef struct _virStorageVolJobData virStorageVolJobData;
+typedef virStorageVolJobData *virStorageVolJobDataPtr;
+struct _virStorageVolJobData {
+    virStorageVolPtr vol;
+    virStoragePoolObjPtr obj;
+    virStoragePoolObjPtr objsrc;   /* pool of @voldefsrc, if not @obj */
+    virStorageBackendPtr backend;
+    virStorageVolDefPtr voldef;    /* owned by @obj */
+    virStorageVolDefPtr shadowvol; /* shallow copy of @voldef, build only */
+    virStorageVolDefPtr voldefsrc; /* build only */
+    unsigned int algorithm;        /* wipe only */
+    unsigned int flags;
+};
+
+
+static void
+storageVolJobDataFree(virStorageVolJobDataPtr data)
+{
+    if (!data)
+        return;
+
+    virObjectUnref(data->vol);
+    VIR_FREE(data->shadowvol);
+    VIR_FREE(data);
+}
+
+
+/*
+ * Relock the pools of @data after the backend finished the operation.
+ * Returns with @data->obj locked.
+ */
+static void
+storageVolJobRelock(virStorageVolJobDataPtr data)
+{
+    storageDriverLock();
+    virStoragePoolObjLock(data->obj);
+    if (data->objsrc)
+        virStoragePoolObjLock(data->objsrc);
+    storageDriverUnlock();
+
+    virStorageVolJobFree(data->voldef->job);
+    data->voldef->job = NULL;
+    virStoragePoolObjDecrAsyncjobs(data->obj);
+
+    if (data->objsrc) {
+        virStoragePoolObjDecrAsyncjobs(data->objsrc);
+        virStoragePoolObjUnlock(data->objsrc);
+        data->objsrc = NULL;
+    }
+}
+
+
+static int
+storageVolCreateXMLFromRun(virStorageVolJobDataPtr data,
+                           bool build)
+{
+    virStoragePoolDefPtr def;
+    virStorageVolDefPtr voldef = data->voldef;
+    int buildret = -1;
+
+    if (build)
+        buildret = data->backend->buildVolFrom(data->vol->conn, data->obj,
+                                               data->shadowvol,
+                                               data->voldefsrc,
+                                               data->flags);
+
+    storageVolJobRelock(data);
+    def = virStoragePoolObjGetDef(data->obj);
+
+    data->voldefsrc->in_use--;
+    voldef->building = false;
+
+    if (buildret < 0 ||
+        (data->backend->refreshVol &&
+         data->backend->refreshVol(data->vol->conn, data->obj, voldef) < 0)) {
+        storageVolDeleteInternal(data->vol, data->backend, data->obj,
+                                 voldef, 0, false);
+        data->voldef = NULL;
+        return -1;
+    }
+
+    /* Updating pool metadata ignoring the disk backend since
+     * it updates the pool values
+     */
+    if (def->type != VIR_STORAGE_POOL_DISK) {
+        def->allocation += voldef->target.allocation;
+        def->available -= voldef->target.allocation;
+    }
+
+    VIR_INFO("Creating volume '%s' in storage pool '%s'",
+             data->vol->name, def->name);
+
+    return 0;
+}
+
+
+static int
+storageVolWipeRun(virStorageVolJobDataPtr data)
+{
+    int ret;
+
+    ret = data->backend->wipeVol(data->vol->conn, data->obj, data->voldef,
+                                 data->algorithm, data->flags);
+
+    storageVolJobRelock(data);
+    data->voldef->in_use--;
+
+    if (ret < 0)
+        return -1;
+
+    /* Instead of using the refreshVol, since much changes on the target
+     * volume, let's update using the same function as refreshPool would
+     * use when it discovers a volume. The only failure to capture is -1,
+     * we can ignore -2. */
+    if (virStorageBackendRefreshVolTargetUpdate(data->voldef) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+storageVolJobThread(void *opaque)
+{
+    virStorageVolJobDataPtr data = opaque;
+    virStoragePoolDefPtr def;
+    virObjectEventPtr event;
+    int type = data->voldef->job->type;
+    int ret;
+
+    if (type == VIR_STORAGE_VOL_JOB_BUILD)
+        ret = storageVolCreateXMLFromRun(data, true);
+    else
+        ret = storageVolWipeRun(data);
+
+    if (ret < 0)
+        VIR_WARN("Background job on volume '%s' in pool '%s' failed: %s",
+                 data->vol->name, data->vol->pool, virGetLastErrorMessage());
+
+    def = virStoragePoolObjGetDef(data->obj);
+    event = virStoragePoolEventVolumeJobNew(def->name, def->uuid,
+                                            data->vol->name, type,
+                                            ret < 0 ?
+                                            VIR_STORAGE_POOL_EVENT_VOLUME_JOB_FAILED :
+                                            VIR_STORAGE_POOL_EVENT_VOLUME_JOB_COMPLETED);
+    virStoragePoolObjUnlock(data->obj);
+
+    if (event)
+        virObjectEventStateQueue(driver->storageEventState, event);
+
+    storageVolJobDataFree(data);
+
+    storageDriverLock();
+    driver->njobs--;
+    virCondBroadcast(&driver->jobsCond);
+    storageDriverUnlock();
+}
+
+
+/*
+ * Start the job thread for @data. On failure the caller still owns
+ * @data and has to finish the operation itself.
+ */
+static int
+storageVolJobStart(virStorageVolJobDataPtr data)
+{
+    virThread thread;
+
+    storageDriverLock();
+    driver->njobs++;
+    storageDriverUnlock();
+
+    if (virThreadCreate(&thread, false, storageVolJobThread, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create volume job thread"));
+        storageDriverLock();
+        driver->njobs--;
+        virCondBroadcast(&driver->jobsCond);
+        storageDriverUnlock();
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static virStorageVolPtr
 storageVolCreateXMLFrom(virStoragePoolPtr pool,
                         const char *xmldesc,
@@ -1952,12 +2278,17 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
     virStorageVolDefPtr shadowvol = NULL;
     virStorageVolPtr newvol = NULL;
     virStorageVolPtr vol = NULL;
-    int buildret;
+    virStorageVolJobDataPtr data = NULL;
+    bool async = !!(flags & VIR_STORAGE_VOL_CREATE_ASYNC);
+    int ret;
 
     virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA |
-                  VIR_STORAGE_VOL_CREATE_REFLINK,
+                  VIR_STORAGE_VOL_CREATE_REFLINK |
+                  VIR_STORAGE_VOL_CREATE_ASYNC,
                   NULL);
 
+    flags &= ~VIR_STORAGE_VOL_CREATE_ASYNC;
+
     storageDriverLock();
     obj = virStoragePoolObjFindByUUID(&driver->pools, pool->uuid);
     if (obj && STRNEQ(pool->name, volsrc->pool)) {
@@ -2061,6 +2392,12 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
     if (backend->createVol(pool->conn, obj, voldef) < 0)
         goto cleanup;
 
+    /* Progress of the copy is reported through the job, which is
+     * shared with the shadow copy handed to the backend */
+    if (!(voldef->job = virStorageVolJobNew(VIR_STORAGE_VOL_JOB_BUILD,
+                                            voldefsrc->target.capacity)))
+        goto cleanup;
+
     /* Make a shallow copy of the 'defined' volume definition, since the
      * original allocation value will change as the user polls 'info',
      * but we only need the initial requested values
@@ -2074,13 +2411,27 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
                                     voldef->key, NULL, NULL)))
         goto cleanup;
 
+    if (VIR_ALLOC(data) < 0)
+        goto cleanup;
+
     /* NB: Upon success voldef "owned" by storage pool for deletion purposes */
     if (virStoragePoolObjAddVol(obj, voldef) < 0)
         goto cleanup;
 
+    data->vol = virObjectRef(newvol);
+    data->obj = obj;
+    data->objsrc = objsrc;
+    data->backend = backend;
+    data->voldef = voldef;
+    data->shadowvol = shadowvol;
+    data->voldefsrc = voldefsrc;
+    data->flags = flags;
+    shadowvol = NULL;
+    voldef = NULL;
+
     /* Drop the pool lock during volume allocation */
     virStoragePoolObjIncrAsyncjobs(obj);
-    voldef->building = true;
+    data->voldef->building = true;
     voldefsrc->in_use++;
     virStoragePoolObjUnlock(obj);
 
@@ -2089,47 +2440,32 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
         virStoragePoolObjUnlock(objsrc);
     }
 
-    buildret = backend->buildVolFrom(pool->conn, obj, shadowvol, voldefsrc, flags);
-
-    storageDriverLock();
-    virStoragePoolObjLock(obj);
-    if (objsrc)
-        virStoragePoolObjLock(objsrc);
-    storageDriverUnlock();
-
-    voldefsrc->in_use--;
-    voldef->building = false;
-    virStoragePoolObjDecrAsyncjobs(obj);
-
-    if (objsrc) {
-        virStoragePoolObjDecrAsyncjobs(objsrc);
-        virStoragePoolObjUnlock(objsrc);
+    if (async && storageVolJobStart(data) == 0) {
+        /* the job thread owns @data and the pools from now on */
+        obj = NULL;
         objsrc = NULL;
-    }
-
-    if (buildret < 0 ||
-        (backend->refreshVol &&
-         backend->refreshVol(pool->conn, obj, voldef) < 0)) {
-        storageVolDeleteInternal(newvol, backend, obj, voldef, 0, false);
-        voldef = NULL;
+        data = NULL;
+        vol = newvol;
+        newvol = NULL;
         goto cleanup;
     }
 
-    /* Updating pool metadata ignoring the disk backend since
-     * it updates the pool values
-     */
-    if (def->type != VIR_STORAGE_POOL_DISK) {
-        def->allocation += voldef->target.allocation;
-        def->available -= voldef->target.allocation;
-    }
+    /* If the job thread could not be started, just clean up */
+    ret = storageVolCreateXMLFromRun(data, !async);
+    objsrc = data->objsrc;
+
+    if (ret < 0)
+        goto cleanup;
 
-    VIR_INFO("Creating volume '%s' in storage pool '%s'",
-             newvol->name, def->name);
     vol = newvol;
     newvol = NULL;
-    voldef = NULL;
 
  cleanup:
+    if (voldef) {
+        virStorageVolJobFree(voldef->job);
+        voldef->job = NULL;
+    }
+    storageVolJobDataFree(data);
     virObjectUnref(newvol);
     virStorageVolDefFree(voldef);
     VIR_FREE(shadowvol);
@@ -2153,7 +2489,8 @@ storageVolDownload(virStorageVolPtr vol,
     virStorageVolDefPtr voldef = NULL;
     int ret = -1;
 
-    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM |
+                  VIR_STORAGE_VOL_DOWNLOAD_NOCACHE, -1);
 
     if (!(voldef = virStorageVolDefFromVol(vol, &obj, &backend)))
         return -1;
@@ -2331,7 +2668,8 @@ storageVolUpload(virStorageVolPtr vol,
     virStorageVolStreamInfoPtr cbdata = NULL;
     int ret = -1;
 
-    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM |
+                  VIR_STORAGE_VOL_UPLOAD_NOCACHE, -1);
 
     if (!(voldef = virStorageVolDefFromVol(vol, &obj, &backend)))
         return -1;
@@ -2502,9 +2840,13 @@ storageVolWipePattern(virStorageVolPtr vol,
     virStorageBackendPtr backend;
     virStoragePoolObjPtr obj = NULL;
     virStorageVolDefPtr voldef = NULL;
+    virStorageVolJobDataPtr data = NULL;
+    bool async = !!(flags & VIR_STORAGE_VOL_WIPE_ASYNC);
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_WIPE_ASYNC, -1);
+
+    flags &= ~VIR_STORAGE_VOL_WIPE_ASYNC;
 
     if (algorithm >= VIR_STORAGE_VOL_WIPE_ALG_LAST) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -2541,20 +2883,45 @@ storageVolWipePattern(virStorageVolPtr vol,
         goto cleanup;
     }
 
-    if (backend->wipeVol(vol->conn, obj, voldef, algorithm, flags) < 0)
+    if (VIR_ALLOC(data) < 0 ||
+        !(voldef->job = virStorageVolJobNew(VIR_STORAGE_VOL_JOB_WIPE,
+                                            voldef->target.allocation)))
         goto cleanup;
 
-    /* Instead of using the refreshVol, since much changes on the target
-     * volume, let's update using the same function as refreshPool would
-     * use when it discovers a volume. The only failure to capture is -1,
-     * we can ignore -2. */
-    if (virStorageBackendRefreshVolTargetUpdate(voldef) == -1)
+    data->vol = virObjectRef(vol);
+    data->obj = obj;
+    data->backend = backend;
+    data->voldef = voldef;
+    data->algorithm = algorithm;
+    data->flags = flags;
+
+    /* Drop the pool lock while wiping, marking the volume as in use
+     * keeps it from being deleted or modified meanwhile */
+    virStoragePoolObjIncrAsyncjobs(obj);
+    voldef->in_use++;
+    virStoragePoolObjUnlock(obj);
+
+    if (async && storageVolJobStart(data) == 0) {
+        /* the job thread owns @data and the pool from now on */
+        data = NULL;
+        obj = NULL;
+        ret = 0;
         goto cleanup;
+    }
 
-    ret = 0;
+    if (async) {
+        /* the job thread could not be started, just undo */
+        storageVolJobRelock(data);
+        voldef->in_use--;
+        goto cleanup;
+    }
+
+    ret = storageVolWipeRun(data);
 
  cleanup:
-    virStoragePoolObjUnlock(obj);
+    storageVolJobDataFree(data);
+    if (obj)
+        virStoragePoolObjUnlock(obj);
 
     return ret;
 }
@@ -2567,6 +2934,41 @@ storageVolWipe(virStorageVolPtr vol,
 }
 
 
+static int
+storageVolGetJobInfo(virStorageVolPtr vol,
+                     virStorageVolJobInfoPtr info,
+                     unsigned int flags)
+{
+    virStoragePoolObjPtr obj;
+    virStorageBackendPtr backend;
+    virStorageVolDefPtr voldef;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(voldef = virStorageVolDefFromVol(vol, &obj, &backend)))
+        return -1;
+
+    if (virStorageVolGetJobInfoEnsureACL(vol->conn,
+                                         virStoragePoolObjGetDef(obj),
+                                         voldef) < 0)
+        goto cleanup;
+
+    memset(info, 0, sizeof(*info));
+    if (voldef->job) {
+        info->type = voldef->job->type;
+        virStorageVolJobGetProgress(voldef->job, &info->processed,
+                                    &info->total);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjUnlock(obj);
+    return ret;
+}
+
+
 static int
 storageVolGetInfoFlags(virStorageVolPtr vol,
                        virStorageVolInfoPtr info,
@@ -2778,6 +3180,7 @@ static virStorageDriver storageDriver = {
 
     .storagePoolIsActive = storagePoolIsActive, /* 0.7.3 */
     .storagePoolIsPersistent = storagePoolIsPersistent, /* 0.7.3 */
+    .storageVolGetJobInfo = storageVolGetJobInfo, /* 4.0.0 */
 };
 
 
@@ -31,6 +31,8 @@
 #include "virlog.h"
 #include "virstring.h"
 #include "virhash.h"
+#include "virthread.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -436,6 +438,157 @@ virStorageFileReportBrokenChain(int errcode,
 }
 
 
+/* Process wide cache of image headers read while traversing backing
+ * chains, keyed by device and inode of the image.  Base images are
+ * typically shared by many domains and never change while they are in
+ * use, so their headers need to be read only once.  The virStorageSource
+ * chain elements themselves are still per domain, since callers modify
+ * them freely; only the raw header bytes are shared.  Entries are
+ * validated against the size, mtime and ctime of the image on every
+ * lookup. */
+typedef struct _virStorageFileHeaderCacheEntry virStorageFileHeaderCacheEntry;
+typedef virStorageFileHeaderCacheEntry *virStorageFileHeaderCacheEntryPtr;
+struct _virStorageFileHeaderCacheEntry {
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    uid_t uid;            /* identity the header was read as */
+    gid_t gid;
+    char *buf;
+    ssize_t len;
+};
+
+/* Number of cached headers; each is at most VIR_STORAGE_MAX_HEADER bytes.
+ * The whole cache is dropped once it is full. */
+#define VIR_STORAGE_FILE_HEADER_CACHE_MAX 1024
+
+static virMutex virStorageFileHeaderCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageFileHeaderCache;
+
+
+static void
+virStorageFileHeaderCacheEntryFree(void *payload,
+                                   const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileHeaderCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->buf);
+    VIR_FREE(entry);
+}
+
+
+static bool
+virStorageFileHeaderCacheEntryMatch(virStorageFileHeaderCacheEntryPtr entry,
+                                    const struct stat *st)
+{
+    struct timespec mtime = get_stat_mtime(st);
+    struct timespec ctime = get_stat_ctime(st);
+
+    return entry->size == st->st_size &&
+        entry->mtime.tv_sec == mtime.tv_sec &&
+        entry->mtime.tv_nsec == mtime.tv_nsec &&
+        entry->ctime.tv_sec == ctime.tv_sec &&
+        entry->ctime.tv_nsec == ctime.tv_nsec;
+}
+
+
+/*
+ * Reads the header of @src like virStorageFileRead, but serves regular
+ * local files from the header cache when they did not change since they
+ * were last read.
+ */
+static ssize_t
+virStorageFileReadHeader(virStorageSourcePtr src,
+                         char **buf)
+{
+    struct stat st;
+    char *key = NULL;
+    virStorageFileHeaderCacheEntryPtr entry;
+    virStorageFileHeaderCacheEntryPtr newent = NULL;
+    bool recheck = false;
+    ssize_t ret = -1;
+
+    if (!virStorageSourceIsLocalStorage(src) ||
+        virStorageFileStat(src, &st) < 0 ||
+        !S_ISREG(st.st_mode))
+        return virStorageFileRead(src, 0, VIR_STORAGE_MAX_HEADER, buf);
+
+    if (virAsprintf(&key, "%llu:%llu",
+                    (unsigned long long) st.st_dev,
+                    (unsigned long long) st.st_ino) < 0)
+        return -1;
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if ((entry = virHashLookup(virStorageFileHeaderCache, key)) &&
+        virStorageFileHeaderCacheEntryMatch(entry, &st)) {
+        if (VIR_ALLOC_N(*buf, entry->len) < 0) {
+            virMutexUnlock(&virStorageFileHeaderCacheLock);
+            goto cleanup;
+        }
+        memcpy(*buf, entry->buf, entry->len);
+        ret = entry->len;
+        recheck = entry->uid != src->drv->uid || entry->gid != src->drv->gid;
+    }
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+    if (ret >= 0) {
+        VIR_DEBUG("using cached header of '%s'", src->path);
+
+        /* the header may have been read by a more privileged user */
+        if (recheck && virStorageFileAccess(src, R_OK) < 0) {
+            virReportSystemError(errno, _("cannot read header of '%s'"),
+                                 src->path);
+            VIR_FREE(*buf);
+            ret = -1;
+        }
+        goto cleanup;
+    }
+
+    if ((ret = virStorageFileRead(src, 0, VIR_STORAGE_MAX_HEADER, buf)) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(newent) < 0 ||
+        VIR_ALLOC_N(newent->buf, ret) < 0) {
+        /* the cache is just an optimization */
+        virResetLastError();
+        goto cleanup;
+    }
+    memcpy(newent->buf, *buf, ret);
+    newent->len = ret;
+    newent->size = st.st_size;
+    newent->mtime = get_stat_mtime(&st);
+    newent->ctime = get_stat_ctime(&st);
+    newent->uid = src->drv->uid;
+    newent->gid = src->drv->gid;
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if (!virStorageFileHeaderCache &&
+        !(virStorageFileHeaderCache =
+          virHashCreate(VIR_STORAGE_FILE_HEADER_CACHE_MAX,
+                        virStorageFileHeaderCacheEntryFree))) {
+        virMutexUnlock(&virStorageFileHeaderCacheLock);
+        virResetLastError();
+        goto cleanup;
+    }
+    if (virHashSize(virStorageFileHeaderCache) >=
+        VIR_STORAGE_FILE_HEADER_CACHE_MAX)
+        virHashRemoveAll(virStorageFileHeaderCache);
+    if (virHashUpdateEntry(virStorageFileHeaderCache, key, newent) == 0)
+        newent = NULL;
+    else
+        virResetLastError();
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+ cleanup:
+    virStorageFileHeaderCacheEntryFree(newent, NULL);
+    VIR_FREE(key);
+    return ret;
+}
+
+
 /* Recursive workhorse for virStorageFileGetMetadata.  */
 static int
 virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
@@ -482,8 +635,7 @@ virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
     if (virHashAddEntry(cycle, uniqueName, (void *)1) < 0)
         goto cleanup;
 
-    if ((headerLen = virStorageFileRead(src, 0, VIR_STORAGE_MAX_HEADER,
-                                        &buf)) < 0)
+    if ((headerLen = virStorageFileReadHeader(src, &buf)) < 0)
         goto cleanup;
 
     if (virStorageFileGetMetadataInternal(src, buf, headerLen,
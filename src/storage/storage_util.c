@@ -66,6 +66,7 @@
 #include "virqemu.h"
 #include "stat-time.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virxml.h"
 #include "virfdstream.h"
 
@@ -77,25 +78,199 @@ VIR_LOG_INIT("storage.storage_util");
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Perform the O(1) reflink clone operation, if possible. FICLONE is the
+ * generic name of the btrfs clone ioctl and is also implemented by XFS
+ * and other copy-on-write file systems.
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
+#if defined(FICLONE)
 static inline int
-btrfsCloneFile(int dest_fd, int src_fd)
+reflinkCloneFile(int dest_fd, int src_fd)
+{
+    return ioctl(dest_fd, FICLONE, src_fd);
+}
+#elif HAVE_LINUX_BTRFS_H
+static inline int
+reflinkCloneFile(int dest_fd, int src_fd)
 {
     return ioctl(dest_fd, BTRFS_IOC_CLONE, src_fd);
 }
 #else
 static inline int
-btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
-               int src_fd ATTRIBUTE_UNUSED)
+reflinkCloneFile(int dest_fd ATTRIBUTE_UNUSED,
+                 int src_fd ATTRIBUTE_UNUSED)
 {
     errno = ENOTSUP;
     return -1;
 }
 #endif
 
+
+/*
+ * Copy @len bytes at @offset of @inputfd to the same offset of @fd.
+ * copy_file_range() is used as long as the kernel supports it for the
+ * pair of files, which lets the file system share extents or, on NFS
+ * 4.2, have the server do the copy. Otherwise the data is read into
+ * @buf of @buflen bytes and written out.
+ *
+ * Returns 0 on success, -errno on failure with error reported.
+ */
+static int
+storageBackendCopyRange(virStorageVolDefPtr vol,
+                        virStorageVolDefPtr inputvol,
+                        int inputfd,
+                        int fd,
+                        off_t offset,
+                        off_t len,
+                        bool *try_copy_range,
+                        char *buf,
+                        size_t buflen)
+{
+    ssize_t amt;
+
+    while (len > 0) {
+#if HAVE_COPY_FILE_RANGE
+        if (*try_copy_range) {
+            loff_t inoff = offset;
+            loff_t outoff = offset;
+
+            if ((amt = copy_file_range(inputfd, &inoff, fd, &outoff,
+                                       len, 0)) > 0) {
+                offset += amt;
+                len -= amt;
+                virStorageVolJobAddProgress(vol->job, amt);
+                continue;
+            }
+
+            if (amt == 0)
+                return 0;
+
+            if (errno != ENOSYS && errno != EXDEV &&
+                errno != EINVAL && errno != EOPNOTSUPP) {
+                virReportSystemError(errno,
+                                     _("failed to copy data from '%s' to '%s'"),
+                                     inputvol->target.path, vol->target.path);
+                return -errno;
+            }
+
+            VIR_DEBUG("copy_file_range not usable for '%s', errno=%d",
+                      vol->target.path, errno);
+            *try_copy_range = false;
+        }
+#else
+        *try_copy_range = false;
+#endif
+
+        if (lseek(inputfd, offset, SEEK_SET) < 0 ||
+            (amt = saferead(inputfd, buf, MIN(len, buflen))) < 0) {
+            virReportSystemError(errno,
+                                 _("failed reading from file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        if (amt == 0)
+            return 0;
+
+        if (lseek(fd, offset, SEEK_SET) < 0 ||
+            safewrite(fd, buf, amt) < 0) {
+            virReportSystemError(errno,
+                                 _("failed writing to file '%s'"),
+                                 vol->target.path);
+            return -errno;
+        }
+
+        offset += amt;
+        len -= amt;
+        virStorageVolJobAddProgress(vol->job, amt);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Copy the first *@total bytes of @inputfd into @fd (which must already
+ * be sized and read back as zeroes) walking only the data regions of
+ * @inputfd, so holes stay holes and are never read.
+ *
+ * Returns 0 on success, 1 if @inputfd can not be walked this way and
+ * the caller has to copy it block by block, -errno on failure with
+ * error reported.
+ */
+static int
+storageBackendCopySparse(virStorageVolDefPtr vol,
+                         virStorageVolDefPtr inputvol,
+                         int inputfd,
+                         int fd,
+                         unsigned long long *total,
+                         char *buf,
+                         size_t buflen)
+{
+#ifdef SEEK_DATA
+    struct stat st;
+    bool try_copy_range = true;
+    off_t end;
+    off_t pos = 0;
+    off_t data;
+    off_t hole;
+    int ret;
+
+    if (fstat(inputfd, &st) < 0 || !S_ISREG(st.st_mode))
+        return 1;
+
+    end = st.st_size;
+    if (*total < (unsigned long long) end)
+        end = *total;
+
+    while (pos < end) {
+        if ((data = lseek(inputfd, pos, SEEK_DATA)) < 0) {
+            /* ENXIO means there is no data past @pos */
+            if (errno == ENXIO)
+                break;
+            if (pos == 0 && (errno == EINVAL || errno == EOPNOTSUPP))
+                return 1;
+            virReportSystemError(errno,
+                                 _("unable to seek in file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        if (data >= end)
+            break;
+
+        if ((hole = lseek(inputfd, data, SEEK_HOLE)) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to seek in file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        if (hole > end)
+            hole = end;
+
+        /* skipped holes count as copied */
+        virStorageVolJobAddProgress(vol->job, data - pos);
+
+        if ((ret = storageBackendCopyRange(vol, inputvol, inputfd, fd,
+                                           data, hole - data,
+                                           &try_copy_range,
+                                           buf, buflen)) < 0)
+            return ret;
+
+        pos = hole;
+    }
+
+    if (pos < end)
+        virStorageVolJobAddProgress(vol->job, end - pos);
+
+    *total -= end;
+    return 0;
+#else /* !SEEK_DATA */
+    return 1;
+#endif /* !SEEK_DATA */
+}
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -142,18 +317,33 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     }
 
     if (reflink_copy) {
-        if (btrfsCloneFile(fd, inputfd) < 0) {
+        if (reflinkCloneFile(fd, inputfd) < 0) {
             ret = -errno;
             virReportSystemError(errno,
                                  _("failed to clone files from '%s'"),
                                  inputvol->target.path);
             goto cleanup;
         } else {
-            VIR_DEBUG("btrfs clone finished.");
+            VIR_DEBUG("reflink clone finished.");
             goto cleanup;
         }
     }
 
+    /* When zero blocks may be skipped, copy only the data regions of
+     * the input and let the kernel do the copying where it can */
+    if (want_sparse) {
+        int rc;
+
+        if ((rc = storageBackendCopySparse(vol, inputvol, inputfd, fd, total,
+                                           buf, rbytes)) < 0) {
+            ret = rc;
+            goto cleanup;
+        }
+
+        if (rc == 0)
+            amtread = 0;
+    }
+
     while (amtread != 0) {
         int amtleft;
 
@@ -168,6 +358,7 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
             goto cleanup;
         }
         *total -= amtread;
+        virStorageVolJobAddProgress(vol->job, amtread);
 
         /* Loop over amt read in 512 byte increments, looking for sparse
          * blocks */
@@ -2529,8 +2720,10 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     int ret = -1;
     int has_snap = 0;
     bool sparse = flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
+    bool nocache = flags & VIR_STORAGE_VOL_UPLOAD_NOCACHE;
 
-    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM |
+                  VIR_STORAGE_VOL_UPLOAD_NOCACHE, -1);
     /* if volume has target format VIR_STORAGE_FILE_PLOOP
      * we need to restore DiskDescriptor.xml, according to
      * new contents of volume. This operation will be perfomed
@@ -2555,7 +2748,7 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     /* Not using O_CREAT because the file is required to already exist at
      * this point */
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, sparse, O_WRONLY);
+                                     offset, len, sparse, nocache, O_WRONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2576,8 +2769,10 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     int ret = -1;
     int has_snap = 0;
     bool sparse = flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
+    bool nocache = flags & VIR_STORAGE_VOL_DOWNLOAD_NOCACHE;
 
-    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM |
+                  VIR_STORAGE_VOL_DOWNLOAD_NOCACHE, -1);
     if (vol->target.format == VIR_STORAGE_FILE_PLOOP) {
         has_snap = storageBackendPloopHasSnapshots(vol->target.path);
         if (has_snap < 0) {
@@ -2594,7 +2789,7 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, sparse, O_RDONLY);
+                                     offset, len, sparse, nocache, O_RDONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2641,30 +2836,183 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
+/*
+ * Ask the kernel to zero (or with @discard, to discard) @len bytes of
+ * @fd starting at @offset without transferring any data: BLKZEROOUT
+ * and BLKDISCARD for block devices, fallocate() for regular files.
+ *
+ * Returns 0 on success, 1 if neither the kernel nor the underlying
+ * storage support the operation, so that the caller can fall back to
+ * writing the data, or -1 on failure with error message set.
+ */
+static int
+storageBackendWipeOffload(const char *path,
+                          int fd,
+                          const struct stat *st,
+                          off_t offset,
+                          unsigned long long len,
+                          bool discard,
+                          virStorageVolJobPtr job)
+{
+#ifdef __linux__
+    char ebuf[1024];
+    int rc = -1;
+
+    if (len == 0)
+        return 0;
+
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2] = { offset, len };
+
+        if (discard) {
+# ifdef BLKDISCARD
+            rc = ioctl(fd, BLKDISCARD, range);
+# else
+            errno = ENOTTY;
+# endif
+        } else {
+# ifdef BLKZEROOUT
+            rc = ioctl(fd, BLKZEROOUT, range);
+# else
+            errno = ENOTTY;
+# endif
+        }
+    } else if (S_ISREG(st->st_mode)) {
+# if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+        if (discard) {
+            rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                           offset, len);
+        } else {
+            /* Prefer keeping the blocks allocated, but a punched hole
+             * reads back as zeroes just as well. */
+#  ifdef FALLOC_FL_ZERO_RANGE
+            rc = fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, len);
+            if (rc < 0 && errno == EOPNOTSUPP)
+#  endif
+                rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                               offset, len);
+        }
+# else
+        errno = EOPNOTSUPP;
+# endif
+    } else {
+        errno = ENOTSUP;
+    }
+
+    if (rc == 0) {
+        virStorageVolJobAddProgress(job, len);
+        VIR_DEBUG("%s %llu bytes at %llu of volume with path '%s'",
+                  discard ? "Discarded" : "Zeroed out", len,
+                  (unsigned long long) offset, path);
+        return 0;
+    }
+
+    if (errno == EOPNOTSUPP || errno == ENOTSUP || errno == ENOTTY ||
+        errno == EINVAL || errno == ENOSYS) {
+        VIR_DEBUG("Offloaded %s not supported for volume with path '%s': %s",
+                  discard ? "discard" : "zeroing", path,
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+        return 1;
+    }
+
+    virReportSystemError(errno,
+                         discard ?
+                         _("Failed to discard %llu bytes of storage volume "
+                           "with path '%s'") :
+                         _("Failed to zero out %llu bytes of storage volume "
+                           "with path '%s'"),
+                         len, path);
+    return -1;
+#else /* !__linux__ */
+    return 1;
+#endif /* !__linux__ */
+}
+
+
+/* Wipes of at least this many bytes which cannot be offloaded are split
+ * among several threads writing disjoint parts of the volume. */
+#define VIR_STORAGE_BACKEND_WIPE_THREAD_MIN (256ULL * 1024 * 1024)
+
+/* Upper bound on threads writing a single volume. Enough to keep the
+ * queue of a fast device busy; more only adds seeking on slow ones. */
+#define VIR_STORAGE_BACKEND_WIPE_THREADS 4
+
+typedef struct _virStorageBackendWipeChunk virStorageBackendWipeChunk;
+typedef virStorageBackendWipeChunk *virStorageBackendWipeChunkPtr;
+struct _virStorageBackendWipeChunk {
+    const char *path;
+    int fd;
+    const char *writebuf;  /* zeroed, shared by all chunks */
+    size_t writebuf_length;
+    off_t offset;
+    unsigned long long len;
+    virStorageVolJobPtr job;
+    int err;               /* result of the wipe */
+    virErrorPtr error;     /* error raised by the wipe, if any */
+};
+
+
+static void
+storageBackendWipeChunk(void *opaque)
+{
+    virStorageBackendWipeChunkPtr chunk = opaque;
+    unsigned long long remaining = chunk->len;
+    off_t offset = chunk->offset;
+
+    chunk->err = 0;
+
+    while (remaining > 0) {
+        size_t write_size = MIN(chunk->writebuf_length, remaining);
+        ssize_t written = pwrite(chunk->fd, chunk->writebuf,
+                                 write_size, offset);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0) {
+            virReportSystemError(written < 0 ? errno : ENOSPC,
+                                 _("Failed to write %zu bytes to "
+                                   "storage volume with path '%s'"),
+                                 write_size, chunk->path);
+            /* Errors are thread local, keep them for the joining thread */
+            chunk->err = -1;
+            chunk->error = virSaveLastError();
+            virResetLastError();
+            return;
+        }
+
+        remaining -= written;
+        offset += written;
+        virStorageVolJobAddProgress(chunk->job, written);
+    }
+
+    VIR_DEBUG("Wrote %llu bytes at %llu to volume with path '%s'",
+              chunk->len, (unsigned long long) chunk->offset, chunk->path);
+}
+
+
 static int
 storageBackendWipeLocal(const char *path,
                         int fd,
+                        const struct stat *st,
                         unsigned long long wipe_len,
-                        size_t writebuf_length,
-                        bool zero_end)
+                        bool zero_end,
+                        virStorageVolJobPtr job)
 {
-    int ret = -1, written = 0;
-    unsigned long long remaining = 0;
+    int ret = -1;
     off_t size;
-    size_t write_size = 0;
     char *writebuf = NULL;
-
-    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
-        goto cleanup;
+    size_t writebuf_length = MAX(st->st_blksize, 1024 * 1024);
+    virStorageBackendWipeChunk chunks[VIR_STORAGE_BACKEND_WIPE_THREADS];
+    virThread threads[VIR_STORAGE_BACKEND_WIPE_THREADS - 1];
+    size_t nchunks = 1;
+    size_t nthreads;
+    unsigned long long chunk_len;
+    size_t i;
+    int rc;
 
     if (!zero_end) {
-        if ((size = lseek(fd, 0, SEEK_SET)) < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to seek to the start in volume "
-                                   "with path '%s'"),
-                                 path);
-            goto cleanup;
-        }
+        size = 0;
     } else {
         if ((size = lseek(fd, -wipe_len, SEEK_END)) < 0) {
             virReportSystemError(errno,
@@ -2677,21 +3025,62 @@ storageBackendWipeLocal(const char *path,
 
     VIR_DEBUG("wiping start: %zd len: %llu", (ssize_t) size, wipe_len);
 
-    remaining = wipe_len;
-    while (remaining > 0) {
+    if ((rc = storageBackendWipeOffload(path, fd, st, size,
+                                        wipe_len, false, job)) <= 0) {
+        ret = rc;
+        goto cleanup;
+    }
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, path);
+    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
+        goto cleanup;
 
-            goto cleanup;
+    if (wipe_len >= VIR_STORAGE_BACKEND_WIPE_THREAD_MIN)
+        nchunks = VIR_STORAGE_BACKEND_WIPE_THREADS;
+
+    /* Keep every chunk boundary aligned to the buffer size */
+    chunk_len = VIR_DIV_UP(wipe_len, nchunks);
+    chunk_len = VIR_ROUND_UP(chunk_len, writebuf_length);
+
+    memset(chunks, 0, sizeof(chunks));
+    for (i = 0; i < nchunks; i++) {
+        unsigned long long start = MIN(i * chunk_len, wipe_len);
+
+        chunks[i].path = path;
+        chunks[i].fd = fd;
+        chunks[i].writebuf = writebuf;
+        chunks[i].writebuf_length = writebuf_length;
+        chunks[i].offset = size + start;
+        chunks[i].len = MIN(chunk_len, wipe_len - start);
+        chunks[i].job = job;
+        chunks[i].err = -1;
+    }
+
+    /* The calling thread wipes the first chunk itself */
+    for (nthreads = 0; nthreads < nchunks - 1; nthreads++) {
+        if (virThreadCreate(&threads[nthreads], true, storageBackendWipeChunk,
+                            &chunks[nthreads + 1]) < 0) {
+            VIR_WARN("Failed to create volume wiping thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
         }
+    }
 
-        remaining -= written;
+    storageBackendWipeChunk(&chunks[0]);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    /* Chunks no thread could be created for are done here */
+    for (i = nthreads + 1; i < nchunks; i++)
+        storageBackendWipeChunk(&chunks[i]);
+
+    for (i = 0; i < nchunks; i++) {
+        if (chunks[i].err < 0) {
+            if (chunks[i].error)
+                virSetError(chunks[i].error);
+            goto cleanup;
+        }
     }
 
     if (fdatasync(fd) < 0) {
@@ -2706,6 +3095,8 @@ storageBackendWipeLocal(const char *path,
     ret = 0;
 
  cleanup:
+    for (i = 0; i < nchunks; i++)
+        virFreeError(chunks[i].error);
     VIR_FREE(writebuf);
     return ret;
 }
@@ -2715,7 +3106,8 @@ static int
 storageBackendVolWipeLocalFile(const char *path,
                                unsigned int algorithm,
                                unsigned long long allocation,
-                               bool zero_end)
+                               bool zero_end,
+                               virStorageVolJobPtr job)
 {
     int ret = -1, fd = -1;
     const char *alg_char = NULL;
@@ -2766,9 +3158,8 @@ storageBackendVolWipeLocalFile(const char *path,
         alg_char = "random";
         break;
     case VIR_STORAGE_VOL_WIPE_ALG_TRIM:
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
-                       _("'trim' algorithm not supported"));
-        goto cleanup;
+        alg_char = "trim";
+        break;
     case VIR_STORAGE_VOL_WIPE_ALG_LAST:
         virReportError(VIR_ERR_INVALID_ARG,
                        _("unsupported algorithm %d"),
@@ -2778,7 +3169,17 @@ storageBackendVolWipeLocalFile(const char *path,
 
     VIR_DEBUG("Wiping file '%s' with algorithm '%s'", path, alg_char);
 
-    if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
+    if (algorithm == VIR_STORAGE_VOL_WIPE_ALG_TRIM) {
+        if ((ret = storageBackendWipeOffload(path, fd, &st, 0, allocation,
+                                             true, job)) > 0) {
+            virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                           _("'trim' algorithm not supported for "
+                             "volume with path '%s'"), path);
+            ret = -1;
+        }
+        if (ret < 0)
+            goto cleanup;
+    } else if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
         cmd = virCommandNew(SCRUB);
         virCommandAddArgList(cmd, "-f", "-p", alg_char, path, NULL);
 
@@ -2790,8 +3191,8 @@ storageBackendVolWipeLocalFile(const char *path,
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
         } else {
-            ret = storageBackendWipeLocal(path, fd, allocation, st.st_blksize,
-                                          zero_end);
+            ret = storageBackendWipeLocal(path, fd, &st, allocation,
+                                          zero_end, job);
         }
         if (ret < 0)
             goto cleanup;
@@ -2829,7 +3230,8 @@ storageBackendVolWipePloop(virStorageVolDefPtr vol,
         goto cleanup;
 
     if (storageBackendVolWipeLocalFile(target_path, algorithm,
-                                       vol->target.allocation, false) < 0)
+                                       vol->target.allocation, false,
+                                       vol->job) < 0)
         goto cleanup;
 
     if (virFileRemove(disk_desc, 0, 0) < 0) {
@@ -2878,7 +3280,8 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         ret = storageBackendVolWipePloop(vol, algorithm);
     } else {
         ret = storageBackendVolWipeLocalFile(vol->target.path, algorithm,
-                                             vol->target.allocation, false);
+                                             vol->target.allocation, false,
+                                             vol->job);
     }
 
     return ret;
@@ -3698,9 +4101,139 @@ virStorageBackendRefreshVolTargetUpdate(virStorageVolDefPtr vol)
 }
 
 
+static void
+virStorageBackendVolFingerprintFill(virStorageVolFingerprintPtr fp,
+                                    const struct stat *sb)
+{
+    fp->valid = true;
+    fp->dev = sb->st_dev;
+    fp->ino = sb->st_ino;
+    fp->size = sb->st_size;
+    fp->mtime = get_stat_mtime(sb);
+    fp->ctime = get_stat_ctime(sb);
+}
+
+
+static bool
+virStorageBackendVolFingerprintMatch(const virStorageVolFingerprint *fp,
+                                     const struct stat *sb)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+    struct timespec ctime = get_stat_ctime(sb);
+
+    return fp->valid &&
+        fp->dev == sb->st_dev &&
+        fp->ino == sb->st_ino &&
+        fp->size == sb->st_size &&
+        fp->mtime.tv_sec == mtime.tv_sec &&
+        fp->mtime.tv_nsec == mtime.tv_nsec &&
+        fp->ctime.tv_sec == ctime.tv_sec &&
+        fp->ctime.tv_nsec == ctime.tv_nsec;
+}
+
+
+/* Upper bound on threads probing volumes during a single refresh. Probing
+ * is bound by file system latency rather than CPU, so this does not
+ * depend on the number of host CPUs. */
+#define VIR_STORAGE_BACKEND_REFRESH_THREADS 8
+
+typedef struct _virStorageBackendRefreshEntry virStorageBackendRefreshEntry;
+typedef virStorageBackendRefreshEntry *virStorageBackendRefreshEntryPtr;
+struct _virStorageBackendRefreshEntry {
+    virStorageVolDefPtr vol;
+    bool probe;           /* vol still needs to be probed */
+    bool have_sb;
+    struct stat sb;       /* file identity before probing */
+    int err;              /* result of the probe */
+    virErrorPtr error;    /* error raised by the probe, if any */
+};
+
+typedef struct _virStorageBackendRefreshData virStorageBackendRefreshData;
+typedef virStorageBackendRefreshData *virStorageBackendRefreshDataPtr;
+struct _virStorageBackendRefreshData {
+    virMutex lock;
+    size_t next;
+    size_t nentries;
+    virStorageBackendRefreshEntryPtr entries;
+};
+
+
+static void
+virStorageBackendRefreshWorker(void *opaque)
+{
+    virStorageBackendRefreshDataPtr data = opaque;
+    virStorageBackendRefreshEntryPtr entry;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->next == data->nentries) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        entry = &data->entries[data->next++];
+        virMutexUnlock(&data->lock);
+
+        if (!entry->probe)
+            continue;
+
+        /* Errors are thread local, keep them for the merging thread */
+        if ((entry->err = virStorageBackendRefreshVolTargetUpdate(entry->vol)) == -1)
+            entry->error = virSaveLastError();
+        virResetLastError();
+    }
+}
+
+
+/*
+ * Probes all entries of @data that need it using up to
+ * VIR_STORAGE_BACKEND_REFRESH_THREADS threads. The calling thread
+ * takes part in probing too, so this works even if no thread can be
+ * spawned.
+ */
+static void
+virStorageBackendRefreshProbeAll(virStorageBackendRefreshDataPtr data,
+                                 size_t nprobe)
+{
+    virThread threads[VIR_STORAGE_BACKEND_REFRESH_THREADS - 1];
+    size_t nthreads = VIR_STORAGE_BACKEND_REFRESH_THREADS;
+    size_t i;
+
+    if (nprobe < nthreads)
+        nthreads = nprobe;
+
+    /* account for the calling thread */
+    if (nthreads > 0)
+        nthreads--;
+
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            virStorageBackendRefreshWorker, data) < 0) {
+            VIR_WARN("Failed to create volume probing thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
+        }
+    }
+    nthreads = i;
+
+    virStorageBackendRefreshWorker(data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+}
+
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * If the volumes were stashed by an incremental refresh, a volume whose
+ * file still has the same device, inode, size, mtime and ctime as when
+ * it was last probed is taken back as is; only new or changed files are
+ * opened and probed.
+ *
+ * Files are probed by a small pool of threads and the resulting volumes
+ * are added to the pool in directory order once all probes finished.
  */
 int
 virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
@@ -3711,16 +4244,28 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     struct dirent *ent;
     struct statvfs sb;
     struct stat statbuf;
+    virStorageBackendRefreshData data;
+    virStorageBackendRefreshEntryPtr entry;
     virStorageVolDefPtr vol = NULL;
+    virStorageVolDefPtr stashed;
     virStorageSourcePtr target = NULL;
+    size_t nprobe = 0;
+    size_t i;
     int direrr;
     int fd = -1, ret = -1;
 
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
     if (virDirOpen(&dir, def->target.path) < 0)
         goto cleanup;
 
     while ((direrr = virDirRead(dir, &ent, def->target.path)) > 0) {
-        int err;
+        virStorageBackendRefreshEntry newent;
 
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file with control characters under '%s'",
@@ -3742,25 +4287,62 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (VIR_STRDUP(vol->key, vol->target.path) < 0)
             goto cleanup;
 
-        if ((err = virStorageBackendRefreshVolTargetUpdate(vol)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
+        memset(&newent, 0, sizeof(newent));
+        newent.have_sb = stat(vol->target.path, &newent.sb) == 0;
+        newent.probe = true;
+
+        if ((stashed = virStoragePoolObjTakeStashedVol(pool, vol->name))) {
+            if (newent.have_sb &&
+                virStorageBackendVolFingerprintMatch(&stashed->fingerprint,
+                                                     &newent.sb)) {
                 virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
+                vol = stashed;
+                newent.probe = false;
+            } else {
+                virStorageVolDefFree(stashed);
             }
-            goto cleanup;
         }
 
-        if (virStoragePoolObjAddVol(pool, vol) < 0)
+        newent.vol = vol;
+        if (VIR_APPEND_ELEMENT(data.entries, data.nentries, newent) < 0)
             goto cleanup;
         vol = NULL;
+
+        if (newent.probe)
+            nprobe++;
     }
     if (direrr < 0)
         goto cleanup;
     VIR_DIR_CLOSE(dir);
 
+    virStorageBackendRefreshProbeAll(&data, nprobe);
+
+    for (i = 0; i < data.nentries; i++) {
+        entry = &data.entries[i];
+
+        if (entry->probe) {
+            if (entry->err == -2) {
+                /* Silently ignore non-regular files,
+                 * eg 'lost+found', dangling symbolic link */
+                continue;
+            } else if (entry->err < 0) {
+                virSetError(entry->error);
+                goto cleanup;
+            }
+
+            /* Remember what the file looked like before it was probed so
+             * that any change made while probing forces a reprobe next
+             * time */
+            if (entry->have_sb)
+                virStorageBackendVolFingerprintFill(&entry->vol->fingerprint,
+                                                    &entry->sb);
+        }
+
+        if (virStoragePoolObjAddVol(pool, entry->vol) < 0)
+            goto cleanup;
+        entry->vol = NULL;
+    }
+
     if (VIR_ALLOC(target))
         goto cleanup;
 
@@ -3807,6 +4389,12 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     VIR_DIR_CLOSE(dir);
     VIR_FORCE_CLOSE(fd);
     virStorageVolDefFree(vol);
+    for (i = 0; i < data.nentries; i++) {
+        virStorageVolDefFree(data.entries[i].vol);
+        virFreeError(data.entries[i].error);
+    }
+    VIR_FREE(data.entries);
+    virMutexDestroy(&data.lock);
     virStorageSourceFree(target);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
@@ -4213,6 +4801,51 @@ processLU(virStoragePoolObjPtr pool,
 }
 
 
+int
+virStorageBackendSCSITriggerRescan(uint32_t host)
+{
+    int fd = -1;
+    int retval = 0;
+    char *path;
+
+    VIR_DEBUG("Triggering rescan of host %d", host);
+
+    if (virAsprintf(&path, "%s/host%u/scan",
+                    LINUX_SYSFS_SCSI_HOST_PREFIX, host) < 0) {
+        retval = -1;
+        goto out;
+    }
+
+    VIR_DEBUG("Scan trigger path is '%s'", path);
+
+    fd = open(path, O_WRONLY);
+
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             _("Could not open '%s' to trigger host scan"),
+                             path);
+        retval = -1;
+        goto free_path;
+    }
+
+    if (safewrite(fd,
+                  LINUX_SYSFS_SCSI_HOST_SCAN_STRING,
+                  sizeof(LINUX_SYSFS_SCSI_HOST_SCAN_STRING)) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        virReportSystemError(errno,
+                             _("Write to '%s' to trigger host scan failed"),
+                             path);
+        retval = -1;
+    }
+
+    VIR_FORCE_CLOSE(fd);
+ free_path:
+    VIR_FREE(path);
+ out:
+    VIR_DEBUG("Rescan of host %d complete", host);
+    return retval;
+}
+
 int
 virStorageBackendSCSIFindLUs(virStoragePoolObjPtr pool,
                               uint32_t scanhost)
@@ -4279,9 +4912,9 @@ virStorageBackendZeroPartitionTable(const char *path,
                                     unsigned long long size)
 {
     if (storageBackendVolWipeLocalFile(path, VIR_STORAGE_VOL_WIPE_ALG_ZERO,
-                                       size, false) < 0)
+                                       size, false, NULL) < 0)
         return -1;
 
     return storageBackendVolWipeLocalFile(path, VIR_STORAGE_VOL_WIPE_ALG_ZERO,
-                                          size, true);
+                                          size, true, NULL);
 }
@@ -67,6 +67,7 @@
 #include "virdomainobjlist.h"
 #include "virinterfaceobj.h"
 #include "virhostcpu.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_TEST
 
@@ -93,6 +94,27 @@ struct _testAuth {
 typedef struct _testAuth testAuth;
 typedef struct _testAuth *testAuthPtr;
 
+/* Classes of API calls which can be given an artificial latency */
+typedef enum {
+    TEST_LATENCY_LOOKUP,
+    TEST_LATENCY_QUERY,
+    TEST_LATENCY_LIST,
+    TEST_LATENCY_LIFECYCLE,
+    TEST_LATENCY_CONFIG,
+    TEST_LATENCY_STATS,
+
+    TEST_LATENCY_LAST
+} testLatency;
+
+VIR_ENUM_DECL(testLatency)
+VIR_ENUM_IMPL(testLatency, TEST_LATENCY_LAST,
+              "lookup",
+              "query",
+              "list",
+              "lifecycle",
+              "config",
+              "stats");
+
 struct _testDriver {
     virMutex lock;
 
@@ -110,6 +132,9 @@ struct _testDriver {
     /* virAtomic access only */
     volatile int nextDomID;
 
+    /* immutable after open, in microseconds */
+    unsigned long long latency[TEST_LATENCY_LAST];
+
     /* immutable pointer, immutable object after being initialized with
      * testBuildCapabilities */
     virCapsPtr caps;
@@ -588,6 +613,16 @@ testDomObjFromDomain(virDomainPtr domain)
     return vm;
 }
 
+/* Make an API call of class @op take as long as configured by the
+ * <synthetic> element of a custom driver file. */
+static void
+testDriverSimulateLatency(testDriverPtr driver,
+                          testLatency op)
+{
+    if (driver->latency[op] > 0)
+        usleep(driver->latency[op]);
+}
+
 static char *
 testDomainGenerateIfname(virDomainDefPtr domdef)
 {
@@ -950,6 +985,129 @@ testParseDomains(testDriverPtr privconn,
 }
 
 
+/* Parses the optional <synthetic> element which allows a custom driver
+ * file to describe large numbers of domains and per API latencies
+ * without spelling out every single domain:
+ *
+ *   <synthetic>
+ *     <domains count='5000' running='2500' vcpus='2' memory='524288'/>
+ *     <latency type='lookup' usecs='100'/>
+ *   </synthetic>
+ */
+static int
+testParseSynthetic(testDriverPtr privconn,
+                   xmlXPathContextPtr ctxt)
+{
+    int num, ret = -1;
+    size_t i;
+    xmlNodePtr *nodes = NULL;
+    char *type = NULL;
+    char *usecs = NULL;
+    char *xml = NULL;
+    unsigned int count = 0;
+    unsigned int running = 0;
+    unsigned int vcpus = 1;
+    unsigned long long memory = 1024 * 1024;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr obj;
+
+    if ((num = virXPathNodeSet("/node/synthetic/latency", ctxt, &nodes)) < 0)
+        goto error;
+
+    for (i = 0; i < num; i++) {
+        int op;
+
+        type = virXMLPropString(nodes[i], "type");
+        if (!type || (op = testLatencyTypeFromString(type)) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("unknown latency type '%s'"), NULLSTR(type));
+            goto error;
+        }
+
+        usecs = virXMLPropString(nodes[i], "usecs");
+        if (!usecs ||
+            virStrToLong_ullp(usecs, NULL, 10, &privconn->latency[op]) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid usecs of latency type '%s'"), type);
+            goto error;
+        }
+
+        VIR_FREE(usecs);
+        VIR_FREE(type);
+    }
+
+    if (virXPathUInt("string(/node/synthetic/domains/@count)",
+                     ctxt, &count) == -2 ||
+        virXPathUInt("string(/node/synthetic/domains/@running)",
+                     ctxt, &running) == -2 ||
+        virXPathUInt("string(/node/synthetic/domains/@vcpus)",
+                     ctxt, &vcpus) == -2 ||
+        virXPathULongLong("string(/node/synthetic/domains/@memory)",
+                          ctxt, &memory) == -2) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("invalid synthetic domains description"));
+        goto error;
+    }
+
+    if (running > count || vcpus == 0 || memory == 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("invalid synthetic domains description"));
+        goto error;
+    }
+
+    for (i = 0; i < count; i++) {
+        virBufferAddLit(&buf, "<domain type='test'>\n");
+        virBufferAsprintf(&buf, "  <name>synthetic-%zu</name>\n", i);
+        virBufferAsprintf(&buf, "  <memory unit='KiB'>%llu</memory>\n",
+                          memory);
+        virBufferAsprintf(&buf, "  <vcpu>%u</vcpu>\n", vcpus);
+        virBufferAddLit(&buf, "  <os><type>hvm</type></os>\n");
+        virBufferAddLit(&buf, "</domain>\n");
+
+        if (!(xml = virBufferContentAndReset(&buf)))
+            goto error;
+
+        if (!(def = virDomainDefParseString(xml, privconn->caps,
+                                            privconn->xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto error;
+
+        if (!(obj = virDomainObjListAdd(privconn->domains,
+                                        def,
+                                        privconn->xmlopt,
+                                        0, NULL)))
+            goto error;
+        def = NULL;
+
+        obj->persistent = true;
+
+        if (i < running) {
+            if (testDomainStartState(privconn, obj,
+                                     VIR_DOMAIN_RUNNING_BOOTED) < 0) {
+                virObjectUnlock(obj);
+                goto error;
+            }
+        } else {
+            testDomainShutdownState(NULL, obj, 0);
+        }
+
+        virObjectUnlock(obj);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+ error:
+    virBufferFreeAndReset(&buf);
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    VIR_FREE(usecs);
+    VIR_FREE(type);
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
 static int
 testParseNetworks(testDriverPtr privconn,
                   const char *file,
@@ -1244,6 +1402,8 @@ testOpenParse(testDriverPtr privconn,
         goto error;
     if (testParseAuthUsers(privconn, ctxt) < 0)
         goto error;
+    if (testParseSynthetic(privconn, ctxt) < 0)
+        goto error;
 
     return 0;
  error:
@@ -1556,20 +1716,17 @@ static int testNodeGetInfo(virConnectPtr conn,
                            virNodeInfoPtr info)
 {
     testDriverPtr privconn = conn->privateData;
-    testDriverLock(privconn);
+
+    /* nodeInfo is only written while opening the connection */
     memcpy(info, &privconn->nodeInfo, sizeof(virNodeInfo));
-    testDriverUnlock(privconn);
     return 0;
 }
 
 static char *testConnectGetCapabilities(virConnectPtr conn)
 {
     testDriverPtr privconn = conn->privateData;
-    char *xml;
-    testDriverLock(privconn);
-    xml = virCapabilitiesFormatXML(privconn->caps);
-    testDriverUnlock(privconn);
-    return xml;
+
+    return virCapabilitiesFormatXML(privconn->caps);
 }
 
 static char *
@@ -1601,13 +1758,10 @@ testConnectGetType(virConnectPtr conn ATTRIBUTE_UNUSED)
 static int testConnectNumOfDomains(virConnectPtr conn)
 {
     testDriverPtr privconn = conn->privateData;
-    int count;
 
-    testDriverLock(privconn);
-    count = virDomainObjListNumOfDomains(privconn->domains, true, NULL, NULL);
-    testDriverUnlock(privconn);
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIST);
 
-    return count;
+    return virDomainObjListNumOfDomains(privconn->domains, true, NULL, NULL);
 }
 
 static int testDomainIsActive(virDomainPtr dom)
@@ -1658,7 +1812,8 @@ testDomainCreateXML(virConnectPtr conn, const char *xml,
     if (flags & VIR_DOMAIN_START_VALIDATE)
         parse_flags |= VIR_DOMAIN_DEF_PARSE_VALIDATE_SCHEMA;
 
-    testDriverLock(privconn);
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if ((def = virDomainDefParseString(xml, privconn->caps, privconn->xmlopt,
                                        NULL, parse_flags)) == NULL)
         goto cleanup;
@@ -1693,7 +1848,6 @@ testDomainCreateXML(virConnectPtr conn, const char *xml,
         virObjectUnlock(dom);
     testObjectEventQueue(privconn, event);
     virDomainDefFree(def);
-    testDriverUnlock(privconn);
     return ret;
 }
 
@@ -1705,6 +1859,8 @@ static virDomainPtr testDomainLookupByID(virConnectPtr conn,
     virDomainPtr ret = NULL;
     virDomainObjPtr dom;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LOOKUP);
+
     if (!(dom = virDomainObjListFindByID(privconn->domains, id))) {
         virReportError(VIR_ERR_NO_DOMAIN, NULL);
         goto cleanup;
@@ -1725,6 +1881,8 @@ static virDomainPtr testDomainLookupByUUID(virConnectPtr conn,
     virDomainPtr ret = NULL;
     virDomainObjPtr dom;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LOOKUP);
+
     if (!(dom = virDomainObjListFindByUUID(privconn->domains, uuid))) {
         virReportError(VIR_ERR_NO_DOMAIN, NULL);
         goto cleanup;
@@ -1745,6 +1903,8 @@ static virDomainPtr testDomainLookupByName(virConnectPtr conn,
     virDomainPtr ret = NULL;
     virDomainObjPtr dom;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LOOKUP);
+
     if (!(dom = virDomainObjListFindByName(privconn->domains, name))) {
         virReportError(VIR_ERR_NO_DOMAIN, NULL);
         goto cleanup;
@@ -1763,6 +1923,8 @@ static int testConnectListDomains(virConnectPtr conn,
 {
     testDriverPtr privconn = conn->privateData;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIST);
+
     return virDomainObjListGetActiveIDs(privconn->domains, ids, maxids,
                                         NULL, NULL);
 }
@@ -1774,6 +1936,8 @@ static int testDomainDestroy(virDomainPtr domain)
     virObjectEventPtr event = NULL;
     int ret = -1;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         goto cleanup;
 
@@ -1805,6 +1969,8 @@ static int testDomainResume(virDomainPtr domain)
     virObjectEventPtr event = NULL;
     int ret = -1;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         return -1;
 
@@ -1835,6 +2001,8 @@ static int testDomainSuspend(virDomainPtr domain)
     int ret = -1;
     int state;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         return -1;
 
@@ -1868,6 +2036,8 @@ static int testDomainShutdownFlags(virDomainPtr domain,
     virCheckFlags(0, -1);
 
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         goto cleanup;
 
@@ -1907,6 +2077,8 @@ static int testDomainReboot(virDomainPtr domain,
     int ret = -1;
 
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         goto cleanup;
 
@@ -1970,6 +2142,8 @@ static int testDomainGetInfo(virDomainPtr domain,
     virDomainObjPtr privdom;
     int ret = -1;
 
+    testDriverSimulateLatency(domain->conn->privateData, TEST_LATENCY_QUERY);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         return -1;
 
@@ -2001,6 +2175,8 @@ testDomainGetState(virDomainPtr domain,
 
     virCheckFlags(0, -1);
 
+    testDriverSimulateLatency(domain->conn->privateData, TEST_LATENCY_QUERY);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         return -1;
 
@@ -2335,6 +2511,7 @@ static int testDomainSetMaxMemory(virDomainPtr domain,
 
     /* XXX validate not over host memory wrt to other domains */
     virDomainDefSetMemoryTotal(privdom->def, memory);
+    virDomainObjBumpGeneration(privdom);
 
     virDomainObjEndAPI(&privdom);
     return 0;
@@ -2355,6 +2532,7 @@ static int testDomainSetMemory(virDomainPtr domain,
     }
 
     privdom->def->mem.cur_balloon = memory;
+    virDomainObjBumpGeneration(privdom);
     ret = 0;
 
  cleanup:
@@ -2457,6 +2635,7 @@ testDomainSetVcpusFlags(virDomainPtr domain, unsigned int nrCpus,
         }
     }
 
+    virDomainObjBumpGeneration(privdom);
     ret = 0;
 
  cleanup:
@@ -2627,6 +2806,8 @@ static char *testDomainGetXMLDesc(virDomainPtr domain, unsigned int flags)
 
     /* Flags checked by virDomainDefFormat */
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_QUERY);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         return NULL;
 
@@ -2676,6 +2857,8 @@ static virDomainPtr testDomainDefineXMLFlags(virConnectPtr conn,
     if (flags & VIR_DOMAIN_DEFINE_VALIDATE)
         parse_flags |= VIR_DOMAIN_DEF_PARSE_VALIDATE_SCHEMA;
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_CONFIG);
+
     if ((def = virDomainDefParseString(xml, privconn->caps, privconn->xmlopt,
                                        NULL, parse_flags)) == NULL)
         goto cleanup;
@@ -2893,7 +3076,7 @@ static int testDomainCreateWithFlags(virDomainPtr domain, unsigned int flags)
 
     virCheckFlags(0, -1);
 
-    testDriverLock(privconn);
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIFECYCLE);
 
     if (!(privdom = testDomObjFromDomain(domain)))
         goto cleanup;
@@ -2917,7 +3100,6 @@ static int testDomainCreateWithFlags(virDomainPtr domain, unsigned int flags)
  cleanup:
     virDomainObjEndAPI(&privdom);
     testObjectEventQueue(privconn, event);
-    testDriverUnlock(privconn);
     return ret;
 }
 
@@ -2939,6 +3121,8 @@ static int testDomainUndefineFlags(virDomainPtr domain,
                   VIR_DOMAIN_UNDEFINE_SNAPSHOTS_METADATA, -1);
 
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_CONFIG);
+
     if (!(privdom = testDomObjFromDomain(domain)))
         goto cleanup;
 
@@ -2973,10 +3157,12 @@ static int testDomainUndefineFlags(virDomainPtr domain,
                                      VIR_DOMAIN_EVENT_UNDEFINED_REMOVED);
     privdom->hasManagedSave = false;
 
-    if (virDomainObjIsActive(privdom))
+    if (virDomainObjIsActive(privdom)) {
         privdom->persistent = 0;
-    else
+        virDomainObjBumpGeneration(privdom);
+    } else {
         virDomainObjListRemove(privconn->domains, privdom);
+    }
 
     ret = 0;
 
@@ -3015,6 +3201,7 @@ static int testDomainSetAutostart(virDomainPtr domain,
         return -1;
 
     privdom->autostart = autostart ? 1 : 0;
+    virDomainObjBumpGeneration(privdom);
 
     virDomainObjEndAPI(&privdom);
     return 0;
@@ -5764,10 +5951,200 @@ static int testConnectListAllDomains(virConnectPtr conn,
 
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
+    testDriverSimulateLatency(privconn, TEST_LATENCY_LIST);
+
     return virDomainObjListExport(privconn->domains, conn, domains,
                                   NULL, flags);
 }
 
+#define TEST_SUPPORTED_STATS (VIR_DOMAIN_STATS_STATE | \
+                              VIR_DOMAIN_STATS_CPU_TOTAL | \
+                              VIR_DOMAIN_STATS_BALLOON | \
+                              VIR_DOMAIN_STATS_VCPU)
+
+/* Fills in a record of the synthetic statistics of @dom. CPU times are
+ * derived from the current time the same way testDomainGetInfo does. */
+static int
+testDomainGetStatsOne(virConnectPtr conn,
+                      virDomainObjPtr dom,
+                      unsigned int stats,
+                      virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp = NULL;
+    int maxparams = 0;
+    int state;
+    int reason;
+    unsigned long long cputime;
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    bool active = virDomainObjIsActive(dom);
+    unsigned int nvcpus = virDomainDefGetVcpus(dom->def);
+    size_t i;
+
+    if (virTimeMillisNow(&cputime) < 0)
+        goto error;
+    cputime *= 1000 * 1000;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto error;
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+                                  dom->def->uuid, dom->def->id)))
+        goto error;
+
+    if (stats & VIR_DOMAIN_STATS_STATE) {
+        state = virDomainObjGetState(dom, &reason);
+        if (virTypedParamsAddInt(&tmp->params, &tmp->nparams, &maxparams,
+                                 "state.state", state) < 0 ||
+            virTypedParamsAddInt(&tmp->params, &tmp->nparams, &maxparams,
+                                 "state.reason", reason) < 0)
+            goto error;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_CPU_TOTAL && active) {
+        if (virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "cpu.time", cputime) < 0 ||
+            virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "cpu.user", cputime / 10 * 9) < 0 ||
+            virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "cpu.system", cputime / 10) < 0)
+            goto error;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BALLOON) {
+        if (virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "balloon.current",
+                                    dom->def->mem.cur_balloon) < 0 ||
+            virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "balloon.maximum",
+                                    virDomainDefGetMemoryTotal(dom->def)) < 0)
+            goto error;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_VCPU) {
+        if (virTypedParamsAddUInt(&tmp->params, &tmp->nparams, &maxparams,
+                                  "vcpu.current", nvcpus) < 0 ||
+            virTypedParamsAddUInt(&tmp->params, &tmp->nparams, &maxparams,
+                                  "vcpu.maximum",
+                                  virDomainDefGetVcpusMax(dom->def)) < 0)
+            goto error;
+
+        for (i = 0; active && i < nvcpus; i++) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "vcpu.%zu.state", i);
+            if (virTypedParamsAddInt(&tmp->params, &tmp->nparams, &maxparams,
+                                     param_name, VIR_VCPU_RUNNING) < 0)
+                goto error;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "vcpu.%zu.time", i);
+            if (virTypedParamsAddULLong(&tmp->params, &tmp->nparams,
+                                        &maxparams, param_name,
+                                        cputime / nvcpus) < 0)
+                goto error;
+        }
+    }
+
+    *record = tmp;
+    return 0;
+
+ error:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        virObjectUnref(tmp->dom);
+        VIR_FREE(tmp);
+    }
+    return -1;
+}
+
+static int
+testConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    testDriverPtr privconn = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    size_t nstats = 0;
+    size_t i;
+    int ret = -1;
+    unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (!stats) {
+        stats = TEST_SUPPORTED_STATS;
+    } else if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS &&
+               stats & ~TEST_SUPPORTED_STATS) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       stats & ~TEST_SUPPORTED_STATS);
+        return -1;
+    }
+    stats &= TEST_SUPPORTED_STATS;
+
+    testDriverSimulateLatency(privconn, TEST_LATENCY_STATS);
+
+    if (ndoms) {
+        if (virDomainObjListConvert(privconn->domains, conn, doms, ndoms,
+                                    &vms, &nvms, NULL, lflags, true) < 0)
+            return -1;
+    } else {
+        if (virDomainObjListCollect(privconn->domains, conn, &vms, &nvms,
+                                    NULL, lflags) < 0)
+            return -1;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        int rc;
+
+        virObjectLock(vms[i]);
+        rc = testDomainGetStatsOne(conn, vms[i], stats, &tmpstats[nstats]);
+        virObjectUnlock(vms[i]);
+
+        if (rc < 0)
+            goto cleanup;
+        nstats++;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+ cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    virObjectListFreeCount(vms, nvms);
+    return ret;
+}
+
+#undef TEST_SUPPORTED_STATS
+
+static int
+testConnectListDomainChanges(virConnectPtr conn,
+                             unsigned long long *cursor,
+                             virDomainPtr **changed,
+                             virDomainPtr **removed,
+                             unsigned int flags)
+{
+    testDriverPtr privconn = conn->privateData;
+
+    virCheckFlags(0, -1);
+
+    return virDomainObjListExportChanges(privconn->domains, conn, cursor,
+                                         changed, removed, NULL);
+}
+
 static int
 testNodeGetCPUMap(virConnectPtr conn ATTRIBUTE_UNUSED,
                   unsigned char **cpumap,
@@ -6327,7 +6704,7 @@ testDomainSnapshotCreateXML(virDomainPtr domain,
 
     if (redefine) {
         if (virDomainSnapshotRedefinePrep(domain, vm, &def, &snap,
-                                          privconn->xmlopt,
+                                          privconn->caps, privconn->xmlopt,
                                           &update_current, flags) < 0)
             goto cleanup;
     } else {
@@ -6368,15 +6745,9 @@ testDomainSnapshotCreateXML(virDomainPtr domain,
     VIR_FREE(xml);
     if (vm) {
         if (snapshot) {
-            virDomainSnapshotObjPtr other;
             if (update_current)
                 vm->current_snapshot = snap;
-            other = virDomainSnapshotFindByName(vm->snapshots,
-                                                snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            virDomainSnapshotSetParent(vm->snapshots, snap);
         }
         virDomainObjEndAPI(&vm);
     }
@@ -6745,6 +7116,7 @@ static virHypervisorDriver testHypervisorDriver = {
     .connectListDomains = testConnectListDomains, /* 0.1.1 */
     .connectNumOfDomains = testConnectNumOfDomains, /* 0.1.1 */
     .connectListAllDomains = testConnectListAllDomains, /* 0.9.13 */
+    .connectGetAllDomainStats = testConnectGetAllDomainStats, /* 4.0.0 */
     .domainCreateXML = testDomainCreateXML, /* 0.1.4 */
     .domainLookupByID = testDomainLookupByID, /* 0.1.1 */
     .domainLookupByUUID = testDomainLookupByUUID, /* 0.1.1 */
@@ -6830,6 +7202,7 @@ static virHypervisorDriver testHypervisorDriver = {
     .domainSnapshotDelete = testDomainSnapshotDelete, /* 1.1.4 */
 
     .connectBaselineCPU = testConnectBaselineCPU, /* 1.2.0 */
+    .connectListDomainChanges = testConnectListDomainChanges, /* 4.0.0 */
 };
 
 static virNetworkDriver testNetworkDriver = {
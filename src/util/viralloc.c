@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virlog.h"
 #include "virerror.h"
 
@@ -106,6 +107,128 @@ void virAllocTestHook(void (*func)(int, void*) ATTRIBUTE_UNUSED,
 #endif
 
 
+/* Counting of allocations, meant for benchmarks. Both are accessed
+ * via virAtomic only. */
+static int allocCounting;
+static int allocCount;
+
+/* Per error domain allocation statistics, meant to be left enabled
+ * in daemons. The flag and all the counters are accessed via virAtomic
+ * only. */
+typedef struct _virAllocStatsCounters virAllocStatsCounters;
+struct _virAllocStatsCounters {
+    unsigned long long allocs;
+    unsigned long long bytes;
+};
+
+static int allocStatsEnabled;
+static virAllocStatsCounters allocStats[VIR_ERR_DOMAIN_LAST];
+
+#define VIR_ALLOC_COUNT(domcode, size) \
+    do { \
+        if (allocCounting) \
+            virAtomicIntInc(&allocCount); \
+        if (allocStatsEnabled) \
+            virAllocStatsAdd(domcode, size); \
+    } while (0)
+
+static void
+virAllocStatsAdd(int domcode, size_t size)
+{
+    if (domcode < 0 || domcode >= VIR_ERR_DOMAIN_LAST)
+        domcode = VIR_FROM_NONE;
+
+    virAtomicULLongAdd(&allocStats[domcode].allocs, 1);
+    virAtomicULLongAdd(&allocStats[domcode].bytes, size);
+}
+
+/**
+ * virAllocCountStart:
+ *
+ * Starts counting the successful allocations made by the functions
+ * in this file and by the string duplication helpers. Any previous
+ * count is discarded.
+ */
+void virAllocCountStart(void)
+{
+    virAtomicIntSet(&allocCount, 0);
+    virAtomicIntSet(&allocCounting, 1);
+}
+
+/**
+ * virAllocCountStop:
+ *
+ * Stops counting allocations.
+ *
+ * Returns the number of allocations made since virAllocCountStart
+ */
+int virAllocCountStop(void)
+{
+    virAtomicIntSet(&allocCounting, 0);
+    return virAtomicIntGet(&allocCount);
+}
+
+/**
+ * virAllocCountAdd:
+ * @domcode: error domain code of the caller
+ * @size: number of bytes allocated
+ *
+ * Accounts for an allocation made outside of this file
+ */
+void virAllocCountAdd(int domcode, size_t size)
+{
+    VIR_ALLOC_COUNT(domcode, size);
+}
+
+/**
+ * virAllocStatsSetEnabled:
+ * @enabled: whether to collect allocation statistics
+ *
+ * Enables or disables the collection of per error domain allocation
+ * statistics. The statistics collected so far are kept.
+ */
+void virAllocStatsSetEnabled(bool enabled)
+{
+    virAtomicIntSet(&allocStatsEnabled, enabled ? 1 : 0);
+}
+
+/**
+ * virAllocStatsIsEnabled:
+ *
+ * Returns true if allocation statistics are being collected
+ */
+bool virAllocStatsIsEnabled(void)
+{
+    return virAtomicIntGet(&allocStatsEnabled) != 0;
+}
+
+/**
+ * virAllocStatsGet:
+ * @domcode: error domain code
+ * @allocs: filled with the number of allocations
+ * @bytes: filled with the number of bytes allocated
+ *
+ * Gets the allocation statistics of the callers using @domcode
+ * as VIR_FROM_THIS, collected while virAllocStatsSetEnabled was in
+ * effect. Both values only ever grow: memory being freed is not
+ * accounted for, and a reallocation counts as a new allocation of
+ * the full new size.
+ *
+ * Returns 0 on success, -1 if @domcode is not valid
+ */
+int virAllocStatsGet(int domcode,
+                     unsigned long long *allocs,
+                     unsigned long long *bytes)
+{
+    if (domcode < 0 || domcode >= VIR_ERR_DOMAIN_LAST)
+        return -1;
+
+    *allocs = virAtomicULLongGet(&allocStats[domcode].allocs);
+    *bytes = virAtomicULLongGet(&allocStats[domcode].bytes);
+    return 0;
+}
+
+
 /**
  * virAlloc:
  * @ptrptr: pointer to pointer for address of allocated memory
@@ -147,6 +270,7 @@ int virAlloc(void *ptrptr,
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         return -1;
     }
+    VIR_ALLOC_COUNT(domcode, size);
     return 0;
 }
 
@@ -194,6 +318,7 @@ int virAllocN(void *ptrptr,
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         return -1;
     }
+    VIR_ALLOC_COUNT(domcode, size * count);
     return 0;
 }
 
@@ -249,6 +374,7 @@ int virReallocN(void *ptrptr,
         return -1;
     }
     *(void**)ptrptr = tmp;
+    VIR_ALLOC_COUNT(domcode, size * count);
     return 0;
 }
 
@@ -563,6 +689,7 @@ int virAllocVar(void *ptrptr,
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         return -1;
     }
+    VIR_ALLOC_COUNT(domcode, alloc_size);
     return 0;
 }
 
@@ -596,4 +596,16 @@ void virAllocTestInit(void);
 int virAllocTestCount(void);
 void virAllocTestOOM(int n, int m);
 void virAllocTestHook(void (*func)(int, void*), void *data);
+
+void virAllocCountStart(void);
+int virAllocCountStop(void);
+void virAllocCountAdd(int domcode, size_t size);
+
+void virAllocStatsSetEnabled(bool enabled);
+bool virAllocStatsIsEnabled(void);
+int virAllocStatsGet(int domcode,
+                     unsigned long long *allocs,
+                     unsigned long long *bytes)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 #endif /* __VIR_MEMORY_H_ */
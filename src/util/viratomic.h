@@ -152,6 +152,29 @@ VIR_STATIC unsigned int virAtomicIntXor(volatile unsigned int *atomic,
                                         unsigned int val)
     ATTRIBUTE_NONNULL(1);
 
+/**
+ * virAtomicULLongAdd:
+ * Atomically adds val to the 64-bit value of atomic.
+ *
+ * Think of this operation as an atomic version of
+ * { tmp = *atomic; *atomic += val; return tmp; }
+ *
+ * This call acts as a full compiler and hardware memory barrier.
+ */
+VIR_STATIC unsigned long long virAtomicULLongAdd(volatile unsigned long long *atomic,
+                                                 unsigned long long val)
+    ATTRIBUTE_NONNULL(1);
+
+/**
+ * virAtomicULLongGet:
+ * Gets the current 64-bit value of atomic, which is read as
+ * a whole even on 32-bit platforms.
+ *
+ * This call acts as a full compiler and hardware memory barrier.
+ */
+VIR_STATIC unsigned long long virAtomicULLongGet(volatile unsigned long long *atomic)
+    ATTRIBUTE_NONNULL(1);
+
 # undef VIR_STATIC
 
 # ifdef VIR_ATOMIC_OPS_GCC
@@ -213,6 +236,16 @@ VIR_STATIC unsigned int virAtomicIntXor(volatile unsigned int *atomic,
             (void) (0 ? *(atomic) ^ (val) : 0); \
             (unsigned int) __sync_fetch_and_xor((atomic), (val)); \
         }))
+#  define virAtomicULLongAdd(atomic, val) \
+    (__extension__ ({ \
+            (void)verify_true(sizeof(*(atomic)) == sizeof(unsigned long long)); \
+            (unsigned long long) __sync_fetch_and_add((atomic), (val)); \
+        }))
+#  define virAtomicULLongGet(atomic) \
+    (__extension__ ({ \
+            (void)verify_true(sizeof(*(atomic)) == sizeof(unsigned long long)); \
+            (unsigned long long) __sync_fetch_and_add((atomic), 0); \
+        }))
 
 
 # else
@@ -294,6 +327,19 @@ virAtomicIntXor(volatile unsigned int *atomic,
     return InterlockedXor((volatile LONG *)atomic, val);
 }
 
+static inline unsigned long long
+virAtomicULLongAdd(volatile unsigned long long *atomic,
+                   unsigned long long val)
+{
+    return InterlockedExchangeAdd64((volatile LONGLONG *)atomic, val);
+}
+
+static inline unsigned long long
+virAtomicULLongGet(volatile unsigned long long *atomic)
+{
+    return InterlockedExchangeAdd64((volatile LONGLONG *)atomic, 0);
+}
+
 
 #  else
 #   ifdef VIR_ATOMIC_OPS_PTHREAD
@@ -419,6 +465,32 @@ virAtomicIntXor(volatile unsigned int *atomic,
     return oldval;
 }
 
+static inline unsigned long long
+virAtomicULLongAdd(volatile unsigned long long *atomic,
+                   unsigned long long val)
+{
+    unsigned long long oldval;
+
+    pthread_mutex_lock(&virAtomicLock);
+    oldval = *atomic;
+    *atomic = oldval + val;
+    pthread_mutex_unlock(&virAtomicLock);
+
+    return oldval;
+}
+
+static inline unsigned long long
+virAtomicULLongGet(volatile unsigned long long *atomic)
+{
+    unsigned long long value;
+
+    pthread_mutex_lock(&virAtomicLock);
+    value = *atomic;
+    pthread_mutex_unlock(&virAtomicLock);
+
+    return value;
+}
+
 
 #   else
 #    error "No atomic integer impl for this platform"
@@ -33,6 +33,8 @@
 #include "virfile.h"
 #include "viralloc.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 
 VIR_LOG_INIT("util.audit");
 
@@ -50,8 +52,48 @@ VIR_LOG_INIT("util.audit");
 
 #define VIR_FROM_THIS VIR_FROM_AUDIT
 
+/* Records which waited this long for room in the queue, or
+ * for the writer thread to pick them up, count as delayed */
+#define VIR_AUDIT_DELAY_MS 1000
+
 #if WITH_AUDIT
 static int auditfd = -1;
+
+typedef struct _virAuditRecord virAuditRecord;
+typedef virAuditRecord *virAuditRecordPtr;
+
+struct _virAuditRecord {
+    virAuditRecordPtr next;
+    int type;
+    bool success;
+    bool delayed;
+    unsigned long long when;
+    char *str;
+    char *clienttty;
+    char *clientaddr;
+};
+
+/*
+ * When the queue is running, records are handed over to a
+ * dedicated thread rather than written to the audit socket by
+ * the caller, so that a slow auditd does not hold up the
+ * thread starting or modifying a guest. At most auditQueueMax
+ * records are kept; once full, further records are dropped,
+ * or, in lossless mode, the caller waits for room.
+ */
+static virMutex auditQueueLock = VIR_MUTEX_INITIALIZER;
+static virCond auditQueueCond;
+static virCond auditQueueRoom;
+static virThread auditQueueThread;
+static bool auditQueueRunning;
+static bool auditQueueQuit;
+static bool auditQueueLossless;
+static bool auditQueueOverflow;
+static size_t auditQueueMax;
+static size_t auditQueueLen;
+static virAuditRecordPtr auditQueueHead;
+static virAuditRecordPtr auditQueueTail;
+static virAuditStats auditStats;
 #endif
 static bool auditlog;
 
@@ -76,6 +118,274 @@ void virAuditLog(bool logging)
 }
 
 
+#if WITH_AUDIT
+static const int virAuditRecordTypes[] = {
+    [VIR_AUDIT_RECORD_MACHINE_CONTROL] = AUDIT_VIRT_CONTROL,
+    [VIR_AUDIT_RECORD_MACHINE_ID] = AUDIT_VIRT_MACHINE_ID,
+    [VIR_AUDIT_RECORD_RESOURCE] = AUDIT_VIRT_RESOURCE,
+};
+
+
+static void
+virAuditWrite(int type,
+              const char *str,
+              const char *clientaddr,
+              const char *clienttty,
+              bool success)
+{
+    if (audit_log_user_message(auditfd, type, str, NULL,
+                               clientaddr, clienttty, success) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Failed to send audit message %s: %s",
+                 NULLSTR(str), virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+}
+
+
+static void
+virAuditRecordFree(virAuditRecordPtr rec)
+{
+    if (!rec)
+        return;
+
+    VIR_FREE(rec->str);
+    VIR_FREE(rec->clienttty);
+    VIR_FREE(rec->clientaddr);
+    VIR_FREE(rec);
+}
+
+
+static void
+virAuditQueueWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&auditQueueLock);
+
+    while (1) {
+        virAuditRecordPtr batch;
+        unsigned long long now = 0;
+        unsigned long long sent = 0;
+        unsigned long long delayed = 0;
+
+        while (!auditQueueHead && !auditQueueQuit) {
+            if (virCondWait(&auditQueueCond, &auditQueueLock) < 0)
+                break;
+        }
+
+        if (!auditQueueHead)
+            break;
+
+        /* Take everything queued so far and let producers
+         * carry on while the batch is written out */
+        batch = auditQueueHead;
+        auditQueueHead = auditQueueTail = NULL;
+        auditQueueLen = 0;
+        auditQueueOverflow = false;
+        virCondBroadcast(&auditQueueRoom);
+        virMutexUnlock(&auditQueueLock);
+
+        ignore_value(virTimeMillisNow(&now));
+
+        while (batch) {
+            virAuditRecordPtr rec = batch;
+            batch = rec->next;
+
+            if (rec->delayed || now > rec->when + VIR_AUDIT_DELAY_MS)
+                delayed++;
+
+            virAuditWrite(rec->type, rec->str, rec->clientaddr,
+                          rec->clienttty, rec->success);
+            sent++;
+            virAuditRecordFree(rec);
+        }
+
+        virMutexLock(&auditQueueLock);
+        auditStats.sent += sent;
+        auditStats.delayed += delayed;
+    }
+
+    virMutexUnlock(&auditQueueLock);
+}
+
+
+/*
+ * Hand @str over to the queue, which takes ownership of it.
+ * Returns 0 if queued, -1 if the record was dropped or the
+ * queue is not running, in which case @str is left to the caller.
+ */
+static int
+virAuditQueuePush(int type,
+                  char **str,
+                  const char *clientaddr,
+                  const char *clienttty,
+                  bool success)
+{
+    virAuditRecordPtr rec = NULL;
+    unsigned long long start = 0;
+    bool warn = false;
+    int ret = -1;
+
+    virMutexLock(&auditQueueLock);
+
+    if (!auditQueueRunning)
+        goto cleanup;
+
+    if (auditQueueLen >= auditQueueMax) {
+        if (!auditQueueLossless) {
+            auditStats.dropped++;
+            warn = !auditQueueOverflow;
+            auditQueueOverflow = true;
+            ret = 0;
+            goto cleanup;
+        }
+
+        ignore_value(virTimeMillisNow(&start));
+        while (auditQueueLen >= auditQueueMax && auditQueueRunning) {
+            if (virCondWait(&auditQueueRoom, &auditQueueLock) < 0)
+                break;
+        }
+        if (auditQueueLen >= auditQueueMax || !auditQueueRunning)
+            goto cleanup;
+    }
+
+    if (VIR_ALLOC_QUIET(rec) < 0 ||
+        VIR_STRDUP_QUIET(rec->clientaddr, clientaddr) < 0 ||
+        VIR_STRDUP_QUIET(rec->clienttty, clienttty) < 0) {
+        virAuditRecordFree(rec);
+        goto cleanup;
+    }
+
+    rec->type = type;
+    rec->success = success;
+    rec->str = *str;
+    *str = NULL;
+
+    ignore_value(virTimeMillisNow(&rec->when));
+    if (start && rec->when > start + VIR_AUDIT_DELAY_MS)
+        rec->delayed = true;
+
+    if (auditQueueTail)
+        auditQueueTail->next = rec;
+    else
+        auditQueueHead = rec;
+    auditQueueTail = rec;
+    auditQueueLen++;
+    auditStats.queued++;
+
+    virCondSignal(&auditQueueCond);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&auditQueueLock);
+    if (warn)
+        VIR_WARN("Audit queue is full, dropping audit records");
+    return ret;
+}
+#endif
+
+
+#if WITH_AUDIT
+/**
+ * virAuditStartQueue:
+ * @size: maximum number of records waiting to be sent
+ * @lossless: whether to block instead of dropping records
+ *
+ * Start sending audit records from a dedicated thread, so that
+ * callers no longer wait for auditd to accept each of them.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virAuditStartQueue(size_t size, bool lossless)
+{
+    int ret = -1;
+
+    if (size == 0)
+        return 0;
+
+    virMutexLock(&auditQueueLock);
+
+    if (auditQueueRunning) {
+        auditQueueMax = size;
+        auditQueueLossless = lossless;
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCondInit(&auditQueueCond) < 0 ||
+        virCondInit(&auditQueueRoom) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize audit queue condition"));
+        goto cleanup;
+    }
+
+    auditQueueMax = size;
+    auditQueueLossless = lossless;
+    auditQueueQuit = false;
+
+    if (virThreadCreate(&auditQueueThread, true,
+                        virAuditQueueWorker, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create audit queue thread"));
+        virCondDestroy(&auditQueueCond);
+        virCondDestroy(&auditQueueRoom);
+        goto cleanup;
+    }
+
+    auditQueueRunning = true;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&auditQueueLock);
+    return ret;
+}
+
+
+static void virAuditStopQueue(void)
+{
+    virMutexLock(&auditQueueLock);
+    if (!auditQueueRunning) {
+        virMutexUnlock(&auditQueueLock);
+        return;
+    }
+
+    /* The worker flushes whatever is still queued before exiting */
+    auditQueueRunning = false;
+    auditQueueQuit = true;
+    virCondSignal(&auditQueueCond);
+    virCondBroadcast(&auditQueueRoom);
+    virMutexUnlock(&auditQueueLock);
+
+    virThreadJoin(&auditQueueThread);
+
+    virCondDestroy(&auditQueueCond);
+    virCondDestroy(&auditQueueRoom);
+}
+
+
+/**
+ * virAuditGetStats:
+ * @stats: filled in with the audit queue counters
+ */
+void virAuditGetStats(virAuditStatsPtr stats)
+{
+    virMutexLock(&auditQueueLock);
+    *stats = auditStats;
+    virMutexUnlock(&auditQueueLock);
+}
+#else /* ! WITH_AUDIT */
+int virAuditStartQueue(size_t size ATTRIBUTE_UNUSED,
+                       bool lossless ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+void virAuditGetStats(virAuditStatsPtr stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+#endif /* ! WITH_AUDIT */
+
+
 void virAuditSend(virLogSourcePtr source,
                   const char *filename,
                   size_t linenr,
@@ -116,20 +426,13 @@ void virAuditSend(virLogSourcePtr source,
 
 #if WITH_AUDIT
     if (str && auditfd >= 0) {
-        static const int record_types[] = {
-            [VIR_AUDIT_RECORD_MACHINE_CONTROL] = AUDIT_VIRT_CONTROL,
-            [VIR_AUDIT_RECORD_MACHINE_ID] = AUDIT_VIRT_MACHINE_ID,
-            [VIR_AUDIT_RECORD_RESOURCE] = AUDIT_VIRT_RESOURCE,
-        };
-
-        if (type >= ARRAY_CARDINALITY(record_types) || record_types[type] == 0)
+        if (type >= ARRAY_CARDINALITY(virAuditRecordTypes) ||
+            virAuditRecordTypes[type] == 0)
             VIR_WARN("Unknown audit record type %d", type);
-        else if (audit_log_user_message(auditfd, record_types[type], str, NULL,
-                                        clientaddr, clienttty, success) < 0) {
-            char ebuf[1024];
-            VIR_WARN("Failed to send audit message %s: %s",
-                     NULLSTR(str), virStrerror(errno, ebuf, sizeof(ebuf)));
-        }
+        else if (virAuditQueuePush(virAuditRecordTypes[type], &str,
+                                   clientaddr, clienttty, success) < 0)
+            virAuditWrite(virAuditRecordTypes[type], str,
+                          clientaddr, clienttty, success);
     }
 #endif
     VIR_FREE(str);
@@ -138,6 +441,7 @@ void virAuditSend(virLogSourcePtr source,
 void virAuditClose(void)
 {
 #if WITH_AUDIT
+    virAuditStopQueue();
     VIR_FORCE_CLOSE(auditfd);
 #endif
 }
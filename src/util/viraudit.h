@@ -34,6 +34,20 @@ typedef enum {
 
 int virAuditOpen(void);
 
+typedef struct _virAuditStats virAuditStats;
+typedef virAuditStats *virAuditStatsPtr;
+
+struct _virAuditStats {
+    unsigned long long queued;  /* records handed over to the queue */
+    unsigned long long sent;    /* records written by the queue thread */
+    unsigned long long dropped; /* records lost because the queue was full */
+    unsigned long long delayed; /* records which took over a second to send */
+};
+
+int virAuditStartQueue(size_t size, bool lossless);
+
+void virAuditGetStats(virAuditStatsPtr stats);
+
 void virAuditLog(bool enabled);
 
 void virAuditSend(virLogSourcePtr source,
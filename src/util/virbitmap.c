@@ -266,6 +266,82 @@ int virBitmapClearBitExpand(virBitmapPtr bitmap, size_t b)
 }
 
 
+/* Helper function. caller must ensure start <= end < bitmap->max_bit */
+static void
+virBitmapUpdateRange(virBitmapPtr bitmap,
+                     size_t start,
+                     size_t end,
+                     bool set)
+{
+    size_t first = VIR_BITMAP_UNIT_OFFSET(start);
+    size_t last = VIR_BITMAP_UNIT_OFFSET(end);
+    unsigned long firstMask = -1UL << VIR_BITMAP_BIT_OFFSET(start);
+    unsigned long lastMask = -1UL >> (VIR_BITMAP_BITS_PER_UNIT - 1 -
+                                      VIR_BITMAP_BIT_OFFSET(end));
+    size_t i;
+
+    if (first == last)
+        firstMask &= lastMask;
+
+    if (set)
+        bitmap->map[first] |= firstMask;
+    else
+        bitmap->map[first] &= ~firstMask;
+
+    if (first == last)
+        return;
+
+    for (i = first + 1; i < last; i++)
+        bitmap->map[i] = set ? -1UL : 0;
+
+    if (set)
+        bitmap->map[last] |= lastMask;
+    else
+        bitmap->map[last] &= ~lastMask;
+}
+
+
+/**
+ * virBitmapSetRange:
+ * @bitmap: Pointer to bitmap
+ * @start: first bit position to set
+ * @end: last bit position to set
+ *
+ * Set bit positions @start to @end (inclusive) in @bitmap, a word at a time.
+ *
+ * Returns 0 on if bits are successfully set, -1 on error.
+ */
+int virBitmapSetRange(virBitmapPtr bitmap, size_t start, size_t end)
+{
+    if (start > end || bitmap->max_bit <= end)
+        return -1;
+
+    virBitmapUpdateRange(bitmap, start, end, true);
+    return 0;
+}
+
+
+/**
+ * virBitmapClearRange:
+ * @bitmap: Pointer to bitmap
+ * @start: first bit position to clear
+ * @end: last bit position to clear
+ *
+ * Clear bit positions @start to @end (inclusive) in @bitmap, a word at a
+ * time.
+ *
+ * Returns 0 on if bits are successfully cleared, -1 on error.
+ */
+int virBitmapClearRange(virBitmapPtr bitmap, size_t start, size_t end)
+{
+    if (start > end || bitmap->max_bit <= end)
+        return -1;
+
+    virBitmapUpdateRange(bitmap, start, end, false);
+    return 0;
+}
+
+
 /* Helper function. caller must ensure b < bitmap->max_bit */
 static bool virBitmapIsSet(virBitmapPtr bitmap, size_t b)
 {
@@ -385,36 +461,33 @@ char *virBitmapFormat(virBitmapPtr bitmap)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     bool first = true;
-    int start, cur, prev;
+    ssize_t start, end;
 
-    if (!bitmap || (cur = virBitmapNextSetBit(bitmap, -1)) < 0) {
+    if (!bitmap || (start = virBitmapNextSetBit(bitmap, -1)) < 0) {
         char *ret;
         ignore_value(VIR_STRDUP(ret, ""));
         return ret;
     }
 
-    start = prev = cur;
-    while (prev >= 0) {
-        cur = virBitmapNextSetBit(bitmap, prev);
-
-        if (cur == prev + 1) {
-            prev = cur;
-            continue;
-        }
-
-        /* cur < 0 or cur > prev + 1 */
+    /* Each range of set bits is found by skipping whole words of set bits
+     * rather than testing its bits one by one.
+     */
+    while (start >= 0) {
+        end = virBitmapNextClearBit(bitmap, start);
+        if (end < 0 || end > bitmap->max_bit)
+            end = bitmap->max_bit;
 
         if (!first)
             virBufferAddLit(&buf, ",");
         else
             first = false;
 
-        if (prev == start)
-            virBufferAsprintf(&buf, "%d", start);
+        if (end - 1 == start)
+            virBufferAsprintf(&buf, "%zd", start);
         else
-            virBufferAsprintf(&buf, "%d-%d", start, prev);
+            virBufferAsprintf(&buf, "%zd-%zd", start, end - 1);
 
-        start = prev = cur;
+        start = virBitmapNextSetBit(bitmap, end);
     }
 
     if (virBufferError(&buf)) {
@@ -457,7 +530,6 @@ virBitmapParseSeparator(const char *str,
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(*bitmap = virBitmapNew(bitmapSize)))
@@ -517,10 +589,8 @@ virBitmapParseSeparator(const char *str,
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBit(*bitmap, i) < 0)
-                    goto error;
-            }
+            if (virBitmapSetRange(*bitmap, start, last) < 0)
+                goto error;
 
             virSkipSpaces(&cur);
         }
@@ -591,7 +661,6 @@ virBitmapParseUnlimited(const char *str)
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(bitmap = virBitmapNewEmpty()))
@@ -651,10 +720,10 @@ virBitmapParseUnlimited(const char *str)
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBitExpand(bitmap, i) < 0)
-                    goto error;
-            }
+            if ((bitmap->max_bit <= last &&
+                 virBitmapExpand(bitmap, last) < 0) ||
+                virBitmapSetRange(bitmap, start, last) < 0)
+                goto error;
 
             virSkipSpaces(&cur);
         }
@@ -974,7 +1043,6 @@ virBitmapNextSetBit(virBitmapPtr bitmap, ssize_t pos)
 ssize_t
 virBitmapLastSetBit(virBitmapPtr bitmap)
 {
-    ssize_t i;
     int unusedBits;
     ssize_t sz;
     unsigned long bits;
@@ -1004,12 +1072,8 @@ virBitmapLastSetBit(virBitmapPtr bitmap)
     return -1;
 
  found:
-    for (i = VIR_BITMAP_BITS_PER_UNIT - 1; i >= 0; i--) {
-        if (bits & 1UL << i)
-            return i + sz * VIR_BITMAP_BITS_PER_UNIT;
-    }
-
-    return -1;
+    return VIR_BITMAP_BITS_PER_UNIT - 1 - count_leading_zeros_l(bits) +
+           sz * VIR_BITMAP_BITS_PER_UNIT;
 }
 
 /**
@@ -1059,6 +1123,62 @@ virBitmapNextClearBit(virBitmapPtr bitmap, ssize_t pos)
     return ffsl(bits) - 1 + nl * VIR_BITMAP_BITS_PER_UNIT;
 }
 
+/**
+ * virBitmapIterInit:
+ * @iter: iterator to initialize
+ * @bitmap: the bitmap to iterate over
+ *
+ * Prepares @iter for walking through the set bits of @bitmap using
+ * virBitmapIterNext. Unlike repeated virBitmapNextSetBit calls, which
+ * have to locate the word containing the starting position and mask out
+ * the bits preceding it every time, the iterator keeps the remaining
+ * bits of the current word and only clears the lowest one on each step.
+ *
+ * The word being walked through is copied into @iter, changes to @bitmap
+ * made during the iteration may not be seen.
+ */
+void
+virBitmapIterInit(virBitmapIterPtr iter,
+                  virBitmapPtr bitmap)
+{
+    iter->bitmap = bitmap;
+    iter->unit = 0;
+    iter->bits = bitmap->map_len ? bitmap->map[0] : 0;
+}
+
+
+/**
+ * virBitmapIterNext:
+ * @iter: iterator initialized by virBitmapIterInit
+ *
+ * Returns the position of the next set bit, or -1 if there are no more
+ * set bits.
+ */
+ssize_t
+virBitmapIterNext(virBitmapIterPtr iter)
+{
+    virBitmapPtr bitmap = iter->bitmap;
+    ssize_t ret;
+
+    while (iter->bits == 0) {
+        if (iter->unit + 1 >= bitmap->map_len)
+            return -1;
+
+        iter->bits = bitmap->map[++iter->unit];
+    }
+
+    ret = ffsl(iter->bits) - 1 + iter->unit * VIR_BITMAP_BITS_PER_UNIT;
+    if (ret >= bitmap->max_bit) {
+        iter->bits = 0;
+        iter->unit = bitmap->map_len;
+        return -1;
+    }
+
+    iter->bits &= iter->bits - 1;
+    return ret;
+}
+
+
 /* Return the number of bits currently set in the map.  */
 size_t
 virBitmapCountBits(virBitmapPtr bitmap)
@@ -32,6 +32,17 @@
 typedef struct _virBitmap virBitmap;
 typedef virBitmap *virBitmapPtr;
 
+/*
+ * Iterator over set bits of a bitmap, see virBitmapIterInit.
+ */
+typedef struct _virBitmapIter virBitmapIter;
+typedef virBitmapIter *virBitmapIterPtr;
+struct _virBitmapIter {
+    virBitmapPtr bitmap;
+    size_t unit;
+    unsigned long bits;
+};
+
 /*
  * Allocate a bitmap capable of containing @size bits.
  */
@@ -69,6 +80,15 @@ int virBitmapClearBit(virBitmapPtr bitmap, size_t b)
 int virBitmapClearBitExpand(virBitmapPtr bitmap, size_t b)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+/*
+ * Set or clear bit positions @start to @end (inclusive) in @bitmap
+ */
+int virBitmapSetRange(virBitmapPtr bitmap, size_t start, size_t end)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
+int virBitmapClearRange(virBitmapPtr bitmap, size_t start, size_t end)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 /*
  * Get bit @b in @bitmap. Returns false if b is out of range.
  */
@@ -140,6 +160,12 @@ ssize_t virBitmapNextClearBit(virBitmapPtr bitmap, ssize_t pos)
 size_t virBitmapCountBits(virBitmapPtr bitmap)
     ATTRIBUTE_NONNULL(1);
 
+void virBitmapIterInit(virBitmapIterPtr iter, virBitmapPtr bitmap)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+ssize_t virBitmapIterNext(virBitmapIterPtr iter)
+    ATTRIBUTE_NONNULL(1);
+
 char *virBitmapDataFormat(const void *data,
                           int len)
     ATTRIBUTE_NONNULL(1);
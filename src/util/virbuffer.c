@@ -137,7 +137,7 @@ virBufferGetIndent(const virBuffer *buf, bool dynamic)
 static int
 virBufferGrow(virBufferPtr buf, unsigned int len)
 {
-    int size;
+    size_t size;
 
     if (buf->error)
         return -1;
@@ -145,7 +145,17 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
     if ((len + buf->use) < buf->size)
         return 0;
 
-    size = buf->use + len + 1000;
+    /* Grow at least geometrically so that building a large document
+     * from many small pieces doesn't copy it over and over again */
+    size = (size_t) buf->use + len + 1000;
+    if (size < (size_t) buf->size * 2)
+        size = (size_t) buf->size * 2;
+    if (size > UINT_MAX)
+        size = (size_t) buf->use + len + 1;
+    if (size > UINT_MAX) {
+        virBufferSetError(buf, ERANGE);
+        return -1;
+    }
 
     if (VIR_REALLOC_N_QUIET(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
@@ -404,7 +414,8 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 
     virBufferAddLit(buf, ""); /* auto-indent */
 
-    if (buf->size == 0 &&
+    /* Most strings are short, make sure they fit on the first try */
+    if (buf->size - buf->use < 100 &&
         virBufferGrow(buf, 100) < 0)
         return;
 
@@ -441,6 +452,96 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 
 
+/* Characters virBufferEscapeString replaces or drops */
+static const char virBufferXMLForbidden[] = {
+    0x01,   0x02,   0x03,   0x04,   0x05,   0x06,   0x07,   0x08,
+    /*\t*/  /*\n*/  0x0B,   0x0C,   /*\r*/  0x0E,   0x0F,   0x10,
+    0x11,   0x12,   0x13,   0x14,   0x15,   0x16,   0x17,   0x18,
+    0x19,   '"',    '&',    '\'',   '<',    '>',
+    '\0'
+};
+
+
+/*
+ * Splits @format into the part before and after its "%s" if that is
+ * the only conversion in it, which is what nearly all callers of the
+ * escaping functions pass. This allows the escaped string to be
+ * written right into the buffer rather than into a temporary string
+ * which is then formatted into the buffer.
+ */
+static bool
+virBufferSplitFormat(const char *format,
+                     size_t *prefixLen,
+                     const char **suffix)
+{
+    const char *conv = strchr(format, '%');
+
+    if (!conv || conv[1] != 's' || strchr(conv + 2, '%'))
+        return false;
+
+    *prefixLen = conv - format;
+    *suffix = conv + 2;
+    return true;
+}
+
+
+/*
+ * Writes the XML escaped @str to @out, which has to have space for
+ * 6 * strlen(@str) characters. The string is copied in runs of
+ * characters not needing any escaping, which are found by strcspn
+ * rather than by looking at one character at a time.
+ *
+ * Returns the position after the last character written.
+ */
+static char *
+virBufferEscapeXML(char *out, const char *str)
+{
+    const char *cur = str;
+    size_t n;
+
+    while (true) {
+        n = strcspn(cur, virBufferXMLForbidden);
+        /*
+         * Note that character over 0x80 are likely to give problem
+         * with UTF-8 XML, but since our string don't have an encoding
+         * it's hard to handle properly we have to assume it's UTF-8 too
+         */
+        memcpy(out, cur, n);
+        out += n;
+        cur += n;
+
+        switch (*cur) {
+        case '\0':
+            return out;
+        case '<':
+            memcpy(out, "&lt;", 4);
+            out += 4;
+            break;
+        case '>':
+            memcpy(out, "&gt;", 4);
+            out += 4;
+            break;
+        case '&':
+            memcpy(out, "&amp;", 5);
+            out += 5;
+            break;
+        case '"':
+            memcpy(out, "&quot;", 6);
+            out += 6;
+            break;
+        case '\'':
+            memcpy(out, "&apos;", 6);
+            out += 6;
+            break;
+        default:
+            /* silently ignore control characters */
+            break;
+        }
+        cur++;
+    }
+}
+
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -455,16 +556,11 @@ VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
+    size_t len;
+    size_t prefixLen;
+    size_t suffixLen;
+    const char *suffix;
     char *escaped, *out;
-    const char *cur;
-    const char forbidden_characters[] = {
-        0x01,   0x02,   0x03,   0x04,   0x05,   0x06,   0x07,   0x08,
-        /*\t*/  /*\n*/  0x0B,   0x0C,   /*\r*/  0x0E,   0x0F,   0x10,
-        0x11,   0x12,   0x13,   0x14,   0x15,   0x16,   0x17,   0x18,
-        0x19,   '"',    '&',    '\'',   '<',    '>',
-        '\0'
-    };
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -473,7 +569,32 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
 
     len = strlen(str);
-    if (strcspn(str, forbidden_characters) == len) {
+
+    if (virBufferSplitFormat(format, &prefixLen, &suffix)) {
+        suffixLen = strlen(suffix);
+
+        if (xalloc_oversized(6, len) ||
+            6 * len + prefixLen + suffixLen >= UINT_MAX) {
+            virBufferSetError(buf, ERANGE);
+            return;
+        }
+
+        virBufferAddLit(buf, ""); /* auto-indent */
+
+        if (virBufferGrow(buf, prefixLen + 6 * len + suffixLen + 1) < 0)
+            return;
+
+        out = buf->content + buf->use;
+        memcpy(out, format, prefixLen);
+        out = virBufferEscapeXML(out + prefixLen, str);
+        memcpy(out, suffix, suffixLen);
+        out += suffixLen;
+        *out = '\0';
+        buf->use = out - buf->content;
+        return;
+    }
+
+    if (strcspn(str, virBufferXMLForbidden) == len) {
         virBufferAsprintf(buf, format, str);
         return;
     }
@@ -484,53 +605,7 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (!strchr(forbidden_characters, *cur)) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        } else {
-            /* silently ignore control characters */
-        }
-        cur++;
-    }
-    *out = 0;
+    *virBufferEscapeXML(escaped, str) = '\0';
 
     virBufferAsprintf(buf, format, escaped);
     VIR_FREE(escaped);
@@ -611,9 +686,13 @@ void
 virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
                 const char *format, const char *str)
 {
-    int len;
+    size_t len;
+    size_t prefixLen;
+    size_t suffixLen;
+    const char *suffix;
     char *escaped, *out;
     const char *cur;
+    size_t n;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -627,22 +706,59 @@ virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
         return;
     }
 
-    if (xalloc_oversized(2, len) ||
-        VIR_ALLOC_N_QUIET(escaped, 2 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    if (xalloc_oversized(2, len)) {
+        virBufferSetError(buf, ERANGE);
         return;
     }
 
+    if (virBufferSplitFormat(format, &prefixLen, &suffix)) {
+        suffixLen = strlen(suffix);
+
+        if (2 * len + prefixLen + suffixLen >= UINT_MAX) {
+            virBufferSetError(buf, ERANGE);
+            return;
+        }
+
+        virBufferAddLit(buf, ""); /* auto-indent */
+
+        if (virBufferGrow(buf, prefixLen + 2 * len + suffixLen + 1) < 0)
+            return;
+
+        out = buf->content + buf->use;
+        memcpy(out, format, prefixLen);
+        out += prefixLen;
+        escaped = NULL;
+    } else {
+        if (VIR_ALLOC_N_QUIET(escaped, 2 * len + 1) < 0) {
+            virBufferSetError(buf, errno);
+            return;
+        }
+        out = escaped;
+        suffix = NULL;
+        suffixLen = 0;
+    }
+
     cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (strchr(toescape, *cur))
-            *out++ = escape;
-        *out++ = *cur;
-        cur++;
+    while (true) {
+        n = strcspn(cur, toescape);
+        memcpy(out, cur, n);
+        out += n;
+        cur += n;
+        if (!*cur)
+            break;
+        *out++ = escape;
+        *out++ = *cur++;
+    }
+
+    if (!escaped) {
+        memcpy(out, suffix, suffixLen);
+        out += suffixLen;
+        *out = '\0';
+        buf->use = out - buf->content;
+        return;
     }
-    *out = 0;
 
+    *out = '\0';
     virBufferAsprintf(buf, format, escaped);
     VIR_FREE(escaped);
 }
@@ -87,9 +87,22 @@ typedef enum {
                                        * before creating subcgroups and
                                        * attaching tasks
                                        */
+    VIR_CGROUP_THREAD = 1 << 1, /* create a threaded group in the unified
+                                 * hierarchy */
 } virCgroupFlags;
 
 
+/* Names under which the controllers are known in the cgroup v2
+ * unified hierarchy, NULL if there is no unified counterpart */
+static const char *virCgroupUnifiedControllers[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "cpu",
+    [VIR_CGROUP_CONTROLLER_CPUACCT] = "cpu",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "cpuset",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "memory",
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "io",
+};
+
+
 /**
  * virCgroupGetDevicePermsString:
  *
@@ -145,9 +158,10 @@ virCgroupAvailable(void)
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
         /* We're looking for at least one 'cgroup' fs mount,
-         * which is *not* a named mount. */
-        if (STREQ(entry.mnt_type, "cgroup") &&
-            !strstr(entry.mnt_opts, "name=")) {
+         * which is *not* a named mount, or the unified hierarchy. */
+        if ((STREQ(entry.mnt_type, "cgroup") &&
+             !strstr(entry.mnt_opts, "name=")) ||
+            STREQ(entry.mnt_type, "cgroup2")) {
             ret = true;
             break;
         }
@@ -360,11 +374,63 @@ virCgroupCopyMounts(virCgroupPtr group,
         if (VIR_STRDUP(group->controllers[i].linkPoint,
                        parent->controllers[i].linkPoint) < 0)
             return -1;
+
+        group->controllers[i].unified = parent->controllers[i].unified;
     }
     return 0;
 }
 
 
+/*
+ * Attach the controllers enabled in the cgroup v2 hierarchy mounted
+ * at @mntdir which have not been found in any v1 hierarchy
+ */
+static int
+virCgroupDetectUnifiedControllers(virCgroupPtr group,
+                                  const char *mntdir)
+{
+    char *path = NULL;
+    char *str = NULL;
+    char **names = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/cgroup.controllers", mntdir) < 0)
+        return -1;
+
+    if (virFileReadAllQuiet(path, 1024, &str) < 0) {
+        VIR_DEBUG("Unable to read %s, ignoring unified hierarchy", path);
+        ret = 0;
+        goto cleanup;
+    }
+
+    virTrimSpaces(str, NULL);
+    if (!(names = virStringSplit(str, " ", 0)))
+        goto cleanup;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        struct virCgroupController *controller = &group->controllers[i];
+
+        if (controller->mountPoint ||
+            !virCgroupUnifiedControllers[i] ||
+            !virStringListHasString((const char **) names,
+                                    virCgroupUnifiedControllers[i]))
+            continue;
+
+        if (VIR_STRDUP(controller->mountPoint, mntdir) < 0)
+            goto cleanup;
+        controller->unified = true;
+    }
+
+    ret = 0;
+ cleanup:
+    virStringListFree(names);
+    VIR_FREE(str);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 /*
  * Process /proc/mounts figuring out what controllers are
  * mounted and where
@@ -379,6 +445,7 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     struct mntent entry;
     char buf[CGROUP_MAX_VAL];
     char *linksrc = NULL;
+    char *unified = NULL;
     int ret = -1;
 
     mounts = fopen(path, "r");
@@ -388,6 +455,13 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     }
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
+        if (STREQ(entry.mnt_type, "cgroup2")) {
+            VIR_FREE(unified);
+            if (VIR_STRDUP(unified, entry.mnt_dir) < 0)
+                goto cleanup;
+            continue;
+        }
+
         if (STRNEQ(entry.mnt_type, "cgroup"))
             continue;
 
@@ -466,8 +540,15 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
         }
     }
 
+    /* Controllers bound to a v1 hierarchy take precedence, the unified
+     * hierarchy provides the rest */
+    if (unified &&
+        virCgroupDetectUnifiedControllers(group, unified) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
+    VIR_FREE(unified);
     VIR_FREE(linksrc);
     VIR_FORCE_FCLOSE(mounts);
     return ret;
@@ -535,6 +616,10 @@ virCgroupCopyPlacement(virCgroupPtr group,
  * 3:cpuacct,cpu:/
  * 2:cpuset:/
  * 1:name=systemd:/user/berrange/2
+ * 0::/user/berrange/2
+ *
+ * where the line with an empty list of controllers gives the
+ * placement in the unified hierarchy.
  *
  * It then appends @path to each detected path.
  */
@@ -583,6 +668,23 @@ virCgroupDetectPlacement(virCgroupPtr group,
         controllers++;
         selfpath++;
 
+        if (*controllers == '\0') {
+            for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+                if (!group->controllers[i].unified ||
+                    !group->controllers[i].mountPoint ||
+                    group->controllers[i].placement)
+                    continue;
+
+                if (virAsprintf(&group->controllers[i].placement,
+                                "%s%s%s", selfpath,
+                                (STREQ(selfpath, "/") ||
+                                 STREQ(path, "") ? "" : "/"),
+                                path) < 0)
+                    goto cleanup;
+            }
+            continue;
+        }
+
         for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
             const char *typestr = virCgroupControllerTypeToString(i);
             int typelen = strlen(typestr);
@@ -604,6 +706,7 @@ virCgroupDetectPlacement(virCgroupPtr group,
                  * selfpath == "/libvirt.service" + path == "foo" -> "/libvirt.service/foo"
                  */
                 if (typelen == len && STREQLEN(typestr, tmp, len) &&
+                    !group->controllers[i].unified &&
                     group->controllers[i].mountPoint != NULL &&
                     group->controllers[i].placement == NULL) {
                     if (i == VIR_CGROUP_CONTROLLER_SYSTEMD) {
@@ -683,6 +786,12 @@ virCgroupDetect(virCgroupPtr group,
                     if (!((1 << j) & controllers))
                         continue;
 
+                    /* Controllers of the unified hierarchy are enabled
+                     * independently of each other */
+                    if (group->controllers[i].unified &&
+                        group->controllers[j].unified)
+                        continue;
+
                     if (STREQ_NULLABLE(group->controllers[i].mountPoint,
                                        group->controllers[j].mountPoint)) {
                         virReportSystemError(EINVAL,
@@ -780,6 +889,183 @@ virCgroupGetBlockDevString(const char *path)
 }
 
 
+/* Accounting files which are read over and over again while polling
+ * domain statistics. Their fds are kept open for as long as the
+ * virCgroup lives and are re-read with pread() */
+static const char *virCgroupCachedFiles[] = {
+    "cpuacct.usage",
+    "cpuacct.stat",
+    "cpuacct.usage_percpu",
+    "blkio.throttle.io_serviced",
+    "blkio.throttle.io_service_bytes",
+    "cpu.stat",
+    "io.stat",
+    NULL
+};
+
+/* Upper bound on the number of fds cached across all groups, so that
+ * hosts with many domains don't run out of file descriptors */
+#define VIR_CGROUP_MAX_CACHED_FDS 1024
+
+/* Protects the fdCache of every group and virCgroupCachedFDs */
+static virMutex virCgroupFDCacheLock = VIR_MUTEX_INITIALIZER;
+static size_t virCgroupCachedFDs;
+
+
+static void
+virCgroupCachedFDFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    int *fd = payload;
+
+    VIR_FORCE_CLOSE(*fd);
+    VIR_FREE(fd);
+    virCgroupCachedFDs--;
+}
+
+
+static void
+virCgroupCloseCachedFiles(virCgroupPtr group)
+{
+    virMutexLock(&virCgroupFDCacheLock);
+    virHashFree(group->fdCache);
+    group->fdCache = NULL;
+    virMutexUnlock(&virCgroupFDCacheLock);
+}
+
+
+/* Returns an fd to read @keypath from, either one cached in @group or a
+ * new one. @cached tells whether the fd must be left open by the caller */
+static int
+virCgroupOpenCached(virCgroupPtr group,
+                    const char *keypath,
+                    bool *cached)
+{
+    int *fdptr;
+    int fd;
+
+    *cached = false;
+
+    virMutexLock(&virCgroupFDCacheLock);
+
+    if (group->fdCache &&
+        (fdptr = virHashLookup(group->fdCache, keypath))) {
+        *cached = true;
+        fd = *fdptr;
+        goto cleanup;
+    }
+
+    if ((fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0)
+        goto cleanup;
+
+    if (virCgroupCachedFDs >= VIR_CGROUP_MAX_CACHED_FDS)
+        goto cleanup;
+
+    if (!group->fdCache &&
+        !(group->fdCache = virHashCreate(8, virCgroupCachedFDFree)))
+        goto nocache;
+
+    if (VIR_ALLOC(fdptr) < 0)
+        goto nocache;
+    *fdptr = fd;
+
+    if (virHashAddEntry(group->fdCache, keypath, fdptr) < 0) {
+        VIR_FREE(fdptr);
+        goto nocache;
+    }
+
+    virCgroupCachedFDs++;
+    *cached = true;
+
+ cleanup:
+    virMutexUnlock(&virCgroupFDCacheLock);
+    return fd;
+
+ nocache:
+    /* Not being able to cache the fd is no reason to fail the read */
+    virResetLastError();
+    goto cleanup;
+}
+
+
+static void
+virCgroupDropCached(virCgroupPtr group,
+                    const char *keypath)
+{
+    virMutexLock(&virCgroupFDCacheLock);
+    if (group->fdCache)
+        virHashRemoveEntry(group->fdCache, keypath);
+    virMutexUnlock(&virCgroupFDCacheLock);
+}
+
+
+/* Read the whole of @keypath through a cached fd. Cgroup files are
+ * generated on each read, so a short read means the end of the file */
+static int
+virCgroupReadCached(virCgroupPtr group,
+                    const char *keypath,
+                    char **value)
+{
+    char *buf = NULL;
+    size_t alloc = 0;
+    size_t len = 0;
+    size_t avail;
+    bool cached = false;
+    bool retried = false;
+    ssize_t got;
+    int fd;
+    int ret = -1;
+
+ retry:
+    if ((fd = virCgroupOpenCached(group, keypath, &cached)) < 0)
+        goto error;
+
+    len = 0;
+    while (true) {
+        if (alloc - len < 1024) {
+            if (alloc >= 1024 * 1024) {
+                errno = E2BIG;
+                goto error;
+            }
+            if (VIR_RESIZE_N(buf, alloc, len, 4096) < 0)
+                goto cleanup;
+        }
+        avail = alloc - len - 1;
+
+        if ((got = pread(fd, buf + len, avail, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            /* The group may have been recreated behind our back */
+            if (cached && !retried) {
+                virCgroupDropCached(group, keypath);
+                retried = true;
+                goto retry;
+            }
+            goto error;
+        }
+
+        len += got;
+        if ((size_t) got < avail)
+            break;
+    }
+
+    buf[len] = '\0';
+    *value = buf;
+    buf = NULL;
+    ret = len;
+
+ cleanup:
+    if (!cached)
+        VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    return ret;
+
+ error:
+    virReportSystemError(errno, _("Unable to read from '%s'"), keypath);
+    goto cleanup;
+}
+
+
 static int
 virCgroupSetValueStr(virCgroupPtr group,
                      int controller,
@@ -831,7 +1117,10 @@ virCgroupGetValueStr(virCgroupPtr group,
 
     VIR_DEBUG("Get value %s", keypath);
 
-    if ((rc = virFileReadAll(keypath, 1024*1024, value)) < 0) {
+    if (virStringListHasString(virCgroupCachedFiles, key)) {
+        if ((rc = virCgroupReadCached(group, keypath, value)) < 0)
+            goto cleanup;
+    } else if ((rc = virFileReadAll(keypath, 1024*1024, value)) < 0) {
         virReportSystemError(errno,
                              _("Unable to read from '%s'"), keypath);
         goto cleanup;
@@ -849,6 +1138,29 @@ virCgroupGetValueStr(virCgroupPtr group,
 }
 
 
+/* Read several files of one controller of @group at once. On success
+ * @values holds one newly allocated string per item of @keys */
+static int
+virCgroupGetValuesStr(virCgroupPtr group,
+                      int controller,
+                      const char *const *keys,
+                      size_t nkeys,
+                      char **values)
+{
+    size_t i;
+
+    for (i = 0; i < nkeys; i++) {
+        if (virCgroupGetValueStr(group, controller, keys[i], &values[i]) < 0) {
+            while (i--)
+                VIR_FREE(values[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 virCgroupGetValueForBlkDev(virCgroupPtr group,
                            int controller,
@@ -976,6 +1288,94 @@ virCgroupGetValueU64(virCgroupPtr group,
 }
 
 
+/*
+ * Parse the value of @name out of @str, which holds a list of
+ * "name=value" pairs as found in the io.max and io.stat files of
+ * the unified hierarchy. A value of "max" is reported as 0.
+ *
+ * Returns 1 if @name was found, 0 if not and -1 on error
+ */
+static int
+virCgroupParseNestedKey(const char *str,
+                        const char *name,
+                        unsigned long long *value)
+{
+    size_t len = strlen(name);
+    const char *p = str;
+    char *end;
+
+    while (p && *p) {
+        while (*p == ' ')
+            p++;
+
+        if (STREQLEN(p, name, len) && p[len] == '=') {
+            p += len + 1;
+            if (STRPREFIX(p, "max")) {
+                *value = 0;
+            } else if (virStrToLong_ull(p, &end, 10, value) < 0 ||
+                       (*end != ' ' && *end != '\0')) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to parse '%s' as an integer"),
+                               p);
+                return -1;
+            }
+            return 1;
+        }
+
+        if ((p = strchr(p, ' ')))
+            p++;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Read a unified hierarchy file holding one "name value" pair per
+ * line, such as cpu.stat, and fill in @values for each of @names.
+ */
+static int
+virCgroupGetKeyedValuesU64(virCgroupPtr group,
+                           int controller,
+                           const char *key,
+                           const char *const *names,
+                           unsigned long long *values,
+                           size_t nnames)
+{
+    char *str = NULL;
+    char *p;
+    char *end;
+    size_t i;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, controller, key, &str) < 0)
+        return -1;
+
+    for (i = 0; i < nnames; i++) {
+        size_t len = strlen(names[i]);
+
+        p = str;
+        while (p && !(STREQLEN(p, names[i], len) && p[len] == ' ')) {
+            if ((p = strchr(p, '\n')))
+                p++;
+        }
+
+        if (!p || virStrToLong_ull(p + len + 1, &end, 10, &values[i]) < 0 ||
+            (*end != '\n' && *end != '\0')) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse '%s' from '%s'"),
+                           names[i], key);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
 static int
 virCgroupCpuSetInherit(virCgroupPtr parent, virCgroupPtr group)
 {
@@ -1037,6 +1437,28 @@ virCgroupSetMemoryUseHierarchy(virCgroupPtr group)
 }
 
 
+/* Delegate @controller of the unified hierarchy to the children
+ * of @parent */
+static int
+virCgroupEnableSubtreeControl(virCgroupPtr parent, int controller)
+{
+    char *value = NULL;
+    int ret;
+
+    if (virAsprintf(&value, "+%s",
+                    virCgroupUnifiedControllers[controller]) < 0)
+        return -1;
+
+    ret = virCgroupSetValueStr(parent, controller,
+                               "cgroup.subtree_control", value);
+    if (ret < 0)
+        virResetLastError();
+
+    VIR_FREE(value);
+    return ret;
+}
+
+
 static int
 virCgroupMakeGroup(virCgroupPtr parent,
                    virCgroupPtr group,
@@ -1049,6 +1471,7 @@ virCgroupMakeGroup(virCgroupPtr parent,
     VIR_DEBUG("Make group %s", group->path);
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         char *path = NULL;
+        bool unified = group->controllers[i].unified;
 
         /* We must never mkdir() in systemd's hierarchy */
         if (i == VIR_CGROUP_CONTROLLER_SYSTEMD) {
@@ -1070,6 +1493,17 @@ virCgroupMakeGroup(virCgroupPtr parent,
          * call did not modify group. */
         sa_assert(group->controllers[i].mountPoint);
 
+        /* In the unified hierarchy a controller is only available
+         * to children once the parent delegates it to its subtree */
+        if (unified && create && parent &&
+            virCgroupEnableSubtreeControl(parent, i) < 0) {
+            VIR_DEBUG("Ignoring unavailable unified controller %s",
+                      virCgroupControllerTypeToString(i));
+            VIR_FREE(group->controllers[i].mountPoint);
+            VIR_FREE(path);
+            continue;
+        }
+
         VIR_DEBUG("Make controller %s", path);
         if (!virFileExists(path)) {
             if (!create ||
@@ -1095,7 +1529,13 @@ virCgroupMakeGroup(virCgroupPtr parent,
                     goto cleanup;
                 }
             }
-            if (group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].mountPoint != NULL &&
+            if (unified && (flags & VIR_CGROUP_THREAD) &&
+                virCgroupSetValueStr(group, i, "cgroup.type", "threaded") < 0) {
+                VIR_FREE(path);
+                goto cleanup;
+            }
+            if (!unified &&
+                group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].mountPoint != NULL &&
                 (i == VIR_CGROUP_CONTROLLER_CPUSET ||
                  STREQ(group->controllers[i].mountPoint,
                        group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].mountPoint))) {
@@ -1108,7 +1548,8 @@ virCgroupMakeGroup(virCgroupPtr parent,
              * Note that virCgroupSetMemoryUseHierarchy should always be
              * called prior to creating subcgroups and attaching tasks.
              */
-            if ((flags & VIR_CGROUP_MEM_HIERACHY) &&
+            if (!unified &&
+                (flags & VIR_CGROUP_MEM_HIERACHY) &&
                 (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].mountPoint != NULL) &&
                 (i == VIR_CGROUP_CONTROLLER_MEMORY ||
                  STREQ(group->controllers[i].mountPoint,
@@ -1123,6 +1564,9 @@ virCgroupMakeGroup(virCgroupPtr parent,
         VIR_FREE(path);
     }
 
+    if (flags & VIR_CGROUP_THREAD)
+        group->threaded = true;
+
     VIR_DEBUG("Done making controllers for group");
     ret = 0;
 
@@ -1185,17 +1629,61 @@ virCgroupNew(pid_t pid,
 }
 
 
+/* Pick the controller used when the caller doesn't care which */
+static int
+virCgroupGetAnyController(virCgroupPtr group)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        /* Reject any controller with a placement
+         * of '/' to avoid doing bad stuff to the root
+         * cgroup
+         */
+        if (group->controllers[i].mountPoint &&
+            group->controllers[i].placement &&
+            STRNEQ(group->controllers[i].placement, "/"))
+            return i;
+    }
+
+    return -1;
+}
+
+
+/* The file listing the tasks of @controller in @group */
+static const char *
+virCgroupGetTasksFile(virCgroupPtr group, int controller)
+{
+    if (controller == -1)
+        controller = virCgroupGetAnyController(group);
+
+    if (controller < 0 || controller >= VIR_CGROUP_CONTROLLER_LAST ||
+        !group->controllers[controller].unified)
+        return "tasks";
+
+    return group->threaded ? "cgroup.threads" : "cgroup.procs";
+}
+
+
 static int
 virCgroupAddTaskInternal(virCgroupPtr group, pid_t pid, bool withSystemd)
 {
     int ret = -1;
     size_t i;
+    bool unifiedDone = false;
 
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
             continue;
 
+        /* All unified controllers share a single directory */
+        if (group->controllers[i].unified) {
+            if (unifiedDone)
+                continue;
+            unifiedDone = true;
+        }
+
         /* We must never add tasks in systemd's hierarchy
          * unless we're intentionally trying to move a
          * task into a systemd machine scope */
@@ -1271,7 +1759,9 @@ virCgroupAddTaskController(virCgroupPtr group, pid_t pid, int controller)
         return -1;
     }
 
-    return virCgroupSetValueI64(group, controller, "tasks", pid);
+    return virCgroupSetValueI64(group, controller,
+                                virCgroupGetTasksFile(group, controller),
+                                pid);
 }
 
 
@@ -1507,7 +1997,7 @@ virCgroupNewThread(virCgroupPtr domain,
     if (virCgroupNew(-1, name, domain, controllers, group) < 0)
         goto cleanup;
 
-    if (virCgroupMakeGroup(domain, *group, create, VIR_CGROUP_NONE) < 0) {
+    if (virCgroupMakeGroup(domain, *group, create, VIR_CGROUP_THREAD) < 0) {
         virCgroupRemove(*group);
         virCgroupFree(group);
         goto cleanup;
@@ -1793,6 +2283,8 @@ virCgroupFree(virCgroupPtr *group)
     if (*group == NULL)
         return;
 
+    virCgroupCloseCachedFiles(*group);
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         VIR_FREE((*group)->controllers[i].mountPoint);
         VIR_FREE((*group)->controllers[i].linkPoint);
@@ -1830,21 +2322,8 @@ virCgroupPathOfController(virCgroupPtr group,
                           const char *key,
                           char **path)
 {
-    if (controller == -1) {
-        size_t i;
-        for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
-            /* Reject any controller with a placement
-             * of '/' to avoid doing bad stuff to the root
-             * cgroup
-             */
-            if (group->controllers[i].mountPoint &&
-                group->controllers[i].placement &&
-                STRNEQ(group->controllers[i].placement, "/")) {
-                controller = i;
-                break;
-            }
-        }
-    }
+    if (controller == -1)
+        controller = virCgroupGetAnyController(group);
     if (controller == -1) {
         virReportSystemError(ENOSYS, "%s",
                              _("No controllers are mounted"));
@@ -1875,6 +2354,139 @@ virCgroupPathOfController(virCgroupPtr group,
 }
 
 
+/*
+ * Sum up the io.stat counters of the unified hierarchy, either of
+ * all devices or of the device at @path only
+ */
+static int
+virCgroupGetUnifiedIoStat(virCgroupPtr group,
+                          const char *path,
+                          long long *bytes_read,
+                          long long *bytes_write,
+                          long long *requests_read,
+                          long long *requests_write)
+{
+    const char *names[] = { "rbytes", "wbytes", "rios", "wios" };
+    long long *ptrs[] = {
+        bytes_read, bytes_write, requests_read, requests_write
+    };
+    char *str = NULL;
+    char *prefix = NULL;
+    char **lines = NULL;
+    bool found = false;
+    size_t i, j;
+    int ret = -1;
+
+    for (j = 0; j < ARRAY_CARDINALITY(ptrs); j++)
+        *ptrs[j] = 0;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                             "io.stat", &str) < 0)
+        goto cleanup;
+
+    if (path && !(prefix = virCgroupGetBlockDevString(path)))
+        goto cleanup;
+
+    if (!(lines = virStringSplit(str, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        const char *line = lines[i];
+
+        if (prefix && !(line = STRSKIP(line, prefix)))
+            continue;
+        found = true;
+
+        for (j = 0; j < ARRAY_CARDINALITY(names); j++) {
+            unsigned long long val;
+            int rc;
+
+            if ((rc = virCgroupParseNestedKey(line, names[j], &val)) < 0)
+                goto cleanup;
+            if (rc == 0)
+                continue;
+
+            if (val > LLONG_MAX - *ptrs[j]) {
+                virReportError(VIR_ERR_OVERFLOW,
+                               _("Sum of %s stat overflows"), names[j]);
+                goto cleanup;
+            }
+            *ptrs[j] += val;
+        }
+    }
+
+    if (prefix && !found) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot find stats for block device '%s'"),
+                       prefix);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virStringListFree(lines);
+    VIR_FREE(prefix);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/* Set the @name throttle of the device at @path in io.max, 0 to clear */
+static int
+virCgroupSetUnifiedBlkioLimit(virCgroupPtr group,
+                              const char *path,
+                              const char *name,
+                              unsigned long long value)
+{
+    char *str = NULL;
+    char *blkstr = NULL;
+    int ret = -1;
+
+    if (!(blkstr = virCgroupGetBlockDevString(path)))
+        return -1;
+
+    if (value == 0)
+        ret = virAsprintf(&str, "%s%s=max", blkstr, name);
+    else
+        ret = virAsprintf(&str, "%s%s=%llu", blkstr, name, value);
+    if (ret < 0)
+        goto cleanup;
+
+    ret = virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                               "io.max", str);
+ cleanup:
+    VIR_FREE(blkstr);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/* Get the @name throttle of the device at @path from io.max, 0 if none */
+static int
+virCgroupGetUnifiedBlkioLimit(virCgroupPtr group,
+                              const char *path,
+                              const char *name,
+                              unsigned long long *value)
+{
+    char *str = NULL;
+    int ret = -1;
+
+    *value = 0;
+
+    if (virCgroupGetValueForBlkDev(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                   "io.max", path, &str) < 0)
+        goto cleanup;
+
+    if (str && virCgroupParseNestedKey(str, name, value) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
 /**
  * virCgroupGetBlkioIoServiced:
  *
@@ -1911,6 +2523,11 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
         requests_write
     };
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupGetUnifiedIoStat(group, NULL,
+                                         bytes_read, bytes_write,
+                                         requests_read, requests_write);
+
     *bytes_read = 0;
     *bytes_write = 0;
     *requests_read = 0;
@@ -2020,6 +2637,11 @@ virCgroupGetBlkioIoDeviceServiced(virCgroupPtr group,
         requests_write
     };
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupGetUnifiedIoStat(group, path,
+                                         bytes_read, bytes_write,
+                                         requests_read, requests_write);
+
     if (virCgroupGetValueStr(group,
                              VIR_CGROUP_CONTROLLER_BLKIO,
                              "blkio.throttle.io_service_bytes", &str1) < 0)
@@ -2098,6 +2720,12 @@ virCgroupGetBlkioIoDeviceServiced(virCgroupPtr group,
 int
 virCgroupSetBlkioWeight(virCgroupPtr group, unsigned int weight)
 {
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupSetValueU64(group,
+                                    VIR_CGROUP_CONTROLLER_BLKIO,
+                                    "io.weight",
+                                    weight);
+
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_BLKIO,
                                 "blkio.weight",
@@ -2118,6 +2746,27 @@ virCgroupGetBlkioWeight(virCgroupPtr group, unsigned int *weight)
 {
     unsigned long long tmp;
     int ret;
+
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified) {
+        char *str = NULL;
+        char *p;
+
+        if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                 "io.weight", &str) < 0)
+            return -1;
+
+        /* The first line holds the default weight, "default N" */
+        if (!(p = STRSKIP(str, "default ")) ||
+            virStrToLong_ui(p, NULL, 10, weight) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse '%s' as a weight"), str);
+            VIR_FREE(str);
+            return -1;
+        }
+        VIR_FREE(str);
+        return 0;
+    }
+
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_BLKIO,
                                "blkio.weight", &tmp);
@@ -2143,6 +2792,9 @@ virCgroupSetBlkioDeviceReadIops(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupSetUnifiedBlkioLimit(group, path, "riops", riops);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2177,6 +2829,9 @@ virCgroupSetBlkioDeviceWriteIops(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupSetUnifiedBlkioLimit(group, path, "wiops", wiops);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2211,6 +2866,9 @@ virCgroupSetBlkioDeviceReadBps(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupSetUnifiedBlkioLimit(group, path, "rbps", rbps);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2244,6 +2902,9 @@ virCgroupSetBlkioDeviceWriteBps(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupSetUnifiedBlkioLimit(group, path, "wbps", wbps);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2278,16 +2939,24 @@ virCgroupSetBlkioDeviceWeight(virCgroupPtr group,
     char *str = NULL;
     char *blkstr = NULL;
     int ret = -1;
+    int rc;
+    bool unified = group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified;
 
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
-    if (virAsprintf(&str, "%s%d", blkstr, weight) < 0)
+    if (!unified)
+        rc = virAsprintf(&str, "%s%d", blkstr, weight);
+    else if (weight == 0)
+        rc = virAsprintf(&str, "%sdefault", blkstr);
+    else
+        rc = virAsprintf(&str, "%s%u", blkstr, weight);
+    if (rc < 0)
         goto error;
 
     ret = virCgroupSetValueStr(group,
                                VIR_CGROUP_CONTROLLER_BLKIO,
-                               "blkio.weight_device",
+                               unified ? "io.weight" : "blkio.weight_device",
                                str);
  error:
     VIR_FREE(blkstr);
@@ -2311,6 +2980,15 @@ virCgroupGetBlkioDeviceReadIops(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified) {
+        unsigned long long tmp;
+
+        if (virCgroupGetUnifiedBlkioLimit(group, path, "riops", &tmp) < 0)
+            return -1;
+        *riops = tmp;
+        return 0;
+    }
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.read_iops_device",
@@ -2349,6 +3027,15 @@ virCgroupGetBlkioDeviceWriteIops(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified) {
+        unsigned long long tmp;
+
+        if (virCgroupGetUnifiedBlkioLimit(group, path, "wiops", &tmp) < 0)
+            return -1;
+        *wiops = tmp;
+        return 0;
+    }
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.write_iops_device",
@@ -2387,6 +3074,9 @@ virCgroupGetBlkioDeviceReadBps(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupGetUnifiedBlkioLimit(group, path, "rbps", rbps);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.read_bps_device",
@@ -2425,6 +3115,9 @@ virCgroupGetBlkioDeviceWriteBps(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified)
+        return virCgroupGetUnifiedBlkioLimit(group, path, "wbps", wbps);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.write_bps_device",
@@ -2465,7 +3158,8 @@ virCgroupGetBlkioDeviceWeight(virCgroupPtr group,
 
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
-                                   "blkio.weight_device",
+                                   group->controllers[VIR_CGROUP_CONTROLLER_BLKIO].unified ?
+                                   "io.weight" : "blkio.weight_device",
                                    path,
                                    &str) < 0)
         goto error;
@@ -2531,6 +3225,54 @@ virCgroupGetMemoryUnlimitedKB(void)
 }
 
 
+/* Set a memory limit file of the unified hierarchy, where "max"
+ * stands for no limit */
+static int
+virCgroupSetUnifiedMemoryLimit(virCgroupPtr group,
+                               const char *key,
+                               unsigned long long kb)
+{
+    if (kb == VIR_DOMAIN_MEMORY_PARAM_UNLIMITED)
+        return virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                    key, "max");
+
+    return virCgroupSetValueU64(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                key, kb << 10);
+}
+
+
+static int
+virCgroupGetUnifiedMemoryLimit(virCgroupPtr group,
+                               const char *key,
+                               unsigned long long *kb)
+{
+    char *str = NULL;
+    unsigned long long value;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                             key, &str) < 0)
+        return -1;
+
+    if (STREQ(str, "max")) {
+        *kb = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
+    } else if (virStrToLong_ull(str, NULL, 10, &value) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s' as an integer"), str);
+        goto cleanup;
+    } else {
+        *kb = value >> 10;
+        if (*kb >= VIR_DOMAIN_MEMORY_PARAM_UNLIMITED)
+            *kb = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
 /**
  * virCgroupSetMemory:
  *
@@ -2551,6 +3293,9 @@ virCgroupSetMemory(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupSetUnifiedMemoryLimit(group, "memory.max", kb);
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2579,7 +3324,9 @@ virCgroupGetMemoryUsage(virCgroupPtr group, unsigned long *kb)
     int ret;
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_MEMORY,
-                               "memory.usage_in_bytes", &usage_in_bytes);
+                               group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified ?
+                               "memory.current" : "memory.usage_in_bytes",
+                               &usage_in_bytes);
     if (ret == 0)
         *kb = (unsigned long) usage_in_bytes >> 10;
     return ret;
@@ -2614,6 +3361,9 @@ virCgroupGetMemoryHardLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupGetUnifiedMemoryLimit(group, "memory.max", kb);
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.limit_in_bytes", &limit_in_bytes) < 0)
@@ -2647,6 +3397,9 @@ virCgroupSetMemorySoftLimit(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupSetUnifiedMemoryLimit(group, "memory.high", kb);
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2673,6 +3426,9 @@ virCgroupGetMemorySoftLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupGetUnifiedMemoryLimit(group, "memory.high", kb);
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.soft_limit_in_bytes", &limit_in_bytes) < 0)
@@ -2706,6 +3462,9 @@ virCgroupSetMemSwapHardLimit(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupSetUnifiedMemoryLimit(group, "memory.swap.max", kb);
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2732,6 +3491,9 @@ virCgroupGetMemSwapHardLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified)
+        return virCgroupGetUnifiedMemoryLimit(group, "memory.swap.max", kb);
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.memsw.limit_in_bytes", &limit_in_bytes) < 0)
@@ -2760,7 +3522,9 @@ virCgroupGetMemSwapUsage(virCgroupPtr group, unsigned long long *kb)
     int ret;
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_MEMORY,
-                               "memory.memsw.usage_in_bytes", &usage_in_bytes);
+                               group->controllers[VIR_CGROUP_CONTROLLER_MEMORY].unified ?
+                               "memory.swap.current" : "memory.memsw.usage_in_bytes",
+                               &usage_in_bytes);
     if (ret == 0)
         *kb = usage_in_bytes >> 10;
     return ret;
@@ -2814,6 +3578,12 @@ virCgroupGetCpusetMems(virCgroupPtr group, char **mems)
 int
 virCgroupSetCpusetMemoryMigrate(virCgroupPtr group, bool migrate)
 {
+    /* The unified cpuset controller always leaves memory in place */
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].unified) {
+        VIR_DEBUG("Ignoring memory migration setting in unified hierarchy");
+        return 0;
+    }
+
     return virCgroupSetValueStr(group,
                                 VIR_CGROUP_CONTROLLER_CPUSET,
                                 "cpuset.memory_migrate",
@@ -2833,10 +3603,17 @@ int
 virCgroupGetCpusetMemoryMigrate(virCgroupPtr group, bool *migrate)
 {
     unsigned long long value = 0;
-    int ret = virCgroupGetValueU64(group,
-                                   VIR_CGROUP_CONTROLLER_CPUSET,
-                                   "cpuset.memory_migrate",
-                                   &value);
+    int ret;
+
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUSET].unified) {
+        *migrate = false;
+        return 0;
+    }
+
+    ret = virCgroupGetValueU64(group,
+                               VIR_CGROUP_CONTROLLER_CPUSET,
+                               "cpuset.memory_migrate",
+                               &value);
     *migrate = !!value;
     return ret;
 }
@@ -3349,7 +4126,9 @@ virCgroupSetCpuShares(virCgroupPtr group, unsigned long long shares)
 {
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
-                                "cpu.shares", shares);
+                                group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified ?
+                                "cpu.weight" : "cpu.shares",
+                                shares);
 }
 
 
@@ -3358,7 +4137,47 @@ virCgroupGetCpuShares(virCgroupPtr group, unsigned long long *shares)
 {
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
-                                "cpu.shares", shares);
+                                group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified ?
+                                "cpu.weight" : "cpu.shares",
+                                shares);
+}
+
+
+/*
+ * Parse cpu.max of the unified hierarchy, "$QUOTA $PERIOD" where
+ * a quota of "max" stands for no limit and is reported as -1
+ */
+static int
+virCgroupGetUnifiedCpuMax(virCgroupPtr group,
+                          long long *quota,
+                          unsigned long long *period)
+{
+    char *str = NULL;
+    char *p;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                             "cpu.max", &str) < 0)
+        return -1;
+
+    if ((p = STRSKIP(str, "max"))) {
+        *quota = -1;
+    } else if (virStrToLong_ll(str, &p, 10, quota) < 0) {
+        goto error;
+    }
+
+    if (*p != ' ' || virStrToLong_ull(p + 1, NULL, 10, period) < 0)
+        goto error;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Unable to parse cpu.max value '%s'"), str);
+    goto cleanup;
 }
 
 
@@ -3383,6 +4202,29 @@ virCgroupSetCpuCfsPeriod(virCgroupPtr group, unsigned long long cfs_period)
         return -1;
     }
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified) {
+        long long quota;
+        unsigned long long period;
+        char *str = NULL;
+        int ret;
+
+        /* The quota has to be written back along with the period */
+        if (virCgroupGetUnifiedCpuMax(group, &quota, &period) < 0)
+            return -1;
+
+        if (quota < 0)
+            ret = virAsprintf(&str, "max %llu", cfs_period);
+        else
+            ret = virAsprintf(&str, "%lld %llu", quota, cfs_period);
+        if (ret < 0)
+            return -1;
+
+        ret = virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                                   "cpu.max", str);
+        VIR_FREE(str);
+        return ret;
+    }
+
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_period_us", cfs_period);
@@ -3400,6 +4242,12 @@ virCgroupSetCpuCfsPeriod(virCgroupPtr group, unsigned long long cfs_period)
 int
 virCgroupGetCpuCfsPeriod(virCgroupPtr group, unsigned long long *cfs_period)
 {
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified) {
+        long long quota;
+
+        return virCgroupGetUnifiedCpuMax(group, &quota, cfs_period);
+    }
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_period_us", cfs_period);
@@ -3428,6 +4276,15 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
         return -1;
     }
 
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified) {
+        if (cfs_quota < 0)
+            return virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                                        "cpu.max", "max");
+
+        return virCgroupSetValueI64(group, VIR_CGROUP_CONTROLLER_CPU,
+                                    "cpu.max", cfs_quota);
+    }
+
     return virCgroupSetValueI64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_quota_us", cfs_quota);
@@ -3437,6 +4294,12 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 {
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].unified) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("per-CPU usage is not available in the unified cgroup hierarchy"));
+        return -1;
+    }
+
     return virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage_percpu", usage);
 }
@@ -3511,6 +4374,8 @@ virCgroupRemove(virCgroupPtr group)
     char *grppath = NULL;
 
     VIR_DEBUG("Removing cgroup %s", group->path);
+    virCgroupCloseCachedFiles(group);
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -3555,7 +4420,8 @@ virCgroupKillInternal(virCgroupPtr group, int signum, virHashTablePtr pids)
     VIR_DEBUG("group=%p path=%s signum=%d pids=%p",
               group, group->path, signum, pids);
 
-    if (virCgroupPathOfController(group, -1, "tasks", &keypath) < 0)
+    if (virCgroupPathOfController(group, -1, virCgroupGetTasksFile(group, -1),
+                                  &keypath) < 0)
         return -1;
 
     /* PIDs may be forking as we kill them, so loop
@@ -3827,47 +4693,81 @@ virCgroupIdentifyRoot(virCgroupPtr group)
 int
 virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 {
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPU].unified) {
+        unsigned long long period;
+
+        return virCgroupGetUnifiedCpuMax(group, cfs_quota, &period);
+    }
+
     return virCgroupGetValueI64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_quota_us", cfs_quota);
 }
 
 
+/*
+ * Fetch the CPU times from cpu.stat of the unified hierarchy, which
+ * reports them all at once in microseconds, scaled into nanoseconds
+ */
+static int
+virCgroupGetUnifiedCpuStat(virCgroupPtr group,
+                           unsigned long long *usage,
+                           unsigned long long *user,
+                           unsigned long long *sys)
+{
+    const char *names[] = { "usage_usec", "user_usec", "system_usec" };
+    unsigned long long values[ARRAY_CARDINALITY(names)];
+
+    if (virCgroupGetKeyedValuesU64(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                   "cpu.stat", names, values,
+                                   ARRAY_CARDINALITY(names)) < 0)
+        return -1;
+
+    if (usage)
+        *usage = values[0] * 1000;
+    if (user)
+        *user = values[1] * 1000;
+    if (sys)
+        *sys = values[2] * 1000;
+
+    return 0;
+}
+
+
 int
 virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].unified)
+        return virCgroupGetUnifiedCpuStat(group, usage, NULL, NULL);
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage", usage);
 }
 
 
-int
-virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
-                        unsigned long long *sys)
+/* Parse the contents of cpuacct.stat, scaled into nanoseconds */
+static int
+virCgroupParseCpuacctStat(char *str,
+                          unsigned long long *user,
+                          unsigned long long *sys)
 {
-    char *str;
     char *p;
-    int ret = -1;
     static double scale = -1.0;
 
-    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                             "cpuacct.stat", &str) < 0)
-        return -1;
-
     if (!(p = STRSKIP(str, "user ")) ||
         virStrToLong_ull(p, &p, 10, user) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Cannot parse user stat '%s'"),
                        p);
-        goto cleanup;
+        return -1;
     }
     if (!(p = STRSKIP(p, "\nsystem ")) ||
         virStrToLong_ull(p, NULL, 10, sys) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Cannot parse sys stat '%s'"),
                        p);
-        goto cleanup;
+        return -1;
     }
     /* times reported are in system ticks (generally 100 Hz), but that
      * rate can theoretically vary between machines.  Scale things
@@ -3877,16 +4777,81 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
         if (ticks_per_sec == -1) {
             virReportSystemError(errno, "%s",
                                  _("Cannot determine system clock HZ"));
-            goto cleanup;
+            return -1;
         }
         scale = 1000000000.0 / ticks_per_sec;
     }
     *user *= scale;
     *sys *= scale;
 
+    return 0;
+}
+
+
+int
+virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
+                        unsigned long long *sys)
+{
+    char *str;
+    int ret;
+
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].unified)
+        return virCgroupGetUnifiedCpuStat(group, NULL, user, sys);
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                             "cpuacct.stat", &str) < 0)
+        return -1;
+
+    ret = virCgroupParseCpuacctStat(str, user, sys);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/**
+ * virCgroupGetCpuacctTimes:
+ * @group: The cgroup to query
+ * @usage: Pointer to the total CPU time
+ * @user: Pointer to the user CPU time
+ * @sys: Pointer to the system CPU time
+ *
+ * Fetch the total, user and system CPU time of @group, in nanoseconds,
+ * in a single pass over the cpuacct controller.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+virCgroupGetCpuacctTimes(virCgroupPtr group,
+                         unsigned long long *usage,
+                         unsigned long long *user,
+                         unsigned long long *sys)
+{
+    const char *keys[] = { "cpuacct.usage", "cpuacct.stat" };
+    char *values[ARRAY_CARDINALITY(keys)] = { NULL };
+    int ret = -1;
+    size_t i;
+
+    if (group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].unified)
+        return virCgroupGetUnifiedCpuStat(group, usage, user, sys);
+
+    if (virCgroupGetValuesStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                              keys, ARRAY_CARDINALITY(keys), values) < 0)
+        return -1;
+
+    if (virStrToLong_ull(values[0], NULL, 10, usage) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s' as an integer"),
+                       values[0]);
+        goto cleanup;
+    }
+
+    if (virCgroupParseCpuacctStat(values[1], user, sys) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
-    VIR_FREE(str);
+    for (i = 0; i < ARRAY_CARDINALITY(values); i++)
+        VIR_FREE(values[i]);
     return ret;
 }
 
@@ -4078,7 +5043,9 @@ virCgroupSupportsCpuBW(virCgroupPtr cgroup)
         return false;
 
     if (virCgroupPathOfController(cgroup, VIR_CGROUP_CONTROLLER_CPU,
-                                  "cpu.cfs_period_us", &path) < 0) {
+                                  cgroup->controllers[VIR_CGROUP_CONTROLLER_CPU].unified ?
+                                  "cpu.max" : "cpu.cfs_period_us",
+                                  &path) < 0) {
         virResetLastError();
         goto cleanup;
     }
@@ -4099,7 +5066,9 @@ virCgroupHasEmptyTasks(virCgroupPtr cgroup, int controller)
     if (!cgroup)
         return -1;
 
-    ret = virCgroupGetValueStr(cgroup, controller, "tasks", &content);
+    ret = virCgroupGetValueStr(cgroup, controller,
+                               virCgroupGetTasksFile(cgroup, controller),
+                               &content);
 
     if (ret == 0 && content[0] == '\0')
         ret = 1;
@@ -4789,6 +5758,18 @@ virCgroupGetCpuacctUsage(virCgroupPtr group ATTRIBUTE_UNUSED,
 }
 
 
+int
+virCgroupGetCpuacctTimes(virCgroupPtr group ATTRIBUTE_UNUSED,
+                         unsigned long long *usage ATTRIBUTE_UNUSED,
+                         unsigned long long *user ATTRIBUTE_UNUSED,
+                         unsigned long long *sys ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group ATTRIBUTE_UNUSED,
                                char **usage ATTRIBUTE_UNUSED)
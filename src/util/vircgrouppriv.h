@@ -30,6 +30,7 @@
 # define __VIR_CGROUP_PRIV_H__
 
 # include "vircgroup.h"
+# include "virhash.h"
 
 struct virCgroupController {
     int type;
@@ -40,12 +41,20 @@ struct virCgroupController {
      */
     char *linkPoint;
     char *placement;
+    /* Whether the controller lives in the cgroup v2 unified hierarchy */
+    bool unified;
 };
 
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Whether tasks are threads of a threaded unified subtree */
+    bool threaded;
+
+    /* Open fds of frequently read files, keyed by path */
+    virHashTablePtr fdCache;
 };
 
 int virCgroupDetectMountsFromFile(virCgroupPtr group,
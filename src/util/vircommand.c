@@ -30,6 +30,10 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
 
 #if WITH_CAPNG
 # include <cap-ng.h>
@@ -279,6 +283,186 @@ virCommandReorderFDs(virCommandPtr cmd)
     return;
 }
 
+static int
+virCommandFDCompare(const void *a, const void *b)
+{
+    int fda = *(const int *)a;
+    int fdb = *(const int *)b;
+
+    return fda - fdb;
+}
+
+
+/*
+ * virCommandMassCloseRange:
+ * @first: first FD to close
+ * @last: last FD to close, inclusive
+ *
+ * Close every FD in the range [@first, @last] with a single
+ * close_range() syscall.
+ *
+ * Returns: 0 on success,
+ *          -1 with errno set if the kernel lacks close_range().
+ */
+static int
+virCommandMassCloseRange(unsigned int first,
+                         unsigned int last)
+{
+# if defined(__linux__) && defined(__NR_close_range)
+    return syscall(__NR_close_range, first, last, 0);
+# else
+    errno = ENOSYS;
+    return -1;
+# endif
+}
+
+
+/*
+ * virCommandMassCloseProcFD:
+ * @keep: sorted list of FDs to keep open
+ * @nkeep: size of @keep
+ *
+ * Close every FD above stderr that is not in @keep by enumerating
+ * /proc/self/fd, so that only FDs which are really open are visited.
+ *
+ * Returns: 0 on success,
+ *          -1 with errno set if /proc is not available.
+ */
+static int
+virCommandMassCloseProcFD(int *keep,
+                          size_t nkeep)
+{
+    DIR *dir;
+    struct dirent *entry;
+    int dfd;
+
+    if (!(dir = opendir("/proc/self/fd")))
+        return -1;
+
+    dfd = dirfd(dir);
+    while ((entry = readdir(dir))) {
+        int fd;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (virStrToLong_i(entry->d_name, NULL, 10, &fd) < 0 ||
+            fd <= STDERR_FILENO || fd == dfd ||
+            bsearch(&fd, keep, nkeep, sizeof(*keep), virCommandFDCompare))
+            continue;
+
+        VIR_MASS_CLOSE(fd);
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+
+/*
+ * virCommandMassClose:
+ * @cmd: the command being executed
+ * @childin: child's stdin FD
+ * @childout: child's stdout FD
+ * @childerr: child's stderr FD
+ *
+ * Called in the child after fork() to close all FDs except those
+ * passed to the child and the ones about to become its std streams.
+ * Looping over all possible FDs up to _SC_OPEN_MAX is very slow with
+ * a large RLIMIT_NOFILE, so ranges between the kept FDs are closed
+ * via close_range() or, if unavailable, by walking /proc/self/fd.
+ * The full loop is used only as the last resort.
+ *
+ * Returns: 0 on success,
+ *         -1 on error (with error reported).
+ */
+static int
+virCommandMassClose(virCommandPtr cmd,
+                    int childin,
+                    int childout,
+                    int childerr)
+{
+    int *keep = NULL;
+    size_t nkeep = 0;
+    size_t i;
+    int openmax;
+    int fd;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keep, cmd->npassfd + 3) < 0)
+        return -1;
+
+    for (i = 0; i < cmd->npassfd; i++) {
+        fd = cmd->passfd[i].fd;
+        if (fd <= STDERR_FILENO)
+            continue;
+
+        if (virSetInherit(fd, true) < 0) {
+            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
+            goto cleanup;
+        }
+        keep[nkeep++] = fd;
+    }
+
+    if (childin > STDERR_FILENO)
+        keep[nkeep++] = childin;
+    if (childout > STDERR_FILENO)
+        keep[nkeep++] = childout;
+    if (childerr > STDERR_FILENO)
+        keep[nkeep++] = childerr;
+
+    qsort(keep, nkeep, sizeof(*keep), virCommandFDCompare);
+
+    fd = STDERR_FILENO + 1;
+    for (i = 0; i <= nkeep; i++) {
+        unsigned int last = i < nkeep ? keep[i] - 1 : ~0U;
+
+        if (i < nkeep && keep[i] < fd) {
+            /* Duplicate entry, e.g. stdout and stderr sharing an FD */
+            continue;
+        }
+
+        if (last >= (unsigned int) fd &&
+            virCommandMassCloseRange(fd, last) < 0)
+            break;
+
+        if (i < nkeep)
+            fd = keep[i] + 1;
+    }
+
+    if (i > nkeep) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCommandMassCloseProcFD(keep, nkeep) == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    openmax = sysconf(_SC_OPEN_MAX);
+    if (openmax < 0) {
+        virReportSystemError(errno,  "%s",
+                             _("sysconf(_SC_OPEN_MAX) failed"));
+        goto cleanup;
+    }
+
+    for (fd = STDERR_FILENO + 1; fd < openmax; fd++) {
+        int tmpfd = fd;
+
+        if (bsearch(&fd, keep, nkeep, sizeof(*keep), virCommandFDCompare))
+            continue;
+
+        VIR_MASS_CLOSE(tmpfd);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(keep);
+    return ret;
+}
+
 /**
  * virFork:
  *
@@ -502,13 +686,12 @@ static int
 virExec(virCommandPtr cmd)
 {
     pid_t pid;
-    int null = -1, fd, openmax;
+    int null = -1;
     int pipeout[2] = {-1, -1};
     int pipeerr[2] = {-1, -1};
     int childin = cmd->infd;
     int childout = -1;
     int childerr = -1;
-    int tmpfd;
     char *binarystr = NULL;
     const char *binary = NULL;
     int ret;
@@ -617,23 +800,8 @@ virExec(virCommandPtr cmd)
     if (cmd->mask)
         umask(cmd->mask);
     ret = EXIT_CANCELED;
-    openmax = sysconf(_SC_OPEN_MAX);
-    if (openmax < 0) {
-        virReportSystemError(errno,  "%s",
-                             _("sysconf(_SC_OPEN_MAX) failed"));
+    if (virCommandMassClose(cmd, childin, childout, childerr) < 0)
         goto fork_error;
-    }
-    for (fd = 3; fd < openmax; fd++) {
-        if (fd == childin || fd == childout || fd == childerr)
-            continue;
-        if (!virCommandFDIsSet(cmd, fd)) {
-            tmpfd = fd;
-            VIR_MASS_CLOSE(tmpfd);
-        } else if (virSetInherit(fd, true) < 0) {
-            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
-            goto fork_error;
-        }
-    }
 
     if (prepareStdFd(childin, STDIN_FILENO) < 0) {
         virReportSystemError(errno,
@@ -1655,3 +1655,16 @@ bool virLastErrorIsSystemErrno(int errnum)
         return false;
     return true;
 }
+
+
+/**
+ * virErrorDomainName:
+ * @domcode: the virErrorDomain value
+ *
+ * Returns the human readable name of @domcode, the empty string for
+ * VIR_FROM_NONE, or NULL if @domcode is not valid
+ */
+const char *virErrorDomainName(int domcode)
+{
+    return virErrorDomainTypeToString(domcode);
+}
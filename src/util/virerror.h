@@ -194,4 +194,6 @@ bool virLastErrorIsSystemErrno(int errnum);
 void virErrorPreserveLast(virErrorPtr *saveerr);
 void virErrorRestore(virErrorPtr *savederr);
 
+const char *virErrorDomainName(int domcode);
+
 #endif
@@ -190,6 +190,42 @@ virEventRemoveTimeout(int timer)
 }
 
 
+/*
+ * virEventAddHandleAffinity:
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from virEventHandleType constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ * @ff: callback to free opaque when handle is removed
+ * @key: hint to pick the event loop thread
+ * @node: host NUMA node to prefer, or -1
+ *
+ * Like virEventAddHandle, but when the default event loop runs extra
+ * threads, handles with the same @key are dispatched from the same
+ * thread, preferably one bound to @node. Other implementations just get
+ * the handle added as usual.
+ *
+ * Returns -1 if the file handle cannot be registered, otherwise a handle
+ * watch number to be used for updating and unregistering for events.
+ */
+int
+virEventAddHandleAffinity(int fd,
+                          int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff,
+                          unsigned int key,
+                          int node)
+{
+    if (addHandleImpl == virEventPollAddHandle)
+        return virEventPollAddHandleAffinity(fd, events, cb, opaque, ff,
+                                             key, node);
+
+    return virEventAddHandle(fd, events, cb, opaque, ff);
+}
+
+
 /**
  * virEventRegisterImpl:
  * @addHandle: the callback to add fd handles
@@ -25,4 +25,12 @@
 # define __VIR_EVENT_H__
 # include "internal.h"
 
+int virEventAddHandleAffinity(int fd,
+                              int events,
+                              virEventHandleCallback cb,
+                              void *opaque,
+                              virFreeCallback ff,
+                              unsigned int key,
+                              int node);
+
 #endif /* __VIR_EVENT_H__ */
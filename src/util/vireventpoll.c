@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 
 #include "virthread.h"
 #include "virlog.h"
@@ -40,6 +43,10 @@
 #include "virerror.h"
 #include "virprobe.h"
 #include "virtime.h"
+#include "virstring.h"
+#include "virnuma.h"
+#include "virprocess.h"
+#include "virbitmap.h"
 
 #define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
 
@@ -47,7 +54,8 @@
 
 VIR_LOG_INIT("util.eventpoll");
 
-static int virEventPollInterruptLocked(void);
+struct virEventPollLoop;
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop);
 
 /* State for a single file handle being monitored */
 struct virEventPollHandle {
@@ -65,18 +73,51 @@ struct virEventPollTimeout {
     int timer;
     int frequency;
     unsigned long long expiresAt;
+    unsigned long long heapSeq; /* Sequence of the live heap entry, 0 if none */
     virEventTimeoutCallback cb;
     virFreeCallback ff;
     void *opaque;
     int deleted;
 };
 
+/* Entry in the timer heap. Entries are never modified in place,
+ * rescheduling a timer pushes a new entry and the old one is
+ * discarded once it bubbles up to the top of the heap */
+struct virEventPollTimeoutEntry {
+    unsigned long long expiresAt;
+    unsigned long long seq;
+    int timer;
+};
+
+#if HAVE_SYS_EPOLL_H
+/* State for a file descriptor watched through epoll */
+struct virEventPollFD {
+    size_t nwatches; /* Number of live handles using the fd */
+    int watch;       /* Watch of the handle if nwatches == 1 */
+    int events;      /* Native events the fd is registered for */
+    bool registered; /* Whether the fd is in the epoll set */
+    bool fallback;   /* epoll refused the fd, it is always ready */
+};
+
+/* Maximum number of events fetched by a single epoll_wait */
+# define EVENT_EPOLL_MAX_EVENTS 64
+#endif
+
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
    records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
 
-/* State for the main event loop */
+/* Maximum number of event loops, including the main one. The
+ * index of the loop a handle belongs to is encoded in the low
+ * bits of its watch */
+#define EVENT_LOOP_MAX 16
+#define EVENT_WATCH_LOOP(watch) ((watch) % EVENT_LOOP_MAX)
+
+/* State for an event loop */
 struct virEventPollLoop {
+    size_t id;
+    int node; /* Host NUMA node the thread runs on, -1 if any */
+    virBitmapPtr cpus; /* CPUs of @node */
     virMutex lock;
     int running;
     virThread leader;
@@ -84,91 +125,511 @@ struct virEventPollLoop {
     size_t handlesCount;
     size_t handlesAlloc;
     struct virEventPollHandle *handles;
+    int nextWatch; /* Sequence of the next FD watch to be registered */
     size_t timeoutsCount;
     size_t timeoutsAlloc;
     struct virEventPollTimeout *timeouts;
+    int nextTimer; /* Unique ID for the next timer to be registered */
+
+    /* Min-heap of pending timer expiries */
+    size_t heapCount;
+    size_t heapAlloc;
+    struct virEventPollTimeoutEntry *heap;
+    unsigned long long heapSeq;
+    /* Scratch space for the timers due in a single iteration */
+    size_t expiredAlloc;
+    struct virEventPollTimeoutEntry *expired;
+
+#if HAVE_SYS_EPOLL_H
+    bool useEpoll;
+    int epollfd;
+    size_t fdsAlloc;
+    struct virEventPollFD *fds; /* Indexed by file descriptor */
+    size_t nfallback;
+#endif
 };
 
-/* Only have one event loop */
-static struct virEventPollLoop eventLoop;
+/* The main event loop is always the first one, the others only
+ * exist after virEventPollStartLoops and only serve handles
+ * registered by virEventPollAddHandleAffinity */
+static struct virEventPollLoop eventLoops[EVENT_LOOP_MAX];
+static size_t nEventLoops = 1;
+
+static struct virEventPollLoop *virEventPollLoopForWatch(int watch)
+{
+    if (EVENT_WATCH_LOOP(watch) >= nEventLoops)
+        return NULL;
+    return &eventLoops[EVENT_WATCH_LOOP(watch)];
+}
+
+
+/*
+ * Handles and timeouts are only ever appended and purging
+ * keeps their relative order, so both arrays are sorted by
+ * their IDs and can be searched by bisection.
+ * returns: the index of @watch, or -1 if not registered
+ */
+static ssize_t virEventPollFindHandle(struct virEventPollLoop *loop,
+                                      int watch)
+{
+    size_t lo = 0;
+    size_t hi = loop->handlesCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (loop->handles[mid].watch == watch)
+            return mid;
+        if (loop->handles[mid].watch < watch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+static ssize_t virEventPollFindTimeout(struct virEventPollLoop *loop,
+                                       int timer)
+{
+    size_t lo = 0;
+    size_t hi = loop->timeoutsCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (loop->timeouts[mid].timer == timer)
+            return mid;
+        if (loop->timeouts[mid].timer < timer)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+
+static bool
+virEventPollTimeoutEntryLess(const struct virEventPollTimeoutEntry *a,
+                             const struct virEventPollTimeoutEntry *b)
+{
+    if (a->expiresAt != b->expiresAt)
+        return a->expiresAt < b->expiresAt;
+    return a->seq < b->seq;
+}
+
+/* Whether @entry still describes when its timer is due */
+static bool
+virEventPollTimeoutEntryValid(struct virEventPollLoop *loop,
+                              const struct virEventPollTimeoutEntry *entry)
+{
+    ssize_t i = virEventPollFindTimeout(loop, entry->timer);
+
+    return i >= 0 &&
+        !loop->timeouts[i].deleted &&
+        loop->timeouts[i].frequency >= 0 &&
+        loop->timeouts[i].heapSeq == entry->seq;
+}
+
+static void virEventPollTimeoutHeapSiftUp(struct virEventPollLoop *loop,
+                                          size_t i)
+{
+    struct virEventPollTimeoutEntry entry = loop->heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!virEventPollTimeoutEntryLess(&entry, &loop->heap[parent]))
+            break;
+        loop->heap[i] = loop->heap[parent];
+        i = parent;
+    }
+    loop->heap[i] = entry;
+}
+
+static void virEventPollTimeoutHeapSiftDown(struct virEventPollLoop *loop,
+                                            size_t i)
+{
+    struct virEventPollTimeoutEntry entry = loop->heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= loop->heapCount)
+            break;
+        if (child + 1 < loop->heapCount &&
+            virEventPollTimeoutEntryLess(&loop->heap[child + 1],
+                                         &loop->heap[child]))
+            child++;
+        if (!virEventPollTimeoutEntryLess(&loop->heap[child], &entry))
+            break;
+        loop->heap[i] = loop->heap[child];
+        i = child;
+    }
+    loop->heap[i] = entry;
+}
+
+static void virEventPollTimeoutHeapPop(struct virEventPollLoop *loop)
+{
+    loop->heapCount--;
+    if (loop->heapCount > 0) {
+        loop->heap[0] = loop->heap[loop->heapCount];
+        virEventPollTimeoutHeapSiftDown(loop, 0);
+    }
+}
+
+/* Drop all stale entries and restore the heap property */
+static void virEventPollTimeoutHeapCompact(struct virEventPollLoop *loop)
+{
+    size_t i;
+    size_t n = 0;
+
+    for (i = 0; i < loop->heapCount; i++) {
+        if (virEventPollTimeoutEntryValid(loop, &loop->heap[i]))
+            loop->heap[n++] = loop->heap[i];
+    }
+    loop->heapCount = n;
+
+    for (i = n / 2; i > 0; i--)
+        virEventPollTimeoutHeapSiftDown(loop, i - 1);
+}
+
+/*
+ * Make room for the heap entries of one more timer. The heap
+ * is kept at least twice as large as the number of timers so
+ * that pushing never needs to allocate and stale entries only
+ * need compacting every so often.
+ */
+static int virEventPollTimeoutHeapReserve(struct virEventPollLoop *loop)
+{
+    size_t want = loop->timeoutsCount + 1;
+
+    if (VIR_RESIZE_N(loop->heap, loop->heapAlloc, want, want) < 0 ||
+        VIR_RESIZE_N(loop->expired, loop->expiredAlloc, want, 0) < 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * (Re)arm the timer at index @i to fire @frequency ms from @now,
+ * or disarm it if @frequency is negative
+ */
+static void virEventPollTimeoutSchedule(struct virEventPollLoop *loop,
+                                        size_t i,
+                                        int frequency,
+                                        unsigned long long now)
+{
+    struct virEventPollTimeout *t = &loop->timeouts[i];
+    struct virEventPollTimeoutEntry *entry;
+
+    t->frequency = frequency;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+    t->heapSeq = 0;
+
+    if (frequency < 0)
+        return;
+
+    if (loop->heapCount == loop->heapAlloc)
+        virEventPollTimeoutHeapCompact(loop);
+
+    t->heapSeq = ++loop->heapSeq;
+    entry = &loop->heap[loop->heapCount++];
+    entry->expiresAt = t->expiresAt;
+    entry->seq = t->heapSeq;
+    entry->timer = t->timer;
+    virEventPollTimeoutHeapSiftUp(loop, loop->heapCount - 1);
+}
+
+
+#if HAVE_SYS_EPOLL_H
+static int virEventPollToEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    if (events & POLLERR)
+        ret |= EPOLLERR;
+    if (events & POLLHUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+static int virEventPollFromEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+/*
+ * epoll only allows a file descriptor to be registered once,
+ * so bring the registration of @fd in line with the union of
+ * the events of all live handles using it.
+ * returns: 0 on success, -1 on error
+ */
+static int virEventPollEpollSync(struct virEventPollLoop *loop,
+                                 int fd)
+{
+    struct virEventPollFD *efd = &loop->fds[fd];
+    struct epoll_event ev;
+    int events = 0;
+    int op;
+    size_t i;
+
+    if (efd->nwatches == 1) {
+        ssize_t idx = virEventPollFindHandle(loop, efd->watch);
+
+        if (idx >= 0)
+            events = loop->handles[idx].events;
+    } else if (efd->nwatches > 1) {
+        for (i = 0; i < loop->handlesCount; i++) {
+            if (loop->handles[i].fd == fd &&
+                !loop->handles[i].deleted)
+                events |= loop->handles[i].events;
+        }
+    }
+
+    if (efd->fallback) {
+        if (efd->nwatches == 0) {
+            efd->fallback = false;
+            loop->nfallback--;
+        }
+        efd->events = events;
+        return 0;
+    }
+
+    if (events == efd->events && (events != 0) == efd->registered)
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = virEventPollToEpollEvents(events);
+    ev.data.fd = fd;
+
+    if (events == 0) {
+        /* The fd may well have been closed already, in which
+         * case the kernel dropped it from the set by itself */
+        if (efd->registered &&
+            epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, fd, &ev) < 0 &&
+            errno != ENOENT && errno != EBADF)
+            VIR_WARN("Unable to remove fd %d from epoll set", fd);
+        efd->registered = false;
+        efd->events = 0;
+        return 0;
+    }
+
+    op = efd->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epollfd, op, fd, &ev) < 0) {
+        /* A closed fd whose number was reused by a new handle
+         * is gone from the set, so re-add it */
+        if (op == EPOLL_CTL_MOD && errno == ENOENT)
+            op = EPOLL_CTL_ADD;
+        if (op != EPOLL_CTL_ADD ||
+            epoll_ctl(loop->epollfd, op, fd, &ev) < 0) {
+            if (errno == EPERM) {
+                /* Regular files cannot be watched by epoll, but
+                 * poll() reports them as always ready, so match that */
+                efd->fallback = true;
+                efd->registered = false;
+                efd->events = events;
+                loop->nfallback++;
+                return 0;
+            }
+            virReportSystemError(errno,
+                                 _("Unable to watch fd %d with epoll"), fd);
+            return -1;
+        }
+    }
+
+    efd->registered = true;
+    efd->events = events;
+    return 0;
+}
+
+/* Forget about a handle with @fd which was just marked as deleted */
+static void virEventPollEpollRemoveWatch(struct virEventPollLoop *loop,
+                                         int fd)
+{
+    struct virEventPollFD *efd = &loop->fds[fd];
+    size_t i;
+
+    efd->nwatches--;
+    if (efd->nwatches == 1) {
+        for (i = 0; i < loop->handlesCount; i++) {
+            if (loop->handles[i].fd == fd &&
+                !loop->handles[i].deleted) {
+                efd->watch = loop->handles[i].watch;
+                break;
+            }
+        }
+    }
 
-/* Unique ID for the next FD watch to be registered */
-static int nextWatch = 1;
+    ignore_value(virEventPollEpollSync(loop, fd));
+}
+#endif /* HAVE_SYS_EPOLL_H */
 
-/* Unique ID for the next timer to be registered */
-static int nextTimer = 1;
 
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
  * For this reason we only ever append to existing list.
  */
-int virEventPollAddHandle(int fd, int events,
-                          virEventHandleCallback cb,
-                          void *opaque,
-                          virFreeCallback ff)
+static int virEventPollAddHandleLoop(struct virEventPollLoop *loop,
+                                     int fd, int events,
+                                     virEventHandleCallback cb,
+                                     void *opaque,
+                                     virFreeCallback ff)
 {
     int watch;
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.handlesCount == eventLoop.handlesAlloc) {
+    virMutexLock(&loop->lock);
+    if (loop->handlesCount == loop->handlesAlloc) {
         EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
-                    eventLoop.handlesAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
-                         eventLoop.handlesCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->handlesAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->handles, loop->handlesAlloc,
+                         loop->handlesCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
             return -1;
         }
     }
 
-    watch = nextWatch++;
+    watch = loop->nextWatch++ * EVENT_LOOP_MAX + loop->id;
 
-    eventLoop.handles[eventLoop.handlesCount].watch = watch;
-    eventLoop.handles[eventLoop.handlesCount].fd = fd;
-    eventLoop.handles[eventLoop.handlesCount].events =
+    loop->handles[loop->handlesCount].watch = watch;
+    loop->handles[loop->handlesCount].fd = fd;
+    loop->handles[loop->handlesCount].events =
                                          virEventPollToNativeEvents(events);
-    eventLoop.handles[eventLoop.handlesCount].cb = cb;
-    eventLoop.handles[eventLoop.handlesCount].ff = ff;
-    eventLoop.handles[eventLoop.handlesCount].opaque = opaque;
-    eventLoop.handles[eventLoop.handlesCount].deleted = 0;
+    loop->handles[loop->handlesCount].cb = cb;
+    loop->handles[loop->handlesCount].ff = ff;
+    loop->handles[loop->handlesCount].opaque = opaque;
+    loop->handles[loop->handlesCount].deleted = 0;
+
+    loop->handlesCount++;
+
+#if HAVE_SYS_EPOLL_H
+    /* poll() ignores negative fds, so there is nothing to watch */
+    if (loop->useEpoll && fd >= 0) {
+        if (VIR_RESIZE_N(loop->fds, loop->fdsAlloc, fd, 1) < 0) {
+            loop->handlesCount--;
+            virMutexUnlock(&loop->lock);
+            return -1;
+        }
+
+        if (loop->fds[fd].nwatches++ == 0)
+            loop->fds[fd].watch = watch;
 
-    eventLoop.handlesCount++;
+        if (virEventPollEpollSync(loop, fd) < 0) {
+            loop->handlesCount--;
+            loop->fds[fd].nwatches--;
+            virMutexUnlock(&loop->lock);
+            return -1;
+        }
+    }
+#endif
 
-    virEventPollInterruptLocked();
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_HANDLE,
           "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
           watch, fd, events, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     return watch;
 }
 
-void virEventPollUpdateHandle(int watch, int events)
+int virEventPollAddHandle(int fd, int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff)
+{
+    return virEventPollAddHandleLoop(&eventLoops[0], fd, events,
+                                     cb, opaque, ff);
+}
+
+/* Pick the extra loop for @key among the ones running on @node, or
+ * among all of them if none does */
+static struct virEventPollLoop *virEventPollLoopForKey(unsigned int key,
+                                                       int node)
 {
+    size_t nnode = 0;
     size_t i;
-    bool found = false;
+
+    if (nEventLoops == 1)
+        return &eventLoops[0];
+
+    if (node >= 0) {
+        for (i = 1; i < nEventLoops; i++) {
+            if (eventLoops[i].node == node)
+                nnode++;
+        }
+    }
+
+    if (nnode == 0)
+        return &eventLoops[1 + key % (nEventLoops - 1)];
+
+    key %= nnode;
+    for (i = 1; i < nEventLoops; i++) {
+        if (eventLoops[i].node == node && key-- == 0)
+            break;
+    }
+
+    return &eventLoops[i];
+}
+
+int virEventPollAddHandleAffinity(int fd, int events,
+                                  virEventHandleCallback cb,
+                                  void *opaque,
+                                  virFreeCallback ff,
+                                  unsigned int key,
+                                  int node)
+{
+    return virEventPollAddHandleLoop(virEventPollLoopForKey(key, node),
+                                     fd, events, cb, opaque, ff);
+}
+
+void virEventPollUpdateHandle(int watch, int events)
+{
+    struct virEventPollLoop *loop;
+    ssize_t i;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
           watch, events);
 
-    if (watch <= 0) {
+    if (watch <= 0 || !(loop = virEventPollLoopForWatch(watch))) {
         VIR_WARN("Ignoring invalid update watch %d", watch);
         return;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindHandle(loop, watch)) >= 0) {
+        loop->handles[i].events =
+                virEventPollToNativeEvents(events);
+#if HAVE_SYS_EPOLL_H
+        /* The kernel picks up epoll_ctl changes immediately,
+         * so there is no need to wake up the loop */
+        if (loop->useEpoll) {
+            if (loop->handles[i].fd >= 0 &&
+                !loop->handles[i].deleted)
+                ignore_value(virEventPollEpollSync(loop, loop->handles[i].fd));
+        } else {
+            virEventPollInterruptLocked(loop);
         }
+#else
+        virEventPollInterruptLocked(loop);
+#endif
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
-    if (!found)
+    if (i < 0)
         VIR_WARN("Got update for non-existent handle watch %d", watch);
 }
 
@@ -180,30 +641,31 @@ void virEventPollUpdateHandle(int watch, int events)
  */
 int virEventPollRemoveHandle(int watch)
 {
-    size_t i;
+    struct virEventPollLoop *loop;
+    ssize_t i;
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
 
-    if (watch <= 0) {
+    if (watch <= 0 || !(loop = virEventPollLoopForWatch(watch))) {
         VIR_WARN("Ignoring invalid remove watch %d", watch);
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %zu %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindHandle(loop, watch)) >= 0 &&
+        !loop->handles[i].deleted) {
+        EVENT_DEBUG("mark delete %zd %d", i, loop->handles[i].fd);
+        loop->handles[i].deleted = 1;
+#if HAVE_SYS_EPOLL_H
+        if (loop->useEpoll && loop->handles[i].fd >= 0)
+            virEventPollEpollRemoveWatch(loop, loop->handles[i].fd);
+#endif
+        virEventPollInterruptLocked(loop);
+        virMutexUnlock(&loop->lock);
+        return 0;
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
     return -1;
 }
 
@@ -218,48 +680,52 @@ int virEventPollAddTimeout(int frequency,
                            void *opaque,
                            virFreeCallback ff)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
     unsigned long long now;
     int ret;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
+    virMutexLock(&loop->lock);
+    if (loop->timeoutsCount == loop->timeoutsAlloc) {
         EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
-                    eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->timeoutsAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->timeouts, loop->timeoutsAlloc,
+                         loop->timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
             return -1;
         }
     }
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
+    if (virEventPollTimeoutHeapReserve(loop) < 0) {
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+
+    loop->timeouts[loop->timeoutsCount].timer = loop->nextTimer++;
+    loop->timeouts[loop->timeoutsCount].cb = cb;
+    loop->timeouts[loop->timeoutsCount].ff = ff;
+    loop->timeouts[loop->timeoutsCount].opaque = opaque;
+    loop->timeouts[loop->timeoutsCount].deleted = 0;
 
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
-    virEventPollInterruptLocked();
+    loop->timeoutsCount++;
+    virEventPollTimeoutSchedule(loop, loop->timeoutsCount - 1, frequency, now);
+    ret = loop->nextTimer-1;
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
           "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
           ret, frequency, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
     return ret;
 }
 
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
     unsigned long long now;
-    size_t i;
-    bool found = false;
+    ssize_t i;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
           timer, frequency);
@@ -272,22 +738,16 @@ void virEventPollUpdateTimeout(int timer, int frequency)
     if (virTimeMillisNow(&now) < 0)
         return;
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindTimeout(loop, timer)) >= 0) {
+        virEventPollTimeoutSchedule(loop, i, frequency, now);
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  loop->timeouts[i].expiresAt);
+        virEventPollInterruptLocked(loop);
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
-    if (!found)
+    if (i < 0)
         VIR_WARN("Got update for non-existent timer %d", timer);
 }
 
@@ -299,7 +759,8 @@ void virEventPollUpdateTimeout(int timer, int frequency)
  */
 int virEventPollRemoveTimeout(int timer)
 {
-    size_t i;
+    struct virEventPollLoop *loop = &eventLoops[0];
+    ssize_t i;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -309,44 +770,37 @@ int virEventPollRemoveTimeout(int timer)
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindTimeout(loop, timer)) >= 0 &&
+        !loop->timeouts[i].deleted) {
+        loop->timeouts[i].deleted = 1;
+        virEventPollInterruptLocked(loop);
+        virMutexUnlock(&loop->lock);
+        return 0;
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
     return -1;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Looks at the top of the timer heap to determine which
+ * timeout will be the first to expire.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
  */
-static int virEventPollCalculateTimeout(int *timeout)
+static int virEventPollCalculateTimeout(struct virEventPollLoop *loop,
+                                        int *timeout)
 {
     unsigned long long then = 0;
-    size_t i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
-    /* Figure out if we need a timeout */
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
+    EVENT_DEBUG("Calculate expiry of %zu timers", loop->timeoutsCount);
+
+    while (loop->heapCount > 0 &&
+           !virEventPollTimeoutEntryValid(loop, &loop->heap[0]))
+        virEventPollTimeoutHeapPop(loop);
 
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
+    if (loop->heapCount > 0) {
+        then = loop->heap[0].expiresAt;
+        EVENT_DEBUG("Got a timeout scheduled for %llu", then);
     }
 
     /* Calculate how long we should wait for a timeout if needed */
@@ -378,13 +832,14 @@ static int virEventPollCalculateTimeout(int *timeout)
  * file handles. The caller must free the returned data struct
  * returns: the pollfd array, or NULL on error
  */
-static struct pollfd *virEventPollMakePollFDs(int *nfds) {
+static struct pollfd *virEventPollMakePollFDs(struct virEventPollLoop *loop,
+                                              int *nfds) {
     struct pollfd *fds;
     size_t i;
 
     *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].events && !eventLoop.handles[i].deleted)
+    for (i = 0; i < loop->handlesCount; i++) {
+        if (loop->handles[i].events && !loop->handles[i].deleted)
             (*nfds)++;
     }
 
@@ -393,16 +848,16 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
         return NULL;
 
     *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
+    for (i = 0; i < loop->handlesCount; i++) {
         EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
-                    eventLoop.handles[i].watch,
-                    eventLoop.handles[i].fd,
-                    eventLoop.handles[i].events,
-                    eventLoop.handles[i].deleted);
-        if (!eventLoop.handles[i].events || eventLoop.handles[i].deleted)
+                    loop->handles[i].watch,
+                    loop->handles[i].fd,
+                    loop->handles[i].events,
+                    loop->handles[i].deleted);
+        if (!loop->handles[i].events || loop->handles[i].deleted)
             continue;
-        fds[*nfds].fd = eventLoop.handles[i].fd;
-        fds[*nfds].events = eventLoop.handles[i].events;
+        fds[*nfds].fd = loop->handles[i].fd;
+        fds[*nfds].events = loop->handles[i].events;
         fds[*nfds].revents = 0;
         (*nfds)++;
     }
@@ -412,7 +867,7 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 
 
 /*
- * Iterate over all timers and determine if any have expired.
+ * Pop all timers which have expired off the timer heap.
  * Invoke the user supplied callback for each timer whose
  * expiry time is met, and schedule the next timeout. Does
  * not try to 'catch up' on time if the actual expiry time
@@ -423,40 +878,58 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchTimeouts(void)
+static int virEventPollDispatchTimeouts(struct virEventPollLoop *loop)
 {
     unsigned long long now;
+    size_t nexpired = 0;
     size_t i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    VIR_DEBUG("Dispatch %zu", loop->timeoutsCount);
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0; i < ntimeouts; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
+    /* Collect everything that is due before running any callback,
+     * so that rescheduled timers are not run twice in a row, and
+     * timers added by a callback wait for the next iteration */
+    while (loop->heapCount > 0) {
+        if (!virEventPollTimeoutEntryValid(loop, &loop->heap[0])) {
+            virEventPollTimeoutHeapPop(loop);
             continue;
+        }
 
         /* Add 20ms fuzz so we don't pointlessly spin doing
          * <10ms sleeps, particularly on kernels with low HZ
          * it is fine that a timer expires 20ms earlier than
          * requested
          */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+        if (loop->heap[0].expiresAt > (now+20))
+            break;
+
+        loop->expired[nexpired++] = loop->heap[0];
+        virEventPollTimeoutHeapPop(loop);
+    }
+
+    for (i = 0; i < nexpired; i++) {
+        virEventTimeoutCallback cb;
+        void *opaque;
+        int timer = loop->expired[i].timer;
+        ssize_t idx;
+
+        /* An earlier callback may have deleted or rescheduled it */
+        if (!virEventPollTimeoutEntryValid(loop, &loop->expired[i]))
+            continue;
+
+        idx = virEventPollFindTimeout(loop, timer);
+        cb = loop->timeouts[idx].cb;
+        opaque = loop->timeouts[idx].opaque;
+        virEventPollTimeoutSchedule(loop, idx, loop->timeouts[idx].frequency, now);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&loop->lock);
+        (cb)(timer, opaque);
+        virMutexLock(&loop->lock);
     }
     return 0;
 }
@@ -472,94 +945,187 @@ static int virEventPollDispatchTimeouts(void)
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
+static int virEventPollDispatchHandles(struct virEventPollLoop *loop,
+                                       int nfds, struct pollfd *fds)
 {
     size_t i, n;
     VIR_DEBUG("Dispatch %d", nfds);
 
-    /* NB, use nfds not eventLoop.handlesCount, because new
+    /* NB, use nfds not loop->handlesCount, because new
      * fds might be added on end of list, and they're not
      * in the fds array we've got */
-    for (i = 0, n = 0; n < nfds && i < eventLoop.handlesCount; n++) {
-        while (i < eventLoop.handlesCount &&
-               (eventLoop.handles[i].fd != fds[n].fd ||
-                eventLoop.handles[i].events == 0)) {
+    for (i = 0, n = 0; n < nfds && i < loop->handlesCount; n++) {
+        while (i < loop->handlesCount &&
+               (loop->handles[i].fd != fds[n].fd ||
+                loop->handles[i].events == 0)) {
             i++;
         }
-        if (i == eventLoop.handlesCount)
+        if (i == loop->handlesCount)
             break;
 
-        VIR_DEBUG("i=%zu w=%d", i, eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].deleted) {
+        VIR_DEBUG("i=%zu w=%d", i, loop->handles[i].watch);
+        if (loop->handles[i].deleted) {
             EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
-                        eventLoop.handles[i].watch, eventLoop.handles[i].fd);
+                        loop->handles[i].watch, loop->handles[i].fd);
             continue;
         }
 
         if (fds[n].revents) {
-            virEventHandleCallback cb = eventLoop.handles[i].cb;
-            int watch = eventLoop.handles[i].watch;
-            void *opaque = eventLoop.handles[i].opaque;
+            virEventHandleCallback cb = loop->handles[i].cb;
+            int watch = loop->handles[i].watch;
+            void *opaque = loop->handles[i].opaque;
             int hEvents = virEventPollFromNativeEvents(fds[n].revents);
             PROBE(EVENT_POLL_DISPATCH_HANDLE,
                   "watch=%d events=%d",
                   watch, hEvents);
-            virMutexUnlock(&eventLoop.lock);
+            virMutexUnlock(&loop->lock);
             (cb)(watch, fds[n].fd, hEvents, opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
+        }
+    }
+
+    return 0;
+}
+
+
+#if HAVE_SYS_EPOLL_H
+/* Invoke the callback of the handle at index @i if any of
+ * the @revents it is interested in are pending */
+static void virEventPollDispatchHandle(struct virEventPollLoop *loop,
+                                       size_t i, int revents)
+{
+    virEventHandleCallback cb = loop->handles[i].cb;
+    int watch = loop->handles[i].watch;
+    int fd = loop->handles[i].fd;
+    void *opaque = loop->handles[i].opaque;
+    int hEvents;
+
+    revents &= loop->handles[i].events | POLLERR | POLLHUP;
+    if (!revents)
+        return;
+
+    hEvents = virEventPollFromNativeEvents(revents);
+    PROBE(EVENT_POLL_DISPATCH_HANDLE,
+          "watch=%d events=%d",
+          watch, hEvents);
+    virMutexUnlock(&loop->lock);
+    (cb)(watch, fd, hEvents, opaque);
+    virMutexLock(&loop->lock);
+}
+
+
+/* Dispatch the handles belonging to each fd reported by
+ * epoll_wait(). Only handles which existed before the wait,
+ * i.e. have a watch below @lastWatch, are considered, just
+ * like new handles are not in the poll() data.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventPollDispatchEpoll(struct virEventPollLoop *loop,
+                                     struct epoll_event *events,
+                                     int nevents,
+                                     int lastWatch)
+{
+    size_t i;
+    int n;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (n = 0; n < nevents; n++) {
+        int fd = events[n].data.fd;
+        int revents = virEventPollFromEpollEvents(events[n].events);
+
+        if (fd >= loop->fdsAlloc || loop->fds[fd].nwatches == 0)
+            continue;
+
+        if (loop->fds[fd].nwatches == 1) {
+            ssize_t idx = virEventPollFindHandle(loop, loop->fds[fd].watch);
+
+            if (idx >= 0 &&
+                loop->handles[idx].watch < lastWatch &&
+                loop->handles[idx].events &&
+                !loop->handles[idx].deleted)
+                virEventPollDispatchHandle(loop, idx, revents);
+            continue;
+        }
+
+        /* Several watches on the same fd, each one must be
+         * checked as the callbacks may remove later ones */
+        for (i = 0; i < loop->handlesCount &&
+             loop->handles[i].watch < lastWatch; i++) {
+            if (loop->handles[i].fd != fd ||
+                !loop->handles[i].events ||
+                loop->handles[i].deleted)
+                continue;
+            virEventPollDispatchHandle(loop, i, revents);
         }
     }
 
+    if (loop->nfallback == 0)
+        return 0;
+
+    for (i = 0; i < loop->handlesCount &&
+         loop->handles[i].watch < lastWatch; i++) {
+        int fd = loop->handles[i].fd;
+
+        if (fd < 0 || fd >= loop->fdsAlloc ||
+            !loop->fds[fd].fallback ||
+            !loop->handles[i].events ||
+            loop->handles[i].deleted)
+            continue;
+        virEventPollDispatchHandle(loop, i, POLLIN | POLLOUT);
+    }
+
     return 0;
 }
+#endif /* HAVE_SYS_EPOLL_H */
 
 
 /* Used post dispatch to actually remove any timers that
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupTimeouts(void)
+static void virEventPollCleanupTimeouts(struct virEventPollLoop *loop)
 {
     size_t i;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
+    VIR_DEBUG("Cleanup %zu", loop->timeoutsCount);
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.timeoutsCount;) {
-        if (!eventLoop.timeouts[i].deleted) {
+    for (i = 0; i < loop->timeoutsCount;) {
+        if (!loop->timeouts[i].deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              loop->timeouts[i].timer);
+        if (loop->timeouts[i].ff) {
+            virFreeCallback ff = loop->timeouts[i].ff;
+            void *opaque = loop->timeouts[i].opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.timeoutsCount) {
-            memmove(eventLoop.timeouts+i,
-                    eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
+        if ((i+1) < loop->timeoutsCount) {
+            memmove(loop->timeouts+i,
+                    loop->timeouts+i+1,
+                    sizeof(struct virEventPollTimeout)*(loop->timeoutsCount
                                                     -(i+1)));
         }
-        eventLoop.timeoutsCount--;
+        loop->timeoutsCount--;
     }
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
-    if (eventLoop.timeoutsCount == 0 ||
-        (gap > eventLoop.timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->timeoutsAlloc - loop->timeoutsCount;
+    if (loop->timeoutsCount == 0 ||
+        (gap > loop->timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu timeout slots used, releasing %zu",
-                    eventLoop.timeoutsCount, eventLoop.timeoutsAlloc, gap);
-        VIR_SHRINK_N(eventLoop.timeouts, eventLoop.timeoutsAlloc, gap);
+                    loop->timeoutsCount, loop->timeoutsAlloc, gap);
+        VIR_SHRINK_N(loop->timeouts, loop->timeoutsAlloc, gap);
     }
 }
 
@@ -567,72 +1133,144 @@ static void virEventPollCleanupTimeouts(void)
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupHandles(void)
+static void virEventPollCleanupHandles(struct virEventPollLoop *loop)
 {
     size_t i;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.handlesCount);
+    VIR_DEBUG("Cleanup %zu", loop->handlesCount);
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.handlesCount;) {
-        if (!eventLoop.handles[i].deleted) {
+    for (i = 0; i < loop->handlesCount;) {
+        if (!loop->handles[i].deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
-              eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].ff) {
-            virFreeCallback ff = eventLoop.handles[i].ff;
-            void *opaque = eventLoop.handles[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              loop->handles[i].watch);
+        if (loop->handles[i].ff) {
+            virFreeCallback ff = loop->handles[i].ff;
+            void *opaque = loop->handles[i].opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.handlesCount) {
-            memmove(eventLoop.handles+i,
-                    eventLoop.handles+i+1,
-                    sizeof(struct virEventPollHandle)*(eventLoop.handlesCount
+        if ((i+1) < loop->handlesCount) {
+            memmove(loop->handles+i,
+                    loop->handles+i+1,
+                    sizeof(struct virEventPollHandle)*(loop->handlesCount
                                                    -(i+1)));
         }
-        eventLoop.handlesCount--;
+        loop->handlesCount--;
     }
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.handlesAlloc - eventLoop.handlesCount;
-    if (eventLoop.handlesCount == 0 ||
-        (gap > eventLoop.handlesCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->handlesAlloc - loop->handlesCount;
+    if (loop->handlesCount == 0 ||
+        (gap > loop->handlesCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu handles slots used, releasing %zu",
-                    eventLoop.handlesCount, eventLoop.handlesAlloc, gap);
-        VIR_SHRINK_N(eventLoop.handles, eventLoop.handlesAlloc, gap);
+                    loop->handlesCount, loop->handlesAlloc, gap);
+        VIR_SHRINK_N(loop->handles, loop->handlesAlloc, gap);
+    }
+}
+
+#if HAVE_SYS_EPOLL_H
+/*
+ * The epoll flavour of virEventPollRunOnce. The registrations
+ * are kept up to date as handles change, so unlike with poll()
+ * there is nothing to rebuild on each iteration.
+ */
+static int virEventPollRunOnceEpoll(struct virEventPollLoop *loop)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout, nhandles, lastWatch;
+
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
+
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+
+    if (virEventPollCalculateTimeout(loop, &timeout) < 0)
+        goto error;
+
+    /* Files epoll refused are always ready */
+    if (loop->nfallback > 0)
+        timeout = 0;
+
+    nhandles = loop->handlesCount;
+    lastWatch = loop->nextWatch * EVENT_LOOP_MAX;
+    virMutexUnlock(&loop->lock);
+
+ retry:
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%d timeout=%d",
+          nhandles, timeout);
+    ret = epoll_wait(loop->epollfd, events,
+                     ARRAY_CARDINALITY(events), timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        return -1;
     }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&loop->lock);
+    if (virEventPollDispatchTimeouts(loop) < 0)
+        goto error;
+
+    if ((ret > 0 || loop->nfallback > 0) &&
+        virEventPollDispatchEpoll(loop, events, ret, lastWatch) < 0)
+        goto error;
+
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
+    return 0;
+
+ error:
+    virMutexUnlock(&loop->lock);
+    return -1;
 }
+#endif /* HAVE_SYS_EPOLL_H */
+
 
 /*
  * Run a single iteration of the event loop, blocking until
  * at least one file handle has an event, or a timer expires
  */
-int virEventPollRunOnce(void)
+static int virEventPollRunOnceLoop(struct virEventPollLoop *loop)
 {
     struct pollfd *fds = NULL;
     int ret, timeout, nfds;
 
-    virMutexLock(&eventLoop.lock);
-    eventLoop.running = 1;
-    virThreadSelf(&eventLoop.leader);
+#if HAVE_SYS_EPOLL_H
+    if (loop->useEpoll)
+        return virEventPollRunOnceEpoll(loop);
+#endif
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
 
-    if (!(fds = virEventPollMakePollFDs(&nfds)) ||
-        virEventPollCalculateTimeout(&timeout) < 0)
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+
+    if (!(fds = virEventPollMakePollFDs(loop, &nfds)) ||
+        virEventPollCalculateTimeout(loop, &timeout) < 0)
         goto error;
 
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
  retry:
     PROBE(EVENT_POLL_RUN,
@@ -649,92 +1287,209 @@ int virEventPollRunOnce(void)
     }
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
-    virMutexLock(&eventLoop.lock);
-    if (virEventPollDispatchTimeouts() < 0)
+    virMutexLock(&loop->lock);
+    if (virEventPollDispatchTimeouts(loop) < 0)
         goto error;
 
     if (ret > 0 &&
-        virEventPollDispatchHandles(nfds, fds) < 0)
+        virEventPollDispatchHandles(loop, nfds, fds) < 0)
         goto error;
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
 
-    eventLoop.running = 0;
-    virMutexUnlock(&eventLoop.lock);
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
     VIR_FREE(fds);
     return 0;
 
  error:
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
  error_unlocked:
     VIR_FREE(fds);
     return -1;
 }
 
+int virEventPollRunOnce(void)
+{
+    return virEventPollRunOnceLoop(&eventLoops[0]);
+}
+
 
 static void virEventPollHandleWakeup(int watch ATTRIBUTE_UNUSED,
                                      int fd,
                                      int events ATTRIBUTE_UNUSED,
-                                     void *opaque ATTRIBUTE_UNUSED)
+                                     void *opaque)
 {
+    struct virEventPollLoop *loop = opaque;
     char c;
-    virMutexLock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
     ignore_value(saferead(fd, &c, sizeof(c)));
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 }
 
-int virEventPollInit(void)
+static int virEventPollLoopInit(struct virEventPollLoop *loop,
+                                size_t id)
 {
-    if (virMutexInit(&eventLoop.lock) < 0) {
+#if HAVE_SYS_EPOLL_H
+    const char *backend = virGetEnvBlockSUID("LIBVIRT_EVENT_BACKEND");
+#endif
+
+    loop->id = id;
+    loop->node = -1;
+    loop->nextWatch = 1;
+    loop->nextTimer = 1;
+
+    if (virMutexInit(&loop->lock) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to initialize mutex"));
         return -1;
     }
 
-    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+#if HAVE_SYS_EPOLL_H
+    loop->epollfd = -1;
+    if (backend && STRNEQ(backend, "epoll") && STRNEQ(backend, "poll"))
+        VIR_WARN("Ignoring unknown event loop backend '%s'", backend);
+
+    if (!backend || STRNEQ(backend, "poll")) {
+        if ((loop->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            char ebuf[1024];
+            VIR_WARN("Unable to create epoll instance, using poll: %s",
+                     virStrerror(errno, ebuf, sizeof(ebuf)));
+        } else {
+            loop->useEpoll = true;
+        }
+    }
+    VIR_DEBUG("Using %s event loop backend",
+              loop->useEpoll ? "epoll" : "poll");
+#endif
+
+    if (pipe2(loop->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
         return -1;
     }
 
-    if (virEventPollAddHandle(eventLoop.wakeupfd[0],
-                              VIR_EVENT_HANDLE_READABLE,
-                              virEventPollHandleWakeup, NULL, NULL) < 0) {
+    if (virEventPollAddHandleLoop(loop, loop->wakeupfd[0],
+                                  VIR_EVENT_HANDLE_READABLE,
+                                  virEventPollHandleWakeup, loop, NULL) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to add handle %d to event loop"),
-                       eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+                       loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int virEventPollInit(void)
+{
+    return virEventPollLoopInit(&eventLoops[0], 0);
+}
+
+
+static void virEventPollLoopThread(void *opaque)
+{
+    struct virEventPollLoop *loop = opaque;
+
+    /* Memory the callbacks allocate is then local to the node too */
+    if (loop->cpus && virProcessSetAffinity(0, loop->cpus) < 0) {
+        VIR_WARN("Unable to bind event loop %zu to NUMA node %d: %s",
+                 loop->id, loop->node, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    while (virEventPollRunOnceLoop(loop) == 0)
+        ;
+
+    VIR_ERROR(_("Event loop %zu stopped: %s"),
+              loop->id, virGetLastErrorMessage());
+}
+
+int virEventPollStartLoops(size_t nloops)
+{
+    int maxnode = -1;
+    size_t i;
+
+    if (nloops == 0)
+        return 0;
+
+    if (nEventLoops > 1) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Event loop threads are already running"));
+        return -1;
+    }
+
+    if (nloops > EVENT_LOOP_MAX - 1) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("At most %d extra event loops are supported"),
+                       EVENT_LOOP_MAX - 1);
         return -1;
     }
 
+    if (virNumaIsAvailable())
+        maxnode = virNumaGetMaxNode();
+
+    for (i = 1; i <= nloops; i++) {
+        virThread thread;
+
+        if (virEventPollLoopInit(&eventLoops[i], i) < 0)
+            return -1;
+
+        /* Spread the loops over the host NUMA nodes, skipping nodes
+         * without CPUs */
+        if (maxnode > 0) {
+            int node = (i - 1) % (maxnode + 1);
+
+            if (virNumaGetNodeCPUs(node, &eventLoops[i].cpus) > 0) {
+                eventLoops[i].node = node;
+            } else {
+                virBitmapFree(eventLoops[i].cpus);
+                eventLoops[i].cpus = NULL;
+                virResetLastError();
+            }
+        }
+
+        if (virThreadCreate(&thread, false, virEventPollLoopThread,
+                            &eventLoops[i]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create event loop thread"));
+            return -1;
+        }
+    }
+
+    /* Only hand out the new loops once all of them are running */
+    nEventLoops = nloops + 1;
+    VIR_DEBUG("Started %zu extra event loops", nloops);
     return 0;
 }
 
-static int virEventPollInterruptLocked(void)
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop)
 {
     char c = '\0';
 
-    if (!eventLoop.running ||
-        virThreadIsSelf(&eventLoop.leader)) {
-        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
-                  virThreadID(&eventLoop.leader));
+    if (!loop->running ||
+        virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", loop->running,
+                  virThreadID(&loop->leader));
         return 0;
     }
 
     VIR_DEBUG("Interrupting");
-    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+    if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
         return -1;
     return 0;
 }
 
 int virEventPollInterrupt(void)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
     int ret;
-    virMutexLock(&eventLoop.lock);
-    ret = virEventPollInterruptLocked();
-    virMutexUnlock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
+    ret = virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
     return ret;
 }
 
@@ -41,6 +41,31 @@ int virEventPollAddHandle(int fd, int events,
                           void *opaque,
                           virFreeCallback ff);
 
+/**
+ * virEventPollAddHandleAffinity: register a callback for monitoring
+ * file handle events on a shared event loop thread
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from POLLnnn constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ * @key: hint to pick the event loop thread
+ * @node: host NUMA node to prefer, or -1
+ *
+ * Like virEventPollAddHandle, but if extra event loops were started
+ * with virEventPollStartLoops the callback is dispatched from the one
+ * @key hashes to, so handles sharing a key are never run concurrently.
+ * Only the loops bound to @node are considered if there are any.
+ *
+ * returns -1 if the file handle cannot be registered, 0 upon success
+ */
+int virEventPollAddHandleAffinity(int fd, int events,
+                                  virEventHandleCallback cb,
+                                  void *opaque,
+                                  virFreeCallback ff,
+                                  unsigned int key,
+                                  int node);
+
 /**
  * virEventPollUpdateHandle: change event set for a monitored file handle
  *
@@ -103,10 +128,26 @@ int virEventPollRemoveTimeout(int timer);
 /**
  * virEventPollInit: Initialize the event loop
  *
+ * Where available epoll is used to wait for events, unless the
+ * LIBVIRT_EVENT_BACKEND environment variable is set to "poll".
+ *
  * returns -1 if initialization failed
  */
 int virEventPollInit(void);
 
+/**
+ * virEventPollStartLoops: start extra event loop threads
+ *
+ * @nloops: number of threads to start
+ *
+ * The threads only serve handles added by virEventPollAddHandleAffinity,
+ * everything else stays in the loop run by virEventPollRunOnce. On NUMA
+ * hosts the threads are spread over the nodes and bound to their CPUs.
+ *
+ * returns -1 if the threads could not be started
+ */
+int virEventPollStartLoops(size_t nloops);
+
 /**
  * virEventPollRunOnce: run a single iteration of the event loop.
  *
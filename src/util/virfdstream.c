@@ -44,11 +44,23 @@
 #include "virstring.h"
 #include "virtime.h"
 #include "virprocess.h"
+#include "virprobe.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
 VIR_LOG_INIT("fdstream");
 
+/* Size of the chunks the I/O thread reads from or writes to the file */
+#define VIR_FDSTREAM_THREAD_BUFLEN (1024 * 1024)
+
+/* How many chunks the I/O thread may read ahead of the stream consumer,
+ * so that file reads overlap with sending already read data */
+#define VIR_FDSTREAM_THREAD_READ_AHEAD 4
+
+/* With nocache, how much data may pass through the page cache between
+ * two requests to drop it */
+#define VIR_FDSTREAM_NOCACHE_WINDOW (64 * 1024 * 1024)
+
 typedef enum {
     VIR_FDSTREAM_MSG_TYPE_DATA,
     VIR_FDSTREAM_MSG_TYPE_HOLE,
@@ -111,6 +123,7 @@ struct virFDStreamData {
     bool threadAbort;
     bool threadDoRead;
     virFDStreamMsgPtr msg;
+    size_t nmsgs;       /* number of messages queued in @msg */
 };
 
 static virClassPtr virFDStreamDataClass;
@@ -141,6 +154,17 @@ static int virFDStreamDataOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(virFDStreamData)
 
 
+/* Number of data bytes carried by @msg, for tracing */
+static unsigned long long
+virFDStreamMsgLength(virFDStreamMsgPtr msg)
+{
+    if (msg->type != VIR_FDSTREAM_MSG_TYPE_DATA)
+        return 0;
+
+    return msg->stream.data.len;
+}
+
+
 static int
 virFDStreamMsgQueuePush(virFDStreamDataPtr fdst,
                         virFDStreamMsgPtr msg,
@@ -154,8 +178,13 @@ virFDStreamMsgQueuePush(virFDStreamDataPtr fdst,
         tmp = &(*tmp)->next;
 
     *tmp = msg;
+    fdst->nmsgs++;
     virCondSignal(&fdst->threadCond);
 
+    PROBE(FDSTREAM_MSG_PUSH,
+          "st=%p len=%llu nmsgs=%llu",
+          fdst, virFDStreamMsgLength(msg), (unsigned long long) fdst->nmsgs);
+
     if (safewrite(fd, &c, sizeof(c)) != sizeof(c)) {
         virReportSystemError(errno,
                              _("Unable to write to %s"),
@@ -178,6 +207,12 @@ virFDStreamMsgQueuePop(virFDStreamDataPtr fdst,
     if (tmp) {
         fdst->msg = tmp->next;
         tmp->next = NULL;
+        fdst->nmsgs--;
+
+        PROBE(FDSTREAM_MSG_POP,
+              "st=%p len=%llu nmsgs=%llu",
+              fdst, virFDStreamMsgLength(tmp),
+              (unsigned long long) fdst->nmsgs);
     }
 
     virCondSignal(&fdst->threadCond);
@@ -399,6 +434,7 @@ struct _virFDStreamThreadData {
     size_t length;
     bool doRead;
     bool sparse;
+    bool nocache;
     int fdin;
     char *fdinname;
     int fdout;
@@ -571,6 +607,33 @@ virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
 }
 
 
+/*
+ * Tells the kernel that the data of @fd transferred so far will not be
+ * needed again, so that streaming a large volume does not push
+ * everything else out of the host page cache. Dirty pages can not be
+ * dropped, so a written file is synced first.
+ */
+static void
+virFDStreamThreadDropCache(int fd,
+                           const char *fdname,
+                           bool written)
+{
+#ifdef POSIX_FADV_DONTNEED
+    int rc;
+
+    if (written && fdatasync(fd) < 0) {
+        VIR_DEBUG("Unable to sync %s: errno=%d", fdname, errno);
+        return;
+    }
+
+    if ((rc = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) != 0)
+        VIR_DEBUG("Unable to drop cached data of %s: %d", fdname, rc);
+#else
+    VIR_DEBUG("Dropping cached data of %s is not supported", fdname);
+#endif
+}
+
+
 static void
 virFDStreamThread(void *opaque)
 {
@@ -578,15 +641,17 @@ virFDStreamThread(void *opaque)
     virStreamPtr st = data->st;
     size_t length = data->length;
     bool sparse = data->sparse;
+    bool nocache = data->nocache;
     int fdin = data->fdin;
     char *fdinname = data->fdinname;
     int fdout = data->fdout;
     char *fdoutname = data->fdoutname;
     virFDStreamDataPtr fdst = st->privateData;
     bool doRead = fdst->threadDoRead;
-    size_t buflen = 256 * 1024;
+    size_t buflen = VIR_FDSTREAM_THREAD_BUFLEN;
     size_t total = 0;
     size_t dataLen = 0;
+    size_t uncached = 0;
 
     virObjectRef(fdst);
     virObjectLock(fdst);
@@ -594,7 +659,10 @@ virFDStreamThread(void *opaque)
     while (1) {
         ssize_t got;
 
-        while (doRead == (fdst->msg != NULL) &&
+        /* A reading thread keeps a few chunks queued ahead of the
+         * consumer, a writing thread waits for data to write */
+        while ((doRead ? fdst->nmsgs >= VIR_FDSTREAM_THREAD_READ_AHEAD :
+                         fdst->msg == NULL) &&
                !fdst->threadQuit) {
             if (virCondWait(&fdst->threadCond, &fdst->parent.lock)) {
                 virReportSystemError(errno, "%s",
@@ -631,6 +699,23 @@ virFDStreamThread(void *opaque)
             break;
 
         total += got;
+
+        if (nocache && (uncached += got) >= VIR_FDSTREAM_NOCACHE_WINDOW) {
+            virObjectUnlock(fdst);
+            virFDStreamThreadDropCache(doRead ? fdin : fdout,
+                                       doRead ? fdinname : fdoutname,
+                                       !doRead);
+            virObjectLock(fdst);
+            uncached = 0;
+        }
+    }
+
+    if (nocache && uncached) {
+        virObjectUnlock(fdst);
+        virFDStreamThreadDropCache(doRead ? fdin : fdout,
+                                   doRead ? fdinname : fdoutname,
+                                   !doRead);
+        virObjectLock(fdst);
     }
 
  cleanup:
@@ -938,6 +1023,23 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             }
             goto cleanup;
         }
+
+        /* Consoles and channels hand out whatever the guest wrote so far,
+         * often a few bytes per read. Drain everything that is already
+         * available so that the caller gets it in one buffer instead of
+         * relaying each little chunk separately. Errors and EOF after
+         * some data was read are left for the next call to report. */
+        if (st->flags & VIR_STREAM_NONBLOCK) {
+            while (ret > 0 && ret < nbytes) {
+                ssize_t got = read(fdst->fd, bytes + ret, nbytes - ret);
+
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got <= 0)
+                    break;
+                ret += got;
+            }
+        }
     }
 
     if (fdst->length)
@@ -1219,7 +1321,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             int oflags,
                             int mode,
                             bool forceIOHelper,
-                            bool sparse)
+                            bool sparse,
+                            bool nocache)
 {
     int fd = -1;
     int pipefds[2] = { -1, -1 };
@@ -1287,6 +1390,7 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         threadData->st = virObjectRef(st);
         threadData->length = length;
         threadData->sparse = sparse;
+        threadData->nocache = nocache;
 
         if ((oflags & O_ACCMODE) == O_RDONLY) {
             threadData->fdin = fd;
@@ -1336,7 +1440,7 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, false, false);
+                                       oflags, 0, false, false, false);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -1349,7 +1453,7 @@ int virFDStreamCreateFile(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, mode,
-                                       false, false);
+                                       false, false, false);
 }
 
 #ifdef HAVE_CFMAKERAW
@@ -1365,7 +1469,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     if (virFDStreamOpenFileInternal(st, path,
                                     offset, length,
                                     oflags | O_CREAT, 0,
-                                    false, false) < 0)
+                                    false, false, false) < 0)
         return -1;
 
     fdst = st->privateData;
@@ -1402,7 +1506,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, 0,
-                                       false, false);
+                                       false, false, false);
 }
 #endif /* !HAVE_CFMAKERAW */
 
@@ -1411,11 +1515,12 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                unsigned long long offset,
                                unsigned long long length,
                                bool sparse,
+                               bool nocache,
                                int oflags)
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, true, sparse);
+                                       oflags, 0, true, sparse, nocache);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
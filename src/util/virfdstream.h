@@ -60,6 +60,7 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                unsigned long long offset,
                                unsigned long long length,
                                bool sparse,
+                               bool nocache,
                                int oflags);
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -35,6 +35,11 @@
 #if defined(HAVE_SYS_MOUNT_H)
 # include <sys/mount.h>
 #endif
+#ifdef MAJOR_IN_MKDEV
+# include <sys/mkdev.h>
+#elif MAJOR_IN_SYSMACROS
+# include <sys/sysmacros.h>
+#endif
 #include <unistd.h>
 #include <dirent.h>
 #include <dirname.h>
@@ -51,6 +56,9 @@
 #if HAVE_SYS_ACL_H
 # include <sys/acl.h>
 #endif
+#if WITH_ATTR
+# include <sys/xattr.h>
+#endif
 
 #ifdef __linux__
 # if HAVE_LINUX_MAGIC_H
@@ -74,6 +82,7 @@
 #include "virlog.h"
 #include "virprocess.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virutil.h"
 
 #include "c-ctype.h"
@@ -169,14 +178,282 @@ virFileDirectFdFlag(void)
     return O_DIRECT ? O_DIRECT : -1;
 }
 
+/* Write @len bytes of @buf into @fd in blocks of @blksize, seeking over
+ * the blocks which contain only zeroes instead of writing them. In
+ * @direct mode, a trailing partial block is padded with zeroes; @buf must
+ * have room for that. The caller is responsible for truncating the file
+ * to the real size at the end. */
+static int
+virFileWrapperFdWriteSparse(int fd,
+                            const char *fdname,
+                            char *buf,
+                            size_t len,
+                            size_t blksize,
+                            bool direct)
+{
+    size_t off;
+
+    for (off = 0; off < len; off += blksize) {
+        size_t n = MIN(blksize, len - off);
+
+        if (buf[off] == 0 && memcmp(buf + off, buf + off + 1, n - 1) == 0) {
+            if (lseek(fd, n, SEEK_CUR) < 0) {
+                virReportSystemError(errno, _("Unable to seek %s"), fdname);
+                return -1;
+            }
+            continue;
+        }
+
+        if (direct && n < blksize) {
+            memset(buf + off + n, 0, blksize - n);
+            n = blksize;
+        }
+
+        if (safewrite(fd, buf + off, n) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), fdname);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * virFileWrapperFdRunIO:
+ * @path: name of the file behind @fd, for diagnostics
+ * @fd: file descriptor of the file to read or write
+ * @oflags: flags @fd was opened with
+ * @pipefd: the other end of the copy, usually a pipe
+ * @pipename: name of @pipefd, for diagnostics
+ *
+ * Copy the entire contents of @fd to @pipefd if @fd was opened
+ * O_RDONLY, or everything readable from @pipefd into @fd if it was
+ * opened O_WRONLY.  If @oflags contains O_DIRECT, all I/O on @fd is
+ * done in aligned chunks, and the file is truncated to the real
+ * size after the last, padded, write.  Otherwise, the data is
+ * spliced without copying it through user space whenever the kernel
+ * allows it.  If @sparse is true and @fd is written, aligned blocks
+ * consisting only of zeroes are skipped over so that they end up as
+ * holes in the file.  @fd is closed on return; @pipefd is left open.
+ *
+ * Returns 0 on success, -1 on failure with an error reported.
+ */
+int
+virFileWrapperFdRunIO(const char *path,
+                      int fd,
+                      int oflags,
+                      int pipefd,
+                      const char *pipename,
+                      bool sparse)
+{
+    void *base = NULL; /* Location to be freed */
+    char *buf = NULL; /* Aligned location within base */
+    size_t buflen = 1024*1024;
+    intptr_t alignMask = 64*1024 - 1;
+    int ret = -1;
+    int fdin, fdout;
+    const char *fdinname, *fdoutname;
+    unsigned long long total = 0;
+    bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
+    off_t end = 0;
+#if HAVE_SPLICE
+    bool trysplice = !direct;
+#endif
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&base, alignMask + 1, buflen)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    buf = base;
+#else
+    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0)
+        goto cleanup;
+    base = buf;
+    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
+#endif
+
+    switch (oflags & O_ACCMODE) {
+    case O_RDONLY:
+        fdin = fd;
+        fdinname = path;
+        fdout = pipefd;
+        fdoutname = pipename;
+        /* To make the implementation simpler, we give up on any
+         * attempt to use O_DIRECT in a non-trivial manner.  */
+        if (direct && ((end = lseek(fd, 0, SEEK_CUR)) != 0)) {
+            virReportSystemError(end < 0 ? errno : EINVAL, "%s",
+                                 _("O_DIRECT read needs entire seekable file"));
+            goto cleanup;
+        }
+        break;
+    case O_WRONLY:
+        fdin = pipefd;
+        fdinname = pipename;
+        fdout = fd;
+        fdoutname = path;
+#if HAVE_SPLICE
+        /* holes can only be made when we see the data */
+        if (sparse)
+            trysplice = false;
+#endif
+        /* To make the implementation simpler, we give up on any
+         * attempt to use O_DIRECT in a non-trivial manner.  */
+        if (direct && (end = lseek(fd, 0, SEEK_END)) != 0) {
+            virReportSystemError(end < 0 ? errno : EINVAL, "%s",
+                                 _("O_DIRECT write needs empty seekable file"));
+            goto cleanup;
+        }
+        break;
+
+    case O_RDWR:
+    default:
+        virReportSystemError(EINVAL,
+                             _("Unable to process file with flags %d"),
+                             (oflags & O_ACCMODE));
+        goto cleanup;
+    }
+
+    while (1) {
+        ssize_t got;
+
+#if HAVE_SPLICE
+        /* Without O_DIRECT there are no alignment constraints, so
+         * let the kernel move the pages between the file and the
+         * pipe.  If neither end turns out to be a pipe, or the file
+         * system cannot splice, fall back to a plain copy.  */
+        if (trysplice) {
+            if ((got = splice(fdin, NULL, fdout, NULL, buflen,
+                              SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+                total += got;
+                continue;
+            }
+            if (got == 0)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno != EINVAL && errno != ENOSYS) {
+                virReportSystemError(errno, _("Unable to copy %s to %s"),
+                                     fdinname, fdoutname);
+                goto cleanup;
+            }
+            trysplice = false;
+        }
+#endif
+
+        /* If we read with O_DIRECT from file we can't use saferead as
+         * it can lead to unaligned read after reading last bytes.
+         * If we write with O_DIRECT use should use saferead so that
+         * writes will be aligned.
+         * In other cases using saferead reduces number of syscalls.
+         */
+        if (fdin == fd && direct) {
+            if ((got = read(fdin, buf, buflen)) < 0 &&
+                errno == EINTR)
+                continue;
+        } else {
+            got = saferead(fdin, buf, buflen);
+        }
+
+        if (got < 0) {
+            virReportSystemError(errno, _("Unable to read %s"), fdinname);
+            goto cleanup;
+        }
+        if (got == 0)
+            break;
+
+        total += got;
+
+        if (sparse && fdout == fd) {
+            if (virFileWrapperFdWriteSparse(fd, fdoutname, buf, got,
+                                            alignMask + 1, direct) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        /* handle last write size align in direct case */
+        if (got < buflen && direct && fdout == fd) {
+            ssize_t aligned_got = (got + alignMask) & ~alignMask;
+
+            memset(buf + got, 0, aligned_got - got);
+
+            if (safewrite(fdout, buf, aligned_got) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+                goto cleanup;
+            }
+
+            if (ftruncate(fd, total) < 0) {
+                virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+                goto cleanup;
+            }
+
+            break;
+        }
+
+        if (safewrite(fdout, buf, got) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+            goto cleanup;
+        }
+    }
+
+    /* Skipped or padded blocks at the end left the size wrong */
+    if (sparse && fdout == fd && ftruncate(fd, total) < 0) {
+        virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
+    }
+
+    /* Ensure all data is written */
+    if (fdatasync(fdout) < 0) {
+        if (errno != EINVAL && errno != EROFS) {
+            /* fdatasync() may fail on some special FDs, e.g. pipes */
+            virReportSystemError(errno, _("unable to fsync %s"), fdoutname);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (VIR_CLOSE(fd) < 0 &&
+        ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
+
+    VIR_FREE(base);
+    return ret;
+}
+
 /* Opaque type for managing a wrapper around a fd.  For now,
  * read-write is not supported, just a single direction.  */
 struct _virFileWrapperFd {
-    virCommandPtr cmd; /* Child iohelper process to do the I/O.  */
-    char *err_msg; /* stderr of @cmd */
+    virThread thread; /* Thread doing the I/O.  */
+    bool running; /* Whether @thread still needs to be joined.  */
+    char *name; /* Name of the wrapped file, for diagnostics.  */
+    int fd; /* The wrapped file.  */
+    int oflags; /* Flags @fd was opened with.  */
+    int pipefd; /* Our end of the pipe handed out to the caller.  */
+    bool sparse; /* Whether to leave holes for zero blocks.  */
+    virErrorPtr err; /* Error reported by @thread, if any.  */
 };
 
 #ifndef WIN32
+static void
+virFileWrapperFdThread(void *opaque)
+{
+    virFileWrapperFdPtr wfd = opaque;
+    int fd = wfd->fd;
+
+    wfd->fd = -1;
+    if (virFileWrapperFdRunIO(wfd->name, fd, wfd->oflags,
+                              wfd->pipefd, "pipe", wfd->sparse) < 0)
+        wfd->err = virSaveLastError();
+
+    /* Let the other end see EOF, or EPIPE, right away.  */
+    VIR_FORCE_CLOSE(wfd->pipefd);
+}
+
+
 /**
  * virFileWrapperFdNew:
  * @fd: pointer to fd to wrap
@@ -194,12 +471,19 @@ struct _virFileWrapperFd {
  * to ensure it properly supports non-blocking I/O, i.e., it will report
  * EAGAIN.
  *
+ * If VIR_FILE_WRAPPER_SPARSE bit is set in @flags and @fd is written, blocks
+ * of zeroes are not written but left as holes in the file.
+ *
  * This must be called after open() and optional fchown() or fchmod(), but
  * before any seek or I/O, and only on seekable fd.  The file must be O_RDONLY
  * (to read the entire existing file) or O_WRONLY (to write to an empty file).
  * In some cases, @fd is changed to a non-seekable pipe; in this case, the
  * caller must not do anything further with the original fd.
  *
+ * The actual I/O is done by a thread of the calling process, which has
+ * already been granted access to the file, so no helper process needs
+ * to be spawned.
+ *
  * On success, the new wrapper object is returned, which must be later
  * freed with virFileWrapperFdFree().  On failure, @fd is unchanged, an
  * error message is output, and NULL is returned.
@@ -211,7 +495,6 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     bool output = false;
     int pipefd[2] = { -1, -1 };
     int mode = -1;
-    char *iohelper_path = NULL;
 
     if (!flags) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -222,8 +505,8 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     /* XXX support posix_fadvise rather than O_DIRECT, if the kernel support
      * for that is decent enough. In that case, we will also need to
      * explicitly support VIR_FILE_WRAPPER_NON_BLOCKING since
-     * VIR_FILE_WRAPPER_BYPASS_CACHE alone will no longer require spawning
-     * iohelper.
+     * VIR_FILE_WRAPPER_BYPASS_CACHE alone will no longer require a
+     * separate I/O thread.
      */
 
     if ((flags & VIR_FILE_WRAPPER_BYPASS_CACHE) && !O_DIRECT) {
@@ -235,6 +518,9 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     if (VIR_ALLOC(ret) < 0)
         return NULL;
 
+    ret->fd = -1;
+    ret->pipefd = -1;
+
     mode = fcntl(*fd, F_GETFL);
 
     if (mode < 0) {
@@ -249,52 +535,34 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
         goto error;
     }
 
+    if (VIR_STRDUP(ret->name, name) < 0)
+        goto error;
+
     if (pipe2(pipefd, O_CLOEXEC) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unable to create pipe for %s"), name);
         goto error;
     }
 
-    if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
-                                              abs_topbuilddir "/src",
-                                              LIBEXECDIR)))
-        goto error;
-
-    ret->cmd = virCommandNewArgList(iohelper_path, name, NULL);
-
-    VIR_FREE(iohelper_path);
-
-    if (output) {
-        virCommandSetInputFD(ret->cmd, pipefd[0]);
-        virCommandSetOutputFD(ret->cmd, fd);
-        virCommandAddArg(ret->cmd, "1");
-    } else {
-        virCommandSetInputFD(ret->cmd, *fd);
-        virCommandSetOutputFD(ret->cmd, &pipefd[1]);
-        virCommandAddArg(ret->cmd, "0");
-    }
-
-    /* In order to catch iohelper stderr, we must change
-     * iohelper's env so virLog functions print to stderr
-     */
-    virCommandAddEnvPair(ret->cmd, "LIBVIRT_LOG_OUTPUTS", "1:stderr");
-    virCommandSetErrorBuffer(ret->cmd, &ret->err_msg);
-    virCommandDoAsyncIO(ret->cmd);
-
-    if (virCommandRunAsync(ret->cmd, NULL) < 0)
-        goto error;
+    ret->fd = *fd;
+    ret->oflags = mode;
+    ret->sparse = output && (flags & VIR_FILE_WRAPPER_SPARSE);
+    ret->pipefd = pipefd[!output];
+    pipefd[!output] = -1;
 
-    if (VIR_CLOSE(pipefd[!output]) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("unable to close pipe"));
+    if (virThreadCreate(&ret->thread, true,
+                        virFileWrapperFdThread, ret) < 0) {
+        virReportSystemError(errno,
+                             _("unable to create I/O thread for %s"), name);
+        ret->fd = -1;
         goto error;
     }
+    ret->running = true;
 
-    VIR_FORCE_CLOSE(*fd);
     *fd = pipefd[output];
     return ret;
 
  error:
-    VIR_FREE(iohelper_path);
     VIR_FORCE_CLOSE(pipefd[0]);
     VIR_FORCE_CLOSE(pipefd[1]);
     virFileWrapperFdFree(ret);
@@ -317,26 +585,30 @@ virFileWrapperFdNew(int *fd ATTRIBUTE_UNUSED,
  * @wfd: fd wrapper, or NULL
  *
  * If @wfd is valid, then ensure that I/O has completed, which may
- * include reaping a child process.  Return 0 if all data for the
- * wrapped fd is complete, or -1 on failure with an error emitted.
- * This function intentionally returns 0 when @wfd is NULL, so that
- * callers can conditionally create a virFileWrapperFd wrapper but
- * unconditionally call the cleanup code.  To avoid deadlock, only
+ * include waiting for the I/O thread to finish.  Return 0 if all data
+ * for the wrapped fd is complete, or -1 on failure with an error
+ * emitted.  This function intentionally returns 0 when @wfd is NULL,
+ * so that callers can conditionally create a virFileWrapperFd wrapper
+ * but unconditionally call the cleanup code.  To avoid deadlock, only
  * call this after closing the fd resulting from virFileWrapperFdNew().
  */
 int
 virFileWrapperFdClose(virFileWrapperFdPtr wfd)
 {
-    int ret;
-
     if (!wfd)
         return 0;
 
-    ret = virCommandWait(wfd->cmd, NULL);
-    if (wfd->err_msg && *wfd->err_msg)
-        VIR_WARN("iohelper reports: %s", wfd->err_msg);
+    if (wfd->running) {
+        virThreadJoin(&wfd->thread);
+        wfd->running = false;
+    }
 
-    return ret;
+    if (wfd->err) {
+        virSetError(wfd->err);
+        return -1;
+    }
+
+    return 0;
 }
 
 /**
@@ -344,9 +616,10 @@ virFileWrapperFdClose(virFileWrapperFdPtr wfd)
  * @wfd: fd wrapper, or NULL
  *
  * Free all remaining resources associated with @wfd.  If
- * virFileWrapperFdClose() was not previously called, then this may
- * discard some previous I/O.  To avoid deadlock, only call this after
- * closing the fd resulting from virFileWrapperFdNew().
+ * virFileWrapperFdClose() was not previously called, then this waits
+ * for the I/O thread and discards any error it hit.  To avoid
+ * deadlock, only call this after closing the fd resulting from
+ * virFileWrapperFdNew().
  */
 void
 virFileWrapperFdFree(virFileWrapperFdPtr wfd)
@@ -354,9 +627,13 @@ virFileWrapperFdFree(virFileWrapperFdPtr wfd)
     if (!wfd)
         return;
 
-    VIR_FREE(wfd->err_msg);
+    if (wfd->running)
+        virThreadJoin(&wfd->thread);
 
-    virCommandFree(wfd->cmd);
+    VIR_FORCE_CLOSE(wfd->fd);
+    VIR_FORCE_CLOSE(wfd->pipefd);
+    virFreeError(wfd->err);
+    VIR_FREE(wfd->name);
     VIR_FREE(wfd);
 }
 
@@ -524,6 +801,305 @@ virFileRewriteStr(const char *path,
 }
 
 
+typedef struct _virFileRewriteWaiter virFileRewriteWaiter;
+struct _virFileRewriteWaiter {
+    virFileRewriteCompleteFunc cb;
+    void *opaque;
+};
+
+typedef struct _virFileRewriteJob virFileRewriteJob;
+typedef virFileRewriteJob *virFileRewriteJobPtr;
+struct _virFileRewriteJob {
+    char *path;
+    char *newfile;
+    mode_t mode;
+    char *str;
+    int fd;
+    int result;
+
+    virFileRewriteWaiter *waiters;
+    size_t nwaiters;
+};
+
+/* Writes queued by virFileRewriteStrAsync, handled in batches by a
+ * single writer thread. */
+static virMutex virFileRewriteLock = VIR_MUTEX_INITIALIZER;
+static virCond virFileRewriteCond;
+static virCond virFileRewriteDoneCond;
+static virFileRewriteJobPtr *virFileRewriteQueue;
+static size_t virFileRewriteQueueLen;
+static bool virFileRewriteBusy;
+static virThread virFileRewriteThread;
+
+
+static void
+virFileRewriteJobFree(virFileRewriteJobPtr job)
+{
+    if (!job)
+        return;
+
+    VIR_FORCE_CLOSE(job->fd);
+    if (job->newfile) {
+        unlink(job->newfile);
+        VIR_FREE(job->newfile);
+    }
+    VIR_FREE(job->path);
+    VIR_FREE(job->str);
+    VIR_FREE(job->waiters);
+    VIR_FREE(job);
+}
+
+
+/*
+ * Handle a batch of writes in three passes so that the files share
+ * the cost of durability: all the data is written and its writeback
+ * started first, then each file is synced (by then the kernel has
+ * usually got most of the data of the batch in flight, so the syncs
+ * mostly wait for the same journal commits), and only then are the
+ * files renamed into place.
+ */
+static void
+virFileRewriteBatch(virFileRewriteJobPtr *jobs,
+                    size_t njobs)
+{
+    size_t i;
+
+    for (i = 0; i < njobs; i++) {
+        virFileRewriteJobPtr job = jobs[i];
+
+        job->result = -1;
+
+        if (virAsprintf(&job->newfile, "%s.new", job->path) < 0)
+            continue;
+
+        if ((job->fd = open(job->newfile, O_WRONLY | O_CREAT | O_TRUNC,
+                            job->mode)) < 0) {
+            virReportSystemError(errno, _("cannot create file '%s'"),
+                                 job->newfile);
+            continue;
+        }
+
+        if (safewrite(job->fd, job->str, strlen(job->str)) < 0) {
+            virReportSystemError(errno, _("cannot write data to file '%s'"),
+                                 job->newfile);
+            continue;
+        }
+
+#ifdef SYNC_FILE_RANGE_WRITE
+        ignore_value(sync_file_range(job->fd, 0, 0, SYNC_FILE_RANGE_WRITE));
+#endif
+        job->result = 0;
+    }
+
+    for (i = 0; i < njobs; i++) {
+        virFileRewriteJobPtr job = jobs[i];
+
+        if (job->result < 0)
+            continue;
+
+        if (fsync(job->fd) < 0) {
+            virReportSystemError(errno, _("cannot sync file '%s'"),
+                                 job->newfile);
+            job->result = -1;
+            continue;
+        }
+
+        if (VIR_CLOSE(job->fd) < 0) {
+            virReportSystemError(errno, _("cannot save file '%s'"),
+                                 job->newfile);
+            job->result = -1;
+            continue;
+        }
+    }
+
+    for (i = 0; i < njobs; i++) {
+        virFileRewriteJobPtr job = jobs[i];
+
+        if (job->result < 0)
+            continue;
+
+        if (rename(job->newfile, job->path) < 0) {
+            virReportSystemError(errno, _("cannot rename file '%s' as '%s'"),
+                                 job->newfile, job->path);
+            job->result = -1;
+            continue;
+        }
+
+        VIR_FREE(job->newfile);
+    }
+}
+
+
+static void
+virFileRewriteWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    virFileRewriteJobPtr *jobs;
+    size_t njobs;
+    size_t i, j;
+
+    virMutexLock(&virFileRewriteLock);
+
+    while (true) {
+        while (virFileRewriteQueueLen == 0) {
+            virFileRewriteBusy = false;
+            virCondBroadcast(&virFileRewriteDoneCond);
+            if (virCondWait(&virFileRewriteCond, &virFileRewriteLock) < 0) {
+                VIR_WARN("unable to wait for file writes");
+                virMutexUnlock(&virFileRewriteLock);
+                return;
+            }
+        }
+
+        virFileRewriteBusy = true;
+        jobs = virFileRewriteQueue;
+        njobs = virFileRewriteQueueLen;
+        virFileRewriteQueue = NULL;
+        virFileRewriteQueueLen = 0;
+        virMutexUnlock(&virFileRewriteLock);
+
+        virFileRewriteBatch(jobs, njobs);
+
+        for (i = 0; i < njobs; i++) {
+            for (j = 0; j < jobs[i]->nwaiters; j++)
+                jobs[i]->waiters[j].cb(jobs[i]->path, jobs[i]->result,
+                                       jobs[i]->waiters[j].opaque);
+            virFileRewriteJobFree(jobs[i]);
+        }
+        VIR_FREE(jobs);
+
+        virMutexLock(&virFileRewriteLock);
+    }
+}
+
+
+static int
+virFileRewriteOnceInit(void)
+{
+    if (virCondInit(&virFileRewriteCond) < 0 ||
+        virCondInit(&virFileRewriteDoneCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize condition variable"));
+        return -1;
+    }
+
+    if (virThreadCreate(&virFileRewriteThread, false,
+                        virFileRewriteWorker, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create file writer thread"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virFileRewrite)
+
+
+/**
+ * virFileRewriteStrAsync:
+ * @path: file to replace
+ * @mode: mode of the new file
+ * @str: new contents of the file
+ * @cb: optional callback to call once @path has been replaced
+ * @opaque: data for @cb
+ *
+ * Like virFileRewriteStr, but rather than replacing @path in the
+ * calling thread, queue the write to a writer thread so that the
+ * caller can drop its locks before the data is made durable. @str is
+ * copied. The writes queued while a batch is being written out are
+ * grouped into the next batch. If a write of @path is still queued,
+ * it is superseded by this one, and its callback gets the result of
+ * this write.
+ *
+ * @cb is called from the writer thread with the result of the write
+ * (0 or -1, in which case the error has been logged) and must not
+ * block.
+ *
+ * Returns 0 if the write was queued, -1 otherwise.
+ */
+int
+virFileRewriteStrAsync(const char *path,
+                       mode_t mode,
+                       const char *str,
+                       virFileRewriteCompleteFunc cb,
+                       void *opaque)
+{
+    virFileRewriteJobPtr job = NULL;
+    virFileRewriteWaiter waiter = { cb, opaque };
+    char *copy = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virFileRewriteInitialize() < 0)
+        return -1;
+
+    if (VIR_STRDUP(copy, str) < 0)
+        return -1;
+
+    virMutexLock(&virFileRewriteLock);
+
+    for (i = 0; i < virFileRewriteQueueLen; i++) {
+        if (STREQ(virFileRewriteQueue[i]->path, path)) {
+            job = virFileRewriteQueue[i];
+            break;
+        }
+    }
+
+    if (job) {
+        if (cb && VIR_APPEND_ELEMENT(job->waiters, job->nwaiters, waiter) < 0)
+            goto cleanup;
+
+        VIR_FREE(job->str);
+        VIR_STEAL_PTR(job->str, copy);
+        job->mode = mode;
+    } else {
+        if (VIR_ALLOC(job) < 0)
+            goto cleanup;
+        job->fd = -1;
+        job->mode = mode;
+        VIR_STEAL_PTR(job->str, copy);
+
+        if (VIR_STRDUP(job->path, path) < 0 ||
+            (cb && VIR_APPEND_ELEMENT(job->waiters, job->nwaiters, waiter) < 0) ||
+            VIR_APPEND_ELEMENT(virFileRewriteQueue,
+                               virFileRewriteQueueLen, job) < 0) {
+            virFileRewriteJobFree(job);
+            goto cleanup;
+        }
+
+        virCondSignal(&virFileRewriteCond);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virFileRewriteLock);
+    VIR_FREE(copy);
+    return ret;
+}
+
+
+/**
+ * virFileRewriteAsyncFlush:
+ *
+ * Wait until all the writes queued by virFileRewriteStrAsync so far
+ * have been made durable.
+ */
+void
+virFileRewriteAsyncFlush(void)
+{
+    /* Nothing can be queued before the writer is initialized */
+    virMutexLock(&virFileRewriteLock);
+    while (virFileRewriteQueueLen > 0 || virFileRewriteBusy) {
+        if (virCondWait(&virFileRewriteDoneCond, &virFileRewriteLock) < 0) {
+            VIR_WARN("unable to wait for file writes");
+            break;
+        }
+    }
+    virMutexUnlock(&virFileRewriteLock);
+}
+
+
 int virFileTouch(const char *path, mode_t mode)
 {
     int fd = -1;
@@ -4208,3 +4784,205 @@ virFileWaitForExists(const char *path,
 
     return 0;
 }
+
+
+#if WITH_ATTR
+/**
+ * virFileGetXAttr:
+ * @path: a filename
+ * @name: name of xattr
+ * @value: read value
+ *
+ * Reads xattr with @name for given @path and stores it into
+ * @value. Caller is responsible for freeing @value.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise (with errno set, no error reported).
+ */
+int
+virFileGetXAttr(const char *path,
+                const char *name,
+                char **value)
+{
+    char *buf = NULL;
+    int ret = -1;
+
+    /* We might be racing with somebody who sets the same attribute. */
+    while (1) {
+        ssize_t need;
+        ssize_t got;
+
+        if ((need = getxattr(path, name, NULL, 0)) < 0)
+            goto cleanup;
+
+        if (VIR_REALLOC_N_QUIET(buf, need + 1) < 0)
+            goto cleanup;
+
+        if ((got = getxattr(path, name, buf, need)) < 0) {
+            if (errno == ERANGE)
+                continue;
+            goto cleanup;
+        }
+
+        buf[got] = '\0';
+        break;
+    }
+
+    *value = buf;
+    buf = NULL;
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+/**
+ * virFileSetXAttr:
+ * @path: a filename
+ * @name: name of xattr
+ * @value: value to set
+ *
+ * Sets xattr with @name and @value on @path.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise (with errno set and error reported).
+ */
+int
+virFileSetXAttr(const char *path,
+                const char *name,
+                const char *value)
+{
+    if (setxattr(path, name, value, strlen(value), 0) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to set XATTR %s on %s"),
+                             name, path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virFileRemoveXAttr:
+ * @path: a filename
+ * @name: name of xattr
+ *
+ * Remove xattr with @name from @path. It is not an error if
+ * @path has no such xattr.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise (with errno set and error reported).
+ */
+int
+virFileRemoveXAttr(const char *path,
+                   const char *name)
+{
+    if (removexattr(path, name) < 0 && errno != ENODATA) {
+        virReportSystemError(errno,
+                             _("Unable to remove XATTR %s on %s"),
+                             name, path);
+        return -1;
+    }
+
+    return 0;
+}
+
+#else /* !WITH_ATTR */
+
+int
+virFileGetXAttr(const char *path ATTRIBUTE_UNUSED,
+                const char *name ATTRIBUTE_UNUSED,
+                char **value ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+virFileSetXAttr(const char *path,
+                const char *name,
+                const char *value ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    virReportSystemError(errno,
+                         _("Unable to set XATTR %s on %s"),
+                         name, path);
+    return -1;
+}
+
+int
+virFileRemoveXAttr(const char *path,
+                   const char *name)
+{
+    errno = ENOSYS;
+    virReportSystemError(errno,
+                         _("Unable to remove XATTR %s on %s"),
+                         name, path);
+    return -1;
+}
+
+#endif /* WITH_ATTR */
+
+
+#ifdef __linux__
+/**
+ * virFileGetNUMANode:
+ * @path: file or block device
+ *
+ * Find the host NUMA node of the device that stores @path, that is,
+ * of @path itself if it is a block device, or of the block device
+ * holding the file system it lives on otherwise.  Partitions are
+ * reported under the node of their disk.
+ *
+ * Returns the node number, or -1 if the node is unknown (for example
+ * for network file systems, device mapper volumes or machines without
+ * NUMA).  No error is reported.
+ */
+int
+virFileGetNUMANode(const char *path)
+{
+    struct stat sb;
+    dev_t dev;
+    int node;
+
+    if (stat(path, &sb) < 0)
+        return -1;
+
+    dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+    if (virFileReadValueInt(&node, "/sys/dev/block/%u:%u/device/numa_node",
+                            major(dev), minor(dev)) == 0)
+        goto done;
+
+    /* NVMe namespaces hang off the controller, not the PCI device */
+    if (virFileReadValueInt(&node,
+                            "/sys/dev/block/%u:%u/device/device/numa_node",
+                            major(dev), minor(dev)) == 0)
+        goto done;
+
+    if (virFileReadValueInt(&node,
+                            "/sys/dev/block/%u:%u/../device/numa_node",
+                            major(dev), minor(dev)) == 0 ||
+        virFileReadValueInt(&node,
+                            "/sys/dev/block/%u:%u/../device/device/numa_node",
+                            major(dev), minor(dev)) == 0)
+        goto done;
+
+    virResetLastError();
+    return -1;
+
+ done:
+    return node >= 0 ? node : -1;
+}
+
+#else /* !__linux__ */
+
+int
+virFileGetNUMANode(const char *path ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+#endif /* !__linux__ */
@@ -90,6 +90,7 @@ int virFileDirectFdFlag(void);
 typedef enum {
     VIR_FILE_WRAPPER_BYPASS_CACHE   = (1 << 0),
     VIR_FILE_WRAPPER_NON_BLOCKING   = (1 << 1),
+    VIR_FILE_WRAPPER_SPARSE         = (1 << 2),
 } virFileWrapperFdFlags;
 
 virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
@@ -101,6 +102,14 @@ int virFileWrapperFdClose(virFileWrapperFdPtr dfd);
 
 void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
 
+int virFileWrapperFdRunIO(const char *path,
+                          int fd,
+                          int oflags,
+                          int pipefd,
+                          const char *pipename,
+                          bool sparse)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(5) ATTRIBUTE_RETURN_CHECK;
+
 int virFileLock(int fd, bool shared, off_t start, off_t len, bool waitForLock);
 int virFileUnlock(int fd, off_t start, off_t len);
 
@@ -113,6 +122,17 @@ int virFileRewriteStr(const char *path,
                       mode_t mode,
                       const char *str);
 
+typedef void (*virFileRewriteCompleteFunc)(const char *path,
+                                           int result,
+                                           void *opaque);
+int virFileRewriteStrAsync(const char *path,
+                           mode_t mode,
+                           const char *str,
+                           virFileRewriteCompleteFunc cb,
+                           void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+void virFileRewriteAsyncFlush(void);
+
 int virFileTouch(const char *path, mode_t mode);
 
 int virFileUpdatePerm(const char *path,
@@ -356,4 +376,21 @@ int virFileInData(int fd,
                   int *inData,
                   long long *length);
 
+int virFileGetXAttr(const char *path,
+                    const char *name,
+                    char **value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+int virFileSetXAttr(const char *path,
+                    const char *name,
+                    const char *value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+int virFileRemoveXAttr(const char *path,
+                       const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virFileGetNUMANode(const char *path)
+    ATTRIBUTE_NONNULL(1);
+
 #endif /* __VIR_FILE_H */
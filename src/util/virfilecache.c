@@ -34,6 +34,7 @@
 #include "virlog.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -366,6 +367,132 @@ virFileCacheLookupByFunc(virFileCachePtr cache,
 }
 
 
+typedef struct _virFileCachePrefetchData virFileCachePrefetchData;
+typedef virFileCachePrefetchData *virFileCachePrefetchDataPtr;
+struct _virFileCachePrefetchData {
+    virFileCachePtr cache;
+    const char *const *names;
+    size_t nnames;
+    size_t next; /* protected by cache lock */
+};
+
+
+static void
+virFileCachePrefetchWorker(void *opaque)
+{
+    virFileCachePrefetchDataPtr pf = opaque;
+    virFileCachePtr cache = pf->cache;
+
+    for (;;) {
+        const char *name;
+        void *data;
+
+        virObjectLock(cache);
+        if (pf->next >= pf->nnames) {
+            virObjectUnlock(cache);
+            break;
+        }
+        name = pf->names[pf->next++];
+
+        data = virHashLookup(cache->table, name);
+        if (data && cache->handlers.isValid(data, cache->priv)) {
+            virObjectUnlock(cache);
+            continue;
+        }
+        virObjectUnlock(cache);
+
+        /* Creating the data is the expensive part, do it without
+         * holding the lock so that other workers can run too. */
+        VIR_DEBUG("Prefetching data for '%s'", name);
+        if (!(data = virFileCacheNewData(cache, name))) {
+            /* The error will be reported again by the lookup which
+             * actually needs the data. */
+            VIR_WARN("Failed to prefetch data for '%s': %s",
+                     name, virGetLastErrorMessage());
+            virResetLastError();
+            continue;
+        }
+
+        virObjectLock(cache);
+        if (virHashLookup(cache->table, name)) {
+            /* Someone else might have looked the data up meanwhile. */
+            if (virHashUpdateEntry(cache->table, name, data) < 0)
+                virObjectUnref(data);
+        } else if (virHashAddEntry(cache->table, name, data) < 0) {
+            virObjectUnref(data);
+        }
+        virObjectUnlock(cache);
+    }
+}
+
+
+/**
+ * virFileCachePrefetch:
+ * @cache: existing cache object
+ * @names: NULL terminated list of data names
+ * @nworkers: maximum number of threads to use
+ *
+ * Makes sure there is valid data cached for each of @names, creating
+ * missing or outdated data from up to @nworkers threads in parallel.
+ * Unlike virFileCacheLookup() a failure to create the data is not
+ * fatal, it is only logged. This is meant to be used when a number of
+ * lookups which would otherwise create the data one by one is
+ * expected to follow. The @priv data must not be changed while this
+ * function is running.
+ *
+ * Returns 0 on success, -1 if no thread could be started.
+ */
+int
+virFileCachePrefetch(virFileCachePtr cache,
+                     const char *const *names,
+                     size_t nworkers)
+{
+    virFileCachePrefetchData pf = { .cache = cache, .names = names };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+    int ret = -1;
+
+    pf.nnames = virStringListLength((const char **) names);
+
+    if (nworkers > pf.nnames)
+        nworkers = pf.nnames;
+
+    if (nworkers <= 1) {
+        virFileCachePrefetchWorker(&pf);
+        return 0;
+    }
+
+    if (VIR_ALLOC_N(threads, nworkers) < 0)
+        return -1;
+
+    for (i = 0; i < nworkers; i++) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            virFileCachePrefetchWorker, &pf) < 0) {
+            VIR_WARN("Failed to start prefetch worker: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            continue;
+        }
+        nthreads++;
+    }
+
+    if (nthreads == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to start any cache prefetch worker"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(threads);
+    return ret;
+}
+
+
 /**
  * virFileCacheGetPriv:
  * @cache: existing cache object
@@ -36,6 +36,7 @@
 #include "virlog.h"
 #include "virdbus.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_FIREWALL
@@ -51,6 +52,14 @@ VIR_ENUM_IMPL(virFirewallLayerCommand, VIR_FIREWALL_LAYER_LAST,
               IPTABLES_PATH,
               IP6TABLES_PATH);
 
+/* The nf_tables flavour of the tools, which program the same rules
+ * through the nftables kernel API instead of the legacy xtables one */
+VIR_ENUM_DECL(virFirewallLayerNFTCommand)
+VIR_ENUM_IMPL(virFirewallLayerNFTCommand, VIR_FIREWALL_LAYER_LAST,
+              EBTABLES_NFT_PATH,
+              IPTABLES_NFT_PATH,
+              IP6TABLES_NFT_PATH);
+
 VIR_ENUM_DECL(virFirewallLayerFirewallD)
 VIR_ENUM_IMPL(virFirewallLayerFirewallD, VIR_FIREWALL_LAYER_LAST,
               "eb", "ipv4", "ipv6")
@@ -107,6 +116,8 @@ VIR_ONCE_GLOBAL_INIT(virFirewall)
 static bool iptablesUseLock;
 static bool ip6tablesUseLock;
 static bool ebtablesUseLock;
+static bool iptablesUseRestore;
+static bool ip6tablesUseRestore;
 static bool lockOverride; /* true to avoid lock probes */
 
 void
@@ -115,6 +126,14 @@ virFirewallSetLockOverride(bool avoid)
     lockOverride = avoid;
 }
 
+/* Only for the test suite, which doesn't probe the host tools */
+void
+virFirewallSetRestoreOverride(bool use)
+{
+    iptablesUseRestore = use;
+    ip6tablesUseRestore = use;
+}
+
 static void
 virFirewallCheckUpdateLock(bool *lockflag,
                            const char *const*args)
@@ -130,17 +149,77 @@ virFirewallCheckUpdateLock(bool *lockflag,
     virCommandFree(cmd);
 }
 
+/* Rules can only be handed over to *tables-restore if it takes the same
+ * lock as the individual commands would */
+static void
+virFirewallCheckUpdateRestore(bool *restoreflag,
+                              bool useLock,
+                              const char *restore)
+{
+    int status; /* Ignore failed commands without logging them */
+    virCommandPtr cmd;
+
+    if (!virFileIsExecutable(restore)) {
+        VIR_INFO("%s not available", restore);
+        return;
+    }
+
+    cmd = virCommandNewArgList(restore, "--test", "--noflush", NULL);
+    if (useLock)
+        virCommandAddArg(cmd, "-w");
+    virCommandSetInputBuffer(cmd, "");
+
+    if (virCommandRun(cmd, &status) < 0 || status) {
+        VIR_INFO("not batching rules with %s", restore);
+    } else {
+        VIR_INFO("batching rules with %s", restore);
+        *restoreflag = true;
+    }
+    virCommandFree(cmd);
+}
+
+/* With the nftables backend a restore run is a single nf_tables
+ * transaction, so batching applies to it just as well */
+static const char *
+virFirewallLayerRestoreCommand(virFirewallLayer layer)
+{
+    bool nft = currentBackend == VIR_FIREWALL_BACKEND_NFTABLES;
+
+    switch (layer) {
+    case VIR_FIREWALL_LAYER_IPV4:
+        return nft ? IPTABLES_NFT_RESTORE_PATH : IPTABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_IPV6:
+        return nft ? IP6TABLES_NFT_RESTORE_PATH : IP6TABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_ETHERNET:
+    case VIR_FIREWALL_LAYER_LAST:
+        break;
+    }
+
+    return NULL;
+}
+
+static const char *
+virFirewallLayerGetCommand(virFirewallLayer layer)
+{
+    if (currentBackend == VIR_FIREWALL_BACKEND_NFTABLES)
+        return virFirewallLayerNFTCommandTypeToString(layer);
+    return virFirewallLayerCommandTypeToString(layer);
+}
+
 static void
 virFirewallCheckUpdateLocking(void)
 {
     const char *iptablesArgs[] = {
-        IPTABLES_PATH, "-w", "-L", "-n", NULL,
+        virFirewallLayerGetCommand(VIR_FIREWALL_LAYER_IPV4),
+        "-w", "-L", "-n", NULL,
     };
     const char *ip6tablesArgs[] = {
-        IP6TABLES_PATH, "-w", "-L", "-n", NULL,
+        virFirewallLayerGetCommand(VIR_FIREWALL_LAYER_IPV6),
+        "-w", "-L", "-n", NULL,
     };
     const char *ebtablesArgs[] = {
-        EBTABLES_PATH, "--concurrent", "-L", NULL,
+        virFirewallLayerGetCommand(VIR_FIREWALL_LAYER_ETHERNET),
+        "--concurrent", "-L", NULL,
     };
     if (lockOverride)
         return;
@@ -150,6 +229,29 @@ virFirewallCheckUpdateLocking(void)
                                ip6tablesArgs);
     virFirewallCheckUpdateLock(&ebtablesUseLock,
                                ebtablesArgs);
+    virFirewallCheckUpdateRestore(&iptablesUseRestore,
+                                  iptablesUseLock,
+                                  virFirewallLayerRestoreCommand(VIR_FIREWALL_LAYER_IPV4));
+    virFirewallCheckUpdateRestore(&ip6tablesUseRestore,
+                                  ip6tablesUseLock,
+                                  virFirewallLayerRestoreCommand(VIR_FIREWALL_LAYER_IPV6));
+}
+
+static bool
+virFirewallToolsPresent(bool nft)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+        const char *command = nft ?
+            virFirewallLayerNFTCommandTypeToString(i) :
+            virFirewallLayerCommandTypeToString(i);
+
+        if (!virFileIsExecutable(command))
+            return false;
+    }
+
+    return true;
 }
 
 static int
@@ -170,6 +272,14 @@ virFirewallValidateBackend(virFirewallBackend backend)
                 } else {
                     VIR_DEBUG("firewalld service not running, trying direct backend");
                     backend = VIR_FIREWALL_BACKEND_DIRECT;
+
+                    /* Hosts which only ship the nf_tables variants of
+                     * the tools can still be handled */
+                    if (!virFirewallToolsPresent(false) &&
+                        virFirewallToolsPresent(true)) {
+                        VIR_DEBUG("legacy tools missing, using nftables backend");
+                        backend = VIR_FIREWALL_BACKEND_NFTABLES;
+                    }
                 }
             } else {
                 return -1;
@@ -197,6 +307,22 @@ virFirewallValidateBackend(virFirewallBackend backend)
         VIR_DEBUG("found iptables/ip6tables/ebtables, using direct backend");
     }
 
+    if (backend == VIR_FIREWALL_BACKEND_NFTABLES) {
+        size_t i;
+
+        for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+            const char *command = virFirewallLayerNFTCommandTypeToString(i);
+
+            if (!virFileIsExecutable(command)) {
+                virReportSystemError(errno,
+                                     _("nftables firewall backend requested, but %s is not available"),
+                                     command);
+                return -1;
+            }
+        }
+        VIR_DEBUG("found nf_tables variants of the tools, using nftables backend");
+    }
+
     currentBackend = backend;
 
     virFirewallCheckUpdateLocking();
@@ -653,10 +779,16 @@ void virFirewallStartRollback(virFirewallPtr firewall,
 }
 
 
+static const char *
+virFirewallRuleGetCommand(virFirewallRulePtr rule)
+{
+    return virFirewallLayerGetCommand(rule->layer);
+}
+
 static char *
 virFirewallRuleToString(virFirewallRulePtr rule)
 {
-    const char *bin = virFirewallLayerCommandTypeToString(rule->layer);
+    const char *bin = virFirewallRuleGetCommand(rule);
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     size_t i;
 
@@ -675,7 +807,7 @@ virFirewallApplyRuleDirect(virFirewallRulePtr rule,
                            char **output)
 {
     size_t i;
-    const char *bin = virFirewallLayerCommandTypeToString(rule->layer);
+    const char *bin = virFirewallRuleGetCommand(rule);
     virCommandPtr cmd = NULL;
     int status;
     int ret = -1;
@@ -820,6 +952,7 @@ virFirewallApplyRule(virFirewallPtr firewall,
 
     switch (currentBackend) {
     case VIR_FIREWALL_BACKEND_DIRECT:
+    case VIR_FIREWALL_BACKEND_NFTABLES:
         if (virFirewallApplyRuleDirect(rule, ignoreErrors, &output) < 0)
             return -1;
         break;
@@ -860,6 +993,171 @@ virFirewallApplyRule(virFirewallPtr firewall,
     return ret;
 }
 
+/* Commands which iptables-restore understands */
+static const char *virFirewallRestoreCommands[] = {
+    "-A", "--append", "-I", "--insert", "-D", "--delete",
+    "-R", "--replace", "-N", "--new-chain", "-F", "--flush",
+    "-X", "--delete-chain", "-E", "--rename-chain", "-P", "--policy",
+    "-Z", "--zero", NULL
+};
+
+/* Returns the table @rule modifies if it can be applied through
+ * iptables-restore, NULL otherwise */
+static const char *
+virFirewallRuleGetRestoreTable(virFirewallRulePtr rule)
+{
+    const char *table = "filter";
+    bool hasCommand = false;
+    size_t i;
+
+    if (rule->queryCB || rule->ignoreErrors)
+        return NULL;
+
+    switch (rule->layer) {
+    case VIR_FIREWALL_LAYER_IPV4:
+        if (!iptablesUseRestore)
+            return NULL;
+        break;
+    case VIR_FIREWALL_LAYER_IPV6:
+        if (!ip6tablesUseRestore)
+            return NULL;
+        break;
+    case VIR_FIREWALL_LAYER_ETHERNET:
+    case VIR_FIREWALL_LAYER_LAST:
+        return NULL;
+    }
+
+    for (i = 0; i < rule->argsLen; i++) {
+        const char *arg = rule->args[i];
+
+        if (i == 0 && STREQ(arg, "-w"))
+            continue;
+
+        if (STREQ(arg, "--table") || STREQ(arg, "-t")) {
+            if (i + 1 == rule->argsLen)
+                return NULL;
+            table = rule->args[++i];
+            continue;
+        }
+
+        /* Don't bother with quoting, the few rules which would need it
+         * are simply run on their own */
+        if (!*arg || strpbrk(arg, " \t\n\"'\\"))
+            return NULL;
+
+        if (!hasCommand) {
+            if (!virStringListHasString(virFirewallRestoreCommands, arg))
+                return NULL;
+            hasCommand = true;
+        }
+    }
+
+    return hasCommand ? table : NULL;
+}
+
+
+/* Returns the number of rules from the beginning of @rules which can be
+ * applied in a single iptables-restore run */
+static size_t
+virFirewallRestoreBatchLength(virFirewallRulePtr *rules,
+                              size_t nrules)
+{
+    size_t i;
+
+    for (i = 0; i < nrules; i++) {
+        if (rules[i]->layer != rules[0]->layer ||
+            !virFirewallRuleGetRestoreTable(rules[i]))
+            break;
+    }
+
+    return i;
+}
+
+
+static int
+virFirewallApplyRulesRestore(virFirewallRulePtr *rules,
+                             size_t nrules)
+{
+    virFirewallLayer layer = rules[0]->layer;
+    const char *bin = virFirewallLayerRestoreCommand(layer);
+    bool useLock;
+    const char *table = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *error = NULL;
+    int status;
+    int ret = -1;
+    size_t i, j;
+
+    if (layer == VIR_FIREWALL_LAYER_IPV4)
+        useLock = iptablesUseLock;
+    else
+        useLock = ip6tablesUseLock;
+
+    for (i = 0; i < nrules; i++) {
+        virFirewallRulePtr rule = rules[i];
+        const char *ruleTable = virFirewallRuleGetRestoreTable(rule);
+        char *str = virFirewallRuleToString(rule);
+        bool first = true;
+
+        VIR_INFO("Applying rule '%s'", NULLSTR(str));
+        VIR_FREE(str);
+
+        if (!table || STRNEQ(table, ruleTable)) {
+            if (table)
+                virBufferAddLit(&buf, "COMMIT\n");
+            virBufferAsprintf(&buf, "*%s\n", ruleTable);
+            table = ruleTable;
+        }
+
+        for (j = 0; j < rule->argsLen; j++) {
+            if (j == 0 && STREQ(rule->args[j], "-w"))
+                continue;
+            if (STREQ(rule->args[j], "--table") ||
+                STREQ(rule->args[j], "-t")) {
+                j++;
+                continue;
+            }
+            if (!first)
+                virBufferAddLit(&buf, " ");
+            virBufferAdd(&buf, rule->args[j], -1);
+            first = false;
+        }
+        virBufferAddLit(&buf, "\n");
+    }
+    virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    input = virBufferContentAndReset(&buf);
+
+    cmd = virCommandNewArgList(bin, "--noflush", NULL);
+    if (useLock)
+        virCommandAddArg(cmd, "-w");
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to apply firewall rules %s: %s"),
+                       input, NULLSTR(error));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(input);
+    VIR_FREE(error);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
 static int
 virFirewallApplyGroup(virFirewallPtr firewall,
                       size_t idx)
@@ -873,6 +1171,24 @@ virFirewallApplyGroup(virFirewallPtr firewall,
     firewall->currentGroup = idx;
     group->addingRollback = false;
     for (i = 0; i < group->naction; i++) {
+        /* Consecutive iptables rules are applied by a single
+         * iptables-restore run rather than one process per rule.
+         * A failure of any of them fails the whole group just like
+         * a failure of a single rule would. */
+        if ((currentBackend == VIR_FIREWALL_BACKEND_DIRECT ||
+             currentBackend == VIR_FIREWALL_BACKEND_NFTABLES) &&
+            !ignoreErrors) {
+            size_t n = virFirewallRestoreBatchLength(group->action + i,
+                                                     group->naction - i);
+
+            if (n > 1) {
+                if (virFirewallApplyRulesRestore(group->action + i, n) < 0)
+                    return -1;
+                i += n - 1;
+                continue;
+            }
+        }
+
         if (virFirewallApplyRule(firewall,
                                  group->action[i],
                                  ignoreErrors) < 0)
@@ -964,3 +1280,374 @@ virFirewallApply(virFirewallPtr firewall)
     virMutexUnlock(&ruleLock);
     return ret;
 }
+
+
+struct _virFirewallSnapshot {
+    /* Canonical form of the rules present in each layer, see
+     * virFirewallRuleKey. Not filled in for the ethernet layer */
+    virHashTablePtr rules[VIR_FIREWALL_LAYER_LAST];
+};
+
+
+/* Long options used in rules, with the short form *tables-save prints */
+static const char *virFirewallOptionAliases[][2] = {
+    { "--source", "-s" },
+    { "--src", "-s" },
+    { "--destination", "-d" },
+    { "--dst", "-d" },
+    { "--in-interface", "-i" },
+    { "--out-interface", "-o" },
+    { "--protocol", "-p" },
+    { "--jump", "-j" },
+    { "--goto", "-g" },
+    { "--match", "-m" },
+    { "--source-port", "--sport" },
+    { "--destination-port", "--dport" },
+};
+
+
+static int
+virFirewallCompareStrings(const void *a,
+                          const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+
+/**
+ * virFirewallRuleKey:
+ * @layer: the layer of the rule
+ * @table: the table the rule is in
+ * @chain: the chain the rule is in
+ * @args: arguments of the rule, after the command selecting the chain
+ * @nargs: number of items in @args
+ *
+ * Build a canonical representation of a rule that is independent of
+ * how the rule was spelled. This is used to compare the rules libvirt
+ * would add with the rules reported by *tables-save, which uses short
+ * options, prints match modules and target defaults explicitly and puts
+ * the options in its own order.
+ *
+ * Returns the key, or NULL on error
+ */
+static char *
+virFirewallRuleKey(virFirewallLayer layer,
+                   const char *table,
+                   const char *chain,
+                   const char *const *args,
+                   size_t nargs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **tokens = NULL;
+    size_t ntokens = 0;
+    bool negate = false;
+    char *ret = NULL;
+    size_t i, j;
+
+    for (i = 0; i < nargs; i++) {
+        virBuffer token = VIR_BUFFER_INITIALIZER;
+        const char *opt = args[i];
+        char *str;
+
+        if (STREQ(opt, "!")) {
+            negate = true;
+            continue;
+        }
+
+        for (j = 0; j < ARRAY_CARDINALITY(virFirewallOptionAliases); j++) {
+            if (STREQ(opt, virFirewallOptionAliases[j][0])) {
+                opt = virFirewallOptionAliases[j][1];
+                break;
+            }
+        }
+
+        if (negate)
+            virBufferAddLit(&token, "! ");
+        virBufferAdd(&token, opt, -1);
+        negate = false;
+
+        while (i + 1 < nargs && args[i + 1][0] != '-' &&
+               STRNEQ(args[i + 1], "!")) {
+            const char *value = args[++i];
+
+            if ((STREQ(opt, "-s") || STREQ(opt, "-d")) && !strchr(value, '/')) {
+                virBufferAsprintf(&token, " %s/%s", value,
+                                  layer == VIR_FIREWALL_LAYER_IPV6 ? "128" : "32");
+            } else if (STREQ(opt, "--ctstate") || STREQ(opt, "--state")) {
+                char **states = virStringSplit(value, ",", 0);
+                size_t nstates = virStringListLength((const char *const *)states);
+                char *joined;
+
+                if (!states)
+                    goto cleanup;
+                qsort(states, nstates, sizeof(*states),
+                      virFirewallCompareStrings);
+                joined = virStringListJoin((const char **)states, ",");
+                virStringListFree(states);
+                if (!joined)
+                    goto cleanup;
+                virBufferAsprintf(&token, " %s", joined);
+                VIR_FREE(joined);
+            } else {
+                virBufferAsprintf(&token, " %s", value);
+            }
+        }
+
+        if (virBufferCheckError(&token) < 0)
+            goto cleanup;
+        str = virBufferContentAndReset(&token);
+
+        /* Match modules are implied by the options which follow them
+         * and REJECT prints its default reply type */
+        if (STRPREFIX(str, "-m ") ||
+            STREQ(str, "--reject-with icmp-port-unreachable") ||
+            STREQ(str, "--reject-with icmp6-port-unreachable")) {
+            VIR_FREE(str);
+            continue;
+        }
+
+        if (VIR_APPEND_ELEMENT(tokens, ntokens, str) < 0) {
+            VIR_FREE(str);
+            goto cleanup;
+        }
+    }
+
+    if (ntokens)
+        qsort(tokens, ntokens, sizeof(*tokens), virFirewallCompareStrings);
+
+    virBufferAsprintf(&buf, "%s %s", table, chain);
+    for (i = 0; i < ntokens; i++)
+        virBufferAsprintf(&buf, "\t%s", tokens[i]);
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    ret = virBufferContentAndReset(&buf);
+
+ cleanup:
+    for (i = 0; i < ntokens; i++)
+        VIR_FREE(tokens[i]);
+    VIR_FREE(tokens);
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+
+/* Returns the canonical key of a rule that inserts or appends
+ * a rule to a chain, NULL if @rule is anything else */
+static char *
+virFirewallRuleGetKey(virFirewallRulePtr rule)
+{
+    const char *table = "filter";
+    size_t i;
+
+    for (i = 0; i < rule->argsLen; i++) {
+        const char *arg = rule->args[i];
+
+        if (i == 0 && STREQ(arg, "-w"))
+            continue;
+
+        if (STREQ(arg, "--table") || STREQ(arg, "-t")) {
+            if (i + 1 == rule->argsLen)
+                return NULL;
+            table = rule->args[++i];
+            continue;
+        }
+
+        if ((STREQ(arg, "--insert") || STREQ(arg, "-I") ||
+             STREQ(arg, "--append") || STREQ(arg, "-A")) &&
+            i + 1 < rule->argsLen) {
+            const char *chain = rule->args[++i];
+            unsigned int pos;
+
+            /* An explicit position doesn't matter for the rule itself */
+            if (i + 1 < rule->argsLen &&
+                virStrToLong_ui(rule->args[i + 1], NULL, 10, &pos) == 0)
+                i++;
+
+            return virFirewallRuleKey(rule->layer, table, chain,
+                                      (const char *const *)rule->args + i + 1,
+                                      rule->argsLen - i - 1);
+        }
+
+        return NULL;
+    }
+
+    return NULL;
+}
+
+
+static int
+virFirewallSnapshotLoadLayer(virFirewallSnapshotPtr snapshot,
+                             virFirewallLayer layer)
+{
+    const char *bin;
+    char *save = NULL;
+    char *output = NULL;
+    char **lines = NULL;
+    char *table = NULL;
+    virCommandPtr cmd = NULL;
+    int ret = -1;
+    size_t i;
+
+    if (!(snapshot->rules[layer] = virHashCreate(256, NULL)))
+        goto cleanup;
+
+    bin = virFirewallLayerGetCommand(layer);
+
+    if (virAsprintf(&save, "%s-save", bin) < 0)
+        goto cleanup;
+
+    cmd = virCommandNew(save);
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    if (!(lines = virStringSplit(output, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        char **args = NULL;
+        char *key = NULL;
+        size_t nargs;
+
+        if (lines[i][0] == '*') {
+            VIR_FREE(table);
+            if (VIR_STRDUP(table, lines[i] + 1) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        if (!table || !STRPREFIX(lines[i], "-A "))
+            continue;
+
+        if (!(args = virStringSplitCount(lines[i], " ", 0, &nargs)))
+            goto cleanup;
+
+        if (nargs >= 2)
+            key = virFirewallRuleKey(layer, table, args[1],
+                                     (const char *const *)args + 2,
+                                     nargs - 2);
+        virStringListFree(args);
+
+        if (nargs >= 2 && !key)
+            goto cleanup;
+
+        if (key &&
+            !virHashLookup(snapshot->rules[layer], key) &&
+            virHashAddEntry(snapshot->rules[layer], key, (void *) 1) < 0) {
+            VIR_FREE(key);
+            goto cleanup;
+        }
+        VIR_FREE(key);
+    }
+
+    VIR_DEBUG("Found %zd rules in %s output",
+              virHashSize(snapshot->rules[layer]), save);
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    virStringListFree(lines);
+    VIR_FREE(output);
+    VIR_FREE(table);
+    VIR_FREE(save);
+    return ret;
+}
+
+
+/**
+ * virFirewallSnapshotNew:
+ *
+ * Record the IPv4 and IPv6 rules currently present on the host, with
+ * a single *tables-save run per layer.
+ *
+ * Returns the snapshot, or NULL on error
+ */
+virFirewallSnapshotPtr
+virFirewallSnapshotNew(void)
+{
+    virFirewallSnapshotPtr snapshot;
+
+    if (virFirewallInitialize() < 0)
+        return NULL;
+
+    if (VIR_ALLOC(snapshot) < 0)
+        return NULL;
+
+    if (virFirewallSnapshotLoadLayer(snapshot, VIR_FIREWALL_LAYER_IPV4) < 0 ||
+        virFirewallSnapshotLoadLayer(snapshot, VIR_FIREWALL_LAYER_IPV6) < 0) {
+        virFirewallSnapshotFree(snapshot);
+        return NULL;
+    }
+
+    return snapshot;
+}
+
+
+void
+virFirewallSnapshotFree(virFirewallSnapshotPtr snapshot)
+{
+    size_t i;
+
+    if (!snapshot)
+        return;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++)
+        virHashFree(snapshot->rules[i]);
+    VIR_FREE(snapshot);
+}
+
+
+/**
+ * virFirewallIsApplied:
+ * @firewall: the firewall ruleset
+ * @snapshot: rules present on the host
+ *
+ * Check whether all rules @firewall would add are already present
+ * in @snapshot. Transactions that ignore errors are not considered, as
+ * their rules are not required to be present. Rules that cannot be
+ * verified, like queries or ethernet layer rules, make the check fail.
+ *
+ * Returns true if applying @firewall would not add any new rule
+ */
+bool
+virFirewallIsApplied(virFirewallPtr firewall,
+                     virFirewallSnapshotPtr snapshot)
+{
+    size_t i, j;
+
+    if (!firewall || firewall->err)
+        return false;
+
+    for (i = 0; i < firewall->ngroups; i++) {
+        virFirewallGroupPtr group = firewall->groups[i];
+
+        if (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS)
+            continue;
+
+        for (j = 0; j < group->naction; j++) {
+            virFirewallRulePtr rule = group->action[j];
+            char *key;
+            bool found;
+
+            if (rule->queryCB || rule->ignoreErrors ||
+                !snapshot->rules[rule->layer])
+                return false;
+
+            if (!(key = virFirewallRuleGetKey(rule))) {
+                virResetLastError();
+                return false;
+            }
+
+            found = !!virHashLookup(snapshot->rules[rule->layer], key);
+            if (!found)
+                VIR_DEBUG("Rule '%s' is missing", key);
+            VIR_FREE(key);
+
+            if (!found)
+                return false;
+        }
+    }
+
+    return true;
+}
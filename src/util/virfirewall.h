@@ -116,4 +116,16 @@ int virFirewallApply(virFirewallPtr firewall);
 
 void virFirewallSetLockOverride(bool avoid);
 
+void virFirewallSetRestoreOverride(bool use);
+
+typedef struct _virFirewallSnapshot virFirewallSnapshot;
+typedef virFirewallSnapshot *virFirewallSnapshotPtr;
+
+virFirewallSnapshotPtr virFirewallSnapshotNew(void);
+
+void virFirewallSnapshotFree(virFirewallSnapshotPtr snapshot);
+
+bool virFirewallIsApplied(virFirewallPtr firewall,
+                          virFirewallSnapshotPtr snapshot);
+
 #endif /* __VIR_FIREWALL_H__ */
@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -37,9 +37,19 @@
 
 VIR_LOG_INIT("util.hash");
 
-#define MAX_HASH_LEN 8
+/* The table always has a power of two number of slots, at most
+ * 3/4 of which are used by entries or deleted entries, so that
+ * probing for a free slot is short and always terminates. */
+#define VIR_HASH_MIN_SIZE 8
+#define VIR_HASH_MAX_LOAD(size) ((size) / 4 * 3)
 
-/* #define DEBUG_GROW */
+/* Tables up to this many slots are resized all at once, bigger ones
+ * have 1/VIR_HASH_MIGRATE_PARTS of the old slots moved over by each
+ * modification while being resized. That bounds the cost of a single
+ * modification, yet resizing finishes soon even for tables which are
+ * seldom modified and would otherwise be looked up in both arrays. */
+#define VIR_HASH_MIGRATE_THRESHOLD 1024
+#define VIR_HASH_MIGRATE_PARTS 64
 
 #define virHashIterationError(ret) \
     do { \
@@ -48,23 +58,55 @@ VIR_LOG_INIT("util.hash");
     } while (0)
 
 /*
- * A single entry in the hash table
+ * A single slot in the hash table
  */
 typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
-    struct _virHashEntry *next;
-    void *name;
+    void *name; /* NULL if the slot is free, VIR_HASH_DELETED if removed */
     void *payload;
 };
 
+static char virHashDeletedMarker;
+#define VIR_HASH_DELETED ((void *) &virHashDeletedMarker)
+
+#define VIR_HASH_ENTRY_USED(entry) \
+    ((entry)->name && (entry)->name != VIR_HASH_DELETED)
+
+/*
+ * Each slot also has a control byte, kept in a separate dense array
+ * so that probing rarely needs to touch the entries or the keys: the
+ * byte tells whether the slot is free or deleted, or otherwise holds
+ * 7 bits of the hash code of the key stored in it.
+ */
+#define VIR_HASH_CTRL_FREE 0
+#define VIR_HASH_CTRL_DELETED 1
+#define VIR_HASH_CTRL_TAG(code) ((uint8_t) (0x80 | ((code) >> 25)))
+
+/*
+ * An array of slots using open addressing with linear probing
+ */
+typedef struct _virHashSlots virHashSlots;
+typedef virHashSlots *virHashSlotsPtr;
+struct _virHashSlots {
+    uint8_t *ctrl;
+    virHashEntryPtr entries;
+    size_t size;
+    size_t used;
+    size_t deleted;
+};
+
 /*
  * The entire hash table
  */
 struct _virHashTable {
-    virHashEntryPtr *table;
+    virHashSlots slots;
+    /* While the table is being resized, entries not moved into @slots
+     * yet. Entries live in exactly one of @slots and @old. */
+    virHashSlots old;
+    /* Index of the next slot of @old to be moved */
+    size_t migrated;
     uint32_t seed;
-    size_t size;
     size_t nbElems;
     /* True iff we are iterating over hash entries. */
     bool iterating;
@@ -130,10 +172,240 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 
 
 static size_t
-virHashComputeKey(const virHashTable *table, const void *name)
+virHashRoundSize(size_t size)
+{
+    size_t ret = VIR_HASH_MIN_SIZE;
+
+    while (ret < size)
+        ret *= 2;
+
+    return ret;
+}
+
+
+static int
+virHashSlotsInit(virHashSlotsPtr slots, size_t size)
+{
+    if (VIR_ALLOC_N(slots->ctrl, size) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(slots->entries, size) < 0) {
+        VIR_FREE(slots->ctrl);
+        return -1;
+    }
+
+    slots->size = size;
+    slots->used = 0;
+    slots->deleted = 0;
+    return 0;
+}
+
+
+static virHashEntryPtr
+virHashSlotsFind(const virHashTable *table,
+                 const virHashSlots *slots,
+                 const void *name,
+                 uint32_t code)
+{
+    size_t mask = slots->size - 1;
+    uint8_t tag = VIR_HASH_CTRL_TAG(code);
+    size_t i;
+
+    if (!slots->entries)
+        return NULL;
+
+    for (i = code & mask; slots->ctrl[i] != VIR_HASH_CTRL_FREE;
+         i = (i + 1) & mask) {
+        if (slots->ctrl[i] == tag &&
+            table->keyEqual(slots->entries[i].name, name))
+            return &slots->entries[i];
+    }
+
+    return NULL;
+}
+
+
+/* The caller must make sure the key is not in the table yet
+ * and that there is room for it */
+static void
+virHashSlotsInsert(virHashSlotsPtr slots,
+                   void *name,
+                   void *payload,
+                   uint32_t code)
+{
+    size_t mask = slots->size - 1;
+    size_t i;
+
+    for (i = code & mask; slots->ctrl[i] & 0x80; i = (i + 1) & mask)
+        ;
+
+    if (slots->ctrl[i] == VIR_HASH_CTRL_DELETED)
+        slots->deleted--;
+
+    slots->ctrl[i] = VIR_HASH_CTRL_TAG(code);
+    slots->entries[i].name = name;
+    slots->entries[i].payload = payload;
+    slots->used++;
+}
+
+
+static virHashEntryPtr
+virHashFindEntry(const virHashTable *table,
+                 const void *name,
+                 virHashSlotsPtr *slots)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    uint32_t code = table->keyCode(name, table->seed);
+    virHashEntryPtr entry;
+
+    if ((entry = virHashSlotsFind(table, &table->slots, name, code))) {
+        if (slots)
+            *slots = (virHashSlotsPtr) &table->slots;
+        return entry;
+    }
+
+    if ((entry = virHashSlotsFind(table, &table->old, name, code))) {
+        if (slots)
+            *slots = (virHashSlotsPtr) &table->old;
+        return entry;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virHashMigrate:
+ * @table: the hash table
+ * @count: how many steps to take, SIZE_MAX to finish it
+ *
+ * Move entries of a table being resized into the new slots. Doing
+ * this a few entries at a time spreads the cost of a resize over
+ * many modifications instead of stalling a single one.
+ */
+static void
+virHashMigrate(virHashTablePtr table, size_t count)
+{
+    virHashSlotsPtr old = &table->old;
+
+    if (!old->entries || table->iterating)
+        return;
+
+    if (count == SIZE_MAX || old->size <= VIR_HASH_MIGRATE_THRESHOLD)
+        count = old->size;
+    else
+        count *= old->size / VIR_HASH_MIGRATE_PARTS;
+
+    while (count-- > 0 && table->migrated < old->size) {
+        virHashEntryPtr entry = &old->entries[table->migrated++];
+
+        if (VIR_HASH_ENTRY_USED(entry)) {
+            virHashSlotsInsert(&table->slots, entry->name, entry->payload,
+                               table->keyCode(entry->name, table->seed));
+
+            /* The entry lives in the new slots only from now on. The
+             * old slot stays deleted rather than free so that probing
+             * for the entries not moved yet still works. */
+            old->ctrl[entry - old->entries] = VIR_HASH_CTRL_DELETED;
+            entry->name = VIR_HASH_DELETED;
+            entry->payload = NULL;
+            old->used--;
+            old->deleted++;
+        }
+    }
+
+    if (table->migrated == old->size) {
+        VIR_FREE(old->ctrl);
+        VIR_FREE(old->entries);
+        memset(old, 0, sizeof(*old));
+        table->migrated = 0;
+    }
+}
+
+
+/**
+ * virHashGrow:
+ * @table: the hash table
+ *
+ * Make room for one more entry, starting a resize if the table is
+ * getting full. Entries are moved to the new slots incrementally by
+ * virHashMigrate.
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+static int
+virHashGrow(virHashTablePtr table)
+{
+    virHashSlots slots;
+    size_t size = table->slots.size;
+
+    /* Count entries still to be migrated as well so that they are
+     * guaranteed to fit once the migration is finished */
+    if (table->slots.used + table->slots.deleted + table->old.used + 1 <=
+        VIR_HASH_MAX_LOAD(size))
+        return 0;
+
+    /* The previous resize has to be finished first */
+    virHashMigrate(table, SIZE_MAX);
+
+    /* If it's mostly deleted entries that fill the table, rebuilding
+     * it at the same size to drop them is enough */
+    if (table->slots.used + 1 > size / 2)
+        size *= 2;
+
+    if (virHashSlotsInit(&slots, size) < 0) {
+        /* Keep at least one free slot to terminate probing */
+        if (table->slots.used + table->slots.deleted + 1 < table->slots.size)
+            return 0;
+        return -1;
+    }
+
+    table->old = table->slots;
+    table->slots = slots;
+    table->migrated = 0;
+
+    virHashMigrate(table, 1);
+    return 0;
+}
+
+
+static void
+virHashSlotsFree(virHashTablePtr table, virHashSlotsPtr slots)
+{
+    size_t i;
+
+    for (i = 0; i < slots->size; i++) {
+        virHashEntryPtr entry = &slots->entries[i];
+
+        if (!VIR_HASH_ENTRY_USED(entry))
+            continue;
+
+        if (table->dataFree)
+            table->dataFree(entry->payload, entry->name);
+        if (table->keyFree)
+            table->keyFree(entry->name);
+    }
+
+    VIR_FREE(slots->ctrl);
+    VIR_FREE(slots->entries);
+}
+
+
+static void
+virHashRemoveSlot(virHashTablePtr table,
+                  virHashSlotsPtr slots,
+                  virHashEntryPtr entry)
+{
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
+
+    slots->ctrl[entry - slots->entries] = VIR_HASH_CTRL_DELETED;
+    entry->name = VIR_HASH_DELETED;
+    entry->payload = NULL;
+    slots->used--;
+    slots->deleted++;
+    table->nbElems--;
 }
 
 /**
@@ -165,7 +437,6 @@ virHashTablePtr virHashCreateFull(ssize_t size,
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -173,7 +444,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (virHashSlotsInit(&table->slots, virHashRoundSize(size)) < 0) {
         VIR_FREE(table);
         return NULL;
     }
@@ -231,69 +502,6 @@ virHashAtomicDispose(void *obj)
 }
 
 
-/**
- * virHashGrow:
- * @table: the hash table
- * @size: the new size of the hash table
- *
- * resize the hash table
- *
- * Returns 0 in case of success, -1 in case of failure
- */
-static int
-virHashGrow(virHashTablePtr table, size_t size)
-{
-    size_t oldsize, i;
-    virHashEntryPtr *oldtable;
-
-#ifdef DEBUG_GROW
-    size_t nbElem = 0;
-#endif
-
-    if (table == NULL)
-        return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
-        return -1;
-
-    oldsize = table->size;
-    oldtable = table->table;
-    if (oldtable == NULL)
-        return -1;
-
-    if (VIR_ALLOC_N(table->table, size) < 0) {
-        table->table = oldtable;
-        return -1;
-    }
-    table->size = size;
-
-    for (i = 0; i < oldsize; i++) {
-        virHashEntryPtr iter = oldtable[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
-
-            iter->next = table->table[key];
-            table->table[key] = iter;
-
-#ifdef DEBUG_GROW
-            nbElem++;
-#endif
-            iter = next;
-        }
-    }
-
-    VIR_FREE(oldtable);
-
-#ifdef DEBUG_GROW
-    VIR_DEBUG("virHashGrow : from %d to %d, %ld elems", oldsize,
-              size, nbElem);
-#endif
-
-    return 0;
-}
-
 /**
  * virHashFree:
  * @table: the hash table
@@ -304,26 +512,11 @@ virHashGrow(virHashTablePtr table, size_t size)
 void
 virHashFree(virHashTablePtr table)
 {
-    size_t i;
-
     if (table == NULL)
         return;
 
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr iter = table->table[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-
-            if (table->dataFree)
-                table->dataFree(iter->payload, iter->name);
-            if (table->keyFree)
-                table->keyFree(iter->name);
-            VIR_FREE(iter);
-            iter = next;
-        }
-    }
-
-    VIR_FREE(table->table);
+    virHashSlotsFree(table, &table->old);
+    virHashSlotsFree(table, &table->slots);
     VIR_FREE(table);
 }
 
@@ -332,7 +525,6 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
                         bool is_update)
 {
-    size_t key, len = 0;
     virHashEntryPtr entry;
     void *new_name;
 
@@ -342,40 +534,30 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    virHashMigrate(table, 1);
 
     /* Check for duplicate entry */
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (is_update) {
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                entry->payload = userdata;
-                return 0;
-            } else {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("Duplicate key"));
-                return -1;
-            }
+    if ((entry = virHashFindEntry(table, name, NULL))) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            entry->payload = userdata;
+            return 0;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Duplicate key"));
+            return -1;
         }
-        len++;
     }
 
-    if (VIR_ALLOC(entry) < 0 || !(new_name = table->keyCopy(name))) {
-        VIR_FREE(entry);
+    if (virHashGrow(table) < 0 ||
+        !(new_name = table->keyCopy(name)))
         return -1;
-    }
-
-    entry->name = new_name;
-    entry->payload = userdata;
-    entry->next = table->table[key];
-    table->table[key] = entry;
 
+    virHashSlotsInsert(&table->slots, new_name, userdata,
+                       table->keyCode(name, table->seed));
     table->nbElems++;
 
-    if (len > MAX_HASH_LEN)
-        virHashGrow(table, MAX_HASH_LEN * table->size);
-
     return 0;
 }
 
@@ -442,18 +624,15 @@ virHashAtomicUpdate(virHashAtomicPtr table,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
     virHashEntryPtr entry;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
-            return entry->payload;
-    }
-    return NULL;
+    if (!(entry = virHashFindEntry(table, name, NULL)))
+        return NULL;
+
+    return entry->payload;
 }
 
 
@@ -514,7 +693,7 @@ virHashSize(const virHashTable *table)
  * virHashTableSize:
  * @table: the hash table
  *
- * Query the size of the hash @table, i.e., number of buckets in the table.
+ * Query the size of the hash @table, i.e., number of slots in the table.
  *
  * Returns the number of keys in the hash table or
  * -1 in case of error
@@ -524,7 +703,7 @@ virHashTableSize(const virHashTable *table)
 {
     if (table == NULL)
         return -1;
-    return table->size;
+    return table->slots.size;
 }
 
 
@@ -543,30 +722,20 @@ int
 virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
-    virHashEntryPtr *nextptr;
+    virHashSlotsPtr slots;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
-    for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (table->iterating && table->current != entry)
-                virHashIterationError(-1);
+    if (!(entry = virHashFindEntry(table, name, &slots)))
+        return -1;
 
-            if (table->dataFree)
-                table->dataFree(entry->payload, entry->name);
-            if (table->keyFree)
-                table->keyFree(entry->name);
-            *nextptr = entry->next;
-            VIR_FREE(entry);
-            table->nbElems--;
-            return 0;
-        }
-        nextptr = &entry->next;
-    }
+    if (table->iterating && table->current != entry)
+        virHashIterationError(-1);
 
-    return -1;
+    virHashRemoveSlot(table, slots, entry);
+    virHashMigrate(table, 1);
+    return 0;
 }
 
 
@@ -598,19 +767,23 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry = table->table[i];
-        while (entry) {
-            virHashEntryPtr next = entry->next;
-            table->current = entry;
-            ret = iter(entry->payload, entry->name, data);
-            table->current = NULL;
-
-            if (ret < 0)
-                goto cleanup;
-
-            entry = next;
-        }
+    for (i = 0; i < table->old.size + table->slots.size; i++) {
+        virHashEntryPtr entry;
+
+        if (i < table->old.size)
+            entry = &table->old.entries[i];
+        else
+            entry = &table->slots.entries[i - table->old.size];
+
+        if (!VIR_HASH_ENTRY_USED(entry))
+            continue;
+
+        table->current = entry;
+        ret = iter(entry->payload, entry->name, data);
+        table->current = NULL;
+
+        if (ret < 0)
+            goto cleanup;
     }
 
     ret = 0;
@@ -648,23 +821,21 @@ virHashRemoveSet(virHashTablePtr table,
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr *nextptr = table->table + i;
-
-        while (*nextptr) {
-            virHashEntryPtr entry = *nextptr;
-            if (!iter(entry->payload, entry->name, data)) {
-                nextptr = &entry->next;
-            } else {
-                count++;
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                if (table->keyFree)
-                    table->keyFree(entry->name);
-                *nextptr = entry->next;
-                VIR_FREE(entry);
-                table->nbElems--;
-            }
+    for (i = 0; i < table->old.size + table->slots.size; i++) {
+        virHashSlotsPtr slots = &table->slots;
+        virHashEntryPtr entry;
+
+        if (i < table->old.size) {
+            slots = &table->old;
+            entry = &slots->entries[i];
+        } else {
+            entry = &slots->entries[i - table->old.size];
+        }
+
+        if (VIR_HASH_ENTRY_USED(entry) &&
+            iter(entry->payload, entry->name, data)) {
+            count++;
+            virHashRemoveSlot(table, slots, entry);
         }
     }
     table->iterating = false;
@@ -728,15 +899,20 @@ void *virHashSearch(const virHashTable *ctable,
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
+    for (i = 0; i < table->old.size + table->slots.size; i++) {
         virHashEntryPtr entry;
-        for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
-                table->iterating = false;
-                if (name)
-                    *name = table->keyCopy(entry->name);
-                return entry->payload;
-            }
+
+        if (i < table->old.size)
+            entry = &table->old.entries[i];
+        else
+            entry = &table->slots.entries[i - table->old.size];
+
+        if (VIR_HASH_ENTRY_USED(entry) &&
+            iter(entry->payload, entry->name, data)) {
+            table->iterating = false;
+            if (name)
+                *name = table->keyCopy(entry->name);
+            return entry->payload;
         }
     }
     table->iterating = false;
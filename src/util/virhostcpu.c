@@ -58,6 +58,7 @@
 #include "virstring.h"
 #include "virnuma.h"
 #include "virlog.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -202,8 +203,96 @@ virHostCPUGetStatsFreeBSD(int cpuNum,
 # define LINUX_NB_CPU_STATS 4
 
 
+/* Topology of a single host CPU as read from
+ * SYSFS_SYSTEM_PATH/cpu/cpuN/topology. Each item is read once and then
+ * served from memory until the set of present or online CPUs changes or
+ * the cache is invalidated explicitly. */
+typedef struct _virHostCPUTopology virHostCPUTopology;
+typedef virHostCPUTopology *virHostCPUTopologyPtr;
+struct _virHostCPUTopology {
+    bool hasSocket;
+    unsigned int socket;
+    bool hasCore;
+    unsigned int core;
+    unsigned long nthreadSiblings; /* 0 if not read yet */
+    virBitmapPtr siblings;
+};
+
+/* Protects all of the virHostCPUTopology* variables below */
+static virMutex virHostCPUTopologyLock = VIR_MUTEX_INITIALIZER;
+static virHostCPUTopologyPtr virHostCPUTopologies;
+static size_t virHostCPUNTopologies;
+/* CPUs present and online when the cache was (in)validated last */
+static virBitmapPtr virHostCPUTopologyPresent;
+static virBitmapPtr virHostCPUTopologyOnline;
+
+
+static void
+virHostCPUTopologyClearLocked(void)
+{
+    size_t i;
+
+    for (i = 0; i < virHostCPUNTopologies; i++)
+        virBitmapFree(virHostCPUTopologies[i].siblings);
+    VIR_FREE(virHostCPUTopologies);
+    virHostCPUNTopologies = 0;
+
+    virBitmapFree(virHostCPUTopologyPresent);
+    virHostCPUTopologyPresent = NULL;
+    virBitmapFree(virHostCPUTopologyOnline);
+    virHostCPUTopologyOnline = NULL;
+}
+
+
+static bool
+virHostCPUTopologyBitmapEqual(virBitmapPtr a,
+                              virBitmapPtr b)
+{
+    if (!a || !b)
+        return a == b;
+
+    return virBitmapEqual(a, b);
+}
+
+
+/* Drops the cached topology if CPUs were (un)plugged or brought
+ * online/offline since the last call */
+static void
+virHostCPUTopologyValidateLocked(virBitmapPtr present,
+                                 virBitmapPtr online)
+{
+    if (virHostCPUTopologyBitmapEqual(present, virHostCPUTopologyPresent) &&
+        virHostCPUTopologyBitmapEqual(online, virHostCPUTopologyOnline))
+        return;
+
+    VIR_DEBUG("Host CPUs changed, dropping cached topology");
+    virHostCPUTopologyClearLocked();
+
+    if (present)
+        virHostCPUTopologyPresent = virBitmapNewCopy(present);
+    if (online)
+        virHostCPUTopologyOnline = virBitmapNewCopy(online);
+
+    /* Failing to remember the maps only means the next call flushes
+     * the cache again */
+    virResetLastError();
+}
+
+
+static virHostCPUTopologyPtr
+virHostCPUTopologyGetLocked(unsigned int cpu)
+{
+    if (cpu >= virHostCPUNTopologies &&
+        VIR_EXPAND_N(virHostCPUTopologies, virHostCPUNTopologies,
+                     cpu + 1 - virHostCPUNTopologies) < 0)
+        return NULL;
+
+    return &virHostCPUTopologies[cpu];
+}
+
+
 static unsigned long
-virHostCPUCountThreadSiblings(unsigned int cpu)
+virHostCPUReadThreadSiblings(unsigned int cpu)
 {
     unsigned long ret = 0;
     int rv = -1;
@@ -230,63 +319,136 @@ virHostCPUCountThreadSiblings(unsigned int cpu)
     return ret;
 }
 
+
+static unsigned long
+virHostCPUCountThreadSiblings(unsigned int cpu)
+{
+    virHostCPUTopologyPtr topo;
+    unsigned long ret = 0;
+
+    virMutexLock(&virHostCPUTopologyLock);
+
+    if (!(topo = virHostCPUTopologyGetLocked(cpu)))
+        goto cleanup;
+
+    if (!topo->nthreadSiblings)
+        topo->nthreadSiblings = virHostCPUReadThreadSiblings(cpu);
+
+    ret = topo->nthreadSiblings;
+
+ cleanup:
+    virMutexUnlock(&virHostCPUTopologyLock);
+    return ret;
+}
+
 int
 virHostCPUGetSocket(unsigned int cpu, unsigned int *socket)
 {
+    virHostCPUTopologyPtr topo;
     int tmp;
-    int ret = virFileReadValueInt(&tmp,
-                                  "%s/cpu/cpu%u/topology/physical_package_id",
-                                  SYSFS_SYSTEM_PATH, cpu);
+    int rv;
+    int ret = -1;
 
-    /* If the file is not there, it's 0 */
-    if (ret == -2)
-        tmp = 0;
-    else if (ret < 0)
-        return -1;
+    virMutexLock(&virHostCPUTopologyLock);
+
+    if (!(topo = virHostCPUTopologyGetLocked(cpu)))
+        goto cleanup;
 
-    /* Some architectures might have '-1' validly in the file, but that actually
-     * means there are no sockets, so from our point of view it's all one socket,
-     * i.e. socket 0.  Similarly when the file does not exist. */
-    if (tmp < 0)
-        tmp = 0;
+    if (!topo->hasSocket) {
+        rv = virFileReadValueInt(&tmp,
+                                 "%s/cpu/cpu%u/topology/physical_package_id",
+                                 SYSFS_SYSTEM_PATH, cpu);
 
-    *socket = tmp;
+        /* If the file is not there, it's 0 */
+        if (rv == -2)
+            tmp = 0;
+        else if (rv < 0)
+            goto cleanup;
 
-    return 0;
+        /* Some architectures might have '-1' validly in the file, but that
+         * actually means there are no sockets, so from our point of view
+         * it's all one socket, i.e. socket 0.  Similarly when the file does
+         * not exist. */
+        if (tmp < 0)
+            tmp = 0;
+
+        topo->socket = tmp;
+        topo->hasSocket = true;
+    }
+
+    *socket = topo->socket;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virHostCPUTopologyLock);
+    return ret;
 }
 
 int
 virHostCPUGetCore(unsigned int cpu, unsigned int *core)
 {
-    int ret = virFileReadValueUint(core,
-                                   "%s/cpu/cpu%u/topology/core_id",
-                                   SYSFS_SYSTEM_PATH, cpu);
+    virHostCPUTopologyPtr topo;
+    int rv;
+    int ret = -1;
 
-    /* If the file is not there, it's 0 */
-    if (ret == -2)
-        *core = 0;
-    else if (ret < 0)
-        return -1;
+    virMutexLock(&virHostCPUTopologyLock);
 
-    return 0;
+    if (!(topo = virHostCPUTopologyGetLocked(cpu)))
+        goto cleanup;
+
+    if (!topo->hasCore) {
+        rv = virFileReadValueUint(&topo->core,
+                                  "%s/cpu/cpu%u/topology/core_id",
+                                  SYSFS_SYSTEM_PATH, cpu);
+
+        /* If the file is not there, it's 0 */
+        if (rv == -2)
+            topo->core = 0;
+        else if (rv < 0)
+            goto cleanup;
+
+        topo->hasCore = true;
+    }
+
+    *core = topo->core;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virHostCPUTopologyLock);
+    return ret;
 }
 
 virBitmapPtr
 virHostCPUGetSiblingsList(unsigned int cpu)
 {
+    virHostCPUTopologyPtr topo;
     virBitmapPtr ret = NULL;
     int rv = -1;
 
-    rv = virFileReadValueBitmap(&ret,
-                                "%s/cpu/cpu%u/topology/thread_siblings_list",
-                                SYSFS_SYSTEM_PATH, cpu);
-    if (rv == -2) {
-        /* If the file doesn't exist, the threadis its only sibling */
-        ret = virBitmapNew(cpu + 1);
-        if (ret)
-            ignore_value(virBitmapSetBit(ret, cpu));
+    virMutexLock(&virHostCPUTopologyLock);
+
+    if (!(topo = virHostCPUTopologyGetLocked(cpu)))
+        goto cleanup;
+
+    if (!topo->siblings) {
+        rv = virFileReadValueBitmap(&topo->siblings,
+                                    "%s/cpu/cpu%u/topology/thread_siblings_list",
+                                    SYSFS_SYSTEM_PATH, cpu);
+        if (rv == -2) {
+            /* If the file doesn't exist, the threadis its only sibling */
+            topo->siblings = virBitmapNew(cpu + 1);
+            if (topo->siblings)
+                ignore_value(virBitmapSetBit(topo->siblings, cpu));
+        }
+
+        if (!topo->siblings)
+            goto cleanup;
     }
 
+    ret = virBitmapNewCopy(topo->siblings);
+
+ cleanup:
+    virMutexUnlock(&virHostCPUTopologyLock);
     return ret;
 }
 
@@ -623,6 +785,10 @@ virHostCPUGetInfoPopulateLinux(FILE *cpuinfo,
     if (!online_cpus_map)
         goto cleanup;
 
+    virMutexLock(&virHostCPUTopologyLock);
+    virHostCPUTopologyValidateLocked(present_cpus_map, online_cpus_map);
+    virMutexUnlock(&virHostCPUTopologyLock);
+
     /* OK, we've parsed clock speed out of /proc/cpuinfo. Get the
      * core, node, socket, thread and topology information from /sys
      */
@@ -1071,6 +1237,50 @@ virHostCPUGetOnlineBitmap(void)
 }
 
 
+/**
+ * virHostCPUTopologyRefresh:
+ *
+ * Host CPU topology is cached after it is read from sysfs for the first
+ * time.  Callers about to query the topology of many CPUs should call this
+ * first, so that the cache is dropped if CPUs were hotplugged or brought
+ * online or offline in the meantime.
+ */
+void
+virHostCPUTopologyRefresh(void)
+{
+#ifdef __linux__
+    virBitmapPtr present = virHostCPUGetPresentBitmap();
+    virBitmapPtr online = virHostCPUGetOnlineBitmap();
+
+    virResetLastError();
+
+    virMutexLock(&virHostCPUTopologyLock);
+    virHostCPUTopologyValidateLocked(present, online);
+    virMutexUnlock(&virHostCPUTopologyLock);
+
+    virBitmapFree(present);
+    virBitmapFree(online);
+#endif
+}
+
+
+/**
+ * virHostCPUTopologyInvalidate:
+ *
+ * Drops the cached host CPU topology, e.g. when a CPU hotplug event is
+ * received or in tests replacing the sysfs data.
+ */
+void
+virHostCPUTopologyInvalidate(void)
+{
+#ifdef __linux__
+    virMutexLock(&virHostCPUTopologyLock);
+    virHostCPUTopologyClearLocked();
+    virMutexUnlock(&virHostCPUTopologyLock);
+#endif
+}
+
+
 int
 virHostCPUGetMap(unsigned char **cpumap,
                  unsigned int *online,
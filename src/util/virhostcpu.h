@@ -66,4 +66,7 @@ virBitmapPtr virHostCPUGetSiblingsList(unsigned int cpu);
 
 int virHostCPUGetOnline(unsigned int cpu, bool *online);
 
+void virHostCPUTopologyRefresh(void);
+void virHostCPUTopologyInvalidate(void);
+
 #endif /* __VIR_HOSTCPU_H__*/
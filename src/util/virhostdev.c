@@ -653,6 +653,108 @@ virHostdevRestoreNetConfig(virDomainHostdevDefPtr hostdev,
     return ret;
 }
 
+struct virHostdevPreDetachPCIData {
+    virPCIDevicePtr pci;
+    virThread thread;
+    bool done;
+};
+
+
+static void
+virHostdevPreDetachPCIDeviceThread(void *opaque)
+{
+    struct virHostdevPreDetachPCIData *data = opaque;
+
+    VIR_DEBUG("Pre-detaching managed PCI device %s",
+              virPCIDeviceGetName(data->pci));
+
+    /* Failures are not fatal here: the device will be detached again
+     * with the bookkeeping lists locked, which reports the error */
+    if (virPCIDeviceDetach(data->pci, NULL, NULL) == 0)
+        data->done = true;
+}
+
+
+/*
+ * Binding devices to the stub driver is by far the slowest part of
+ * preparing them, and doing it with the bookkeeping lists locked
+ * serializes the startup of all domains with assigned devices. Bind
+ * those managed devices that are not in use and that support the
+ * driver_override interface (which, other than new_id, doesn't affect
+ * other devices) to the stub driver in parallel and without holding
+ * the locks. virHostdevPreparePCIDevices() then finds the devices
+ * already bound and runs all the checks again with the lists locked.
+ *
+ * @predetached is filled in with the devices that were bound here, so
+ * that they can be returned to the host if preparing them fails.
+ */
+static void
+virHostdevPreDetachPCIDevices(virHostdevManagerPtr mgr,
+                              virPCIDeviceListPtr pcidevs,
+                              bool *predetached)
+{
+    struct virHostdevPreDetachPCIData *data = NULL;
+    size_t ndata = 0;
+    size_t count = virPCIDeviceListCount(pcidevs);
+    size_t i;
+
+    if (VIR_ALLOC_N(data, count) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    virObjectLock(mgr->activePCIHostdevs);
+    virObjectLock(mgr->inactivePCIHostdevs);
+
+    for (i = 0; i < count; i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
+
+        if (!virPCIDeviceGetManaged(pci) ||
+            virPCIDeviceListFind(mgr->activePCIHostdevs, pci) ||
+            virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci) ||
+            !virPCIDeviceHasDriverOverride(pci))
+            continue;
+
+        data[i].pci = pci;
+        ndata++;
+    }
+
+    virObjectUnlock(mgr->activePCIHostdevs);
+    virObjectUnlock(mgr->inactivePCIHostdevs);
+
+    /* A single device isn't worth a thread */
+    if (ndata == 1) {
+        for (i = 0; i < count; i++) {
+            if (data[i].pci)
+                virHostdevPreDetachPCIDeviceThread(&data[i]);
+        }
+    } else if (ndata > 1) {
+        for (i = 0; i < count; i++) {
+            if (data[i].pci &&
+                virThreadCreate(&data[i].thread, true,
+                                virHostdevPreDetachPCIDeviceThread,
+                                &data[i]) < 0) {
+                VIR_DEBUG("Failed to create thread to pre-detach "
+                          "PCI device %s", virPCIDeviceGetName(data[i].pci));
+                data[i].pci = NULL;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            if (data[i].pci)
+                virThreadJoin(&data[i].thread);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        predetached[i] = data[i].done;
+
+    /* Errors were either ignored or will be reported again */
+    virResetLastError();
+    VIR_FREE(data);
+}
+
+
 int
 virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
                             const char *drv_name,
@@ -667,16 +769,24 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
     size_t i;
     int ret = -1;
     virPCIDeviceAddressPtr devAddr = NULL;
+    bool *predetached = NULL;
 
     if (!nhostdevs)
         return 0;
 
+    if (!(pcidevs = virHostdevGetPCIHostDeviceList(hostdevs, nhostdevs)))
+        return -1;
+
+    if (VIR_ALLOC_N(predetached, virPCIDeviceListCount(pcidevs)) < 0) {
+        virObjectUnref(pcidevs);
+        return -1;
+    }
+
+    virHostdevPreDetachPCIDevices(mgr, pcidevs, predetached);
+
     virObjectLock(mgr->activePCIHostdevs);
     virObjectLock(mgr->inactivePCIHostdevs);
 
-    if (!(pcidevs = virHostdevGetPCIHostDeviceList(hostdevs, nhostdevs)))
-        goto cleanup;
-
     /* Detaching devices from the host involves several steps; each
      * of them is described at length below.
      *
@@ -694,20 +804,20 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
         int hdrType = -1;
 
         if (virPCIGetHeaderType(pci, &hdrType) < 0)
-            goto cleanup;
+            goto undopredetach;
 
         if (hdrType != VIR_PCI_HEADER_ENDPOINT) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Non-endpoint PCI devices cannot be assigned "
                              "to guests"));
-            goto cleanup;
+            goto undopredetach;
         }
 
         if (!usesVFIO && !virPCIDeviceIsAssignable(pci, strict_acs_check)) {
             virReportError(VIR_ERR_OPERATION_INVALID,
                            _("PCI device %s is not assignable"),
                            virPCIDeviceGetName(pci));
-            goto cleanup;
+            goto undopredetach;
         }
 
         /* The device is in use by other active domain if
@@ -720,9 +830,9 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
             if (virPCIDeviceAddressIOMMUGroupIterate(devAddr,
                                                      virHostdevIsPCINodeDeviceUsed,
                                                      &data) < 0)
-                goto cleanup;
+                goto undopredetach;
         } else if (virHostdevIsPCINodeDeviceUsed(devAddr, &data)) {
-            goto cleanup;
+            goto undopredetach;
         }
     }
 
@@ -731,7 +841,7 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
      */
     for (i = 0; i < nhostdevs; i++) {
         if (virHostdevSaveNetConfig(hostdevs[i], mgr->stateDir) < 0)
-            goto cleanup;
+            goto undopredetach;
     }
 
     /* Step 2: detach managed devices and make sure unmanaged devices
@@ -940,14 +1050,32 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
             ignore_value(virPCIDeviceReattach(actual,
                                               mgr->activePCIHostdevs,
                                               mgr->inactivePCIHostdevs));
+            predetached[i] = false;
         } else {
             VIR_DEBUG("Not reattaching unmanaged PCI device %s",
                       virPCIDeviceGetName(pci));
         }
     }
 
+ undopredetach:
+    /* Return devices bound to the stub by virHostdevPreDetachPCIDevices()
+     * to the host unless they made it into one of the lists meanwhile */
+    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
+
+        if (!predetached[i] ||
+            virPCIDeviceListFind(mgr->activePCIHostdevs, pci) ||
+            virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci))
+            continue;
+
+        VIR_DEBUG("Reattaching pre-detached PCI device %s",
+                  virPCIDeviceGetName(pci));
+        ignore_value(virPCIDeviceReattach(pci, NULL, NULL));
+    }
+
  cleanup:
     virObjectUnref(pcidevs);
+    VIR_FREE(predetached);
     virObjectUnlock(mgr->activePCIHostdevs);
     virObjectUnlock(mgr->inactivePCIHostdevs);
 
@@ -24,6 +24,8 @@
 #include <config.h>
 
 #include "virjson.h"
+#include "c-ctype.h"
+#include "virbuffer.h"
 #include "viralloc.h"
 #include "virerror.h"
 #include "virlog.h"
@@ -1422,6 +1424,1412 @@ virJSONValueCopy(const virJSONValue *in)
 }
 
 
+/*
+ * The pull parser below is a self-contained tokenizer which does not
+ * depend on yajl. It is meant for callers which only need a few fields
+ * from a (possibly large) document: values are handed out one token at a
+ * time and string data is decoded into a single scratch buffer which is
+ * reused for every token, so nothing is allocated per value unless the
+ * caller explicitly asks for a subtree via virJSONReaderReadValue.
+ */
+typedef enum {
+    VIR_JSON_READER_STATE_VALUE,        /* expecting a value */
+    VIR_JSON_READER_STATE_OBJECT_FIRST, /* expecting a key or '}' */
+    VIR_JSON_READER_STATE_KEY,          /* expecting a key */
+    VIR_JSON_READER_STATE_ARRAY_FIRST,  /* expecting a value or ']' */
+    VIR_JSON_READER_STATE_AFTER,        /* expecting ',' or a closing bracket */
+    VIR_JSON_READER_STATE_DONE,         /* top level value was read */
+    VIR_JSON_READER_STATE_ERROR,
+} virJSONReaderState;
+
+struct _virJSONReader {
+    const char *data;
+    const char *pos;
+
+    virJSONReaderState state;
+    virJSONToken token;
+    bool boolean;
+
+    char *text;
+    size_t ntext;
+    size_t text_max;
+
+    char *stack;
+    size_t nstack;
+    size_t stack_max;
+};
+
+
+/**
+ * virJSONReaderNew:
+ * @data: NUL terminated JSON document
+ *
+ * Creates a pull parser for @data. The string is not copied and must
+ * outlive the reader.
+ *
+ * Returns the reader or NULL on OOM.
+ */
+virJSONReaderPtr
+virJSONReaderNew(const char *data)
+{
+    virJSONReaderPtr reader;
+
+    if (VIR_ALLOC(reader) < 0)
+        return NULL;
+
+    reader->data = data;
+    reader->pos = data;
+    reader->state = VIR_JSON_READER_STATE_VALUE;
+    reader->token = VIR_JSON_TOKEN_NONE;
+
+    return reader;
+}
+
+
+void
+virJSONReaderFree(virJSONReaderPtr reader)
+{
+    if (!reader)
+        return;
+
+    VIR_FREE(reader->text);
+    VIR_FREE(reader->stack);
+    VIR_FREE(reader);
+}
+
+
+static int
+virJSONReaderError(virJSONReaderPtr reader,
+                   const char *reason)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("cannot parse json %s: %s at offset %zu"),
+                   reader->data, reason,
+                   (size_t) (reader->pos - reader->data));
+    reader->state = VIR_JSON_READER_STATE_ERROR;
+    return -1;
+}
+
+
+static int
+virJSONReaderTextAppend(virJSONReaderPtr reader,
+                        const char *buf,
+                        size_t len)
+{
+    if (VIR_RESIZE_N(reader->text, reader->text_max, reader->ntext, len + 1) < 0) {
+        reader->state = VIR_JSON_READER_STATE_ERROR;
+        return -1;
+    }
+
+    memcpy(reader->text + reader->ntext, buf, len);
+    reader->ntext += len;
+    reader->text[reader->ntext] = '\0';
+    return 0;
+}
+
+
+static int
+virJSONReaderTextAppendCodepoint(virJSONReaderPtr reader,
+                                 unsigned int cp)
+{
+    char buf[4];
+    size_t len;
+
+    if (cp < 0x80) {
+        buf[0] = cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        buf[0] = 0xC0 | (cp >> 6);
+        buf[1] = 0x80 | (cp & 0x3F);
+        len = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = 0xE0 | (cp >> 12);
+        buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+        buf[2] = 0x80 | (cp & 0x3F);
+        len = 3;
+    } else {
+        buf[0] = 0xF0 | (cp >> 18);
+        buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+        buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+        buf[3] = 0x80 | (cp & 0x3F);
+        len = 4;
+    }
+
+    return virJSONReaderTextAppend(reader, buf, len);
+}
+
+
+static int
+virJSONReaderParseHex4(const char *str,
+                       unsigned int *cp)
+{
+    size_t i;
+
+    *cp = 0;
+    for (i = 0; i < 4; i++) {
+        int digit = virHexToBin(str[i]);
+        if (digit < 0)
+            return -1;
+        *cp = (*cp << 4) | digit;
+    }
+
+    return 0;
+}
+
+
+/* Returns length of the valid UTF-8 sequence starting at @str, 0 if
+ * the sequence is invalid. */
+static size_t
+virJSONUTF8Length(const unsigned char *str)
+{
+    size_t len;
+    size_t i;
+
+    if (str[0] < 0x80)
+        return 1;
+    else if (str[0] >= 0xC2 && str[0] <= 0xDF)
+        len = 2;
+    else if (str[0] >= 0xE0 && str[0] <= 0xEF)
+        len = 3;
+    else if (str[0] >= 0xF0 && str[0] <= 0xF4)
+        len = 4;
+    else
+        return 0;
+
+    for (i = 1; i < len; i++) {
+        if ((str[i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    return len;
+}
+
+
+/* Decodes the string starting at the opening quote into reader->text */
+static int
+virJSONReaderParseString(virJSONReaderPtr reader)
+{
+    const char *run;
+    unsigned int cp;
+    unsigned int low;
+
+    reader->ntext = 0;
+    if (virJSONReaderTextAppend(reader, "", 0) < 0)
+        return -1;
+
+    run = ++reader->pos;
+    while (true) {
+        unsigned char c = *reader->pos;
+
+        if (c == '"' || c == '\\' || c < 0x20) {
+            if (virJSONReaderTextAppend(reader, run, reader->pos - run) < 0)
+                return -1;
+        }
+
+        if (c == '"') {
+            reader->pos++;
+            return 0;
+        }
+
+        if (c == '\0')
+            return virJSONReaderError(reader, _("unterminated string"));
+
+        if (c < 0x20)
+            return virJSONReaderError(reader, _("invalid character in string"));
+
+        if (c != '\\') {
+            size_t len = virJSONUTF8Length((const unsigned char *) reader->pos);
+            if (len == 0)
+                return virJSONReaderError(reader, _("invalid UTF-8 in string"));
+            reader->pos += len;
+            continue;
+        }
+
+        reader->pos++;
+        switch (*reader->pos) {
+        case '"':
+        case '\\':
+        case '/':
+            cp = *reader->pos;
+            break;
+        case 'b':
+            cp = '\b';
+            break;
+        case 'f':
+            cp = '\f';
+            break;
+        case 'n':
+            cp = '\n';
+            break;
+        case 'r':
+            cp = '\r';
+            break;
+        case 't':
+            cp = '\t';
+            break;
+        case 'u':
+            if (virJSONReaderParseHex4(reader->pos + 1, &cp) < 0)
+                return virJSONReaderError(reader, _("invalid unicode escape"));
+            reader->pos += 4;
+
+            if (cp >= 0xDC00 && cp <= 0xDFFF)
+                return virJSONReaderError(reader, _("invalid unicode escape"));
+
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                if (reader->pos[1] != '\\' || reader->pos[2] != 'u' ||
+                    virJSONReaderParseHex4(reader->pos + 3, &low) < 0 ||
+                    low < 0xDC00 || low > 0xDFFF)
+                    return virJSONReaderError(reader, _("invalid unicode escape"));
+                reader->pos += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            break;
+        default:
+            return virJSONReaderError(reader, _("invalid escape sequence"));
+        }
+
+        if (virJSONReaderTextAppendCodepoint(reader, cp) < 0)
+            return -1;
+
+        run = ++reader->pos;
+    }
+}
+
+
+static int
+virJSONReaderParseNumber(virJSONReaderPtr reader)
+{
+    const char *start = reader->pos;
+    const char *p = start;
+
+    if (*p == '-')
+        p++;
+
+    if (*p == '0') {
+        p++;
+    } else if (c_isdigit(*p)) {
+        while (c_isdigit(*p))
+            p++;
+    } else {
+        reader->pos = p;
+        return virJSONReaderError(reader, _("invalid number"));
+    }
+
+    if (*p == '.') {
+        p++;
+        if (!c_isdigit(*p)) {
+            reader->pos = p;
+            return virJSONReaderError(reader, _("invalid number"));
+        }
+        while (c_isdigit(*p))
+            p++;
+    }
+
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-')
+            p++;
+        if (!c_isdigit(*p)) {
+            reader->pos = p;
+            return virJSONReaderError(reader, _("invalid number"));
+        }
+        while (c_isdigit(*p))
+            p++;
+    }
+
+    reader->pos = p;
+    reader->ntext = 0;
+    return virJSONReaderTextAppend(reader, start, p - start);
+}
+
+
+static int
+virJSONReaderParseKeyword(virJSONReaderPtr reader,
+                          const char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    if (STRNEQLEN(reader->pos, keyword, len) ||
+        c_isalnum(reader->pos[len]))
+        return virJSONReaderError(reader, _("invalid keyword"));
+
+    reader->pos += len;
+    return 0;
+}
+
+
+static int
+virJSONReaderPush(virJSONReaderPtr reader,
+                  char bracket)
+{
+    if (VIR_RESIZE_N(reader->stack, reader->stack_max, reader->nstack, 1) < 0) {
+        reader->state = VIR_JSON_READER_STATE_ERROR;
+        return -1;
+    }
+
+    reader->stack[reader->nstack++] = bracket;
+    reader->pos++;
+    return 0;
+}
+
+
+static void
+virJSONReaderPop(virJSONReaderPtr reader)
+{
+    reader->nstack--;
+    reader->pos++;
+    if (reader->nstack == 0)
+        reader->state = VIR_JSON_READER_STATE_DONE;
+    else
+        reader->state = VIR_JSON_READER_STATE_AFTER;
+}
+
+
+static int
+virJSONReaderParseValue(virJSONReaderPtr reader)
+{
+    int rc = 0;
+
+    switch (*reader->pos) {
+    case '{':
+        reader->token = VIR_JSON_TOKEN_OBJECT_START;
+        if (virJSONReaderPush(reader, '{') < 0)
+            return -1;
+        reader->state = VIR_JSON_READER_STATE_OBJECT_FIRST;
+        return 0;
+
+    case '[':
+        reader->token = VIR_JSON_TOKEN_ARRAY_START;
+        if (virJSONReaderPush(reader, '[') < 0)
+            return -1;
+        reader->state = VIR_JSON_READER_STATE_ARRAY_FIRST;
+        return 0;
+
+    case '"':
+        reader->token = VIR_JSON_TOKEN_STRING;
+        rc = virJSONReaderParseString(reader);
+        break;
+
+    case 't':
+        reader->token = VIR_JSON_TOKEN_BOOLEAN;
+        reader->boolean = true;
+        rc = virJSONReaderParseKeyword(reader, "true");
+        break;
+
+    case 'f':
+        reader->token = VIR_JSON_TOKEN_BOOLEAN;
+        reader->boolean = false;
+        rc = virJSONReaderParseKeyword(reader, "false");
+        break;
+
+    case 'n':
+        reader->token = VIR_JSON_TOKEN_NULL;
+        rc = virJSONReaderParseKeyword(reader, "null");
+        break;
+
+    case '\0':
+        return virJSONReaderError(reader, _("unexpected end of data"));
+
+    default:
+        if (*reader->pos != '-' && !c_isdigit(*reader->pos))
+            return virJSONReaderError(reader, _("unexpected character"));
+        reader->token = VIR_JSON_TOKEN_NUMBER;
+        rc = virJSONReaderParseNumber(reader);
+        break;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    if (reader->nstack == 0)
+        reader->state = VIR_JSON_READER_STATE_DONE;
+    else
+        reader->state = VIR_JSON_READER_STATE_AFTER;
+
+    return 0;
+}
+
+
+/**
+ * virJSONReaderNext:
+ * @reader: the reader
+ * @token: filled with the type of the next token
+ *
+ * Advances @reader to the next token of the document. For
+ * VIR_JSON_TOKEN_KEY, VIR_JSON_TOKEN_STRING and VIR_JSON_TOKEN_NUMBER
+ * the decoded text is available via virJSONReaderGetText until the next
+ * call.
+ *
+ * Returns 1 if a token was read, 0 once the whole document was consumed
+ * (@token is set to VIR_JSON_TOKEN_NONE) and -1 on error.
+ */
+int
+virJSONReaderNext(virJSONReaderPtr reader,
+                  virJSONToken *token)
+{
+    *token = VIR_JSON_TOKEN_NONE;
+
+    while (true) {
+        while (c_isspace(*reader->pos))
+            reader->pos++;
+
+        switch (reader->state) {
+        case VIR_JSON_READER_STATE_ERROR:
+            return -1;
+
+        case VIR_JSON_READER_STATE_DONE:
+            if (*reader->pos != '\0')
+                return virJSONReaderError(reader, _("trailing garbage"));
+            reader->token = VIR_JSON_TOKEN_NONE;
+            return 0;
+
+        case VIR_JSON_READER_STATE_OBJECT_FIRST:
+            if (*reader->pos == '}') {
+                reader->token = VIR_JSON_TOKEN_OBJECT_END;
+                virJSONReaderPop(reader);
+                goto done;
+            }
+            ATTRIBUTE_FALLTHROUGH;
+
+        case VIR_JSON_READER_STATE_KEY:
+            if (*reader->pos != '"')
+                return virJSONReaderError(reader, _("expected object key"));
+            if (virJSONReaderParseString(reader) < 0)
+                return -1;
+
+            while (c_isspace(*reader->pos))
+                reader->pos++;
+            if (*reader->pos != ':')
+                return virJSONReaderError(reader, _("expected ':'"));
+            reader->pos++;
+
+            reader->token = VIR_JSON_TOKEN_KEY;
+            reader->state = VIR_JSON_READER_STATE_VALUE;
+            goto done;
+
+        case VIR_JSON_READER_STATE_ARRAY_FIRST:
+            if (*reader->pos == ']') {
+                reader->token = VIR_JSON_TOKEN_ARRAY_END;
+                virJSONReaderPop(reader);
+                goto done;
+            }
+            ATTRIBUTE_FALLTHROUGH;
+
+        case VIR_JSON_READER_STATE_VALUE:
+            if (virJSONReaderParseValue(reader) < 0)
+                return -1;
+            goto done;
+
+        case VIR_JSON_READER_STATE_AFTER:
+            if (*reader->pos == ',') {
+                reader->pos++;
+                if (reader->stack[reader->nstack - 1] == '{')
+                    reader->state = VIR_JSON_READER_STATE_KEY;
+                else
+                    reader->state = VIR_JSON_READER_STATE_VALUE;
+                continue;
+            }
+
+            if (*reader->pos == '}' &&
+                reader->stack[reader->nstack - 1] == '{') {
+                reader->token = VIR_JSON_TOKEN_OBJECT_END;
+                virJSONReaderPop(reader);
+                goto done;
+            }
+
+            if (*reader->pos == ']' &&
+                reader->stack[reader->nstack - 1] == '[') {
+                reader->token = VIR_JSON_TOKEN_ARRAY_END;
+                virJSONReaderPop(reader);
+                goto done;
+            }
+
+            if (*reader->pos == '\0')
+                return virJSONReaderError(reader,
+                                          _("unterminated string/map/array"));
+
+            return virJSONReaderError(reader, _("unexpected character"));
+        }
+    }
+
+ done:
+    *token = reader->token;
+    return 1;
+}
+
+
+/**
+ * virJSONReaderGetText:
+ * @reader: the reader
+ *
+ * Returns the decoded text of the current key, string or number token
+ * or NULL for other tokens. The string is owned by @reader and is
+ * invalidated by the next virJSONReaderNext call.
+ */
+const char *
+virJSONReaderGetText(virJSONReaderPtr reader)
+{
+    switch (reader->token) {
+    case VIR_JSON_TOKEN_KEY:
+    case VIR_JSON_TOKEN_STRING:
+    case VIR_JSON_TOKEN_NUMBER:
+        return reader->text;
+
+    case VIR_JSON_TOKEN_NONE:
+    case VIR_JSON_TOKEN_OBJECT_START:
+    case VIR_JSON_TOKEN_OBJECT_END:
+    case VIR_JSON_TOKEN_ARRAY_START:
+    case VIR_JSON_TOKEN_ARRAY_END:
+    case VIR_JSON_TOKEN_BOOLEAN:
+    case VIR_JSON_TOKEN_NULL:
+        break;
+    }
+
+    return NULL;
+}
+
+
+int
+virJSONReaderGetNumberLong(virJSONReaderPtr reader,
+                           long long *value)
+{
+    if (reader->token != VIR_JSON_TOKEN_NUMBER)
+        return -1;
+
+    return virStrToLong_ll(reader->text, NULL, 10, value);
+}
+
+
+int
+virJSONReaderGetNumberUlong(virJSONReaderPtr reader,
+                            unsigned long long *value)
+{
+    if (reader->token != VIR_JSON_TOKEN_NUMBER)
+        return -1;
+
+    return virStrToLong_ull(reader->text, NULL, 10, value);
+}
+
+
+int
+virJSONReaderGetBoolean(virJSONReaderPtr reader,
+                        bool *value)
+{
+    if (reader->token != VIR_JSON_TOKEN_BOOLEAN)
+        return -1;
+
+    *value = reader->boolean;
+    return 0;
+}
+
+
+/**
+ * virJSONReaderNextKey:
+ * @reader: the reader
+ * @key: filled with the key name
+ *
+ * Convenience wrapper for iterating over members of an object whose
+ * VIR_JSON_TOKEN_OBJECT_START token was already consumed. The caller must
+ * consume the member value (virJSONReaderNext, virJSONReaderSkip or
+ * virJSONReaderReadValue) before asking for the next key. @key is valid
+ * until the next call on @reader.
+ *
+ * Returns 1 if a key was read, 0 at the end of the object and -1 on
+ * error.
+ */
+int
+virJSONReaderNextKey(virJSONReaderPtr reader,
+                     const char **key)
+{
+    virJSONToken token;
+
+    *key = NULL;
+
+    if (virJSONReaderNext(reader, &token) < 0)
+        return -1;
+
+    if (token == VIR_JSON_TOKEN_OBJECT_END)
+        return 0;
+
+    if (token != VIR_JSON_TOKEN_KEY)
+        return virJSONReaderError(reader, _("expected object key"));
+
+    *key = reader->text;
+    return 1;
+}
+
+
+/**
+ * virJSONReaderSkip:
+ * @reader: the reader
+ *
+ * Skips the value of the current token: for VIR_JSON_TOKEN_OBJECT_START
+ * and VIR_JSON_TOKEN_ARRAY_START everything up to and including the
+ * matching end token is consumed, for VIR_JSON_TOKEN_KEY the member value
+ * is skipped. Scalar tokens need no skipping.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virJSONReaderSkip(virJSONReaderPtr reader)
+{
+    virJSONToken token;
+    size_t depth = reader->nstack;
+
+    switch (reader->token) {
+    case VIR_JSON_TOKEN_KEY:
+        if (virJSONReaderNext(reader, &token) < 0)
+            return -1;
+        return virJSONReaderSkip(reader);
+
+    case VIR_JSON_TOKEN_OBJECT_START:
+    case VIR_JSON_TOKEN_ARRAY_START:
+        break;
+
+    case VIR_JSON_TOKEN_NONE:
+    case VIR_JSON_TOKEN_OBJECT_END:
+    case VIR_JSON_TOKEN_ARRAY_END:
+    case VIR_JSON_TOKEN_STRING:
+    case VIR_JSON_TOKEN_NUMBER:
+    case VIR_JSON_TOKEN_BOOLEAN:
+    case VIR_JSON_TOKEN_NULL:
+        return 0;
+    }
+
+    while (reader->nstack >= depth) {
+        if (virJSONReaderNext(reader, &token) <= 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virJSONReaderReadValue:
+ * @reader: the reader
+ *
+ * Builds a virJSONValue tree from the value whose first token was
+ * returned by the last virJSONReaderNext call, consuming the rest of it.
+ * This allows mixing streamed access with tree access for the parts of a
+ * document the caller wants to keep.
+ *
+ * Returns the new value or NULL on error.
+ */
+virJSONValuePtr
+virJSONReaderReadValue(virJSONReaderPtr reader)
+{
+    virJSONValuePtr ret = NULL;
+    virJSONValuePtr val = NULL;
+    virJSONToken token;
+    const char *name;
+    char *key = NULL;
+    int rc;
+
+    switch (reader->token) {
+    case VIR_JSON_TOKEN_STRING:
+        return virJSONValueNewString(reader->text);
+
+    case VIR_JSON_TOKEN_NUMBER:
+        return virJSONValueNewNumber(reader->text);
+
+    case VIR_JSON_TOKEN_BOOLEAN:
+        return virJSONValueNewBoolean(reader->boolean);
+
+    case VIR_JSON_TOKEN_NULL:
+        return virJSONValueNewNull();
+
+    case VIR_JSON_TOKEN_OBJECT_START:
+        if (!(ret = virJSONValueNewObject()))
+            return NULL;
+
+        while ((rc = virJSONReaderNextKey(reader, &name)) > 0) {
+            if (VIR_STRDUP(key, name) < 0)
+                goto error;
+
+            if (virJSONReaderNext(reader, &token) < 0 ||
+                !(val = virJSONReaderReadValue(reader)))
+                goto error;
+
+            if (virJSONValueObjectAppend(ret, key, val) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("cannot parse json %s: duplicate key '%s'"),
+                               reader->data, key);
+                goto error;
+            }
+            val = NULL;
+            VIR_FREE(key);
+        }
+        if (rc < 0)
+            goto error;
+        return ret;
+
+    case VIR_JSON_TOKEN_ARRAY_START:
+        if (!(ret = virJSONValueNewArray()))
+            return NULL;
+
+        while ((rc = virJSONReaderNext(reader, &token)) > 0 &&
+               token != VIR_JSON_TOKEN_ARRAY_END) {
+            if (!(val = virJSONReaderReadValue(reader)))
+                goto error;
+
+            if (virJSONValueArrayAppend(ret, val) < 0)
+                goto error;
+            val = NULL;
+        }
+        if (rc <= 0)
+            goto error;
+        return ret;
+
+    case VIR_JSON_TOKEN_NONE:
+    case VIR_JSON_TOKEN_OBJECT_END:
+    case VIR_JSON_TOKEN_ARRAY_END:
+    case VIR_JSON_TOKEN_KEY:
+        break;
+    }
+
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("JSON reader is not positioned at a value"));
+    return NULL;
+
+ error:
+    VIR_FREE(key);
+    virJSONValueFree(val);
+    virJSONValueFree(ret);
+    return NULL;
+}
+
+
+/*
+ * virJSONWriter formats JSON straight into a virBuffer, for callers that
+ * would otherwise build a virJSONValue tree only to serialize and free
+ * it right away. The output is identical to the compact format of
+ * virJSONValueToString. Misuse (unbalanced containers, values without
+ * keys inside objects, ...) is remembered and reported by
+ * virJSONWriterFinish, just like virBuffer errors are.
+ */
+void
+virJSONWriterInit(virJSONWriterPtr writer,
+                  virBufferPtr buf)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->buf = buf;
+}
+
+
+static int
+virJSONWriterError(virJSONWriterPtr writer,
+                   const char *reason)
+{
+    if (!writer->error) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot format json: %s"), reason);
+    }
+    writer->error = true;
+    return -1;
+}
+
+
+static int
+virJSONWriterEscapeString(virJSONWriterPtr writer,
+                          const char *str)
+{
+    const char *run = str;
+    const char *p = str;
+
+    virBufferAddChar(writer->buf, '"');
+
+    while (*p) {
+        unsigned char c = *p;
+        const char *esc = NULL;
+
+        switch (c) {
+        case '"':
+            esc = "\\\"";
+            break;
+        case '\\':
+            esc = "\\\\";
+            break;
+        case '\b':
+            esc = "\\b";
+            break;
+        case '\f':
+            esc = "\\f";
+            break;
+        case '\n':
+            esc = "\\n";
+            break;
+        case '\r':
+            esc = "\\r";
+            break;
+        case '\t':
+            esc = "\\t";
+            break;
+        }
+
+        /* Like yajl, copy anything else verbatim without checking it
+         * is valid UTF-8 */
+        if (!esc && c >= 0x20) {
+            p++;
+            continue;
+        }
+
+        virBufferAdd(writer->buf, run, p - run);
+        if (esc)
+            virBufferAdd(writer->buf, esc, -1);
+        else
+            virBufferAsprintf(writer->buf, "\\u%04X", c);
+        run = ++p;
+    }
+
+    virBufferAdd(writer->buf, run, p - run);
+    virBufferAddChar(writer->buf, '"');
+    return 0;
+}
+
+
+/* Writes the separator needed before a new value, if any */
+static int
+virJSONWriterBeginValue(virJSONWriterPtr writer)
+{
+    unsigned long long bit;
+
+    if (writer->error)
+        return -1;
+
+    if (writer->depth == 0) {
+        if (writer->toplevel)
+            return virJSONWriterError(writer, _("multiple top level values"));
+        writer->toplevel = true;
+        return 0;
+    }
+
+    bit = 1ULL << (writer->depth - 1);
+
+    if (writer->objects & bit) {
+        if (!writer->key)
+            return virJSONWriterError(writer, _("object member without key"));
+        writer->key = false;
+        return 0;
+    }
+
+    if (writer->members & bit)
+        virBufferAddChar(writer->buf, ',');
+    writer->members |= bit;
+    return 0;
+}
+
+
+static int
+virJSONWriterStart(virJSONWriterPtr writer,
+                   bool object)
+{
+    unsigned long long bit;
+
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    if (writer->depth == VIR_JSON_WRITER_MAX_DEPTH)
+        return virJSONWriterError(writer, _("nesting too deep"));
+
+    bit = 1ULL << writer->depth++;
+    writer->members &= ~bit;
+    if (object)
+        writer->objects |= bit;
+    else
+        writer->objects &= ~bit;
+
+    virBufferAddChar(writer->buf, object ? '{' : '[');
+    return 0;
+}
+
+
+static int
+virJSONWriterEnd(virJSONWriterPtr writer,
+                 bool object)
+{
+    if (writer->error)
+        return -1;
+
+    if (writer->depth == 0 ||
+        !!(writer->objects & (1ULL << (writer->depth - 1))) != object ||
+        writer->key)
+        return virJSONWriterError(writer, _("unbalanced object or array"));
+
+    writer->depth--;
+    virBufferAddChar(writer->buf, object ? '}' : ']');
+    return 0;
+}
+
+
+int
+virJSONWriterStartObject(virJSONWriterPtr writer)
+{
+    return virJSONWriterStart(writer, true);
+}
+
+
+int
+virJSONWriterEndObject(virJSONWriterPtr writer)
+{
+    return virJSONWriterEnd(writer, true);
+}
+
+
+int
+virJSONWriterStartArray(virJSONWriterPtr writer)
+{
+    return virJSONWriterStart(writer, false);
+}
+
+
+int
+virJSONWriterEndArray(virJSONWriterPtr writer)
+{
+    return virJSONWriterEnd(writer, false);
+}
+
+
+/**
+ * virJSONWriterKey:
+ * @writer: the writer
+ * @key: member name
+ *
+ * Starts a new member of the innermost object. Exactly one value
+ * (scalar, object or array) has to follow.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virJSONWriterKey(virJSONWriterPtr writer,
+                 const char *key)
+{
+    unsigned long long bit;
+
+    if (writer->error)
+        return -1;
+
+    if (writer->depth == 0 ||
+        !(writer->objects & (bit = 1ULL << (writer->depth - 1))) ||
+        writer->key)
+        return virJSONWriterError(writer, _("key outside of an object"));
+
+    if (writer->members & bit)
+        virBufferAddChar(writer->buf, ',');
+    writer->members |= bit;
+
+    if (virJSONWriterEscapeString(writer, key) < 0)
+        return -1;
+
+    virBufferAddChar(writer->buf, ':');
+    writer->key = true;
+    return 0;
+}
+
+
+static int
+virJSONWriterLiteral(virJSONWriterPtr writer,
+                     const char *str)
+{
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    virBufferAdd(writer->buf, str, -1);
+    return 0;
+}
+
+
+/* Same as virJSONValueNewString, NULL is formatted as null */
+int
+virJSONWriterString(virJSONWriterPtr writer,
+                    const char *str)
+{
+    if (!str)
+        return virJSONWriterNull(writer);
+
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    return virJSONWriterEscapeString(writer, str);
+}
+
+
+int
+virJSONWriterNumberInt(virJSONWriterPtr writer,
+                       int number)
+{
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    virBufferAsprintf(writer->buf, "%i", number);
+    return 0;
+}
+
+
+int
+virJSONWriterNumberUint(virJSONWriterPtr writer,
+                        unsigned int number)
+{
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    virBufferAsprintf(writer->buf, "%u", number);
+    return 0;
+}
+
+
+int
+virJSONWriterNumberLong(virJSONWriterPtr writer,
+                        long long number)
+{
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    virBufferAsprintf(writer->buf, "%lld", number);
+    return 0;
+}
+
+
+int
+virJSONWriterNumberUlong(virJSONWriterPtr writer,
+                         unsigned long long number)
+{
+    if (virJSONWriterBeginValue(writer) < 0)
+        return -1;
+
+    virBufferAsprintf(writer->buf, "%llu", number);
+    return 0;
+}
+
+
+int
+virJSONWriterNumberDouble(virJSONWriterPtr writer,
+                          double number)
+{
+    char *str;
+    int ret;
+
+    if (virDoubleToStr(&str, number) < 0) {
+        writer->error = true;
+        return -1;
+    }
+
+    ret = virJSONWriterLiteral(writer, str);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+int
+virJSONWriterBoolean(virJSONWriterPtr writer,
+                     bool boolean)
+{
+    return virJSONWriterLiteral(writer, boolean ? "true" : "false");
+}
+
+
+int
+virJSONWriterNull(virJSONWriterPtr writer)
+{
+    return virJSONWriterLiteral(writer, "null");
+}
+
+
+/**
+ * virJSONWriterValue:
+ * @writer: the writer
+ * @value: JSON value to format
+ *
+ * Formats @value, which is left untouched, as the next value.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virJSONWriterValue(virJSONWriterPtr writer,
+                   const virJSONValue *value)
+{
+    size_t i;
+
+    switch ((virJSONType) value->type) {
+    case VIR_JSON_TYPE_OBJECT:
+        if (virJSONWriterStartObject(writer) < 0)
+            return -1;
+        for (i = 0; i < value->data.object.npairs; i++) {
+            if (virJSONWriterKey(writer, value->data.object.pairs[i].key) < 0 ||
+                virJSONWriterValue(writer, value->data.object.pairs[i].value) < 0)
+                return -1;
+        }
+        return virJSONWriterEndObject(writer);
+
+    case VIR_JSON_TYPE_ARRAY:
+        if (virJSONWriterStartArray(writer) < 0)
+            return -1;
+        for (i = 0; i < value->data.array.nvalues; i++) {
+            if (virJSONWriterValue(writer, value->data.array.values[i]) < 0)
+                return -1;
+        }
+        return virJSONWriterEndArray(writer);
+
+    case VIR_JSON_TYPE_STRING:
+        return virJSONWriterString(writer, value->data.string);
+
+    case VIR_JSON_TYPE_NUMBER:
+        return virJSONWriterLiteral(writer, value->data.number);
+
+    case VIR_JSON_TYPE_BOOLEAN:
+        return virJSONWriterBoolean(writer, value->data.boolean);
+
+    case VIR_JSON_TYPE_NULL:
+        return virJSONWriterNull(writer);
+    }
+
+    return virJSONWriterError(writer, _("unknown value type"));
+}
+
+
+/**
+ * virJSONWriterObjectAddVArgs:
+ * @writer: the writer
+ * @args: a key-value argument pairs, terminated by NULL
+ *
+ * Writes the key-value pairs as members of the innermost object. The
+ * arguments use the same type codes as virJSONValueObjectAddVArgs, the
+ * only difference being that values passed via 'a' and 'A' are formatted
+ * in place and stay owned by the caller.
+ *
+ * Returns -1 on error, 1 if at least one member was written and 0 if
+ * nothing was written.
+ */
+int
+virJSONWriterObjectAddVArgs(virJSONWriterPtr writer,
+                            va_list args)
+{
+    char type;
+    char *key;
+    bool added = false;
+    int rc;
+
+    while ((key = va_arg(args, char *)) != NULL) {
+
+        if (strlen(key) < 3) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("argument key '%s' is too short, missing type prefix"),
+                           key);
+            writer->error = true;
+            return -1;
+        }
+
+        type = key[0];
+        key += 2;
+
+        switch (type) {
+        case 'S':
+        case 's': {
+            char *val = va_arg(args, char *);
+            if (!val) {
+                if (type == 'S')
+                    continue;
+
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("argument key '%s' must not have null value"),
+                               key);
+                writer->error = true;
+                return -1;
+            }
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterString(writer, val);
+        }   break;
+
+        case 'z':
+        case 'y':
+        case 'j':
+        case 'i': {
+            int val = va_arg(args, int);
+
+            if (val < 0 && (type == 'j' || type == 'y')) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("argument key '%s' must not be negative"),
+                               key);
+                writer->error = true;
+                return -1;
+            }
+
+            if (!val && (type == 'z' || type == 'y'))
+                continue;
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNumberInt(writer, val);
+        }   break;
+
+        case 'p':
+        case 'u': {
+            unsigned int val = va_arg(args, unsigned int);
+
+            if (!val && type == 'p')
+                continue;
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNumberUint(writer, val);
+        }   break;
+
+        case 'Z':
+        case 'Y':
+        case 'J':
+        case 'I': {
+            long long val = va_arg(args, long long);
+
+            if (val < 0 && (type == 'J' || type == 'Y')) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("argument key '%s' must not be negative"),
+                               key);
+                writer->error = true;
+                return -1;
+            }
+
+            if (!val && (type == 'Z' || type == 'Y'))
+                continue;
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNumberLong(writer, val);
+        }   break;
+
+        case 'P':
+        case 'U': {
+            /* See virJSONValueObjectAddVArgs for why this is signed */
+            long long val = va_arg(args, long long);
+
+            if (!val && type == 'P')
+                continue;
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNumberLong(writer, val);
+        }   break;
+
+        case 'd': {
+            double val = va_arg(args, double);
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNumberDouble(writer, val);
+        }   break;
+
+        case 'B':
+        case 'b': {
+            int val = va_arg(args, int);
+
+            if (!val && type == 'B')
+                continue;
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterBoolean(writer, val);
+        }   break;
+
+        case 'n': {
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterNull(writer);
+        }   break;
+
+        case 'A':
+        case 'a': {
+            virJSONValuePtr val = va_arg(args, virJSONValuePtr);
+
+            if (!val) {
+                if (type == 'A')
+                    continue;
+
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("argument key '%s' must not have null value"),
+                               key);
+                writer->error = true;
+                return -1;
+            }
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0)
+                rc = virJSONWriterValue(writer, val);
+        }   break;
+
+        case 'M':
+        case 'm': {
+            virBitmapPtr map = va_arg(args, virBitmapPtr);
+            ssize_t pos = -1;
+
+            if (!map) {
+                if (type == 'M')
+                    continue;
+
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("argument key '%s' must not have null value"),
+                               key);
+                writer->error = true;
+                return -1;
+            }
+
+            if ((rc = virJSONWriterKey(writer, key)) == 0 &&
+                (rc = virJSONWriterStartArray(writer)) == 0) {
+                while (rc == 0 && (pos = virBitmapNextSetBit(map, pos)) > -1)
+                    rc = virJSONWriterNumberLong(writer, pos);
+                if (rc == 0)
+                    rc = virJSONWriterEndArray(writer);
+            }
+        } break;
+
+        default:
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unsupported data type '%c' for arg '%s'"), type, key - 2);
+            writer->error = true;
+            return -1;
+        }
+
+        if (rc < 0)
+            return -1;
+
+        added = true;
+    }
+
+    return added ? 1 : 0;
+}
+
+
+int
+virJSONWriterObjectAdd(virJSONWriterPtr writer, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, writer);
+    ret = virJSONWriterObjectAddVArgs(writer, args);
+    va_end(args);
+
+    return ret;
+}
+
+
+/**
+ * virJSONWriterFinish:
+ * @writer: the writer
+ *
+ * Checks that exactly one complete value was written and that the
+ * underlying buffer has no error. Errors are reported the first time
+ * they are detected.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virJSONWriterFinish(virJSONWriterPtr writer)
+{
+    if (writer->error)
+        return -1;
+
+    if (writer->depth != 0 || !writer->toplevel)
+        return virJSONWriterError(writer, _("unbalanced object or array"));
+
+    if (virBufferCheckError(writer->buf) < 0) {
+        writer->error = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+
 #if WITH_YAJL
 static int
 virJSONParserInsertValue(virJSONParserPtr parser,
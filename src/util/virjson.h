@@ -26,6 +26,7 @@
 
 # include "internal.h"
 # include "virbitmap.h"
+# include "virbuffer.h"
 
 # include <stdarg.h>
 
@@ -188,4 +189,72 @@ char *virJSONStringReformat(const char *jsonstr, bool pretty);
 
 virJSONValuePtr virJSONValueObjectDeflatten(virJSONValuePtr json);
 
+typedef enum {
+    VIR_JSON_TOKEN_NONE = 0, /* end of document */
+    VIR_JSON_TOKEN_OBJECT_START,
+    VIR_JSON_TOKEN_OBJECT_END,
+    VIR_JSON_TOKEN_ARRAY_START,
+    VIR_JSON_TOKEN_ARRAY_END,
+    VIR_JSON_TOKEN_KEY,
+    VIR_JSON_TOKEN_STRING,
+    VIR_JSON_TOKEN_NUMBER,
+    VIR_JSON_TOKEN_BOOLEAN,
+    VIR_JSON_TOKEN_NULL,
+} virJSONToken;
+
+typedef struct _virJSONReader virJSONReader;
+typedef virJSONReader *virJSONReaderPtr;
+
+virJSONReaderPtr virJSONReaderNew(const char *data)
+    ATTRIBUTE_NONNULL(1);
+void virJSONReaderFree(virJSONReaderPtr reader);
+int virJSONReaderNext(virJSONReaderPtr reader, virJSONToken *token)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virJSONReaderNextKey(virJSONReaderPtr reader, const char **key)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+const char *virJSONReaderGetText(virJSONReaderPtr reader);
+int virJSONReaderGetNumberLong(virJSONReaderPtr reader, long long *value);
+int virJSONReaderGetNumberUlong(virJSONReaderPtr reader, unsigned long long *value);
+int virJSONReaderGetBoolean(virJSONReaderPtr reader, bool *value);
+int virJSONReaderSkip(virJSONReaderPtr reader);
+virJSONValuePtr virJSONReaderReadValue(virJSONReaderPtr reader);
+
+# define VIR_JSON_WRITER_MAX_DEPTH 64
+
+typedef struct _virJSONWriter virJSONWriter;
+typedef virJSONWriter *virJSONWriterPtr;
+struct _virJSONWriter {
+    /* Don't access these fields directly, use the accessors. */
+    virBufferPtr buf;
+    unsigned int depth;
+    unsigned long long objects; /* bit N set if container at depth N is an object */
+    unsigned long long members; /* bit N set if container at depth N has members */
+    bool key;                   /* a key is waiting for its value */
+    bool toplevel;              /* the top level value was started */
+    bool error;
+};
+
+void virJSONWriterInit(virJSONWriterPtr writer, virBufferPtr buf)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virJSONWriterStartObject(virJSONWriterPtr writer);
+int virJSONWriterEndObject(virJSONWriterPtr writer);
+int virJSONWriterStartArray(virJSONWriterPtr writer);
+int virJSONWriterEndArray(virJSONWriterPtr writer);
+int virJSONWriterKey(virJSONWriterPtr writer, const char *key)
+    ATTRIBUTE_NONNULL(2);
+int virJSONWriterString(virJSONWriterPtr writer, const char *str);
+int virJSONWriterNumberInt(virJSONWriterPtr writer, int number);
+int virJSONWriterNumberUint(virJSONWriterPtr writer, unsigned int number);
+int virJSONWriterNumberLong(virJSONWriterPtr writer, long long number);
+int virJSONWriterNumberUlong(virJSONWriterPtr writer, unsigned long long number);
+int virJSONWriterNumberDouble(virJSONWriterPtr writer, double number);
+int virJSONWriterBoolean(virJSONWriterPtr writer, bool boolean);
+int virJSONWriterNull(virJSONWriterPtr writer);
+int virJSONWriterValue(virJSONWriterPtr writer, const virJSONValue *value)
+    ATTRIBUTE_NONNULL(2);
+int virJSONWriterObjectAdd(virJSONWriterPtr writer, ...)
+    ATTRIBUTE_SENTINEL;
+int virJSONWriterObjectAddVArgs(virJSONWriterPtr writer, va_list args);
+int virJSONWriterFinish(virJSONWriterPtr writer);
+
 #endif /* __VIR_JSON_H_ */
@@ -25,12 +25,19 @@
 #include "virlease.h"
 
 #include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "virfile.h"
 #include "virstring.h"
 #include "virerror.h"
 #include "viralloc.h"
 #include "virutil.h"
+#include "virsocketaddr.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 
@@ -295,3 +302,523 @@ virLeaseNew(virJSONValuePtr *lease_ret,
     virJSONValueFree(lease_new);
     return ret;
 }
+
+
+/*
+ * The lease index is a snapshot of all the leases of the networks
+ * (and, for each domain, of the leases of its MAC addresses) hashed
+ * by name, so that the NSS modules can map it and resolve a name with
+ * a single lookup rather than parsing every lease file each time. It
+ * is laid out as follows, all integers in host byte order:
+ *
+ *   virLeaseIndexHeader
+ *   virLeaseIndexSource[nsources]   files the index was built from
+ *   uint32_t[nbuckets]              1-based index of the first entry
+ *   virLeaseIndexEntry[nentries]    chained through @next, 1-based
+ *   NUL terminated strings          referred to by offset
+ *
+ * The index is only trusted as long as the files it was built from
+ * are unchanged, readers fall back to parsing them otherwise.
+ */
+
+#define VIR_LEASE_INDEX_MAGIC "LVLIDX01"
+
+typedef struct _virLeaseIndexHeader virLeaseIndexHeader;
+struct _virLeaseIndexHeader {
+    char magic[8];
+    uint32_t size;
+    uint32_t nsources;
+    uint32_t nbuckets;
+    uint32_t nentries;
+};
+
+typedef struct _virLeaseIndexSource virLeaseIndexSource;
+struct _virLeaseIndexSource {
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtimeNsec;
+    uint32_t path;
+    uint32_t padding;
+};
+
+typedef struct _virLeaseIndexEntry virLeaseIndexEntry;
+struct _virLeaseIndexEntry {
+    uint32_t name;
+    uint32_t next;
+    uint32_t type;  /* virLeaseIndexKeyType */
+    int32_t family;
+    int64_t expiry;
+    unsigned char addr[16];
+};
+
+verify(sizeof(virLeaseIndexHeader) % 8 == 0);
+verify(sizeof(virLeaseIndexSource) % 8 == 0);
+verify(sizeof(virLeaseIndexEntry) % 8 == 0);
+
+
+static uint32_t
+virLeaseIndexHash(const char *name)
+{
+    /* FNV-1a; the hash must not depend on a per-process seed */
+    uint32_t hash = 2166136261U;
+
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+static void
+virLeaseIndexSourceFill(virLeaseIndexSource *source,
+                        const struct stat *sb)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+
+    source->ino = sb->st_ino;
+    source->size = sb->st_size;
+    source->mtime = mtime.tv_sec;
+    source->mtimeNsec = mtime.tv_nsec;
+}
+
+
+typedef struct _virLeaseIndexBuilder virLeaseIndexBuilder;
+struct _virLeaseIndexBuilder {
+    virLeaseIndexSource *sources;
+    size_t nsources;
+    virLeaseIndexEntry *entries;
+    size_t nentries;
+    virBuffer strings;
+    size_t stringsLen;
+};
+
+
+static int
+virLeaseIndexAddString(virLeaseIndexBuilder *builder,
+                       const char *str,
+                       uint32_t *offset)
+{
+    *offset = builder->stringsLen;
+    virBufferAdd(&builder->strings, str, -1);
+    virBufferAddChar(&builder->strings, '\0');
+    builder->stringsLen += strlen(str) + 1;
+
+    return virBufferCheckError(&builder->strings);
+}
+
+
+static int
+virLeaseIndexAddSource(virLeaseIndexBuilder *builder,
+                       const char *path)
+{
+    virLeaseIndexSource source = { 0 };
+    struct stat sb;
+
+    if (stat(path, &sb) < 0) {
+        virReportSystemError(errno, _("cannot stat '%s'"), path);
+        return -1;
+    }
+
+    virLeaseIndexSourceFill(&source, &sb);
+    if (virLeaseIndexAddString(builder, path, &source.path) < 0)
+        return -1;
+
+    return VIR_APPEND_ELEMENT(builder->sources, builder->nsources, source);
+}
+
+
+static int
+virLeaseIndexAddLease(virLeaseIndexBuilder *builder,
+                      virLeaseIndexKeyType type,
+                      const char *name,
+                      virJSONValuePtr lease)
+{
+    virLeaseIndexEntry entry = { 0 };
+    const char *ip;
+    long long expirytime;
+    virSocketAddr sa;
+
+    if (!(ip = virJSONValueObjectGetString(lease, "ip-address")) ||
+        virJSONValueObjectGetNumberLong(lease, "expiry-time", &expirytime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to parse json"));
+        return -1;
+    }
+
+    if (virSocketAddrParse(&sa, ip, AF_UNSPEC) < 0)
+        return -1;
+
+    entry.type = type;
+    entry.expiry = expirytime;
+    entry.family = VIR_SOCKET_ADDR_FAMILY(&sa);
+    if (entry.family == AF_INET)
+        memcpy(entry.addr, &sa.data.inet4.sin_addr.s_addr, 4);
+    else
+        memcpy(entry.addr, &sa.data.inet6.sin6_addr.s6_addr, 16);
+
+    if (virLeaseIndexAddString(builder, name, &entry.name) < 0)
+        return -1;
+
+    return VIR_APPEND_ELEMENT(builder->entries, builder->nentries, entry);
+}
+
+
+static int
+virLeaseIndexAddDomains(virLeaseIndexBuilder *builder,
+                        virJSONValuePtr macmap,
+                        virJSONValuePtr leases)
+{
+    size_t i, j, k;
+
+    for (i = 0; i < virJSONValueArraySize(macmap); i++) {
+        virJSONValuePtr dom = virJSONValueArrayGet(macmap, i);
+        const char *name = virJSONValueObjectGetString(dom, "domain");
+        virJSONValuePtr macs = virJSONValueObjectGetArray(dom, "macs");
+
+        if (!name || !macs)
+            continue;
+
+        for (j = 0; j < virJSONValueArraySize(macs); j++) {
+            const char *mac = virJSONValueGetString(virJSONValueArrayGet(macs, j));
+
+            if (!mac)
+                continue;
+
+            for (k = 0; k < virJSONValueArraySize(leases); k++) {
+                virJSONValuePtr lease = virJSONValueArrayGet(leases, k);
+
+                if (STRNEQ_NULLABLE(mac, virJSONValueObjectGetString(lease,
+                                                                     "mac-address")))
+                    continue;
+
+                if (virLeaseIndexAddLease(builder, VIR_LEASE_INDEX_KEY_DOMAIN,
+                                          name, lease) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+struct virLeaseIndexWriteData {
+    const char *data;
+    size_t len;
+};
+
+
+static int
+virLeaseIndexWriteHelper(int fd,
+                         const void *opaque)
+{
+    const struct virLeaseIndexWriteData *data = opaque;
+
+    if (safewrite(fd, data->data, data->len) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * virLeaseIndexRebuild:
+ * @leaseDir: directory with the lease (.status) and MAC map (.macs) files
+ * @indexPath: where to store the index
+ *
+ * Build the lease index out of all the lease and MAC map files in
+ * @leaseDir and atomically replace @indexPath with it. The caller
+ * must make sure no one else rebuilds @indexPath concurrently.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virLeaseIndexRebuild(const char *leaseDir,
+                     const char *indexPath)
+{
+    virLeaseIndexBuilder builder = { .strings = VIR_BUFFER_INITIALIZER };
+    virLeaseIndexHeader header = { .magic = VIR_LEASE_INDEX_MAGIC };
+    struct virLeaseIndexWriteData data;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    virJSONValuePtr leases = NULL;
+    virJSONValuePtr *macmaps = NULL;
+    size_t nmacmaps = 0;
+    uint32_t *buckets = NULL;
+    char *blob = NULL;
+    char *ptr;
+    char *path = NULL;
+    char *content = NULL;
+    size_t nbuckets;
+    size_t size;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (!(leases = virJSONValueNewArray()))
+        goto cleanup;
+
+    if (virDirOpen(&dir, leaseDir) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, leaseDir)) > 0) {
+        bool status = virFileHasSuffix(ent->d_name, ".status");
+        virJSONValuePtr macmap;
+
+        if (!status && !virFileHasSuffix(ent->d_name, ".macs"))
+            continue;
+
+        if (!(path = virFileBuildPath(leaseDir, ent->d_name, NULL)) ||
+            virLeaseIndexAddSource(&builder, path) < 0)
+            goto cleanup;
+
+        if (status) {
+            if (virLeaseReadCustomLeaseFile(leases, path, NULL, NULL) < 0)
+                goto cleanup;
+        } else {
+            if (virFileReadAll(path, VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
+                               &content) < 0)
+                goto cleanup;
+
+            /* an empty or corrupted map has no domains to index */
+            if ((macmap = virJSONValueFromString(content)) &&
+                VIR_APPEND_ELEMENT(macmaps, nmacmaps, macmap) < 0) {
+                virJSONValueFree(macmap);
+                goto cleanup;
+            }
+            VIR_FREE(content);
+        }
+        VIR_FREE(path);
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    for (i = 0; i < virJSONValueArraySize(leases); i++) {
+        virJSONValuePtr lease = virJSONValueArrayGet(leases, i);
+        const char *hostname = virJSONValueObjectGetString(lease, "hostname");
+
+        if (hostname &&
+            virLeaseIndexAddLease(&builder, VIR_LEASE_INDEX_KEY_HOSTNAME,
+                                  hostname, lease) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < nmacmaps; i++) {
+        if (virJSONValueIsArray(macmaps[i]) &&
+            virLeaseIndexAddDomains(&builder, macmaps[i], leases) < 0)
+            goto cleanup;
+    }
+
+    /* keep the buckets 8 byte aligned */
+    nbuckets = (builder.nentries + 1) & ~1;
+    size = sizeof(header) +
+        builder.nsources * sizeof(virLeaseIndexSource) +
+        nbuckets * sizeof(uint32_t) +
+        builder.nentries * sizeof(virLeaseIndexEntry);
+
+    if (size + builder.stringsLen > UINT32_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("too many leases to index"));
+        goto cleanup;
+    }
+
+    /* string offsets are relative to the start of the file */
+    for (i = 0; i < builder.nsources; i++)
+        builder.sources[i].path += size;
+
+    if (VIR_ALLOC_N(buckets, nbuckets) < 0)
+        goto cleanup;
+
+    for (i = 0; i < builder.nentries; i++) {
+        virLeaseIndexEntry *entry = &builder.entries[i];
+        uint32_t bucket;
+
+        bucket = virLeaseIndexHash(virBufferCurrentContent(&builder.strings) +
+                                   entry->name) % nbuckets;
+        entry->name += size;
+        entry->next = buckets[bucket];
+        buckets[bucket] = i + 1;
+    }
+
+    header.size = size + builder.stringsLen;
+    header.nsources = builder.nsources;
+    header.nbuckets = nbuckets;
+    header.nentries = builder.nentries;
+
+    if (VIR_ALLOC_N(blob, header.size) < 0)
+        goto cleanup;
+
+    ptr = blob;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    memcpy(ptr, builder.sources, builder.nsources * sizeof(virLeaseIndexSource));
+    ptr += builder.nsources * sizeof(virLeaseIndexSource);
+    memcpy(ptr, buckets, nbuckets * sizeof(uint32_t));
+    ptr += nbuckets * sizeof(uint32_t);
+    memcpy(ptr, builder.entries, builder.nentries * sizeof(virLeaseIndexEntry));
+    ptr += builder.nentries * sizeof(virLeaseIndexEntry);
+    memcpy(ptr, virBufferCurrentContent(&builder.strings), builder.stringsLen);
+
+    data.data = blob;
+    data.len = header.size;
+
+    if (virFileRewrite(indexPath, 0644, virLeaseIndexWriteHelper, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    virJSONValueFree(leases);
+    while (nmacmaps)
+        virJSONValueFree(macmaps[--nmacmaps]);
+    VIR_FREE(macmaps);
+    VIR_FREE(builder.sources);
+    VIR_FREE(builder.entries);
+    virBufferFreeAndReset(&builder.strings);
+    VIR_FREE(buckets);
+    VIR_FREE(blob);
+    VIR_FREE(content);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static bool
+virLeaseIndexString(const char *base,
+                    size_t size,
+                    uint32_t offset,
+                    const char **str)
+{
+    if (offset >= size || !memchr(base + offset, '\0', size - offset))
+        return false;
+
+    *str = base + offset;
+    return true;
+}
+
+
+/**
+ * virLeaseIndexLookup:
+ * @indexPath: index built by virLeaseIndexRebuild
+ * @name: host or domain name to look up
+ * @type: whether @name is a host or a domain name
+ * @now: current time, leases expired by then are skipped
+ * @cb: callback to call for each address of @name
+ * @opaque: data for @cb
+ *
+ * Look @name up in the lease index. This does not report errors, as
+ * it is meant to be used by the NSS modules.
+ *
+ * Returns: 1 if the index was consulted, whether @name is in it or not,
+ *          0 if there's no index or it's out of date, in which case the
+ *            caller must look at the lease files,
+ *         -1 if @cb failed.
+ */
+int
+virLeaseIndexLookup(const char *indexPath,
+                    const char *name,
+                    virLeaseIndexKeyType type,
+                    long long now,
+                    virLeaseIndexCallback cb,
+                    void *opaque)
+{
+#if HAVE_MMAP
+    const virLeaseIndexHeader *header;
+    const virLeaseIndexSource *sources;
+    const uint32_t *buckets;
+    const virLeaseIndexEntry *entries;
+    struct stat sb;
+    void *map = MAP_FAILED;
+    const char *base;
+    size_t size = 0;
+    uint32_t idx;
+    size_t i;
+    int fd = -1;
+    int ret = 0;
+
+    if ((fd = open(indexPath, O_RDONLY)) < 0 ||
+        fstat(fd, &sb) < 0 ||
+        sb.st_size < (off_t) sizeof(*header) ||
+        sb.st_size > UINT32_MAX)
+        goto cleanup;
+
+    size = sb.st_size;
+    if ((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        goto cleanup;
+    VIR_FORCE_CLOSE(fd);
+
+    base = map;
+    header = map;
+    if (memcmp(header->magic, VIR_LEASE_INDEX_MAGIC, sizeof(header->magic)) ||
+        header->size != size ||
+        header->nsources > size / sizeof(*sources) ||
+        header->nbuckets > size / sizeof(*buckets) ||
+        header->nentries > size / sizeof(*entries) ||
+        sizeof(*header) +
+        header->nsources * sizeof(*sources) +
+        header->nbuckets * sizeof(*buckets) +
+        header->nentries * sizeof(*entries) > size)
+        goto cleanup;
+
+    sources = (const virLeaseIndexSource *) (header + 1);
+    buckets = (const uint32_t *) (sources + header->nsources);
+    entries = (const virLeaseIndexEntry *) (buckets + header->nbuckets);
+
+    /* make sure the index still describes the lease files */
+    for (i = 0; i < header->nsources; i++) {
+        virLeaseIndexSource actual = { 0 };
+        const char *path;
+
+        if (!virLeaseIndexString(base, size, sources[i].path, &path) ||
+            stat(path, &sb) < 0)
+            goto cleanup;
+
+        virLeaseIndexSourceFill(&actual, &sb);
+        if (actual.ino != sources[i].ino ||
+            actual.size != sources[i].size ||
+            actual.mtime != sources[i].mtime ||
+            actual.mtimeNsec != sources[i].mtimeNsec)
+            goto cleanup;
+    }
+
+    ret = 1;
+
+    if (header->nbuckets == 0)
+        goto cleanup;
+
+    idx = buckets[virLeaseIndexHash(name) % header->nbuckets];
+    for (i = 0; idx && i < header->nentries; i++) {
+        const virLeaseIndexEntry *entry;
+        const char *entryName;
+
+        if (idx > header->nentries)
+            break;
+
+        entry = &entries[idx - 1];
+        idx = entry->next;
+
+        if (entry->type != type ||
+            entry->expiry < now ||
+            !virLeaseIndexString(base, size, entry->name, &entryName) ||
+            STRNEQ(entryName, name))
+            continue;
+
+        if (cb(entry->family, entry->addr, opaque) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (map != MAP_FAILED)
+        munmap(map, size);
+    return ret;
+#else /* !HAVE_MMAP */
+    return 0;
+#endif /* !HAVE_MMAP */
+}
@@ -41,4 +41,25 @@ int virLeaseNew(virJSONValuePtr *lease_ret,
                 const char *hostname,
                 const char *iaid,
                 const char *server_duid);
+
+# define VIR_LEASE_INDEX_FILE "leases.index"
+
+typedef enum {
+    VIR_LEASE_INDEX_KEY_HOSTNAME = 0, /* hostname of the DHCP client */
+    VIR_LEASE_INDEX_KEY_DOMAIN,       /* domain owning the MAC address */
+} virLeaseIndexKeyType;
+
+typedef int (*virLeaseIndexCallback)(int family,
+                                     const unsigned char *addr,
+                                     void *opaque);
+
+int virLeaseIndexRebuild(const char *leaseDir,
+                         const char *indexPath);
+
+int virLeaseIndexLookup(const char *indexPath,
+                        const char *name,
+                        virLeaseIndexKeyType type,
+                        long long now,
+                        virLeaseIndexCallback cb,
+                        void *opaque);
 #endif /* __VIR_LEASE_H */
@@ -30,6 +30,7 @@
 #include "virhash.h"
 #include "virthread.h"
 #include "virstring.h"
+#include "virhashcode.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -41,6 +42,12 @@ VIR_LOG_INIT("util.lockspace");
 
 #define VIR_LOCKSPACE_TABLE_SIZE 10
 
+/* Resources are spread over a number of independently locked
+ * hash tables, so that acquiring leases for unrelated disks
+ * does not serialize on a single mutex while the lock files
+ * are opened and fcntl()'d */
+#define VIR_LOCKSPACE_SHARDS 16
+
 typedef struct _virLockSpaceResource virLockSpaceResource;
 typedef virLockSpaceResource *virLockSpaceResourcePtr;
 
@@ -54,11 +61,19 @@ struct _virLockSpaceResource {
     pid_t *owners;
 };
 
+typedef struct _virLockSpaceShard virLockSpaceShard;
+typedef virLockSpaceShard *virLockSpaceShardPtr;
+
+struct _virLockSpaceShard {
+    virMutex lock;
+    virHashTablePtr resources;
+};
+
 struct _virLockSpace {
     char *dir;
-    virMutex lock;
 
-    virHashTablePtr resources;
+    size_t nshards;
+    virLockSpaceShard shards[VIR_LOCKSPACE_SHARDS];
 };
 
 
@@ -239,6 +254,40 @@ static void virLockSpaceResourceDataFree(void *opaque, const void *name ATTRIBUT
 }
 
 
+static int virLockSpaceInitShards(virLockSpacePtr lockspace)
+{
+    for (lockspace->nshards = 0;
+         lockspace->nshards < VIR_LOCKSPACE_SHARDS;
+         lockspace->nshards++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[lockspace->nshards];
+
+        if (virMutexInit(&shard->lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to initialize lockspace mutex"));
+            return -1;
+        }
+
+        if (!(shard->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
+                                               virLockSpaceResourceDataFree))) {
+            virMutexDestroy(&shard->lock);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static virLockSpaceShardPtr
+virLockSpaceGetShard(virLockSpacePtr lockspace,
+                     const char *resname)
+{
+    uint32_t code = virHashCodeGen(resname, strlen(resname), 0);
+
+    return &lockspace->shards[code % VIR_LOCKSPACE_SHARDS];
+}
+
+
 virLockSpacePtr virLockSpaceNew(const char *directory)
 {
     virLockSpacePtr lockspace;
@@ -248,18 +297,10 @@ virLockSpacePtr virLockSpaceNew(const char *directory)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
-
-    if (VIR_STRDUP(lockspace->dir, directory) < 0)
+    if (virLockSpaceInitShards(lockspace) < 0)
         goto error;
 
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (VIR_STRDUP(lockspace->dir, directory) < 0)
         goto error;
 
     if (directory) {
@@ -301,15 +342,7 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
-
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (virLockSpaceInitShards(lockspace) < 0)
         goto error;
 
     if (virJSONValueObjectHasKey(object, "directory")) {
@@ -423,7 +456,8 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
             res->owners[j] = (pid_t)owner;
         }
 
-        if (virHashAddEntry(lockspace->resources, res->name, res) < 0) {
+        if (virHashAddEntry(virLockSpaceGetShard(lockspace, res->name)->resources,
+                            res->name, res) < 0) {
             virLockSpaceResourceFree(res);
             goto error;
         }
@@ -442,11 +476,13 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
     virJSONValuePtr object = virJSONValueNewObject();
     virJSONValuePtr resources;
     virHashKeyValuePairPtr pairs = NULL, tmp;
+    size_t i;
 
     if (!object)
         return NULL;
 
-    virMutexLock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexLock(&lockspace->shards[i].lock);
 
     if (lockspace->dir &&
         virJSONValueObjectAppendString(object, "directory", lockspace->dir) < 0)
@@ -460,76 +496,84 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
         goto error;
     }
 
-    tmp = pairs = virHashGetItems(lockspace->resources, NULL);
-    while (tmp && tmp->value) {
-        virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
-        virJSONValuePtr child = virJSONValueNewObject();
-        virJSONValuePtr owners = NULL;
-        size_t i;
+    for (i = 0; i < lockspace->nshards; i++) {
+        tmp = pairs = virHashGetItems(lockspace->shards[i].resources, NULL);
+        while (tmp && tmp->value) {
+            virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
+            virJSONValuePtr child = virJSONValueNewObject();
+            virJSONValuePtr owners = NULL;
+            size_t j;
 
-        if (!child)
-            goto error;
-
-        if (virJSONValueArrayAppend(resources, child) < 0) {
-            virJSONValueFree(child);
-            goto error;
-        }
-
-        if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
-            virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
-            virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
-            virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
-            virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
-            goto error;
+            if (!child)
+                goto error;
 
-        if (virSetInherit(res->fd, true) < 0) {
-            virReportSystemError(errno, "%s",
-                                 _("Cannot disable close-on-exec flag"));
-            goto error;
-        }
+            if (virJSONValueArrayAppend(resources, child) < 0) {
+                virJSONValueFree(child);
+                goto error;
+            }
 
-        if (!(owners = virJSONValueNewArray()))
-            goto error;
+            if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
+                virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
+                virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
+                virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
+                virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
+                goto error;
 
-        if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
-            virJSONValueFree(owners);
-            goto error;
-        }
+            if (virSetInherit(res->fd, true) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Cannot disable close-on-exec flag"));
+                goto error;
+            }
 
-        for (i = 0; i < res->nOwners; i++) {
-            virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[i]);
-            if (!owner)
+            if (!(owners = virJSONValueNewArray()))
                 goto error;
 
-            if (virJSONValueArrayAppend(owners, owner) < 0) {
-                virJSONValueFree(owner);
+            if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
+                virJSONValueFree(owners);
                 goto error;
             }
-        }
 
-        tmp++;
+            for (j = 0; j < res->nOwners; j++) {
+                virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[j]);
+                if (!owner)
+                    goto error;
+
+                if (virJSONValueArrayAppend(owners, owner) < 0) {
+                    virJSONValueFree(owner);
+                    goto error;
+                }
+            }
+
+            tmp++;
+        }
+        VIR_FREE(pairs);
     }
-    VIR_FREE(pairs);
 
-    virMutexUnlock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexUnlock(&lockspace->shards[i].lock);
     return object;
 
  error:
     VIR_FREE(pairs);
     virJSONValueFree(object);
-    virMutexUnlock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexUnlock(&lockspace->shards[i].lock);
     return NULL;
 }
 
 
 void virLockSpaceFree(virLockSpacePtr lockspace)
 {
+    size_t i;
+
     if (!lockspace)
         return;
 
-    virHashFree(lockspace->resources);
+    for (i = 0; i < lockspace->nshards; i++) {
+        virHashFree(lockspace->shards[i].resources);
+        virMutexDestroy(&lockspace->shards[i].lock);
+    }
     VIR_FREE(lockspace->dir);
-    virMutexDestroy(&lockspace->lock);
     VIR_FREE(lockspace);
 }
 
@@ -545,12 +589,14 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard;
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    shard = virLockSpaceGetShard(lockspace, resname);
+    virMutexLock(&shard->lock);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -566,7 +612,7 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
@@ -577,12 +623,14 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard;
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    shard = virLockSpaceGetShard(lockspace, resname);
+    virMutexLock(&shard->lock);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -603,7 +651,7 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
@@ -616,6 +664,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard;
 
     VIR_DEBUG("lockspace=%p resname=%s flags=0x%x owner=%lld",
               lockspace, resname, flags, (unsigned long long)owner);
@@ -623,9 +672,10 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
                   VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
 
-    virMutexLock(&lockspace->lock);
+    shard = virLockSpaceGetShard(lockspace, resname);
+    virMutexLock(&shard->lock);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         if ((res->flags & VIR_LOCK_SPACE_ACQUIRE_SHARED) &&
             (flags & VIR_LOCK_SPACE_ACQUIRE_SHARED)) {
 
@@ -644,7 +694,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     if (!(res = virLockSpaceResourceNew(lockspace, resname, flags, owner)))
         goto cleanup;
 
-    if (virHashAddEntry(lockspace->resources, resname, res) < 0) {
+    if (virHashAddEntry(shard->resources, resname, res) < 0) {
         virLockSpaceResourceFree(res);
         goto cleanup;
     }
@@ -653,7 +703,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     return ret;
 }
 
@@ -664,14 +714,16 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard;
     size_t i;
 
     VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
               lockspace, resname, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    shard = virLockSpaceGetShard(lockspace, resname);
+    virMutexLock(&shard->lock);
 
-    if (!(res = virHashLookup(lockspace->resources, resname))) {
+    if (!(res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is not locked"),
                        resname);
@@ -693,13 +745,13 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
     VIR_DELETE_ELEMENT(res->owners, i, res->nOwners);
 
     if ((res->nOwners == 0) &&
-        virHashRemoveEntry(lockspace->resources, resname) < 0)
+        virHashRemoveEntry(shard->resources, resname) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     return ret;
 }
 
@@ -746,26 +798,26 @@ virLockSpaceRemoveResourcesForOwner(const void *payload,
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner)
 {
-    int ret = 0;
     struct virLockSpaceRemoveData data = {
         owner, 0
     };
+    size_t i;
 
     VIR_DEBUG("lockspace=%p owner=%lld", lockspace, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
-
-    if (virHashRemoveSet(lockspace->resources,
-                         virLockSpaceRemoveResourcesForOwner,
-                         &data) < 0)
-        goto error;
+    for (i = 0; i < lockspace->nshards; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
+        int rc;
 
-    ret = data.count;
+        virMutexLock(&shard->lock);
+        rc = virHashRemoveSet(shard->resources,
+                              virLockSpaceRemoveResourcesForOwner,
+                              &data);
+        virMutexUnlock(&shard->lock);
 
-    virMutexUnlock(&lockspace->lock);
-    return ret;
+        if (rc < 0)
+            return -1;
+    }
 
- error:
-    virMutexUnlock(&lockspace->lock);
-    return -1;
+    return data.count;
 }
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <execinfo.h>
 #include <regex.h>
+#include <signal.h>
 #include <sys/uio.h>
 #if HAVE_SYSLOG_H
 # include <syslog.h>
@@ -47,6 +48,7 @@
 #include "virutil.h"
 #include "virbuffer.h"
 #include "virthread.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virtime.h"
 #include "intprops.h"
@@ -77,7 +79,7 @@ static regex_t *virLogRegex;
 
 VIR_ENUM_DECL(virLogDestination);
 VIR_ENUM_IMPL(virLogDestination, VIR_LOG_TO_OUTPUT_LAST,
-              "stderr", "syslog", "file", "journald");
+              "stderr", "syslog", "file", "journald", "json");
 
 /*
  * Filters are used to refine the rules on what to keep or drop
@@ -89,10 +91,14 @@ struct _virLogFilter {
     unsigned int flags;
 };
 
-static int virLogFiltersSerial = 1;
+/* Bumped whenever the cached priorities of the log sources are stale */
+unsigned int virLogFiltersSerial = 1;
 static virLogFilterPtr *virLogFilters;
 static size_t virLogNbFilters;
 
+/* Number of messages the flight recorder keeps per thread, 0 if disabled */
+static size_t virLogRecorderSize;
+
 /*
  * Outputs are used to emit the messages retained
  * after filtering, multiple output can be used simultaneously
@@ -110,6 +116,13 @@ struct _virLogOutput {
 static char *virLogDefaultOutput;
 static virLogOutputPtr *virLogOutputs;
 static size_t virLogNbOutputs;
+/* Outputs not served from the per-thread buffers, see virLogSetAsync */
+static size_t virLogNbSyncOutputs;
+/* Number of outputs in the structured format */
+static size_t virLogNbJSONOutputs;
+/* Number of journald outputs */
+static size_t virLogNbJournaldOutputs;
+static bool virLogInitMessageStderr = true;
 
 /*
  * Default priorities
@@ -118,6 +131,25 @@ static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
 static void virLogResetFilters(void);
 static void virLogResetOutputs(void);
+static void virLogDrainBuffers(void);
+static char *virLogFormatJSON(virLogSourcePtr source,
+                              virLogPriority priority,
+                              int linenr,
+                              const char *funcname,
+                              const char *timestamp,
+                              virLogMetadataPtr metadata,
+                              const char *rawstr);
+static void virLogOutputToJSON(virLogSourcePtr src,
+                               virLogPriority priority,
+                               const char *filename,
+                               int linenr,
+                               const char *funcname,
+                               const char *timestamp,
+                               virLogMetadataPtr metadata,
+                               unsigned int flags,
+                               const char *rawstr,
+                               const char *str,
+                               void *data);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -321,7 +353,10 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogLock();
     virLogDefaultPriority = priority;
+    virLogFiltersSerial++;
+    virLogUnlock();
     return 0;
 }
 
@@ -381,9 +416,15 @@ virLogFilterListFree(virLogFilterPtr *list, int count)
 static void
 virLogResetOutputs(void)
 {
+    /* Whatever is buffered was meant for the outputs going away */
+    virLogDrainBuffers();
+
     virLogOutputListFree(virLogOutputs, virLogNbOutputs);
     virLogOutputs = NULL;
     virLogNbOutputs = 0;
+    virLogNbSyncOutputs = 0;
+    virLogNbJSONOutputs = 0;
+    virLogNbJournaldOutputs = 0;
 }
 
 
@@ -505,12 +546,1190 @@ virLogSourceUpdate(virLogSourcePtr source)
         }
 
         source->priority = priority;
+        /* The recorder wants every message */
+        source->threshold = virLogRecorderSize ? VIR_LOG_DEBUG : priority;
         source->flags = flags;
         source->serial = virLogFiltersSerial;
     }
     virLogUnlock();
 }
 
+/* Emits the version and hostname lines an output starts with */
+static void
+virLogOutputInitMessages(virLogOutputFunc f,
+                         void *data,
+                         const char *timestamp)
+{
+    const char *rawinitmsg;
+    char *hoststr = NULL;
+    char *initmsg = NULL;
+
+    if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
+        f(&virLogSelf, VIR_LOG_INFO,
+          __FILE__, __LINE__, __func__,
+          timestamp, NULL, 0, rawinitmsg, initmsg, data);
+    VIR_FREE(initmsg);
+    if (virLogHostnameString(&hoststr, &initmsg) >= 0)
+        f(&virLogSelf, VIR_LOG_INFO,
+          __FILE__, __LINE__, __func__,
+          timestamp, NULL, 0, hoststr, initmsg, data);
+    VIR_FREE(hoststr);
+    VIR_FREE(initmsg);
+}
+
+
+/*
+ * Buffered logging
+ *
+ * With virLogSetAsync enabled, messages for the file, json, journald and
+ * stderr outputs are not written by the thread emitting them. Each thread
+ * appends them to a ring of its own, guarded by a mutex only the thread
+ * itself and the writer ever take, so emitting threads don't contend on
+ * virLogMutex.
+ * A writer thread periodically collects the rings of all threads, puts
+ * the messages back in the order they were emitted and writes them to
+ * each output with as few writev() calls as possible. Journald entries
+ * are serialized up front as well and handed to the journal socket with
+ * sendmmsg(). Syslog and any custom outputs are still fed synchronously.
+ */
+
+/* Messages a thread can have pending before it drains them itself */
+#define VIR_LOG_BUFFER_SIZE 256
+/* How long the writer lets messages sit in the buffers */
+#define VIR_LOG_WRITER_INTERVAL 100
+
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+struct _virLogRecord {
+    unsigned int seq;
+    virLogPriority priority;
+    char *msg;  /* "timestamp: message", as virLogOutputToFd writes it */
+    size_t len;
+    char *json; /* the same, as virLogOutputToJSON writes it, if needed */
+    size_t jsonlen;
+    char *journal; /* the same, as a journal entry, if needed */
+    size_t journallen;
+};
+
+typedef struct _virLogBuffer virLogBuffer;
+typedef virLogBuffer *virLogBufferPtr;
+struct _virLogBuffer {
+    virMutex lock;
+    size_t head;
+    size_t count;
+    virLogRecord records[VIR_LOG_BUFFER_SIZE];
+
+    virLogBufferPtr next;
+};
+
+#if USE_JOURNALD
+typedef struct _virLogJournal virLogJournal;
+typedef virLogJournal *virLogJournalPtr;
+
+static void virLogOutputToJournald(virLogSourcePtr src,
+                                   virLogPriority priority,
+                                   const char *filename,
+                                   int linenr,
+                                   const char *funcname,
+                                   const char *timestamp,
+                                   virLogMetadataPtr metadata,
+                                   unsigned int flags,
+                                   const char *rawstr,
+                                   const char *str,
+                                   void *data);
+static char *virLogFormatJournal(virLogSourcePtr source,
+                                 virLogPriority priority,
+                                 const char *filename,
+                                 int linenr,
+                                 const char *funcname,
+                                 virLogMetadataPtr metadata,
+                                 const char *rawstr,
+                                 size_t *len);
+static void virLogJournalSendRecords(virLogJournalPtr journal,
+                                     virLogPriority priority,
+                                     virLogRecordPtr records,
+                                     size_t nrecords);
+#endif
+
+static bool virLogAsync;
+static bool virLogAsyncInitialized;
+static int virLogSeq;
+static virThreadLocal virLogBufferKey;
+
+/* Protects the list of buffers. Nests inside virLogMutex */
+static virMutex virLogBuffersLock = VIR_MUTEX_INITIALIZER;
+static virLogBufferPtr virLogBuffers;
+
+static virMutex virLogWriterLock = VIR_MUTEX_INITIALIZER;
+static virCond virLogWriterCond;
+static virThread virLogWriter;
+static bool virLogWriterQuit;
+
+static struct sigaction virLogOldAbortAction;
+static bool virLogAbortHandlerInstalled;
+
+
+static bool
+virLogOutputIsJSON(virLogOutputPtr output)
+{
+    return output->f == virLogOutputToJSON;
+}
+
+
+static bool
+virLogOutputIsJournald(virLogOutputPtr output ATTRIBUTE_UNUSED)
+{
+#if USE_JOURNALD
+    return output->f == virLogOutputToJournald;
+#else
+    return false;
+#endif
+}
+
+
+/* Whether @output writes to the file descriptor in its data */
+static bool
+virLogOutputIsFd(virLogOutputPtr output)
+{
+    return output->f == virLogOutputToFd || virLogOutputIsJSON(output);
+}
+
+
+static bool
+virLogOutputIsBuffered(virLogOutputPtr output)
+{
+    return virLogOutputIsFd(output) || virLogOutputIsJournald(output);
+}
+
+
+static void
+virLogBufferFree(void *opaque)
+{
+    virLogBufferPtr buf = opaque;
+    virLogBufferPtr *tmp;
+
+    /* Write out whatever the exiting thread left behind */
+    virLogLock();
+    virLogDrainBuffers();
+
+    virMutexLock(&virLogBuffersLock);
+    for (tmp = &virLogBuffers; *tmp; tmp = &(*tmp)->next) {
+        if (*tmp == buf) {
+            *tmp = buf->next;
+            break;
+        }
+    }
+    virMutexUnlock(&virLogBuffersLock);
+    virLogUnlock();
+
+    virMutexDestroy(&buf->lock);
+    VIR_FREE(buf);
+}
+
+
+static virLogBufferPtr
+virLogBufferGet(void)
+{
+    virLogBufferPtr buf;
+
+    if ((buf = virThreadLocalGet(&virLogBufferKey)))
+        return buf;
+
+    if (VIR_ALLOC_QUIET(buf) < 0)
+        return NULL;
+
+    if (virMutexInit(&buf->lock) < 0) {
+        VIR_FREE(buf);
+        return NULL;
+    }
+
+    if (virThreadLocalSet(&virLogBufferKey, buf) < 0) {
+        virMutexDestroy(&buf->lock);
+        VIR_FREE(buf);
+        return NULL;
+    }
+
+    virMutexLock(&virLogBuffersLock);
+    buf->next = virLogBuffers;
+    virLogBuffers = buf;
+    virMutexUnlock(&virLogBuffersLock);
+
+    return buf;
+}
+
+
+/*
+ * Stores @str, emitted at @timestamp, in the buffer of the calling thread,
+ * along with its structured form @json and its journal entry @journal,
+ * which are consumed in any case.
+ * Returns 0 on success, -1 if the message has to be written directly.
+ */
+static int
+virLogBufferMessage(virLogPriority priority,
+                    const char *timestamp,
+                    const char *str,
+                    char *json,
+                    char *journal,
+                    size_t journallen)
+{
+    virLogBufferPtr buf;
+    virLogRecordPtr rec;
+    char *msg;
+    bool full;
+
+    if (!(buf = virLogBufferGet()) ||
+        virAsprintfQuiet(&msg, "%s: %s", timestamp, str) < 0) {
+        VIR_FREE(json);
+        VIR_FREE(journal);
+        return -1;
+    }
+
+    virMutexLock(&buf->lock);
+    if (buf->count == VIR_LOG_BUFFER_SIZE) {
+        /* The writer can't keep up, write the messages ourselves */
+        virMutexUnlock(&buf->lock);
+        virLogLock();
+        virLogDrainBuffers();
+        virLogUnlock();
+        virMutexLock(&buf->lock);
+
+        if (buf->count == VIR_LOG_BUFFER_SIZE) {
+            virMutexUnlock(&buf->lock);
+            VIR_FREE(msg);
+            VIR_FREE(json);
+            VIR_FREE(journal);
+            return -1;
+        }
+    }
+
+    rec = &buf->records[(buf->head + buf->count) % VIR_LOG_BUFFER_SIZE];
+    rec->seq = virAtomicIntInc(&virLogSeq);
+    rec->priority = priority;
+    rec->msg = msg;
+    rec->len = strlen(msg);
+    rec->json = json;
+    rec->jsonlen = json ? strlen(json) : 0;
+    rec->journal = journal;
+    rec->journallen = journallen;
+    full = ++buf->count >= VIR_LOG_BUFFER_SIZE / 2;
+    virMutexUnlock(&buf->lock);
+
+    if (full)
+        virCondSignal(&virLogWriterCond);
+
+    return 0;
+}
+
+
+static int
+virLogRecordCompare(const void *a,
+                    const void *b)
+{
+    const virLogRecord *ra = a;
+    const virLogRecord *rb = b;
+
+    /* copes with the sequence number wrapping around */
+    return (int) (ra->seq - rb->seq);
+}
+
+
+static void
+virLogWriteRecords(int fd,
+                   virLogPriority priority,
+                   bool json,
+                   virLogRecordPtr records,
+                   size_t nrecords)
+{
+    struct iovec iov[64];
+    size_t niov = 0;
+    size_t i;
+
+    for (i = 0; i <= nrecords; i++) {
+        if (i < nrecords) {
+            if (records[i].priority < priority)
+                continue;
+
+            if (json) {
+                /* buffered before the output was defined */
+                if (!records[i].json)
+                    continue;
+                iov[niov].iov_base = records[i].json;
+                iov[niov].iov_len = records[i].jsonlen;
+            } else {
+                iov[niov].iov_base = records[i].msg;
+                iov[niov].iov_len = records[i].len;
+            }
+            niov++;
+        }
+
+        if (niov && (niov == ARRAY_CARDINALITY(iov) || i == nrecords)) {
+            ssize_t done = writev(fd, iov, niov);
+            size_t j;
+
+            /* On a short write fall back to writing the rest one by one */
+            for (j = 0; j < niov && done >= 0; j++) {
+                if (done >= iov[j].iov_len) {
+                    done -= iov[j].iov_len;
+                    continue;
+                }
+                ignore_value(safewrite(fd, (char *) iov[j].iov_base + done,
+                                       iov[j].iov_len - done));
+                done = 0;
+            }
+            niov = 0;
+        }
+    }
+}
+
+
+/*
+ * Writes out the messages buffered by all threads.
+ * Must be called with virLogMutex held.
+ */
+static void
+virLogDrainBuffers(void)
+{
+    virLogRecordPtr records = NULL;
+    size_t nrecords = 0;
+    size_t maxrecords = 0;
+    virLogBufferPtr buf;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    size_t i;
+
+    if (!virLogAsync)
+        return;
+
+    virMutexLock(&virLogBuffersLock);
+    for (buf = virLogBuffers; buf; buf = buf->next) {
+        virMutexLock(&buf->lock);
+        if (buf->count &&
+            VIR_RESIZE_N(records, maxrecords, nrecords, buf->count) == 0) {
+            for (; buf->count; buf->count--) {
+                records[nrecords++] = buf->records[buf->head];
+                buf->head = (buf->head + 1) % VIR_LOG_BUFFER_SIZE;
+            }
+        }
+        virMutexUnlock(&buf->lock);
+    }
+    virMutexUnlock(&virLogBuffersLock);
+
+    if (!nrecords)
+        return;
+
+    qsort(records, nrecords, sizeof(*records), virLogRecordCompare);
+
+    if (virTimeStringNowRaw(timestamp) < 0)
+        timestamp[0] = '\0';
+
+    if (virLogNbOutputs == 0) {
+        if (virLogInitMessageStderr) {
+            virLogOutputInitMessages(virLogOutputToFd,
+                                     (void *) STDERR_FILENO, timestamp);
+            virLogInitMessageStderr = false;
+        }
+        virLogWriteRecords(STDERR_FILENO, 0, false, records, nrecords);
+    }
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        virLogOutputPtr output = virLogOutputs[i];
+
+        if (!virLogOutputIsBuffered(output))
+            continue;
+
+        if (output->logInitMessage) {
+            virLogOutputInitMessages(output->f, output->data, timestamp);
+            output->logInitMessage = false;
+        }
+
+#if USE_JOURNALD
+        if (virLogOutputIsJournald(output)) {
+            virLogJournalSendRecords(output->data, output->priority,
+                                     records, nrecords);
+            continue;
+        }
+#endif
+
+        virLogWriteRecords((intptr_t) output->data, output->priority,
+                           virLogOutputIsJSON(output), records, nrecords);
+    }
+
+    for (i = 0; i < nrecords; i++) {
+        VIR_FREE(records[i].msg);
+        VIR_FREE(records[i].json);
+        VIR_FREE(records[i].journal);
+    }
+    VIR_FREE(records);
+}
+
+
+static void
+virLogWriterThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long now;
+
+    virMutexLock(&virLogWriterLock);
+    while (!virLogWriterQuit) {
+        if (virTimeMillisNow(&now) < 0 ||
+            (virCondWaitUntil(&virLogWriterCond, &virLogWriterLock,
+                              now + VIR_LOG_WRITER_INTERVAL) < 0 &&
+             errno != ETIMEDOUT))
+            break;
+
+        virMutexUnlock(&virLogWriterLock);
+        virLogLock();
+        virLogDrainBuffers();
+        virLogUnlock();
+        virMutexLock(&virLogWriterLock);
+    }
+    virMutexUnlock(&virLogWriterLock);
+}
+
+
+static void virLogRecorderWrite(bool lock);
+
+/*
+ * Called on abort() to get the buffered messages out before the process
+ * dies. No lock can be taken here, so this is a best effort only.
+ */
+static void
+virLogAbortHandler(int sig)
+{
+    virLogBufferPtr buf;
+    size_t i;
+    size_t j;
+
+    for (buf = virLogBuffers; buf; buf = buf->next) {
+        for (i = 0; i < buf->count; i++) {
+            virLogRecordPtr rec = &buf->records[(buf->head + i) %
+                                                VIR_LOG_BUFFER_SIZE];
+
+            if (virLogNbOutputs == 0)
+                ignore_value(safewrite(STDERR_FILENO, rec->msg, rec->len));
+
+            for (j = 0; j < virLogNbOutputs; j++) {
+                if (!virLogOutputIsFd(virLogOutputs[j]) ||
+                    rec->priority < virLogOutputs[j]->priority)
+                    continue;
+
+                if (!virLogOutputIsJSON(virLogOutputs[j]))
+                    ignore_value(safewrite((intptr_t) virLogOutputs[j]->data,
+                                           rec->msg, rec->len));
+                else if (rec->json)
+                    ignore_value(safewrite((intptr_t) virLogOutputs[j]->data,
+                                           rec->json, rec->jsonlen));
+            }
+        }
+    }
+
+    /* The recorder has to be formatted, which might not succeed in a
+     * process that is aborting, so it goes last. */
+    if (virLogRecorderSize)
+        virLogRecorderWrite(false);
+
+    sigaction(SIGABRT, &virLogOldAbortAction, NULL);
+    raise(sig);
+}
+
+
+static void
+virLogAtForkChild(void)
+{
+    /* The writer thread doesn't exist in the child. The buffers are left
+     * alone, their contents will be written by the parent. */
+    virLogAsync = false;
+    virLogBuffers = NULL;
+    virLogNbSyncOutputs = virLogNbOutputs;
+}
+
+
+/**
+ * virLogSetAsync:
+ * @async: whether to buffer messages
+ * @flushOnAbort: whether buffered messages should be written out when the
+ *                process aborts
+ *
+ * Turns buffered logging on or off. When on, messages for file, json,
+ * journald and stderr outputs are written in batches by a dedicated thread instead of
+ * by the thread emitting them, so they may reach the output up to
+ * VIR_LOG_WRITER_INTERVAL milliseconds later. Turning buffering off
+ * writes out all pending messages.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(bool async,
+               bool flushOnAbort)
+{
+    struct sigaction sa;
+    size_t i;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    if (async == virLogAsync)
+        return 0;
+
+    if (!async) {
+        virMutexLock(&virLogWriterLock);
+        virLogWriterQuit = true;
+        virCondSignal(&virLogWriterCond);
+        virMutexUnlock(&virLogWriterLock);
+        virThreadJoin(&virLogWriter);
+
+        virLogLock();
+        virLogDrainBuffers();
+        virLogAsync = false;
+        virLogNbSyncOutputs = virLogNbOutputs;
+        virLogUnlock();
+
+        if (virLogAbortHandlerInstalled) {
+            sigaction(SIGABRT, &virLogOldAbortAction, NULL);
+            virLogAbortHandlerInstalled = false;
+        }
+        return 0;
+    }
+
+    if (!virLogAsyncInitialized) {
+        if (virThreadLocalInit(&virLogBufferKey, virLogBufferFree) < 0 ||
+            virCondInit(&virLogWriterCond) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to initialize log buffers"));
+            return -1;
+        }
+        pthread_atfork(NULL, NULL, virLogAtForkChild);
+        virLogAsyncInitialized = true;
+    }
+
+    virLogLock();
+    virLogAsync = true;
+    virLogNbSyncOutputs = 0;
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (!virLogOutputIsBuffered(virLogOutputs[i]))
+            virLogNbSyncOutputs++;
+    }
+    virLogUnlock();
+
+    virLogWriterQuit = false;
+    if (virThreadCreate(&virLogWriter, true, virLogWriterThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create log writer thread"));
+        virLogLock();
+        virLogDrainBuffers();
+        virLogAsync = false;
+        virLogNbSyncOutputs = virLogNbOutputs;
+        virLogUnlock();
+        return -1;
+    }
+
+    if (flushOnAbort && !virLogAbortHandlerInstalled) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = virLogAbortHandler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGABRT, &sa, &virLogOldAbortAction) == 0)
+            virLogAbortHandlerInstalled = true;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLogFlush:
+ *
+ * Writes out the messages buffered by all threads right away.
+ */
+void
+virLogFlush(void)
+{
+    if (virLogInitialize() < 0)
+        return;
+
+    virLogLock();
+    virLogDrainBuffers();
+    virLogUnlock();
+}
+
+
+/*
+ * Flight recorder
+ *
+ * Keeps the most recent messages of every thread in memory, regardless
+ * of the filters, so that the debug context of a failure can be obtained
+ * without running with debug logs enabled. To keep the cost low nothing
+ * is formatted when a message is recorded: the format string, which is
+ * static, is stored along with the raw values of the arguments. Only
+ * strings are copied, as they are likely to be gone by the time the
+ * recorder is dumped. Messages whose format can't be decomposed are
+ * formatted right away into the space reserved for strings.
+ */
+
+#define VIR_LOG_RECORDER_ARGS 8
+#define VIR_LOG_RECORDER_STRLEN 96
+
+typedef enum {
+    VIR_LOG_RECORDER_ARG_INT,
+    VIR_LOG_RECORDER_ARG_LONG,
+    VIR_LOG_RECORDER_ARG_LLONG,
+    VIR_LOG_RECORDER_ARG_SIZE,
+    VIR_LOG_RECORDER_ARG_DOUBLE,
+    VIR_LOG_RECORDER_ARG_POINTER,
+    VIR_LOG_RECORDER_ARG_STRING,
+} virLogRecorderArgType;
+
+typedef struct _virLogRecorderEntry virLogRecorderEntry;
+typedef virLogRecorderEntry *virLogRecorderEntryPtr;
+struct _virLogRecorderEntry {
+    unsigned long long when;
+    unsigned int seq;
+    virLogPriority priority;
+    const char *funcname;
+    int linenr;
+    const char *fmt;    /* NULL if @strs holds the formatted message */
+    size_t nargs;
+    union {
+        long long i;
+        double d;
+        const void *p;
+        size_t str;     /* offset in @strs, SIZE_MAX for NULL */
+    } args[VIR_LOG_RECORDER_ARGS];
+    char strs[VIR_LOG_RECORDER_STRLEN];
+};
+
+typedef struct _virLogRecorderRing virLogRecorderRing;
+typedef virLogRecorderRing *virLogRecorderRingPtr;
+struct _virLogRecorderRing {
+    virMutex lock;
+    unsigned long long tid;
+    size_t size;
+    size_t next;
+    size_t count;
+    virLogRecorderEntryPtr entries;
+
+    virLogRecorderRingPtr next_ring;
+};
+
+static bool virLogRecorderInitialized;
+static virThreadLocal virLogRecorderKey;
+
+/* Protects the list of rings */
+static virMutex virLogRecordersLock = VIR_MUTEX_INITIALIZER;
+static virLogRecorderRingPtr virLogRecorders;
+
+
+static void
+virLogRecorderRingFree(void *opaque)
+{
+    virLogRecorderRingPtr ring = opaque;
+    virLogRecorderRingPtr *tmp;
+
+    virMutexLock(&virLogRecordersLock);
+    for (tmp = &virLogRecorders; *tmp; tmp = &(*tmp)->next_ring) {
+        if (*tmp == ring) {
+            *tmp = ring->next_ring;
+            break;
+        }
+    }
+    virMutexUnlock(&virLogRecordersLock);
+
+    virMutexDestroy(&ring->lock);
+    VIR_FREE(ring->entries);
+    VIR_FREE(ring);
+}
+
+
+static virLogRecorderRingPtr
+virLogRecorderRingGet(void)
+{
+    virLogRecorderRingPtr ring;
+
+    if ((ring = virThreadLocalGet(&virLogRecorderKey)))
+        return ring;
+
+    if (VIR_ALLOC_QUIET(ring) < 0)
+        return NULL;
+
+    if (virMutexInit(&ring->lock) < 0) {
+        VIR_FREE(ring);
+        return NULL;
+    }
+
+    ring->tid = virThreadSelfID();
+
+    if (virThreadLocalSet(&virLogRecorderKey, ring) < 0) {
+        virMutexDestroy(&ring->lock);
+        VIR_FREE(ring);
+        return NULL;
+    }
+
+    virMutexLock(&virLogRecordersLock);
+    ring->next_ring = virLogRecorders;
+    virLogRecorders = ring;
+    virMutexUnlock(&virLogRecordersLock);
+
+    return ring;
+}
+
+
+/*
+ * Splits @fmt into conversions, storing the type of each argument in
+ * @types. Returns the number of arguments or -1 if @fmt uses anything
+ * the recorder can't store.
+ */
+static int
+virLogRecorderParseFormat(const char *fmt,
+                          virLogRecorderArgType *types)
+{
+    size_t nargs = 0;
+    const char *p;
+
+    for (p = fmt; (p = strchr(p, '%')); p++) {
+        int longs = 0;
+        bool size = false;
+
+        p++;
+        if (*p == '%')
+            continue;
+
+        p += strspn(p, "-+ #0'");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+
+        for (;; p++) {
+            if (*p == 'h')
+                continue;
+            else if (*p == 'l')
+                longs++;
+            else if (*p == 'z' || *p == 't')
+                size = true;
+            else if (*p == 'j' || *p == 'q')
+                longs = 2;
+            else
+                break;
+        }
+
+        if (nargs == VIR_LOG_RECORDER_ARGS)
+            return -1;
+
+        switch (*p) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            if (size)
+                types[nargs] = VIR_LOG_RECORDER_ARG_SIZE;
+            else if (longs >= 2)
+                types[nargs] = VIR_LOG_RECORDER_ARG_LLONG;
+            else if (longs == 1)
+                types[nargs] = VIR_LOG_RECORDER_ARG_LONG;
+            else
+                types[nargs] = VIR_LOG_RECORDER_ARG_INT;
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            types[nargs] = VIR_LOG_RECORDER_ARG_DOUBLE;
+            break;
+        case 'p':
+            types[nargs] = VIR_LOG_RECORDER_ARG_POINTER;
+            break;
+        case 's':
+            if (longs)
+                return -1;
+            types[nargs] = VIR_LOG_RECORDER_ARG_STRING;
+            break;
+        default:
+            /* '*' width, positional arguments, %m, %n, long double... */
+            return -1;
+        }
+        nargs++;
+    }
+
+    return nargs;
+}
+
+
+static void
+virLogRecorderStore(virLogPriority priority,
+                    const char *funcname,
+                    int linenr,
+                    const char *fmt,
+                    va_list vargs)
+{
+    virLogRecorderArgType types[VIR_LOG_RECORDER_ARGS];
+    virLogRecorderRingPtr ring;
+    virLogRecorderEntryPtr entry;
+    size_t size = virLogRecorderSize;
+    size_t strpos = 0;
+    int nargs;
+    size_t i;
+
+    if (!(ring = virLogRecorderRingGet()))
+        return;
+
+    virMutexLock(&ring->lock);
+    if (ring->size != size) {
+        VIR_FREE(ring->entries);
+        ring->size = ring->next = ring->count = 0;
+        if (VIR_ALLOC_N_QUIET(ring->entries, size) < 0)
+            goto cleanup;
+        ring->size = size;
+    }
+
+    entry = &ring->entries[ring->next];
+    ring->next = (ring->next + 1) % ring->size;
+    if (ring->count < ring->size)
+        ring->count++;
+
+    ignore_value(virTimeMillisNowRaw(&entry->when));
+    entry->seq = virAtomicIntInc(&virLogSeq);
+    entry->priority = priority;
+    entry->funcname = funcname;
+    entry->linenr = linenr;
+    entry->fmt = fmt;
+    entry->nargs = 0;
+
+    if ((nargs = virLogRecorderParseFormat(fmt, types)) < 0) {
+        entry->fmt = NULL;
+        ignore_value(vsnprintf(entry->strs, sizeof(entry->strs), fmt, vargs));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nargs; i++) {
+        const char *str;
+        size_t len;
+
+        switch (types[i]) {
+        case VIR_LOG_RECORDER_ARG_INT:
+            entry->args[i].i = va_arg(vargs, int);
+            break;
+        case VIR_LOG_RECORDER_ARG_LONG:
+            entry->args[i].i = va_arg(vargs, long);
+            break;
+        case VIR_LOG_RECORDER_ARG_LLONG:
+            entry->args[i].i = va_arg(vargs, long long);
+            break;
+        case VIR_LOG_RECORDER_ARG_SIZE:
+            entry->args[i].i = va_arg(vargs, size_t);
+            break;
+        case VIR_LOG_RECORDER_ARG_DOUBLE:
+            entry->args[i].d = va_arg(vargs, double);
+            break;
+        case VIR_LOG_RECORDER_ARG_POINTER:
+            entry->args[i].p = va_arg(vargs, void *);
+            break;
+        case VIR_LOG_RECORDER_ARG_STRING:
+            if (!(str = va_arg(vargs, const char *))) {
+                entry->args[i].str = SIZE_MAX;
+                break;
+            }
+            /* strings which don't fit are truncated */
+            len = strnlen(str, sizeof(entry->strs));
+            if (len >= sizeof(entry->strs) - strpos)
+                len = sizeof(entry->strs) - strpos - 1;
+            memcpy(entry->strs + strpos, str, len);
+            entry->strs[strpos + len] = '\0';
+            entry->args[i].str = strpos;
+            strpos += len;
+            if (strpos < sizeof(entry->strs) - 1)
+                strpos++;
+            break;
+        }
+    }
+    entry->nargs = nargs;
+
+ cleanup:
+    virMutexUnlock(&ring->lock);
+}
+
+
+/* Formats the message of @entry the way virVasprintf would have */
+static void
+virLogRecorderFormatMessage(virBufferPtr buf,
+                            virLogRecorderEntryPtr entry)
+{
+    virLogRecorderArgType types[VIR_LOG_RECORDER_ARGS];
+    const char *p;
+    const char *start;
+    size_t n = 0;
+    char spec[32];
+
+    if (!entry->fmt) {
+        virBufferAdd(buf, entry->strs, -1);
+        return;
+    }
+
+    ignore_value(virLogRecorderParseFormat(entry->fmt, types));
+
+    for (start = p = entry->fmt; *p; p++) {
+        const char *conv;
+        size_t len;
+
+        if (*p != '%')
+            continue;
+
+        virBufferAdd(buf, start, p - start);
+
+        if (p[1] == '%') {
+            virBufferAddChar(buf, '%');
+            start = ++p + 1;
+            continue;
+        }
+
+        conv = p + 1 + strcspn(p + 1, "diuxXoceEfFgGaAps");
+        len = conv - p + 1;
+        start = conv + 1;
+
+        if (n >= entry->nargs || len >= sizeof(spec)) {
+            virBufferAdd(buf, p, len);
+            p = conv;
+            continue;
+        }
+
+        memcpy(spec, p, len);
+        spec[len] = '\0';
+
+        switch (types[n]) {
+        case VIR_LOG_RECORDER_ARG_INT:
+            virBufferAsprintf(buf, spec, (int) entry->args[n].i);
+            break;
+        case VIR_LOG_RECORDER_ARG_LONG:
+            virBufferAsprintf(buf, spec, (long) entry->args[n].i);
+            break;
+        case VIR_LOG_RECORDER_ARG_LLONG:
+            virBufferAsprintf(buf, spec, entry->args[n].i);
+            break;
+        case VIR_LOG_RECORDER_ARG_SIZE:
+            virBufferAsprintf(buf, spec, (size_t) entry->args[n].i);
+            break;
+        case VIR_LOG_RECORDER_ARG_DOUBLE:
+            virBufferAsprintf(buf, spec, entry->args[n].d);
+            break;
+        case VIR_LOG_RECORDER_ARG_POINTER:
+            virBufferAsprintf(buf, spec, entry->args[n].p);
+            break;
+        case VIR_LOG_RECORDER_ARG_STRING:
+            virBufferAsprintf(buf, spec,
+                              entry->args[n].str == SIZE_MAX ? NULL :
+                              entry->strs + entry->args[n].str);
+            break;
+        }
+
+        n++;
+        p = conv;
+    }
+
+    virBufferAdd(buf, start, -1);
+}
+
+
+typedef struct _virLogRecorderLine virLogRecorderLine;
+struct _virLogRecorderLine {
+    unsigned long long tid;
+    virLogRecorderEntry entry;
+};
+
+
+static int
+virLogRecorderLineCompare(const void *a,
+                          const void *b)
+{
+    const virLogRecorderLine *la = a;
+    const virLogRecorderLine *lb = b;
+
+    return (int) (la->entry.seq - lb->entry.seq);
+}
+
+
+/**
+ * virLogSetRecorderSize:
+ * @size: number of messages to keep per thread
+ *
+ * Sets up the flight recorder, which keeps the last @size messages
+ * emitted by each thread in memory regardless of the log filters and
+ * outputs. Passing 0 turns the recorder off.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetRecorderSize(size_t size)
+{
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virLogRecordersLock);
+    if (!virLogRecorderInitialized) {
+        if (virThreadLocalInit(&virLogRecorderKey,
+                               virLogRecorderRingFree) < 0) {
+            virMutexUnlock(&virLogRecordersLock);
+            virReportSystemError(errno, "%s",
+                                 _("unable to initialize log recorder"));
+            return -1;
+        }
+        virLogRecorderInitialized = true;
+    }
+    virLogRecorderSize = size;
+    virMutexUnlock(&virLogRecordersLock);
+
+    virLogLock();
+    virLogFiltersSerial++;
+    virLogUnlock();
+
+    return 0;
+}
+
+
+/*
+ * Formats the messages kept by the flight recorder, oldest first. The
+ * locks are skipped if @lock is false, which is only meant for the abort
+ * handler.
+ */
+static char *
+virLogRecorderFormat(bool lock)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virLogRecorderLine *lines = NULL;
+    size_t nlines = 0;
+    size_t maxlines = 0;
+    virLogRecorderRingPtr ring;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char *ret = NULL;
+    size_t i;
+
+    if (lock)
+        virMutexLock(&virLogRecordersLock);
+    for (ring = virLogRecorders; ring; ring = ring->next_ring) {
+        if (lock)
+            virMutexLock(&ring->lock);
+        if (ring->count &&
+            VIR_RESIZE_N_QUIET(lines, maxlines, nlines, ring->count) < 0) {
+            if (lock) {
+                virMutexUnlock(&ring->lock);
+                virMutexUnlock(&virLogRecordersLock);
+                virReportOOMError();
+            }
+            goto error;
+        }
+        for (i = 0; i < ring->count; i++) {
+            size_t idx = (ring->next + ring->size - ring->count + i) % ring->size;
+
+            lines[nlines].tid = ring->tid;
+            lines[nlines].entry = ring->entries[idx];
+            nlines++;
+        }
+        if (lock)
+            virMutexUnlock(&ring->lock);
+    }
+    if (lock)
+        virMutexUnlock(&virLogRecordersLock);
+
+    qsort(lines, nlines, sizeof(*lines), virLogRecorderLineCompare);
+
+    for (i = 0; i < nlines; i++) {
+        virLogRecorderEntryPtr entry = &lines[i].entry;
+
+        if (virTimeStringThenRaw(entry->when, timestamp) < 0)
+            timestamp[0] = '\0';
+
+        virBufferAsprintf(&buf, "%s: %llu: %s : ", timestamp, lines[i].tid,
+                          virLogPriorityString(entry->priority));
+        if (entry->funcname)
+            virBufferAsprintf(&buf, "%s:%d : ", entry->funcname, entry->linenr);
+        virLogRecorderFormatMessage(&buf, entry);
+        virBufferAddChar(&buf, '\n');
+    }
+
+    VIR_FREE(lines);
+
+    if (!nlines) {
+        ignore_value(VIR_STRDUP_QUIET(ret, ""));
+        return ret;
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+
+ error:
+    VIR_FREE(lines);
+    virBufferFreeAndReset(&buf);
+    return NULL;
+}
+
+
+/**
+ * virLogRecorderDump:
+ *
+ * Formats the messages kept by the flight recorder, oldest first, in
+ * the format used by the file outputs.
+ *
+ * Returns the messages, which the caller has to free, or NULL on error.
+ */
+char *
+virLogRecorderDump(void)
+{
+    char *ret;
+
+    if (!(ret = virLogRecorderFormat(true)))
+        virReportOOMError();
+
+    return ret;
+}
+
+
+static void
+virLogRecorderWrite(bool lock)
+{
+    char *dump;
+    size_t len;
+    size_t i;
+
+    if (!(dump = virLogRecorderFormat(lock)))
+        return;
+    len = strlen(dump);
+
+    if (virLogNbOutputs == 0)
+        ignore_value(safewrite(STDERR_FILENO, dump, len));
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (virLogOutputIsFd(virLogOutputs[i]) &&
+            !virLogOutputIsJSON(virLogOutputs[i]))
+            ignore_value(safewrite((intptr_t) virLogOutputs[i]->data,
+                                   dump, len));
+    }
+
+    VIR_FREE(dump);
+}
+
+
+/**
+ * virLogRecorderDumpToOutputs:
+ *
+ * Writes the messages kept by the flight recorder to the file and stderr
+ * log outputs.
+ */
+void
+virLogRecorderDumpToOutputs(void)
+{
+    virLogLock();
+    virLogDrainBuffers();
+    virLogRecorderWrite(true);
+    virLogUnlock();
+}
+
+
 /**
  * virLogMessage:
  * @source: where is that message coming from
@@ -567,7 +1786,6 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logInitMessageStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
@@ -575,6 +1793,7 @@ virLogVMessage(virLogSourcePtr source,
     size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
+    bool buffered = false;
 
     if (virLogInitialize() < 0)
         return;
@@ -590,6 +1809,14 @@ virLogVMessage(virLogSourcePtr source,
      * thread is updating log filter list concurrently
      * with a log message emission.
      */
+    if (virLogRecorderSize) {
+        va_list ap;
+
+        va_copy(ap, vargs);
+        virLogRecorderStore(priority, funcname, linenr, fmt, ap);
+        va_end(ap);
+    }
+
     if (source->serial < virLogFiltersSerial)
         virLogSourceUpdate(source);
     if (priority < source->priority)
@@ -609,6 +1836,31 @@ virLogVMessage(virLogSourcePtr source,
     if (virTimeStringNowRaw(timestamp) < 0)
         timestamp[0] = '\0';
 
+    /* Stack traces have to be taken by the emitting thread. The read of
+     * virLogNbSyncOutputs is racy in the same way as the ones above. */
+    if (virLogAsync && !(filterflags & VIR_LOG_STACK_TRACE)) {
+        char *json = NULL;
+        char *journal = NULL;
+        size_t journallen = 0;
+
+        if (virLogNbJSONOutputs)
+            json = virLogFormatJSON(source, priority, linenr, funcname,
+                                    timestamp, metadata, str);
+#if USE_JOURNALD
+        if (virLogNbJournaldOutputs)
+            journal = virLogFormatJournal(source, priority, filename, linenr,
+                                          funcname, metadata, str,
+                                          &journallen);
+#endif
+
+        if (virLogBufferMessage(priority, timestamp, msg,
+                                json, journal, journallen) == 0) {
+            if (virLogNbSyncOutputs == 0)
+                goto cleanup;
+            buffered = true;
+        }
+    }
+
     virLogLock();
 
     /*
@@ -616,24 +1868,13 @@ virLogVMessage(virLogSourcePtr source,
      * use stderr.
      */
     for (i = 0; i < virLogNbOutputs; i++) {
+        if (buffered && virLogOutputIsBuffered(virLogOutputs[i]))
+            continue;
+
         if (priority >= virLogOutputs[i]->priority) {
             if (virLogOutputs[i]->logInitMessage) {
-                const char *rawinitmsg;
-                char *hoststr = NULL;
-                char *initmsg = NULL;
-                if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawinitmsg, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(initmsg);
-                if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, hoststr, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(hoststr);
-                VIR_FREE(initmsg);
+                virLogOutputInitMessages(virLogOutputs[i]->f,
+                                         virLogOutputs[i]->data, timestamp);
                 virLogOutputs[i]->logInitMessage = false;
             }
             virLogOutputs[i]->f(source, priority,
@@ -642,25 +1883,11 @@ virLogVMessage(virLogSourcePtr source,
                                str, msg, virLogOutputs[i]->data);
         }
     }
-    if (virLogNbOutputs == 0) {
-        if (logInitMessageStderr) {
-            const char *rawinitmsg;
-            char *hoststr = NULL;
-            char *initmsg = NULL;
-            if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawinitmsg, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(initmsg);
-            if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, hoststr, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(hoststr);
-            VIR_FREE(initmsg);
-            logInitMessageStderr = false;
+    if (virLogNbOutputs == 0 && !buffered) {
+        if (virLogInitMessageStderr) {
+            virLogOutputInitMessages(virLogOutputToFd,
+                                     (void *) STDERR_FILENO, timestamp);
+            virLogInitMessageStderr = false;
         }
         virLogOutputToFd(source, priority,
                          filename, linenr, funcname,
@@ -726,6 +1953,126 @@ virLogOutputToFd(virLogSourcePtr source ATTRIBUTE_UNUSED,
 }
 
 
+/*
+ * Appends @str to @buf, escaped for use inside a JSON string
+ */
+static void
+virLogJSONEscape(virBufferPtr buf,
+                 const char *str)
+{
+    const char *start = str;
+    const char *p;
+
+    for (p = str; *p; p++) {
+        unsigned char c = *p;
+
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        virBufferAdd(buf, start, p - start);
+        start = p + 1;
+
+        switch (c) {
+        case '"':
+            virBufferAddLit(buf, "\\\"");
+            break;
+        case '\\':
+            virBufferAddLit(buf, "\\\\");
+            break;
+        case '\n':
+            virBufferAddLit(buf, "\\n");
+            break;
+        case '\t':
+            virBufferAddLit(buf, "\\t");
+            break;
+        default:
+            virBufferAsprintf(buf, "\\u%04x", c);
+            break;
+        }
+    }
+
+    virBufferAdd(buf, start, p - start);
+}
+
+
+/*
+ * Formats a message as a single line JSON object, for consumption by
+ * log collectors rather than by humans. The metadata, if any, is added
+ * as extra top level keys.
+ */
+static char *
+virLogFormatJSON(virLogSourcePtr source,
+                 virLogPriority priority,
+                 int linenr,
+                 const char *funcname,
+                 const char *timestamp,
+                 virLogMetadataPtr metadata,
+                 const char *rawstr)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAddLit(&buf, "{\"ts\":\"");
+    virLogJSONEscape(&buf, timestamp);
+    virBufferAsprintf(&buf, "\",\"tid\":%llu,\"level\":\"%s\",\"source\":\"",
+                      virThreadSelfID(), virLogPriorityString(priority));
+    virLogJSONEscape(&buf, source->name);
+    virBufferAddLit(&buf, "\",\"func\":\"");
+    virLogJSONEscape(&buf, funcname ? funcname : "");
+    virBufferAsprintf(&buf, "\",\"line\":%d,\"msg\":\"", linenr);
+    virLogJSONEscape(&buf, rawstr);
+    virBufferAddChar(&buf, '"');
+
+    for (; metadata && metadata->key; metadata++) {
+        virBufferAddLit(&buf, ",\"");
+        virLogJSONEscape(&buf, metadata->key);
+        if (metadata->s) {
+            virBufferAddLit(&buf, "\":\"");
+            virLogJSONEscape(&buf, metadata->s);
+            virBufferAddChar(&buf, '"');
+        } else {
+            virBufferAsprintf(&buf, "\":%d", metadata->iv);
+        }
+    }
+    virBufferAddLit(&buf, "}\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static void
+virLogOutputToJSON(virLogSourcePtr source,
+                   virLogPriority priority,
+                   const char *filename ATTRIBUTE_UNUSED,
+                   int linenr,
+                   const char *funcname,
+                   const char *timestamp,
+                   virLogMetadataPtr metadata,
+                   unsigned int flags ATTRIBUTE_UNUSED,
+                   const char *rawstr,
+                   const char *str ATTRIBUTE_UNUSED,
+                   void *data)
+{
+    int fd = (intptr_t) data;
+    char *msg;
+
+    if (fd < 0)
+        return;
+
+    /* Stack traces are left out, they would not be valid JSON */
+    if (!(msg = virLogFormatJSON(source, priority, linenr, funcname,
+                                 timestamp, metadata, rawstr)))
+        return;
+
+    ignore_value(safewrite(fd, msg, strlen(msg)));
+    VIR_FREE(msg);
+}
+
+
 static void
 virLogCloseFd(void *data)
 {
@@ -766,6 +2113,29 @@ virLogNewOutputToFile(virLogPriority priority,
 }
 
 
+static virLogOutputPtr
+virLogNewOutputToJSON(virLogPriority priority,
+                      const char *file)
+{
+    int fd;
+    virLogOutputPtr ret = NULL;
+
+    fd = open(file, O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        virReportSystemError(errno, _("failed to open %s"), file);
+        return NULL;
+    }
+
+    if (!(ret = virLogOutputNew(virLogOutputToJSON, virLogCloseFd,
+                                (void *)(intptr_t)fd,
+                                priority, VIR_LOG_TO_JSON, file))) {
+        VIR_LOG_CLOSE(fd);
+        return NULL;
+    }
+    return ret;
+}
+
+
 #if HAVE_SYSLOG_H || USE_JOURNALD
 
 /* Compat in case we build with journald, but no syslog */
@@ -889,6 +2259,10 @@ virLogNewOutputToSyslog(virLogPriority priority,
 /* Used for conversion of numbers to strings, and for length of binary data */
 #  define JOURNAL_BUF_SIZE (MAX(INT_BUFSIZE_BOUND(int), sizeof(uint64_t)))
 
+#  define NUM_FIELDS_CORE 6
+#  define NUM_FIELDS_META 5
+#  define NUM_FIELDS (NUM_FIELDS_CORE + NUM_FIELDS_META)
+
 struct journalState
 {
     struct iovec *iov, *iov_end;
@@ -950,81 +2324,132 @@ journalAddInt(struct journalState *state, const char *field, int value)
     state->iov += 4;
 }
 
-static void
-virLogOutputToJournald(virLogSourcePtr source,
-                       virLogPriority priority,
-                       const char *filename,
-                       int linenr,
-                       const char *funcname,
-                       const char *timestamp ATTRIBUTE_UNUSED,
-                       virLogMetadataPtr metadata,
-                       unsigned int flags,
-                       const char *rawstr,
-                       const char *str ATTRIBUTE_UNUSED,
-                       void *data)
+/*
+ * Fills @state with the fields of a message, in the native journal
+ * protocol. Returns the number of iovecs used.
+ */
+static size_t
+virLogJournalFill(struct journalState *state,
+                  virLogSourcePtr source,
+                  virLogPriority priority,
+                  const char *filename,
+                  int linenr,
+                  const char *funcname,
+                  virLogMetadataPtr metadata,
+                  const char *rawstr)
 {
-    virCheckFlags(VIR_LOG_STACK_TRACE,);
-    int buffd = -1;
-    int journalfd = (intptr_t) data;
-    struct msghdr mh;
-    struct sockaddr_un sa;
-    union {
-        struct cmsghdr cmsghdr;
-        uint8_t buf[CMSG_SPACE(sizeof(int))];
-    } control;
-    struct cmsghdr *cmsg;
-    /* We use /dev/shm instead of /tmp here, since we want this to
-     * be a tmpfs, and one that is available from early boot on
-     * and where unprivileged users can create files. */
-    char path[] = "/dev/shm/journal.XXXXXX";
+    struct iovec *start = state->iov;
     size_t nmetadata = 0;
 
-#  define NUM_FIELDS_CORE 6
-#  define NUM_FIELDS_META 5
-#  define NUM_FIELDS (NUM_FIELDS_CORE + NUM_FIELDS_META)
-    struct iovec iov[NUM_FIELDS * 5];
-    char iov_bufs[NUM_FIELDS][JOURNAL_BUF_SIZE];
-    struct journalState state;
-
-    state.iov = iov;
-    state.iov_end = iov + ARRAY_CARDINALITY(iov);
-    state.bufs = iov_bufs;
-    state.bufs_end = iov_bufs + ARRAY_CARDINALITY(iov_bufs);
-
-    journalAddString(&state, "MESSAGE", rawstr);
-    journalAddInt(&state, "PRIORITY",
+    journalAddString(state, "MESSAGE", rawstr);
+    journalAddInt(state, "PRIORITY",
                   virLogPrioritySyslog(priority));
-    journalAddInt(&state, "SYSLOG_FACILITY", LOG_DAEMON);
-    journalAddString(&state, "LIBVIRT_SOURCE", source->name);
+    journalAddInt(state, "SYSLOG_FACILITY", LOG_DAEMON);
+    journalAddString(state, "LIBVIRT_SOURCE", source->name);
     if (filename)
-        journalAddString(&state, "CODE_FILE", filename);
-    journalAddInt(&state, "CODE_LINE", linenr);
+        journalAddString(state, "CODE_FILE", filename);
+    journalAddInt(state, "CODE_LINE", linenr);
     if (funcname)
-        journalAddString(&state, "CODE_FUNC", funcname);
+        journalAddString(state, "CODE_FUNC", funcname);
     if (metadata != NULL) {
         while (metadata->key != NULL &&
                nmetadata < NUM_FIELDS_META) {
             if (metadata->s != NULL)
-                journalAddString(&state, metadata->key, metadata->s);
+                journalAddString(state, metadata->key, metadata->s);
             else
-                journalAddInt(&state, metadata->key, metadata->iv);
+                journalAddInt(state, metadata->key, metadata->iv);
             metadata++;
             nmetadata++;
         }
     }
 
-    memset(&sa, 0, sizeof(sa));
-    sa.sun_family = AF_UNIX;
-    if (!virStrcpy(sa.sun_path, "/run/systemd/journal/socket", sizeof(sa.sun_path)))
-        return;
+    return state->iov - start;
+}
+
+
+typedef struct _virLogJournal virLogJournal;
+typedef virLogJournal *virLogJournalPtr;
+struct _virLogJournal {
+    int fd;
+    /* Whether @fd is connected to the journal socket, which spares the
+     * kernel a path lookup for every message */
+    bool connected;
+    struct sockaddr_un sa;
+    socklen_t salen;
+};
+
+
+static void
+virLogJournalConnect(virLogJournalPtr journal)
+{
+    journal->connected = connect(journal->fd,
+                                 (struct sockaddr *) &journal->sa,
+                                 journal->salen) == 0;
+}
+
+
+static void
+virLogJournalSetAddress(virLogJournalPtr journal,
+                        struct msghdr *mh)
+{
+    if (journal->connected) {
+        mh->msg_name = NULL;
+        mh->msg_namelen = 0;
+    } else {
+        mh->msg_name = &journal->sa;
+        mh->msg_namelen = journal->salen;
+    }
+}
+
+
+static int
+virLogJournalSendMsg(virLogJournalPtr journal,
+                     struct msghdr *mh)
+{
+    int rc;
+
+    virLogJournalSetAddress(journal, mh);
+    if ((rc = sendmsg(journal->fd, mh, MSG_NOSIGNAL)) >= 0)
+        return rc;
+
+    /* The journal went away and was restarted since we connected */
+    if (journal->connected &&
+        (errno == ECONNREFUSED || errno == ENOTCONN)) {
+        virLogJournalConnect(journal);
+        virLogJournalSetAddress(journal, mh);
+        rc = sendmsg(journal->fd, mh, MSG_NOSIGNAL);
+    }
+
+    return rc;
+}
+
+
+/*
+ * Sends a single journal entry, passing it over as a file
+ * descriptor if it is too large for a datagram.
+ */
+static void
+virLogJournalSend(virLogJournalPtr journal,
+                  struct iovec *iov,
+                  size_t niov)
+{
+    int buffd = -1;
+    struct msghdr mh;
+    union {
+        struct cmsghdr cmsghdr;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    /* We use /dev/shm instead of /tmp here, since we want this to
+     * be a tmpfs, and one that is available from early boot on
+     * and where unprivileged users can create files. */
+    char path[] = "/dev/shm/journal.XXXXXX";
 
     memset(&mh, 0, sizeof(mh));
-    mh.msg_name = &sa;
-    mh.msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path);
     mh.msg_iov = iov;
-    mh.msg_iovlen = state.iov - iov;
+    mh.msg_iovlen = niov;
 
-    if (sendmsg(journalfd, &mh, MSG_NOSIGNAL) >= 0)
+    if (virLogJournalSendMsg(journal, &mh) >= 0)
         return;
 
     if (errno != EMSGSIZE && errno != ENOBUFS)
@@ -1046,7 +2471,7 @@ virLogOutputToJournald(virLogSourcePtr source,
     if (unlink(path) < 0)
         goto cleanup;
 
-    if (writev(buffd, iov, state.iov - iov) < 0)
+    if (writev(buffd, iov, niov) < 0)
         goto cleanup;
 
     mh.msg_iov = NULL;
@@ -1064,35 +2489,193 @@ virLogOutputToJournald(virLogSourcePtr source,
 
     mh.msg_controllen = cmsg->cmsg_len;
 
-    ignore_value(sendmsg(journalfd, &mh, MSG_NOSIGNAL));
+    ignore_value(virLogJournalSendMsg(journal, &mh));
 
  cleanup:
     VIR_LOG_CLOSE(buffd);
 }
 
 
+static void
+virLogOutputToJournald(virLogSourcePtr source,
+                       virLogPriority priority,
+                       const char *filename,
+                       int linenr,
+                       const char *funcname,
+                       const char *timestamp ATTRIBUTE_UNUSED,
+                       virLogMetadataPtr metadata,
+                       unsigned int flags,
+                       const char *rawstr,
+                       const char *str ATTRIBUTE_UNUSED,
+                       void *data)
+{
+    virCheckFlags(VIR_LOG_STACK_TRACE,);
+    struct iovec iov[NUM_FIELDS * 5];
+    char iov_bufs[NUM_FIELDS][JOURNAL_BUF_SIZE];
+    struct journalState state;
+    size_t niov;
+
+    state.iov = iov;
+    state.iov_end = iov + ARRAY_CARDINALITY(iov);
+    state.bufs = iov_bufs;
+    state.bufs_end = iov_bufs + ARRAY_CARDINALITY(iov_bufs);
+
+    niov = virLogJournalFill(&state, source, priority, filename, linenr,
+                             funcname, metadata, rawstr);
+
+    virLogJournalSend(data, iov, niov);
+}
+
+
+/*
+ * Serializes a message as a journal entry, so that it can be buffered
+ * and sent later on by virLogJournalSendRecords.
+ */
+static char *
+virLogFormatJournal(virLogSourcePtr source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    virLogMetadataPtr metadata,
+                    const char *rawstr,
+                    size_t *len)
+{
+    struct iovec iov[NUM_FIELDS * 5];
+    char iov_bufs[NUM_FIELDS][JOURNAL_BUF_SIZE];
+    struct journalState state;
+    size_t niov;
+    size_t i;
+    char *ret;
+    char *p;
+
+    state.iov = iov;
+    state.iov_end = iov + ARRAY_CARDINALITY(iov);
+    state.bufs = iov_bufs;
+    state.bufs_end = iov_bufs + ARRAY_CARDINALITY(iov_bufs);
+
+    niov = virLogJournalFill(&state, source, priority, filename, linenr,
+                             funcname, metadata, rawstr);
+
+    *len = 0;
+    for (i = 0; i < niov; i++)
+        *len += iov[i].iov_len;
+
+    if (VIR_ALLOC_N_QUIET(ret, *len) < 0)
+        return NULL;
+
+    for (p = ret, i = 0; i < niov; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Sends the buffered journal entries of @records with as few
+ * sendmmsg() calls as possible.
+ */
+static void
+virLogJournalSendRecords(virLogJournalPtr journal,
+                         virLogPriority priority,
+                         virLogRecordPtr records,
+                         size_t nrecords)
+{
+    struct mmsghdr msgs[64];
+    struct iovec iov[ARRAY_CARDINALITY(msgs)];
+    size_t nmsgs = 0;
+    size_t i;
+    size_t j;
+
+    memset(msgs, 0, sizeof(msgs));
+
+    for (i = 0; i <= nrecords; i++) {
+        size_t done = 0;
+
+        if (i < nrecords) {
+            if (records[i].priority < priority || !records[i].journal)
+                continue;
+
+            iov[nmsgs].iov_base = records[i].journal;
+            iov[nmsgs].iov_len = records[i].journallen;
+            msgs[nmsgs].msg_hdr.msg_iov = &iov[nmsgs];
+            msgs[nmsgs].msg_hdr.msg_iovlen = 1;
+            virLogJournalSetAddress(journal, &msgs[nmsgs].msg_hdr);
+            nmsgs++;
+        }
+
+        if (!nmsgs || (nmsgs < ARRAY_CARDINALITY(msgs) && i < nrecords))
+            continue;
+
+        while (done < nmsgs) {
+            int rc = sendmmsg(journal->fd, msgs + done, nmsgs - done,
+                              MSG_NOSIGNAL);
+
+            if (rc > 0) {
+                done += rc;
+                continue;
+            }
+
+            /* Let the single message path deal with whatever made the
+             * first entry fail, be it its size or a restarted journal */
+            virLogJournalSend(journal, &iov[done], 1);
+            for (j = ++done; j < nmsgs; j++)
+                virLogJournalSetAddress(journal, &msgs[j].msg_hdr);
+        }
+        nmsgs = 0;
+    }
+}
+
+
+static void
+virLogJournalFree(void *data)
+{
+    virLogJournalPtr journal = data;
+
+    VIR_LOG_CLOSE(journal->fd);
+    VIR_FREE(journal);
+}
+
+
 static virLogOutputPtr
 virLogNewOutputToJournald(int priority)
 {
-    int journalfd;
+    virLogJournalPtr journal;
     virLogOutputPtr ret = NULL;
 
-    if ((journalfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+    if (VIR_ALLOC(journal) < 0)
         return NULL;
 
-    if (virSetInherit(journalfd, false) < 0) {
-        VIR_LOG_CLOSE(journalfd);
+    if ((journal->fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        VIR_FREE(journal);
         return NULL;
     }
 
-    if (!(ret = virLogOutputNew(virLogOutputToJournald, virLogCloseFd,
-                                (void *)(intptr_t) journalfd, priority,
-                                VIR_LOG_TO_JOURNALD, NULL))) {
-        VIR_LOG_CLOSE(journalfd);
-        return NULL;
-    }
+    if (virSetInherit(journal->fd, false) < 0)
+        goto error;
+
+    journal->sa.sun_family = AF_UNIX;
+    if (!virStrcpy(journal->sa.sun_path, "/run/systemd/journal/socket",
+                   sizeof(journal->sa.sun_path)))
+        goto error;
+    journal->salen = offsetof(struct sockaddr_un, sun_path) +
+        strlen(journal->sa.sun_path);
+
+    /* Not fatal, the journal may just not be running yet */
+    virLogJournalConnect(journal);
+
+    if (!(ret = virLogOutputNew(virLogOutputToJournald, virLogJournalFree,
+                                journal, priority,
+                                VIR_LOG_TO_JOURNALD, NULL)))
+        goto error;
 
     return ret;
+
+ error:
+    virLogJournalFree(journal);
+    return NULL;
 }
 # endif /* USE_JOURNALD */
 
@@ -1190,6 +2773,7 @@ virLogGetOutputs(void)
         switch (dest) {
             case VIR_LOG_TO_SYSLOG:
             case VIR_LOG_TO_FILE:
+            case VIR_LOG_TO_JSON:
                 virBufferAsprintf(&outputbuf, "%d:%s:%s",
                                   virLogOutputs[i]->priority,
                                   virLogDestinationTypeToString(dest),
@@ -1337,7 +2921,8 @@ virLogOutputNew(virLogOutputFunc f,
     virLogOutputPtr ret = NULL;
     char *ndup = NULL;
 
-    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE) {
+    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE ||
+        dest == VIR_LOG_TO_JSON) {
         if (!name) {
             virReportError(VIR_ERR_INVALID_ARG, "%s",
                            _("Missing auxiliary data in output definition"));
@@ -1457,6 +3042,7 @@ virLogFindOutput(virLogOutputPtr *outputs, size_t noutputs,
 int
 virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
 {
+    size_t i;
 #if HAVE_SYSLOG_H
     int id;
     char *tmp = NULL;
@@ -1489,6 +3075,17 @@ virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
     virLogOutputs = outputs;
     virLogNbOutputs = noutputs;
 
+    virLogNbSyncOutputs = 0;
+    virLogNbJSONOutputs = 0;
+    for (i = 0; i < noutputs; i++) {
+        if (!virLogAsync || !virLogOutputIsBuffered(outputs[i]))
+            virLogNbSyncOutputs++;
+        if (virLogOutputIsJSON(outputs[i]))
+            virLogNbJSONOutputs++;
+        if (virLogOutputIsJournald(outputs[i]))
+            virLogNbJournaldOutputs++;
+    }
+
     virLogUnlock();
     return 0;
 }
@@ -1585,6 +3182,7 @@ virLogParseOutput(const char *src)
     if (((dest == VIR_LOG_TO_STDERR ||
           dest == VIR_LOG_TO_JOURNALD) && count != 2) ||
         ((dest == VIR_LOG_TO_FILE ||
+          dest == VIR_LOG_TO_JSON ||
           dest == VIR_LOG_TO_SYSLOG) && count != 3)) {
         virReportError(VIR_ERR_INVALID_ARG,
                        _("Output '%s' does not meet the format requirements "
@@ -1615,6 +3213,12 @@ virLogParseOutput(const char *src)
         ret = virLogNewOutputToFile(prio, abspath);
         VIR_FREE(abspath);
         break;
+    case VIR_LOG_TO_JSON:
+        if (virFileAbsPath(tokens[2], &abspath) < 0)
+            goto cleanup;
+        ret = virLogNewOutputToJSON(prio, abspath);
+        VIR_FREE(abspath);
+        break;
     case VIR_LOG_TO_JOURNALD:
 #if USE_JOURNALD
         ret = virLogNewOutputToJournald(prio);
@@ -55,6 +55,7 @@ typedef enum {
     VIR_LOG_TO_SYSLOG,
     VIR_LOG_TO_FILE,
     VIR_LOG_TO_JOURNALD,
+    VIR_LOG_TO_JSON,
     VIR_LOG_TO_OUTPUT_LAST,
 } virLogDestination;
 
@@ -64,10 +65,32 @@ typedef virLogSource *virLogSourcePtr;
 struct _virLogSource {
     const char *name;
     unsigned int priority;
+    unsigned int threshold;     /* lowest priority virLogMessage needs */
     unsigned int serial;
     unsigned int flags;
 };
 
+extern unsigned int virLogFiltersSerial;
+
+/**
+ * virLogSourceIsEnabled:
+ * @source: where the message is coming from
+ * @priority: the priority of the message
+ *
+ * Checked by the logging macros before the arguments of a message are
+ * evaluated, so that a disabled log call only costs a couple of well
+ * predicted branches. Once the filters change, the cached threshold of
+ * @source is stale and messages are let through until virLogMessage
+ * refreshes it.
+ */
+static inline bool
+virLogSourceIsEnabled(virLogSourcePtr source,
+                      virLogPriority priority)
+{
+    return priority >= source->threshold ||
+           source->serial < virLogFiltersSerial;
+}
+
 /*
  * ATTRIBUTE_UNUSED is to make gcc keep quiet if all the
  * log statements in a file are conditionally disabled
@@ -77,6 +100,7 @@ struct _virLogSource {
     static ATTRIBUTE_UNUSED virLogSource virLogSelf = { \
         .name = "" n "", \
         .priority = VIR_LOG_ERROR, \
+        .threshold = VIR_LOG_ERROR, \
         .serial = 0, \
         .flags = 0, \
     };
@@ -86,9 +110,16 @@ struct _virLogSource {
  * are printed to stderr for debugging or to an appropriate channel
  * defined at runtime from the libvirt daemon configuration file
  */
+# define VIR_LOG_INT(src, priority, filename, linenr, funcname, ...) \
+    do { \
+        if (virLogSourceIsEnabled(src, priority)) \
+            virLogMessage(src, priority, filename, linenr, funcname, \
+                          NULL, __VA_ARGS__); \
+    } while (0)
+
 # ifdef ENABLE_DEBUG
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_INT(src, VIR_LOG_DEBUG, filename, linenr, funcname, __VA_ARGS__)
 # else
 /**
  * virLogEatParams:
@@ -105,11 +136,11 @@ static inline void virLogEatParams(virLogSourcePtr unused, ...)
 # endif /* !ENABLE_DEBUG */
 
 # define VIR_INFO_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_INFO, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_INT(src, VIR_LOG_INFO, filename, linenr, funcname, __VA_ARGS__)
 # define VIR_WARN_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_WARN, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_INT(src, VIR_LOG_WARN, filename, linenr, funcname, __VA_ARGS__)
 # define VIR_ERROR_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_INT(src, VIR_LOG_ERROR, filename, linenr, funcname, __VA_ARGS__)
 
 # define VIR_DEBUG(...) \
     VIR_DEBUG_INT(&virLogSelf, __FILE__, __LINE__, __func__, __VA_ARGS__)
@@ -199,6 +230,11 @@ int virLogSetDefaultOutput(const char *fname, bool godaemon, bool privileged);
 void virLogLock(void);
 void virLogUnlock(void);
 int virLogReset(void);
+int virLogSetAsync(bool async, bool flushOnAbort);
+void virLogFlush(void);
+int virLogSetRecorderSize(size_t size);
+char *virLogRecorderDump(void);
+void virLogRecorderDumpToOutputs(void);
 int virLogParseDefaultPriority(const char *priority);
 int virLogPriorityFromSyslog(int priority);
 void virLogMessage(virLogSourcePtr source,
@@ -25,6 +25,7 @@
 
 #include "virnetdevbandwidth.h"
 #include "vircommand.h"
+#include "virbuffer.h"
 #include "viralloc.h"
 #include "virerror.h"
 #include "virstring.h"
@@ -43,9 +44,8 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
     VIR_FREE(def);
 }
 
-static void
-virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
-                                       const virNetDevBandwidthRate *rate)
+static unsigned long long
+virNetDevBandwidthOptimalQuantum(const virNetDevBandwidthRate *rate)
 {
     const unsigned long long mtu = 1500;
     unsigned long long r2q;
@@ -62,8 +62,53 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
     if (!r2q)
         r2q = 1;
 
+    return r2q;
+}
+
+static void
+virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
+                                       const virNetDevBandwidthRate *rate)
+{
     virCommandAddArg(cmd, "quantum");
-    virCommandAddArgFormat(cmd, "%llu", r2q);
+    virCommandAddArgFormat(cmd, "%llu", virNetDevBandwidthOptimalQuantum(rate));
+}
+
+/**
+ * virNetDevBandwidthRunBatch:
+ * @batch: tc commands, one per line, without the leading "tc"
+ * @force: keep going if a command fails
+ *
+ * Run all the commands in @batch with a single tc process, so that
+ * setting up QoS costs one fork instead of one per qdisc, class and
+ * filter. tc stops at the first command that fails, unless @force
+ * is set, in which case all commands are tried and their failures
+ * are ignored. This suits teardown, where some of the objects may
+ * not exist.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+static int
+virNetDevBandwidthRunBatch(virBufferPtr batch,
+                           bool force)
+{
+    virCommandPtr cmd = NULL;
+    int dummy; /* for ignoring the exit status */
+    int ret;
+
+    if (virBufferCheckError(batch) < 0)
+        return -1;
+
+    if (!virBufferUse(batch))
+        return 0;
+
+    if (force)
+        cmd = virCommandNewArgList(TC, "-force", "-batch", "-", NULL);
+    else
+        cmd = virCommandNewArgList(TC, "-batch", "-", NULL);
+    virCommandSetInputBuffer(cmd, virBufferCurrentContent(batch));
+    ret = virCommandRun(cmd, force ? &dummy : NULL);
+    virCommandFree(cmd);
+    return ret;
 }
 
 /**
@@ -200,7 +245,7 @@ virNetDevBandwidthSet(const char *ifname,
 {
     int ret = -1;
     virNetDevBandwidthRatePtr rx = NULL, tx = NULL; /* From domain POV */
-    virCommandPtr cmd = NULL;
+    virBuffer batch = VIR_BUFFER_INITIALIZER;
     char *average = NULL;
     char *peak = NULL;
     char *burst = NULL;
@@ -245,12 +290,9 @@ virNetDevBandwidthSet(const char *ifname,
             (virAsprintf(&burst, "%llukb", tx->burst) < 0))
             goto cleanup;
 
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname, "root",
-                             "handle", "1:", "htb", "default",
-                             hierarchical_class ? "2" : "1", NULL);
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        virBufferAsprintf(&batch,
+                          "qdisc add dev %s root handle 1: htb default %s\n",
+                          ifname, hierarchical_class ? "2" : "1");
 
         /* If we are creating a hierarchical class, all non guaranteed traffic
          * goes to the 1:2 class which will adjust 'rate' dynamically as NICs
@@ -316,49 +358,32 @@ virNetDevBandwidthSet(const char *ifname,
          * it before you dig into the code.
          */
         if (hierarchical_class) {
-            virCommandFree(cmd);
-            cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                                 "1:", "classid", "1:1", "htb", "rate", average,
-                                 "ceil", peak ? peak : average, NULL);
-            virNetDevBandwidthCmdAddOptimalQuantum(cmd, tx);
-            if (virCommandRun(cmd, NULL) < 0)
-                goto cleanup;
+            virBufferAsprintf(&batch,
+                              "class add dev %s parent 1: classid 1:1 htb "
+                              "rate %s ceil %s quantum %llu\n",
+                              ifname, average, peak ? peak : average,
+                              virNetDevBandwidthOptimalQuantum(tx));
         }
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:1" : "1:", "classid",
-                             hierarchical_class ? "1:2" : "1:1", "htb",
-                             "rate", average, NULL);
+        virBufferAsprintf(&batch,
+                          "class add dev %s parent %s classid %s htb rate %s",
+                          ifname, hierarchical_class ? "1:1" : "1:",
+                          hierarchical_class ? "1:2" : "1:1", average);
 
         if (peak)
-            virCommandAddArgList(cmd, "ceil", peak, NULL);
+            virBufferAsprintf(&batch, " ceil %s", peak);
         if (burst)
-            virCommandAddArgList(cmd, "burst", burst, NULL);
+            virBufferAsprintf(&batch, " burst %s", burst);
 
-        virNetDevBandwidthCmdAddOptimalQuantum(cmd, tx);
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:2" : "1:1",
-                             "handle", "2:", "sfq", "perturb",
-                             "10", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        virBufferAsprintf(&batch, " quantum %llu\n",
+                          virNetDevBandwidthOptimalQuantum(tx));
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "1:0", "protocol", "all", "prio", "1", "handle",
-                             "1", "fw", "flowid", "1", NULL);
+        virBufferAsprintf(&batch,
+                          "qdisc add dev %s parent %s handle 2: sfq perturb 10\n",
+                          ifname, hierarchical_class ? "1:2" : "1:1");
 
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        virBufferAsprintf(&batch,
+                          "filter add dev %s parent 1:0 protocol all prio 1 "
+                          "handle 1 fw flowid 1\n", ifname);
 
         VIR_FREE(average);
         VIR_FREE(peak);
@@ -371,31 +396,23 @@ virNetDevBandwidthSet(const char *ifname,
         if (virAsprintf(&burst, "%llukb", rx->burst ? rx->burst : rx->average) < 0)
             goto cleanup;
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname,
-                                 "ingress", NULL);
+        virBufferAsprintf(&batch, "qdisc add dev %s ingress\n", ifname);
 
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
         /* Set filter to match all ingress traffic */
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "ffff:", "protocol", "all", "u32", "match", "u32",
-                             "0", "0", "police", "rate", average,
-                             "burst", burst, "mtu", "64kb", "drop", "flowid",
-                             ":1", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        virBufferAsprintf(&batch,
+                          "filter add dev %s parent ffff: protocol all "
+                          "u32 match u32 0 0 police rate %s burst %s "
+                          "mtu 64kb drop flowid :1\n",
+                          ifname, average, burst);
     }
 
+    if (virNetDevBandwidthRunBatch(&batch, false) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
-    virCommandFree(cmd);
+    virBufferFreeAndReset(&batch);
     VIR_FREE(average);
     VIR_FREE(peak);
     VIR_FREE(burst);
@@ -415,29 +432,17 @@ virNetDevBandwidthSet(const char *ifname,
 int
 virNetDevBandwidthClear(const char *ifname)
 {
-    int ret = 0;
-    int dummy; /* for ignoring the exit status */
-    virCommandPtr cmd = NULL;
+    virBuffer batch = VIR_BUFFER_INITIALIZER;
+    int ret;
 
     if (!ifname)
        return 0;
 
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", ifname, "root", NULL);
-
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
-
-    virCommandFree(cmd);
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc",  "del", "dev", ifname, "ingress", NULL);
-
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
-
-    virCommandFree(cmd);
+    virBufferAsprintf(&batch, "qdisc del dev %s root\n", ifname);
+    virBufferAsprintf(&batch, "qdisc del dev %s ingress\n", ifname);
 
+    ret = virNetDevBandwidthRunBatch(&batch, true);
+    virBufferFreeAndReset(&batch);
     return ret;
 }
 
@@ -557,7 +562,7 @@ virNetDevBandwidthPlug(const char *brname,
                        unsigned int id)
 {
     int ret = -1;
-    virCommandPtr cmd = NULL;
+    virBuffer batch = VIR_BUFFER_INITIALIZER;
     char *class_id = NULL;
     char *qdisc_id = NULL;
     char *floor = NULL;
@@ -587,22 +592,16 @@ virNetDevBandwidthPlug(const char *brname,
                     net_bandwidth->in->average) < 0)
         goto cleanup;
 
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "add", "dev", brname, "parent", "1:1",
-                         "classid", class_id, "htb", "rate", floor,
-                         "ceil", ceil, NULL);
-    virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
+    virBufferAsprintf(&batch,
+                      "class add dev %s parent 1:1 classid %s htb "
+                      "rate %s ceil %s quantum %llu\n",
+                      brname, class_id, floor, ceil,
+                      virNetDevBandwidthOptimalQuantum(bandwidth->in));
+    virBufferAsprintf(&batch,
+                      "qdisc add dev %s parent %s handle %s sfq perturb 10\n",
+                      brname, class_id, qdisc_id);
 
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "add", "dev", brname, "parent",
-                         class_id, "handle", qdisc_id, "sfq", "perturb",
-                         "10", NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
+    if (virNetDevBandwidthRunBatch(&batch, false) < 0)
         goto cleanup;
 
     if (virNetDevBandwidthManipulateFilter(brname, ifmac_ptr, id,
@@ -616,7 +615,7 @@ virNetDevBandwidthPlug(const char *brname,
     VIR_FREE(floor);
     VIR_FREE(qdisc_id);
     VIR_FREE(class_id);
-    virCommandFree(cmd);
+    virBufferFreeAndReset(&batch);
     return ret;
 }
 
@@ -633,48 +632,24 @@ int
 virNetDevBandwidthUnplug(const char *brname,
                          unsigned int id)
 {
-    int ret = -1;
-    int cmd_ret = 0;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *qdisc_id = NULL;
+    virBuffer batch = VIR_BUFFER_INITIALIZER;
+    int ret;
 
     if (id <= 2) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
         return -1;
     }
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&qdisc_id, "%x:", id) < 0)
-        goto cleanup;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", brname,
-                         "handle", qdisc_id, NULL);
-
     /* Don't threat tc errors as fatal, but
      * try to remove as much as possible */
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    if (virNetDevBandwidthManipulateFilter(brname, NULL, id,
-                                           NULL, true, false) < 0)
-        goto cleanup;
-
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "del", "dev", brname,
-                         "classid", class_id, NULL);
-
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    ret = 0;
+    virBufferAsprintf(&batch, "qdisc del dev %s handle %x:\n", brname, id);
+    /* u32 filters must have 800:: prefix. Don't ask. */
+    virBufferAsprintf(&batch, "filter del dev %s prio 2 handle 800::%u u32\n",
+                      brname, id);
+    virBufferAsprintf(&batch, "class del dev %s classid 1:%x\n", brname, id);
 
- cleanup:
-    VIR_FREE(qdisc_id);
-    VIR_FREE(class_id);
-    virCommandFree(cmd);
+    ret = virNetDevBandwidthRunBatch(&batch, true);
+    virBufferFreeAndReset(&batch);
     return ret;
 }
 
@@ -339,15 +339,34 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
                                    virDomainInterfaceStatsPtr stats)
 {
     virCommandPtr cmd = NULL;
-    char *output;
-    char *tmp;
+    char *output = NULL;
+    char *start;
+    char *end;
+    char **entries = NULL;
     bool gotStats = false;
+    size_t i, j;
     int ret = -1;
-
-    /* Just ensure the interface exists in ovs */
+    /* The TX/RX fields appear to be swapped here
+     * because this is the host view. */
+    struct {
+        const char *name;
+        long long *member;
+    } fields[] = {
+        { "rx_bytes", &stats->tx_bytes },
+        { "rx_packets", &stats->tx_packets },
+        { "rx_errors", &stats->tx_errs },
+        { "rx_dropped", &stats->tx_drop },
+        { "tx_bytes", &stats->rx_bytes },
+        { "tx_packets", &stats->rx_packets },
+        { "tx_errors", &stats->rx_errs },
+        { "tx_dropped", &stats->rx_drop },
+    };
+
+    /* Fetch the whole statistics map at once; this also fails if the
+     * interface doesn't exist in ovs */
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
-    virCommandAddArgList(cmd, "get", "Interface", ifname, "name", NULL);
+    virCommandAddArgList(cmd, "get", "Interface", ifname, "statistics", NULL);
     virCommandSetOutputBuffer(cmd, &output);
 
     if (virCommandRun(cmd, NULL) < 0) {
@@ -357,38 +376,44 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
         goto cleanup;
     }
 
-#define GET_STAT(name, member) \
-    do { \
-        VIR_FREE(output); \
-        virCommandFree(cmd); \
-        cmd = virCommandNew(OVSVSCTL); \
-        virNetDevOpenvswitchAddTimeout(cmd); \
-        virCommandAddArgList(cmd, "get", "Interface", ifname, \
-                             "statistics:" name, NULL); \
-        virCommandSetOutputBuffer(cmd, &output); \
-        if (virCommandRun(cmd, NULL) < 0) { \
-            stats->member = -1; \
-        } else { \
-            if (virStrToLong_ll(output, &tmp, 10, &stats->member) < 0 || \
-                *tmp != '\n') { \
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s", \
-                               _("Fail to parse ovs-vsctl output")); \
-                goto cleanup; \
-            } \
-            gotStats = true; \
-        } \
-    } while (0)
+    /* The map looks like "{collisions=0, rx_bytes=1024, ...}" */
+    if (!output ||
+        !(start = strchr(output, '{')) ||
+        !(end = strrchr(start, '}'))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Fail to parse ovs-vsctl output"));
+        goto cleanup;
+    }
+    *end = '\0';
+
+    if (!(entries = virStringSplit(start + 1, ",", 0)))
+        goto cleanup;
 
-    /* The TX/RX fields appear to be swapped here
-     * because this is the host view. */
-    GET_STAT("rx_bytes", tx_bytes);
-    GET_STAT("rx_packets", tx_packets);
-    GET_STAT("rx_errors", tx_errs);
-    GET_STAT("rx_dropped", tx_drop);
-    GET_STAT("tx_bytes", rx_bytes);
-    GET_STAT("tx_packets", rx_packets);
-    GET_STAT("tx_errors", rx_errs);
-    GET_STAT("tx_dropped", rx_drop);
+    for (j = 0; j < ARRAY_CARDINALITY(fields); j++)
+        *fields[j].member = -1;
+
+    for (i = 0; entries[i]; i++) {
+        char *key = entries[i];
+        char *value;
+
+        virSkipSpaces((const char **) &key);
+        if (!(value = strchr(key, '=')))
+            continue;
+        *value++ = '\0';
+
+        for (j = 0; j < ARRAY_CARDINALITY(fields); j++) {
+            if (STRNEQ(key, fields[j].name))
+                continue;
+
+            if (virStrToLong_ll(value, NULL, 10, fields[j].member) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Fail to parse ovs-vsctl output"));
+                goto cleanup;
+            }
+            gotStats = true;
+            break;
+        }
+    }
 
     if (!gotStats) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -399,6 +424,7 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
     ret = 0;
 
  cleanup:
+    virStringListFree(entries);
     VIR_FREE(output);
     virCommandFree(cmd);
     return ret;
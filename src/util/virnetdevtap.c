@@ -33,6 +33,8 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virnetlink.h"
+#include "virhash.h"
 #include "datatypes.h"
 
 #include <stdlib.h>
@@ -53,6 +55,9 @@
 #if defined(HAVE_GETIFADDRS) && defined(AF_LINK)
 # include <ifaddrs.h>
 #endif
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/if_link.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -846,3 +851,163 @@ virNetDevTapInterfaceStats(const char *ifname ATTRIBUTE_UNUSED,
 }
 
 #endif /* __linux__ */
+
+
+/**
+ * virNetDevTapInterfaceStatsSwap:
+ * @host: statistics of an interface as seen from the host
+ * @stats: where to store statistics
+ * @swapped: whether to swap RX/TX fields
+ */
+static void
+virNetDevTapInterfaceStatsSwap(const virDomainInterfaceStatsStruct *host,
+                               virDomainInterfaceStatsPtr stats,
+                               bool swapped)
+{
+    if (!swapped) {
+        *stats = *host;
+        return;
+    }
+
+    stats->rx_bytes = host->tx_bytes;
+    stats->rx_packets = host->tx_packets;
+    stats->rx_errs = host->tx_errs;
+    stats->rx_drop = host->tx_drop;
+    stats->tx_bytes = host->rx_bytes;
+    stats->tx_packets = host->rx_packets;
+    stats->tx_errs = host->rx_errs;
+    stats->tx_drop = host->rx_drop;
+}
+
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+static int
+virNetDevTapInterfaceStatsAllCallback(const struct nlmsghdr *resp,
+                                      void *opaque)
+{
+    virHashTablePtr table = opaque;
+    struct nlattr *tb[IFLA_MAX + 1] = {NULL, };
+    struct rtnl_link_stats64 *link;
+    virDomainInterfaceStatsPtr stats = NULL;
+
+    /* Ignore messages other than link ones */
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse((struct nlmsghdr *)resp, sizeof(struct ifinfomsg),
+                    tb, IFLA_MAX, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed netlink response message"));
+        return -1;
+    }
+
+    if (!tb[IFLA_IFNAME] || !tb[IFLA_STATS64] ||
+        nla_len(tb[IFLA_STATS64]) < sizeof(*link))
+        return 0;
+
+    link = nla_data(tb[IFLA_STATS64]);
+
+    if (VIR_ALLOC(stats) < 0)
+        return -1;
+
+    stats->rx_bytes = link->rx_bytes;
+    stats->rx_packets = link->rx_packets;
+    stats->rx_errs = link->rx_errors;
+    stats->rx_drop = link->rx_dropped;
+    stats->tx_bytes = link->tx_bytes;
+    stats->tx_packets = link->tx_packets;
+    stats->tx_errs = link->tx_errors;
+    stats->tx_drop = link->tx_dropped;
+
+    if (virHashUpdateEntry(table, nla_data(tb[IFLA_IFNAME]), stats) < 0) {
+        VIR_FREE(stats);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetDevTapInterfaceStatsAll:
+ *
+ * Fetch RX/TX statistics of all host interfaces with a single netlink
+ * dump. This is meant for callers which need the statistics of many
+ * interfaces at once, see virNetDevTapInterfaceStatsLookup.
+ *
+ * Returns a hash table of virDomainInterfaceStats keyed by interface
+ * name, as seen from the host, or NULL on error.
+ */
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    struct nl_msg *nlmsg = NULL;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    virHashTablePtr table = NULL;
+    virHashTablePtr ret = NULL;
+
+    if (!(table = virHashCreate(0, virHashValueFree)))
+        return NULL;
+
+    if (!(nlmsg = nlmsg_alloc_simple(RTM_GETLINK,
+                                     NLM_F_REQUEST | NLM_F_DUMP))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (nlmsg_append(nlmsg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    if (virNetlinkDumpCommand(nlmsg, virNetDevTapInterfaceStatsAllCallback,
+                              0, 0, NETLINK_ROUTE, 0, table) < 0)
+        goto cleanup;
+
+    ret = table;
+    table = NULL;
+
+ cleanup:
+    nlmsg_free(nlmsg);
+    virHashFree(table);
+    return ret;
+}
+#else
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("bulk interface stats not implemented on this platform"));
+    return NULL;
+}
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
+
+
+/**
+ * virNetDevTapInterfaceStatsLookup:
+ * @all: result of virNetDevTapInterfaceStatsAll, or NULL
+ * @ifname: interface
+ * @stats: where to store statistics
+ * @swapped: whether to swap RX/TX fields
+ *
+ * Like virNetDevTapInterfaceStats, but take the statistics from @all
+ * if it has them. Interfaces missing from @all, e.g. because they were
+ * created after it had been fetched, are queried directly.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virNetDevTapInterfaceStatsLookup(virHashTablePtr all,
+                                 const char *ifname,
+                                 virDomainInterfaceStatsPtr stats,
+                                 bool swapped)
+{
+    virDomainInterfaceStatsPtr host;
+
+    if (!all || !(host = virHashLookup(all, ifname)))
+        return virNetDevTapInterfaceStats(ifname, stats, swapped);
+
+    virNetDevTapInterfaceStatsSwap(host, stats, swapped);
+    return 0;
+}
@@ -27,6 +27,7 @@
 # include "virnetdev.h"
 # include "virnetdevvportprofile.h"
 # include "virnetdevvlan.h"
+# include "virhash.h"
 
 # ifdef __FreeBSD__
 /* This should be defined on OSes that don't automatically
@@ -96,4 +97,12 @@ int virNetDevTapInterfaceStats(const char *ifname,
                                bool swapped)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+virHashTablePtr virNetDevTapInterfaceStatsAll(void);
+
+int virNetDevTapInterfaceStatsLookup(virHashTablePtr all,
+                                     const char *ifname,
+                                     virDomainInterfaceStatsPtr stats,
+                                     bool swapped)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 #endif /* __VIR_NETDEV_TAP_H__ */
@@ -45,6 +45,7 @@
 #include "virbitmap.h"
 #include "virstring.h"
 #include "virfile.h"
+#include "virhostcpu.h"
 #include "virhostmem.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -53,9 +54,9 @@ VIR_LOG_INIT("util.numa");
 
 
 #if HAVE_NUMAD
-char *
-virNumaGetAutoPlacementAdvice(unsigned short vcpus,
-                              unsigned long long balloon)
+static char *
+virNumaGetAutoPlacementAdviceNumad(unsigned short vcpus,
+                                   unsigned long long balloon)
 {
     virCommandPtr cmd = NULL;
     char *output = NULL;
@@ -74,16 +75,253 @@ virNumaGetAutoPlacementAdvice(unsigned short vcpus,
     virCommandFree(cmd);
     return output;
 }
-#else /* !HAVE_NUMAD */
+#endif /* HAVE_NUMAD */
+
+
+/* How long the CPU load of the host is sampled for the built-in placement */
+#define VIR_NUMA_PLACEMENT_SAMPLE_USEC (100 * 1000)
+
+typedef struct _virNumaPlacementNode virNumaPlacementNode;
+typedef virNumaPlacementNode *virNumaPlacementNodePtr;
+struct _virNumaPlacementNode {
+    int node;
+    virBitmapPtr cpus;
+    unsigned long long memfree; /* in KiB */
+    unsigned long long idle;    /* idle time of all CPUs of the node */
+    unsigned long long total;   /* total time of all CPUs of the node */
+    double idlecpus;            /* average number of idle CPUs */
+    bool used;
+};
+
+
+/* Sum the idle and total time of all the CPUs in @cpus */
+static int
+virNumaGetCPUTimes(virBitmapPtr cpus,
+                   unsigned long long *idle,
+                   unsigned long long *total)
+{
+    virNodeCPUStats params[4];
+    int nparams = ARRAY_CARDINALITY(params);
+    ssize_t cpu = -1;
+    size_t i;
+
+    *idle = 0;
+    *total = 0;
+
+    while ((cpu = virBitmapNextSetBit(cpus, cpu)) >= 0) {
+        if (virHostCPUGetStats(cpu, params, &nparams, 0) < 0)
+            return -1;
+
+        for (i = 0; i < nparams; i++) {
+            if (STREQ(params[i].field, VIR_NODE_CPU_STATS_IDLE) ||
+                STREQ(params[i].field, VIR_NODE_CPU_STATS_IOWAIT))
+                *idle += params[i].value;
+            *total += params[i].value;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Returns the fraction of the demand the node @n can satisfy on its own */
+static double
+virNumaPlacementNodeScore(virNumaPlacementNodePtr n,
+                          unsigned short vcpus,
+                          unsigned long long balloon)
+{
+    double mem = balloon ? (double) n->memfree / balloon : 1;
+    double cpu = vcpus ? n->idlecpus / vcpus : 1;
+
+    return mem < cpu ? mem : cpu;
+}
+
+
+/**
+ * virNumaGetAutoPlacementAdviceBuiltin:
+ * @vcpus: number of vCPUs of the domain
+ * @balloon: memory of the domain in KiB
+ * @hugepage_size: size of the huge pages backing the memory in KiB, or 0
+ *
+ * Pick the nodes for a domain from the free memory (or free huge pages) and
+ * the idle CPU time of each host node.  A single node able to hold the whole
+ * domain is preferred, otherwise the closest nodes are added until the
+ * domain fits.
+ *
+ * Returns the nodeset formatted as a string, or NULL on error.
+ */
+static char *
+virNumaGetAutoPlacementAdviceBuiltin(unsigned short vcpus,
+                                     unsigned long long balloon,
+                                     unsigned int hugepage_size)
+{
+    virNumaPlacementNodePtr nodes = NULL;
+    virNumaPlacementNodePtr best = NULL;
+    virBitmapPtr nodeset = NULL;
+    int *distances = NULL;
+    int ndistances = 0;
+    unsigned long long memfree = 0;
+    double idlecpus = 0;
+    size_t nnodes = 0;
+    size_t i;
+    int maxnode;
+    char *ret = NULL;
+
+    if (!virNumaIsAvailable()) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("NUMA isn't available on this host"));
+        return NULL;
+    }
+
+    if ((maxnode = virNumaGetMaxNode()) < 0)
+        return NULL;
+
+    for (i = 0; i <= maxnode; i++) {
+        virNumaPlacementNode n = { .node = i };
+
+        if (!virNumaNodeIsAvailable(i))
+            continue;
+
+        if (hugepage_size) {
+            unsigned int page_avail;
+            unsigned int page_free;
+
+            if (virNumaGetPageInfo(i, hugepage_size, 0,
+                                   &page_avail, &page_free) < 0)
+                goto cleanup;
+
+            n.memfree = (unsigned long long) page_free * hugepage_size;
+        } else {
+            if (virNumaGetNodeMemory(i, NULL, &n.memfree) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to get free memory of NUMA node %zu"),
+                               i);
+                goto cleanup;
+            }
+            n.memfree /= 1024;
+        }
+
+        if (virNumaGetNodeCPUs(i, &n.cpus) < 0 ||
+            virNumaGetCPUTimes(n.cpus, &n.idle, &n.total) < 0 ||
+            VIR_APPEND_ELEMENT(nodes, nnodes, n) < 0) {
+            virBitmapFree(n.cpus);
+            goto cleanup;
+        }
+    }
+
+    if (nnodes == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("No usable NUMA node found"));
+        goto cleanup;
+    }
+
+    usleep(VIR_NUMA_PLACEMENT_SAMPLE_USEC);
+
+    for (i = 0; i < nnodes; i++) {
+        virNumaPlacementNodePtr n = &nodes[i];
+        unsigned long long idle;
+        unsigned long long total;
+
+        if (virNumaGetCPUTimes(n->cpus, &idle, &total) < 0)
+            goto cleanup;
+
+        if (total > n->total)
+            n->idlecpus = virBitmapCountBits(n->cpus) *
+                (double) (idle - n->idle) / (total - n->total);
+
+        VIR_DEBUG("NUMA node %d: free memory %llu KiB, idle CPUs %.2f",
+                  n->node, n->memfree, n->idlecpus);
+
+        /* nodes without memory can only complement others */
+        if (n->memfree &&
+            (!best ||
+             virNumaPlacementNodeScore(n, vcpus, balloon) >
+             virNumaPlacementNodeScore(best, vcpus, balloon)))
+            best = n;
+    }
+
+    if (!best)
+        best = &nodes[0];
+
+    if (virNumaGetDistances(best->node, &distances, &ndistances) < 0 ||
+        !(nodeset = virBitmapNew(maxnode + 1)))
+        goto cleanup;
+
+    /* Grow the nodeset by the nearest node until the domain fits */
+    while (best) {
+        virNumaPlacementNodePtr next = NULL;
+
+        best->used = true;
+        ignore_value(virBitmapSetBit(nodeset, best->node));
+        memfree += best->memfree;
+        idlecpus += best->idlecpus;
+
+        if (memfree >= balloon && idlecpus >= vcpus)
+            break;
+
+        for (i = 0; i < nnodes; i++) {
+            virNumaPlacementNodePtr n = &nodes[i];
+            int dist = n->node < ndistances ? distances[n->node] : 0;
+            int nextdist;
+
+            if (n->used)
+                continue;
+
+            if (!next) {
+                next = n;
+                continue;
+            }
+
+            nextdist = next->node < ndistances ? distances[next->node] : 0;
+            if (dist < nextdist ||
+                (dist == nextdist &&
+                 virNumaPlacementNodeScore(n, vcpus, balloon) >
+                 virNumaPlacementNodeScore(next, vcpus, balloon)))
+                next = n;
+        }
+
+        best = next;
+    }
+
+    ret = virBitmapFormat(nodeset);
+
+ cleanup:
+    for (i = 0; i < nnodes; i++)
+        virBitmapFree(nodes[i].cpus);
+    VIR_FREE(nodes);
+    VIR_FREE(distances);
+    virBitmapFree(nodeset);
+    return ret;
+}
+
+
+/**
+ * virNumaGetAutoPlacementAdvice:
+ * @vcpus: number of vCPUs of the domain
+ * @balloon: memory of the domain in KiB
+ * @hugepage_size: size of the huge pages backing the memory in KiB, or 0
+ *
+ * Get the advisory nodeset for a domain with placement 'auto'.  numad is
+ * queried when it is installed, otherwise a built-in placement based on the
+ * current free memory and CPU load of the host nodes is used.
+ *
+ * Returns the nodeset formatted as a string, or NULL on error.
+ */
 char *
-virNumaGetAutoPlacementAdvice(unsigned short vcpus ATTRIBUTE_UNUSED,
-                              unsigned long long balloon ATTRIBUTE_UNUSED)
+virNumaGetAutoPlacementAdvice(unsigned short vcpus,
+                              unsigned long long balloon,
+                              unsigned int hugepage_size)
 {
-    virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
-                   _("numad is not available on this host"));
-    return NULL;
+#if HAVE_NUMAD
+    if (virFileIsExecutable(NUMAD))
+        return virNumaGetAutoPlacementAdviceNumad(vcpus, balloon);
+
+    VIR_DEBUG("%s is not available, using built-in placement", NUMAD);
+#endif
+
+    return virNumaGetAutoPlacementAdviceBuiltin(vcpus, balloon,
+                                                hugepage_size);
 }
-#endif /* !HAVE_NUMAD */
 
 #if WITH_NUMACTL
 int
@@ -28,7 +28,8 @@
 
 
 char *virNumaGetAutoPlacementAdvice(unsigned short vcups,
-                                    unsigned long long balloon);
+                                    unsigned long long balloon,
+                                    unsigned int hugepage_size);
 
 int virNumaSetupMemoryPolicy(virDomainNumatuneMemMode mode,
                              virBitmapPtr nodeset);
@@ -30,6 +30,7 @@
 #include "virlog.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -37,16 +38,31 @@ VIR_LOG_INIT("util.object");
 
 static unsigned int magicCounter = 0xCAFE0000;
 
+enum {
+    VIR_CLASS_LOCKABLE = (1 << 0),
+    VIR_CLASS_RWLOCKABLE = (1 << 1),
+};
+
 struct _virClass {
     virClassPtr parent;
+    virClassPtr next;
 
     unsigned int magic;
+    unsigned int flags; /* VIR_CLASS_* inherited from the parent */
     char *name;
     size_t objectSize;
 
     virObjectDisposeCallback dispose;
+
+    /* Lock contention statistics of instances, accessed via virAtomic */
+    unsigned long long contended;
+    unsigned long long waited;
 };
 
+/* All classes ever registered, which are never freed */
+static virMutex classListLock;
+static virClassPtr classList;
+
 #define VIR_OBJECT_NOTVALID(obj) (!obj || ((obj->u.s.magic & 0xFFFF0000) != 0xCAFE0000))
 
 #define VIR_OBJECT_USAGE_PRINT_WARNING(anyobj, objclass) \
@@ -75,6 +91,12 @@ static void virObjectRWLockableDispose(void *anyobj);
 static int
 virObjectOnceInit(void)
 {
+    if (virMutexInit(&classListLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
     if (!(virObjectClass = virClassNew(NULL,
                                        "virObject",
                                        sizeof(virObject),
@@ -93,6 +115,11 @@ virObjectOnceInit(void)
                                                  virObjectRWLockableDispose)))
         return -1;
 
+    /* Classes derived from these inherit the flags in virClassNew, so
+     * that locking does not need to walk the chain of parents */
+    virObjectLockableClass->flags |= VIR_CLASS_LOCKABLE;
+    virObjectRWLockableClass->flags |= VIR_CLASS_RWLOCKABLE;
+
     return 0;
 }
 
@@ -194,6 +221,13 @@ virClassNew(virClassPtr parent,
         goto error;
     klass->objectSize = objectSize;
     klass->dispose = dispose;
+    if (parent)
+        klass->flags = parent->flags;
+
+    virMutexLock(&classListLock);
+    klass->next = classList;
+    classList = klass;
+    virMutexUnlock(&classListLock);
 
     return klass;
 
@@ -390,10 +424,20 @@ virObjectRef(void *anyobj)
 }
 
 
+static inline bool
+virObjectHasClassFlag(void *anyobj,
+                      unsigned int flag)
+{
+    virObjectPtr obj = anyobj;
+
+    return !VIR_OBJECT_NOTVALID(obj) && (obj->klass->flags & flag);
+}
+
+
 static virObjectLockablePtr
 virObjectGetLockableObj(void *anyobj)
 {
-    if (virObjectIsClass(anyobj, virObjectLockableClass))
+    if (virObjectHasClassFlag(anyobj, VIR_CLASS_LOCKABLE))
         return anyobj;
 
     VIR_OBJECT_USAGE_PRINT_WARNING(anyobj, virObjectLockable);
@@ -404,7 +448,7 @@ virObjectGetLockableObj(void *anyobj)
 static virObjectRWLockablePtr
 virObjectGetRWLockableObj(void *anyobj)
 {
-    if (virObjectIsClass(anyobj, virObjectRWLockableClass))
+    if (virObjectHasClassFlag(anyobj, VIR_CLASS_RWLOCKABLE))
         return anyobj;
 
     VIR_OBJECT_USAGE_PRINT_WARNING(anyobj, virObjectRWLockable);
@@ -412,12 +456,32 @@ virObjectGetRWLockableObj(void *anyobj)
 }
 
 
+/*
+ * Called when the lock of an instance of @klass could not be taken
+ * right away, with @start being the time the caller started to wait
+ * and @end the time it got the lock.
+ */
+static void
+virClassLockContended(virClassPtr klass,
+                      unsigned long long start,
+                      unsigned long long end)
+{
+    virAtomicULLongAdd(&klass->contended, 1);
+    if (end > start)
+        virAtomicULLongAdd(&klass->waited, end - start);
+}
+
+
 /**
- * virObjectLock:
+ * virObjectLockFull:
  * @anyobj: any instance of virObjectLockable or virObjectRWLockable
+ * @filename: file name of the caller
+ * @funcname: function name of the caller
+ * @linenr: line number of the caller
  *
  * Acquire a lock on @anyobj. The lock must be released by
- * virObjectUnlock.
+ * virObjectUnlock. Callers use the virObjectLock macro which
+ * fills in their location, used to attribute lock contention.
  *
  * The caller is expected to have acquired a reference
  * on the object before locking it (eg virObjectRef).
@@ -425,23 +489,38 @@ virObjectGetRWLockableObj(void *anyobj)
  * reference.
  */
 void
-virObjectLock(void *anyobj)
+virObjectLockFull(void *anyobj,
+                  const char *filename,
+                  const char *funcname,
+                  size_t linenr)
 {
     virObjectLockablePtr obj = virObjectGetLockableObj(anyobj);
+    unsigned long long start = 0;
+    unsigned long long end = 0;
 
     if (!obj)
         return;
 
-    virMutexLock(&obj->lock);
+    if (virMutexTryLock(&obj->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
+    virMutexLockFull(&obj->lock, filename, funcname, linenr);
+    ignore_value(virTimeMicrosNowRaw(&end));
+    virClassLockContended(obj->parent.klass, start, end);
 }
 
 
 /**
- * virObjectRWLockRead:
+ * virObjectRWLockReadFull:
  * @anyobj: any instance of virObjectRWLockable
+ * @filename: file name of the caller
+ * @funcname: function name of the caller
+ * @linenr: line number of the caller
  *
  * Acquire a read lock on @anyobj. The lock must be
- * released by virObjectRWUnlock.
+ * released by virObjectRWUnlock. Callers use the
+ * virObjectRWLockRead macro.
  *
  * The caller is expected to have acquired a reference
  * on the object before locking it (eg virObjectRef).
@@ -454,23 +533,38 @@ virObjectLock(void *anyobj)
  *     should be checked.
  */
 void
-virObjectRWLockRead(void *anyobj)
+virObjectRWLockReadFull(void *anyobj,
+                        const char *filename,
+                        const char *funcname,
+                        size_t linenr)
 {
     virObjectRWLockablePtr obj = virObjectGetRWLockableObj(anyobj);
+    unsigned long long start = 0;
+    unsigned long long end = 0;
 
     if (!obj)
         return;
 
-    virRWLockRead(&obj->lock);
+    if (virRWLockTryRead(&obj->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
+    virRWLockReadFull(&obj->lock, filename, funcname, linenr);
+    ignore_value(virTimeMicrosNowRaw(&end));
+    virClassLockContended(obj->parent.klass, start, end);
 }
 
 
 /**
- * virObjectRWLockWrite:
+ * virObjectRWLockWriteFull:
  * @anyobj: any instance of virObjectRWLockable
+ * @filename: file name of the caller
+ * @funcname: function name of the caller
+ * @linenr: line number of the caller
  *
  * Acquire a write lock on @anyobj. The lock must be
- * released by virObjectRWUnlock.
+ * released by virObjectRWUnlock. Callers use the
+ * virObjectRWLockWrite macro.
  *
  * The caller is expected to have acquired a reference
  * on the object before locking it (eg virObjectRef).
@@ -483,14 +577,25 @@ virObjectRWLockRead(void *anyobj)
  *     should be checked.
  */
 void
-virObjectRWLockWrite(void *anyobj)
+virObjectRWLockWriteFull(void *anyobj,
+                         const char *filename,
+                         const char *funcname,
+                         size_t linenr)
 {
     virObjectRWLockablePtr obj = virObjectGetRWLockableObj(anyobj);
+    unsigned long long start = 0;
+    unsigned long long end = 0;
 
     if (!obj)
         return;
 
-    virRWLockWrite(&obj->lock);
+    if (virRWLockTryWrite(&obj->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
+    virRWLockWriteFull(&obj->lock, filename, funcname, linenr);
+    ignore_value(virTimeMicrosNowRaw(&end));
+    virClassLockContended(obj->parent.klass, start, end);
 }
 
 
@@ -567,6 +672,65 @@ virClassName(virClassPtr klass)
 }
 
 
+/**
+ * virClassGetLockStats:
+ * @stats: filled with an array of statistics
+ * @nstats: filled with the number of elements of @stats
+ *
+ * Collects the lock contention statistics of all object classes
+ * whose instances had to wait for their lock at least once, that is
+ * the number of times virObjectLock, virObjectRWLockRead or
+ * virObjectRWLockWrite found the lock held by someone else, and the
+ * total time spent waiting for it, in microseconds.
+ *
+ * The class names stay valid for the lifetime of the process.
+ *
+ * Returns 0 on success, allocating @stats which the caller is
+ * responsible for freeing, -1 on error.
+ */
+int
+virClassGetLockStats(virClassLockStatsPtr *stats,
+                     size_t *nstats)
+{
+    virClassLockStatsPtr tmp = NULL;
+    size_t ntmp = 0;
+    virClassPtr klass;
+    int ret = -1;
+
+    *stats = NULL;
+    *nstats = 0;
+
+    if (virObjectInitialize() < 0)
+        return -1;
+
+    virMutexLock(&classListLock);
+
+    for (klass = classList; klass; klass = klass->next) {
+        virClassLockStats st = {
+            .name = klass->name,
+            .contended = virAtomicULLongGet(&klass->contended),
+            .waited = virAtomicULLongGet(&klass->waited),
+        };
+
+        if (!st.contended)
+            continue;
+
+        if (VIR_APPEND_ELEMENT(tmp, ntmp, st) < 0)
+            goto cleanup;
+    }
+
+    *stats = tmp;
+    *nstats = ntmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&classListLock);
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
 /**
  * virObjectFreeCallback:
  * @opaque: a pointer to a virObject instance
@@ -39,6 +39,14 @@ typedef virObjectRWLockable *virObjectRWLockablePtr;
 
 typedef void (*virObjectDisposeCallback)(void *obj);
 
+typedef struct _virClassLockStats virClassLockStats;
+typedef virClassLockStats *virClassLockStatsPtr;
+struct _virClassLockStats {
+    const char *name;
+    unsigned long long contended; /* number of times a lock was busy */
+    unsigned long long waited; /* total wait time in microseconds */
+};
+
 /* Most code should not play with the contents of this struct; however,
  * the struct itself is public so that it can be embedded as the first
  * field of a subclassed object.  */
@@ -85,6 +93,11 @@ const char *
 virClassName(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 
+int
+virClassGetLockStats(virClassLockStatsPtr *stats,
+                     size_t *nstats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 bool
 virClassIsDerivedFrom(virClassPtr klass,
                       virClassPtr parent)
@@ -121,16 +134,31 @@ virObjectRWLockableNew(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 
 void
-virObjectLock(void *lockableobj)
+virObjectLockFull(void *lockableobj,
+                  const char *filename,
+                  const char *funcname,
+                  size_t linenr)
     ATTRIBUTE_NONNULL(1);
+# define virObjectLock(obj) \
+    virObjectLockFull(obj, __FILE__, __func__, __LINE__)
 
 void
-virObjectRWLockRead(void *lockableobj)
+virObjectRWLockReadFull(void *lockableobj,
+                        const char *filename,
+                        const char *funcname,
+                        size_t linenr)
     ATTRIBUTE_NONNULL(1);
+# define virObjectRWLockRead(obj) \
+    virObjectRWLockReadFull(obj, __FILE__, __func__, __LINE__)
 
 void
-virObjectRWLockWrite(void *lockableobj)
+virObjectRWLockWriteFull(void *lockableobj,
+                         const char *filename,
+                         const char *funcname,
+                         size_t linenr)
     ATTRIBUTE_NONNULL(1);
+# define virObjectRWLockWrite(obj) \
+    virObjectRWLockWriteFull(obj, __FILE__, __func__, __LINE__)
 
 void
 virObjectUnlock(void *lockableobj)
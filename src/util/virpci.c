@@ -1523,6 +1523,29 @@ virPCIDeviceBindToStub(virPCIDevicePtr dev)
     return ret;
 }
 
+/* virPCIDeviceHasDriverOverride:
+ *
+ * Returns true if the device can be bound to the stub driver through
+ * its driver_override interface. Unlike the new_id interface, which
+ * modifies state shared by all devices with the same ID, this only
+ * affects the device itself, so several devices can be detached in
+ * parallel.
+ */
+bool
+virPCIDeviceHasDriverOverride(virPCIDevicePtr dev)
+{
+    char *path;
+    bool ret;
+
+    if (!(path = virPCIFile(dev->name, "driver_override")))
+        return false;
+
+    ret = virFileExists(path);
+
+    VIR_FREE(path);
+    return ret;
+}
+
 /* virPCIDeviceDetach:
  *
  * Detach this device from the host driver, attach it to the stub
@@ -100,6 +100,7 @@ void virPCIDeviceFree(virPCIDevicePtr dev);
 const char *virPCIDeviceGetName(virPCIDevicePtr dev);
 const char *virPCIDeviceGetConfigPath(virPCIDevicePtr dev);
 
+bool virPCIDeviceHasDriverOverride(virPCIDevicePtr dev);
 int virPCIDeviceDetach(virPCIDevicePtr dev,
                        virPCIDeviceListPtr activeDevs,
                        virPCIDeviceListPtr inactiveDevs);
@@ -50,7 +50,6 @@ VIR_ENUM_IMPL(virPerfEvent, VIR_PERF_EVENT_LAST,
               "alignment_faults", "emulation_faults");
 
 struct virPerfEvent {
-    int fd;
     bool enabled;
     union {
         /* cmt */
@@ -61,10 +60,94 @@ struct virPerfEvent {
 };
 typedef struct virPerfEvent *virPerfEventPtr;
 
+/* Events opened for one task.  The hardware and software events are put
+ * in a single group led by a dummy event, so that all of them are read at
+ * once and are scheduled onto the PMU together. */
+struct virPerfGroup {
+    pid_t pid;
+    bool inherit;       /* count child tasks too */
+    int leader;
+    int fds[VIR_PERF_EVENT_LAST];
+    uint64_t ids[VIR_PERF_EVENT_LAST];
+};
+typedef struct virPerfGroup *virPerfGroupPtr;
+
+struct virPerfThread {
+    unsigned int id;
+    struct virPerfGroup group;
+};
+typedef struct virPerfThread *virPerfThreadPtr;
+
 struct virPerf {
     struct virPerfEvent events[VIR_PERF_EVENT_LAST];
+
+    /* the whole process */
+    struct virPerfGroup group;
+
+    /* individual threads of the process */
+    size_t nthreads;
+    virPerfThreadPtr threads;
 };
 
+
+static void
+virPerfGroupInit(virPerfGroupPtr group,
+                 pid_t pid,
+                 bool inherit)
+{
+    size_t i;
+
+    group->pid = pid;
+    group->inherit = inherit;
+    group->leader = -1;
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        group->fds[i] = -1;
+        group->ids[i] = 0;
+    }
+}
+
+
+static void
+virPerfGroupClose(virPerfGroupPtr group)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++)
+        VIR_FORCE_CLOSE(group->fds[i]);
+    VIR_FORCE_CLOSE(group->leader);
+}
+
+
+static virPerfThreadPtr
+virPerfFindThread(virPerfPtr perf,
+                  unsigned int id)
+{
+    size_t i;
+
+    for (i = 0; i < perf->nthreads; i++) {
+        if (perf->threads[i].id == id)
+            return &perf->threads[i];
+    }
+
+    return NULL;
+}
+
+
+void
+virPerfRemoveThread(virPerfPtr perf,
+                    unsigned int id)
+{
+    size_t i;
+
+    for (i = 0; i < perf->nthreads; i++) {
+        if (perf->threads[i].id == id) {
+            virPerfGroupClose(&perf->threads[i].group);
+            VIR_DELETE_ELEMENT(perf->threads, i, perf->nthreads);
+            return;
+        }
+    }
+}
+
 #if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H)
 
 # include <linux/perf_event.h>
@@ -205,15 +288,189 @@ virPerfRdtAttrInit(void)
 }
 
 
+/* Intel RDT events live on their own PMU and can't join the group */
+static bool
+virPerfEventIsGrouped(virPerfEventType type)
+{
+    return attrs[type].attrType == PERF_TYPE_HARDWARE ||
+           attrs[type].attrType == PERF_TYPE_SOFTWARE;
+}
+
+
+# define VIR_PERF_READ_FORMAT (PERF_FORMAT_GROUP | PERF_FORMAT_ID | \
+                               PERF_FORMAT_TOTAL_TIME_ENABLED | \
+                               PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+static int
+virPerfOpen(virPerfGroupPtr group,
+            unsigned int attrType,
+            unsigned long long attrConfig,
+            int groupfd,
+            const char *name)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.inherit = group->inherit;
+    attr.disabled = 1;
+    attr.enable_on_exec = 0;
+    attr.type = attrType;
+    attr.config = attrConfig;
+    attr.read_format = VIR_PERF_READ_FORMAT;
+
+    fd = syscall(__NR_perf_event_open, &attr, group->pid, -1, groupfd, 0);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             _("unable to open host cpu perf event for %s"),
+                             name);
+        return -1;
+    }
+
+    if (ioctl(fd, PERF_EVENT_IOC_ENABLE) < 0) {
+        virReportSystemError(errno,
+                             _("unable to enable host cpu perf event for %s"),
+                             name);
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static int
+virPerfGroupOpenEvent(virPerfGroupPtr group,
+                      virPerfEventType type)
+{
+    virPerfEventAttrPtr event_attr = &attrs[type];
+    int groupfd = -1;
+    int fd;
+
+    if (group->fds[type] >= 0)
+        return 0;
+
+    if (virPerfEventIsGrouped(type)) {
+        if (group->leader < 0 &&
+            (group->leader = virPerfOpen(group, PERF_TYPE_SOFTWARE,
+                                         PERF_COUNT_SW_DUMMY, -1,
+                                         "group leader")) < 0)
+            return -1;
+
+        groupfd = group->leader;
+    }
+
+    if ((fd = virPerfOpen(group, event_attr->attrType, event_attr->attrConfig,
+                          groupfd, virPerfEventTypeToString(type))) < 0)
+        return -1;
+
+    if (ioctl(fd, PERF_EVENT_IOC_ID, &group->ids[type]) < 0) {
+        virReportSystemError(errno,
+                             _("unable to get id of host cpu perf event for %s"),
+                             virPerfEventTypeToString(type));
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    group->fds[type] = fd;
+    return 0;
+}
+
+
+static void
+virPerfGroupCloseEvent(virPerfGroupPtr group,
+                       virPerfEventType type)
+{
+    size_t i;
+
+    VIR_FORCE_CLOSE(group->fds[type]);
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (group->fds[i] >= 0 && virPerfEventIsGrouped(i))
+            return;
+    }
+
+    VIR_FORCE_CLOSE(group->leader);
+}
+
+
+/* Value of a counter, extrapolated if it was multiplexed on the PMU */
+static uint64_t
+virPerfScale(uint64_t value,
+             uint64_t enabled,
+             uint64_t running)
+{
+    if (running == 0 || running >= enabled)
+        return value;
+
+    return (double) value * enabled / running;
+}
+
+
+static int
+virPerfGroupRead(virPerfPtr perf,
+                 virPerfGroupPtr group,
+                 virPerfCountersPtr counters)
+{
+    /* nr, time_enabled, time_running, then a value and id per event */
+    uint64_t buf[3 + 2 * (VIR_PERF_EVENT_LAST + 1)];
+    size_t i;
+    size_t j;
+
+    memset(counters, 0, sizeof(*counters));
+
+    if (group->leader >= 0) {
+        if (saferead(group->leader, buf, sizeof(buf)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to read perf event group"));
+            return -1;
+        }
+
+        for (i = 0; i < buf[0] && 3 + 2 * i + 1 < ARRAY_CARDINALITY(buf); i++) {
+            uint64_t value = buf[3 + 2 * i];
+            uint64_t id = buf[3 + 2 * i + 1];
+
+            for (j = 0; j < VIR_PERF_EVENT_LAST; j++) {
+                if (group->fds[j] >= 0 && group->ids[j] == id) {
+                    counters->values[j] = virPerfScale(value, buf[1], buf[2]);
+                    counters->valid[j] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (group->fds[i] < 0 || virPerfEventIsGrouped(i))
+            continue;
+
+        if (saferead(group->fds[i], buf, sizeof(buf)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to read cache data"));
+            return -1;
+        }
+
+        counters->values[i] = virPerfScale(buf[3], buf[1], buf[2]);
+        counters->valid[i] = true;
+
+        if (i == VIR_PERF_EVENT_CMT)
+            counters->values[i] *= perf->events[i].efields.cmt.scale;
+    }
+
+    return 0;
+}
+
+
 int
 virPerfEventEnable(virPerfPtr perf,
                    virPerfEventType type,
                    pid_t pid)
 {
     char *buf = NULL;
-    struct perf_event_attr attr;
     virPerfEventPtr event = &(perf->events[type]);
     virPerfEventAttrPtr event_attr = &attrs[type];
+    size_t i;
 
     if (event->enabled)
         return 0;
@@ -241,34 +498,24 @@ virPerfEventEnable(virPerfPtr perf,
         VIR_FREE(buf);
     }
 
-    memset(&attr, 0, sizeof(attr));
-    attr.size = sizeof(attr);
-    attr.inherit = 1;
-    attr.disabled = 1;
-    attr.enable_on_exec = 0;
-    attr.type = event_attr->attrType;
-    attr.config = event_attr->attrConfig;
-
-    event->fd = syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
-    if (event->fd < 0) {
-        virReportSystemError(errno,
-                             _("unable to open host cpu perf event for %s"),
-                             virPerfEventTypeToString(type));
+    perf->group.pid = pid;
+    if (virPerfGroupOpenEvent(&perf->group, type) < 0)
         goto error;
-    }
 
-    if (ioctl(event->fd, PERF_EVENT_IOC_ENABLE) < 0) {
-        virReportSystemError(errno,
-                             _("unable to enable host cpu perf event for %s"),
-                             virPerfEventTypeToString(type));
-        goto error;
+    if (virPerfEventIsGrouped(type)) {
+        for (i = 0; i < perf->nthreads; i++) {
+            if (virPerfGroupOpenEvent(&perf->threads[i].group, type) < 0)
+                goto error;
+        }
     }
 
     event->enabled = true;
     return 0;
 
  error:
-    VIR_FORCE_CLOSE(event->fd);
+    virPerfGroupCloseEvent(&perf->group, type);
+    for (i = 0; i < perf->nthreads; i++)
+        virPerfGroupCloseEvent(&perf->threads[i].group, type);
     VIR_FREE(buf);
     return -1;
 }
@@ -278,11 +525,12 @@ virPerfEventDisable(virPerfPtr perf,
                     virPerfEventType type)
 {
     virPerfEventPtr event = &(perf->events[type]);
+    size_t i;
 
     if (!event->enabled)
         return 0;
 
-    if (ioctl(event->fd, PERF_EVENT_IOC_DISABLE) < 0) {
+    if (ioctl(perf->group.fds[type], PERF_EVENT_IOC_DISABLE) < 0) {
         virReportSystemError(errno,
                              _("unable to disable host cpu perf event for %s"),
                              virPerfEventTypeToString(type));
@@ -290,7 +538,9 @@ virPerfEventDisable(virPerfPtr perf,
     }
 
     event->enabled = false;
-    VIR_FORCE_CLOSE(event->fd);
+    virPerfGroupCloseEvent(&perf->group, type);
+    for (i = 0; i < perf->nthreads; i++)
+        virPerfGroupCloseEvent(&perf->threads[i].group, type);
     return 0;
 }
 
@@ -305,20 +555,101 @@ virPerfReadEvent(virPerfPtr perf,
                  virPerfEventType type,
                  uint64_t *value)
 {
-    virPerfEventPtr event = &perf->events[type];
-    if (!event->enabled)
+    virPerfCounters counters;
+
+    if (!perf->events[type].enabled)
         return -1;
 
-    if (saferead(event->fd, value, sizeof(uint64_t)) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to read cache data"));
+    if (virPerfGroupRead(perf, &perf->group, &counters) < 0)
         return -1;
+
+    *value = counters.values[type];
+    return 0;
+}
+
+
+/**
+ * virPerfReadEvents:
+ * @perf: perf events of a process
+ * @counters: filled with the values of all enabled events
+ *
+ * Read all the enabled events of the process at once.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virPerfReadEvents(virPerfPtr perf,
+                  virPerfCountersPtr counters)
+{
+    return virPerfGroupRead(perf, &perf->group, counters);
+}
+
+
+/**
+ * virPerfAddThread:
+ * @perf: perf events of a process
+ * @id: caller's identifier of the thread
+ * @tid: thread id
+ *
+ * Count the enabled events, except for the Intel RDT ones, also for the
+ * single thread @tid.  Events enabled later are counted for the thread as
+ * well.  Any thread previously added as @id is replaced.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virPerfAddThread(virPerfPtr perf,
+                 unsigned int id,
+                 pid_t tid)
+{
+    struct virPerfThread thread = { .id = id };
+    size_t i;
+
+    virPerfRemoveThread(perf, id);
+    virPerfGroupInit(&thread.group, tid, false);
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (!perf->events[i].enabled || !virPerfEventIsGrouped(i))
+            continue;
+
+        if (virPerfGroupOpenEvent(&thread.group, i) < 0)
+            goto error;
     }
 
-    if (type == VIR_PERF_EVENT_CMT)
-        *value *= event->efields.cmt.scale;
+    if (VIR_APPEND_ELEMENT(perf->threads, perf->nthreads, thread) < 0)
+        goto error;
 
     return 0;
+
+ error:
+    virPerfGroupClose(&thread.group);
+    return -1;
+}
+
+
+/**
+ * virPerfReadThreadEvents:
+ * @perf: perf events of a process
+ * @id: caller's identifier of the thread
+ * @counters: filled with the values of the events counted for the thread
+ *
+ * Returns 1 if @counters were filled, 0 if the thread isn't counted
+ * separately and -1 on error.
+ */
+int
+virPerfReadThreadEvents(virPerfPtr perf,
+                        unsigned int id,
+                        virPerfCountersPtr counters)
+{
+    virPerfThreadPtr thread = virPerfFindThread(perf, id);
+
+    if (!thread)
+        return 0;
+
+    if (virPerfGroupRead(perf, &thread->group, counters) < 0)
+        return -1;
+
+    return 1;
 }
 
 #else
@@ -365,6 +696,31 @@ virPerfReadEvent(virPerfPtr perf ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+virPerfReadEvents(virPerfPtr perf ATTRIBUTE_UNUSED,
+                  virPerfCountersPtr counters ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Perf not supported on this platform"));
+    return -1;
+}
+
+int
+virPerfAddThread(virPerfPtr perf ATTRIBUTE_UNUSED,
+                 unsigned int id ATTRIBUTE_UNUSED,
+                 pid_t tid ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+int
+virPerfReadThreadEvents(virPerfPtr perf ATTRIBUTE_UNUSED,
+                        unsigned int id ATTRIBUTE_UNUSED,
+                        virPerfCountersPtr counters ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
 #endif
 
 virPerfPtr
@@ -376,10 +732,10 @@ virPerfNew(void)
     if (VIR_ALLOC(perf) < 0)
         return NULL;
 
-    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
-        perf->events[i].fd = -1;
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++)
         perf->events[i].enabled = false;
-    }
+
+    virPerfGroupInit(&perf->group, 0, true);
 
     if (virPerfRdtAttrInit() < 0)
         virResetLastError();
@@ -400,5 +756,9 @@ virPerfFree(virPerfPtr perf)
             virPerfEventDisable(perf, i);
     }
 
+    while (perf->nthreads)
+        virPerfRemoveThread(perf, perf->threads[0].id);
+    virPerfGroupClose(&perf->group);
+
     VIR_FREE(perf);
 }
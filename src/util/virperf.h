@@ -83,4 +83,25 @@ int virPerfReadEvent(virPerfPtr perf,
                      virPerfEventType type,
                      uint64_t *value);
 
+typedef struct _virPerfCounters virPerfCounters;
+typedef virPerfCounters *virPerfCountersPtr;
+struct _virPerfCounters {
+    bool valid[VIR_PERF_EVENT_LAST];
+    uint64_t values[VIR_PERF_EVENT_LAST];
+};
+
+int virPerfReadEvents(virPerfPtr perf,
+                      virPerfCountersPtr counters);
+
+int virPerfAddThread(virPerfPtr perf,
+                     unsigned int id,
+                     pid_t tid);
+
+void virPerfRemoveThread(virPerfPtr perf,
+                         unsigned int id);
+
+int virPerfReadThreadEvents(virPerfPtr perf,
+                            unsigned int id,
+                            virPerfCountersPtr counters);
+
 #endif /* __VIR_PERF_H__ */
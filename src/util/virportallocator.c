@@ -44,6 +44,11 @@ struct _virPortAllocator {
     unsigned short start;
     unsigned short end;
 
+    /* Offset to start the next search from. Every port below it is
+     * either reserved or was found to be in use by someone else when
+     * the cursor moved past it. */
+    size_t next;
+
     unsigned int flags;
 };
 
@@ -172,37 +177,63 @@ static int virPortAllocatorBindToPort(bool *used,
     return ret;
 }
 
+static int
+virPortAllocatorIsUsed(virPortAllocatorPtr pa,
+                       unsigned short port,
+                       bool *used)
+{
+    *used = false;
+
+    if (pa->flags & VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)
+        return 0;
+
+    if (virPortAllocatorBindToPort(used, port, AF_INET6) < 0)
+        return -1;
+
+    if (*used)
+        return 0;
+
+    return virPortAllocatorBindToPort(used, port, AF_INET);
+}
+
 int virPortAllocatorAcquire(virPortAllocatorPtr pa,
                             unsigned short *port)
 {
     int ret = -1;
-    size_t i;
+    size_t nbits = pa->end - pa->start + 1;
+    size_t pass;
 
     *port = 0;
     virObjectLock(pa);
 
-    for (i = pa->start; i <= pa->end && !*port; i++) {
-        bool used = false, v6used = false;
+    /* Search from the cursor to the end of the range first and only
+     * then wrap around, so that ports which were busy the last time we
+     * looked are not probed again on every allocation. */
+    for (pass = 0; pass < 2 && !*port; pass++) {
+        ssize_t limit = pass == 0 ? nbits : pa->next;
+        ssize_t i = pass == 0 ? (ssize_t) pa->next - 1 : -1;
 
-        if (virBitmapIsBitSet(pa->bitmap, i - pa->start))
-            continue;
+        while ((i = virBitmapNextClearBit(pa->bitmap, i)) >= 0 &&
+               i < limit) {
+            bool used;
 
-        if (!(pa->flags & VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)) {
-            if (virPortAllocatorBindToPort(&v6used, i, AF_INET6) < 0 ||
-                virPortAllocatorBindToPort(&used, i, AF_INET) < 0)
+            if (virPortAllocatorIsUsed(pa, pa->start + i, &used) < 0)
                 goto cleanup;
-        }
 
-        if (!used && !v6used) {
+            if (used)
+                continue;
+
             /* Add port to bitmap of reserved ports */
-            if (virBitmapSetBit(pa->bitmap,
-                                i - pa->start) < 0) {
+            if (virBitmapSetBit(pa->bitmap, i) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to reserve port %zu"), i);
+                               _("Failed to reserve port %zd"),
+                               pa->start + i);
                 goto cleanup;
             }
-            *port = i;
+            *port = pa->start + i;
+            pa->next = i + 1;
             ret = 0;
+            break;
         }
     }
 
@@ -241,6 +272,9 @@ int virPortAllocatorRelease(virPortAllocatorPtr pa,
         goto cleanup;
     }
 
+    if (port - pa->start < pa->next)
+        pa->next = port - pa->start;
+
     ret = 0;
  cleanup:
     virObjectUnlock(pa);
@@ -276,6 +310,9 @@ int virPortAllocatorSetUsed(virPortAllocatorPtr pa,
                            port);
             goto cleanup;
         }
+
+        if (port - pa->start < pa->next)
+            pa->next = port - pa->start;
     }
 
     ret = 0;
@@ -409,7 +409,8 @@ virProcessKillPainfully(pid_t pid, bool force)
 
 int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
 {
-    size_t i;
+    virBitmapIter iter;
+    ssize_t i;
     VIR_DEBUG("Set process affinity on %lld", (long long)pid);
 # ifdef CPU_ALLOC
     /* New method dynamically allocates cpu mask, allowing unlimted cpus */
@@ -434,10 +435,9 @@ int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
     }
 
     CPU_ZERO_S(masklen, mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET_S(i, masklen, mask);
-    }
+    virBitmapIterInit(&iter, map);
+    while ((i = virBitmapIterNext(&iter)) >= 0)
+        CPU_SET_S(i, masklen, mask);
 
     if (sched_setaffinity(pid, masklen, mask) < 0) {
         CPU_FREE(mask);
@@ -456,10 +456,9 @@ int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
     cpu_set_t mask;
 
     CPU_ZERO(&mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET(i, &mask);
-    }
+    virBitmapIterInit(&iter, map);
+    while ((i = virBitmapIterNext(&iter)) >= 0)
+        CPU_SET(i, &mask);
 
     if (sched_setaffinity(pid, sizeof(mask), &mask) < 0) {
         virReportSystemError(errno,
@@ -536,14 +535,14 @@ virProcessGetAffinity(pid_t pid)
 int virProcessSetAffinity(pid_t pid,
                           virBitmapPtr map)
 {
-    size_t i;
+    virBitmapIter iter;
+    ssize_t i;
     cpuset_t mask;
 
     CPU_ZERO(&mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET(i, &mask);
-    }
+    virBitmapIterInit(&iter, map);
+    while ((i = virBitmapIterNext(&iter)) >= 0)
+        CPU_SET(i, &mask);
 
     if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, pid,
                            sizeof(mask), &mask) != 0) {
@@ -18,13 +18,19 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
 #include "virresctrl.h"
 
 #include "c-ctype.h"
 #include "count-one-bits.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhostcpu.h"
 #include "virlog.h"
+#include "virobject.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_RESCTRL
@@ -185,3 +191,1114 @@ virResctrlGetCacheControlType(unsigned int level)
 
     return 0;
 }
+
+
+/*
+ * Allocations
+ *
+ * An allocation is built from the requested cache sizes and memory
+ * bandwidth, which do not depend on the host.  When the allocation is
+ * created the sizes are translated into capacity bitmasks out of the
+ * bits no other resctrl group is using, so that allocations of
+ * different domains never overlap.
+ */
+typedef struct _virResctrlAllocCache virResctrlAllocCache;
+typedef virResctrlAllocCache *virResctrlAllocCachePtr;
+struct _virResctrlAllocCache {
+    unsigned int level;
+    virCacheType type;
+    unsigned int cache;
+    unsigned long long size;
+    virBitmapPtr mask;
+};
+
+typedef struct _virResctrlAllocMemory virResctrlAllocMemory;
+typedef virResctrlAllocMemory *virResctrlAllocMemoryPtr;
+struct _virResctrlAllocMemory {
+    unsigned int node;
+    unsigned int bandwidth;
+};
+
+struct _virResctrlAlloc {
+    virObject parent;
+
+    size_t ncaches;
+    virResctrlAllocCachePtr caches;
+
+    size_t nmems;
+    virResctrlAllocMemoryPtr mems;
+
+    char *id;
+    char *path;
+};
+
+static virClassPtr virResctrlAllocClass;
+
+static void
+virResctrlAllocDispose(void *obj)
+{
+    virResctrlAllocPtr alloc = obj;
+    size_t i;
+
+    for (i = 0; i < alloc->ncaches; i++)
+        virBitmapFree(alloc->caches[i].mask);
+    VIR_FREE(alloc->caches);
+    VIR_FREE(alloc->mems);
+    VIR_FREE(alloc->id);
+    VIR_FREE(alloc->path);
+}
+
+
+static int
+virResctrlAllocOnceInit(void)
+{
+    if (!(virResctrlAllocClass = virClassNew(virClassForObject(),
+                                             "virResctrlAlloc",
+                                             sizeof(virResctrlAlloc),
+                                             virResctrlAllocDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virResctrlAlloc)
+
+
+virResctrlAllocPtr
+virResctrlAllocNew(void)
+{
+    if (virResctrlAllocInitialize() < 0)
+        return NULL;
+
+    return virObjectNew(virResctrlAllocClass);
+}
+
+
+bool
+virResctrlAllocIsEmpty(virResctrlAllocPtr alloc)
+{
+    return !alloc || (alloc->ncaches == 0 && alloc->nmems == 0);
+}
+
+
+int
+virResctrlAllocSetCacheSize(virResctrlAllocPtr alloc,
+                            unsigned int level,
+                            virCacheType type,
+                            unsigned int cache,
+                            unsigned long long size)
+{
+    virResctrlAllocCache item = {
+        .level = level, .type = type, .cache = cache, .size = size,
+    };
+    size_t i;
+
+    for (i = 0; i < alloc->ncaches; i++) {
+        virResctrlAllocCachePtr tmp = &alloc->caches[i];
+
+        if (tmp->level == level && tmp->cache == cache &&
+            (tmp->type == type ||
+             tmp->type == VIR_CACHE_TYPE_BOTH ||
+             type == VIR_CACHE_TYPE_BOTH)) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("Cache allocation of type '%s' for level %u "
+                             "cache %u collides with an allocation of "
+                             "type '%s'"),
+                           virCacheTypeToString(type), level, cache,
+                           virCacheTypeToString(tmp->type));
+            return -1;
+        }
+    }
+
+    if (size == 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Cache allocation for level %u cache %u "
+                         "must not be empty"), level, cache);
+        return -1;
+    }
+
+    return VIR_APPEND_ELEMENT(alloc->caches, alloc->ncaches, item);
+}
+
+
+int
+virResctrlAllocSetMemoryBandwidth(virResctrlAllocPtr alloc,
+                                  unsigned int node,
+                                  unsigned int bandwidth)
+{
+    virResctrlAllocMemory item = { .node = node, .bandwidth = bandwidth };
+    size_t i;
+
+    if (bandwidth == 0 || bandwidth > 100) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Memory bandwidth '%u' for node %u must be "
+                         "a percentage between 1 and 100"),
+                       bandwidth, node);
+        return -1;
+    }
+
+    for (i = 0; i < alloc->nmems; i++) {
+        if (alloc->mems[i].node == node) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("Memory bandwidth for node %u is already set"),
+                           node);
+            return -1;
+        }
+    }
+
+    return VIR_APPEND_ELEMENT(alloc->mems, alloc->nmems, item);
+}
+
+
+bool
+virResctrlAllocHasMemoryBandwidth(virResctrlAllocPtr alloc)
+{
+    return alloc && alloc->nmems > 0;
+}
+
+
+int
+virResctrlAllocForeachCache(virResctrlAllocPtr alloc,
+                            virResctrlAllocForeachCacheCallback cb,
+                            void *opaque)
+{
+    size_t i;
+
+    for (i = 0; i < alloc->ncaches; i++) {
+        virResctrlAllocCachePtr item = &alloc->caches[i];
+
+        if (cb(item->level, item->type, item->cache, item->size, opaque) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocForeachMemory(virResctrlAllocPtr alloc,
+                             virResctrlAllocForeachMemoryCallback cb,
+                             void *opaque)
+{
+    size_t i;
+
+    for (i = 0; i < alloc->nmems; i++) {
+        if (cb(alloc->mems[i].node, alloc->mems[i].bandwidth, opaque) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocSetID(virResctrlAllocPtr alloc,
+                     const char *id)
+{
+    if (!id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl allocation 'id' cannot be NULL"));
+        return -1;
+    }
+
+    VIR_FREE(alloc->id);
+    return VIR_STRDUP(alloc->id, id);
+}
+
+
+const char *
+virResctrlAllocGetID(virResctrlAllocPtr alloc)
+{
+    return alloc->id;
+}
+
+
+static int
+virResctrlGetResourceName(char **name,
+                          unsigned int level,
+                          virCacheType type)
+{
+    return virAsprintf(name, "L%u%s", level, virResctrlTypeToString(type));
+}
+
+
+/*
+ * Format the allocation the way the schemata file expects it, e.g.
+ *
+ *   L3CODE:0=f0;1=f0
+ *   L3DATA:0=0f;1=0f
+ *   MB:0=50;1=50
+ *
+ * Only caches which got a mask assigned already are formatted.
+ */
+char *
+virResctrlAllocFormat(virResctrlAllocPtr alloc)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    bool *done = NULL;
+    char *name = NULL;
+    char *mask = NULL;
+    size_t i, j;
+
+    if (VIR_ALLOC_N(done, alloc->ncaches) < 0)
+        return NULL;
+
+    for (i = 0; i < alloc->ncaches; i++) {
+        virResctrlAllocCachePtr item = &alloc->caches[i];
+        const char *sep = "";
+
+        if (done[i] || !item->mask)
+            continue;
+
+        if (virResctrlGetResourceName(&name, item->level, item->type) < 0)
+            goto error;
+
+        virBufferAsprintf(&buf, "%s:", name);
+        VIR_FREE(name);
+
+        /* Every cache of the same level and type goes onto one line */
+        for (j = i; j < alloc->ncaches; j++) {
+            virResctrlAllocCachePtr other = &alloc->caches[j];
+
+            if (done[j] || !other->mask ||
+                other->level != item->level || other->type != item->type)
+                continue;
+
+            if (!(mask = virBitmapToString(other->mask, false, true)))
+                goto error;
+
+            virBufferAsprintf(&buf, "%s%u=%s", sep, other->cache, mask);
+            VIR_FREE(mask);
+            sep = ";";
+            done[j] = true;
+        }
+        virBufferAddLit(&buf, "\n");
+    }
+
+    if (alloc->nmems) {
+        virBufferAddLit(&buf, "MB:");
+        for (i = 0; i < alloc->nmems; i++) {
+            virBufferAsprintf(&buf, "%s%u=%u", i ? ";" : "",
+                              alloc->mems[i].node, alloc->mems[i].bandwidth);
+        }
+        virBufferAddLit(&buf, "\n");
+    }
+
+    VIR_FREE(done);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+
+ error:
+    VIR_FREE(done);
+    virBufferFreeAndReset(&buf);
+    return NULL;
+}
+
+
+/*
+ * Find the mask of @cache in the line for @resource of @schemata.
+ *
+ * Returns 1 and fills in @mask if found, 0 if not, -1 on error
+ */
+static int
+virResctrlParseSchemataMask(const char *schemata,
+                            const char *resource,
+                            unsigned int cache,
+                            virBitmapPtr *mask)
+{
+    char **lines = NULL;
+    char **items = NULL;
+    size_t i;
+    int ret = -1;
+
+    *mask = NULL;
+
+    if (!(lines = virStringSplit(schemata, "\n", 0)))
+        return -1;
+
+    for (i = 0; lines[i]; i++) {
+        char *line = lines[i];
+        char *tmp;
+        size_t j;
+
+        virSkipSpaces((const char **) &line);
+        if (!(tmp = STRSKIP(line, resource)) || *tmp != ':')
+            continue;
+
+        if (!(items = virStringSplit(tmp + 1, ";", 0)))
+            goto cleanup;
+
+        for (j = 0; items[j]; j++) {
+            unsigned int id;
+            char *end;
+
+            if (virStrToLong_uip(items[j], &end, 10, &id) < 0 ||
+                *end != '=') {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Cannot parse resctrl schemata '%s'"),
+                               line);
+                goto cleanup;
+            }
+
+            if (id != cache)
+                continue;
+
+            virTrimSpaces(end + 1, NULL);
+            if (!(*mask = virBitmapNewString(end + 1)))
+                goto cleanup;
+
+            ret = 1;
+            goto cleanup;
+        }
+        virStringListFree(items);
+        items = NULL;
+    }
+
+    ret = 0;
+ cleanup:
+    virStringListFree(items);
+    virStringListFree(lines);
+    return ret;
+}
+
+
+/*
+ * Compute the bits of @resource on @cache which are neither used by
+ * any group but the default one nor lie outside of the default
+ * group's mask.  @self is the path of the group being created, which
+ * is ignored.
+ */
+static virBitmapPtr
+virResctrlAllocGetUnused(const char *resource,
+                         unsigned int cache,
+                         const char *self)
+{
+    virBitmapPtr unused = NULL;
+    virBitmapPtr used = NULL;
+    char *schemata = NULL;
+    char *path = NULL;
+    DIR *dirp = NULL;
+    struct dirent *ent;
+    int rv;
+
+    if (virFileReadAll(SYSFS_RESCTRL_PATH "/schemata", 1024 * 1024,
+                       &schemata) < 0)
+        goto error;
+
+    if ((rv = virResctrlParseSchemataMask(schemata, resource, cache,
+                                          &unused)) < 0)
+        goto error;
+
+    if (rv == 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Cache allocation for resource '%s' cache %u "
+                         "is not supported on this host"),
+                       resource, cache);
+        goto error;
+    }
+    VIR_FREE(schemata);
+
+    if (virDirOpen(&dirp, SYSFS_RESCTRL_PATH) < 0)
+        goto error;
+
+    while ((rv = virDirRead(dirp, &ent, SYSFS_RESCTRL_PATH)) > 0) {
+        if (STREQ(ent->d_name, "info"))
+            continue;
+
+        VIR_FREE(path);
+        if (virAsprintf(&path, "%s/%s", SYSFS_RESCTRL_PATH, ent->d_name) < 0)
+            goto error;
+
+        if (STREQ_NULLABLE(path, self) || !virFileIsDir(path))
+            continue;
+
+        /* Monitoring groups have no schemata of their own */
+        VIR_FREE(schemata);
+        if (virFileReadValueString(&schemata, "%s/schemata", path) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        if (virResctrlParseSchemataMask(schemata, resource, cache, &used) < 0)
+            goto error;
+
+        if (used) {
+            virBitmapSubtract(unused, used);
+            virBitmapFree(used);
+            used = NULL;
+        }
+    }
+    if (rv < 0)
+        goto error;
+
+    VIR_DIR_CLOSE(dirp);
+    VIR_FREE(schemata);
+    VIR_FREE(path);
+    return unused;
+
+ error:
+    VIR_DIR_CLOSE(dirp);
+    VIR_FREE(schemata);
+    VIR_FREE(path);
+    virBitmapFree(unused);
+    return NULL;
+}
+
+
+/*
+ * Look up the size of cache @cache of level @level in bytes.
+ */
+static int
+virResctrlGetCacheSize(unsigned int level,
+                       unsigned int cache,
+                       unsigned long long *size)
+{
+    virBitmapPtr cpus = NULL;
+    char *type = NULL;
+    ssize_t cpu = -1;
+    int ret = -1;
+
+    if (!(cpus = virHostCPUGetOnlineBitmap()))
+        return -1;
+
+    while ((cpu = virBitmapNextSetBit(cpus, cpu)) >= 0) {
+        size_t i;
+
+        for (i = 0; ; i++) {
+            unsigned int tmp;
+            int rv;
+
+            rv = virFileReadValueUint(&tmp,
+                                      "/sys/devices/system/cpu/cpu%zd/"
+                                      "cache/index%zu/level", cpu, i);
+            if (rv == -2)
+                break;
+            if (rv < 0)
+                goto cleanup;
+            if (tmp != level)
+                continue;
+
+            if (virFileReadValueUint(&tmp,
+                                     "/sys/devices/system/cpu/cpu%zd/"
+                                     "cache/index%zu/id", cpu, i) < 0)
+                goto cleanup;
+            if (tmp != cache)
+                continue;
+
+            VIR_FREE(type);
+            if (virFileReadValueString(&type,
+                                       "/sys/devices/system/cpu/cpu%zd/"
+                                       "cache/index%zu/type", cpu, i) < 0)
+                goto cleanup;
+            if (STRPREFIX(type, "Instruction"))
+                continue;
+
+            if (virFileReadValueScaledInt(size,
+                                          "/sys/devices/system/cpu/cpu%zd/"
+                                          "cache/index%zu/size", cpu, i) < 0)
+                goto cleanup;
+
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                   _("Cannot find level %u cache %u on this host"),
+                   level, cache);
+
+ cleanup:
+    VIR_FREE(type);
+    virBitmapFree(cpus);
+    return ret;
+}
+
+
+/*
+ * Pick the first contiguous run of bits out of the unused ones which
+ * is large enough to cover the requested size.
+ */
+static int
+virResctrlAllocCacheMask(virResctrlAllocCachePtr item,
+                         const char *self)
+{
+    virBitmapPtr unused = NULL;
+    char *resource = NULL;
+    char *cbm_mask = NULL;
+    unsigned int min_cbm_bits = 1;
+    unsigned long long cache_size;
+    unsigned long long granularity;
+    size_t nbits;
+    size_t need;
+    ssize_t start = -1;
+    ssize_t pos;
+    size_t i;
+    int ret = -1;
+
+    if (virResctrlGetResourceName(&resource, item->level, item->type) < 0)
+        return -1;
+
+    if (virFileReadValueString(&cbm_mask,
+                               SYSFS_RESCTRL_PATH "/info/%s/cbm_mask",
+                               resource) < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Cache allocation of type '%s' for level %u "
+                         "is not supported on this host"),
+                       virCacheTypeToString(item->type), item->level);
+        goto cleanup;
+    }
+    virStringTrimOptionalNewline(cbm_mask);
+
+    if (virFileReadValueUint(&min_cbm_bits,
+                             SYSFS_RESCTRL_PATH "/info/%s/min_cbm_bits",
+                             resource) < 0)
+        goto cleanup;
+
+    for (nbits = 0, i = 0; cbm_mask[i]; i++) {
+        if (c_isxdigit(cbm_mask[i]))
+            nbits += count_one_bits(virHexToBin(cbm_mask[i]));
+    }
+
+    if (virResctrlGetCacheSize(item->level, item->cache, &cache_size) < 0)
+        goto cleanup;
+
+    granularity = cache_size / nbits;
+    need = VIR_DIV_UP(item->size, granularity);
+    if (need < min_cbm_bits)
+        need = min_cbm_bits;
+
+    if (need > nbits) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Cache allocation of %llu bytes for level %u "
+                         "cache %u exceeds the cache size of %llu bytes"),
+                       item->size, item->level, item->cache, cache_size);
+        goto cleanup;
+    }
+
+    if (!(unused = virResctrlAllocGetUnused(resource, item->cache, self)))
+        goto cleanup;
+
+    /* Capacity bitmasks have to be contiguous */
+    for (pos = 0; pos < nbits; pos++) {
+        if (!virBitmapIsBitSet(unused, pos)) {
+            start = -1;
+            continue;
+        }
+
+        if (start < 0)
+            start = pos;
+
+        if (pos - start + 1 == need)
+            break;
+    }
+
+    if (pos == nbits) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Not enough room for allocation of %llu bytes "
+                         "for level %u cache %u scope type '%s'"),
+                       item->size, item->level, item->cache,
+                       virCacheTypeToString(item->type));
+        goto cleanup;
+    }
+
+    virBitmapFree(item->mask);
+    if (!(item->mask = virBitmapNew(nbits)))
+        goto cleanup;
+
+    for (pos = start; pos < start + need; pos++)
+        ignore_value(virBitmapSetBit(item->mask, pos));
+
+    VIR_DEBUG("Allocated bits %zd-%zd of %s cache %u",
+              start, start + need - 1, resource, item->cache);
+
+    ret = 0;
+ cleanup:
+    virBitmapFree(unused);
+    VIR_FREE(cbm_mask);
+    VIR_FREE(resource);
+    return ret;
+}
+
+
+static int
+virResctrlAllocCheckMemory(virResctrlAllocPtr alloc)
+{
+    unsigned int min_bandwidth = 0;
+    size_t i;
+
+    if (!alloc->nmems)
+        return 0;
+
+    if (virFileReadValueUint(&min_bandwidth,
+                             SYSFS_RESCTRL_PATH "/info/MB/min_bandwidth") < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("Memory bandwidth allocation is not supported "
+                         "on this host"));
+        return -1;
+    }
+
+    for (i = 0; i < alloc->nmems; i++) {
+        if (alloc->mems[i].bandwidth < min_bandwidth) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("Memory bandwidth '%u' for node %u is below "
+                             "the minimum of %u"),
+                           alloc->mems[i].bandwidth, alloc->mems[i].node,
+                           min_bandwidth);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocDeterminePath(virResctrlAllocPtr alloc,
+                             const char *machinename)
+{
+    if (!alloc->id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl allocation must have an id"));
+        return -1;
+    }
+
+    VIR_FREE(alloc->path);
+    return virAsprintf(&alloc->path, "%s/%s-%s",
+                       SYSFS_RESCTRL_PATH, machinename, alloc->id);
+}
+
+
+/* Serialize allocations among all libvirt daemons on the host, the
+ * lock is released by closing the returned fd */
+static int
+virResctrlLock(void)
+{
+    int fd;
+
+    if ((fd = open(SYSFS_RESCTRL_PATH, O_DIRECTORY | O_CLOEXEC)) < 0) {
+        virReportSystemError(errno, _("Cannot open %s"), SYSFS_RESCTRL_PATH);
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX) < 0) {
+        virReportSystemError(errno, _("Cannot lock %s"), SYSFS_RESCTRL_PATH);
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * virResctrlAllocCreate:
+ * @alloc: the allocation to create
+ * @machinename: name of the machine the allocation belongs to
+ *
+ * Create the resctrl group for @alloc, translating the requested cache
+ * sizes into capacity bitmasks which don't overlap with the masks of
+ * any other group.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virResctrlAllocCreate(virResctrlAllocPtr alloc,
+                      const char *machinename)
+{
+    char *schemata = NULL;
+    char *path = NULL;
+    int lockfd = -1;
+    size_t i;
+    int ret = -1;
+
+    if (virResctrlAllocIsEmpty(alloc))
+        return 0;
+
+    if (!virFileExists(SYSFS_RESCTRL_PATH "/info")) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("Resource control is not supported on this host"));
+        return -1;
+    }
+
+    if (virResctrlAllocDeterminePath(alloc, machinename) < 0)
+        return -1;
+
+    if (virFileExists(alloc->path)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Path '%s' for resctrl allocation exists"),
+                       alloc->path);
+        return -1;
+    }
+
+    if ((lockfd = virResctrlLock()) < 0)
+        return -1;
+
+    for (i = 0; i < alloc->ncaches; i++) {
+        if (virResctrlAllocCacheMask(&alloc->caches[i], alloc->path) < 0)
+            goto cleanup;
+    }
+
+    if (virResctrlAllocCheckMemory(alloc) < 0)
+        goto cleanup;
+
+    if (!(schemata = virResctrlAllocFormat(alloc)))
+        goto cleanup;
+
+    if (virFileMakePath(alloc->path) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot create resctrl directory '%s'"),
+                             alloc->path);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&path, "%s/schemata", alloc->path) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Writing resctrl schemata '%s' into '%s'", schemata, path);
+    if (virFileWriteStr(path, schemata, 0) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot write into schemata file '%s'"),
+                             path);
+        ignore_value(rmdir(alloc->path));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(path);
+    VIR_FREE(schemata);
+    VIR_FORCE_CLOSE(lockfd);
+    return ret;
+}
+
+
+int
+virResctrlAllocAddPID(virResctrlAllocPtr alloc,
+                      pid_t pid)
+{
+    char *tasks = NULL;
+    char *pidstr = NULL;
+    int ret = -1;
+
+    if (!alloc->path) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot add pid to non-existing resctrl allocation"));
+        return -1;
+    }
+
+    if (virAsprintf(&tasks, "%s/tasks", alloc->path) < 0 ||
+        virAsprintf(&pidstr, "%lld", (long long) pid) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(tasks, pidstr, 0) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot write pid in tasks file '%s'"),
+                             tasks);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(tasks);
+    VIR_FREE(pidstr);
+    return ret;
+}
+
+
+int
+virResctrlAllocRemove(virResctrlAllocPtr alloc)
+{
+    int ret = 0;
+
+    if (!alloc->path)
+        return 0;
+
+    VIR_DEBUG("Removing resctrl allocation %s", alloc->path);
+    if (rmdir(alloc->path) != 0 && errno != ENOENT) {
+        ret = -errno;
+        VIR_ERROR(_("Unable to remove %s (%d)"), alloc->path, errno);
+    }
+
+    return ret;
+}
+
+
+/* Monitoring of cache occupancy and memory bandwidth
+ *
+ * A monitoring group is a directory under mon_groups/ of either the resctrl
+ * root or of the allocation its tasks belong to.  The kernel reports the
+ * counters separately for each L3 cache in mon_data/mon_L3_<id>/, those are
+ * summed up here.
+ */
+VIR_ENUM_IMPL(virResctrlMonitor, VIR_RESCTRL_MONITOR_LAST,
+              "llc_occupancy",
+              "mbm_total_bytes",
+              "mbm_local_bytes")
+
+struct _virResctrlMonitor {
+    virObject parent;
+
+    char *id;
+    char *path;
+};
+
+static virClassPtr virResctrlMonitorClass;
+
+static void
+virResctrlMonitorDispose(void *obj)
+{
+    virResctrlMonitorPtr monitor = obj;
+
+    VIR_FREE(monitor->id);
+    VIR_FREE(monitor->path);
+}
+
+
+static int
+virResctrlMonitorOnceInit(void)
+{
+    if (!(virResctrlMonitorClass = virClassNew(virClassForObject(),
+                                               "virResctrlMonitor",
+                                               sizeof(virResctrlMonitor),
+                                               virResctrlMonitorDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virResctrlMonitor)
+
+
+virResctrlMonitorPtr
+virResctrlMonitorNew(void)
+{
+    if (virResctrlMonitorInitialize() < 0)
+        return NULL;
+
+    return virObjectNew(virResctrlMonitorClass);
+}
+
+
+/**
+ * virResctrlMonitorIsSupported:
+ * @type: the monitoring feature
+ *
+ * Returns true if the host kernel is able to monitor @type through resctrl.
+ */
+bool
+virResctrlMonitorIsSupported(virResctrlMonitorType type)
+{
+    char *features = NULL;
+    char **list = NULL;
+    bool ret;
+
+    if (virFileReadAllQuiet(SYSFS_RESCTRL_PATH "/info/L3_MON/mon_features",
+                            1024, &features) < 0)
+        return false;
+
+    if (!(list = virStringSplit(features, "\n", 0))) {
+        VIR_FREE(features);
+        return false;
+    }
+
+    ret = virStringListHasString((const char **) list,
+                                 virResctrlMonitorTypeToString(type));
+
+    virStringListFree(list);
+    VIR_FREE(features);
+    return ret;
+}
+
+
+int
+virResctrlMonitorSetID(virResctrlMonitorPtr monitor,
+                       const char *id)
+{
+    if (!id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl monitor 'id' cannot be NULL"));
+        return -1;
+    }
+
+    VIR_FREE(monitor->id);
+    return VIR_STRDUP(monitor->id, id);
+}
+
+
+int
+virResctrlMonitorDeterminePath(virResctrlMonitorPtr monitor,
+                               virResctrlAllocPtr alloc,
+                               const char *machinename)
+{
+    const char *parent = SYSFS_RESCTRL_PATH;
+
+    if (!monitor->id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl monitor must have an id"));
+        return -1;
+    }
+
+    if (alloc && alloc->path)
+        parent = alloc->path;
+
+    VIR_FREE(monitor->path);
+    return virAsprintf(&monitor->path, "%s/mon_groups/%s-%s",
+                       parent, machinename, monitor->id);
+}
+
+
+/**
+ * virResctrlMonitorCreate:
+ * @monitor: the monitoring group to create
+ * @alloc: allocation the monitored tasks belong to, or NULL
+ * @machinename: name of the machine the group belongs to
+ *
+ * Create the resctrl monitoring group for @monitor.  Any tasks added to it
+ * are also moved into the resctrl group of @alloc.  An already existing
+ * group is reused, so that monitoring can be picked up again after the
+ * daemon restarted.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virResctrlMonitorCreate(virResctrlMonitorPtr monitor,
+                        virResctrlAllocPtr alloc,
+                        const char *machinename)
+{
+    if (virResctrlMonitorDeterminePath(monitor, alloc, machinename) < 0)
+        return -1;
+
+    if (virFileMakePath(monitor->path) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot create resctrl directory '%s'"),
+                             monitor->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlMonitorAddPID(virResctrlMonitorPtr monitor,
+                        pid_t pid)
+{
+    char *tasks = NULL;
+    char *pidstr = NULL;
+    int ret = -1;
+
+    if (!monitor->path) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot add pid to non-existing resctrl monitor"));
+        return -1;
+    }
+
+    if (virAsprintf(&tasks, "%s/tasks", monitor->path) < 0 ||
+        virAsprintf(&pidstr, "%lld", (long long) pid) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(tasks, pidstr, 0) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot write pid in tasks file '%s'"),
+                             tasks);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(tasks);
+    VIR_FREE(pidstr);
+    return ret;
+}
+
+
+/**
+ * virResctrlMonitorGetStats:
+ * @monitor: the monitoring group
+ * @type: which counter to read
+ * @value: filled with the counter in bytes summed over all L3 caches
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virResctrlMonitorGetStats(virResctrlMonitorPtr monitor,
+                          virResctrlMonitorType type,
+                          unsigned long long *value)
+{
+    DIR *dirp = NULL;
+    struct dirent *ent = NULL;
+    char *datapath = NULL;
+    char *path = NULL;
+    char *buf = NULL;
+    unsigned long long tmp;
+    int rv;
+    int ret = -1;
+
+    *value = 0;
+
+    if (!monitor->path) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot get stats of non-existing resctrl monitor"));
+        return -1;
+    }
+
+    if (virAsprintf(&datapath, "%s/mon_data", monitor->path) < 0)
+        return -1;
+
+    if (virDirOpen(&dirp, datapath) < 0)
+        goto cleanup;
+
+    while ((rv = virDirRead(dirp, &ent, datapath)) > 0) {
+        if (!STRPREFIX(ent->d_name, "mon_L3_"))
+            continue;
+
+        VIR_FREE(path);
+        VIR_FREE(buf);
+        if (virAsprintf(&path, "%s/%s/%s", datapath, ent->d_name,
+                        virResctrlMonitorTypeToString(type)) < 0)
+            goto cleanup;
+
+        if (virFileReadAll(path, 64, &buf) < 0)
+            goto cleanup;
+
+        virStringTrimOptionalNewline(buf);
+        if (virStrToLong_ull(buf, NULL, 10, &tmp) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Cannot parse '%s' from '%s'"), buf, path);
+            goto cleanup;
+        }
+
+        *value += tmp;
+    }
+    if (rv < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_DIR_CLOSE(dirp);
+    VIR_FREE(datapath);
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+int
+virResctrlMonitorRemove(virResctrlMonitorPtr monitor)
+{
+    int ret = 0;
+
+    if (!monitor->path)
+        return 0;
+
+    VIR_DEBUG("Removing resctrl monitor %s", monitor->path);
+    if (rmdir(monitor->path) != 0 && errno != ENOENT) {
+        ret = -errno;
+        VIR_ERROR(_("Unable to remove %s (%d)"), monitor->path, errno);
+    }
+
+    return ret;
+}
@@ -60,4 +60,122 @@ virResctrlGetCacheInfo(unsigned int level,
 int
 virResctrlGetCacheControlType(unsigned int level);
 
+
+/* Allocation of cache and memory bandwidth for a set of tasks */
+typedef struct _virResctrlAlloc virResctrlAlloc;
+typedef virResctrlAlloc *virResctrlAllocPtr;
+
+typedef int virResctrlAllocForeachCacheCallback(unsigned int level,
+                                                virCacheType type,
+                                                unsigned int cache,
+                                                unsigned long long size,
+                                                void *opaque);
+
+typedef int virResctrlAllocForeachMemoryCallback(unsigned int node,
+                                                 unsigned int bandwidth,
+                                                 void *opaque);
+
+virResctrlAllocPtr
+virResctrlAllocNew(void);
+
+bool
+virResctrlAllocIsEmpty(virResctrlAllocPtr alloc);
+
+int
+virResctrlAllocSetCacheSize(virResctrlAllocPtr alloc,
+                            unsigned int level,
+                            virCacheType type,
+                            unsigned int cache,
+                            unsigned long long size);
+
+int
+virResctrlAllocSetMemoryBandwidth(virResctrlAllocPtr alloc,
+                                  unsigned int node,
+                                  unsigned int bandwidth);
+
+bool
+virResctrlAllocHasMemoryBandwidth(virResctrlAllocPtr alloc);
+
+int
+virResctrlAllocForeachCache(virResctrlAllocPtr alloc,
+                            virResctrlAllocForeachCacheCallback cb,
+                            void *opaque);
+
+int
+virResctrlAllocForeachMemory(virResctrlAllocPtr alloc,
+                             virResctrlAllocForeachMemoryCallback cb,
+                             void *opaque);
+
+int
+virResctrlAllocSetID(virResctrlAllocPtr alloc,
+                     const char *id);
+
+const char *
+virResctrlAllocGetID(virResctrlAllocPtr alloc);
+
+char *
+virResctrlAllocFormat(virResctrlAllocPtr alloc);
+
+int
+virResctrlAllocDeterminePath(virResctrlAllocPtr alloc,
+                             const char *machinename);
+
+int
+virResctrlAllocCreate(virResctrlAllocPtr alloc,
+                      const char *machinename);
+
+int
+virResctrlAllocAddPID(virResctrlAllocPtr alloc,
+                      pid_t pid);
+
+int
+virResctrlAllocRemove(virResctrlAllocPtr alloc);
+
+
+/* Monitoring of cache occupancy and memory bandwidth for a set of tasks */
+typedef enum {
+    VIR_RESCTRL_MONITOR_LLC_OCCUPANCY,
+    VIR_RESCTRL_MONITOR_MBM_TOTAL_BYTES,
+    VIR_RESCTRL_MONITOR_MBM_LOCAL_BYTES,
+
+    VIR_RESCTRL_MONITOR_LAST
+} virResctrlMonitorType;
+
+VIR_ENUM_DECL(virResctrlMonitor);
+
+typedef struct _virResctrlMonitor virResctrlMonitor;
+typedef virResctrlMonitor *virResctrlMonitorPtr;
+
+virResctrlMonitorPtr
+virResctrlMonitorNew(void);
+
+bool
+virResctrlMonitorIsSupported(virResctrlMonitorType type);
+
+int
+virResctrlMonitorSetID(virResctrlMonitorPtr monitor,
+                       const char *id);
+
+int
+virResctrlMonitorDeterminePath(virResctrlMonitorPtr monitor,
+                               virResctrlAllocPtr alloc,
+                               const char *machinename);
+
+int
+virResctrlMonitorCreate(virResctrlMonitorPtr monitor,
+                        virResctrlAllocPtr alloc,
+                        const char *machinename);
+
+int
+virResctrlMonitorAddPID(virResctrlMonitorPtr monitor,
+                        pid_t pid);
+
+int
+virResctrlMonitorGetStats(virResctrlMonitorPtr monitor,
+                          virResctrlMonitorType type,
+                          unsigned long long *value);
+
+int
+virResctrlMonitorRemove(virResctrlMonitorPtr monitor);
+
 #endif /*  __VIR_RESCTRL_H__ */
@@ -57,6 +57,12 @@ struct virRotatingFileWriter {
     size_t maxbackup;
     mode_t mode;
     size_t maxlen;
+    bool nosplice;
+
+    /* Inodes of the current file followed by the backups, newest
+     * first, 0 for those which don't exist. Lets readers go straight
+     * to the file they want. */
+    ino_t *inodes;
 };
 
 
@@ -108,7 +114,9 @@ virRotatingFileWriterEntryNew(const char *path,
     if (VIR_ALLOC(entry) < 0)
         return NULL;
 
-    if ((entry->fd = open(path, O_CREAT|O_APPEND|O_WRONLY|O_CLOEXEC, mode)) < 0) {
+    /* No O_APPEND, since splice() refuses to write to such files. We're
+     * the only writer and keep track of the position anyway. */
+    if ((entry->fd = open(path, O_CREAT|O_WRONLY|O_CLOEXEC, mode)) < 0) {
         virReportSystemError(errno,
                              _("Unable to open file: %s"), path);
         goto error;
@@ -239,6 +247,7 @@ virRotatingFileWriterNew(const char *path,
                          mode_t mode)
 {
     virRotatingFileWriterPtr file;
+    size_t i;
 
     if (VIR_ALLOC(file) < 0)
         goto error;
@@ -265,6 +274,22 @@ virRotatingFileWriterNew(const char *path,
                                                       mode)))
         goto error;
 
+    if (VIR_ALLOC_N(file->inodes, maxbackup + 1) < 0)
+        goto error;
+
+    file->inodes[0] = file->entry->inode;
+    for (i = 0; i < maxbackup; i++) {
+        char *backup;
+        struct stat sb;
+
+        if (virAsprintf(&backup, "%s.%zu", path, i) < 0)
+            goto error;
+
+        if (stat(backup, &sb) == 0)
+            file->inodes[i + 1] = sb.st_ino;
+        VIR_FREE(backup);
+    }
+
     return file;
 
  error:
@@ -327,6 +352,86 @@ virRotatingFileReaderNew(const char *path,
 }
 
 
+/**
+ * virRotatingFileWriterNewReader:
+ * @file: the file context of the writer
+ * @inode: the inode of the file to start reading from
+ * @offset: the offset within the file to start reading from
+ *
+ * Create a new object for reading the files written by @file, starting
+ * at @offset in the file identified by @inode. Unlike a reader created
+ * by virRotatingFileReaderNew, only the files from the requested one to
+ * the newest are opened, which the writer knows of without looking at
+ * the others. If no file matching @inode exists any more, reading
+ * starts at the beginning of the oldest file.
+ */
+virRotatingFileReaderPtr
+virRotatingFileWriterNewReader(virRotatingFileWriterPtr file,
+                               ino_t inode,
+                               off_t offset)
+{
+    virRotatingFileReaderPtr reader;
+    size_t first = 0;
+    size_t i;
+
+    for (i = 0; i <= file->maxbackup; i++) {
+        if (!file->inodes[i])
+            continue;
+        first = i;
+        if (file->inodes[i] == inode)
+            break;
+    }
+    if (i > file->maxbackup)
+        offset = 0;
+
+    VIR_DEBUG("Reading %s from file %zu offset %llu", file->basepath,
+              first, (unsigned long long)offset);
+
+    if (VIR_ALLOC(reader) < 0)
+        return NULL;
+
+    reader->nentries = first + 1;
+    if (VIR_ALLOC_N(reader->entries, reader->nentries) < 0)
+        goto error;
+
+    for (i = 0; i <= first; i++) {
+        virRotatingFileReaderEntryPtr entry;
+        char *path;
+
+        if (i == 0) {
+            entry = virRotatingFileReaderEntryNew(file->basepath);
+        } else {
+            if (virAsprintf(&path, "%s.%zu", file->basepath, i - 1) < 0)
+                goto error;
+            entry = virRotatingFileReaderEntryNew(path);
+            VIR_FREE(path);
+        }
+
+        if (!(reader->entries[first - i] = entry))
+            goto error;
+    }
+
+    /* The files may have been moved behind our back */
+    if (reader->entries[0]->inode != file->inodes[first])
+        offset = 0;
+
+    if (reader->entries[0]->fd != -1 &&
+        lseek(reader->entries[0]->fd, offset, SEEK_SET) == (off_t)-1) {
+        virReportSystemError(errno,
+                             _("Unable to seek to inode %llu offset %llu"),
+                             (unsigned long long)inode,
+                             (unsigned long long)offset);
+        goto error;
+    }
+
+    return reader;
+
+ error:
+    virRotatingFileReaderFree(reader);
+    return NULL;
+}
+
+
 /**
  * virRotatingFileWriterGetPath:
  * @file: the file context
@@ -490,12 +595,17 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
             if (virRotatingFileWriterRollover(file) < 0)
                 return -1;
 
+            memmove(file->inodes + 1, file->inodes,
+                    file->maxbackup * sizeof(*file->inodes));
+            file->inodes[0] = 0;
+
             if (!(tmp = virRotatingFileWriterEntryNew(file->basepath,
                                                       file->mode)))
                 return -1;
 
             virRotatingFileWriterEntryFree(file->entry);
             file->entry = tmp;
+            file->inodes[0] = tmp->inode;
         }
     }
 
@@ -503,6 +613,75 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
 }
 
 
+/**
+ * virRotatingFileWriterAppendFD:
+ * @file: the file context
+ * @fd: the pipe to read data from
+ * @len: the maximum number of bytes to append
+ *
+ * Append up to @len bytes readable from the pipe @fd to the file.
+ * As long as the data can't make the file exceed its size limit, it
+ * is spliced from @fd without being copied through user space.
+ * Otherwise it is read and appended with virRotatingFileWriterAppend,
+ * which performs the rollover without splitting lines across files.
+ *
+ * Returns the number of bytes appended, which is 0 if nothing could be
+ * read from @fd, or -1 on error
+ */
+ssize_t
+virRotatingFileWriterAppendFD(virRotatingFileWriterPtr file,
+                              int fd,
+                              size_t len)
+{
+    char buf[8192];
+    ssize_t got;
+
+#if HAVE_SPLICE
+    if (!file->nosplice &&
+        file->entry->pos + len <= file->maxlen) {
+        do {
+            got = splice(fd, NULL, file->entry->fd, NULL, len,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } while (got < 0 && errno == EINTR);
+
+        if (got >= 0) {
+            file->entry->pos += got;
+            file->entry->len += got;
+            return got;
+        }
+
+        if (errno == EAGAIN)
+            return 0;
+
+        if (errno != EINVAL && errno != ENOSYS) {
+            virReportSystemError(errno,
+                                 _("Unable to write to file %s"),
+                                 file->basepath);
+            return -1;
+        }
+
+        /* The file system can't splice, stick to plain copies */
+        file->nosplice = true;
+    }
+#endif /* HAVE_SPLICE */
+
+    do {
+        got = read(fd, buf, MIN(len, sizeof(buf)));
+    } while (got < 0 && errno == EINTR);
+
+    if (got < 0) {
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Unable to read from log pipe"));
+        return -1;
+    }
+
+    return virRotatingFileWriterAppend(file, buf, got);
+}
+
+
 /**
  * virRotatingFileReaderSeek
  * @file: the file context
@@ -542,7 +721,7 @@ virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
     }
 
     file->current = 0;
-    ret = lseek(file->entries[0]->fd, offset, SEEK_SET);
+    ret = lseek(file->entries[0]->fd, 0, SEEK_SET);
     if (ret == (off_t)-1) {
         virReportSystemError(errno,
                              _("Unable to seek to inode %llu offset %llu"),
@@ -619,6 +798,7 @@ virRotatingFileWriterFree(virRotatingFileWriterPtr file)
         return;
 
     virRotatingFileWriterEntryFree(file->entry);
+    VIR_FREE(file->inodes);
     VIR_FREE(file->basepath);
     VIR_FREE(file);
 }
@@ -39,6 +39,10 @@ virRotatingFileWriterPtr virRotatingFileWriterNew(const char *path,
 virRotatingFileReaderPtr virRotatingFileReaderNew(const char *path,
                                                   size_t maxbackup);
 
+virRotatingFileReaderPtr virRotatingFileWriterNewReader(virRotatingFileWriterPtr file,
+                                                        ino_t inode,
+                                                        off_t offset);
+
 const char *virRotatingFileWriterGetPath(virRotatingFileWriterPtr file);
 
 ino_t virRotatingFileWriterGetINode(virRotatingFileWriterPtr file);
@@ -47,6 +51,9 @@ off_t virRotatingFileWriterGetOffset(virRotatingFileWriterPtr file);
 ssize_t virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
                                     const char *buf,
                                     size_t len);
+ssize_t virRotatingFileWriterAppendFD(virRotatingFileWriterPtr file,
+                                      int fd,
+                                      size_t len);
 
 int virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
                               ino_t inode,
@@ -2067,7 +2067,7 @@ virStorageSourceCopy(const virStorageSource *src,
 
     if (VIR_STRDUP(ret->path, src->path) < 0 ||
         VIR_STRDUP(ret->volume, src->volume) < 0 ||
-        VIR_STRDUP(ret->driverName, src->driverName) < 0 ||
+        virStringIntern(&ret->driverName, src->driverName) < 0 ||
         VIR_STRDUP(ret->relPath, src->relPath) < 0 ||
         VIR_STRDUP(ret->backingStoreRaw, src->backingStoreRaw) < 0 ||
         VIR_STRDUP(ret->snapshot, src->snapshot) < 0 ||
@@ -2155,7 +2155,7 @@ virStorageSourceInitChainElement(virStorageSourcePtr newelem,
         goto cleanup;
 
     if (!newelem->driverName &&
-        VIR_STRDUP(newelem->driverName, old->driverName) < 0)
+        virStringIntern(&newelem->driverName, old->driverName) < 0)
         goto cleanup;
 
     newelem->shared = old->shared;
@@ -2285,7 +2285,8 @@ virStorageSourceClear(virStorageSourcePtr def)
     VIR_FREE(def->snapshot);
     VIR_FREE(def->configFile);
     virStorageSourcePoolDefFree(def->srcpool);
-    VIR_FREE(def->driverName);
+    virStringInternFree(def->driverName);
+    def->driverName = NULL;
     virBitmapFree(def->features);
     VIR_FREE(def->compat);
     virStorageEncryptionFree(def->encryption);
@@ -246,7 +246,7 @@ struct _virStorageSource {
 
     virObjectPtr privateData;
 
-    char *driverName;
+    const char *driverName; /* interned, see virStringIntern */
     int format; /* virStorageFileFormat in domain backing chains, but
                  * pool-specific enum for storage volumes */
     virBitmapPtr features;
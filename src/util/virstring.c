@@ -33,6 +33,7 @@
 #include "viralloc.h"
 #include "virbuffer.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virlog.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -709,6 +710,8 @@ virVasprintfInternal(bool report,
         if (report)
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         *strp = NULL;
+    } else {
+        virAllocCountAdd(domcode, ret + 1);
     }
     return ret;
 }
@@ -943,6 +946,7 @@ virStrdup(char **dest,
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         return -1;
     }
+    virAllocCountAdd(domcode, strlen(*dest) + 1);
 
     return 1;
 }
@@ -989,6 +993,7 @@ virStrndup(char **dest,
             virReportOOMErrorFull(domcode, filename, funcname, linenr);
         return -1;
     }
+    virAllocCountAdd(domcode, strlen(*dest) + 1);
 
    return 1;
 }
@@ -1435,3 +1440,108 @@ virStringParsePort(const char *str,
 
     return 0;
 }
+
+
+typedef struct _virStringInternEntry virStringInternEntry;
+typedef virStringInternEntry *virStringInternEntryPtr;
+struct _virStringInternEntry {
+    char *str;
+    size_t refs;
+};
+
+static virMutex virStringInternLock = VIR_MUTEX_INITIALIZER;
+/* string -> virStringInternEntry */
+static virHashTablePtr virStringInternTable;
+
+
+static void
+virStringInternEntryFree(void *payload,
+                         const void *name ATTRIBUTE_UNUSED)
+{
+    virStringInternEntryPtr entry = payload;
+
+    VIR_FREE(entry->str);
+    VIR_FREE(entry);
+}
+
+
+/**
+ * virStringIntern:
+ * @dst: where to store the interned string
+ * @src: the string to intern, may be NULL
+ *
+ * Stores in @dst a copy of @src which is shared with every other user
+ * interning the same string. This is meant for strings with just a
+ * few distinct values which are repeated in many objects, such as disk
+ * driver names, to save both memory and allocations. The string must
+ * not be modified and has to be released by virStringInternFree()
+ * rather than freed.
+ *
+ * Returns -1 on error with error reported, 0 if @src was NULL (@dst is
+ * set to NULL then) and 1 otherwise, like VIR_STRDUP.
+ */
+int
+virStringIntern(const char **dst,
+                const char *src)
+{
+    virStringInternEntryPtr entry = NULL;
+    int ret = -1;
+
+    *dst = NULL;
+    if (!src)
+        return 0;
+
+    virMutexLock(&virStringInternLock);
+
+    if (!virStringInternTable &&
+        !(virStringInternTable = virHashCreate(32, virStringInternEntryFree)))
+        goto cleanup;
+
+    if (!(entry = virHashLookup(virStringInternTable, src))) {
+        if (VIR_ALLOC(entry) < 0 ||
+            VIR_STRDUP(entry->str, src) < 0 ||
+            virHashAddEntry(virStringInternTable, src, entry) < 0) {
+            if (entry)
+                VIR_FREE(entry->str);
+            VIR_FREE(entry);
+            goto cleanup;
+        }
+    }
+
+    entry->refs++;
+    *dst = entry->str;
+    ret = 1;
+
+ cleanup:
+    virMutexUnlock(&virStringInternLock);
+    return ret;
+}
+
+
+/**
+ * virStringInternFree:
+ * @str: string returned by virStringIntern, may be NULL
+ *
+ * Releases one reference to the interned @str.
+ */
+void
+virStringInternFree(const char *str)
+{
+    virStringInternEntryPtr entry;
+
+    if (!str)
+        return;
+
+    virMutexLock(&virStringInternLock);
+
+    if (virStringInternTable &&
+        (entry = virHashLookup(virStringInternTable, str)) &&
+        entry->str == str) {
+        if (--entry->refs == 0)
+            virHashRemoveEntry(virStringInternTable, str);
+    } else {
+        VIR_WARN("string '%s' was not interned", str);
+    }
+
+    virMutexUnlock(&virStringInternLock);
+}
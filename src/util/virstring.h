@@ -305,4 +305,8 @@ int virStringParsePort(const char *str,
                        unsigned int *port)
     ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+int virStringIntern(const char **dst, const char *src)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virStringInternFree(const char *str);
+
 #endif /* __VIR_STRING_H__ */
@@ -36,6 +36,7 @@
 #include "vircommand.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define __VIR_SYSINFO_PRIV_H_ALLOW__
 #include "virsysinfopriv.h"
@@ -55,15 +56,40 @@ static const char *sysinfoCpuinfo = "/proc/cpuinfo";
 #define CPUINFO sysinfoCpuinfo
 #define CPUINFO_FILE_LEN (1024*1024)    /* 1MB limit for /proc/cpuinfo file */
 
+/* The host data does not change while the daemon runs, so it is read once
+ * and every driver gets a copy of it */
+static virMutex sysinfoLock;
+static virSysinfoDefPtr sysinfoHost;
+
+static int
+virSysinfoOnceInit(void)
+{
+    if (virMutexInit(&sysinfoLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virSysinfo)
+
 
 void
 virSysinfoSetup(const char *dmidecode,
                 const char *sysinfo,
                 const char *cpuinfo)
 {
+    if (virSysinfoInitialize() < 0)
+        return;
+
+    virMutexLock(&sysinfoLock);
     sysinfoDmidecode = dmidecode;
     sysinfoSysinfo = sysinfo;
     sysinfoCpuinfo = cpuinfo;
+    virSysinfoDefFree(sysinfoHost);
+    sysinfoHost = NULL;
+    virMutexUnlock(&sysinfoLock);
 }
 
 void virSysinfoBIOSDefFree(virSysinfoBIOSDefPtr def)
@@ -159,6 +185,126 @@ void virSysinfoDefFree(virSysinfoDefPtr def)
 }
 
 
+/**
+ * virSysinfoDefCopy:
+ * @src: sysinfo definition to copy
+ *
+ * Returns a deep copy of @src, or NULL on error.
+ */
+virSysinfoDefPtr
+virSysinfoDefCopy(const virSysinfoDef *src)
+{
+    virSysinfoDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+
+    if (src->bios) {
+        if (VIR_ALLOC(def->bios) < 0 ||
+            VIR_STRDUP(def->bios->vendor, src->bios->vendor) < 0 ||
+            VIR_STRDUP(def->bios->version, src->bios->version) < 0 ||
+            VIR_STRDUP(def->bios->date, src->bios->date) < 0 ||
+            VIR_STRDUP(def->bios->release, src->bios->release) < 0)
+            goto error;
+    }
+
+    if (src->system) {
+        if (VIR_ALLOC(def->system) < 0 ||
+            VIR_STRDUP(def->system->manufacturer, src->system->manufacturer) < 0 ||
+            VIR_STRDUP(def->system->product, src->system->product) < 0 ||
+            VIR_STRDUP(def->system->version, src->system->version) < 0 ||
+            VIR_STRDUP(def->system->serial, src->system->serial) < 0 ||
+            VIR_STRDUP(def->system->uuid, src->system->uuid) < 0 ||
+            VIR_STRDUP(def->system->sku, src->system->sku) < 0 ||
+            VIR_STRDUP(def->system->family, src->system->family) < 0)
+            goto error;
+    }
+
+    if (src->nbaseBoard) {
+        if (VIR_ALLOC_N(def->baseBoard, src->nbaseBoard) < 0)
+            goto error;
+        def->nbaseBoard = src->nbaseBoard;
+    }
+
+    for (i = 0; i < src->nbaseBoard; i++) {
+        virSysinfoBaseBoardDefPtr dst = def->baseBoard + i;
+        const virSysinfoBaseBoardDef *board = src->baseBoard + i;
+
+        if (VIR_STRDUP(dst->manufacturer, board->manufacturer) < 0 ||
+            VIR_STRDUP(dst->product, board->product) < 0 ||
+            VIR_STRDUP(dst->version, board->version) < 0 ||
+            VIR_STRDUP(dst->serial, board->serial) < 0 ||
+            VIR_STRDUP(dst->asset, board->asset) < 0 ||
+            VIR_STRDUP(dst->location, board->location) < 0)
+            goto error;
+    }
+
+    if (src->nprocessor) {
+        if (VIR_ALLOC_N(def->processor, src->nprocessor) < 0)
+            goto error;
+        def->nprocessor = src->nprocessor;
+    }
+
+    for (i = 0; i < src->nprocessor; i++) {
+        virSysinfoProcessorDefPtr dst = def->processor + i;
+        const virSysinfoProcessorDef *proc = src->processor + i;
+
+        if (VIR_STRDUP(dst->processor_socket_destination,
+                       proc->processor_socket_destination) < 0 ||
+            VIR_STRDUP(dst->processor_type, proc->processor_type) < 0 ||
+            VIR_STRDUP(dst->processor_family, proc->processor_family) < 0 ||
+            VIR_STRDUP(dst->processor_manufacturer,
+                       proc->processor_manufacturer) < 0 ||
+            VIR_STRDUP(dst->processor_signature,
+                       proc->processor_signature) < 0 ||
+            VIR_STRDUP(dst->processor_version, proc->processor_version) < 0 ||
+            VIR_STRDUP(dst->processor_external_clock,
+                       proc->processor_external_clock) < 0 ||
+            VIR_STRDUP(dst->processor_max_speed,
+                       proc->processor_max_speed) < 0 ||
+            VIR_STRDUP(dst->processor_status, proc->processor_status) < 0 ||
+            VIR_STRDUP(dst->processor_serial_number,
+                       proc->processor_serial_number) < 0 ||
+            VIR_STRDUP(dst->processor_part_number,
+                       proc->processor_part_number) < 0)
+            goto error;
+    }
+
+    if (src->nmemory) {
+        if (VIR_ALLOC_N(def->memory, src->nmemory) < 0)
+            goto error;
+        def->nmemory = src->nmemory;
+    }
+
+    for (i = 0; i < src->nmemory; i++) {
+        virSysinfoMemoryDefPtr dst = def->memory + i;
+        const virSysinfoMemoryDef *mem = src->memory + i;
+
+        if (VIR_STRDUP(dst->memory_size, mem->memory_size) < 0 ||
+            VIR_STRDUP(dst->memory_form_factor, mem->memory_form_factor) < 0 ||
+            VIR_STRDUP(dst->memory_locator, mem->memory_locator) < 0 ||
+            VIR_STRDUP(dst->memory_bank_locator, mem->memory_bank_locator) < 0 ||
+            VIR_STRDUP(dst->memory_type, mem->memory_type) < 0 ||
+            VIR_STRDUP(dst->memory_type_detail, mem->memory_type_detail) < 0 ||
+            VIR_STRDUP(dst->memory_speed, mem->memory_speed) < 0 ||
+            VIR_STRDUP(dst->memory_manufacturer, mem->memory_manufacturer) < 0 ||
+            VIR_STRDUP(dst->memory_serial_number,
+                       mem->memory_serial_number) < 0 ||
+            VIR_STRDUP(dst->memory_part_number, mem->memory_part_number) < 0)
+            goto error;
+    }
+
+    return def;
+
+ error:
+    virSysinfoDefFree(def);
+    return NULL;
+}
+
+
 static int
 virSysinfoParsePPCSystem(const char *base, virSysinfoSystemDefPtr *sysdef)
 {
@@ -1045,15 +1191,8 @@ virSysinfoReadX86(void)
 }
 
 
-/**
- * virSysinfoRead:
- *
- * Tries to read the SMBIOS information from the current host
- *
- * Returns: a filled up sysinfo structure or NULL in case of error
- */
-virSysinfoDefPtr
-virSysinfoRead(void)
+static virSysinfoDefPtr
+virSysinfoReadHost(void)
 {
 #if defined(__powerpc__)
     return virSysinfoReadPPC();
@@ -1081,6 +1220,36 @@ virSysinfoRead(void)
 }
 
 
+/**
+ * virSysinfoRead:
+ *
+ * Tries to read the SMBIOS information from the current host. The host is
+ * only probed on the first successful call; later calls get a copy of the
+ * cached data.
+ *
+ * Returns: a filled up sysinfo structure or NULL in case of error
+ */
+virSysinfoDefPtr
+virSysinfoRead(void)
+{
+    virSysinfoDefPtr ret = NULL;
+
+    if (virSysinfoInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&sysinfoLock);
+
+    if (!sysinfoHost)
+        sysinfoHost = virSysinfoReadHost();
+
+    if (sysinfoHost)
+        ret = virSysinfoDefCopy(sysinfoHost);
+
+    virMutexUnlock(&sysinfoLock);
+    return ret;
+}
+
+
 static void
 virSysinfoBIOSFormat(virBufferPtr buf, virSysinfoBIOSDefPtr def)
 {
@@ -30,7 +30,25 @@
 #endif
 
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virthreadjob.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#if WITH_DTRACE_PROBES
+/* virprobe.h can't be used here as PROBE logs the event, and logging
+ * takes a mutex itself */
+# include "libvirt_probes.h"
+# define VIR_THREAD_LOCK_PROBE_ENABLED() \
+    LIBVIRT_THREAD_LOCK_CONTENDED_ENABLED()
+# define VIR_THREAD_LOCK_PROBE(lock, filename, funcname, linenr, waited) \
+    LIBVIRT_THREAD_LOCK_CONTENDED(lock, (char *) filename, \
+                                  (char *) funcname, (int) linenr, waited)
+#else
+# define VIR_THREAD_LOCK_PROBE_ENABLED() 0
+# define VIR_THREAD_LOCK_PROBE(lock, filename, funcname, linenr, waited)
+#endif
 
 
 /* Nothing special required for pthreads */
@@ -84,9 +102,152 @@ void virMutexDestroy(virMutexPtr m)
     pthread_mutex_destroy(&m->lock);
 }
 
-void virMutexLock(virMutexPtr m)
+
+/* Lock contention statistics, one entry per caller of the lock
+ * functions. Callers beyond VIR_THREAD_LOCK_STATS_MAX are accounted in
+ * the last entry. The table is protected by a plain pthread mutex so
+ * that updating it never recurses into the code being instrumented. */
+#define VIR_THREAD_LOCK_STATS_MAX 512
+
+static int lockStatsEnabled;
+static pthread_mutex_t lockStatsLock = PTHREAD_MUTEX_INITIALIZER;
+static virThreadLockStats lockStats[VIR_THREAD_LOCK_STATS_MAX + 1];
+static size_t nlockStats;
+
+/**
+ * virThreadLockStatsSetEnabled:
+ * @enabled: whether to collect lock contention statistics
+ *
+ * Enables or disables the collection of contention statistics by
+ * virMutexLock, virRWLockRead and virRWLockWrite. When enabled, every
+ * lock is first tried without blocking and, if it is busy, the time
+ * spent waiting for it is accounted to the source location of the
+ * caller. The statistics collected so far are kept.
+ */
+void virThreadLockStatsSetEnabled(bool enabled)
+{
+    virAtomicIntSet(&lockStatsEnabled, enabled ? 1 : 0);
+}
+
+/**
+ * virThreadLockStatsIsEnabled:
+ *
+ * Returns true if lock contention statistics are being collected
+ */
+bool virThreadLockStatsIsEnabled(void)
+{
+    return virAtomicIntGet(&lockStatsEnabled) != 0;
+}
+
+static void
+virThreadLockContended(void *lock,
+                       const char *filename,
+                       const char *funcname,
+                       size_t linenr,
+                       unsigned long long start)
+{
+    unsigned long long end = 0;
+    unsigned long long waited = 0;
+    size_t i;
+
+    if (virTimeMicrosNowRaw(&end) == 0 && end > start)
+        waited = end - start;
+
+    VIR_THREAD_LOCK_PROBE(lock, filename, funcname, linenr, waited);
+
+    if (!lockStatsEnabled)
+        return;
+
+    pthread_mutex_lock(&lockStatsLock);
+
+    for (i = 0; i < nlockStats; i++) {
+        if (lockStats[i].linenr == linenr &&
+            lockStats[i].filename == filename &&
+            lockStats[i].funcname == funcname)
+            break;
+    }
+
+    if (i == nlockStats) {
+        if (nlockStats < VIR_THREAD_LOCK_STATS_MAX) {
+            lockStats[i].filename = filename;
+            lockStats[i].funcname = funcname;
+            lockStats[i].linenr = linenr;
+            nlockStats++;
+        } else {
+            i = VIR_THREAD_LOCK_STATS_MAX;
+        }
+    }
+
+    lockStats[i].contended++;
+    lockStats[i].waited += waited;
+
+    pthread_mutex_unlock(&lockStatsLock);
+}
+
+/**
+ * virThreadLockStatsGet:
+ * @stats: filled with an array of statistics
+ * @nstats: filled with the number of elements of @stats
+ *
+ * Gets the contention statistics collected while
+ * virThreadLockStatsSetEnabled was in effect, one element per source
+ * location which had to wait for a lock at least once. The strings
+ * point to static data of the callers.
+ *
+ * Returns 0 on success, allocating @stats which the caller is
+ * responsible for freeing, -1 on error.
+ */
+int virThreadLockStatsGet(virThreadLockStatsPtr *stats,
+                          size_t *nstats)
+{
+    virThreadLockStatsPtr tmp;
+    size_t i;
+
+    *stats = NULL;
+    *nstats = 0;
+
+    /* Allocate upfront: reporting an OOM error takes locks */
+    if (VIR_ALLOC_N(tmp, VIR_THREAD_LOCK_STATS_MAX + 1) < 0)
+        return -1;
+
+    pthread_mutex_lock(&lockStatsLock);
+    for (i = 0; i < nlockStats; i++)
+        tmp[(*nstats)++] = lockStats[i];
+    if (lockStats[VIR_THREAD_LOCK_STATS_MAX].contended)
+        tmp[(*nstats)++] = lockStats[VIR_THREAD_LOCK_STATS_MAX];
+    pthread_mutex_unlock(&lockStatsLock);
+
+    *stats = tmp;
+    return 0;
+}
+
+#define VIR_THREAD_LOCK_STATS_WANTED() \
+    (lockStatsEnabled || VIR_THREAD_LOCK_PROBE_ENABLED())
+
+void virMutexLockFull(virMutexPtr m,
+                      const char *filename,
+                      const char *funcname,
+                      size_t linenr)
 {
+    unsigned long long start = 0;
+
+    if (!VIR_THREAD_LOCK_STATS_WANTED()) {
+        pthread_mutex_lock(&m->lock);
+        return;
+    }
+
+    if (pthread_mutex_trylock(&m->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
     pthread_mutex_lock(&m->lock);
+    virThreadLockContended(m, filename, funcname, linenr, start);
+}
+
+/* Returns 0 if the lock was acquired, -1 if it is held by someone else */
+int virMutexTryLock(virMutexPtr m)
+{
+    return pthread_mutex_trylock(&m->lock) == 0 ? 0 : -1;
 }
 
 void virMutexUnlock(virMutexPtr m)
@@ -112,14 +273,54 @@ void virRWLockDestroy(virRWLockPtr m)
 }
 
 
-void virRWLockRead(virRWLockPtr m)
+void virRWLockReadFull(virRWLockPtr m,
+                       const char *filename,
+                       const char *funcname,
+                       size_t linenr)
 {
+    unsigned long long start = 0;
+
+    if (!VIR_THREAD_LOCK_STATS_WANTED()) {
+        pthread_rwlock_rdlock(&m->lock);
+        return;
+    }
+
+    if (pthread_rwlock_tryrdlock(&m->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
     pthread_rwlock_rdlock(&m->lock);
+    virThreadLockContended(m, filename, funcname, linenr, start);
 }
 
-void virRWLockWrite(virRWLockPtr m)
+void virRWLockWriteFull(virRWLockPtr m,
+                        const char *filename,
+                        const char *funcname,
+                        size_t linenr)
 {
+    unsigned long long start = 0;
+
+    if (!VIR_THREAD_LOCK_STATS_WANTED()) {
+        pthread_rwlock_wrlock(&m->lock);
+        return;
+    }
+
+    if (pthread_rwlock_trywrlock(&m->lock) == 0)
+        return;
+
+    ignore_value(virTimeMicrosNowRaw(&start));
     pthread_rwlock_wrlock(&m->lock);
+    virThreadLockContended(m, filename, funcname, linenr, start);
+}
+
+int virRWLockTryRead(virRWLockPtr m)
+{
+    return pthread_rwlock_tryrdlock(&m->lock) == 0 ? 0 : -1;
+}
+
+int virRWLockTryWrite(virRWLockPtr m)
+{
+    return pthread_rwlock_trywrlock(&m->lock) == 0 ? 0 : -1;
 }
 
 
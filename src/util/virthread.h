@@ -131,18 +131,55 @@ int virMutexInit(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 int virMutexInitRecursive(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 void virMutexDestroy(virMutexPtr m);
 
-void virMutexLock(virMutexPtr m);
+/* The lock functions take the location of their caller so that
+ * contention can be attributed to it, see virThreadLockStatsSetEnabled */
+void virMutexLockFull(virMutexPtr m,
+                      const char *filename,
+                      const char *funcname,
+                      size_t linenr);
+# define virMutexLock(m) \
+    virMutexLockFull(m, __FILE__, __func__, __LINE__)
+int virMutexTryLock(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 void virMutexUnlock(virMutexPtr m);
 
 
 int virRWLockInit(virRWLockPtr m) ATTRIBUTE_RETURN_CHECK;
 void virRWLockDestroy(virRWLockPtr m);
 
-void virRWLockRead(virRWLockPtr m);
-void virRWLockWrite(virRWLockPtr m);
+void virRWLockReadFull(virRWLockPtr m,
+                       const char *filename,
+                       const char *funcname,
+                       size_t linenr);
+# define virRWLockRead(m) \
+    virRWLockReadFull(m, __FILE__, __func__, __LINE__)
+void virRWLockWriteFull(virRWLockPtr m,
+                        const char *filename,
+                        const char *funcname,
+                        size_t linenr);
+# define virRWLockWrite(m) \
+    virRWLockWriteFull(m, __FILE__, __func__, __LINE__)
+int virRWLockTryRead(virRWLockPtr m) ATTRIBUTE_RETURN_CHECK;
+int virRWLockTryWrite(virRWLockPtr m) ATTRIBUTE_RETURN_CHECK;
 void virRWLockUnlock(virRWLockPtr m);
 
 
+typedef struct _virThreadLockStats virThreadLockStats;
+typedef virThreadLockStats *virThreadLockStatsPtr;
+struct _virThreadLockStats {
+    const char *filename; /* NULL for callers not fitting in the table */
+    const char *funcname;
+    size_t linenr;
+    unsigned long long contended; /* number of times the lock was busy */
+    unsigned long long waited; /* total wait time in microseconds */
+};
+
+void virThreadLockStatsSetEnabled(bool enabled);
+bool virThreadLockStatsIsEnabled(void);
+int virThreadLockStatsGet(virThreadLockStatsPtr *stats,
+                          size_t *nstats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+
 int virCondInit(virCondPtr c) ATTRIBUTE_RETURN_CHECK;
 int virCondDestroy(virCondPtr c);
 
@@ -30,27 +30,50 @@
 #include "viralloc.h"
 #include "virthread.h"
 #include "virerror.h"
+#include "virtime.h"
+#include "virhash.h"
+#include "virhashcode.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+VIR_ENUM_IMPL(virThreadPoolPriority, VIR_THREAD_POOL_PRIORITY_LAST,
+              "normal", "high", "urgent")
+
+VIR_ENUM_IMPL(virThreadPoolLatencyBucket, VIR_THREAD_POOL_LATENCY_LAST,
+              "1ms", "10ms", "100ms", "1s", "10s", "inf")
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
 struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
-    unsigned int priority;
+    unsigned long long queued;
 
     void *data;
 };
 
+/* Jobs of a single owner queued at one priority level */
+typedef struct _virThreadPoolJobQueue virThreadPoolJobQueue;
+typedef virThreadPoolJobQueue *virThreadPoolJobQueuePtr;
+
+struct _virThreadPoolJobQueue {
+    virThreadPoolJobQueuePtr next;
+    const void *owner;
+
+    virThreadPoolJobPtr head;
+    virThreadPoolJobPtr tail;
+};
+
+/* Each priority level keeps a ring of owners with queued jobs and takes
+ * one job from each owner in turn, so that an owner queueing lots of
+ * jobs cannot delay those of the others */
 typedef struct _virThreadPoolJobList virThreadPoolJobList;
 typedef virThreadPoolJobList *virThreadPoolJobListPtr;
 
 struct _virThreadPoolJobList {
-    virThreadPoolJobPtr head;
-    virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
+    virThreadPoolJobQueuePtr head;
+    virThreadPoolJobQueuePtr tail;
+    virHashTablePtr owners;
 };
 
 
@@ -60,8 +83,13 @@ struct _virThreadPool {
     virThreadPoolJobFunc jobFunc;
     const char *jobFuncName;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
+    virThreadPoolJobList jobList[VIR_THREAD_POOL_PRIORITY_LAST];
     size_t jobQueueDepth;
+    size_t prioJobQueueDepth;
+
+    /* Time jobs spent queued, per priority level */
+    unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                              [VIR_THREAD_POOL_LATENCY_LAST];
 
     virMutex mutex;
     virCond cond;
@@ -93,6 +121,151 @@ static inline bool virThreadPoolWorkerQuitHelper(size_t count, size_t limit)
     return count > limit;
 }
 
+/* Pick the queue the next job should be taken from: the highest non-empty
+ * priority level, but never below HIGH for priority workers. Returns -1 if
+ * there is nothing the worker may run.
+ */
+static int
+virThreadPoolNextJobLevel(virThreadPoolPtr pool, bool priority)
+{
+    int level;
+    int lowest = priority ? VIR_THREAD_POOL_PRIORITY_HIGH :
+                            VIR_THREAD_POOL_PRIORITY_NORMAL;
+
+    for (level = VIR_THREAD_POOL_PRIORITY_LAST - 1; level >= lowest; level--) {
+        if (pool->jobList[level].head)
+            return level;
+    }
+
+    return -1;
+}
+
+static void
+virThreadPoolRecordLatency(virThreadPoolPtr pool,
+                           int level,
+                           virThreadPoolJobPtr job)
+{
+    unsigned long long now;
+    unsigned long long waited = 0;
+    unsigned long long limit = 1;
+    size_t bucket;
+
+    if (virTimeMillisNowRaw(&now) == 0 && now > job->queued)
+        waited = now - job->queued;
+
+    for (bucket = 0; bucket < VIR_THREAD_POOL_LATENCY_INF; bucket++) {
+        if (waited < limit)
+            break;
+        limit *= 10;
+    }
+
+    pool->latency[level][bucket]++;
+}
+
+static uint32_t
+virThreadPoolOwnerCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(&name, sizeof(name), seed);
+}
+
+
+static bool
+virThreadPoolOwnerEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+
+
+static void *
+virThreadPoolOwnerCopy(const void *name)
+{
+    return (void *)name;
+}
+
+
+static int
+virThreadPoolJobListInit(virThreadPoolJobListPtr list)
+{
+    if (!(list->owners = virHashCreateFull(32, NULL,
+                                           virThreadPoolOwnerCode,
+                                           virThreadPoolOwnerEqual,
+                                           virThreadPoolOwnerCopy,
+                                           NULL)))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virThreadPoolJobListPush(virThreadPoolJobListPtr list,
+                         const void *owner,
+                         virThreadPoolJobPtr job)
+{
+    virThreadPoolJobQueuePtr queue;
+
+    if (!(queue = virHashLookup(list->owners, owner))) {
+        if (VIR_ALLOC(queue) < 0)
+            return -1;
+        queue->owner = owner;
+
+        if (virHashAddEntry(list->owners, owner, queue) < 0) {
+            VIR_FREE(queue);
+            return -1;
+        }
+
+        if (list->tail)
+            list->tail->next = queue;
+        else
+            list->head = queue;
+        list->tail = queue;
+    }
+
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+
+    return 0;
+}
+
+
+static virThreadPoolJobPtr
+virThreadPoolJobListPop(virThreadPoolJobListPtr list)
+{
+    virThreadPoolJobQueuePtr queue = list->head;
+    virThreadPoolJobPtr job;
+
+    if (!queue)
+        return NULL;
+
+    job = queue->head;
+    queue->head = job->next;
+    job->next = NULL;
+
+    /* Move the owner to the back of the ring, or drop it if it has
+     * nothing else queued */
+    list->head = queue->next;
+    queue->next = NULL;
+    if (!list->head)
+        list->tail = NULL;
+
+    if (queue->head) {
+        if (list->tail)
+            list->tail->next = queue;
+        else
+            list->head = queue;
+        list->tail = queue;
+    } else {
+        virHashRemoveEntry(list->owners, queue->owner);
+        VIR_FREE(queue);
+    }
+
+    return job;
+}
+
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
@@ -102,6 +275,7 @@ static void virThreadPoolWorker(void *opaque)
     size_t *curWorkers = priority ? &pool->nPrioWorkers : &pool->nWorkers;
     size_t *maxLimit = priority ? &pool->maxPrioWorkers : &pool->maxWorkers;
     virThreadPoolJobPtr job = NULL;
+    int level;
 
     VIR_FREE(data);
 
@@ -117,8 +291,8 @@ static void virThreadPoolWorker(void *opaque)
         if (virThreadPoolWorkerQuitHelper(*curWorkers, *maxLimit))
             goto out;
         while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
+               ((!priority && !pool->jobQueueDepth) ||
+                (priority && !pool->prioJobQueueDepth))) {
             if (!priority)
                 pool->freeWorkers++;
             if (virCondWait(cond, &pool->mutex) < 0) {
@@ -136,32 +310,16 @@ static void virThreadPoolWorker(void *opaque)
         if (pool->quit)
             break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
+        if ((level = virThreadPoolNextJobLevel(pool, priority)) < 0)
+            continue;
 
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority)
-                    break;
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
+        job = virThreadPoolJobListPop(&pool->jobList[level]);
 
         pool->jobQueueDepth--;
+        if (level >= VIR_THREAD_POOL_PRIORITY_HIGH)
+            pool->prioJobQueueDepth--;
+
+        virThreadPoolRecordLatency(pool, level, job);
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
@@ -226,6 +384,7 @@ virThreadPoolNewFull(size_t minWorkers,
                      void *opaque)
 {
     virThreadPoolPtr pool;
+    size_t i;
 
     if (minWorkers > maxWorkers)
         minWorkers = maxWorkers;
@@ -233,8 +392,6 @@ virThreadPoolNewFull(size_t minWorkers,
     if (VIR_ALLOC(pool) < 0)
         return NULL;
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobFuncName = funcName;
     pool->jobOpaque = opaque;
@@ -246,6 +403,11 @@ virThreadPoolNewFull(size_t minWorkers,
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
 
+    for (i = 0; i < VIR_THREAD_POOL_PRIORITY_LAST; i++) {
+        if (virThreadPoolJobListInit(&pool->jobList[i]) < 0)
+            goto error;
+    }
+
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
     pool->maxPrioWorkers = prioWorkers;
@@ -273,6 +435,7 @@ void virThreadPoolFree(virThreadPoolPtr pool)
 {
     virThreadPoolJobPtr job;
     bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
@@ -289,9 +452,12 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
+    for (i = 0; i < VIR_THREAD_POOL_PRIORITY_LAST; i++) {
+        if (!pool->jobList[i].owners)
+            continue;
+        while ((job = virThreadPoolJobListPop(&pool->jobList[i])))
+            VIR_FREE(job);
+        virHashFree(pool->jobList[i].owners);
     }
 
     VIR_FREE(pool->workers);
@@ -373,13 +539,41 @@ size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
     return ret;
 }
 
+void virThreadPoolGetJobLatency(virThreadPoolPtr pool,
+                                unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                                                          [VIR_THREAD_POOL_LATENCY_LAST])
+{
+    virMutexLock(&pool->mutex);
+    memcpy(latency, pool->latency, sizeof(pool->latency));
+    virMutexUnlock(&pool->mutex);
+}
+
 /*
- * @priority - job priority
+ * @priority - job priority, one of virThreadPoolPriority; larger values
+ *             are treated as the highest priority level
  * Return: 0 on success, -1 otherwise
  */
 int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
+{
+    return virThreadPoolSendJobFull(pool, priority, NULL, jobData);
+}
+
+/*
+ * @priority - job priority, one of virThreadPoolPriority; larger values
+ *             are treated as the highest priority level
+ * @owner - who the job is run on behalf of, or NULL
+ *
+ * Jobs of the same priority are run in the order they were queued,
+ * except that different owners take turns.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *owner,
+                             void *jobData)
 {
     virThreadPoolJobPtr job;
 
@@ -395,24 +589,28 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
     if (VIR_ALLOC(job) < 0)
         goto error;
 
-    job->data = jobData;
-    job->priority = priority;
+    if (priority >= VIR_THREAD_POOL_PRIORITY_LAST)
+        priority = VIR_THREAD_POOL_PRIORITY_LAST - 1;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
+    job->data = jobData;
+    if (virTimeMillisNowRaw(&job->queued) < 0)
+        job->queued = 0;
 
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
+    /* Jobs without an owner all share one turn */
+    if (!owner)
+        owner = pool;
 
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    if (virThreadPoolJobListPush(&pool->jobList[priority], owner, job) < 0) {
+        VIR_FREE(job);
+        goto error;
+    }
 
     pool->jobQueueDepth++;
+    if (priority >= VIR_THREAD_POOL_PRIORITY_HIGH)
+        pool->prioJobQueueDepth++;
 
     virCondSignal(&pool->cond);
-    if (priority)
+    if (priority >= VIR_THREAD_POOL_PRIORITY_HIGH)
         virCondSignal(&pool->prioCond);
 
     virMutexUnlock(&pool->mutex);
@@ -27,12 +27,41 @@
 # define __VIR_THREADPOOL_H__
 
 # include "internal.h"
+# include "virutil.h"
 
 typedef struct _virThreadPool virThreadPool;
 typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+/* Jobs are queued per priority level and the highest non-empty level is
+ * always served first. Priority workers only pick up jobs of
+ * VIR_THREAD_POOL_PRIORITY_HIGH and above. Within a level, the owners
+ * of the jobs take turns. */
+typedef enum {
+    VIR_THREAD_POOL_PRIORITY_NORMAL = 0,
+    VIR_THREAD_POOL_PRIORITY_HIGH,
+    VIR_THREAD_POOL_PRIORITY_URGENT,
+
+    VIR_THREAD_POOL_PRIORITY_LAST
+} virThreadPoolPriority;
+
+/* Queue latency histogram buckets, each one covering wait times below
+ * 10^n milliseconds, with the last one catching everything else. */
+typedef enum {
+    VIR_THREAD_POOL_LATENCY_1MS = 0,
+    VIR_THREAD_POOL_LATENCY_10MS,
+    VIR_THREAD_POOL_LATENCY_100MS,
+    VIR_THREAD_POOL_LATENCY_1S,
+    VIR_THREAD_POOL_LATENCY_10S,
+    VIR_THREAD_POOL_LATENCY_INF,
+
+    VIR_THREAD_POOL_LATENCY_LAST
+} virThreadPoolLatencyBucket;
+
+VIR_ENUM_DECL(virThreadPoolPriority)
+VIR_ENUM_DECL(virThreadPoolLatencyBucket)
+
 # define virThreadPoolNew(min, max, prio, func, opaque) \
     virThreadPoolNewFull(min, max, prio, func, #func, opaque)
 
@@ -49,6 +78,9 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetCurrentWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetFreeWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool);
+void virThreadPoolGetJobLatency(virThreadPoolPtr pool,
+                                unsigned long long latency[VIR_THREAD_POOL_PRIORITY_LAST]
+                                                          [VIR_THREAD_POOL_LATENCY_LAST]);
 
 void virThreadPoolFree(virThreadPoolPtr pool);
 
@@ -57,6 +89,12 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *owner,
+                             void *jobdata) ATTRIBUTE_NONNULL(1)
+                                            ATTRIBUTE_RETURN_CHECK;
+
 int virThreadPoolSetParameters(virThreadPoolPtr pool,
                                long long int minWorkers,
                                long long int maxWorkers,
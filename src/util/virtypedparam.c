@@ -1375,12 +1375,13 @@ virTypedParamsRemoteFree(virTypedParameterRemotePtr remote_params_val,
  *
  * Returns 0 on success or -1 in case of an error.
  */
-int
-virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
-                          unsigned int remote_params_len,
-                          int limit,
-                          virTypedParameterPtr *params,
-                          int *nparams)
+static int
+virTypedParamsDeserializeInternal(virTypedParameterRemotePtr remote_params,
+                                  unsigned int remote_params_len,
+                                  int limit,
+                                  virTypedParameterPtr *params,
+                                  int *nparams,
+                                  bool borrow)
 {
     size_t i = 0;
     int rv = -1;
@@ -1447,8 +1448,10 @@ virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
                 remote_param->value.remote_typed_param_value.b;
             break;
         case VIR_TYPED_PARAM_STRING:
-            if (VIR_STRDUP(param->value.s,
-                           remote_param->value.remote_typed_param_value.s) < 0)
+            if (borrow)
+                param->value.s = remote_param->value.remote_typed_param_value.s;
+            else if (VIR_STRDUP(param->value.s,
+                                remote_param->value.remote_typed_param_value.s) < 0)
                 goto cleanup;
             break;
         default:
@@ -1462,7 +1465,13 @@ virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
 
  cleanup:
     if (rv < 0) {
-        if (userAllocated) {
+        if (borrow) {
+            if (userAllocated) {
+                memset(*params, 0, sizeof(**params) * i);
+            } else {
+                VIR_FREE(*params);
+            }
+        } else if (userAllocated) {
             virTypedParamsClear(*params, i);
         } else {
             virTypedParamsFree(*params, i);
@@ -1473,6 +1482,47 @@ virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
 }
 
 
+int
+virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
+                          unsigned int remote_params_len,
+                          int limit,
+                          virTypedParameterPtr *params,
+                          int *nparams)
+{
+    return virTypedParamsDeserializeInternal(remote_params, remote_params_len,
+                                             limit, params, nparams, false);
+}
+
+
+/**
+ * virTypedParamsDeserializeBorrow:
+ * @remote_params: protocol data to be deserialized (obtained from remote side)
+ * @remote_params_len: number of parameters returned in @remote_params
+ * @limit: user specified maximum limit to @remote_params_len
+ * @params: pointer which will hold the deserialized @remote_params data
+ * @nparams: number of entries in @params
+ *
+ * Works as virTypedParamsDeserialize except that string values in @params
+ * point to the strings in @remote_params rather than to copies of them.
+ * This saves copying the strings again when @params is only needed while
+ * @remote_params exist, e.g. in server side dispatchers. The strings must
+ * not be freed, i.e. only the array allocated for @params is to be freed
+ * with VIR_FREE.
+ *
+ * Returns 0 on success or -1 in case of an error.
+ */
+int
+virTypedParamsDeserializeBorrow(virTypedParameterRemotePtr remote_params,
+                                unsigned int remote_params_len,
+                                int limit,
+                                virTypedParameterPtr *params,
+                                int *nparams)
+{
+    return virTypedParamsDeserializeInternal(remote_params, remote_params_len,
+                                             limit, params, nparams, true);
+}
+
+
 /**
  * virTypedParamsSerialize:
  * @params: array of parameters to be serialized and later sent to remote side
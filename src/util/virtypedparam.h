@@ -112,6 +112,12 @@ int virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
                               virTypedParameterPtr *params,
                               int *nparams);
 
+int virTypedParamsDeserializeBorrow(virTypedParameterRemotePtr remote_params,
+                                    unsigned int remote_params_len,
+                                    int limit,
+                                    virTypedParameterPtr *params,
+                                    int *nparams);
+
 int virTypedParamsSerialize(virTypedParameterPtr params,
                             int nparams,
                             virTypedParameterRemotePtr *remote_params_val,
@@ -37,6 +37,10 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "virobject.h"
+#include "virthread.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_XML
 
@@ -49,6 +53,153 @@ struct virParserData {
     int domcode;
 };
 
+/* Compiled expressions are kept for this many distinct XPath strings at
+ * most, so that strings built at runtime can't grow the cache without
+ * bounds. Anything beyond is compiled on each evaluation. */
+#define VIR_XPATH_CACHE_MAX 2048
+
+struct _virXPathCache {
+    virObjectRWLockable parent;
+
+    virHashTablePtr exprs; /* XPath string -> xmlXPathCompExprPtr */
+};
+
+static virClassPtr virXPathCacheClass;
+static void virXPathCacheDispose(void *obj);
+
+static int
+virXPathCacheOnceInit(void)
+{
+    if (!(virXPathCacheClass = virClassNew(virClassForObjectRWLockable(),
+                                           "virXPathCache",
+                                           sizeof(virXPathCache),
+                                           virXPathCacheDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virXPathCache)
+
+
+static void
+virXPathCacheExprFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    xmlXPathFreeCompExpr(payload);
+}
+
+
+/**
+ * virXPathCacheNew:
+ *
+ * Creates a cache of compiled XPath expressions. Once attached to an
+ * XPath context with virXPathContextSetCache, the virXPath* helpers
+ * compile every distinct expression only once and reuse it in all the
+ * contexts sharing the cache. The cache is safe to use from multiple
+ * threads at once.
+ *
+ * Returns the new cache or NULL on error.
+ */
+virXPathCachePtr
+virXPathCacheNew(void)
+{
+    virXPathCachePtr cache;
+
+    if (virXPathCacheInitialize() < 0)
+        return NULL;
+
+    if (!(cache = virObjectRWLockableNew(virXPathCacheClass)))
+        return NULL;
+
+    if (!(cache->exprs = virHashCreate(256, virXPathCacheExprFree))) {
+        virObjectUnref(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+static void
+virXPathCacheDispose(void *obj)
+{
+    virXPathCachePtr cache = obj;
+
+    virHashFree(cache->exprs);
+}
+
+
+/**
+ * virXPathContextSetCache:
+ * @ctxt: an XPath context
+ * @cache: cache of compiled expressions
+ *
+ * Makes the virXPath* helpers evaluate expressions in @ctxt using the
+ * compiled expressions from @cache. The caller has to make sure @cache
+ * outlives @ctxt.
+ */
+void
+virXPathContextSetCache(xmlXPathContextPtr ctxt,
+                        virXPathCachePtr cache)
+{
+    ctxt->userData = cache;
+}
+
+
+static xmlXPathCompExprPtr
+virXPathCacheLookup(virXPathCachePtr cache,
+                    const char *xpath)
+{
+    xmlXPathCompExprPtr comp;
+
+    virObjectRWLockRead(cache);
+    comp = virHashLookup(cache->exprs, xpath);
+    virObjectRWUnlock(cache);
+
+    if (comp)
+        return comp;
+
+    if (!(comp = xmlXPathCompile(BAD_CAST xpath)))
+        return NULL;
+
+    virObjectRWLockWrite(cache);
+    if (virHashSize(cache->exprs) >= VIR_XPATH_CACHE_MAX) {
+        virObjectRWUnlock(cache);
+        xmlXPathFreeCompExpr(comp);
+        return NULL;
+    }
+
+    /* somebody else may have been faster */
+    if (virHashLookup(cache->exprs, xpath) ||
+        virHashAddEntry(cache->exprs, xpath, comp) < 0) {
+        xmlXPathFreeCompExpr(comp);
+        comp = virHashLookup(cache->exprs, xpath);
+    }
+    virObjectRWUnlock(cache);
+
+    return comp;
+}
+
+
+/*
+ * Evaluates @xpath in @ctxt, using the cache of compiled expressions
+ * attached to @ctxt if there is one.
+ */
+static xmlXPathObjectPtr
+virXPathEval(const char *xpath,
+             xmlXPathContextPtr ctxt)
+{
+    virXPathCachePtr cache = ctxt->userData;
+    xmlXPathCompExprPtr comp;
+
+    if (cache && virObjectIsClass(cache, virXPathCacheClass) &&
+        (comp = virXPathCacheLookup(cache, xpath)))
+        return xmlXPathCompiledEval(comp, ctxt);
+
+    return xmlXPathEval(BAD_CAST xpath, ctxt);
+}
+
 
 /**
  * virXPathString:
@@ -74,7 +225,7 @@ virXPathString(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_STRING) ||
         (obj->stringval == NULL) || (obj->stringval[0] == 0)) {
@@ -151,7 +302,7 @@ virXPathNumber(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NUMBER) ||
         (isnan(obj->floatval))) {
@@ -180,7 +331,7 @@ virXPathLongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -285,7 +436,7 @@ virXPathULongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -401,7 +552,7 @@ virXPathULongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -447,7 +598,7 @@ virXPathLongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -573,7 +724,7 @@ virXPathBoolean(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_BOOLEAN) ||
         (obj->boolval < 0) || (obj->boolval > 1)) {
@@ -610,7 +761,7 @@ virXPathNode(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NODESET) ||
         (obj->nodesetval == NULL) || (obj->nodesetval->nodeNr <= 0) ||
@@ -654,7 +805,7 @@ virXPathNodeSet(const char *xpath,
         *list = NULL;
 
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if (obj == NULL)
         return 0;
@@ -1315,22 +1466,202 @@ virXMLValidatorValidate(virXMLValidatorPtr validator,
 }
 
 
+/* A compiled RNG schema, shared by all the validations against its file
+ * for as long as the file does not change */
+typedef struct _virXMLSchema virXMLSchema;
+typedef virXMLSchema *virXMLSchemaPtr;
+struct _virXMLSchema {
+    virObject parent;
+
+    xmlRelaxNGPtr rng;
+
+    /* Identity of the file @rng was compiled from */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+static virClassPtr virXMLSchemaClass;
+static virMutex virXMLSchemaLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virXMLSchemas; /* schema file -> virXMLSchemaPtr */
+
+static void virXMLSchemaDispose(void *obj);
+
+static int
+virXMLSchemaOnceInit(void)
+{
+    if (!(virXMLSchemaClass = virClassNew(virClassForObject(),
+                                          "virXMLSchema",
+                                          sizeof(virXMLSchema),
+                                          virXMLSchemaDispose)))
+        return -1;
+
+    if (!(virXMLSchemas = virHashCreate(10, virObjectFreeHashData)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virXMLSchema)
+
+
+static void
+virXMLSchemaDispose(void *obj)
+{
+    virXMLSchemaPtr schema = obj;
+
+    xmlRelaxNGFree(schema->rng);
+}
+
+
+static virXMLSchemaPtr
+virXMLSchemaNew(const char *schemafile,
+                const struct stat *sb)
+{
+    virXMLSchemaPtr schema = NULL;
+    xmlRelaxNGParserCtxtPtr rngParser = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    if (!(rngParser = xmlRelaxNGNewParserCtxt(schemafile))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to create RNG parser for %s"),
+                       schemafile);
+        goto cleanup;
+    }
+
+    xmlRelaxNGSetParserErrors(rngParser,
+                              catchRNGError,
+                              ignoreRNGError,
+                              &buf);
+
+    if (!(schema = virObjectNew(virXMLSchemaClass)))
+        goto cleanup;
+
+    if (!(schema->rng = xmlRelaxNGParse(rngParser))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse RNG %s: %s"),
+                       schemafile,
+                       virBufferCurrentContent(&buf));
+        virObjectUnref(schema);
+        schema = NULL;
+        goto cleanup;
+    }
+
+    schema->dev = sb->st_dev;
+    schema->ino = sb->st_ino;
+    schema->size = sb->st_size;
+    schema->mtime = get_stat_mtime(sb);
+
+ cleanup:
+    xmlRelaxNGFreeParserCtxt(rngParser);
+    virBufferFreeAndReset(&buf);
+    return schema;
+}
+
+
+/*
+ * Returns a reference to the compiled @schemafile, compiling it if it
+ * was not yet or if it has changed since. Files included by the schema
+ * are not checked for changes.
+ */
+static virXMLSchemaPtr
+virXMLSchemaGet(const char *schemafile)
+{
+    virXMLSchemaPtr schema;
+    struct stat sb;
+    struct timespec mtime;
+
+    if (virXMLSchemaInitialize() < 0)
+        return NULL;
+
+    if (stat(schemafile, &sb) < 0) {
+        virReportSystemError(errno, _("Unable to access RNG %s"),
+                             schemafile);
+        return NULL;
+    }
+    mtime = get_stat_mtime(&sb);
+
+    /* Compiling under the lock makes concurrent validations against a
+     * new schema wait for a single compilation */
+    virMutexLock(&virXMLSchemaLock);
+
+    schema = virHashLookup(virXMLSchemas, schemafile);
+    if (!schema ||
+        schema->dev != sb.st_dev ||
+        schema->ino != sb.st_ino ||
+        schema->size != sb.st_size ||
+        schema->mtime.tv_sec != mtime.tv_sec ||
+        schema->mtime.tv_nsec != mtime.tv_nsec) {
+        if (!(schema = virXMLSchemaNew(schemafile, &sb)))
+            goto cleanup;
+
+        if (virHashUpdateEntry(virXMLSchemas, schemafile, schema) < 0) {
+            virObjectUnref(schema);
+            schema = NULL;
+            goto cleanup;
+        }
+    }
+
+    virObjectRef(schema);
+
+ cleanup:
+    virMutexUnlock(&virXMLSchemaLock);
+    return schema;
+}
+
+
+/**
+ * virXMLValidateAgainstSchema:
+ * @schemafile: path to the RNG schema
+ * @doc: document to validate
+ *
+ * Validates @doc against @schemafile. The compiled schema is kept for
+ * the whole process and shared by concurrent callers, so only the first
+ * validation against a schema file, or the first one after it changed,
+ * pays for compiling it.
+ *
+ * Returns 0 if @doc is valid, -1 with an error reported otherwise.
+ */
 int
 virXMLValidateAgainstSchema(const char *schemafile,
                             xmlDocPtr doc)
 {
-    virXMLValidatorPtr validator = NULL;
+    virXMLSchemaPtr schema;
+    xmlRelaxNGValidCtxtPtr rngValid = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
     int ret = -1;
 
-    if (!(validator = virXMLValidatorInit(schemafile)))
+    if (!(schema = virXMLSchemaGet(schemafile)))
         return -1;
 
-    if (virXMLValidatorValidate(validator, doc) < 0)
+    /* A validation context is cheap and, unlike the compiled schema,
+     * must not be used by several threads at once */
+    if (!(rngValid = xmlRelaxNGNewValidCtxt(schema->rng))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to create RNG validation context %s"),
+                       schemafile);
         goto cleanup;
+    }
+
+    xmlRelaxNGSetValidErrors(rngValid,
+                             catchRNGError,
+                             ignoreRNGError,
+                             &buf);
+
+    if (xmlRelaxNGValidateDoc(rngValid, doc) != 0) {
+        virReportError(VIR_ERR_XML_INVALID_SCHEMA,
+                       _("Unable to validate doc against %s\n%s"),
+                       schemafile,
+                       virBufferCurrentContent(&buf));
+        goto cleanup;
+    }
 
     ret = 0;
  cleanup:
-    virXMLValidatorFree(validator);
+    xmlRelaxNGFreeValidCtxt(rngValid);
+    virBufferFreeAndReset(&buf);
+    virObjectUnref(schema);
     return ret;
 }
 
@@ -32,6 +32,14 @@
 
 # include "virbuffer.h"
 
+typedef struct _virXPathCache virXPathCache;
+typedef virXPathCache *virXPathCachePtr;
+
+virXPathCachePtr virXPathCacheNew(void);
+void virXPathContextSetCache(xmlXPathContextPtr ctxt,
+                             virXPathCachePtr cache)
+    ATTRIBUTE_NONNULL(1);
+
 int              virXPathBoolean(const char *xpath,
                                  xmlXPathContextPtr ctxt);
 char *            virXPathString(const char *xpath,
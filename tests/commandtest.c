@@ -27,6 +27,7 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 
 #include "testutils.h"
@@ -39,6 +40,7 @@
 #include "virthread.h"
 #include "virstring.h"
 #include "virprocess.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -1138,6 +1140,89 @@ static int test25(const void *unused ATTRIBUTE_UNUSED)
 }
 
 
+/*
+ * Run program, no args, inherit all ENV, keep CWD.
+ * Only stdin/out/err open, plus one passed FD far above
+ * the others; a leaked FD in between must be closed.
+ */
+static int test26(const void *unused ATTRIBUTE_UNUSED)
+{
+    virCommandPtr cmd = virCommandNew(abs_builddir "/commandhelper");
+    int newfd1 = dup2(STDERR_FILENO, 200);
+    int newfd2 = dup2(STDERR_FILENO, 300);
+    int ret = -1;
+
+    if (newfd1 < 0 || newfd2 < 0) {
+        puts("cannot dup2 fds");
+        goto cleanup;
+    }
+
+    virCommandPassFD(cmd, newfd2, 0);
+
+    if (virCommandRun(cmd, NULL) < 0) {
+        printf("Cannot run child %s\n", virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    ret = checkoutput("test26", NULL);
+
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FORCE_CLOSE(newfd1);
+    VIR_FORCE_CLOSE(newfd2);
+    return ret;
+}
+
+
+/*
+ * Benchmark spawning a trivial child with the FD limit raised
+ * as far as the hard limit allows.
+ */
+static int test27(const void *unused ATTRIBUTE_UNUSED)
+{
+    unsigned long long start;
+    unsigned long long end;
+    struct rlimit rlim;
+    struct rlimit orig;
+    size_t i;
+    int ret = -1;
+
+    if (getrlimit(RLIMIT_NOFILE, &orig) < 0)
+        return -1;
+
+    rlim = orig;
+    rlim.rlim_cur = rlim.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        return -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 100; i++) {
+        virCommandPtr cmd = virCommandNew("/bin/true");
+        int rv = virCommandRun(cmd, NULL);
+
+        virCommandFree(cmd);
+        if (rv < 0) {
+            printf("Cannot run child %s\n", virGetLastErrorMessage());
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_DEBUG("spawned 100 children with RLIMIT_NOFILE=%llu in %llums\n",
+                   (unsigned long long) rlim.rlim_cur, end - start);
+
+    ret = 0;
+
+ cleanup:
+    ignore_value(setrlimit(RLIMIT_NOFILE, &orig));
+    return ret;
+}
+
+
 static void virCommandThreadWorker(void *opaque)
 {
     virCommandTestDataPtr test = opaque;
@@ -1214,6 +1299,7 @@ mymain(void)
      * since we're about to reset 'environ' */
     ignore_value(virTestGetDebug());
     ignore_value(virTestGetVerbose());
+    ignore_value(virTestGetExpensive());
 
     /* Make sure to not leak fd's */
     virinitret = virInitialize();
@@ -1236,6 +1322,11 @@ mymain(void)
     if (virinitret < 0)
         return EXIT_FAILURE;
 
+    /* The expected logs assume the event loop holds only its wakeup
+     * pipe, so keep the epoll backend from taking another fd.  */
+    if (setenv("LIBVIRT_EVENT_BACKEND", "poll", 1) < 0)
+        return EXIT_FAILURE;
+
     virEventRegisterDefaultImpl();
     if (VIR_ALLOC(test) < 0)
         goto cleanup;
@@ -1291,6 +1382,10 @@ mymain(void)
     DO_TEST(test23);
     DO_TEST(test24);
     DO_TEST(test25);
+    DO_TEST(test26);
+
+    if (virTestGetExpensive())
+        DO_TEST(test27);
 
     virMutexLock(&test->lock);
     if (test->running) {
@@ -571,6 +571,188 @@ cpuTestGetCPUModels(const struct data *data,
 #endif
 
 
+/* Host CPUs decoded from cputestdata, used by cpuTestBenchFleet */
+static virCPUDefPtr *fleet;
+static size_t nfleet;
+
+
+static int
+cpuTestBenchDecode(const void *opaque)
+{
+    const virCPUData *hostData = opaque;
+    virCPUDefPtr cpu;
+    int ret;
+
+    if (VIR_ALLOC(cpu) < 0)
+        return -1;
+
+    cpu->arch = hostData->arch;
+    cpu->type = VIR_CPU_TYPE_HOST;
+
+    ret = cpuDecode(cpu, hostData, NULL);
+    virCPUDefFree(cpu);
+    return ret;
+}
+
+
+static int
+cpuTestBenchCPUID(const struct data *data,
+                  const virCPUData *hostData)
+{
+    virCPUDefPtr cpu = NULL;
+    int ret = -1;
+
+    if (virTestBench(data->host, "decode", cpuTestBenchDecode, hostData) < 0)
+        return -1;
+
+    if (data->arch != VIR_ARCH_X86_64)
+        return 0;
+
+    if (VIR_ALLOC(cpu) < 0)
+        goto cleanup;
+
+    cpu->arch = hostData->arch;
+    cpu->type = VIR_CPU_TYPE_HOST;
+
+    if (cpuDecode(cpu, hostData, NULL) < 0 ||
+        VIR_APPEND_ELEMENT(fleet, nfleet, cpu) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCPUDefFree(cpu);
+    return ret;
+}
+
+
+struct cpuTestFleet {
+    virCPUDefPtr *cpus;
+    size_t ncpus;
+    virCPUDefPtr baseline;
+};
+
+
+static int
+cpuTestBenchBaseline(const void *opaque)
+{
+    const struct cpuTestFleet *group = opaque;
+    virCPUDefPtr baseline;
+
+    if (!(baseline = cpuBaseline(group->cpus, group->ncpus, NULL, false)))
+        return -1;
+
+    virCPUDefFree(baseline);
+    return 0;
+}
+
+
+static int
+cpuTestBenchCompare(const void *opaque)
+{
+    const struct cpuTestFleet *group = opaque;
+    size_t i;
+
+    for (i = 0; i < group->ncpus; i++) {
+        if (virCPUCompare(group->cpus[i]->arch, group->cpus[i],
+                          group->baseline, false) == VIR_CPU_COMPARE_ERROR)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/* Updates a host-model guest CPU for each host as done on domain start */
+static int
+cpuTestBenchUpdate(const void *opaque)
+{
+    const struct cpuTestFleet *group = opaque;
+    virCPUDefPtr guest = NULL;
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < group->ncpus; i++) {
+        if (VIR_ALLOC(guest) < 0)
+            goto cleanup;
+
+        guest->type = VIR_CPU_TYPE_GUEST;
+        guest->mode = VIR_CPU_MODE_HOST_MODEL;
+        guest->match = VIR_CPU_MATCH_EXACT;
+
+        if (virCPUUpdate(group->cpus[i]->arch, guest, group->cpus[i]) < 0)
+            goto cleanup;
+
+        virCPUDefFree(guest);
+        guest = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCPUDefFree(guest);
+    return ret;
+}
+
+
+/* Baselines all x86_64 hosts from cputestdata sharing a CPU vendor and
+ * compares each of them with the result, which is what a scheduler does
+ * when looking for a CPU model usable across a heterogeneous fleet.
+ */
+static int
+cpuTestBenchFleet(const void *arg ATTRIBUTE_UNUSED)
+{
+    struct cpuTestFleet group = { NULL, 0, NULL };
+    char *name = NULL;
+    int ret = -1;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < nfleet; i++) {
+        const char *vendor = fleet[i]->vendor;
+        bool seen = false;
+
+        for (j = 0; j < i; j++) {
+            if (STREQ_NULLABLE(fleet[j]->vendor, vendor))
+                seen = true;
+        }
+        if (seen)
+            continue;
+
+        group.ncpus = 0;
+        for (j = i; j < nfleet; j++) {
+            if (STREQ_NULLABLE(fleet[j]->vendor, vendor) &&
+                VIR_APPEND_ELEMENT_COPY(group.cpus, group.ncpus, fleet[j]) < 0)
+                goto cleanup;
+        }
+
+        if (virAsprintf(&name, "fleet-%s-%zu",
+                        NULLSTR(vendor), group.ncpus) < 0 ||
+            !(group.baseline = cpuBaseline(group.cpus, group.ncpus,
+                                           NULL, false)))
+            goto cleanup;
+
+        if (virTestBench(name, "baseline", cpuTestBenchBaseline, &group) < 0 ||
+            virTestBench(name, "compare", cpuTestBenchCompare, &group) < 0 ||
+            virTestBench(name, "update", cpuTestBenchUpdate, &group) < 0)
+            goto cleanup;
+
+        virCPUDefFree(group.baseline);
+        group.baseline = NULL;
+        VIR_FREE(group.cpus);
+        VIR_FREE(name);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCPUDefFree(group.baseline);
+    VIR_FREE(group.cpus);
+    VIR_FREE(name);
+    return ret;
+}
+
+
 static int
 cpuTestCPUID(bool guest, const void *arg)
 {
@@ -616,6 +798,10 @@ cpuTestCPUID(bool guest, const void *arg)
     if (cpuDecode(cpu, hostData, models) < 0)
         goto cleanup;
 
+    if (!guest && virTestGetBench() &&
+        cpuTestBenchCPUID(data, hostData) < 0)
+        goto cleanup;
+
     if (virAsprintf(&result, "cpuid-%s-%s",
                     data->host,
                     guest ? "guest" : "host") < 0)
@@ -910,6 +1096,7 @@ mymain(void)
     virDomainCapsCPUModelsPtr haswell = NULL;
     virDomainCapsCPUModelsPtr ppc_models = NULL;
     int ret = 0;
+    size_t i;
 
 #if WITH_QEMU && WITH_YAJL
     if (qemuTestDriverInit(&driver) < 0)
@@ -1198,6 +1385,10 @@ mymain(void)
     DO_TEST_CPUID(VIR_ARCH_X86_64, "Xeon-W3520", JSON_HOST);
     DO_TEST_CPUID(VIR_ARCH_X86_64, "Xeon-X5460", JSON_NONE);
 
+    if (virTestGetBench() &&
+        virTestRun("CPUID fleet benchmark", cpuTestBenchFleet, NULL) < 0)
+        ret = -1;
+
  cleanup:
 #if WITH_QEMU && WITH_YAJL
     qemuTestDriverFree(&driver);
@@ -1209,6 +1400,10 @@ mymain(void)
     virObjectUnref(haswell);
     virObjectUnref(ppc_models);
 
+    for (i = 0; i < nfleet; i++)
+        virCPUDefFree(fleet[i]);
+    VIR_FREE(fleet);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
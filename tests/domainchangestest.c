@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library;  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#include "virerror.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Keep in sync with VIR_DOMAIN_OBJ_LIST_TOMBSTONES_MAX */
+#define TOMBSTONES_MAX 1024
+
+static const char domainDefFmt[] =
+"<domain type='test'>"
+"  <name>%s</name>"
+"  <memory>8388608</memory>"
+"  <currentMemory>2097152</currentMemory>"
+"  <vcpu>2</vcpu>"
+"  <os>"
+"    <type>hvm</type>"
+"  </os>"
+"</domain>";
+
+
+typedef struct {
+    virDomainPtr *changed;
+    virDomainPtr *removed;
+    int nchanged;
+} domainChanges;
+
+
+static void
+domainChangesClear(domainChanges *changes)
+{
+    virDomainPtr *tmp;
+
+    for (tmp = changes->changed; tmp && *tmp; tmp++)
+        virObjectUnref(*tmp);
+    for (tmp = changes->removed; tmp && *tmp; tmp++)
+        virObjectUnref(*tmp);
+
+    VIR_FREE(changes->changed);
+    VIR_FREE(changes->removed);
+    changes->nchanged = 0;
+}
+
+
+static int
+domainChangesGet(virConnectPtr conn,
+                 unsigned long long *cursor,
+                 domainChanges *changes)
+{
+    domainChangesClear(changes);
+
+    if ((changes->nchanged = virConnectListDomainChanges(conn, cursor,
+                                                         &changes->changed,
+                                                         &changes->removed,
+                                                         0)) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static bool
+domainListHas(virDomainPtr *list,
+              const char *name)
+{
+    for (; list && *list; list++) {
+        if (STREQ(virDomainGetName(*list), name))
+            return true;
+    }
+
+    return false;
+}
+
+
+static size_t
+domainListCount(virDomainPtr *list)
+{
+    size_t n = 0;
+
+    for (; list && *list; list++)
+        n++;
+
+    return n;
+}
+
+
+static virDomainPtr
+domainDefine(virConnectPtr conn,
+             const char *name)
+{
+    char *xml = NULL;
+    virDomainPtr dom;
+
+    if (virAsprintf(&xml, domainDefFmt, name) < 0)
+        return NULL;
+
+    dom = virDomainDefineXML(conn, xml);
+    VIR_FREE(xml);
+    return dom;
+}
+
+
+/* Returns the cursor after a full listing, or 0 on error */
+static unsigned long long
+domainChangesSync(virConnectPtr conn)
+{
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor = 0;
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        cursor = 0;
+
+    domainChangesClear(&changes);
+    return cursor;
+}
+
+
+static int
+testResync(const void *data)
+{
+    virConnectPtr conn = (virConnectPtr) data;
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor = 0;
+    int nall;
+    int ret = -1;
+
+    if ((nall = virConnectNumOfDomains(conn) +
+                virConnectNumOfDefinedDomains(conn)) < 0)
+        goto cleanup;
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (cursor == 0 || changes.removed ||
+        changes.nchanged != nall ||
+        domainListCount(changes.changed) != nall ||
+        !domainListHas(changes.changed, "test")) {
+        VIR_TEST_DEBUG("expected all %d domains and no removed list", nall);
+        goto cleanup;
+    }
+
+    /* A cursor from the future, e.g. issued before the daemon was
+     * restarted, has to result in a full listing too */
+    cursor += 1000000;
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.removed || changes.nchanged != nall) {
+        VIR_TEST_DEBUG("unknown cursor did not cause a resync");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    domainChangesClear(&changes);
+    return ret;
+}
+
+
+static int
+testNoChanges(const void *data)
+{
+    virConnectPtr conn = (virConnectPtr) data;
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor;
+    unsigned long long prev;
+    int ret = -1;
+
+    if (!(cursor = domainChangesSync(conn)))
+        goto cleanup;
+
+    prev = cursor;
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.nchanged != 0 || !changes.removed ||
+        domainListCount(changes.removed) != 0 || cursor < prev) {
+        VIR_TEST_DEBUG("expected no changes, got %d", changes.nchanged);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    domainChangesClear(&changes);
+    return ret;
+}
+
+
+static int
+testDefineUndefine(const void *data)
+{
+    virConnectPtr conn = (virConnectPtr) data;
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor;
+    virDomainPtr dom = NULL;
+    int ret = -1;
+
+    if (!(cursor = domainChangesSync(conn)))
+        goto cleanup;
+
+    if (!(dom = domainDefine(conn, "changes-define")))
+        goto cleanup;
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.nchanged != 1 ||
+        !domainListHas(changes.changed, "changes-define") ||
+        domainListCount(changes.removed) != 0) {
+        VIR_TEST_DEBUG("defined domain not reported as changed");
+        goto cleanup;
+    }
+
+    if (virDomainUndefine(dom) < 0)
+        goto cleanup;
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.nchanged != 0 || !changes.removed ||
+        domainListCount(changes.removed) != 1 ||
+        !domainListHas(changes.removed, "changes-define")) {
+        VIR_TEST_DEBUG("undefined domain not reported as removed");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    domainChangesClear(&changes);
+    virObjectUnref(dom);
+    return ret;
+}
+
+
+typedef struct {
+    int (*change)(virDomainPtr dom);
+} domainChangeData;
+
+static int
+domainChangeAutostart(virDomainPtr dom)
+{
+    return virDomainSetAutostart(dom, 1);
+}
+
+static int
+domainChangeMemory(virDomainPtr dom)
+{
+    return virDomainSetMemory(dom, 1048576);
+}
+
+static int
+domainChangeMaxMemory(virDomainPtr dom)
+{
+    return virDomainSetMaxMemory(dom, 4194304);
+}
+
+static int
+domainChangeVcpus(virDomainPtr dom)
+{
+    return virDomainSetVcpusFlags(dom, 1, VIR_DOMAIN_AFFECT_LIVE);
+}
+
+/* Undefining a running domain keeps it around as transient */
+static int
+domainChangeUndefine(virDomainPtr dom)
+{
+    return virDomainUndefine(dom);
+}
+
+
+static int
+testChange(const void *data)
+{
+    const domainChangeData *info = data;
+    virConnectPtr conn = NULL;
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor;
+    virDomainPtr dom = NULL;
+    int ret = -1;
+
+    /* Each change gets a fresh copy of the default config */
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (!(dom = virDomainLookupByName(conn, "test")))
+        goto cleanup;
+
+    if (!(cursor = domainChangesSync(conn)))
+        goto cleanup;
+
+    if (info->change(dom) < 0)
+        goto cleanup;
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.nchanged != 1 ||
+        !domainListHas(changes.changed, "test") ||
+        domainListCount(changes.removed) != 0) {
+        VIR_TEST_DEBUG("changed domain not reported");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    domainChangesClear(&changes);
+    virObjectUnref(dom);
+    if (conn)
+        virConnectClose(conn);
+    return ret;
+}
+
+
+static int
+testTombstoneExpiry(const void *data)
+{
+    virConnectPtr conn = (virConnectPtr) data;
+    domainChanges changes = { NULL, NULL, 0 };
+    unsigned long long cursor;
+    unsigned long long recent = 0;
+    virDomainPtr dom = NULL;
+    char *name = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(cursor = domainChangesSync(conn)))
+        goto cleanup;
+
+    /* Removing more domains than can be remembered expires the oldest
+     * tombstones; the old cursor then requires a resync, while a cursor
+     * issued after the first removal is still served incrementally. */
+    for (i = 0; i <= TOMBSTONES_MAX; i++) {
+        if (virAsprintf(&name, "changes-tomb-%zu", i) < 0)
+            goto cleanup;
+
+        if (!(dom = domainDefine(conn, name)) ||
+            virDomainUndefine(dom) < 0)
+            goto cleanup;
+
+        virObjectUnref(dom);
+        dom = NULL;
+        VIR_FREE(name);
+
+        if (i == 1 && !(recent = domainChangesSync(conn)))
+            goto cleanup;
+    }
+
+    if (domainChangesGet(conn, &cursor, &changes) < 0)
+        goto cleanup;
+
+    if (changes.removed ||
+        domainListHas(changes.changed, "changes-tomb-0")) {
+        VIR_TEST_DEBUG("expired cursor did not cause a resync");
+        goto cleanup;
+    }
+
+    if (domainChangesGet(conn, &recent, &changes) < 0)
+        goto cleanup;
+
+    if (!changes.removed || changes.nchanged != 0 ||
+        domainListCount(changes.removed) != TOMBSTONES_MAX - 1 ||
+        domainListHas(changes.removed, "changes-tomb-1") ||
+        !domainListHas(changes.removed, "changes-tomb-2")) {
+        VIR_TEST_DEBUG("expected %d removed domains, got %zu",
+                       TOMBSTONES_MAX - 1, domainListCount(changes.removed));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    domainChangesClear(&changes);
+    virObjectUnref(dom);
+    VIR_FREE(name);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    virConnectPtr conn;
+    int ret = 0;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        return EXIT_FAILURE;
+
+    if (virTestRun("Resync", testResync, conn) < 0)
+        ret = -1;
+    if (virTestRun("No changes", testNoChanges, conn) < 0)
+        ret = -1;
+    if (virTestRun("Define undefine", testDefineUndefine, conn) < 0)
+        ret = -1;
+    if (virTestRun("Tombstone expiry", testTombstoneExpiry, conn) < 0)
+        ret = -1;
+
+    virConnectClose(conn);
+
+#define DO_TEST_CHANGE(name) \
+    do { \
+        static domainChangeData info = { domainChange ## name }; \
+        if (virTestRun("Change " #name, testChange, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+    DO_TEST_CHANGE(Autostart);
+    DO_TEST_CHANGE(Memory);
+    DO_TEST_CHANGE(MaxMemory);
+    DO_TEST_CHANGE(Vcpus);
+    DO_TEST_CHANGE(Undefine);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -0,0 +1,307 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virCapsPtr caps;
+static virDomainXMLOptionPtr xmlopt;
+
+static virDomainDefParserConfig testParserConfig = {
+    .features = VIR_DOMAIN_DEF_FEATURE_INDIVIDUAL_VCPUS |
+                VIR_DOMAIN_DEF_FEATURE_USER_ALIAS,
+};
+
+struct testInfo {
+    const char *name;
+    bool live;
+};
+
+
+/*
+ * virDomainDefCopy must give the same result as formatting the
+ * definition into XML and parsing it again as inactive XML, which
+ * is how it used to copy definitions.
+ */
+static int
+testDomainDefCopyCompare(virDomainDefPtr def)
+{
+    char *xml = NULL;
+    char *expect = NULL;
+    char *actual = NULL;
+    virDomainDefPtr reparsed = NULL;
+    virDomainDefPtr copy = NULL;
+    int ret = -1;
+
+    if (!(xml = virDomainDefFormat(def, caps, VIR_DOMAIN_DEF_FORMAT_SECURE)) ||
+        !(reparsed = virDomainDefParseString(xml, caps, xmlopt, NULL,
+                                             VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                             VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)) ||
+        !(expect = virDomainDefFormat(reparsed, caps,
+                                      VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (!(copy = virDomainDefCopy(def, caps, xmlopt, NULL, false)) ||
+        !(actual = virDomainDefFormat(copy, caps,
+                                      VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (STRNEQ(expect, actual)) {
+        virTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(reparsed);
+    virDomainDefFree(copy);
+    VIR_FREE(xml);
+    VIR_FREE(expect);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static virDomainDefPtr
+testDomainDefCopyParse(const char *path,
+                       bool live)
+{
+    virDomainDefPtr def;
+    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+
+    if (!live)
+        parse_flags |= VIR_DOMAIN_DEF_PARSE_INACTIVE;
+
+    if (!(def = virDomainDefParseFile(path, caps, xmlopt, NULL, parse_flags)))
+        return NULL;
+
+    if (live)
+        def->id = 1;
+
+    return def;
+}
+
+
+static int
+testDomainDefCopy(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    char *path = NULL;
+    virDomainDefPtr def = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/qemuxml2argvdata/qemuxml2argv-%s.xml",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    if (!(def = testDomainDefCopyParse(path, info->live)))
+        goto cleanup;
+
+    ret = testDomainDefCopyCompare(def);
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/*
+ * Copy every definition of a directory of parser test data, so that
+ * a virDomainDef member added later without being handled by the
+ * native copy shows up as soon as there is test data using it. Files
+ * the generic capabilities of this test can't parse are skipped.
+ */
+static int
+testDomainDefCopyDir(const void *opaque)
+{
+    const char *name = opaque;
+    char *dirpath = NULL;
+    char *path = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    size_t ncopied = 0;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (virAsprintf(&dirpath, "%s/%s", abs_srcdir, name) < 0)
+        goto cleanup;
+
+    if (virDirOpen(&dir, dirpath) < 0)
+        goto cleanup;
+
+    ret = 0;
+    while ((rc = virDirRead(dir, &ent, dirpath)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirpath, ent->d_name) < 0) {
+            ret = -1;
+            break;
+        }
+
+        for (i = 0; i < 2; i++) {
+            virDomainDefPtr def;
+
+            if (!(def = testDomainDefCopyParse(path, i == 1))) {
+                virResetLastError();
+                continue;
+            }
+
+            if (testDomainDefCopyCompare(def) < 0) {
+                VIR_TEST_VERBOSE("\n%s copy of %s differs\n",
+                                 i == 1 ? "live" : "inactive", ent->d_name);
+                virResetLastError();
+                ret = -1;
+            }
+            ncopied++;
+            virDomainDefFree(def);
+        }
+
+        VIR_FREE(path);
+    }
+
+    if (rc < 0)
+        ret = -1;
+
+    VIR_TEST_DEBUG("copied %zu definitions from %s", ncopied, name);
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(dirpath);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testInitCaps(void)
+{
+    size_t i;
+
+    if (!(caps = virTestGenericCapsInit()))
+        return -1;
+
+    for (i = 0; i < caps->nguests; i++) {
+        if (!virCapabilitiesAddGuestDomain(caps->guests[i],
+                                           VIR_DOMAIN_VIRT_QEMU,
+                                           NULL, NULL, 0, NULL) ||
+            !virCapabilitiesAddGuestDomain(caps->guests[i],
+                                           VIR_DOMAIN_VIRT_KVM,
+                                           NULL, NULL, 0, NULL))
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (testInitCaps() < 0)
+        return EXIT_FAILURE;
+
+    if (!(xmlopt = virDomainXMLOptionNew(&testParserConfig,
+                                         NULL, NULL, NULL, NULL)))
+        return EXIT_FAILURE;
+
+#define DO_TEST_FULL(name, live) \
+    do { \
+        const struct testInfo info = { name, live }; \
+        if (virTestRun(live ? "DomainDefCopy live " name : \
+                              "DomainDefCopy " name, \
+                       testDomainDefCopy, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+#define DO_TEST(name) \
+    do { \
+        DO_TEST_FULL(name, false); \
+        DO_TEST_FULL(name, true); \
+    } while (0)
+
+#define DO_TEST_INACTIVE(name) \
+    DO_TEST_FULL(name, false)
+
+    DO_TEST("minimal");
+    DO_TEST("autoindex");
+    DO_TEST("boot-menu-enable");
+    DO_TEST("clock-variable");
+    DO_TEST("clock-timer-hyperv-rtc");
+    DO_TEST("cputune-numatune");
+    DO_TEST("numatune-memnode");
+    DO_TEST("hugepages-pages");
+    DO_TEST("blkiotune-device");
+    DO_TEST("smbios");
+    DO_TEST("cpu-host-model-features");
+    DO_TEST("hyperv");
+    DO_TEST("kvm-features");
+    DO_TEST("disk-drive-network-iscsi-auth");
+    DO_TEST("disk-drive-network-rbd");
+    DO_TEST("disk-geometry");
+    DO_TEST("disk-blockio");
+    DO_TEST("disk-cdrom-tray");
+    DO_TEST("luks-disks");
+    DO_TEST_INACTIVE("seclabel-dynamic-baselabel");
+    DO_TEST("seclabel-static");
+    DO_TEST("seclabel-none");
+    DO_TEST("net-virtio-device");
+    DO_TEST("net-vhostuser");
+    DO_TEST("net-bandwidth");
+    DO_TEST("net-openvswitch");
+    DO_TEST("net-mcast");
+    DO_TEST("serial-pty");
+    DO_TEST("serial-tcp-telnet-chardev");
+    DO_TEST("console-compat2");
+    DO_TEST("channel-guestfwd");
+    DO_TEST("channel-virtio-auto");
+    DO_TEST("chardev-reconnect");
+    DO_TEST("graphics-vnc");
+    DO_TEST("graphics-vnc-websocket");
+    DO_TEST("graphics-spice");
+    DO_TEST("graphics-spice-auto-socket");
+    DO_TEST("graphics-sdl");
+    DO_TEST("video-virtio-gpu-device");
+    DO_TEST("sound-device");
+    DO_TEST("usb-redir-filter");
+    DO_TEST("graphics-spice-usb-redir");
+    DO_TEST("virtio-rng-egd");
+    DO_TEST("virtio-rng-random");
+    DO_TEST("watchdog");
+    DO_TEST("balloon-device-period");
+    DO_TEST("panic");
+    DO_TEST("metadata");
+    DO_TEST("iothreads-ids");
+    DO_TEST("intel-iommu");
+    DO_TEST("virtio-options");
+
+    /* copied through XML */
+    DO_TEST("hostdev-pci-address");
+    DO_TEST("smartcard-host");
+    DO_TEST("tpm-passthrough");
+
+    if (virTestRun("DomainDefCopy all genericxml2xmlindata",
+                   testDomainDefCopyDir, "genericxml2xmlindata") < 0)
+        ret = -1;
+    if (virTestRun("DomainDefCopy all qemuxml2argvdata",
+                   testDomainDefCopyDir, "qemuxml2argvdata") < 0)
+        ret = -1;
+
+    virObjectUnref(caps);
+    virObjectUnref(xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -154,6 +154,28 @@ testTimer(int timer, void *data)
         virEventPollRemoveTimeout(info->delete);
 }
 
+static pthread_mutex_t affinityMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t affinityCond = PTHREAD_COND_INITIALIZER;
+static bool affinityFired;
+static pthread_t affinityThread;
+
+static void
+testAffinityReader(int watch ATTRIBUTE_UNUSED,
+                   int fd,
+                   int events ATTRIBUTE_UNUSED,
+                   void *data ATTRIBUTE_UNUSED)
+{
+    char one;
+
+    ignore_value(read(fd, &one, 1));
+
+    pthread_mutex_lock(&affinityMutex);
+    affinityFired = true;
+    affinityThread = pthread_self();
+    pthread_cond_signal(&affinityCond);
+    pthread_mutex_unlock(&affinityMutex);
+}
+
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t eventThreadRunCond = PTHREAD_COND_INITIALIZER;
 static int eventThreadRunOnce;
@@ -315,6 +337,7 @@ mymain(void)
 {
     size_t i;
     pthread_t eventThread;
+    bool failed;
     char one = '1';
 
     for (i = 0; i < NUM_FDS; i++) {
@@ -433,6 +456,17 @@ mymain(void)
 
     resetAll();
 
+    /* Two timers, make sure only the one due first fires */
+    virEventPollUpdateTimeout(timers[4].timer, 1000);
+    virEventPollUpdateTimeout(timers[5].timer, 100);
+    startJob();
+    if (finishJob("Firing the soonest timer", -1, 5) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    virEventPollUpdateTimeout(timers[4].timer, -1);
+    virEventPollUpdateTimeout(timers[5].timer, -1);
+
+    resetAll();
+
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
     virEventPollUpdateTimeout(timers[1].timer, 100);
@@ -523,6 +557,35 @@ mymain(void)
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    /* Handles with affinity must be served by an extra loop
+     * without the main loop running at all */
+    if (virEventPollStartLoops(2) < 0 ||
+        virEventPollAddHandleAffinity(handles[2].pipeFD[0],
+                                      VIR_EVENT_HANDLE_READABLE,
+                                      testAffinityReader,
+                                      NULL, NULL, 0, -1) < 0)
+        return EXIT_FAILURE;
+
+    pthread_mutex_lock(&affinityMutex);
+    if (safewrite(handles[2].pipeFD[1], &one, 1) != 1)
+        return EXIT_FAILURE;
+    while (!affinityFired) {
+        struct timespec waitTime;
+
+        clock_gettime(CLOCK_REALTIME, &waitTime);
+        waitTime.tv_sec += 5;
+        if (pthread_cond_timedwait(&affinityCond, &affinityMutex,
+                                   &waitTime) != 0)
+            break;
+    }
+    failed = !affinityFired ||
+             pthread_equal(affinityThread, eventThread) ||
+             pthread_equal(affinityThread, pthread_self());
+    testEventReport("Write with affinity", failed,
+                    failed ? "Handle was not dispatched from an extra loop\n"
+                           : NULL);
+    pthread_mutex_unlock(&affinityMutex);
+
     /* pthread_kill(eventThread, SIGTERM); */
 
     return EXIT_SUCCESS;
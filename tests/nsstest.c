@@ -28,6 +28,8 @@
 # include <arpa/inet.h>
 # include "libvirt_nss.h"
 # include "virsocketaddr.h"
+# include "virlease.h"
+# include "virfile.h"
 
 # define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -169,6 +171,81 @@ testGetHostByName(const void *opaque)
     return ret;
 }
 
+# define LEASE_INDEX abs_builddir "/nssdata-" VIR_LEASE_INDEX_FILE
+
+struct testLeaseIndexData {
+    int af;
+    char **addrs;
+};
+
+static int
+testLeaseIndexCallback(int family,
+                       const unsigned char *addr,
+                       void *opaque)
+{
+    struct testLeaseIndexData *data = opaque;
+    char buf[INET6_ADDRSTRLEN];
+    char **tmp;
+
+    if (family != data->af)
+        return 0;
+
+    if (!inet_ntop(family, addr, buf, sizeof(buf)) ||
+        !(tmp = virStringListAdd((const char **) data->addrs, buf)))
+        return -1;
+
+    virStringListFree(data->addrs);
+    data->addrs = tmp;
+    return 0;
+}
+
+static int
+testLeaseIndex(const void *opaque)
+{
+    const struct testNSSData *data = opaque;
+    struct testLeaseIndexData lookup = {
+        .af = data->af == AF_UNSPEC ? AF_INET : data->af, .addrs = NULL,
+    };
+    size_t i;
+    int ret = -1;
+
+#  if !defined(LIBVIRT_NSS_GUEST)
+    virLeaseIndexKeyType type = VIR_LEASE_INDEX_KEY_HOSTNAME;
+#  else
+    virLeaseIndexKeyType type = VIR_LEASE_INDEX_KEY_DOMAIN;
+#  endif
+
+    if (virLeaseIndexLookup(LEASE_INDEX, data->hostname, type, time(NULL),
+                            testLeaseIndexCallback, &lookup) != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Lookup of %s in the lease index failed",
+                       data->hostname);
+        goto cleanup;
+    }
+
+    for (i = 0; data->ipAddr[i]; i++) {
+        if (!virStringListHasString((const char **) lookup.addrs,
+                                    data->ipAddr[i])) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "Address %s missing in the lease index",
+                           data->ipAddr[i]);
+            goto cleanup;
+        }
+    }
+
+    if (virStringListLength((const char * const *) lookup.addrs) != i) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected %zu addresses, got %zu", i,
+                       virStringListLength((const char * const *) lookup.addrs));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virStringListFree(lookup.addrs);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -182,8 +259,13 @@ mymain(void)
         }; \
         if (virTestRun(name, testGetHostByName, &data) < 0) \
             ret = -1; \
+        if (virTestRun(name " (index)", testLeaseIndex, &data) < 0) \
+            ret = -1; \
     } while (0)
 
+    if (virLeaseIndexRebuild(abs_srcdir "/nssdata", LEASE_INDEX) < 0)
+        return EXIT_FAILURE;
+
 # if !defined(LIBVIRT_NSS_GUEST)
     DO_TEST("fedora", AF_INET, "192.168.122.197", "192.168.122.198", "192.168.122.199");
     DO_TEST("gentoo", AF_INET, "192.168.122.254");
@@ -195,6 +277,8 @@ mymain(void)
     DO_TEST("suse", AF_INET, "192.168.122.3");
 # endif /* defined(LIBVIRT_NSS_GUEST) */
 
+    unlink(LEASE_INDEX);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
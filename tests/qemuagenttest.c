@@ -53,9 +53,6 @@ testQemuAgentFSFreeze(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-freeze",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -104,9 +101,6 @@ testQemuAgentFSThaw(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -269,9 +263,6 @@ testQemuAgentGetFSInfo(const void *data)
         goto cleanup;
     }
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-get-fsinfo",
                                "{\"error\":"
                                "    {\"class\":\"CommandDisabled\","
@@ -563,9 +554,6 @@ testQemuAgentCPU(const void *data)
     if (qemuAgentUpdateCPUInfo(2, cpuinfo, nvcpus) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments1,
@@ -576,18 +564,12 @@ testQemuAgentCPU(const void *data)
         goto cleanup;
 
     /* try to hotplug two, second one will fail*/
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments2,
                                      NULL) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"error\" : \"random error\" }",
                                      "vcpus", testQemuAgentCPUArguments3,
@@ -654,6 +636,116 @@ testQemuAgentArbitraryCommand(const void *data)
 }
 
 
+static const char testQemuAgentArbitraryCommandBatchResponse[] =
+    "[{\"return\":\"bla\"},"
+    "{\"error\":{\"class\":\"CommandDisabled\",\"desc\":\"disabled\"}}]";
+
+static int
+testQemuAgentArbitraryCommandBatch(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewAgent(xmlopt);
+    int ret = -1;
+    char *reply = NULL;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "ble",
+                               testQemuAgentArbitraryCommandResponse) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "bla",
+                               "{\"error\":{\"class\":\"CommandDisabled\","
+                               "\"desc\":\"disabled\"}}") < 0)
+        goto cleanup;
+
+    /* still in sync after the batch, so no guest-sync before this one */
+    if (qemuMonitorTestAddItem(test, "ble",
+                               testQemuAgentArbitraryCommandResponse) < 0)
+        goto cleanup;
+
+    if (qemuAgentArbitraryCommand(qemuMonitorTestGetAgent(test),
+                                  "[{\"execute\":\"ble\"},"
+                                  "{\"execute\":\"bla\"}]",
+                                  &reply,
+                                  VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+
+    if (STRNEQ(reply, testQemuAgentArbitraryCommandBatchResponse)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "invalid processing of guest agent batch reply: "
+                       "got '%s' expected '%s'",
+                       reply, testQemuAgentArbitraryCommandBatchResponse);
+        goto cleanup;
+    }
+    VIR_FREE(reply);
+
+    if (qemuAgentArbitraryCommand(qemuMonitorTestGetAgent(test),
+                                  "{\"execute\":\"ble\"}",
+                                  &reply,
+                                  VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(reply);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
+static int
+testQemuAgentResyncAfterReset(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewAgent(xmlopt);
+    int ret = -1;
+    char *reply = NULL;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0 ||
+        qemuMonitorTestAddItem(test, "ble",
+                               testQemuAgentArbitraryCommandResponse) < 0)
+        goto cleanup;
+
+    if (qemuAgentArbitraryCommand(qemuMonitorTestGetAgent(test),
+                                  "{\"execute\":\"ble\"}",
+                                  &reply,
+                                  VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+    VIR_FREE(reply);
+
+    /* the agent restarted with the guest, so it has to be synced again */
+    qemuAgentNotifyEvent(qemuMonitorTestGetAgent(test),
+                         QEMU_AGENT_EVENT_RESET);
+
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0 ||
+        qemuMonitorTestAddItem(test, "ble",
+                               testQemuAgentArbitraryCommandResponse) < 0)
+        goto cleanup;
+
+    if (qemuAgentArbitraryCommand(qemuMonitorTestGetAgent(test),
+                                  "{\"execute\":\"ble\"}",
+                                  &reply,
+                                  VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(reply);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 qemuAgentTimeoutTestMonitorHandler(qemuMonitorTestPtr test ATTRIBUTE_UNUSED,
                                    qemuMonitorTestItemPtr item ATTRIBUTE_UNUSED,
@@ -930,6 +1022,8 @@ mymain(void)
     DO_TEST(Shutdown);
     DO_TEST(CPU);
     DO_TEST(ArbitraryCommand);
+    DO_TEST(ArbitraryCommandBatch);
+    DO_TEST(ResyncAfterReset);
     DO_TEST(GetInterfaces);
 
     DO_TEST(Timeout); /* Timeout should always be called last */
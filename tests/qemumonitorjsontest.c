@@ -1340,11 +1340,15 @@ GEN_TEST_FUNC(qemuMonitorJSONAddDevice, "some_dummy_devicestr")
 GEN_TEST_FUNC(qemuMonitorJSONSetDrivePassphrase, "drive-vda", "secret_passhprase")
 GEN_TEST_FUNC(qemuMonitorJSONDriveMirror, "vdb", "/foo/bar", NULL, 1024, 0, 0,
               VIR_DOMAIN_BLOCK_REBASE_SHALLOW | VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT)
+GEN_TEST_FUNC(qemuMonitorJSONDriveBackup, NULL, "vdb", "/foo/bar", NULL, "bitmap0",
+              1024, true)
+GEN_TEST_FUNC(qemuMonitorJSONAddBitmap, NULL, "vdb", "bitmap0", true)
 GEN_TEST_FUNC(qemuMonitorJSONBlockCommit, "vdb", "/foo/bar1", "/foo/bar2", NULL, 1024)
 GEN_TEST_FUNC(qemuMonitorJSONDrivePivot, "vdb")
 GEN_TEST_FUNC(qemuMonitorJSONScreendump, "/foo/bar")
 GEN_TEST_FUNC(qemuMonitorJSONOpenGraphics, "spice", "spicefd", false)
 GEN_TEST_FUNC(qemuMonitorJSONNBDServerStart, "localhost", 12345)
+GEN_TEST_FUNC(qemuMonitorJSONStartDirtyRateCalc, 1)
 GEN_TEST_FUNC(qemuMonitorJSONNBDServerAdd, "vda", true)
 GEN_TEST_FUNC(qemuMonitorJSONDetachCharDev, "serial1")
 
@@ -1352,7 +1356,9 @@ static bool
 testQemuMonitorJSONqemuMonitorJSONQueryCPUsEqual(struct qemuMonitorQueryCpusEntry *a,
                                                  struct qemuMonitorQueryCpusEntry *b)
 {
-    if (a->tid != b->tid ||
+    if (a->qemu_id != b->qemu_id ||
+        a->tid != b->tid ||
+        a->halted != b->halted ||
         STRNEQ_NULLABLE(a->qom_path, b->qom_path))
         return false;
 
@@ -1419,7 +1425,7 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
         goto cleanup;
 
     if (qemuMonitorJSONQueryCPUs(qemuMonitorTestGetMonitor(test),
-                                 &cpudata, &ncpudata, true) < 0)
+                                 &cpudata, &ncpudata, true, false) < 0)
         goto cleanup;
 
     if (ncpudata != 4) {
@@ -1445,6 +1451,79 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryCPUsFast(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+    struct qemuMonitorQueryCpusEntry *cpudata = NULL;
+    struct qemuMonitorQueryCpusEntry expect[] = {
+        {0, 17622, (char *) "/machine/unattached/device[0]", false},
+        {1, 17624, (char *) "/machine/unattached/device[1]", false},
+        {2, 17626, (char *) "/machine/unattached/device[2]", true},
+    };
+    size_t ncpudata = 0;
+    size_t i;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-cpus-fast",
+                               "{"
+                               "    \"return\": ["
+                               "        {"
+                               "            \"arch\": \"x86\","
+                               "            \"cpu-index\": 0,"
+                               "            \"qom-path\": \"/machine/unattached/device[0]\","
+                               "            \"thread-id\": 17622"
+                               "        },"
+                               "        {"
+                               "            \"arch\": \"s390\","
+                               "            \"cpu-index\": 1,"
+                               "            \"qom-path\": \"/machine/unattached/device[1]\","
+                               "            \"thread-id\": 17624,"
+                               "            \"cpu-state\": \"operating\""
+                               "        },"
+                               "        {"
+                               "            \"arch\": \"s390\","
+                               "            \"cpu-index\": 2,"
+                               "            \"qom-path\": \"/machine/unattached/device[2]\","
+                               "            \"thread-id\": 17626,"
+                               "            \"cpu-state\": \"stopped\""
+                               "        }"
+                               "    ],"
+                               "    \"id\": \"libvirt-7\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryCPUs(qemuMonitorTestGetMonitor(test),
+                                 &cpudata, &ncpudata, true, true) < 0)
+        goto cleanup;
+
+    if (ncpudata != 3) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expecting ncpupids = 3 but got %zu", ncpudata);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ncpudata; i++) {
+        if (!testQemuMonitorJSONqemuMonitorJSONQueryCPUsEqual(cpudata + i,
+                                                              expect + i)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "vcpu entry %zu does not match expected data", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorQueryCpusFree(cpudata, ncpudata);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetBalloonInfo(const void *data)
 {
@@ -1549,6 +1628,7 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockInfo(const void *data)
     int ret = -1;
     virHashTablePtr blockDevices = NULL, expectedBlockDevices = NULL;
     struct qemuDomainDiskInfo *info;
+    size_t i;
 
     if (!test)
         return -1;
@@ -1601,16 +1681,28 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockInfo(const void *data)
         goto cleanup;
     }
 
-    if (qemuMonitorTestAddItem(test, "query-block", queryBlockReply) < 0)
+    /* the second lookup is answered from the cache, the third one has to
+     * query QEMU again as the reset might have changed the devices */
+    if (qemuMonitorTestAddItem(test, "query-block", queryBlockReply) < 0 ||
+        qemuMonitorTestAddItem(test, "system_reset", "{\"return\":{}}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", queryBlockReply) < 0)
         goto cleanup;
 
-    if (qemuMonitorJSONGetBlockInfo(qemuMonitorTestGetMonitor(test), blockDevices) < 0)
-        goto cleanup;
+    for (i = 0; i < 3; i++) {
+        if (i == 2 &&
+            qemuMonitorJSONSystemReset(qemuMonitorTestGetMonitor(test)) < 0)
+            goto cleanup;
 
-    if (!virHashEqual(blockDevices, expectedBlockDevices, testHashEqualQemuDomainDiskInfo)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       "Hashtable is different to the expected one");
-        goto cleanup;
+        virHashRemoveAll(blockDevices);
+
+        if (qemuMonitorJSONGetBlockInfo(qemuMonitorTestGetMonitor(test), blockDevices) < 0)
+            goto cleanup;
+
+        if (!virHashEqual(blockDevices, expectedBlockDevices, testHashEqualQemuDomainDiskInfo)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           "Hashtable is different to the expected one");
+            goto cleanup;
+        }
     }
 
     ret = 0;
@@ -1720,11 +1812,10 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     if (!test)
         return -1;
 
-    /* fill in seven times - we are gonna ask seven times later on */
+    /* the second query is pipelined together with query-block */
     if (qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
-        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
-        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0)
+        qemuMonitorTestAddItem(test, "query-block", queryBlockReply) < 0)
         goto cleanup;
 
 #define CHECK0FULL(var, value, varformat, valformat) \
@@ -1771,6 +1862,17 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     CHECK("virtio-disk1", 85, 348160, 8232156, 0, 0, 0, 0, 0, 0ULL, true)
     CHECK("ide0-1-0", 16, 49250, 1004952, 0, 0, 0, 0, 0, 0ULL, false)
 
+    virHashFree(blockstats);
+    blockstats = NULL;
+
+    if (qemuMonitorGetAllBlockStatsCapacity(qemuMonitorTestGetMonitor(test),
+                                            &blockstats, false, false) < 0)
+        goto cleanup;
+
+    CHECK("virtio-disk0", 1279, 28505088, 640616474, 174, 2845696, 530699221, 0, 0, 5256018944ULL, true)
+    CHECK("virtio-disk1", 85, 348160, 8232156, 0, 0, 0, 0, 0, 0ULL, true)
+    CHECK("ide0-1-0", 16, 49250, 1004952, 0, 0, 0, 0, 0, 0ULL, false)
+
     ret = 0;
 
 #undef CHECK
@@ -1806,7 +1908,8 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
                                "        \"tls-hostname\": \"\","
                                "        \"max-bandwidth\": 1234567890,"
                                "        \"downtime-limit\": 500,"
-                               "        \"block-incremental\": true"
+                               "        \"block-incremental\": true,"
+                               "        \"x-multifd-channels\": 4"
                                "    }"
                                "}") < 0) {
         goto cleanup;
@@ -1863,6 +1966,7 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
     CHECK_ULONG(maxBandwidth, "max-bandwidth", 1234567890ULL);
     CHECK_ULONG(downtimeLimit, "downtime-limit", 500ULL);
     CHECK_BOOL(blockIncremental, "block-incremental", true);
+    CHECK_INT(multifdChannels, "x-multifd-channels", 4);
 
 #undef CHECK_NUM
 #undef CHECK_INT
@@ -1916,6 +2020,71 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationCacheSize(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryDirtyRate(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    qemuMonitorDirtyRateInfo info;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measured\","
+                               "        \"start-time\": 1606434530,"
+                               "        \"calc-time\": 2,"
+                               "        \"dirty-rate\": 108"
+                               "    },"
+                               "    \"id\": \"libvirt-12\""
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measuring\","
+                               "        \"start-time\": 1606434540,"
+                               "        \"calc-time\": 5"
+                               "    },"
+                               "    \"id\": \"libvirt-13\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != VIR_DOMAIN_DIRTYRATE_MEASURED ||
+        info.startTime != 1606434530 ||
+        info.calcTime != 2 ||
+        info.dirtyRate != 108) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected measured dirty rate info");
+        goto cleanup;
+    }
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != VIR_DOMAIN_DIRTYRATE_MEASURING ||
+        info.startTime != 1606434540 ||
+        info.calcTime != 5 ||
+        info.dirtyRate != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected measuring dirty rate info");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
 {
@@ -1923,7 +2092,9 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
     qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
     int ret = -1;
     qemuMonitorMigrationStats stats, expectedStats;
+    qemuMonitorCompletionPtr completion = NULL;
     char *error = NULL;
+    int rc;
 
     if (!test)
         return -1;
@@ -1956,6 +2127,18 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
                                "        \"error-desc\": \"It's broken\""
                                "    },"
                                "    \"id\": \"libvirt-14\""
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-migrate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"active\","
+                               "        \"total-time\": 47,"
+                               "        \"ram\": {"
+                               "            \"total\": 1611038720,"
+                               "            \"remaining\": 1605013504,"
+                               "            \"transferred\": 3625548"
+                               "        }"
+                               "    }"
                                "}") < 0)
         goto cleanup;
 
@@ -1980,9 +2163,30 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
                        "Invalid failed migration status");
         goto cleanup;
     }
+    VIR_FREE(error);
+
+    if (!(completion = qemuMonitorGetMigrationStatsStart(qemuMonitorTestGetMonitor(test))))
+        goto cleanup;
+
+    /* the reply is processed by the event loop while we wait */
+    virObjectUnlock(qemuMonitorTestGetMonitor(test));
+    rc = qemuMonitorCompletionWait(completion, 10 * 1000);
+    virObjectLock(qemuMonitorTestGetMonitor(test));
+
+    memset(&stats, 0, sizeof(stats));
+    if (rc < 0 ||
+        qemuMonitorGetMigrationStatsFinish(completion, &stats, &error) < 0)
+        goto cleanup;
+
+    if (memcmp(&stats, &expectedStats, sizeof(stats)) != 0 || error) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Invalid asynchronously fetched migration statistics");
+        goto cleanup;
+    }
 
     ret = 0;
  cleanup:
+    virObjectUnref(completion);
     qemuMonitorTestFree(test);
     VIR_FREE(error);
     return ret;
@@ -2715,7 +2919,7 @@ testQemuMonitorCPUInfo(const void *opaque)
         goto cleanup;
 
     rc = qemuMonitorGetCPUInfo(qemuMonitorTestGetMonitor(test),
-                               &vcpus, data->maxvcpus, true);
+                               &vcpus, data->maxvcpus, true, false);
 
     if (rc < 0)
         goto cleanup;
@@ -2924,6 +3128,8 @@ mymain(void)
     DO_TEST_GEN(qemuMonitorJSONAddDevice);
     DO_TEST_GEN(qemuMonitorJSONSetDrivePassphrase);
     DO_TEST_GEN(qemuMonitorJSONDriveMirror);
+    DO_TEST_GEN(qemuMonitorJSONDriveBackup);
+    DO_TEST_GEN(qemuMonitorJSONAddBitmap);
     DO_TEST_GEN(qemuMonitorJSONBlockCommit);
     DO_TEST_GEN(qemuMonitorJSONDrivePivot);
     DO_TEST_GEN(qemuMonitorJSONScreendump);
@@ -2931,17 +3137,20 @@ mymain(void)
     DO_TEST_GEN(qemuMonitorJSONNBDServerStart);
     DO_TEST_GEN(qemuMonitorJSONNBDServerAdd);
     DO_TEST_GEN(qemuMonitorJSONDetachCharDev);
+    DO_TEST_GEN(qemuMonitorJSONStartDirtyRateCalc);
     DO_TEST(qemuMonitorJSONGetBalloonInfo);
     DO_TEST(qemuMonitorJSONGetBlockInfo);
     DO_TEST(qemuMonitorJSONGetBlockStatsInfo);
     DO_TEST(qemuMonitorJSONGetMigrationCacheSize);
     DO_TEST(qemuMonitorJSONGetMigrationParams);
     DO_TEST(qemuMonitorJSONGetMigrationStats);
+    DO_TEST(qemuMonitorJSONQueryDirtyRate);
     DO_TEST(qemuMonitorJSONGetChardevInfo);
     DO_TEST(qemuMonitorJSONSetBlockIoThrottle);
     DO_TEST(qemuMonitorJSONGetTargetArch);
     DO_TEST(qemuMonitorJSONGetMigrationCapability);
     DO_TEST(qemuMonitorJSONQueryCPUs);
+    DO_TEST(qemuMonitorJSONQueryCPUsFast);
     DO_TEST(qemuMonitorJSONGetVirtType);
     DO_TEST(qemuMonitorJSONSendKey);
     DO_TEST(qemuMonitorJSONGetDumpGuestMemoryCapability);
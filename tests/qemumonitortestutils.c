@@ -75,6 +75,9 @@ struct _qemuMonitorTest {
     size_t nitems;
     qemuMonitorTestItemPtr *items;
 
+    /* id of the command being processed */
+    char *cmdID;
+
     virDomainObjPtr vm;
 };
 
@@ -92,6 +95,33 @@ qemuMonitorTestItemFree(qemuMonitorTestItemPtr item)
 }
 
 
+/*
+ * The canned replies carry whatever id they were captured with, while the
+ * monitor checks that the id of a reply matches the command. Returns the
+ * reply with the id replaced by @id, or NULL if it has none.
+ */
+static char *
+qemuMonitorTestReplaceID(const char *response,
+                         const char *id)
+{
+    virJSONValuePtr obj;
+    char *ret = NULL;
+
+    if (!(obj = virJSONValueFromString(response))) {
+        virResetLastError();
+        return NULL;
+    }
+
+    if (virJSONValueObjectHasKey(obj, "id") == 1 &&
+        virJSONValueObjectRemoveKey(obj, "id", NULL) == 1 &&
+        virJSONValueObjectAppendString(obj, "id", id) == 0)
+        ret = virJSONValueToString(obj, false);
+
+    virJSONValueFree(obj);
+    return ret;
+}
+
+
 /*
  * Appends data for a reply to the outgoing buffer
  */
@@ -99,21 +129,31 @@ int
 qemuMonitorTestAddResponse(qemuMonitorTestPtr test,
                            const char *response)
 {
-    size_t want = strlen(response) + 2;
+    char *fixed = NULL;
+    size_t want;
     size_t have = test->outgoingCapacity - test->outgoingLength;
 
+    if (test->cmdID &&
+        (fixed = qemuMonitorTestReplaceID(response, test->cmdID)))
+        response = fixed;
+
+    want = strlen(response) + 2;
+
     VIR_DEBUG("Adding response to monitor command: '%s", response);
 
     if (have < want) {
         size_t need = want - have;
-        if (VIR_EXPAND_N(test->outgoing, test->outgoingCapacity, need) < 0)
+        if (VIR_EXPAND_N(test->outgoing, test->outgoingCapacity, need) < 0) {
+            VIR_FREE(fixed);
             return -1;
+        }
     }
 
     want -= 2;
     memcpy(test->outgoing + test->outgoingLength, response, want);
     memcpy(test->outgoing + test->outgoingLength + want, "\r\n", 2);
     test->outgoingLength += want + 2;
+    VIR_FREE(fixed);
     return 0;
 }
 
@@ -252,16 +292,29 @@ qemuMonitorTestProcessCommand(qemuMonitorTestPtr test,
 
     VIR_DEBUG("Processing string from monitor handler: '%s", cmdstr);
 
+    if (test->json && !test->agent) {
+        virJSONValuePtr cmd;
+
+        if ((cmd = virJSONValueFromString(cmdstr))) {
+            ignore_value(VIR_STRDUP(test->cmdID,
+                                    virJSONValueObjectGetString(cmd, "id")));
+            virJSONValueFree(cmd);
+        } else {
+            virResetLastError();
+        }
+    }
+
     if (test->nitems == 0) {
-        return qemuMonitorTestAddUnexpectedErrorResponse(test, cmdstr);
+        ret = qemuMonitorTestAddUnexpectedErrorResponse(test, cmdstr);
     } else {
         qemuMonitorTestItemPtr item = test->items[0];
         ret = (item->cb)(test, item, cmdstr);
         qemuMonitorTestItemFree(item);
         if (VIR_DELETE_ELEMENT(test->items, 0, test->nitems) < 0)
-            return -1;
+            ret = -1;
     }
 
+    VIR_FREE(test->cmdID);
     return ret;
 }
 
@@ -445,6 +498,7 @@ qemuMonitorTestFree(qemuMonitorTestPtr test)
 
     VIR_FREE(test->incoming);
     VIR_FREE(test->outgoing);
+    VIR_FREE(test->cmdID);
 
     for (i = 0; i < test->nitems; i++)
         qemuMonitorTestItemFree(test->items[i]);
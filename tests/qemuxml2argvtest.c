@@ -23,7 +23,10 @@
 # include "datatypes.h"
 # include "conf/storage_conf.h"
 # include "cpu/cpu_map.h"
+# include "virbuffer.h"
+# include "virfile.h"
 # include "virstring.h"
+# include "virutil.h"
 # include "storage/storage_driver.h"
 # include "virmock.h"
 
@@ -406,6 +409,116 @@ testUpdateQEMUCaps(const struct testInfo *info,
 }
 
 
+/*
+ * With VIR_TEST_BENCH=1 every case that produces a command line is also
+ * used to time parsing, formatting and copying its definition and
+ * building its command line, see virTestBench.
+ */
+struct testBenchData {
+    const char *xml;
+    unsigned int parseFlags;
+    /* inactive definition, as passed to qemuProcessCreatePretendCmd */
+    virDomainDefPtr def;
+    /* NULL if the command line is not to be benchmarked */
+    virConnectPtr conn;
+    const char *migrateURI;
+    bool fips;
+};
+
+static int
+testBenchParse(const void *opaque)
+{
+    const struct testBenchData *data = opaque;
+    virDomainDefPtr def;
+
+    if (!(def = virDomainDefParseString(data->xml, driver.caps, driver.xmlopt,
+                                        NULL, data->parseFlags)))
+        return -1;
+
+    virDomainDefFree(def);
+    return 0;
+}
+
+static int
+testBenchFormat(const void *opaque)
+{
+    const struct testBenchData *data = opaque;
+    char *xml;
+
+    if (!(xml = virDomainDefFormat(data->def, driver.caps, 0)))
+        return -1;
+
+    VIR_FREE(xml);
+    return 0;
+}
+
+static int
+testBenchCopy(const void *opaque)
+{
+    const struct testBenchData *data = opaque;
+    virDomainDefPtr def;
+
+    if (!(def = virDomainDefCopy(data->def, driver.caps, driver.xmlopt,
+                                 NULL, false)))
+        return -1;
+
+    virDomainDefFree(def);
+    return 0;
+}
+
+/* Includes a copy of the definition, as building the command line
+ * modifies it */
+static int
+testBenchCommandLine(const void *opaque)
+{
+    const struct testBenchData *data = opaque;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv;
+    virCommandPtr cmd = NULL;
+    int ret = -1;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)) ||
+        !(vm->def = virDomainDefCopy(data->def, driver.caps, driver.xmlopt,
+                                     NULL, false)))
+        goto cleanup;
+    priv = vm->privateData;
+
+    if (virBitmapParse("0-3", &priv->autoNodeset, 4) < 0)
+        goto cleanup;
+
+    vm->def->id = -1;
+
+    if (!(cmd = qemuProcessCreatePretendCmd(data->conn, &driver, vm,
+                                            data->migrateURI, data->fips,
+                                            false,
+                                            VIR_QEMU_PROCESS_START_COLD)))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCommandFree(cmd);
+    virObjectUnref(vm);
+    return ret;
+}
+
+static int
+testBenchDomain(const char *name,
+                const struct testBenchData *data)
+{
+    if (virTestBench(name, "parse", testBenchParse, data) < 0 ||
+        virTestBench(name, "format", testBenchFormat, data) < 0 ||
+        virTestBench(name, "copy", testBenchCopy, data) < 0)
+        return -1;
+
+    if (data->conn &&
+        virTestBench(name, "argv", testBenchCommandLine, data) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 static int
 testCompareXMLToArgv(const void *data)
 {
@@ -424,6 +537,8 @@ testCompareXMLToArgv(const void *data)
     virCommandPtr cmd = NULL;
     size_t i;
     qemuDomainObjPrivatePtr priv = NULL;
+    virDomainDefPtr benchDef = NULL;
+    char *benchXML = NULL;
 
     memset(&monitor_chr, 0, sizeof(monitor_chr));
 
@@ -499,6 +614,11 @@ testCompareXMLToArgv(const void *data)
         }
     }
 
+    if (virTestGetBench() &&
+        !(benchDef = virDomainDefCopy(vm->def, driver.caps, driver.xmlopt,
+                                      NULL, false)))
+        goto cleanup;
+
     if (!(cmd = qemuProcessCreatePretendCmd(conn, &driver, vm, migrateURI,
                                             (flags & FLAG_FIPS), false,
                                             VIR_QEMU_PROCESS_START_COLD))) {
@@ -517,6 +637,23 @@ testCompareXMLToArgv(const void *data)
     if (virTestCompareToFile(actualargv, args) < 0)
         goto cleanup;
 
+    if (benchDef) {
+        struct testBenchData bench = {
+            .parseFlags = parseFlags,
+            .def = benchDef,
+            .conn = conn,
+            .migrateURI = migrateURI,
+            .fips = !!(flags & FLAG_FIPS),
+        };
+
+        if (virTestLoadFile(xml, &benchXML) < 0)
+            goto cleanup;
+        bench.xml = benchXML;
+
+        if (testBenchDomain(info->name, &bench) < 0)
+            goto cleanup;
+    }
+
     ret = 0;
 
  ok:
@@ -537,6 +674,8 @@ testCompareXMLToArgv(const void *data)
  cleanup:
     VIR_FREE(log);
     VIR_FREE(actualargv);
+    VIR_FREE(benchXML);
+    virDomainDefFree(benchDef);
     virDomainChrSourceDefClear(&monitor_chr);
     virCommandFree(cmd);
     virObjectUnref(vm);
@@ -547,6 +686,168 @@ testCompareXMLToArgv(const void *data)
     return ret;
 }
 
+
+# define BENCH_SYNTHETIC_DISKS 250
+# define BENCH_SYNTHETIC_NICS 250
+
+static char *
+testBenchSyntheticXML(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *dev;
+    size_t i;
+
+    virBufferAddLit(&buf,
+                    "<domain type='qemu'>\n"
+                    "  <name>synthetic</name>\n"
+                    "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db1809</uuid>\n"
+                    "  <memory unit='KiB'>4194304</memory>\n"
+                    "  <vcpu placement='static'>4</vcpu>\n"
+                    "  <os>\n"
+                    "    <type arch='x86_64' machine='pc-i440fx-1.4'>hvm</type>\n"
+                    "  </os>\n"
+                    "  <devices>\n"
+                    "    <emulator>/usr/bin/qemu-system-x86_64</emulator>\n");
+
+    for (i = 0; i < BENCH_SYNTHETIC_DISKS; i++) {
+        if (!(dev = virIndexToDiskName(i, "vd"))) {
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+        virBufferAsprintf(&buf,
+                          "    <disk type='file' device='disk'>\n"
+                          "      <driver name='qemu' type='raw'/>\n"
+                          "      <source file='/var/lib/libvirt/images/%s.img'/>\n"
+                          "      <target dev='%s' bus='virtio'/>\n"
+                          "    </disk>\n", dev, dev);
+        VIR_FREE(dev);
+    }
+
+    for (i = 0; i < BENCH_SYNTHETIC_NICS; i++) {
+        virBufferAsprintf(&buf,
+                          "    <interface type='user'>\n"
+                          "      <mac address='52:54:00:00:%02zx:%02zx'/>\n"
+                          "      <model type='virtio'/>\n"
+                          "    </interface>\n", i / 256, i % 256);
+    }
+
+    virBufferAddLit(&buf,
+                    "    <memballoon model='none'/>\n"
+                    "  </devices>\n"
+                    "</domain>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+/* A domain with 500 devices, which is spread over PCI bridges */
+static int
+testBenchSynthetic(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testInfo info = { "synthetic", NULL, NULL, -1, 0, 0, false };
+    struct testBenchData bench = { .parseFlags = VIR_DOMAIN_DEF_PARSE_INACTIVE };
+    char *xml = NULL;
+    virConnectPtr conn = NULL;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+
+    if (!(xml = testBenchSyntheticXML()))
+        goto cleanup;
+
+    if (testInitQEMUCaps(&info, GIC_NONE) < 0)
+        goto cleanup;
+    virQEMUCapsSet(info.qemuCaps, QEMU_CAPS_DEVICE_PCI_BRIDGE);
+
+    if (qemuTestCapsCacheInsert(driver.qemuCapsCache, info.qemuCaps) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()))
+        goto cleanup;
+    conn->secretDriver = &fakeSecretDriver;
+    conn->storageDriver = &fakeStorageDriver;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)) ||
+        !(vm->def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL, bench.parseFlags)))
+        goto cleanup;
+
+    if (testUpdateQEMUCaps(&info, vm, driver.caps) < 0)
+        goto cleanup;
+
+    bench.xml = xml;
+    bench.def = vm->def;
+    bench.conn = conn;
+
+    ret = testBenchDomain("synthetic-500-devices", &bench);
+
+ cleanup:
+    virObjectUnref(vm);
+    virObjectUnref(conn);
+    virObjectUnref(info.qemuCaps);
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* The schema test corpus, as far as it can be parsed by the QEMU driver */
+static int
+testBenchSchemaData(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testBenchData bench = { .parseFlags = VIR_DOMAIN_DEF_PARSE_INACTIVE };
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *dirpath = NULL;
+    char *path = NULL;
+    char *xml = NULL;
+    virDomainDefPtr def = NULL;
+    int rc;
+    int ret = -1;
+
+    if (virAsprintf(&dirpath, "%s/domainschemadata", abs_srcdir) < 0 ||
+        virDirOpen(&dir, dirpath) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, dirpath)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirpath, ent->d_name) < 0 ||
+            virTestLoadFile(path, &xml) < 0)
+            goto cleanup;
+
+        if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL, bench.parseFlags))) {
+            VIR_TEST_DEBUG("skipping %s: %s\n",
+                           ent->d_name, virGetLastErrorMessage());
+            virResetLastError();
+        } else {
+            bench.xml = xml;
+            bench.def = def;
+            if (testBenchDomain(ent->d_name, &bench) < 0)
+                goto cleanup;
+        }
+
+        virDomainDefFree(def);
+        def = NULL;
+        VIR_FREE(xml);
+        VIR_FREE(path);
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(xml);
+    VIR_FREE(path);
+    VIR_FREE(dirpath);
+    return ret;
+}
+
 # define FAKEROOTDIRTEMPLATE abs_builddir "/fakerootdir-XXXXXX"
 
 static int
@@ -846,6 +1147,10 @@ mymain(void)
                   QEMU_CAPS_OBJECT_MEMORY_FILE);
     DO_TEST("hugepages-pages2", QEMU_CAPS_MEM_PATH, QEMU_CAPS_OBJECT_MEMORY_RAM,
             QEMU_CAPS_OBJECT_MEMORY_FILE);
+    DO_TEST_LINUX("hugepages-prealloc-threads", QEMU_CAPS_MEM_PATH,
+                  QEMU_CAPS_OBJECT_MEMORY_RAM,
+                  QEMU_CAPS_OBJECT_MEMORY_FILE,
+                  QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS);
     DO_TEST("hugepages-pages3", QEMU_CAPS_MEM_PATH, QEMU_CAPS_OBJECT_MEMORY_RAM,
             QEMU_CAPS_OBJECT_MEMORY_FILE);
     DO_TEST_LINUX("hugepages-shared", QEMU_CAPS_MEM_PATH,
@@ -2842,6 +3147,15 @@ mymain(void)
             QEMU_CAPS_HDA_DUPLEX);
     DO_TEST("user-aliases2", QEMU_CAPS_DEVICE_IOH3420, QEMU_CAPS_ICH9_AHCI);
 
+    if (virTestGetBench()) {
+        if (virTestRun("QEMU XML-2-ARGV benchmark synthetic",
+                       testBenchSynthetic, NULL) < 0)
+            ret = -1;
+        if (virTestRun("QEMU XML-2-ARGV benchmark domainschemadata",
+                       testBenchSchemaData, NULL) < 0)
+            ret = -1;
+    }
+
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(fakerootdir);
 
@@ -0,0 +1,816 @@
+/*
+ * rpcbench.c: Performance benchmarks of libvirtd and the RPC layer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The benchmarks are run against the test driver, once in process and
+ * once through a private libvirtd listening on a UNIX socket. If
+ * VIR_BENCH_PKI_DIR names a directory with cacert.pem, servercert.pem,
+ * serverkey.pem, clientcert.pem and clientkey.pem, they are repeated
+ * over TLS. Results are printed to stdout as CSV rows of
+ *
+ *   transport,benchmark,parameter,value,unit
+ *
+ * so that they can be compared between builds. VIR_BENCH_OPS scales the
+ * number of calls made by each benchmark.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "datatypes.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "vircommand.h"
+#include "virerror.h"
+#include "virfdstream.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "viratomic.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.rpcbench");
+
+#define BENCH_DEFAULT_OPS 10000
+#define BENCH_TLS_PORT "16555"
+#define BENCH_STREAM_CHUNK (256 * 1024)
+#define BENCH_STREAM_SIZE (256 * 1024 * 1024)
+
+static unsigned int benchOps = BENCH_DEFAULT_OPS;
+static char *benchDir;
+
+/* How to reach the test driver: the URI of a driver config @path is
+ * prefix + path + suffix */
+typedef struct _benchTarget benchTarget;
+typedef benchTarget *benchTargetPtr;
+struct _benchTarget {
+    const char *name;
+    char *prefix;
+    char *suffix;
+};
+
+static char *
+benchTargetURI(benchTargetPtr target,
+               const char *path)
+{
+    char *uri;
+
+    ignore_value(virAsprintf(&uri, "%s%s%s",
+                             target->prefix, path, target->suffix));
+    return uri;
+}
+
+static virConnectPtr
+benchTargetOpen(benchTargetPtr target,
+                const char *path)
+{
+    char *uri;
+    virConnectPtr conn;
+
+    if (!(uri = benchTargetURI(target, path)))
+        return NULL;
+
+    conn = virConnectOpen(uri);
+    VIR_FREE(uri);
+    return conn;
+}
+
+
+static void
+benchReport(benchTargetPtr target,
+            const char *bench,
+            const char *param,
+            double value,
+            const char *unit)
+{
+    printf("%s,%s,%s,%.3f,%s\n", target->name, bench, param, value, unit);
+    fflush(stdout);
+}
+
+
+static unsigned long long
+benchNow(void)
+{
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMicrosNowRaw(&now));
+    return now;
+}
+
+
+/*
+ * Private libvirtd with an isolated configuration and socket directory
+ */
+typedef struct _benchDaemon benchDaemon;
+typedef benchDaemon *benchDaemonPtr;
+struct _benchDaemon {
+    virCommandPtr cmd;
+    char *sock;
+};
+
+static void
+benchDaemonStop(benchDaemonPtr libvirtd)
+{
+    if (libvirtd->cmd) {
+        virCommandAbort(libvirtd->cmd);
+        virCommandFree(libvirtd->cmd);
+        libvirtd->cmd = NULL;
+    }
+    VIR_FREE(libvirtd->sock);
+}
+
+static int
+benchDaemonStart(benchDaemonPtr libvirtd,
+                 const char *pkidir)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *conf = NULL;
+    char *pidfile = NULL;
+    char *logfile = NULL;
+    char *content = NULL;
+    char *uri = NULL;
+    virConnectPtr conn = NULL;
+    int logfd = -1;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&conf, "%s/libvirtd.conf", benchDir) < 0 ||
+        virAsprintf(&pidfile, "%s/libvirtd.pid", benchDir) < 0 ||
+        virAsprintf(&logfile, "%s/libvirtd.log", benchDir) < 0 ||
+        virAsprintf(&libvirtd->sock, "%s/libvirt-sock", benchDir) < 0)
+        goto cleanup;
+
+    virBufferAsprintf(&buf, "unix_sock_dir = \"%s\"\n", benchDir);
+    virBufferAddLit(&buf, "unix_sock_rw_perms = \"0700\"\n");
+    virBufferAddLit(&buf, "auth_unix_rw = \"none\"\n");
+    virBufferAddLit(&buf, "max_clients = 1000\n");
+    virBufferAddLit(&buf, "max_workers = 32\n");
+    virBufferAddLit(&buf, "keepalive_interval = -1\n");
+    virBufferAddLit(&buf, "listen_tcp = 0\n");
+    if (pkidir) {
+        virBufferAddLit(&buf, "listen_tls = 1\n");
+        virBufferAddLit(&buf, "listen_addr = \"127.0.0.1\"\n");
+        virBufferAddLit(&buf, "tls_port = \"" BENCH_TLS_PORT "\"\n");
+        virBufferAsprintf(&buf, "ca_file = \"%s/cacert.pem\"\n", pkidir);
+        virBufferAsprintf(&buf, "cert_file = \"%s/servercert.pem\"\n", pkidir);
+        virBufferAsprintf(&buf, "key_file = \"%s/serverkey.pem\"\n", pkidir);
+        virBufferAddLit(&buf, "tls_no_verify_certificate = 1\n");
+    } else {
+        virBufferAddLit(&buf, "listen_tls = 0\n");
+    }
+
+    if (!(content = virBufferContentAndReset(&buf)) ||
+        virFileWriteStr(conf, content, 0600) < 0)
+        goto cleanup;
+
+    if ((logfd = open(logfile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        virReportSystemError(errno, _("cannot create %s"), logfile);
+        goto cleanup;
+    }
+
+    libvirtd->cmd = virCommandNewArgList(abs_topbuilddir "/daemon/libvirtd",
+                                         "--config", conf,
+                                         "--pid-file", pidfile,
+                                         NULL);
+    if (pkidir)
+        virCommandAddArg(libvirtd->cmd, "--listen");
+    virCommandAddEnvPassCommon(libvirtd->cmd);
+    virCommandAddEnvPass(libvirtd->cmd, "LIBVIRT_DRIVER_DIR");
+    virCommandAddEnvPair(libvirtd->cmd, "LIBVIRT_AUTOSTART", "0");
+    virCommandAddEnvPair(libvirtd->cmd, "XDG_RUNTIME_DIR", benchDir);
+    virCommandAddEnvPair(libvirtd->cmd, "XDG_CONFIG_HOME", benchDir);
+    virCommandAddEnvPair(libvirtd->cmd, "XDG_CACHE_HOME", benchDir);
+    virCommandSetOutputFD(libvirtd->cmd, &logfd);
+    virCommandSetErrorFD(libvirtd->cmd, &logfd);
+
+    if (virCommandRunAsync(libvirtd->cmd, NULL) < 0)
+        goto cleanup;
+
+    if (virAsprintf(&uri, "test+unix:///default?socket=%s", libvirtd->sock) < 0)
+        goto cleanup;
+
+    /* Wait up to 10 seconds for the daemon to take connections */
+    for (i = 0; i < 100 && !conn; i++) {
+        if (virFileExists(libvirtd->sock))
+            conn = virConnectOpen(uri);
+        if (!conn)
+            usleep(100 * 1000);
+    }
+
+    if (!conn) {
+        virFilePrintf(stderr, "libvirtd did not start, see %s\n", logfile);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        benchDaemonStop(libvirtd);
+    if (conn)
+        virConnectClose(conn);
+    virBufferFreeAndReset(&buf);
+    VIR_FORCE_CLOSE(logfd);
+    VIR_FREE(content);
+    VIR_FREE(uri);
+    VIR_FREE(logfile);
+    VIR_FREE(pidfile);
+    VIR_FREE(conf);
+    return ret;
+}
+
+
+/*
+ * Round trip latency of a cheap and a typical call
+ */
+static int
+benchRoundTrip(const void *opaque)
+{
+    benchTargetPtr target = (benchTargetPtr) opaque;
+    virConnectPtr conn;
+    virDomainPtr dom;
+    unsigned long version;
+    unsigned long long start;
+    size_t i;
+    int ret = -1;
+
+    if (!(conn = benchTargetOpen(target, "/default")))
+        return -1;
+
+    start = benchNow();
+    for (i = 0; i < benchOps; i++) {
+        if (virConnectGetLibVersion(conn, &version) < 0)
+            goto cleanup;
+    }
+    benchReport(target, "roundtrip", "version",
+                (double) (benchNow() - start) / benchOps, "us/call");
+
+    start = benchNow();
+    for (i = 0; i < benchOps; i++) {
+        if (!(dom = virDomainLookupByName(conn, "test")))
+            goto cleanup;
+        virDomainFree(dom);
+    }
+    benchReport(target, "roundtrip", "lookup",
+                (double) (benchNow() - start) / benchOps, "us/call");
+
+    ret = 0;
+
+ cleanup:
+    virConnectClose(conn);
+    return ret;
+}
+
+
+/*
+ * Throughput of N clients each using its own connection
+ */
+typedef struct _benchClients benchClients;
+typedef benchClients *benchClientsPtr;
+struct _benchClients {
+    virMutex lock;
+    virCond cond;
+    bool go;
+    unsigned int ops;
+    int failed;
+};
+
+typedef struct _benchClient benchClient;
+typedef benchClient *benchClientPtr;
+struct _benchClient {
+    benchClientsPtr shared;
+    virConnectPtr conn;
+    virThread thread;
+};
+
+static void
+benchClientWorker(void *opaque)
+{
+    benchClientPtr client = opaque;
+    benchClientsPtr shared = client->shared;
+    virDomainPtr dom;
+    size_t i;
+
+    virMutexLock(&shared->lock);
+    while (!shared->go)
+        ignore_value(virCondWait(&shared->cond, &shared->lock));
+    virMutexUnlock(&shared->lock);
+
+    for (i = 0; i < shared->ops; i++) {
+        if (!(dom = virDomainLookupByName(client->conn, "test"))) {
+            virAtomicIntInc(&shared->failed);
+            return;
+        }
+        virDomainFree(dom);
+    }
+}
+
+static int
+benchConcurrentClients(benchTargetPtr target,
+                       size_t nclients)
+{
+    benchClients shared = { .ops = MAX(1, benchOps / nclients) };
+    benchClientPtr clients = NULL;
+    unsigned long long start;
+    size_t nthreads = 0;
+    size_t i;
+    char param[32];
+    int ret = -1;
+
+    if (virMutexInit(&shared.lock) < 0)
+        return -1;
+    if (virCondInit(&shared.cond) < 0) {
+        virMutexDestroy(&shared.lock);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(clients, nclients) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nclients; i++) {
+        clients[i].shared = &shared;
+        if (!(clients[i].conn = benchTargetOpen(target, "/default")))
+            goto cleanup;
+    }
+
+    for (; nthreads < nclients; nthreads++) {
+        if (virThreadCreate(&clients[nthreads].thread, true,
+                            benchClientWorker, &clients[nthreads]) < 0)
+            goto cleanup;
+    }
+
+    virMutexLock(&shared.lock);
+    start = benchNow();
+    shared.go = true;
+    virCondBroadcast(&shared.cond);
+    virMutexUnlock(&shared.lock);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&clients[i].thread);
+    nthreads = 0;
+
+    if (virAtomicIntGet(&shared.failed) == 0) {
+        snprintf(param, sizeof(param), "clients=%zu", nclients);
+        benchReport(target, "throughput", param,
+                    (double) shared.ops * nclients * 1000 * 1000 /
+                    (benchNow() - start), "calls/s");
+        ret = 0;
+    }
+
+ cleanup:
+    if (nthreads > 0) {
+        /* Let already running threads finish before tearing down */
+        virMutexLock(&shared.lock);
+        shared.go = true;
+        virCondBroadcast(&shared.cond);
+        virMutexUnlock(&shared.lock);
+        for (i = 0; i < nthreads; i++)
+            virThreadJoin(&clients[i].thread);
+    }
+    for (i = 0; clients && i < nclients; i++) {
+        if (clients[i].conn)
+            virConnectClose(clients[i].conn);
+    }
+    VIR_FREE(clients);
+    virCondDestroy(&shared.cond);
+    virMutexDestroy(&shared.lock);
+    return ret;
+}
+
+static int
+benchThroughput(const void *opaque)
+{
+    benchTargetPtr target = (benchTargetPtr) opaque;
+    static const size_t nclients[] = { 1, 2, 4, 8, 16, 32 };
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(nclients); i++) {
+        if (benchConcurrentClients(target, nclients[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Delivery of lifecycle events to M subscribed connections
+ */
+typedef struct _benchEvents benchEvents;
+typedef benchEvents *benchEventsPtr;
+struct _benchEvents {
+    virMutex lock;
+    virCond cond;
+    size_t received;
+};
+
+static volatile int benchEventLoopQuit;
+
+static void
+benchEventLoop(void *opaque ATTRIBUTE_UNUSED)
+{
+    while (!virAtomicIntGet(&benchEventLoopQuit)) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+static void
+benchEventTimer(int timer ATTRIBUTE_UNUSED,
+                void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static int
+benchEventLifecycle(virConnectPtr conn ATTRIBUTE_UNUSED,
+                    virDomainPtr dom ATTRIBUTE_UNUSED,
+                    int event ATTRIBUTE_UNUSED,
+                    int detail ATTRIBUTE_UNUSED,
+                    void *opaque)
+{
+    benchEventsPtr events = opaque;
+
+    virMutexLock(&events->lock);
+    events->received++;
+    virCondSignal(&events->cond);
+    virMutexUnlock(&events->lock);
+    return 0;
+}
+
+static int
+benchEventSubscribers(benchTargetPtr target,
+                      size_t nsubscribers)
+{
+    benchEvents events = { .received = 0 };
+    virConnectPtr *subscribers = NULL;
+    int *callbacks = NULL;
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    size_t rounds = MAX(1, benchOps / 100);
+    size_t expected = nsubscribers * rounds * 2;
+    unsigned long long start;
+    unsigned long long deadline;
+    size_t i;
+    char param[32];
+    int ret = -1;
+
+    if (virMutexInit(&events.lock) < 0)
+        return -1;
+    if (virCondInit(&events.cond) < 0) {
+        virMutexDestroy(&events.lock);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(subscribers, nsubscribers) < 0 ||
+        VIR_ALLOC_N(callbacks, nsubscribers) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nsubscribers; i++) {
+        callbacks[i] = -1;
+        if (!(subscribers[i] = benchTargetOpen(target, "/default")) ||
+            (callbacks[i] = virConnectDomainEventRegisterAny(subscribers[i], NULL,
+                                                             VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                             VIR_DOMAIN_EVENT_CALLBACK(benchEventLifecycle),
+                                                             &events, NULL)) < 0)
+            goto cleanup;
+    }
+
+    if (!(conn = benchTargetOpen(target, "/default")) ||
+        !(dom = virDomainLookupByName(conn, "test")))
+        goto cleanup;
+
+    start = benchNow();
+    for (i = 0; i < rounds; i++) {
+        if (virDomainSuspend(dom) < 0 ||
+            virDomainResume(dom) < 0)
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += 30 * 1000;
+
+    virMutexLock(&events.lock);
+    while (events.received < expected) {
+        if (virCondWaitUntil(&events.cond, &events.lock, deadline) < 0)
+            break;
+    }
+    virMutexUnlock(&events.lock);
+
+    if (events.received < expected) {
+        virFilePrintf(stderr, "received %zu of %zu events\n",
+                      events.received, expected);
+        goto cleanup;
+    }
+
+    snprintf(param, sizeof(param), "subscribers=%zu", nsubscribers);
+    benchReport(target, "events", param,
+                (double) expected * 1000 * 1000 / (benchNow() - start),
+                "events/s");
+    ret = 0;
+
+ cleanup:
+    /* Callbacks must be gone before the stack allocated counter is */
+    for (i = 0; subscribers && i < nsubscribers; i++) {
+        if (!subscribers[i])
+            continue;
+        if (callbacks[i] >= 0)
+            virConnectDomainEventDeregisterAny(subscribers[i], callbacks[i]);
+        virConnectClose(subscribers[i]);
+    }
+    VIR_FREE(callbacks);
+    VIR_FREE(subscribers);
+    if (dom)
+        virDomainFree(dom);
+    if (conn)
+        virConnectClose(conn);
+    virCondDestroy(&events.cond);
+    virMutexDestroy(&events.lock);
+    return ret;
+}
+
+static int
+benchEventFanout(const void *opaque)
+{
+    benchTargetPtr target = (benchTargetPtr) opaque;
+    static const size_t nsubscribers[] = { 1, 10, 50 };
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(nsubscribers); i++) {
+        if (benchEventSubscribers(target, nsubscribers[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Scaling of virConnectGetAllDomainStats with the number of domains,
+ * using the synthetic domains of the test driver
+ */
+static int
+benchStatsDomains(benchTargetPtr target,
+                  size_t ndomains)
+{
+    char *path = NULL;
+    char *xml = NULL;
+    virConnectPtr conn = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+    size_t calls = MAX(1, benchOps / 1000);
+    unsigned long long start;
+    size_t i;
+    char param[32];
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/synthetic-%zu.xml", benchDir, ndomains) < 0 ||
+        virAsprintf(&xml,
+                    "<node>\n"
+                    "  <synthetic>\n"
+                    "    <domains count='%zu' running='%zu' vcpus='4'/>\n"
+                    "  </synthetic>\n"
+                    "</node>\n", ndomains, ndomains) < 0 ||
+        virFileWriteStr(path, xml, 0600) < 0)
+        goto cleanup;
+
+    if (!(conn = benchTargetOpen(target, path)))
+        goto cleanup;
+
+    start = benchNow();
+    for (i = 0; i < calls; i++) {
+        if (virConnectGetAllDomainStats(conn, 0, &records, 0) != ndomains)
+            goto cleanup;
+        virDomainStatsRecordListFree(records);
+        records = NULL;
+    }
+
+    snprintf(param, sizeof(param), "domains=%zu", ndomains);
+    benchReport(target, "stats", param,
+                (double) (benchNow() - start) / calls / 1000, "ms/call");
+    ret = 0;
+
+ cleanup:
+    virDomainStatsRecordListFree(records);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(xml);
+    VIR_FREE(path);
+    return ret;
+}
+
+static int
+benchStats(const void *opaque)
+{
+    benchTargetPtr target = (benchTargetPtr) opaque;
+    static const size_t ndomains[] = { 10, 100, 1000 };
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(ndomains); i++) {
+        if (benchStatsDomains(target, ndomains[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Throughput of virStreamSend and virStreamRecv through virFDStream.
+ * No stream capable API of the test driver moves a useful amount of
+ * data, so this is measured in process only.
+ */
+static int
+benchStream(const void *opaque)
+{
+    benchTargetPtr target = (benchTargetPtr) opaque;
+    virConnectPtr conn;
+    virStreamPtr st = NULL;
+    char *path = NULL;
+    char *buf = NULL;
+    unsigned long long start;
+    size_t done;
+    int got;
+    int ret = -1;
+
+    if (!(conn = benchTargetOpen(target, "/default")))
+        return -1;
+
+    if (virAsprintf(&path, "%s/stream.data", benchDir) < 0 ||
+        VIR_ALLOC_N(buf, BENCH_STREAM_CHUNK) < 0)
+        goto cleanup;
+
+    if (!(st = virStreamNew(conn, 0)) ||
+        virFDStreamCreateFile(st, path, 0, 0, O_WRONLY, 0600) < 0)
+        goto cleanup;
+
+    start = benchNow();
+    for (done = 0; done < BENCH_STREAM_SIZE; done += BENCH_STREAM_CHUNK) {
+        if (virStreamSend(st, buf, BENCH_STREAM_CHUNK) != BENCH_STREAM_CHUNK)
+            goto cleanup;
+    }
+    if (virStreamFinish(st) < 0)
+        goto cleanup;
+    benchReport(target, "stream", "send",
+                (double) done / (benchNow() - start), "MB/s");
+
+    virObjectUnref(st);
+    if (!(st = virStreamNew(conn, 0)) ||
+        virFDStreamOpenFile(st, path, 0, 0, O_RDONLY) < 0)
+        goto cleanup;
+
+    start = benchNow();
+    done = 0;
+    while ((got = virStreamRecv(st, buf, BENCH_STREAM_CHUNK)) > 0)
+        done += got;
+    if (got < 0 || done != BENCH_STREAM_SIZE || virStreamFinish(st) < 0)
+        goto cleanup;
+    benchReport(target, "stream", "recv",
+                (double) done / (benchNow() - start), "MB/s");
+
+    ret = 0;
+
+ cleanup:
+    if (st && ret < 0)
+        virStreamAbort(st);
+    virObjectUnref(st);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    virConnectClose(conn);
+    return ret;
+}
+
+
+static int
+benchRunTarget(benchTargetPtr target,
+               bool stream)
+{
+    int ret = 0;
+
+#define BENCH_RUN(desc, fn) \
+    do { \
+        char *title; \
+        if (virAsprintf(&title, "%s %s", target->name, desc) < 0) \
+            return -1; \
+        if (virTestRun(title, fn, target) < 0) \
+            ret = -1; \
+        VIR_FREE(title); \
+    } while (0)
+
+    BENCH_RUN("round trip", benchRoundTrip);
+    BENCH_RUN("throughput", benchThroughput);
+    BENCH_RUN("event fan-out", benchEventFanout);
+    BENCH_RUN("bulk stats", benchStats);
+    if (stream)
+        BENCH_RUN("stream", benchStream);
+
+#undef BENCH_RUN
+
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    benchTarget localTarget = { "local", (char *) "test://", (char *) "" };
+    benchTarget unixTarget = { "unix", NULL, NULL };
+    benchTarget tlsTarget = { "tls", NULL, NULL };
+    benchDaemon libvirtd = { NULL, NULL };
+    const char *pkidir = virGetEnvAllowSUID("VIR_BENCH_PKI_DIR");
+    const char *ops = virGetEnvAllowSUID("VIR_BENCH_OPS");
+    char *template = NULL;
+    int timer = -1;
+    virThread loop;
+    bool loopStarted = false;
+    int ret = -1;
+
+    if (ops && (virStrToLong_ui(ops, NULL, 10, &benchOps) < 0 ||
+                benchOps == 0)) {
+        virFilePrintf(stderr, "invalid VIR_BENCH_OPS '%s'\n", ops);
+        return EXIT_FAILURE;
+    }
+
+    if (virEventRegisterDefaultImpl() < 0 ||
+        (timer = virEventAddTimeout(100, benchEventTimer, NULL, NULL)) < 0 ||
+        virThreadCreate(&loop, true, benchEventLoop, NULL) < 0)
+        goto cleanup;
+    loopStarted = true;
+
+    if (VIR_STRDUP(template, abs_builddir "/rpcbench-XXXXXX") < 0)
+        goto cleanup;
+    if (!(benchDir = mkdtemp(template))) {
+        virFilePrintf(stderr, "cannot create %s\n", template);
+        goto cleanup;
+    }
+
+    printf("transport,benchmark,parameter,value,unit\n");
+
+    ret = 0;
+    if (benchRunTarget(&localTarget, true) < 0)
+        ret = -1;
+
+    if (benchDaemonStart(&libvirtd, pkidir) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    unixTarget.prefix = (char *) "test+unix://";
+    if (virAsprintf(&unixTarget.suffix, "?socket=%s", libvirtd.sock) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    if (benchRunTarget(&unixTarget, false) < 0)
+        ret = -1;
+
+    if (pkidir) {
+        tlsTarget.prefix = (char *) "test+tls://127.0.0.1:" BENCH_TLS_PORT;
+        if (virAsprintf(&tlsTarget.suffix, "?pkipath=%s&no_verify=1",
+                        pkidir) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        if (benchRunTarget(&tlsTarget, false) < 0)
+            ret = -1;
+    }
+
+ cleanup:
+    benchDaemonStop(&libvirtd);
+    if (loopStarted) {
+        virAtomicIntSet(&benchEventLoopQuit, 1);
+        virThreadJoin(&loop);
+    }
+    if (timer >= 0)
+        virEventRemoveTimeout(timer);
+    if (benchDir && getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(benchDir);
+    VIR_FREE(unixTarget.suffix);
+    VIR_FREE(tlsTarget.suffix);
+    VIR_FREE(template);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -61,11 +61,13 @@ VIR_LOG_INIT("tests.testutils");
 
 #include "virbitmap.h"
 #include "virfile.h"
+#include "virtime.h"
 
 static unsigned int testDebug = -1;
 static unsigned int testVerbose = -1;
 static unsigned int testExpensive = -1;
 static unsigned int testRegenerate = -1;
+static unsigned int testBench = -1;
 
 #ifdef TEST_OOM
 static unsigned int testOOM;
@@ -959,6 +961,80 @@ virTestGetRegenerate(void)
     return testRegenerate;
 }
 
+unsigned int
+virTestGetBench(void)
+{
+    if (testBench == -1)
+        testBench = virTestGetFlag("VIR_TEST_BENCH");
+    return testBench;
+}
+
+
+#define VIR_TEST_BENCH_MIN_USECS (100 * 1000)
+#define VIR_TEST_BENCH_MAX_ITERATIONS (1 << 20)
+
+/*
+ * virTestBench:
+ * @name: name of the input being benchmarked
+ * @op: name of the operation being benchmarked
+ * @body: performs the operation once
+ * @data: passed to @body
+ *
+ * After a warm-up call, runs @body often enough to take at least
+ * 100ms and prints "name,op,ns/op,allocs/op" to stdout, counting the
+ * allocations made through viralloc.
+ *
+ * Returns 0 on success, -1 if @body failed.
+ */
+int
+virTestBench(const char *name,
+             const char *op,
+             int (*body)(const void *data),
+             const void *data)
+{
+    static bool header;
+    unsigned long long start;
+    unsigned long long end;
+    size_t iterations = 1;
+    size_t i;
+    int allocs;
+
+    if (body(data) < 0)
+        return -1;
+
+    while (true) {
+        if (virTimeMicrosNowRaw(&start) < 0)
+            return -1;
+
+        virAllocCountStart();
+        for (i = 0; i < iterations; i++) {
+            if (body(data) < 0) {
+                virAllocCountStop();
+                return -1;
+            }
+        }
+        allocs = virAllocCountStop();
+
+        if (virTimeMicrosNowRaw(&end) < 0)
+            return -1;
+
+        if (end - start >= VIR_TEST_BENCH_MIN_USECS ||
+            iterations >= VIR_TEST_BENCH_MAX_ITERATIONS)
+            break;
+        iterations *= 2;
+    }
+
+    if (!header) {
+        printf("name,operation,ns_per_op,allocs_per_op\n");
+        header = true;
+    }
+    printf("%s,%s,%llu,%.1f\n", name, op,
+           (end - start) * 1000 / iterations, (double) allocs / iterations);
+    fflush(stdout);
+
+    return 0;
+}
+
 static int
 virTestSetEnvPath(void)
 {
@@ -90,6 +90,12 @@ unsigned int virTestGetDebug(void);
 unsigned int virTestGetVerbose(void);
 unsigned int virTestGetExpensive(void);
 unsigned int virTestGetRegenerate(void);
+unsigned int virTestGetBench(void);
+
+int virTestBench(const char *name,
+                 const char *op,
+                 int (*body)(const void *data),
+                 const void *data);
 
 # define VIR_TEST_DEBUG(...) \
     do { \
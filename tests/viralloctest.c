@@ -24,6 +24,7 @@
 #include <viralloc.h>
 
 #include "testutils.h"
+#include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -418,6 +419,56 @@ testDispose(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testAllocStats(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int *nums = NULL;
+    char *str = NULL;
+    unsigned long long allocs;
+    unsigned long long bytes;
+    int ret = -1;
+
+    if (virAllocStatsGet(VIR_ERR_DOMAIN_LAST, &allocs, &bytes) == 0) {
+        fprintf(stderr, "Invalid error domain was accepted\n");
+        return -1;
+    }
+
+    /* Nothing is accounted for while disabled */
+    if (virAllocN(&nums, sizeof(*nums), 10, true, VIR_FROM_TEST,
+                  __FILE__, __FUNCTION__, __LINE__) < 0)
+        goto cleanup;
+    VIR_FREE(nums);
+
+    virAllocStatsSetEnabled(true);
+
+    if (virAllocN(&nums, sizeof(*nums), 10, true, VIR_FROM_TEST,
+                  __FILE__, __FUNCTION__, __LINE__) < 0 ||
+        virReallocN(&nums, sizeof(*nums), 20, true, VIR_FROM_TEST,
+                    __FILE__, __FUNCTION__, __LINE__) < 0 ||
+        virStrdup(&str, "test", true, VIR_FROM_TEST,
+                  __FILE__, __FUNCTION__, __LINE__) < 0)
+        goto cleanup;
+
+    virAllocStatsSetEnabled(false);
+
+    if (virAllocStatsGet(VIR_FROM_TEST, &allocs, &bytes) < 0)
+        goto cleanup;
+
+    if (allocs != 3 || bytes != sizeof(*nums) * 30 + 5) {
+        fprintf(stderr, "Expected 3 allocations of %zu bytes, got %llu of %llu\n",
+                sizeof(*nums) * 30 + 5, allocs, bytes);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virAllocStatsSetEnabled(false);
+    VIR_FREE(nums);
+    VIR_FREE(str);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -437,6 +488,8 @@ mymain(void)
         ret = -1;
     if (virTestRun("dispose tests", testDispose, NULL) < 0)
         ret = -1;
+    if (virTestRun("alloc stats", testAllocStats, NULL) < 0)
+        ret = -1;
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
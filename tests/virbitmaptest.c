@@ -735,6 +735,219 @@ test14(const void *opaque)
 }
 
 
+/* virBitmap(Set/Clear)Range */
+static int
+test15(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr map = NULL;
+    virBitmapPtr expected = NULL;
+    size_t ranges[][2] = {
+        { 0, 0 }, { 0, 63 }, { 1, 62 }, { 63, 64 }, { 60, 130 },
+        { 64, 127 }, { 5, 299 }, { 128, 191 }, { 299, 299 },
+    };
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (!(map = virBitmapNew(300)) ||
+        !(expected = virBitmapNew(300)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(ranges); i++) {
+        size_t start = ranges[i][0];
+        size_t end = ranges[i][1];
+
+        virBitmapClearAll(map);
+        virBitmapClearAll(expected);
+        if (virBitmapSetRange(map, start, end) < 0)
+            goto cleanup;
+        for (j = start; j <= end; j++)
+            ignore_value(virBitmapSetBit(expected, j));
+
+        if (!virBitmapEqual(map, expected)) {
+            fprintf(stderr, "\n setting range %zu-%zu failed\n", start, end);
+            goto cleanup;
+        }
+
+        virBitmapSetAll(map);
+        virBitmapSetAll(expected);
+        if (virBitmapClearRange(map, start, end) < 0)
+            goto cleanup;
+        for (j = start; j <= end; j++)
+            ignore_value(virBitmapClearBit(expected, j));
+
+        if (!virBitmapEqual(map, expected)) {
+            fprintf(stderr, "\n clearing range %zu-%zu failed\n", start, end);
+            goto cleanup;
+        }
+    }
+
+    if (virBitmapSetRange(map, 10, 300) == 0 ||
+        virBitmapSetRange(map, 10, 9) == 0 ||
+        virBitmapClearRange(map, 300, 300) == 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(map);
+    virBitmapFree(expected);
+    return ret;
+}
+
+
+/* virBitmapIter */
+static int
+test16(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *strings[] = {
+        "0", "63", "64", "0-5,63-65,127,128,299", "1,3,5-200,298", "299",
+    };
+    virBitmapPtr map = NULL;
+    virBitmapIter iter;
+    ssize_t i;
+    ssize_t j;
+    size_t k;
+    int ret = -1;
+
+    for (k = 0; k < ARRAY_CARDINALITY(strings); k++) {
+        if (virBitmapParse(strings[k], &map, 300) < 0)
+            goto cleanup;
+
+        i = -1;
+        virBitmapIterInit(&iter, map);
+        do {
+            i = virBitmapNextSetBit(map, i);
+            j = virBitmapIterNext(&iter);
+
+            if (i != j) {
+                fprintf(stderr, "\n iterating '%s' returned %zd instead "
+                        "of %zd\n", strings[k], j, i);
+                goto cleanup;
+            }
+        } while (i >= 0);
+
+        virBitmapFree(map);
+        map = NULL;
+    }
+
+    if (!(map = virBitmapNew(300)))
+        goto cleanup;
+
+    virBitmapIterInit(&iter, map);
+    if (virBitmapIterNext(&iter) != -1)
+        goto cleanup;
+
+    virBitmapShrink(map, 100);
+    ignore_value(virBitmapSetBit(map, 99));
+    virBitmapIterInit(&iter, map);
+    if (virBitmapIterNext(&iter) != 99 ||
+        virBitmapIterNext(&iter) != -1)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(map);
+    return ret;
+}
+
+
+/* Host CPU map with every other core of four NUMA nodes */
+#define BENCH_MAP_SIZE 4096
+#define BENCH_MAP "0-511,1024-1535,2048-2559,3072-3583,^7,4000"
+
+static int
+testBenchParse(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr map;
+
+    if (virBitmapParse(BENCH_MAP, &map, BENCH_MAP_SIZE) < 0)
+        return -1;
+
+    virBitmapFree(map);
+    return 0;
+}
+
+
+static int
+testBenchFormat(const void *opaque)
+{
+    char *str;
+
+    if (!(str = virBitmapFormat((virBitmapPtr) opaque)))
+        return -1;
+
+    VIR_FREE(str);
+    return 0;
+}
+
+
+static int
+testBenchNextSetBit(const void *opaque)
+{
+    virBitmapPtr map = (virBitmapPtr) opaque;
+    ssize_t i = -1;
+    size_t count = 0;
+
+    while ((i = virBitmapNextSetBit(map, i)) >= 0)
+        count++;
+
+    return count == virBitmapCountBits(map) ? 0 : -1;
+}
+
+
+static int
+testBenchIter(const void *opaque)
+{
+    virBitmapPtr map = (virBitmapPtr) opaque;
+    virBitmapIter iter;
+    size_t count = 0;
+
+    virBitmapIterInit(&iter, map);
+    while (virBitmapIterNext(&iter) >= 0)
+        count++;
+
+    return count == virBitmapCountBits(map) ? 0 : -1;
+}
+
+
+static int
+testBenchLastSetBit(const void *opaque)
+{
+    return virBitmapLastSetBit((virBitmapPtr) opaque) == 4000 ? 0 : -1;
+}
+
+
+static int
+testBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr map = NULL;
+    int ret = -1;
+
+    if (virBitmapParse(BENCH_MAP, &map, BENCH_MAP_SIZE) < 0)
+        return -1;
+
+    if (virTestBench("cpumap-4096", "parse", testBenchParse, NULL) < 0 ||
+        virTestBench("cpumap-4096", "format", testBenchFormat, map) < 0 ||
+        virTestBench("cpumap-4096", "next-set-bit",
+                     testBenchNextSetBit, map) < 0 ||
+        virTestBench("cpumap-4096", "iter", testBenchIter, map) < 0 ||
+        virTestBench("cpumap-4096", "last-set-bit",
+                     testBenchLastSetBit, map) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(map);
+    return ret;
+}
+
+#undef BENCH_MAP
+#undef BENCH_MAP_SIZE
+
+
 #define TESTBINARYOP(A, B, RES, FUNC) \
     testBinaryOpData.a = A; \
     testBinaryOpData.b = B; \
@@ -792,6 +1005,15 @@ mymain(void)
     TESTBINARYOP("0-3", "0,^0", "0-3", test14);
     TESTBINARYOP("0,2", "1,3", "0,2", test14);
 
+    if (virTestRun("test15", test15, NULL) < 0)
+        ret = -1;
+    if (virTestRun("test16", test16, NULL) < 0)
+        ret = -1;
+
+    if (virTestGetBench() &&
+        virTestRun("benchmark", testBench, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
@@ -433,6 +433,83 @@ testBufEscapeRegex(const void *opaque)
 }
 
 
+static int
+testBufEscapeFormat(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual;
+    const char *expect =
+        "  <a v='&lt;&amp;&gt;'/>\n"
+        "  <b v='100%'>&apos;x&apos;</b>\n"
+        "  4.5\\:6\n";
+    int ret = -1;
+
+    virBufferAdjustIndent(&buf, 2);
+    /* formats with the single %s are written directly to the buffer... */
+    virBufferEscapeString(&buf, "<a v='%s'/>\n", "<&>");
+    /* ... anything else goes through a temporary string */
+    virBufferEscapeString(&buf, "<b v='100%%'>%s</b>\n", "'x'");
+    virBufferEscape(&buf, '\\', ":", "%s\n", "4.5:6");
+
+    if (!(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, expect)) {
+        virTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+testBufGrow(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    char *expect = NULL;
+    size_t i;
+    size_t len;
+    int ret = -1;
+
+    /* at most 9 characters per iteration */
+    if (VIR_ALLOC_N(expect, 100000 * 9 + 1) < 0)
+        goto cleanup;
+
+    for (i = 0, len = 0; i < 100000; i++) {
+        const char *escaped = i % 2 ? "&lt;&amp;" : "a&lt;";
+
+        virBufferEscapeString(&buf, "%s", i % 2 ? "<&" : "a<");
+        memcpy(expect + len, escaped, strlen(escaped));
+        len += strlen(escaped);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    if (!(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, expect)) {
+        VIR_TEST_DEBUG("testBufGrow: Strings don't match\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    VIR_FREE(expect);
+    return ret;
+}
+
+
 static int
 testBufSetIndent(const void *opaque ATTRIBUTE_UNUSED)
 {
@@ -480,6 +557,8 @@ mymain(void)
     DO_TEST("Trim", testBufTrim, 0);
     DO_TEST("AddBuffer", testBufAddBuffer, 0);
     DO_TEST("set indent", testBufSetIndent, 0);
+    DO_TEST("Escape with format", testBufEscapeFormat, 0);
+    DO_TEST("Grow", testBufGrow, 0);
 
 #define DO_TEST_ADD_STR(DATA, EXPECT) \
     do { \
@@ -26,6 +26,7 @@
 #include "capabilities.h"
 #include "virbitmap.h"
 #include "virfilewrapper.h"
+#include "virhostcpu.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -65,6 +66,7 @@ test_virCapabilities(const void *opaque)
 
     virFileWrapperAddPrefix("/sys/devices/system", dir);
     virFileWrapperAddPrefix("/sys/fs/resctrl", resctrl);
+    virHostCPUTopologyInvalidate();
     caps = virCapabilitiesNew(data->arch, data->offlineMigrate, data->liveMigrate);
 
     if (!caps)
@@ -139,6 +139,23 @@ const char *proccgroupsallinone =
     "devices  6   1  1\n"
     "blkio    6   1  1\n";
 
+const char *procmountsunified =
+    "tmpfs /not/really/sys/fs/cgroup tmpfs rw,seclabel,nosuid,nodev,noexec,mode=755 0 0\n"
+    "cgroup2 /not/really/sys/fs/cgroup/unified cgroup2 rw,nosuid,nodev,noexec,relatime 0 0\n";
+
+const char *procselfcgroupsunified =
+    "0::/\n";
+
+const char *proccgroupsunified =
+    "#subsys_name    hierarchy       num_cgroups     enabled\n"
+    "cpuset    0  1  1\n"
+    "cpu       0  1  1\n"
+    "cpuacct   0  1  1\n"
+    "memory    0  1  1\n"
+    "devices   0  1  1\n"
+    "freezer   0  1  1\n"
+    "blkio     0  1  1\n";
+
 const char *procmountslogind =
     "none /not/really/sys/fs/cgroup tmpfs rw,rootcontext=system_u:object_r:sysfs_t:s0,seclabel,relatime,size=4k,mode=755 0 0\n"
     "systemd /not/really/sys/fs/cgroup/systemd cgroup rw,nosuid,nodev,noexec,relatime,name=systemd 0 0\n";
@@ -380,6 +397,33 @@ static int make_controller(const char *path, mode_t mode)
         MAKE_FILE("blkio.weight", "1000\n");
         MAKE_FILE("blkio.weight_device", "");
 
+    } else if (STRPREFIX(controller, "unified")) {
+        MAKE_FILE("cgroup.controllers", "cpuset cpu io memory pids\n");
+        MAKE_FILE("cgroup.procs", "");
+        MAKE_FILE("cgroup.subtree_control", "");
+        MAKE_FILE("cgroup.type", "domain\n");
+        MAKE_FILE("cpu.max", "max 100000\n");
+        MAKE_FILE("cpu.stat",
+                  "usage_usec 2787788855799\n"
+                  "user_usec 2166870250\n"
+                  "system_usec 434213960\n"
+                  "nr_periods 0\n"
+                  "nr_throttled 0\n"
+                  "throttled_usec 0\n");
+        MAKE_FILE("cpu.weight", "100\n");
+        MAKE_FILE("io.max", "8:0 rbps=max wbps=1048576 riops=max wiops=200\n");
+        MAKE_FILE("io.stat",
+                  "8:0 rbytes=59542107136 wbytes=411440480256 rios=4832583 "
+                  "wios=36641903 dbytes=0 dios=0\n"
+                  "9:0 rbytes=59542107137 wbytes=411440480257 rios=4832584 "
+                  "wios=36641904 dbytes=0 dios=0\n");
+        MAKE_FILE("io.weight", "default 100\n");
+        MAKE_FILE("memory.current", "1455321088\n");
+        MAKE_FILE("memory.high", "max\n");
+        MAKE_FILE("memory.max", "max\n");
+        MAKE_FILE("memory.swap.current", "0\n");
+        MAKE_FILE("memory.swap.max", "max\n");
+
     } else {
         errno = EINVAL;
         goto cleanup;
@@ -443,6 +487,7 @@ static void init_sysfs(void)
     MAKE_CONTROLLER("blkio");
     MAKE_CONTROLLER("memory");
     MAKE_CONTROLLER("freezer");
+    MAKE_CONTROLLER("unified");
 
     if (make_file(fakesysfscgroupdir,
                   SYSFS_CPU_PRESENT_MOCKED, "8-23,48-159\n") < 0)
@@ -453,7 +498,7 @@ static void init_sysfs(void)
 FILE *fopen(const char *path, const char *mode)
 {
     const char *mock;
-    bool allinone = false, logind = false;
+    bool allinone = false, logind = false, unified = false;
     init_syms();
 
     mock = getenv("VIR_CGROUP_MOCK_MODE");
@@ -462,6 +507,8 @@ FILE *fopen(const char *path, const char *mode)
             allinone = true;
         else if (STREQ(mock, "logind"))
             logind = true;
+        else if (STREQ(mock, "unified"))
+            unified = true;
     }
 
     if (STREQ(path, "/proc/mounts")) {
@@ -472,6 +519,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)procmountslogind,
                                 strlen(procmountslogind), mode);
+            else if (unified)
+                return fmemopen((void *)procmountsunified,
+                                strlen(procmountsunified), mode);
             else
                 return fmemopen((void *)procmounts, strlen(procmounts), mode);
         } else {
@@ -487,6 +537,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)proccgroupslogind,
                                 strlen(proccgroupslogind), mode);
+            else if (unified)
+                return fmemopen((void *)proccgroupsunified,
+                                strlen(proccgroupsunified), mode);
             else
                 return fmemopen((void *)proccgroups, strlen(proccgroups), mode);
         } else {
@@ -502,6 +555,9 @@ FILE *fopen(const char *path, const char *mode)
             else if (logind)
                 return fmemopen((void *)procselfcgroupslogind,
                                 strlen(procselfcgroupslogind), mode);
+            else if (unified)
+                return fmemopen((void *)procselfcgroupsunified,
+                                strlen(procselfcgroupsunified), mode);
             else
                 return fmemopen((void *)procselfcgroups, strlen(procselfcgroups), mode);
         } else {
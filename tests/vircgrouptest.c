@@ -124,6 +124,16 @@ const char *mountsLogind[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_BLKIO] = NULL,
     [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/not/really/sys/fs/cgroup/systemd",
 };
+const char *mountsUnified[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUACCT] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+    [VIR_CGROUP_CONTROLLER_FREEZER] = NULL,
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_SYSTEMD] = NULL,
+};
 
 const char *links[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_CPU] = "/not/really/sys/fs/cgroup/cpu",
@@ -568,6 +578,102 @@ static int testCgroupNewForSelfLogind(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testCgroupNewForSelfUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+    const char *placement[VIR_CGROUP_CONTROLLER_LAST] = {
+        [VIR_CGROUP_CONTROLLER_CPU] = "/",
+        [VIR_CGROUP_CONTROLLER_CPUACCT] = "/",
+        [VIR_CGROUP_CONTROLLER_CPUSET] = "/",
+        [VIR_CGROUP_CONTROLLER_MEMORY] = "/",
+        [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+        [VIR_CGROUP_CONTROLLER_FREEZER] = NULL,
+        [VIR_CGROUP_CONTROLLER_BLKIO] = "/",
+    };
+
+    if (virCgroupNewSelf(&cgroup) < 0) {
+        fprintf(stderr, "Cannot create cgroup for self\n");
+        goto cleanup;
+    }
+
+    ret = validateCgroup(cgroup, "", mountsUnified, linksAllInOne, placement);
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
+static int testCgroupGetUnifiedStats(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+    unsigned long long usage, user, sys;
+    unsigned long long period, kb, wbps;
+    unsigned int wiops, riops;
+    long long quota;
+    long long values[4];
+
+    if (virCgroupNewSelf(&cgroup) < 0) {
+        fprintf(stderr, "Cannot create cgroup for self\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuacctTimes(cgroup, &usage, &user, &sys) < 0 ||
+        usage != 2787788855799000ULL ||
+        user != 2166870250000ULL ||
+        sys != 434213960000ULL) {
+        fprintf(stderr, "Wrong CPU times from cpu.stat\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuCfsPeriod(cgroup, &period) < 0 ||
+        virCgroupGetCpuCfsQuota(cgroup, &quota) < 0 ||
+        period != 100000 || quota != -1) {
+        fprintf(stderr, "Wrong bandwidth from cpu.max\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetMemoryHardLimit(cgroup, &kb) < 0 ||
+        kb != VIR_DOMAIN_MEMORY_PARAM_UNLIMITED) {
+        fprintf(stderr, "Wrong limit from memory.max\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetBlkioIoServiced(cgroup, values, &values[1],
+                                    &values[2], &values[3]) < 0 ||
+        values[0] != 119084214273LL || values[1] != 822880960513LL ||
+        values[2] != 9665167 || values[3] != 73283807) {
+        fprintf(stderr, "Wrong totals from io.stat\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetBlkioIoDeviceServiced(cgroup, FAKEDEVDIR1, values,
+                                          &values[1], &values[2],
+                                          &values[3]) < 0 ||
+        values[0] != 59542107137LL || values[1] != 411440480257LL ||
+        values[2] != 4832584 || values[3] != 36641904) {
+        fprintf(stderr, "Wrong device stats from io.stat\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetBlkioDeviceReadIops(cgroup, FAKEDEVDIR0, &riops) < 0 ||
+        virCgroupGetBlkioDeviceWriteIops(cgroup, FAKEDEVDIR0, &wiops) < 0 ||
+        virCgroupGetBlkioDeviceWriteBps(cgroup, FAKEDEVDIR0, &wbps) < 0 ||
+        riops != 0 || wiops != 200 || wbps != 1048576) {
+        fprintf(stderr, "Wrong device throttles from io.max\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
 static int testCgroupAvailable(const void *args)
 {
     bool got = virCgroupAvailable();
@@ -727,6 +833,50 @@ static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testCgroupGetCpuacctTimes(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int rv, ret = -1;
+    unsigned long long usage, user, sys;
+    unsigned long long expectUser, expectSys;
+    size_t i;
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_CPU) |
+                                    (1 << VIR_CGROUP_CONTROLLER_CPUACCT),
+                                    &cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuacctStat(cgroup, &expectUser, &expectSys) < 0) {
+        fprintf(stderr, "Could not retrieve GetCpuacctStat\n");
+        goto cleanup;
+    }
+
+    /* The second round is served from the cached fds */
+    for (i = 0; i < 2; i++) {
+        if (virCgroupGetCpuacctTimes(cgroup, &usage, &user, &sys) < 0) {
+            fprintf(stderr, "Could not retrieve GetCpuacctTimes\n");
+            goto cleanup;
+        }
+
+        if (usage != 2787788855799582ULL ||
+            user != expectUser || sys != expectSys) {
+            fprintf(stderr,
+                    "Wrong values from virCgroupGetCpuacctTimes: "
+                    "%llu %llu %llu\n", usage, user, sys);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 static int testCgroupGetBlkioIoServiced(const void *args ATTRIBUTE_UNUSED)
 {
     virCgroupPtr cgroup = NULL;
@@ -926,6 +1076,9 @@ mymain(void)
     if (virTestRun("virCgroupGetPercpuStats works", testCgroupGetPercpuStats, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupGetCpuacctTimes works", testCgroupGetCpuacctTimes, NULL) < 0)
+        ret = -1;
+
     setenv("VIR_CGROUP_MOCK_MODE", "allinone", 1);
     if (virTestRun("New cgroup for self (allinone)", testCgroupNewForSelfAllInOne, NULL) < 0)
         ret = -1;
@@ -940,6 +1093,15 @@ mymain(void)
         ret = -1;
     unsetenv("VIR_CGROUP_MOCK_MODE");
 
+    setenv("VIR_CGROUP_MOCK_MODE", "unified", 1);
+    if (virTestRun("New cgroup for self (unified)", testCgroupNewForSelfUnified, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Cgroup available", testCgroupAvailable, (void*)0x1) < 0)
+        ret = -1;
+    if (virTestRun("Unified cgroup stats", testCgroupGetUnifiedStats, NULL) < 0)
+        ret = -1;
+    unsetenv("VIR_CGROUP_MOCK_MODE");
+
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(fakerootdir);
 
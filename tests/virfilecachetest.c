@@ -202,6 +202,60 @@ testFileCache(const void *opaque)
 }
 
 
+static int
+testFileCachePrefetch(const void *opaque)
+{
+    int ret = -1;
+    virFileCachePtr cache = (virFileCachePtr) opaque;
+    testFileCachePrivPtr testPriv = virFileCacheGetPriv(cache);
+    const char *names[] = {
+        "cacheValid", "cacheInvalid", "prefetch1", "prefetch2",
+        "prefetch3", "prefetch4", "prefetch5", NULL
+    };
+    testFileCacheObjPtr obj = NULL;
+    size_t i;
+
+    testPriv->newData = "ddd\n";
+    testPriv->expectData = "ddd\n";
+
+    if (virFileCachePrefetch(cache, names, 3) < 0) {
+        fprintf(stderr, "Prefetching data failed.\n");
+        goto cleanup;
+    }
+
+    /* Everything is cached now, the lookups must not create anything */
+    testPriv->newData = "eee\n";
+    testPriv->dataSaved = false;
+
+    for (i = 0; names[i]; i++) {
+        if (!(obj = virFileCacheLookup(cache, names[i]))) {
+            fprintf(stderr, "Getting cached data '%s' failed.\n", names[i]);
+            goto cleanup;
+        }
+
+        if (STRNEQ(testPriv->expectData, obj->data)) {
+            fprintf(stderr, "Expect data '%s' for '%s', cached data '%s'.\n",
+                    testPriv->expectData, names[i], obj->data);
+            goto cleanup;
+        }
+
+        virObjectUnref(obj);
+        obj = NULL;
+    }
+
+    if (testPriv->dataSaved) {
+        fprintf(stderr, "Data was created again after prefetch.\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(obj);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -230,6 +284,9 @@ mymain(void)
     TEST_RUN("cacheInvalid", "bbb\n", "bbb\n", true);
     TEST_RUN("cacheMissing", "ccc\n", "ccc\n", true);
 
+    if (virTestRun("prefetch", testFileCachePrefetch, cache) < 0)
+        ret = -1;
+
     virObjectUnref(cache);
 
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
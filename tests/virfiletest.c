@@ -31,6 +31,8 @@
 # include <linux/falloc.h>
 #endif
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 static int testFileCheckMounts(const char *prefix,
@@ -310,6 +312,91 @@ testFileInData(const void *opaque)
 }
 
 
+static void
+testFileRewriteAsyncDone(const char *path ATTRIBUTE_UNUSED,
+                         int result,
+                         void *opaque)
+{
+    int *done = opaque;
+
+    if (result == 0)
+        (*done)++;
+}
+
+
+static int
+testFileRewriteAsyncCheck(const char *path,
+                          const char *expect)
+{
+    char *actual = NULL;
+    int ret = -1;
+
+    if (virFileReadAll(path, 1024, &actual) < 0)
+        goto cleanup;
+
+    if (STRNEQ(actual, expect)) {
+        fprintf(stderr, "Unexpected contents of %s. Expected '%s' got '%s'\n",
+                path, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+testFileRewriteAsync(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *dir = NULL;
+    char *path1 = NULL;
+    char *path2 = NULL;
+    int done = 0;
+    int ret = -1;
+
+    if (VIR_STRDUP(dir, abs_builddir "/virfiletest-XXXXXX") < 0 ||
+        !mkdtemp(dir)) {
+        fprintf(stderr, "Unable to create temporary directory\n");
+        goto cleanup;
+    }
+
+    if (virAsprintf(&path1, "%s/one", dir) < 0 ||
+        virAsprintf(&path2, "%s/two", dir) < 0)
+        goto cleanup;
+
+    /* the second write of @path1 may supersede the first one, but
+     * both callbacks must be called */
+    if (virFileRewriteStrAsync(path1, 0600, "first",
+                               testFileRewriteAsyncDone, &done) < 0 ||
+        virFileRewriteStrAsync(path2, 0600, "other", NULL, NULL) < 0 ||
+        virFileRewriteStrAsync(path1, 0600, "second",
+                               testFileRewriteAsyncDone, &done) < 0)
+        goto cleanup;
+
+    virFileRewriteAsyncFlush();
+
+    if (done != 2) {
+        fprintf(stderr, "Expected 2 completed writes, got %d\n", done);
+        goto cleanup;
+    }
+
+    if (testFileRewriteAsyncCheck(path1, "second") < 0 ||
+        testFileRewriteAsyncCheck(path2, "other") < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (dir)
+        virFileDeleteTree(dir);
+    VIR_FREE(path1);
+    VIR_FREE(path2);
+    VIR_FREE(dir);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -396,6 +483,10 @@ mymain(void)
         DO_TEST_IN_DATA(true, 8, 16, 32, 64, 128, 256, 512);
         DO_TEST_IN_DATA(false, 8, 16, 32, 64, 128, 256, 512);
     }
+
+    if (virTestRun("Rewrite async", testFileRewriteAsync, NULL) < 0)
+        ret = -1;
+
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
@@ -1123,6 +1123,244 @@ testFirewallQuery(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+
+static void
+testFirewallRestoreHook(const char *const*args ATTRIBUTE_UNUSED,
+                        const char *const*env ATTRIBUTE_UNUSED,
+                        const char *input,
+                        char **output ATTRIBUTE_UNUSED,
+                        char **error ATTRIBUTE_UNUSED,
+                        int *status ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (input)
+        virBufferAdd(buf, input, -1);
+}
+
+#define TEST_FIREWALL_RESTORE_RULES \
+    "*filter\n" \
+    "-N LIBVIRT_INP\n" \
+    "-A LIBVIRT_INP --source-host 192.168.122.1 --jump ACCEPT\n" \
+    "COMMIT\n" \
+    "*nat\n" \
+    "-A POSTROUTING --source 192.168.122.0/24 --jump MASQUERADE\n" \
+    "COMMIT\n"
+
+static int
+testFirewallRestore(const void *opaque)
+{
+    const struct testFirewallData *data = opaque;
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected;
+
+    if (data->tryBackend == VIR_FIREWALL_BACKEND_NFTABLES) {
+        expected =
+            IPTABLES_NFT_RESTORE_PATH " --noflush\n"
+            TEST_FIREWALL_RESTORE_RULES
+            EBTABLES_NFT_PATH " -A FORWARD --jump ACCEPT\n"
+            IPTABLES_NFT_PATH " -A INPUT -m comment --comment 'a comment' --jump ACCEPT\n";
+    } else {
+        expected =
+            IPTABLES_RESTORE_PATH " --noflush\n"
+            TEST_FIREWALL_RESTORE_RULES
+            EBTABLES_PATH " -A FORWARD --jump ACCEPT\n"
+            IPTABLES_PATH " -A INPUT -m comment --comment 'a comment' --jump ACCEPT\n";
+    }
+
+    if (virFirewallSetBackend(data->tryBackend) < 0) {
+        /* The nf_tables tools are optional */
+        if (data->tryBackend == VIR_FIREWALL_BACKEND_NFTABLES) {
+            virResetLastError();
+            ret = EXIT_AM_SKIP;
+        }
+        goto cleanup;
+    }
+
+    virFirewallSetRestoreOverride(true);
+    virCommandSetDryRun(&cmdbuf, testFirewallRestoreHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-N", "LIBVIRT_INP", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "LIBVIRT_INP",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--source", "192.168.122.0/24",
+                       "--jump", "MASQUERADE", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-A", "FORWARD",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "-m", "comment", "--comment", "a comment",
+                       "--jump", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virFirewallSetRestoreOverride(false);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallFree(fw);
+    return ret;
+}
+
+static const char *testIPTablesSave =
+    "# Generated by iptables-save\n"
+    "*nat\n"
+    ":PREROUTING ACCEPT [0:0]\n"
+    ":POSTROUTING ACCEPT [0:0]\n"
+    "-A POSTROUTING -s 192.168.122.0/24 ! -d 192.168.122.0/24 -p tcp -j MASQUERADE --to-ports 1024-65535\n"
+    "COMMIT\n"
+    "*filter\n"
+    ":INPUT ACCEPT [0:0]\n"
+    ":FORWARD ACCEPT [0:0]\n"
+    "-A INPUT -i virbr0 -p udp -m udp --dport 53 -j ACCEPT\n"
+    "-A FORWARD -d 192.168.122.0/24 -o virbr0 -m conntrack --ctstate RELATED,ESTABLISHED -j ACCEPT\n"
+    "-A FORWARD -i virbr0 -j REJECT --reject-with icmp-port-unreachable\n"
+    "COMMIT\n";
+
+static void
+testFirewallSnapshotHook(const char *const*args,
+                         const char *const*env ATTRIBUTE_UNUSED,
+                         const char *input ATTRIBUTE_UNUSED,
+                         char **output,
+                         char **error ATTRIBUTE_UNUSED,
+                         int *status,
+                         void *opaque ATTRIBUTE_UNUSED)
+{
+    if (STREQ(args[0], IPTABLES_PATH "-save")) {
+        if (VIR_STRDUP(*output, testIPTablesSave) < 0)
+            *status = 127;
+    } else {
+        if (VIR_STRDUP(*output, "") < 0)
+            *status = 127;
+    }
+}
+
+static int
+testFirewallSnapshot(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virFirewallSnapshotPtr snapshot = NULL;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+
+    if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_DIRECT) < 0)
+        goto cleanup;
+
+    virCommandSetDryRun(NULL, testFirewallSnapshotHook, NULL);
+
+    if (!(snapshot = virFirewallSnapshotNew()))
+        goto cleanup;
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "filter",
+                       "--insert", "INPUT",
+                       "--in-interface", "virbr0",
+                       "--protocol", "udp",
+                       "--destination-port", "53",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "filter",
+                       "--insert", "FORWARD",
+                       "--in-interface", "virbr0",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "filter",
+                       "--insert", "FORWARD",
+                       "--destination", "192.168.122.0/24",
+                       "--out-interface", "virbr0",
+                       "--match", "conntrack",
+                       "--ctstate", "ESTABLISHED,RELATED",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "--insert", "POSTROUTING",
+                       "--source", "192.168.122.0/24",
+                       "-p", "tcp",
+                       "!", "--destination", "192.168.122.0/24",
+                       "--jump", "MASQUERADE",
+                       "--to-ports", "1024-65535", NULL);
+
+    virFirewallStartRollback(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "filter",
+                       "--delete", "INPUT",
+                       "--in-interface", "virbr0",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "mangle",
+                       "--insert", "POSTROUTING",
+                       "--out-interface", "virbr0",
+                       "--jump", "CHECKSUM",
+                       "--checksum-fill", NULL);
+
+    if (!virFirewallIsApplied(fw, snapshot)) {
+        fprintf(stderr, "Expected rules to be present\n");
+        goto cleanup;
+    }
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "filter",
+                       "--insert", "FORWARD",
+                       "--out-interface", "virbr0",
+                       "--jump", "REJECT", NULL);
+
+    if (virFirewallIsApplied(fw, snapshot)) {
+        fprintf(stderr, "Expected a rule to be missing\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallSnapshotFree(snapshot);
+    virFirewallFree(fw);
+    return ret;
+}
+
 static bool
 hasNetfilterTools(void)
 {
@@ -1134,6 +1372,12 @@ hasNetfilterTools(void)
 static int
 mymain(void)
 {
+    struct testFirewallData restoreDirect = {
+        VIR_FIREWALL_BACKEND_DIRECT, VIR_FIREWALL_BACKEND_DIRECT, true,
+    };
+    struct testFirewallData restoreNFTables = {
+        VIR_FIREWALL_BACKEND_NFTABLES, VIR_FIREWALL_BACKEND_NFTABLES, true,
+    };
     int ret = 0;
 
     if (!hasNetfilterTools()) {
@@ -1192,6 +1436,14 @@ mymain(void)
     RUN_TEST("many rollback", testFirewallManyRollback);
     RUN_TEST("chained rollback", testFirewallChainedRollback);
     RUN_TEST("query transaction", testFirewallQuery);
+    if (virTestRun("restore transaction", testFirewallRestore,
+                   &restoreDirect) < 0)
+        ret = -1;
+    if (virTestRun("restore transaction nftables", testFirewallRestore,
+                   &restoreNFTables) < 0)
+        ret = -1;
+    if (virTestRun("snapshot", testFirewallSnapshot, NULL) < 0)
+        ret = -1;
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -8,10 +8,13 @@
 #include "internal.h"
 #include "virhash.h"
 #include "virhashdata.h"
+#include "virhashcode.h"
 #include "testutils.h"
 #include "viralloc.h"
 #include "virlog.h"
+#include "virrandom.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -530,6 +533,161 @@ testHashGetItems(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Enough entries for the table to be resized incrementally, see
+ * VIR_HASH_MIGRATE_THRESHOLD, and few enough for that resize to be
+ * still in progress when the table is used below */
+#define TEST_HASH_MIGRATE_ENTRIES 1560
+#define TEST_HASH_MIGRATE_REMOVED 20
+
+static int
+testHashMigrateForEach(void *payload,
+                       const void *name,
+                       void *data)
+{
+    size_t *seen = data;
+    unsigned int i;
+
+    if (STRNEQ(payload, name) ||
+        sscanf(name, "key-%u", &i) != 1 ||
+        i >= TEST_HASH_MIGRATE_ENTRIES) {
+        VIR_TEST_VERBOSE("\nunexpected entry '%s'\n", (const char *) name);
+        return -1;
+    }
+
+    seen[i]++;
+    return 0;
+}
+
+
+static int
+testHashMigrateRemoveSetIter(const void *payload ATTRIBUTE_UNUSED,
+                             const void *name,
+                             const void *data ATTRIBUTE_UNUSED)
+{
+    unsigned int i;
+
+    return sscanf(name, "key-%u", &i) == 1 && i % 10 == 1;
+}
+
+
+static int
+testHashMigrateCheck(virHashTablePtr hash,
+                     size_t *seen,
+                     size_t expected)
+{
+    virHashKeyValuePairPtr items = NULL;
+    size_t found = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(seen, 0, sizeof(*seen) * TEST_HASH_MIGRATE_ENTRIES);
+
+    if (virHashForEach(hash, testHashMigrateForEach, seen) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_HASH_MIGRATE_ENTRIES; i++) {
+        if (seen[i] > 1) {
+            VIR_TEST_VERBOSE("\nentry key-%zu iterated %zu times\n",
+                             i, seen[i]);
+            goto cleanup;
+        }
+        found += seen[i];
+    }
+
+    if (found != expected || virHashSize(hash) != expected) {
+        VIR_TEST_VERBOSE("\nexpected %zu entries, iterated over %zu, "
+                         "size %zd\n", expected, found, virHashSize(hash));
+        goto cleanup;
+    }
+
+    if (!(items = virHashGetItems(hash, NULL)))
+        goto cleanup;
+
+    for (found = 0; items[found].key; found++)
+        ;
+
+    if (found != expected) {
+        VIR_TEST_VERBOSE("\nvirHashGetItems returned %zu entries "
+                         "instead of %zu\n", found, expected);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(items);
+    return ret;
+}
+
+
+static int
+testHashMigrate(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    size_t *seen = NULL;
+    size_t expected = TEST_HASH_MIGRATE_ENTRIES;
+    char *key;
+    size_t i;
+    int ret = -1;
+
+    if (!(hash = virHashCreate(0, virHashValueFree)) ||
+        VIR_ALLOC_N(seen, TEST_HASH_MIGRATE_ENTRIES) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_HASH_MIGRATE_ENTRIES; i++) {
+        if (virAsprintf(&key, "key-%zu", i) < 0)
+            goto cleanup;
+
+        if (virHashAddEntry(hash, key, key) < 0) {
+            VIR_FREE(key);
+            goto cleanup;
+        }
+    }
+
+    if (testHashMigrateCheck(hash, seen, expected) < 0)
+        goto cleanup;
+
+    /* The lowest keys are likely to have been moved to the new slots */
+    for (i = 0; i < TEST_HASH_MIGRATE_REMOVED; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "key-%zu", i * 7);
+        if (virHashRemoveEntry(hash, name) < 0) {
+            VIR_TEST_VERBOSE("\nentry '%s' could not be removed\n", name);
+            goto cleanup;
+        }
+        expected--;
+
+        if (virHashLookup(hash, name)) {
+            VIR_TEST_VERBOSE("\nremoved entry '%s' still found\n", name);
+            goto cleanup;
+        }
+    }
+
+    if (testHashMigrateCheck(hash, seen, expected) < 0)
+        goto cleanup;
+
+    if (virHashRemoveSet(hash, testHashMigrateRemoveSetIter, NULL) < 0)
+        goto cleanup;
+
+    /* Entries removed one by one above don't count again */
+    for (i = 1; i < TEST_HASH_MIGRATE_ENTRIES; i += 10) {
+        if (i % 7 != 0 || i / 7 >= TEST_HASH_MIGRATE_REMOVED)
+            expected--;
+    }
+
+    if (testHashMigrateCheck(hash, seen, expected) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(seen);
+    virHashFree(hash);
+    return ret;
+}
+
+
 static int
 testHashEqualCompValue(const void *value1, const void *value2)
 {
@@ -597,6 +755,267 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+/*
+ * Microbenchmark comparing virHashTable with a minimal chained table
+ * built the way virHashTable used to be: one malloc'd node and one
+ * strdup'd key per entry and a rehash of all entries at once when
+ * growing. Entries are looked up and removed in random order so that
+ * the chained table doesn't benefit from its nodes sitting in memory
+ * in insertion order. Only run with VIR_TEST_EXPENSIVE=1, results are
+ * printed with VIR_TEST_VERBOSE=1.
+ */
+#define TEST_HASH_BENCH_ENTRIES 200000
+
+typedef struct _testChainEntry testChainEntry;
+struct _testChainEntry {
+    testChainEntry *next;
+    char *name;
+    void *payload;
+};
+
+typedef struct {
+    testChainEntry **table;
+    size_t size;
+    size_t nbElems;
+} testChainTable;
+
+static int
+testChainGrow(testChainTable *table, size_t size)
+{
+    testChainEntry **oldtable = table->table;
+    size_t oldsize = table->size;
+    size_t i;
+
+    if (VIR_ALLOC_N(table->table, size) < 0) {
+        table->table = oldtable;
+        return -1;
+    }
+    table->size = size;
+
+    for (i = 0; i < oldsize; i++) {
+        testChainEntry *iter = oldtable[i];
+        while (iter) {
+            testChainEntry *next = iter->next;
+            size_t key = virHashCodeGen(iter->name, strlen(iter->name), 0) % size;
+
+            iter->next = table->table[key];
+            table->table[key] = iter;
+            iter = next;
+        }
+    }
+
+    VIR_FREE(oldtable);
+    return 0;
+}
+
+static int
+testChainAdd(testChainTable *table, const char *name, void *payload)
+{
+    size_t key = virHashCodeGen(name, strlen(name), 0) % table->size;
+    testChainEntry *entry;
+    size_t len = 0;
+
+    for (entry = table->table[key]; entry; entry = entry->next)
+        len++;
+
+    if (VIR_ALLOC(entry) < 0 || VIR_STRDUP(entry->name, name) < 0) {
+        VIR_FREE(entry);
+        return -1;
+    }
+    entry->payload = payload;
+    entry->next = table->table[key];
+    table->table[key] = entry;
+    table->nbElems++;
+
+    if (len > 8)
+        testChainGrow(table, 8 * table->size);
+
+    return 0;
+}
+
+static void *
+testChainLookup(testChainTable *table, const char *name)
+{
+    size_t key = virHashCodeGen(name, strlen(name), 0) % table->size;
+    testChainEntry *entry;
+
+    for (entry = table->table[key]; entry; entry = entry->next) {
+        if (STREQ(entry->name, name))
+            return entry->payload;
+    }
+    return NULL;
+}
+
+static void
+testChainRemove(testChainTable *table, const char *name)
+{
+    size_t key = virHashCodeGen(name, strlen(name), 0) % table->size;
+    testChainEntry **nextptr = &table->table[key];
+    testChainEntry *entry;
+
+    for (entry = *nextptr; entry; entry = entry->next) {
+        if (STREQ(entry->name, name)) {
+            *nextptr = entry->next;
+            VIR_FREE(entry->name);
+            VIR_FREE(entry);
+            table->nbElems--;
+            return;
+        }
+        nextptr = &entry->next;
+    }
+}
+
+struct testHashBenchResult {
+    unsigned long long add;
+    unsigned long long addMax;
+    unsigned long long lookup;
+    unsigned long long miss;
+    unsigned long long remove;
+};
+
+static unsigned long long
+testHashBenchNow(void)
+{
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMicrosNowRaw(&now));
+    return now;
+}
+
+static void
+testHashBenchReport(const char *name,
+                    struct testHashBenchResult *res)
+{
+    VIR_TEST_VERBOSE("\n%-8s add %6llu us (slowest %5llu us) "
+                     "lookup %6llu us miss %6llu us remove %6llu us",
+                     name, res->add, res->addMax, res->lookup,
+                     res->miss, res->remove);
+}
+
+static int
+testHashBench(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testHashBenchResult hres = { 0 }, cres = { 0 };
+    virHashTablePtr hash = NULL;
+    testChainTable chain = { NULL, 0, 0 };
+    char **keys = NULL;
+    char **missing = NULL;
+    size_t *order = NULL;
+    unsigned long long start, t;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keys, TEST_HASH_BENCH_ENTRIES) < 0 ||
+        VIR_ALLOC_N(missing, TEST_HASH_BENCH_ENTRIES) < 0 ||
+        VIR_ALLOC_N(order, TEST_HASH_BENCH_ENTRIES) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++)
+        order[i] = i;
+    for (i = TEST_HASH_BENCH_ENTRIES - 1; i > 0; i--) {
+        size_t j = virRandomInt(i + 1);
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (virAsprintf(&keys[i], "domain-%zu", i) < 0 ||
+            virAsprintf(&missing[i], "missing-%zu", i) < 0)
+            goto cleanup;
+    }
+
+    if (!(hash = virHashCreate(0, NULL)) ||
+        testChainGrow(&chain, 256) < 0)
+        goto cleanup;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        t = testHashBenchNow();
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+        t = testHashBenchNow() - t;
+        hres.addMax = MAX(hres.addMax, t);
+    }
+    hres.add = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        t = testHashBenchNow();
+        if (testChainAdd(&chain, keys[i], keys[i]) < 0)
+            goto cleanup;
+        t = testHashBenchNow() - t;
+        cres.addMax = MAX(cres.addMax, t);
+    }
+    cres.add = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (virHashLookup(hash, keys[order[i]]) != keys[order[i]]) {
+            VIR_TEST_VERBOSE("\nentry \"%s\" could not be found\n", keys[order[i]]);
+            goto cleanup;
+        }
+    }
+    hres.lookup = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (testChainLookup(&chain, keys[order[i]]) != keys[order[i]])
+            goto cleanup;
+    }
+    cres.lookup = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (virHashLookup(hash, missing[order[i]]))
+            goto cleanup;
+    }
+    hres.miss = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (testChainLookup(&chain, missing[order[i]]))
+            goto cleanup;
+    }
+    cres.miss = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+        if (virHashRemoveEntry(hash, keys[order[i]]) < 0)
+            goto cleanup;
+    }
+    hres.remove = testHashBenchNow() - start;
+
+    start = testHashBenchNow();
+    for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++)
+        testChainRemove(&chain, keys[order[i]]);
+    cres.remove = testHashBenchNow() - start;
+
+    if (testHashCheckCount(hash, 0) < 0 || chain.nbElems != 0)
+        goto cleanup;
+
+    testHashBenchReport("virHash", &hres);
+    testHashBenchReport("chained", &cres);
+    VIR_TEST_VERBOSE("\n");
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    VIR_FREE(chain.table);
+    if (keys) {
+        for (i = 0; i < TEST_HASH_BENCH_ENTRIES; i++) {
+            VIR_FREE(keys[i]);
+            VIR_FREE(missing[i]);
+        }
+    }
+    VIR_FREE(keys);
+    VIR_FREE(missing);
+    VIR_FREE(order);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -635,6 +1054,10 @@ mymain(void)
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
     DO_TEST("Equal", Equal);
+    DO_TEST("Migrate", Migrate);
+
+    if (virTestGetExpensive())
+        DO_TEST("Benchmark", Bench);
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
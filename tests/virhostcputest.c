@@ -181,6 +181,7 @@ linuxTestHostCPU(const void *opaque)
     }
 
     virFileWrapperAddPrefix(SYSFS_SYSTEM_PATH, sysfs_prefix);
+    virHostCPUTopologyInvalidate();
     result = linuxTestCompareFiles(cpuinfo, data->arch, output);
     virFileWrapperRemovePrefix(SYSFS_SYSTEM_PATH);
 
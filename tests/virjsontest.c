@@ -66,6 +66,193 @@ testJSONFromString(const void *data)
 }
 
 
+static int
+testJSONReader(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONReaderPtr reader = NULL;
+    virJSONValuePtr json = NULL;
+    virJSONToken token;
+    const char *expectstr = info->expect ? info->expect : info->doc;
+    char *formatted = NULL;
+    int ret = -1;
+
+    if (!(reader = virJSONReaderNew(info->doc)))
+        goto cleanup;
+
+    if (virJSONReaderNext(reader, &token) <= 0 ||
+        !(json = virJSONReaderReadValue(reader)) ||
+        virJSONReaderNext(reader, &token) != 0) {
+        if (info->pass) {
+            VIR_TEST_VERBOSE("Fail to read %s\n", info->doc);
+        } else {
+            VIR_TEST_DEBUG("Fail to read %s\n", info->doc);
+            ret = 0;
+        }
+        goto cleanup;
+    }
+
+    if (!info->pass) {
+        VIR_TEST_VERBOSE("Should not have read %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (!(formatted = virJSONValueToString(json, false))) {
+        VIR_TEST_VERBOSE("Failed to format json data\n");
+        goto cleanup;
+    }
+
+    if (STRNEQ(expectstr, formatted)) {
+        virTestDifference(stderr, expectstr, formatted);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(formatted);
+    virJSONValueFree(json);
+    virJSONReaderFree(reader);
+    return ret;
+}
+
+
+static int
+testJSONReaderSkip(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONReaderPtr reader = NULL;
+    virJSONToken token;
+    const char *key;
+    char *id = NULL;
+    int rc;
+    int ret = -1;
+
+    if (!(reader = virJSONReaderNew(info->doc)))
+        goto cleanup;
+
+    if (virJSONReaderNext(reader, &token) <= 0 ||
+        token != VIR_JSON_TOKEN_OBJECT_START)
+        goto fail;
+
+    while ((rc = virJSONReaderNextKey(reader, &key)) > 0) {
+        if (STREQ(key, "id")) {
+            if (virJSONReaderNext(reader, &token) <= 0 ||
+                token != VIR_JSON_TOKEN_STRING ||
+                VIR_STRDUP(id, virJSONReaderGetText(reader)) < 0)
+                goto fail;
+        } else if (virJSONReaderSkip(reader) < 0) {
+            goto fail;
+        }
+    }
+
+    if (rc < 0 || virJSONReaderNext(reader, &token) != 0)
+        goto fail;
+
+    if (!info->pass) {
+        VIR_TEST_VERBOSE("Should not have read %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (STRNEQ_NULLABLE(info->expect, id)) {
+        virTestDifference(stderr, NULLSTR(info->expect), NULLSTR(id));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(id);
+    virJSONReaderFree(reader);
+    return ret;
+
+ fail:
+    if (info->pass)
+        VIR_TEST_VERBOSE("Fail to read %s\n", info->doc);
+    else
+        ret = 0;
+    goto cleanup;
+}
+
+
+static int
+testJSONWriter(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    const char *expectstr = info->expect ? info->expect : info->doc;
+    char *formatted = NULL;
+    int ret = -1;
+
+    if (!(json = virJSONValueFromString(info->doc))) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    virJSONWriterInit(&writer, &buf);
+    if (virJSONWriterValue(&writer, json) < 0 ||
+        virJSONWriterFinish(&writer) < 0) {
+        VIR_TEST_VERBOSE("Failed to write json data\n");
+        goto cleanup;
+    }
+
+    formatted = virBufferContentAndReset(&buf);
+
+    if (STRNEQ_NULLABLE(expectstr, formatted)) {
+        virTestDifference(stderr, expectstr, NULLSTR(formatted));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(formatted);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+/* Formats a string value built from the raw bytes in @doc */
+static int
+testJSONWriterString(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    char *formatted = NULL;
+    int ret = -1;
+
+    if (!(json = virJSONValueNewString(info->doc)))
+        goto cleanup;
+
+    virJSONWriterInit(&writer, &buf);
+    if (virJSONWriterValue(&writer, json) < 0 ||
+        virJSONWriterFinish(&writer) < 0) {
+        VIR_TEST_VERBOSE("Failed to write json data\n");
+        goto cleanup;
+    }
+
+    formatted = virBufferContentAndReset(&buf);
+
+    if (STRNEQ_NULLABLE(info->expect, formatted)) {
+        virTestDifference(stderr, info->expect, NULLSTR(formatted));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(formatted);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
 static int
 testJSONAddRemove(const void *data)
 {
@@ -451,10 +638,29 @@ mymain(void)
  * identical to @doc.
  */
 #define DO_TEST_PARSE(name, doc, expect) \
-    DO_TEST_FULL(name, FromString, doc, expect, true)
+    do { \
+        DO_TEST_FULL(name, FromString, doc, expect, true); \
+        DO_TEST_FULL(name " (reader)", Reader, doc, expect, true); \
+        DO_TEST_FULL(name " (writer)", Writer, doc, expect, true); \
+    } while (0)
 
 #define DO_TEST_PARSE_FAIL(name, doc) \
-    DO_TEST_FULL(name, FromString, doc, NULL, false)
+    do { \
+        DO_TEST_FULL(name, FromString, doc, NULL, false); \
+        DO_TEST_FULL(name " (reader)", Reader, doc, NULL, false); \
+    } while (0)
+
+#define DO_TEST_WRITER_STRING(name, str, expect) \
+    DO_TEST_FULL("Writer string " name, WriterString, str, expect, true)
+
+    DO_TEST_WRITER_STRING("plain", "plain", "\"plain\"");
+    DO_TEST_WRITER_STRING("escapes", "a\"b\\c\n\t\x01",
+                          "\"a\\\"b\\\\c\\n\\t\\u0001\"");
+    DO_TEST_WRITER_STRING("UTF-8", "\xc3\xa9t\xc3\xa9",
+                          "\"\xc3\xa9t\xc3\xa9\"");
+    /* Invalid UTF-8 is passed through as yajl did */
+    DO_TEST_WRITER_STRING("invalid UTF-8", "a\xff\xc3" "b",
+                          "\"a\xff\xc3" "b\"");
 
 
     DO_TEST_PARSE("Simple", "{\"return\": {}, \"id\": \"libvirt-1\"}",
@@ -572,6 +778,15 @@ mymain(void)
     DO_TEST_PARSE_FAIL("object with unterminated key", "{ \"key:7 }");
     DO_TEST_PARSE_FAIL("duplicate key", "{ \"a\": 1, \"a\": 1 }");
 
+    DO_TEST_FULL("reader skip", ReaderSkip,
+                 "{\"return\": [{\"device\": \"drive-virtio-disk0\", "
+                 "\"stats\": {\"rd_bytes\": 1, \"wr_bytes\": [2, {}]}}, "
+                 "{\"id\": \"bogus\"}], \"id\": \"libvirt-2\", "
+                 "\"other\": \"\\u00e9t\\u00e9\"}", "libvirt-2", true);
+    DO_TEST_FULL("reader skip unterminated", ReaderSkip,
+                 "{\"return\": [{\"stats\": {}], \"id\": \"libvirt-2\"}",
+                 NULL, false);
+
     DO_TEST_FULL("lookup on array", Lookup,
                  "[ 1 ]", NULL, false);
     DO_TEST_FULL("lookup on string", Lookup,
@@ -22,6 +22,14 @@
 #include "testutils.h"
 
 #include "virlog.h"
+#include "viralloc.h"
+#include "virtime.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logtest");
 
 struct testLogData {
     const char *str;
@@ -107,6 +115,201 @@ testLogParseFilters(const void *opaque)
     return ret;
 }
 
+static int
+testLogRecorder(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int ret = -1;
+    char *dump = NULL;
+    const char *str = "recorded";
+    const char *expect[] = {
+        "debug : testLogRecorder:",
+        ": int=-3 uint=42 size=7 str='recorded' dbl=1.50 100%\n",
+        ": fallback=  *\n",
+    };
+    size_t i;
+
+    if (virLogSetRecorderSize(2) < 0)
+        goto cleanup;
+
+    /* Debug messages are filtered out by default, but must be recorded */
+    virLogMessage(&virLogSelf, VIR_LOG_DEBUG, __FILE__, __LINE__, __func__,
+                  NULL, "dropped %d", 1);
+    virLogMessage(&virLogSelf, VIR_LOG_DEBUG, __FILE__, __LINE__, __func__,
+                  NULL, "int=%d uint=%llu size=%zu str='%s' dbl=%.2f 100%%",
+                  -3, 42ULL, (size_t) 7, str, 1.5);
+    virLogMessage(&virLogSelf, VIR_LOG_DEBUG, __FILE__, __LINE__, __func__,
+                  NULL, "fallback=%*s", 3, "*");
+
+    if (!(dump = virLogRecorderDump()))
+        goto cleanup;
+
+    if (strstr(dump, "dropped")) {
+        VIR_TEST_DEBUG("Oldest message should have been dropped:\n%s", dump);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(expect); i++) {
+        if (!strstr(dump, expect[i])) {
+            VIR_TEST_DEBUG("Expected '%s' in:\n%s", expect[i], dump);
+            goto cleanup;
+        }
+    }
+
+    if (!virLogProbablyLogMessage(dump)) {
+        VIR_TEST_DEBUG("Unexpected format of:\n%s", dump);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogSetRecorderSize(0);
+    VIR_FREE(dump);
+    return ret;
+}
+
+static int
+testLogJSON(const void *opaque)
+{
+    int ret = -1;
+    bool async = *(const bool *) opaque;
+    char *path = NULL;
+    char *outputs = NULL;
+    char *content = NULL;
+    virLogMetadata meta[] = {
+        { "LIBVIRT_DOMAIN", "guest", 0 },
+        { "LIBVIRT_CODE", NULL, 7 },
+        { NULL, NULL, 0 },
+    };
+    const char *expect[] = {
+        "\"level\":\"info\",\"source\":\"tests.logtest\","
+        "\"func\":\"testLogJSON\",",
+        "\"msg\":\"quote=\\\" backslash=\\\\ nl=\\n ctrl=\\u0001\","
+        "\"LIBVIRT_DOMAIN\":\"guest\",\"LIBVIRT_CODE\":7}\n",
+    };
+    size_t i;
+
+    if (virAsprintf(&path, "%s/virlogtest-%d.json",
+                    abs_builddir, (int) getpid()) < 0)
+        goto cleanup;
+    unlink(path);
+
+    if (virAsprintf(&outputs, "2:json:%s", path) < 0 ||
+        virLogSetOutputs(outputs) < 0 ||
+        virLogSetFilters("2:tests.logtest") < 0)
+        goto cleanup;
+
+    if (async && virLogSetAsync(true, false) < 0)
+        goto cleanup;
+
+    virLogMessage(&virLogSelf, VIR_LOG_INFO, __FILE__, __LINE__, __func__,
+                  meta, "quote=\" backslash=\\ nl=\n ctrl=\001");
+
+    if (async && virLogSetAsync(false, false) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(path, 1024 * 1024, &content) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(expect); i++) {
+        if (!strstr(content, expect[i])) {
+            VIR_TEST_DEBUG("Expected '%s' in:\n%s", expect[i], content);
+            goto cleanup;
+        }
+    }
+
+    if (!STRPREFIX(content, "{\"ts\":\"")) {
+        VIR_TEST_DEBUG("Unexpected format of:\n%s", content);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogReset();
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(outputs);
+    VIR_FREE(content);
+    return ret;
+}
+
+
+/*
+ * Microbenchmark of the cost of a log call on the RPC path, modelled on
+ * the message logged for each RPC message a client sends. Only run with
+ * VIR_TEST_EXPENSIVE=1, results are printed with VIR_TEST_VERBOSE=1.
+ */
+#define TEST_LOG_BENCH_CALLS 1000000
+
+typedef enum {
+    TEST_LOG_BENCH_FILTERED,    /* filtered out, checked in the caller */
+    TEST_LOG_BENCH_UNGUARDED,   /* filtered out, checked by virLogMessage */
+    TEST_LOG_BENCH_RECORDED,    /* filtered out, kept by the recorder */
+    TEST_LOG_BENCH_WRITTEN,     /* written to /dev/null */
+} testLogBenchMode;
+
+static unsigned long long
+testLogBenchNow(void)
+{
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMicrosNowRaw(&now));
+    return now;
+}
+
+static unsigned long long
+testLogBenchRun(testLogBenchMode mode)
+{
+    unsigned long long start = testLogBenchNow();
+    unsigned int prog = 0x20008086;
+    size_t i;
+
+    for (i = 0; i < TEST_LOG_BENCH_CALLS; i++) {
+        if (mode == TEST_LOG_BENCH_UNGUARDED) {
+            virLogMessage(&virLogSelf, VIR_LOG_INFO, __FILE__, __LINE__,
+                          __func__, NULL,
+                          "client=%p len=%zu prog=%u vers=%u proc=%u "
+                          "type=%u status=%u serial=%zu",
+                          &i, i & 0xffff, prog, 1, 66, 0, 0, i);
+        } else {
+            VIR_INFO("client=%p len=%zu prog=%u vers=%u proc=%u "
+                     "type=%u status=%u serial=%zu",
+                     &i, i & 0xffff, prog, 1, 66, 0, 0, i);
+        }
+    }
+
+    return (testLogBenchNow() - start) * 1000 / TEST_LOG_BENCH_CALLS;
+}
+
+static int
+testLogBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int ret = -1;
+
+    VIR_TEST_VERBOSE("\nfiltered  %4llu ns/call",
+                     testLogBenchRun(TEST_LOG_BENCH_FILTERED));
+    VIR_TEST_VERBOSE("\nunguarded %4llu ns/call",
+                     testLogBenchRun(TEST_LOG_BENCH_UNGUARDED));
+
+    if (virLogSetRecorderSize(256) < 0)
+        goto cleanup;
+    VIR_TEST_VERBOSE("\nrecorded  %4llu ns/call",
+                     testLogBenchRun(TEST_LOG_BENCH_RECORDED));
+    if (virLogSetRecorderSize(0) < 0)
+        goto cleanup;
+
+    if (virLogSetOutputs("1:file:/dev/null") < 0 ||
+        virLogSetFilters("1:tests.logtest") < 0)
+        goto cleanup;
+    VIR_TEST_VERBOSE("\nwritten   %4llu ns/call\n",
+                     testLogBenchRun(TEST_LOG_BENCH_WRITTEN));
+
+    ret = 0;
+ cleanup:
+    virLogReset();
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -144,6 +347,8 @@ mymain(void)
     TEST_PARSE_OUTPUTS_FAIL("foo:stderr", 1);
     TEST_PARSE_OUTPUTS_FAIL("1:bar", 1);
     TEST_PARSE_OUTPUTS_FAIL("1:stderr:foobar", 1);
+    TEST_PARSE_OUTPUTS("1:json:/dev/null 2:file:/dev/null", 2);
+    TEST_PARSE_OUTPUTS_FAIL("1:json", 1);
     TEST_PARSE_FILTERS("1:foo", 1);
     TEST_PARSE_FILTERS("1:foo 2:bar  3:foobar", 3);
     TEST_PARSE_FILTERS_FAIL("5:foo", 1);
@@ -151,6 +356,18 @@ mymain(void)
     TEST_PARSE_FILTERS_FAIL(":foo", 1);
     TEST_PARSE_FILTERS_FAIL("1:+", 1);
 
+    if (virTestRun("testLogRecorder", testLogRecorder, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("testLogJSON sync", testLogJSON, &(bool){false}) < 0)
+        ret = -1;
+    if (virTestRun("testLogJSON async", testLogJSON, &(bool){true}) < 0)
+        ret = -1;
+
+    if (virTestGetExpensive() &&
+        virTestRun("testLogBench", testLogBench, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
@@ -64,6 +64,22 @@ struct testSetStruct {
             goto cleanup; \
     } while (0)
 
+static void
+testVirNetDevBandwidthDryRunInput(const char *const*args ATTRIBUTE_UNUSED,
+                                  const char *const*env ATTRIBUTE_UNUSED,
+                                  const char *input,
+                                  char **output ATTRIBUTE_UNUSED,
+                                  char **error ATTRIBUTE_UNUSED,
+                                  int *status ATTRIBUTE_UNUSED,
+                                  void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    /* Show the commands fed to 'tc -batch' along with the command line */
+    if (input)
+        virBufferAdd(buf, input, -1);
+}
+
 static int
 testVirNetDevBandwidthSet(const void *data)
 {
@@ -79,7 +95,7 @@ testVirNetDevBandwidthSet(const void *data)
     if (!iface)
         iface = "eth0";
 
-    virCommandSetDryRun(&buf, NULL, NULL);
+    virCommandSetDryRun(&buf, testVirNetDevBandwidthDryRunInput, &buf);
 
     if (virNetDevBandwidthSet(iface, band, info->hierarchical_class, true) < 0)
         goto cleanup;
@@ -134,34 +150,40 @@ mymain(void)
     DO_TEST_SET(("<bandwidth>"
                  "  <inbound average='1024'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 root handle 1: htb default 1\n"
-                 TC " class add dev eth0 parent 1: classid 1:1 htb rate 1024kbps quantum 87\n"
-                 TC " qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
-                 TC " filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"));
+                (TC " -force -batch -\n"
+                 "qdisc del dev eth0 root\n"
+                 "qdisc del dev eth0 ingress\n"
+                 TC " -batch -\n"
+                 "qdisc add dev eth0 root handle 1: htb default 1\n"
+                 "class add dev eth0 parent 1: classid 1:1 htb rate 1024kbps quantum 87\n"
+                 "qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
+                 "filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"));
 
     DO_TEST_SET(("<bandwidth>"
                  "  <outbound average='1024'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 ingress\n"
-                 TC " filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
+                (TC " -force -batch -\n"
+                 "qdisc del dev eth0 root\n"
+                 "qdisc del dev eth0 ingress\n"
+                 TC " -batch -\n"
+                 "qdisc add dev eth0 ingress\n"
+                 "filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
                  "police rate 1024kbps burst 1024kb mtu 64kb drop flowid :1\n"));
 
     DO_TEST_SET(("<bandwidth>"
                  "  <inbound average='1' peak='2' floor='3' burst='4'/>"
                  "  <outbound average='5' peak='6' burst='7'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 root handle 1: htb default 1\n"
-                 TC " class add dev eth0 parent 1: classid 1:1 htb rate 1kbps ceil 2kbps burst 4kb quantum 1\n"
-                 TC " qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
-                 TC " filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"
-                 TC " qdisc add dev eth0 ingress\n"
-                 TC " filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
+                (TC " -force -batch -\n"
+                 "qdisc del dev eth0 root\n"
+                 "qdisc del dev eth0 ingress\n"
+                 TC " -batch -\n"
+                 "qdisc add dev eth0 root handle 1: htb default 1\n"
+                 "class add dev eth0 parent 1: classid 1:1 htb rate 1kbps ceil 2kbps burst 4kb quantum 1\n"
+                 "qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
+                 "filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"
+                 "qdisc add dev eth0 ingress\n"
+                 "filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
                  "police rate 5kbps burst 7kb mtu 64kb drop flowid :1\n"));
 
     return ret;
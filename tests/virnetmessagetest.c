@@ -28,6 +28,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virobject.h"
 #include "rpc/virnetmessage.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -522,6 +523,160 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testMessagePayloadStreamEncodeRef(const void *args ATTRIBUTE_UNUSED)
+{
+    char stream[] = "The quick brown fox jumps over the lazy dog";
+    virNetMessagePtr msg = virNetMessageNew(true);
+    static const char expect[] = {
+        0x00, 0x00, 0x00, 0x47,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x03,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x02,  /* Status */
+
+        'T', 'h', 'e', ' ',
+        'q', 'u', 'i', 'c',
+        'k', ' ', 'b', 'r',
+        'o', 'w', 'n', ' ',
+        'f', 'o', 'x', ' ',
+        'j', 'u', 'm', 'p',
+        's', ' ', 'o', 'v',
+        'e', 'r', ' ', 't',
+        'h', 'e', ' ', 'l',
+        'a', 'z', 'y', ' ',
+        'd', 'o', 'g',
+    };
+    char actual[sizeof(expect)];
+    size_t len = 0;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayloadRef(msg, stream, strlen(stream), false) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength != 28 || msg->body != stream) {
+        VIR_DEBUG("Expect 28 byte header and referenced body, got %zu %p",
+                  msg->bufferLength, msg->body);
+        goto cleanup;
+    }
+
+    /* Pretend the socket takes 10 bytes at a time, so that the
+     * boundary between header and body is crossed mid-write */
+    while (virNetMessageHasPendingData(msg)) {
+        struct iovec iov[VIR_NET_MESSAGE_IOV_MAX];
+        int niov = virNetMessageGetIOV(msg, iov);
+        size_t want = 10;
+        size_t i;
+
+        for (i = 0; i < niov && want; i++) {
+            size_t n = MIN(want, iov[i].iov_len);
+
+            if (len + n > sizeof(actual)) {
+                VIR_DEBUG("Message is longer than expected");
+                goto cleanup;
+            }
+            memcpy(actual + len, iov[i].iov_base, n);
+            len += n;
+            want -= n;
+        }
+
+        virNetMessageConsumeIOV(msg, 10 - want);
+    }
+
+    if (len != sizeof(expect)) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  sizeof(expect), len);
+        goto cleanup;
+    }
+
+    if (memcmp(expect, actual, sizeof(expect)) != 0) {
+        virTestDifferenceBin(stderr, expect, actual, sizeof(expect));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int testMessagePool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePoolPtr pool = NULL;
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr oldmsg;
+    char *oldbuf;
+    unsigned long long hits;
+    unsigned long long misses;
+    int ret = -1;
+
+    if (!(pool = virNetMessagePoolNew(1)))
+        goto cleanup;
+
+    if (!(msg = virNetMessageNewFromPool(pool, true)))
+        goto cleanup;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    oldmsg = msg;
+    oldbuf = msg->buffer;
+    virNetMessageFree(msg);
+
+    /* Both the message and its buffer must be recycled */
+    if (!(msg = virNetMessageNewFromPool(pool, false)))
+        goto cleanup;
+
+    if (msg != oldmsg || msg->tracked || msg->buffer) {
+        VIR_DEBUG("Expected recycled, cleared message");
+        goto cleanup;
+    }
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (msg->buffer != oldbuf) {
+        VIR_DEBUG("Expected recycled buffer");
+        goto cleanup;
+    }
+
+    virNetMessagePoolGetStats(pool, &hits, &misses);
+    if (hits != 2 || misses != 2) {
+        VIR_DEBUG("Expected 2 hits, 2 misses, got %llu hits, %llu misses",
+                  hits, misses);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    virObjectUnref(pool);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -544,6 +699,13 @@ mymain(void)
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Stream Encode Ref",
+                   testMessagePayloadStreamEncodeRef, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Message Pool", testMessagePool, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
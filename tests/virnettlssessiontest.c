@@ -138,8 +138,8 @@ static int testTLSSessionInit(const void *opaque)
 
 
     /* Now the real part of the test, setup the sessions */
-    serverSess = virNetTLSSessionNew(serverCtxt, NULL);
-    clientSess = virNetTLSSessionNew(clientCtxt, data->hostname);
+    serverSess = virNetTLSSessionNew(serverCtxt, NULL, NULL);
+    clientSess = virNetTLSSessionNew(clientCtxt, data->hostname, NULL);
 
     if (!serverSess) {
         VIR_WARN("Unexpected failure using %s against %s",
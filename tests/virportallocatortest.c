@@ -152,6 +152,68 @@ static int testAllocReuse(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testAllocReleaseOrder(const void *args ATTRIBUTE_UNUSED)
+{
+    virPortAllocatorPtr alloc = virPortAllocatorNew("test", 5900, 5909, 0);
+    int ret = -1;
+    unsigned short p1, p2, p3, p4, p5;
+
+    if (!alloc)
+        return -1;
+
+    if (virPortAllocatorAcquire(alloc, &p1) < 0 ||
+        virPortAllocatorAcquire(alloc, &p2) < 0 ||
+        virPortAllocatorAcquire(alloc, &p3) < 0 ||
+        virPortAllocatorAcquire(alloc, &p4) < 0)
+        goto cleanup;
+    if (p4 != 5907) {
+        VIR_TEST_DEBUG("Expected 5907, got %d", p4);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorRelease(alloc, p3) < 0 ||
+        virPortAllocatorRelease(alloc, p1) < 0)
+        goto cleanup;
+
+    /* The lowest released port must be handed out first */
+    if (virPortAllocatorAcquire(alloc, &p5) < 0)
+        goto cleanup;
+    if (p5 != 5901) {
+        VIR_TEST_DEBUG("Expected 5901, got %d", p5);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorAcquire(alloc, &p5) < 0)
+        goto cleanup;
+    if (p5 != 5903) {
+        VIR_TEST_DEBUG("Expected 5903, got %d", p5);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorSetUsed(alloc, p2, false) < 0)
+        goto cleanup;
+
+    if (virPortAllocatorAcquire(alloc, &p5) < 0)
+        goto cleanup;
+    if (p5 != 5902) {
+        VIR_TEST_DEBUG("Expected 5902, got %d", p5);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorAcquire(alloc, &p5) < 0)
+        goto cleanup;
+    if (p5 != 5908) {
+        VIR_TEST_DEBUG("Expected 5908, got %d", p5);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(alloc);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -163,6 +225,9 @@ mymain(void)
     if (virTestRun("Test alloc reuse", testAllocReuse, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Test alloc release order", testAllocReleaseOrder, NULL) < 0)
+        ret = -1;
+
     setenv("LIBVIRT_TEST_IPV4ONLY", "really", 1);
 
     if (virTestRun("Test IPv4-only alloc all", testAllocAll, NULL) < 0)
@@ -171,6 +236,10 @@ mymain(void)
     if (virTestRun("Test IPv4-only alloc reuse", testAllocReuse, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Test IPv4-only alloc release order",
+                   testAllocReleaseOrder, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -25,6 +25,8 @@
 #include <fcntl.h>
 
 #include "virrotatingfile.h"
+#include "virfile.h"
+#include "virutil.h"
 #include "virlog.h"
 #include "testutils.h"
 
@@ -424,6 +426,69 @@ static int testRotatingFileWriterRolloverAppend(const void *data ATTRIBUTE_UNUSE
 }
 
 
+static int testRotatingFileWriterAppendFD(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr file;
+    int ret = -1;
+    int fds[2] = { -1, -1 };
+    char buf[512];
+
+    if (testRotatingFileInitFiles((off_t)768,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    if (pipe(fds) < 0 || virSetNonBlock(fds[0]) < 0) {
+        fprintf(stderr, "Cannot create pipe\n");
+        goto cleanup;
+    }
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    /* Nothing to read yet */
+    if (virRotatingFileWriterAppendFD(file, fds[0], sizeof(buf)) != 0)
+        goto cleanup;
+
+    /* Fits in the current file */
+    if (safewrite(fds[1], buf, 128) != 128 ||
+        virRotatingFileWriterAppendFD(file, fds[0], 128) != 128)
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(896,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    /* Needs a rollover */
+    if (safewrite(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+        virRotatingFileWriterAppendFD(file, fds[0], sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(384,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fds[0]);
+    VIR_FORCE_CLOSE(fds[1]);
+    virRotatingFileWriterFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int testRotatingFileWriterRolloverMany(const void *data ATTRIBUTE_UNUSED)
 {
     virRotatingFileWriterPtr file;
@@ -694,6 +759,64 @@ static int testRotatingFileReaderSeek(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testRotatingFileWriterReader(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr writer = NULL;
+    virRotatingFileReaderPtr file = NULL;
+    int ret = -1;
+    char buf[1024];
+    ssize_t got;
+    size_t regions[] = { 156, 256 };
+    size_t allregions[] = { 256, 256, 256 };
+    struct stat sb;
+
+    if (testRotatingFileInitFiles(256, 256, 256) < 0)
+        return -1;
+
+    if (!(writer = virRotatingFileWriterNew(FILENAME, 1024, 2, false, 0700)))
+        goto cleanup;
+
+    if (stat(FILENAME0, &sb) < 0) {
+        virReportSystemError(errno, "Cannot stat %s", FILENAME0);
+        goto cleanup;
+    }
+
+    if (!(file = virRotatingFileWriterNewReader(writer, sb.st_ino, 100)))
+        goto cleanup;
+
+    if ((got = virRotatingFileReaderConsume(file, buf, sizeof(buf))) < 0)
+        goto cleanup;
+
+    if (testRotatingFileReaderAssertBufferContent(buf, got,
+                                                  ARRAY_CARDINALITY(regions),
+                                                  regions) < 0)
+        goto cleanup;
+
+    virRotatingFileReaderFree(file);
+
+    /* Unknown files are assumed to be rotated out */
+    if (!(file = virRotatingFileWriterNewReader(writer, 0, 100)))
+        goto cleanup;
+
+    if ((got = virRotatingFileReaderConsume(file, buf, sizeof(buf))) < 0)
+        goto cleanup;
+
+    if (testRotatingFileReaderAssertBufferContent(buf, got,
+                                                  ARRAY_CARDINALITY(allregions),
+                                                  allregions) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileReaderFree(file);
+    virRotatingFileWriterFree(writer);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -717,6 +840,9 @@ mymain(void)
     if (virTestRun("Rotating file write rollover append", testRotatingFileWriterRolloverAppend, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file write from pipe", testRotatingFileWriterAppendFD, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Rotating file write rollover many", testRotatingFileWriterRolloverMany, NULL) < 0)
         ret = -1;
 
@@ -738,6 +864,9 @@ mymain(void)
     if (virTestRun("Rotating file read seek", testRotatingFileReaderSeek, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file read from writer", testRotatingFileWriterReader, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -117,6 +117,18 @@ static int testCompareListCustom(const void *data ATTRIBUTE_UNUSED)
   return testCompareOutputLit(exp, NULL, argv);
 }
 
+static int testCompareListParallel(const void *data ATTRIBUTE_UNUSED)
+{
+  const char *const argv[] = { VIRSH_CUSTOM, "list", "--parallel", "4", NULL };
+  const char *exp = "\
+ Id    Name                           State\n\
+----------------------------------------------------\n\
+ 1     fv0                            running\n\
+ 2     fc4                            running\n\
+\n";
+  return testCompareOutputLit(exp, NULL, argv);
+}
+
 static int testCompareNodeinfoDefault(const void *data ATTRIBUTE_UNUSED)
 {
   const char *const argv[] = { VIRSH_DEFAULT, "nodeinfo", NULL };
@@ -266,6 +278,10 @@ mymain(void)
                    testCompareListCustom, NULL) != 0)
         ret = -1;
 
+    if (virTestRun("virsh list (parallel)",
+                   testCompareListParallel, NULL) != 0)
+        ret = -1;
+
     if (virTestRun("virsh nodeinfo (default)",
                    testCompareNodeinfoDefault, NULL) != 0)
         ret = -1;
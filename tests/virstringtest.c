@@ -714,6 +714,54 @@ testVirStringListFreeCount(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testStringIntern(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *a = NULL;
+    const char *b = NULL;
+    const char *c = NULL;
+    char *qemu = NULL;
+    int ret = -1;
+
+    if (VIR_STRDUP(qemu, "qemu") < 0 ||
+        virStringIntern(&a, qemu) < 0 ||
+        virStringIntern(&b, "qemu") < 0 ||
+        virStringIntern(&c, "tap") < 0)
+        goto cleanup;
+
+    if (a != b || a == qemu || STRNEQ(a, "qemu") || STRNEQ(c, "tap")) {
+        fprintf(stderr, "unexpected interned strings\n");
+        goto cleanup;
+    }
+
+    /* still referenced by @b */
+    virStringInternFree(a);
+    a = NULL;
+    if (virStringIntern(&a, "qemu") < 0)
+        goto cleanup;
+
+    if (a != b) {
+        fprintf(stderr, "interned string dropped while in use\n");
+        goto cleanup;
+    }
+
+    virStringInternFree(c);
+    if (virStringIntern(&c, NULL) != 0 || c) {
+        fprintf(stderr, "NULL not interned as NULL\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringInternFree(a);
+    virStringInternFree(b);
+    virStringInternFree(c);
+    VIR_FREE(qemu);
+    return ret;
+}
+
+
 struct testStripData {
     const char *string;
     const char *result;
@@ -1050,6 +1098,9 @@ mymain(void)
                    NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virStringIntern", testStringIntern, NULL) < 0)
+        ret = -1;
+
 #define TEST_STRIP_IPV6_BRACKETS(str, res) \
     do { \
         struct testStripData stripData = { \
@@ -151,6 +151,56 @@ testTypedParamsAddStringList(const void *opaque ATTRIBUTE_UNUSED)
     return rv;
 }
 
+static int
+testTypedParamsDeserializeBorrow(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    char field1[] = "foo";
+    char field2[] = "bar";
+    char value[] = "foobar";
+    struct _virTypedParameterRemote remote[] = {
+        { .field = field1,
+          .value = { .type = VIR_TYPED_PARAM_UINT,
+                     .remote_typed_param_value = { .ui = 42 } } },
+        { .field = field2,
+          .value = { .type = VIR_TYPED_PARAM_STRING,
+                     .remote_typed_param_value = { .s = value } } },
+    };
+
+    if (virTypedParamsDeserializeBorrow(remote, ARRAY_CARDINALITY(remote),
+                                        1, &params, &nparams) == 0 ||
+        params) {
+        fprintf(stderr, "limit of parameters was ignored\n");
+        goto cleanup;
+    }
+
+    if (virTypedParamsDeserializeBorrow(remote, ARRAY_CARDINALITY(remote),
+                                        0, &params, &nparams) < 0)
+        goto cleanup;
+
+    if (nparams != 2 ||
+        STRNEQ(params[0].field, "foo") ||
+        params[0].type != VIR_TYPED_PARAM_UINT ||
+        params[0].value.ui != 42 ||
+        STRNEQ(params[1].field, "bar") ||
+        params[1].type != VIR_TYPED_PARAM_STRING) {
+        fprintf(stderr, "unexpected parameters\n");
+        goto cleanup;
+    }
+
+    if (params[1].value.s != value) {
+        fprintf(stderr, "string value was copied\n");
+        goto cleanup;
+    }
+
+    rv = 0;
+ cleanup:
+    VIR_FREE(params);
+    return rv;
+}
+
 static int
 testTypedParamsGetStringList(const void *opaque ATTRIBUTE_UNUSED)
 {
@@ -302,6 +352,10 @@ mymain(void)
     if (virTestRun("Add string list", testTypedParamsAddStringList, NULL) < 0)
         rv = -1;
 
+    if (virTestRun("Deserialize borrowed", testTypedParamsDeserializeBorrow,
+                   NULL) < 0)
+        rv = -1;
+
     if (rv < 0)
         return EXIT_FAILURE;
     return EXIT_SUCCESS;
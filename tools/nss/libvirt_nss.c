@@ -73,6 +73,12 @@ do { \
 
 #define LEASEDIR LOCALSTATEDIR "/lib/libvirt/dnsmasq/"
 
+#if !defined(LIBVIRT_NSS_GUEST)
+# define LEASE_INDEX_KEY VIR_LEASE_INDEX_KEY_HOSTNAME
+#else
+# define LEASE_INDEX_KEY VIR_LEASE_INDEX_KEY_DOMAIN
+#endif
+
 #define LIBVIRT_ALIGN(x) (((x) + __SIZEOF_POINTER__ - 1) & ~(__SIZEOF_POINTER__ - 1))
 #define FAMILY_ADDRESS_SIZE(family) ((family) == AF_INET6 ? 16 : 4)
 
@@ -82,64 +88,92 @@ typedef struct {
 } leaseAddress;
 
 
+static int
+appendAddrRaw(leaseAddress **tmpAddress,
+              size_t *ntmpAddress,
+              int family,
+              const void *addr,
+              int af)
+{
+    size_t i;
+
+    if (af != AF_UNSPEC && af != family) {
+        DEBUG("Skipping address which family is %d, %d requested", family, af);
+        return 0;
+    }
+
+    for (i = 0; i < *ntmpAddress; i++) {
+        if (memcmp((*tmpAddress)[i].addr, addr,
+                   FAMILY_ADDRESS_SIZE(family)) == 0) {
+            DEBUG("IP address already in the list");
+            return 0;
+        }
+    }
+
+    if (VIR_REALLOC_N_QUIET(*tmpAddress, *ntmpAddress + 1) < 0) {
+        ERROR("Out of memory");
+        return -1;
+    }
+
+    (*tmpAddress)[*ntmpAddress].af = family;
+    memcpy((*tmpAddress)[*ntmpAddress].addr, addr,
+           FAMILY_ADDRESS_SIZE(family));
+    (*ntmpAddress)++;
+    return 0;
+}
+
+
 static int
 appendAddr(leaseAddress **tmpAddress,
            size_t *ntmpAddress,
            virJSONValuePtr lease,
            int af)
 {
-    int ret = -1;
     const char *ipAddr;
     virSocketAddr sa;
     int family;
-    size_t i;
 
     if (!(ipAddr = virJSONValueObjectGetString(lease, "ip-address"))) {
         ERROR("ip-address field missing for %s", name);
-        goto cleanup;
+        return -1;
     }
 
     DEBUG("IP address: %s", ipAddr);
 
     if (virSocketAddrParse(&sa, ipAddr, AF_UNSPEC) < 0) {
         ERROR("Unable to parse %s", ipAddr);
-        goto cleanup;
+        return -1;
     }
 
     family = VIR_SOCKET_ADDR_FAMILY(&sa);
-    if (af != AF_UNSPEC && af != family) {
-        DEBUG("Skipping address which family is %d, %d requested", family, af);
-        ret = 0;
-        goto cleanup;
-    }
 
-    for (i = 0; i < *ntmpAddress; i++) {
-        if (memcmp((*tmpAddress)[i].addr,
-                   (family == AF_INET ?
-                    (void *) &sa.data.inet4.sin_addr.s_addr :
-                    (void *) &sa.data.inet6.sin6_addr.s6_addr),
-                   FAMILY_ADDRESS_SIZE(family)) == 0) {
-            DEBUG("IP address already in the list");
-            ret = 0;
-            goto cleanup;
-        }
-    }
+    return appendAddrRaw(tmpAddress, ntmpAddress, family,
+                         (family == AF_INET ?
+                          (void *) &sa.data.inet4.sin_addr.s_addr :
+                          (void *) &sa.data.inet6.sin6_addr.s6_addr),
+                         af);
+}
 
-    if (VIR_REALLOC_N_QUIET(*tmpAddress, *ntmpAddress + 1) < 0) {
-        ERROR("Out of memory");
-        goto cleanup;
-    }
 
-    (*tmpAddress)[*ntmpAddress].af = family;
-    memcpy((*tmpAddress)[*ntmpAddress].addr,
-           (family == AF_INET ?
-            (void *) &sa.data.inet4.sin_addr.s_addr :
-            (void *) &sa.data.inet6.sin6_addr.s6_addr),
-           FAMILY_ADDRESS_SIZE(family));
-    (*ntmpAddress)++;
-    ret = 0;
- cleanup:
-    return ret;
+struct findLeaseIndexData {
+    leaseAddress **tmpAddress;
+    size_t *ntmpAddress;
+    int af;
+    bool *found;
+};
+
+
+static int
+findLeaseIndexCallback(int family,
+                       const unsigned char *addr,
+                       void *opaque)
+{
+    struct findLeaseIndexData *data = opaque;
+
+    *data->found = true;
+
+    return appendAddrRaw(data->tmpAddress, data->ntmpAddress,
+                         family, addr, data->af);
 }
 
 
@@ -253,6 +287,11 @@ findLease(const char *name,
     size_t ntmpAddress = 0;
     virMacMapPtr *macmaps = NULL;
     size_t nMacmaps = 0;
+    struct findLeaseIndexData indexData = {
+        &tmpAddress, &ntmpAddress, af, found
+    };
+    time_t currtime;
+    int rv;
 
     *address = NULL;
     *naddress = 0;
@@ -263,6 +302,23 @@ findLease(const char *name,
         goto cleanup;
     }
 
+    if ((currtime = time(NULL)) == (time_t) - 1) {
+        ERROR("Failed to get current system time");
+        goto cleanup;
+    }
+
+    /* Try the index published by the leases helper first, it saves
+     * parsing all the lease files. */
+    if ((rv = virLeaseIndexLookup(LEASEDIR VIR_LEASE_INDEX_FILE, name,
+                                  LEASE_INDEX_KEY, currtime,
+                                  findLeaseIndexCallback, &indexData)) < 0)
+        goto cleanup;
+
+    if (rv > 0) {
+        DEBUG("Looked %s up in the lease index", name);
+        goto done;
+    }
+
     if (virDirOpenQuiet(&dir, leaseDir) < 0) {
         ERROR("Failed to open dir '%s'", leaseDir);
         goto cleanup;
@@ -336,6 +392,7 @@ findLease(const char *name,
 
 #endif /* defined(LIBVIRT_NSS_GUEST) */
 
+ done:
     *address = tmpAddress;
     *naddress = ntmpAddress;
     tmpAddress = NULL;
@@ -36,7 +36,10 @@
 #include "conf/virdomainobjlist.h"
 #include "intprops.h"
 #include "viralloc.h"
+#include "viratomic.h"
+#include "virjson.h"
 #include "virmacaddr.h"
+#include "virthread.h"
 #include "virxml.h"
 #include "virstring.h"
 
@@ -1772,9 +1775,173 @@ static const vshCmdOptDef opts_list[] = {
      .type = VSH_OT_BOOL,
      .help = N_("show domain title")
     },
+    {.name = "json",
+     .type = VSH_OT_BOOL,
+     .help = N_("list domains as a JSON array")
+    },
+    {.name = "parallel",
+     .type = VSH_OT_INT,
+     .help = N_("number of domains to query concurrently")
+    },
     {.name = NULL}
 };
 
+/* Per domain data needed by the table and JSON outputs of 'list' */
+typedef struct _virshListEntry virshListEntry;
+typedef virshListEntry *virshListEntryPtr;
+struct _virshListEntry {
+    virDomainPtr dom;
+    int state; /* -1 if the domain is gone, -2 if it has a managed save */
+    char *title;
+    bool failed;
+};
+
+typedef struct _virshListQuery virshListQuery;
+typedef virshListQuery *virshListQueryPtr;
+struct _virshListQuery {
+    vshControl *ctl;
+    virshListEntryPtr entries;
+    size_t nentries;
+    bool managed;
+    bool title;
+    int next; /* index of the next entry to query, accessed via virAtomic */
+};
+
+static void
+virshListQueryEntry(virshListQueryPtr query,
+                    virshListEntryPtr entry)
+{
+    entry->state = virshDomainState(query->ctl, entry->dom, NULL);
+
+    /* Domain could've been removed in the meantime */
+    if (entry->state < 0)
+        return;
+
+    if (query->managed && entry->state == VIR_DOMAIN_SHUTOFF &&
+        virDomainHasManagedSaveImage(entry->dom, 0) > 0)
+        entry->state = -2;
+
+    if (query->title &&
+        !(entry->title = virshGetDomainDescription(query->ctl, entry->dom,
+                                                   true, 0)))
+        entry->failed = true;
+}
+
+static void
+virshListQueryWorker(void *opaque)
+{
+    virshListQueryPtr query = opaque;
+    int i;
+
+    while ((i = virAtomicIntInc(&query->next) - 1) < (int) query->nentries)
+        virshListQueryEntry(query, &query->entries[i]);
+}
+
+/*
+ * Fetch the state, and title if requested, of every domain in @query.
+ * Up to @nworkers domains are queried at the same time, each by its own
+ * thread sharing the connection, which lets a remote daemon process the
+ * calls concurrently instead of paying one round trip after another.
+ */
+static void
+virshListQueryRun(virshListQueryPtr query,
+                  unsigned int nworkers)
+{
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (nworkers > query->nentries)
+        nworkers = query->nentries;
+
+    if (nworkers > 1 && VIR_ALLOC_N_QUIET(threads, nworkers - 1) == 0) {
+        for (i = 0; i < nworkers - 1; i++) {
+            if (virThreadCreate(&threads[i], true,
+                                virshListQueryWorker, query) < 0)
+                break;
+            nthreads++;
+        }
+    }
+
+    /* This thread takes part as well and finishes the work alone if no
+     * thread could be created */
+    virshListQueryWorker(query);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    VIR_FREE(threads);
+}
+
+static const char *
+virshListEntryStateToString(virshListEntryPtr entry,
+                            bool translate)
+{
+    const char *str;
+
+    if (entry->state == -2)
+        return translate ? _("saved") : "saved";
+    if (translate)
+        return virshDomainStateToString(entry->state);
+    if (!(str = virshDomainStateTypeToString(entry->state)))
+        str = "no state";
+    return str;
+}
+
+static bool
+virshListPrintJSON(vshControl *ctl,
+                   virshListEntryPtr entries,
+                   size_t nentries,
+                   bool title)
+{
+    bool ret = false;
+    virJSONValuePtr array = NULL;
+    virJSONValuePtr obj = NULL;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char *str = NULL;
+    size_t i;
+
+    if (!(array = virJSONValueNewArray()))
+        goto cleanup;
+
+    for (i = 0; i < nentries; i++) {
+        virshListEntryPtr entry = &entries[i];
+        unsigned int id = virDomainGetID(entry->dom);
+
+        /* Domain could've been removed in the meantime */
+        if (entry->state == -1)
+            continue;
+
+        if (virDomainGetUUIDString(entry->dom, uuid) < 0 ||
+            !(obj = virJSONValueNewObject()) ||
+            (id != (unsigned int) -1 &&
+             virJSONValueObjectAppendNumberUint(obj, "id", id) < 0) ||
+            virJSONValueObjectAppendString(obj, "name",
+                                           virDomainGetName(entry->dom)) < 0 ||
+            virJSONValueObjectAppendString(obj, "uuid", uuid) < 0 ||
+            virJSONValueObjectAppendString(obj, "state",
+                                           virshListEntryStateToString(entry, false)) < 0 ||
+            (title &&
+             virJSONValueObjectAppendString(obj, "title", entry->title) < 0) ||
+            virJSONValueArrayAppend(array, obj) < 0)
+            goto cleanup;
+        obj = NULL;
+    }
+
+    if (!(str = virJSONValueToString(array, false)))
+        goto cleanup;
+
+    vshPrint(ctl, "%s\n", str);
+    ret = true;
+
+ cleanup:
+    if (!ret)
+        vshError(ctl, "%s", _("Failed to format domain list as JSON"));
+    VIR_FREE(str);
+    virJSONValueFree(obj);
+    virJSONValueFree(array);
+    return ret;
+}
+
 #define FILTER(NAME, FLAG) \
     if (vshCommandOptBool(cmd, NAME)) \
         flags |= (FLAG)
@@ -1786,17 +1953,21 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
     bool optTable = vshCommandOptBool(cmd, "table");
     bool optUUID = vshCommandOptBool(cmd, "uuid");
     bool optName = vshCommandOptBool(cmd, "name");
+    bool optJSON = vshCommandOptBool(cmd, "json");
+    unsigned int parallel = 1;
     size_t i;
-    char *title;
     char uuid[VIR_UUID_STRING_BUFLEN];
-    int state;
     bool ret = false;
     virshDomainListPtr list = NULL;
+    virshListQuery query;
+    virshListEntryPtr entry;
     virDomainPtr dom;
     char id_buf[INT_BUFSIZE_BOUND(unsigned int)];
     unsigned int id;
     unsigned int flags = VIR_CONNECT_LIST_DOMAINS_ACTIVE;
 
+    memset(&query, 0, sizeof(query));
+
     /* construct filter flags */
     if (vshCommandOptBool(cmd, "inactive") ||
         vshCommandOptBool(cmd, "state-shutoff"))
@@ -1825,13 +1996,50 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
 
     VSH_EXCLUSIVE_OPTIONS("table", "name");
     VSH_EXCLUSIVE_OPTIONS("table", "uuid");
+    VSH_EXCLUSIVE_OPTIONS("json", "table");
+    VSH_EXCLUSIVE_OPTIONS("json", "name");
+    VSH_EXCLUSIVE_OPTIONS("json", "uuid");
 
-    if (!optUUID && !optName)
+    if (vshCommandOptUInt(ctl, cmd, "parallel", &parallel) < 0)
+        return false;
+
+    if (parallel == 0) {
+        vshError(ctl, "%s", _("number of domains to query concurrently "
+                              "must be greater than zero"));
+        return false;
+    }
+
+    if (!optUUID && !optName && !optJSON)
         optTable = true;
 
     if (!(list = virshDomainListCollect(ctl, flags)))
         goto cleanup;
 
+    /* the table and JSON outputs need further calls for each domain */
+    if (optTable || optJSON) {
+        if (VIR_ALLOC_N(query.entries, list->ndomains) < 0)
+            goto cleanup;
+
+        query.ctl = ctl;
+        query.nentries = list->ndomains;
+        query.managed = managed;
+        query.title = optTitle;
+        for (i = 0; i < list->ndomains; i++)
+            query.entries[i].dom = list->domains[i];
+
+        virshListQueryRun(&query, parallel);
+
+        for (i = 0; i < query.nentries; i++) {
+            if (query.entries[i].failed)
+                goto cleanup;
+        }
+    }
+
+    if (optJSON) {
+        ret = virshListPrintJSON(ctl, query.entries, query.nentries, optTitle);
+        goto cleanup;
+    }
+
     /* print table header in legacy mode */
     if (optTable) {
         if (optTitle)
@@ -1855,32 +2063,21 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
             ignore_value(virStrcpyStatic(id_buf, "-"));
 
         if (optTable) {
-            state = virshDomainState(ctl, dom, NULL);
+            entry = &query.entries[i];
 
             /* Domain could've been removed in the meantime */
-            if (state < 0)
+            if (entry->state == -1)
                 continue;
 
-            if (managed && state == VIR_DOMAIN_SHUTOFF &&
-                virDomainHasManagedSaveImage(dom, 0) > 0)
-                state = -2;
-
             if (optTitle) {
-                if (!(title = virshGetDomainDescription(ctl, dom, true, 0)))
-                    goto cleanup;
-
                 vshPrint(ctl, " %-5s %-30s %-10s %-20s\n", id_buf,
                          virDomainGetName(dom),
-                         state == -2 ? _("saved")
-                         : virshDomainStateToString(state),
-                         title);
-
-                VIR_FREE(title);
+                         virshListEntryStateToString(entry, true),
+                         entry->title);
             } else {
                 vshPrint(ctl, " %-5s %-30s %s\n", id_buf,
                          virDomainGetName(dom),
-                         state == -2 ? _("saved")
-                         : virshDomainStateToString(state));
+                         virshListEntryStateToString(entry, true));
             }
         } else if (optUUID && optName) {
             if (virDomainGetUUIDString(dom, uuid) < 0) {
@@ -1901,6 +2098,9 @@ cmdList(vshControl *ctl, const vshCmd *cmd)
 
     ret = true;
  cleanup:
+    for (i = 0; i < query.nentries; i++)
+        VIR_FREE(query.entries[i].title);
+    VIR_FREE(query.entries);
     virshDomainListFree(list);
     return ret;
 }
@@ -1948,6 +2148,18 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("report domain perf event statistics"),
     },
+    {.name = "start",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain startup timing"),
+    },
+    {.name = "guest",
+     .type = VSH_OT_BOOL,
+     .help = N_("report information from the guest agent"),
+    },
+    {.name = "dirtyrate",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain dirty rate information"),
+    },
     {.name = "list-active",
      .type = VSH_OT_BOOL,
      .help = N_("list only active domains"),
@@ -1984,6 +2196,10 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("do not pretty-print the fields"),
     },
+    {.name = "json",
+     .type = VSH_OT_BOOL,
+     .help = N_("print the statistics as a JSON array"),
+    },
     {.name = "enforce",
      .type = VSH_OT_BOOL,
      .help = N_("enforce requested stats parameters"),
@@ -2025,6 +2241,108 @@ virshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
     return true;
 }
 
+/* Stats become an object keyed by field name, with values of their
+ * native type rather than formatted as strings */
+static virJSONValuePtr
+virshDomainStatsRecordToJSON(virDomainStatsRecordPtr record)
+{
+    virJSONValuePtr obj = NULL;
+    virJSONValuePtr stats = NULL;
+    size_t i;
+
+    if (!(obj = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(obj, "name",
+                                       virDomainGetName(record->dom)) < 0 ||
+        !(stats = virJSONValueNewObject()))
+        goto error;
+
+    for (i = 0; i < record->nparams; i++) {
+        virTypedParameterPtr param = record->params + i;
+        int rc = -1;
+
+        switch ((virTypedParameterType) param->type) {
+        case VIR_TYPED_PARAM_INT:
+            rc = virJSONValueObjectAppendNumberInt(stats, param->field,
+                                                   param->value.i);
+            break;
+        case VIR_TYPED_PARAM_UINT:
+            rc = virJSONValueObjectAppendNumberUint(stats, param->field,
+                                                    param->value.ui);
+            break;
+        case VIR_TYPED_PARAM_LLONG:
+            rc = virJSONValueObjectAppendNumberLong(stats, param->field,
+                                                    param->value.l);
+            break;
+        case VIR_TYPED_PARAM_ULLONG:
+            rc = virJSONValueObjectAppendNumberUlong(stats, param->field,
+                                                     param->value.ul);
+            break;
+        case VIR_TYPED_PARAM_DOUBLE:
+            rc = virJSONValueObjectAppendNumberDouble(stats, param->field,
+                                                      param->value.d);
+            break;
+        case VIR_TYPED_PARAM_BOOLEAN:
+            rc = virJSONValueObjectAppendBoolean(stats, param->field,
+                                                 param->value.b);
+            break;
+        case VIR_TYPED_PARAM_STRING:
+            rc = virJSONValueObjectAppendString(stats, param->field,
+                                                param->value.s);
+            break;
+        case VIR_TYPED_PARAM_LAST:
+            break;
+        }
+
+        if (rc < 0)
+            goto error;
+    }
+
+    if (virJSONValueObjectAppend(obj, "stats", stats) < 0)
+        goto error;
+
+    return obj;
+
+ error:
+    virJSONValueFree(stats);
+    virJSONValueFree(obj);
+    return NULL;
+}
+
+static bool
+virshDomainStatsPrintJSON(vshControl *ctl,
+                          virDomainStatsRecordPtr *records)
+{
+    virJSONValuePtr array = NULL;
+    virJSONValuePtr obj = NULL;
+    virDomainStatsRecordPtr *next;
+    char *str = NULL;
+    bool ret = false;
+
+    if (!(array = virJSONValueNewArray()))
+        goto cleanup;
+
+    for (next = records; *next; next++) {
+        if (!(obj = virshDomainStatsRecordToJSON(*next)) ||
+            virJSONValueArrayAppend(array, obj) < 0)
+            goto cleanup;
+        obj = NULL;
+    }
+
+    if (!(str = virJSONValueToString(array, false)))
+        goto cleanup;
+
+    vshPrint(ctl, "%s\n", str);
+    ret = true;
+
+ cleanup:
+    if (!ret)
+        vshError(ctl, "%s", _("Failed to format domain statistics as JSON"));
+    VIR_FREE(str);
+    virJSONValueFree(obj);
+    virJSONValueFree(array);
+    return ret;
+}
+
 static bool
 cmdDomstats(vshControl *ctl, const vshCmd *cmd)
 {
@@ -2035,11 +2353,14 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     virDomainStatsRecordPtr *records = NULL;
     virDomainStatsRecordPtr *next;
     bool raw = vshCommandOptBool(cmd, "raw");
+    bool json = vshCommandOptBool(cmd, "json");
     int flags = 0;
     const vshCmdOpt *opt = NULL;
     bool ret = false;
     virshControlPtr priv = ctl->privData;
 
+    VSH_EXCLUSIVE_OPTIONS_VAR(json, raw);
+
     if (vshCommandOptBool(cmd, "state"))
         stats |= VIR_DOMAIN_STATS_STATE;
 
@@ -2061,6 +2382,15 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "perf"))
         stats |= VIR_DOMAIN_STATS_PERF;
 
+    if (vshCommandOptBool(cmd, "start"))
+        stats |= VIR_DOMAIN_STATS_START;
+
+    if (vshCommandOptBool(cmd, "guest"))
+        stats |= VIR_DOMAIN_STATS_GUEST;
+
+    if (vshCommandOptBool(cmd, "dirtyrate"))
+        stats |= VIR_DOMAIN_STATS_DIRTYRATE;
+
     if (vshCommandOptBool(cmd, "list-active"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
 
@@ -2119,6 +2449,11 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
            goto cleanup;
     }
 
+    if (json) {
+        ret = virshDomainStatsPrintJSON(ctl, records);
+        goto cleanup;
+    }
+
     next = records;
     while (*next) {
         if (!virshDomainStatsPrintRecord(ctl, *next, raw))
@@ -2470,7 +2470,8 @@ VIR_ENUM_IMPL(virshDomainBlockJob,
               N_("Block Pull"),
               N_("Block Copy"),
               N_("Block Commit"),
-              N_("Active Block Commit"))
+              N_("Active Block Commit"),
+              N_("Block Backup"))
 
 static const char *
 virshDomainBlockJobToString(int type)
@@ -2801,6 +2802,165 @@ cmdBlockPull(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/*
+ * "blockbackup" command
+ */
+static const vshCmdInfo info_block_backup[] = {
+    {.name = "help",
+     .data = N_("Start a block backup operation.")
+    },
+    {.name = "desc",
+     .data = N_("Copy a point-in-time view of a disk to dest.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_block_backup[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "path",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("fully-qualified path of source disk")
+    },
+    {.name = "dest",
+     .type = VSH_OT_STRING,
+     .help = N_("path of the backup to create")
+    },
+    {.name = "xml",
+     .type = VSH_OT_STRING,
+     .help = N_("filename containing XML description of the backup destination")
+    },
+    {.name = "format",
+     .type = VSH_OT_STRING,
+     .help = N_("format of the destination file")
+    },
+    {.name = "bitmap",
+     .type = VSH_OT_STRING,
+     .help = N_("name of the dirty bitmap to create or back up from")
+    },
+    {.name = "incremental",
+     .type = VSH_OT_BOOL,
+     .help = N_("copy only the data recorded in the dirty bitmap")
+    },
+    {.name = "reuse-external",
+     .type = VSH_OT_BOOL,
+     .help = N_("reuse existing destination")
+    },
+    {.name = "bandwidth",
+     .type = VSH_OT_INT,
+     .help = N_("bandwidth limit in MiB/s")
+    },
+    {.name = "bytes",
+     .type = VSH_OT_BOOL,
+     .help = N_("the bandwidth limit is in bytes/s rather than MiB/s")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdBlockBackup(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    const char *path = NULL;
+    const char *dest = NULL;
+    const char *xml = NULL;
+    const char *format = NULL;
+    const char *bitmap = NULL;
+    unsigned long bandwidth = 0;
+    unsigned long long speed;
+    bool bytes = vshCommandOptBool(cmd, "bytes");
+    unsigned int flags = 0;
+    char *xmlstr = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int maxparams = 0;
+    bool ret = false;
+
+    if (vshCommandOptStringReq(ctl, cmd, "path", &path) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "dest", &dest) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "xml", &xml) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "format", &format) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "bitmap", &bitmap) < 0)
+        return false;
+    if (vshBlockJobOptionBandwidth(ctl, cmd, bytes, &bandwidth) < 0)
+        return false;
+
+    if (vshCommandOptBool(cmd, "incremental"))
+        flags |= VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL;
+    if (vshCommandOptBool(cmd, "reuse-external"))
+        flags |= VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT;
+
+    VSH_EXCLUSIVE_OPTIONS_VAR(dest, xml);
+    VSH_EXCLUSIVE_OPTIONS_VAR(format, xml);
+    VSH_REQUIRE_OPTION("incremental", "bitmap");
+
+    if (!dest && !xml) {
+        vshError(ctl, "%s", _("need either --dest or --xml"));
+        return false;
+    }
+
+    if (bandwidth) {
+        speed = bandwidth;
+        if (!bytes) {
+            /* bandwidth is ulong MiB/s, but the typed parameter is
+             * ullong bytes/s; make sure we don't overflow */
+            unsigned long long limit = MIN(ULONG_MAX, ULLONG_MAX >> 20);
+            if (speed > limit) {
+                vshError(ctl, _("bandwidth must be less than %llu"), limit);
+                return false;
+            }
+
+            speed <<= 20ULL;
+        }
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                                    speed) < 0)
+            goto save_error;
+    }
+
+    if (bitmap &&
+        virTypedParamsAddString(&params, &nparams, &maxparams,
+                                VIR_DOMAIN_BLOCK_BACKUP_BITMAP, bitmap) < 0)
+        goto save_error;
+
+    if (xml) {
+        if (virFileReadAll(xml, VSH_MAX_XML_FILE, &xmlstr) < 0) {
+            vshReportError(ctl);
+            goto cleanup;
+        }
+    } else {
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        virBufferAddLit(&buf, "<disk type='file'>\n");
+        virBufferAdjustIndent(&buf, 2);
+        virBufferEscapeString(&buf, "<source file='%s'/>\n", dest);
+        virBufferEscapeString(&buf, "<driver type='%s'/>\n", format);
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</disk>\n");
+        if (virBufferCheckError(&buf) < 0)
+            goto cleanup;
+        xmlstr = virBufferContentAndReset(&buf);
+    }
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        goto cleanup;
+
+    if (virDomainBlockBackup(dom, path, xmlstr, params, nparams, flags) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, "%s", _("Block Backup started"));
+    ret = true;
+
+ cleanup:
+    VIR_FREE(xmlstr);
+    virTypedParamsFree(params, nparams);
+    virshDomainFree(dom);
+    return ret;
+
+ save_error:
+    vshSaveLibvirtError();
+    goto cleanup;
+}
+
 /*
  * "blockresize" command
  */
@@ -10031,6 +10191,10 @@ static const vshCmdOptDef opts_dumpxml[] = {
      .type = VSH_OT_BOOL,
      .help = N_("provide XML suitable for migrations")
     },
+    {.name = "subtree",
+     .type = VSH_OT_STRING,
+     .help = N_("dump only the given part of the XML, e.g. devices/disk")
+    },
     {.name = NULL}
 };
 
@@ -10045,6 +10209,13 @@ cmdDumpXML(vshControl *ctl, const vshCmd *cmd)
     bool secure = vshCommandOptBool(cmd, "security-info");
     bool update = vshCommandOptBool(cmd, "update-cpu");
     bool migratable = vshCommandOptBool(cmd, "migratable");
+    const char *subtree = NULL;
+
+    VSH_EXCLUSIVE_OPTIONS("subtree", "update-cpu");
+    VSH_EXCLUSIVE_OPTIONS("subtree", "migratable");
+
+    if (vshCommandOptStringReq(ctl, cmd, "subtree", &subtree) < 0)
+        return false;
 
     if (inactive)
         flags |= VIR_DOMAIN_XML_INACTIVE;
@@ -10058,7 +10229,10 @@ cmdDumpXML(vshControl *ctl, const vshCmd *cmd)
     if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
         return false;
 
-    dump = virDomainGetXMLDesc(dom, flags);
+    if (subtree)
+        dump = virDomainGetXMLDescSubtree(dom, subtree, flags);
+    else
+        dump = virDomainGetXMLDesc(dom, flags);
     if (dump != NULL) {
         vshPrint(ctl, "%s", dump);
         VIR_FREE(dump);
@@ -10536,6 +10710,22 @@ static const vshCmdOptDef opts_migrate[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use TLS for migration")
     },
+    {.name = "parallel",
+     .type = VSH_OT_BOOL,
+     .help = N_("enable parallel migration")
+    },
+    {.name = "parallel-connections",
+     .type = VSH_OT_INT,
+     .help = N_("number of connections for parallel migration")
+    },
+    {.name = "converge-time",
+     .type = VSH_OT_INT,
+     .help = N_("total time (in ms) the migration should take")
+    },
+    {.name = "converge-max-downtime",
+     .type = VSH_OT_INT,
+     .help = N_("maximum downtime (in ms) allowed while trying to converge")
+    },
     {.name = NULL}
 };
 
@@ -10732,6 +10922,34 @@ doMigrate(void *opaque)
             goto save_error;
     }
 
+    if ((rv = vshCommandOptInt(ctl, cmd, "parallel-connections", &intOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                 intOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "converge-time", &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_CONVERGENCE_TIME,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "converge-max-downtime",
+                                     &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_CONVERGENCE_MAX_DOWNTIME,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
     if (vshCommandOptBool(cmd, "live"))
         flags |= VIR_MIGRATE_LIVE;
     if (vshCommandOptBool(cmd, "p2p"))
@@ -10780,6 +10998,9 @@ doMigrate(void *opaque)
     if (vshCommandOptBool(cmd, "tls"))
         flags |= VIR_MIGRATE_TLS;
 
+    if (vshCommandOptBool(cmd, "parallel"))
+        flags |= VIR_MIGRATE_PARALLEL;
+
     if (flags & VIR_MIGRATE_PEER2PEER || vshCommandOptBool(cmd, "direct")) {
         if (virDomainMigrateToURI3(dom, desturi, params, nparams, flags) == 0)
             ret = '0';
@@ -11237,6 +11458,57 @@ cmdMigratePostCopy(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/*
+ * "domdirtyrate-calc" command
+ */
+static const vshCmdInfo info_domdirtyrate_calc[] = {
+    {.name = "help",
+     .data = N_("Calculate a vm's memory dirty rate")
+    },
+    {.name = "desc",
+     .data = N_("Calculate memory dirty rate of a domain in order to "
+                "decide whether it's proper to be migrated out or not.\n"
+                "The calculated dirty rate information is available by "
+                "calling 'domstats --dirtyrate'.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_domdirtyrate_calc[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "seconds",
+     .type = VSH_OT_INT,
+     .help = N_("calculate memory dirty rate within specified seconds, "
+                "the supported value range from 1 to 60, default to 1.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDomDirtyRateCalc(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    int seconds = 1; /* the default value is 1 */
+    bool ret = false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (vshCommandOptInt(ctl, cmd, "seconds", &seconds) < 0)
+        goto cleanup;
+
+    if (virDomainStartDirtyRateCalc(dom, seconds, 0) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, _("Start to calculate domain's memory "
+                         "dirty rate successfully.\n"));
+    ret = true;
+
+ cleanup:
+    virshDomainFree(dom);
+    return ret;
+}
+
 /*
  * "domdisplay" command
  */
@@ -13881,6 +14153,12 @@ const vshCmdDef domManagementCmds[] = {
      .info = info_blkiotune,
      .flags = 0
     },
+    {.name = "blockbackup",
+     .handler = cmdBlockBackup,
+     .opts = opts_block_backup,
+     .info = info_block_backup,
+     .flags = 0
+    },
     {.name = "blockcommit",
      .handler = cmdBlockCommit,
      .opts = opts_block_commit,
@@ -13985,6 +14263,12 @@ const vshCmdDef domManagementCmds[] = {
      .info = info_detach_interface,
      .flags = 0
     },
+    {.name = "domdirtyrate-calc",
+     .handler = cmdDomDirtyRateCalc,
+     .opts = opts_domdirtyrate_calc,
+     .info = info_domdirtyrate_calc,
+     .flags = 0
+    },
     {.name = "domdisplay",
      .handler = cmdDomDisplay,
      .opts = opts_domdisplay,
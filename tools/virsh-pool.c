@@ -25,6 +25,7 @@
 
 #include <config.h>
 #include "virsh-pool.h"
+#include "virsh-volume.h"
 
 #include "internal.h"
 #include "virbuffer.h"
@@ -706,6 +707,10 @@ static const vshCmdInfo info_pool_refresh[] = {
 
 static const vshCmdOptDef opts_pool_refresh[] = {
     VIRSH_COMMON_OPT_POOL_FULL,
+    {.name = "incremental",
+     .type = VSH_OT_BOOL,
+     .help = N_("only probe volumes whose files changed since the last refresh")
+    },
 
     {.name = NULL}
 };
@@ -716,11 +721,15 @@ cmdPoolRefresh(vshControl *ctl, const vshCmd *cmd)
     virStoragePoolPtr pool;
     bool ret = true;
     const char *name;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "incremental"))
+        flags |= VIR_STORAGE_POOL_REFRESH_INCREMENTAL;
 
     if (!(pool = virshCommandOptPool(ctl, cmd, "pool", &name)))
         return false;
 
-    if (virStoragePoolRefresh(pool, 0) == 0) {
+    if (virStoragePoolRefresh(pool, flags) == 0) {
         vshPrintExtra(ctl, _("Pool %s refreshed\n"), name);
     } else {
         vshError(ctl, _("Failed to refresh pool %s"), name);
@@ -1973,6 +1982,19 @@ virshPoolEventToString(int event)
     return str ? _(str) : _("unknown");
 }
 
+VIR_ENUM_DECL(virshPoolEventVolumeJobStatus)
+VIR_ENUM_IMPL(virshPoolEventVolumeJobStatus,
+              VIR_STORAGE_POOL_EVENT_VOLUME_JOB_LAST,
+              N_("completed"),
+              N_("failed"))
+
+static const char *
+virshPoolEventVolumeJobStatusToString(int status)
+{
+    const char *str = virshPoolEventVolumeJobStatusTypeToString(status);
+    return str ? _(str) : _("unknown");
+}
+
 struct vshEventCallback {
     const char *name;
     virConnectStoragePoolEventGenericCallback cb;
@@ -2053,10 +2075,52 @@ vshEventGenericPrint(virConnectPtr conn ATTRIBUTE_UNUSED,
         vshEventDone(data->ctl);
 }
 
+static void
+vshEventVolumeJobPrint(virConnectPtr conn ATTRIBUTE_UNUSED,
+                       virStoragePoolPtr pool,
+                       const char *volume,
+                       int type,
+                       int status,
+                       void *opaque)
+{
+    virshPoolEventData *data = opaque;
+
+    if (!data->loop && data->count)
+        return;
+
+    if (data->timestamp) {
+        char timestamp[VIR_TIME_STRING_BUFLEN];
+
+        if (virTimeStringNowRaw(timestamp) < 0)
+            timestamp[0] = '\0';
+
+        vshPrint(data->ctl, _("%s: event 'volume-job' for storage pool %s: "
+                              "volume %s %s %s\n"),
+                 timestamp,
+                 virStoragePoolGetName(pool),
+                 volume,
+                 virshVolumeJobTypeToString(type),
+                 virshPoolEventVolumeJobStatusToString(status));
+    } else {
+        vshPrint(data->ctl, _("event 'volume-job' for storage pool %s: "
+                              "volume %s %s %s\n"),
+                 virStoragePoolGetName(pool),
+                 volume,
+                 virshVolumeJobTypeToString(type),
+                 virshPoolEventVolumeJobStatusToString(status));
+    }
+
+    data->count++;
+    if (!data->loop)
+        vshEventDone(data->ctl);
+}
+
 static vshEventCallback vshEventCallbacks[] = {
     { "lifecycle",
       VIR_STORAGE_POOL_EVENT_CALLBACK(vshEventLifecyclePrint), },
-    { "refresh", vshEventGenericPrint, }
+    { "refresh", vshEventGenericPrint, },
+    { "volume-job",
+      VIR_STORAGE_POOL_EVENT_CALLBACK(vshEventVolumeJobPrint), },
 };
 verify(VIR_STORAGE_POOL_EVENT_ID_LAST == ARRAY_CARDINALITY(vshEventCallbacks));
 
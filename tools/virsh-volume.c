@@ -455,6 +455,10 @@ static const vshCmdOptDef opts_vol_create_from[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use btrfs COW lightweight copy")
     },
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the volume is defined, copy data in the background")
+    },
     {.name = NULL}
 };
 
@@ -477,6 +481,9 @@ cmdVolCreateFrom(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "reflink"))
         flags |= VIR_STORAGE_VOL_CREATE_REFLINK;
 
+    if (vshCommandOptBool(cmd, "async"))
+        flags |= VIR_STORAGE_VOL_CREATE_ASYNC;
+
     if (vshCommandOptStringReq(ctl, cmd, "file", &from) < 0)
         goto cleanup;
 
@@ -491,8 +498,14 @@ cmdVolCreateFrom(vshControl *ctl, const vshCmd *cmd)
     newvol = virStorageVolCreateXMLFrom(pool, buffer, inputvol, flags);
 
     if (newvol != NULL) {
-        vshPrintExtra(ctl, _("Vol %s created from input vol %s\n"),
-                      virStorageVolGetName(newvol), virStorageVolGetName(inputvol));
+        if (flags & VIR_STORAGE_VOL_CREATE_ASYNC)
+            vshPrintExtra(ctl, _("Vol %s is being created from input vol %s\n"),
+                          virStorageVolGetName(newvol),
+                          virStorageVolGetName(inputvol));
+        else
+            vshPrintExtra(ctl, _("Vol %s created from input vol %s\n"),
+                          virStorageVolGetName(newvol),
+                          virStorageVolGetName(inputvol));
     } else {
         vshError(ctl, _("Failed to create vol from %s"), from);
         goto cleanup;
@@ -568,6 +581,10 @@ static const vshCmdOptDef opts_vol_clone[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use btrfs COW lightweight copy")
     },
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the volume is defined, copy data in the background")
+    },
     {.name = NULL}
 };
 
@@ -591,6 +608,9 @@ cmdVolClone(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "reflink"))
         flags |= VIR_STORAGE_VOL_CREATE_REFLINK;
 
+    if (vshCommandOptBool(cmd, "async"))
+        flags |= VIR_STORAGE_VOL_CREATE_ASYNC;
+
     origpool = virStoragePoolLookupByVolume(origvol);
     if (!origpool) {
         vshError(ctl, "%s", _("failed to get parent pool"));
@@ -613,8 +633,14 @@ cmdVolClone(vshControl *ctl, const vshCmd *cmd)
     newvol = virStorageVolCreateXMLFrom(origpool, (char *) newxml, origvol, flags);
 
     if (newvol != NULL) {
-        vshPrintExtra(ctl, _("Vol %s cloned from %s\n"),
-                      virStorageVolGetName(newvol), virStorageVolGetName(origvol));
+        if (flags & VIR_STORAGE_VOL_CREATE_ASYNC)
+            vshPrintExtra(ctl, _("Vol %s is being cloned from %s\n"),
+                          virStorageVolGetName(newvol),
+                          virStorageVolGetName(origvol));
+        else
+            vshPrintExtra(ctl, _("Vol %s cloned from %s\n"),
+                          virStorageVolGetName(newvol),
+                          virStorageVolGetName(origvol));
     } else {
         vshError(ctl, _("Failed to clone vol from %s"),
                  virStorageVolGetName(origvol));
@@ -664,6 +690,10 @@ static const vshCmdOptDef opts_vol_upload[] = {
      .type = VSH_OT_BOOL,
      .help = N_("preserve sparseness of volume")
     },
+    {.name = "nocache",
+     .type = VSH_OT_BOOL,
+     .help = N_("don't keep the volume data in the host page cache")
+    },
     {.name = NULL}
 };
 
@@ -704,6 +734,9 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "sparse"))
         flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
 
+    if (vshCommandOptBool(cmd, "nocache"))
+        flags |= VIR_STORAGE_VOL_UPLOAD_NOCACHE;
+
     if (!(st = virStreamNew(priv->conn, 0))) {
         vshError(ctl, _("cannot create a new stream"));
         goto cleanup;
@@ -779,6 +812,10 @@ static const vshCmdOptDef opts_vol_download[] = {
      .type = VSH_OT_BOOL,
      .help = N_("preserve sparseness of volume")
     },
+    {.name = "nocache",
+     .type = VSH_OT_BOOL,
+     .help = N_("don't keep the volume data in the host page cache")
+    },
     {.name = NULL}
 };
 
@@ -811,6 +848,9 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "sparse"))
         flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
 
+    if (vshCommandOptBool(cmd, "nocache"))
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_NOCACHE;
+
     if ((fd = open(file, O_WRONLY|O_CREAT|O_EXCL, 0666)) < 0) {
         if (errno != EEXIST ||
             (fd = open(file, O_WRONLY|O_TRUNC, 0666)) < 0) {
@@ -930,6 +970,10 @@ static const vshCmdOptDef opts_vol_wipe[] = {
      .type = VSH_OT_STRING,
      .help = N_("perform selected wiping algorithm")
     },
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the wipe is started, finish it in the background")
+    },
     {.name = NULL}
 };
 
@@ -947,10 +991,14 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
     const char *algorithm_str = NULL;
     int algorithm = VIR_STORAGE_VOL_WIPE_ALG_ZERO;
     int funcRet;
+    unsigned int flags = 0;
 
     if (!(vol = virshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
         return false;
 
+    if (vshCommandOptBool(cmd, "async"))
+        flags |= VIR_STORAGE_VOL_WIPE_ASYNC;
+
     if (vshCommandOptStringReq(ctl, cmd, "algorithm", &algorithm_str) < 0)
         goto out;
 
@@ -960,10 +1008,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    if ((funcRet = virStorageVolWipePattern(vol, algorithm, 0)) < 0) {
+    if ((funcRet = virStorageVolWipePattern(vol, algorithm, flags)) < 0) {
         if (last_error->code == VIR_ERR_NO_SUPPORT &&
             algorithm == VIR_STORAGE_VOL_WIPE_ALG_ZERO)
-            funcRet = virStorageVolWipe(vol, 0);
+            funcRet = virStorageVolWipe(vol, flags);
     }
 
     if (funcRet < 0) {
@@ -971,7 +1019,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    vshPrintExtra(ctl, _("Vol %s wiped\n"), name);
+    if (flags & VIR_STORAGE_VOL_WIPE_ASYNC)
+        vshPrintExtra(ctl, _("Vol %s is being wiped\n"), name);
+    else
+        vshPrintExtra(ctl, _("Vol %s wiped\n"), name);
     ret = true;
  out:
     virStorageVolFree(vol);
@@ -997,6 +1048,21 @@ virshVolumeTypeToString(int type)
 }
 
 
+VIR_ENUM_DECL(virshStorageVolJob)
+VIR_ENUM_IMPL(virshStorageVolJob,
+              VIR_STORAGE_VOL_JOB_LAST,
+              N_("none"),
+              N_("build"),
+              N_("wipe"))
+
+const char *
+virshVolumeJobTypeToString(int type)
+{
+    const char *str = virshStorageVolJobTypeToString(type);
+    return str ? _(str) : _("unknown");
+}
+
+
 /*
  * "vol-info" command
  */
@@ -1081,6 +1147,21 @@ cmdVolInfo(vshControl *ctl, const vshCmd *cmd)
         ret = false;
     }
 
+    if (ret) {
+        virStorageVolJobInfo jobinfo;
+
+        /* Older servers don't know about volume jobs */
+        if (virStorageVolGetJobInfo(vol, &jobinfo, 0) < 0) {
+            vshResetLibvirtError();
+        } else if (jobinfo.type != VIR_STORAGE_VOL_JOB_NONE) {
+            vshPrint(ctl, "%-15s %s\n", _("Job:"),
+                     virshVolumeJobTypeToString(jobinfo.type));
+            if (jobinfo.total)
+                vshPrint(ctl, "%-15s %2.2lf %%\n", _("Progress:"),
+                         100.0 * jobinfo.processed / jobinfo.total);
+        }
+    }
+
     virStorageVolFree(vol);
     return ret;
 }
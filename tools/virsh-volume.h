@@ -38,6 +38,8 @@ virStorageVolPtr virshCommandOptVolBy(vshControl *ctl, const vshCmd *cmd,
     virshCommandOptVolBy(_ctl, _cmd, _optname, _pooloptname, _name, \
                          VIRSH_BYUUID | VIRSH_BYNAME)
 
+const char *virshVolumeJobTypeToString(int type);
+
 extern const vshCmdDef storageVolCmds[];
 
 #endif /* VIRSH_VOLUME_H */
@@ -457,8 +457,11 @@ cmdSrvThreadpoolInfo(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
-    for (i = 0; i < nparams; i++)
-        vshPrint(ctl, "%-15s: %u\n", params[i].field, params[i].value.ui);
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-15s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
 
     ret = true;
 
@@ -867,6 +870,151 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/* ---------------------------
+ * Command srv-procedure-stats
+ * ---------------------------
+ */
+
+static const vshCmdInfo info_srv_procedure_stats[] = {
+    {.name = "help",
+     .data = N_("get server's per procedure RPC call statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve the number of calls, errors and bytes transferred "
+                "for every RPC procedure called on a server, optionally "
+                "along with histograms of their queue and execution times.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_procedure_stats[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve procedure statistics from."),
+    },
+    {.name = "histograms",
+     .type = VSH_OT_BOOL,
+     .help = N_("print queue and execution time histograms"),
+    },
+    {.name = NULL}
+};
+
+static const char *vshAdmProcedureTimeBuckets[] = {
+    "10us", "100us", "1ms", "10ms", "100ms", "1s", "10s", "inf",
+};
+
+static int
+vshAdmPrintProcedureHistogram(vshControl *ctl,
+                              virTypedParameterPtr params,
+                              int nparams,
+                              unsigned int idx,
+                              const char *kind,
+                              const char *label)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long value;
+    size_t i;
+
+    vshPrint(ctl, "      %-10s", label);
+    for (i = 0; i < ARRAY_CARDINALITY(vshAdmProcedureTimeBuckets); i++) {
+        snprintf(field, sizeof(field),
+                 VIR_SERVER_PROCEDURE_STATS_PREFIX "%u.%s.%s",
+                 idx, kind, vshAdmProcedureTimeBuckets[i]);
+        if (virTypedParamsGetULLong(params, nparams, field, &value) <= 0)
+            return -1;
+        vshPrint(ctl, " <%s:%llu", vshAdmProcedureTimeBuckets[i], value);
+    }
+    vshPrint(ctl, "\n");
+
+    return 0;
+}
+
+static bool
+cmdSrvProcedureStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int count = 0;
+    unsigned int i;
+    const char *srvname = NULL;
+    bool histograms = vshCommandOptBool(cmd, "histograms");
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetProcedureStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get server procedure statistics"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_SERVER_PROCEDURE_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, " %-10s %-40s %-10s %-10s %-14s %-14s\n%s\n",
+                  _("Program"), _("Procedure"), _("Calls"), _("Errors"),
+                  _("Bytes in"), _("Bytes out"),
+                  "-------------------------------------------------"
+                  "-------------------------------------------------"
+                  "-------");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        unsigned int program = 0;
+        const char *name = NULL;
+        unsigned long long calls = 0;
+        unsigned long long errors = 0;
+        unsigned long long bytesIn = 0;
+        unsigned long long bytesOut = 0;
+
+#define GET_PARAM(type, suffix, value) \
+        do { \
+            snprintf(field, sizeof(field), \
+                     VIR_SERVER_PROCEDURE_STATS_PREFIX "%u." suffix, i); \
+            if (virTypedParamsGet ## type(params, nparams, field, value) <= 0) { \
+                vshError(ctl, _("Missing procedure statistics field '%s'"), \
+                         field); \
+                goto cleanup; \
+            } \
+        } while (0)
+
+        GET_PARAM(UInt, "program", &program);
+        GET_PARAM(String, "name", &name);
+        GET_PARAM(ULLong, "calls", &calls);
+        GET_PARAM(ULLong, "errors", &errors);
+        GET_PARAM(ULLong, "bytesIn", &bytesIn);
+        GET_PARAM(ULLong, "bytesOut", &bytesOut);
+
+#undef GET_PARAM
+
+        vshPrint(ctl, " 0x%-8x %-40s %-10llu %-10llu %-14llu %-14llu\n",
+                 program, name, calls, errors, bytesIn, bytesOut);
+
+        if (histograms &&
+            (vshAdmPrintProcedureHistogram(ctl, params, nparams, i,
+                                           "queueTime", _("queued")) < 0 ||
+             vshAdmPrintProcedureHistogram(ctl, params, nparams, i,
+                                           "execTime", _("executed")) < 0)) {
+            vshError(ctl, "%s", _("Unable to parse procedure histograms"));
+            goto cleanup;
+        }
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
 /* -----------------------
  * Command srv-clients-set
  * -----------------------
@@ -1079,6 +1227,219 @@ cmdDaemonLogOutputs(vshControl *ctl, const vshCmd *cmd)
     return true;
 }
 
+/* -----------------------
+ * Command daemon-log-dump
+ * -----------------------
+ */
+static const vshCmdInfo info_daemon_log_dump[] = {
+    {.name = "help",
+     .data = N_("fetch the messages kept by the log flight recorder of daemon")
+    },
+    {.name = "desc",
+     .data = N_("Prints the last messages logged by each thread of daemon, "
+                "regardless of the logging filters.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLogDump(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    char *messages = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetLoggingRecorder(priv->conn, &messages, 0) < 0) {
+        vshError(ctl, _("Unable to get daemon log flight recorder messages"));
+        return false;
+    }
+
+    vshPrint(ctl, "%s", messages);
+    VIR_FREE(messages);
+
+    return true;
+}
+
+/* --------------------------
+ * Command daemon-alloc-stats
+ * --------------------------
+ */
+static const vshCmdInfo info_daemon_alloc_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon's memory allocation statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve the number of allocations and of bytes allocated "
+                "by each subsystem of daemon since it started.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonAllocStats(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int count = 0;
+    unsigned int i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetAllocStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get daemon allocation statistics"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_CONNECT_ALLOC_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, " %-30s %-16s %-20s\n%s\n",
+                  _("Subsystem"), _("Allocations"), _("Bytes"),
+                  "-------------------------------------------------"
+                  "------------------");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *name = NULL;
+        unsigned long long allocs = 0;
+        unsigned long long bytes = 0;
+
+#define GET_PARAM(type, suffix, value) \
+        do { \
+            snprintf(field, sizeof(field), \
+                     VIR_CONNECT_ALLOC_STATS_PREFIX "%u." suffix, i); \
+            if (virTypedParamsGet ## type(params, nparams, field, value) <= 0) { \
+                vshError(ctl, _("Missing allocation statistics field '%s'"), \
+                         field); \
+                goto cleanup; \
+            } \
+        } while (0)
+
+        GET_PARAM(String, "name", &name);
+        GET_PARAM(ULLong, "allocs", &allocs);
+        GET_PARAM(ULLong, "bytes", &bytes);
+
+#undef GET_PARAM
+
+        vshPrint(ctl, " %-30s %-16llu %-20llu\n", name, allocs, bytes);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* -------------------------
+ * Command daemon-lock-stats
+ * -------------------------
+ */
+static const vshCmdInfo info_daemon_lock_stats[] = {
+    {.name = "help",
+     .data = N_("get daemon's lock contention statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve, for each class of objects, how many times "
+                "threads of daemon had to wait for the lock of an object "
+                "and for how long.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLockStats(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned int count = 0;
+    unsigned int ncallsites = 0;
+    unsigned int i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetLockStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to get daemon lock statistics"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_CONNECT_LOCK_STATS_COUNT, &count) < 0 ||
+        virTypedParamsGetUInt(params, nparams,
+                              VIR_CONNECT_LOCK_STATS_CALLSITE_COUNT,
+                              &ncallsites) < 0)
+        goto cleanup;
+
+#define GET_PARAM(type, prefix, suffix, value) \
+    do { \
+        snprintf(field, sizeof(field), prefix "%u." suffix, i); \
+        if (virTypedParamsGet ## type(params, nparams, field, value) <= 0) { \
+            vshError(ctl, _("Missing lock statistics field '%s'"), field); \
+            goto cleanup; \
+        } \
+    } while (0)
+
+    vshPrintExtra(ctl, " %-30s %-16s %-20s\n%s\n",
+                  _("Class"), _("Contended"), _("Wait (us)"),
+                  "-------------------------------------------------"
+                  "------------------");
+
+    for (i = 0; i < count; i++) {
+        const char *name = NULL;
+        unsigned long long contended = 0;
+        unsigned long long wait = 0;
+
+        GET_PARAM(String, VIR_CONNECT_LOCK_STATS_PREFIX, "class", &name);
+        GET_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_PREFIX,
+                  "contended", &contended);
+        GET_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_PREFIX, "wait", &wait);
+
+        vshPrint(ctl, " %-30s %-16llu %-20llu\n", name, contended, wait);
+    }
+
+    if (ncallsites) {
+        vshPrintExtra(ctl, "\n %-16s %-20s %s\n%s\n",
+                      _("Contended"), _("Wait (us)"), _("Location"),
+                      "-------------------------------------------------"
+                      "------------------");
+    }
+
+    for (i = 0; i < ncallsites; i++) {
+        const char *file = NULL;
+        const char *function = NULL;
+        unsigned int line = 0;
+        unsigned long long contended = 0;
+        unsigned long long wait = 0;
+
+        GET_PARAM(String, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "file", &file);
+        GET_PARAM(String, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "function", &function);
+        GET_PARAM(UInt, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "line", &line);
+        GET_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "contended", &contended);
+        GET_PARAM(ULLong, VIR_CONNECT_LOCK_STATS_CALLSITE_PREFIX,
+                  "wait", &wait);
+
+        if (*file)
+            vshPrint(ctl, " %-16llu %-20llu %s (%s:%u)\n",
+                     contended, wait, function, file, line);
+        else
+            vshPrint(ctl, " %-16llu %-20llu %s\n",
+                     contended, wait, _("other"));
+    }
+
+#undef GET_PARAM
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
 static void *
 vshAdmConnectionHandler(vshControl *ctl)
 {
@@ -1419,6 +1780,16 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "srv-procedure-stats",
+     .flags = VSH_CMD_FLAG_ALIAS,
+     .alias = "server-procedure-stats"
+    },
+    {.name = "server-procedure-stats",
+     .handler = cmdSrvProcedureStats,
+     .opts = opts_srv_procedure_stats,
+     .info = info_srv_procedure_stats,
+     .flags = 0
+    },
     {.name = NULL}
 };
 
@@ -1461,6 +1832,24 @@ static const vshCmdDef managementCmds[] = {
      .info = info_daemon_log_outputs,
      .flags = 0
     },
+    {.name = "daemon-log-dump",
+     .handler = cmdDaemonLogDump,
+     .opts = NULL,
+     .info = info_daemon_log_dump,
+     .flags = 0
+    },
+    {.name = "daemon-alloc-stats",
+     .handler = cmdDaemonAllocStats,
+     .opts = NULL,
+     .info = info_daemon_alloc_stats,
+     .flags = 0
+    },
+    {.name = "daemon-lock-stats",
+     .handler = cmdDaemonLockStats,
+     .opts = NULL,
+     .info = info_daemon_lock_stats,
+     .flags = 0
+    },
     {.name = NULL}
 };
 
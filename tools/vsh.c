@@ -238,6 +238,9 @@ vshStringToArray(const char *str,
 
 virErrorPtr last_error;
 
+/* Commands may issue calls from several threads at once */
+static virMutex last_error_lock = VIR_MUTEX_INITIALIZER;
+
 /*
  * Quieten libvirt until we're done with the command.
  */
@@ -245,8 +248,10 @@ void
 vshErrorHandler(void *opaque ATTRIBUTE_UNUSED,
                 virErrorPtr error ATTRIBUTE_UNUSED)
 {
+    virMutexLock(&last_error_lock);
     virFreeError(last_error);
     last_error = virSaveLastError();
+    virMutexUnlock(&last_error_lock);
 }
 
 /* Store a libvirt error that is from a helper API that doesn't raise errors